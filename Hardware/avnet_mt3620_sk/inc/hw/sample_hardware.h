@@ -52,6 +52,9 @@
 // MT3620 SPI Chip Select (CS) value "B". This is not a peripheral identifier, and so has no meaning in an app manifest.
 #define SAMPLE_LSM6DS3_SPI_CS MT3620_SPI_CS_B
 
+// MT3620 SK: Connect external LSM6DS3 INT1 to GPIO16 on SOCKET1.
+#define SAMPLE_LSM6DS3_INT1 AVNET_MT3620_SK_GPIO16
+
 // MT3620 SK: Connect external reset signal using SOCKET1: RX.
 #define SAMPLE_NRF52_RESET AVNET_MT3620_SK_GPIO28
 
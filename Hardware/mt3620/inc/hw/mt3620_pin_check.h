@@ -0,0 +1,122 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This header checks at compile time that the peripherals which an application uses have their
+// own pins on the MT3620, so that a hardware definition which maps two of them to the same pins
+// fails to build, rather than making GPIO_OpenAsOutput or UART_Open fail when the application
+// starts. Every board and module definition maps its peripherals to the MT3620 identifiers, so
+// these checks apply to all of them.
+//
+// For example, after including <hw/sample_hardware.h>:
+//
+//     MT3620_CHECK_GPIOS_DISTINCT(SAMPLE_BUTTON_1, SAMPLE_NRF52_RESET, SAMPLE_NRF52_DFU);
+//     MT3620_CHECK_GPIOS_NOT_ON_UART(SAMPLE_NRF52_UART, SAMPLE_BUTTON_1, SAMPLE_NRF52_RESET,
+//                                    SAMPLE_NRF52_DFU);
+//
+// Each check takes up to 8 GPIOs. This file is not generated from mt3620.json.
+
+#pragma once
+
+// The ISU (0 to 4) whose pins a GPIO shares, or -1 if it does not share an ISU's pins.
+#define MT3620_GPIO_ISU(gpio)                                \
+    (((gpio) >= 26 && (gpio) <= 40)   ? ((gpio)-26) / 5      \
+     : ((gpio) >= 66 && (gpio) <= 75) ? 3 + ((gpio)-66) / 5 \
+                                      : -1)
+
+// Which of the five pins of its ISU a GPIO is, from 0 to 4, or -1 if it does not share an ISU's
+// pins. A UART uses pins 0 to 3, an I2C master pins 1 and 2, and an SPI master pins 0 to 2 and
+// the pin of its chip select, 3 for MT3620_SPI_CS_A or 4 for MT3620_SPI_CS_B.
+#define MT3620_GPIO_ISU_PIN(gpio)                        \
+    (((gpio) >= 26 && (gpio) <= 40)   ? ((gpio)-26) % 5 \
+     : ((gpio) >= 66 && (gpio) <= 75) ? ((gpio)-66) % 5 \
+                                      : -1)
+
+// The PWM controller (0 to 2) whose pins a GPIO shares, or -1 if it does not share a PWM
+// controller's pins.
+#define MT3620_GPIO_PWM_CONTROLLER(gpio) (((gpio) >= 0 && (gpio) <= 11) ? (gpio) / 4 : -1)
+
+// The ADC controller whose pins a GPIO shares, or -1 if it does not share an ADC controller's
+// pins.
+#define MT3620_GPIO_ADC_CONTROLLER(gpio) (((gpio) >= 41 && (gpio) <= 48) ? 0 : -1)
+
+// The ISU of an I2C master, SPI master or UART. The UARTs are numbered after the I2C and SPI
+// masters, so their identifiers do not match their ISUs.
+#define MT3620_I2C_ISU(i2c) (i2c)
+#define MT3620_SPI_ISU(spi) (spi)
+#define MT3620_UART_ISU(uart) ((uart)-4)
+
+// Checks that GPIOs are all different.
+#define MT3620_CHECK_GPIOS_DISTINCT(...)                                         \
+    _Static_assert(MT3620_PIN_CHECK_DISTINCT_WORD(0, __VA_ARGS__) &&             \
+                       MT3620_PIN_CHECK_DISTINCT_WORD(1, __VA_ARGS__) &&         \
+                       MT3620_PIN_CHECK_DISTINCT_WORD(2, __VA_ARGS__),           \
+                   "Two of " #__VA_ARGS__ " are the same GPIO")
+
+// Checks that GPIOs do not use the pins of an I2C master, SPI master, UART, PWM controller or
+// ADC controller which the application also uses. As the chip select of an SPI master is chosen
+// when it is opened, the GPIOs must not use any of the pins of its ISU.
+#define MT3620_CHECK_GPIOS_NOT_ON_I2C(i2c, ...)                                                \
+    _Static_assert(MT3620_PIN_CHECK_FOLD(MT3620_PIN_CHECK_OFF_I2C, &&, MT3620_I2C_ISU(i2c),    \
+                                         __VA_ARGS__),                                         \
+                   "One of " #__VA_ARGS__ " uses a pin of " #i2c)
+#define MT3620_CHECK_GPIOS_NOT_ON_SPI(spi, ...)                                                \
+    _Static_assert(MT3620_PIN_CHECK_FOLD(MT3620_PIN_CHECK_OFF_ISU, &&, MT3620_SPI_ISU(spi),     \
+                                         __VA_ARGS__),                                         \
+                   "One of " #__VA_ARGS__ " uses a pin of the ISU of " #spi)
+#define MT3620_CHECK_GPIOS_NOT_ON_UART(uart, ...)                                              \
+    _Static_assert(MT3620_PIN_CHECK_FOLD(MT3620_PIN_CHECK_OFF_UART, &&, MT3620_UART_ISU(uart), \
+                                         __VA_ARGS__),                                         \
+                   "One of " #__VA_ARGS__ " uses a pin of " #uart)
+#define MT3620_CHECK_GPIOS_NOT_ON_PWM(pwm, ...)                                                \
+    _Static_assert(MT3620_PIN_CHECK_FOLD(MT3620_PIN_CHECK_OFF_PWM, &&, pwm, __VA_ARGS__),     \
+                   "One of " #__VA_ARGS__ " uses a pin of " #pwm)
+#define MT3620_CHECK_GPIOS_NOT_ON_ADC(adc, ...)                                                \
+    _Static_assert(MT3620_PIN_CHECK_FOLD(MT3620_PIN_CHECK_OFF_ADC, &&, adc, __VA_ARGS__),     \
+                   "One of " #__VA_ARGS__ " uses a pin of " #adc)
+
+// Checks that two ISUs which the application uses in different roles, such as an I2C master and
+// a UART, are different ISUs. Pass the ISUs, such as MT3620_I2C_ISU(SAMPLE_LSM6DS3_I2C).
+#define MT3620_CHECK_ISUS_DISTINCT(isuA, isuB) \
+    _Static_assert((isuA) != (isuB), #isuA " and " #isuB " are the same ISU")
+
+// The implementation of the checks. MT3620_PIN_CHECK_FOLD applies a term to each of the GPIOs,
+// and combines the terms with an operator.
+//
+// For MT3620_CHECK_GPIOS_DISTINCT, each GPIO is a bit in one of three 32-bit words. No two GPIOs
+// share a bit if the sum of the bits in each word equals their bitwise OR, and as there are at
+// most 8 GPIOs, the sum cannot overflow.
+#define MT3620_PIN_CHECK_BIT(word, gpio) (((gpio) / 32 == (word)) ? (1ULL << ((gpio) % 32)) : 0ULL)
+#define MT3620_PIN_CHECK_DISTINCT_WORD(word, ...)                         \
+    (MT3620_PIN_CHECK_FOLD(MT3620_PIN_CHECK_BIT, +, word, __VA_ARGS__) == \
+     MT3620_PIN_CHECK_FOLD(MT3620_PIN_CHECK_BIT, |, word, __VA_ARGS__))
+#define MT3620_PIN_CHECK_OFF_ISU(isu, gpio) (MT3620_GPIO_ISU(gpio) != (isu))
+#define MT3620_PIN_CHECK_OFF_I2C(isu, gpio)                              \
+    (MT3620_GPIO_ISU(gpio) != (isu) || MT3620_GPIO_ISU_PIN(gpio) == 0 || \
+     MT3620_GPIO_ISU_PIN(gpio) >= 3)
+#define MT3620_PIN_CHECK_OFF_UART(isu, gpio) \
+    (MT3620_GPIO_ISU(gpio) != (isu) || MT3620_GPIO_ISU_PIN(gpio) == 4)
+#define MT3620_PIN_CHECK_OFF_PWM(pwm, gpio) (MT3620_GPIO_PWM_CONTROLLER(gpio) != (pwm))
+#define MT3620_PIN_CHECK_OFF_ADC(adc, gpio) (MT3620_GPIO_ADC_CONTROLLER(gpio) != (adc))
+
+#define MT3620_PIN_CHECK_COUNT(...) MT3620_PIN_CHECK_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define MT3620_PIN_CHECK_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, count, ...) count
+#define MT3620_PIN_CHECK_CONCAT(a, b) MT3620_PIN_CHECK_CONCAT_(a, b)
+#define MT3620_PIN_CHECK_CONCAT_(a, b) a##b
+#define MT3620_PIN_CHECK_FOLD(term, op, arg, ...)                                       \
+    MT3620_PIN_CHECK_CONCAT(MT3620_PIN_CHECK_FOLD, MT3620_PIN_CHECK_COUNT(__VA_ARGS__)) \
+    (term, op, arg, __VA_ARGS__)
+#define MT3620_PIN_CHECK_FOLD1(term, op, arg, gpio) term(arg, gpio)
+#define MT3620_PIN_CHECK_FOLD2(term, op, arg, gpio, ...) \
+    (term(arg, gpio) op MT3620_PIN_CHECK_FOLD1(term, op, arg, __VA_ARGS__))
+#define MT3620_PIN_CHECK_FOLD3(term, op, arg, gpio, ...) \
+    (term(arg, gpio) op MT3620_PIN_CHECK_FOLD2(term, op, arg, __VA_ARGS__))
+#define MT3620_PIN_CHECK_FOLD4(term, op, arg, gpio, ...) \
+    (term(arg, gpio) op MT3620_PIN_CHECK_FOLD3(term, op, arg, __VA_ARGS__))
+#define MT3620_PIN_CHECK_FOLD5(term, op, arg, gpio, ...) \
+    (term(arg, gpio) op MT3620_PIN_CHECK_FOLD4(term, op, arg, __VA_ARGS__))
+#define MT3620_PIN_CHECK_FOLD6(term, op, arg, gpio, ...) \
+    (term(arg, gpio) op MT3620_PIN_CHECK_FOLD5(term, op, arg, __VA_ARGS__))
+#define MT3620_PIN_CHECK_FOLD7(term, op, arg, gpio, ...) \
+    (term(arg, gpio) op MT3620_PIN_CHECK_FOLD6(term, op, arg, __VA_ARGS__))
+#define MT3620_PIN_CHECK_FOLD8(term, op, arg, gpio, ...) \
+    (term(arg, gpio) op MT3620_PIN_CHECK_FOLD7(term, op, arg, __VA_ARGS__))
@@ -54,6 +54,9 @@
 // MT3620 SPI Chip Select (CS) value "A". This is not a peripheral identifier, and so has no meaning in an app manifest.
 #define SAMPLE_LSM6DS3_SPI_CS MT3620_SPI_CS_A
 
+// MT3620 RDB: Connect external LSM6DS3 INT1 to header 1, pin 4
+#define SAMPLE_LSM6DS3_INT1 MT3620_RDB_HEADER1_PIN4_GPIO
+
 // MT3620 RDB: Connect external NRF52 RESET GPIO using header 2, pin 4
 #define SAMPLE_NRF52_RESET MT3620_RDB_HEADER2_PIN4_GPIO
 
@@ -52,6 +52,9 @@
 // MT3620 SPI Chip Select (CS) value "A". This is not a peripheral identifier, and so has no meaning in an app manifest.
 #define SAMPLE_LSM6DS3_SPI_CS MT3620_SPI_CS_A
 
+// MT3620 MDB: Connect external LSM6DS3 INT1 using J1, pin 3.
+#define SAMPLE_LSM6DS3_INT1 SEEED_MT3620_MDB_J1_PIN3_GPIO6
+
 // MT3620 MDB: Connect external reset signal using J1, pin 1.
 #define SAMPLE_NRF52_RESET SEEED_MT3620_MDB_J1_PIN11_GPIO34
 
@@ -52,6 +52,9 @@
 // MT3620 SPI Chip Select (CS) value "A". This is not a peripheral identifier, and so has no meaning in an app manifest.
 #define SAMPLE_LSM6DS3_SPI_CS MT3620_SPI_CS_A
 
+// MT3620 USI BT EVB: Connect external LSM6DS3 INT1 using J32, pin 5.
+#define SAMPLE_LSM6DS3_INT1 USI_MT3620_BT_EVB_J32_PIN5_GPIO4
+
 // MT3620 USI BT EVB: BT_nRST (RESET) signal on nRF52810.
 #define SAMPLE_NRF52_RESET USI_MT3620_BT_COMBO_NRF52_RESET
 
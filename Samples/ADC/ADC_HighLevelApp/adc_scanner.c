@@ -0,0 +1,142 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include "adc_scanner.h"
+#include "json_writer.h"
+
+static void ResetAggregates(AdcScanner *scanner)
+{
+    scanner->scanCount = 0;
+    for (size_t i = 0; i < scanner->channelCount; ++i) {
+        scanner->sumMillivolts[i] = 0;
+        scanner->minMillivolts[i] = UINT32_MAX;
+        scanner->maxMillivolts[i] = 0;
+    }
+}
+
+int AdcScanner_Init(AdcScanner *scanner, int adcFd, const ADC_ChannelId *channels,
+                    size_t channelCount, unsigned int oversampleCount, float referenceVoltage)
+{
+    if (channelCount == 0 || channelCount > ADC_SCANNER_MAX_CHANNELS || oversampleCount == 0 ||
+        oversampleCount > ADC_SCANNER_MAX_OVERSAMPLE || referenceVoltage <= 0.0f) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->adcFd = adcFd;
+    scanner->channelCount = channelCount;
+    scanner->oversampleCount = oversampleCount;
+
+    uint64_t referenceMillivolts = (uint64_t)(referenceVoltage * 1000.0f + 0.5f);
+    for (size_t i = 0; i < channelCount; ++i) {
+        scanner->channels[i] = channels[i];
+
+        int sampleBitCount = ADC_GetSampleBitCount(adcFd, channels[i]);
+        if (sampleBitCount == -1) {
+            return -1;
+        }
+        if (sampleBitCount <= 0 || sampleBitCount > 16) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (ADC_SetReferenceVoltage(adcFd, channels[i], referenceVoltage) == -1) {
+            return -1;
+        }
+
+        // The largest sum of a scan's polls is the reference voltage.
+        uint64_t maxSum = (((uint64_t)1 << sampleBitCount) - 1) * oversampleCount;
+        scanner->millivoltsPerSumQ16[i] =
+            (uint32_t)(((referenceMillivolts << 16) + maxSum / 2) / maxSum);
+    }
+
+    ResetAggregates(scanner);
+    return 0;
+}
+
+int AdcScanner_Scan(AdcScanner *scanner)
+{
+    // Poll every channel before updating anything, so a failed scan leaves no partial results.
+    uint32_t sums[ADC_SCANNER_MAX_CHANNELS] = {0};
+    for (unsigned int n = 0; n < scanner->oversampleCount; ++n) {
+        for (size_t i = 0; i < scanner->channelCount; ++i) {
+            uint32_t value;
+            if (ADC_Poll(scanner->adcFd, scanner->channels[i], &value) == -1) {
+                return -1;
+            }
+            sums[i] += value;
+        }
+    }
+
+    for (size_t i = 0; i < scanner->channelCount; ++i) {
+        uint32_t millivolts =
+            (uint32_t)(((uint64_t)sums[i] * scanner->millivoltsPerSumQ16[i] + 0x8000) >> 16);
+        scanner->millivolts[i] = millivolts;
+        scanner->sumMillivolts[i] += millivolts;
+        if (millivolts < scanner->minMillivolts[i]) {
+            scanner->minMillivolts[i] = millivolts;
+        }
+        if (millivolts > scanner->maxMillivolts[i]) {
+            scanner->maxMillivolts[i] = millivolts;
+        }
+    }
+    ++scanner->scanCount;
+
+    return 0;
+}
+
+int AdcScanner_FormatRecord(AdcScanner *scanner, char *buffer, size_t size)
+{
+    if (scanner->scanCount == 0) {
+        return -1;
+    }
+
+    JsonWriter writer;
+    JsonWriter_Init(&writer, buffer, size);
+    JsonWriter_BeginObject(&writer);
+
+    JsonWriter_Key(&writer, "AdcScanCount");
+    JsonWriter_Integer(&writer, scanner->scanCount);
+
+    JsonWriter_Key(&writer, "AdcChannels");
+    JsonWriter_BeginArray(&writer);
+    for (size_t i = 0; i < scanner->channelCount; ++i) {
+        JsonWriter_Integer(&writer, scanner->channels[i]);
+    }
+    JsonWriter_EndArray(&writer);
+
+    JsonWriter_Key(&writer, "AdcMeanMillivolts");
+    JsonWriter_BeginArray(&writer);
+    for (size_t i = 0; i < scanner->channelCount; ++i) {
+        uint64_t roundedSum = scanner->sumMillivolts[i] + scanner->scanCount / 2;
+        JsonWriter_Integer(&writer, (int64_t)(roundedSum / scanner->scanCount));
+    }
+    JsonWriter_EndArray(&writer);
+
+    JsonWriter_Key(&writer, "AdcMinMillivolts");
+    JsonWriter_BeginArray(&writer);
+    for (size_t i = 0; i < scanner->channelCount; ++i) {
+        JsonWriter_Integer(&writer, scanner->minMillivolts[i]);
+    }
+    JsonWriter_EndArray(&writer);
+
+    JsonWriter_Key(&writer, "AdcMaxMillivolts");
+    JsonWriter_BeginArray(&writer);
+    for (size_t i = 0; i < scanner->channelCount; ++i) {
+        JsonWriter_Integer(&writer, scanner->maxMillivolts[i]);
+    }
+    JsonWriter_EndArray(&writer);
+
+    JsonWriter_EndObject(&writer);
+
+    // Keep the aggregates if the record did not fit, so they are in the next one.
+    int length = JsonWriter_Finish(&writer);
+    if (length >= 0) {
+        ResetAggregates(scanner);
+    }
+    return length;
+}
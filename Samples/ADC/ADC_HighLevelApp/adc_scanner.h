@@ -0,0 +1,84 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/adc.h>
+
+/// <summary>Number of channels on the MT3620 ADC controller.</summary>
+#define ADC_SCANNER_MAX_CHANNELS 8
+
+/// <summary>Most samples which are averaged for each channel in a scan.</summary>
+#define ADC_SCANNER_MAX_OVERSAMPLE 64
+
+/// <summary>
+/// <para>Polls a list of channels of one ADC controller in each scan, and keeps the results
+/// and their aggregates since the last record, one array per field, indexed by the position of
+/// the channel in the list.</para>
+/// <para>Each channel is polled oversampleCount times per scan and the values are averaged.
+/// The average is converted to millivolts with a fixed-point multiplier per channel, which
+/// is calculated once from the channel's sample size and reference voltage, so a scan does no
+/// floating-point arithmetic or division.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="AdcScanner_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The controller, which was opened with ADC_Open.</summary>
+    int adcFd;
+    /// <summary>Number of channels in the list.</summary>
+    size_t channelCount;
+    /// <summary>Number of polls of each channel which are averaged in a scan.</summary>
+    unsigned int oversampleCount;
+    /// <summary>The channels.</summary>
+    ADC_ChannelId channels[ADC_SCANNER_MAX_CHANNELS];
+    /// <summary>Converts the sum of a scan's polls of each channel to millivolts, in Q16.
+    /// </summary>
+    uint32_t millivoltsPerSumQ16[ADC_SCANNER_MAX_CHANNELS];
+    /// <summary>Voltage of each channel in the latest scan, in millivolts.</summary>
+    uint32_t millivolts[ADC_SCANNER_MAX_CHANNELS];
+    /// <summary>Sum, minimum and maximum of each channel's voltage over the scans since the
+    /// last record, in millivolts.</summary>
+    uint64_t sumMillivolts[ADC_SCANNER_MAX_CHANNELS];
+    uint32_t minMillivolts[ADC_SCANNER_MAX_CHANNELS];
+    uint32_t maxMillivolts[ADC_SCANNER_MAX_CHANNELS];
+    /// <summary>Number of scans since the last record.</summary>
+    uint32_t scanCount;
+} AdcScanner;
+
+/// <summary>
+///     Initializes a scanner for a list of channels, and sets the reference voltage of each
+///     channel.
+/// </summary>
+/// <param name="scanner">The scanner to initialize.</param>
+/// <param name="adcFd">The controller, which was opened with ADC_Open.</param>
+/// <param name="channels">The channels to scan, in the order of the results.</param>
+/// <param name="channelCount">Number of channels, from 1 to
+/// <see cref="ADC_SCANNER_MAX_CHANNELS" />.</param>
+/// <param name="oversampleCount">Number of polls of each channel to average in each scan,
+/// from 1 to <see cref="ADC_SCANNER_MAX_OVERSAMPLE" />.</param>
+/// <param name="referenceVoltage">Reference voltage of every channel, in volts.</param>
+/// <returns>0 on success, or -1 with errno set to EINVAL if an argument is out of range, or by
+/// the ADC call which failed.</returns>
+int AdcScanner_Init(AdcScanner *scanner, int adcFd, const ADC_ChannelId *channels,
+                    size_t channelCount, unsigned int oversampleCount, float referenceVoltage);
+
+/// <summary>
+///     Polls every channel, and updates the latest voltages and the aggregates.
+/// </summary>
+/// <param name="scanner">The scanner.</param>
+/// <returns>0 on success, or -1 with errno set by ADC_Poll if a channel could not be read, in
+/// which case the scan is not counted.</returns>
+int AdcScanner_Scan(AdcScanner *scanner);
+
+/// <summary>
+///     Formats the aggregates since the last record as one JSON telemetry object, with an
+///     array per field which is indexed like the channel list, and starts new aggregates.
+/// </summary>
+/// <param name="scanner">The scanner.</param>
+/// <param name="buffer">Receives the JSON, followed by a null terminator.</param>
+/// <param name="size">Size of the buffer.</param>
+/// <returns>The length of the JSON, or -1 if no scans have been made since the last record, or
+/// the JSON did not fit in the buffer, in which case the aggregates are kept.</returns>
+int AdcScanner_FormatRecord(AdcScanner *scanner, char *buffer, size_t size);
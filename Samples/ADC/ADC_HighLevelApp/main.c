@@ -5,6 +5,8 @@
 // Conversion).
 // The sample opens an ADC controller which is connected to a potentiometer. Adjusting the
 // potentiometer will change the displayed values.
+// Each second, every channel in a list is polled several times and averaged, and every few
+// seconds the mean, minimum and maximum of each channel are formatted as one telemetry record.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - ADC (Analog to Digital Conversion)
@@ -21,6 +23,7 @@
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include "epoll_timerfd_utilities.h"
+#include "adc_scanner.h"
 #include <applibs/adc.h>
 #include <applibs/log.h>
 
@@ -42,12 +45,18 @@ static int epollFd = -1;
 static int adcControllerFd = -1;
 static int pollTimerFd = -1;
 
-// The size of a sample in bits
-static int sampleBitCount = -1;
-
 // The maximum voltage
 static float sampleMaxVoltage = 2.5f;
 
+// The channels which are scanned each second. Other channels of the controller can be added,
+// up to ADC_SCANNER_MAX_CHANNELS; the potentiometer's voltage is logged from the first one.
+static const ADC_ChannelId scanChannels[] = {SAMPLE_POTENTIOMETER_ADC_CHANNEL};
+// Each channel is polled this many times in a scan, and the values are averaged.
+#define OVERSAMPLE_COUNT 4
+// A telemetry record is sent after this many scans.
+#define SCANS_PER_RECORD 10
+static AdcScanner scanner;
+
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
@@ -61,26 +70,48 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Handle polling timer event: takes a single reading from ADC channelId,
-///     every second, outputting the result.
+///     Hand a telemetry message to the telemetry path. This sample only logs it; the AzureIoT
+///     sample's SendTelemetry shows how to send the same message to IoT Hub.
+/// </summary>
+/// <param name="message">The telemetry message, as a JSON object.</param>
+static void SendTelemetry(const char *message)
+{
+    Log_Debug("Sending telemetry: %s\n", message);
+}
+
+/// <summary>
+///     Handle polling timer event: scans every channel every second, outputting the voltage of
+///     the potentiometer, and sends a telemetry record every SCANS_PER_RECORD scans.
 /// </summary>
 static void AdcPollingEventHandler(EventData *eventData)
 {
-    if (ConsumeTimerFdEvent(pollTimerFd) != 0) {
+    uint64_t expiryCount;
+    if (ConsumeTimerFdExpiries(pollTimerFd, &expiryCount) != 0) {
         terminationRequired = true;
         return;
     }
 
-    uint32_t value;
-    int result = ADC_Poll(adcControllerFd, SAMPLE_POTENTIOMETER_ADC_CHANNEL, &value);
-    if (result < -1) {
+    // Only one scan is made per call, so report any polling periods which were missed.
+    if (expiryCount > 1) {
+        Log_Debug("WARNING: Missed %llu ADC polling periods.\n",
+                  (unsigned long long)(expiryCount - 1));
+    }
+
+    if (AdcScanner_Scan(&scanner) != 0) {
         Log_Debug("ADC_Poll failed with error: %s (%d)\n", strerror(errno), errno);
         terminationRequired = true;
         return;
     }
 
-    float voltage = ((float)value * sampleMaxVoltage) / (float)((1 << sampleBitCount) - 1);
-    Log_Debug("The out sample value is %.3f V\n", voltage);
+    uint32_t millivolts = scanner.millivolts[0];
+    Log_Debug("The out sample value is %u.%03u V\n", millivolts / 1000, millivolts % 1000);
+
+    if (scanner.scanCount == SCANS_PER_RECORD) {
+        static char record[512];
+        if (AdcScanner_FormatRecord(&scanner, record, sizeof(record)) >= 0) {
+            SendTelemetry(record);
+        }
+    }
 }
 
 // event handler data structures. Only the event handler field needs to be populated.
@@ -108,20 +139,11 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    sampleBitCount = ADC_GetSampleBitCount(adcControllerFd, SAMPLE_POTENTIOMETER_ADC_CHANNEL);
-    if (sampleBitCount == -1) {
-        Log_Debug("ADC_GetSampleBitCount failed with error : %s (%d)\n", strerror(errno), errno);
-        return -1;
-    }
-    if (sampleBitCount == 0) {
-        Log_Debug("ADC_GetSampleBitCount returned sample size of 0 bits.\n");
-        return -1;
-    }
-
-    int result = ADC_SetReferenceVoltage(adcControllerFd, SAMPLE_POTENTIOMETER_ADC_CHANNEL,
-                                         sampleMaxVoltage);
-    if (result < 0) {
-        Log_Debug("ADC_SetReferenceVoltage failed with error : %s (%d)\n", strerror(errno), errno);
+    // This reads the sample size and sets the reference voltage of each channel.
+    if (AdcScanner_Init(&scanner, adcControllerFd, scanChannels,
+                        sizeof(scanChannels) / sizeof(scanChannels[0]), OVERSAMPLE_COUNT,
+                        sampleMaxVoltage) != 0) {
+        Log_Debug("ERROR: Could not set up the ADC channels: %s (%d)\n", strerror(errno), errno);
         return -1;
     }
 
@@ -0,0 +1,216 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-adc.h"
+#include "mt3620-gpio.h"
+#include "mt3620-timer.h"
+#include "mt3620-timer-scheduler.h"
+#include "adc-phase.h"
+
+static AdcPhaseSubscribe config;
+static int edgePin = -1;
+static uint8_t periodsPerBlock;
+static bool isRunning = false;
+
+// The interrupt handlers fill one block while the main loop sends the other. The ready block
+// belongs to the main loop while isReady is set.
+static AdcPhaseBlock blocks[2];
+static AdcPhaseBlock *fillBlock = &blocks[0];
+static volatile bool isReady = false;
+static uint32_t nextSequence = 0;
+static uint32_t missedPeriods = 0;
+
+// Start of the current period, and of the previous one, on the microsecond counter.
+static uint32_t periodStartUs;
+static uint32_t lastPeriodStartUs;
+static bool hasLastPeriod = false;
+// Next phase to convert in the current period. This is phaseCount once the period is done.
+static uint8_t phaseIndex;
+
+// Starts each period, if the real-time core times them itself.
+static ScheduledTimer periodTimer;
+// Starts each conversion.
+static ScheduledTimer phaseTimer;
+
+static void HandlePhaseTimerIrq(void);
+
+static bool IsValidSubscription(const AdcPhaseSubscribe *subscribe)
+{
+    if (subscribe->phaseCount == 0 || subscribe->phaseCount > ADC_PHASE_MAX_OFFSETS) {
+        return false;
+    }
+
+    for (size_t i = 1; i < subscribe->phaseCount; ++i) {
+        if (subscribe->phaseOffsetsUs[i] <
+            subscribe->phaseOffsetsUs[i - 1] + ADC_PHASE_MIN_SPACING_US) {
+            return false;
+        }
+    }
+
+    uint32_t lastOffsetUs = subscribe->phaseOffsetsUs[subscribe->phaseCount - 1];
+    return subscribe->periodUs == 0 ||
+           (subscribe->periodUs >= lastOffsetUs + ADC_PHASE_MIN_SPACING_US &&
+            subscribe->periodUs <= TIMER_SCHEDULER_MAX_DELAY_US);
+}
+
+static void ResetBlock(AdcPhaseBlock *block)
+{
+    block->channel = config.channel;
+    block->phaseCount = config.phaseCount;
+    block->periodCount = 0;
+    block->periodUs = config.periodUs;
+}
+
+// Arm the phase timer for the next conversion. The deadline is measured from the start of the
+// period, not from the previous conversion, so the phases do not drift by the time each
+// conversion takes.
+static void ScheduleNextPhase(void)
+{
+    uint32_t deadlineUs = periodStartUs + config.phaseOffsetsUs[phaseIndex];
+    int32_t delayUs = (int32_t)(deadlineUs - Gpt_GetMicroseconds());
+    TimerScheduler_Start(&phaseTimer, delayUs > 0 ? (uint32_t)delayUs : 0, 0,
+                         HandlePhaseTimerIrq);
+}
+
+// Hand the full block to the main loop, and start filling the other one. If the main loop has
+// not released the previous block yet, this block's periods are dropped instead.
+static void PublishBlock(void)
+{
+    if (isReady) {
+        missedPeriods += fillBlock->periodCount;
+        ResetBlock(fillBlock);
+        return;
+    }
+
+    fillBlock->sequence = nextSequence++;
+    fillBlock->missedPeriods = missedPeriods;
+    __asm__ volatile("" ::: "memory");
+    isReady = true;
+
+    fillBlock = (fillBlock == &blocks[0]) ? &blocks[1] : &blocks[0];
+    ResetBlock(fillBlock);
+}
+
+static void StartPeriod(uint32_t nowUs)
+{
+    // The conversions of the previous period were not all made in time, so drop it.
+    if (phaseIndex < config.phaseCount) {
+        ++missedPeriods;
+    }
+
+    if (hasLastPeriod && config.periodUs == 0) {
+        fillBlock->periodUs = nowUs - lastPeriodStartUs;
+    }
+    lastPeriodStartUs = nowUs;
+    hasLastPeriod = true;
+
+    if (fillBlock->periodCount == 0) {
+        fillBlock->timestampUs = nowUs;
+    }
+
+    periodStartUs = nowUs;
+    phaseIndex = 0;
+    ScheduleNextPhase();
+}
+
+static void HandleSyncEdgeIrq(int pin)
+{
+    StartPeriod(Gpt_GetMicroseconds());
+}
+
+static void HandlePeriodTimerIrq(void)
+{
+    StartPeriod(Gpt_GetMicroseconds());
+}
+
+static void HandlePhaseTimerIrq(void)
+{
+    uint32_t value = ReadAdc(config.channel);
+    size_t sampleIndex = (size_t)fillBlock->periodCount * config.phaseCount + phaseIndex;
+    fillBlock->samples[sampleIndex] =
+        value == UINT32_MAX ? ADC_PHASE_INVALID_SAMPLE : (uint16_t)value;
+
+    if (++phaseIndex < config.phaseCount) {
+        ScheduleNextPhase();
+        return;
+    }
+
+    if (++fillBlock->periodCount == periodsPerBlock) {
+        PublishBlock();
+    }
+}
+
+int AdcPhase_Start(int syncPin, const AdcPhaseSubscribe *subscribe)
+{
+    if (!IsValidSubscription(subscribe)) {
+        return -1;
+    }
+
+    AdcPhase_Stop();
+
+    config = *subscribe;
+    periodsPerBlock = (uint8_t)(ADC_PHASE_BLOCK_SAMPLE_COUNT / config.phaseCount);
+    nextSequence = 0;
+    missedPeriods = 0;
+    hasLastPeriod = false;
+    // No period is in progress, so the first edge does not count a missed period.
+    phaseIndex = config.phaseCount;
+    fillBlock = &blocks[0];
+    ResetBlock(fillBlock);
+    isReady = false;
+    isRunning = true;
+
+    if (config.periodUs != 0) {
+        TimerScheduler_Start(&periodTimer, config.periodUs, config.periodUs,
+                             HandlePeriodTimerIrq);
+    } else {
+        edgePin = syncPin;
+        if (Mt3620_Gpio_EnableEdgeInterrupt(edgePin, GpioEdge_Rising, HandleSyncEdgeIrq) != 0) {
+            edgePin = -1;
+            isRunning = false;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void AdcPhase_Stop(void)
+{
+    if (!isRunning) {
+        return;
+    }
+
+    // Block the GPT and EINT interrupts, so that no period starts while the timers stop.
+    uint32_t prevBasePri = BlockIrqs();
+    if (edgePin >= 0) {
+        Mt3620_Gpio_DisableEdgeInterrupt(edgePin);
+        edgePin = -1;
+    }
+    TimerScheduler_Stop(&periodTimer);
+    TimerScheduler_Stop(&phaseTimer);
+    isReady = false;
+    isRunning = false;
+    RestoreIrqs(prevBasePri);
+}
+
+const AdcPhaseBlock *AdcPhase_GetReadyBlock(void)
+{
+    if (!isReady) {
+        return NULL;
+    }
+
+    // The ready block is the one which is not being filled.
+    return (fillBlock == &blocks[0]) ? &blocks[1] : &blocks[0];
+}
+
+void AdcPhase_ReleaseBlock(void)
+{
+    __asm__ volatile("" ::: "memory");
+    isReady = false;
+}
@@ -0,0 +1,50 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef ADC_PHASE_H
+#define ADC_PHASE_H
+
+#include "adc_stream_messages.h"
+
+/// <summary>
+/// <para>Start converting a channel at fixed phases of each period, and collecting the samples
+/// into blocks, as requested by an <see cref="AdcPhaseSubscribe" /> message.</para>
+/// <para>Each period starts at a rising edge of syncPin, or every subscribe->periodUs if that
+/// is not zero. The conversions are started by a software timer on the scheduler at each
+/// offset from the start of the period, so <see cref="TimerScheduler_Init" /> must have been
+/// called. If syncPin is used, its EINT handler must be installed in the vector table, and
+/// <see cref="Mt3620_Gpio_ConfigurePinForInput" /> must have been called for it.</para>
+/// <para>Call <see cref="EnableAdc" /> and stop continuous mode before calling this function.
+/// Continuous mode must not be started again until <see cref="AdcPhase_Stop" /> has been
+/// called.</para>
+/// </summary>
+/// <param name="syncPin">Input which the PWM output is wired to. This must have an
+/// EINT.</param>
+/// <param name="subscribe">The channel, the phases and the source of the periods. This is
+/// copied.</param>
+/// <returns>0 on success; -1 if the subscription is not valid.</returns>
+int AdcPhase_Start(int syncPin, const AdcPhaseSubscribe *subscribe);
+
+/// <summary>
+/// Stop phase sampling. A block which has not been consumed with
+/// <see cref="AdcPhase_ReleaseBlock" /> is discarded. It is safe to call this function when
+/// phase sampling is not running.
+/// </summary>
+void AdcPhase_Stop(void);
+
+/// <summary>
+/// <para>Get the oldest full block of samples, if there is one. Call this from the main loop.
+/// The interrupt handlers fill the next block while the application sends this one.</para>
+/// <para>Call <see cref="AdcPhase_ReleaseBlock" /> when the block has been used. If it is not
+/// released by the time the next block fills up, that block is dropped.</para>
+/// </summary>
+/// <returns>The block, or NULL if none is ready.</returns>
+const AdcPhaseBlock *AdcPhase_GetReadyBlock(void);
+
+/// <summary>
+/// Release the block which was returned by <see cref="AdcPhase_GetReadyBlock" />, so that the
+/// interrupt handlers can reuse it.
+/// </summary>
+void AdcPhase_ReleaseBlock(void);
+
+#endif // #ifndef ADC_PHASE_H
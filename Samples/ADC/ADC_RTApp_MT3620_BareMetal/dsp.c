@@ -0,0 +1,250 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+#include "dsp.h"
+
+static inline int16_t Saturate16(int32_t value)
+{
+    if (value > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (value < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)value;
+}
+
+// Read two adjacent 16-bit values as one word, with the first in the low half. The Cortex-M4
+// allows unaligned word loads, which the compiler uses for this copy.
+static inline uint32_t LoadPair(const int16_t *p)
+{
+    uint32_t pair;
+    __builtin_memcpy(&pair, p, sizeof(pair));
+    return pair;
+}
+
+// Multiply both halves of x by the halves of y, and add both products to acc.
+static inline int32_t MultiplyAccumulateDual(uint32_t x, uint32_t y, int32_t acc)
+{
+#if defined(__ARM_FEATURE_DSP)
+    int32_t result;
+    __asm__("smlad %0, %1, %2, %3" : "=r"(result) : "r"(x), "r"(y), "r"(acc));
+    return result;
+#else
+    return acc + (int32_t)(int16_t)(x & 0xFFFF) * (int16_t)(y & 0xFFFF) +
+           (int32_t)(int16_t)(x >> 16) * (int16_t)(y >> 16);
+#endif
+}
+
+static uint32_t SquareRoot64(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = UINT64_C(1) << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)result;
+}
+
+int Dsp_InitFir(DspFir *fir, const int16_t *coefficients, size_t tapCount)
+{
+    if (tapCount == 0 || tapCount % 2 != 0 || tapCount > DSP_FIR_MAX_TAPS) {
+        return -1;
+    }
+
+    fir->coefficients = coefficients;
+    fir->tapCount = tapCount;
+    for (size_t i = 0; i < 2 * tapCount; ++i) {
+        fir->history[i] = 0;
+    }
+    fir->position = 0;
+    fir->decimationPhase = 0;
+    return 0;
+}
+
+static inline void PushFirSample(DspFir *fir, int16_t sample)
+{
+    // After this, history[position .. position + tapCount - 1] holds the most recent tapCount
+    // samples, oldest first.
+    fir->history[fir->position] = sample;
+    fir->history[fir->position + fir->tapCount] = sample;
+    if (++fir->position == fir->tapCount) {
+        fir->position = 0;
+    }
+}
+
+static inline int16_t CalculateFirOutput(const DspFir *fir)
+{
+    const int16_t *samples = &fir->history[fir->position];
+    const int16_t *coefficients = fir->coefficients;
+
+    // Round to nearest when converting back from Q15.
+    int32_t acc = INT32_C(1) << 14;
+    for (size_t i = 0; i < fir->tapCount; i += 2) {
+        acc = MultiplyAccumulateDual(LoadPair(&samples[i]), LoadPair(&coefficients[i]), acc);
+    }
+
+    return Saturate16(acc >> 15);
+}
+
+TCM_CODE void Dsp_FirFilter(DspFir *fir, const int16_t *input, size_t count, int16_t *output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        PushFirSample(fir, input[i]);
+        output[i] = CalculateFirOutput(fir);
+    }
+}
+
+TCM_CODE size_t Dsp_FirDecimate(DspFir *fir, uint32_t factor, const int16_t *input, size_t count,
+                                int16_t *output)
+{
+    size_t outputCount = 0;
+    for (size_t i = 0; i < count; ++i) {
+        PushFirSample(fir, input[i]);
+        if (++fir->decimationPhase >= factor) {
+            fir->decimationPhase = 0;
+            output[outputCount++] = CalculateFirOutput(fir);
+        }
+    }
+    return outputCount;
+}
+
+TCM_CODE void Dsp_BiquadFilter(DspBiquad *sections, size_t sectionCount, const int16_t *input,
+                               size_t count, int16_t *output)
+{
+    for (size_t i = 0; i < count; ++i) {
+        int16_t x = input[i];
+
+        for (size_t s = 0; s < sectionCount; ++s) {
+            DspBiquad *section = &sections[s];
+
+            // Round to nearest when converting back from Q14.
+            int32_t acc = INT32_C(1) << 13;
+            acc += (int32_t)section->b0 * x + (int32_t)section->b1 * section->x1 +
+                   (int32_t)section->b2 * section->x2;
+            acc -= (int32_t)section->a1 * section->y1 + (int32_t)section->a2 * section->y2;
+            int16_t y = Saturate16(acc >> 14);
+
+            section->x2 = section->x1;
+            section->x1 = x;
+            section->y2 = section->y1;
+            section->y1 = y;
+
+            // The output of this section is the input of the next.
+            x = y;
+        }
+
+        output[i] = x;
+    }
+}
+
+static void ResetWindow(DspWindow *window)
+{
+    window->count = 0;
+    window->sum = 0;
+    window->sumOfSquares = 0;
+    window->min = INT16_MAX;
+    window->max = INT16_MIN;
+}
+
+void Dsp_InitWindow(DspWindow *window, uint32_t windowSize)
+{
+    window->windowSize = windowSize == 0 ? 1 : windowSize;
+    ResetWindow(window);
+}
+
+bool Dsp_AddToWindow(DspWindow *window, int16_t sample, DspWindowResult *result)
+{
+    window->sum += sample;
+    window->sumOfSquares += (uint64_t)((int32_t)sample * sample);
+    window->min = sample < window->min ? sample : window->min;
+    window->max = sample > window->max ? sample : window->max;
+
+    if (++window->count < window->windowSize) {
+        return false;
+    }
+
+    int64_t mean = window->sum / (int64_t)window->count;
+    uint64_t meanSquare = window->sumOfSquares / window->count;
+    uint64_t squaredMean = (uint64_t)(mean * mean);
+
+    result->mean = (int16_t)mean;
+    result->min = window->min;
+    result->max = window->max;
+    result->rms = (uint16_t)SquareRoot64(meanSquare);
+    result->acRms =
+        (uint16_t)SquareRoot64(meanSquare > squaredMean ? meanSquare - squaredMean : 0);
+
+    ResetWindow(window);
+    return true;
+}
+
+DspThresholdEvent Dsp_CheckThreshold(DspThreshold *threshold, int16_t value)
+{
+    if (!threshold->isHigh && value > threshold->high) {
+        threshold->isHigh = true;
+        return DspThresholdEvent_High;
+    }
+
+    if (threshold->isHigh && value < threshold->low) {
+        threshold->isHigh = false;
+        return DspThresholdEvent_Low;
+    }
+
+    return DspThresholdEvent_None;
+}
+
+int Dsp_InitScale(DspScale *scale, uint32_t numerator, uint32_t denominator, uint32_t maxInput)
+{
+    if (denominator == 0) {
+        return -1;
+    }
+
+    uint64_t bound = (uint64_t)maxInput * denominator;
+    if (bound > UINT32_MAX || (uint64_t)maxInput * numerator / denominator > UINT32_MAX) {
+        return -1;
+    }
+
+    uint32_t shift = 0;
+    while ((UINT64_C(1) << shift) <= bound) {
+        ++shift;
+    }
+
+    uint64_t multiplier =
+        ((UINT64_C(1) << shift) * numerator + (denominator - 1)) / denominator;
+    if (multiplier > UINT32_MAX) {
+        return -1;
+    }
+
+    scale->multiplier = (uint32_t)multiplier;
+    scale->shift = shift;
+    return 0;
+}
+
+TCM_CODE void Dsp_ScaleBlock(const DspScale *scale, const uint16_t *input, size_t count,
+                             uint32_t *output)
+{
+    uint32_t multiplier = scale->multiplier;
+    uint32_t shift = scale->shift;
+
+    for (size_t i = 0; i < count; ++i) {
+        output[i] = (uint32_t)(((uint64_t)input[i] * multiplier) >> shift);
+    }
+}
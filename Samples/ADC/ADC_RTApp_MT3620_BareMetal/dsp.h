@@ -0,0 +1,244 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-point signal processing for sample streams, such as those from
+// <see cref="ReadAdcBlock" />, so that only reduced results need to leave the real-time core.
+// Samples are signed 16-bit values. On cores with the DSP extension, such as the Cortex-M4F,
+// the FIR filter multiplies two taps per instruction with SMLAD.
+
+/// <summary>
+/// Maximum number of taps in a <see cref="DspFir" /> filter.
+/// </summary>
+#define DSP_FIR_MAX_TAPS 64
+
+/// <summary>
+/// <para>Finite impulse response (FIR) filter with Q15 coefficients.</para>
+/// <para>Initialize it with <see cref="Dsp_InitFir" />. The members are managed by the DSP
+/// functions and must not be modified by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Coefficients, with the one for the oldest sample first.</summary>
+    const int16_t *coefficients;
+    /// <summary>Number of taps, which is even.</summary>
+    size_t tapCount;
+    /// <summary>The most recent tapCount samples, stored twice so that they can be read
+    /// oldest-first without wrapping.</summary>
+    int16_t history[2 * DSP_FIR_MAX_TAPS];
+    /// <summary>Index in history of the oldest sample.</summary>
+    size_t position;
+    /// <summary>Number of samples since the last output, for <see cref="Dsp_FirDecimate" />.
+    /// </summary>
+    uint32_t decimationPhase;
+} DspFir;
+
+/// <summary>
+/// <para>Second-order infinite impulse response (IIR) filter section, in direct form I, with Q14
+/// coefficients:</para>
+/// <para>y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]</para>
+/// <para>Set the coefficients, and zero the state, before filtering. Q14 allows coefficients
+/// from -2.0 to just under 2.0, which covers every stable section.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Coefficients b0, b1, b2, a1, a2 in Q14.</summary>
+    int16_t b0, b1, b2, a1, a2;
+    /// <summary>Previous inputs and outputs.</summary>
+    int16_t x1, x2, y1, y2;
+} DspBiquad;
+
+/// <summary>
+/// Statistics of one complete window of samples from <see cref="Dsp_AddToWindow" />.
+/// </summary>
+typedef struct {
+    /// <summary>Mean of the samples, rounded towards zero.</summary>
+    int16_t mean;
+    /// <summary>Smallest sample.</summary>
+    int16_t min;
+    /// <summary>Largest sample.</summary>
+    int16_t max;
+    /// <summary>Root mean square of the samples.</summary>
+    uint16_t rms;
+    /// <summary>Root mean square of the samples about their mean, i.e. their standard deviation.
+    /// For vibration or current signals, this is the RMS of the AC component.</summary>
+    uint16_t acRms;
+} DspWindowResult;
+
+/// <summary>
+/// <para>Accumulates the statistics of consecutive, non-overlapping windows of samples.</para>
+/// <para>Initialize it with <see cref="Dsp_InitWindow" />. The members are managed by the DSP
+/// functions and must not be modified by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Number of samples in each window.</summary>
+    uint32_t windowSize;
+    /// <summary>Number of samples in the current window.</summary>
+    uint32_t count;
+    /// <summary>Sum of the samples in the current window.</summary>
+    int64_t sum;
+    /// <summary>Sum of the squares of the samples in the current window.</summary>
+    uint64_t sumOfSquares;
+    /// <summary>Smallest sample in the current window.</summary>
+    int16_t min;
+    /// <summary>Largest sample in the current window.</summary>
+    int16_t max;
+} DspWindow;
+
+/// <summary>
+/// Events which are reported by <see cref="Dsp_CheckThreshold" />.
+/// </summary>
+typedef enum {
+    /// <summary>The value has not crossed a threshold.</summary>
+    DspThresholdEvent_None = 0,
+    /// <summary>The value has risen above the high threshold.</summary>
+    DspThresholdEvent_High = 1,
+    /// <summary>The value has fallen below the low threshold.</summary>
+    DspThresholdEvent_Low = -1
+} DspThresholdEvent;
+
+/// <summary>
+/// <para>Detects when a value crosses a pair of thresholds. The gap between the thresholds acts
+/// as hysteresis, so a noisy value which hovers around one threshold only reports one event.
+/// </para>
+/// <para>Set high and low, with low below high, and set isHigh to false, before use.</para>
+/// </summary>
+typedef struct {
+    /// <summary>A value above this reports <see cref="DspThresholdEvent_High" />.</summary>
+    int16_t high;
+    /// <summary>A value below this reports <see cref="DspThresholdEvent_Low" />.</summary>
+    int16_t low;
+    /// <summary>Whether the last event was <see cref="DspThresholdEvent_High" />.</summary>
+    bool isHigh;
+} DspThreshold;
+
+/// <summary>
+/// <para>Multiplies values by a constant ratio, such as reference millivolts over the largest
+/// sample value, with a multiply and a shift instead of a division.</para>
+/// <para>Initialize it with <see cref="Dsp_InitScale" />. The members must not be modified by
+/// the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The ratio in fixed point, with shift fractional bits, rounded up.</summary>
+    uint32_t multiplier;
+    /// <summary>Number of fractional bits in multiplier.</summary>
+    uint32_t shift;
+} DspScale;
+
+/// <summary>
+/// <para>Set up a FIR filter. The history starts at zero.</para>
+/// <para>For an odd number of taps, add a zero coefficient. The sum of the absolute values of
+/// the coefficients must be less than 2.0 (65536 in Q15), so that the accumulator cannot
+/// overflow.</para>
+/// </summary>
+/// <param name="fir">The filter to set up.</param>
+/// <param name="coefficients">The coefficients in Q15, with the one for the oldest sample
+/// first, i.e. the impulse response reversed. This is the same as the impulse response for
+/// symmetric, linear-phase filters. It must remain valid while the filter is used.</param>
+/// <param name="tapCount">Number of coefficients, which must be even and no greater than
+/// DSP_FIR_MAX_TAPS.</param>
+/// <returns>0 on success; -1 if tapCount is invalid.</returns>
+int Dsp_InitFir(DspFir *fir, const int16_t *coefficients, size_t tapCount);
+
+/// <summary>
+/// Filter a block of samples with a FIR filter.
+/// </summary>
+/// <param name="fir">Filter set up by <see cref="Dsp_InitFir" />.</param>
+/// <param name="input">Samples to filter.</param>
+/// <param name="count">Number of samples.</param>
+/// <param name="output">Receives count filtered samples. This can be the same as input.</param>
+void Dsp_FirFilter(DspFir *fir, const int16_t *input, size_t count, int16_t *output);
+
+/// <summary>
+/// Filter a block of samples with a FIR filter, and keep only every factor-th output. Only the
+/// outputs which are kept are calculated. The phase carries over from one block to the next,
+/// so the blocks do not need to be multiples of factor.
+/// </summary>
+/// <param name="fir">Filter set up by <see cref="Dsp_InitFir" />. It should remove frequencies
+/// above half the decimated sample rate.</param>
+/// <param name="factor">Decimation factor.</param>
+/// <param name="input">Samples to filter.</param>
+/// <param name="count">Number of samples.</param>
+/// <param name="output">Receives the decimated samples. This can be the same as input.</param>
+/// <returns>The number of decimated samples.</returns>
+size_t Dsp_FirDecimate(DspFir *fir, uint32_t factor, const int16_t *input, size_t count,
+                       int16_t *output);
+
+/// <summary>
+/// Filter a block of samples with a cascade of second-order IIR sections.
+/// </summary>
+/// <param name="sections">The sections, which are applied in order.</param>
+/// <param name="sectionCount">Number of sections.</param>
+/// <param name="input">Samples to filter.</param>
+/// <param name="count">Number of samples.</param>
+/// <param name="output">Receives count filtered samples. This can be the same as input.</param>
+void Dsp_BiquadFilter(DspBiquad *sections, size_t sectionCount, const int16_t *input,
+                      size_t count, int16_t *output);
+
+/// <summary>
+/// Set up window statistics.
+/// </summary>
+/// <param name="window">The window to set up.</param>
+/// <param name="windowSize">Number of samples in each window, at least 1.</param>
+void Dsp_InitWindow(DspWindow *window, uint32_t windowSize);
+
+/// <summary>
+/// Add one sample to the current window.
+/// </summary>
+/// <param name="window">Window set up by <see cref="Dsp_InitWindow" />.</param>
+/// <param name="sample">The sample to add.</param>
+/// <param name="result">Receives the statistics if the sample completes the window.</param>
+/// <returns>true if the window is complete, in which case a new window starts; false
+/// otherwise.</returns>
+bool Dsp_AddToWindow(DspWindow *window, int16_t sample, DspWindowResult *result);
+
+/// <summary>
+/// Check a value against a pair of thresholds.
+/// </summary>
+/// <param name="threshold">The thresholds and their state.</param>
+/// <param name="value">The value to check.</param>
+/// <returns>The event, if the value has crossed a threshold since the last event.</returns>
+DspThresholdEvent Dsp_CheckThreshold(DspThreshold *threshold, int16_t value);
+
+/// <summary>
+/// <para>Set up a scale which calculates (value * numerator) / denominator, rounded down, for
+/// every value from 0 to maxInput. The result is the same as the division.</para>
+/// <para>The multiplier is the ratio rounded up, with just enough fractional bits that 2^shift
+/// is greater than maxInput * denominator; the rounding error then never reaches the next
+/// whole number.</para>
+/// </summary>
+/// <param name="scale">The scale to set up.</param>
+/// <param name="numerator">Numerator of the ratio.</param>
+/// <param name="denominator">Denominator of the ratio, at least 1.</param>
+/// <param name="maxInput">Largest value which will be scaled.</param>
+/// <returns>0 on success; -1 if denominator is 0, maxInput * denominator or the result for
+/// maxInput does not fit in 32 bits, or the ratio is too large for the fractional bits which
+/// are needed.</returns>
+int Dsp_InitScale(DspScale *scale, uint32_t numerator, uint32_t denominator, uint32_t maxInput);
+
+/// <summary>
+/// Scale one value.
+/// </summary>
+/// <param name="scale">Scale set up by <see cref="Dsp_InitScale" />.</param>
+/// <param name="value">Value to scale, no greater than maxInput.</param>
+/// <returns>(value * numerator) / denominator, rounded down.</returns>
+static inline uint32_t Dsp_Scale(const DspScale *scale, uint32_t value)
+{
+    return (uint32_t)(((uint64_t)value * scale->multiplier) >> scale->shift);
+}
+
+/// <summary>
+/// Scale a block of values, such as converting ADC samples to millivolts.
+/// </summary>
+/// <param name="scale">Scale set up by <see cref="Dsp_InitScale" />.</param>
+/// <param name="input">Values to scale, each no greater than maxInput.</param>
+/// <param name="count">Number of values.</param>
+/// <param name="output">Receives count scaled values.</param>
+void Dsp_ScaleBlock(const DspScale *scale, const uint16_t *input, size_t count,
+                    uint32_t *output);
+
+#endif // #ifndef DSP_H
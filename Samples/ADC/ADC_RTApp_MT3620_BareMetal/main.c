@@ -7,16 +7,74 @@
 #include <limits.h>
 
 #include "mt3620-baremetal.h"
-#include "mt3620-timer-poll.h"
 #include "mt3620-uart-poll.h"
 #include "mt3620-adc.h"
+#include "mt3620-gpio.h"
+#include "mt3620-intercore.h"
+#include "mt3620-timer.h"
+#include "mt3620-timer-scheduler.h"
+#include "adc-phase.h"
+#include "dsp.h"
+#include "adc_stream_messages.h"
+
+INTERCORE_DEFINE_RING_CODEC(AdcStreamSubscribe)
+INTERCORE_DEFINE_RING_CODEC(AdcSampleBlock)
+INTERCORE_DEFINE_RING_CODEC(AdcLatestSummary)
+INTERCORE_DEFINE_RING_CODEC(AdcPhaseSubscribe)
+INTERCORE_DEFINE_RING_CODEC(AdcPhaseBlock)
 
 extern uint32_t StackTop; // &StackTop == end of TCM
 
 static _Noreturn void DefaultExceptionHandler(void);
 
+static void PrintMillivolts(uint32_t value);
+static void PollStreamSubscription(void);
+static void AddToStreamBlock(const AdcSample *sample);
+static void SendStreamBlock(void);
+static int StartContinuousSampling(void);
+static void HandlePhaseSubscribe(const AdcPhaseSubscribe *subscribe);
+static void SendPhaseBlock(void);
 static _Noreturn void RTCoreMain(void);
 
+// Channel zero is sampled continuously at this rate, and a summary of each second of samples
+// is printed.
+#define SAMPLE_RATE_HZ 1000
+static AdcSample sampleBuffer[256];
+
+// The samples are also low-pass filtered and decimated to 100Hz, and the filtered value is
+// checked against a pair of thresholds.
+#define DECIMATION_FACTOR 10
+// 20-tap Hamming-windowed low-pass filter, with a 40Hz cutoff at 1kHz, in Q15.
+static const int16_t lowPassCoefficients[] = {85,   153,  329,  650,  1120, 1706, 2342,
+                                              2939, 3403, 3657, 3657, 3403, 2939, 2342,
+                                              1706, 1120, 650,  329,  153,  85};
+// 2.0V and 0.5V as sample values, i.e. proportions of 2.5V.
+#define THRESHOLD_HIGH ((2000 * 0xFFF) / 2500)
+#define THRESHOLD_LOW ((500 * 0xFFF) / 2500)
+
+// The samples are streamed, in timestamped blocks, to a high-level application which subscribes
+// with an AdcStreamSubscribe message. The timestamps are derived from the number of samples
+// which have been converted, so SAMPLE_RATE_HZ must divide 1MHz.
+#define SAMPLE_PERIOD_US (1000000 / SAMPLE_RATE_HZ)
+_Static_assert(SAMPLE_PERIOD_US * SAMPLE_RATE_HZ == 1000000,
+               "SAMPLE_RATE_HZ must be a whole number of microseconds");
+static BufferHeader *outbound, *inbound;
+static uint32_t sharedBufSize = 0;
+static bool intercoreAvailable = false;
+static bool streamEnabled = false;
+static uint8_t subscriberHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+static AdcSampleBlock streamBlock;
+static uint32_t nextBlockSequence = 0;
+static uint32_t nextSummarySequence = 0;
+static uint64_t samplesConverted = 0;
+
+// Instead of the continuous stream, the high-level application can ask for conversions at fixed
+// phases of a PWM period, with an AdcPhaseSubscribe message. The PWM output which the
+// high-level application drives with PWM_Apply is wired to this input, whose EINT marks the
+// start of each period.
+#define PWM_SYNC_GPIO 2
+static bool phaseSamplingEnabled = false;
+
 // ARM DDI0403E.d SB1.5.2-3
 // From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
 // value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
@@ -41,7 +99,13 @@ __attribute__((used)) = {
     [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
     [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
 
-    [INT_TO_EXC(0)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+    [INT_TO_EXC(0)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(1)] = (uintptr_t)Gpt_HandleIrq1,
+    [INT_TO_EXC(2)... INT_TO_EXC(GPIO_EINT_FIRST_IRQ + PWM_SYNC_GPIO - 1)] =
+        (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(GPIO_EINT_FIRST_IRQ + PWM_SYNC_GPIO)] = (uintptr_t)Mt3620_Gpio_HandleEintIrq,
+    [INT_TO_EXC(GPIO_EINT_FIRST_IRQ + PWM_SYNC_GPIO + 1)... INT_TO_EXC(INTERRUPT_COUNT - 1)] =
+        (uintptr_t)DefaultExceptionHandler};
 
 static _Noreturn void DefaultExceptionHandler(void)
 {
@@ -50,6 +114,178 @@ static _Noreturn void DefaultExceptionHandler(void)
     }
 }
 
+// Converts 12-bit sample values to millivolts of the 2.5V reference: the same as
+// (value * 2500) / 0xFFF, without a division.
+static DspScale millivoltScale;
+
+// Write whole-part, ".", fractional-part
+static void PrintMillivolts(uint32_t value)
+{
+    uint32_t mV = Dsp_Scale(&millivoltScale, value);
+    Uart_WriteIntegerPoll(mV / 1000);
+    Uart_WriteStringPoll(".");
+    Uart_WriteIntegerWidthPoll(mV % 1000, 3);
+}
+
+// Start or stop the stream when the high-level application sends a subscription.
+static void PollStreamSubscription(void)
+{
+    IntercoreCursor readCursor;
+    if (BeginDequeue(&readCursor, outbound, inbound, sharedBufSize) == -1) {
+        return;
+    }
+
+    IntercoreBlock block;
+    while (PeekNextBlock(&readCursor, &block) == 0) {
+        uint16_t typeId;
+        uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+        AdcPhaseSubscribe phaseSubscribe;
+        if (IsTypedMessage(&block, &typeId) && typeId == AdcPhaseSubscribe_TypeId &&
+            AdcPhaseSubscribe_Decode(&block, messageHeader, &phaseSubscribe) == 0) {
+            __builtin_memcpy(subscriberHeader, messageHeader, sizeof(subscriberHeader));
+            HandlePhaseSubscribe(&phaseSubscribe);
+            continue;
+        }
+
+        AdcStreamSubscribe subscribe;
+        if (!IsTypedMessage(&block, &typeId) || typeId != AdcStreamSubscribe_TypeId ||
+            AdcStreamSubscribe_Decode(&block, messageHeader, &subscribe) == -1) {
+            Uart_WriteStringPoll("Discarding unexpected message\r\n");
+            continue;
+        }
+
+        // Send the blocks to the application which subscribed, starting with a new block.
+        __builtin_memcpy(subscriberHeader, messageHeader, sizeof(subscriberHeader));
+        streamEnabled = subscribe.enable != 0;
+        streamBlock.sampleCount = 0;
+        Uart_WriteStringPoll(streamEnabled ? "Stream started\r\n" : "Stream stopped\r\n");
+    }
+
+    CommitDequeue(&readCursor);
+}
+
+// Add a sample to the block which is being filled, and send the block once it is full.
+static void AddToStreamBlock(const AdcSample *sample)
+{
+    uint64_t sampleIndex = samplesConverted++;
+    if (!streamEnabled) {
+        return;
+    }
+
+    if (streamBlock.sampleCount == 0) {
+        streamBlock.timestampUs = sampleIndex * SAMPLE_PERIOD_US;
+        streamBlock.channel = sample->channel;
+    }
+    streamBlock.samples[streamBlock.sampleCount++] = sample->value;
+
+    if (streamBlock.sampleCount == ADC_STREAM_BLOCK_SAMPLE_COUNT) {
+        SendStreamBlock();
+    }
+}
+
+// Write the full block directly into the shared buffer, leaving the control lane free for the
+// summaries. If the high-level application has not kept up, the block is dropped rather than
+// holding up sampling, and the gap in the sequence numbers tells the high-level application.
+static void SendStreamBlock(void)
+{
+    streamBlock.sequence = nextBlockSequence++;
+    streamBlock.samplePeriodUs = SAMPLE_PERIOD_US;
+    streamBlock.overrunCount = GetAdcOverrunCount();
+
+    IntercoreCursor writeCursor;
+    if (BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == 0 &&
+        AdcSampleBlock_EnqueueBulk(&writeCursor, subscriberHeader, &streamBlock) == 0) {
+        CommitEnqueue(&writeCursor);
+    }
+
+    streamBlock.sampleCount = 0;
+}
+
+// Start or stop phase sampling. The ADC converts either continuously or at the phases, so the
+// continuous stream and the summaries pause while phase sampling is enabled.
+static void HandlePhaseSubscribe(const AdcPhaseSubscribe *subscribe)
+{
+    if (subscribe->enable == 0) {
+        if (phaseSamplingEnabled) {
+            AdcPhase_Stop();
+            phaseSamplingEnabled = false;
+            Uart_WriteStringPoll("Phase sampling stopped\r\n");
+            StartContinuousSampling();
+        }
+        return;
+    }
+
+    if (subscribe->channel > 7) {
+        Uart_WriteStringPoll("Ignoring invalid phase subscription\r\n");
+        return;
+    }
+
+    StopContinuousAdc();
+    if (AdcPhase_Start(PWM_SYNC_GPIO, subscribe) == -1) {
+        Uart_WriteStringPoll("Ignoring invalid phase subscription\r\n");
+        if (!phaseSamplingEnabled) {
+            StartContinuousSampling();
+        }
+        return;
+    }
+
+    phaseSamplingEnabled = true;
+    Uart_WriteStringPoll("Phase sampling started\r\n");
+}
+
+// Send a full block of phase samples to the subscriber. As with the stream blocks, the block is
+// dropped if the shared buffer is full, and the gap in the sequence numbers shows it.
+static void SendPhaseBlock(void)
+{
+    const AdcPhaseBlock *block = AdcPhase_GetReadyBlock();
+    if (block == NULL) {
+        return;
+    }
+
+    IntercoreCursor writeCursor;
+    if (BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == 0 &&
+        AdcPhaseBlock_EnqueueBulk(&writeCursor, subscriberHeader, block) == 0) {
+        CommitEnqueue(&writeCursor);
+    }
+
+    AdcPhase_ReleaseBlock();
+}
+
+// Start converting channel zero continuously, into the ring buffer.
+static int StartContinuousSampling(void)
+{
+    int result = StartContinuousAdc(1U << 0, SAMPLE_RATE_HZ, sampleBuffer,
+                                     sizeof(sampleBuffer) / sizeof(sampleBuffer[0]));
+    if (result == -1) {
+        Uart_WriteStringPoll("ERROR: Unable to start continuous sampling\r\n");
+    }
+    return result;
+}
+
+// Send the summary of the last second to the subscriber. The summary is small and only the
+// latest one matters, so it goes in the control lane, ahead of any sample blocks which are still
+// waiting, and is dropped if even that is full.
+static void SendLatestSummary(const DspWindowResult *result)
+{
+    if (!streamEnabled) {
+        return;
+    }
+
+    AdcLatestSummary summary = {
+        .sequence = nextSummarySequence++,
+        .meanMillivolts = Dsp_Scale(&millivoltScale, (uint32_t)result->mean),
+        .minMillivolts = Dsp_Scale(&millivoltScale, (uint32_t)result->min),
+        .maxMillivolts = Dsp_Scale(&millivoltScale, (uint32_t)result->max),
+        .acRmsMillivolts = Dsp_Scale(&millivoltScale, result->acRms),
+        .overrunCount = GetAdcOverrunCount()};
+
+    IntercoreCursor writeCursor;
+    if (BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == 0 &&
+        AdcLatestSummary_Enqueue(&writeCursor, subscriberHeader, &summary) == 0) {
+        CommitEnqueue(&writeCursor);
+    }
+}
+
 static _Noreturn void RTCoreMain(void)
 {
     // SCB->VTOR = ExceptionVectorTable
@@ -60,19 +296,85 @@ static _Noreturn void RTCoreMain(void)
     Uart_WriteStringPoll("ADC_RTApp_MT3620_BareMetal\r\n");
     Uart_WriteStringPoll("App built on: " __DATE__ ", " __TIME__ "\r\n");
 
+    // The samples are still printed if the shared buffers are unusable, but cannot be streamed.
+    intercoreAvailable = GetIntercoreBuffers(&outbound, &inbound, &sharedBufSize) == 0;
+    if (!intercoreAvailable) {
+        Uart_WriteStringPoll("WARNING: Unable to get shared buffers; not streaming\r\n");
+    }
+    SetIntercoreControlLaneSize(INTERCORE_SUGGESTED_CONTROL_LANE_SIZE);
+
+    Dsp_InitScale(&millivoltScale, 2500, 0xFFF, 0xFFF);
+
+    // GPT3 counts the microseconds which the ADC driver waits for, and GPT0 times the phases.
+    Gpt_Init();
+    TimerScheduler_Init(TimerGpt0);
+
+    // Block includes GPIO0-3.
+    static const GpioBlock pwm0 = {
+        .baseAddr = 0x38010000, .type = GpioBlock_PWM, .firstPin = 0, .pinCount = 4};
+    Mt3620_Gpio_AddBlock(&pwm0);
+    Mt3620_Gpio_ConfigurePinForInput(PWM_SYNC_GPIO);
+
     EnableAdc();
 
-    // Print voltage on channel zero every second.
+    if (StartContinuousSampling() == -1) {
+        for (;;) {
+            // empty.
+        }
+    }
+
+    DspWindow window;
+    Dsp_InitWindow(&window, SAMPLE_RATE_HZ);
+
+    static DspFir lowPass;
+    Dsp_InitFir(&lowPass, lowPassCoefficients,
+                sizeof(lowPassCoefficients) / sizeof(lowPassCoefficients[0]));
+
+    DspThreshold threshold = {.high = THRESHOLD_HIGH, .low = THRESHOLD_LOW, .isHigh = false};
+
+    // Print the mean, minimum, maximum and AC RMS voltage on channel zero every second, and
+    // print an event whenever the filtered voltage crosses a threshold.
     for (;;) {
-        Gpt3_WaitUs(1000 * 1000);
+        if (intercoreAvailable) {
+            PollStreamSubscription();
+            SendPhaseBlock();
+        }
+
+        AdcSample block[32];
+        int16_t values[32];
+        size_t blockCount = ReadAdcBlock(block, sizeof(block) / sizeof(block[0]));
+
+        for (size_t i = 0; i < blockCount; ++i) {
+            values[i] = (int16_t)block[i].value;
+            AddToStreamBlock(&block[i]);
 
-        uint32_t value = ReadAdc(0);
+            DspWindowResult result;
+            if (Dsp_AddToWindow(&window, values[i], &result)) {
+                PrintMillivolts((uint32_t)result.mean);
+                Uart_WriteStringPoll(" (min ");
+                PrintMillivolts((uint32_t)result.min);
+                Uart_WriteStringPoll(", max ");
+                PrintMillivolts((uint32_t)result.max);
+                Uart_WriteStringPoll(", AC RMS ");
+                PrintMillivolts(result.acRms);
+                Uart_WriteStringPoll(", overruns ");
+                Uart_WriteIntegerPoll((int)GetAdcOverrunCount());
+                Uart_WriteStringPoll(")\r\n");
+                SendLatestSummary(&result);
+            }
+        }
 
-        // Write whole-part, ".", fractional-part
-        uint32_t mV = (value * 2500) / 0xFFF;
-        Uart_WriteIntegerPoll(mV / 1000);
-        Uart_WriteStringPoll(".");
-        Uart_WriteIntegerWidthPoll(mV % 1000, 3);
-        Uart_WriteStringPoll("\r\n");
+        size_t filteredCount =
+            Dsp_FirDecimate(&lowPass, DECIMATION_FACTOR, values, blockCount, values);
+        for (size_t i = 0; i < filteredCount; ++i) {
+            DspThresholdEvent event = Dsp_CheckThreshold(&threshold, values[i]);
+            if (event != DspThresholdEvent_None) {
+                Uart_WriteStringPoll(event == DspThresholdEvent_High ? "Rose above "
+                                                                     : "Fell below ");
+                PrintMillivolts((uint32_t)(event == DspThresholdEvent_High ? threshold.high
+                                                                           : threshold.low));
+                Uart_WriteStringPoll("\r\n");
+            }
+        }
     }
 }
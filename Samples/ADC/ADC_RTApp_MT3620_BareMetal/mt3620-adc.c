@@ -7,7 +7,7 @@
 
 #include "mt3620-baremetal.h"
 #include "mt3620-adc.h"
-#include "mt3620-timer-poll.h"
+#include "mt3620-timer.h"
 
 static const uintptr_t ADC_CTRL_BASE = 0x38000100;
 
@@ -21,6 +21,23 @@ typedef enum {
     ADC_FIFO_DEBUG16 = 0x1D4
 } AdcReg;
 
+// The ADC controller runs at 2MHz.
+static const uint32_t ADC_CLOCK_HZ = 2000000;
+// Allow the same 42 clock cycles for each conversion as ReadAdc does, so that the periodic timer
+// never starts a new round of conversions before the last one has finished.
+static const uint32_t ADC_CYCLES_PER_CONVERSION = 42;
+// ADC_CTL1[31:8] = REG_PERIOD, in ADC clock cycles.
+static const uint32_t ADC_MAX_PERIOD = 0xFFFFFF;
+
+static AdcSample *ringBuffer = NULL;
+static size_t ringCapacity = 0;
+static size_t ringHead = 0;
+static size_t ringCount = 0;
+static uint32_t overrunCount = 0;
+// Set while the periodic timer is converting into the FIFO. Otherwise the FIFO belongs to
+// ReadAdc, which may be called from an interrupt handler, so DrainAdcFifo does not touch it.
+static volatile bool isContinuous = false;
+
 static inline uint32_t Bit(size_t index)
 {
     return UINT32_C(1) << index;
@@ -45,7 +62,7 @@ static inline void WriteAdcReg32(AdcReg reg, uint32_t value)
     WriteReg32(ADC_CTRL_BASE, reg, value);
 }
 
-void EnableAdc(void)
+COLD_CODE void EnableAdc(void)
 {
     // Select clocks and other input parameters.
     uint32_t adc_ctl3 = ReadAdcReg32(ADC_CTL3);
@@ -80,7 +97,7 @@ void EnableAdc(void)
 
     // From datasheet, "wait 100 clock cycles for ADC reference generator settled".
     // 100 cycles @ 2MHz = 50us.
-    Gpt3_WaitUs(50);
+    Gpt_WaitMicroseconds(50);
 }
 
 static size_t FifoEntryCount(void)
@@ -102,12 +119,17 @@ static size_t FifoEntryCount(void)
     return entryCount;
 }
 
-uint32_t ReadAdc(uint8_t channel)
+static void DrainFifoEntries(void)
 {
-    // Drain any existing data from the RX FIFO.
     for (size_t i = FifoEntryCount(); i > 0; --i) {
         ReadAdcReg32(ADC_FIFO_RBR);
     }
+}
+
+uint32_t ReadAdc(uint8_t channel)
+{
+    // Drain any existing data from the RX FIFO.
+    DrainFifoEntries();
 
     // Select channel and enable the FSM.
     uint32_t adc_ctl0 = ReadAdcReg32(ADC_CTL0);
@@ -120,7 +142,7 @@ uint32_t ReadAdc(uint8_t channel)
     // "4. wait 8 clock cycles for channel switches settled & ADC latency (2 clock cycles)
     //  5.. 32 clock cycles for averaging"
     // 8 + 2 + 32 = 42 cycles, @2MHz = 21us
-    Gpt3_WaitUs(21);
+    Gpt_WaitMicroseconds(21);
 
     while (FifoEntryCount() == 0) {
         // empty.
@@ -142,3 +164,102 @@ uint32_t ReadAdc(uint8_t channel)
 
     return rbrValue;
 }
+
+int StartContinuousAdc(uint8_t channelMask, uint32_t sampleRateHz, AdcSample *buffer,
+                       size_t bufferCount)
+{
+    uint32_t channelCount = (uint32_t)__builtin_popcount(channelMask);
+    if (channelCount == 0 || sampleRateHz == 0 || buffer == NULL || bufferCount == 0) {
+        return -1;
+    }
+
+    // Every channel in the set is converted in each period.
+    uint32_t period = ADC_CLOCK_HZ / sampleRateHz;
+    if (period < channelCount * ADC_CYCLES_PER_CONVERSION || period > ADC_MAX_PERIOD) {
+        return -1;
+    }
+
+    StopContinuousAdc();
+    DrainFifoEntries();
+
+    ringBuffer = buffer;
+    ringCapacity = bufferCount;
+    ringHead = 0;
+    ringCount = 0;
+    overrunCount = 0;
+
+    // Set the period of the periodic timer.
+    uint32_t adc_ctl1 = ReadAdcReg32(ADC_CTL1);
+    adc_ctl1 &= ~BitMask(31, 8); // [REG_PERIOD] = period
+    adc_ctl1 |= period << 8;
+    WriteAdcReg32(ADC_CTL1, adc_ctl1);
+
+    // Select channels, enable the periodic timer, and enable the FSM.
+    uint32_t adc_ctl0 = ReadAdcReg32(ADC_CTL0);
+    adc_ctl0 &= ~BitMask(31, 16); // [REG_CH_MAP] = channelMask
+    adc_ctl0 |= (uint32_t)channelMask << 16;
+    adc_ctl0 |= Bit(8); // [PMODE] = 1 -> enable periodic timer
+    adc_ctl0 |= Bit(0); // [ADC_FSM_EN] = 1 -> start FSM
+    WriteAdcReg32(ADC_CTL0, adc_ctl0);
+    isContinuous = true;
+
+    return 0;
+}
+
+void StopContinuousAdc(void)
+{
+    isContinuous = false;
+    uint32_t adc_ctl0 = ReadAdcReg32(ADC_CTL0);
+    adc_ctl0 &= ~Bit(8); // [PMODE] = 0 -> disable periodic timer
+    adc_ctl0 &= ~Bit(0); // [ADC_FSM_EN] = 0 -> disable FSM
+    WriteAdcReg32(ADC_CTL0, adc_ctl0);
+}
+
+size_t DrainAdcFifo(void)
+{
+    if (ringBuffer == NULL || !isContinuous) {
+        return ringCount;
+    }
+
+    size_t entryCount = FifoEntryCount();
+
+    // A full FIFO may have discarded conversions since it was last drained.
+    if (entryCount >= ADC_FIFO_SIZE) {
+        ++overrunCount;
+    }
+
+    for (; entryCount > 0; --entryCount) {
+        uint32_t rbr = ReadAdcReg32(ADC_FIFO_RBR);
+
+        if (ringCount == ringCapacity) {
+            ++overrunCount;
+            continue;
+        }
+
+        AdcSample *sample = &ringBuffer[(ringHead + ringCount) % ringCapacity];
+        sample->channel = (uint8_t)(rbr & 0xF);        // ADC_FIFO_RBR[3:0] = channel number
+        sample->value = (uint16_t)((rbr >> 4) & 0xFFF); // ADC_FIFO_RBR[15:4] = sample
+        ++ringCount;
+    }
+
+    return ringCount;
+}
+
+size_t ReadAdcBlock(AdcSample *dest, size_t maxCount)
+{
+    DrainAdcFifo();
+
+    size_t readCount = ringCount < maxCount ? ringCount : maxCount;
+    for (size_t i = 0; i < readCount; ++i) {
+        dest[i] = ringBuffer[ringHead];
+        ringHead = (ringHead + 1) % ringCapacity;
+    }
+    ringCount -= readCount;
+
+    return readCount;
+}
+
+uint32_t GetAdcOverrunCount(void)
+{
+    return overrunCount;
+}
@@ -4,6 +4,7 @@
 #ifndef MT3620_ADC_H
 #define MT3620_ADC_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /// <summary>
@@ -23,4 +24,66 @@ void EnableAdc(void);
 /// If an error occurs, returns 0xFFFFFFFF.</returns>
 uint32_t ReadAdc(uint8_t channel);
 
+/// <summary>
+/// Number of samples which the ADC's hardware FIFO holds.
+/// </summary>
+#define ADC_FIFO_SIZE 16
+
+/// <summary>
+/// One conversion which was made in continuous mode.
+/// </summary>
+typedef struct {
+    /// <summary>12-bit sample value, as returned by <see cref="ReadAdc" />.</summary>
+    uint16_t value;
+    /// <summary>Channel which the sample was read from.</summary>
+    uint8_t channel;
+} AdcSample;
+
+/// <summary>
+/// <para>Start converting a set of channels continuously. The ADC's periodic timer converts
+/// each channel in the set once per period, into the hardware FIFO. The samples are moved to a
+/// ring buffer by <see cref="DrainAdcFifo" /> and <see cref="ReadAdcBlock" />, which must be
+/// called often enough that the FIFO does not fill up: it holds ADC_FIFO_SIZE samples.</para>
+/// <para>Call <see cref="EnableAdc" /> before calling this function. <see cref="ReadAdc" />
+/// must not be called until <see cref="StopContinuousAdc" /> has been called.</para>
+/// </summary>
+/// <param name="channelMask">Bit n is set to convert channel n.</param>
+/// <param name="sampleRateHz">Number of times per second to convert each channel.</param>
+/// <param name="buffer">Ring buffer which holds converted samples until they are read. This
+/// must remain valid until continuous mode is stopped.</param>
+/// <param name="bufferCount">Number of samples which buffer can hold.</param>
+/// <returns>0 on success; -1 if the arguments are invalid, or the ADC cannot convert the
+/// channels at this rate.</returns>
+int StartContinuousAdc(uint8_t channelMask, uint32_t sampleRateHz, AdcSample *buffer,
+                       size_t bufferCount);
+
+/// <summary>
+/// Stop continuous mode. Samples which are already in the ring buffer can still be read.
+/// <see cref="ReadAdc" /> can be called again after this, including from an interrupt
+/// handler.
+/// </summary>
+void StopContinuousAdc(void);
+
+/// <summary>
+/// Move converted samples from the hardware FIFO to the ring buffer. If the ring buffer is
+/// full, new samples are discarded and counted by <see cref="GetAdcOverrunCount" />.
+/// </summary>
+/// <returns>The number of samples in the ring buffer.</returns>
+size_t DrainAdcFifo(void);
+
+/// <summary>
+/// Read the oldest samples from the ring buffer, after moving any new samples from the
+/// hardware FIFO. Samples from the channels in the set are interleaved in channel order.
+/// </summary>
+/// <param name="dest">Receives the samples.</param>
+/// <param name="maxCount">Maximum number of samples to read.</param>
+/// <returns>The number of samples which were read.</returns>
+size_t ReadAdcBlock(AdcSample *dest, size_t maxCount);
+
+/// <summary>
+/// Get the number of times that samples may have been lost in continuous mode, because the
+/// hardware FIFO or the ring buffer was full, since continuous mode was started.
+/// </summary>
+uint32_t GetAdcOverrunCount(void);
+
 #endif // #ifndef MT3620_ADC_H
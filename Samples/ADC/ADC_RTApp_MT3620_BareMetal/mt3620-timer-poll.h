@@ -1,12 +0,0 @@
-/* Copyright (c) Microsoft Corporation. All rights reserved.
-   Licensed under the MIT License. */
-
-#ifndef MT3620_TIMER_POLL_H
-#define MT3620_TIMER_POLL_H
-
-/// <summary>
-/// Busy wait for the supplied number of microseconds.
-/// </summary>
-void Gpt3_WaitUs(int microseconds);
-
-#endif // #ifndef MT3620_TIMER_POLL_H
@@ -0,0 +1,173 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-timer-scheduler.h"
+
+// If the earliest deadline is no further away than this, busy-wait for it instead of arming
+// the GPT. This covers the rounding of the delay down to a whole number of 32kHz ticks.
+#define SPIN_THRESHOLD_US 64
+
+static TimerGpt hardwareTimer;
+// Active timers, sorted by deadline. Only modified with the GPT interrupt blocked, or from
+// the GPT interrupt itself.
+static ScheduledTimer *queueHead = NULL;
+// Set while ServiceQueue is running, so a timer which is started or stopped from a callback
+// is handled by the running loop, rather than by a recursive call.
+static bool isServicing = false;
+
+static void HandleHardwareTimerIrq(void);
+
+// Returns true if deadline a is before deadline b. The counter wraps, so compare the signed
+// difference, which is valid while the deadlines are less than 2^31 us apart.
+static inline bool IsBefore(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static void InsertTimer(ScheduledTimer *timer)
+{
+    // Insert after any timers with the same deadline, so they expire in the order started.
+    ScheduledTimer **link = &queueHead;
+    while (*link != NULL && !IsBefore(timer->deadlineUs, (*link)->deadlineUs)) {
+        link = &(*link)->next;
+    }
+
+    timer->next = *link;
+    *link = timer;
+    timer->isActive = true;
+}
+
+static void RemoveTimer(ScheduledTimer *timer)
+{
+    for (ScheduledTimer **link = &queueHead; *link != NULL; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+
+    timer->next = NULL;
+    timer->isActive = false;
+}
+
+// Arm the GPT to interrupt at, or slightly before, the earliest deadline.
+static void ArmHardwareTimer(uint32_t remainingUs)
+{
+    // Round down, so the interrupt is never late. The interrupt handler busy-waits for the
+    // remainder, or re-arms the timer if the 32kHz clock has run fast over a long delay.
+    uint32_t ticks = (uint32_t)(((uint64_t)remainingUs * GPT_32KHZ_CLOCK_HZ) / 1000000U);
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    Gpt_LaunchTimer(hardwareTimer, ticks, GptSpeed_32KHz, /* periodic */ false,
+                    HandleHardwareTimerIrq);
+}
+
+// Run every timer whose deadline has been reached, then arm the GPT for the next deadline.
+// Called from the GPT interrupt, or with it blocked.
+static void ServiceQueue(void)
+{
+    if (isServicing) {
+        return;
+    }
+
+    isServicing = true;
+
+    for (;;) {
+        ScheduledTimer *timer = queueHead;
+        if (timer == NULL) {
+            Gpt_StopTimer(hardwareTimer);
+            break;
+        }
+
+        uint32_t now = Gpt_GetMicroseconds();
+        int32_t remainingUs = (int32_t)(timer->deadlineUs - now);
+        if (remainingUs > SPIN_THRESHOLD_US) {
+            ArmHardwareTimer((uint32_t)remainingUs);
+            break;
+        }
+
+        if (remainingUs > 0) {
+            Gpt_WaitMicroseconds((uint32_t)remainingUs);
+            now = timer->deadlineUs;
+        }
+
+        RemoveTimer(timer);
+
+        if (timer->periodUs != 0) {
+            // Schedule from the previous deadline, not from now, so the timer does not drift.
+            timer->deadlineUs += timer->periodUs;
+            if (!IsBefore(now, timer->deadlineUs)) {
+                // More than one period has passed. Skip to the next deadline in the future.
+                uint32_t missed = (now - timer->deadlineUs) / timer->periodUs + 1;
+                timer->deadlineUs += missed * timer->periodUs;
+                timer->missedPeriods += missed;
+            }
+            InsertTimer(timer);
+        }
+
+        // The callback may start or stop timers, including this one, so re-read the queue head
+        // on the next iteration.
+        timer->callback();
+    }
+
+    isServicing = false;
+}
+
+static void HandleHardwareTimerIrq(void)
+{
+    ServiceQueue();
+}
+
+void TimerScheduler_Init(TimerGpt gpt)
+{
+    hardwareTimer = gpt;
+    queueHead = NULL;
+}
+
+void TimerScheduler_Start(ScheduledTimer *timer, uint32_t delayUs, uint32_t periodUs,
+                          Callback callback)
+{
+    // Block the GPT interrupt, so the queue is not modified by the scheduler's interrupt
+    // handler at the same time. This is a no-op when called from a timer callback.
+    uint32_t prevBasePri = BlockIrqs();
+
+    if (timer->isActive) {
+        RemoveTimer(timer);
+    }
+
+    timer->callback = callback;
+    timer->periodUs = periodUs;
+    timer->deadlineUs = Gpt_GetMicroseconds() + delayUs;
+    timer->missedPeriods = 0;
+    InsertTimer(timer);
+
+    // Only the earliest deadline is armed, so re-arm if this timer is now at the front.
+    // ServiceQueue runs the callback immediately if the deadline is already close.
+    if (queueHead == timer) {
+        ServiceQueue();
+    }
+
+    RestoreIrqs(prevBasePri);
+}
+
+void TimerScheduler_Stop(ScheduledTimer *timer)
+{
+    uint32_t prevBasePri = BlockIrqs();
+
+    if (timer->isActive) {
+        bool wasHead = (queueHead == timer);
+        RemoveTimer(timer);
+
+        // If this timer was armed, arm the next one instead, or stop the GPT.
+        if (wasHead) {
+            ServiceQueue();
+        }
+    }
+
+    RestoreIrqs(prevBasePri);
+}
@@ -0,0 +1,477 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This sample C application for Azure Sphere receives a stream of ADC samples from the
+// ADC_RTApp_MT3620_BareMetal real-time capable application, which samples the potentiometer
+// at 1kHz with the ADC's periodic timer. That is a higher rate, with less jitter, than
+// ADC_Poll can reach on the high-level core.
+// The samples arrive in timestamped blocks through the epoll loop. Every few seconds, their
+// mean, minimum and maximum voltage, and the health of the stream, are formatted as a telemetry
+// message in the same form as the AzureIoT sample sends to IoT Hub, together with the latest
+// one-second summary from the real-time capable application, which includes the AC RMS voltage.
+// The real-time capable application can instead sample at fixed phases of the period of a PWM
+// output, such as one which drives a load with PWM_Apply, and then the mean voltage at each
+// phase is sent too.
+//
+// It uses the following Azure Sphere libraries
+// - log (messages shown in Visual Studio's Device Output window during debugging);
+// - application (establish a connection with a real-time capable application).
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "intercore_channel.h"
+#include "adc_stream_messages.h"
+
+INTERCORE_CHANNEL_DEFINE_CODEC(AdcStreamSubscribe)
+INTERCORE_CHANNEL_DEFINE_CODEC(AdcSampleBlock)
+INTERCORE_CHANNEL_DEFINE_CODEC(AdcLatestSummary)
+INTERCORE_CHANNEL_DEFINE_CODEC(AdcPhaseSubscribe)
+INTERCORE_CHANNEL_DEFINE_CODEC(AdcPhaseBlock)
+
+static int epollFd = -1;
+static int telemetryTimerFd = -1;
+static IntercoreChannel rtAppChannel = {.sockFd = -1};
+static volatile sig_atomic_t terminationRequired = false;
+
+static const char rtAppComponentId[] = "4cbd8fa4-96b3-ff48-7e2f-47f637d702dd";
+
+// The samples are 12-bit proportions of the 2.5V reference.
+#define SAMPLE_MAX_VALUE 0xFFF
+static const float voltsPerSampleValue = 2.5f / (float)SAMPLE_MAX_VALUE;
+
+#define TELEMETRY_PERIOD_SECONDS 5
+
+// To sample at fixed phases of a PWM period instead of continuously, wire the PWM output to the
+// real-time capable application's sync input, GPIO2, and set enable to 1. These phases are
+// 50us after each rising edge, and 50us after the falling edge of a 1kHz PWM at 50% duty cycle.
+static const AdcPhaseSubscribe phaseSubscribe = {
+    .enable = 0, .channel = 0, .phaseCount = 2, .periodUs = 0, .phaseOffsetsUs = {50, 550}};
+
+/// <summary>
+///     Aggregates of the blocks which have arrived since telemetry was last sent.
+/// </summary>
+typedef struct {
+    /// <summary>Number of samples.</summary>
+    uint32_t sampleCount;
+    /// <summary>Sum of the sample values.</summary>
+    uint64_t sampleSum;
+    /// <summary>Smallest sample value.</summary>
+    uint16_t minSample;
+    /// <summary>Largest sample value.</summary>
+    uint16_t maxSample;
+    /// <summary>Number of blocks which were missing from the sequence.</summary>
+    uint32_t lostBlocks;
+    /// <summary>Number of ADC overruns reported by the real-time capable application.</summary>
+    uint32_t overruns;
+    /// <summary>Smallest and largest difference, in microseconds, between when a block
+    /// arrived and when its last sample was taken. The spread is the delivery jitter.</summary>
+    int64_t minDelayUs;
+    int64_t maxDelayUs;
+    /// <summary>Number and sum of the samples at each phase, while phase sampling is
+    /// enabled.</summary>
+    uint32_t phaseSampleCount[ADC_PHASE_MAX_OFFSETS];
+    uint64_t phaseSampleSum[ADC_PHASE_MAX_OFFSETS];
+    /// <summary>Number of periods which the real-time capable application missed.</summary>
+    uint32_t missedPeriods;
+} AdcAggregate;
+
+static AdcAggregate aggregate;
+
+// State of the stream, which carries over between telemetry periods.
+static bool streamStarted = false;
+static uint32_t nextExpectedSequence = 0;
+static uint32_t lastOverrunCount = 0;
+static uint32_t lastMissedPeriods = 0;
+// Offset from the real-time capable application's timestamps to CLOCK_MONOTONIC, taken from the
+// first block. Only the variation in the delay is meaningful, not its absolute value.
+static int64_t timestampOffsetUs = 0;
+
+// Latest summary from the real-time capable application. The channel's handler overwrites it
+// and telemetry reads it, both on the event loop thread, so it is a plain copy. It is only sent
+// once, while isSummaryNew is set.
+static AdcLatestSummary latestSummary;
+static bool isSummaryNew = false;
+
+static void TerminationHandler(int signalNumber);
+static void TelemetryTimerEventHandler(EventData *eventData);
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size);
+static void RTCoreTypedMessageHandler(IntercoreChannel *channel,
+                                      const IntercoreTypedHeader *header, const uint8_t *body,
+                                      size_t bodySize);
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error);
+static void HandleSampleBlock(const AdcSampleBlock *block);
+static void HandlePhaseBlock(const AdcPhaseBlock *block);
+static void FormatPhaseFields(char *fields, size_t size);
+static void ResetAggregate(void);
+static float SampleToVoltage(float sample);
+static void SendTelemetry(const char *message);
+static int64_t GetMonotonicTimeUs(void);
+static int InitHandlers(void);
+static void CloseHandlers(void);
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+    // Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Handle telemetry timer event: sends the aggregates of the samples which have arrived
+///     since the last event.
+/// </summary>
+static void TelemetryTimerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(telemetryTimerFd) != 0) {
+        terminationRequired = true;
+        return;
+    }
+
+    if (aggregate.sampleCount == 0) {
+        Log_Debug("WARNING: No ADC samples have arrived from the real-time core.\n");
+        return;
+    }
+
+    float mean = (float)aggregate.sampleSum / (float)aggregate.sampleCount;
+
+    // The summary's readings are only sent when a new one has arrived.
+    char summaryFields[96] = "";
+    if (isSummaryNew) {
+        snprintf(summaryFields, sizeof(summaryFields),
+                 ", \"AdcAcRmsVoltage\": \"%.3f\", \"AdcSummaryMeanVoltage\": \"%.3f\"",
+                 (float)latestSummary.acRmsMillivolts / 1000.0f,
+                 (float)latestSummary.meanMillivolts / 1000.0f);
+        isSummaryNew = false;
+    }
+
+    char phaseFields[160] = "";
+    if (phaseSubscribe.enable != 0) {
+        FormatPhaseFields(phaseFields, sizeof(phaseFields));
+    }
+
+    static char message[480];
+    int len = snprintf(message, sizeof(message),
+                       "{ \"AdcMeanVoltage\": \"%.3f\", \"AdcMinVoltage\": \"%.3f\", "
+                       "\"AdcMaxVoltage\": \"%.3f\", \"AdcSampleCount\": \"%u\", "
+                       "\"AdcLostBlocks\": \"%u\", \"AdcOverruns\": \"%u\", "
+                       "\"AdcJitterUs\": \"%lld\"%s%s }",
+                       SampleToVoltage(mean), SampleToVoltage(aggregate.minSample),
+                       SampleToVoltage(aggregate.maxSample), aggregate.sampleCount,
+                       aggregate.lostBlocks, aggregate.overruns,
+                       (long long)(aggregate.maxDelayUs - aggregate.minDelayUs), summaryFields,
+                       phaseFields);
+    if (len > 0 && (size_t)len < sizeof(message)) {
+        SendTelemetry(message);
+    }
+
+    ResetAggregate();
+}
+
+/// <summary>
+///     Handle an untyped message from the real-time capable application, which only sends
+///     typed messages.
+/// </summary>
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size)
+{
+    Log_Debug("WARNING: Discarding untyped message of %zu bytes.\n", size);
+}
+
+/// <summary>
+///     Handle a typed message from the real-time capable application.
+/// </summary>
+static void RTCoreTypedMessageHandler(IntercoreChannel *channel,
+                                      const IntercoreTypedHeader *header, const uint8_t *body,
+                                      size_t bodySize)
+{
+    AdcSampleBlock block;
+    if (AdcSampleBlock_Decode(header, body, bodySize, &block)) {
+        HandleSampleBlock(&block);
+        return;
+    }
+
+    AdcPhaseBlock phaseBlock;
+    if (AdcPhaseBlock_Decode(header, body, bodySize, &phaseBlock)) {
+        HandlePhaseBlock(&phaseBlock);
+        return;
+    }
+
+    if (AdcLatestSummary_Decode(header, body, bodySize, &latestSummary)) {
+        isSummaryNew = true;
+        return;
+    }
+
+    Log_Debug("WARNING: Discarding typed message of type %u version %u.\n", header->typeId,
+              header->version);
+}
+
+/// <summary>
+///     Handle a failure of the connection to the real-time capable application.
+/// </summary>
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error)
+{
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Add a block of samples to the aggregates, and check it for lost blocks and overruns.
+/// </summary>
+static void HandleSampleBlock(const AdcSampleBlock *block)
+{
+    if (block->sampleCount == 0 || block->sampleCount > ADC_STREAM_BLOCK_SAMPLE_COUNT) {
+        Log_Debug("WARNING: Discarding block with %u samples.\n", block->sampleCount);
+        return;
+    }
+
+    int64_t lastSampleUs =
+        (int64_t)(block->timestampUs + (uint64_t)(block->sampleCount - 1) * block->samplePeriodUs);
+    int64_t nowUs = GetMonotonicTimeUs();
+
+    if (!streamStarted) {
+        streamStarted = true;
+        nextExpectedSequence = block->sequence;
+        lastOverrunCount = block->overrunCount;
+        timestampOffsetUs = nowUs - lastSampleUs;
+    }
+
+    // The sequence numbers are consecutive unless the real-time core dropped blocks because the
+    // shared buffer was full.
+    aggregate.lostBlocks += block->sequence - nextExpectedSequence;
+    nextExpectedSequence = block->sequence + 1;
+
+    aggregate.overruns += block->overrunCount - lastOverrunCount;
+    lastOverrunCount = block->overrunCount;
+
+    int64_t delayUs = nowUs - lastSampleUs - timestampOffsetUs;
+    if (aggregate.sampleCount == 0 || delayUs < aggregate.minDelayUs) {
+        aggregate.minDelayUs = delayUs;
+    }
+    if (aggregate.sampleCount == 0 || delayUs > aggregate.maxDelayUs) {
+        aggregate.maxDelayUs = delayUs;
+    }
+
+    for (size_t i = 0; i < block->sampleCount; ++i) {
+        uint16_t sample = block->samples[i];
+        aggregate.sampleSum += sample;
+        if (sample < aggregate.minSample) {
+            aggregate.minSample = sample;
+        }
+        if (sample > aggregate.maxSample) {
+            aggregate.maxSample = sample;
+        }
+    }
+    aggregate.sampleCount += block->sampleCount;
+}
+
+/// <summary>
+///     Add a block of phase samples to the aggregates, both to those of each phase and to those
+///     of all the samples, and check it for lost blocks and missed periods.
+/// </summary>
+static void HandlePhaseBlock(const AdcPhaseBlock *block)
+{
+    size_t sampleCount = (size_t)block->phaseCount * block->periodCount;
+    if (block->phaseCount != phaseSubscribe.phaseCount ||
+        sampleCount > ADC_PHASE_BLOCK_SAMPLE_COUNT) {
+        Log_Debug("WARNING: Discarding phase block with %u phases and %u periods.\n",
+                  block->phaseCount, block->periodCount);
+        return;
+    }
+
+    if (!streamStarted) {
+        streamStarted = true;
+        nextExpectedSequence = block->sequence;
+        lastMissedPeriods = block->missedPeriods;
+    }
+
+    aggregate.lostBlocks += block->sequence - nextExpectedSequence;
+    nextExpectedSequence = block->sequence + 1;
+
+    aggregate.missedPeriods += block->missedPeriods - lastMissedPeriods;
+    lastMissedPeriods = block->missedPeriods;
+
+    for (size_t i = 0; i < sampleCount; ++i) {
+        uint16_t sample = block->samples[i];
+        if (sample == ADC_PHASE_INVALID_SAMPLE) {
+            continue;
+        }
+
+        size_t phase = i % block->phaseCount;
+        ++aggregate.phaseSampleCount[phase];
+        aggregate.phaseSampleSum[phase] += sample;
+
+        ++aggregate.sampleCount;
+        aggregate.sampleSum += sample;
+        if (sample < aggregate.minSample) {
+            aggregate.minSample = sample;
+        }
+        if (sample > aggregate.maxSample) {
+            aggregate.maxSample = sample;
+        }
+    }
+}
+
+/// <summary>
+///     Format the mean voltage at each phase, and the number of missed periods, as telemetry
+///     fields which follow the others.
+/// </summary>
+/// <param name="fields">Receives the fields, each preceded by a comma.</param>
+/// <param name="size">Size of the fields buffer.</param>
+static void FormatPhaseFields(char *fields, size_t size)
+{
+    int len = snprintf(fields, size, ", \"AdcMissedPeriods\": \"%u\", \"AdcPhaseVoltages\": [",
+                       aggregate.missedPeriods);
+    for (size_t i = 0; i < phaseSubscribe.phaseCount && len > 0 && (size_t)len < size; ++i) {
+        uint32_t count = aggregate.phaseSampleCount[i];
+        float mean = count == 0 ? 0.0f : (float)aggregate.phaseSampleSum[i] / (float)count;
+        len += snprintf(fields + len, size - (size_t)len, "%s\"%.3f\"", i == 0 ? "" : ", ",
+                        SampleToVoltage(mean));
+    }
+    if (len > 0 && (size_t)len < size) {
+        snprintf(fields + len, size - (size_t)len, "]");
+    }
+}
+
+/// <summary>
+///     Clear the aggregates at the start of a telemetry period.
+/// </summary>
+static void ResetAggregate(void)
+{
+    memset(&aggregate, 0, sizeof(aggregate));
+    aggregate.minSample = UINT16_MAX;
+}
+
+/// <summary>
+///     Convert a sample value, or an average of sample values, to volts.
+/// </summary>
+static float SampleToVoltage(float sample)
+{
+    return sample * voltsPerSampleValue;
+}
+
+/// <summary>
+///     Hand a telemetry message to the telemetry path. This sample only logs it; the AzureIoT
+///     sample's SendTelemetry shows how to send the same message to IoT Hub with
+///     IoTHubMessage_CreateFromString and IoTHubDeviceClient_LL_SendEventAsync.
+/// </summary>
+/// <param name="message">The telemetry message, as a JSON object.</param>
+static void SendTelemetry(const char *message)
+{
+    Log_Debug("Sending telemetry: %s\n", message);
+}
+
+/// <summary>
+///     Get the current CLOCK_MONOTONIC time in microseconds.
+/// </summary>
+static int64_t GetMonotonicTimeUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// event handler data structures. Only the event handler field needs to be populated.
+static EventData telemetryTimerEventData = {.eventHandler = &TelemetryTimerEventHandler};
+
+/// <summary>
+///     Set up SIGTERM termination handler, the telemetry timer, and the connection to the
+///     real-time capable application, and start the stream.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitHandlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    ResetAggregate();
+
+    epollFd = CreateEpollFd();
+    if (epollFd < 0) {
+        return -1;
+    }
+
+    static const struct timespec telemetryPeriod = {.tv_sec = TELEMETRY_PERIOD_SECONDS,
+                                                    .tv_nsec = 0};
+    telemetryTimerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &telemetryPeriod, &telemetryTimerEventData, EPOLLIN);
+    if (telemetryTimerFd < 0) {
+        return -1;
+    }
+
+    if (IntercoreChannel_Open(&rtAppChannel, epollFd, rtAppComponentId, RTCoreMessageHandler,
+                              RTCoreChannelErrorHandler) != 0) {
+        return -1;
+    }
+    IntercoreChannel_SetTypedMessageHandler(&rtAppChannel, RTCoreTypedMessageHandler);
+
+    // The real-time capable application sends its blocks to this application once it has
+    // received the subscription.
+    if (phaseSubscribe.enable != 0) {
+        if (AdcPhaseSubscribe_Send(&rtAppChannel, &phaseSubscribe) != 0) {
+            Log_Debug("ERROR: Unable to start phase sampling: %d (%s)\n", errno, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    AdcStreamSubscribe subscribe = {.enable = 1};
+    if (AdcStreamSubscribe_Send(&rtAppChannel, &subscribe) != 0) {
+        Log_Debug("ERROR: Unable to start the ADC stream: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/// <summary>
+///     Stop the stream and clean up the resources previously allocated.
+/// </summary>
+static void CloseHandlers(void)
+{
+    // This is sent on a best-effort basis. If it is lost, the real-time capable application
+    // drops its blocks once the shared buffer is full.
+    if (phaseSubscribe.enable != 0) {
+        AdcPhaseSubscribe stopPhases = {.enable = 0};
+        AdcPhaseSubscribe_Send(&rtAppChannel, &stopPhases);
+    } else {
+        AdcStreamSubscribe subscribe = {.enable = 0};
+        AdcStreamSubscribe_Send(&rtAppChannel, &subscribe);
+    }
+
+    Log_Debug("Closing file descriptors.\n");
+    IntercoreChannel_Close(&rtAppChannel);
+    CloseFdAndPrintError(telemetryTimerFd, "TelemetryTimer");
+    CloseFdAndPrintError(epollFd, "Epoll");
+}
+
+int main(void)
+{
+    Log_Debug("ADC streaming application starting.\n");
+
+    if (InitHandlers() != 0) {
+        terminationRequired = true;
+    }
+
+    while (!terminationRequired) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
+            terminationRequired = true;
+        }
+    }
+
+    CloseHandlers();
+    Log_Debug("Application exiting.\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "intercore_typed_defs.h"
+
+/// <summary>
+/// Number of samples in each <see cref="AdcSampleBlock" />.
+/// </summary>
+#define ADC_STREAM_BLOCK_SAMPLE_COUNT 64
+
+/// <summary>
+/// Sent by the high-level application to start or stop the stream of
+/// <see cref="AdcSampleBlock" /> messages. The blocks are sent to the application which sent
+/// the most recent subscription.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>1 to start the stream, 0 to stop it.</summary>
+    uint32_t enable;
+} AdcStreamSubscribe;
+INTERCORE_TYPED_MESSAGE(AdcStreamSubscribe, 16, 1);
+
+/// <summary>
+/// <para>Sent by the real-time capable application for each block of consecutive samples from
+/// one channel, while the stream is enabled.</para>
+/// <para>The ADC's periodic timer converts the samples, so they are exactly samplePeriodUs
+/// apart. The timestamps count converted samples: if overrunCount has changed since the
+/// previous block, samples were lost in between and the timestamps have skipped ahead by less
+/// than the lost time.</para>
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Incremented for each block which is made while the stream is enabled, so a
+    /// gap means blocks were dropped because the shared buffer was full.</summary>
+    uint32_t sequence;
+    /// <summary>Time of the first sample, in microseconds since sampling started.</summary>
+    uint64_t timestampUs;
+    /// <summary>Time between consecutive samples, in microseconds.</summary>
+    uint32_t samplePeriodUs;
+    /// <summary>Value of GetAdcOverrunCount when the block was sent.</summary>
+    uint32_t overrunCount;
+    /// <summary>Channel which the samples were read from.</summary>
+    uint8_t channel;
+    /// <summary>Number of entries in samples which are used.</summary>
+    uint8_t sampleCount;
+    /// <summary>12-bit sample values, which are proportions of the 2.5V reference.</summary>
+    uint16_t samples[ADC_STREAM_BLOCK_SAMPLE_COUNT];
+} AdcSampleBlock;
+INTERCORE_TYPED_MESSAGE(AdcSampleBlock, 17, 1);
+
+/// <summary>
+/// Sent by the real-time capable application once a second while the stream is enabled, with
+/// the summary of the last second of samples on channel 0. Only the latest summary matters, so
+/// the high-level application keeps a copy of it rather than a queue.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Incremented for each summary, so the reader can tell a new one.</summary>
+    uint32_t sequence;
+    /// <summary>Mean, minimum and maximum voltage, and the RMS of the voltage around the mean,
+    /// in millivolts.</summary>
+    uint32_t meanMillivolts;
+    uint32_t minMillivolts;
+    uint32_t maxMillivolts;
+    uint32_t acRmsMillivolts;
+    /// <summary>Value of GetAdcOverrunCount when the summary was made.</summary>
+    uint32_t overrunCount;
+} AdcLatestSummary;
+INTERCORE_TYPED_MESSAGE(AdcLatestSummary, 20, 1);
+
+/// <summary>
+/// Most phases in an <see cref="AdcPhaseSubscribe" />.
+/// </summary>
+#define ADC_PHASE_MAX_OFFSETS 8
+
+/// <summary>
+/// Shortest time between the phases of an <see cref="AdcPhaseSubscribe" />, and between the
+/// last phase and the end of the period, in microseconds. Each conversion takes this long.
+/// </summary>
+#define ADC_PHASE_MIN_SPACING_US 30
+
+/// <summary>
+/// Number of samples in each <see cref="AdcPhaseBlock" />. The block holds as many whole
+/// periods as fit.
+/// </summary>
+#define ADC_PHASE_BLOCK_SAMPLE_COUNT 64
+
+/// <summary>
+/// Value of a sample in an <see cref="AdcPhaseBlock" /> whose conversion failed.
+/// </summary>
+#define ADC_PHASE_INVALID_SAMPLE 0xFFFF
+
+/// <summary>
+/// <para>Sent by the high-level application to start or stop sampling at fixed phases of a
+/// PWM period, instead of the continuous stream. While it is enabled, the real-time capable
+/// application converts the channel once at each offset from the start of every period, and
+/// sends <see cref="AdcPhaseBlock" /> messages to the application which subscribed.</para>
+/// <para>The periods start at each rising edge of the PWM output, which is wired to the
+/// real-time capable application's sync input, or every periodUs if that is not zero. A
+/// subscription which is not valid is ignored.</para>
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>1 to start sampling, 0 to stop it and restart the continuous stream.</summary>
+    uint8_t enable;
+    /// <summary>Channel to convert.</summary>
+    uint8_t channel;
+    /// <summary>Number of entries in phaseOffsetsUs which are used, from 1 to
+    /// ADC_PHASE_MAX_OFFSETS.</summary>
+    uint8_t phaseCount;
+    uint8_t reserved;
+    /// <summary>Period in microseconds, to time the periods with the real-time core's own
+    /// timer, or 0 to start each period at a rising edge of the sync input.</summary>
+    uint32_t periodUs;
+    /// <summary>Time from the start of the period to the start of each conversion, in
+    /// microseconds. These must increase, and be at least ADC_PHASE_MIN_SPACING_US apart so
+    /// that each conversion finishes before the next one starts.</summary>
+    uint16_t phaseOffsetsUs[ADC_PHASE_MAX_OFFSETS];
+} AdcPhaseSubscribe;
+INTERCORE_TYPED_MESSAGE(AdcPhaseSubscribe, 22, 1);
+
+/// <summary>
+/// <para>Sent by the real-time capable application for each block of periods, while phase
+/// sampling is enabled. Sample n of period p is samples[p * phaseCount + n], taken at
+/// phaseOffsetsUs[n] from the start of that period.</para>
+/// <para>The periods are consecutive unless missedPeriods has changed since the previous
+/// block. A period is missed if the next one starts before all of its conversions have been
+/// made, or the previous block has not been sent yet.</para>
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Incremented for each block which is made, so a gap means blocks were dropped
+    /// because the shared buffer was full.</summary>
+    uint32_t sequence;
+    /// <summary>Start of the first period, on the real-time core's microsecond counter, which
+    /// wraps every 2^32 microseconds.</summary>
+    uint32_t timestampUs;
+    /// <summary>Length of the last period in the block, in microseconds.</summary>
+    uint32_t periodUs;
+    /// <summary>Number of periods which have been missed since sampling started.</summary>
+    uint32_t missedPeriods;
+    /// <summary>Channel which the samples were read from.</summary>
+    uint8_t channel;
+    /// <summary>Number of samples in each period.</summary>
+    uint8_t phaseCount;
+    /// <summary>Number of periods in the block.</summary>
+    uint8_t periodCount;
+    /// <summary>12-bit sample values, which are proportions of the 2.5V reference, or
+    /// ADC_PHASE_INVALID_SAMPLE.</summary>
+    uint16_t samples[ADC_PHASE_BLOCK_SAMPLE_COUNT];
+} AdcPhaseBlock;
+INTERCORE_TYPED_MESSAGE(AdcPhaseBlock, 23, 1);
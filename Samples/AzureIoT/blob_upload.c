@@ -0,0 +1,100 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "applibs_versions.h"
+#include <applibs/log.h>
+
+#include "blob_upload.h"
+#include "storage_metrics.h"
+
+// The block which is being uploaded. The IoT Hub client uploads it before it asks for the next
+// one, so a single buffer is enough.
+static uint8_t chunkBuffer[BLOB_UPLOAD_CHUNK_SIZE];
+
+// State of the upload, which is passed to GetBlockCallback.
+typedef struct {
+    BlobUploadReadHandler readHandler;
+    void *context;
+    size_t bytesUploaded;
+    bool readFailed;
+    bool succeeded;
+} BlobUploadState;
+
+/// <summary>
+///     Called by the IoT Hub client for each block of the upload, and once more with data
+///     set to NULL when the upload has finished.
+/// </summary>
+static IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_RESULT GetBlockCallback(
+    IOTHUB_CLIENT_FILE_UPLOAD_RESULT result, unsigned char const **data, size_t *size,
+    void *context)
+{
+    BlobUploadState *state = context;
+    if (data == NULL || size == NULL) {
+        state->succeeded = (result == FILE_UPLOAD_OK);
+        return IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_OK;
+    }
+
+    if (result != FILE_UPLOAD_OK) {
+        return IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_ABORT;
+    }
+
+    ssize_t count = state->readHandler(chunkBuffer, sizeof(chunkBuffer), state->context);
+    if (count < 0) {
+        state->readFailed = true;
+        return IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_ABORT;
+    }
+
+    // A size of 0 tells the client that there are no more blocks.
+    *data = chunkBuffer;
+    *size = (size_t)count;
+    state->bytesUploaded += (size_t)count;
+    return IOTHUB_CLIENT_FILE_UPLOAD_GET_DATA_OK;
+}
+
+ssize_t BlobUpload_ReadFileRegion(uint8_t *buffer, size_t size, void *context)
+{
+    BlobUploadFileRegion *region = context;
+    size_t remaining = region->length - region->position;
+    if (size > remaining) {
+        size = remaining;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    ssize_t count = StorageMetrics_PRead(StorageFile_Mutable, region->fd, buffer, size,
+                                         region->offset + (off_t)region->position);
+    if (count < 0) {
+        Log_Debug("ERROR: Could not read the file to upload: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    region->position += (size_t)count;
+    return count;
+}
+
+int BlobUpload_Upload(IOTHUB_DEVICE_CLIENT_LL_HANDLE client, const char *destinationFileName,
+                      BlobUploadReadHandler readHandler, void *context, size_t *bytesUploaded)
+{
+    BlobUploadState state = {.readHandler = readHandler,
+                             .context = context,
+                             .bytesUploaded = 0,
+                             .readFailed = false,
+                             .succeeded = false};
+
+    IOTHUB_CLIENT_RESULT result = IoTHubDeviceClient_LL_UploadMultipleBlocksToBlob(
+        client, destinationFileName, &GetBlockCallback, &state);
+    *bytesUploaded = state.bytesUploaded;
+
+    if (result != IOTHUB_CLIENT_OK || !state.succeeded) {
+        Log_Debug("ERROR: Upload of '%s' failed after %zu bytes%s.\n", destinationFileName,
+                  state.bytesUploaded, state.readFailed ? ", because it could not be read" : "");
+        return -1;
+    }
+
+    return 0;
+}
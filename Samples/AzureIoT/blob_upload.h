@@ -0,0 +1,63 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <iothub_device_client_ll.h>
+
+/// <summary>Size of each block which is read and uploaded, in bytes. Only one block is held
+/// in memory at a time, however large the upload is.</summary>
+#define BLOB_UPLOAD_CHUNK_SIZE 4096
+
+/// <summary>
+///     Function which reads the next part of the data which is uploaded.
+/// </summary>
+/// <param name="buffer">Receives the data.</param>
+/// <param name="size">The size of the buffer, which is BLOB_UPLOAD_CHUNK_SIZE.</param>
+/// <param name="context">The context which was passed to <see cref="BlobUpload_Upload" />.
+/// </param>
+/// <returns>The number of bytes which were read, 0 at the end of the data, or -1 to abort the
+/// upload</returns>
+typedef ssize_t (*BlobUploadReadHandler)(uint8_t *buffer, size_t size, void *context);
+
+/// <summary>
+///     A region of a file, such as the mutable storage file, which
+///     <see cref="BlobUpload_ReadFileRegion" /> reads from start to end.
+/// </summary>
+typedef struct {
+    /// <summary>The file, which is not closed.</summary>
+    int fd;
+    /// <summary>Offset of the region in the file.</summary>
+    off_t offset;
+    /// <summary>Length of the region in bytes.</summary>
+    size_t length;
+    /// <summary>Number of bytes which have been read. Set this to 0 before the upload.
+    /// </summary>
+    size_t position;
+} BlobUploadFileRegion;
+
+/// <summary>
+///     Read handler which reads a <see cref="BlobUploadFileRegion" />, with pread, so that the
+///     file position and the other users of the file are not disturbed.
+/// </summary>
+/// <param name="context">The region.</param>
+ssize_t BlobUpload_ReadFileRegion(uint8_t *buffer, size_t size, void *context);
+
+/// <summary>
+///     Uploads data to a blob in the storage account which is associated with the IoT hub, in
+///     blocks of BLOB_UPLOAD_CHUNK_SIZE, without holding all of it in memory. The blob's host
+///     must be in the AllowedConnections of the application manifest.
+///     The IoT Hub client does not return until the upload has finished, so this blocks the
+///     caller for as long as the upload takes.
+/// </summary>
+/// <param name="client">The IoT Hub client, which must be connected.</param>
+/// <param name="destinationFileName">Name of the blob.</param>
+/// <param name="readHandler">Function which reads each block.</param>
+/// <param name="context">Value which is passed to readHandler.</param>
+/// <param name="bytesUploaded">Receives the number of bytes which were uploaded.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int BlobUpload_Upload(IOTHUB_DEVICE_CLIENT_LL_HANDLE client, const char *destinationFileName,
+                      BlobUploadReadHandler readHandler, void *context, size_t *bytesUploaded);
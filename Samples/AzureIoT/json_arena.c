@@ -0,0 +1,107 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdalign.h>
+#include <stdint.h>
+
+#include <applibs/log.h>
+
+#include "json_arena.h"
+#include "memory_metrics.h"
+
+// The arenas which have been initialized, and the one which is being parsed into, if any.
+static JsonArena *arenas = NULL;
+static JsonArena *activeArena = NULL;
+
+// Tag of parson's allocations outside an arena.
+static MemoryTag parsonMemoryTag = MemoryTag_Other;
+
+/// <summary>
+///     Allocates from the arena which is being parsed into, or from the heap outside a parse.
+/// </summary>
+static void *ArenaMalloc(size_t size)
+{
+    if (activeArena == NULL) {
+        return MemoryMetrics_Malloc(parsonMemoryTag, size);
+    }
+
+    const size_t alignment = alignof(max_align_t);
+    size_t start = (activeArena->used + alignment - 1) & ~(alignment - 1);
+    if (start > activeArena->size || size > activeArena->size - start) {
+        ++activeArena->failedAllocations;
+        return NULL;
+    }
+
+    activeArena->used = start + size;
+    if (activeArena->used > activeArena->peakUsed) {
+        activeArena->peakUsed = activeArena->used;
+    }
+    return activeArena->buffer + start;
+}
+
+/// <summary>
+///     Does nothing for memory in an arena, which is released with the rest of the arena, and
+///     frees any other memory.
+/// </summary>
+static void ArenaFree(void *pointer)
+{
+    uintptr_t address = (uintptr_t)pointer;
+    for (const JsonArena *arena = arenas; arena != NULL; arena = arena->next) {
+        uintptr_t start = (uintptr_t)arena->buffer;
+        if (address >= start && address < start + arena->size) {
+            return;
+        }
+    }
+    MemoryMetrics_Free(pointer);
+}
+
+void JsonArena_Install(void)
+{
+    parsonMemoryTag = MemoryMetrics_AddTag("parson");
+    json_set_allocation_functions(ArenaMalloc, ArenaFree);
+}
+
+void JsonArena_Init(JsonArena *arena, void *buffer, size_t size)
+{
+    arena->buffer = buffer;
+    arena->size = size;
+    arena->used = 0;
+    arena->peakUsed = 0;
+    arena->failedAllocations = 0;
+    arena->next = arenas;
+    arenas = arena;
+}
+
+JSON_Value *JsonArena_Parse(JsonArena *arena, const char *json, size_t length)
+{
+    JsonArena_Reset(arena);
+
+    activeArena = arena;
+    JSON_Value *value = json_parse_buffer(json, length);
+    activeArena = NULL;
+
+    if (value == NULL && arena->failedAllocations > 0) {
+        Log_Debug("ERROR: JSON document does not fit in its arena of %zu bytes.\n", arena->size);
+    }
+    return value;
+}
+
+void JsonArena_Reset(JsonArena *arena)
+{
+    arena->used = 0;
+}
+
+void JsonArena_Close(JsonArena *arena)
+{
+    for (JsonArena **link = &arenas; *link != NULL; link = &(*link)->next) {
+        if (*link == arena) {
+            *link = arena->next;
+            break;
+        }
+    }
+
+    arena->buffer = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    arena->next = NULL;
+}
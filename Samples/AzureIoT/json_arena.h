@@ -0,0 +1,77 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stddef.h>
+
+#include "parson.h"
+
+/// <summary>
+/// <para>A bump-pointer arena for the values which parson builds while it parses a document.
+/// Each allocation takes the next aligned bytes of a buffer which the caller owns, and the whole
+/// document is released at once by <see cref="JsonArena_Reset" />, rather than by freeing each
+/// value, key and array one by one. Parsing a document therefore does not fragment the heap of a
+/// long-running device.</para>
+/// <para>Arena allocation is hooked into parson through json_set_allocation_functions, by
+/// <see cref="JsonArena_Install" />. Values which are not parsed into an arena are still
+/// allocated from the heap, through MemoryMetrics with the "parson" tag, so both kinds can be
+/// used together, and json_value_free can be called on either: it does nothing for a value in an
+/// arena.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="JsonArena_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct JsonArena {
+    unsigned char *buffer;
+    size_t size;
+    /// <summary>Number of bytes of the buffer which are in use.</summary>
+    size_t used;
+    /// <summary>Most bytes which were in use at once, which shows how large the buffer
+    /// needs to be.</summary>
+    size_t peakUsed;
+    /// <summary>Number of allocations which failed because the buffer was full.</summary>
+    size_t failedAllocations;
+    /// <summary>The next arena which has been initialized.</summary>
+    struct JsonArena *next;
+} JsonArena;
+
+/// <summary>
+///     Makes parson allocate from an arena while <see cref="JsonArena_Parse" /> runs, and from
+///     the heap otherwise. Call this once, before any other parson function.
+/// </summary>
+void JsonArena_Install(void);
+
+/// <summary>
+///     Initializes an arena.
+/// </summary>
+/// <param name="arena">Arena to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="buffer">Memory from which values are allocated. parson reserves room for
+/// several members in each object and array, so a document can take tens of times the length
+/// of its JSON text; peakUsed shows how much was needed. It must remain valid until the arena
+/// is closed.</param>
+/// <param name="size">The size of the buffer.</param>
+void JsonArena_Init(JsonArena *arena, void *buffer, size_t size);
+
+/// <summary>
+///     Releases the values in an arena, and parses a document into it.
+/// </summary>
+/// <param name="arena">The arena.</param>
+/// <param name="json">The JSON text, which need not be null-terminated.</param>
+/// <param name="length">The length of the text.</param>
+/// <returns>The value, which is valid until the arena is reset or closed, or NULL if the text
+/// is not valid JSON or the arena is too small. It should not be modified, because what it
+/// allocates afterwards is not in the arena and is not released with it.</returns>
+JSON_Value *JsonArena_Parse(JsonArena *arena, const char *json, size_t length);
+
+/// <summary>
+///     Releases all the values in an arena at once.
+/// </summary>
+/// <param name="arena">The arena.</param>
+void JsonArena_Reset(JsonArena *arena);
+
+/// <summary>
+///     Releases the values in an arena, and stops using its buffer. It is safe to call this
+///     function on an arena which has been zero-initialized.
+/// </summary>
+/// <param name="arena">The arena.</param>
+void JsonArena_Close(JsonArena *arena);
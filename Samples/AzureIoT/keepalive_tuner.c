@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "keepalive_tuner.h"
+
+// Number of intervals for which a connection must stay open before its interval is confirmed.
+static const int confirmIntervals = 3;
+
+// The search stops once the longest confirmed interval and the shortest failed one are this
+// many seconds apart, or a tenth of the confirmed interval, whichever is more.
+static const int minStepSeconds = 5;
+
+static int Clamp(const KeepAliveTuner *tuner, int seconds)
+{
+    if (seconds < tuner->minSeconds) {
+        return tuner->minSeconds;
+    }
+    if (seconds > tuner->maxSeconds) {
+        return tuner->maxSeconds;
+    }
+    return seconds;
+}
+
+void KeepAliveTuner_Init(KeepAliveTuner *tuner, int minSeconds, int maxSeconds)
+{
+    memset(tuner, 0, sizeof(*tuner));
+    tuner->minSeconds = minSeconds;
+    tuner->maxSeconds = maxSeconds;
+    tuner->confirmedSeconds = minSeconds;
+    tuner->currentSeconds = minSeconds;
+}
+
+void KeepAliveTuner_Restore(KeepAliveTuner *tuner, int confirmedSeconds, int ceilingSeconds)
+{
+    tuner->confirmedSeconds = Clamp(tuner, confirmedSeconds);
+    tuner->ceilingSeconds =
+        (ceilingSeconds > tuner->confirmedSeconds && ceilingSeconds <= tuner->maxSeconds)
+            ? ceilingSeconds
+            : 0;
+}
+
+int KeepAliveTuner_NextInterval(KeepAliveTuner *tuner)
+{
+    int confirmed = tuner->confirmedSeconds;
+    int probe;
+    if (tuner->ceilingSeconds == 0) {
+        probe = confirmed < tuner->maxSeconds / 2 ? confirmed * 2 : tuner->maxSeconds;
+    } else {
+        probe = confirmed + (tuner->ceilingSeconds - confirmed) / 2;
+    }
+
+    int step = confirmed / 10 > minStepSeconds ? confirmed / 10 : minStepSeconds;
+    if (probe - confirmed < step) {
+        probe = confirmed;
+    }
+
+    tuner->currentSeconds = Clamp(tuner, probe);
+    return tuner->currentSeconds;
+}
+
+void KeepAliveTuner_OnConnected(KeepAliveTuner *tuner, const struct timespec *now)
+{
+    tuner->connected = true;
+    tuner->connectedTime = *now;
+}
+
+bool KeepAliveTuner_Check(KeepAliveTuner *tuner, const struct timespec *now)
+{
+    if (!tuner->connected || tuner->currentSeconds <= tuner->confirmedSeconds) {
+        return false;
+    }
+
+    time_t openSeconds = now->tv_sec - tuner->connectedTime.tv_sec;
+    if (openSeconds < (time_t)confirmIntervals * tuner->currentSeconds) {
+        return false;
+    }
+
+    tuner->confirmedSeconds = tuner->currentSeconds;
+    return true;
+}
+
+bool KeepAliveTuner_OnDisconnected(KeepAliveTuner *tuner, bool communicationError,
+                                   const struct timespec *now)
+{
+    if (!tuner->connected) {
+        return false;
+    }
+    tuner->connected = false;
+
+    // A connection which is lost before it was idle for a whole interval says nothing about
+    // the interval.
+    time_t openSeconds = now->tv_sec - tuner->connectedTime.tv_sec;
+    if (!communicationError || openSeconds < tuner->currentSeconds) {
+        return false;
+    }
+
+    if (tuner->currentSeconds > tuner->confirmedSeconds) {
+        tuner->ceilingSeconds = tuner->currentSeconds;
+    } else {
+        // If even the shortest interval failed, the connection was lost for another reason,
+        // and the tuner stays there rather than trying longer intervals again.
+        int failedSeconds = tuner->confirmedSeconds;
+        tuner->confirmedSeconds = Clamp(tuner, failedSeconds / 2);
+        tuner->ceilingSeconds =
+            failedSeconds > tuner->confirmedSeconds ? failedSeconds : tuner->confirmedSeconds + 1;
+    }
+    return true;
+}
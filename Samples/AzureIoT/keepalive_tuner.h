@@ -0,0 +1,91 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/// <summary>
+/// <para>Finds the longest MQTT keep-alive interval which keeps the connection to IoT Hub open
+/// on the current network. A NAT on a cellular link may drop an idle mapping within a minute,
+/// while a stable Ethernet link keeps it for much longer, where a long keep-alive saves radio
+/// power and traffic.</para>
+/// <para>The tuner starts from the shortest interval. Once a connection has stayed open for
+/// several intervals, the interval is confirmed, and the next connection tries a longer one:
+/// twice as long until an interval fails, then halfway between the longest confirmed interval
+/// and the shortest which failed. An interval fails when the connection is lost with a
+/// communication error after it has been open for at least one interval. If the confirmed
+/// interval itself fails, the network has changed, so the tuner falls back to half of it.</para>
+/// <para>The keep-alive only takes effect when the client connects, so the interval is chosen
+/// once per connection. Times are given by the caller from CLOCK_MONOTONIC.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="KeepAliveTuner_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    int minSeconds;
+    int maxSeconds;
+    /// <summary>Longest interval which is known to keep the connection open.</summary>
+    int confirmedSeconds;
+    /// <summary>Shortest interval which is known to lose the connection, or 0 if none
+    /// is.</summary>
+    int ceilingSeconds;
+    /// <summary>Interval of the current or last connection.</summary>
+    int currentSeconds;
+    /// <summary>Whether the client is connected, and since when.</summary>
+    bool connected;
+    struct timespec connectedTime;
+} KeepAliveTuner;
+
+/// <summary>
+///     Initializes a tuner, which starts from the shortest interval.
+/// </summary>
+/// <param name="tuner">Tuner to initialize.</param>
+/// <param name="minSeconds">Shortest interval.</param>
+/// <param name="maxSeconds">Longest interval.</param>
+void KeepAliveTuner_Init(KeepAliveTuner *tuner, int minSeconds, int maxSeconds);
+
+/// <summary>
+///     Restores what was learned about a network, such as from mutable storage.
+/// </summary>
+/// <param name="tuner">The tuner.</param>
+/// <param name="confirmedSeconds">The longest interval which was confirmed.</param>
+/// <param name="ceilingSeconds">The shortest interval which failed, or 0.</param>
+void KeepAliveTuner_Restore(KeepAliveTuner *tuner, int confirmedSeconds, int ceilingSeconds);
+
+/// <summary>
+///     Chooses the interval for the next connection.
+/// </summary>
+/// <param name="tuner">The tuner.</param>
+/// <returns>The interval, in seconds</returns>
+int KeepAliveTuner_NextInterval(KeepAliveTuner *tuner);
+
+/// <summary>
+///     Records that the client connected with the interval which was chosen last.
+/// </summary>
+/// <param name="tuner">The tuner.</param>
+/// <param name="now">The current time.</param>
+void KeepAliveTuner_OnConnected(KeepAliveTuner *tuner, const struct timespec *now);
+
+/// <summary>
+///     Confirms the interval of the current connection once it has stayed open long enough.
+///     Call this periodically while the client is connected.
+/// </summary>
+/// <param name="tuner">The tuner.</param>
+/// <param name="now">The current time.</param>
+/// <returns>true if the interval was confirmed by this call, so what was learned should be
+/// saved; false otherwise</returns>
+bool KeepAliveTuner_Check(KeepAliveTuner *tuner, const struct timespec *now);
+
+/// <summary>
+///     Records that the connection was lost.
+/// </summary>
+/// <param name="tuner">The tuner.</param>
+/// <param name="communicationError">Whether it was lost with a communication error, which a
+/// keep-alive that is too long for the network causes, rather than for another reason, such
+/// as an expired SAS token.</param>
+/// <param name="now">The current time.</param>
+/// <returns>true if the interval was found to fail, so what was learned should be saved; false
+/// otherwise</returns>
+bool KeepAliveTuner_OnDisconnected(KeepAliveTuner *tuner, bool communicationError,
+                                   const struct timespec *now);
@@ -29,6 +29,7 @@
 #include <applibs/networking.h>
 #include <applibs/gpio.h>
 #include <applibs/storage.h>
+#include <applibs/wificonfig.h>
 
 // By default, this sample's CMake build targets hardware that follows the MT3620
 // Reference Development Board (RDB) specification, such as the MT3620 Dev Kit from
@@ -43,7 +44,23 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+#include "app_log.h"
+#include "blob_upload.h"
+#include "change_filter.h"
 #include "epoll_timerfd_utilities.h"
+#include "input_manager.h"
+#include "keepalive_tuner.h"
+#include "kv_store.h"
+#include "memory_metrics.h"
+#include "metrics.h"
+#include "metrics_exporter.h"
+#include "network_monitor.h"
+#include "perf_profile.h"
+#include "shutdown_coordinator.h"
+#include "startup_sequence.h"
+#include "storage_metrics.h"
+#include "telemetry_batcher.h"
+#include "telemetry_store.h"
 
 // Azure IoT SDK
 #include <iothub_client_core_common.h>
@@ -55,7 +72,8 @@
 
 static volatile sig_atomic_t terminationRequired = false;
 
-#include "parson.h" // used to parse Device Twin messages.
+#include "reconnect_manager.h"
+#include "twin_dispatcher.h" // used to parse Device Twin messages.
 
 // Azure IoT Hub/Central defines.
 #define SCOPEID_LENGTH 20
@@ -63,25 +81,64 @@ static char scopeId[SCOPEID_LENGTH]; // ScopeId for the Azure IoT Central applic
                                      // app_manifest.json, CmdArgs
 
 static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
-static const int keepalivePeriodSeconds = 20;
 static bool iothubAuthenticated = false;
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
 static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                          size_t payloadSize, void *userContextCallback);
-static void TwinReportBoolState(const char *propertyName, bool propertyValue);
+static void TwinReportBoolState(const char *propertyName, bool propertyValue,
+                                ChangeFilter *filter);
+static void SendReportedProperties(void);
 static void ReportStatusCallback(int result, void *context);
+static void StatusLedTwinHandler(const TwinValue *value, void *context);
+static void UploadStorageTwinHandler(const TwinValue *value, void *context);
+static void PerformanceProfileTwinHandler(const TwinValue *value, void *context);
+static void PerformanceProfileChangedHandler(const PerfProfile *profile,
+                                             const PerfProfile *previous, void *context);
+static void ReportPerformanceProfile(void);
+static bool PeriodEquals(const struct timespec *a, const struct timespec *b);
+static bool IsZeroPeriod(const struct timespec *period);
+static void UploadStorageIfRequested(void);
 static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
 static const char *getAzureSphereProvisioningResultString(
     AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
-static void SendTelemetry(const unsigned char *key, const unsigned char *value);
+static bool SendTelemetryBatch(TelemetryBatcher *batcher, const char *message, size_t length,
+                               void *context);
 static void SetupAzureClient(void);
+static void ScheduleReconnect(ReconnectReason reason);
+static uint32_t GetReconnectSeed(void);
 
 // Function to generate simulated Temperature data/telemetry
 static void SendSimulatedTemperature(void);
+static void SendStoredTelemetry(void);
+
+// Scheduling of IoTHubDeviceClient_LL_DoWork
+static void ScheduleDoWork(bool busy);
+static void BeginClientOperation(void);
+static void EndClientOperation(void);
 
 // Initialization/Cleanup
 static int InitPeripheralsAndHandlers(void);
 static void ClosePeripheralsAndHandlers(void);
+static StartupStepResult OpenGpiosStepHandler(StartupStep *step);
+static StartupStepResult InitHandlersStepHandler(StartupStep *step);
+static StartupStepResult OpenTelemetryStoreStepHandler(StartupStep *step);
+static StartupStepResult OpenKeepAliveStoreStepHandler(StartupStep *step);
+static void StartupFinishedHandler(StartupSequence *sequence, int result);
+
+// The application is ready once the GPIOs are open and the handlers are set up, which the
+// startup trace times. The telemetry store, which reads its ring from mutable storage, is opened
+// in the background after that, or as soon as a reading has to be stored.
+static StartupSequence startupSequence;
+static StartupStep openGpiosStep = {
+    .name = "GPIOs", .handler = &OpenGpiosStepHandler, .isCritical = true};
+static StartupStep initHandlersStep = {.name = "Handlers",
+                                       .handler = &InitHandlersStepHandler,
+                                       .isCritical = true,
+                                       .after = &openGpiosStep};
+static StartupStep telemetryStoreStep = {.name = "TelemetryStore",
+                                         .handler = &OpenTelemetryStoreStepHandler};
+static StartupStep keepAliveStoreStep = {.name = "KeepAliveStore",
+                                         .handler = &OpenKeepAliveStoreStepHandler};
 
 // File descriptors - initialized to invalid value
 // Buttons
@@ -91,29 +148,195 @@ static int sendOrientationButtonGpioFd = -1;
 // LED
 static int deviceTwinStatusLedGpioFd = -1;
 static bool statusLedOn = false;
+// The LED state is reported only when it changes. The filter is reset when a report is
+// rejected, so that the next one is sent.
+static ChangeFilter statusLedReportFilter;
+static const ChangeFilterConfig statusLedReportFilterConfig = {0};
+
+// Device Twin desired properties, and the handlers which apply them.
+static TwinDispatcher twinDispatcher;
+static const TwinProperty twinProperties[] = {
+    {.path = "StatusLED.value", .handler = &StatusLedTwinHandler, .context = NULL},
+    {.path = "UploadStorage.value", .handler = &UploadStorageTwinHandler, .context = NULL},
+    {.path = "PerformanceProfile", .handler = &PerformanceProfileTwinHandler, .context = NULL}};
+// Whether the update which is being dispatched is the complete twin, rather than a patch of the
+// desired properties which changed.
+static bool twinUpdateIsComplete = false;
+
+// The periods of the event loop, the telemetry batch and the temperature sampling come from the
+// active performance profile, which starts as PERF_PROFILE_DEFAULT. The 'PerformanceProfile'
+// desired property switches it while the application runs, such as
+// {"value": "LowPower", "overrides": {"TelemetryFlushMs": 120000}}, and the name of the active
+// profile is reported back.
+static PerfProfileManager perfProfileManager;
+
+// The profile which a 'PerformanceProfile' update selects, while its members are read.
+typedef struct {
+    PerfProfileSelection selection;
+    bool isValid;
+} PerformanceProfileUpdate;
+
+// Setting the 'UploadStorage' desired property to a new positive number uploads the readings
+// in mutable storage to a blob in the storage account which is linked to the IoT hub. The blob
+// is read from the file and uploaded one block at a time, so the upload takes the same memory
+// however large the file is. The number of the last upload is reported back once it is done.
+static uint32_t requestedStorageUpload = 0;
+static uint32_t completedStorageUpload = 0;
 
 // Timer / polling
-static int buttonPollTimerFd = -1;
+static InputManager inputManager;
 static int azureTimerFd = -1;
+static int telemetryTimerFd = -1;
+static int doWorkTimerFd = -1;
 static int epollFd = -1;
 
-// Azure IoT poll periods
-static const int AzureIoTDefaultPollPeriodSeconds = 5;
+// Azure IoT poll periods. The connection is checked every poll period and when the network
+// becomes ready, and the reconnect manager decides when the next attempt to connect is due.
+static const struct timespec azureIoTPollPeriod = {5, 0};
 static const int AzureIoTMinReconnectPeriodSeconds = 60;
 static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60;
 
-static int azureIoTPollPeriodSeconds = -1;
-
-// Button state variables
-static GPIO_Value_Type sendMessageButtonState = GPIO_Value_High;
-static GPIO_Value_Type sendOrientationButtonState = GPIO_Value_High;
-
-static void ButtonPollTimerEventHandler(EventData *eventData);
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState);
-static void SendMessageButtonHandler(void);
-static void SendOrientationButtonHandler(void);
+static ReconnectManager reconnectManager;
+
+// Detects when the device has internet connectivity, so that it connects to IoT Hub at once
+// rather than at the next poll, and checks less often while nothing changes.
+static NetworkMonitor networkMonitor;
+static const NetworkMonitorConfig networkMonitorConfig = {.interfaceName = NULL,
+                                                          .minInterval = {0, 100 * 1000 * 1000},
+                                                          .waitingInterval = {2, 0},
+                                                          .readyInterval = {30, 0}};
+
+// The temperature moves slowly, so a reading is only added to the batch or the store when it
+// has moved by at least half a degree since the last one which was, and at least every five
+// minutes, so that the cloud can still tell that the device is sampling it.
+static ChangeFilter temperatureFilter;
+static const ChangeFilterConfig temperatureFilterConfig = {
+    .absoluteDeadband = 0.5, .minInterval = {0, 0}, .maxInterval = {5 * 60, 0}};
+
+// IoTHubDeviceClient_LL_DoWork is called on its own timer, rather than once per telemetry
+// period, so that acknowledgements, twin updates and cloud-to-device messages are not held up.
+// It is called every doWorkBusyPeriod while messages or reported properties are waiting for
+// IoT Hub, or while callbacks are being invoked, and the period doubles up to
+// doWorkMaxIdlePeriod while the client is idle. These are the busy and idle poll periods of the
+// event loop in the performance profile.
+static struct timespec doWorkBusyPeriod;
+static struct timespec doWorkMaxIdlePeriod;
+static struct timespec doWorkPeriod;
+// Number of messages and reported properties which IoT Hub has not confirmed yet.
+static unsigned int outstandingClientOperations = 0;
+// Whether a callback was invoked during the last call to IoTHubDeviceClient_LL_DoWork.
+static bool clientCallbackInvoked = false;
+
+// Telemetry is collected from all the sources and sent as one message a minute, with the
+// simulated temperature summarized over the minute, rather than as one message per reading.
+// The messages are JSON, which IoT Central and IoT Hub message routing understand. Set the
+// encoding to TelemetryEncoding_Cbor to send about a third of the bytes to a backend which
+// decodes CBOR with the same schema of field IDs. The flush period and the aggregation are set
+// from the performance profile.
+static TelemetryBatcher telemetryBatcher;
+static char telemetryBuffer[1024];
+static const TelemetryField telemetrySchema[] = {
+    {.key = "Temperature", .id = 1},
+    {.key = "ButtonPress", .id = 2},
+    {.key = "Orientation", .id = 3}};
+static TelemetryBatcherConfig telemetryBatcherConfig = {
+    .buffer = telemetryBuffer,
+    .bufferSize = sizeof(telemetryBuffer),
+    .encoding = TelemetryEncoding_Json,
+    .fields = telemetrySchema,
+    .fieldCount = sizeof(telemetrySchema) / sizeof(telemetrySchema[0])};
+
+// System properties of the telemetry messages, indexed by the encoding of the batch. The body is
+// marked as JSON, so that IoT Hub message routing can query it, or as CBOR, so that the backend
+// knows to decode it. A content encoding of NULL is not set.
+typedef struct {
+    const char *contentType;
+    const char *contentEncoding;
+} TelemetryMessageShape;
+static const TelemetryMessageShape telemetryMessageShapes[] = {
+    [TelemetryEncoding_Json] = {.contentType = "application%2fjson", .contentEncoding = "utf-8"},
+    [TelemetryEncoding_Cbor] = {.contentType = "application%2fcbor", .contentEncoding = NULL}};
+
+// The application's own metrics, whose changes are added to the telemetry batch every five
+// minutes, so that its performance can be compared across devices. The counters and the
+// histogram are updated where the events happen; the metrics which other modules keep are
+// copied from their snapshots before each export.
+static MetricsExporter metricsExporter;
+static const struct timespec metricsExportPeriod = {5 * 60, 0};
+static MetricCounter telemetryMessagesMetric = METRIC_COUNTER_INIT("TelemetryMsgs");
+static MetricCounter telemetryFailuresMetric = METRIC_COUNTER_INIT("TelemetryFails");
+static MetricCounter droppedReadingsMetric = METRIC_COUNTER_INIT("DroppedReadings");
+static MetricCounter filteredReadingsMetric = METRIC_COUNTER_INIT("FilteredReadings");
+static MetricCounter twinUpdatesMetric = METRIC_COUNTER_INIT("TwinUpdates");
+static MetricCounter flashWritesMetric = METRIC_COUNTER_INIT("FlashWrites");
+static MetricCounter flashWriteBytesMetric = METRIC_COUNTER_INIT("FlashWriteBytes");
+static MetricGauge heapBytesMetric = METRIC_GAUGE_INIT("HeapBytes");
+static MetricGauge heapPeakMetric = METRIC_GAUGE_INIT("HeapPeak");
+static MetricGauge stackPeakMetric = METRIC_GAUGE_INIT("StackPeak");
+static MetricHistogram batchBytesMetric = METRIC_HISTOGRAM_INIT("BatchBytes", 128, 256, 512);
+static Metric *const registeredMetrics[] = {
+    &telemetryMessagesMetric.metric, &telemetryFailuresMetric.metric,
+    &droppedReadingsMetric.metric,   &filteredReadingsMetric.metric,
+    &twinUpdatesMetric.metric,       &flashWritesMetric.metric,
+    &flashWriteBytesMetric.metric,   &heapBytesMetric.metric,
+    &heapPeakMetric.metric,          &stackPeakMetric.metric,
+    &batchBytesMetric.metric};
+static void CollectMetrics(MetricsExporter *exporter, void *context);
+
+// Readings which are taken while the device is not connected to IoT Hub are kept in a ring in
+// mutable storage, and sent in batches once it connects again. The 32 KB ring holds about two
+// thousand readings, which is nearly three hours of simulated temperatures.
+static TelemetryStore telemetryStore;
+static bool telemetryStoreOpen = false;
+static const size_t telemetryStoreSize = 32 * 1024;
+// Number of stored readings which are sent in each message, and number of messages which are
+// sent each time IoTHubDeviceClient_LL_DoWork is called, so that the SDK's queue stays short.
+#define STORED_READINGS_PER_MESSAGE 16
+static const int storedTelemetryMessagesPerDoWork = 4;
+
+// Keys of the stored readings, which are indexed by their key ID.
+typedef enum { StoredTelemetryKey_Temperature, StoredTelemetryKey_Count } StoredTelemetryKey;
+static const char *const storedTelemetryKeys[StoredTelemetryKey_Count] = {"Temperature"};
+
+// The MQTT keep-alive is tuned for each network, from 20 seconds up to 20 minutes, and what is
+// learned is kept in a key-value store in mutable storage after the telemetry store, under a key
+// for the Wi-Fi network which the device is connected to.
+static KeepAliveTuner keepAliveTuner;
+static const int keepAliveMinSeconds = 20;
+static const int keepAliveMaxSeconds = 20 * 60;
+static char keepAliveNetworkKey[KV_STORE_MAX_KEY_LENGTH + 1] = "";
+static KvStore keepAliveStore;
+static bool keepAliveStoreOpen = false;
+#define KEEP_ALIVE_STORE_SIZE (4 * 1024)
+static uint8_t keepAliveStoreBuffer[KV_STORE_MAX_RECORD_SIZE];
+
+// What was learned about the keep-alive on one network, as it is stored.
+#define STORED_KEEP_ALIVE_VERSION 1
+typedef struct {
+    uint8_t version;
+    uint8_t reserved[3];
+    int32_t confirmedSeconds;
+    int32_t ceilingSeconds;
+} StoredKeepAlive;
+static void LoadKeepAlive(void);
+static void SaveKeepAlive(void);
+
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error);
+static void SendMessageButtonHandler(InputManagerInput *input, bool isPressed);
+static void SendOrientationButtonHandler(InputManagerInput *input, bool isPressed);
 static bool deviceIsUp = false; // Orientation
 static void AzureTimerEventHandler(EventData *eventData);
+static void ConnectIfDue(void);
+static void TelemetryTimerEventHandler(EventData *eventData);
+static void DoWorkTimerEventHandler(EventData *eventData);
+static bool TelemetryShutdownHook(ShutdownHook *hook);
+
+// When the application is asked to exit, the readings which are waiting in the batch are sent,
+// and the event loop keeps running until IoT Hub has confirmed the messages.
+static ShutdownCoordinator shutdownCoordinator;
+static const struct timespec shutdownGracePeriod = {SHUTDOWN_GRACE_PERIOD_SECONDS - 2, 0};
+static ShutdownHook telemetryShutdownHook = {
+    .name = "Telemetry", .handler = &TelemetryShutdownHook, .deadline = {7, 0}};
 
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
@@ -129,6 +352,8 @@ static void TerminationHandler(int signalNumber)
 /// </summary>
 int main(int argc, char *argv[])
 {
+    MemoryMetrics_PaintStack(16 * 1024);
+
     Log_Debug("IoT Hub/Central Application starting.\n");
 
     if (argc == 2) {
@@ -141,15 +366,22 @@ int main(int argc, char *argv[])
 
     if (InitPeripheralsAndHandlers() != 0) {
         terminationRequired = true;
+    } else {
+        // From here on, the memory metrics count the heap allocations of each module, or
+        // reject them in the static-allocation build.
+        MemoryMetrics_EndInit();
     }
 
     // Main loop
     while (!terminationRequired) {
-        if (WaitForEventAndCallHandler(epollFd) != 0) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
             terminationRequired = true;
         }
     }
 
+    ShutdownCoordinator_Drain(&shutdownCoordinator, epollFd);
+
     ClosePeripheralsAndHandlers();
 
     Log_Debug("Application exiting.\n");
@@ -158,49 +390,158 @@ int main(int argc, char *argv[])
 }
 
 /// <summary>
-/// Button timer event:  Check the status of buttons A and B
+/// The input manager could not read button A or B, so exit.
+/// </summary>
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error)
+{
+    terminationRequired = true;
+}
+
+/// <summary>
+/// Azure timer event:  Check connection status, and connect to IoT Hub if necessary
 /// </summary>
-static void ButtonPollTimerEventHandler(EventData *eventData)
+static void AzureTimerEventHandler(EventData *eventData)
 {
-    if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0) {
+    if (ConsumeTimerFdEvent(azureTimerFd) != 0) {
         terminationRequired = true;
         return;
     }
-    SendMessageButtonHandler();
-    SendOrientationButtonHandler();
+
+    // Keep the keep-alive interval once the connection has stayed open with it for long enough
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (KeepAliveTuner_Check(&keepAliveTuner, &now)) {
+        Log_Debug("INFO: Keep-alive of %d seconds confirmed.\n", keepAliveTuner.confirmedSeconds);
+        SaveKeepAlive();
+    }
+
+    ConnectIfDue();
 }
 
 /// <summary>
-/// Azure timer event:  Check connection status and send telemetry
+/// Connects to IoT Hub if the network is ready and the reconnect backoff allows
 /// </summary>
-static void AzureTimerEventHandler(EventData *eventData)
+static void ConnectIfDue(void)
 {
-    if (ConsumeTimerFdEvent(azureTimerFd) != 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // Creating the client blocks while the device is provisioned, so it is only attempted
+    // when the backoff allows.
+    if (NetworkMonitor_IsReady(&networkMonitor) && !iothubAuthenticated &&
+        ReconnectManager_IsDue(&reconnectManager, &now)) {
+        SetupAzureClient();
+    }
+}
+
+/// <summary>
+/// Network state change:  Connect to IoT Hub as soon as the network is ready
+/// </summary>
+static void NetworkStateHandler(NetworkMonitor *monitor, uint32_t events,
+                                const NetworkMonitorState *state, void *context)
+{
+    if (events & NetworkMonitorEvent_Up) {
+        ConnectIfDue();
+    }
+}
+
+/// <summary>
+/// Telemetry timer event:  Add a simulated temperature reading to the telemetry batch
+/// </summary>
+static void TelemetryTimerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(telemetryTimerFd) != 0) {
         terminationRequired = true;
         return;
     }
 
-    bool isNetworkReady = false;
-    if (Networking_IsNetworkingReady(&isNetworkReady) != -1) {
-        if (isNetworkReady && !iothubAuthenticated) {
-            SetupAzureClient();
-        }
+    // The batch keeps the readings until the device is connected.
+    SendSimulatedTemperature();
+}
+
+/// <summary>
+/// DoWork timer event:  Let the IoT Hub client send and receive, then schedule the next call
+/// </summary>
+static void DoWorkTimerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(doWorkTimerFd) != 0) {
+        terminationRequired = true;
+        return;
+    }
+
+    // The timer is started again when the client is set up.
+    if (!iothubAuthenticated) {
+        return;
+    }
+
+    // The reported properties which were set since the last call are sent together.
+    SendReportedProperties();
+
+    clientCallbackInvoked = false;
+    IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    SendStoredTelemetry();
+    UploadStorageIfRequested();
+    ScheduleDoWork(outstandingClientOperations > 0 || clientCallbackInvoked);
+}
+
+/// <summary>
+///     Schedules the next call to IoTHubDeviceClient_LL_DoWork.
+/// </summary>
+/// <param name="busy">true if the client has work in hand, so it should be called soon;
+/// false to back off</param>
+static void ScheduleDoWork(bool busy)
+{
+    if (busy) {
+        doWorkPeriod = doWorkBusyPeriod;
     } else {
-        Log_Debug("Failed to get Network state\n");
+        doWorkPeriod.tv_sec *= 2;
+        doWorkPeriod.tv_nsec *= 2;
+        if (doWorkPeriod.tv_nsec >= 1000 * 1000 * 1000) {
+            doWorkPeriod.tv_sec += doWorkPeriod.tv_nsec / (1000 * 1000 * 1000);
+            doWorkPeriod.tv_nsec %= 1000 * 1000 * 1000;
+        }
+        if (doWorkPeriod.tv_sec >= doWorkMaxIdlePeriod.tv_sec) {
+            doWorkPeriod = doWorkMaxIdlePeriod;
+        }
     }
 
-    if (iothubAuthenticated) {
-        SendSimulatedTemperature();
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    SetTimerFdToSingleExpiry(doWorkTimerFd, &doWorkPeriod);
+}
+
+/// <summary>
+///     Records that a message or reported property was handed to the IoT Hub client, so that
+///     it is sent without waiting for the client to come out of its idle backoff.
+/// </summary>
+static void BeginClientOperation(void)
+{
+    ++outstandingClientOperations;
+    ScheduleDoWork(true);
+}
+
+/// <summary>
+///     Records that IoT Hub confirmed, or the client gave up on, a message or reported property.
+/// </summary>
+static void EndClientOperation(void)
+{
+    clientCallbackInvoked = true;
+    if (outstandingClientOperations > 0) {
+        --outstandingClientOperations;
     }
 }
 
 // event handler data structures. Only the event handler field needs to be populated.
-static EventData buttonPollEventData = {.eventHandler = &ButtonPollTimerEventHandler};
 static EventData azureEventData = {.eventHandler = &AzureTimerEventHandler};
+static EventData telemetryEventData = {.eventHandler = &TelemetryTimerEventHandler};
+static EventData doWorkEventData = {.eventHandler = &DoWorkTimerEventHandler};
+
+// Buttons A and B read low when they are pressed.
+static InputManagerInput sendMessageButton = {.activeValue = GPIO_Value_Low,
+                                              .changedHandler = &SendMessageButtonHandler};
+static InputManagerInput sendOrientationButton = {.activeValue = GPIO_Value_Low,
+                                                  .changedHandler = &SendOrientationButtonHandler};
 
 /// <summary>
-///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
+///     Set up SIGTERM termination handler, and start the steps which initialize the peripherals
+///     and event handlers.
 /// </summary>
 /// <returns>0 on success, or -1 on failure</returns>
 static int InitPeripheralsAndHandlers(void)
@@ -210,17 +551,35 @@ static int InitPeripheralsAndHandlers(void)
     action.sa_handler = TerminationHandler;
     sigaction(SIGTERM, &action, NULL);
 
+    ChangeFilter_Init(&temperatureFilter, &temperatureFilterConfig);
+    ChangeFilter_Init(&statusLedReportFilter, &statusLedReportFilterConfig);
+
     epollFd = CreateEpollFd();
     if (epollFd < 0) {
         return -1;
     }
 
+    if (StartupSequence_Init(&startupSequence, epollFd, &StartupFinishedHandler) != 0) {
+        return -1;
+    }
+    StartupSequence_AddStep(&startupSequence, &openGpiosStep);
+    StartupSequence_AddStep(&startupSequence, &initHandlersStep);
+    StartupSequence_AddStep(&startupSequence, &telemetryStoreStep);
+    StartupSequence_AddStep(&startupSequence, &keepAliveStoreStep);
+    return StartupSequence_Start(&startupSequence);
+}
+
+/// <summary>
+///     Startup step: opens the buttons and the LED.
+/// </summary>
+static StartupStepResult OpenGpiosStepHandler(StartupStep *step)
+{
     // Open button A GPIO as input
     Log_Debug("Opening SAMPLE_BUTTON_1 as input\n");
     sendMessageButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (sendMessageButtonGpioFd < 0) {
         Log_Debug("ERROR: Could not open button A: %s (%d).\n", strerror(errno), errno);
-        return -1;
+        return StartupStepResult_Failed;
     }
 
     // Open button B GPIO as input
@@ -228,7 +587,7 @@ static int InitPeripheralsAndHandlers(void)
     sendOrientationButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_2);
     if (sendOrientationButtonGpioFd < 0) {
         Log_Debug("ERROR: Could not open button B: %s (%d).\n", strerror(errno), errno);
-        return -1;
+        return StartupStepResult_Failed;
     }
 
     // LED 4 Blue is used to show Device Twin settings state
@@ -237,26 +596,143 @@ static int InitPeripheralsAndHandlers(void)
         GPIO_OpenAsOutput(SAMPLE_LED, GPIO_OutputMode_PushPull, GPIO_Value_High);
     if (deviceTwinStatusLedGpioFd < 0) {
         Log_Debug("ERROR: Could not open LED: %s (%d).\n", strerror(errno), errno);
-        return -1;
+        return StartupStepResult_Failed;
     }
 
-    // Set up a timer to poll for button events.
-    struct timespec buttonPressCheckPeriod = {0, 1000 * 1000};
-    buttonPollTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod, &buttonPollEventData, EPOLLIN);
-    if (buttonPollTimerFd < 0) {
-        return -1;
+    return StartupStepResult_Done;
+}
+
+/// <summary>
+///     Startup step: sets up the input manager, timers, network monitor, telemetry batcher and
+///     shutdown hooks.
+/// </summary>
+static StartupStepResult InitHandlersStepHandler(StartupStep *step)
+{
+    TwinDispatcher_Init(&twinDispatcher, twinProperties,
+                        sizeof(twinProperties) / sizeof(twinProperties[0]));
+
+    // The handlers below are set up with the startup profile, and the profile handler applies
+    // the ones which change later.
+    PerfProfileManager_Init(&perfProfileManager, PERF_PROFILE_DEFAULT);
+    PerfProfileManager_AddHandler(&perfProfileManager, &PerformanceProfileChangedHandler, NULL);
+    const PerfProfile *profile = PerfProfileManager_GetActive(&perfProfileManager);
+    Log_Debug("INFO: Starting with the %s performance profile.\n",
+              PerfProfile_GetName(profile->id));
+    doWorkBusyPeriod = profile->eventLoop.busyPollPeriod;
+    doWorkMaxIdlePeriod = profile->eventLoop.idlePollPeriod;
+
+    // Sample both buttons on one timer, which reports only debounced presses and releases.
+    if (InputManager_Init(&inputManager, epollFd, NULL, 0, &ButtonReadErrorHandler) != 0) {
+        return StartupStepResult_Failed;
+    }
+    // Sample the buttons less often while neither of them is changing.
+    const struct timespec *idleSamplePeriod = &profile->eventLoop.inputIdleSamplePeriod;
+    if (IsZeroPeriod(idleSamplePeriod)) {
+        idleSamplePeriod = NULL;
+    }
+    if (InputManager_SetIdleSamplePeriod(&inputManager, idleSamplePeriod) != 0) {
+        return StartupStepResult_Failed;
     }
+    sendMessageButton.gpioFd = sendMessageButtonGpioFd;
+    InputManager_AddInput(&inputManager, &sendMessageButton);
+    sendOrientationButton.gpioFd = sendOrientationButtonGpioFd;
+    InputManager_AddInput(&inputManager, &sendOrientationButton);
 
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
+    ReconnectManager_Init(&reconnectManager, AzureIoTMinReconnectPeriodSeconds,
+                          AzureIoTMaxReconnectPeriodSeconds, GetReconnectSeed());
     azureTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &azureTelemetryPeriod, &azureEventData, EPOLLIN);
+        CreateTimerFdAndAddToEpoll(epollFd, &azureIoTPollPeriod, &azureEventData, EPOLLIN);
     if (azureTimerFd < 0) {
-        return -1;
+        return StartupStepResult_Failed;
+    }
+    if (NetworkMonitor_Init(&networkMonitor, epollFd, &networkMonitorConfig) != 0 ||
+        NetworkMonitor_AddHandler(&networkMonitor, &NetworkStateHandler, NULL) != 0) {
+        return StartupStepResult_Failed;
     }
 
-    return 0;
+    // The simulated temperature is sampled on its own timer, so that it keeps its period while
+    // the connection to IoT Hub is retried with a backoff.
+    telemetryTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &profile->sensor.samplePeriod,
+                                                  &telemetryEventData, EPOLLIN);
+    if (telemetryTimerFd < 0) {
+        return StartupStepResult_Failed;
+    }
+
+    // The DoWork timer is started when the client is set up.
+    static const struct timespec doWorkTimerDisabled = {0, 0};
+    doWorkTimerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &doWorkTimerDisabled, &doWorkEventData, EPOLLIN);
+    if (doWorkTimerFd < 0) {
+        return StartupStepResult_Failed;
+    }
+
+    telemetryBatcherConfig.flushPeriod = profile->telemetry.flushPeriod;
+    telemetryBatcherConfig.aggregate = profile->telemetry.aggregate;
+    if (TelemetryBatcher_Init(&telemetryBatcher, epollFd, &telemetryBatcherConfig,
+                              &SendTelemetryBatch, NULL) != 0) {
+        return StartupStepResult_Failed;
+    }
+
+    for (size_t i = 0; i < sizeof(registeredMetrics) / sizeof(registeredMetrics[0]); i++) {
+        Metrics_Register(registeredMetrics[i]);
+    }
+    if (MetricsExporter_Init(&metricsExporter, epollFd, &metricsExportPeriod, &telemetryBatcher,
+                             &CollectMetrics, NULL) != 0) {
+        return StartupStepResult_Failed;
+    }
+
+    ShutdownCoordinator_Init(&shutdownCoordinator, &shutdownGracePeriod);
+    ShutdownCoordinator_AddHook(&shutdownCoordinator, &telemetryShutdownHook);
+
+    return StartupStepResult_Done;
+}
+
+/// <summary>
+///     Background startup step: opens the telemetry store. The application works without it,
+///     so the step does not fail if the store cannot be opened.
+/// </summary>
+static StartupStepResult OpenTelemetryStoreStepHandler(StartupStep *step)
+{
+    // Without the store, the readings only wait in the batch while the device is offline.
+    StorageMetrics_SetMutableFileQuota(telemetryStoreSize + KEEP_ALIVE_STORE_SIZE);
+    int storageFd = StorageMetrics_OpenMutableFile();
+    if (storageFd < 0) {
+        Log_Debug("WARNING: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+    } else if (TelemetryStore_Open(&telemetryStore, storageFd, 0, telemetryStoreSize) == 0) {
+        telemetryStoreOpen = true;
+    }
+
+    return StartupStepResult_Done;
+}
+
+/// <summary>
+///     Background startup step: opens the store of the keep-alive intervals which were learned
+///     for each network. Without it, the intervals are learned again after each restart.
+/// </summary>
+static StartupStepResult OpenKeepAliveStoreStepHandler(StartupStep *step)
+{
+    // The key-value store closes its own descriptor, so it does not share the telemetry store's.
+    int storageFd = StorageMetrics_OpenMutableFile();
+    if (storageFd < 0) {
+        Log_Debug("WARNING: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+    } else if (KvStore_Open(&keepAliveStore, storageFd, (off_t)telemetryStoreSize,
+                            KEEP_ALIVE_STORE_SIZE, keepAliveStoreBuffer,
+                            sizeof(keepAliveStoreBuffer)) == 0) {
+        keepAliveStoreOpen = true;
+    }
+
+    return StartupStepResult_Done;
+}
+
+/// <summary>
+///     Logs the startup trace once the application is ready, or exits if it could not start.
+/// </summary>
+static void StartupFinishedHandler(StartupSequence *sequence, int result)
+{
+    StartupSequence_LogTrace(sequence);
+    if (result != 0) {
+        terminationRequired = true;
+    }
 }
 
 /// <summary>
@@ -264,6 +740,27 @@ static int InitPeripheralsAndHandlers(void)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
+    // Report how long each handler ran and how late the timers were dispatched, which shows
+    // whether any handler is delaying the IoTHubDeviceClient_LL_DoWork cadence.
+    LogEventHandlerStats("InputManager", &inputManager.timerEventData);
+    LogEventHandlerStats("AzureTimer", &azureEventData);
+    LogEventHandlerStats("TelemetryTimer", &telemetryEventData);
+    LogEventHandlerStats("DoWorkTimer", &doWorkEventData);
+    Log_Debug("INFO: Sent %lu telemetry message(s); dropped %lu reading(s).\n",
+              (unsigned long)telemetryBatcher.messagesSent,
+              (unsigned long)telemetryBatcher.droppedReadings);
+    if (telemetryStoreOpen) {
+        Log_Debug("INFO: %zu stored reading(s) have not been sent; %lu were overwritten.\n",
+                  telemetryStore.pendingCount, (unsigned long)telemetryStore.overwrittenReadings);
+    }
+    StorageMetrics storageMetrics;
+    StorageMetrics_GetSnapshot(&storageMetrics);
+    StorageMetrics_Log(&storageMetrics);
+
+    MemoryMetrics memoryMetrics;
+    MemoryMetrics_GetSnapshot(&memoryMetrics);
+    MemoryMetrics_Log(&memoryMetrics);
+
     Log_Debug("Closing file descriptors\n");
 
     // Leave the LEDs off
@@ -271,14 +768,46 @@ static void ClosePeripheralsAndHandlers(void)
         GPIO_SetValue(deviceTwinStatusLedGpioFd, GPIO_Value_High);
     }
 
-    CloseFdAndPrintError(buttonPollTimerFd, "ButtonTimer");
+    InputManager_Close(&inputManager);
+    MetricsExporter_Close(&metricsExporter);
+    TelemetryBatcher_Close(&telemetryBatcher);
+    TelemetryStore_Close(&telemetryStore);
+    KvStore_Close(&keepAliveStore);
+    NetworkMonitor_Close(&networkMonitor);
     CloseFdAndPrintError(azureTimerFd, "AzureTimer");
+    CloseFdAndPrintError(telemetryTimerFd, "TelemetryTimer");
+    CloseFdAndPrintError(doWorkTimerFd, "DoWorkTimer");
+    StartupSequence_Close(&startupSequence);
     CloseFdAndPrintError(sendMessageButtonGpioFd, "SendMessageButton");
     CloseFdAndPrintError(sendOrientationButtonGpioFd, "SendOrientationButton");
     CloseFdAndPrintError(deviceTwinStatusLedGpioFd, "StatusLed");
     CloseFdAndPrintError(epollFd, "Epoll");
 }
 
+/// <summary>
+///     Copies the metrics which the telemetry batcher, the storage metrics and the memory
+///     metrics keep into the registry, before each export.
+/// </summary>
+static void CollectMetrics(MetricsExporter *exporter, void *context)
+{
+    Metrics_SetTotal(&droppedReadingsMetric, telemetryBatcher.droppedReadings);
+    Metrics_SetTotal(&filteredReadingsMetric, temperatureFilter.suppressedCount);
+
+    StorageMetrics storageMetrics;
+    StorageMetrics_GetSnapshot(&storageMetrics);
+    const StorageOperationMetrics *writes =
+        &storageMetrics.operations[StorageFile_Mutable][StorageOperation_Write];
+    Metrics_SetTotal(&flashWritesMetric, writes->count);
+    // Only the increase is exported, so the total may wrap around.
+    Metrics_SetTotal(&flashWriteBytesMetric, (uint32_t)writes->bytes);
+
+    MemoryMetrics memoryMetrics;
+    MemoryMetrics_GetSnapshot(&memoryMetrics);
+    Metrics_SetGauge(&heapBytesMetric, (int32_t)memoryMetrics.currentBytes);
+    Metrics_SetGauge(&heapPeakMetric, (int32_t)memoryMetrics.peakBytes);
+    Metrics_SetGauge(&stackPeakMetric, (int32_t)memoryMetrics.stackPeakBytes);
+}
+
 /// <summary>
 ///     Sets the IoT Hub authentication state for the app
 ///     The SAS Token expires which will set the authentication state
@@ -288,7 +817,127 @@ static void HubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         void *userContextCallback)
 {
     iothubAuthenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    clientCallbackInvoked = true;
     Log_Debug("IoT Hub Authenticated: %s\n", GetReasonString(reason));
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (iothubAuthenticated) {
+        ReconnectManager_OnConnected(&reconnectManager);
+        KeepAliveTuner_OnConnected(&keepAliveTuner, &now);
+        return;
+    }
+
+    // A keep-alive which is too long for a NAT on the network loses the connection with a
+    // communication error.
+    bool communicationError = (reason == IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR);
+    if (KeepAliveTuner_OnDisconnected(&keepAliveTuner, communicationError, &now)) {
+        Log_Debug("INFO: Keep-alive of %d seconds failed; %d seconds is known to work.\n",
+                  keepAliveTuner.currentSeconds, keepAliveTuner.confirmedSeconds);
+        SaveKeepAlive();
+    }
+
+    switch (reason) {
+    case IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN:
+        ScheduleReconnect(ReconnectReason_TokenExpired);
+        break;
+    case IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED:
+    case IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL:
+        ScheduleReconnect(ReconnectReason_Rejected);
+        break;
+    case IOTHUB_CLIENT_CONNECTION_NO_NETWORK:
+        ScheduleReconnect(ReconnectReason_NotReady);
+        break;
+    default:
+        ScheduleReconnect(ReconnectReason_Transient);
+        break;
+    }
+}
+
+/// <summary>
+///     Schedules the next attempt to connect to IoT Hub.
+/// </summary>
+/// <param name="reason">Why the connection failed or was lost.</param>
+static void ScheduleReconnect(ReconnectReason reason)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int delaySeconds = ReconnectManager_OnFailure(&reconnectManager, reason, &now);
+    Log_Debug("INFO: Will connect to IoT Hub again in %d seconds.\n", delaySeconds);
+}
+
+/// <summary>
+///     Gets a seed for the reconnect jitter, from the fractions of a second of the wall clock
+///     and of the time since boot, which differ between devices even if they start together.
+/// </summary>
+static uint32_t GetReconnectSeed(void)
+{
+    struct timespec realtime, monotonic;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    return (uint32_t)realtime.tv_nsec ^ ((uint32_t)monotonic.tv_nsec << 7) ^
+           (uint32_t)monotonic.tv_sec;
+}
+
+/// <summary>
+///     Gets the key under which the keep-alive of the current network is stored: a hash of the
+///     SSID of the Wi-Fi network, or a shared key on other networks.
+/// </summary>
+static void GetKeepAliveNetworkKey(char *key, size_t size)
+{
+    WifiConfig_ConnectedNetwork network;
+    if (WifiConfig_GetCurrentNetwork(&network) != 0) {
+        snprintf(key, size, "keepalive-other");
+        return;
+    }
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < network.ssidLength; i++) {
+        hash = (hash ^ network.ssid[i]) * 16777619u;
+    }
+    snprintf(key, size, "keepalive-%08lx", (unsigned long)hash);
+}
+
+/// <summary>
+///     Restores what was learned about the keep-alive of the current network, if the device
+///     has moved to another network since it last connected.
+/// </summary>
+static void LoadKeepAlive(void)
+{
+    char key[sizeof(keepAliveNetworkKey)];
+    GetKeepAliveNetworkKey(key, sizeof(key));
+    if (strcmp(key, keepAliveNetworkKey) == 0) {
+        return;
+    }
+    strcpy(keepAliveNetworkKey, key);
+
+    KeepAliveTuner_Init(&keepAliveTuner, keepAliveMinSeconds, keepAliveMaxSeconds);
+    StartupSequence_Require(&startupSequence, &keepAliveStoreStep);
+    StoredKeepAlive stored;
+    if (keepAliveStoreOpen &&
+        KvStore_Get(&keepAliveStore, key, &stored, sizeof(stored)) == sizeof(stored) &&
+        stored.version == STORED_KEEP_ALIVE_VERSION) {
+        KeepAliveTuner_Restore(&keepAliveTuner, stored.confirmedSeconds, stored.ceilingSeconds);
+    }
+}
+
+/// <summary>
+///     Stores what was learned about the keep-alive of the current network.
+/// </summary>
+static void SaveKeepAlive(void)
+{
+    if (!keepAliveStoreOpen || keepAliveNetworkKey[0] == '\0') {
+        return;
+    }
+
+    StoredKeepAlive stored = {.version = STORED_KEEP_ALIVE_VERSION,
+                              .confirmedSeconds = keepAliveTuner.confirmedSeconds,
+                              .ceilingSeconds = keepAliveTuner.ceilingSeconds};
+    if (KvStore_Set(&keepAliveStore, keepAliveNetworkKey, &stored, sizeof(stored)) != 0 ||
+        KvStore_Commit(&keepAliveStore) != 0) {
+        Log_Debug("WARNING: Could not store the keep-alive interval.\n");
+    }
 }
 
 /// <summary>
@@ -300,6 +949,7 @@ static void SetupAzureClient(void)
 {
     if (iothubClientHandle != NULL)
         IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+    outstandingClientOperations = 0;
 
     AZURE_SPHERE_PROV_RETURN_VALUE provResult =
         IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning(scopeId, 10000,
@@ -308,36 +958,25 @@ static void SetupAzureClient(void)
               getAzureSphereProvisioningResultString(provResult));
 
     if (provResult.result != AZURE_SPHERE_PROV_RESULT_OK) {
-
-        // If we fail to connect, reduce the polling frequency, starting at
-        // AzureIoTMinReconnectPeriodSeconds and with a backoff up to
-        // AzureIoTMaxReconnectPeriodSeconds
-        if (azureIoTPollPeriodSeconds == AzureIoTDefaultPollPeriodSeconds) {
-            azureIoTPollPeriodSeconds = AzureIoTMinReconnectPeriodSeconds;
-        } else {
-            azureIoTPollPeriodSeconds *= 2;
-            if (azureIoTPollPeriodSeconds > AzureIoTMaxReconnectPeriodSeconds) {
-                azureIoTPollPeriodSeconds = AzureIoTMaxReconnectPeriodSeconds;
-            }
-        }
-
-        struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-        SetTimerFdToPeriod(azureTimerFd, &azureTelemetryPeriod);
-
-        Log_Debug("ERROR: failure to create IoTHub Handle - will retry in %i seconds.\n",
-                  azureIoTPollPeriodSeconds);
+        // If we fail to connect, back off with a delay which starts at
+        // AzureIoTMinReconnectPeriodSeconds and doubles up to AzureIoTMaxReconnectPeriodSeconds.
+        // If the device is not ready yet, try again at the next poll.
+        Log_Debug("ERROR: failure to create IoTHub Handle.\n");
+        bool notReady = (provResult.result == AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY ||
+                         provResult.result == AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY);
+        ScheduleReconnect(notReady ? ReconnectReason_NotReady : ReconnectReason_Transient);
         return;
     }
 
-    // Successfully connected, so make sure the polling frequency is back to the default
-    azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
-    struct timespec azureTelemetryPeriod = {azureIoTPollPeriodSeconds, 0};
-    SetTimerFdToPeriod(azureTimerFd, &azureTelemetryPeriod);
-
     iothubAuthenticated = true;
+    // Call DoWork straight away, to open the connection and fetch the device twin.
+    ScheduleDoWork(true);
 
+    LoadKeepAlive();
+    int keepAliveSeconds = KeepAliveTuner_NextInterval(&keepAliveTuner);
+    APP_LOG_DEBUG("INFO: Connecting with a keep-alive of %d seconds.\n", keepAliveSeconds);
     if (IoTHubDeviceClient_LL_SetOption(iothubClientHandle, OPTION_KEEP_ALIVE,
-                                        &keepalivePeriodSeconds) != IOTHUB_CLIENT_OK) {
+                                        &keepAliveSeconds) != IOTHUB_CLIENT_OK) {
         Log_Debug("ERROR: failure setting option \"%s\"\n", OPTION_KEEP_ALIVE);
         return;
     }
@@ -349,51 +988,237 @@ static void SetupAzureClient(void)
 
 /// <summary>
 ///     Callback invoked when a Device Twin update is received from IoT Hub.
-///     Updates local state for 'showEvents' (bool).
+///     Calls the handlers of the desired properties which the update holds.
 /// </summary>
-/// <param name="payload">contains the Device Twin JSON document (desired and reported)</param>
+/// <param name="payload">contains the Device Twin JSON document (desired and reported), or the
+/// desired properties which changed</param>
 /// <param name="payloadSize">size of the Device Twin JSON document</param>
 static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                          size_t payloadSize, void *userContextCallback)
 {
-    size_t nullTerminatedJsonSize = payloadSize + 1;
-    char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
-    if (nullTerminatedJsonString == NULL) {
-        Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
-        abort();
+    clientCallbackInvoked = true;
+    Metrics_Increment(&twinUpdatesMetric);
+
+    // The payload is parsed where it is, so it need not be copied to add a null terminator.
+    twinUpdateIsComplete = (updateState == DEVICE_TWIN_UPDATE_COMPLETE);
+    TwinDispatcher_Dispatch(&twinDispatcher, updateState == DEVICE_TWIN_UPDATE_COMPLETE, payload,
+                            payloadSize);
+}
+
+/// <summary>
+///     Handles the 'StatusLED' desired property: turns the status LED on or off, and reports
+///     its new state.
+/// </summary>
+static void StatusLedTwinHandler(const TwinValue *value, void *context)
+{
+    if (!TwinValue_GetBool(value, &statusLedOn)) {
+        APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_WARNING, 3, 10000,
+                             "WARNING: StatusLED.value is not a boolean.\n");
+        return;
+    }
+
+    GPIO_SetValue(deviceTwinStatusLedGpioFd,
+                  (statusLedOn == true ? GPIO_Value_Low : GPIO_Value_High));
+    TwinReportBoolState("StatusLED", statusLedOn, &statusLedReportFilter);
+}
+
+/// <summary>
+///     Handles the 'UploadStorage' desired property: requests an upload of the mutable storage
+///     when it is set to a number which has not been uploaded yet.
+/// </summary>
+static void UploadStorageTwinHandler(const TwinValue *value, void *context)
+{
+    double request;
+    if (!TwinValue_GetNumber(value, &request) || request < 1 || request > UINT32_MAX) {
+        APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_WARNING, 3, 10000,
+                             "WARNING: UploadStorage.value is not a positive number.\n");
+        return;
+    }
+
+    if ((uint32_t)request != completedStorageUpload) {
+        requestedStorageUpload = (uint32_t)request;
+        ScheduleDoWork(true);
+    }
+}
+
+/// <summary>
+///     Receives a member of the 'overrides' object of the 'PerformanceProfile' desired property,
+///     which sets or, if it is null, removes the override of one parameter.
+/// </summary>
+static void PerformanceOverrideHandler(const char *name, size_t length, const TwinValue *value,
+                                       void *context)
+{
+    PerformanceProfileUpdate *update = context;
+    double number;
+    bool flag;
+    int result;
+    if (value->type == TwinValueType_Null) {
+        result = PerfProfileSelection_ClearOverride(&update->selection, name, length);
+    } else if (TwinValue_GetBool(value, &flag)) {
+        result = PerfProfileSelection_SetOverride(&update->selection, name, length, flag ? 1 : 0);
+    } else if (TwinValue_GetNumber(value, &number)) {
+        result = PerfProfileSelection_SetOverride(&update->selection, name, length, number);
+    } else {
+        result = -1;
     }
 
-    // Copy the provided buffer to a null terminated buffer.
-    memcpy(nullTerminatedJsonString, payload, payloadSize);
-    // Add the null terminator at the end.
-    nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
+    if (result != 0) {
+        APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_WARNING, 3, 10000,
+                             "WARNING: PerformanceProfile override '%.*s' is not valid.\n",
+                             (int)length, name);
+        update->isValid = false;
+    }
+}
 
-    JSON_Value *rootProperties = NULL;
-    rootProperties = json_parse_string(nullTerminatedJsonString);
-    if (rootProperties == NULL) {
-        Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
-        goto cleanup;
+/// <summary>
+///     Receives a member of the 'PerformanceProfile' desired property: the name of the profile
+///     in 'value', or its 'overrides'.
+/// </summary>
+static void PerformanceProfileMemberHandler(const char *name, size_t length,
+                                            const TwinValue *value, void *context)
+{
+    PerformanceProfileUpdate *update = context;
+    if (length == 5 && strncmp(name, "value", 5) == 0) {
+        if (value->type == TwinValueType_Null) {
+            update->selection.id = PERF_PROFILE_DEFAULT;
+        } else if (value->type != TwinValueType_String ||
+                   !PerfProfile_FindId(value->text, value->length, &update->selection.id)) {
+            APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_WARNING, 3, 10000,
+                                 "WARNING: PerformanceProfile.value is not LowPower, Balanced or "
+                                 "MaxThroughput.\n");
+            update->isValid = false;
+        }
+    } else if (length == 9 && strncmp(name, "overrides", 9) == 0) {
+        if (value->type == TwinValueType_Null) {
+            PerfProfileSelection_Init(&update->selection, update->selection.id);
+        } else if (TwinValue_ForEachMember(value, &PerformanceOverrideHandler, update) < 0) {
+            APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_WARNING, 3, 10000,
+                                 "WARNING: PerformanceProfile.overrides is not an object.\n");
+            update->isValid = false;
+        }
     }
+}
 
-    JSON_Object *rootObject = json_value_get_object(rootProperties);
-    JSON_Object *desiredProperties = json_object_dotget_object(rootObject, "desired");
-    if (desiredProperties == NULL) {
-        desiredProperties = rootObject;
+/// <summary>
+///     Handles the 'PerformanceProfile' desired property: switches to the profile which it names,
+///     with its overrides. The complete twin holds all of the overrides, so it replaces those
+///     which were applied before, while a patch only holds the ones which changed. The active
+///     profile is only changed if the whole property is valid.
+/// </summary>
+static void PerformanceProfileTwinHandler(const TwinValue *value, void *context)
+{
+    PerformanceProfileUpdate update = {.isValid = true};
+    if (twinUpdateIsComplete || value->type == TwinValueType_Null) {
+        PerfProfileSelection_Init(&update.selection, PERF_PROFILE_DEFAULT);
+    } else {
+        update.selection = *PerfProfileManager_GetSelection(&perfProfileManager);
     }
 
-    // Handle the Device Twin Desired Properties here.
-    JSON_Object *LEDState = json_object_dotget_object(desiredProperties, "StatusLED");
-    if (LEDState != NULL) {
-        statusLedOn = (bool)json_object_get_boolean(LEDState, "value");
-        GPIO_SetValue(deviceTwinStatusLedGpioFd,
-                      (statusLedOn == true ? GPIO_Value_Low : GPIO_Value_High));
-        TwinReportBoolState("StatusLED", statusLedOn);
+    if (value->type != TwinValueType_Null &&
+        TwinValue_ForEachMember(value, &PerformanceProfileMemberHandler, &update) < 0) {
+        APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_WARNING, 3, 10000,
+                             "WARNING: PerformanceProfile is not an object.\n");
+        return;
+    }
+    if (!update.isValid) {
+        return;
     }
 
-cleanup:
-    // Release the allocated memory.
-    json_value_free(rootProperties);
-    free(nullTerminatedJsonString);
+    PerfProfileManager_Apply(&perfProfileManager, &update.selection);
+}
+
+/// <summary>
+///     Applies the parameters of the performance profile which has just become active. Timers
+///     are only restarted if their periods changed.
+/// </summary>
+static void PerformanceProfileChangedHandler(const PerfProfile *profile,
+                                             const PerfProfile *previous, void *context)
+{
+    Log_Debug("INFO: Switched from the %s to the %s performance profile.\n",
+              PerfProfile_GetName(previous->id), PerfProfile_GetName(profile->id));
+
+    // The DoWork timer picks up its new periods the next time that it is scheduled.
+    doWorkBusyPeriod = profile->eventLoop.busyPollPeriod;
+    doWorkMaxIdlePeriod = profile->eventLoop.idlePollPeriod;
+
+    const struct timespec *idleSamplePeriod = &profile->eventLoop.inputIdleSamplePeriod;
+    if (!PeriodEquals(idleSamplePeriod, &previous->eventLoop.inputIdleSamplePeriod)) {
+        InputManager_SetIdleSamplePeriod(&inputManager,
+                                         IsZeroPeriod(idleSamplePeriod) ? NULL : idleSamplePeriod);
+    }
+    if (!PeriodEquals(&profile->sensor.samplePeriod, &previous->sensor.samplePeriod)) {
+        SetTimerFdToPeriod(telemetryTimerFd, &profile->sensor.samplePeriod);
+    }
+    if (!PeriodEquals(&profile->telemetry.flushPeriod, &previous->telemetry.flushPeriod)) {
+        TelemetryBatcher_SetFlushPeriod(&telemetryBatcher, &profile->telemetry.flushPeriod);
+    }
+    TelemetryBatcher_SetAggregate(&telemetryBatcher, profile->telemetry.aggregate);
+
+    ReportPerformanceProfile();
+}
+
+static bool PeriodEquals(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static bool IsZeroPeriod(const struct timespec *period)
+{
+    return period->tv_sec == 0 && period->tv_nsec == 0;
+}
+
+/// <summary>
+///     Reports the name of the active performance profile in the 'PerformanceProfile' reported
+///     property.
+/// </summary>
+static void ReportPerformanceProfile(void)
+{
+    const PerfProfile *profile = PerfProfileManager_GetActive(&perfProfileManager);
+    char reportedValue[TWIN_DISPATCHER_MAX_VALUE_LENGTH + 1];
+    snprintf(reportedValue, sizeof(reportedValue), "{\"value\":\"%s\"}",
+             PerfProfile_GetName(profile->id));
+    if (TwinDispatcher_SetReported(&twinDispatcher, "PerformanceProfile", reportedValue) != 0) {
+        Log_Debug("ERROR: failed to set reported state for 'PerformanceProfile'.\n");
+    } else if (iothubClientHandle != NULL) {
+        ScheduleDoWork(true);
+    }
+}
+
+/// <summary>
+///     Uploads the telemetry store from mutable storage if an upload was requested, and reports
+///     its number once it has finished. This is called from the DoWork timer rather than from
+///     the twin callback, because the upload waits for the IoT Hub client.
+/// </summary>
+static void UploadStorageIfRequested(void)
+{
+    if (requestedStorageUpload == 0 || !telemetryStoreOpen) {
+        return;
+    }
+
+    uint32_t request = requestedStorageUpload;
+    requestedStorageUpload = 0;
+
+    char blobName[48];
+    snprintf(blobName, sizeof(blobName), "telemetry-store-%lu.bin", (unsigned long)request);
+    BlobUploadFileRegion region = {
+        .fd = telemetryStore.fd,
+        .offset = telemetryStore.offset,
+        .length = telemetryStore.capacity * TELEMETRY_STORE_RECORD_SIZE,
+        .position = 0};
+
+    size_t bytesUploaded;
+    if (BlobUpload_Upload(iothubClientHandle, blobName, &BlobUpload_ReadFileRegion, &region,
+                          &bytesUploaded) != 0) {
+        return;
+    }
+
+    Log_Debug("INFO: Uploaded %zu bytes to '%s'.\n", bytesUploaded, blobName);
+    completedStorageUpload = request;
+    char reportedValue[12];
+    snprintf(reportedValue, sizeof(reportedValue), "%lu", (unsigned long)request);
+    if (TwinDispatcher_SetReported(&twinDispatcher, "UploadStorage", reportedValue) != 0) {
+        Log_Debug("ERROR: failed to set reported state for 'UploadStorage'.\n");
+    }
 }
 
 /// <summary>
@@ -453,35 +1278,66 @@ static const char *getAzureSphereProvisioningResultString(
 }
 
 /// <summary>
-///     Sends telemetry to IoT Hub
+///     Sends a batch of telemetry to IoT Hub. This is called by the telemetry batcher.
 /// </summary>
-/// <param name="key">The telemetry item to update</param>
-/// <param name="value">new telemetry value</param>
-static void SendTelemetry(const unsigned char *key, const unsigned char *value)
+/// <param name="message">The batch, as a JSON or CBOR array</param>
+/// <param name="length">The length of the batch</param>
+/// <returns>true if IoTHubClient accepted the message; false to keep the batch for the next
+/// flush</returns>
+static bool SendTelemetryBatch(TelemetryBatcher *batcher, const char *message, size_t length,
+                               void *context)
 {
-    static char eventBuffer[100] = {0};
-    static const char *EventMsgTemplate = "{ \"%s\": \"%s\" }";
-    int len = snprintf(eventBuffer, sizeof(eventBuffer), EventMsgTemplate, key, value);
-    if (len < 0)
-        return;
+    // Keep the batch until the device is connected.
+    if (!iothubAuthenticated) {
+        return false;
+    }
 
-    Log_Debug("Sending IoT Hub Message: %s\n", eventBuffer);
+    bool isJson = (telemetryBatcherConfig.encoding == TelemetryEncoding_Json);
+    if (isJson) {
+        APP_LOG_DEBUG("Sending IoT Hub Message: %s\n", message);
+    } else {
+        APP_LOG_DEBUG("Sending IoT Hub Message: %zu bytes of CBOR\n", length);
+    }
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(eventBuffer);
+    // The message handle cannot be kept for the next batch: IoTHubMessage has no way to
+    // replace the body of a message, and IoTHubDeviceClient_LL_SendEventAsync queues a clone of
+    // the message rather than the handle it is given. The batcher keeps this to one message
+    // per flush period rather than one per reading.
+    IOTHUB_MESSAGE_HANDLE messageHandle =
+        IoTHubMessage_CreateFromByteArray((const unsigned char *)message, length);
 
     if (messageHandle == 0) {
         Log_Debug("WARNING: unable to create a new IoTHubMessage\n");
-        return;
+        return false;
+    }
+
+    // A message without its content type could not be routed or decoded, so keep the batch.
+    const TelemetryMessageShape *shape = &telemetryMessageShapes[telemetryBatcherConfig.encoding];
+    if (IoTHubMessage_SetContentTypeSystemProperty(messageHandle, shape->contentType) !=
+            IOTHUB_MESSAGE_OK ||
+        (shape->contentEncoding != NULL &&
+         IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, shape->contentEncoding) !=
+             IOTHUB_MESSAGE_OK)) {
+        Log_Debug("WARNING: unable to set the properties of the IoTHubMessage\n");
+        IoTHubMessage_Destroy(messageHandle);
+        return false;
     }
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
-                                             /*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
+    bool accepted = IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle,
+                                                         SendMessageCallback,
+                                                         /*&callback_param*/ 0) == IOTHUB_CLIENT_OK;
+    if (!accepted) {
         Log_Debug("WARNING: failed to hand over the message to IoTHubClient\n");
+        Metrics_Increment(&telemetryFailuresMetric);
     } else {
-        Log_Debug("INFO: IoTHubClient accepted the message for delivery\n");
+        Metrics_Increment(&telemetryMessagesMetric);
+        Metrics_Observe(&batchBytesMetric, (uint32_t)length);
+        APP_LOG_DEBUG("INFO: IoTHubClient accepted the message for delivery\n");
+        BeginClientOperation();
     }
 
     IoTHubMessage_Destroy(messageHandle);
+    return accepted;
 }
 
 /// <summary>
@@ -491,48 +1347,90 @@ static void SendTelemetry(const unsigned char *key, const unsigned char *value)
 /// <param name="context">User specified context</param>
 static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
-    Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    APP_LOG_DEBUG("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    if (result != IOTHUB_CLIENT_CONFIRMATION_OK) {
+        Metrics_Increment(&telemetryFailuresMetric);
+    }
+    EndClientOperation();
 }
 
 /// <summary>
-///     Creates and enqueues a report containing the name and value pair of a Device Twin reported
-///     property. The report is not sent immediately, but it is sent on the next invocation of
-///     IoTHubDeviceClient_LL_DoWork().
+///     Sets the value of a Device Twin reported property. The report is not sent immediately:
+///     all the properties which are set before the next invocation of
+///     IoTHubDeviceClient_LL_DoWork() are sent together in one report, with only the latest
+///     value of each.
 /// </summary>
 /// <param name="propertyName">the IoT Hub Device Twin property name</param>
 /// <param name="propertyValue">the IoT Hub Device Twin property value</param>
-static void TwinReportBoolState(const char *propertyName, bool propertyValue)
+/// <param name="filter">Filter which decides whether the value has changed since it was last
+/// reported, or NULL to always report it</param>
+static void TwinReportBoolState(const char *propertyName, bool propertyValue,
+                                ChangeFilter *filter)
 {
+    if (filter != NULL && !ChangeFilter_CheckBool(filter, propertyValue)) {
+        return;
+    }
+
     if (iothubClientHandle == NULL) {
         Log_Debug("ERROR: client not initialized\n");
+    } else if (TwinDispatcher_SetReportedBool(&twinDispatcher, propertyName, propertyValue) != 0) {
+        Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
     } else {
-        static char reportedPropertiesString[30] = {0};
-        int len = snprintf(reportedPropertiesString, 30, "{\"%s\":%s}", propertyName,
-                           (propertyValue == true ? "true" : "false"));
-        if (len < 0)
-            return;
+        ScheduleDoWork(true);
+        return;
+    }
 
-        if (IoTHubDeviceClient_LL_SendReportedState(
-                iothubClientHandle, (unsigned char *)reportedPropertiesString,
-                strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
-            Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
-        } else {
-            Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName,
-                      (propertyValue == true ? "true" : "false"));
-        }
+    // The value was not reported, so the filter must not treat it as the last reported one.
+    if (filter != NULL) {
+        ChangeFilter_Reset(filter);
     }
 }
 
+/// <summary>
+///     Enqueues one report which holds all the reported properties that were set since the
+///     last report.
+/// </summary>
+static void SendReportedProperties(void)
+{
+    static char reportedPropertiesString[256];
+    int len = TwinDispatcher_FormatReported(&twinDispatcher, reportedPropertiesString,
+                                            sizeof(reportedPropertiesString));
+    if (len == 0) {
+        return;
+    }
+
+    if (len < 0) {
+        Log_Debug("ERROR: reported properties do not fit in the report.\n");
+        ChangeFilter_Reset(&statusLedReportFilter);
+    } else if (IoTHubDeviceClient_LL_SendReportedState(
+                   iothubClientHandle, (unsigned char *)reportedPropertiesString, (size_t)len,
+                   ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
+        Log_Debug("ERROR: failed to send reported state '%s'.\n", reportedPropertiesString);
+        ChangeFilter_Reset(&statusLedReportFilter);
+    } else {
+        APP_LOG_DEBUG("INFO: Reported state '%s'.\n", reportedPropertiesString);
+        BeginClientOperation();
+    }
+    TwinDispatcher_ClearReported(&twinDispatcher);
+}
+
 /// <summary>
 ///     Callback invoked when the Device Twin reported properties are accepted by IoT Hub.
 /// </summary>
 static void ReportStatusCallback(int result, void *context)
 {
-    Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
+    APP_LOG_DEBUG("INFO: Device Twin reported properties update result: HTTP status code %d\n",
+                  result);
+    if (result < 200 || result >= 300) {
+        ChangeFilter_Reset(&statusLedReportFilter);
+    }
+    EndClientOperation();
 }
 
 /// <summary>
-///     Generates a simulated Temperature and sends to IoT Hub.
+///     Generates a simulated Temperature and, if it has changed enough to be reported, adds it
+///     to the telemetry batch, or to the telemetry store while the device is not connected to
+///     IoT Hub.
 /// </summary>
 void SendSimulatedTemperature(void)
 {
@@ -544,43 +1442,89 @@ void SendSimulatedTemperature(void)
         temperature -= deltaTemp;
     }
 
-    char tempBuffer[20];
-    int len = snprintf(tempBuffer, 20, "%3.2f", temperature);
-    if (len > 0)
-        SendTelemetry("Temperature", tempBuffer);
+    if (!ChangeFilter_Check(&temperatureFilter, temperature)) {
+        return;
+    }
+
+    // While the device is offline, the readings are stored, so the store is opened now if it
+    // has not been opened in the background yet.
+    if (!iothubAuthenticated) {
+        StartupSequence_Require(&startupSequence, &telemetryStoreStep);
+    }
+    if (!iothubAuthenticated && telemetryStoreOpen &&
+        TelemetryStore_Append(&telemetryStore, StoredTelemetryKey_Temperature, temperature,
+                              time(NULL)) == 0) {
+        return;
+    }
+
+    TelemetryBatcher_AddValue(&telemetryBatcher, "Temperature", temperature);
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+///     Sends the readings which were stored while the device was not connected to IoT Hub, a
+///     few batches at a time. A batch is marked as delivered once IoTHubClient accepts it, so
+///     that a connection which drops again leaves the rest of the readings in the store.
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>true if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+static void SendStoredTelemetry(void)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        terminationRequired = true;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
+    if (!iothubAuthenticated || !telemetryStoreOpen || telemetryStore.pendingCount == 0) {
+        return;
     }
 
-    return isButtonPressed;
+    // Send the readings which are waiting in the batch first, so that the stored ones fit.
+    if (!TelemetryBatcher_Flush(&telemetryBatcher)) {
+        return;
+    }
+
+    TelemetryStoreRecord records[STORED_READINGS_PER_MESSAGE];
+    for (int i = 0; i < storedTelemetryMessagesPerDoWork; i++) {
+        ssize_t count = TelemetryStore_Peek(&telemetryStore, records, STORED_READINGS_PER_MESSAGE);
+        if (count <= 0) {
+            return;
+        }
+
+        for (ssize_t j = 0; j < count; j++) {
+            if (records[j].keyId < StoredTelemetryKey_Count) {
+                const char *key = storedTelemetryKeys[records[j].keyId];
+                TelemetryBatcher_AddValueAt(&telemetryBatcher, key, records[j].value,
+                                            (time_t)records[j].time);
+            }
+        }
+
+        if (!TelemetryBatcher_Flush(&telemetryBatcher)) {
+            return;
+        }
+        TelemetryStore_MarkDelivered(&telemetryStore, records[count - 1].sequence);
+    }
+}
+
+/// <summary>
+///     Shutdown hook which sends the readings which are waiting in the batch, and waits until
+///     IoT Hub has confirmed them and the other messages. While the device is not connected,
+///     the readings are already in the telemetry store, so there is nothing to wait for.
+/// </summary>
+static bool TelemetryShutdownHook(ShutdownHook *hook)
+{
+    if (!iothubAuthenticated) {
+        return true;
+    }
+    if (!TelemetryBatcher_Flush(&telemetryBatcher)) {
+        return false;
+    }
+    return outstandingClientOperations == 0;
 }
 
 /// <summary>
 /// Pressing button A will:
 ///     Send a 'Button Pressed' event to Azure IoT Central
 /// </summary>
-static void SendMessageButtonHandler(void)
+static void SendMessageButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    if (IsButtonPressed(sendMessageButtonGpioFd, &sendMessageButtonState)) {
-        SendTelemetry("ButtonPress", "True");
+    // A button press is sent straight away, together with the readings which are waiting in
+    // the batch, rather than at the end of the minute.
+    if (isPressed) {
+        TelemetryBatcher_AddEvent(&telemetryBatcher, "ButtonPress", "True");
+        TelemetryBatcher_Flush(&telemetryBatcher);
     }
 }
 
@@ -588,10 +1532,11 @@ static void SendMessageButtonHandler(void)
 /// Pressing button B will:
 ///     Send an 'Orientation' event to Azure IoT Central
 /// </summary>
-static void SendOrientationButtonHandler(void)
+static void SendOrientationButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    if (IsButtonPressed(sendOrientationButtonGpioFd, &sendOrientationButtonState)) {
+    if (isPressed) {
         deviceIsUp = !deviceIsUp;
-        SendTelemetry("Orientation", deviceIsUp ? "Up" : "Down");
+        TelemetryBatcher_AddEvent(&telemetryBatcher, "Orientation", deviceIsUp ? "Up" : "Down");
+        TelemetryBatcher_Flush(&telemetryBatcher);
     }
 }
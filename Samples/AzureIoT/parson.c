@@ -41,24 +41,40 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
 #define sscanf THINK_TWICE_ABOUT_USING_SSCANF
 
 #define STARTING_CAPACITY 16
+/* Objects with more members than this get a hash index, so that looking up a key does not scan
+   all the names */
+#define HASH_INDEX_THRESHOLD 16
 #define MAX_NESTING 2048
 
+#define SAX_PATH_SIZE 128 /* longest path, with its null terminator, which the streaming parser
+                             reports */
+
 #define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
 /* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's use 64 */
 #define NUM_BUF_SIZE 64
+/* Numbers with at most this many digits and no exponent are parsed without strtod. Such a
+   number has a mantissa below 2^53 and at most 15 fraction digits, so it is exactly
+   representable and one division by an exact power of ten rounds it correctly. */
+#define FAST_NUMBER_MAX_DIGITS 15
 
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
-#define SKIP_WHITESPACES(str)                 \
-    while (isspace((unsigned char)(**str))) { \
-        SKIP_CHAR(str);                       \
-    }
+/* The parser reads the input up to an end pointer, rather than up to a null terminator, so
+   PEEK_CHAR returns '\0' at the end of the input. */
+#define PEEK_CHAR(str, end) ((*(str) < (end)) ? **(str) : '\0')
+#define REMAINING(str, end) ((size_t)((end) - *(str)))
+#define SKIP_WHITESPACES(str, end) (*(str) = skip_whitespaces(*(str), (end)))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #undef malloc
@@ -91,6 +107,10 @@ struct json_object_t {
     JSON_Value **values;
     size_t count;
     size_t capacity;
+    /* Open-addressed hash table of member index + 1, where 0 is an empty slot, or NULL while
+       the object is small. Its capacity is a power of two, at least twice count. */
+    size_t *hash_index;
+    size_t hash_capacity;
 };
 
 struct json_array_t {
@@ -117,6 +137,11 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value);
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
+static size_t hash_string(const char *string, size_t n);
+static void json_object_index_insert(JSON_Object *object, size_t index);
+static void json_object_index_build(JSON_Object *object);
+static size_t json_object_find_index(const JSON_Object *object, const char *name,
+                                     size_t name_len);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
@@ -135,24 +160,67 @@ static void json_array_free(JSON_Array *array);
 static JSON_Value *json_value_init_string_no_copy(char *string);
 
 /* Parser */
-static JSON_Status skip_quotes(const char **string);
-static int parse_utf16(const char **unprocessed, char **processed);
+static const char *skip_whitespaces(const char *string, const char *end);
+static const char *find_string_special(const char *string, const char *end);
+static JSON_Status skip_quotes(const char **string, const char *end);
+static int parse_utf16(const char **unprocessed, const char *end, char **processed);
 static char *process_string(const char *input, size_t len);
-static char *get_quoted_string(const char **string);
-static JSON_Value *parse_object_value(const char **string, size_t nesting);
-static JSON_Value *parse_array_value(const char **string, size_t nesting);
-static JSON_Value *parse_string_value(const char **string);
-static JSON_Value *parse_boolean_value(const char **string);
-static JSON_Value *parse_number_value(const char **string);
-static JSON_Value *parse_null_value(const char **string);
-static JSON_Value *parse_value(const char **string, size_t nesting);
-
-/* Serialization */
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf);
-static int json_serialize_string(const char *string, char *buf);
-static int append_indent(char *buf, int level);
-static int append_string(char *buf, const char *string);
+static char *get_quoted_string(const char **string, const char *end);
+static JSON_Value *parse_object_value(const char **string, const char *end, size_t nesting);
+static JSON_Value *parse_array_value(const char **string, const char *end, size_t nesting);
+static JSON_Value *parse_string_value(const char **string, const char *end);
+static JSON_Value *parse_boolean_value(const char **string, const char *end);
+static int parse_number_fast(const char **string, const char *end, double *number);
+static size_t scan_number(const char *string, const char *end);
+static JSON_Status parse_number(const char **string, const char *end, double *number);
+static JSON_Value *parse_number_value(const char **string, const char *end);
+static JSON_Value *parse_null_value(const char **string, const char *end);
+static JSON_Value *parse_value(const char **string, const char *end, size_t nesting);
+
+/* Streaming parser */
+typedef struct json_sax_state_t {
+    const char *string;
+    const char *end;
+    JSON_Sax_Callback callback;
+    void *context;
+    char path[SAX_PATH_SIZE];
+    size_t path_len;
+    int path_valid;
+    size_t depth;
+    int stopped;
+} JSON_Sax_State;
+
+static int sax_emit(JSON_Sax_State *state, JSON_Sax_Event *event);
+static int sax_push_key(JSON_Sax_State *state, const char *key);
+static JSON_Status sax_parse_object(JSON_Sax_State *state, size_t nesting);
+static JSON_Status sax_parse_array(JSON_Sax_State *state, size_t nesting);
+static JSON_Status sax_parse_value(JSON_Sax_State *state, size_t nesting);
+
+/* Serialization
+   The serializer writes its output in a single pass, either into a buffer or, with no buffer,
+   only counting its length. A growable buffer is replaced by one twice as large when it fills,
+   so the tree is not walked once to size the output and again to write it. */
+typedef enum json_output_mode {
+    JSONOutputCount,
+    JSONOutputFixed,
+    JSONOutputGrowable
+} JSON_Output_Mode;
+
+typedef struct json_output_t {
+    JSON_Output_Mode mode;
+    char *buf;
+    size_t size;   /* size of buf, which always keeps room for the null terminator */
+    size_t length; /* length of the output so far */
+} JSON_Output;
+
+static int output_reserve(JSON_Output *out, size_t n);
+static int output_append(JSON_Output *out, const char *data, size_t n);
+static int json_serialize_r(const JSON_Value *value, JSON_Output *out, int level, int is_pretty);
+static int json_serialize_string(const char *string, JSON_Output *out);
+static int json_serialize_number(double num, JSON_Output *out);
+static int append_indent(JSON_Output *out, int level);
+static JSON_Status json_serialize_to_output(const JSON_Value *value, JSON_Output *out,
+                                            int is_pretty);
 
 /* Various */
 static char *parson_strndup(const char *string, size_t n)
@@ -334,6 +402,8 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value)
     new_obj->values = (JSON_Value **)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->hash_index = NULL;
+    new_obj->hash_capacity = 0;
     return new_obj;
 }
 
@@ -369,6 +439,11 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
     value->parent = json_object_get_wrapping_value(object);
     object->values[index] = value;
     object->count++;
+    if (object->hash_index != NULL && object->count * 2 <= object->hash_capacity) {
+        json_object_index_insert(object, index);
+    } else if (object->count > HASH_INDEX_THRESHOLD) {
+        json_object_index_build(object);
+    }
     return JSONSuccess;
 }
 
@@ -402,45 +477,121 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
     return JSONSuccess;
 }
 
-static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
-                                          size_t name_len)
+static size_t hash_string(const char *string, size_t n)
 {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
+    /* 32-bit FNV-1a */
+    size_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void json_object_index_insert(JSON_Object *object, size_t index)
+{
+    size_t mask = object->hash_capacity - 1;
+    size_t slot = hash_string(object->names[index], strlen(object->names[index])) & mask;
+    while (object->hash_index[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    object->hash_index[slot] = index + 1;
+}
+
+/* Rebuilds the hash index for all the members. If it cannot be allocated, keys are looked up by
+   scanning the names instead. */
+static void json_object_index_build(JSON_Object *object)
+{
+    size_t i, new_capacity = 1;
+    parson_free(object->hash_index);
+    object->hash_index = NULL;
+    object->hash_capacity = 0;
+    if (object->count <= HASH_INDEX_THRESHOLD) {
+        return;
+    }
+    while (new_capacity < object->count * 4) {
+        new_capacity *= 2;
+    }
+    object->hash_index = (size_t *)parson_malloc(new_capacity * sizeof(size_t));
+    if (object->hash_index == NULL) {
+        return;
+    }
+    memset(object->hash_index, 0, new_capacity * sizeof(size_t));
+    object->hash_capacity = new_capacity;
+    for (i = 0; i < object->count; i++) {
+        json_object_index_insert(object, i);
+    }
+}
+
+/* Returns the index of the member with the name, or the count if there is none */
+static size_t json_object_find_index(const JSON_Object *object, const char *name,
+                                     size_t name_len)
+{
+    size_t i, name_length, mask, slot;
+    if (object == NULL) {
+        return 0;
+    }
+    if (object->hash_index != NULL) {
+        mask = object->hash_capacity - 1;
+        slot = hash_string(name, name_len) & mask;
+        while (object->hash_index[slot] != 0) {
+            i = object->hash_index[slot] - 1;
+            if (strncmp(object->names[i], name, name_len) == 0 &&
+                object->names[i][name_len] == '\0') {
+                return i;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return object->count;
+    }
+    for (i = 0; i < object->count; i++) {
         name_length = strlen(object->names[i]);
         if (name_length != name_len) {
             continue;
         }
         if (strncmp(object->names[i], name, name_len) == 0) {
-            return object->values[i];
+            return i;
         }
     }
-    return NULL;
+    return object->count;
+}
+
+static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
+                                          size_t name_len)
+{
+    size_t index = json_object_find_index(object, name, name_len);
+    if (object == NULL || index >= object->count) {
+        return NULL;
+    }
+    return object->values[index];
 }
 
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value)
 {
     size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL) {
+    if (object == NULL || name == NULL) {
+        return JSONFailure;
+    }
+    i = json_object_find_index(object, name, strlen(name));
+    if (i >= object->count) {
         return JSONFailure;
     }
     last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            if (free_value) {
-                json_value_free(object->values[i]);
-            }
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
-            }
-            object->count -= 1;
-            return JSONSuccess;
-        }
+    parson_free(object->names[i]);
+    if (free_value) {
+        json_value_free(object->values[i]);
     }
-    return JSONFailure; /* No execution path should end here */
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
+    }
+    object->count -= 1;
+    if (object->hash_index != NULL) { /* Members have moved, so the index is rebuilt */
+        json_object_index_build(object);
+    }
+    return JSONSuccess;
 }
 
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -469,6 +620,7 @@ static void json_object_free(JSON_Object *object)
     }
     parson_free(object->names);
     parson_free(object->values);
+    parson_free(object->hash_index);
     parson_free(object);
 }
 
@@ -543,18 +695,99 @@ static JSON_Value *json_value_init_string_no_copy(char *string)
 }
 
 /* Parser */
-static JSON_Status skip_quotes(const char **string)
+#if defined(__ARM_NEON)
+/* Returns a mask with 4 bits set for each byte of the vector which is non-zero, starting at the
+   lowest bits, so that the index of the first such byte is the count of trailing zeros / 4. */
+static uint64_t neon_nibble_mask(uint8x16_t matches)
+{
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+#endif
+
+/* Returns the first character from string which is not whitespace, as isspace in the "C" locale
+   defines it, or end. Most runs of whitespace are short, so the first character is checked
+   before scanning 16 bytes at a time. */
+static const char *skip_whitespaces(const char *string, const char *end)
+{
+    unsigned char c;
+    if (string < end && (unsigned char)*string > ' ') {
+        return string;
+    }
+#if defined(__ARM_NEON)
+    {
+        const uint8x16_t space = vdupq_n_u8(' ');
+        const uint8x16_t tab = vdupq_n_u8('\t');
+        const uint8x16_t control_span = vdupq_n_u8('\r' - '\t');
+        while (end - string >= 16) {
+            uint8x16_t chunk = vld1q_u8((const uint8_t *)string);
+            /* \t, \n, \v, \f and \r are consecutive */
+            uint8x16_t is_space = vorrq_u8(vceqq_u8(chunk, space),
+                                           vcleq_u8(vsubq_u8(chunk, tab), control_span));
+            uint64_t mask = neon_nibble_mask(vmvnq_u8(is_space));
+            if (mask != 0) {
+                return string + (__builtin_ctzll(mask) >> 2);
+            }
+            string += 16;
+        }
+    }
+#endif
+    while (string < end) {
+        c = (unsigned char)*string;
+        if (c != ' ' && (c < '\t' || c > '\r')) {
+            break;
+        }
+        string++;
+    }
+    return string;
+}
+
+/* Returns the first quote, backslash or control character from string, or end. Characters in
+   between need no processing, so strings are scanned 16 bytes at a time where NEON is
+   available. */
+static const char *find_string_special(const char *string, const char *end)
+{
+    unsigned char c;
+#if defined(__ARM_NEON)
+    const uint8x16_t quote = vdupq_n_u8('\"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t first_printable = vdupq_n_u8(0x20);
+    while (end - string >= 16) {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)string);
+        uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)),
+                                      vcltq_u8(chunk, first_printable));
+        uint64_t mask = neon_nibble_mask(special);
+        if (mask != 0) {
+            return string + (__builtin_ctzll(mask) >> 2);
+        }
+        string += 16;
+    }
+#endif
+    while (string < end) {
+        c = (unsigned char)*string;
+        if (c == '\"' || c == '\\' || c < 0x20) {
+            break;
+        }
+        string++;
+    }
+    return string;
+}
+
+static JSON_Status skip_quotes(const char **string, const char *end)
 {
-    if (**string != '\"') {
+    if (PEEK_CHAR(string, end) != '\"') {
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"') {
-        if (**string == '\0') {
+    while (1) {
+        *string = find_string_special(*string, end);
+        if (PEEK_CHAR(string, end) == '\"') {
+            break;
+        } else if (PEEK_CHAR(string, end) == '\0') {
             return JSONFailure;
         } else if (**string == '\\') {
             SKIP_CHAR(string);
-            if (**string == '\0') {
+            if (PEEK_CHAR(string, end) == '\0') {
                 return JSONFailure;
             }
         }
@@ -564,13 +797,16 @@ static JSON_Status skip_quotes(const char **string)
     return JSONSuccess;
 }
 
-static int parse_utf16(const char **unprocessed, char **processed)
+static int parse_utf16(const char **unprocessed, const char *end, char **processed)
 {
     unsigned int cp, lead, trail;
     int parse_succeeded = 0;
     char *processed_ptr = *processed;
     const char *unprocessed_ptr = *unprocessed;
     unprocessed_ptr++; /* skips u */
+    if (end - unprocessed_ptr < 4) {
+        return JSONFailure;
+    }
     parse_succeeded = parse_utf16_hex(unprocessed_ptr, &cp);
     if (!parse_succeeded) {
         return JSONFailure;
@@ -590,6 +826,9 @@ static int parse_utf16(const char **unprocessed, char **processed)
         lead = cp;
         unprocessed_ptr +=
             4; /* should always be within the buffer, otherwise previous sscanf would fail */
+        if (end - unprocessed_ptr < 6) {
+            return JSONFailure;
+        }
         if (*unprocessed_ptr++ != '\\' || *unprocessed_ptr++ != 'u') {
             return JSONFailure;
         }
@@ -618,6 +857,7 @@ Example: "\u006Corem ipsum" -> lorem ipsum */
 static char *process_string(const char *input, size_t len)
 {
     const char *input_ptr = input;
+    const char *special_ptr = NULL;
     size_t initial_size = (len + 1) * sizeof(char);
     size_t final_size = 0;
     char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
@@ -626,7 +866,15 @@ static char *process_string(const char *input, size_t len)
         goto error;
     }
     output_ptr = output;
-    while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < len) {
+    while ((size_t)(input_ptr - input) < len) {
+        /* Copy the characters up to the next one which needs processing at once */
+        special_ptr = find_string_special(input_ptr, input + len);
+        memcpy(output_ptr, input_ptr, (size_t)(special_ptr - input_ptr));
+        output_ptr += special_ptr - input_ptr;
+        input_ptr = special_ptr;
+        if ((size_t)(input_ptr - input) >= len || *input_ptr == '\0') {
+            break;
+        }
         if (*input_ptr == '\\') {
             input_ptr++;
             switch (*input_ptr) {
@@ -655,7 +903,7 @@ static char *process_string(const char *input, size_t len)
                 *output_ptr = '\t';
                 break;
             case 'u':
-                if (parse_utf16(&input_ptr, &output_ptr) == JSONFailure) {
+                if (parse_utf16(&input_ptr, input + len, &output_ptr) == JSONFailure) {
                     goto error;
                 }
                 break;
@@ -689,11 +937,11 @@ error:
 
 /* Return processed contents of a string between quotes and
    skips passed argument to a matching quote. */
-static char *get_quoted_string(const char **string)
+static char *get_quoted_string(const char **string, const char *end)
 {
     const char *string_start = *string;
     size_t string_len = 0;
-    JSON_Status status = skip_quotes(string);
+    JSON_Status status = skip_quotes(string, end);
     if (status != JSONSuccess) {
         return NULL;
     }
@@ -701,22 +949,22 @@ static char *get_quoted_string(const char **string)
     return process_string(string_start + 1, string_len);
 }
 
-static JSON_Value *parse_value(const char **string, size_t nesting)
+static JSON_Value *parse_value(const char **string, const char *end, size_t nesting)
 {
     if (nesting > MAX_NESTING) {
         return NULL;
     }
-    SKIP_WHITESPACES(string);
-    switch (**string) {
+    SKIP_WHITESPACES(string, end);
+    switch (PEEK_CHAR(string, end)) {
     case '{':
-        return parse_object_value(string, nesting + 1);
+        return parse_object_value(string, end, nesting + 1);
     case '[':
-        return parse_array_value(string, nesting + 1);
+        return parse_array_value(string, end, nesting + 1);
     case '\"':
-        return parse_string_value(string);
+        return parse_string_value(string, end);
     case 'f':
     case 't':
-        return parse_boolean_value(string);
+        return parse_boolean_value(string, end);
     case '-':
     case '0':
     case '1':
@@ -728,15 +976,15 @@ static JSON_Value *parse_value(const char **string, size_t nesting)
     case '7':
     case '8':
     case '9':
-        return parse_number_value(string);
+        return parse_number_value(string, end);
     case 'n':
-        return parse_null_value(string);
+        return parse_null_value(string, end);
     default:
         return NULL;
     }
 }
 
-static JSON_Value *parse_object_value(const char **string, size_t nesting)
+static JSON_Value *parse_object_value(const char **string, const char *end, size_t nesting)
 {
     JSON_Value *output_value = NULL, *new_value = NULL;
     JSON_Object *output_object = NULL;
@@ -745,31 +993,31 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '{') {
+    if (PEEK_CHAR(string, end) != '{') {
         json_value_free(output_value);
         return NULL;
     }
     output_object = json_value_get_object(output_value);
     SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == '}') { /* empty object */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) == '}') { /* empty object */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
-        new_key = get_quoted_string(string);
+    while (PEEK_CHAR(string, end) != '\0') {
+        new_key = get_quoted_string(string, end);
         if (new_key == NULL) {
             json_value_free(output_value);
             return NULL;
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ':') {
+        SKIP_WHITESPACES(string, end);
+        if (PEEK_CHAR(string, end) != ':') {
             parson_free(new_key);
             json_value_free(output_value);
             return NULL;
         }
         SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
+        new_value = parse_value(string, end, nesting);
         if (new_value == NULL) {
             parson_free(new_key);
             json_value_free(output_value);
@@ -782,15 +1030,15 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
             return NULL;
         }
         parson_free(new_key);
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        SKIP_WHITESPACES(string, end);
+        if (PEEK_CHAR(string, end) != ',') {
             break;
         }
         SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
+        SKIP_WHITESPACES(string, end);
     }
-    SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) != '}' || /* Trim object after parsing is over */
         json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -799,7 +1047,7 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
     return output_value;
 }
 
-static JSON_Value *parse_array_value(const char **string, size_t nesting)
+static JSON_Value *parse_array_value(const char **string, const char *end, size_t nesting)
 {
     JSON_Value *output_value = NULL, *new_array_value = NULL;
     JSON_Array *output_array = NULL;
@@ -807,19 +1055,19 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     if (output_value == NULL) {
         return NULL;
     }
-    if (**string != '[') {
+    if (PEEK_CHAR(string, end) != '[') {
         json_value_free(output_value);
         return NULL;
     }
     output_array = json_value_get_array(output_value);
     SKIP_CHAR(string);
-    SKIP_WHITESPACES(string);
-    if (**string == ']') { /* empty array */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) == ']') { /* empty array */
         SKIP_CHAR(string);
         return output_value;
     }
-    while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
+    while (PEEK_CHAR(string, end) != '\0') {
+        new_array_value = parse_value(string, end, nesting);
         if (new_array_value == NULL) {
             json_value_free(output_value);
             return NULL;
@@ -829,15 +1077,15 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
             json_value_free(output_value);
             return NULL;
         }
-        SKIP_WHITESPACES(string);
-        if (**string != ',') {
+        SKIP_WHITESPACES(string, end);
+        if (PEEK_CHAR(string, end) != ',') {
             break;
         }
         SKIP_CHAR(string);
-        SKIP_WHITESPACES(string);
+        SKIP_WHITESPACES(string, end);
     }
-    SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) != ']' || /* Trim array after parsing is over */
         json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
         json_value_free(output_value);
         return NULL;
@@ -846,10 +1094,10 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
     return output_value;
 }
 
-static JSON_Value *parse_string_value(const char **string)
+static JSON_Value *parse_string_value(const char **string, const char *end)
 {
     JSON_Value *value = NULL;
-    char *new_string = get_quoted_string(string);
+    char *new_string = get_quoted_string(string, end);
     if (new_string == NULL) {
         return NULL;
     }
@@ -861,78 +1109,444 @@ static JSON_Value *parse_string_value(const char **string)
     return value;
 }
 
-static JSON_Value *parse_boolean_value(const char **string)
+static JSON_Value *parse_boolean_value(const char **string, const char *end)
 {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
-    if (strncmp("true", *string, true_token_size) == 0) {
+    if (REMAINING(string, end) >= true_token_size &&
+        strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
         return json_value_init_boolean(1);
-    } else if (strncmp("false", *string, false_token_size) == 0) {
+    } else if (REMAINING(string, end) >= false_token_size &&
+               strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
         return json_value_init_boolean(0);
     }
     return NULL;
 }
 
-static JSON_Value *parse_number_value(const char **string)
+/* Parses a number of the form -?(0|[1-9][0-9]*)(.[0-9]+)? with at most FAST_NUMBER_MAX_DIGITS
+   digits, which is what most payloads contain. Returns 0 without consuming anything for any
+   other number, which parse_number then passes to strtod. */
+static int parse_number_fast(const char **string, const char *end, double *number)
 {
-    char *end;
-    double number = 0;
+    static const double powers_of_ten[FAST_NUMBER_MAX_DIGITS + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    const char *p = *string;
+    uint64_t mantissa = 0;
+    size_t digits = 0;
+    size_t fraction_digits = 0;
+    int negative = 0;
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p == end || !isdigit((unsigned char)*p)) {
+        return 0;
+    }
+    if (*p == '0') {
+        p++;
+        if (p < end && isdigit((unsigned char)*p)) {
+            return 0;
+        }
+    } else {
+        while (p < end && isdigit((unsigned char)*p)) {
+            if (++digits > FAST_NUMBER_MAX_DIGITS) {
+                return 0;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            p++;
+        }
+    }
+    if (p < end && *p == '.') {
+        p++;
+        if (p == end || !isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        while (p < end && isdigit((unsigned char)*p)) {
+            if (++digits > FAST_NUMBER_MAX_DIGITS) {
+                return 0;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            fraction_digits++;
+            p++;
+        }
+    }
+    /* Anything else which strtod might consume, such as an exponent, takes the slow path. */
+    if (p < end && *p != '\0' && strchr("+-.eExX", *p) != NULL) {
+        return 0;
+    }
+    *number = (double)mantissa / powers_of_ten[fraction_digits];
+    if (negative) {
+        *number = -*number;
+    }
+    *string = p;
+    return 1;
+}
+
+/* Returns the length of the number at string, which is -?[0-9]+(.[0-9]*)?([eE][+-]?[0-9]+)?,
+   the decimal part of what strtod reads. An exponent without digits is not part of it, as for
+   strtod. Leading zeros are left to is_decimal. */
+static size_t scan_number(const char *string, const char *end)
+{
+    const char *p = string;
+    const char *exponent = NULL;
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p == end || !isdigit((unsigned char)*p)) {
+        return 0;
+    }
+    while (p < end && isdigit((unsigned char)*p)) {
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && isdigit((unsigned char)*p)) {
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        exponent = p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p == end || !isdigit((unsigned char)*p)) {
+            return (size_t)(exponent - string);
+        }
+        while (p < end && isdigit((unsigned char)*p)) {
+            p++;
+        }
+    }
+    return (size_t)(p - string);
+}
+
+static JSON_Status parse_number(const char **string, const char *end, double *number)
+{
+    if (parse_number_fast(string, end, number)) {
+        return JSONSuccess;
+    }
+    size_t number_len = scan_number(*string, end);
+    /* Hexadecimal numbers, which strtod would read, are not JSON. */
+    if (number_len == 0 || !is_decimal(*string, number_len) ||
+        (number_len < REMAINING(string, end) &&
+         ((*string)[number_len] == 'x' || (*string)[number_len] == 'X'))) {
+        return JSONFailure;
+    }
+    /* strtod needs a null-terminated string, so the number is copied first: to the stack if it
+       is short, as most are, and otherwise to the heap. */
+    char stack_buf[NUM_BUF_SIZE];
+    char *number_buf = stack_buf;
+    if (number_len >= sizeof(stack_buf)) {
+        number_buf = (char *)parson_malloc(number_len + 1);
+        if (number_buf == NULL) {
+            return JSONFailure;
+        }
+    }
+    memcpy(number_buf, *string, number_len);
+    number_buf[number_len] = '\0';
+    char *number_end;
     errno = 0;
-    number = strtod(*string, &end);
-    if (errno || !is_decimal(*string, (size_t)(end - *string))) {
+    *number = strtod(number_buf, &number_end);
+    int is_valid = errno == 0 && (size_t)(number_end - number_buf) == number_len;
+    if (number_buf != stack_buf) {
+        parson_free(number_buf);
+    }
+    if (!is_valid) {
+        return JSONFailure;
+    }
+    *string += number_len;
+    return JSONSuccess;
+}
+
+static JSON_Value *parse_number_value(const char **string, const char *end)
+{
+    double number = 0;
+    if (parse_number(string, end, &number) == JSONFailure) {
         return NULL;
     }
-    *string = end;
     return json_value_init_number(number);
 }
 
-static JSON_Value *parse_null_value(const char **string)
+static JSON_Value *parse_null_value(const char **string, const char *end)
 {
     size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
+    if (REMAINING(string, end) >= token_size && strncmp("null", *string, token_size) == 0) {
         *string += token_size;
         return json_value_init_null();
     }
     return NULL;
 }
 
+/* Streaming parser */
+/* Calls the callback, and returns non-zero if it asked to stop */
+static int sax_emit(JSON_Sax_State *state, JSON_Sax_Event *event)
+{
+    event->path = state->path_valid ? state->path : NULL;
+    event->depth = state->depth;
+    if (state->callback(event, state->context) != 0) {
+        state->stopped = 1;
+    }
+    return state->stopped;
+}
+
+/* Appends a key to the path. Returns 0 if it does not fit, in which case the path is not valid
+   until the key is popped again. */
+static int sax_push_key(JSON_Sax_State *state, const char *key)
+{
+    size_t key_len = strlen(key);
+    size_t separator_len = state->path_len > 0 ? 1 : 0;
+    if (!state->path_valid || state->path_len + separator_len + key_len >= SAX_PATH_SIZE) {
+        state->path_valid = 0;
+        return 0;
+    }
+    if (separator_len > 0) {
+        state->path[state->path_len++] = '.';
+    }
+    memcpy(state->path + state->path_len, key, key_len + 1);
+    state->path_len += key_len;
+    return 1;
+}
+
+static JSON_Status sax_parse_object(JSON_Sax_State *state, size_t nesting)
+{
+    JSON_Sax_Event event;
+    JSON_Status status = JSONSuccess;
+    const char **string = &state->string;
+    const char *end = state->end;
+    size_t saved_path_len = 0;
+    int saved_path_valid = 0;
+    char *key = NULL;
+    memset(&event, 0, sizeof(event));
+    event.type = JSONSaxObjectStart;
+    if (sax_emit(state, &event)) {
+        return JSONFailure;
+    }
+    SKIP_CHAR(string);
+    state->depth++;
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) != '}') {
+        while (1) {
+            key = get_quoted_string(string, end);
+            if (key == NULL) {
+                return JSONFailure;
+            }
+            SKIP_WHITESPACES(string, end);
+            if (PEEK_CHAR(string, end) != ':') {
+                parson_free(key);
+                return JSONFailure;
+            }
+            SKIP_CHAR(string);
+            saved_path_len = state->path_len;
+            saved_path_valid = state->path_valid;
+            sax_push_key(state, key);
+            memset(&event, 0, sizeof(event));
+            event.type = JSONSaxKey;
+            event.string = key;
+            event.string_len = strlen(key);
+            sax_emit(state, &event);
+            parson_free(key);
+            status = state->stopped ? JSONFailure : sax_parse_value(state, nesting);
+            state->path_len = saved_path_len;
+            state->path[saved_path_len] = '\0';
+            state->path_valid = saved_path_valid;
+            if (status == JSONFailure) {
+                return JSONFailure;
+            }
+            SKIP_WHITESPACES(string, end);
+            if (PEEK_CHAR(string, end) != ',') {
+                break;
+            }
+            SKIP_CHAR(string);
+            SKIP_WHITESPACES(string, end);
+        }
+    }
+    if (PEEK_CHAR(string, end) != '}') {
+        return JSONFailure;
+    }
+    SKIP_CHAR(string);
+    state->depth--;
+    memset(&event, 0, sizeof(event));
+    event.type = JSONSaxObjectEnd;
+    return sax_emit(state, &event) ? JSONFailure : JSONSuccess;
+}
+
+static JSON_Status sax_parse_array(JSON_Sax_State *state, size_t nesting)
+{
+    JSON_Sax_Event event;
+    const char **string = &state->string;
+    const char *end = state->end;
+    memset(&event, 0, sizeof(event));
+    event.type = JSONSaxArrayStart;
+    if (sax_emit(state, &event)) {
+        return JSONFailure;
+    }
+    SKIP_CHAR(string);
+    state->depth++;
+    SKIP_WHITESPACES(string, end);
+    if (PEEK_CHAR(string, end) != ']') {
+        while (1) {
+            if (sax_parse_value(state, nesting) == JSONFailure) {
+                return JSONFailure;
+            }
+            SKIP_WHITESPACES(string, end);
+            if (PEEK_CHAR(string, end) != ',') {
+                break;
+            }
+            SKIP_CHAR(string);
+        }
+    }
+    if (PEEK_CHAR(string, end) != ']') {
+        return JSONFailure;
+    }
+    SKIP_CHAR(string);
+    state->depth--;
+    memset(&event, 0, sizeof(event));
+    event.type = JSONSaxArrayEnd;
+    return sax_emit(state, &event) ? JSONFailure : JSONSuccess;
+}
+
+static JSON_Status sax_parse_value(JSON_Sax_State *state, size_t nesting)
+{
+    JSON_Sax_Event event;
+    const char **string = &state->string;
+    const char *end = state->end;
+    char *value_string = NULL;
+    size_t true_token_size = SIZEOF_TOKEN("true");
+    size_t false_token_size = SIZEOF_TOKEN("false");
+    size_t null_token_size = SIZEOF_TOKEN("null");
+    if (nesting > MAX_NESTING) {
+        return JSONFailure;
+    }
+    memset(&event, 0, sizeof(event));
+    event.type = JSONSaxValue;
+    SKIP_WHITESPACES(string, end);
+    switch (PEEK_CHAR(string, end)) {
+    case '{':
+        return sax_parse_object(state, nesting + 1);
+    case '[':
+        return sax_parse_array(state, nesting + 1);
+    case '\"':
+        value_string = get_quoted_string(string, end);
+        if (value_string == NULL) {
+            return JSONFailure;
+        }
+        event.value_type = JSONString;
+        event.string = value_string;
+        event.string_len = strlen(value_string);
+        sax_emit(state, &event);
+        parson_free(value_string);
+        return state->stopped ? JSONFailure : JSONSuccess;
+    case 'f':
+    case 't':
+        if (REMAINING(string, end) >= true_token_size &&
+            strncmp("true", *string, true_token_size) == 0) {
+            *string += true_token_size;
+            event.boolean = 1;
+        } else if (REMAINING(string, end) >= false_token_size &&
+                   strncmp("false", *string, false_token_size) == 0) {
+            *string += false_token_size;
+            event.boolean = 0;
+        } else {
+            return JSONFailure;
+        }
+        event.value_type = JSONBoolean;
+        break;
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        if (parse_number(string, end, &event.number) == JSONFailure) {
+            return JSONFailure;
+        }
+        event.value_type = JSONNumber;
+        break;
+    case 'n':
+        if (REMAINING(string, end) < null_token_size ||
+            strncmp("null", *string, null_token_size) != 0) {
+            return JSONFailure;
+        }
+        *string += null_token_size;
+        event.value_type = JSONNull;
+        break;
+    default:
+        return JSONFailure;
+    }
+    return sax_emit(state, &event) ? JSONFailure : JSONSuccess;
+}
+
 /* Serialization */
-#define APPEND_STRING(str)                   \
-    do {                                     \
-        written = append_string(buf, (str)); \
-        if (written < 0) {                   \
-            return -1;                       \
-        }                                    \
-        if (buf != NULL) {                   \
-            buf += written;                  \
-        }                                    \
-        written_total += written;            \
+/* str must be a string literal */
+#define APPEND_STRING(str)                                       \
+    do {                                                         \
+        if (output_append(out, (str), SIZEOF_TOKEN(str)) != 0) { \
+            return -1;                                           \
+        }                                                        \
     } while (0)
 
-#define APPEND_INDENT(level)                   \
-    do {                                       \
-        written = append_indent(buf, (level)); \
-        if (written < 0) {                     \
-            return -1;                         \
-        }                                      \
-        if (buf != NULL) {                     \
-            buf += written;                    \
-        }                                      \
-        written_total += written;              \
+#define APPEND_INDENT(level)                    \
+    do {                                        \
+        if (append_indent(out, (level)) != 0) { \
+            return -1;                          \
+        }                                       \
     } while (0)
 
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf)
+static int output_reserve(JSON_Output *out, size_t n)
+{
+    char *new_buf = NULL;
+    size_t new_size = 0;
+    if (out->mode == JSONOutputCount || n < out->size - out->length) {
+        return 0;
+    }
+    if (out->mode != JSONOutputGrowable) {
+        return -1;
+    }
+    new_size = out->size > 0 ? out->size : 128;
+    while (n >= new_size - out->length) {
+        if (new_size > ((size_t)-1) / 2) {
+            return -1;
+        }
+        new_size *= 2;
+    }
+    new_buf = (char *)parson_malloc(new_size);
+    if (new_buf == NULL) {
+        return -1;
+    }
+    if (out->length > 0) {
+        memcpy(new_buf, out->buf, out->length);
+    }
+    parson_free(out->buf);
+    out->buf = new_buf;
+    out->size = new_size;
+    return 0;
+}
+
+static int output_append(JSON_Output *out, const char *data, size_t n)
+{
+    if (out->mode != JSONOutputCount) {
+        if (output_reserve(out, n) != 0) {
+            return -1;
+        }
+        memcpy(out->buf + out->length, data, n);
+    }
+    out->length += n;
+    return 0;
+}
+
+static int json_serialize_r(const JSON_Value *value, JSON_Output *out, int level, int is_pretty)
 {
     const char *key = NULL, *string = NULL;
     JSON_Value *temp_value = NULL;
     JSON_Array *array = NULL;
     JSON_Object *object = NULL;
     size_t i = 0, count = 0;
-    double num = 0.0;
-    int written = -1, written_total = 0;
 
     switch (json_value_get_type(value)) {
     case JSONArray:
@@ -947,14 +1561,9 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
                 APPEND_INDENT(level + 1);
             }
             temp_value = json_array_get_value(array, i);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
+            if (json_serialize_r(temp_value, out, level + 1, is_pretty) != 0) {
                 return -1;
             }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -966,7 +1575,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             APPEND_INDENT(level);
         }
         APPEND_STRING("]");
-        return written_total;
+        return 0;
     case JSONObject:
         object = json_value_get_object(value);
         count = json_object_get_count(object);
@@ -982,27 +1591,19 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             if (is_pretty) {
                 APPEND_INDENT(level + 1);
             }
-            written = json_serialize_string(key, buf);
-            if (written < 0) {
+            if (json_serialize_string(key, out) != 0) {
                 return -1;
             }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
             APPEND_STRING(":");
             if (is_pretty) {
                 APPEND_STRING(" ");
             }
-            temp_value = json_object_get_value(object, key);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
+            /* The values are in the same order as the names, so the value is found by its
+               index rather than by looking the name up again */
+            temp_value = object->values[i];
+            if (json_serialize_r(temp_value, out, level + 1, is_pretty) != 0) {
                 return -1;
             }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -1014,45 +1615,25 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             APPEND_INDENT(level);
         }
         APPEND_STRING("}");
-        return written_total;
+        return 0;
     case JSONString:
         string = json_value_get_string(value);
         if (string == NULL) {
             return -1;
         }
-        written = json_serialize_string(string, buf);
-        if (written < 0) {
-            return -1;
-        }
-        if (buf != NULL) {
-            buf += written;
-        }
-        written_total += written;
-        return written_total;
+        return json_serialize_string(string, out);
     case JSONBoolean:
         if (json_value_get_boolean(value)) {
             APPEND_STRING("true");
         } else {
             APPEND_STRING("false");
         }
-        return written_total;
+        return 0;
     case JSONNumber:
-        num = json_value_get_number(value);
-        if (buf != NULL) {
-            num_buf = buf;
-        }
-        written = sprintf(num_buf, FLOAT_FORMAT, num);
-        if (written < 0) {
-            return -1;
-        }
-        if (buf != NULL) {
-            buf += written;
-        }
-        written_total += written;
-        return written_total;
+        return json_serialize_number(json_value_get_number(value), out);
     case JSONNull:
         APPEND_STRING("null");
-        return written_total;
+        return 0;
     case JSONError:
         return -1;
     default:
@@ -1060,169 +1641,164 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
     }
 }
 
-static int json_serialize_string(const char *string, char *buf)
+static int json_serialize_string(const char *string, JSON_Output *out)
 {
-    size_t i = 0, len = strlen(string);
-    char c = '\0';
-    int written = -1, written_total = 0;
+    static const char hex_digits[] = "0123456789abcdef";
+    const char *run = string;
+    const char *escape = NULL;
+    char unicode_escape[6] = {'\\', 'u', '0', '0', '0', '0'};
+    size_t escape_len = 0;
+    unsigned char c;
     APPEND_STRING("\"");
-    for (i = 0; i < len; i++) {
-        c = string[i];
+    /* Characters which need no escaping are copied in runs, rather than one at a time */
+    for (; (c = (unsigned char)*string) != '\0'; string++) {
         switch (c) {
         case '\"':
-            APPEND_STRING("\\\"");
+            escape = "\\\"";
             break;
         case '\\':
-            APPEND_STRING("\\\\");
+            escape = "\\\\";
             break;
         case '/':
-            APPEND_STRING("\\/");
-            break; /* to make json embeddable in xml\/html */
+            escape = "\\/"; /* to make json embeddable in xml\/html */
+            break;
         case '\b':
-            APPEND_STRING("\\b");
+            escape = "\\b";
             break;
         case '\f':
-            APPEND_STRING("\\f");
+            escape = "\\f";
             break;
         case '\n':
-            APPEND_STRING("\\n");
+            escape = "\\n";
             break;
         case '\r':
-            APPEND_STRING("\\r");
+            escape = "\\r";
             break;
         case '\t':
-            APPEND_STRING("\\t");
-            break;
-        case '\x00':
-            APPEND_STRING("\\u0000");
-            break;
-        case '\x01':
-            APPEND_STRING("\\u0001");
-            break;
-        case '\x02':
-            APPEND_STRING("\\u0002");
-            break;
-        case '\x03':
-            APPEND_STRING("\\u0003");
-            break;
-        case '\x04':
-            APPEND_STRING("\\u0004");
-            break;
-        case '\x05':
-            APPEND_STRING("\\u0005");
-            break;
-        case '\x06':
-            APPEND_STRING("\\u0006");
-            break;
-        case '\x07':
-            APPEND_STRING("\\u0007");
-            break;
-        /* '\x08' duplicate: '\b' */
-        /* '\x09' duplicate: '\t' */
-        /* '\x0a' duplicate: '\n' */
-        case '\x0b':
-            APPEND_STRING("\\u000b");
-            break;
-        /* '\x0c' duplicate: '\f' */
-        /* '\x0d' duplicate: '\r' */
-        case '\x0e':
-            APPEND_STRING("\\u000e");
-            break;
-        case '\x0f':
-            APPEND_STRING("\\u000f");
-            break;
-        case '\x10':
-            APPEND_STRING("\\u0010");
-            break;
-        case '\x11':
-            APPEND_STRING("\\u0011");
-            break;
-        case '\x12':
-            APPEND_STRING("\\u0012");
-            break;
-        case '\x13':
-            APPEND_STRING("\\u0013");
-            break;
-        case '\x14':
-            APPEND_STRING("\\u0014");
-            break;
-        case '\x15':
-            APPEND_STRING("\\u0015");
-            break;
-        case '\x16':
-            APPEND_STRING("\\u0016");
-            break;
-        case '\x17':
-            APPEND_STRING("\\u0017");
-            break;
-        case '\x18':
-            APPEND_STRING("\\u0018");
-            break;
-        case '\x19':
-            APPEND_STRING("\\u0019");
-            break;
-        case '\x1a':
-            APPEND_STRING("\\u001a");
-            break;
-        case '\x1b':
-            APPEND_STRING("\\u001b");
-            break;
-        case '\x1c':
-            APPEND_STRING("\\u001c");
-            break;
-        case '\x1d':
-            APPEND_STRING("\\u001d");
-            break;
-        case '\x1e':
-            APPEND_STRING("\\u001e");
-            break;
-        case '\x1f':
-            APPEND_STRING("\\u001f");
+            escape = "\\t";
             break;
         default:
-            if (buf != NULL) {
-                buf[0] = c;
-                buf += 1;
+            if (c >= 0x20) {
+                continue;
             }
-            written_total += 1;
+            unicode_escape[4] = hex_digits[c >> 4];
+            unicode_escape[5] = hex_digits[c & 0xF];
+            escape = unicode_escape;
             break;
         }
+        escape_len = (escape == unicode_escape) ? sizeof(unicode_escape) : strlen(escape);
+        if (output_append(out, run, (size_t)(string - run)) != 0 ||
+            output_append(out, escape, escape_len) != 0) {
+            return -1;
+        }
+        run = string + 1;
+    }
+    if (output_append(out, run, (size_t)(string - run)) != 0) {
+        return -1;
     }
     APPEND_STRING("\"");
-    return written_total;
+    return 0;
 }
 
-static int append_indent(char *buf, int level)
+static int json_serialize_number(double num, JSON_Output *out)
 {
-    int i;
-    int written = -1, written_total = 0;
-    for (i = 0; i < level; i++) {
-        APPEND_STRING("    ");
+    char num_buf[NUM_BUF_SIZE];
+    char *digits = num_buf + sizeof(num_buf);
+    unsigned long long magnitude = 0;
+    int written = -1;
+    /* Whole numbers which a double holds exactly have at most 16 digits, which FLOAT_FORMAT
+       writes without an exponent, so they are written digit by digit instead of with sprintf.
+       -0 keeps its sign, as sprintf writes it. */
+    if (num >= -9007199254740992.0 && num <= 9007199254740992.0 &&
+        num == (double)(long long)num && !(num == 0.0 && signbit(num))) {
+        magnitude = num < 0 ? (unsigned long long)(-num) : (unsigned long long)num;
+        do {
+            *--digits = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (num < 0) {
+            *--digits = '-';
+        }
+        return output_append(out, digits, (size_t)(num_buf + sizeof(num_buf) - digits));
+    }
+    written = sprintf(num_buf, FLOAT_FORMAT, num);
+    if (written < 0) {
+        return -1;
     }
-    return written_total;
+    return output_append(out, num_buf, (size_t)written);
 }
 
-static int append_string(char *buf, const char *string)
+static int append_indent(JSON_Output *out, int level)
 {
-    if (buf == NULL) {
-        return (int)strlen(string);
+    int i;
+    for (i = 0; i < level; i++) {
+        APPEND_STRING("    ");
     }
-    return sprintf(buf, "%s", string);
+    return 0;
 }
 
 #undef APPEND_STRING
 #undef APPEND_INDENT
 
+/* Serializes the value and null-terminates the output */
+static JSON_Status json_serialize_to_output(const JSON_Value *value, JSON_Output *out,
+                                            int is_pretty)
+{
+    if (json_serialize_r(value, out, 0, is_pretty) != 0) {
+        return JSONFailure;
+    }
+    if (out->mode != JSONOutputCount) {
+        /* output_reserve always keeps room for the terminator, unless nothing was written into
+           an empty growable buffer */
+        if (output_reserve(out, 0) != 0) {
+            return JSONFailure;
+        }
+        out->buf[out->length] = '\0';
+    }
+    return JSONSuccess;
+}
+
 /* Parser API */
 JSON_Value *json_parse_string(const char *string)
 {
     if (string == NULL) {
         return NULL;
     }
-    if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
-        string = string + 3; /* Support for UTF-8 BOM */
+    return json_parse_buffer(string, strlen(string));
+}
+
+JSON_Value *json_parse_buffer(const char *buf, size_t len)
+{
+    const char *end = NULL;
+    if (buf == NULL) {
+        return NULL;
+    }
+    end = buf + len;
+    if (len >= 3 && buf[0] == '\xEF' && buf[1] == '\xBB' && buf[2] == '\xBF') {
+        buf = buf + 3; /* Support for UTF-8 BOM */
     }
-    return parse_value((const char **)&string, 0);
+    return parse_value(&buf, end, 0);
+}
+
+JSON_Status json_sax_parse_buffer(const char *buf, size_t len, JSON_Sax_Callback callback,
+                                  void *context)
+{
+    JSON_Sax_State state;
+    JSON_Status status = JSONFailure;
+    if (buf == NULL || callback == NULL) {
+        return JSONFailure;
+    }
+    memset(&state, 0, sizeof(state));
+    state.string = buf;
+    state.end = buf + len;
+    state.callback = callback;
+    state.context = context;
+    state.path_valid = 1;
+    if (len >= 3 && buf[0] == '\xEF' && buf[1] == '\xBB' && buf[2] == '\xBF') {
+        state.string = buf + 3; /* Support for UTF-8 BOM */
+    }
+    status = sax_parse_value(&state, 0);
+    return (status == JSONSuccess || state.stopped) ? JSONSuccess : JSONFailure;
 }
 
 JSON_Value *json_parse_string_with_comments(const char *string)
@@ -1236,7 +1812,8 @@ JSON_Value *json_parse_string_with_comments(const char *string)
     remove_comments(string_mutable_copy, "/*", "*/");
     remove_comments(string_mutable_copy, "//", "\n");
     string_mutable_copy_ptr = string_mutable_copy;
-    result = parse_value((const char **)&string_mutable_copy_ptr, 0);
+    result = parse_value((const char **)&string_mutable_copy_ptr,
+                         string_mutable_copy + strlen(string_mutable_copy), 0);
     parson_free(string_mutable_copy);
     return result;
 }
@@ -1633,89 +2210,84 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
     }
 }
 
-size_t json_serialization_size(const JSON_Value *value)
+static size_t json_serialization_size_r(const JSON_Value *value, int is_pretty)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Output out = {JSONOutputCount, NULL, 0, 0};
+    if (json_serialize_to_output(value, &out, is_pretty) == JSONFailure) {
+        return 0;
+    }
+    return out.length + 1;
 }
 
-JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
+static JSON_Status json_serialize_to_buffer_r(const JSON_Value *value, char *buf,
+                                              size_t buf_size_in_bytes, int is_pretty)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0) {
+    JSON_Output out = {JSONOutputFixed, buf, buf_size_in_bytes, 0};
+    if (buf == NULL || buf_size_in_bytes == 0) {
         return JSONFailure;
     }
-    return JSONSuccess;
+    return json_serialize_to_output(value, &out, is_pretty);
 }
 
-char *json_serialize_to_string(const JSON_Value *value)
+static char *json_serialize_to_string_r(const JSON_Value *value, int is_pretty)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
+    JSON_Output out = {JSONOutputGrowable, NULL, 0, 0};
+    if (json_serialize_to_output(value, &out, is_pretty) == JSONFailure) {
+        parson_free(out.buf);
         return NULL;
     }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
+    return out.buf;
+}
+
+size_t json_serialization_size(const JSON_Value *value)
+{
+    return json_serialization_size_r(value, 0);
+}
+
+JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
+{
+    return json_serialize_to_buffer_r(value, buf, buf_size_in_bytes, 0);
+}
+
+char *json_serialize_to_string(const JSON_Value *value)
+{
+    return json_serialize_to_string_r(value, 0);
+}
+
+JSON_Status json_serialize_to_growable_buffer(const JSON_Value *value, char **buf,
+                                              size_t *buf_size_in_bytes, size_t *length)
+{
+    JSON_Output out = {JSONOutputGrowable, NULL, 0, 0};
+    JSON_Status status = JSONFailure;
+    if (buf == NULL || buf_size_in_bytes == NULL || (*buf == NULL && *buf_size_in_bytes != 0)) {
+        return JSONFailure;
     }
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
+    out.buf = *buf;
+    out.size = *buf_size_in_bytes;
+    status = json_serialize_to_output(value, &out, 0);
+    /* The buffer may have been replaced even if the serialization failed */
+    *buf = out.buf;
+    *buf_size_in_bytes = out.size;
+    if (length != NULL) {
+        *length = status == JSONSuccess ? out.length : 0;
     }
-    return buf;
+    return status;
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    return json_serialization_size_r(value, 1);
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                             size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0) {
-        return JSONFailure;
-    }
-    return JSONSuccess;
+    return json_serialize_to_buffer_r(value, buf, buf_size_in_bytes, 1);
 }
 
 char *json_serialize_to_string_pretty(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+    return json_serialize_to_string_r(value, 1);
 }
 
 void json_free_serialized_string(char *string)
@@ -1880,16 +2452,13 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
     if (object == NULL || name == NULL || value == NULL || value->parent != NULL) {
         return JSONFailure;
     }
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
+    i = json_object_find_index(object, name, strlen(name));
+    if (i < object->count) { /* free and overwrite old value */
+        old_value = object->values[i];
         json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                value->parent = json_object_get_wrapping_value(object);
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+        value->parent = json_object_get_wrapping_value(object);
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
     return json_object_add(object, name, value);
@@ -2032,6 +2601,7 @@ JSON_Status json_object_clear(JSON_Object *object)
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    json_object_index_build(object);
     return JSONSuccess;
 }
 
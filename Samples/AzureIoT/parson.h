@@ -66,15 +66,69 @@ void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Fu
 /*  Parses first JSON value in a string, returns NULL in case of error */
 JSON_Value *json_parse_string(const char *string);
 
+/*  Parses first JSON value in the first len bytes of buf, which need not be null-terminated,
+    such as a payload from the IoT Hub SDK. Returns NULL in case of error */
+JSON_Value *json_parse_buffer(const char *buf, size_t len);
+
 /*  Parses first JSON value in a string and ignores comments (/ * * / and //),
     returns NULL in case of error */
 JSON_Value *json_parse_string_with_comments(const char *string);
 
-/* Serialization */
+/* Streaming parser, which reports the document as a series of events instead of building it */
+enum json_sax_event_type_t {
+    JSONSaxObjectStart = 1,
+    JSONSaxObjectEnd = 2,
+    JSONSaxArrayStart = 3,
+    JSONSaxArrayEnd = 4,
+    JSONSaxKey = 5,  /* name of the next member of an object */
+    JSONSaxValue = 6 /* a string, number, boolean or null */
+};
+typedef int JSON_Sax_Event_Type;
+
+typedef struct json_sax_event_t {
+    JSON_Sax_Event_Type type;
+    /* Names of the objects which hold the current value, and its own name, separated by '.',
+       such as "desired.StatusLED.value". Values in an array have the path of the array. NULL if
+       the path is too long to be reported. */
+    const char *path;
+    size_t depth; /* number of objects and arrays which hold the current value */
+    /* The key, or the value of a JSONString, decoded and null-terminated */
+    const char *string;
+    size_t string_len;
+    JSON_Value_Type value_type; /* for JSONSaxValue */
+    double number;
+    int boolean;
+} JSON_Sax_Event;
+
+/* The event, and the strings it refers to, are only valid until the callback returns. Return 0
+   to continue parsing, or any other value to stop, such as once the fields which are needed have
+   been found. */
+typedef int (*JSON_Sax_Callback)(const JSON_Sax_Event *event, void *context);
+
+/*  Parses first JSON value in the first len bytes of buf, which need not be null-terminated,
+    calling the callback for each part of it. At most one key or string is allocated at a time,
+    so the memory which is used does not grow with the size of the document. Returns
+    JSONSuccess if the value was valid or the callback stopped the parser before the end,
+    otherwise JSONFailure. */
+JSON_Status json_sax_parse_buffer(const char *buf, size_t len, JSON_Sax_Callback callback,
+                                  void *context);
+
+/* Serialization
+   Each value is serialized in a single pass. json_serialize_to_buffer fails if the output and
+   its null terminator do not fit, in which case the contents of buf are undefined. */
 size_t json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
 char *json_serialize_to_string(const JSON_Value *value);
 
+/*  Serializes into a buffer which was allocated with the malloc function that parson uses, such
+    as one from an earlier call, or NULL with a size of 0. If the output does not fit, the buffer
+    is freed and replaced by a larger one, and *buf and *buf_size_in_bytes are updated, so a
+    buffer which is kept between calls stops being reallocated once it is large enough. length
+    receives the length of the output, not counting its null terminator, and may be NULL. Free
+    the buffer with json_free_serialized_string. */
+JSON_Status json_serialize_to_growable_buffer(const JSON_Value *value, char **buf,
+                                              size_t *buf_size_in_bytes, size_t *length);
+
 /* Pretty serialization */
 size_t json_serialization_size_pretty(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "reconnect_manager.h"
+
+// Longest delay after the SAS token expired.
+static const int tokenExpiredMaxDelaySeconds = 10;
+
+/// <summary>
+///     Returns the next number from a xorshift32 generator, which is good enough for jitter.
+/// </summary>
+static uint32_t NextRandom(ReconnectManager *manager)
+{
+    uint32_t x = manager->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    manager->randomState = x;
+    return x;
+}
+
+/// <summary>
+///     Picks a delay between half of the limit and the limit, so that the delay still grows
+///     with each failure but the devices spread out.
+/// </summary>
+static int Jitter(ReconnectManager *manager, int limitSeconds)
+{
+    int half = limitSeconds / 2;
+    return half + (int)(NextRandom(manager) % (uint32_t)(limitSeconds - half + 1));
+}
+
+void ReconnectManager_Init(ReconnectManager *manager, int minDelaySeconds, int maxDelaySeconds,
+                           uint32_t seed)
+{
+    memset(manager, 0, sizeof(*manager));
+    manager->minDelaySeconds = minDelaySeconds;
+    manager->maxDelaySeconds = maxDelaySeconds;
+    // xorshift must not start from 0.
+    manager->randomState = (seed != 0) ? seed : 0x9e3779b9u;
+}
+
+bool ReconnectManager_IsDue(const ReconnectManager *manager, const struct timespec *now)
+{
+    if (now->tv_sec != manager->nextAttempt.tv_sec) {
+        return now->tv_sec > manager->nextAttempt.tv_sec;
+    }
+    return now->tv_nsec >= manager->nextAttempt.tv_nsec;
+}
+
+int ReconnectManager_OnFailure(ReconnectManager *manager, ReconnectReason reason,
+                               const struct timespec *now)
+{
+    int delaySeconds;
+    switch (reason) {
+    case ReconnectReason_NotReady:
+        delaySeconds = 0;
+        break;
+    case ReconnectReason_TokenExpired:
+        delaySeconds = Jitter(manager, tokenExpiredMaxDelaySeconds);
+        break;
+    case ReconnectReason_Rejected:
+        delaySeconds = Jitter(manager, manager->maxDelaySeconds);
+        break;
+    case ReconnectReason_Transient:
+    default: {
+        int limitSeconds = manager->minDelaySeconds;
+        for (uint32_t i = 0; i < manager->failures && limitSeconds < manager->maxDelaySeconds;
+             i++) {
+            limitSeconds *= 2;
+        }
+        if (limitSeconds > manager->maxDelaySeconds) {
+            limitSeconds = manager->maxDelaySeconds;
+        }
+        ++manager->failures;
+        delaySeconds = Jitter(manager, limitSeconds);
+        break;
+    }
+    }
+
+    manager->nextAttempt = *now;
+    manager->nextAttempt.tv_sec += delaySeconds;
+    return delaySeconds;
+}
+
+void ReconnectManager_OnConnected(ReconnectManager *manager)
+{
+    manager->failures = 0;
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/// <summary>
+///     Why the connection to IoT Hub failed or was lost, which decides how long to wait before
+///     the next attempt.
+/// </summary>
+typedef enum {
+    /// <summary>A failure which may clear by itself, such as a communication error or a
+    /// provisioning error. Each such failure in a row doubles the delay.</summary>
+    ReconnectReason_Transient,
+    /// <summary>The SAS token expired, which the client is expected to renew, so the next
+    /// attempt is made soon.</summary>
+    ReconnectReason_TokenExpired,
+    /// <summary>The device is disabled or its credentials were rejected, which is not expected
+    /// to change soon, so the longest delay is used.</summary>
+    ReconnectReason_Rejected,
+    /// <summary>The network or device authentication is not ready. The attempt is made once it
+    /// is, without counting as a failure.</summary>
+    ReconnectReason_NotReady
+} ReconnectReason;
+
+/// <summary>
+/// <para>Decides when to try to connect to IoT Hub again, with an exponential backoff and jitter.
+/// The delay after each transient failure in a row doubles from the minimum to the maximum, and a
+/// random part of it is subtracted, so that devices which lost their connection at the same time,
+/// such as during an outage, do not all reconnect at the same moment.</para>
+/// <para>Times are given by the caller from CLOCK_MONOTONIC.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="ReconnectManager_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    int minDelaySeconds;
+    int maxDelaySeconds;
+    /// <summary>Number of transient failures in a row.</summary>
+    uint32_t failures;
+    /// <summary>State of the random number generator for the jitter.</summary>
+    uint32_t randomState;
+    /// <summary>Time after which the next attempt may be made.</summary>
+    struct timespec nextAttempt;
+} ReconnectManager;
+
+/// <summary>
+///     Initializes a manager, which allows an attempt straight away.
+/// </summary>
+/// <param name="manager">Manager to initialize.</param>
+/// <param name="minDelaySeconds">Delay after the first transient failure.</param>
+/// <param name="maxDelaySeconds">Longest delay.</param>
+/// <param name="seed">Seed for the jitter, which should differ between devices.</param>
+void ReconnectManager_Init(ReconnectManager *manager, int minDelaySeconds, int maxDelaySeconds,
+                           uint32_t seed);
+
+/// <summary>
+///     Checks whether the next attempt may be made.
+/// </summary>
+/// <param name="manager">The manager.</param>
+/// <param name="now">The current time.</param>
+bool ReconnectManager_IsDue(const ReconnectManager *manager, const struct timespec *now);
+
+/// <summary>
+///     Records that an attempt failed, or that the connection was lost, and schedules the next
+///     attempt.
+/// </summary>
+/// <param name="manager">The manager.</param>
+/// <param name="reason">Why the connection failed.</param>
+/// <param name="now">The current time.</param>
+/// <returns>The delay before the next attempt, in seconds</returns>
+int ReconnectManager_OnFailure(ReconnectManager *manager, ReconnectReason reason,
+                               const struct timespec *now);
+
+/// <summary>
+///     Records that the device is connected, so that the next failure starts from the minimum
+///     delay again.
+/// </summary>
+/// <param name="manager">The manager.</param>
+void ReconnectManager_OnConnected(ReconnectManager *manager);
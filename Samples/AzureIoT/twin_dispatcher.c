@@ -0,0 +1,449 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "app_log.h"
+#include "json_writer.h"
+#include "twin_dispatcher.h"
+
+/// <summary>
+///     A name in the path of a value, which refers to the payload.
+/// </summary>
+typedef struct {
+    const char *text;
+    size_t length;
+} Name;
+
+/// <summary>
+///     The state of parsing one twin payload.
+/// </summary>
+typedef struct {
+    const char *position;
+    const char *end;
+    /// <summary>Names of the objects which hold the current value, and its own name.</summary>
+    Name path[TWIN_DISPATCHER_MAX_DEPTH];
+    size_t depth;
+    /// <summary>Number of path names before the desired properties: 1 for "desired" in the
+    /// complete twin, 0 for a partial update.</summary>
+    size_t desiredDepth;
+    /// <summary>Number of arrays which hold the current value. Values in arrays are not
+    /// dispatched.</summary>
+    size_t arrayDepth;
+    const TwinDispatcher *dispatcher;
+    /// <summary>The value of each registered property which was found.</summary>
+    TwinValue values[TWIN_DISPATCHER_MAX_PROPERTIES];
+    bool found[TWIN_DISPATCHER_MAX_PROPERTIES];
+    int64_t version;
+    /// <summary>When this is set, the members of the outermost object are passed to it
+    /// instead of being dispatched.</summary>
+    TwinMemberHandler memberHandler;
+    void *memberContext;
+    /// <summary>Number of members which were passed to the member handler.</summary>
+    int memberCount;
+} Parser;
+
+static bool ParseValue(Parser *parser);
+
+static void SkipWhitespace(Parser *parser)
+{
+    while (parser->position < parser->end &&
+           (*parser->position == ' ' || *parser->position == '\t' || *parser->position == '\n' ||
+            *parser->position == '\r')) {
+        ++parser->position;
+    }
+}
+
+/// <summary>
+///     Checks whether a name is the same as the first part of a dotted path.
+/// </summary>
+/// <returns>The rest of the path after the name and any '.', or NULL if they differ</returns>
+static const char *MatchName(const char *path, const Name *name)
+{
+    if (strncmp(path, name->text, name->length) != 0) {
+        return NULL;
+    }
+    path += name->length;
+    if (*path == '.') {
+        return path + 1;
+    }
+    return (*path == '\0') ? path : NULL;
+}
+
+/// <summary>
+///     Checks whether the current value is at a dotted path within the desired properties.
+/// </summary>
+static bool PathEquals(const Parser *parser, const char *path)
+{
+    for (size_t i = parser->desiredDepth; i < parser->depth; i++) {
+        if (*path == '\0') {
+            return false;
+        }
+        path = MatchName(path, &parser->path[i]);
+        if (path == NULL) {
+            return false;
+        }
+    }
+    return *path == '\0';
+}
+
+/// <summary>
+///     Records a value which has been parsed, if it is a registered property or the desired
+///     $version.
+/// </summary>
+static void VisitValue(Parser *parser, const TwinValue *value)
+{
+    if (parser->memberHandler != NULL) {
+        if (parser->depth == 1 && parser->arrayDepth == 0) {
+            parser->memberHandler(parser->path[0].text, parser->path[0].length, value,
+                                  parser->memberContext);
+            ++parser->memberCount;
+        }
+        return;
+    }
+
+    if (parser->arrayDepth > 0 || parser->depth <= parser->desiredDepth) {
+        return;
+    }
+    if (parser->desiredDepth == 1 &&
+        (parser->path[0].length != 7 || strncmp(parser->path[0].text, "desired", 7) != 0)) {
+        return;
+    }
+
+    if (parser->depth == parser->desiredDepth + 1 && PathEquals(parser, "$version")) {
+        double version;
+        if (TwinValue_GetNumber(value, &version)) {
+            parser->version = (int64_t)version;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < parser->dispatcher->propertyCount; i++) {
+        if (PathEquals(parser, parser->dispatcher->properties[i].path)) {
+            parser->values[i] = *value;
+            parser->found[i] = true;
+        }
+    }
+}
+
+/// <summary>
+///     Parses a string, whose opening quote is at the current position.
+/// </summary>
+/// <param name="name">Receives the text between the quotes.</param>
+static bool ParseString(Parser *parser, Name *name)
+{
+    const char *start = ++parser->position;
+    while (parser->position < parser->end) {
+        char c = *parser->position++;
+        if (c == '"') {
+            name->text = start;
+            name->length = (size_t)(parser->position - 1 - start);
+            return true;
+        }
+        if (c == '\\') {
+            ++parser->position;
+        }
+    }
+    return false;
+}
+
+static bool ParseObject(Parser *parser)
+{
+    ++parser->position;
+    SkipWhitespace(parser);
+    if (parser->position < parser->end && *parser->position == '}') {
+        ++parser->position;
+        return true;
+    }
+    if (parser->depth >= TWIN_DISPATCHER_MAX_DEPTH) {
+        Log_Debug("ERROR: Device twin is nested too deeply.\n");
+        return false;
+    }
+
+    while (parser->position < parser->end) {
+        if (*parser->position != '"' || !ParseString(parser, &parser->path[parser->depth])) {
+            return false;
+        }
+        SkipWhitespace(parser);
+        if (parser->position >= parser->end || *parser->position++ != ':') {
+            return false;
+        }
+
+        ++parser->depth;
+        bool parsed = ParseValue(parser);
+        --parser->depth;
+        if (!parsed) {
+            return false;
+        }
+
+        SkipWhitespace(parser);
+        if (parser->position >= parser->end) {
+            return false;
+        }
+        char c = *parser->position++;
+        if (c == '}') {
+            return true;
+        }
+        if (c != ',') {
+            return false;
+        }
+        SkipWhitespace(parser);
+    }
+    return false;
+}
+
+static bool ParseArray(Parser *parser)
+{
+    ++parser->position;
+    SkipWhitespace(parser);
+    if (parser->position < parser->end && *parser->position == ']') {
+        ++parser->position;
+        return true;
+    }
+    if (parser->arrayDepth >= TWIN_DISPATCHER_MAX_DEPTH) {
+        Log_Debug("ERROR: Device twin is nested too deeply.\n");
+        return false;
+    }
+
+    ++parser->arrayDepth;
+    bool parsed = false;
+    while (ParseValue(parser)) {
+        SkipWhitespace(parser);
+        if (parser->position >= parser->end) {
+            break;
+        }
+        char c = *parser->position++;
+        if (c == ']') {
+            parsed = true;
+            break;
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+    --parser->arrayDepth;
+    return parsed;
+}
+
+/// <summary>
+///     Parses a literal or a number, which continues until the next delimiter.
+/// </summary>
+static bool ParseScalar(Parser *parser, TwinValue *value)
+{
+    const char *start = parser->position;
+    while (parser->position < parser->end && strchr(",}] \t\r\n", *parser->position) == NULL) {
+        ++parser->position;
+    }
+    size_t length = (size_t)(parser->position - start);
+
+    if (length == 4 && strncmp(start, "true", 4) == 0) {
+        value->type = TwinValueType_Bool;
+    } else if (length == 5 && strncmp(start, "false", 5) == 0) {
+        value->type = TwinValueType_Bool;
+    } else if (length == 4 && strncmp(start, "null", 4) == 0) {
+        value->type = TwinValueType_Null;
+    } else if (length > 0 && (*start == '-' || (*start >= '0' && *start <= '9'))) {
+        value->type = TwinValueType_Number;
+    } else {
+        return false;
+    }
+    value->text = start;
+    value->length = length;
+    return true;
+}
+
+static bool ParseValue(Parser *parser)
+{
+    SkipWhitespace(parser);
+    if (parser->position >= parser->end) {
+        return false;
+    }
+
+    TwinValue value;
+    const char *start = parser->position;
+    bool parsed;
+    switch (*start) {
+    case '{':
+        value.type = TwinValueType_Object;
+        parsed = ParseObject(parser);
+        break;
+    case '[':
+        value.type = TwinValueType_Array;
+        parsed = ParseArray(parser);
+        break;
+    case '"': {
+        Name text;
+        value.type = TwinValueType_String;
+        parsed = ParseString(parser, &text);
+        value.text = text.text;
+        value.length = text.length;
+        break;
+    }
+    default:
+        parsed = ParseScalar(parser, &value);
+        break;
+    }
+
+    if (!parsed) {
+        return false;
+    }
+    if (value.type == TwinValueType_Object || value.type == TwinValueType_Array) {
+        value.text = start;
+        value.length = (size_t)(parser->position - start);
+    }
+    VisitValue(parser, &value);
+    return true;
+}
+
+int TwinDispatcher_Init(TwinDispatcher *dispatcher, const TwinProperty *properties,
+                        size_t propertyCount)
+{
+    memset(dispatcher, 0, sizeof(*dispatcher));
+    dispatcher->desiredVersion = -1;
+    if (propertyCount > TWIN_DISPATCHER_MAX_PROPERTIES) {
+        Log_Debug("ERROR: Too many device twin properties.\n");
+        return -1;
+    }
+    dispatcher->properties = properties;
+    dispatcher->propertyCount = propertyCount;
+    return 0;
+}
+
+int TwinDispatcher_Dispatch(TwinDispatcher *dispatcher, bool complete, const unsigned char *payload,
+                            size_t payloadSize)
+{
+    Parser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.position = (const char *)payload;
+    parser.end = parser.position + payloadSize;
+    parser.desiredDepth = complete ? 1 : 0;
+    parser.dispatcher = dispatcher;
+    parser.version = -1;
+
+    SkipWhitespace(&parser);
+    if (parser.position >= parser.end || *parser.position != '{' || !ParseValue(&parser)) {
+        APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_ERROR, 3, 10000,
+                             "ERROR: Could not parse the device twin.\n");
+        return -1;
+    }
+
+    if (parser.version >= 0 && parser.version <= dispatcher->desiredVersion) {
+        ++dispatcher->skippedUpdates;
+        APP_LOG_DEBUG("INFO: Device twin desired version %lld was already applied.\n",
+                      (long long)parser.version);
+        return 0;
+    }
+    if (parser.version >= 0) {
+        dispatcher->desiredVersion = parser.version;
+    }
+
+    int handlersCalled = 0;
+    for (size_t i = 0; i < dispatcher->propertyCount; i++) {
+        if (parser.found[i]) {
+            const TwinProperty *property = &dispatcher->properties[i];
+            property->handler(&parser.values[i], property->context);
+            ++handlersCalled;
+        }
+    }
+    return handlersCalled;
+}
+
+int TwinValue_ForEachMember(const TwinValue *value, TwinMemberHandler handler, void *context)
+{
+    if (value->type != TwinValueType_Object) {
+        return -1;
+    }
+
+    Parser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.position = value->text;
+    parser.end = value->text + value->length;
+    parser.memberHandler = handler;
+    parser.memberContext = context;
+    return ParseValue(&parser) ? parser.memberCount : -1;
+}
+
+bool TwinValue_GetBool(const TwinValue *value, bool *result)
+{
+    if (value->type != TwinValueType_Bool) {
+        return false;
+    }
+    *result = (value->text[0] == 't');
+    return true;
+}
+
+bool TwinValue_GetNumber(const TwinValue *value, double *result)
+{
+    // strtod needs a null-terminated string, so the number is copied.
+    char number[32];
+    if (value->type != TwinValueType_Number || value->length >= sizeof(number)) {
+        return false;
+    }
+    memcpy(number, value->text, value->length);
+    number[value->length] = '\0';
+
+    char *end;
+    *result = strtod(number, &end);
+    return *end == '\0';
+}
+
+int TwinDispatcher_SetReported(TwinDispatcher *dispatcher, const char *name,
+                               const char *jsonValue)
+{
+    size_t nameLength = strlen(name);
+    size_t valueLength = strlen(jsonValue);
+    if (nameLength > TWIN_DISPATCHER_MAX_NAME_LENGTH ||
+        valueLength > TWIN_DISPATCHER_MAX_VALUE_LENGTH) {
+        Log_Debug("ERROR: Reported property '%s' is too long.\n", name);
+        return -1;
+    }
+
+    TwinReportedProperty *property = NULL;
+    for (size_t i = 0; i < dispatcher->reportedCount; i++) {
+        if (strcmp(dispatcher->reported[i].name, name) == 0) {
+            property = &dispatcher->reported[i];
+            break;
+        }
+    }
+    if (property == NULL) {
+        if (dispatcher->reportedCount == TWIN_DISPATCHER_MAX_REPORTED) {
+            Log_Debug("ERROR: Too many reported properties are waiting to be sent.\n");
+            return -1;
+        }
+        property = &dispatcher->reported[dispatcher->reportedCount++];
+        memcpy(property->name, name, nameLength + 1);
+    }
+    memcpy(property->value, jsonValue, valueLength + 1);
+    return 0;
+}
+
+int TwinDispatcher_SetReportedBool(TwinDispatcher *dispatcher, const char *name, bool value)
+{
+    return TwinDispatcher_SetReported(dispatcher, name, value ? "true" : "false");
+}
+
+int TwinDispatcher_FormatReported(const TwinDispatcher *dispatcher, char *buffer,
+                                  size_t bufferSize)
+{
+    if (dispatcher->reportedCount == 0) {
+        return 0;
+    }
+
+    JsonWriter writer;
+    JsonWriter_Init(&writer, buffer, bufferSize);
+    JsonWriter_BeginObject(&writer);
+    for (size_t i = 0; i < dispatcher->reportedCount; i++) {
+        JsonWriter_Key(&writer, dispatcher->reported[i].name);
+        JsonWriter_Raw(&writer, dispatcher->reported[i].value);
+    }
+    JsonWriter_EndObject(&writer);
+    return JsonWriter_Finish(&writer);
+}
+
+void TwinDispatcher_ClearReported(TwinDispatcher *dispatcher)
+{
+    dispatcher->reportedCount = 0;
+}
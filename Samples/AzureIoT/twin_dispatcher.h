@@ -0,0 +1,192 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Number of desired properties whose handlers can be registered.</summary>
+#define TWIN_DISPATCHER_MAX_PROPERTIES 8
+
+/// <summary>Number of reported properties which can wait to be sent at once.</summary>
+#define TWIN_DISPATCHER_MAX_REPORTED 8
+
+/// <summary>Longest name of a reported property, not including the null terminator.</summary>
+#define TWIN_DISPATCHER_MAX_NAME_LENGTH 31
+
+/// <summary>Longest JSON value of a reported property, not including the null
+/// terminator.</summary>
+#define TWIN_DISPATCHER_MAX_VALUE_LENGTH 31
+
+/// <summary>Deepest nesting of objects and arrays in a twin document which can be
+/// parsed.</summary>
+#define TWIN_DISPATCHER_MAX_DEPTH 8
+
+/// <summary>
+///     The JSON types of a property value.
+/// </summary>
+typedef enum {
+    TwinValueType_Null,
+    TwinValueType_Bool,
+    TwinValueType_Number,
+    TwinValueType_String,
+    TwinValueType_Object,
+    TwinValueType_Array
+} TwinValueType;
+
+/// <summary>
+///     A property value, which refers to the twin payload rather than being copied out of it.
+///     It is only valid while the property handler runs.
+/// </summary>
+typedef struct {
+    TwinValueType type;
+    /// <summary>The JSON text of the value. For a string, this is the text between the
+    /// quotes, with any escape sequences left as they are.</summary>
+    const char *text;
+    size_t length;
+} TwinValue;
+
+/// <summary>
+///     Function which applies a desired property.
+/// </summary>
+/// <param name="value">The value of the property.</param>
+/// <param name="context">The context which was registered with the property.</param>
+typedef void (*TwinPropertyHandler)(const TwinValue *value, void *context);
+
+/// <summary>
+///     A desired property, and the handler which applies it.
+/// </summary>
+typedef struct {
+    /// <summary>Path of the property in the desired properties, with '.' between the names of
+    /// nested objects, such as "StatusLED.value".</summary>
+    const char *path;
+    TwinPropertyHandler handler;
+    void *context;
+} TwinProperty;
+
+/// <summary>
+///     A reported property which waits to be sent.
+/// </summary>
+typedef struct {
+    char name[TWIN_DISPATCHER_MAX_NAME_LENGTH + 1];
+    char value[TWIN_DISPATCHER_MAX_VALUE_LENGTH + 1];
+} TwinReportedProperty;
+
+/// <summary>
+/// <para>Dispatches device twin updates to the handlers of the desired properties which they
+/// hold, and collects reported properties so that they are sent together.</para>
+/// <para>The twin payload is parsed in place, within its length, without copying it or
+/// building a document tree, and only the registered properties are extracted. An update
+/// whose desired $version has already been applied is skipped, such as the complete twin
+/// which is received again after reconnecting.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="TwinDispatcher_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    const TwinProperty *properties;
+    size_t propertyCount;
+    /// <summary>The desired $version which was last applied, or -1 if none was.</summary>
+    int64_t desiredVersion;
+    /// <summary>Number of updates which were skipped because their version was
+    /// applied already.</summary>
+    uint32_t skippedUpdates;
+    TwinReportedProperty reported[TWIN_DISPATCHER_MAX_REPORTED];
+    size_t reportedCount;
+} TwinDispatcher;
+
+/// <summary>
+///     Initializes a dispatcher.
+/// </summary>
+/// <param name="dispatcher">Dispatcher to initialize.</param>
+/// <param name="properties">The desired properties and their handlers. This must remain valid
+/// while the dispatcher is used.</param>
+/// <param name="propertyCount">The number of properties, which is at most
+/// TWIN_DISPATCHER_MAX_PROPERTIES.</param>
+/// <returns>0 on success, or -1 if there are too many properties</returns>
+int TwinDispatcher_Init(TwinDispatcher *dispatcher, const TwinProperty *properties,
+                        size_t propertyCount);
+
+/// <summary>
+///     Parses a twin update, and calls the handler of each registered property which it holds.
+/// </summary>
+/// <param name="dispatcher">The dispatcher.</param>
+/// <param name="complete">true for the complete twin, whose desired properties are in the
+/// "desired" object; false for a partial update, which only holds desired properties.</param>
+/// <param name="payload">The JSON payload, which need not be null-terminated.</param>
+/// <param name="payloadSize">The length of the payload.</param>
+/// <returns>The number of handlers which were called, or -1 if the payload is not valid
+/// JSON</returns>
+int TwinDispatcher_Dispatch(TwinDispatcher *dispatcher, bool complete, const unsigned char *payload,
+                            size_t payloadSize);
+
+/// <summary>
+///     Function which receives a member of an object.
+/// </summary>
+/// <param name="name">The name of the member, which is not null-terminated, with any escape
+/// sequences left as they are.</param>
+/// <param name="length">The length of the name.</param>
+/// <param name="value">The value of the member.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="TwinValue_ForEachMember" />.</param>
+typedef void (*TwinMemberHandler)(const char *name, size_t length, const TwinValue *value,
+                                  void *context);
+
+/// <summary>
+///     Calls a handler for each member of an object value, in the order in which they appear,
+///     such as for the settings in a desired property whose names are not known in advance.
+/// </summary>
+/// <param name="value">The object.</param>
+/// <param name="handler">Function which receives each member.</param>
+/// <param name="context">Value which is passed to the handler.</param>
+/// <returns>The number of members, or -1 if the value is not an object</returns>
+int TwinValue_ForEachMember(const TwinValue *value, TwinMemberHandler handler, void *context);
+
+/// <summary>
+///     Gets a boolean value.
+/// </summary>
+/// <returns>true if the value is a boolean, otherwise false</returns>
+bool TwinValue_GetBool(const TwinValue *value, bool *result);
+
+/// <summary>
+///     Gets a numeric value.
+/// </summary>
+/// <returns>true if the value is a number, otherwise false</returns>
+bool TwinValue_GetNumber(const TwinValue *value, double *result);
+
+/// <summary>
+///     Sets a reported property, which is sent with the others at the next
+///     <see cref="TwinDispatcher_FormatReported" />. Setting a property again before then
+///     replaces its value, so only the latest value is sent.
+/// </summary>
+/// <param name="dispatcher">The dispatcher.</param>
+/// <param name="name">The name of the property.</param>
+/// <param name="jsonValue">The value, as JSON text, such as "true" or "\"text\"".</param>
+/// <returns>0 on success, or -1 if the name or value is too long, or too many properties are
+/// waiting</returns>
+int TwinDispatcher_SetReported(TwinDispatcher *dispatcher, const char *name,
+                               const char *jsonValue);
+
+/// <summary>
+///     Sets a boolean reported property.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int TwinDispatcher_SetReportedBool(TwinDispatcher *dispatcher, const char *name, bool value);
+
+/// <summary>
+///     Formats the reported properties which are waiting as a single JSON object, for
+///     IoTHubDeviceClient_LL_SendReportedState.
+/// </summary>
+/// <param name="dispatcher">The dispatcher.</param>
+/// <param name="buffer">Receives the JSON, followed by a null terminator.</param>
+/// <param name="bufferSize">The size of the buffer.</param>
+/// <returns>The length of the JSON, 0 if no properties are waiting, or -1 if it does not fit
+/// in the buffer</returns>
+int TwinDispatcher_FormatReported(const TwinDispatcher *dispatcher, char *buffer,
+                                  size_t bufferSize);
+
+/// <summary>
+///     Discards the reported properties which are waiting, once they have been sent.
+/// </summary>
+/// <param name="dispatcher">The dispatcher.</param>
+void TwinDispatcher_ClearReported(TwinDispatcher *dispatcher);
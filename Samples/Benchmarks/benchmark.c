@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "benchmark.h"
+
+volatile uint32_t benchmarkSink;
+
+static uint64_t GetCurrentTimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t TimeIterations(const Benchmark *benchmark, uint32_t iterations)
+{
+    uint64_t startNs = GetCurrentTimeNs();
+    benchmark->run(iterations);
+    return GetCurrentTimeNs() - startNs;
+}
+
+void Benchmark_Measure(const Benchmark *benchmark, unsigned int minSampleMs,
+                       unsigned int sampleCount, BenchmarkResult *result)
+{
+    if (benchmark->setup != NULL) {
+        benchmark->setup();
+    }
+
+    // Find how many iterations take at least minSampleMs. This also warms up the caches.
+    const uint64_t minSampleNs = (uint64_t)minSampleMs * 1000000ULL;
+    uint32_t iterations = 1;
+    uint64_t elapsedNs = TimeIterations(benchmark, iterations);
+    while (elapsedNs < minSampleNs && iterations < (1U << 30)) {
+        iterations *= 2;
+        elapsedNs = TimeIterations(benchmark, iterations);
+    }
+
+    uint64_t fastestNs = elapsedNs;
+    for (unsigned int i = 1; i < sampleCount; ++i) {
+        elapsedNs = TimeIterations(benchmark, iterations);
+        if (elapsedNs < fastestNs) {
+            fastestNs = elapsedNs;
+        }
+    }
+
+    result->nsPerOp = (double)fastestNs / iterations;
+    result->bytesPerSec =
+        (benchmark->bytesPerOp == 0) ? 0 : (double)benchmark->bytesPerOp * 1e9 / result->nsPerOp;
+}
+
+int BenchmarkBaseline_Read(BenchmarkBaseline *baseline, const char *path)
+{
+    baseline->count = 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char line[128];
+    const size_t capacity = sizeof(baseline->entries) / sizeof(baseline->entries[0]);
+    while (fgets(line, sizeof(line), file) != NULL && baseline->count < capacity) {
+        char name[sizeof(baseline->entries[0].name)];
+        double nsPerOp;
+        if (line[0] == '#' || sscanf(line, "%63s %lf", name, &nsPerOp) != 2) {
+            continue;
+        }
+        strcpy(baseline->entries[baseline->count].name, name);
+        baseline->entries[baseline->count].nsPerOp = nsPerOp;
+        ++baseline->count;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+double BenchmarkBaseline_Find(const BenchmarkBaseline *baseline, const char *name)
+{
+    for (size_t i = 0; i < baseline->count; ++i) {
+        if (strcmp(baseline->entries[i].name, name) == 0) {
+            return baseline->entries[i].nsPerOp;
+        }
+    }
+    return 0;
+}
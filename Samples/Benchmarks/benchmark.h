@@ -0,0 +1,80 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Runs the operation being measured the given number of times. Results which would
+///     otherwise be unused should be added to <see cref="benchmarkSink" />, so that the compiler
+///     does not remove the work.
+/// </summary>
+typedef void (*BenchmarkRunHandler)(uint32_t iterations);
+
+/// <summary>
+///     One micro-benchmark.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the benchmark, which identifies it in the baseline.</summary>
+    const char *name;
+    /// <summary>Called once before the benchmark is measured, or NULL.</summary>
+    void (*setup)(void);
+    BenchmarkRunHandler run;
+    /// <summary>Number of bytes which one operation processes, or 0 if bytes/s is not
+    /// meaningful for the benchmark.</summary>
+    size_t bytesPerOp;
+} Benchmark;
+
+/// <summary>
+///     Result of a benchmark. The fastest of several samples is kept, as the slower samples
+///     were interrupted by other work on the machine.
+/// </summary>
+typedef struct {
+    double nsPerOp;
+    /// <summary>Bytes per second, or 0 if the benchmark does not process bytes.</summary>
+    double bytesPerSec;
+} BenchmarkResult;
+
+/// <summary>Results which must not be optimized away are accumulated here.</summary>
+extern volatile uint32_t benchmarkSink;
+
+/// <summary>
+///     Measures a benchmark. The number of iterations is doubled until one sample takes at
+///     least minSampleMs, and then sampleCount samples of that many iterations are taken.
+/// </summary>
+/// <param name="benchmark">The benchmark to measure.</param>
+/// <param name="minSampleMs">Minimum duration of one sample, in milliseconds.</param>
+/// <param name="sampleCount">Number of samples to take.</param>
+/// <param name="result">Receives the result.</param>
+void Benchmark_Measure(const Benchmark *benchmark, unsigned int minSampleMs,
+                       unsigned int sampleCount, BenchmarkResult *result);
+
+/// <summary>
+///     Baseline of stored results, read from a text file with one line per benchmark, holding
+///     its name and its ns/op. Lines which start with '#' are ignored.
+/// </summary>
+typedef struct {
+    size_t count;
+    struct {
+        char name[64];
+        double nsPerOp;
+    } entries[64];
+} BenchmarkBaseline;
+
+/// <summary>
+///     Reads a baseline.
+/// </summary>
+/// <param name="baseline">Receives the baseline.</param>
+/// <param name="path">Path of the baseline file.</param>
+/// <returns>0 on success, or -1 if the file could not be read</returns>
+int BenchmarkBaseline_Read(BenchmarkBaseline *baseline, const char *path);
+
+/// <summary>
+///     Finds the stored ns/op of a benchmark.
+/// </summary>
+/// <param name="baseline">The baseline.</param>
+/// <param name="name">Name of the benchmark.</param>
+/// <returns>The stored ns/op, or 0 if the benchmark is not in the baseline</returns>
+double BenchmarkBaseline_Find(const BenchmarkBaseline *baseline, const char *name);
@@ -0,0 +1,320 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Runs the DFU code of the ExternalMcuUpdate sample, through the event loop, against the
+// simulated bootloader in ExternalMcuUpdate/DfuBenchmark on a pseudo-terminal, so that the speed
+// of an update can be measured without a device. The simulated bootloader holds each request and
+// response back for as long as a UART at the negotiated baud rate would, and reports the round
+// trips of each image. This program reports the time, the throughput and the processor time of
+// each update. See README.md.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <applibs/storage.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "worker_pool.h"
+#include "nordic/dfu_uart_protocol.h"
+
+// The same images as the sample writes, from its image package.
+static DfuImageData images[] = {
+    {.datPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.dat",
+     .binPathname = "ExternalNRF52Firmware/s132_nrf52_6.1.0_softdevice.bin",
+     .firmwareType = DfuFirmware_Softdevice,
+     .version = 6001000},
+    {.datPathname = "ExternalNRF52Firmware/blinkyV1.dat",
+     .binPathname = "ExternalNRF52Firmware/blinkyV1.bin",
+     .firmwareType = DfuFirmware_Application,
+     .version = 1}};
+
+#define IMAGE_COUNT (sizeof(images) / sizeof(images[0]))
+
+// Writes per acknowledgement, as with the Balanced performance profile of the sample.
+#define DEFAULT_PACKET_RECEIPT_INTERVAL 16
+
+// The fastest rate which the sample tries after the nRF52 has entered DFU mode.
+#define DEFAULT_BAUD_RATE 1000000
+
+static const char *pythonPath = "python3";
+static const char *bootloaderPath = DFU_BENCH_BOOTLOADER;
+static const char *imageDirectory = DFU_BENCH_IMAGE_DIRECTORY;
+static double latencyMs = 0;
+static uint32_t baudRate = DEFAULT_BAUD_RATE;
+static unsigned int packetReceiptInterval = DEFAULT_PACKET_RECEIPT_INTERVAL;
+static unsigned int runCount = 2;
+
+static int epollFd = -1;
+static int uartFd = -1;
+static pid_t bootloaderPid = -1;
+
+static bool updateFinished = false;
+static DfuResultStatus updateStatus = DfuResult_Fail;
+static DfuTransferProgress lastProgress[IMAGE_COUNT];
+
+static void DfuResultReceived(DfuTarget *target, DfuResultStatus status)
+{
+    (void)target;
+    updateStatus = status;
+    updateFinished = true;
+}
+
+static void DfuProgressReceived(DfuTarget *target, const DfuTransferProgress *progress)
+{
+    (void)target;
+    if (progress->imageIndex < IMAGE_COUNT) {
+        lastProgress[progress->imageIndex] = *progress;
+    }
+}
+
+// A pseudo-terminal has no line rate, so the same descriptor is returned, and the simulated
+// bootloader changes the rate at which it paces the link. The descriptor is duplicated, because
+// the DFU code expects a new one.
+static int ReopenUart(DfuTarget *target, uint32_t newBaudRate)
+{
+    (void)target;
+    (void)newBaudRate;
+    int fd = fcntl(uartFd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(stderr, "Could not duplicate the pseudo-terminal: %s\n", strerror(errno));
+        return -1;
+    }
+    close(uartFd);
+    uartFd = fd;
+    return fd;
+}
+
+// Opens a pseudo-terminal whose master end stands for the MT3620 UART, and starts the simulated
+// bootloader on its slave end. The slave is kept open in raw mode, so that no byte is changed
+// before the bootloader has opened it. Returns the slave descriptor, or -1 on failure.
+static int StartBootloader(int extraArgc, char *extraArgv[])
+{
+    uartFd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (uartFd == -1 || grantpt(uartFd) != 0 || unlockpt(uartFd) != 0) {
+        fprintf(stderr, "Could not open a pseudo-terminal: %s\n", strerror(errno));
+        return -1;
+    }
+    const char *slavePath = ptsname(uartFd);
+    int slaveFd = slavePath ? open(slavePath, O_RDWR | O_NOCTTY | O_CLOEXEC) : -1;
+    struct termios attributes;
+    if (slaveFd == -1 || tcgetattr(slaveFd, &attributes) != 0) {
+        fprintf(stderr, "Could not open the pseudo-terminal slave: %s\n", strerror(errno));
+        return -1;
+    }
+    cfmakeraw(&attributes);
+    tcsetattr(slaveFd, TCSANOW, &attributes);
+
+    // The DFU code reads and writes the UART without blocking.
+    fcntl(uartFd, F_SETFL, fcntl(uartFd, F_GETFL) | O_NONBLOCK);
+
+    char latency[32];
+    snprintf(latency, sizeof(latency), "%g", latencyMs);
+    const char *argv[16 + extraArgc];
+    int argc = 0;
+    argv[argc++] = pythonPath;
+    argv[argc++] = "-u";
+    argv[argc++] = bootloaderPath;
+    argv[argc++] = slavePath;
+    argv[argc++] = "--pace";
+    argv[argc++] = "--latency-ms";
+    argv[argc++] = latency;
+    for (int i = 0; i < extraArgc; ++i) {
+        argv[argc++] = extraArgv[i];
+    }
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    bootloaderPid = fork();
+    if (bootloaderPid == -1) {
+        fprintf(stderr, "Could not start the simulated bootloader: %s\n", strerror(errno));
+        return -1;
+    }
+    if (bootloaderPid == 0) {
+        execvp(pythonPath, (char *const *)argv);
+        fprintf(stderr, "Could not run %s: %s\n", pythonPath, strerror(errno));
+        _exit(127);
+    }
+    return slaveFd;
+}
+
+static void StopBootloader(void)
+{
+    if (bootloaderPid > 0) {
+        kill(bootloaderPid, SIGTERM);
+        waitpid(bootloaderPid, NULL, 0);
+    }
+}
+
+static double SecondsSince(clockid_t clock, const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Runs one update to the end, and prints what was measured. Returns 0 on success.
+static int RunUpdate(DfuTarget *target, unsigned int run)
+{
+    memset(lastProgress, 0, sizeof(lastProgress));
+    updateFinished = false;
+
+    struct timespec wallStart, cpuStart;
+    clock_gettime(CLOCK_MONOTONIC, &wallStart);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+
+    ProgramImages(target, images, IMAGE_COUNT, &DfuResultReceived);
+    while (!updateFinished) {
+        if (WaitForEventAndCallHandler(epollFd) != 0) {
+            fprintf(stderr, "The event loop failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    double wallSeconds = SecondsSince(CLOCK_MONOTONIC, &wallStart);
+    double cpuSeconds = SecondsSince(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+
+    uint64_t bytesSent = 0;
+    unsigned int retries = 0;
+    for (size_t i = 0; i < IMAGE_COUNT; ++i) {
+        bytesSent += lastProgress[i].bytesSent;
+        if (lastProgress[i].retries > retries) {
+            retries = lastProgress[i].retries;
+        }
+    }
+
+    printf("Update %u: %s in %.2f s, %u retries.\n", run + 1,
+           updateStatus == DfuResult_Success ? "succeeded" : "FAILED", wallSeconds, retries);
+    for (size_t i = 0; i < IMAGE_COUNT; ++i) {
+        if (lastProgress[i].bytesTotal != 0) {
+            printf("  %s: %u of %u bytes, %u bytes/s.\n", images[i].binPathname,
+                   lastProgress[i].bytesSent, lastProgress[i].bytesTotal,
+                   lastProgress[i].bytesPerSecond);
+        }
+    }
+    if (bytesSent != 0) {
+        printf("  Firmware: %llu bytes, %.0f bytes/s, %.1f ms processor time, %.3f ms per KB.\n",
+               (unsigned long long)bytesSent, (double)bytesSent / wallSeconds, cpuSeconds * 1e3,
+               cpuSeconds * 1e3 * 1024 / (double)bytesSent);
+    } else {
+        printf("  All images were installed; %.1f ms processor time.\n", cpuSeconds * 1e3);
+    }
+    fflush(stdout);
+
+    return updateStatus == DfuResult_Success ? 0 : -1;
+}
+
+static void PrintUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--baud N] [--latency-ms MS] [--prn N] [--runs N]\n"
+            "          [--python PATH] [--bootloader PATH] [--images DIR]\n"
+            "          [-- FAKE_BOOTLOADER_OPTIONS]\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    int extraArgc = 0;
+    char **extraArgv = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc) {
+            baudRate = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--latency-ms") == 0 && i + 1 < argc) {
+            latencyMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--prn") == 0 && i + 1 < argc) {
+            packetReceiptInterval = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runCount = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--python") == 0 && i + 1 < argc) {
+            pythonPath = argv[++i];
+        } else if (strcmp(argv[i], "--bootloader") == 0 && i + 1 < argc) {
+            bootloaderPath = argv[++i];
+        } else if (strcmp(argv[i], "--images") == 0 && i + 1 < argc) {
+            imageDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--") == 0) {
+            extraArgc = argc - i - 1;
+            extraArgv = &argv[i + 1];
+            break;
+        } else {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The progress of the update is saved to a temporary file, which stands for the mutable
+    // storage of the device, so that the resume code runs too.
+    char mutableFilePath[] = "/tmp/dfu_bench_XXXXXX";
+    int mutableFd = mkstemp(mutableFilePath);
+    if (mutableFd == -1) {
+        fprintf(stderr, "Could not create the mutable file: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    close(mutableFd);
+    HostStorage_SetImagePackageDirectory(imageDirectory);
+    HostStorage_SetMutableFilePath(mutableFilePath);
+
+    // The simulated bootloader is started before the worker thread, so that it is not forked.
+    int result = EXIT_FAILURE;
+    int slaveFd = StartBootloader(extraArgc, extraArgv);
+    WorkerPool workerPool;
+    bool workerPoolInitialized = false;
+    DfuTarget *target = NULL;
+    if (slaveFd == -1 || (epollFd = CreateEpollFd()) == -1) {
+        goto cleanup;
+    }
+    if (WorkerPool_Init(&workerPool, epollFd, 1, 64 * 1024) != 0) {
+        goto cleanup;
+    }
+    workerPoolInitialized = true;
+
+    // The GPIOs are not used by the simulated bootloader.
+    target = OpenDfuTarget(uartFd, -1, -1, epollFd);
+    if (target == NULL) {
+        goto cleanup;
+    }
+    EnableDfuResume(target, 0);
+    if (baudRate > DFU_BOOTLOADER_BAUD_RATE) {
+        SetDfuBaudRates(target, &baudRate, 1, &ReopenUart);
+    }
+    SetDfuProgressHandler(target, &DfuProgressReceived);
+    SetDfuWorkerPool(target, &workerPool);
+    SetPacketReceiptInterval(target, (uint16_t)packetReceiptInterval);
+
+    // The first update writes every image, and the later ones find them installed.
+    result = EXIT_SUCCESS;
+    for (unsigned int run = 0; run < runCount; ++run) {
+        if (RunUpdate(target, run) != 0) {
+            result = EXIT_FAILURE;
+            break;
+        }
+    }
+
+cleanup:
+    if (workerPoolInitialized) {
+        WorkerPool_Close(&workerPool);
+    }
+    CloseDfuTarget(target);
+    StopBootloader();
+    if (slaveFd != -1) {
+        close(slaveFd);
+    }
+    if (uartFd != -1) {
+        close(uartFd);
+    }
+    if (epollFd != -1) {
+        close(epollFd);
+    }
+    unlink(mutableFilePath);
+    return result;
+}
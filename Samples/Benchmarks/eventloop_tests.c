@@ -0,0 +1,137 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Checks that the epoll registration functions of the event loop keep registeredEvents in step
+// with the kernel, so that the MOD fast path and the persistent registrations arm the fd when
+// they should. They run against a real epoll instance and eventfd. See README.md.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "epoll_timerfd_utilities.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,       \
+                    #condition);                                                    \
+            ++failures;                                                             \
+        }                                                                           \
+    } while (0)
+
+static void IgnoreEvent(EventData *eventData)
+{
+    (void)eventData;
+}
+
+// Makes the eventfd readable, and returns whether the epoll instance reports it.
+static bool IsArmed(int epollFd, int eventFd, EventData *eventData)
+{
+    uint64_t value = 1;
+    if (write(eventFd, &value, sizeof(value)) != sizeof(value)) {
+        return false;
+    }
+
+    struct epoll_event event;
+    int count = epoll_wait(epollFd, &event, 1, 0);
+
+    // Read the count back, so that the next check starts from an fd which is not readable.
+    if (read(eventFd, &value, sizeof(value)) != sizeof(value)) {
+        return false;
+    }
+    return count == 1 && event.data.ptr == eventData;
+}
+
+// Registering again with another mask is tracked, so the second call goes through the MOD
+// fast path and the fd keeps its registration.
+static void TestRegisterTracksEvents(int epollFd, int eventFd)
+{
+    EventData eventData = {.eventHandler = IgnoreEvent};
+
+    CHECK(RegisterEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN) == 0);
+    CHECK(eventData.fd == eventFd);
+    CHECK(eventData.registeredEvents == EPOLLIN);
+    CHECK(IsArmed(epollFd, eventFd, &eventData));
+
+    CHECK(RegisterEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN | EPOLLET) == 0);
+    CHECK(eventData.registeredEvents == (EPOLLIN | EPOLLET));
+    CHECK(IsArmed(epollFd, eventFd, &eventData));
+
+    CHECK(UnregisterPersistentEventHandlerFromEpoll(epollFd, &eventData) == 0);
+    CHECK(eventData.registeredEvents == 0);
+    CHECK(!IsArmed(epollFd, eventFd, &eventData));
+}
+
+// A persistent registration which is removed and made again with the same mask must arm the
+// fd again, rather than be skipped as unchanged.
+static void TestPersistentReregisterAfterUnregister(int epollFd, int eventFd)
+{
+    EventData eventData = {.eventHandler = IgnoreEvent};
+
+    CHECK(RegisterPersistentEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN) == 0);
+    CHECK(eventData.registeredEvents == (EPOLLIN | EPOLLET));
+    CHECK(IsArmed(epollFd, eventFd, &eventData));
+
+    CHECK(UnregisterPersistentEventHandlerFromEpoll(epollFd, &eventData) == 0);
+    CHECK(eventData.registeredEvents == 0);
+    CHECK(!IsArmed(epollFd, eventFd, &eventData));
+
+    CHECK(RegisterPersistentEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN) == 0);
+    CHECK(IsArmed(epollFd, eventFd, &eventData));
+
+    // Unregistering twice is allowed.
+    CHECK(UnregisterPersistentEventHandlerFromEpoll(epollFd, &eventData) == 0);
+    CHECK(UnregisterPersistentEventHandlerFromEpoll(epollFd, &eventData) == 0);
+    CHECK(!IsArmed(epollFd, eventFd, &eventData));
+}
+
+// An fd which was registered without EPOLLET and is then made persistent is modified, and one
+// which was registered elsewhere with the same event data is added again.
+static void TestPersistentAfterPlainRegistration(int epollFd, int eventFd)
+{
+    EventData eventData = {.eventHandler = IgnoreEvent};
+
+    CHECK(RegisterEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN) == 0);
+    CHECK(RegisterPersistentEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN) == 0);
+    CHECK(eventData.registeredEvents == (EPOLLIN | EPOLLET));
+    CHECK(IsArmed(epollFd, eventFd, &eventData));
+    CHECK(UnregisterPersistentEventHandlerFromEpoll(epollFd, &eventData) == 0);
+
+    // The fd is removed behind the event data's back, so the MOD fast path fails and the fd is
+    // added again.
+    CHECK(RegisterEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN) == 0);
+    CHECK(UnregisterEventHandlerFromEpoll(epollFd, eventFd) == 0);
+    CHECK(RegisterEventHandlerToEpoll(epollFd, eventFd, &eventData, EPOLLIN) == 0);
+    CHECK(IsArmed(epollFd, eventFd, &eventData));
+    CHECK(UnregisterPersistentEventHandlerFromEpoll(epollFd, &eventData) == 0);
+}
+
+int main(void)
+{
+    int epollFd = CreateEpollFd();
+    int eventFd = eventfd(0, EFD_NONBLOCK);
+    if (epollFd < 0 || eventFd < 0) {
+        fprintf(stderr, "Could not create the epoll instance or eventfd.\n");
+        return 1;
+    }
+
+    TestRegisterTracksEvents(epollFd, eventFd);
+    TestPersistentReregisterAfterUnregister(epollFd, eventFd);
+    TestPersistentAfterPlainRegistration(epollFd, eventFd);
+
+    close(eventFd);
+    close(epollFd);
+
+    if (failures != 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All event loop checks passed\n");
+    return 0;
+}
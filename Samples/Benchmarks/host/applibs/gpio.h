@@ -0,0 +1,21 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdint.h>
+
+// Host replacement for the Applibs GPIO, used when the DFU code is built for the DFU benchmark.
+// The simulated bootloader is always in DFU mode, so the reset and DFU pins are not driven.
+
+typedef uint8_t GPIO_Value_Type;
+typedef enum {
+    GPIO_Value_Low = 0,
+    GPIO_Value_High = 1
+} GPIO_Value;
+
+static inline int GPIO_SetValue(int gpioFd, GPIO_Value_Type value)
+{
+    (void)gpioFd;
+    (void)value;
+    return 0;
+}
@@ -0,0 +1,20 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdarg.h>
+
+// Host replacement for the Applibs log, used when the sample code is built for the benchmarks.
+// Messages are discarded, so that logging does not distort the measurements.
+static inline int Log_Debug(const char *fmt, ...)
+{
+    (void)fmt;
+    return 0;
+}
+
+static inline int Log_DebugVarArgs(const char *fmt, va_list args)
+{
+    (void)fmt;
+    (void)args;
+    return 0;
+}
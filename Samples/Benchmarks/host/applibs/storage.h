@@ -0,0 +1,21 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+// Host replacement for the Applibs storage, used when the DFU code is built for the DFU
+// benchmark. The image package is a directory, and the mutable file is a file on the host,
+// which are set with the functions below before the storage is used.
+
+int Storage_OpenFileInImagePackage(const char *relativePath);
+int Storage_OpenMutableFile(void);
+
+/// <summary>
+///     Sets the directory which stands for the root of the image package.
+/// </summary>
+void HostStorage_SetImagePackageDirectory(const char *directory);
+
+/// <summary>
+///     Sets the file which stands for the mutable file. It is created if it does not exist.
+/// </summary>
+void HostStorage_SetMutableFilePath(const char *path);
@@ -0,0 +1,11 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdint.h>
+
+// Host replacement for the Applibs UART types, used when the sample code is built for the trace
+// replay. The replay passes its own file descriptor to the code, so UART_Open is not provided.
+
+typedef int UART_Id;
+typedef uint32_t UART_BaudRate_Type;
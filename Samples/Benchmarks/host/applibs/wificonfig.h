@@ -0,0 +1,26 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdint.h>
+
+// Host replacement for the Applibs Wi-Fi configuration types, with the same members as the
+// SDK's scanned network.
+
+#define WIFICONFIG_SSID_MAX_LENGTH 32
+#define WIFICONFIG_BSSID_BUFFER_SIZE 6
+
+typedef uint8_t WifiConfig_Security_Type;
+#define WifiConfig_Security_Unknown 0
+#define WifiConfig_Security_Open 1
+#define WifiConfig_Security_Wpa2_Psk 2
+
+typedef struct {
+    uint32_t z__magicAndVersion;
+    uint8_t ssid[WIFICONFIG_SSID_MAX_LENGTH];
+    uint8_t bssid[WIFICONFIG_BSSID_BUFFER_SIZE];
+    uint8_t ssidLength;
+    WifiConfig_Security_Type security;
+    int8_t signalRssi;
+    uint32_t frequencyMHz;
+} WifiConfig_ScannedNetwork;
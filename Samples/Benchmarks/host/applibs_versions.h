@@ -0,0 +1,6 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+// The host replacements of the Applibs headers do not depend on the API version.
@@ -0,0 +1,51 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+
+#include "image_stream.h"
+
+// Host replacement for the image downloads of the ExternalMcuUpdate sample, which need cURL and
+// the Applibs networking. The DFU benchmark writes the images from the image package, so no
+// stream is opened.
+
+ImageStream *OpenImageStream(const char *url, const char *certificatePath, int epollFd,
+                             size_t bufferSize)
+{
+    (void)url;
+    (void)certificatePath;
+    (void)epollFd;
+    (void)bufferSize;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void CloseImageStream(ImageStream *self)
+{
+    (void)self;
+}
+
+void ImageStreamSetDataHandler(ImageStream *self, ImageStreamDataHandler handler, void *context)
+{
+    (void)self;
+    (void)handler;
+    (void)context;
+}
+
+int ImageStreamGetSize(ImageStream *self, off_t *size)
+{
+    (void)self;
+    (void)size;
+    errno = ENOSYS;
+    return -1;
+}
+
+int ImageStreamRead(ImageStream *self, off_t offset, uint8_t *buf, size_t length)
+{
+    (void)self;
+    (void)offset;
+    (void)buf;
+    (void)length;
+    errno = ENOSYS;
+    return -1;
+}
@@ -0,0 +1,83 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Host replacement for mt3620-baremetal.h, which is force-included when the intercore library
+// is built for the benchmarks. It defines the same include guard, so the real header, which
+// accesses the MT3620 registers, is skipped. Register writes, such as the mailbox
+// notifications, are discarded and register reads return 0.
+
+#ifndef MT3620_BAREMETAL_H
+#define MT3620_BAREMETAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The host has one kind of memory, so the placement attributes have no effect.
+#define TCM_CODE
+#define COLD_CODE
+#define SYSRAM_BSS
+
+typedef void (*Callback)(void);
+
+static inline void WriteReg8(uintptr_t baseAddr, size_t offset, uint8_t value)
+{
+    (void)baseAddr;
+    (void)offset;
+    (void)value;
+}
+
+static inline void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value)
+{
+    (void)baseAddr;
+    (void)offset;
+    (void)value;
+}
+
+static inline uint32_t ReadReg32(uintptr_t baseAddr, size_t offset)
+{
+    (void)baseAddr;
+    (void)offset;
+    return 0;
+}
+
+static inline void ClearReg32(uintptr_t baseAddr, size_t offset, uint32_t clearBits)
+{
+    (void)baseAddr;
+    (void)offset;
+    (void)clearBits;
+}
+
+static inline void SetReg32(uintptr_t baseAddr, size_t offset, uint32_t setBits)
+{
+    (void)baseAddr;
+    (void)offset;
+    (void)setBits;
+}
+
+static inline uint32_t BlockIrqs(void)
+{
+    return 0;
+}
+
+static inline void RestoreIrqs(uint32_t prevBasePri)
+{
+    (void)prevBasePri;
+}
+
+static inline void SetNvicPriority(int irqNum, uint8_t pri)
+{
+    (void)irqNum;
+    (void)pri;
+}
+
+static inline void EnableNvicInterrupt(int irqNum)
+{
+    (void)irqNum;
+}
+
+static inline void DisableNvicInterrupt(int irqNum)
+{
+    (void)irqNum;
+}
+
+#endif // #ifndef MT3620_BAREMETAL_H
@@ -0,0 +1,13 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdio.h>
+
+#include "mt3620-uart-poll.h"
+
+// Host replacement for the debug UART of the real-time capable application. The intercore
+// library only writes errors to it, which are shown on stderr.
+void Uart_WriteStringPoll(const char *msg)
+{
+    fputs(msg, stderr);
+}
@@ -0,0 +1,42 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include <applibs/storage.h>
+
+static const char *imagePackageDirectory = ".";
+static const char *mutableFilePath = NULL;
+
+void HostStorage_SetImagePackageDirectory(const char *directory)
+{
+    imagePackageDirectory = directory;
+}
+
+void HostStorage_SetMutableFilePath(const char *path)
+{
+    mutableFilePath = path;
+}
+
+int Storage_OpenFileInImagePackage(const char *relativePath)
+{
+    char path[PATH_MAX];
+    int length = snprintf(path, sizeof(path), "%s/%s", imagePackageDirectory, relativePath);
+    if (length < 0 || (size_t)length >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+int Storage_OpenMutableFile(void)
+{
+    if (mutableFilePath == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    return open(mutableFilePath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+}
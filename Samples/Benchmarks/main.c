@@ -0,0 +1,610 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Micro-benchmarks for the utility code which the samples run most often: checksums, framing,
+// buffers, JSON, Wi-Fi scan aggregation and the intercore ring buffers. They are built for the
+// development machine, so they run without a device, and each result is compared with a stored
+// baseline. See README.md.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+
+#include "nordic/crc.h"
+#include "nordic/slip.h"
+#include "mem_buf.h"
+#include "message_protocol_utilities.h"
+#include "parson.h"
+#include "wifi_scan_aggregator.h"
+#include "mt3620-intercore.h"
+
+// Fills a buffer with the same pseudo-random bytes on every run.
+static void FillPseudoRandom(uint8_t *data, size_t len, uint32_t seed)
+{
+    for (size_t i = 0; i < len; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+// CRC-32, as used to check each object which is sent to the nRF52.
+
+static uint8_t crcData[4096];
+
+static void CrcSetup(void)
+{
+    FillPseudoRandom(crcData, sizeof(crcData), 1);
+}
+
+static void Crc32_64Run(uint32_t iterations)
+{
+    uint32_t crc = 0;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        crc = CalcCrc32WithSeed(crcData, 64, crc);
+    }
+    benchmarkSink += crc;
+}
+
+static void Crc32_4kRun(uint32_t iterations)
+{
+    uint32_t crc = 0;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        crc = CalcCrc32WithSeed(crcData, sizeof(crcData), crc);
+    }
+    benchmarkSink += crc;
+}
+
+// SLIP framing of the packets which are exchanged with the nRF52 bootloader.
+
+#define SLIP_PACKET_SIZE 1024
+static uint8_t slipPacket[SLIP_PACKET_SIZE];
+static MemBuf *slipEncoded;
+static MemBuf *slipDecoded;
+
+static void SlipSetup(void)
+{
+    FillPseudoRandom(slipPacket, sizeof(slipPacket), 2);
+    if (slipEncoded == NULL) {
+        slipEncoded = AllocMemBuf(SLIP_PACKET_SIZE * 2 + 1);
+        slipDecoded = AllocMemBuf(SLIP_PACKET_SIZE);
+    }
+    MemBufReset(slipEncoded);
+    SlipEncodeAppend(slipEncoded, slipPacket, sizeof(slipPacket));
+    SlipEncodeAddEndMarker(slipEncoded);
+}
+
+static void SlipEncodeRun(uint32_t iterations)
+{
+    MemBuf *encoded = AllocMemBuf(SLIP_PACKET_SIZE * 2 + 1);
+    for (uint32_t i = 0; i < iterations; ++i) {
+        MemBufReset(encoded);
+        SlipEncodeAppend(encoded, slipPacket, sizeof(slipPacket));
+        SlipEncodeAddEndMarker(encoded);
+    }
+    benchmarkSink += (uint32_t)MemBufCurSize(encoded);
+    FreeMemBuf(encoded);
+}
+
+static void SlipDecodeByteRun(uint32_t iterations)
+{
+    const uint8_t *data;
+    size_t len;
+    MemBufData(slipEncoded, &data, &len);
+    for (uint32_t i = 0; i < iterations; ++i) {
+        MemBufReset(slipDecoded);
+        NrfSlipDecodeState state = NRF_SLIP_STATE_DECODING;
+        bool finished = false;
+        for (size_t j = 0; j < len && !finished; ++j) {
+            SlipDecodeAddByte(data[j], slipDecoded, &state, &finished);
+        }
+    }
+    benchmarkSink += (uint32_t)MemBufCurSize(slipDecoded);
+}
+
+static void SlipDecodeAppendRun(uint32_t iterations)
+{
+    const uint8_t *data;
+    size_t len;
+    MemBufData(slipEncoded, &data, &len);
+    for (uint32_t i = 0; i < iterations; ++i) {
+        MemBufReset(slipDecoded);
+        NrfSlipDecodeState state = NRF_SLIP_STATE_DECODING;
+        bool finished = false;
+        SlipDecodeAppend(data, len, slipDecoded, &state, &finished);
+    }
+    benchmarkSink += (uint32_t)MemBufCurSize(slipDecoded);
+}
+
+// MemBuf, which holds the SLIP packets and the UART data.
+
+static MemBuf *memBuf;
+
+static void MemBufSetup(void)
+{
+    if (memBuf == NULL) {
+        memBuf = AllocMemBuf(1024);
+    }
+}
+
+static void MemBufAppend8Run(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i) {
+        MemBufReset(memBuf);
+        for (size_t j = 0; j < 1024; ++j) {
+            MemBufAppend8(memBuf, (uint8_t)j);
+        }
+    }
+    benchmarkSink += MemBufRead8(memBuf, 1023);
+}
+
+static void MemBufAppendConsumeRun(uint32_t iterations)
+{
+    // Data arrives in 64-byte chunks, of which 48 bytes are consumed at a time, so that the
+    // buffer is compacted as it fills up.
+    MemBufReset(memBuf);
+    for (uint32_t i = 0; i < iterations; ++i) {
+        if (MemBufCurSize(memBuf) + 64 > MemBufMaxSize(memBuf)) {
+            MemBufReset(memBuf);
+        }
+        MemBufAppend(memBuf, crcData, 64);
+        MemBufConsume(memBuf, 48);
+    }
+    benchmarkSink += (uint32_t)MemBufCurSize(memBuf);
+}
+
+static void MemBufReserveCommitRun(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i) {
+        MemBufReset(memBuf);
+        for (size_t j = 0; j < 1024; j += 64) {
+            uint8_t *dest = MemBufReserve(memBuf, 64);
+            memcpy(dest, crcData + j, 64);
+            MemBufCommit(memBuf, 64);
+        }
+        benchmarkSink += MemBufReadLe32(memBuf, 512);
+    }
+}
+
+// The message protocol between the Azure Sphere device and the nRF52, over the UART.
+
+#define FRAMER_STREAM_SIZE 4096
+static uint8_t framerStream[FRAMER_STREAM_SIZE] __attribute__((aligned(4)));
+static size_t framerStreamLength;
+static uint8_t singleMessage[64] __attribute__((aligned(4)));
+
+static size_t WriteMessage(uint8_t *dest, uint16_t bodyLength)
+{
+    MessageProtocol_MessageHeader header;
+    memcpy(header.preamble, MessageProtocol_MessagePreamble, sizeof(header.preamble));
+    header.length = bodyLength;
+    memcpy(dest, &header, sizeof(header));
+    FillPseudoRandom(dest + sizeof(header), bodyLength, bodyLength);
+    return sizeof(header) + bodyLength;
+}
+
+static void FramerSetup(void)
+{
+    WriteMessage(singleMessage, sizeof(singleMessage) - sizeof(MessageProtocol_MessageHeader));
+
+    // Messages of between 8 and 200 bytes, with some noise between them, as is seen when the
+    // UART is opened part way through a message.
+    framerStreamLength = 0;
+    uint8_t noise[7];
+    FillPseudoRandom(noise, sizeof(noise), 3);
+    for (uint16_t i = 0;; ++i) {
+        uint16_t bodyLength = (uint16_t)(8 + (i * 37) % 193);
+        if (framerStreamLength + sizeof(noise) + sizeof(MessageProtocol_MessageHeader) +
+                bodyLength >
+            sizeof(framerStream)) {
+            break;
+        }
+        if (i % 8 == 7) {
+            memcpy(framerStream + framerStreamLength, noise, sizeof(noise));
+            framerStreamLength += sizeof(noise);
+        }
+        framerStreamLength += WriteMessage(framerStream + framerStreamLength, bodyLength);
+    }
+}
+
+static void MessageCompleteRun(uint32_t iterations)
+{
+    uint32_t complete = 0;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        // Check the partial messages, as the framer does while the message arrives.
+        complete += MessageProtocol_IsMessageComplete(singleMessage, sizeof(singleMessage) - i % 8);
+    }
+    benchmarkSink += complete;
+}
+
+// Splits the stream into messages in the same way as HandleReceivedMessages in the
+// WifiSetupAndDeviceControlViaBle sample: the bytes before a preamble are skipped, and each
+// message is taken once it is complete.
+static void FramerRun(uint32_t iterations)
+{
+    const size_t preambleSize = sizeof(MessageProtocol_MessagePreamble);
+    uint32_t messages = 0;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        size_t head = 0;
+        while (head < framerStreamLength) {
+            const uint8_t *found = memchr(framerStream + head, MessageProtocol_MessagePreamble[0],
+                                          framerStreamLength - head);
+            if (found == NULL) {
+                break;
+            }
+            head = (size_t)(found - framerStream);
+            if (framerStreamLength - head < preambleSize ||
+                memcmp(found, MessageProtocol_MessagePreamble, preambleSize) != 0) {
+                ++head;
+                continue;
+            }
+            if (!MessageProtocol_IsMessageComplete(framerStream + head,
+                                                   framerStreamLength - head)) {
+                break;
+            }
+            MessageProtocol_MessageHeader header;
+            memcpy(&header, found, sizeof(header));
+            head += sizeof(header) + header.length;
+            ++messages;
+        }
+    }
+    benchmarkSink += messages;
+}
+
+// Parson, which parses the device twin and serializes the reported properties.
+
+static const char twinJson[] =
+    "{\"desired\":{\"StatusLED\":{\"value\":true},\"TelemetryPeriod\":{\"value\":30},"
+    "\"Thresholds\":{\"temperature\":[18.5,27.25],\"humidity\":[30,70]},"
+    "\"Firmware\":{\"version\":\"20.07.1\",\"url\":\"https://example.com/firmware/v20.07.1.bin\","
+    "\"sha256\":\"9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08\"},"
+    "\"$version\":42},"
+    "\"reported\":{\"StatusLED\":{\"value\":false},\"TelemetryPeriod\":{\"value\":60},"
+    "\"Uptime\":123456,\"LastError\":null,\"Name\":\"Caf\\u00e9 sensor \\\"A\\\"\","
+    "\"$version\":17}}";
+static JSON_Value *twinValue;
+
+static void ParsonSetup(void)
+{
+    if (twinValue == NULL) {
+        twinValue = json_parse_string(twinJson);
+        if (twinValue == NULL) {
+            fprintf(stderr, "ERROR: Could not parse the device twin.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void ParsonParseRun(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i) {
+        JSON_Value *value = json_parse_string(twinJson);
+        benchmarkSink += (uint32_t)json_value_get_type(value);
+        json_value_free(value);
+    }
+}
+
+static void ParsonSerializeRun(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i) {
+        char *serialized = json_serialize_to_string(twinValue);
+        benchmarkSink += (uint32_t)serialized[0];
+        json_free_serialized_string(serialized);
+    }
+}
+
+static void ParsonSerializeReusedRun(uint32_t iterations)
+{
+    // The buffer is kept between iterations, as a caller which reports periodically would.
+    static char *serialized;
+    static size_t serializedSize;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        size_t length;
+        if (json_serialize_to_growable_buffer(twinValue, &serialized, &serializedSize, &length) !=
+            JSONSuccess) {
+            fprintf(stderr, "ERROR: Could not serialize the device twin.\n");
+            exit(EXIT_FAILURE);
+        }
+        benchmarkSink += (uint32_t)length;
+    }
+}
+
+// A batch of telemetry readings and a configuration, which are mostly small integers and short
+// decimals, as the payloads which the samples send and receive are.
+static const char numbersJson[] =
+    "{\"config\":{\"TelemetryPeriod\":30,\"SampleCount\":8,\"Deadband\":0.5,"
+    "\"Thresholds\":{\"temperature\":[18.5,27.25],\"humidity\":[30,70],\"pressure\":[950,1050]},"
+    "\"Calibration\":[1.0023,-0.37,0.000125,12],\"$version\":42},"
+    "\"readings\":["
+    "{\"t\":1602672000,\"temperature\":21.37,\"humidity\":45.2,\"pressure\":1013.25,\"rssi\":-67},"
+    "{\"t\":1602672030,\"temperature\":21.41,\"humidity\":45.1,\"pressure\":1013.2,\"rssi\":-66},"
+    "{\"t\":1602672060,\"temperature\":21.44,\"humidity\":44.9,\"pressure\":1013.18,\"rssi\":-68},"
+    "{\"t\":1602672090,\"temperature\":21.5,\"humidity\":44.8,\"pressure\":1013.21,\"rssi\":-67},"
+    "{\"t\":1602672120,\"temperature\":21.48,\"humidity\":44.8,\"pressure\":1013.3,\"rssi\":-65},"
+    "{\"t\":1602672150,\"temperature\":21.52,\"humidity\":44.7,\"pressure\":1013.27,\"rssi\":-66},"
+    "{\"t\":1602672180,\"temperature\":21.55,\"humidity\":44.5,\"pressure\":1013.24,\"rssi\":-69},"
+    "{\"t\":1602672210,\"temperature\":21.6,\"humidity\":44.6,\"pressure\":1013.19,\"rssi\":-67}"
+    "]}";
+
+static void ParsonParseNumbersRun(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; ++i) {
+        JSON_Value *value = json_parse_string(numbersJson);
+        if (value == NULL) {
+            fprintf(stderr, "ERROR: Could not parse the telemetry readings.\n");
+            exit(EXIT_FAILURE);
+        }
+        benchmarkSink += (uint32_t)json_value_get_type(value);
+        json_value_free(value);
+    }
+}
+
+// Wi-Fi scan aggregation, which collapses the scanned networks with the same SSID and security
+// type, as CollapseNetworks does in the WifiSetupAndDeviceControlViaBle sample.
+
+#define SCANNED_NETWORK_COUNT 40
+#define FOUND_AP_COUNT 20
+static WifiConfig_ScannedNetwork scannedNetworks[SCANNED_NETWORK_COUNT];
+static WifiScanAggregator scanAggregator;
+
+static void CollapseNetworksSetup(void)
+{
+    // 40 networks, which are 25 distinct access points, as several of them have more than one
+    // radio.
+    for (size_t i = 0; i < SCANNED_NETWORK_COUNT; ++i) {
+        WifiConfig_ScannedNetwork *network = &scannedNetworks[i];
+        memset(network, 0, sizeof(*network));
+        size_t ap = i % 25;
+        network->ssidLength =
+            (uint8_t)snprintf((char *)network->ssid, sizeof(network->ssid), "Network-%zu", ap);
+        network->security = (ap % 3 == 0) ? WifiConfig_Security_Open : WifiConfig_Security_Wpa2_Psk;
+        network->signalRssi = (int8_t)(-30 - (int)((i * 7) % 60));
+        network->frequencyMHz = (i < 25) ? 2412 : 5180;
+    }
+}
+
+static void CollapseNetworksRun(uint32_t iterations)
+{
+    const WifiConfig_ScannedNetwork *strongest[FOUND_AP_COUNT];
+    for (uint32_t i = 0; i < iterations; ++i) {
+        WifiScanAggregator_Reset(&scanAggregator);
+        WifiScanAggregator_AddAll(&scanAggregator, scannedNetworks, SCANNED_NETWORK_COUNT);
+        benchmarkSink +=
+            (uint32_t)WifiScanAggregator_GetStrongest(&scanAggregator, strongest, FOUND_AP_COUNT);
+    }
+}
+
+// The intercore ring buffers of the real-time capable application. The application's outbound
+// buffer is read back as if the high-level application had shared it as its inbound buffer, so
+// the messages which are enqueued are dequeued again from the same memory.
+
+#define INTERCORE_BUFFER_SIZE 4032
+static struct {
+    BufferHeader header;
+    uint8_t data[INTERCORE_BUFFER_SIZE];
+} __attribute__((aligned(16))) ringBuffer;
+static BufferHeader readerHeader;
+static uint8_t intercoreMessage[64];
+
+static void IntercoreSetup(void)
+{
+    memset(&ringBuffer, 0, sizeof(ringBuffer));
+    memset(&readerHeader, 0, sizeof(readerHeader));
+    FillPseudoRandom(intercoreMessage, sizeof(intercoreMessage), 4);
+}
+
+static void IntercoreRoundTripRun(uint32_t iterations)
+{
+    uint8_t received[sizeof(intercoreMessage)];
+    for (uint32_t i = 0; i < iterations; ++i) {
+        uint32_t size = sizeof(received);
+        if (EnqueueData(&readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE,
+                        intercoreMessage, sizeof(intercoreMessage)) != 0 ||
+            DequeueData(&readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE, received,
+                        &size) != 0) {
+            fprintf(stderr, "ERROR: The intercore ring buffer is in an invalid state.\n");
+            exit(EXIT_FAILURE);
+        }
+        benchmarkSink += received[i % sizeof(received)];
+    }
+}
+
+static void IntercoreBatchRun(uint32_t iterations)
+{
+    // Fill most of the buffer, then drain it, so that messages wrap around its end.
+    uint8_t received[sizeof(intercoreMessage)];
+    for (uint32_t i = 0; i < iterations; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            EnqueueData(&readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE, intercoreMessage,
+                        sizeof(intercoreMessage));
+        }
+        for (int j = 0; j < 16; ++j) {
+            uint32_t size = sizeof(received);
+            DequeueData(&readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE, received,
+                        &size);
+            benchmarkSink += size;
+        }
+    }
+}
+
+// 62 four-byte samples, which is as many as fit in one packed message. Sent one at a time, each
+// sample is a message of its own, with the 20-byte intercore message header.
+#define SMALL_SAMPLE_COUNT (INTERCORE_PACKED_RECORDS_SIZE / sizeof(uint32_t))
+static uint32_t smallSamples[SMALL_SAMPLE_COUNT];
+static uint8_t intercoreMessageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+
+static void IntercoreSmallSetup(void)
+{
+    IntercoreSetup();
+    FillPseudoRandom((uint8_t *)smallSamples, sizeof(smallSamples), 5);
+    FillPseudoRandom(intercoreMessageHeader, sizeof(intercoreMessageHeader), 6);
+}
+
+static void IntercoreSmallRun(uint32_t iterations)
+{
+    uint8_t message[INTERCORE_MESSAGE_HEADER_SIZE + sizeof(uint32_t)];
+    memcpy(message, intercoreMessageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    for (uint32_t i = 0; i < iterations; ++i) {
+        for (size_t j = 0; j < SMALL_SAMPLE_COUNT; ++j) {
+            memcpy(message + INTERCORE_MESSAGE_HEADER_SIZE, &smallSamples[j], sizeof(uint32_t));
+            EnqueueData(&readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE, message,
+                        sizeof(message));
+        }
+        for (size_t j = 0; j < SMALL_SAMPLE_COUNT; ++j) {
+            uint8_t received[sizeof(message)];
+            uint32_t size = sizeof(received);
+            DequeueData(&readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE, received,
+                        &size);
+            benchmarkSink += received[INTERCORE_MESSAGE_HEADER_SIZE];
+        }
+    }
+}
+
+static void IntercorePackedRun(uint32_t iterations)
+{
+    static IntercorePackedBatch batch;
+    InitPackedBatch(&batch, intercoreMessageHeader, sizeof(uint32_t));
+    for (uint32_t i = 0; i < iterations; ++i) {
+        for (size_t j = 0; j < SMALL_SAMPLE_COUNT; ++j) {
+            AddPackedRecord(&batch, &smallSamples[j], i);
+        }
+        IntercoreCursor cursor;
+        if (BeginEnqueue(&cursor, &readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE) != 0 ||
+            EnqueuePackedBatch(&cursor, &batch) != 0) {
+            fprintf(stderr, "ERROR: The intercore ring buffer is in an invalid state.\n");
+            exit(EXIT_FAILURE);
+        }
+        CommitEnqueue(&cursor);
+
+        IntercoreBlock block;
+        IntercorePackedHeader header;
+        uint32_t received[SMALL_SAMPLE_COUNT];
+        if (BeginDequeue(&cursor, &readerHeader, &ringBuffer.header, INTERCORE_BUFFER_SIZE) != 0 ||
+            PeekNextBlock(&cursor, &block) != 0 || !IsPackedMessage(&block, &header) ||
+            ReadPackedRecords(&block, &header, 0, received, header.recordCount) != 0) {
+            fprintf(stderr, "ERROR: The packed message could not be read back.\n");
+            exit(EXIT_FAILURE);
+        }
+        CommitDequeue(&cursor);
+        benchmarkSink += received[i % SMALL_SAMPLE_COUNT];
+    }
+}
+
+static const Benchmark benchmarks[] = {
+    {"crc32_64", CrcSetup, Crc32_64Run, 64},
+    {"crc32_4k", CrcSetup, Crc32_4kRun, sizeof(crcData)},
+    {"slip_encode_1k", SlipSetup, SlipEncodeRun, SLIP_PACKET_SIZE},
+    {"slip_decode_byte_1k", SlipSetup, SlipDecodeByteRun, SLIP_PACKET_SIZE},
+    {"slip_decode_append_1k", SlipSetup, SlipDecodeAppendRun, SLIP_PACKET_SIZE},
+    {"membuf_append8_1k", MemBufSetup, MemBufAppend8Run, 1024},
+    {"membuf_append_consume_64", MemBufSetup, MemBufAppendConsumeRun, 64},
+    {"membuf_reserve_commit_1k", MemBufSetup, MemBufReserveCommitRun, 1024},
+    {"message_is_complete", FramerSetup, MessageCompleteRun, 0},
+    {"message_framer_4k", FramerSetup, FramerRun, FRAMER_STREAM_SIZE},
+    {"parson_parse_twin", ParsonSetup, ParsonParseRun, sizeof(twinJson) - 1},
+    {"parson_serialize_twin", ParsonSetup, ParsonSerializeRun, 0},
+    {"parson_serialize_reuse", ParsonSetup, ParsonSerializeReusedRun, 0},
+    {"parson_parse_numbers", NULL, ParsonParseNumbersRun, sizeof(numbersJson) - 1},
+    {"collapse_networks_40", CollapseNetworksSetup, CollapseNetworksRun, 0},
+    {"intercore_round_trip_64", IntercoreSetup, IntercoreRoundTripRun, 64},
+    {"intercore_batch_16x64", IntercoreSetup, IntercoreBatchRun, 16 * 64},
+    {"intercore_small_62x4", IntercoreSmallSetup, IntercoreSmallRun, sizeof(smallSamples)},
+    {"intercore_packed_62x4", IntercoreSmallSetup, IntercorePackedRun, sizeof(smallSamples)},
+};
+
+static void PrintUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--filter TEXT] [--baseline FILE] [--max-regression PERCENT]\n"
+            "          [--write-baseline FILE] [--quick]\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filter = NULL;
+    const char *baselinePath = NULL;
+    const char *writeBaselinePath = NULL;
+    double maxRegressionPercent = 0;
+    unsigned int minSampleMs = 50;
+    unsigned int sampleCount = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            writeBaselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--max-regression") == 0 && i + 1 < argc) {
+            maxRegressionPercent = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            minSampleMs = 10;
+            sampleCount = 3;
+        } else {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    static BenchmarkBaseline baseline;
+    if (baselinePath != NULL && BenchmarkBaseline_Read(&baseline, baselinePath) != 0) {
+        fprintf(stderr, "ERROR: Could not read the baseline %s.\n", baselinePath);
+        return EXIT_FAILURE;
+    }
+
+    FILE *writeBaseline = NULL;
+    if (writeBaselinePath != NULL) {
+        writeBaseline = fopen(writeBaselinePath, "w");
+        if (writeBaseline == NULL) {
+            fprintf(stderr, "ERROR: Could not write the baseline %s.\n", writeBaselinePath);
+            return EXIT_FAILURE;
+        }
+        fprintf(writeBaseline, "# benchmark ns/op\n");
+    }
+
+    printf("%-26s %12s %12s %12s %8s\n", "benchmark", "ns/op", "MB/s", "baseline", "ratio");
+    int regressions = 0;
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i) {
+        const Benchmark *benchmark = &benchmarks[i];
+        if (filter != NULL && strstr(benchmark->name, filter) == NULL) {
+            continue;
+        }
+
+        BenchmarkResult result;
+        Benchmark_Measure(benchmark, minSampleMs, sampleCount, &result);
+        printf("%-26s %12.1f", benchmark->name, result.nsPerOp);
+        if (result.bytesPerSec > 0) {
+            printf(" %12.1f", result.bytesPerSec / 1e6);
+        } else {
+            printf(" %12s", "-");
+        }
+
+        // A ratio above 1 is slower than the baseline.
+        double baselineNs = BenchmarkBaseline_Find(&baseline, benchmark->name);
+        if (baselineNs > 0) {
+            double ratio = result.nsPerOp / baselineNs;
+            bool isRegression =
+                maxRegressionPercent > 0 && ratio > 1 + maxRegressionPercent / 100;
+            printf(" %12.1f %8.2f%s\n", baselineNs, ratio, isRegression ? "  REGRESSION" : "");
+            regressions += isRegression ? 1 : 0;
+        } else {
+            printf(" %12s %8s\n", "-", "-");
+        }
+
+        if (writeBaseline != NULL) {
+            fprintf(writeBaseline, "%s %.1f\n", benchmark->name, result.nsPerOp);
+        }
+    }
+
+    if (writeBaseline != NULL) {
+        fclose(writeBaseline);
+    }
+    if (regressions > 0) {
+        fprintf(stderr, "ERROR: %d benchmark(s) are more than %.0f%% slower than the baseline.\n",
+                regressions, maxRegressionPercent);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Checks that the number parser of parson accepts the numbers which its strtod path always
+// accepted, however long they are, and still rejects the ones which are not JSON. See README.md.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parson.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,       \
+                    #condition);                                                    \
+            ++failures;                                                             \
+        }                                                                           \
+    } while (0)
+
+// A number of more than 64 characters, as other serializers write for a long decimal.
+static const char longNumber[] =
+    "3.14159265358979323846264338327950288419716939937510582097494459230781640628e-2";
+
+// A number longer than the stack buffer of the parser is read, and reads back as the same
+// value once it is serialized.
+static void TestLongNumberRoundTrips(void)
+{
+    CHECK(strlen(longNumber) > 64);
+    double expected = strtod(longNumber, NULL);
+
+    JSON_Value *value = json_parse_string(longNumber);
+    CHECK(value != NULL && json_value_get_type(value) == JSONNumber);
+    CHECK(json_value_get_number(value) == expected);
+
+    char *serialized = json_serialize_to_string(value);
+    CHECK(serialized != NULL);
+    JSON_Value *reparsed = serialized == NULL ? NULL : json_parse_string(serialized);
+    CHECK(reparsed != NULL && json_value_get_number(reparsed) == expected);
+
+    json_free_serialized_string(serialized);
+    json_value_free(reparsed);
+    json_value_free(value);
+
+    // The same number inside an array, read through the length-bounded entry point.
+    char array[sizeof(longNumber) + 2];
+    snprintf(array, sizeof(array), "[%s]", longNumber);
+    value = json_parse_buffer(array, strlen(array));
+    CHECK(value != NULL && json_array_get_count(json_value_get_array(value)) == 1);
+    CHECK(json_array_get_number(json_value_get_array(value), 0) == expected);
+    json_value_free(value);
+}
+
+// A long number which ends at the end of the buffer is not read past it.
+static void TestLongNumberAtEndOfBuffer(void)
+{
+    char buffer[] = "1234567890123456789012345678901234567890123456789012345678901234567890"
+                    "99";
+    size_t length = strlen(buffer) - 2;
+    char expected[sizeof(buffer)];
+    memcpy(expected, buffer, length);
+    expected[length] = '\0';
+
+    JSON_Value *value = json_parse_buffer(buffer, length);
+    CHECK(value != NULL && json_value_get_number(value) == strtod(expected, NULL));
+    json_value_free(value);
+}
+
+// Hexadecimal numbers and leading zeros are not JSON, although strtod reads them.
+static void TestNonDecimalNumbersAreRejected(void)
+{
+    JSON_Value *value = json_parse_string("0x10");
+    CHECK(value == NULL);
+    json_value_free(value);
+
+    value = json_parse_string("[0x10]");
+    CHECK(value == NULL);
+    json_value_free(value);
+
+    value = json_parse_string("-0X10");
+    CHECK(value == NULL);
+    json_value_free(value);
+
+    value = json_parse_string("[010]");
+    CHECK(value == NULL);
+    json_value_free(value);
+}
+
+// An exponent which is not complete is not part of the number, as for strtod.
+static void TestIncompleteExponent(void)
+{
+    JSON_Value *value = json_parse_string("[1.5e3, 2E-2]");
+    CHECK(value != NULL);
+    CHECK(json_array_get_number(json_value_get_array(value), 0) == 1500);
+    CHECK(json_array_get_number(json_value_get_array(value), 1) == 0.02);
+    json_value_free(value);
+
+    value = json_parse_string("[1.5e]");
+    CHECK(value == NULL);
+    json_value_free(value);
+}
+
+int main(void)
+{
+    TestLongNumberRoundTrips();
+    TestLongNumberAtEndOfBuffer();
+    TestNonDecimalNumbersAreRejected();
+    TestIncompleteExponent();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All parson checks passed\n");
+    return 0;
+}
@@ -0,0 +1,258 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Replays UART traces into the receive paths of the BLE message protocol and the DFU protocol,
+// through the event loop, and reports the parse throughput, the handler latency, reads which
+// left the parser stalled, and how much the parser copied. With no trace files, generated
+// traces are replayed and compared with a stored baseline. See README.md.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "trace_replay.h"
+
+// The DFU link negotiates its MTU with the bootloader, and the sample allows at most this.
+#define DEFAULT_DFU_MTU 512
+
+typedef int (*ReplayFunction)(const Trace *trace, const ReplayOptions *options,
+                              ReplayStats *stats);
+
+static ReplayOptions options = {.speed = 0, .dfuMtu = DEFAULT_DFU_MTU, .stallUs = 1000};
+static double maxCopyRatio = 4;
+
+// Replays a trace once and prints what was measured. Returns the number of problems which
+// were found, or -1 if the trace could not be replayed.
+static int ReportReplay(const char *name, const Trace *trace, ReplayFunction replay,
+                        const char *frameName)
+{
+    static ReplayStats stats;
+    if (replay(trace, &options, &stats) != 0) {
+        return -1;
+    }
+
+    double nsPerByte = stats.bytes > 0 ? (double)stats.dispatchNs / (double)stats.bytes : 0;
+    double copyRatio = stats.bytes > 0 ? (double)stats.copiedBytes / (double)stats.bytes : 0;
+    printf("%s: %zu reads, %zu bytes, %zu %s, %zu decode errors\n", name, stats.records,
+           stats.bytes, stats.frames, frameName, stats.errors);
+    printf("  dispatch: %.1f ns/byte, %.1f MB/s\n", nsPerByte,
+           nsPerByte > 0 ? 1e3 / nsPerByte : 0);
+    printf("  latency:  p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           (double)ReplayStats_Percentile(&stats, 50) / 1e3,
+           (double)ReplayStats_Percentile(&stats, 99) / 1e3,
+           (double)ReplayStats_Percentile(&stats, 100) / 1e3);
+    printf("  stalls:   %zu reads left bytes unread, %zu reads took over %u us (slowest %.1f us)\n",
+           stats.unreadStalls, stats.slowRecords, options.stallUs,
+           (double)stats.slowestRecordNs / 1e3);
+    printf("  copies:   %.2f bytes copied for each byte received, largest copy %zu bytes\n",
+           copyRatio, stats.largestCopy);
+
+    int problems = 0;
+    if (stats.unreadStalls > 0) {
+        printf("  STALL: the parser went idle with received bytes unread.\n");
+        ++problems;
+    }
+    if (stats.slowRecords > 0) {
+        printf("  SLOW: %zu reads took longer than %u us to handle.\n", stats.slowRecords,
+               options.stallUs);
+        ++problems;
+    }
+    if (copyRatio > maxCopyRatio) {
+        printf("  COPIES: more than %.1f bytes were copied for each byte received.\n",
+               maxCopyRatio);
+        ++problems;
+    }
+    return problems;
+}
+
+// The generated traces are measured as benchmarks, with one replay of the trace for each
+// operation.
+
+static Trace bleTrace;
+static Trace dfuTrace;
+static ReplayStats benchmarkStats;
+
+static void BleReplayRun(uint32_t iterations)
+{
+    while (iterations--) {
+        if (Replay_Ble(&bleTrace, &options, &benchmarkStats) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        benchmarkSink += (uint32_t)benchmarkStats.frames;
+    }
+}
+
+static void DfuReplayRun(uint32_t iterations)
+{
+    while (iterations--) {
+        if (Replay_Dfu(&dfuTrace, &options, &benchmarkStats) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        benchmarkSink += (uint32_t)benchmarkStats.frames;
+    }
+}
+
+static void PrintUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--ble FILE] [--dfu FILE] [--speed FACTOR] [--mtu BYTES]\n"
+            "          [--stall-us MICROSECONDS] [--max-copy-ratio RATIO]\n"
+            "          [--baseline FILE] [--max-regression PERCENT] [--write-baseline FILE]\n"
+            "          [--quick]\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *blePath = NULL;
+    const char *dfuPath = NULL;
+    const char *baselinePath = NULL;
+    const char *writeBaselinePath = NULL;
+    double maxRegressionPercent = 0;
+    unsigned int minSampleMs = 50;
+    unsigned int sampleCount = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ble") == 0 && i + 1 < argc) {
+            blePath = argv[++i];
+        } else if (strcmp(argv[i], "--dfu") == 0 && i + 1 < argc) {
+            dfuPath = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            options.speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--mtu") == 0 && i + 1 < argc) {
+            options.dfuMtu = (size_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--stall-us") == 0 && i + 1 < argc) {
+            options.stallUs = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-copy-ratio") == 0 && i + 1 < argc) {
+            maxCopyRatio = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc) {
+            writeBaselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--max-regression") == 0 && i + 1 < argc) {
+            maxRegressionPercent = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            minSampleMs = 10;
+            sampleCount = 3;
+        } else {
+            PrintUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.dfuMtu < 2 || options.speed < 0) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Recorded traces are replayed once each, and only the report is printed.
+    if (blePath != NULL || dfuPath != NULL) {
+        int problems = 0;
+        Trace trace;
+        if (blePath != NULL) {
+            if (Trace_Load(&trace, blePath) != 0) {
+                return EXIT_FAILURE;
+            }
+            int result = ReportReplay(blePath, &trace, Replay_Ble, "messages");
+            Trace_Free(&trace);
+            if (result < 0) {
+                return EXIT_FAILURE;
+            }
+            problems += result;
+        }
+        if (dfuPath != NULL) {
+            if (Trace_Load(&trace, dfuPath) != 0) {
+                return EXIT_FAILURE;
+            }
+            int result = ReportReplay(dfuPath, &trace, Replay_Dfu, "packets");
+            Trace_Free(&trace);
+            if (result < 0) {
+                return EXIT_FAILURE;
+            }
+            problems += result;
+        }
+        return problems > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    static BenchmarkBaseline baseline;
+    if (baselinePath != NULL && BenchmarkBaseline_Read(&baseline, baselinePath) != 0) {
+        fprintf(stderr, "ERROR: Could not read the baseline %s.\n", baselinePath);
+        return EXIT_FAILURE;
+    }
+
+    Trace_GenerateBle(&bleTrace);
+    Trace_GenerateDfu(&dfuTrace);
+
+    int problems = 0;
+    int result = ReportReplay("replay_ble", &bleTrace, Replay_Ble, "messages");
+    if (result >= 0) {
+        problems += result;
+        result = ReportReplay("replay_dfu", &dfuTrace, Replay_Dfu, "packets");
+    }
+    if (result < 0) {
+        return EXIT_FAILURE;
+    }
+    problems += result;
+    printf("\n");
+
+    // The benchmarks always replay as fast as possible.
+    options.speed = 0;
+    const Benchmark benchmarks[] = {
+        {"replay_ble", NULL, BleReplayRun, bleTrace.dataLength},
+        {"replay_dfu", NULL, DfuReplayRun, dfuTrace.dataLength},
+    };
+
+    FILE *writeBaseline = NULL;
+    if (writeBaselinePath != NULL) {
+        writeBaseline = fopen(writeBaselinePath, "w");
+        if (writeBaseline == NULL) {
+            fprintf(stderr, "ERROR: Could not write the baseline %s.\n", writeBaselinePath);
+            return EXIT_FAILURE;
+        }
+        fprintf(writeBaseline, "# benchmark ns/op\n");
+    }
+
+    printf("%-26s %12s %12s %12s %8s\n", "benchmark", "ns/op", "MB/s", "baseline", "ratio");
+    int regressions = 0;
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i) {
+        const Benchmark *benchmark = &benchmarks[i];
+        BenchmarkResult measured;
+        Benchmark_Measure(benchmark, minSampleMs, sampleCount, &measured);
+        printf("%-26s %12.1f %12.1f", benchmark->name, measured.nsPerOp,
+               measured.bytesPerSec / 1e6);
+
+        // A ratio above 1 is slower than the baseline.
+        double baselineNs = BenchmarkBaseline_Find(&baseline, benchmark->name);
+        if (baselineNs > 0) {
+            double ratio = measured.nsPerOp / baselineNs;
+            bool isRegression =
+                maxRegressionPercent > 0 && ratio > 1 + maxRegressionPercent / 100;
+            printf(" %12.1f %8.2f%s\n", baselineNs, ratio, isRegression ? "  REGRESSION" : "");
+            regressions += isRegression ? 1 : 0;
+        } else {
+            printf(" %12s %8s\n", "-", "-");
+        }
+
+        if (writeBaseline != NULL) {
+            fprintf(writeBaseline, "%s %.1f\n", benchmark->name, measured.nsPerOp);
+        }
+    }
+
+    if (writeBaseline != NULL) {
+        fclose(writeBaseline);
+    }
+    ReplayStats_Free(&benchmarkStats);
+    Trace_Free(&bleTrace);
+    Trace_Free(&dfuTrace);
+
+    if (regressions > 0) {
+        fprintf(stderr, "ERROR: %d benchmark(s) are more than %.0f%% slower than the baseline.\n",
+                regressions, maxRegressionPercent);
+    }
+    if (problems > 0) {
+        fprintf(stderr, "ERROR: The replay found %d problem(s) in the generated traces.\n",
+                problems);
+    }
+    return (regressions > 0 || problems > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
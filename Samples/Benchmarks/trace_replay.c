@@ -0,0 +1,648 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "trace_replay.h"
+
+#include "epoll_timerfd_utilities.h"
+#include "deferred_work.h"
+#include "message_protocol.h"
+#include "message_protocol_private.h"
+#include "mem_buf.h"
+#include "nordic/slip.h"
+
+// Time which one byte takes at 115200 baud, with a start and stop bit, in microseconds.
+static const double BYTE_TIME_US = 10 * 1e6 / 115200;
+
+// Size of the generated traces, in bytes.
+#define GENERATED_TRACE_SIZE (32 * 1024)
+
+// Longest read in the generated traces. The UART driver returns at most this much at once.
+#define GENERATED_MAX_READ 64
+
+static uint64_t GetCurrentTimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// The trace replay is linked with --wrap=memcpy,--wrap=memmove, so every call to them from the
+// sample code comes here first. Copies are only counted while the event loop runs, so the
+// harness's own copies are excluded.
+void *__real_memcpy(void *destination, const void *source, size_t length);
+void *__real_memmove(void *destination, const void *source, size_t length);
+
+static ReplayStats *countingStats = NULL;
+
+static void CountCopy(size_t length)
+{
+    if (countingStats != NULL) {
+        countingStats->copiedBytes += length;
+        if (length > countingStats->largestCopy) {
+            countingStats->largestCopy = length;
+        }
+    }
+}
+
+void *__wrap_memcpy(void *destination, const void *source, size_t length)
+{
+    CountCopy(length);
+    return __real_memcpy(destination, source, length);
+}
+
+void *__wrap_memmove(void *destination, const void *source, size_t length)
+{
+    CountCopy(length);
+    return __real_memmove(destination, source, length);
+}
+
+// Trace storage.
+
+static void AppendData(Trace *trace, const uint8_t *data, size_t length)
+{
+    if (trace->dataLength + length > trace->dataCapacity) {
+        size_t capacity = trace->dataCapacity == 0 ? 4096 : trace->dataCapacity;
+        while (capacity < trace->dataLength + length) {
+            capacity *= 2;
+        }
+        uint8_t *grown = realloc(trace->data, capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "ERROR: Out of memory for the trace.\n");
+            exit(EXIT_FAILURE);
+        }
+        trace->data = grown;
+        trace->dataCapacity = capacity;
+    }
+    memcpy(trace->data + trace->dataLength, data, length);
+    trace->dataLength += length;
+}
+
+static void AppendRecord(Trace *trace, uint64_t timeUs, size_t offset, size_t length)
+{
+    if (trace->recordCount == trace->recordCapacity) {
+        size_t capacity = trace->recordCapacity == 0 ? 256 : trace->recordCapacity * 2;
+        TraceRecord *grown = realloc(trace->records, capacity * sizeof(TraceRecord));
+        if (grown == NULL) {
+            fprintf(stderr, "ERROR: Out of memory for the trace.\n");
+            exit(EXIT_FAILURE);
+        }
+        trace->records = grown;
+        trace->recordCapacity = capacity;
+    }
+    trace->records[trace->recordCount++] =
+        (TraceRecord){.timeUs = timeUs, .offset = offset, .length = length};
+}
+
+static int HexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int Trace_Load(Trace *trace, const char *path)
+{
+    memset(trace, 0, sizeof(*trace));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Could not open the trace %s: %s (%d).\n", path, strerror(errno),
+                errno);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    size_t lineNumber = 0;
+    int result = 0;
+    while (getline(&line, &lineCapacity, file) != -1) {
+        ++lineNumber;
+        const char *p = line;
+        while (isspace((unsigned char)*p)) {
+            ++p;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+
+        char *end;
+        unsigned long long timeUs = strtoull(p, &end, 10);
+        if (end == p || !isspace((unsigned char)*end)) {
+            fprintf(stderr, "ERROR: %s:%zu: Expected the time in microseconds.\n", path,
+                    lineNumber);
+            result = -1;
+            break;
+        }
+
+        size_t offset = trace->dataLength;
+        for (p = end; *p != '\0' && result == 0;) {
+            if (isspace((unsigned char)*p)) {
+                ++p;
+                continue;
+            }
+            int high = HexDigitValue(p[0]);
+            int low = (high < 0) ? -1 : HexDigitValue(p[1]);
+            if (low < 0) {
+                fprintf(stderr, "ERROR: %s:%zu: Expected pairs of hexadecimal digits.\n", path,
+                        lineNumber);
+                result = -1;
+                break;
+            }
+            uint8_t byte = (uint8_t)((high << 4) | low);
+            AppendData(trace, &byte, 1);
+            p += 2;
+        }
+        if (result != 0) {
+            break;
+        }
+
+        if (trace->recordCount > 0 && timeUs < trace->records[trace->recordCount - 1].timeUs) {
+            fprintf(stderr, "ERROR: %s:%zu: The time is earlier than the previous line.\n", path,
+                    lineNumber);
+            result = -1;
+            break;
+        }
+        AppendRecord(trace, timeUs, offset, trace->dataLength - offset);
+    }
+
+    free(line);
+    fclose(file);
+    if (result != 0) {
+        Trace_Free(trace);
+    }
+    return result;
+}
+
+void Trace_Free(Trace *trace)
+{
+    free(trace->records);
+    free(trace->data);
+    memset(trace, 0, sizeof(*trace));
+}
+
+// Trace generation. The same pseudo-random sequence is used on every run, so that the results
+// can be compared with the baseline.
+
+static uint32_t NextPseudoRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+// Splits the bytes which have been appended to the trace into reads of 1 to
+// GENERATED_MAX_READ bytes, each timed as though it took the time to arrive at 115200 baud.
+static void SplitIntoReads(Trace *trace, uint32_t seed)
+{
+    double timeUs = 0;
+    for (size_t offset = 0; offset < trace->dataLength;) {
+        size_t length = 1 + NextPseudoRandom(&seed) % GENERATED_MAX_READ;
+        if (length > trace->dataLength - offset) {
+            length = trace->dataLength - offset;
+        }
+        timeUs += (double)length * BYTE_TIME_US;
+        AppendRecord(trace, (uint64_t)timeUs, offset, length);
+        offset += length;
+    }
+}
+
+void Trace_GenerateBle(Trace *trace)
+{
+    memset(trace, 0, sizeof(*trace));
+    uint32_t seed = 1;
+    unsigned int eventIndex = 0;
+
+    while (trace->dataLength < GENERATED_TRACE_SIZE) {
+        uint32_t kind = NextPseudoRandom(&seed) % 8;
+        if (kind == 0) {
+            // Noise, such as the bytes which the nRF52 sends while it starts.
+            uint8_t noise[16];
+            size_t length = 1 + NextPseudoRandom(&seed) % sizeof(noise);
+            for (size_t i = 0; i < length; ++i) {
+                noise[i] = (uint8_t)NextPseudoRandom(&seed);
+            }
+            AppendData(trace, noise, length);
+        } else if (kind <= 2) {
+            // A response of any size, which matches no request, so it is parsed and then
+            // discarded.
+            MessageProtocol_ResponseMessage response;
+            size_t dataLength = NextPseudoRandom(&seed) % (MAX_RESPONSE_DATA_SIZE + 1);
+            size_t messageLength = sizeof(MessageProtocol_ResponseHeader) + dataLength;
+            memset(&response, 0, sizeof(response));
+            MessageProtocol_MessageHeaderWithType *header =
+                &response.responseHeader.messageHeaderWithType;
+            memcpy(header->messageHeader.preamble, MessageProtocol_MessagePreamble,
+                   sizeof(MessageProtocol_MessagePreamble));
+            header->messageHeader.length =
+                (uint16_t)(messageLength - sizeof(MessageProtocol_MessageHeader));
+            header->type = MessageProtocol_ResponseMessageType;
+            response.responseHeader.categoryId = (MessageProtocol_CategoryId)(1 + kind);
+            response.responseHeader.sequenceNumber = (MessageProtocol_SequenceNumber)(
+                0x8000u | NextPseudoRandom(&seed));
+            for (size_t i = 0; i < dataLength; ++i) {
+                response.data[i] = (uint8_t)NextPseudoRandom(&seed);
+            }
+            AppendData(trace, (const uint8_t *)&response, messageLength);
+        } else {
+            // An event for each category and event in turn.
+            MessageProtocol_EventMessage event;
+            memset(&event, 0, sizeof(event));
+            MessageProtocol_MessageHeaderWithType *header = &event.messageHeaderWithType;
+            memcpy(header->messageHeader.preamble, MessageProtocol_MessagePreamble,
+                   sizeof(MessageProtocol_MessagePreamble));
+            header->messageHeader.length =
+                (uint16_t)(sizeof(event) - sizeof(MessageProtocol_MessageHeader));
+            header->type = MessageProtocol_EventMessageType;
+            event.eventInfo.categoryId =
+                (MessageProtocol_CategoryId)(eventIndex % (MESSAGE_PROTOCOL_MAX_CATEGORY_ID + 1));
+            event.eventInfo.eventId =
+                (MessageProtocol_EventId)(eventIndex / (MESSAGE_PROTOCOL_MAX_CATEGORY_ID + 1) %
+                                          (MESSAGE_PROTOCOL_MAX_EVENT_ID + 1));
+            ++eventIndex;
+            AppendData(trace, (const uint8_t *)&event, sizeof(event));
+        }
+    }
+
+    SplitIntoReads(trace, 2);
+}
+
+void Trace_GenerateDfu(Trace *trace)
+{
+    memset(trace, 0, sizeof(*trace));
+    uint32_t seed = 3;
+    MemBuf *encoded = AllocMemBuf(2 * (3 + GENERATED_MAX_READ) + 1);
+
+    while (trace->dataLength < GENERATED_TRACE_SIZE) {
+        // A response to a request: the response opcode, the request opcode, the result, and
+        // the payload of a select, CRC or firmware version response.
+        uint8_t packet[3 + GENERATED_MAX_READ];
+        size_t payloadLength = NextPseudoRandom(&seed) % (GENERATED_MAX_READ + 1);
+        packet[0] = 0x60;
+        packet[1] = (uint8_t)(1 + NextPseudoRandom(&seed) % 0x0D);
+        packet[2] = 0x01;
+        for (size_t i = 0; i < payloadLength; ++i) {
+            // About one byte in eight must be escaped.
+            uint32_t r = NextPseudoRandom(&seed);
+            packet[3 + i] = (r % 16 == 0) ? 0xC0 : (r % 16 == 1) ? 0xDB : (uint8_t)(r >> 4);
+        }
+
+        MemBufReset(encoded);
+        SlipEncodeAppend(encoded, packet, 3 + payloadLength);
+        SlipEncodeAddEndMarker(encoded);
+        const uint8_t *data;
+        size_t extent;
+        MemBufData(encoded, &data, &extent);
+        AppendData(trace, data, extent);
+    }
+
+    FreeMemBuf(encoded);
+    SplitIntoReads(trace, 4);
+}
+
+// Replay. The code under test reads from receiveFd, as though it were the UART, and each read
+// of the trace is written to sendFd.
+
+typedef struct {
+    int epollFd;
+    int sendFd;
+    int receiveFd;
+} ReplayLink;
+
+static ReplayStats *currentStats = NULL;
+static uint64_t lastWriteNs = 0;
+
+// Called by the handlers of the code under test for each frame which it delivers.
+static void RecordFrame(void)
+{
+    uint64_t latencyNs = GetCurrentTimeNs() - lastWriteNs;
+    if (currentStats->frames < currentStats->latencyCapacity) {
+        currentStats->latenciesNs[currentStats->frames] = latencyNs;
+    }
+    ++currentStats->frames;
+}
+
+static int OpenLink(ReplayLink *link)
+{
+    link->epollFd = CreateEpollFd();
+    if (link->epollFd < 0) {
+        return -1;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        fprintf(stderr, "ERROR: Could not create the socket pair: %s (%d).\n", strerror(errno),
+                errno);
+        close(link->epollFd);
+        return -1;
+    }
+    link->sendFd = fds[0];
+    link->receiveFd = fds[1];
+    fcntl(link->sendFd, F_SETFL, O_NONBLOCK);
+    fcntl(link->receiveFd, F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+static void CloseLink(ReplayLink *link)
+{
+    close(link->sendFd);
+    close(link->receiveFd);
+    close(link->epollFd);
+}
+
+// Prepares the measurements for a replay, with room for a latency for every byte, so that the
+// array is not reallocated while the event loop runs.
+static void ResetStats(ReplayStats *stats, const Trace *trace)
+{
+    uint64_t *latencies = stats->latenciesNs;
+    size_t capacity = stats->latencyCapacity;
+    if (capacity < trace->dataLength + 1) {
+        free(latencies);
+        capacity = trace->dataLength + 1;
+        latencies = malloc(capacity * sizeof(uint64_t));
+        if (latencies == NULL) {
+            fprintf(stderr, "ERROR: Out of memory for the latencies.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->latenciesNs = latencies;
+    stats->latencyCapacity = capacity;
+}
+
+// Runs the event loop until it has no more events to handle.
+static void RunUntilIdle(ReplayLink *link)
+{
+    while (WaitForEventsAndCallHandlers(link->epollFd, EPOLL_MAX_EVENTS_PER_WAIT, 0, NULL) > 0) {
+    }
+}
+
+// Runs the event loop until the given time, so that timers which are due meanwhile are handled
+// as they would be on the device.
+static void RunUntil(ReplayLink *link, uint64_t dueNs)
+{
+    for (;;) {
+        uint64_t now = GetCurrentTimeNs();
+        if (now >= dueNs) {
+            return;
+        }
+        int timeoutMs = (int)((dueNs - now) / 1000000u);
+        if (timeoutMs == 0) {
+            uint64_t remainingNs = dueNs - now;
+            struct timespec pause = {0, (long)remainingNs};
+            nanosleep(&pause, NULL);
+            return;
+        }
+        WaitForEventsAndCallHandlers(link->epollFd, EPOLL_MAX_EVENTS_PER_WAIT, timeoutMs, NULL);
+    }
+}
+
+static int ReplayRecords(ReplayLink *link, const Trace *trace, const ReplayOptions *options,
+                         ReplayStats *stats)
+{
+    currentStats = stats;
+    uint64_t startNs = GetCurrentTimeNs();
+    uint64_t stallNs = (uint64_t)options->stallUs * 1000u;
+
+    for (size_t i = 0; i < trace->recordCount; ++i) {
+        const TraceRecord *record = &trace->records[i];
+        if (options->speed > 0) {
+            RunUntil(link, startNs + (uint64_t)((double)record->timeUs * 1000 / options->speed));
+        }
+
+        // The socket buffer holds far more than one read, so the write only falls short if the
+        // code under test has stopped reading.
+        ssize_t written = write(link->sendFd, trace->data + record->offset, record->length);
+        if (written != (ssize_t)record->length) {
+            fprintf(stderr, "ERROR: The code under test stopped reading after %zu bytes.\n",
+                    stats->bytes);
+            currentStats = NULL;
+            return -1;
+        }
+
+        lastWriteNs = GetCurrentTimeNs();
+        countingStats = stats;
+        RunUntilIdle(link);
+        countingStats = NULL;
+        uint64_t recordNs = GetCurrentTimeNs() - lastWriteNs;
+
+        ++stats->records;
+        stats->bytes += record->length;
+        stats->dispatchNs += recordNs;
+        if (recordNs > stats->slowestRecordNs) {
+            stats->slowestRecordNs = recordNs;
+        }
+        if (recordNs > stallNs) {
+            ++stats->slowRecords;
+        }
+
+        int unread = 0;
+        if (ioctl(link->receiveFd, FIONREAD, &unread) == 0 && unread > 0) {
+            ++stats->unreadStalls;
+        }
+    }
+
+    currentStats = NULL;
+    return 0;
+}
+
+// BLE message protocol.
+
+static void BleEventHandler(MessageProtocol_CategoryId categoryId,
+                            MessageProtocol_EventId eventId)
+{
+    (void)categoryId;
+    (void)eventId;
+    RecordFrame();
+}
+
+int Replay_Ble(const Trace *trace, const ReplayOptions *options, ReplayStats *stats)
+{
+    ResetStats(stats, trace);
+    ReplayLink link;
+    if (OpenLink(&link) != 0) {
+        return -1;
+    }
+
+    static const struct timespec deferredWorkBudget = {0, 5 * 1000 * 1000};
+    DeferredWorkQueue deferredWorkQueue;
+    int result = -1;
+    if (DeferredWorkQueue_Init(&deferredWorkQueue, link.epollFd, &deferredWorkBudget) != 0) {
+        goto closeLink;
+    }
+    if (MessageProtocol_Init(link.epollFd, link.receiveFd, &deferredWorkQueue) != 0) {
+        goto cleanup;
+    }
+    for (MessageProtocol_CategoryId category = 0; category <= MESSAGE_PROTOCOL_MAX_CATEGORY_ID;
+         ++category) {
+        for (MessageProtocol_EventId event = 0; event <= MESSAGE_PROTOCOL_MAX_EVENT_ID; ++event) {
+            MessageProtocol_RegisterEventHandler(category, event, BleEventHandler);
+        }
+    }
+
+    // The UART is writable when it is registered, so handle that before the first read.
+    RunUntilIdle(&link);
+    result = ReplayRecords(&link, trace, options, stats);
+
+cleanup:
+    MessageProtocol_Cleanup();
+    DeferredWorkQueue_Close(&deferredWorkQueue);
+closeLink:
+    CloseLink(&link);
+    return result;
+}
+
+// DFU protocol. The state machine in dfu_uart_protocol.c is bound to the Applibs GPIO and the
+// nRF52 reset line, so the receive path is copied from ReceivePacket. It decodes with the same
+// MemBuf and SLIP functions, into buffers which are allocated in the same way.
+
+typedef struct {
+    int uartFd;
+    size_t mtu;
+    MemArena *bufArena;
+    MemBuf *encodedRxBuf;
+    MemBuf *decodedRxBuf;
+    bool rxInProgress;
+    size_t bytesRead;
+    NrfSlipDecodeState decodeState;
+    EventData uartEventData;
+} DfuReceiver;
+
+static DfuReceiver dfuReceiver;
+
+// Returns 1 if a whole packet is in decodedRxBuf, 0 if the UART has no more data, or -1 if the
+// packet could not be decoded, as ReceivePacket does.
+static int ReceiveDfuPacket(DfuReceiver *dts)
+{
+    if (!dts->rxInProgress) {
+        dts->bytesRead = 0;
+        dts->decodeState = NRF_SLIP_STATE_DECODING;
+        MemBufReset(dts->decodedRxBuf);
+        dts->rxInProgress = true;
+    }
+
+    bool finished = false;
+    while (!finished && dts->bytesRead < dts->mtu) {
+        if (MemBufCurSize(dts->encodedRxBuf) == 0) {
+            size_t space;
+            uint8_t *tail = MemBufTail(dts->encodedRxBuf, &space);
+            ssize_t bytesReadOneSysCall = read(dts->uartFd, tail, space);
+            if ((bytesReadOneSysCall == 0) || (bytesReadOneSysCall < 0 && errno == EAGAIN)) {
+                return 0;
+            } else if (bytesReadOneSysCall < 0) {
+                dts->rxInProgress = false;
+                return -1;
+            }
+            MemBufCommit(dts->encodedRxBuf, (size_t)bytesReadOneSysCall);
+        }
+
+        const uint8_t *encoded;
+        size_t extent;
+        MemBufData(dts->encodedRxBuf, &encoded, &extent);
+        if (extent > dts->mtu - dts->bytesRead) {
+            extent = dts->mtu - dts->bytesRead;
+        }
+
+        size_t consumed =
+            SlipDecodeAppend(encoded, extent, dts->decodedRxBuf, &dts->decodeState, &finished);
+        MemBufConsume(dts->encodedRxBuf, consumed);
+        dts->bytesRead += consumed;
+
+        if (dts->decodeState == NRF_SLIP_STATE_CLEARING_INVALID_PACKET) {
+            dts->rxInProgress = false;
+            return -1;
+        }
+    }
+
+    dts->rxInProgress = false;
+    return finished ? 1 : -1;
+}
+
+// Edge-triggered, so keep receiving until the UART has no more data. The state machine would
+// abort the transfer on an error; the replay counts it and carries on with the next packet.
+static void DfuUartEventHandler(EventData *eventData)
+{
+    (void)eventData;
+    for (;;) {
+        int result = ReceiveDfuPacket(&dfuReceiver);
+        if (result == 0) {
+            return;
+        } else if (result > 0) {
+            RecordFrame();
+        } else {
+            ++currentStats->errors;
+        }
+    }
+}
+
+int Replay_Dfu(const Trace *trace, const ReplayOptions *options, ReplayStats *stats)
+{
+    ResetStats(stats, trace);
+    ReplayLink link;
+    if (OpenLink(&link) != 0) {
+        return -1;
+    }
+
+    memset(&dfuReceiver, 0, sizeof(dfuReceiver));
+    dfuReceiver.uartFd = link.receiveFd;
+    dfuReceiver.mtu = options->dfuMtu;
+    dfuReceiver.uartEventData.eventHandler = &DfuUartEventHandler;
+    dfuReceiver.bufArena = AllocMemArena(2 * MemArenaBufSize(options->dfuMtu));
+    if (dfuReceiver.bufArena == NULL) {
+        fprintf(stderr, "ERROR: Out of memory for the DFU receive buffers.\n");
+        CloseLink(&link);
+        return -1;
+    }
+    dfuReceiver.decodedRxBuf = MemArenaAllocBuf(dfuReceiver.bufArena, options->dfuMtu);
+    dfuReceiver.encodedRxBuf = MemArenaAllocBuf(dfuReceiver.bufArena, options->dfuMtu);
+
+    int result = -1;
+    if (RegisterPersistentEventHandlerToEpoll(link.epollFd, link.receiveFd,
+                                              &dfuReceiver.uartEventData, EPOLLIN) == 0) {
+        result = ReplayRecords(&link, trace, options, stats);
+        UnregisterPersistentEventHandlerFromEpoll(link.epollFd, &dfuReceiver.uartEventData);
+    }
+
+    FreeMemArena(dfuReceiver.bufArena);
+    CloseLink(&link);
+    return result;
+}
+
+// Measurements.
+
+static int CompareLatencies(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t ReplayStats_Percentile(ReplayStats *stats, double percentile)
+{
+    size_t count = stats->frames < stats->latencyCapacity ? stats->frames : stats->latencyCapacity;
+    if (count == 0) {
+        return 0;
+    }
+    qsort(stats->latenciesNs, count, sizeof(uint64_t), CompareLatencies);
+    size_t index = (size_t)(percentile / 100 * (double)(count - 1) + 0.5);
+    return stats->latenciesNs[index < count ? index : count - 1];
+}
+
+void ReplayStats_Free(ReplayStats *stats)
+{
+    free(stats->latenciesNs);
+    memset(stats, 0, sizeof(*stats));
+}
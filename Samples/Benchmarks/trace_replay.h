@@ -0,0 +1,147 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     One read which the UART returned while the trace was recorded: the time at which it
+///     arrived and the bytes which it held.
+/// </summary>
+typedef struct {
+    /// <summary>Time since the start of the trace, in microseconds.</summary>
+    uint64_t timeUs;
+    /// <summary>Offset of the bytes in <see cref="Trace.data" />.</summary>
+    size_t offset;
+    size_t length;
+} TraceRecord;
+
+/// <summary>
+///     The bytes which were received from a UART, in the order and with the timing in which they
+///     arrived. The members are owned by the trace, and released by <see cref="Trace_Free" />.
+/// </summary>
+typedef struct {
+    TraceRecord *records;
+    size_t recordCount;
+    size_t recordCapacity;
+    uint8_t *data;
+    size_t dataLength;
+    size_t dataCapacity;
+} Trace;
+
+/// <summary>
+///     Reads a trace from a text file. Each line holds the time in microseconds at which a
+///     read arrived, and then its bytes in hexadecimal, such as "1250 22b558b9 0600". Spaces
+///     between the bytes are ignored. Lines which are empty or start with '#' are ignored.
+/// </summary>
+/// <param name="trace">Receives the trace, which must be released with
+/// <see cref="Trace_Free" />.</param>
+/// <param name="path">Path of the trace file.</param>
+/// <returns>0 on success, or -1 if the file could not be read or a line is invalid</returns>
+int Trace_Load(Trace *trace, const char *path);
+
+/// <summary>
+///     Generates the same trace of the BLE message protocol on every run. It holds event
+///     messages for every category and event, responses of up to the largest size which the
+///     protocol allows, and noise between some of the messages, received in reads of 1 to 64
+///     bytes at 115200 baud.
+/// </summary>
+/// <param name="trace">Receives the trace, which must be released with
+/// <see cref="Trace_Free" />.</param>
+void Trace_GenerateBle(Trace *trace);
+
+/// <summary>
+///     Generates the same trace of SLIP-encoded responses from the nRF52 bootloader on every
+///     run, with payloads which contain the bytes that SLIP must escape, received in reads of 1
+///     to 64 bytes at 115200 baud.
+/// </summary>
+/// <param name="trace">Receives the trace, which must be released with
+/// <see cref="Trace_Free" />.</param>
+void Trace_GenerateDfu(Trace *trace);
+
+/// <summary>
+///     Releases the memory of a trace.
+/// </summary>
+void Trace_Free(Trace *trace);
+
+/// <summary>
+///     How a trace is replayed.
+/// </summary>
+typedef struct {
+    /// <summary>Multiple of the recorded speed at which the reads are delivered, or 0 to
+    /// deliver each read as soon as the previous one has been handled.</summary>
+    double speed;
+    /// <summary>Largest packet which the DFU replay accepts, as negotiated with the nRF52
+    /// bootloader.</summary>
+    size_t dfuMtu;
+    /// <summary>A read which the event loop takes longer than this to handle, in
+    /// microseconds, counts as a slow read.</summary>
+    unsigned int stallUs;
+} ReplayOptions;
+
+/// <summary>
+///     What was measured while a trace was replayed.
+/// </summary>
+typedef struct {
+    size_t records;
+    size_t bytes;
+    /// <summary>Messages which reached an event handler, or packets which were decoded.</summary>
+    size_t frames;
+    /// <summary>Packets which could not be decoded. Only the DFU replay counts these.</summary>
+    size_t errors;
+    /// <summary>Time in the event loop, from the write of each read until the loop is idle
+    /// again.</summary>
+    uint64_t dispatchNs;
+    /// <summary>Time from the write of the read which completed each frame until its handler
+    /// was called, in nanoseconds, one for each frame.</summary>
+    uint64_t *latenciesNs;
+    size_t latencyCapacity;
+    /// <summary>Reads after which the event loop went idle with bytes left unread.</summary>
+    size_t unreadStalls;
+    /// <summary>Reads which took longer than <see cref="ReplayOptions.stallUs" /> to handle,
+    /// and the longest time which any read took.</summary>
+    size_t slowRecords;
+    uint64_t slowestRecordNs;
+    /// <summary>Bytes which were copied with memcpy or memmove while the event loop ran, and
+    /// the largest single copy.</summary>
+    uint64_t copiedBytes;
+    size_t largestCopy;
+} ReplayStats;
+
+/// <summary>
+///     Replays a trace into the BLE message protocol. The protocol reads from one end of a
+///     socket pair, as though it were the UART, and each read of the trace is written to the
+///     other end. A handler is registered for every category and event.
+/// </summary>
+/// <param name="trace">The trace.</param>
+/// <param name="options">How the trace is replayed.</param>
+/// <param name="stats">Receives the measurements. The latency array is reused between calls,
+/// and must be released with <see cref="ReplayStats_Free" />.</param>
+/// <returns>0 on success, or -1 if the event loop or socket pair could not be set up</returns>
+int Replay_Ble(const Trace *trace, const ReplayOptions *options, ReplayStats *stats);
+
+/// <summary>
+///     Replays a trace into the receive path of the DFU protocol, with the same socket pair and
+///     event loop as <see cref="Replay_Ble" />. A packet which cannot be decoded is counted, and
+///     decoding carries on with the next one.
+/// </summary>
+/// <param name="trace">The trace.</param>
+/// <param name="options">How the trace is replayed.</param>
+/// <param name="stats">Receives the measurements, as for <see cref="Replay_Ble" />.</param>
+/// <returns>0 on success, or -1 if the event loop or socket pair could not be set up</returns>
+int Replay_Dfu(const Trace *trace, const ReplayOptions *options, ReplayStats *stats);
+
+/// <summary>
+///     Finds a percentile of the handler latencies. The latencies are sorted in place.
+/// </summary>
+/// <param name="stats">The measurements.</param>
+/// <param name="percentile">The percentile, from 0 to 100.</param>
+/// <returns>The latency in nanoseconds, or 0 if no frame was handled</returns>
+uint64_t ReplayStats_Percentile(ReplayStats *stats, double percentile);
+
+/// <summary>
+///     Releases the latency array of the measurements.
+/// </summary>
+void ReplayStats_Free(ReplayStats *stats);
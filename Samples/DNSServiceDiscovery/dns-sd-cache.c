@@ -0,0 +1,367 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dns-sd-cache.h"
+#include <applibs/log.h>
+#include <resolv.h>
+#include <string.h>
+#include <strings.h>
+
+// Percentages of the TTL at which refresh queries are sent, from RFC 6762 section 5.2.
+static const uint32_t refreshPercentages[] = {80, 85, 90, 95};
+#define REFRESH_COUNT (sizeof(refreshPercentages) / sizeof(refreshPercentages[0]))
+
+static bool IsCached(const DnsSdRecordLifetime *lifetime, time_t now)
+{
+    return lifetime->ttl > 0 && now < lifetime->received + (time_t)lifetime->ttl;
+}
+
+static void CacheRecord(DnsSdRecordLifetime *lifetime, uint32_t ttl, time_t now)
+{
+    lifetime->received = now;
+    lifetime->ttl = ttl;
+    lifetime->refreshes = 0;
+}
+
+/// <summary>
+///     Gets the time of the next refresh of a record, or of its expiry once all the refreshes
+///     have been sent.
+/// </summary>
+static time_t NextEventTime(const DnsSdRecordLifetime *lifetime)
+{
+    if (lifetime->refreshes < REFRESH_COUNT) {
+        return lifetime->received +
+               (time_t)(lifetime->ttl * refreshPercentages[lifetime->refreshes] / 100);
+    }
+    return lifetime->received + (time_t)lifetime->ttl;
+}
+
+/// <summary>
+///     Checks whether a refresh of a cached record is due, and counts it as sent if it is.
+/// </summary>
+static bool TakeDueRefresh(DnsSdRecordLifetime *lifetime, time_t now)
+{
+    if (!IsCached(lifetime, now) || lifetime->refreshes >= REFRESH_COUNT ||
+        now < NextEventTime(lifetime)) {
+        return false;
+    }
+    // Skip the refreshes which were missed, such as while the device was busy.
+    while (lifetime->refreshes < REFRESH_COUNT && now >= NextEventTime(lifetime)) {
+        ++lifetime->refreshes;
+    }
+    return true;
+}
+
+static bool IsEntryUsed(const DnsSdCacheEntry *entry, time_t now)
+{
+    return entry->name[0] != '\0' &&
+           (IsCached(&entry->ptr, now) || IsCached(&entry->srv, now) ||
+            IsCached(&entry->txt, now));
+}
+
+/// <summary>
+///     Checks whether a name is the service type which is cached or, if isInstance is true, the
+///     name of one of its instances.
+/// </summary>
+static bool IsCachedServiceName(const DnsSdCache *cache, const char *name, bool isInstance)
+{
+    if (cache->serviceType[0] == '\0') {
+        return true;
+    }
+    if (!isInstance) {
+        return strcasecmp(name, cache->serviceType) == 0;
+    }
+    size_t nameLength = strlen(name);
+    size_t typeLength = strlen(cache->serviceType);
+    return nameLength > typeLength + 1 && name[nameLength - typeLength - 1] == '.' &&
+           strcasecmp(name + nameLength - typeLength, cache->serviceType) == 0;
+}
+
+static DnsSdCacheEntry *FindEntry(DnsSdCache *cache, const char *name)
+{
+    for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+        if (cache->entries[i].name[0] != '\0' && strcasecmp(cache->entries[i].name, name) == 0) {
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Finds the entry of an instance, or adds one, in a free slot or else in place of the
+///     entry which was received longest ago.
+/// </summary>
+static DnsSdCacheEntry *FindOrAddEntry(DnsSdCache *cache, const char *name, time_t now)
+{
+    DnsSdCacheEntry *entry = FindEntry(cache, name);
+    if (entry != NULL) {
+        return entry;
+    }
+    if (strlen(name) >= DNS_SD_CACHE_NAME_SIZE) {
+        return NULL;
+    }
+
+    DnsSdCacheEntry *oldest = NULL;
+    for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+        DnsSdCacheEntry *candidate = &cache->entries[i];
+        if (!IsEntryUsed(candidate, now)) {
+            oldest = candidate;
+            break;
+        }
+        if (oldest == NULL || candidate->ptr.received < oldest->ptr.received) {
+            oldest = candidate;
+        }
+    }
+    if (IsEntryUsed(oldest, now)) {
+        Log_Debug("INFO: DNS-SD cache is full; dropping instance %s.\n", oldest->name);
+    }
+
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->ipv4Address.s_addr = INADDR_NONE;
+    strcpy(oldest->name, name);
+    return oldest;
+}
+
+static void RemoveEntry(DnsSdCacheEntry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+}
+
+/// <summary>
+///     Caches one record. A records are only matched to the hosts of the SRV records which
+///     are already cached, so they are added after the other records of the response.
+/// </summary>
+/// <returns>1 if the record was cached, 0 if it is not for a service instance, or -1 if it is
+/// malformed</returns>
+static int CacheResourceRecord(DnsSdCache *cache, const uint8_t *response, size_t length,
+                               ns_rr *rr, bool addressRecords, time_t now)
+{
+    char nameBuf[DNS_SD_CACHE_NAME_SIZE];
+    const uint8_t *end = response + length;
+    const uint8_t *data = ns_rr_rdata(*rr);
+    uint32_t ttl = ns_rr_ttl(*rr);
+    DnsSdCacheEntry *entry = NULL;
+
+    if ((ns_rr_type(*rr) == ns_t_a) != addressRecords) {
+        return 0;
+    }
+
+    bool isInstance = ns_rr_type(*rr) != ns_t_ptr;
+    if (ns_rr_type(*rr) != ns_t_a && !IsCachedServiceName(cache, ns_rr_name(*rr), isInstance)) {
+        return 0;
+    }
+
+    switch (ns_rr_type(*rr)) {
+    case ns_t_ptr:
+        if (dn_expand(response, end, data, nameBuf, sizeof(nameBuf)) <= 0) {
+            return -1;
+        }
+        if (ttl == 0) {
+            entry = FindEntry(cache, nameBuf);
+            if (entry != NULL) {
+                Log_Debug("INFO: DNS-SD instance %s has gone away.\n", entry->name);
+                RemoveEntry(entry);
+            }
+            return 1;
+        }
+        entry = FindOrAddEntry(cache, nameBuf, now);
+        if (entry == NULL || strlen(ns_rr_name(*rr)) >= sizeof(entry->serviceType)) {
+            return -1;
+        }
+        strcpy(entry->serviceType, ns_rr_name(*rr));
+        CacheRecord(&entry->ptr, ttl, now);
+        // The details are asked for again if the last query for them was not answered.
+        if (!IsCached(&entry->srv, now)) {
+            entry->detailsRequested = false;
+        }
+        return 1;
+
+    case ns_t_srv:
+        // SRV record format: Priority|  Weight |   Port  |     Target
+        //                   (2 Bytes)|(2 Bytes)|(2 Bytes)|(Remaining Bytes)
+        if (ns_rr_rdlen(*rr) < 3 * sizeof(uint16_t) ||
+            dn_expand(response, end, data + 3 * sizeof(uint16_t), nameBuf, sizeof(nameBuf)) <= 0) {
+            return -1;
+        }
+        entry = FindOrAddEntry(cache, ns_rr_name(*rr), now);
+        if (entry == NULL) {
+            return -1;
+        }
+        entry->port = (uint16_t)ns_get16(data + 2 * sizeof(uint16_t));
+        if (strcasecmp(entry->host, nameBuf) != 0) {
+            strcpy(entry->host, nameBuf);
+            memset(&entry->a, 0, sizeof(entry->a));
+            entry->ipv4Address.s_addr = INADDR_NONE;
+        }
+        CacheRecord(&entry->srv, ttl, now);
+        return 1;
+
+    case ns_t_txt:
+        entry = FindOrAddEntry(cache, ns_rr_name(*rr), now);
+        if (entry == NULL) {
+            return -1;
+        }
+        entry->txtDataLength = (ns_rr_rdlen(*rr) < DNS_SD_CACHE_TXT_SIZE)
+                                   ? (uint16_t)ns_rr_rdlen(*rr)
+                                   : DNS_SD_CACHE_TXT_SIZE;
+        memcpy(entry->txtData, data, entry->txtDataLength);
+        CacheRecord(&entry->txt, ttl, now);
+        return 1;
+
+    case ns_t_a: {
+        if (ns_rr_rdlen(*rr) != sizeof(struct in_addr)) {
+            Log_Debug("ERROR: Invalid DNS A record length: %d\n", ns_rr_rdlen(*rr));
+            return -1;
+        }
+        int cached = 0;
+        for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+            entry = &cache->entries[i];
+            if (entry->name[0] != '\0' && strcasecmp(entry->host, ns_rr_name(*rr)) == 0) {
+                memcpy(&entry->ipv4Address.s_addr, data, sizeof(entry->ipv4Address.s_addr));
+                CacheRecord(&entry->a, ttl, now);
+                cached = 1;
+            }
+        }
+        return cached;
+    }
+
+    default:
+        return 0;
+    }
+}
+
+void DnsSdCache_Init(DnsSdCache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+int DnsSdCache_SetServiceType(DnsSdCache *cache, const char *serviceType)
+{
+    if (serviceType == NULL) {
+        cache->serviceType[0] = '\0';
+        return 0;
+    }
+    if (strlen(serviceType) >= sizeof(cache->serviceType)) {
+        return -1;
+    }
+    strcpy(cache->serviceType, serviceType);
+    return 0;
+}
+
+int DnsSdCache_AddResponse(DnsSdCache *cache, const uint8_t *response, size_t length,
+                           time_t now)
+{
+    ns_msg msg;
+    ns_rr rr;
+    int cachedCount = 0;
+    if (ns_initparse(response, (int)length, &msg) != 0) {
+        return -1;
+    }
+
+    static const ns_sect sections[] = {ns_s_an, ns_s_ar};
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); s++) {
+            int recordCount = ns_msg_count(msg, sections[s]);
+            for (int i = 0; i < recordCount; i++) {
+                if (ns_parserr(&msg, sections[s], i, &rr) != 0) {
+                    return -1;
+                }
+                int result = CacheResourceRecord(cache, response, length, &rr, pass == 1, now);
+                if (result > 0) {
+                    cachedCount += result;
+                }
+            }
+        }
+    }
+    return cachedCount;
+}
+
+const DnsSdCacheEntry *DnsSdCache_Find(const DnsSdCache *cache, const char *instanceName,
+                                       time_t now)
+{
+    for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+        const DnsSdCacheEntry *entry = DnsSdCache_GetInstance(cache, i, now);
+        if (entry != NULL && strcasecmp(entry->name, instanceName) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+const DnsSdCacheEntry *DnsSdCache_GetInstance(const DnsSdCache *cache, size_t index,
+                                              time_t now)
+{
+    if (index >= DNS_SD_CACHE_MAX_INSTANCES) {
+        return NULL;
+    }
+    const DnsSdCacheEntry *entry = &cache->entries[index];
+    if (entry->name[0] == '\0' || !IsCached(&entry->srv, now) || entry->host[0] == '\0') {
+        return NULL;
+    }
+    return entry;
+}
+
+bool DnsSdCache_GetDueQuery(DnsSdCache *cache, time_t now, DnsSdQueryType *type,
+                            const char **name)
+{
+    for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+        DnsSdCacheEntry *entry = &cache->entries[i];
+        if (entry->name[0] == '\0') {
+            continue;
+        }
+        if (!IsEntryUsed(entry, now)) {
+            Log_Debug("INFO: DNS-SD instance %s has expired.\n", entry->name);
+            RemoveEntry(entry);
+            continue;
+        }
+
+        // Refreshing the PTR record of one instance refreshes all the instances of its service
+        // type, so the others are counted as refreshed too.
+        if (TakeDueRefresh(&entry->ptr, now)) {
+            for (size_t j = i + 1; j < DNS_SD_CACHE_MAX_INSTANCES; j++) {
+                if (strcasecmp(cache->entries[j].serviceType, entry->serviceType) == 0) {
+                    TakeDueRefresh(&cache->entries[j].ptr, now);
+                }
+            }
+            *type = DnsSdQueryType_Service;
+            *name = entry->serviceType;
+            return true;
+        }
+
+        // One query for the instance refreshes its SRV, TXT and A records together.
+        bool missingDetails = !IsCached(&entry->srv, now) && !entry->detailsRequested;
+        bool srvDue = TakeDueRefresh(&entry->srv, now);
+        bool txtDue = TakeDueRefresh(&entry->txt, now);
+        bool aDue = TakeDueRefresh(&entry->a, now);
+        if (missingDetails || srvDue || txtDue || aDue) {
+            entry->detailsRequested = true;
+            *type = DnsSdQueryType_Instance;
+            *name = entry->name;
+            return true;
+        }
+    }
+    return false;
+}
+
+time_t DnsSdCache_GetNextEventTime(const DnsSdCache *cache)
+{
+    time_t next = 0;
+    for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+        const DnsSdCacheEntry *entry = &cache->entries[i];
+        if (entry->name[0] == '\0') {
+            continue;
+        }
+        const DnsSdRecordLifetime *lifetimes[] = {&entry->ptr, &entry->srv, &entry->txt,
+                                                  &entry->a};
+        for (size_t j = 0; j < sizeof(lifetimes) / sizeof(lifetimes[0]); j++) {
+            if (lifetimes[j]->ttl == 0) {
+                continue;
+            }
+            time_t eventTime = NextEventTime(lifetimes[j]);
+            if (next == 0 || eventTime < next) {
+                next = eventTime;
+            }
+        }
+    }
+    return next;
+}
@@ -0,0 +1,162 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+/// <summary>Number of service instances which the cache holds.</summary>
+#define DNS_SD_CACHE_MAX_INSTANCES 16
+
+/// <summary>Size of each name in the cache, including the null terminator.</summary>
+#define DNS_SD_CACHE_NAME_SIZE 256
+
+/// <summary>Most bytes of TXT data which are kept for an instance.</summary>
+#define DNS_SD_CACHE_TXT_SIZE 256
+
+/// <summary>
+///     When a cached record was received and how long it lives, from its TTL.
+/// </summary>
+typedef struct {
+    /// <summary>When the record was received, in seconds of CLOCK_MONOTONIC.</summary>
+    time_t received;
+    /// <summary>The TTL of the record in seconds, or 0 if it is not cached.</summary>
+    uint32_t ttl;
+    /// <summary>Number of refresh queries which have been sent for this record.</summary>
+    uint32_t refreshes;
+} DnsSdRecordLifetime;
+
+/// <summary>
+///     The details of one service instance, which are collected from its PTR, SRV, TXT and A
+///     records.
+/// </summary>
+typedef struct {
+    /// <summary>Service instance name, such as "SampleInstanceName._sample-service._tcp.local",
+    /// or an empty string if the slot is free.</summary>
+    char name[DNS_SD_CACHE_NAME_SIZE];
+    /// <summary>Service type which the PTR record was for, such as
+    /// "_sample-service._tcp.local".</summary>
+    char serviceType[DNS_SD_CACHE_NAME_SIZE];
+    /// <summary>Service host name, from the SRV record.</summary>
+    char host[DNS_SD_CACHE_NAME_SIZE];
+    /// <summary>IPv4 address of the host, from its A record.</summary>
+    struct in_addr ipv4Address;
+    /// <summary>Network port, from the SRV record.</summary>
+    uint16_t port;
+    /// <summary>DNS TXT data, which is truncated to DNS_SD_CACHE_TXT_SIZE bytes.</summary>
+    uint8_t txtData[DNS_SD_CACHE_TXT_SIZE];
+    uint16_t txtDataLength;
+    DnsSdRecordLifetime ptr;
+    DnsSdRecordLifetime srv;
+    DnsSdRecordLifetime txt;
+    DnsSdRecordLifetime a;
+    /// <summary>Whether the SRV, TXT and A records have been queried since the instance was
+    /// found without them.</summary>
+    bool detailsRequested;
+} DnsSdCacheEntry;
+
+/// <summary>
+///     The kinds of query which the cache asks to be sent.
+/// </summary>
+typedef enum {
+    /// <summary>A PTR query for a service type, with <see cref="SendServiceDiscoveryQuery" />.
+    /// </summary>
+    DnsSdQueryType_Service,
+    /// <summary>A query for the SRV, TXT and A records of an instance, with
+    /// <see cref="SendServiceInstanceDetailsQuery" />.</summary>
+    DnsSdQueryType_Instance
+} DnsSdQueryType;
+
+/// <summary>
+/// <para>Caches the service instances which have been discovered, keyed by instance name, so
+/// that the app can look them up without querying the network again.</para>
+/// <para>Every PTR, SRV, TXT and A record in a response is cached, so a response which lists
+/// several instances adds all of them. Each record is kept for its TTL, and refresh queries are
+/// asked for at 80%, 85%, 90% and 95% of it, as RFC 6762 section 5.2 suggests, so that a record
+/// whose service is still there is renewed before it expires. A record with a TTL of 0, which
+/// an mDNS responder sends when the service goes away, removes it at once.</para>
+/// <para>When a service type is set with <see cref="DnsSdCache_SetServiceType" />, only its
+/// PTR records and the records of its instances are cached, so that the unsolicited
+/// announcements of the other services on the network are ignored.</para>
+/// <para>Times are seconds of CLOCK_MONOTONIC, which the caller passes in.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="DnsSdCache_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    DnsSdCacheEntry entries[DNS_SD_CACHE_MAX_INSTANCES];
+    /// <summary>The service type whose records are cached, or an empty string to cache the
+    /// records of every service.</summary>
+    char serviceType[DNS_SD_CACHE_NAME_SIZE];
+} DnsSdCache;
+
+/// <summary>
+///     Initializes an empty cache.
+/// </summary>
+void DnsSdCache_Init(DnsSdCache *cache);
+
+/// <summary>
+///     Sets the service type whose records are cached. The records of other services which are
+///     already cached are kept until they expire.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="serviceType">The service type, such as "_sample-service._tcp.local", or NULL
+/// to cache the records of every service.</param>
+/// <returns>0 on success, or -1 if the name is too long</returns>
+int DnsSdCache_SetServiceType(DnsSdCache *cache, const char *serviceType);
+
+/// <summary>
+///     Adds the records of a DNS response to the cache.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="response">The DNS response, as it was received.</param>
+/// <param name="length">The length of the response.</param>
+/// <param name="now">The current time.</param>
+/// <returns>The number of records which were cached, or -1 if the response could not be
+/// parsed</returns>
+int DnsSdCache_AddResponse(DnsSdCache *cache, const uint8_t *response, size_t length,
+                           time_t now);
+
+/// <summary>
+///     Looks up an instance whose host has been resolved and whose SRV record has not expired.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="instanceName">The service instance name.</param>
+/// <param name="now">The current time.</param>
+/// <returns>The instance, or NULL if it is not in the cache</returns>
+const DnsSdCacheEntry *DnsSdCache_Find(const DnsSdCache *cache, const char *instanceName,
+                                       time_t now);
+
+/// <summary>
+///     Gets the instance in a slot of the cache, to list all of them.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="index">The slot, from 0 to DNS_SD_CACHE_MAX_INSTANCES - 1.</param>
+/// <param name="now">The current time.</param>
+/// <returns>The instance, or NULL if the slot does not hold a complete instance</returns>
+const DnsSdCacheEntry *DnsSdCache_GetInstance(const DnsSdCache *cache, size_t index,
+                                              time_t now);
+
+/// <summary>
+///     Removes the records which have expired, and gets the next query which is due: to
+///     fetch the details of an instance which was found without them, or to refresh a record
+///     before it expires. Call this repeatedly until it returns false, sending each query.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="now">The current time.</param>
+/// <param name="type">Receives the kind of query.</param>
+/// <param name="name">Receives the name to query: the service type or the instance
+/// name.</param>
+/// <returns>true if a query is due, which is then counted as sent; false if none is</returns>
+bool DnsSdCache_GetDueQuery(DnsSdCache *cache, time_t now, DnsSdQueryType *type,
+                            const char **name);
+
+/// <summary>
+///     Gets the time at which <see cref="DnsSdCache_GetDueQuery" /> should be called next,
+///     when a refresh is due or a record expires.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <returns>The time, or 0 if the cache is empty</returns>
+time_t DnsSdCache_GetNextEventTime(const DnsSdCache *cache);
@@ -0,0 +1,230 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "dns-sd-resolver.h"
+#include "dns-sd.h"
+#include <applibs/log.h>
+#include <resolv.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+// How long the first attempt of a query waits for its response. Each retry waits twice as long.
+#define QUERY_TIMEOUT_MS 1000
+
+static void QueryTimeoutEventHandler(EventData *eventData);
+
+/// <summary>
+///     Sends a query with a new message ID, and waits for its response.
+/// </summary>
+static int SendPendingQuery(DnsSdPendingQuery *query)
+{
+    DnsSdResolver *resolver = query->resolver;
+    query->id = NextDnsQueryId();
+
+    int type = (query->type == DnsSdQueryType_Service) ? ns_t_ptr : ns_t_any;
+    if (SendDnsQueryWithId(query->name, ns_c_in, type, query->id, resolver->fd) != 0) {
+        return -1;
+    }
+
+    long timeoutMs = (long)QUERY_TIMEOUT_MS << query->retries;
+    struct timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000 * 1000};
+    return TimerWheel_SetTimerToSingleExpiry(&resolver->timerWheel, &query->timeoutTimer,
+                                             &timeout);
+}
+
+static void ReleaseQuery(DnsSdPendingQuery *query)
+{
+    TimerWheel_CancelTimer(&query->resolver->timerWheel, &query->timeoutTimer);
+    query->inUse = false;
+    --query->resolver->pendingCount;
+}
+
+static void QueryTimeoutEventHandler(EventData *eventData)
+{
+    DnsSdPendingQuery *query =
+        (DnsSdPendingQuery *)((uint8_t *)eventData -
+                              offsetof(DnsSdPendingQuery, timeoutTimer.eventData));
+
+    if (query->retries < DNS_SD_RESOLVER_MAX_RETRIES) {
+        ++query->retries;
+        if (SendPendingQuery(query) == 0) {
+            return;
+        }
+    } else {
+        Log_Debug("INFO: DNS-SD query for %s was not answered.\n", query->name);
+        ++query->resolver->timedOutQueries;
+    }
+    ReleaseQuery(query);
+}
+
+/// <summary>
+///     Checks whether a record answers a query: the PTR records of a service type, or any record
+///     of an instance.
+/// </summary>
+static bool RecordAnswersQuery(const DnsSdPendingQuery *query, ns_rr *rr)
+{
+    if (query->type == DnsSdQueryType_Service && ns_rr_type(*rr) != ns_t_ptr) {
+        return false;
+    }
+    return strcasecmp(ns_rr_name(*rr), query->name) == 0;
+}
+
+/// <summary>
+///     Stops waiting for the queries which a multicast DNS response answers, by the names of
+///     its records.
+/// </summary>
+static void ReleaseQueriesByName(DnsSdResolver *resolver, ns_msg *msg)
+{
+    static const ns_sect sections[] = {ns_s_an, ns_s_ar};
+    ns_rr rr;
+    for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); s++) {
+        int recordCount = ns_msg_count(*msg, sections[s]);
+        for (int i = 0; i < recordCount && resolver->pendingCount > 0; i++) {
+            if (ns_parserr(msg, sections[s], i, &rr) != 0) {
+                return;
+            }
+            for (size_t q = 0; q < DNS_SD_RESOLVER_MAX_QUERIES; q++) {
+                if (resolver->queries[q].inUse && RecordAnswersQuery(&resolver->queries[q], &rr)) {
+                    ReleaseQuery(&resolver->queries[q]);
+                }
+            }
+        }
+    }
+}
+
+int DnsSdResolver_Init(DnsSdResolver *resolver, int epollFd, int fd, DnsSdCache *cache)
+{
+    memset(resolver, 0, sizeof(*resolver));
+    resolver->fd = fd;
+
+    static const struct timespec timerWheelResolution = {0, 100 * 1000 * 1000};
+    if (TimerWheel_Init(&resolver->timerWheel, epollFd, &timerWheelResolution) != 0) {
+        return -1;
+    }
+
+    // A timeout may expire a little late, so that the timeouts of queries which were sent
+    // together share one wakeup.
+    static const struct timespec timeoutSlack = {0, 200 * 1000 * 1000};
+    for (size_t i = 0; i < DNS_SD_RESOLVER_MAX_QUERIES; i++) {
+        resolver->queries[i].resolver = resolver;
+        resolver->queries[i].timeoutTimer.eventData.eventHandler = &QueryTimeoutEventHandler;
+        TimerWheel_SetTimerSlack(&resolver->timerWheel, &resolver->queries[i].timeoutTimer,
+                                 &timeoutSlack);
+    }
+    // The cache is only set once the wheel has been created, so Close knows to close it.
+    resolver->cache = cache;
+    return 0;
+}
+
+int DnsSdResolver_Query(DnsSdResolver *resolver, DnsSdQueryType type, const char *name)
+{
+    DnsSdPendingQuery *query = NULL;
+    for (size_t i = 0; i < DNS_SD_RESOLVER_MAX_QUERIES; i++) {
+        DnsSdPendingQuery *candidate = &resolver->queries[i];
+        if (candidate->inUse && candidate->type == type &&
+            strcasecmp(candidate->name, name) == 0) {
+            return 0;
+        }
+        if (!candidate->inUse && query == NULL) {
+            query = candidate;
+        }
+    }
+    if (query == NULL || strlen(name) >= sizeof(query->name)) {
+        Log_Debug("ERROR: Could not send the DNS-SD query for %s.\n", name);
+        return -1;
+    }
+
+    query->inUse = true;
+    query->type = type;
+    strcpy(query->name, name);
+    query->retries = 0;
+    ++resolver->pendingCount;
+    if (SendPendingQuery(query) != 0) {
+        ReleaseQuery(query);
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Adds the records of one response to the cache, and stops waiting for the queries which it
+///     answers.
+/// </summary>
+static void ProcessResponse(DnsSdResolver *resolver, const uint8_t *response, size_t length,
+                            time_t now)
+{
+    ns_msg msg;
+    if (ns_initparse(response, (int)length, &msg) != 0) {
+        Log_Debug("ERROR: Could not parse the DNS response.\n");
+        return;
+    }
+    // The mDNS group also carries the queries of other hosts, which hold no records to cache.
+    if (!ns_msg_getflag(msg, ns_f_qr)) {
+        return;
+    }
+    if (DnsSdCache_AddResponse(resolver->cache, response, length, now) < 0) {
+        Log_Debug("ERROR: Could not parse the DNS response.\n");
+        return;
+    }
+
+    uint16_t id = ns_msg_id(msg);
+    if (id != 0) {
+        for (size_t i = 0; i < DNS_SD_RESOLVER_MAX_QUERIES; i++) {
+            if (resolver->queries[i].inUse && resolver->queries[i].id == id) {
+                ReleaseQuery(&resolver->queries[i]);
+                return;
+            }
+        }
+    }
+    ReleaseQueriesByName(resolver, &msg);
+}
+
+static int HandleResponsesFromSocket(DnsSdResolver *resolver, int fd, time_t now)
+{
+    int handled = 0;
+    // Stop after a few batches, so that a flood of responses does not hold up the other event
+    // handlers. The socket is still readable, so the rest are received at the next wakeup.
+    for (int batch = 0; batch < DNS_SD_RESOLVER_MAX_BATCHES; batch++) {
+        int received = ReceiveDnsResponses(fd, resolver->responses, resolver->responseLengths,
+                                           DNS_SD_RESOLVER_BATCH_SIZE);
+        if (received < 0) {
+            return (handled > 0) ? handled : -1;
+        }
+        for (int i = 0; i < received; i++) {
+            ProcessResponse(resolver, resolver->responses[i], resolver->responseLengths[i], now);
+        }
+        handled += received;
+        if (received < DNS_SD_RESOLVER_BATCH_SIZE) {
+            break;
+        }
+    }
+    return handled;
+}
+
+int DnsSdResolver_HandleResponses(DnsSdResolver *resolver, time_t now)
+{
+    return HandleResponsesFromSocket(resolver, resolver->fd, now);
+}
+
+int DnsSdResolver_HandleAnnouncements(DnsSdResolver *resolver, int fd, time_t now)
+{
+    return HandleResponsesFromSocket(resolver, fd, now);
+}
+
+size_t DnsSdResolver_GetPendingCount(const DnsSdResolver *resolver)
+{
+    return resolver->pendingCount;
+}
+
+void DnsSdResolver_Close(DnsSdResolver *resolver)
+{
+    if (resolver->cache != NULL) {
+        TimerWheel_Close(&resolver->timerWheel);
+    }
+    for (size_t i = 0; i < DNS_SD_RESOLVER_MAX_QUERIES; i++) {
+        resolver->queries[i].inUse = false;
+    }
+    resolver->pendingCount = 0;
+    resolver->cache = NULL;
+}
@@ -0,0 +1,127 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "dns-sd.h"
+#include "dns-sd-cache.h"
+#include "timer_wheel.h"
+
+/// <summary>Number of queries which can wait for their responses at once.</summary>
+#define DNS_SD_RESOLVER_MAX_QUERIES DNS_SD_CACHE_MAX_INSTANCES
+
+/// <summary>Number of times a query is sent again when it is not answered.</summary>
+#define DNS_SD_RESOLVER_MAX_RETRIES 2
+
+/// <summary>Number of responses which are received with one system call.</summary>
+#define DNS_SD_RESOLVER_BATCH_SIZE 8
+
+/// <summary>Most batches of responses which are received at one wakeup.</summary>
+#define DNS_SD_RESOLVER_MAX_BATCHES 4
+
+struct DnsSdResolver;
+
+/// <summary>
+///     A query which is waiting for its response.
+/// </summary>
+typedef struct {
+    /// <summary>Timer which expires when the query has waited too long. This is the first
+    /// member, so the timeout handler can find the query.</summary>
+    TimerWheelTimer timeoutTimer;
+    struct DnsSdResolver *resolver;
+    bool inUse;
+    /// <summary>The DNS message ID of the last query which was sent.</summary>
+    uint16_t id;
+    DnsSdQueryType type;
+    char name[DNS_SD_CACHE_NAME_SIZE];
+    /// <summary>Number of times the query has been sent again.</summary>
+    uint8_t retries;
+} DnsSdPendingQuery;
+
+/// <summary>
+/// <para>Sends DNS-SD queries over one UDP socket without waiting for each response before
+/// sending the next, so the details of all the instances which a browse finds are resolved
+/// in one round trip rather than one after another.</para>
+/// <para>Each query has its own timeout on a timer wheel, and is sent again up to
+/// DNS_SD_RESOLVER_MAX_RETRIES times, waiting twice as long each time, if it is not answered.
+/// Responses are matched to their queries by message ID. Multicast DNS responses have an ID of
+/// 0 (RFC 6762 section 18.1), so these are matched by the names of the records they hold
+/// instead. The records of every response are added to the cache.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="DnsSdResolver_Init" /> and disposes of it with
+/// <see cref="DnsSdResolver_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct DnsSdResolver {
+    TimerWheel timerWheel;
+    int fd;
+    DnsSdCache *cache;
+    DnsSdPendingQuery queries[DNS_SD_RESOLVER_MAX_QUERIES];
+    size_t pendingCount;
+    /// <summary>Number of queries which were not answered after all their retries.</summary>
+    uint32_t timedOutQueries;
+    /// <summary>Buffers which a batch of responses is received into, so that none is allocated
+    /// per response.</summary>
+    uint8_t responses[DNS_SD_RESOLVER_BATCH_SIZE][DNS_RESPONSE_BUF_SIZE];
+    size_t responseLengths[DNS_SD_RESOLVER_BATCH_SIZE];
+} DnsSdResolver;
+
+/// <summary>
+///     Creates the timer wheel of the query timeouts and adds it to an epoll instance.
+/// </summary>
+/// <param name="resolver">Resolver to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="fd">The UDP socket which the queries are sent on and the responses received
+/// from.</param>
+/// <param name="cache">The cache which the records of the responses are added to. This must
+/// remain valid until the resolver is closed.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int DnsSdResolver_Init(DnsSdResolver *resolver, int epollFd, int fd, DnsSdCache *cache);
+
+/// <summary>
+///     Sends a query, unless the same query is already waiting for its response.
+/// </summary>
+/// <param name="resolver">The resolver.</param>
+/// <param name="type">Whether to browse a service type or to resolve an instance.</param>
+/// <param name="name">The service type or the instance name.</param>
+/// <returns>0 on success, or -1 if the query could not be sent or too many are
+/// waiting</returns>
+int DnsSdResolver_Query(DnsSdResolver *resolver, DnsSdQueryType type, const char *name);
+
+/// <summary>
+///     Receives the pending responses in batches, adds their records to the cache, and stops
+///     waiting for the queries which they answer. Responses which cannot be parsed are skipped.
+/// </summary>
+/// <param name="resolver">The resolver.</param>
+/// <param name="now">The current time, in seconds of CLOCK_MONOTONIC.</param>
+/// <returns>The number of responses which were received, or -1 if they could not be
+/// received</returns>
+int DnsSdResolver_HandleResponses(DnsSdResolver *resolver, time_t now);
+
+/// <summary>
+///     Receives the unsolicited multicast DNS responses which are pending on a socket from
+///     <see cref="OpenMulticastDnsListener" />, such as announcements and goodbyes, and handles
+///     them as <see cref="DnsSdResolver_HandleResponses" /> does. The queries which other hosts
+///     multicast are skipped.
+/// </summary>
+/// <param name="resolver">The resolver.</param>
+/// <param name="fd">The socket which the multicast DNS messages are received from.</param>
+/// <param name="now">The current time, in seconds of CLOCK_MONOTONIC.</param>
+/// <returns>The number of messages which were received, or -1 if they could not be
+/// received</returns>
+int DnsSdResolver_HandleAnnouncements(DnsSdResolver *resolver, int fd, time_t now);
+
+/// <summary>
+///     Gets the number of queries which are waiting for their responses.
+/// </summary>
+size_t DnsSdResolver_GetPendingCount(const DnsSdResolver *resolver);
+
+/// <summary>
+///     Stops waiting for every query and closes the timer wheel. It is safe to call this
+///     function on a resolver which has been zero-initialized, or whose initialization failed.
+/// </summary>
+/// <param name="resolver">The resolver.</param>
+void DnsSdResolver_Close(DnsSdResolver *resolver);
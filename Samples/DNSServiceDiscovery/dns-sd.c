@@ -1,51 +1,109 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#define _GNU_SOURCE // required for recvmmsg
 #include "dns-sd.h"
+#include "memory_metrics.h"
 #include <applibs/log.h>
 #include <errno.h>
 #include <resolv.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 
 #define DNS_SERVER_PORT 53
+#define MDNS_PORT 5353
+#define MDNS_GROUP_ADDRESS "224.0.0.251"
 #define QUERY_BUF_SIZE 2048u
-#define ANSWER_BUF_SIZE 2048u
+#define ANSWER_BUF_SIZE DNS_RESPONSE_BUF_SIZE
 #define DISPLAY_BUF_SIZE 256u
 
-int SendDnsQuery(const char *dName, int class, int type, int fd)
+// Size of the DNS message header, which comes before the question.
+#define DNS_HEADER_SIZE 12u
+
+// A query is built once in this buffer: the header and the destination address are prepared on
+// first use, and each query only patches the message ID and writes its question. This avoids
+// calling res_init, which re-reads the resolver configuration, and res_mkquery for every query.
+static unsigned char queryBuf[QUERY_BUF_SIZE];
+static struct sockaddr_in queryAddress;
+static bool isQueryTemplateReady = false;
+
+// Message ID of the last query. The IDs of all the queries which the application sends come
+// from this one sequence, which starts at a random value, so that they are not predictable
+// from the start of the application, and a query of SendDnsQuery never has the ID of one of
+// the resolver.
+static uint16_t lastQueryId = 0;
+static bool isQueryIdSeeded = false;
+
+// Tag of the service instance details, which is added on their first allocation.
+static MemoryTag memoryTag = MemoryTag_Other;
+static bool isMemoryTagAdded = false;
+
+static MemoryTag GetMemoryTag(void)
+{
+    if (!isMemoryTagAdded) {
+        memoryTag = MemoryMetrics_AddTag("dns-sd");
+        isMemoryTagAdded = true;
+    }
+    return memoryTag;
+}
+
+/// <summary>
+/// Prepare the header of the query template: a standard query with recursion desired and one
+/// question, as res_mkquery builds it
+/// </summary>
+static void PrepareQueryTemplate(void)
+{
+    memset(queryBuf, 0, DNS_HEADER_SIZE);
+    queryBuf[2] = 0x01; // RD
+    ns_put16(1, queryBuf + 4); // QDCOUNT
+
+    memset(&queryAddress, 0, sizeof(queryAddress));
+    queryAddress.sin_family = AF_INET;
+    queryAddress.sin_port = htons(DNS_SERVER_PORT);
+    // NOTE: The Beta support for mDNS currently requires using the loopback IP address as follows.
+    // This will most likely be replaced in a future release, causing a breaking change for
+    // applications that rely on it.
+    queryAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    isQueryTemplateReady = true;
+}
+
+/// <summary>
+/// Construct and send a DNS query from the template, with the given message ID
+/// </summary>
+static int SendDnsQueryMessage(const char *dName, int class, int type, uint16_t id, int fd)
 {
-    char queryBuf[QUERY_BUF_SIZE];
     if (!dName) {
         Log_Debug("ERROR: Can't send DNS query as the domain name is null.\n");
         errno = EINVAL;
         return -1;
     }
-
-    // Construct the DNS query to send
-    int ret = res_init();
-    if (ret) {
-        Log_Debug("ERROR: res_init: %d (%s)\n", errno, strerror(errno));
-        return -1;
+    if (!isQueryTemplateReady) {
+        PrepareQueryTemplate();
     }
-    int messageSize =
-        res_mkquery(ns_o_query, dName, class, type, NULL, 0, NULL, queryBuf, QUERY_BUF_SIZE);
-    if (messageSize <= 0) {
-        Log_Debug("ERROR: res_mkquery: %d (%s)\n", errno, strerror(errno));
+
+    // Patch the ID, then write the question: the encoded name, its type and its class.
+    ns_put16(id, queryBuf);
+    unsigned char *question = queryBuf + DNS_HEADER_SIZE;
+    int nameSize = dn_comp(dName, question, (int)(sizeof(queryBuf) - DNS_HEADER_SIZE - 4u), NULL,
+                           NULL);
+    if (nameSize <= 0) {
+        Log_Debug("ERROR: Can't encode the domain name %s in a DNS query.\n", dName);
+        errno = EINVAL;
         return -1;
     }
+    ns_put16((unsigned int)type, question + nameSize);
+    ns_put16((unsigned int)class, question + nameSize + 2);
+    size_t messageSize = DNS_HEADER_SIZE + (size_t)nameSize + 4u;
 
     // Send the constructed DNS query
-    struct sockaddr_in si;
-    memset(&si, 0, sizeof(si));
-    si.sin_family = AF_INET;
-    si.sin_port = htons(DNS_SERVER_PORT);
-    // NOTE: The Beta support for mDNS currently requires using the loopback IP address as follows.
-    // This will most likely be replaced in a future release, causing a breaking change for
-    // applications that rely on it.
-    si.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    ret = sendto(fd, queryBuf, (size_t)messageSize, 0, (struct sockaddr *)&si, sizeof(si));
+    ssize_t ret = sendto(fd, queryBuf, messageSize, 0, (struct sockaddr *)&queryAddress,
+                         sizeof(queryAddress));
     if (ret == -1) {
         Log_Debug("ERROR: sendto: %d (%s)\n", errno, strerror(errno));
         return -1;
@@ -54,6 +112,37 @@ int SendDnsQuery(const char *dName, int class, int type, int fd)
     return 0;
 }
 
+uint16_t NextDnsQueryId(void)
+{
+    if (!isQueryIdSeeded) {
+        if (getrandom(&lastQueryId, sizeof(lastQueryId), GRND_NONBLOCK) !=
+            (ssize_t)sizeof(lastQueryId)) {
+            // Without entropy, the clock still differs from one start of the application to
+            // the next.
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            lastQueryId = (uint16_t)(now.tv_nsec ^ now.tv_sec);
+        }
+        isQueryIdSeeded = true;
+    }
+
+    // An ID of 0 is what multicast DNS responses carry, so it is never used for a query.
+    if (++lastQueryId == 0) {
+        lastQueryId = 1;
+    }
+    return lastQueryId;
+}
+
+int SendDnsQuery(const char *dName, int class, int type, int fd)
+{
+    return SendDnsQueryMessage(dName, class, type, NextDnsQueryId(), fd);
+}
+
+int SendDnsQueryWithId(const char *dName, int class, int type, uint16_t id, int fd)
+{
+    return SendDnsQueryMessage(dName, class, type, id, fd);
+}
+
 int SendServiceDiscoveryQuery(const char *dName, int fd)
 {
     return SendDnsQuery(dName, ns_c_in, ns_t_ptr, fd);
@@ -73,7 +162,7 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
 
     if (!(*instanceDetails)) {
         // Allocate for ServiceInstanceDetails and initialize its members.
-        *instanceDetails = malloc(sizeof(ServiceInstanceDetails));
+        *instanceDetails = MemoryMetrics_Malloc(GetMemoryTag(), sizeof(ServiceInstanceDetails));
         if (!(*instanceDetails)) {
             Log_Debug("ERROR: recvfrom: %d (%s)\n", errno, strerror(errno));
             return -1;
@@ -96,7 +185,7 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
             int compressedNameLength =
                 dn_expand(buf, buf + len, ns_rr_rdata(rr), displayBuf, sizeof(displayBuf));
             if (compressedNameLength > 0 && !(*instanceDetails)->name) {
-                (*instanceDetails)->name = strdup(displayBuf);
+                (*instanceDetails)->name = MemoryMetrics_Strdup(GetMemoryTag(), displayBuf);
                 if (!(*instanceDetails)->name) {
                     Log_Debug("ERROR: strdup for instance name failed: %d (%s)\n", errno,
                               strerror(errno));
@@ -117,7 +206,7 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
                 buf, buf + len, data + sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t),
                 displayBuf, sizeof(displayBuf));
             if (compressedTargetDomainNameLength > 0 && !(*instanceDetails)->host) {
-                (*instanceDetails)->host = strdup(displayBuf);
+                (*instanceDetails)->host = MemoryMetrics_Strdup(GetMemoryTag(), displayBuf);
                 if (!(*instanceDetails)->host) {
                     Log_Debug("ERROR: strdup: %d (%s)\n", errno, strerror(errno));
                     return -1;
@@ -128,7 +217,7 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
         case ns_t_txt: {
             // Populate name field in instance details if it hasn't been set
             if (!(*instanceDetails)->name) {
-                (*instanceDetails)->name = strdup(ns_rr_name(rr));
+                (*instanceDetails)->name = MemoryMetrics_Strdup(GetMemoryTag(), ns_rr_name(rr));
                 if (!(*instanceDetails)->name) {
                     Log_Debug("ERROR: strdup(ns_rr_name(rr)): %d (%s)\n", errno, strerror(errno));
                     return -1;
@@ -137,8 +226,8 @@ int ProcessMessageBySection(char *buf, ssize_t len, ns_msg msg, ns_sect section,
 
             // Get TXT record, populate txtData and txtDataLength fields in instance details
             if (!(*instanceDetails)->txtData) {
-                (*instanceDetails)->txtData =
-                    malloc(sizeof(unsigned char) * (size_t)(ns_rr_rdlen(rr)));
+                (*instanceDetails)->txtData = MemoryMetrics_Malloc(
+                    GetMemoryTag(), sizeof(unsigned char) * (size_t)(ns_rr_rdlen(rr)));
                 if (!(*instanceDetails)->txtData) {
                     Log_Debug("ERROR: malloc: %d (%s)\n", errno, strerror(errno));
                     return -1;
@@ -198,9 +287,94 @@ fail:
 void FreeServiceInstanceDetails(const ServiceInstanceDetails *details)
 {
     if (details) {
-        free(details->name);
-        free(details->host);
-        free(details->txtData);
-        free((void *)details);
+        MemoryMetrics_Free(details->name);
+        MemoryMetrics_Free(details->host);
+        MemoryMetrics_Free(details->txtData);
+        MemoryMetrics_Free((void *)details);
+    }
+}
+
+int OpenMulticastDnsListener(struct in_addr interfaceAddress)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_UDP);
+    if (fd == -1) {
+        Log_Debug("ERROR: Failed to create the mDNS socket: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    // Other processes may be listening on the mDNS port too.
+    int reuse = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) {
+        Log_Debug("ERROR: setsockopt(SO_REUSEADDR): %d (%s)\n", errno, strerror(errno));
+        goto fail;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(MDNS_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        Log_Debug("ERROR: Failed to bind the mDNS socket: %d (%s)\n", errno, strerror(errno));
+        goto fail;
+    }
+
+    struct ip_mreq membership;
+    membership.imr_multiaddr.s_addr = inet_addr(MDNS_GROUP_ADDRESS);
+    membership.imr_interface = interfaceAddress;
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) == -1) {
+        Log_Debug("ERROR: Failed to join the mDNS group: %d (%s)\n", errno, strerror(errno));
+        goto fail;
     }
-}
\ No newline at end of file
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+int ReceiveDnsResponses(int fd, uint8_t (*buffers)[DNS_RESPONSE_BUF_SIZE], size_t *lengths,
+                        size_t count)
+{
+#if defined(MSG_WAITFORONE)
+    // Receive as many of the pending datagrams as there are buffers with a single system call.
+    struct mmsghdr messages[DNS_MAX_RESPONSE_BATCH];
+    struct iovec iovecs[DNS_MAX_RESPONSE_BATCH];
+    if (count > DNS_MAX_RESPONSE_BATCH) {
+        count = DNS_MAX_RESPONSE_BATCH;
+    }
+    memset(messages, 0, sizeof(messages));
+    for (size_t i = 0; i < count; i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = DNS_RESPONSE_BUF_SIZE;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int received = recvmmsg(fd, messages, (unsigned int)count, MSG_DONTWAIT, NULL);
+    if (received == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        Log_Debug("ERROR: recvmmsg: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < received; i++) {
+        lengths[i] = messages[i].msg_len;
+    }
+    return received;
+#else
+    size_t received = 0;
+    while (received < count) {
+        ssize_t len = recv(fd, buffers[received], DNS_RESPONSE_BUF_SIZE, MSG_DONTWAIT);
+        if (len == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            Log_Debug("ERROR: recv: %d (%s)\n", errno, strerror(errno));
+            return (received > 0) ? (int)received : -1;
+        }
+        lengths[received++] = (size_t)len;
+    }
+    return (int)received;
+#endif
+}
@@ -4,8 +4,15 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <netinet/in.h>
 
+/// <summary>Size of the buffer which receives one DNS response.</summary>
+#define DNS_RESPONSE_BUF_SIZE 2048u
+
+/// <summary>Most DNS responses which are received at once.</summary>
+#define DNS_MAX_RESPONSE_BATCH 16u
+
 /// <summary>
 /// Data structure for a DNS instance details.
 /// This should be created with <see cref="ProcessServiceInstanceDetailsResponse"/> and freed with
@@ -54,4 +61,46 @@ int ProcessDnsResponse(int fd, ServiceInstanceDetails **instanceDetails);
 /// Free memory used by a ServiceInstanceDetails
 /// </summary>
 /// <param name="instance">The ServiceInstanceDetails struct to free</param>
-void FreeServiceInstanceDetails(const ServiceInstanceDetails *instance);
\ No newline at end of file
+void FreeServiceInstanceDetails(const ServiceInstanceDetails *instance);
+
+/// <summary>
+/// Get a message ID for a new query. The IDs start at a random value and are shared with the
+/// queries of SendDnsQuery, so that no two queries which are pending at once have the same ID.
+/// 0, which multicast DNS responses carry, is never returned.
+/// </summary>
+/// <returns>The message ID</returns>
+uint16_t NextDnsQueryId(void);
+
+/// <summary>
+/// Send a DNS query with a given message ID, so that its response can be matched to it
+/// </summary>
+/// <param name="dName">The domain name to query</param>
+/// <param name="class">The class of the query, such as ns_c_in</param>
+/// <param name="type">The type of the query, such as ns_t_ptr</param>
+/// <param name="id">The message ID</param>
+/// <param name="fd">The socket file descriptor to send the DNS query to</param>
+/// <returns>0 if succeeded, -1 if an error occurred.</returns>
+int SendDnsQueryWithId(const char *dName, int class, int type, uint16_t id, int fd);
+
+/// <summary>
+/// Open a socket which receives the multicast DNS messages that are sent to 224.0.0.251 port
+/// 5353, including the announcements and goodbyes which responders send when their services
+/// start, change or stop
+/// </summary>
+/// <param name="interfaceAddress">IPv4 address of the interface to receive the messages on</param>
+/// <returns>The non-blocking socket file descriptor, or -1 if an error occurred.</returns>
+int OpenMulticastDnsListener(struct in_addr interfaceAddress);
+
+/// <summary>
+/// Receive the DNS responses which are pending, without blocking or decoding them. recvmmsg is
+/// used where it is available, so a burst of responses is received with one system call.
+/// </summary>
+/// <param name="fd">The socket file descriptor to receive the DNS responses from</param>
+/// <param name="buffers">The buffers which receive one response each</param>
+/// <param name="lengths">Receives the length of each response</param>
+/// <param name="count">The number of buffers, of which at most DNS_MAX_RESPONSE_BATCH are
+/// used</param>
+/// <returns>The number of responses received, 0 if none was pending, or -1 if an error
+/// occurred.</returns>
+int ReceiveDnsResponses(int fd, uint8_t (*buffers)[DNS_RESPONSE_BUF_SIZE], size_t *lengths,
+                        size_t count);
\ No newline at end of file
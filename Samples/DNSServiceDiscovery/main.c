@@ -2,34 +2,62 @@
    Licensed under the MIT License. */
 
 // This sample C application shows how to perform a DNS service discovery. It makes queries using
-// multicast to local network and processes responses from the available DNS responders.
+// multicast to local network and processes responses from the available DNS responders. It also
+// listens for the announcements which the responders multicast when their services start or
+// stop, so that it only needs to query occasionally.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging)
 // - networking (get network interface connection status)
 
 #include "dns-sd.h"
+#include "dns-sd-resolver.h"
 #include "epoll_timerfd_utilities.h"
+#include "memory_metrics.h"
+#include "network_monitor.h"
 #include <applibs/log.h>
 #include <applibs/networking.h>
 #include <errno.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 // File descriptors - initialized to invalid value
 static int epollFd = -1;
-static int timerFd = -1;
 static int dnsSocketFd = -1;
-static bool isNetworkStackReady = false;
+static int refreshTimerFd = -1;
+static int browseTimerFd = -1;
+static int announcementSocketFd = -1;
+static bool isDnsSocketRegistered = false;
 
 // If using DNS in an internet-connected network, consider setting the desired status to be
 // Networking_InterfaceConnectionStatus_ConnectedToInternet instead.
 static const Networking_InterfaceConnectionStatus RequiredNetworkStatus =
     Networking_InterfaceConnectionStatus_IpAvailable;
 static const char NetworkInterface[] = "wlan0";
+
+// Detects when the interface has an address, checking quickly at first so that the discovery
+// starts soon after, and less often while nothing changes.
+static NetworkMonitor networkMonitor;
 static const char DnsServiceDiscoveryServer[] = "_sample-service._tcp.local";
 
+// The service instances which have been discovered, which are kept for the TTLs of their records.
+static DnsSdCache dnsSdCache;
+
+// Sends the queries without waiting for each response, and adds the responses to the cache.
+static DnsSdResolver dnsSdResolver;
+
+// The service type is browsed again at intervals which double from a second, as RFC 6762 section
+// 5.2 describes for continuous querying. While the announcements are received, the cache learns
+// of changes as they happen, so these queries only catch announcements which were missed and the
+// interval grows to an hour. Without them, it stops growing at a minute, so new instances are
+// still found soon after they start.
+static const time_t MinBrowseIntervalSeconds = 1;
+static const time_t MaxListeningBrowseIntervalSeconds = 60 * 60;
+static const time_t MaxQueryingBrowseIntervalSeconds = 60;
+static time_t browseIntervalSeconds = 1;
+
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
@@ -43,95 +71,220 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Handle DNS service discover response received event.
+///     Get the current time in seconds of CLOCK_MONOTONIC, which the cache uses for TTLs.
 /// </summary>
-/// <param name="eventData">Context data for handled event.</param>
-static void HandleReceivedDnsDiscoveryResponse(EventData *eventData)
+static time_t GetMonotonicSeconds(void)
 {
-    // Read received DNS response over socket.
-    // Process received response, if it contains PRT message, but no SRV or TXT message, send
-    // instance details request for each PTR instance. Otherwise, get the instance details.
-    ServiceInstanceDetails *details = NULL;
-    int result = ProcessDnsResponse(dnsSocketFd, &details);
-    if (result != 0) {
-        goto fail;
-    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
 
-    if (details && details->name) {
-        Log_Debug("INFO: DNS Service Discovery has found a instance: %s.\n", details->name);
-        if (!details->host) {
-            Log_Debug("INFO: Requesting SRV and TXT details for the instance.\n");
-            SendServiceInstanceDetailsQuery(details->name, dnsSocketFd);
+/// <summary>
+///     Send the queries which the cache asks for, then arm the refresh timer for the next
+///     refresh or expiry of a cached record.
+/// </summary>
+static void SendDueQueriesAndArmRefreshTimer(void)
+{
+    time_t now = GetMonotonicSeconds();
+    DnsSdQueryType type;
+    const char *name;
+    while (DnsSdCache_GetDueQuery(&dnsSdCache, now, &type, &name)) {
+        if (type == DnsSdQueryType_Service) {
+            Log_Debug("INFO: Refreshing the instances of %s.\n", name);
         } else {
-            // NOTE: The TXT data is simply treated as a string and isn't parsed here. You should
-            // replace this with your own production logic.
-            Log_Debug("\tName: %s\n\tHost: %s\n\tIPv4 Address: %s\n\tPort: %hd\n\tTXT Data: %.*s\n",
-                      details->name, details->host, inet_ntoa(details->ipv4Address), details->port,
-                      details->txtDataLength, details->txtData);
+            Log_Debug("INFO: Requesting SRV and TXT details for the instance %s.\n", name);
         }
+        // The queries for all the instances are sent at once, and resolved in parallel.
+        DnsSdResolver_Query(&dnsSdResolver, type, name);
     }
 
-fail:
-    FreeServiceInstanceDetails(details);
+    // A zero expiry disarms the timer while the cache is empty.
+    struct timespec expiry = {0, 0};
+    time_t next = DnsSdCache_GetNextEventTime(&dnsSdCache);
+    if (next != 0) {
+        expiry.tv_sec = (next > now) ? next - now : 1;
+    }
+    if (SetTimerFdToSingleExpiry(refreshTimerFd, &expiry) != 0) {
+        terminationRequired = true;
+    }
 }
 
-static EventData socketReceivedEventData = {.eventHandler = &HandleReceivedDnsDiscoveryResponse};
-
 /// <summary>
-///     Check whether the required network connection status has been met.
+///     Add the pending responses to the cache and show the instances which are new.
 /// </summary>
-/// <param name="interface">The network interface to perform the check on.</param>
-/// <param name="ipAddressAvailable">The result of the connection status check.</param>
-/// <returns>0 on success, or -1 on failure.</returns>
-int IsConnectionReady(const char *interface, bool *ipAddressAvailable)
+/// <param name="fromAnnouncementSocket">Whether to receive the unsolicited announcements, rather
+/// than the responses to the queries.</param>
+static void HandleReceivedDnsResponses(bool fromAnnouncementSocket)
 {
-    Networking_InterfaceConnectionStatus status;
-    if (Networking_GetInterfaceConnectionStatus(interface, &status) == 0) {
-        Log_Debug("INFO: Network interface %s status: 0x%02x\n", interface, status);
-        isNetworkStackReady = true;
+    // Remember which instances were already complete, so that only new ones are shown.
+    bool wasComplete[DNS_SD_CACHE_MAX_INSTANCES];
+    time_t now = GetMonotonicSeconds();
+    for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+        wasComplete[i] = DnsSdCache_GetInstance(&dnsSdCache, i, now) != NULL;
+    }
+
+    // Read all the DNS responses which are waiting on the socket and cache the records they hold.
+    // The cache then asks for the details of each PTR instance which came without its SRV and TXT
+    // records.
+    int handled;
+    if (fromAnnouncementSocket) {
+        handled = DnsSdResolver_HandleAnnouncements(&dnsSdResolver, announcementSocketFd, now);
     } else {
-        if (errno == EAGAIN) {
-            Log_Debug("INFO: The networking stack isn't ready yet, will try again later.\n");
-            return 0;
-        } else {
-            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus: %d (%s)\n", errno,
-                      strerror(errno));
-            return -1;
+        handled = DnsSdResolver_HandleResponses(&dnsSdResolver, now);
+    }
+    if (handled <= 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < DNS_SD_CACHE_MAX_INSTANCES; i++) {
+        const DnsSdCacheEntry *details = DnsSdCache_GetInstance(&dnsSdCache, i, now);
+        if (details == NULL || wasComplete[i]) {
+            continue;
         }
+        // NOTE: The TXT data is simply treated as a string and isn't parsed here. You should
+        // replace this with your own production logic.
+        Log_Debug("INFO: DNS Service Discovery has found a instance: %s.\n", details->name);
+        Log_Debug("\tName: %s\n\tHost: %s\n\tIPv4 Address: %s\n\tPort: %hd\n\tTXT Data: %.*s\n",
+                  details->name, details->host, inet_ntoa(details->ipv4Address), details->port,
+                  details->txtDataLength, details->txtData);
     }
-    *ipAddressAvailable = (status & RequiredNetworkStatus) != 0;
-    return 0;
+
+    SendDueQueriesAndArmRefreshTimer();
+}
+
+/// <summary>
+///     Handle DNS service discover response received event.
+/// </summary>
+/// <param name="eventData">Context data for handled event.</param>
+static void HandleReceivedDnsDiscoveryResponse(EventData *eventData)
+{
+    HandleReceivedDnsResponses(false);
+}
+
+static EventData socketReceivedEventData = {.eventHandler = &HandleReceivedDnsDiscoveryResponse};
+
+/// <summary>
+///     Handle the multicast DNS messages which are received without being asked for.
+/// </summary>
+/// <param name="eventData">Context data for handled event.</param>
+static void HandleReceivedAnnouncement(EventData *eventData)
+{
+    HandleReceivedDnsResponses(true);
+}
+
+static EventData announcementReceivedEventData = {.eventHandler = &HandleReceivedAnnouncement};
+
+/// <summary>
+///     The timer event handler to refresh the cached records before they expire.
+/// </summary>
+static void RefreshTimerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(refreshTimerFd) != 0) {
+        terminationRequired = true;
+        return;
+    }
+    SendDueQueriesAndArmRefreshTimer();
 }
 
+static EventData refreshTimerEventData = {.eventHandler = &RefreshTimerEventHandler};
+
 /// <summary>
-///     The timer event handler to check whether network connection is ready.
+///     Browse the service type, and arm the browse timer for the next browse.
 /// </summary>
-static void ConnectionTimerEventHandler(EventData *eventData)
+static void BrowseAndArmBrowseTimer(void)
 {
-    if (ConsumeTimerFdEvent(timerFd) != 0) {
+    DnsSdResolver_Query(&dnsSdResolver, DnsSdQueryType_Service, DnsServiceDiscoveryServer);
+
+    struct timespec expiry = {browseIntervalSeconds, 0};
+    if (SetTimerFdToSingleExpiry(browseTimerFd, &expiry) != 0) {
         terminationRequired = true;
         return;
     }
+    time_t maxInterval = (announcementSocketFd >= 0) ? MaxListeningBrowseIntervalSeconds
+                                                     : MaxQueryingBrowseIntervalSeconds;
+    browseIntervalSeconds =
+        (browseIntervalSeconds * 2 < maxInterval) ? browseIntervalSeconds * 2 : maxInterval;
+}
 
-    // Check whether the network connection is ready.
-    bool isConnectionReady = false;
-    if (IsConnectionReady(NetworkInterface, &isConnectionReady) != 0) {
+/// <summary>
+///     The timer event handler to browse the service type again.
+/// </summary>
+static void BrowseTimerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(browseTimerFd) != 0) {
         terminationRequired = true;
-    } else if (isConnectionReady) {
-        // Connection is ready, unregister the connection event handler. Register DNS response
-        // handler, then start DNS service discovery.
-        if (UnregisterEventHandlerFromEpoll(epollFd, timerFd) != 0 ||
-            RegisterEventHandlerToEpoll(epollFd, dnsSocketFd, &socketReceivedEventData, EPOLLIN) !=
-                0) {
+        return;
+    }
+    BrowseAndArmBrowseTimer();
+}
+
+static EventData browseTimerEventData = {.eventHandler = &BrowseTimerEventHandler};
+
+/// <summary>
+///     Stop listening for announcements, such as when the address of the interface changes.
+/// </summary>
+static void CloseAnnouncementSocket(void)
+{
+    if (announcementSocketFd >= 0) {
+        UnregisterPersistentEventHandlerFromEpoll(epollFd, &announcementReceivedEventData);
+        CloseFdAndPrintError(announcementSocketFd, "Announcement Socket");
+        announcementSocketFd = -1;
+    }
+}
+
+/// <summary>
+///     Listen for the announcements which are multicast on the interface with the given address.
+///     If this is not possible, the discovery relies on the queries alone.
+/// </summary>
+static void OpenAnnouncementSocket(struct in_addr address)
+{
+    CloseAnnouncementSocket();
+    announcementSocketFd = OpenMulticastDnsListener(address);
+    if (announcementSocketFd >= 0 &&
+        RegisterEventHandlerToEpoll(epollFd, announcementSocketFd, &announcementReceivedEventData,
+                                    EPOLLIN) != 0) {
+        CloseAnnouncementSocket();
+    }
+    if (announcementSocketFd < 0) {
+        Log_Debug("INFO: Not listening for mDNS announcements; instances are found by queries.\n");
+    }
+}
+
+/// <summary>
+///     Called when the state of the network interface changes.
+/// </summary>
+static void NetworkStateHandler(NetworkMonitor *monitor, uint32_t events,
+                                const NetworkMonitorState *state, void *context)
+{
+    // Start the discovery once the connection is ready, and again whenever the connection or
+    // the address has changed, because the instances may be on a different network. Register
+    // the DNS response handler first. Stop listening and browsing while it is not ready.
+    uint32_t startEvents = NetworkMonitorEvent_Up | NetworkMonitorEvent_AddressChanged;
+    if (!state->isReady) {
+        CloseAnnouncementSocket();
+        struct timespec disarmed = {0, 0};
+        if (SetTimerFdToSingleExpiry(browseTimerFd, &disarmed) != 0) {
+            terminationRequired = true;
+        }
+        return;
+    }
+    if ((events & startEvents) == 0) {
+        return;
+    }
+    if (!isDnsSocketRegistered) {
+        if (RegisterEventHandlerToEpoll(epollFd, dnsSocketFd, &socketReceivedEventData, EPOLLIN) !=
+            0) {
             terminationRequired = true;
             return;
         }
-        SendServiceDiscoveryQuery(DnsServiceDiscoveryServer, dnsSocketFd);
+        isDnsSocketRegistered = true;
     }
+    OpenAnnouncementSocket(state->address);
+    browseIntervalSeconds = MinBrowseIntervalSeconds;
+    BrowseAndArmBrowseTimer();
 }
 
-static EventData timerEventData = {.eventHandler = &ConnectionTimerEventHandler};
-
 /// <summary>
 ///     Set up SIGTERM termination handler and event handlers.
 /// </summary>
@@ -149,16 +302,39 @@ static int InitializeAndStartDnsServiceDiscovery(void)
         return -1;
     }
 
-    dnsSocketFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    dnsSocketFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_UDP);
     if (dnsSocketFd < 0) {
         Log_Debug("ERROR: Failed to create dnsSocketFd: %d (%s)\n", errno, strerror(errno));
         return -1;
     }
 
-    // Check network interface status at the specified period until it is ready.
-    struct timespec checkInterval = {1, 0};
-    timerFd = CreateTimerFdAndAddToEpoll(epollFd, &checkInterval, &timerEventData, EPOLLIN);
-    if (timerFd < 0) {
+    // Start the discovery as soon as the network connection is ready.
+    const NetworkMonitorConfig networkMonitorConfig = {.interfaceName = NetworkInterface,
+                                                       .requiredStatus = RequiredNetworkStatus,
+                                                       .minInterval = {0, 100 * 1000 * 1000},
+                                                       .waitingInterval = {2, 0},
+                                                       .readyInterval = {30, 0}};
+    if (NetworkMonitor_Init(&networkMonitor, epollFd, &networkMonitorConfig) != 0 ||
+        NetworkMonitor_AddHandler(&networkMonitor, &NetworkStateHandler, NULL) != 0) {
+        return -1;
+    }
+
+    // The refresh timer is armed once the first response has been cached, and the browse timer
+    // once the network is ready. Only the records of the browsed service type are cached, as
+    // the announcements of every service on the network are received.
+    DnsSdCache_Init(&dnsSdCache);
+    if (DnsSdCache_SetServiceType(&dnsSdCache, DnsServiceDiscoveryServer) != 0 ||
+        DnsSdResolver_Init(&dnsSdResolver, epollFd, dnsSocketFd, &dnsSdCache) != 0) {
+        return -1;
+    }
+    struct timespec disarmed = {0, 0};
+    refreshTimerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &refreshTimerEventData, EPOLLIN);
+    if (refreshTimerFd < 0) {
+        return -1;
+    }
+    browseTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &browseTimerEventData, EPOLLIN);
+    if (browseTimerFd < 0) {
         return -1;
     }
     return 0;
@@ -170,13 +346,19 @@ static int InitializeAndStartDnsServiceDiscovery(void)
 static void Cleanup(void)
 {
     Log_Debug("INFO: Closing file descriptors\n");
+    DnsSdResolver_Close(&dnsSdResolver);
     CloseFdAndPrintError(epollFd, "Epoll");
-    CloseFdAndPrintError(timerFd, "Timer");
+    NetworkMonitor_Close(&networkMonitor);
+    CloseFdAndPrintError(refreshTimerFd, "Refresh Timer");
+    CloseFdAndPrintError(browseTimerFd, "Browse Timer");
+    CloseFdAndPrintError(announcementSocketFd, "Announcement Socket");
     CloseFdAndPrintError(dnsSocketFd, "DNS Socket");
 }
 
 int main(void)
 {
+    MemoryMetrics_PaintStack(16 * 1024);
+
     Log_Debug("INFO: DNS Service Discovery sample starting.\n");
     if (InitializeAndStartDnsServiceDiscovery() != 0) {
         terminationRequired = true;
@@ -190,6 +372,11 @@ int main(void)
     }
 
     Cleanup();
+
+    MemoryMetrics memoryMetrics;
+    MemoryMetrics_GetSnapshot(&memoryMetrics);
+    MemoryMetrics_Log(&memoryMetrics);
+
     Log_Debug("INFO: Application exiting.\n");
     return 0;
 }
\ No newline at end of file
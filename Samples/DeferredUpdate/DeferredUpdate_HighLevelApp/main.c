@@ -5,7 +5,9 @@
 // notifications for a pending application update, and then deferring that update.
 // On the MT3620 RDB,
 // LED 2 is green when the update should be deferred, and yellow when it should be applied.
-// Press button A to toggle between these modes.
+// Press button A to toggle between these modes. While updates are deferred, the update policy
+// works out how long for: while the application is busy, and otherwise until its maintenance
+// window. Press button B to start or stop a simulated HTTP transfer, which keeps it busy.
 // LED 3 is lit up blue when an OTA update is available.
 //
 // It uses the API for the following Azure Sphere application libraries:
@@ -41,7 +43,15 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+// Fail the build if the hardware definition maps two of the peripherals which this sample
+// uses to the same pins. See mt3620_pin_check.h.
+#include <hw/mt3620_pin_check.h>
+MT3620_CHECK_GPIOS_DISTINCT(SAMPLE_BUTTON_1, SAMPLE_BUTTON_2, SAMPLE_RGBLED_RED,
+                            SAMPLE_RGBLED_GREEN, SAMPLE_RGBLED_BLUE, SAMPLE_PENDING_UPDATE_LED);
+
 #include "epoll_timerfd_utilities.h"
+#include "input_manager.h"
+#include "update_policy.h"
 
 static volatile sig_atomic_t terminationRequired = false;
 
@@ -53,13 +63,19 @@ static int acceptLedGreenFd = -1;
 static int acceptLedBlueFd = -1;
 
 // Press the button to toggle between accept or defer updates.
-static int timerFd = -1;
+static InputManager inputManager;
 static int buttonFd = -1;
 static bool acceptUpdate = false;
 
+// Press button B to start or stop a simulated transfer, which the update policy waits for.
+static int transferButtonFd = -1;
+static bool transferActive = false;
+
 static void UpdateAcceptModeLed(void);
 static void SwitchOffAcceptModeLed(void);
-static void ButtonTimerEventHandler(EventData *eventData);
+static void ButtonChangedHandler(InputManagerInput *input, bool isPressed);
+static void TransferButtonChangedHandler(InputManagerInput *input, bool isPressed);
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error);
 
 // The pending update LED lights up the application is notified of a pending update.
 static int pendingUpdateLedFd = -1;
@@ -72,6 +88,19 @@ static EventLoop *eventLoop = NULL;
 static EventRegistration *updateEventReg = NULL;
 static int eventLoopFd = -1;
 static bool pendingUpdate = false;
+static uint32_t maxDeferralMinutes = 0;
+
+// Works out how long to defer an update for. Updates are deferred by a minute at a time while
+// a transfer is active, or while more than 10 telemetry messages are waiting, and are otherwise
+// deferred until 02:00 to 04:00 UTC.
+static UpdatePolicy updatePolicy;
+static const UpdatePolicyConfig updatePolicyConfig = {
+    .busyDeferralMinutes = 1,
+    .idleThresholds = {[UpdatePolicyLoad_TelemetryBacklog] = 10},
+    .maintenanceWindowStart = 2 * 60,
+    .maintenanceWindowEnd = 4 * 60};
+
+static void ResumeUpdateIfAllowed(void);
 
 static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const SysEvent_Info *info,
                            void *context);
@@ -139,44 +168,71 @@ static void SwitchOffAcceptModeLed(void)
 }
 
 /// <summary>
-///     Handle button timer event by toggling the accept mode.
+///     Handle the button changing state by toggling the accept mode.
 /// </summary>
-/// <param name="eventData">EPOLL utilities cookie. Not used.</param>
-static void ButtonTimerEventHandler(EventData *eventData)
+/// <param name="input">The button. Not used.</param>
+/// <param name="isPressed">Whether the button has been pressed or released.</param>
+static void ButtonChangedHandler(InputManagerInput *input, bool isPressed)
 {
-    if (ConsumeTimerFdEvent(timerFd) != 0) {
-        terminationRequired = true;
+    if (!isPressed) {
         return;
     }
 
-    static GPIO_Value_Type buttonState = GPIO_Value_High;
+    // The button has just been pressed, so change update mode from
+    // updates accepted to updates deferred or vice-versa.
+    acceptUpdate = !acceptUpdate;
+    UpdateAcceptModeLed();
 
-    GPIO_Value_Type newButtonState;
-    int result = GPIO_GetValue(buttonFd, &newButtonState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        terminationRequired = true;
+    // If user has accepted updates and there is already a pending update then
+    // apply it immediately. An update which arrives later is allowed by UpdateCallback.
+    ResumeUpdateIfAllowed();
+}
+
+/// <summary>
+///     Handle button B changing state by starting or stopping the simulated transfer. An
+///     application reports its real load in the same way, for example when a transfer
+///     completes.
+/// </summary>
+/// <param name="input">The button. Not used.</param>
+/// <param name="isPressed">Whether the button has been pressed or released.</param>
+static void TransferButtonChangedHandler(InputManagerInput *input, bool isPressed)
+{
+    if (!isPressed) {
         return;
     }
 
-    // If the button has just been pressed, then change update mode from
-    // updates accepted to updates deferred or vice-versa.
-    if (newButtonState != buttonState) {
-        if (newButtonState == GPIO_Value_Low) {
-            acceptUpdate = !acceptUpdate;
-            UpdateAcceptModeLed();
-        }
+    transferActive = !transferActive;
+    Log_Debug("INFO: Simulated transfer %s.\n", transferActive ? "started" : "stopped");
+    UpdatePolicy_SetLoad(&updatePolicy, UpdatePolicyLoad_HttpTransfers, transferActive ? 1 : 0);
 
-        buttonState = newButtonState;
-    }
+    // The application may have just become idle, so apply a deferred update now if it may be.
+    ResumeUpdateIfAllowed();
+}
 
-    // If user has accepted updates and there is already a pending update then]
-    // apply it immediately.
-    if (acceptUpdate && pendingUpdate) {
+/// <summary>
+///     If an update is pending, and the user has accepted updates or the update policy no
+///     longer defers it, apply it now rather than when its deferral ends.
+/// </summary>
+static void ResumeUpdateIfAllowed(void)
+{
+    if (!pendingUpdate) {
+        return;
+    }
+    if (acceptUpdate ||
+        UpdatePolicy_GetDeferralMinutes(&updatePolicy, maxDeferralMinutes, time(NULL)) == 0) {
+        Log_Debug("INFO: Applying the deferred update.\n");
         SysEvent_ResumeEvent(SysEvent_Events_Update);
     }
 }
 
+/// <summary>
+///     The input manager could not read the button, so exit.
+/// </summary>
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error)
+{
+    terminationRequired = true;
+}
+
 /// <summary>
 ///     Update the pending LED. If an update is available, the LED is switched
 ///     on. Otherwise, it is swtiched off.
@@ -247,15 +303,22 @@ static void UpdateCallback(SysEvent_Events event, SysEvent_Status status, const
     Log_Debug("INFO: Update Type: %s (%u).\n", UpdateTypeToString(data.update_type),
               data.update_type);
 
+    uint32_t deferralMinutes = 0;
     switch (status) {
-        // If an update is pending, and the user has not allowed updates, then defer the update.
+        // If an update is pending, and the user has not allowed updates, then defer the update
+        // for as long as the update policy says.
     case SysEvent_Status_Pending:
         pendingUpdate = true;
-        if (acceptUpdate) {
+        maxDeferralMinutes = data.max_deferral_time_in_minutes;
+        if (!acceptUpdate) {
+            deferralMinutes =
+                UpdatePolicy_GetDeferralMinutes(&updatePolicy, maxDeferralMinutes, t);
+        }
+        if (deferralMinutes == 0) {
             Log_Debug("INFO: Allowing update.\n");
         } else {
-            Log_Debug("INFO: Deferring update for 1 minute.\n");
-            result = SysEvent_DeferEvent(SysEvent_Events_Update, 1);
+            Log_Debug("INFO: Deferring update for %u minutes.\n", deferralMinutes);
+            result = SysEvent_DeferEvent(SysEvent_Events_Update, deferralMinutes);
         }
 
         if (result == -1) {
@@ -438,7 +501,8 @@ static int InitPeripheralsAndHandlers(void)
 
     UpdatePendingStatusLed();
 
-    // Open button and timer to check for button press.
+    // Open button, and sample it to check for button presses. The application only needs to
+    // respond to the button slowly, so sample it every 100ms and report each change at once.
     buttonFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (buttonFd < 0) {
         Log_Debug("ERROR: Could not open sample button 1: %s (%d).\n", strerror(errno), errno);
@@ -446,8 +510,27 @@ static int InitPeripheralsAndHandlers(void)
     }
 
     static const struct timespec buttonCheckInterval = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
-    static struct EventData buttonEventData = {.eventHandler = ButtonTimerEventHandler};
-    timerFd = CreateTimerFdAndAddToEpoll(epollFd, &buttonCheckInterval, &buttonEventData, EPOLLIN);
+    if (InputManager_Init(&inputManager, epollFd, &buttonCheckInterval, 1,
+                          &ButtonReadErrorHandler) != 0) {
+        return -1;
+    }
+    // The button reads low when it is pressed.
+    static InputManagerInput button = {.activeValue = GPIO_Value_Low,
+                                       .changedHandler = &ButtonChangedHandler};
+    button.gpioFd = buttonFd;
+    InputManager_AddInput(&inputManager, &button);
+
+    transferButtonFd = GPIO_OpenAsInput(SAMPLE_BUTTON_2);
+    if (transferButtonFd < 0) {
+        Log_Debug("ERROR: Could not open sample button 2: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    static InputManagerInput transferButton = {.activeValue = GPIO_Value_Low,
+                                               .changedHandler = &TransferButtonChangedHandler};
+    transferButton.gpioFd = transferButtonFd;
+    InputManager_AddInput(&inputManager, &transferButton);
+
+    UpdatePolicy_Init(&updatePolicy, &updatePolicyConfig);
 
     if (SetUpSysEventHandler() == -1) {
         return -1;
@@ -469,7 +552,8 @@ static void ClosePeripheralsAndHandlers(void)
     CloseFdAndPrintError(pendingUpdateLedFd, "pendingUpdateLedFd");
 
     CloseFdAndPrintError(buttonFd, "buttonFd");
-    CloseFdAndPrintError(timerFd, "timerFd");
+    CloseFdAndPrintError(transferButtonFd, "transferButtonFd");
+    InputManager_Close(&inputManager);
 
     CloseFdAndPrintError(acceptLedRedFd, "acceptLedRedFd");
     CloseFdAndPrintError(acceptLedGreenFd, "acceptLedGreenFd");
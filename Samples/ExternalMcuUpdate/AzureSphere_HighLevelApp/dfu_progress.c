@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "dfu_progress.h"
+#include "nordic/crc.h"
+
+// Identifies a saved progress record, and its layout.
+static const uint32_t DFU_PROGRESS_MAGIC = 0x31504644; // "DFP1"
+
+// Layout of each slot in the mutable file.  The checksum covers the
+// magic value and the progress, so a torn write is not mistaken for
+// valid progress.
+typedef struct {
+    uint32_t magic;
+    DfuProgress progress;
+    uint32_t checksum;
+} DfuProgressRecord;
+
+static uint32_t RecordChecksum(const DfuProgressRecord *record)
+{
+    return CalcCrc32((const uint8_t *)record, offsetof(DfuProgressRecord, checksum));
+}
+
+// Number of records which have been written, in any slot.
+static uint32_t writeCount = 0;
+
+static off_t SlotOffset(size_t slot)
+{
+    return (off_t)(slot * sizeof(DfuProgressRecord));
+}
+
+// Writes a whole record to the supplied slot.
+static bool WriteRecord(size_t slot, const DfuProgressRecord *record)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        Log_Debug("ERROR: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    ssize_t ret = pwrite(fd, record, sizeof(*record), SlotOffset(slot));
+    if (ret < 0) {
+        Log_Debug("ERROR: Could not write DFU progress: %s (%d).\n", strerror(errno), errno);
+    } else if ((size_t)ret < sizeof(*record)) {
+        Log_Debug("ERROR: Only wrote %zd of %zu bytes of DFU progress.\n", ret, sizeof(*record));
+    }
+
+    close(fd);
+    if (ret != (ssize_t)sizeof(*record)) {
+        return false;
+    }
+    ++writeCount;
+    return true;
+}
+
+bool LoadDfuProgress(size_t slot, DfuProgress *progress)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        Log_Debug("ERROR: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+        return false;
+    }
+
+    DfuProgressRecord record;
+    ssize_t ret = pread(fd, &record, sizeof(record), SlotOffset(slot));
+    if (ret < 0) {
+        Log_Debug("ERROR: Could not read DFU progress: %s (%d).\n", strerror(errno), errno);
+    }
+    close(fd);
+
+    // A short read means that no progress has been saved in this slot.
+    if (ret < (ssize_t)sizeof(record) || record.magic != DFU_PROGRESS_MAGIC ||
+        record.checksum != RecordChecksum(&record)) {
+        return false;
+    }
+
+    *progress = record.progress;
+    return true;
+}
+
+bool SaveDfuProgress(size_t slot, const DfuProgress *progress)
+{
+    DfuProgressRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = DFU_PROGRESS_MAGIC;
+    record.progress = *progress;
+    record.checksum = RecordChecksum(&record);
+
+    return WriteRecord(slot, &record);
+}
+
+uint32_t GetDfuProgressWriteCount(void)
+{
+    return writeCount;
+}
+
+void ClearDfuProgress(size_t slot)
+{
+    DfuProgressRecord record;
+    memset(&record, 0, sizeof(record));
+
+    WriteRecord(slot, &record);
+}
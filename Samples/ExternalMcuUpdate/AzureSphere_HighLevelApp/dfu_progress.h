@@ -0,0 +1,60 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+/// Progress of an interrupted image transfer.  This is saved to mutable storage
+/// each time an object has been executed by the attached board, so the transfer
+/// can be resumed from that point after a restart.
+/// </summary>
+typedef struct {
+    /// <summary>Index of the image in the array which was passed to ProgramImages.</summary>
+    uint32_t imageIndex;
+
+    /// <summary>Version of the image which was being written.</summary>
+    uint32_t imageVersion;
+
+    /// <summary>Number of firmware bytes which the attached board has executed.</summary>
+    uint32_t fileOffset;
+
+    /// <summary>CRC-32 of the firmware bytes which the attached board has executed.</summary>
+    uint32_t crc32;
+} DfuProgress;
+
+/// <summary>
+/// Reads saved progress from mutable storage.
+/// <param name="slot">Identifies the attached board.  Each board which is updated
+/// uses a different slot.</param>
+/// <param name="progress">On success, receives the saved progress.</param>
+/// <returns>true if valid progress was read; false if none was saved, or if the
+/// saved data is corrupt.</returns>
+/// </summary>
+bool LoadDfuProgress(size_t slot, DfuProgress *progress);
+
+/// <summary>
+/// Writes progress to mutable storage, replacing any progress which was previously
+/// saved in the same slot.
+/// <param name="slot">Identifies the attached board.</param>
+/// <param name="progress">Progress to save.</param>
+/// <returns>true on success; false otherwise.</returns>
+/// </summary>
+bool SaveDfuProgress(size_t slot, const DfuProgress *progress);
+
+/// <summary>
+/// Counts the progress which has been saved or cleared, so that a caller can wait for the
+/// next checkpoint.
+/// <returns>The number of records which have been written since the application
+/// started.</returns>
+/// </summary>
+uint32_t GetDfuProgressWriteCount(void);
+
+/// <summary>
+/// Invalidates any progress which was saved in the supplied slot.
+/// <param name="slot">Identifies the attached board.</param>
+/// </summary>
+void ClearDfuProgress(size_t slot);
@@ -6,12 +6,14 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 
 #include <applibs/log.h>
 #include <applibs/storage.h>
 
 #include "file_view.h"
+#include "storage_metrics.h"
 
 // Call FileViewMoveWindow before attempting to read data from the window.
 // This special value means that the file view does not contain valid data.
@@ -27,16 +29,17 @@ FileView *OpenFileView(const char *path, size_t windowSize)
     // Initialize owned resources so they can be cleaned
     // up safely if only some of them are initialized.
     self->fd = -1;
+    self->mapping = NULL;
     self->fileOffset = NO_VALID_WINDOW;
     self->window = NULL;
+    self->buffer = NULL;
+    self->nextFileOffset = NO_VALID_WINDOW;
+    self->nextWindow = NULL;
+    self->stream = NULL;
 
     self->windowSize = windowSize;
-    self->window = malloc(windowSize);
-    if (!self->window) {
-        goto failed;
-    }
 
-    self->fd = Storage_OpenFileInImagePackage(path);
+    self->fd = StorageMetrics_OpenFileInImagePackage(path);
     if (self->fd == -1) {
         goto failed;
     }
@@ -46,6 +49,29 @@ FileView *OpenFileView(const char *path, size_t windowSize)
         goto failed;
     }
 
+    // Map the file so the window can point directly into it. This avoids copying
+    // the file contents into a separate buffer.
+    if (self->fileSize > 0) {
+        void *mapping = mmap(NULL, (size_t)self->fileSize, PROT_READ, MAP_PRIVATE, self->fd, 0);
+        if (mapping != MAP_FAILED) {
+            self->mapping = mapping;
+            return self;
+        }
+
+        Log_Debug("INFO: Could not map %s (errno=%d); reading it into a buffer instead.\n", path,
+                  errno);
+    }
+
+    self->buffer = malloc(windowSize);
+    if (!self->buffer) {
+        goto failed;
+    }
+
+    self->nextWindow = malloc(windowSize);
+    if (!self->nextWindow) {
+        goto failed;
+    }
+
     return self;
 
 failed:
@@ -53,21 +79,59 @@ failed:
     return NULL;
 }
 
+FileView *OpenStreamFileView(ImageStream *stream, size_t windowSize)
+{
+    off_t fileSize;
+    if (ImageStreamGetSize(stream, &fileSize) == -1) {
+        return NULL;
+    }
+
+    FileView *self = malloc(sizeof(*self));
+    if (!self) {
+        return NULL;
+    }
+
+    self->fd = -1;
+    self->mapping = NULL;
+    self->fileOffset = NO_VALID_WINDOW;
+    self->window = NULL;
+    self->nextFileOffset = NO_VALID_WINDOW;
+    self->nextWindow = NULL;
+    self->stream = stream;
+    self->windowSize = windowSize;
+    self->fileSize = fileSize;
+
+    self->buffer = malloc(windowSize);
+    if (!self->buffer) {
+        CloseFileView(self);
+        return NULL;
+    }
+
+    return self;
+}
+
 void CloseFileView(FileView *self)
 {
     if (!self) {
         return;
     }
 
+    if (self->mapping) {
+        munmap((void *)self->mapping, (size_t)self->fileSize);
+    }
+
     if (self->fd != -1) {
         close(self->fd);
     }
 
-    free(self->window);
+    free(self->buffer);
+    free(self->nextWindow);
     free(self);
 }
 
-bool FileViewMoveWindow(FileView *self, off_t offset)
+// Reads data from the supplied offset into buf, up to the end of the
+// window size or up to the end of the file, whichever is sooner.
+static bool ReadWindowFromFile(FileView *self, off_t offset, uint8_t *buf)
 {
     if (lseek(self->fd, offset, SEEK_SET) == -1) {
         Log_Debug("ERROR:%s: could not seek to %lld (errno=%d)\n", __func__, offset, errno);
@@ -84,7 +148,8 @@ bool FileViewMoveWindow(FileView *self, off_t offset)
     off_t bytesSoFar = 0;
     while (bytesSoFar < bytesToRead) {
         off_t remainBytes = bytesToRead - bytesSoFar;
-        int b = read(self->fd, &self->window[bytesSoFar], (size_t)remainBytes);
+        int b = (int)StorageMetrics_Read(StorageFile_ImagePackage, self->fd, &buf[bytesSoFar],
+                                         (size_t)remainBytes);
         if (b == -1) {
             Log_Debug("ERROR:%s: read failure bytes_so_far=%lld, remain_bytes=%lld, errno=%d\n",
                       __func__, bytesSoFar, remainBytes, errno);
@@ -93,10 +158,108 @@ bool FileViewMoveWindow(FileView *self, off_t offset)
         bytesSoFar += b;
     }
 
+    return true;
+}
+
+// Copies the window at offset out of the stream.  The data is released from the stream once it
+// has been copied, so moving to the same window again does not read it again.
+static bool ReadWindowFromStream(FileView *self, off_t offset)
+{
+    if (offset == self->fileOffset) {
+        return true;
+    }
+
+    if (offset < 0 || offset > self->fileSize) {
+        Log_Debug("ERROR:%s: offset %lld is outside the file\n", __func__, offset);
+        return false;
+    }
+
+    off_t bytesToRead = self->fileSize - offset;
+    if (bytesToRead > (off_t)self->windowSize) {
+        bytesToRead = self->windowSize;
+    }
+
+    // The window is invalid if the data is not all there yet.
+    self->fileOffset = NO_VALID_WINDOW;
+    if (ImageStreamRead(self->stream, offset, self->buffer, (size_t)bytesToRead) == -1) {
+        return false;
+    }
+
+    self->window = self->buffer;
     self->fileOffset = offset;
     return true;
 }
 
+bool FileViewMoveWindow(FileView *self, off_t offset)
+{
+    if (self->stream) {
+        return ReadWindowFromStream(self, offset);
+    }
+
+    // If the file is mapped then point the window into the mapping.
+    if (self->mapping) {
+        if (offset < 0 || offset > self->fileSize) {
+            Log_Debug("ERROR:%s: offset %lld is outside the file\n", __func__, offset);
+            return false;
+        }
+
+        self->window = &self->mapping[offset];
+        self->fileOffset = offset;
+        return true;
+    }
+
+    // If the data has already been prefetched, then swap the buffers.
+    if (offset == self->nextFileOffset) {
+        uint8_t *prefetched = self->nextWindow;
+        self->nextWindow = self->buffer;
+        self->buffer = prefetched;
+        self->nextFileOffset = NO_VALID_WINDOW;
+    } else if (!ReadWindowFromFile(self, offset, self->buffer)) {
+        return false;
+    }
+
+    self->window = self->buffer;
+    self->fileOffset = offset;
+    return true;
+}
+
+bool FileViewPrefetchNextWindow(FileView *self)
+{
+    assert(self->fileOffset != NO_VALID_WINDOW);
+
+    off_t nextOffset = self->fileOffset + (off_t)self->windowSize;
+    if (self->stream || nextOffset >= self->fileSize || nextOffset == self->nextFileOffset) {
+        return true;
+    }
+
+    // If the file is mapped then ask for the next window to be paged in.
+    if (self->mapping) {
+        off_t length = self->fileSize - nextOffset;
+        if (length > (off_t)self->windowSize) {
+            length = (off_t)self->windowSize;
+        }
+
+        // madvise requires a page-aligned start address.
+        long pageSize = sysconf(_SC_PAGESIZE);
+        off_t alignedOffset = (pageSize > 0) ? nextOffset - nextOffset % pageSize : nextOffset;
+        if (madvise((void *)&self->mapping[alignedOffset],
+                    (size_t)(length + (nextOffset - alignedOffset)), MADV_WILLNEED) == -1) {
+            return false;
+        }
+
+        self->nextFileOffset = nextOffset;
+        return true;
+    }
+
+    self->nextFileOffset = NO_VALID_WINDOW;
+    if (!ReadWindowFromFile(self, nextOffset, self->nextWindow)) {
+        return false;
+    }
+
+    self->nextFileOffset = nextOffset;
+    return true;
+}
+
 void FileViewFileOffsetSize(const FileView *self, off_t *offset, off_t *size)
 {
     if (offset != 0) {
@@ -8,9 +8,14 @@
 #include <sys/types.h>
 #include <time.h>
 
+#include "image_stream.h"
+
 /// <summary>
 /// Provides a movable window to a file's contents.
 /// This removes the need to load the entire file into memory at once.
+/// If possible, the file is mapped into memory read-only and the window points
+/// directly into the mapping.  Otherwise, the window is read into a buffer.
+/// A file view can also read a file which is being downloaded, from an ImageStream.
 /// </summary>
 typedef struct {
     /// <summary>
@@ -21,14 +26,41 @@ typedef struct {
     /// <summary>Size of window in bytes.</summary>
     size_t windowSize;
 
+    /// <summary>
+    /// Start of the read-only mapping of the whole file, or NULL if the file
+    /// could not be mapped.  This is owned by the file view.
+    /// </summary>
+    const uint8_t *mapping;
+
     /// <summary>Start of window in memory.</summary>
-    uint8_t *window;
+    const uint8_t *window;
 
     /// <summary>Data in window starts at this offset in the file.</summary>
     off_t fileOffset;
 
+    /// <summary>
+    /// Buffer which holds the window when the file is not mapped; NULL otherwise.
+    /// </summary>
+    uint8_t *buffer;
+
+    /// <summary>
+    /// Second buffer, of the same size as the window, which FileViewPrefetchNextWindow
+    /// fills with the data that follows the window when the file is not mapped;
+    /// NULL otherwise.
+    /// </summary>
+    uint8_t *nextWindow;
+
+    /// <summary>Data in nextWindow starts at this offset in the file.</summary>
+    off_t nextFileOffset;
+
     /// <summary>Total file size.</summary>
     off_t fileSize;
+
+    /// <summary>
+    /// Download which the window is read from, or NULL if the file is in the image
+    /// package.  This is not owned by the file view.
+    /// </summary>
+    ImageStream *stream;
 } FileView;
 
 /// <summary>
@@ -43,7 +75,24 @@ typedef struct {
 FileView *OpenFileView(const char *path, size_t windowSize);
 
 /// <summary>
-/// Frees a file view which was allocated with OpenFileView.  It is safe to
+/// Allocates a file view which reads a file as it is downloaded.  FileViewMoveWindow
+/// copies each window out of the stream, which frees its space for the data that follows,
+/// so it fails with errno set to EAGAIN until the window has arrived.
+/// <param name="stream">
+///     Download to read.  It must remain valid until the file view is closed.
+/// </param>
+/// <param name="windowSize">
+///     Window size in bytes.  This must not be larger than the stream's buffer.
+/// </param>
+/// <returns>On success, a pointer to a newly-allocated file view which the caller
+/// must dispose of with CloseFileView.  On failure it returns NULL, with errno set to
+/// EAGAIN if the size of the file is not known yet, in which case try again when
+/// more data arrives.</returns>
+/// </summary>
+FileView *OpenStreamFileView(ImageStream *stream, size_t windowSize);
+
+/// <summary>
+/// Frees a file view which was allocated with OpenFileView or OpenStreamFileView.  It is safe to
 /// call this function with a NULL pointer.
 /// </summary>
 void CloseFileView(FileView *self);
@@ -51,15 +100,32 @@ void CloseFileView(FileView *self);
 /// <summary>
 /// Move the internal window so it starts at the supplied offset.
 /// This function will read data up to the end of the window or the
-/// end of the file, whichever is sooner.
+/// end of the file, whichever is sooner.  If the data was already read by
+/// FileViewPrefetchNextWindow, then the buffers are swapped instead.
 /// <param name="self">File view returned by OpenFileView.</param>
 /// <param name="offset">Offset in file from which to read data.</param>
 /// <returns>true if successfully read data into the window; false otherwise.
 /// If this function fails, then the state of the window is undefined and
-/// the FileView object should be disposed of.</returns>
+/// the FileView object should be disposed of, unless it reads a stream and
+/// errno is EAGAIN, in which case call it again when more data arrives.</returns>
 /// </summary>
 bool FileViewMoveWindow(FileView *self, off_t offset);
 
+/// <summary>
+/// Read the data which follows the current window into a second buffer, so a
+/// later call to FileViewMoveWindow for that offset does not have to access
+/// the file.  Call this while waiting for another operation to complete, so
+/// the time taken to read the file is hidden.  Nothing is read if the window
+/// already reaches the end of the file, or if the data has already been read.
+/// If the file is mapped, this only advises the OS that the data will be needed.
+/// Nothing is done for a stream, which reads ahead by itself.
+/// <param name="self">File view returned by OpenFileView.</param>
+/// <returns>true if the data was read or did not need to be read; false otherwise.
+/// If this function fails, the file view is still valid, and FileViewMoveWindow will
+/// read the data itself.</returns>
+/// </summary>
+bool FileViewPrefetchNextWindow(FileView *self);
+
 /// <summary>
 /// Gets current file offset and size.
 /// <param name="self">File view returned by OpenFileView.</param>
@@ -0,0 +1,537 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <curl/curl.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/networking.h>
+#include <applibs/storage.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "image_stream.h"
+
+// If no data arrives for this long, the download fails rather than stalling the update.
+static const long lowSpeedTimeSeconds = 60;
+
+// How often the worker checks whether the network is ready before the download starts.
+static const struct timespec networkPollPeriod = {1, 0};
+
+struct ImageStream {
+    /// <summary>URL of the file.  This is owned by the stream.</summary>
+    char *url;
+
+    /// <summary>Absolute path of the CA certificate file.  This is owned by the stream.</summary>
+    char *certificatePath;
+
+    /// <summary>Epoll instance which eventFd is registered with.</summary>
+    int epollFd;
+
+    /// <summary>
+    /// The eventfd which the worker signals when data arrives or the download ends.
+    /// </summary>
+    int eventFd;
+
+    /// <summary>Event data for eventFd.</summary>
+    EventData eventFdEventData;
+
+    /// <summary>Called on the event loop thread when eventFd is signalled, or NULL.</summary>
+    ImageStreamDataHandler dataHandler;
+
+    /// <summary>Passed to dataHandler.</summary>
+    void *dataHandlerContext;
+
+    /// <summary>Protects the members below it, which are shared with the worker.</summary>
+    pthread_mutex_t mutex;
+
+    /// <summary>Signalled when the reader releases data, or the worker should stop.</summary>
+    pthread_cond_t spaceAvailable;
+
+    /// <summary>Whether mutex and spaceAvailable have been initialized.</summary>
+    bool isSyncInitialized;
+
+    /// <summary>The worker thread, which runs one download.</summary>
+    pthread_t thread;
+
+    /// <summary>Whether the worker thread has been started and not joined.</summary>
+    bool isRunning;
+
+    /// <summary>Whether the worker should abandon the download.</summary>
+    bool isStopping;
+
+    /// <summary>Circular buffer of downloaded data which has not been read yet.</summary>
+    uint8_t *buffer;
+
+    /// <summary>Size of buffer in bytes.</summary>
+    size_t bufferSize;
+
+    /// <summary>Index in buffer of the byte at bufferOffset.</summary>
+    size_t head;
+
+    /// <summary>Number of bytes in buffer.</summary>
+    size_t length;
+
+    /// <summary>Offset in the file of the first byte in buffer.</summary>
+    off_t bufferOffset;
+
+    /// <summary>Offset in the file from which the current download was requested.</summary>
+    off_t startOffset;
+
+    /// <summary>Size of the file, or -1 if the response headers have not arrived yet.</summary>
+    off_t fileSize;
+
+    /// <summary>Whether the current download has checked its response headers.</summary>
+    bool hasCheckedResponse;
+
+    /// <summary>Whether the current download has received the rest of the file.</summary>
+    bool isFinished;
+
+    /// <summary>Whether the current download failed.</summary>
+    bool hasFailed;
+
+    /// <summary>Handle of the current download.  This is only used by the worker.</summary>
+    CURL *curl;
+};
+
+static void LogCurlError(const char *message, CURLcode curlErrCode)
+{
+    Log_Debug("ERROR: %s (curl err=%d, '%s')\n", message, curlErrCode,
+              curl_easy_strerror(curlErrCode));
+}
+
+// Wakes the event loop, so the data handler is called.  Call this with the mutex held.
+static void SignalData(ImageStream *self)
+{
+    uint64_t increment = 1;
+    if (write(self->eventFd, &increment, sizeof(increment)) == -1) {
+        Log_Debug("ERROR: Could not signal image stream eventfd: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+}
+
+static bool IsStopping(ImageStream *self)
+{
+    pthread_mutex_lock(&self->mutex);
+    bool isStopping = self->isStopping;
+    pthread_mutex_unlock(&self->mutex);
+    return isStopping;
+}
+
+// Checks the status and length of the response when its body starts to arrive.  Call this
+// with the mutex held.
+static bool CheckResponse(ImageStream *self)
+{
+    long responseCode = 0;
+    curl_easy_getinfo(self->curl, CURLINFO_RESPONSE_CODE, &responseCode);
+    if (self->startOffset != 0 && responseCode != 206) {
+        Log_Debug("ERROR: %s does not support range requests (HTTP status %ld).\n", self->url,
+                  responseCode);
+        return false;
+    }
+
+    curl_off_t contentLength = -1;
+    curl_easy_getinfo(self->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+    if (contentLength < 0) {
+        Log_Debug("ERROR: %s was sent without a Content-Length.\n", self->url);
+        return false;
+    }
+
+    off_t fileSize = self->startOffset + (off_t)contentLength;
+    if (self->fileSize != -1 && self->fileSize != fileSize) {
+        Log_Debug("ERROR: %s changed size from %lld to %lld bytes.\n", self->url, self->fileSize,
+                  fileSize);
+        return false;
+    }
+    self->fileSize = fileSize;
+    self->hasCheckedResponse = true;
+    return true;
+}
+
+// Called by cURL on the worker thread with each part of the body.  It copies the data into the
+// buffer, and waits while the buffer is full.  Returning less than the full length aborts the
+// download.
+static size_t WriteCallback(char *data, size_t size, size_t nmemb, void *userData)
+{
+    ImageStream *self = userData;
+    size_t total = size * nmemb;
+    size_t copied = 0;
+
+    pthread_mutex_lock(&self->mutex);
+    if (!self->hasCheckedResponse && !CheckResponse(self)) {
+        pthread_mutex_unlock(&self->mutex);
+        return 0;
+    }
+
+    while (copied < total && !self->isStopping) {
+        if (self->length == self->bufferSize) {
+            SignalData(self);
+            pthread_cond_wait(&self->spaceAvailable, &self->mutex);
+            continue;
+        }
+
+        size_t tail = (self->head + self->length) % self->bufferSize;
+        size_t chunk = total - copied;
+        if (chunk > self->bufferSize - self->length) {
+            chunk = self->bufferSize - self->length;
+        }
+        if (chunk > self->bufferSize - tail) {
+            chunk = self->bufferSize - tail;
+        }
+
+        memcpy(&self->buffer[tail], &data[copied], chunk);
+        self->length += chunk;
+        copied += chunk;
+    }
+    SignalData(self);
+    pthread_mutex_unlock(&self->mutex);
+
+    return copied;
+}
+
+// Called by cURL on the worker thread while it waits for the server, so that closing the stream
+// does not have to wait for a connection or a response.
+static int ProgressCallback(void *userData, curl_off_t downloadTotal, curl_off_t downloadNow,
+                            curl_off_t uploadTotal, curl_off_t uploadNow)
+{
+    return IsStopping(userData) ? 1 : 0;
+}
+
+// Downloads the file from startOffset to its end into the buffer.
+static bool Download(ImageStream *self)
+{
+    CURLcode res;
+    char range[24];
+
+    if ((self->curl = curl_easy_init()) == NULL) {
+        Log_Debug("ERROR: curl_easy_init() failed\n");
+        return false;
+    }
+
+    // Important: any change in the domain name must be reflected in the AllowedConnections
+    // capability in app_manifest.json.
+    if ((res = curl_easy_setopt(self->curl, CURLOPT_URL, self->url)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_CAINFO, self->certificatePath)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_FOLLOWLOCATION, 1L)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_FAILONERROR, 1L)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_NOSIGNAL, 1L)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_WRITEFUNCTION, WriteCallback)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_WRITEDATA, (void *)self)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_NOPROGRESS, 0L)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback)) !=
+            CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_XFERINFODATA, (void *)self)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_LOW_SPEED_LIMIT, 1L)) != CURLE_OK ||
+        (res = curl_easy_setopt(self->curl, CURLOPT_LOW_SPEED_TIME, lowSpeedTimeSeconds)) !=
+            CURLE_OK) {
+        LogCurlError("curl_easy_setopt", res);
+        goto done;
+    }
+
+    if (self->startOffset != 0) {
+        snprintf(range, sizeof(range), "%lld-", (long long)self->startOffset);
+        if ((res = curl_easy_setopt(self->curl, CURLOPT_RANGE, range)) != CURLE_OK) {
+            LogCurlError("curl_easy_setopt CURLOPT_RANGE", res);
+            goto done;
+        }
+    }
+
+    Log_Debug("INFO: Downloading %s from offset %lld.\n", self->url, self->startOffset);
+    if ((res = curl_easy_perform(self->curl)) != CURLE_OK && !IsStopping(self)) {
+        LogCurlError("Could not download the image", res);
+    }
+
+done:
+    curl_easy_cleanup(self->curl);
+    self->curl = NULL;
+    return res == CURLE_OK;
+}
+
+static void *DownloadThread(void *arg)
+{
+    ImageStream *self = arg;
+
+    // Wait for the network, so an update which starts at boot does not fail straight away.
+    bool isNetworkingReady = false;
+    while (!IsStopping(self) &&
+           (Networking_IsNetworkingReady(&isNetworkingReady) == -1 || !isNetworkingReady)) {
+        nanosleep(&networkPollPeriod, NULL);
+    }
+
+    bool succeeded = !IsStopping(self) && Download(self);
+
+    pthread_mutex_lock(&self->mutex);
+    if (!self->isStopping) {
+        self->isFinished = succeeded;
+        self->hasFailed = !succeeded;
+        SignalData(self);
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    return NULL;
+}
+
+static void StopDownload(ImageStream *self)
+{
+    if (!self->isRunning) {
+        return;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    self->isStopping = true;
+    pthread_cond_signal(&self->spaceAvailable);
+    pthread_mutex_unlock(&self->mutex);
+
+    int result = pthread_join(self->thread, NULL);
+    if (result != 0) {
+        Log_Debug("ERROR: Could not join image stream thread: %s (%d).\n", strerror(result),
+                  result);
+    }
+    self->isRunning = false;
+}
+
+// Discards the buffer and starts a download from offset.  The worker must not be running.
+static int StartDownload(ImageStream *self, off_t offset)
+{
+    self->head = 0;
+    self->length = 0;
+    self->bufferOffset = offset;
+    self->startOffset = offset;
+    self->hasCheckedResponse = false;
+    self->isFinished = false;
+    self->hasFailed = false;
+    self->isStopping = false;
+
+    int result = pthread_create(&self->thread, NULL, &DownloadThread, self);
+    if (result != 0) {
+        Log_Debug("ERROR: Could not create image stream thread: %s (%d).\n", strerror(result),
+                  result);
+        self->hasFailed = true;
+        return -1;
+    }
+    self->isRunning = true;
+    return 0;
+}
+
+// Starts the download the first time the file is read, so a stream which is opened when the
+// application starts does not hold a connection open until the update reaches the file.
+static int StartDownloadIfIdle(ImageStream *self)
+{
+    return self->isRunning ? 0 : StartDownload(self, 0);
+}
+
+static int RestartDownload(ImageStream *self, off_t offset)
+{
+    Log_Debug("INFO: Restarting download of %s at offset %lld.\n", self->url, offset);
+    StopDownload(self);
+    if (StartDownload(self, offset) == -1) {
+        errno = EIO;
+        return -1;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+// Frees the first count bytes of the buffer.  Call this with the mutex held.
+static void ReleaseData(ImageStream *self, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    self->head = (self->head + count) % self->bufferSize;
+    self->length -= count;
+    self->bufferOffset += (off_t)count;
+    pthread_cond_signal(&self->spaceAvailable);
+}
+
+static void DataEventHandler(EventData *eventData)
+{
+    ImageStream *self =
+        (ImageStream *)((uint8_t *)eventData - offsetof(ImageStream, eventFdEventData));
+
+    uint64_t value;
+    if (read(self->eventFd, &value, sizeof(value)) == -1) {
+        if (errno != EAGAIN) {
+            Log_Debug("ERROR: Could not read image stream eventfd: %s (%d).\n", strerror(errno),
+                      errno);
+        }
+        return;
+    }
+
+    if (self->dataHandler) {
+        self->dataHandler(self, self->dataHandlerContext);
+    }
+}
+
+ImageStream *OpenImageStream(const char *url, const char *certificatePath, int epollFd,
+                             size_t bufferSize)
+{
+    if (bufferSize == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ImageStream *self = calloc(1, sizeof(*self));
+    if (!self) {
+        return NULL;
+    }
+
+    // Initialize owned resources so they can be cleaned
+    // up safely if only some of them are initialized.
+    self->eventFd = -1;
+    self->epollFd = epollFd;
+    self->fileSize = -1;
+    self->bufferSize = bufferSize;
+    self->eventFdEventData.eventHandler = &DataEventHandler;
+
+    self->url = strdup(url);
+    if (!self->url) {
+        goto failed;
+    }
+
+    self->certificatePath = Storage_GetAbsolutePathInImagePackage(certificatePath);
+    if (!self->certificatePath) {
+        Log_Debug("ERROR: The certificate path could not be resolved: %s (%d).\n",
+                  strerror(errno), errno);
+        goto failed;
+    }
+
+    self->buffer = malloc(bufferSize);
+    if (!self->buffer) {
+        goto failed;
+    }
+
+    self->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (self->eventFd == -1) {
+        Log_Debug("ERROR: Could not create eventfd: %s (%d).\n", strerror(errno), errno);
+        goto failed;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, self->eventFd, &self->eventFdEventData, EPOLLIN) !=
+        0) {
+        goto failed;
+    }
+
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->spaceAvailable, NULL);
+    self->isSyncInitialized = true;
+
+    return self;
+
+failed:
+    CloseImageStream(self);
+    return NULL;
+}
+
+void CloseImageStream(ImageStream *self)
+{
+    if (!self) {
+        return;
+    }
+
+    StopDownload(self);
+
+    if (self->eventFd != -1) {
+        UnregisterPersistentEventHandlerFromEpoll(self->epollFd, &self->eventFdEventData);
+        CloseFdAndPrintError(self->eventFd, "ImageStream");
+    }
+
+    if (self->isSyncInitialized) {
+        pthread_cond_destroy(&self->spaceAvailable);
+        pthread_mutex_destroy(&self->mutex);
+    }
+
+    free(self->buffer);
+    free(self->certificatePath);
+    free(self->url);
+    free(self);
+}
+
+void ImageStreamSetDataHandler(ImageStream *self, ImageStreamDataHandler handler, void *context)
+{
+    self->dataHandler = handler;
+    self->dataHandlerContext = context;
+}
+
+int ImageStreamGetSize(ImageStream *self, off_t *size)
+{
+    if (StartDownloadIfIdle(self) == -1) {
+        errno = EIO;
+        return -1;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    off_t fileSize = self->fileSize;
+    bool hasFailed = self->hasFailed;
+    pthread_mutex_unlock(&self->mutex);
+
+    if (fileSize != -1) {
+        *size = fileSize;
+        return 0;
+    }
+
+    errno = hasFailed ? EIO : EAGAIN;
+    return -1;
+}
+
+int ImageStreamRead(ImageStream *self, off_t offset, uint8_t *buf, size_t length)
+{
+    if (offset < 0 || length > self->bufferSize) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (StartDownloadIfIdle(self) == -1) {
+        errno = EIO;
+        return -1;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    if (self->hasFailed) {
+        pthread_mutex_unlock(&self->mutex);
+        errno = EIO;
+        return -1;
+    }
+
+    if (self->fileSize != -1 && offset + (off_t)length > self->fileSize) {
+        pthread_mutex_unlock(&self->mutex);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The data has already been released, or is further ahead than the download has reached,
+    // so ask the server for it instead of waiting for the data in between.
+    if (offset < self->bufferOffset || offset > self->bufferOffset + (off_t)self->length) {
+        pthread_mutex_unlock(&self->mutex);
+        return RestartDownload(self, offset);
+    }
+
+    ReleaseData(self, (size_t)(offset - self->bufferOffset));
+    if (self->length < length) {
+        bool isFinished = self->isFinished;
+        pthread_mutex_unlock(&self->mutex);
+        errno = isFinished ? EIO : EAGAIN;
+        return -1;
+    }
+
+    size_t firstPart = self->bufferSize - self->head;
+    if (firstPart > length) {
+        firstPart = length;
+    }
+    memcpy(buf, &self->buffer[self->head], firstPart);
+    memcpy(&buf[firstPart], self->buffer, length - firstPart);
+    ReleaseData(self, length);
+    pthread_mutex_unlock(&self->mutex);
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct ImageStream ImageStream;
+
+/// <summary>
+/// Called on the event loop thread when more of the stream has been downloaded, or when the
+/// download has failed.
+/// </summary>
+typedef void (*ImageStreamDataHandler)(ImageStream *stream, void *context);
+
+/// <summary>
+/// Downloads a file over HTTPS into a bounded buffer, so a firmware image can be written to
+/// the attached board as it arrives instead of being stored first.  The download runs with
+/// the cURL easy interface on a worker thread.  When the buffer is full, the worker waits
+/// until the reader has released some of it, so the TCP window closes and the server is
+/// held back to the rate at which the data is written.  The buffer only has to hold a few
+/// file view windows, whatever the size of the image.
+/// <param name="url">
+///     HTTPS URL of the file.  The server must send a Content-Length and support range
+///     requests, which are used to read again from an earlier offset.  Its domain must be
+///     in the AllowedConnections capability in app_manifest.json.
+/// </param>
+/// <param name="certificatePath">
+///     Name of the CA certificate file, in the image package, which is used to verify the server.
+/// </param>
+/// <param name="epollFd">
+///     Epoll instance of the event loop, on which the data handler is called.
+/// </param>
+/// <param name="bufferSize">
+///     Size of the buffer in bytes.  This must be at least the window size of the file views
+///     which read the stream.
+/// </param>
+/// <returns>
+///     On success, a pointer to a newly-allocated stream, which the caller must dispose of
+///     with CloseImageStream.  The download starts when the stream is first read, or its size
+///     is first requested.  On failure it returns NULL.
+/// </returns>
+/// </summary>
+ImageStream *OpenImageStream(const char *url, const char *certificatePath, int epollFd,
+                             size_t bufferSize);
+
+/// <summary>
+/// Stops the download and frees a stream which was allocated with OpenImageStream.  It is
+/// safe to call this function with a NULL pointer.
+/// </summary>
+void CloseImageStream(ImageStream *self);
+
+/// <summary>
+/// Sets the function which is called when more data arrives.  It replaces any previous handler.
+/// <param name="self">Stream returned by OpenImageStream.</param>
+/// <param name="handler">Function to call, or NULL to stop calling one.</param>
+/// <param name="context">Passed to the handler.</param>
+/// </summary>
+void ImageStreamSetDataHandler(ImageStream *self, ImageStreamDataHandler handler, void *context);
+
+/// <summary>
+/// Gets the size of the file, which is known once the response headers have arrived.
+/// <param name="self">Stream returned by OpenImageStream.</param>
+/// <param name="size">On success contains the file size.</param>
+/// <returns>
+///     0 on success, or -1 with errno set to EAGAIN if the size is not known yet, or
+///     to EIO if the download failed.
+/// </returns>
+/// </summary>
+int ImageStreamGetSize(ImageStream *self, off_t *size);
+
+/// <summary>
+/// Copies part of the file, and releases the data before its end, so the download can
+/// continue into that space.  Data before offset is discarded.  If offset comes before the
+/// data which is still buffered, the download is started again from offset.
+/// <param name="self">Stream returned by OpenImageStream.</param>
+/// <param name="offset">Offset in the file of the first byte to copy.</param>
+/// <param name="buf">Receives the data.</param>
+/// <param name="length">
+///     Number of bytes to copy, which must not be more than the buffer size or go beyond
+///     the end of the file.
+/// </param>
+/// <returns>
+///     0 on success, or -1 with errno set to EAGAIN if the data has not all arrived yet, in
+///     which case call this again from the data handler, or to EIO if the download failed,
+///     or to EINVAL if the arguments are out of range.
+/// </returns>
+/// </summary>
+int ImageStreamRead(ImageStream *self, off_t offset, uint8_t *buf, size_t length);
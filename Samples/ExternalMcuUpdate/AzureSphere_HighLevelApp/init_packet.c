@@ -0,0 +1,253 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include "init_packet.h"
+
+// Field numbers in dfu-cc.proto, which the bootloader uses to decode the init packet.
+enum {
+    PacketField_Command = 1,
+    PacketField_SignedCommand = 2,
+
+    SignedCommandField_Command = 1,
+
+    CommandField_OpCode = 1,
+    CommandField_Init = 2,
+
+    InitField_FwVersion = 1,
+    InitField_HwVersion = 2,
+    InitField_Type = 4,
+    InitField_SdSize = 5,
+    InitField_BlSize = 6,
+    InitField_AppSize = 7
+};
+
+// Value of the op_code field in a command which carries an init command.
+static const uint64_t OP_CODE_INIT = 1;
+
+// Protocol buffer wire types.
+enum {
+    WireType_Varint = 0,
+    WireType_Fixed64 = 1,
+    WireType_LengthDelimited = 2,
+    WireType_Fixed32 = 5
+};
+
+// Encoded message which is being read.
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+    bool failed;
+} PbReader;
+
+// One field of a message.  For a length-delimited field, contents holds its data.  For a
+// varint field, value holds its value.
+typedef struct {
+    uint32_t number;
+    uint8_t wireType;
+    uint64_t value;
+    PbReader contents;
+} PbField;
+
+static bool ReadVarint(PbReader *reader, uint64_t *value)
+{
+    *value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if (reader->pos >= reader->length) {
+            return false;
+        }
+        uint8_t b = reader->data[reader->pos++];
+        *value |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool Skip(PbReader *reader, uint64_t length)
+{
+    if (length > reader->length - reader->pos) {
+        return false;
+    }
+    reader->pos += (size_t)length;
+    return true;
+}
+
+// Reads the key of the next field, and its value or the extent of its contents.
+static bool ReadFieldContents(PbReader *reader, PbField *field)
+{
+    uint64_t key;
+    if (!ReadVarint(reader, &key) || (key >> 3) > UINT32_MAX) {
+        return false;
+    }
+
+    memset(field, 0, sizeof(*field));
+    field->number = (uint32_t)(key >> 3);
+    field->wireType = (uint8_t)(key & 0x7);
+
+    switch (field->wireType) {
+    case WireType_Varint:
+        return ReadVarint(reader, &field->value);
+
+    case WireType_Fixed64:
+        return Skip(reader, 8);
+
+    case WireType_Fixed32:
+        return Skip(reader, 4);
+
+    case WireType_LengthDelimited:
+        if (!ReadVarint(reader, &field->value) || field->value > reader->length - reader->pos) {
+            return false;
+        }
+        field->contents.data = &reader->data[reader->pos];
+        field->contents.length = (size_t)field->value;
+        reader->pos += (size_t)field->value;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Reads the next field.  Returns false at the end of the message, or if it is malformed,
+// in which case failed is set.
+static bool ReadField(PbReader *reader, PbField *field)
+{
+    if (reader->pos >= reader->length) {
+        return false;
+    }
+
+    bool valid = ReadFieldContents(reader, field);
+    reader->failed = !valid;
+    return valid;
+}
+
+// Stores a varint field which holds a uint32 value.
+static bool GetUint32(const PbField *field, uint32_t *value)
+{
+    if (field->wireType != WireType_Varint || field->value > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)field->value;
+    return true;
+}
+
+static bool DecodeInitCommand(PbReader *reader, InitPacketInfo *info)
+{
+    PbField field;
+    while (ReadField(reader, &field)) {
+        bool valid = true;
+        uint32_t type = 0;
+        switch (field.number) {
+        case InitField_FwVersion:
+            valid = GetUint32(&field, &info->fwVersion);
+            info->hasFwVersion = true;
+            break;
+
+        case InitField_HwVersion:
+            valid = GetUint32(&field, &info->hwVersion);
+            info->hasHwVersion = true;
+            break;
+
+        case InitField_Type:
+            valid = GetUint32(&field, &type);
+            if (valid) {
+                info->type = (InitPacketType)type;
+            }
+            break;
+
+        case InitField_SdSize:
+            valid = GetUint32(&field, &info->sdSize);
+            break;
+
+        case InitField_BlSize:
+            valid = GetUint32(&field, &info->blSize);
+            break;
+
+        case InitField_AppSize:
+            valid = GetUint32(&field, &info->appSize);
+            break;
+
+        default:
+            // The SoftDevice requirements, the hash and the debug flag are not checked.
+            break;
+        }
+
+        if (!valid) {
+            return false;
+        }
+    }
+
+    return !reader->failed;
+}
+
+static bool DecodeCommand(PbReader *reader, InitPacketInfo *info)
+{
+    bool hasInit = false;
+    PbField field;
+    while (ReadField(reader, &field)) {
+        if (field.number == CommandField_OpCode) {
+            if (field.wireType != WireType_Varint || field.value != OP_CODE_INIT) {
+                return false;
+            }
+        } else if (field.number == CommandField_Init) {
+            if (field.wireType != WireType_LengthDelimited ||
+                !DecodeInitCommand(&field.contents, info)) {
+                return false;
+            }
+            hasInit = true;
+        }
+    }
+
+    return hasInit && !reader->failed;
+}
+
+// Finds the field with the supplied number, which must be a message, and decodes it as a
+// command.  In a signed command, the command comes before the signature.
+static bool DecodeCommandField(PbReader *reader, uint32_t number, InitPacketInfo *info,
+                               bool *found)
+{
+    PbField field;
+    while (ReadField(reader, &field)) {
+        if (field.number == number) {
+            if (field.wireType != WireType_LengthDelimited) {
+                return false;
+            }
+            *found = true;
+            return DecodeCommand(&field.contents, info);
+        }
+    }
+
+    *found = false;
+    return !reader->failed;
+}
+
+bool ParseInitPacket(const uint8_t *data, size_t length, InitPacketInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->type = InitPacketType_Application;
+
+    PbReader reader = {.data = data, .length = length, .pos = 0, .failed = false};
+    PbField field;
+    while (ReadField(&reader, &field)) {
+        if (field.wireType != WireType_LengthDelimited) {
+            continue;
+        }
+
+        if (field.number == PacketField_Command) {
+            return DecodeCommand(&field.contents, info);
+        }
+        if (field.number == PacketField_SignedCommand) {
+            info->isSigned = true;
+            bool found;
+            bool valid =
+                DecodeCommandField(&field.contents, SignedCommandField_Command, info, &found);
+            return valid && found;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,62 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+/// Values of the type field in an init packet, which identify the firmware it describes.
+/// </summary>
+typedef enum {
+    InitPacketType_Application = 0,
+    InitPacketType_Softdevice = 1,
+    InitPacketType_Bootloader = 2,
+    InitPacketType_SoftdeviceBootloader = 3
+} InitPacketType;
+
+/// <summary>
+/// The fields of an init packet which can be checked before it is sent.  The
+/// init packet is the protocol buffer in a .dat file, which the nRF52 bootloader
+/// decodes and validates before it accepts the firmware.
+/// </summary>
+typedef struct {
+    /// <summary>Whether the packet is signed.  The signature is not checked.</summary>
+    bool isSigned;
+
+    /// <summary>Whether the packet has a firmware version.</summary>
+    bool hasFwVersion;
+
+    /// <summary>Version of the firmware, if hasFwVersion is true.</summary>
+    uint32_t fwVersion;
+
+    /// <summary>Whether the packet has a hardware version.</summary>
+    bool hasHwVersion;
+
+    /// <summary>Hardware version which the firmware is for, if hasHwVersion is true.</summary>
+    uint32_t hwVersion;
+
+    /// <summary>Type of the firmware.</summary>
+    InitPacketType type;
+
+    /// <summary>Size of the SoftDevice, or zero.</summary>
+    uint32_t sdSize;
+
+    /// <summary>Size of the bootloader, or zero.</summary>
+    uint32_t blSize;
+
+    /// <summary>Size of the application, or zero.</summary>
+    uint32_t appSize;
+} InitPacketInfo;
+
+/// <summary>
+/// Decodes an init packet, signed or unsigned, in the same way as the bootloader's
+/// stored_init_cmd_decode.  Fields which are not listed in InitPacketInfo are skipped.
+/// <param name="data">The contents of the .dat file.</param>
+/// <param name="length">Length of data in bytes.</param>
+/// <param name="info">On success, receives the decoded fields.</param>
+/// <returns>true if the packet is a valid init command; false otherwise.</returns>
+/// </summary>
+bool ParseInitPacket(const uint8_t *data, size_t length, InitPacketInfo *info);
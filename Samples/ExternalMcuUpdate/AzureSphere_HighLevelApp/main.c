@@ -9,9 +9,15 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <curl/curl.h>
+
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include "epoll_timerfd_utilities.h"
+#include "perf_profile.h"
+#include "shutdown_coordinator.h"
+#include "storage_metrics.h"
+#include "worker_pool.h"
 #include <applibs/uart.h>
 #include <applibs/gpio.h>
 #include <applibs/log.h>
@@ -29,7 +35,17 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+// Fail the build if the hardware definition maps two of the peripherals which this sample
+// uses to the same pins. See mt3620_pin_check.h.
+#include <hw/mt3620_pin_check.h>
+MT3620_CHECK_GPIOS_DISTINCT(SAMPLE_BUTTON_1, SAMPLE_NRF52_RESET, SAMPLE_NRF52_DFU);
+MT3620_CHECK_GPIOS_NOT_ON_UART(SAMPLE_NRF52_UART, SAMPLE_BUTTON_1, SAMPLE_NRF52_RESET,
+                               SAMPLE_NRF52_DFU);
+
 #include "nordic/dfu_uart_protocol.h"
+#include "nordic/crc.h"
+#include "dfu_progress.h"
+#include "image_stream.h"
 
 // The file descriptors are initialized to an invalid value so they can
 // be cleaned up safely if they are only partially initialized.
@@ -40,6 +56,17 @@ static int nrfDfuModeGpioFd = -1;
 static int triggerUpdateButtonGpioFd = -1;
 static int buttonPollTimerFd = -1;
 
+// The attached nRF52 board.  Further boards on other UARTs can be updated at the
+// same time by opening a target, and a separate array of images, for each one.
+static DfuTarget *nrfTarget = NULL;
+
+// Calculates the CRC-32 of each image file, which is compared with the installed image, so
+// that reading the file does not hold up the event loop. One thread is enough for the CRC
+// of one file at a time, and its stack is kept small.
+static WorkerPool workerPool;
+static bool workerPoolInitialized = false;
+static const size_t workerStackSize = 32 * 1024;
+
 // State variables
 static GPIO_Value_Type buttonState = GPIO_Value_High;
 
@@ -54,16 +81,56 @@ static DfuImageData images[] = {
     {.datPathname = "ExternalNRF52Firmware/blinkyV1.dat",
      .binPathname = "ExternalNRF52Firmware/blinkyV1.bin",
      .firmwareType = DfuFirmware_Application,
-     .version = 1}};
+     .version = 1,
+     // To send a patch when an older version is installed, make it with
+     // DeltaTool/make_delta.py and set its path and the older version here.
+     .deltaPathname = NULL,
+     .deltaBaseVersion = 0,
+     // To send the image compressed when there is no patch for the installed version,
+     // make it with DeltaTool/make_delta.py without --base and set its path here.
+     .compressedPathname = NULL}};
 
 static const size_t imageCount = sizeof(images) / sizeof(images[0]);
 
+// To download an image over HTTPS while it is written, instead of including it in the image
+// package, set the URLs of its .dat and .bin files here, in the same order as images.  The
+// domain must be added to the AllowedConnections capability in app_manifest.json, and the
+// server must support range requests.  Leave a URL NULL to use the file in the image package.
+typedef struct {
+    const char *datUrl;
+    const char *binUrl;
+} ImageDownload;
+static const ImageDownload imageDownloads[sizeof(images) / sizeof(images[0])] = {
+    {.datUrl = NULL, .binUrl = NULL}, {.datUrl = NULL, .binUrl = NULL}};
+
+// CA certificate, in the image package, which is used to verify the download server.
+static const char *const downloadCertificatePath = "certs/DigiCertGlobalRootCA.pem";
+
+// Each download is held back once this many bytes are buffered ahead of the data which has
+// been written to the nRF52.  It must hold at least one window, which is the size of an nRF52
+// data object, 16KB with the bootloader in this sample.
+static const size_t downloadBufferSize = 32 * 1024;
+static bool curlGlobalInitialized = false;
+
+// Faster UART rates to try once the nRF52 is in DFU mode, fastest first.  Images are
+// written at the fastest rate that works, or at DFU_BOOTLOADER_BAUD_RATE if none does.
+static const uint32_t dfuBaudRates[] = {1000000, 460800};
+static const size_t dfuBaudRateCount = sizeof(dfuBaudRates) / sizeof(dfuBaudRates[0]);
+
 // Whether currently writing images to attached board.
 static bool inDfuMode = false;
 
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
+// When the application is asked to exit during an update, the object which is being written is
+// allowed to finish, so that its progress is saved and the update resumes after it.
+static bool DfuShutdownHook(ShutdownHook *hook);
+static ShutdownCoordinator shutdownCoordinator;
+static const struct timespec shutdownGracePeriod = {SHUTDOWN_GRACE_PERIOD_SECONDS - 2, 0};
+static ShutdownHook dfuShutdownHook = {
+    .name = "DfuCheckpoint", .handler = &DfuShutdownHook, .deadline = {5, 0}};
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -73,13 +140,131 @@ static void TerminationHandler(int signalNumber)
     terminationRequired = true;
 }
 
-void DfuTerminationHandler(DfuResultStatus status)
+void DfuTerminationHandler(DfuTarget *target, DfuResultStatus status)
 {
     Log_Debug("\nFinished updating images with status: %s, setting DFU mode to false.\n",
               status == DfuResult_Success ? "SUCCESS" : "FAILED");
+    if (status == DfuResult_Success) {
+        Log_Debug("Images were written at %u baud.\n", GetDfuBaudRate(target));
+    }
     inDfuMode = false;
 }
 
+/// <summary>
+///     Called by the DFU protocol with the progress of the image which is being written.
+/// </summary>
+static void DfuProgressReportHandler(DfuTarget *target, const DfuTransferProgress *progress)
+{
+    Log_Debug("INFO: Image %zu of %zu: %u of %u bytes", progress->imageIndex + 1,
+              progress->imageCount, progress->bytesSent, progress->bytesTotal);
+    if (progress->bytesPerSecond != 0) {
+        Log_Debug(", %u bytes/s, %u s remaining", progress->bytesPerSecond,
+                  (progress->msRemaining + 999) / 1000);
+    }
+    Log_Debug(", %u retries.\n", progress->retries);
+}
+
+/// <summary>
+///     Shutdown hook which waits for the next checkpoint of the update, if one is running. An
+///     object which is interrupted is written again from its start when the update resumes.
+/// </summary>
+static bool DfuShutdownHook(ShutdownHook *hook)
+{
+    static uint32_t writesAtShutdown = 0;
+    if (!inDfuMode) {
+        return true;
+    }
+    if (hook->calls == 0) {
+        writesAtShutdown = GetDfuProgressWriteCount();
+        Log_Debug("INFO: Waiting for the firmware update to save its progress.\n");
+        return false;
+    }
+    return GetDfuProgressWriteCount() != writesAtShutdown;
+}
+
+/// <summary>
+///     Opens the UART which is connected to the nRF52.
+/// </summary>
+/// <param name="baudRate">Baud rate at which to open the UART.</param>
+/// <returns>File descriptor for the UART, or -1 on failure.</returns>
+static int OpenNrfUart(uint32_t baudRate)
+{
+    UART_Config uartConfig;
+    UART_InitConfig(&uartConfig);
+    uartConfig.baudRate = baudRate;
+    uartConfig.flowControl = UART_FlowControl_RTSCTS;
+    int fd = UART_Open(SAMPLE_NRF52_UART, &uartConfig);
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
+    }
+    return fd;
+}
+
+/// <summary>
+///     Called by the DFU protocol to change the rate of the UART which is connected to the nRF52.
+/// </summary>
+static int ReopenNrfUart(DfuTarget *target, uint32_t baudRate)
+{
+    CloseFdAndPrintError(nrfUartFd, "NrfUart");
+    nrfUartFd = OpenNrfUart(baudRate);
+    return nrfUartFd;
+}
+
+/// <summary>
+///     Opens the downloads of the images which have URLs.  Each one starts when the update
+///     reaches its file.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int OpenImageDownloads(void)
+{
+    for (size_t i = 0; i < imageCount; ++i) {
+        const char *urls[] = {imageDownloads[i].datUrl, imageDownloads[i].binUrl};
+        ImageStream **streams[] = {&images[i].datStream, &images[i].binStream};
+        for (size_t j = 0; j < 2; ++j) {
+            if (urls[j] == NULL) {
+                continue;
+            }
+
+            if (!curlGlobalInitialized) {
+                CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
+                if (res != CURLE_OK) {
+                    Log_Debug("ERROR: curl_global_init failed (curl err=%d, '%s').\n", res,
+                              curl_easy_strerror(res));
+                    return -1;
+                }
+                curlGlobalInitialized = true;
+            }
+
+            *streams[j] =
+                OpenImageStream(urls[j], downloadCertificatePath, epollFd, downloadBufferSize);
+            if (*streams[j] == NULL) {
+                Log_Debug("ERROR: Could not open download of %s.\n", urls[j]);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+///     Closes the downloads of the images.
+/// </summary>
+static void CloseImageDownloads(void)
+{
+    for (size_t i = 0; i < imageCount; ++i) {
+        CloseImageStream(images[i].datStream);
+        images[i].datStream = NULL;
+        CloseImageStream(images[i].binStream);
+        images[i].binStream = NULL;
+    }
+
+    if (curlGlobalInitialized) {
+        curl_global_cleanup();
+        curlGlobalInitialized = false;
+    }
+}
+
 /// <summary>
 ///     Handle button timer event: if the button is pressed, trigger DFU mode and send updates.
 /// </summary>
@@ -105,7 +290,7 @@ static void ButtonPollTimerEventHandler(EventData *eventData)
             if (!inDfuMode) {
                 Log_Debug("\nStarting firmware update...\n");
                 inDfuMode = true;
-                ProgramImages(images, imageCount, &DfuTerminationHandler);
+                ProgramImages(nrfTarget, images, imageCount, &DfuTerminationHandler);
             }
         }
         buttonState = newButtonState;
@@ -139,14 +324,14 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    // Create a UART_Config object, open the UART and set up UART event handler
-    UART_Config uartConfig;
-    UART_InitConfig(&uartConfig);
-    uartConfig.baudRate = 115200;
-    uartConfig.flowControl = UART_FlowControl_RTSCTS;
-    nrfUartFd = UART_Open(SAMPLE_NRF52_UART, &uartConfig);
+    workerPoolInitialized = true;
+    if (WorkerPool_Init(&workerPool, epollFd, 1, workerStackSize) != 0) {
+        return -1;
+    }
+
+    // Open the UART at the rate which the nRF52 bootloader starts with
+    nrfUartFd = OpenNrfUart(DFU_BOOTLOADER_BAUD_RATE);
     if (nrfUartFd == -1) {
-        Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
         return -1;
     }
     // uartFd will be added to the epoll when needed (check epoll protocol)
@@ -158,7 +343,22 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    InitUartProtocol(nrfUartFd, nrfResetGpioFd, nrfDfuModeGpioFd, epollFd);
+    nrfTarget = OpenDfuTarget(nrfUartFd, nrfResetGpioFd, nrfDfuModeGpioFd, epollFd);
+    if (!nrfTarget) {
+        return -1;
+    }
+    EnableDfuResume(nrfTarget, 0);
+    SetDfuBaudRates(nrfTarget, dfuBaudRates, dfuBaudRateCount, &ReopenNrfUart);
+    SetDfuProgressHandler(nrfTarget, &DfuProgressReportHandler);
+    SetDfuWorkerPool(nrfTarget, &workerPool);
+    // The number of writes per acknowledgement comes from the performance profile: 16 with the
+    // Balanced profile, and more with the others, so that more is in flight.
+    const PerfProfile *profile = PerfProfile_GetDefaults(PERF_PROFILE_DEFAULT);
+    SetPacketReceiptInterval(nrfTarget, (uint16_t)profile->dfu.packetReceiptInterval);
+
+    if (OpenImageDownloads() != 0) {
+        return -1;
+    }
 
     Log_Debug("Opening SAMPLE_BUTTON_1 as input\n");
     triggerUpdateButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
@@ -177,9 +377,12 @@ static int InitPeripheralsAndHandlers(void)
     // Take nRF52 out of reset, allowing its application to start
     GPIO_SetValue(nrfResetGpioFd, GPIO_Value_High);
 
+    ShutdownCoordinator_Init(&shutdownCoordinator, &shutdownGracePeriod);
+    ShutdownCoordinator_AddHook(&shutdownCoordinator, &dfuShutdownHook);
+
     Log_Debug("\nStarting firmware update...\n");
     inDfuMode = true;
-    ProgramImages(images, imageCount, &DfuTerminationHandler);
+    ProgramImages(nrfTarget, images, imageCount, &DfuTerminationHandler);
 
     return 0;
 }
@@ -189,6 +392,18 @@ static int InitPeripheralsAndHandlers(void)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
+    // Wait for a CRC-32 which is being calculated before the target is freed.
+    if (workerPoolInitialized) {
+        WorkerPool_Close(&workerPool);
+    }
+    CloseDfuTarget(nrfTarget);
+    CloseImageDownloads();
+
+    // Show how long the reads of the firmware images from the image package took.
+    StorageMetrics storageMetrics;
+    StorageMetrics_GetSnapshot(&storageMetrics);
+    StorageMetrics_Log(&storageMetrics);
+
     Log_Debug("Closing file descriptors\n");
     CloseFdAndPrintError(buttonPollTimerFd, "ButtonPollTimer");
     CloseFdAndPrintError(triggerUpdateButtonGpioFd, "TriggerUpdateButtonGpio");
@@ -204,6 +419,11 @@ static void ClosePeripheralsAndHandlers(void)
 int main(int argc, char *argv[])
 {
     Log_Debug("DFU firmware update application\n");
+
+#ifdef CRC32_BENCHMARK
+    Crc32Benchmark();
+#endif
+
     if (InitPeripheralsAndHandlers() != 0) {
         terminationRequired = true;
     }
@@ -215,6 +435,7 @@ int main(int argc, char *argv[])
         }
     }
 
+    ShutdownCoordinator_Drain(&shutdownCoordinator, epollFd);
     ClosePeripheralsAndHandlers();
     Log_Debug("Application exiting\n");
     return 0;
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +16,26 @@
 #include <applibs/log.h>
 #include "mem_buf.h"
 
+// Buffer state and data which are allocated from an arena start at this alignment.
+#define ARENA_ALIGNMENT (_Alignof(max_align_t))
+
+static size_t AlignArenaSize(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+// Moves the current data to the start of the buffer, so that all of the unused
+// space is at the end.
+static void Compact(MemBuf *self)
+{
+    if (self->head == 0) {
+        return;
+    }
+
+    memmove(self->data, &self->data[self->head], self->curSize);
+    self->head = 0;
+}
+
 MemBuf *AllocMemBuf(size_t maxSize)
 {
     uint8_t *data = calloc(maxSize, sizeof(uint8_t));
@@ -30,12 +51,48 @@ MemBuf *AllocMemBuf(size_t maxSize)
 
     self->maxSize = maxSize;
     self->curSize = 0;
+    self->head = 0;
+    self->capacity = maxSize;
+    self->arena = NULL;
     self->data = data;
 
     return self;
 }
 
 void FreeMemBuf(MemBuf *self)
+{
+    // Buffers which were allocated from an arena are freed with the arena.
+    if (!self || self->arena) {
+        return;
+    }
+
+    free(self->data);
+    free(self);
+}
+
+// ---- arena ----
+
+MemArena *AllocMemArena(size_t size)
+{
+    MemArena *self = malloc(sizeof(*self));
+    if (!self) {
+        return NULL;
+    }
+
+    // malloc returns memory which is suitably aligned for any type.
+    self->data = malloc(AlignArenaSize(size));
+    if (!self->data) {
+        free(self);
+        return NULL;
+    }
+
+    self->size = AlignArenaSize(size);
+    self->used = 0;
+
+    return self;
+}
+
+void FreeMemArena(MemArena *self)
 {
     if (!self) {
         return;
@@ -45,12 +102,41 @@ void FreeMemBuf(MemBuf *self)
     free(self);
 }
 
+void MemArenaReset(MemArena *self)
+{
+    self->used = 0;
+}
+
+size_t MemArenaBufSize(size_t capacity)
+{
+    return AlignArenaSize(sizeof(MemBuf)) + AlignArenaSize(capacity);
+}
+
+MemBuf *MemArenaAllocBuf(MemArena *self, size_t capacity)
+{
+    size_t required = MemArenaBufSize(capacity);
+    if (required > self->size - self->used) {
+        return NULL;
+    }
+
+    MemBuf *buf = (MemBuf *)&self->data[self->used];
+    buf->maxSize = capacity;
+    buf->curSize = 0;
+    buf->head = 0;
+    buf->capacity = capacity;
+    buf->arena = self;
+    buf->data = &self->data[self->used + AlignArenaSize(sizeof(MemBuf))];
+
+    self->used += required;
+    return buf;
+}
+
 // ---- window management ----
 
 void MemBufData(const MemBuf *self, uint8_t const **data, size_t *extent)
 {
     if (data) {
-        *data = self->data;
+        *data = &self->data[self->head];
     }
 
     *extent = self->curSize;
@@ -69,16 +155,26 @@ size_t MemBufMaxSize(const MemBuf *self)
 void MemBufReset(MemBuf *self)
 {
     self->curSize = 0;
+    self->head = 0;
 }
 
 bool MemBufResize(MemBuf *self, size_t maxSize)
 {
-    uint8_t *newData = realloc(self->data, maxSize);
-    if (!newData) {
-        return false;
+    if (maxSize > self->capacity) {
+        if (self->arena) {
+            return false;
+        }
+
+        uint8_t *newData = realloc(self->data, maxSize);
+        if (!newData) {
+            return false;
+        }
+
+        self->data = newData;
+        self->capacity = maxSize;
     }
 
-    self->data = newData;
+    Compact(self);
     self->maxSize = maxSize;
     if (self->curSize > self->maxSize) {
         self->curSize = self->maxSize;
@@ -87,13 +183,12 @@ bool MemBufResize(MemBuf *self, size_t maxSize)
     return true;
 }
 
-void MemBufShiftLeft(MemBuf *self, size_t distance)
+void MemBufConsume(MemBuf *self, size_t len)
 {
-    assert(distance <= self->curSize);
+    assert(len <= self->curSize);
 
-    size_t newSize = self->curSize - distance;
-    memmove(self->data, &self->data[distance], newSize);
-    self->curSize = newSize;
+    self->curSize -= len;
+    self->head = (self->curSize == 0) ? 0 : self->head + len;
 }
 
 void MemBufDump(const MemBuf *self, const char *desc)
@@ -116,28 +211,65 @@ void MemBufDump(const MemBuf *self, const char *desc)
 void MemBufWrite8(MemBuf *self, size_t idx, uint8_t val)
 {
     assert(idx < self->curSize);
-    self->data[idx] = val;
+    self->data[self->head + idx] = val;
 }
 
 uint8_t MemBufRead8(const MemBuf *self, size_t idx)
 {
     assert(idx < self->curSize);
-    return self->data[idx];
+    return self->data[self->head + idx];
 }
 
 void MemBufAppend8(MemBuf *self, uint8_t val)
 {
-    assert(self->curSize < self->maxSize);
+    uint8_t *tail = MemBufReserve(self, 1);
+    assert(tail);
 
+    *tail = val;
     ++self->curSize;
-    MemBufWrite8(self, self->curSize - 1, val);
+}
+
+void MemBufAppend(MemBuf *self, const uint8_t *data, size_t len)
+{
+    uint8_t *tail = MemBufReserve(self, len);
+    assert(tail);
+
+    memcpy(tail, data, len);
+    self->curSize += len;
+}
+
+uint8_t *MemBufTail(MemBuf *self, size_t *space)
+{
+    Compact(self);
+    *space = self->maxSize - self->curSize;
+    return &self->data[self->curSize];
+}
+
+uint8_t *MemBufReserve(MemBuf *self, size_t len)
+{
+    if (len > self->maxSize - self->curSize) {
+        return NULL;
+    }
+
+    // Only move the current data if there is not enough space after it.
+    if (len > self->maxSize - self->head - self->curSize) {
+        Compact(self);
+    }
+
+    return &self->data[self->head + self->curSize];
+}
+
+void MemBufCommit(MemBuf *self, size_t len)
+{
+    assert(len <= self->maxSize - self->curSize);
+    self->curSize += len;
 }
 
 uint16_t MemBufReadLe16(const MemBuf *self, size_t offset)
 {
     // Copy to a local value to avoid alignment problems.
     uint16_t value;
-    memcpy(&value, &self->data[offset], sizeof(value));
+    memcpy(&value, &self->data[self->head + offset], sizeof(value));
 
     return le16toh(value);
 }
@@ -146,7 +278,7 @@ uint32_t MemBufReadLe32(const MemBuf *self, size_t offset)
 {
     // Copy to a local value to avoid alignment problems.
     uint32_t value;
-    memcpy(&value, &self->data[offset], sizeof(value));
+    memcpy(&value, &self->data[self->head + offset], sizeof(value));
 
     return le32toh(value);
 }
@@ -7,6 +7,23 @@
 #include <sys/types.h>
 #include <endian.h>
 
+/// <summary>
+/// <para>A fixed region of memory which buffers can be allocated from, so that
+/// a set of buffers needs a single heap allocation.</para>
+/// <para>Buffers which are allocated from an arena are not freed individually.
+/// They are all released when the arena is reset or freed.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Size of the arena in bytes.</summary>
+    size_t size;
+
+    /// <summary>Number of bytes which have been allocated from the arena.</summary>
+    size_t used;
+
+    /// <summary>Start of arena in memory.</summary>
+    uint8_t *data;
+} MemArena;
+
 /// <summary>
 /// <para>An in-memory buffer which is used to store encoded data before it is
 /// written to the UART, and to store decoded data which is read from the
@@ -14,6 +31,8 @@
 /// <para>The buffer's maximum size is set when it is allocated or resized, but
 /// the caller does not have to use the whole buffer.  The buffer will track the
 /// amount of space which is currently used.
+/// <para>Data which is consumed from the start of the buffer is not moved.  The
+/// remaining data is only moved when space is needed at the end of the buffer.</para>
 /// </summary>
 typedef struct {
     /// <summary>Maximum size of buffer in bytes.</summary>
@@ -22,6 +41,19 @@ typedef struct {
     /// <summary>Current size of buffer in bytes.</summary>
     size_t curSize;
 
+    /// <summary>Offset of the current data from the start of the buffer.</summary>
+    size_t head;
+
+    /// <summary>
+    /// Number of bytes which are allocated for the buffer.  This is at least maxSize.
+    /// </summary>
+    size_t capacity;
+
+    /// <summary>
+    /// Arena which the buffer was allocated from, or NULL if it was allocated by AllocMemBuf.
+    /// </summary>
+    MemArena *arena;
+
     /// <summary>Start of buffer in memory.</summary>
     uint8_t *data;
 } MemBuf;
@@ -43,6 +75,49 @@ MemBuf *AllocMemBuf(size_t maxSize);
 /// </summary>
 void FreeMemBuf(MemBuf *self);
 
+/// <summary>
+/// Allocates a new arena.
+/// <param name="size">Size of arena in bytes.  This must include the overhead
+/// which is returned by MemArenaBufSize for each buffer.</param>
+/// <returns>Newly-allocated arena, which must be disposed of with FreeMemArena.
+/// On failure returns NULL.</returns>
+/// </summary>
+MemArena *AllocMemArena(size_t size);
+
+/// <summary>
+/// Frees an arena which was allocated with AllocMemArena, and all of the
+/// buffers which were allocated from it.
+/// <param name="self">Arena which was allocated by AllocMemArena.  It is safe
+/// to call this function with a NULL pointer.</param>
+/// </summary>
+void FreeMemArena(MemArena *self);
+
+/// <summary>
+/// Releases all of the buffers which were allocated from the arena, so that
+/// its memory can be used again.  Those buffers must not be used afterwards.
+/// <param name="self">Arena which was allocated by AllocMemArena.</param>
+/// </summary>
+void MemArenaReset(MemArena *self);
+
+/// <summary>
+/// Gets the number of bytes of arena space which MemArenaAllocBuf uses for a buffer.
+/// <param name="capacity">Largest maximum size of the buffer in bytes.</param>
+/// <returns>Arena space in bytes, including the buffer state.</returns>
+/// </summary>
+size_t MemArenaBufSize(size_t capacity);
+
+/// <summary>
+/// <para>Allocates a buffer from an arena.</para>
+/// <para>On success the buffer is empty and its maximum size is capacity.  It can
+/// be resized with MemBufResize up to capacity.  FreeMemBuf does nothing for this
+/// buffer.</para>
+/// <param name="self">Arena which was allocated by AllocMemArena.</param>
+/// <param name="capacity">Largest maximum size of the buffer in bytes.</param>
+/// <returns>Buffer which is valid until the arena is reset or freed.  If the arena
+/// does not have enough space then returns NULL.</returns>
+/// </summary>
+MemBuf *MemArenaAllocBuf(MemArena *self, size_t capacity);
+
 /// <summary>
 /// Get address and extent of data in buffer.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
@@ -76,7 +151,8 @@ void MemBufReset(MemBuf *self);
 
 /// <summary>
 /// Changes the maximum buffer size.  Any existing data will be
-/// preserved if possible.
+/// preserved if possible.  A buffer which was allocated from an arena
+/// cannot grow beyond the capacity which it was allocated with.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
 /// <param name="maxSize">New maximum size in bytes.</param>
 /// <returns>true if the buffer was resized; false otherwise.  If the
@@ -86,13 +162,13 @@ void MemBufReset(MemBuf *self);
 bool MemBufResize(MemBuf *self, size_t maxSize);
 
 /// <summary>
-/// Discards data at the beginning of the buffer and moves the following
-/// data down.
+/// Discards data at the beginning of the buffer.  The following data
+/// is not moved, so this takes constant time.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
-/// <param name="distance">Number of bytes to discard from the start
+/// <param name="len">Number of bytes to discard from the start
 /// of the buffer.  This must be no greater than the current buffer size.</param>
 /// </summary>
-void MemBufShiftLeft(MemBuf *self, size_t distance);
+void MemBufConsume(MemBuf *self, size_t len);
 
 /// <summary>
 /// Provided for debugging purposes, writes the buffer contents
@@ -130,6 +206,47 @@ uint8_t MemBufRead8(const MemBuf *self, size_t idx);
 /// </summary>
 void MemBufAppend8(MemBuf *self, uint8_t val);
 
+/// <summary>
+/// <para>Append a block of bytes to the end of the buffer.</para>
+/// <para>On exit the current size is increased by len.  It must not
+/// exceed the maximum size.</para>
+/// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
+/// <param name="data">Start of data to append to the buffer.</param>
+/// <param name="len">Length of data in bytes.</param>
+/// </summary>
+void MemBufAppend(MemBuf *self, const uint8_t *data, size_t len);
+
+/// <summary>
+/// <para>Get the unused space at the end of the buffer, so that it can be filled
+/// directly, for example by a call to read().  Call MemBufCommit afterwards to
+/// add the filled bytes to the buffer.</para>
+/// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
+/// <param name="space">Receives the number of unused bytes.</param>
+/// <returns>Start of the unused space.</returns>
+/// </summary>
+uint8_t *MemBufTail(MemBuf *self, size_t *space);
+
+/// <summary>
+/// <para>Reserve space at the end of the buffer, so that it can be filled
+/// directly.  Call MemBufCommit afterwards to add the bytes which were
+/// written to the buffer.</para>
+/// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
+/// <param name="len">Number of bytes to reserve.</param>
+/// <returns>Start of the reserved space, or NULL if the buffer does not
+/// have len unused bytes.</returns>
+/// </summary>
+uint8_t *MemBufReserve(MemBuf *self, size_t len);
+
+/// <summary>
+/// <para>Add bytes which were written into the space returned by MemBufTail
+/// or MemBufReserve to the buffer.</para>
+/// <para>On exit the current size is increased by len.  It must not
+/// exceed the maximum size.</para>
+/// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
+/// <param name="len">Number of bytes which were written.</param>
+/// </summary>
+void MemBufCommit(MemBuf *self, size_t len);
+
 /// <summary>
 /// Read a unsigned little-endian 16-bit value from the buffer.
 /// <param name="self">Buffer which was allocated by AllocMemBuf.</param>
@@ -3,9 +3,13 @@ LICENSE.txt in this directory, and for more background, see the README.md for th
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
+// Define CRC32_BENCHMARK to compile Crc32Benchmark, which main calls at startup.
+//#define CRC32_BENCHMARK
+
 /// <summary>
 /// Calculates the CRC-32 checksum for the supplied data.
 /// <param name="data">Block of data over which to calculate checksum.</param>
@@ -29,3 +33,12 @@ uint32_t CalcCrc32(const uint8_t *data, size_t len);
 /// again, passing in the returned value as the seed.</returns>
 /// <seealso cref="CalcCrc32" />
 uint32_t CalcCrc32WithSeed(const uint8_t *data, size_t len, uint32_t seed);
+
+#ifdef CRC32_BENCHMARK
+/// <summary>
+/// Checks the CRC-32 implementation against the byte-at-a-time reference, and logs
+/// the throughput of both.  This is only compiled if CRC32_BENCHMARK is defined.
+/// </summary>
+/// <returns>true if the results matched the reference; false otherwise.</returns>
+bool Crc32Benchmark(void);
+#endif
@@ -5,12 +5,15 @@ LICENSE.txt in this directory, and for more background, see the README.md for th
 
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "../file_view.h"
 #include "../mem_buf.h"
-#include "../epoll_timerfd_utilities.h"
+#include "../dfu_progress.h"
+#include "epoll_timerfd_utilities.h"
 
 #include "slip.h"
+#include "dfu_uart_protocol.h"
 
 /// <summary>
 /// These opcodes are included in the headers for requests sent to and responses
@@ -127,9 +130,21 @@ typedef enum {
     DfuState_Failed,
 
     /// <summary>Entered after a file has been written to the attached board.
-    /// Launches a timer which gives the board time to consume the file.</summary>
+    /// Waits until the board has restarted after consuming the file.</summary>
     DfuState_PostValidateImage,
 
+    /// <summary>Pings the attached board to find out whether it has restarted after
+    /// activating the file.</summary>
+    DfuState_PostValidateProbe,
+
+    /// <summary>Have received a response to the ping which checks whether the attached
+    /// board has restarted.</summary>
+    DfuState_PostValidateProbeReceivedResponse,
+
+    /// <summary>The attached board did not answer the ping which checks whether it has
+    /// restarted.</summary>
+    DfuState_PostValidateProbeNoResponse,
+
     /// <summary>A short timer is used to give the attached board some time to
     /// go into DFU mode before images can be written. This state is entered
     /// when that timer expires.</summary>
@@ -138,6 +153,17 @@ typedef enum {
     /// <summary>Have received a ping response from the attached board.</summary>
     DfuState_PingReceivedResponse,
 
+    /// <summary>Chooses whether to ask the attached board to use a faster baud rate.</summary>
+    DfuState_NegotiateBaudRate,
+
+    /// <summary>Have received a response to the request to change baud rate.</summary>
+    DfuState_BaudRateReceivedResponse,
+
+    /// <summary>The attached board did not respond correctly at the new baud rate, or
+    /// data written at that rate was corrupted. The attached board is reset so it
+    /// returns to DFU_BOOTLOADER_BAUD_RATE.</summary>
+    DfuState_BaudRateFailed,
+
     /// <summary>Have received a PRN response from the attached board.</summary>
     DfuState_ReceiptNotificationReceivedResponse,
 
@@ -153,6 +179,23 @@ typedef enum {
     /// <summary>Select the next image to update, or abort if no images need updating.</summary>
     DfuState_SelectNextImage,
 
+    /// <summary>
+    /// A worker has calculated the CRC-32 of the current image file, which can be compared
+    /// with the installed version of the image.
+    /// </summary>
+    DfuState_ImageCrcCalculated,
+
+    /// <summary>
+    /// Have asked the attached board to check the installed version of the current image.
+    /// </summary>
+    DfuState_ImageCrcReceivedCreateResponse,
+
+    /// <summary>
+    /// Have received the CRC-32 of the installed version of the current image.  If it
+    /// matches the image file, then the image is not written.
+    /// </summary>
+    DfuState_ImageCrcReceivedCrcResponse,
+
     /// <summary>Start writing the init packet file to the attached board.</summary>
     DfuState_InitPacketStart,
 
@@ -165,6 +208,13 @@ typedef enum {
     /// <summary>Have asked board to begin receiving firmware data.</summary>
     DfuState_FirmwareDoneSelectData,
 
+    /// <summary>
+    /// Move the file view to firmwareWindowOffset and send the window.  If the
+    /// firmware is being downloaded and the window has not arrived yet, this state
+    /// runs again when more data arrives.
+    /// </summary>
+    DfuState_FirmwareMoveWindow,
+
     /// <summary>Have received response to NrfDfuOp_ObjectSelect request.</summary>
     DfuState_SelectReceivedSelectResponse,
 
@@ -177,11 +227,40 @@ typedef enum {
     /// <summary>Have received response to NrfDfuOp_ObjectWrite request.</summary>
     DfuState_FileTransferSentWriteObjectRequest,
 
-    /// <summary>Have received response to NrfDfuOp_CrcGet request.</summary>
+    /// <summary>
+    /// Have received a packet receipt notification while waiting for the number
+    /// of outstanding notifications to fall below MAX_OUTSTANDING_RECEIPTS.
+    /// </summary>
+    DfuState_FileTransferReceivedReceiptNotification,
+
+    /// <summary>
+    /// Have received a checksum response or packet receipt notification which was
+    /// in flight when a mismatch was found, and which is discarded before resending
+    /// the file view.
+    /// </summary>
+    DfuState_FileTransferDiscardedResponse,
+
+    /// <summary>
+    /// Have received response to NrfDfuOp_CrcGet request, or an outstanding packet
+    /// receipt notification which arrived before it.
+    /// </summary>
     DfuState_FileTrnasferReceivedWindowChecksumResponse,
 
     /// <summary>Have received response to NrfDfuOp_ObjectExecute request.</summary>
     DfuState_FileTransferReceivedExecuteResponse,
+
+    /// <summary>
+    /// A response was lost or could not be decoded while the current object was being
+    /// written.  Sends a ping, so that responses which are still in flight can be told
+    /// apart from the one to this ping.
+    /// </summary>
+    DfuState_FileTransferResync,
+
+    /// <summary>
+    /// Have received a response while resynchronizing.  Responses are discarded until the
+    /// one to the ping arrives, and then the file view is sent again.
+    /// </summary>
+    DfuState_FileTransferResyncReceivedResponse,
 } DfuProtocolStates;
 
 /// <summary>
@@ -243,12 +322,255 @@ typedef enum {
     StateTransition_Done
 } StateTransition;
 
+/// <summary>
+/// Maximum number of packet receipt notifications which can be outstanding
+/// during a file transfer.  When this many are outstanding, the state machine
+/// waits for the oldest one before writing more data.
+/// </summary>
+#define MAX_OUTSTANDING_RECEIPTS 4
+
+/// <summary>
+/// Number of firmware version requests which are sent back to back, before their
+/// responses are read.  This is how many images are found per round trip.
+/// </summary>
+#define FIRMWARE_DETAILS_BATCH_SIZE 4
+
+/// <summary>Maximum number of installed images whose details are kept.</summary>
+#define MAX_INSTALLED_IMAGES 16
+
+/// <summary>
+/// Details of an image on the attached board, as reported in response to a
+/// NrfDfuOp_FirmwareVersion request.  The image number is the index in the table.
+/// </summary>
+typedef struct {
+    uint8_t type;
+    uint32_t version;
+    uint32_t size;
+} DfuInstalledImage;
+
+/// <summary>
+/// Vendor object type for a data object which the attached board rebuilds from a patch
+/// against the installed application.  The patch file format is described in
+/// DeltaTool/make_delta.py.
+/// </summary>
+#define DELTA_OBJECT_TYPE 0x81
+
+/// <summary>
+/// Vendor object type for a data object which is sent compressed.  This uses the same
+/// file format as a patch, except that it does not refer to the installed application.
+/// </summary>
+#define COMPRESSED_OBJECT_TYPE 0x82
+
+/// <summary>Identifies a patch file, "NDLT" in little-endian order.</summary>
+#define DELTA_MAGIC 0x544C444E
+
+/// <summary>Version of the patch file format.</summary>
+#define DELTA_FORMAT_VERSION 1
+
+/// <summary>Size of the header at the start of a patch file.</summary>
+#define DELTA_FILE_HEADER_SIZE 24
+
+/// <summary>Size of the header which precedes the patch for each object.</summary>
+#define DELTA_SEGMENT_HEADER_SIZE 12
+
+/// <summary>Largest init packet which the nRF52 bootloader accepts.</summary>
+#define INIT_PACKET_MAX_SIZE 512
+
+/// <summary>
+/// Expected contents of a packet receipt notification.  This is recorded when
+/// the write which triggers the notification is sent.
+/// </summary>
+typedef struct {
+    /// <summary>Total number of bytes which will have been written to the object.</summary>
+    uint32_t offset;
+
+    /// <summary>CRC-32 of all data which will have been written.</summary>
+    uint32_t crc32;
+} DfuReceiptCheckpoint;
+
 /// <summary>
 /// Because the state machine runs asynchronously, it must retain
 /// its state while it is waiting to transition to the next state.
-/// This structure holds that state.
+/// This structure holds that state for one attached board.
 /// </summary>
-struct DeviceTransferState {
+struct DfuTarget {
+    /// <summary>Descriptor used to write to and read from the attached board.</summary>
+    int uartFd;
+
+    /// <summary>GPIO used to reset the attached board.</summary>
+    int resetGpioFd;
+
+    /// <summary>GPIO used to put the attached board into DFU mode.</summary>
+    int dfuGpioFd;
+
+    /// <summary>Descriptor which the UART and timers are registered with.</summary>
+    int epollFd;
+
+    /// <summary>
+    /// Event data for the UART.  UartEvent hands each event to the read or
+    /// write which is waiting for it.
+    /// </summary>
+    EventData uartEventData;
+
+    /// <summary>
+    /// When the state machine completes successfully or otherwise, it calls
+    /// the termination handler which is provided to ProgramImages.
+    /// </summary>
+    DfuResultHandler resultHandler;
+
+    /// <summary>Status which is passed to resultHandler.</summary>
+    DfuResultStatus statusToReturn;
+
+    /// <summary>Packet receipt notification interval to request. See SetPacketReceiptInterval.</summary>
+    uint16_t packetReceiptInterval;
+
+    /// <summary>Time which is added to each response timeout. See SetDfuRetryPolicy.</summary>
+    uint32_t extraTimeoutMs;
+
+    /// <summary>How many times a file view is sent again before the update fails.</summary>
+    unsigned int maxWindowRetries;
+
+    /// <summary>Function which is called with the progress of each image, or NULL. See
+    /// SetDfuProgressHandler.</summary>
+    DfuProgressHandler progressHandler;
+
+    /// <summary>Function which reopens the UART at a different rate. See SetDfuBaudRates.</summary>
+    DfuUartReopenHandler uartReopenHandler;
+
+    /// <summary>Faster baud rates to try, fastest first.</summary>
+    const uint32_t *baudRates;
+
+    /// <summary>Number of rates in baudRates.</summary>
+    size_t baudRateCount;
+
+    /// <summary>Index of the next rate in baudRates to try.  Rates before this one
+    /// have failed, so they are not tried again.</summary>
+    size_t nextBaudRateIndex;
+
+    /// <summary>Rate at which the UART is currently open.</summary>
+    uint32_t baudRate;
+
+    /// <summary>Rate at which the most recent images were written. See GetDfuBaudRate.</summary>
+    uint32_t achievedBaudRate;
+
+    /// <summary>Whether the attached board is using the final rate for this operation.</summary>
+    bool baudRateNegotiated;
+
+    /// <summary>Whether the ping which is in flight checks the link at a new rate.</summary>
+    bool verifyingBaudRate;
+
+    /// <summary>Number of pings left to check whether the attached board has restarted after
+    /// activating an image.</summary>
+    unsigned int postValidateProbesLeft;
+
+    /// <summary>Whether the attached board has stopped answering since the last image was
+    /// executed, which shows that it has reset.</summary>
+    bool postValidateBoardSilent;
+
+    /// <summary>Whether the bootloader answered after activating the previous image, so the
+    /// board does not have to be reset into DFU mode for the next image.</summary>
+    bool bootloaderReady;
+
+    /// <summary>
+    /// Multiple images, e.g. soft device and application, can be written
+    /// to the device.  These fields track which image is being written.
+    /// </summary>
+    DfuImageData *allImages;
+    size_t numberOfImages;
+    size_t nextImageIndex;
+    const DfuImageData *currentImage;
+
+    /// <summary>Image number of the next firmware version response from nRF52.</summary>
+    uint8_t nrfImageIndex;
+
+    /// <summary>Number of firmware version requests whose responses have not arrived.</summary>
+    uint8_t firmwareDetailsOutstanding;
+
+    /// <summary>Whether a response has reported that there are no more images.</summary>
+    bool firmwareDetailsComplete;
+
+    /// <summary>
+    /// Images which the attached board reported, kept between operations on this target
+    /// so that they are not requested again while nothing has been written.
+    /// </summary>
+    DfuInstalledImage installedImages[MAX_INSTALLED_IMAGES];
+    size_t installedImageCount;
+
+    /// <summary>Whether installedImages holds every image on the attached board.</summary>
+    bool hasInstalledImages;
+
+    /// <summary>Size of the current image file, which is compared with the installed image.</summary>
+    uint32_t imageSize;
+
+    /// <summary>CRC-32 of the current image file, which is compared with the installed image.</summary>
+    uint32_t imageCrc32;
+
+    /// <summary>Pool on which the CRC-32 is calculated, or NULL. See SetDfuWorkerPool.</summary>
+    WorkerPool *workerPool;
+
+    /// <summary>Job which calculates imageSize and imageCrc32 on the worker pool.</summary>
+    WorkerPoolJob imageCrcJob;
+
+    /// <summary>Whether imageCrcJob could read the current image file.</summary>
+    bool imageCrcCalculated;
+
+    /// <summary>Whether progress is saved so an interrupted transfer can be resumed.</summary>
+    bool resumeEnabled;
+
+    /// <summary>Mutable storage slot for this target's progress. See EnableDfuResume.</summary>
+    size_t progressSlot;
+
+    /// <summary>Whether savedProgress was loaded when ProgramImages was called.</summary>
+    bool hasSavedProgress;
+
+    /// <summary>Progress of an earlier transfer which was interrupted.</summary>
+    DfuProgress savedProgress;
+
+    /// <summary>
+    /// Whether the init packet for the current image was already on the attached board,
+    /// so the firmware should continue from savedProgress.
+    /// </summary>
+    bool resumingImage;
+
+    /// <summary>Whether the current image is being sent as a patch or compressed.</summary>
+    bool sendingDelta;
+
+    /// <summary>Patch or compressed image which is being sent.</summary>
+    const char *deltaPathname;
+
+    /// <summary>DELTA_OBJECT_TYPE or COMPRESSED_OBJECT_TYPE.</summary>
+    uint8_t deltaObjectType;
+
+    /// <summary>
+    /// Whether the patch or compressed image could not be applied, so the rest of the
+    /// image is sent from the .bin file.
+    /// </summary>
+    bool deltaFailed;
+
+    /// <summary>Whether to stop sending deltaPathname once discarded responses have arrived.</summary>
+    bool abandoningDelta;
+
+    /// <summary>
+    /// Length of the patch for the current object.  The patch follows the segment header
+    /// at the start of the file view window.
+    /// </summary>
+    uint32_t deltaPatchLength;
+
+    /// <summary>Number of image bytes which the current object is rebuilt into.</summary>
+    uint32_t deltaOutputLength;
+
+    /// <summary>Size of the image which the patch or compressed image is rebuilt into.</summary>
+    uint32_t deltaImageSize;
+
+    /// <summary>CRC-32 of the image up to the end of the current object.</summary>
+    uint32_t deltaOutputCrc32;
+
+    /// <summary>Image offset at the start of the current object.</summary>
+    uint32_t deltaObjectOffset;
+
+    /// <summary>CRC-32 of the image up to deltaObjectOffset.</summary>
+    uint32_t deltaObjectCrc32;
+
     /// <summary>
     /// The next state that MoveToNextDfuState will transition to.
     /// This is not the state which was just executed.
@@ -268,6 +590,12 @@ struct DeviceTransferState {
     /// </summary>
     EventData postValidateTimerEventData;
 
+    /// <summary>
+    /// Memory for txBuf, decodedRxBuf, and encodedRxBuf.  It is allocated with the
+    /// target, so that no buffers are allocated while images are written.
+    /// </summary>
+    MemArena *bufArena;
+
     /// <summary>
     /// Holds up to one MTU worth of SLIP-encoded data which will be written
     /// to attached board.
@@ -280,13 +608,23 @@ struct DeviceTransferState {
     /// </summary>
     MemBuf *decodedRxBuf;
 
+    /// <summary>
+    /// Holds up to one MTU worth of SLIP-encoded data which has been read from the
+    /// UART but not yet decoded.  Bytes which follow the end of a packet are kept
+    /// here until the next packet is read.
+    /// </summary>
+    MemBuf *encodedRxBuf;
+
     /// <summary>
     /// Identifier sent with ping request. The state machine verifies that
     /// the ping response contains the same identifier.
     /// </summary>
     uint8_t pingId;
 
-    /// <summary>Packet receipt notification. Always set to zero.</summary>
+    /// <summary>
+    /// Packet receipt notification interval.  The attached board reports the offset
+    /// and CRC-32 after this many writes to an object.  Zero disables notifications.
+    /// </summary>
     uint16_t prn;
 
     /// <summary>Maximum transfer unit size in bytes.</summary>
@@ -299,18 +637,61 @@ struct DeviceTransferState {
     /// </summary>
     uint32_t maxTxSize;
 
+    /// <summary>Offset which was reported in the most recent select response.</summary>
+    uint32_t selectOffset;
+
+    /// <summary>CRC-32 which was reported in the most recent select response.</summary>
+    uint32_t selectCrc32;
+
     /// <summary>CRC-32 of data which has been written so far.</summary>
     uint32_t runningCrc32;
 
+    /// <summary>
+    /// CRC-32 of data which was written before the current file view. This is
+    /// restored if the file view has to be sent again.
+    /// </summary>
+    uint32_t windowStartCrc32;
+
+    /// <summary>How many times the current file view has been sent again.</summary>
+    unsigned int windowRetries;
+
+    /// <summary>How many times any file view has been sent again since ProgramImages was
+    /// called.</summary>
+    unsigned int totalRetries;
+
+    /// <summary>When the firmware transfer of the current image started.</summary>
+    struct timespec transferStartTime;
+
+    /// <summary>Image offset at which the firmware transfer of the current image started.</summary>
+    uint32_t transferStartOffset;
+
+    /// <summary>Size of the firmware of the current image.</summary>
+    uint32_t transferImageSize;
+
+    /// <summary>Most recent request, which determines how long to wait for its response.</summary>
+    NrfDfuOpCode requestOp;
+
+    /// <summary>Object type which the current file view is written to.</summary>
+    uint8_t objectType;
+
     /// <summary>
     /// Provides access to the init packet file or the firmware file, whichever
     /// is currently being transferred.
     ///</summary>
     FileView *fv;
 
+    /// <summary>Offset which DfuState_FirmwareMoveWindow moves the file view to.</summary>
+    off_t firmwareWindowOffset;
+
+    /// <summary>
+    /// Download which the state machine is waiting for data from, or NULL.  The
+    /// current state runs again when more of it arrives.
+    /// </summary>
+    ImageStream *waitingStream;
+
     /// <summary>
-    /// Number of bytes to write in a single operation. This value is chosen so
-    /// that the amount of data will not exceed the MTU size, even after SLIP encoding.
+    /// Number of SLIP-encoded payload bytes which fit in a single write operation
+    /// without exceeding the MTU size.
     /// </summary>
     off_t stepSize;
 
@@ -323,22 +704,54 @@ struct DeviceTransferState {
 
     /// <summary>
     /// How much data from the file view has been written to the attached board.
-    /// This will be the lesser of stepSize and the remaining data in the file view.
+    /// This is the longest run of remaining data in the file view which fits in
+    /// stepSize after SLIP encoding, rounded down to whole flash words unless it
+    /// reaches the end of the file view.
     /// </summary>
     off_t fvFragmentLen;
 
+    /// <summary>
+    /// Number of writes to the current object since the last one which will be
+    /// acknowledged with a packet receipt notification.
+    /// </summary>
+    uint16_t writesSinceReceipt;
+
+    /// <summary>
+    /// Circular buffer of packet receipt notifications which are expected but
+    /// have not yet arrived, oldest first.
+    /// </summary>
+    DfuReceiptCheckpoint receiptCheckpoints[MAX_OUTSTANDING_RECEIPTS];
+
+    /// <summary>Index of the oldest entry in receiptCheckpoints.</summary>
+    size_t receiptHead;
+
+    /// <summary>Number of entries in receiptCheckpoints.</summary>
+    size_t receiptCount;
+
+    /// <summary>Whether a NrfDfuOp_CrcGet request has been sent and not yet answered.</summary>
+    bool checksumRequested;
+
+    /// <summary>Number of in-flight responses to discard before resending the file view.</summary>
+    size_t responsesToDiscard;
+
     /// <summary>How many bytes have been written to the UART.</summary>
     size_t bytesSent;
 
-    /// <summary>How many bytes have been read from the UART.</summary>
+    /// <summary>How many SLIP-encoded bytes of the current packet have been decoded.</summary>
     size_t bytesRead;
 
+    /// <summary>
+    /// Whether a packet has been partly received.  If so, dts.decodedRxBuf, dts.bytesRead,
+    /// and dts.decodeState hold the progress so far.
+    /// </summary>
+    bool rxInProgress;
+
     /// <summary>Whether to launch a read when the write completes successfully.</summary>
     bool readAfterWrite;
 
     /// <summary>
-    /// How the SLIP decoding is progressing. Data is read from the UART one
-    /// byte at a time and so need to keep track of whether in escape sequence.
+    /// How the SLIP decoding is progressing. A packet can arrive over several
+    /// reads from the UART and so need to keep track of whether in escape sequence.
     /// </summary>
     NrfSlipDecodeState decodeState;
 
@@ -3,10 +3,13 @@ done by Microsoft. See the LICENSE.txt in this directory, and for more backgroun
 for this sample. */
 
 #include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include <applibs/log.h>
 #include <applibs/gpio.h>
@@ -16,9 +19,11 @@ for this sample. */
 #define _BSD_SOURCE
 #include <endian.h>
 
-#include "../epoll_timerfd_utilities.h"
+#include "epoll_timerfd_utilities.h"
 #include "../file_view.h"
 #include "../mem_buf.h"
+#include "../dfu_progress.h"
+#include "../init_packet.h"
 
 #include "crc.h"
 #include "slip.h"
@@ -32,156 +37,364 @@ for this sample. */
 #define IMAGE_TYPE_UNKNOWN 255
 
 // Support functions.
-static void LaunchRead(void);
-static void ReadData(EventData *eventData);
-static void LaunchWrite(void);
-static void LaunchWriteThenRead(void);
-static void WriteData(EventData *eventData);
-
-static int StartTimeoutTimer(void);
-static void CancelTimeoutTimer(void);
+static void LaunchRead(DfuTarget *dts);
+static int ReceivePacket(DfuTarget *dts);
+static void ReadData(DfuTarget *dts);
+static void PrefetchWhileWaiting(DfuTarget *dts);
+static void LaunchWrite(DfuTarget *dts);
+static void LaunchWriteThenRead(DfuTarget *dts);
+static void WriteData(DfuTarget *dts);
+static void UartEvent(EventData *eventData);
+
+static int StartTimeoutTimer(DfuTarget *dts);
+static uint32_t GetResponseTimeoutMs(const DfuTarget *dts);
+static DfuProtocolStates GetLinkErrorState(const DfuTarget *dts);
+static void CancelTimeoutTimer(DfuTarget *dts);
 static void TimeoutTimerExpiredEvent(EventData *eventData);
 
-static bool ValidateHeader(NrfDfuOpCode op);
-static bool ValidateAndRemoveHeader(NrfDfuOpCode op);
+static bool ValidateHeader(DfuTarget *dts, NrfDfuOpCode op);
+static bool ValidateAndRemoveHeader(DfuTarget *dts, NrfDfuOpCode op);
 
-static void MoveToNextDfuState(void);
+static void MoveToNextDfuState(DfuTarget *dts);
 
-static void CleanUpStateMachine(void);
+static void CleanUpStateMachine(DfuTarget *dts);
 
-static StateTransition HandleStart(void);
-static void InitTimerExpiredEvent(EventData *eventData);
-static StateTransition HandleInitTimerExpired(void);
-static StateTransition HandlePingReceivedResponse(void);
-static StateTransition HandlePrnReceivedResponse(void);
-static StateTransition HandleMtuReceivedResponse(void);
-static StateTransition HandleGetFirmwareDetails(void);
-static StateTransition HandleFirmwareVersionReceivedResponse(void);
-static StateTransition HandleSelectNextImage(void);
-
-static StateTransition HandleInitPacketStart(void);
-static StateTransition HandleInitPacketDoneSelectCommand(void);
-
-static StateTransition HandleFirmwareStart(void);
-static StateTransition HandleFirmwareDoneSelectData(void);
-
-static StateTransition LaunchSelect(uint8_t objectType, DfuProtocolStates continueState);
-static StateTransition HandleSelectReceivedSelectResponse(void);
+static void StartTransferProgress(DfuTarget *dts, off_t startOffset, off_t imageSize);
+static void ReportTransferProgress(DfuTarget *dts, uint32_t bytesSent);
 
-static StateTransition TransferDataInFileViewWindow(uint8_t objectType,
+static StateTransition HandleStart(DfuTarget *dts);
+static StateTransition ResetIntoDfuMode(DfuTarget *dts);
+static void InitTimerExpiredEvent(EventData *eventData);
+static StateTransition HandleInitTimerExpired(DfuTarget *dts);
+static StateTransition HandlePingReceivedResponse(DfuTarget *dts);
+static StateTransition HandleNegotiateBaudRate(DfuTarget *dts);
+static StateTransition HandleBaudRateReceivedResponse(DfuTarget *dts);
+static StateTransition HandleBaudRateFailed(DfuTarget *dts);
+static bool SwitchUartBaudRate(DfuTarget *dts, uint32_t baudRate);
+static StateTransition HandlePrnReceivedResponse(DfuTarget *dts);
+static StateTransition HandleMtuReceivedResponse(DfuTarget *dts);
+static StateTransition HandleGetFirmwareDetails(DfuTarget *dts);
+static StateTransition HandleFirmwareVersionReceivedResponse(DfuTarget *dts);
+static void ApplyInstalledImages(DfuTarget *dts);
+static StateTransition HandleSelectNextImage(DfuTarget *dts);
+static StateTransition UpdateCurrentImage(DfuTarget *dts);
+static bool LaunchImageCrcCheck(DfuTarget *dts);
+static bool LaunchImageCrcRequest(DfuTarget *dts);
+static void CalcImageCrcJob(WorkerPoolJob *job);
+static void ImageCrcJobCompleted(WorkerPoolJob *job);
+static StateTransition HandleImageCrcCalculated(DfuTarget *dts);
+static bool CalcFileCrc32(const char *pathname, uint32_t *size, uint32_t *crc32);
+static bool CheckInitPacket(const DfuImageData *image, const uint8_t *packet, size_t length);
+static bool CheckPackagedInitPacket(const DfuImageData *image);
+static StateTransition HandleImageCrcReceivedCreateResponse(DfuTarget *dts);
+static StateTransition HandleImageCrcReceivedCrcResponse(DfuTarget *dts);
+
+static StateTransition HandleInitPacketStart(DfuTarget *dts);
+static StateTransition HandleInitPacketDoneSelectCommand(DfuTarget *dts);
+static bool CanResumeCurrentImage(DfuTarget *dts, off_t initPacketSize);
+
+static StateTransition HandleFirmwareStart(DfuTarget *dts);
+static StateTransition HandleFirmwareDoneSelectData(DfuTarget *dts);
+static StateTransition HandleFirmwareMoveWindow(DfuTarget *dts);
+static FileView *OpenImageFileView(const char *pathname, ImageStream *stream, size_t windowSize);
+static bool IsWaitingForStream(const ImageStream *stream);
+static StateTransition WaitForStreamData(DfuTarget *dts, ImageStream *stream);
+static void StreamDataArrived(ImageStream *stream, void *context);
+static bool ShouldSendDelta(const DfuTarget *dts);
+static bool StartDeltaTransfer(DfuTarget *dts, const char *pathname, uint8_t objectType);
+static bool LoadDeltaSegment(DfuTarget *dts, off_t segmentOffset);
+static StateTransition FallBackFromDelta(DfuTarget *dts);
+static uint32_t ReadLe32(const uint8_t *p);
+
+static StateTransition LaunchSelect(DfuTarget *dts, uint8_t objectType, DfuProtocolStates continueState);
+static StateTransition HandleSelectReceivedSelectResponse(DfuTarget *dts);
+
+static StateTransition LaunchCreateObject(DfuTarget *dts);
+static void GetObjectData(DfuTarget *dts, const uint8_t **data, off_t *extent);
+static void GetObjectEnd(DfuTarget *dts, uint32_t *offset, uint32_t *crc32);
+static StateTransition TransferDataInFileViewWindow(DfuTarget *dts, uint8_t objectType,
                                                     DfuProtocolStates continueState);
-static StateTransition HandleFileTransferReceivedCreateResponse(void);
-static StateTransition HandleFileTransferSendNextFragmentFromFileView(void);
-static StateTransition HandleFileTransferSentWriteObjectRequest(void);
-static StateTransition HandleFileTransferReceivedWindowChecksumResponse(void);
-static StateTransition HandleFileTransferReceivedExecuteResponse(void);
-
-static StateTransition HandlePostValidateImage(void);
+static StateTransition HandleFileTransferReceivedCreateResponse(DfuTarget *dts);
+static StateTransition HandleFileTransferSendNextFragmentFromFileView(DfuTarget *dts);
+static StateTransition HandleFileTransferSentWriteObjectRequest(DfuTarget *dts);
+static StateTransition SendNextFragmentOrRequestChecksum(DfuTarget *dts);
+static bool ReadChecksumResponse(DfuTarget *dts, uint32_t *offset, uint32_t *crc32);
+static void AddReceiptCheckpoint(DfuTarget *dts, uint32_t offset, uint32_t crc32);
+static int CheckReceiptNotification(DfuTarget *dts);
+static StateTransition RewindFileViewWindow(DfuTarget *dts);
+static StateTransition AbandonFileViewWindow(DfuTarget *dts);
+static StateTransition DiscardNextResponseOrResend(DfuTarget *dts);
+static StateTransition ResyncFileTransfer(DfuTarget *dts);
+static StateTransition HandleFileTransferResync(DfuTarget *dts);
+static StateTransition HandleFileTransferResyncReceivedResponse(DfuTarget *dts);
+static StateTransition HandleFileTransferReceivedReceiptNotification(DfuTarget *dts);
+static StateTransition HandleFileTransferDiscardedResponse(DfuTarget *dts);
+static StateTransition HandleFileTransferReceivedWindowChecksumResponse(DfuTarget *dts);
+static StateTransition HandleFileTransferReceivedExecuteResponse(DfuTarget *dts);
+
+static StateTransition HandlePostValidateImage(DfuTarget *dts);
+static StateTransition LaunchPostValidateProbe(DfuTarget *dts);
 static void PostValidateTimerExpiredEvent(EventData *eventData);
+static StateTransition HandlePostValidateProbe(DfuTarget *dts);
+static StateTransition HandlePostValidateProbeReceivedResponse(DfuTarget *dts);
+static StateTransition HandlePostValidateProbeNoResponse(DfuTarget *dts);
+static StateTransition FinishPostValidate(DfuTarget *dts, bool bootloaderReady);
+static bool DiscardUartInput(DfuTarget *dts);
 
-static int CreateDisarmedTimer(EventData *eventData);
+static int CreateDisarmedTimer(DfuTarget *dts, EventData *eventData);
 static int LaunchOneShotTimer(int fd, const struct timespec *delay);
 static int CancelTimer(int fd);
 
-// When the state machine completes successfully or otherwise,
-// it calls the termination handler which is provided to ProgramImages.
-static DfuResultHandler resultHandler = NULL;
-static DfuResultStatus statusToReturn = DfuResult_Success;
-
-struct DeviceTransferState dts;
-
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData uartWriteEventData = {.eventHandler = &WriteData};
-static EventData uartReadEventData = {.eventHandler = &ReadData};
-
 // The state machine issues a ping request followed by an
 // MTU request.  The MTU response contains the MTU value.
 // Until this value is available, the buffer must be large
 // enough to read responses from the device.
 static const uint16_t PREAMBLE_MTU_SIZE = 16;
 
-static int nrfUartFd = -1;
-static int gpioResetFd = -1;
-static int gpioDfuFd = -1;
-static int epollFd = -1;
+// Largest MTU which is used, even if the attached board reports a larger one.
+// The buffers are allocated at this size when the target is opened.  The bootloader
+// in this sample reports NRF_DFU_SERIAL_UART_MTU, 507 bytes by default.
+static const uint16_t MAX_MTU_SIZE = 512;
+
+// Unit in which the attached board writes its flash.  File data is sent in multiples of it.
+static const off_t FLASH_WORD_SIZE = 4;
+
+// Default number of writes per packet receipt notification. See SetPacketReceiptInterval.
+static const uint16_t DEFAULT_PACKET_RECEIPT_INTERVAL = 16;
+
+// Default number of times a file view is sent again after a mismatched offset or checksum,
+// or a lost response, before the transfer is abandoned. See SetDfuRetryPolicy.
+static const unsigned int DEFAULT_MAX_WINDOW_RETRIES = 3;
+
+// Time in milliseconds which the attached board is given to act on each type of request
+// before it responds.  The time to send the data which is still in flight is added to
+// this.  Creating an object erases flash, and executing the last object of an image
+// validates the whole image.
+static const uint32_t DEFAULT_RESPONSE_TIME_MS = 250;
+static const uint32_t PING_RESPONSE_TIME_MS = 1000;
+static const uint32_t CREATE_RESPONSE_TIME_MS = 1000;
+static const uint32_t WRITE_RESPONSE_TIME_MS = 500;
+static const uint32_t EXECUTE_RESPONSE_TIME_MS = 5000;
+
+// A ping which checks a new baud rate is answered quickly if the rate works.
+static const uint32_t VERIFY_BAUD_RATE_TIME_MS = 500;
+
+// After an image has been written, the attached board validates it, resets, and activates
+// it before its bootloader answers again.  It is pinged at this interval, and each ping is
+// given this long to be answered, until it is ready or the wait for that type of image
+// has elapsed.  The board is then reset into DFU mode as it is for the first image.
+static const uint32_t POST_VALIDATE_PROBE_INTERVAL_MS = 50;
+static const uint32_t POST_VALIDATE_PROBE_RESPONSE_TIME_MS = 100;
+static const uint32_t POST_VALIDATE_APP_WAIT_MS = 1000;
+static const uint32_t POST_VALIDATE_SOFTDEVICE_WAIT_MS = 5000;
+
+// Object type which the bootloader in this sample uses to change its baud rate.  A create
+// request for this type carries the new rate in place of the object size, and the
+// bootloader switches to that rate after it has sent the response.
+static const uint8_t BAUD_RATE_OBJECT_TYPE = 0x80;
+
+// Object type which the bootloader in this sample uses to report the CRC-32 of an installed
+// image.  A create request carries the image number in the top 8 bits of the object size,
+// and the number of bytes to check in the other 24 bits.  The CRC request then returns
+// that length and the CRC-32 of those bytes.
+static const uint8_t IMAGE_CRC_OBJECT_TYPE = 0x83;
+
+// Largest number of bytes from an installed image which can be checked.
+static const uint32_t MAX_IMAGE_CRC_LENGTH = 0x00FFFFFF;
+
+// How long to wait after changing the rate before the link is checked with a ping.
+static const struct timespec baudRateSettleDuration = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+
+// Gets the target which contains the supplied event data.
+static DfuTarget *EventDataToTarget(EventData *eventData, size_t offsetOfEventData)
+{
+    return (DfuTarget *)((uint8_t *)eventData - offsetOfEventData);
+}
+
+DfuTarget *OpenDfuTarget(int openedUartFd, int openedResetFd, int openedDfuFd, int openedEpollFd)
+{
+    DfuTarget *target = calloc(1, sizeof(*target));
+    if (!target) {
+        Log_Debug("ERROR: Could not allocate DFU target.\n");
+        return NULL;
+    }
+
+    target->bufArena = AllocMemArena(3 * MemArenaBufSize(MAX_MTU_SIZE));
+    if (!target->bufArena) {
+        Log_Debug("ERROR: Could not allocate DFU buffers.\n");
+        free(target);
+        return NULL;
+    }
+
+    target->uartFd = openedUartFd;
+    target->resetGpioFd = openedResetFd;
+    target->dfuGpioFd = openedDfuFd;
+    target->epollFd = openedEpollFd;
+
+    // The UART is registered once per DFU operation for both EPOLLIN and EPOLLOUT,
+    // edge-triggered, and UartEvent hands each event to the read or write which is
+    // waiting for it.
+    target->uartEventData.eventHandler = &UartEvent;
+    target->uartEventData.priority = EventPriority_High;
+
+    target->packetReceiptInterval = DEFAULT_PACKET_RECEIPT_INTERVAL;
+    target->maxWindowRetries = DEFAULT_MAX_WINDOW_RETRIES;
+    target->baudRate = DFU_BOOTLOADER_BAUD_RATE;
+    target->achievedBaudRate = DFU_BOOTLOADER_BAUD_RATE;
+    target->state = DfuState_Start;
+    target->mtu = PREAMBLE_MTU_SIZE;
+    return target;
+}
+
+void CloseDfuTarget(DfuTarget *target)
+{
+    // Stop a download which the state machine is waiting for from calling back into it.
+    if (target->waitingStream) {
+        ImageStreamSetDataHandler(target->waitingStream, NULL, NULL);
+    }
+
+    FreeMemArena(target->bufArena);
+    free(target);
+}
+
+void EnableDfuResume(DfuTarget *target, size_t slot)
+{
+    target->resumeEnabled = true;
+    target->progressSlot = slot;
+}
+
+void SetDfuBaudRates(DfuTarget *target, const uint32_t *baudRates, size_t count,
+                     DfuUartReopenHandler reopenHandler)
+{
+    target->baudRates = baudRates;
+    target->baudRateCount = count;
+    target->nextBaudRateIndex = 0;
+    target->uartReopenHandler = reopenHandler;
+}
+
+uint32_t GetDfuBaudRate(const DfuTarget *target)
+{
+    return target->achievedBaudRate;
+}
+
+void SetPacketReceiptInterval(DfuTarget *target, uint16_t interval)
+{
+    target->packetReceiptInterval = interval;
+}
+
+void SetDfuRetryPolicy(DfuTarget *target, uint32_t extraTimeoutMs, unsigned int maxRetries)
+{
+    target->extraTimeoutMs = extraTimeoutMs;
+    target->maxWindowRetries = maxRetries;
+}
 
-// Multiple images, e.g. soft device and application, can be written
-// to the device.  These variables track which image is being written.
-static size_t nextImageIndex = 0;
-static size_t numberOfImages = 0;
-static DfuImageData *allImages = NULL;
-static const DfuImageData *currentImage = NULL;
+void SetDfuProgressHandler(DfuTarget *target, DfuProgressHandler handler)
+{
+    target->progressHandler = handler;
+}
 
-// Tracks image number requested from nRF52
-static uint8_t nrfImageIndex = 0;
+void SetDfuWorkerPool(DfuTarget *target, WorkerPool *pool)
+{
+    target->workerPool = pool;
+    target->imageCrcJob.jobHandler = CalcImageCrcJob;
+    target->imageCrcJob.completionHandler = ImageCrcJobCompleted;
+    target->imageCrcJob.context = target;
+}
 
-void ProgramImages(DfuImageData *imagesToWrite, size_t imageCount, DfuResultHandler exitHandler)
+void ProgramImages(DfuTarget *target, DfuImageData *imagesToWrite, size_t imageCount,
+                   DfuResultHandler exitHandler)
 {
     assert(exitHandler != NULL);
 
     // Fail if no image was provided.
     if (!imagesToWrite || imageCount == 0) {
         Log_Debug("ERROR:Invalid array of images.\n");
-        exitHandler(DfuResult_Fail);
+        exitHandler(target, DfuResult_Fail);
         return;
     }
 
-    resultHandler = exitHandler;
-    allImages = imagesToWrite;
-    numberOfImages = imageCount;
-    nextImageIndex = 0;
-    nrfImageIndex = 0;
-    for (unsigned int i = 0; i < numberOfImages; ++i) {
-        allImages[i].isInstalled = false;
+    target->resultHandler = exitHandler;
+    target->allImages = imagesToWrite;
+    target->numberOfImages = imageCount;
+    target->nextImageIndex = 0;
+    target->currentImage = NULL;
+    target->nrfImageIndex = 0;
+    target->totalRetries = 0;
+    for (unsigned int i = 0; i < target->numberOfImages; ++i) {
+        target->allImages[i].isInstalled = false;
     }
-    dts.state = DfuState_Start;
-    MoveToNextDfuState();
-}
 
-void InitUartProtocol(int openedUartFd, int openedResetFd, int openedDfuFd, int openedEpollFd)
-{
-    nrfUartFd = openedUartFd;
-    gpioResetFd = openedResetFd;
-    gpioDfuFd = openedDfuFd;
-    epollFd = openedEpollFd;
-    dts.state = DfuState_Start;
-    dts.mtu = PREAMBLE_MTU_SIZE;
+    // Reject a package which the bootloader would reject, before the board is reset.
+    for (size_t i = 0; i < imageCount; ++i) {
+        if (!CheckPackagedInitPacket(&imagesToWrite[i])) {
+            exitHandler(target, DfuResult_Fail);
+            return;
+        }
+    }
+
+    // If a previous update was interrupted, then load how far it got.
+    target->hasSavedProgress =
+        target->resumeEnabled && LoadDfuProgress(target->progressSlot, &target->savedProgress);
+    target->resumingImage = false;
+    target->sendingDelta = false;
+    target->deltaFailed = false;
+    target->abandoningDelta = false;
+
+    target->baudRateNegotiated = false;
+    target->verifyingBaudRate = false;
+    target->bootloaderReady = false;
+
+    target->state = DfuState_Start;
+    MoveToNextDfuState(target);
 }
 
 /// <summary>
-/// Encodes the header and (optionally) the payload.
+/// Encodes a request after those which are already in the TX buffer, so that several
+/// requests are written together.
 /// </summary>
 /// <param name="op">Type of request to send.</param>
 /// <param name="buf">Start of payload data.  Can be NULL.</param>
 /// <param name="len">Length of payload data.  Not used if buf is NULL.</param>
-static void EncodeHeaderAndOptionalPayload(NrfDfuOpCode op, const uint8_t *buf, size_t len)
+static void AppendRequest(DfuTarget *dts, NrfDfuOpCode op, const uint8_t *buf, size_t len)
 {
     // Encode header.
-    MemBufReset(dts.txBuf);
+    dts->requestOp = op;
     uint8_t op8 = (uint8_t)op;
-    SlipEncodeAppend(dts.txBuf, &op8, sizeof(op8));
+    SlipEncodeAppend(dts->txBuf, &op8, sizeof(op8));
 
     // Encode payload if required.
     if (buf) {
-        SlipEncodeAppend(dts.txBuf, buf, len);
+        SlipEncodeAppend(dts->txBuf, buf, len);
     }
-    SlipEncodeAddEndMarker(dts.txBuf);
+    SlipEncodeAddEndMarker(dts->txBuf);
 
 #ifdef DUMP_TX_ENCODED
-    MemBufDump(dts.txBuf, "Slip TX.Wire");
+    MemBufDump(dts->txBuf, "Slip TX.Wire");
 #endif
 }
 
+/// <summary>
+/// Encodes the header and (optionally) the payload.
+/// </summary>
+/// <param name="op">Type of request to send.</param>
+/// <param name="buf">Start of payload data.  Can be NULL.</param>
+/// <param name="len">Length of payload data.  Not used if buf is NULL.</param>
+static void EncodeHeaderAndOptionalPayload(DfuTarget *dts, NrfDfuOpCode op, const uint8_t *buf, size_t len)
+{
+    MemBufReset(dts->txBuf);
+    AppendRequest(dts, op, buf, len);
+}
+
 // Encode a request without a payload.
-static void EncodeHeaderOnly(NrfDfuOpCode op)
+static void EncodeHeaderOnly(DfuTarget *dts, NrfDfuOpCode op)
 {
-    EncodeHeaderAndOptionalPayload(op, NULL, 0);
+    EncodeHeaderAndOptionalPayload(dts, op, NULL, 0);
 }
 
 // Encode a request with a payload.
-static void EncodeHeaderAndPayload(NrfDfuOpCode op, const uint8_t *buf, size_t len)
+static void EncodeHeaderAndPayload(DfuTarget *dts, NrfDfuOpCode op, const uint8_t *buf, size_t len)
 {
-    EncodeHeaderAndOptionalPayload(op, buf, len);
+    EncodeHeaderAndOptionalPayload(dts, op, buf, len);
 }
 
 /// <summary>
@@ -191,21 +404,21 @@ static void EncodeHeaderAndPayload(NrfDfuOpCode op, const uint8_t *buf, size_t l
 /// <param name="op">The response should be for this operation.</param>
 /// <returns>true if the expected header is present, valid, and successful;
 /// false otherwise.</returns>
-static bool ValidateHeader(NrfDfuOpCode op)
+static bool ValidateHeader(DfuTarget *dts, NrfDfuOpCode op)
 {
     // The received data must be at least three bytes long
     // to contain a valid header.
     const uint8_t *data;
     size_t extent;
-    MemBufData(dts.decodedRxBuf, &data, &extent);
+    MemBufData(dts->decodedRxBuf, &data, &extent);
 
     if (extent < 3) {
         return false;
     }
 
-    uint8_t r0 = MemBufRead8(dts.decodedRxBuf, /* idx */ 0);
-    uint8_t r1 = MemBufRead8(dts.decodedRxBuf, /* idx */ 1);
-    uint8_t r2 = MemBufRead8(dts.decodedRxBuf, /* idx */ 2);
+    uint8_t r0 = MemBufRead8(dts->decodedRxBuf, /* idx */ 0);
+    uint8_t r1 = MemBufRead8(dts->decodedRxBuf, /* idx */ 1);
+    uint8_t r2 = MemBufRead8(dts->decodedRxBuf, /* idx */ 2);
 
     bool asExpected = (r0 == NrfDfuOp_Response && r1 == op && r2 == NrfDfuRes_Success);
     if (r2 != NrfDfuRes_Success) {
@@ -216,39 +429,103 @@ static bool ValidateHeader(NrfDfuOpCode op)
 
 /// <summary>
 /// Tests whether the received data contains an expected, successful
-/// header.  If so, it removes the header and shifts the payload down
-// to the start of the buffer.
+/// header.  If so, it removes the header so the payload is at the
+/// start of the buffer.
 /// </summary>
 /// <param name="op">The response should be for this operation.</param>
 /// <returns>true if the expected header is present, valid, and successful;
 /// false otherwise.</returns>
-static bool ValidateAndRemoveHeader(NrfDfuOpCode op)
+static bool ValidateAndRemoveHeader(DfuTarget *dts, NrfDfuOpCode op)
 {
-    if (!ValidateHeader(op)) {
+    if (!ValidateHeader(dts, op)) {
         return false;
     }
 
     // Header is always three bytes.
-    MemBufShiftLeft(dts.decodedRxBuf, 3);
+    MemBufConsume(dts->decodedRxBuf, 3);
     return true;
 }
 
 /// <summary>
-/// <para>Resets the state machine's read buffer and reads a packet from
-/// the device.  The incoming packet will be SLIP-encoded, but is
-/// stored in dts.decodedRxBuf in decoded form.</para>
+/// <para>Reads a packet from the device.  The incoming packet will be
+/// SLIP-encoded, but is stored in dts->decodedRxBuf in decoded form.</para>
 ///
 /// <para>If the read completes successfully, the state machine will advance
-/// to dts.state.  If an error occurs, the state machine will be advanced to
+/// to dts->state.  If an error occurs, the state machine will be advanced to
 /// DfuState_Failed.</para>
 /// </summary>
-static void LaunchRead(void)
+static void LaunchRead(DfuTarget *dts)
+{
+    ReadData(dts);
+}
+
+/// <summary>
+/// <para>Reads and decodes data from the UART until a whole packet has been
+/// received, or until the UART has no more data.  This function never blocks.</para>
+///
+/// <para>A packet which has only been partly received is kept in dts->decodedRxBuf,
+/// and the next call continues to decode it.  A new packet is started after the
+/// previous one has been received.  This function uses the global UART file
+/// descriptor.</para>
+/// </summary>
+/// <returns>1 if a whole packet is in dts->decodedRxBuf; 0 if the UART has no more
+/// data; -1 if an error occurred.</returns>
+static int ReceivePacket(DfuTarget *dts)
 {
-    dts.bytesRead = 0;
-    dts.decodeState = NRF_SLIP_STATE_DECODING;
-    MemBufReset(dts.decodedRxBuf);
+    if (!dts->rxInProgress) {
+        dts->bytesRead = 0;
+        dts->decodeState = NRF_SLIP_STATE_DECODING;
+        MemBufReset(dts->decodedRxBuf);
+        dts->rxInProgress = true;
+    }
+
+    bool finished = false;
+    while (!finished && dts->bytesRead < dts->mtu) {
+        // Refill the receive buffer with as much data as the UART has available.
+        if (MemBufCurSize(dts->encodedRxBuf) == 0) {
+            size_t space;
+            uint8_t *tail = MemBufTail(dts->encodedRxBuf, &space);
+            ssize_t bytesReadOneSysCall = read(dts->uartFd, tail, space);
+
+            // If receive buffer is empty then the rest of the packet has not arrived yet.
+            if ((bytesReadOneSysCall == 0) || (bytesReadOneSysCall < 0 && errno == EAGAIN)) {
+                return 0;
+            }
+
+            // Another error occured so abort the transfer.
+            else if (bytesReadOneSysCall < 0) {
+                dts->rxInProgress = false;
+                return -1;
+            }
+
+            MemBufCommit(dts->encodedRxBuf, (size_t)bytesReadOneSysCall);
+        }
+
+        // Decode buffered data up to the end of the packet. Any bytes which follow
+        // the end of the packet are left in the buffer for the next read.
+        const uint8_t *encoded;
+        size_t extent;
+        MemBufData(dts->encodedRxBuf, &encoded, &extent);
+        if (extent > dts->mtu - dts->bytesRead) {
+            extent = dts->mtu - dts->bytesRead;
+        }
+
+        size_t consumed =
+            SlipDecodeAppend(encoded, extent, dts->decodedRxBuf, &dts->decodeState, &finished);
+        MemBufConsume(dts->encodedRxBuf, consumed);
+        dts->bytesRead += consumed;
+
+        // If the incoming data could not be decoded then abort the transfer.
+        if (dts->decodeState == NRF_SLIP_STATE_CLEARING_INVALID_PACKET) {
+            dts->rxInProgress = false;
+            return -1;
+        }
+    }
 
-    ReadData(NULL);
+    // If received full mtu of bytes and Slip data has not yet
+    // finished, then an error has occured so abort the transfer.
+    dts->rxInProgress = false;
+    return finished ? 1 : -1;
 }
 
 /// <summary>
@@ -258,89 +535,82 @@ static void LaunchRead(void)
 /// when more data becomes available.</para>
 ///
 /// <para>When an entire packet has been successfully read, this function will
-/// advance the state machine to dts.state. If an error occurs, the state machine
-/// will be transitioned to DfuState_Failed. This function uses the global UART file descriptor
-/// as well as the global read event handler structure.</para>
+/// advance the state machine to dts->state. If an error occurs, the state machine
+/// will be transitioned to DfuState_Failed.</para>
 /// </summary>
-static void ReadData(EventData *eventData)
+static void ReadData(DfuTarget *dts)
 {
-    if (dts.epollinEnabled) {
-        CancelTimeoutTimer();
-        UnregisterEventHandlerFromEpoll(epollFd, nrfUartFd);
-        dts.epollinEnabled = false;
+    if (dts->epollinEnabled) {
+        CancelTimeoutTimer(dts);
+        dts->epollinEnabled = false;
     }
 
-    bool finished = false;
-    while (!finished && dts.bytesRead < dts.mtu) {
-        // Read a single byte from the UART and decode it.
-        uint8_t b;
-        ssize_t bytesReadOneSysCall = read(nrfUartFd, &b, 1);
-
-        // Successfully read a single byte.
-        if (bytesReadOneSysCall == 1) {
-            ++dts.bytesRead;
-
-            SlipDecodeAddByte(b, dts.decodedRxBuf, &dts.decodeState, &finished);
-
-            // If the incoming data could not be decoded then abort the transfer.
-            if (dts.decodeState == NRF_SLIP_STATE_CLEARING_INVALID_PACKET) {
-                dts.state = DfuState_Failed;
-                finished = true;
-            }
-        }
+    int result = ReceivePacket(dts);
 
-        // If receive buffer is empty then stay in current state and wait for EPOLLIN.
-        else if ((bytesReadOneSysCall == 0) || (bytesReadOneSysCall < 0 && errno == EAGAIN)) {
-            if (StartTimeoutTimer() == -1) {
-                dts.state = DfuState_Failed;
-                break;
-            }
+    // If the packet has not fully arrived then stay in current state and wait for EPOLLIN.
+    if (result == 0) {
+        PrefetchWhileWaiting(dts);
 
-            // Return rather than transition to next state.
-            RegisterEventHandlerToEpoll(epollFd, nrfUartFd, &uartReadEventData, EPOLLIN);
-            dts.epollinEnabled = true;
+        if (StartTimeoutTimer(dts) == 0) {
+            // Return rather than transition to next state. The UART is already registered
+            // with epoll, so UartEvent will call back when more data arrives.
+            dts->epollinEnabled = true;
             return;
         }
 
-        // Another error occured so abort the transfer.
-        else {
-            dts.state = DfuState_Failed;
-            break;
-        }
+        result = -1;
     }
 
-    // If received full mtu of bytes and Slip data has not yet
-    // finished, then an error has occured so abort the transfer.
-    if (!finished && dts.bytesRead == dts.mtu) {
-        dts.state = DfuState_Failed;
+    // Data which cannot be decoded is handled in the same way as a timeout.
+    if (result == -1) {
+        dts->state = GetLinkErrorState(dts);
     }
 
     // receive finished - move to next DFU state
-    MoveToNextDfuState();
+    MoveToNextDfuState(dts);
 }
 
 /// <summary>
-/// <para>Writes data in dts.txBuf to the attached board.
+/// Called when waiting for a response from the attached board.  If the
+/// response is to the checksum or execute request at the end of a file view
+/// window, then the next window is read from storage while the attached board
+/// processes the request, rather than after the response arrives.
+/// </summary>
+static void PrefetchWhileWaiting(DfuTarget *dts)
+{
+    if (!dts->fv) {
+        return;
+    }
+
+    if (dts->state == DfuState_FileTrnasferReceivedWindowChecksumResponse ||
+        dts->state == DfuState_FileTransferReceivedExecuteResponse) {
+        // On failure, FileViewMoveWindow reads the data when it is needed.
+        FileViewPrefetchNextWindow(dts->fv);
+    }
+}
+
+/// <summary>
+/// <para>Writes data in dts->txBuf to the attached board.
 /// The data must be in SLIP-encoded format.  If data cannot
 /// be immediately written because an underlying buffer is
 /// full this function will return to the epoll event loop,
 /// which will call it again when there is space in the buffer.</para>
 ///
 /// <para>If the write completes successfully, this function
-/// will transition the state machine to dts.state.  If an error
+/// will transition the state machine to dts->state.  If an error
 /// occurs then it will transition the state machine to
 /// DfuState_Failed.</para>
 /// </summary>
-static void LaunchWrite(void)
+static void LaunchWrite(DfuTarget *dts)
 {
-    dts.bytesSent = 0;
-    dts.readAfterWrite = false;
+    dts->bytesSent = 0;
+    dts->readAfterWrite = false;
 
-    WriteData(NULL);
+    WriteData(dts);
 }
 
 /// <summary>
-/// <para>Writes data in dts.txBuf to the attached board.
+/// <para>Writes data in dts->txBuf to the attached board.
 /// The data must be in SLIP-encoded format.  If data cannot
 /// be immediately written because an underlying buffer is
 /// full this function will return to the epoll event loop,
@@ -349,119 +619,210 @@ static void LaunchWrite(void)
 /// <para>If the write completes successfully, this function
 /// will will immediately launch a read.  If the read completes
 /// successfully, then the state machine will be transitioned to
-/// dts.state.  If an error occurs then it will transition the state
+/// dts->state.  If an error occurs then it will transition the state
 /// machine to DfuState_Failed.</para>
 /// </summary>
-static void LaunchWriteThenRead(void)
+static void LaunchWriteThenRead(DfuTarget *dts)
 {
-    dts.bytesSent = 0;
-    dts.readAfterWrite = true;
+    dts->bytesSent = 0;
+    dts->readAfterWrite = true;
 
-    WriteData(NULL);
+    WriteData(dts);
 }
 
 /// <summary>
 ///	This function is called by LaunchWrite or LaunchWriteThenRead to
-/// write data in dts.txBuf.  If it cannot write data because the
+/// write data in dts->txBuf.  If it cannot write data because the
 /// underlying buffer is full, then it will return to the epoll event
 /// handler, which will call it when there is space in the buffer.
-/// This function uses the global UART file descriptor as well as
-/// the global write event handler structure.
+/// This function uses the global UART file descriptor.
 /// </summary>
-static void WriteData(EventData *eventData)
+static void WriteData(DfuTarget *dts)
 {
-    if (dts.epolloutEnabled) {
-        CancelTimeoutTimer();
-        UnregisterEventHandlerFromEpoll(epollFd, nrfUartFd);
-        dts.epolloutEnabled = false;
+    if (dts->epolloutEnabled) {
+        CancelTimeoutTimer(dts);
+        dts->epolloutEnabled = false;
     }
 
     // Continue to fill the UART buffer while there is data remaining
     // and while the buffer is not full.
-    while (dts.bytesSent < MemBufCurSize(dts.txBuf)) {
+    while (dts->bytesSent < MemBufCurSize(dts->txBuf)) {
         const uint8_t *data;
         size_t availBytes;
-        MemBufData(dts.txBuf, &data, &availBytes);
+        MemBufData(dts->txBuf, &data, &availBytes);
 
-        size_t remainingBytes = availBytes - dts.bytesSent;
-        ssize_t bytesSent = write(nrfUartFd, &data[dts.bytesSent], remainingBytes);
+        size_t remainingBytes = availBytes - dts->bytesSent;
+        ssize_t bytesSent = write(dts->uartFd, &data[dts->bytesSent], remainingBytes);
 
         // If actually sent data then stay in the while loop and try
         // to send more data.
         if (bytesSent > 0) {
-            dts.bytesSent += (size_t)bytesSent;
+            dts->bytesSent += (size_t)bytesSent;
         }
 
         // Buffer is full so wait for EPOLLOUT.
         // Return rather than advance state machine to stay in current state.
         else if (bytesSent < 0 && errno == EAGAIN) {
-            if (StartTimeoutTimer() == -1) {
-                dts.state = DfuState_Failed;
+            if (StartTimeoutTimer(dts) == -1) {
+                dts->state = DfuState_Failed;
                 break;
             }
 
-            RegisterEventHandlerToEpoll(epollFd, nrfUartFd, &uartWriteEventData, EPOLLOUT);
-            dts.epolloutEnabled = true;
+            dts->epolloutEnabled = true;
             return;
         }
 
         // Else another error occured so move to invalid state to abort transfer.
         // A return code of zero is interpreted as an error.
         else {
-            dts.state = DfuState_Failed;
+            dts->state = DfuState_Failed;
             break;
         }
     }
 
     // Write completed successfully or otherwise.
-    if (dts.state != DfuState_Failed && dts.readAfterWrite) {
-        LaunchRead();
+    if (dts->state != DfuState_Failed && dts->readAfterWrite) {
+        LaunchRead(dts);
     } else {
-        MoveToNextDfuState();
+        MoveToNextDfuState(dts);
+    }
+}
+
+/// <summary>
+/// Called by the epoll event loop when the UART becomes readable or writable.
+/// The UART is registered edge-triggered, so an event which no operation is
+/// waiting for can be discarded: ReadData and WriteData always start by
+/// accessing the UART until it would block.
+/// </summary>
+static void UartEvent(EventData *eventData)
+{
+    DfuTarget *dts = EventDataToTarget(eventData, offsetof(DfuTarget, uartEventData));
+    uint32_t events = eventData->readyEvents;
+
+    if (dts->epolloutEnabled && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        WriteData(dts);
+    } else if (dts->epollinEnabled && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+        ReadData(dts);
     }
 }
 
-// Start a 5 second timer to identify timeout conditions.
-static int StartTimeoutTimer(void)
+// Start a timer to identify timeout conditions.  See GetResponseTimeoutMs.
+static int StartTimeoutTimer(DfuTarget *dts)
 {
-    static const struct timespec timeoutDuration = {.tv_sec = 5, .tv_nsec = 0};
-    if (LaunchOneShotTimer(dts.timeoutTimerEventData.fd, &timeoutDuration) == -1) {
+    uint32_t timeoutMs = GetResponseTimeoutMs(dts);
+    const struct timespec duration = {.tv_sec = timeoutMs / 1000,
+                                      .tv_nsec = (long)(timeoutMs % 1000) * 1000 * 1000};
+    if (LaunchOneShotTimer(dts->timeoutTimerEventData.fd, &duration) == -1) {
         return -1;
     }
 
     return 0;
 }
 
+/// <summary>
+/// Gets how long to wait for the UART to make progress with the current request.  This is
+/// the time which the attached board is given to act on the request, and twice the time to
+/// send the data which may be ahead of its response at the current baud rate: the rest of
+/// this request, each write which has not been acknowledged, and the response itself.
+/// </summary>
+static uint32_t GetResponseTimeoutMs(const DfuTarget *dts)
+{
+    uint32_t responseTimeMs;
+    if (dts->verifyingBaudRate) {
+        responseTimeMs = VERIFY_BAUD_RATE_TIME_MS;
+    } else if (dts->state == DfuState_PostValidateProbeReceivedResponse) {
+        responseTimeMs = POST_VALIDATE_PROBE_RESPONSE_TIME_MS;
+    } else {
+        switch (dts->requestOp) {
+        case NrfDfuOp_Ping:
+            responseTimeMs = PING_RESPONSE_TIME_MS;
+            break;
+        case NrfDfuOp_ObjectCreate:
+            responseTimeMs = CREATE_RESPONSE_TIME_MS;
+            break;
+        case NrfDfuOp_ObjectWrite:
+            responseTimeMs = WRITE_RESPONSE_TIME_MS;
+            break;
+        case NrfDfuOp_ObjectExecute:
+            responseTimeMs = EXECUTE_RESPONSE_TIME_MS;
+            break;
+        default:
+            responseTimeMs = DEFAULT_RESPONSE_TIME_MS;
+            break;
+        }
+    }
+
+    // Each byte takes ten bit times on the UART.
+    uint32_t packetsInFlight = (uint32_t)dts->receiptCount * dts->prn + 2;
+    uint32_t wireTimeMs =
+        (uint32_t)(((uint64_t)packetsInFlight * dts->mtu * 10 * 1000) / dts->baudRate);
+
+    return responseTimeMs + 2 * wireTimeMs + dts->extraTimeoutMs;
+}
+
+/// <summary>
+/// Gets the state to move to when a response does not arrive in time, or cannot be
+/// decoded.  While an object is being written, the board is resynchronized and the
+/// object is written again.  While waiting for the board to activate an image, no
+/// response means it has not restarted yet.
+/// </summary>
+static DfuProtocolStates GetLinkErrorState(const DfuTarget *dts)
+{
+    // No response at a new rate means the rate does not work.
+    if (dts->verifyingBaudRate) {
+        return DfuState_BaudRateFailed;
+    }
+
+    // The execute request is not repeated, because the board may already have acted on it.
+    switch (dts->state) {
+    case DfuState_FileTransferReceivedCreateResponse:
+    case DfuState_FileTransferSentWriteObjectRequest:
+    case DfuState_FileTransferReceivedReceiptNotification:
+    case DfuState_FileTransferDiscardedResponse:
+    case DfuState_FileTrnasferReceivedWindowChecksumResponse:
+    case DfuState_FileTransferResyncReceivedResponse:
+        return DfuState_FileTransferResync;
+
+    case DfuState_PostValidateProbeReceivedResponse:
+        return DfuState_PostValidateProbeNoResponse;
+
+    default:
+        return DfuState_Failed;
+    }
+}
+
 // Called when a read or write has occurred.
-static void CancelTimeoutTimer(void)
+static void CancelTimeoutTimer(DfuTarget *dts)
 {
-    CancelTimer(dts.timeoutTimerEventData.fd);
+    CancelTimer(dts->timeoutTimerEventData.fd);
 }
 
 static void TimeoutTimerExpiredEvent(EventData *eventData)
 {
-    ConsumeTimerFdEvent(dts.timeoutTimerEventData.fd);
+    DfuTarget *dts = EventDataToTarget(eventData, offsetof(DfuTarget, timeoutTimerEventData));
 
-    // Don't get notified if pending read or write completes after
-    // this timer has expired.
-    if (dts.epollinEnabled || dts.epolloutEnabled) {
-        UnregisterEventHandlerFromEpoll(epollFd, nrfUartFd);
-        dts.epollinEnabled = false;
-        dts.epolloutEnabled = false;
-    }
+    ConsumeTimerFdEvent(dts->timeoutTimerEventData.fd);
+
+    // Ignore the pending read or write if it completes after this timer has expired.
+    dts->epollinEnabled = false;
+    dts->epolloutEnabled = false;
 
-    dts.state = DfuState_Failed;
+    dts->state = GetLinkErrorState(dts);
+    if (dts->state == DfuState_FileTransferResync) {
+        Log_Debug("WARNING: Timed out waiting for board.\n");
+    } else if (dts->state == DfuState_Failed) {
+        Log_Debug("ERROR: Could not communicate with board.  Operation timed out.\n");
+    }
 
-    Log_Debug("ERROR: Could not communicate with board.  Operation timed out.\n");
-    MoveToNextDfuState();
+    MoveToNextDfuState(dts);
 }
 
 /// <summary>
-/// Calls the state handler for dts.state.  This may launch a read,
+/// Calls the state handler for dts->state.  This may launch a read,
 /// write, or read-then-write; cause an immediate transition; indicate
 /// a failure; or indicate a successful termination.
 /// </summary>
-static void MoveToNextDfuState(void)
+static void MoveToNextDfuState(DfuTarget *dts)
 {
     StateTransition sttr;
 
@@ -472,101 +833,161 @@ static void MoveToNextDfuState(void)
     bool done = false;
 
     do {
-        switch (dts.state) {
+        switch (dts->state) {
             // Preamble.
         case DfuState_Start:
-            sttr = HandleStart();
+            sttr = HandleStart(dts);
             break;
 
         case DfuState_InitTimerExpired:
-            sttr = HandleInitTimerExpired();
+            sttr = HandleInitTimerExpired(dts);
             break;
 
         case DfuState_PingReceivedResponse:
-            sttr = HandlePingReceivedResponse();
+            sttr = HandlePingReceivedResponse(dts);
+            break;
+
+        case DfuState_NegotiateBaudRate:
+            sttr = HandleNegotiateBaudRate(dts);
+            break;
+
+        case DfuState_BaudRateReceivedResponse:
+            sttr = HandleBaudRateReceivedResponse(dts);
+            break;
+
+        case DfuState_BaudRateFailed:
+            sttr = HandleBaudRateFailed(dts);
             break;
 
         case DfuState_ReceiptNotificationReceivedResponse:
-            sttr = HandlePrnReceivedResponse();
+            sttr = HandlePrnReceivedResponse(dts);
             break;
 
         case DfuState_MtuReceivedResponse:
-            sttr = HandleMtuReceivedResponse();
+            sttr = HandleMtuReceivedResponse(dts);
             break;
 
         case DfuState_GetFirmwareDetails:
-            sttr = HandleGetFirmwareDetails();
+            sttr = HandleGetFirmwareDetails(dts);
             break;
 
         case DfuState_FirmwareVersionReceivedResponse:
-            sttr = HandleFirmwareVersionReceivedResponse();
+            sttr = HandleFirmwareVersionReceivedResponse(dts);
             break;
 
         case DfuState_SelectNextImage:
-            sttr = HandleSelectNextImage();
+            sttr = HandleSelectNextImage(dts);
+            break;
+
+        case DfuState_ImageCrcCalculated:
+            sttr = HandleImageCrcCalculated(dts);
+            break;
+
+        case DfuState_ImageCrcReceivedCreateResponse:
+            sttr = HandleImageCrcReceivedCreateResponse(dts);
+            break;
+
+        case DfuState_ImageCrcReceivedCrcResponse:
+            sttr = HandleImageCrcReceivedCrcResponse(dts);
             break;
 
             // Init packet (.DAT) transfer.
         case DfuState_InitPacketStart:
-            sttr = HandleInitPacketStart();
+            sttr = HandleInitPacketStart(dts);
             break;
 
         case DfuState_InitPacketDoneSelectCommand:
-            sttr = HandleInitPacketDoneSelectCommand();
+            sttr = HandleInitPacketDoneSelectCommand(dts);
             break;
 
             // Firmware (.BIN) transfer.
         case DfuState_FirmwareStart:
-            sttr = HandleFirmwareStart();
+            sttr = HandleFirmwareStart(dts);
             break;
 
         case DfuState_FirmwareDoneSelectData:
-            sttr = HandleFirmwareDoneSelectData();
+            sttr = HandleFirmwareDoneSelectData(dts);
+            break;
+
+        case DfuState_FirmwareMoveWindow:
+            sttr = HandleFirmwareMoveWindow(dts);
             break;
 
             // File transfer states common to .BIN and.DAT.
         case DfuState_FileTransferReceivedCreateResponse:
-            sttr = HandleFileTransferReceivedCreateResponse();
+            sttr = HandleFileTransferReceivedCreateResponse(dts);
             break;
 
         case DfuState_FileTransferSendNextFragmentFromFileView:
-            sttr = HandleFileTransferSendNextFragmentFromFileView();
+            sttr = HandleFileTransferSendNextFragmentFromFileView(dts);
             break;
 
         case DfuState_FileTransferSentWriteObjectRequest:
-            sttr = HandleFileTransferSentWriteObjectRequest();
+            sttr = HandleFileTransferSentWriteObjectRequest(dts);
+            break;
+
+        case DfuState_FileTransferReceivedReceiptNotification:
+            sttr = HandleFileTransferReceivedReceiptNotification(dts);
+            break;
+
+        case DfuState_FileTransferDiscardedResponse:
+            sttr = HandleFileTransferDiscardedResponse(dts);
             break;
 
         case DfuState_FileTrnasferReceivedWindowChecksumResponse:
-            sttr = HandleFileTransferReceivedWindowChecksumResponse();
+            sttr = HandleFileTransferReceivedWindowChecksumResponse(dts);
             break;
 
         case DfuState_FileTransferReceivedExecuteResponse:
-            sttr = HandleFileTransferReceivedExecuteResponse();
+            sttr = HandleFileTransferReceivedExecuteResponse(dts);
+            break;
+
+        case DfuState_FileTransferResync:
+            sttr = HandleFileTransferResync(dts);
+            break;
+
+        case DfuState_FileTransferResyncReceivedResponse:
+            sttr = HandleFileTransferResyncReceivedResponse(dts);
             break;
 
             // Select command used by both transfers.
         case DfuState_SelectReceivedSelectResponse:
-            sttr = HandleSelectReceivedSelectResponse();
+            sttr = HandleSelectReceivedSelectResponse(dts);
             break;
 
         case DfuState_PostValidateImage:
-            sttr = HandlePostValidateImage();
+            sttr = HandlePostValidateImage(dts);
+            break;
+
+        case DfuState_PostValidateProbe:
+            sttr = HandlePostValidateProbe(dts);
+            break;
+
+        case DfuState_PostValidateProbeReceivedResponse:
+            sttr = HandlePostValidateProbeReceivedResponse(dts);
+            break;
+
+        case DfuState_PostValidateProbeNoResponse:
+            sttr = HandlePostValidateProbeNoResponse(dts);
             break;
 
             // Terminal states.
         case DfuState_Success:
-            statusToReturn = DfuResult_Success;
+            dts->achievedBaudRate = dts->baudRate;
+            if (dts->resumeEnabled) {
+                ClearDfuProgress(dts->progressSlot);
+            }
+            dts->statusToReturn = DfuResult_Success;
             sttr = StateTransition_Done;
             break;
 
         case DfuState_Failed:
-            statusToReturn = DfuResult_Fail;
+            dts->statusToReturn = DfuResult_Fail;
             sttr = StateTransition_Done;
             break;
 
         default:
-            Log_Debug("Unrecognized state %d\n", dts.state);
+            Log_Debug("Unrecognized state %d\n", dts->state);
             sttr = StateTransition_Done;
             assert(false);
             break;
@@ -576,22 +997,22 @@ static void MoveToNextDfuState(void)
         // or leave the state machine.
         switch (sttr) {
         case StateTransition_LaunchRead:
-            LaunchRead();
+            LaunchRead(dts);
             done = true;
             break;
 
         case StateTransition_LaunchWrite:
-            LaunchWrite();
+            LaunchWrite(dts);
             done = true;
             break;
 
         case StateTransition_LaunchWriteThenRead:
-            LaunchWriteThenRead();
+            LaunchWriteThenRead(dts);
             done = true;
             break;
 
         case StateTransition_Failed:
-            dts.state = DfuState_Failed;
+            dts->state = DfuState_Failed;
             break;
 
         case StateTransition_MoveImmediately:
@@ -602,12 +1023,12 @@ static void MoveToNextDfuState(void)
             break;
 
         case StateTransition_Done:
-            CleanUpStateMachine();
+            CleanUpStateMachine(dts);
             // Exit DFU mode and restart the available firmware
-            GPIO_SetValue(gpioDfuFd, GPIO_Value_High);
-            GPIO_SetValue(gpioResetFd, GPIO_Value_Low);
-            GPIO_SetValue(gpioResetFd, GPIO_Value_High);
-            resultHandler(statusToReturn);
+            GPIO_SetValue(dts->dfuGpioFd, GPIO_Value_High);
+            GPIO_SetValue(dts->resetGpioFd, GPIO_Value_Low);
+            GPIO_SetValue(dts->resetGpioFd, GPIO_Value_High);
+            dts->resultHandler(dts, dts->statusToReturn);
             done = true;
             return;
 
@@ -623,100 +1044,141 @@ static void MoveToNextDfuState(void)
 /// Clean up any resources which were successfully allocated
 /// by the state machine.
 /// </summary>
-static void CleanUpStateMachine(void)
+static void CleanUpStateMachine(DfuTarget *dts)
 {
-    if (dts.initTimerEventData.fd != -1) {
-        UnregisterEventHandlerFromEpoll(epollFd, dts.initTimerEventData.fd);
-        CloseFdAndPrintError(dts.initTimerEventData.fd, "initTimer");
-        dts.initTimerEventData.fd = -1;
+    UnregisterPersistentEventHandlerFromEpoll(dts->epollFd, &dts->uartEventData);
+
+    // The attached board is reset when the state machine finishes, and so returns to
+    // the bootloader's rate.
+    dts->verifyingBaudRate = false;
+    if (dts->baudRate != DFU_BOOTLOADER_BAUD_RATE) {
+        int fd = dts->uartReopenHandler(dts, DFU_BOOTLOADER_BAUD_RATE);
+        if (fd != -1) {
+            dts->uartFd = fd;
+            dts->baudRate = DFU_BOOTLOADER_BAUD_RATE;
+        }
+    }
+
+    if (dts->initTimerEventData.fd != -1) {
+        UnregisterPersistentEventHandlerFromEpoll(dts->epollFd, &dts->initTimerEventData);
+        CloseFdAndPrintError(dts->initTimerEventData.fd, "initTimer");
+        dts->initTimerEventData.fd = -1;
     }
 
-    if (dts.postValidateTimerEventData.fd != -1) {
-        UnregisterEventHandlerFromEpoll(epollFd, dts.postValidateTimerEventData.fd);
-        CloseFdAndPrintError(dts.postValidateTimerEventData.fd, "postValidateTimer");
-        dts.postValidateTimerEventData.fd = -1;
+    if (dts->postValidateTimerEventData.fd != -1) {
+        UnregisterPersistentEventHandlerFromEpoll(dts->epollFd, &dts->postValidateTimerEventData);
+        CloseFdAndPrintError(dts->postValidateTimerEventData.fd, "postValidateTimer");
+        dts->postValidateTimerEventData.fd = -1;
     }
 
-    if (dts.timeoutTimerEventData.fd != -1) {
-        UnregisterEventHandlerFromEpoll(epollFd, dts.timeoutTimerEventData.fd);
-        CloseFdAndPrintError(dts.timeoutTimerEventData.fd, "timeoutTimer");
-        dts.timeoutTimerEventData.fd = -1;
+    if (dts->timeoutTimerEventData.fd != -1) {
+        UnregisterPersistentEventHandlerFromEpoll(dts->epollFd, &dts->timeoutTimerEventData);
+        CloseFdAndPrintError(dts->timeoutTimerEventData.fd, "timeoutTimer");
+        dts->timeoutTimerEventData.fd = -1;
     }
 
-    CloseFileView(dts.fv);
-    dts.fv = NULL;
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
 
-    FreeMemBuf(dts.txBuf);
-    dts.txBuf = NULL;
+    if (dts->waitingStream) {
+        ImageStreamSetDataHandler(dts->waitingStream, NULL, NULL);
+        dts->waitingStream = NULL;
+    }
 
-    FreeMemBuf(dts.decodedRxBuf);
-    dts.decodedRxBuf = NULL;
+    // The buffers are kept in the target's arena for the next operation.
+    dts->txBuf = NULL;
+    dts->decodedRxBuf = NULL;
+    dts->encodedRxBuf = NULL;
 }
 
 // Called on DfuState_Start.
 //
 /// Allocates resources required to send images and puts attached
 /// nRF52 board into DFU mode.
-static StateTransition HandleStart(void)
+static StateTransition HandleStart(DfuTarget *dts)
 {
     // Mark resources as unused so they can be safely cleaned up if an
     // error occurs before they are all initialized.
-    dts.txBuf = NULL;
-    dts.decodedRxBuf = NULL;
-    dts.fv = NULL;
-
-    dts.initTimerEventData.eventHandler = &InitTimerExpiredEvent;
-    dts.initTimerEventData.fd = -1;
-
-    dts.postValidateTimerEventData.eventHandler = &PostValidateTimerExpiredEvent;
-    dts.postValidateTimerEventData.fd = -1;
-
-    dts.timeoutTimerEventData.eventHandler = &TimeoutTimerExpiredEvent;
-    dts.timeoutTimerEventData.fd = -1;
-
-    dts.epollinEnabled = false;
-    dts.epolloutEnabled = false;
+    dts->txBuf = NULL;
+    dts->decodedRxBuf = NULL;
+    dts->encodedRxBuf = NULL;
+    dts->rxInProgress = false;
+    dts->fv = NULL;
+
+    dts->initTimerEventData.eventHandler = &InitTimerExpiredEvent;
+    dts->initTimerEventData.fd = -1;
+
+    dts->postValidateTimerEventData.eventHandler = &PostValidateTimerExpiredEvent;
+    dts->postValidateTimerEventData.fd = -1;
+
+    dts->timeoutTimerEventData.eventHandler = &TimeoutTimerExpiredEvent;
+    dts->timeoutTimerEventData.fd = -1;
+    dts->timeoutTimerEventData.priority = EventPriority_High;
+
+    dts->epollinEnabled = false;
+    dts->epolloutEnabled = false;
+
+    // The buffers are allocated from the target's arena.  These sizes are large
+    // enough to send the ping and request the MTU size.  They will be adjusted
+    // once the actual MTU size has been retrieved from the device.
+    MemArenaReset(dts->bufArena);
+    dts->txBuf = MemArenaAllocBuf(dts->bufArena, MAX_MTU_SIZE);
+    dts->decodedRxBuf = MemArenaAllocBuf(dts->bufArena, MAX_MTU_SIZE);
+    dts->encodedRxBuf = MemArenaAllocBuf(dts->bufArena, MAX_MTU_SIZE);
+    if (!dts->txBuf || !dts->decodedRxBuf || !dts->encodedRxBuf) {
+        return StateTransition_Failed;
+    }
 
-    // These buffer sizes are large enough to send the ping
-    // and request the MTU size.  They will be adjusted once the
-    // actual MTU size has been retrieved from the device.
-    dts.txBuf = AllocMemBuf(PREAMBLE_MTU_SIZE);
+    MemBufResize(dts->txBuf, PREAMBLE_MTU_SIZE);
+    MemBufResize(dts->decodedRxBuf, PREAMBLE_MTU_SIZE);
+    MemBufResize(dts->encodedRxBuf, PREAMBLE_MTU_SIZE);
 
-    if (!dts.txBuf) {
+    // Create all of the required timers in disarmed state.
+    dts->initTimerEventData.fd = CreateDisarmedTimer(dts, &dts->initTimerEventData);
+    if (dts->initTimerEventData.fd == -1) {
         return StateTransition_Failed;
     }
 
-    dts.decodedRxBuf = AllocMemBuf(PREAMBLE_MTU_SIZE);
-    if (!dts.decodedRxBuf) {
+    dts->postValidateTimerEventData.fd = CreateDisarmedTimer(dts, &dts->postValidateTimerEventData);
+    if (dts->postValidateTimerEventData.fd == -1) {
         return StateTransition_Failed;
     }
 
-    // Create all of the required timers in disarmed state.
-    dts.initTimerEventData.fd = CreateDisarmedTimer(&dts.initTimerEventData);
-    if (dts.initTimerEventData.fd == -1) {
+    dts->timeoutTimerEventData.fd = CreateDisarmedTimer(dts, &dts->timeoutTimerEventData);
+    if (dts->timeoutTimerEventData.fd == -1) {
         return StateTransition_Failed;
     }
 
-    dts.postValidateTimerEventData.fd = CreateDisarmedTimer(&dts.postValidateTimerEventData);
-    if (dts.postValidateTimerEventData.fd == -1) {
+    // Register the UART for both directions for the rest of the operation, so
+    // partial reads and writes do not have to add and remove it from epoll.
+    if (RegisterPersistentEventHandlerToEpoll(dts->epollFd, dts->uartFd, &dts->uartEventData,
+                                              EPOLLIN | EPOLLOUT) == -1) {
         return StateTransition_Failed;
     }
 
-    dts.timeoutTimerEventData.fd = CreateDisarmedTimer(&dts.timeoutTimerEventData);
-    if (dts.timeoutTimerEventData.fd == -1) {
-        return StateTransition_Failed;
+    dts->pingId = 1;
+
+    // The bootloader already answered after activating the previous image.
+    if (dts->bootloaderReady) {
+        dts->bootloaderReady = false;
+        dts->state = DfuState_NegotiateBaudRate;
+        return StateTransition_MoveImmediately;
     }
 
-    dts.pingId = 1;
+    return ResetIntoDfuMode(dts);
+}
 
+// Resets the nRF52 into DFU mode, and waits for its bootloader to start.
+static StateTransition ResetIntoDfuMode(DfuTarget *dts)
+{
     // Put the nRF52 into DFU mode.
-    GPIO_SetValue(gpioResetFd, GPIO_Value_Low);
-    GPIO_SetValue(gpioDfuFd, GPIO_Value_Low);
-    GPIO_SetValue(gpioResetFd, GPIO_Value_High);
+    GPIO_SetValue(dts->resetGpioFd, GPIO_Value_Low);
+    GPIO_SetValue(dts->dfuGpioFd, GPIO_Value_Low);
+    GPIO_SetValue(dts->resetGpioFd, GPIO_Value_High);
 
     // Wait one second for nRF52 to go into DFU mode.
     static const struct timespec initTimerDuration = {.tv_sec = 1, .tv_nsec = 0};
-    if (LaunchOneShotTimer(dts.initTimerEventData.fd, &initTimerDuration) == -1) {
+    if (LaunchOneShotTimer(dts->initTimerEventData.fd, &initTimerDuration) == -1) {
         return StateTransition_Failed;
     }
 
@@ -728,98 +1190,219 @@ static StateTransition HandleStart(void)
 // Consumes one-shot timer event but does not close the timer.
 static void InitTimerExpiredEvent(EventData *eventData)
 {
-    bool consumed = (ConsumeTimerFdEvent(dts.initTimerEventData.fd) == 0);
-    dts.state = consumed ? DfuState_InitTimerExpired : DfuState_Failed;
+    DfuTarget *dts = EventDataToTarget(eventData, offsetof(DfuTarget, initTimerEventData));
+
+    bool consumed = (ConsumeTimerFdEvent(dts->initTimerEventData.fd) == 0);
+    dts->state = consumed ? DfuState_InitTimerExpired : DfuState_Failed;
 
-    MoveToNextDfuState();
+    MoveToNextDfuState(dts);
 }
 
 // Called on DfuState_InitTimerExpired.
-static StateTransition HandleInitTimerExpired(void)
+static StateTransition HandleInitTimerExpired(DfuTarget *dts)
 {
     // At this point the nRF52 should not be sending any data so
     // clear any previously-sent data from the OS receive buffer.
+    if (!DiscardUartInput(dts)) {
+        return StateTransition_Failed;
+    }
 
-    bool cleared = false;
-    do {
-        uint8_t b;
-        int r = read(nrfUartFd, &b, 1);
+    // Send the ping command.
+    ++dts->pingId;
+    EncodeHeaderAndPayload(dts, NrfDfuOp_Ping, &dts->pingId, 1);
 
-        // If a read error occurred then abort.
-        if (r < 0) {
-            return StateTransition_Failed;
-        }
+    dts->state = DfuState_PingReceivedResponse;
+    return StateTransition_LaunchWriteThenRead;
+}
 
-        // If no data was read then have exhausted the OS receive
-        // buffer so stop reading from the UART.
-        else if (r == 0) {
-            cleared = true;
+// Called on DfuState_PingReceivedResponse.
+static StateTransition HandlePingReceivedResponse(DfuTarget *dts)
+{
+    // Payload should contain a one-byte ping id, which is equal to the ping id that was sent.
+    bool validResponse = ValidateAndRemoveHeader(dts, NrfDfuOp_Ping) &&
+                         MemBufCurSize(dts->decodedRxBuf) == 1 &&
+                         MemBufRead8(dts->decodedRxBuf, /* idx */ 0) == dts->pingId;
+
+    if (dts->verifyingBaudRate) {
+        dts->verifyingBaudRate = false;
+        if (!validResponse) {
+            dts->state = DfuState_BaudRateFailed;
+            return StateTransition_MoveImmediately;
         }
 
-        // Else a byte was read from the buffer, so iterate again.
-    } while (!cleared);
+        Log_Debug("Communicating with board at %" PRIu32 " baud.\n", dts->baudRate);
+        dts->baudRateNegotiated = true;
+    }
 
-    // Send the ping command.
-    ++dts.pingId;
-    EncodeHeaderAndPayload(NrfDfuOp_Ping, &dts.pingId, 1);
+    if (!validResponse) {
+        return StateTransition_Failed;
+    }
+
+    dts->state = DfuState_NegotiateBaudRate;
+    return StateTransition_MoveImmediately;
+}
+
+// Called on DfuState_NegotiateBaudRate.
+static StateTransition HandleNegotiateBaudRate(DfuTarget *dts)
+{
+    // Ask the bootloader to switch to the fastest rate which has not yet failed.
+    if (!dts->baudRateNegotiated && dts->uartReopenHandler &&
+        dts->nextBaudRateIndex < dts->baudRateCount &&
+        dts->baudRates[dts->nextBaudRateIndex] > DFU_BOOTLOADER_BAUD_RATE) {
+        uint8_t buf[5];
+        buf[0] = BAUD_RATE_OBJECT_TYPE;
+        uint32_t baudRateLe = htole32(dts->baudRates[dts->nextBaudRateIndex]);
+        memcpy(&buf[1], &baudRateLe, sizeof(baudRateLe));
+        EncodeHeaderAndPayload(dts, NrfDfuOp_ObjectCreate, buf, sizeof(buf));
+
+        dts->state = DfuState_BaudRateReceivedResponse;
+        return StateTransition_LaunchWriteThenRead;
+    }
+    dts->baudRateNegotiated = true;
 
-    dts.state = DfuState_PingReceivedResponse;
+    // Send the packet receipt notification (PRN) interval.
+    dts->prn = dts->packetReceiptInterval;
+    uint16_t sendPrn = htole16(dts->prn);
+    EncodeHeaderAndPayload(dts, NrfDfuOp_ReceiptNotificationSet, (const uint8_t *)&sendPrn, 2);
+
+    dts->state = DfuState_ReceiptNotificationReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
-// Called on DfuState_PingReceivedResponse.
-static StateTransition HandlePingReceivedResponse(void)
+// Called on DfuState_BaudRateReceivedResponse.
+static StateTransition HandleBaudRateReceivedResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_Ping)) {
+    uint32_t requestedRate = dts->baudRates[dts->nextBaudRateIndex];
+
+    if (!ValidateHeader(dts, NrfDfuOp_ObjectCreate)) {
+        // A bootloader which cannot change rate rejects the object type, so do not try
+        // any other rates.  Otherwise try the next rate.
+        if (MemBufCurSize(dts->decodedRxBuf) >= 3 &&
+            MemBufRead8(dts->decodedRxBuf, /* idx */ 2) == NrfDfuRes_InvalidObject) {
+            Log_Debug("Bootloader does not support changing baud rate.\n");
+            dts->nextBaudRateIndex = dts->baudRateCount;
+        } else {
+            Log_Debug("Bootloader does not support %" PRIu32 " baud.\n", requestedRate);
+            ++dts->nextBaudRateIndex;
+        }
+
+        dts->state = DfuState_NegotiateBaudRate;
+        return StateTransition_MoveImmediately;
+    }
+
+    // The bootloader has switched rate after sending the response, so follow it, and
+    // check that the link works with a ping once the UART has settled.
+    if (!SwitchUartBaudRate(dts, requestedRate)) {
         return StateTransition_Failed;
     }
 
-    // Payload should contain a one-byte ping id.
-    if (MemBufCurSize(dts.decodedRxBuf) != 1) {
+    dts->verifyingBaudRate = true;
+    if (LaunchOneShotTimer(dts->initTimerEventData.fd, &baudRateSettleDuration) == -1) {
         return StateTransition_Failed;
     }
 
-    // Ensure the ping id in the payload is equal to the ping id that was sent.
-    uint8_t receivedPingId = MemBufRead8(dts.decodedRxBuf, /* idx */ 0);
-    if (receivedPingId != dts.pingId) {
+    return StateTransition_WaitAsync;
+}
+
+// Called on DfuState_BaudRateFailed.
+static StateTransition HandleBaudRateFailed(DfuTarget *dts)
+{
+    Log_Debug("WARNING: Link failed at %" PRIu32 " baud, resetting board to try a slower rate.\n",
+              dts->baudRate);
+
+    dts->verifyingBaudRate = false;
+    dts->baudRateNegotiated = false;
+    ++dts->nextBaudRateIndex;
+
+    if (!SwitchUartBaudRate(dts, DFU_BOOTLOADER_BAUD_RATE)) {
         return StateTransition_Failed;
     }
 
-    // Send the packet receipt notification (PRN).
-    dts.prn = 0;
-    uint16_t sendPrn = htole16(dts.prn);
-    EncodeHeaderAndPayload(NrfDfuOp_ReceiptNotificationSet, (const uint8_t *)&sendPrn, 2);
+    // If an image was being written, then write it again after the reset.  Any
+    // objects which were executed before the failure are resumed if possible.
+    if (dts->currentImage) {
+        dts->nextImageIndex = (size_t)(dts->currentImage - dts->allImages);
+        dts->currentImage = NULL;
+        dts->hasSavedProgress =
+            dts->resumeEnabled && LoadDfuProgress(dts->progressSlot, &dts->savedProgress);
+        dts->resumingImage = false;
+    }
+    dts->sendingDelta = false;
+    dts->abandoningDelta = false;
 
-    dts.state = DfuState_ReceiptNotificationReceivedResponse;
-    return StateTransition_LaunchWriteThenRead;
+    // If the first image was being written, then the installed versions are read again.
+    if (dts->nextImageIndex == 0) {
+        dts->nrfImageIndex = 0;
+    }
+
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
+
+    return ResetIntoDfuMode(dts);
+}
+
+/// <summary>
+/// Reopens the UART at the supplied rate, and registers the new file descriptor
+/// with epoll.  Any data which was received at the previous rate is discarded.
+/// </summary>
+/// <returns>true on success; false otherwise.</returns>
+static bool SwitchUartBaudRate(DfuTarget *dts, uint32_t baudRate)
+{
+    if (dts->baudRate == baudRate) {
+        return true;
+    }
+
+    UnregisterPersistentEventHandlerFromEpoll(dts->epollFd, &dts->uartEventData);
+    dts->epollinEnabled = false;
+    dts->epolloutEnabled = false;
+    CancelTimeoutTimer(dts);
+
+    int fd = dts->uartReopenHandler(dts, baudRate);
+    if (fd == -1) {
+        Log_Debug("ERROR: Could not reopen UART at %" PRIu32 " baud.\n", baudRate);
+        return false;
+    }
+
+    dts->uartFd = fd;
+    dts->baudRate = baudRate;
+    MemBufReset(dts->encodedRxBuf);
+    dts->rxInProgress = false;
+
+    return RegisterPersistentEventHandlerToEpoll(dts->epollFd, dts->uartFd, &dts->uartEventData,
+                                                 EPOLLIN | EPOLLOUT) != -1;
 }
 
 // Called on DfuState_ReceiptNotificationReceivedResponse.
-static StateTransition HandlePrnReceivedResponse(void)
+static StateTransition HandlePrnReceivedResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_ReceiptNotificationSet)) {
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_ReceiptNotificationSet)) {
         return StateTransition_Failed;
     }
 
     // There should not be any payload with this response.
-    if (MemBufCurSize(dts.decodedRxBuf) != 0) {
+    if (MemBufCurSize(dts->decodedRxBuf) != 0) {
         return StateTransition_Failed;
     }
 
     // Request MTU from nRF52 board.
-    EncodeHeaderOnly(NrfDfuOp_MtuGet);
-    dts.state = DfuState_MtuReceivedResponse;
+    EncodeHeaderOnly(dts, NrfDfuOp_MtuGet);
+    dts->state = DfuState_MtuReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
 // Called on DfuState_MtuReceivedResponse.
-static StateTransition HandleMtuReceivedResponse(void)
+static StateTransition HandleMtuReceivedResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_MtuGet)) {
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_MtuGet)) {
         return StateTransition_Failed;
     }
 
-    dts.mtu = MemBufReadLe16(dts.decodedRxBuf, 0);
+    dts->mtu = MemBufReadLe16(dts->decodedRxBuf, 0);
+
+    // A smaller MTU than the attached board supports can still be used.
+    if (dts->mtu > MAX_MTU_SIZE) {
+        dts->mtu = MAX_MTU_SIZE;
+    }
 
     // Resize the buffers according to the available MTU size.
     // The TX buffer contains SLIP encoded payloads.  It should
@@ -827,408 +1410,1540 @@ static StateTransition HandleMtuReceivedResponse(void)
     // up before it is encoded to ensure that it does not exceed
     // the MTU after it has been encoded.
 
-    if (!MemBufResize(dts.txBuf, dts.mtu)) {
+    if (!MemBufResize(dts->txBuf, dts->mtu)) {
         return StateTransition_Failed;
     }
 
     // The RX buffer contains decoded payloads, and so will be
     // no longer than the MTU.
-    if (!MemBufResize(dts.decodedRxBuf, dts.mtu)) {
+    if (!MemBufResize(dts->decodedRxBuf, dts->mtu)) {
         return StateTransition_Failed;
     }
 
-    // if the nextImageIndex is greater than 0
+    // The encoded RX buffer holds SLIP-encoded data read from the UART,
+    // which should also fit in the MTU.
+    if (!MemBufResize(dts->encodedRxBuf, dts->mtu)) {
+        return StateTransition_Failed;
+    }
+
+    // if the dts->nextImageIndex is greater than 0
     // then the image isInstalled and installedVersion
     // fields have been set for all images which
     // have to be updated
-    if (nextImageIndex != 0) {
-        dts.state = DfuState_SelectNextImage;
+    if (dts->nextImageIndex != 0) {
+        dts->state = DfuState_SelectNextImage;
     }
     // otherwise, the version of each image has to be
     // checked and the isInstalled and installedVersion fields
     // have to be set accordingly
     else {
+        // Nothing has been written since the details were last read, so use them again.
+        if (dts->hasInstalledImages) {
+            Log_Debug("Using details of firmware read earlier from nRF52.\n");
+            ApplyInstalledImages(dts);
+            dts->state = DfuState_SelectNextImage;
+            return StateTransition_MoveImmediately;
+        }
+
         Log_Debug("Requesting details of firmware present on nRF52:\n");
-        dts.state = DfuState_GetFirmwareDetails;
+        dts->nrfImageIndex = 0;
+        dts->installedImageCount = 0;
+        dts->firmwareDetailsComplete = false;
+        dts->state = DfuState_GetFirmwareDetails;
     }
     return StateTransition_MoveImmediately;
 }
 
 // called on DfuState_GetFirmwareDetails
-static StateTransition HandleGetFirmwareDetails(void)
+//
+// Requests the details of the next few images together, so the board answers them
+// back to back rather than waiting for a round trip for each one.
+static StateTransition HandleGetFirmwareDetails(DfuTarget *dts)
 {
-    EncodeHeaderAndOptionalPayload(NrfDfuOp_FirmwareVersion, &nrfImageIndex, 1);
-    nrfImageIndex++;
-    dts.state = DfuState_FirmwareVersionReceivedResponse;
+    // Each request is three bytes once it is encoded, unless the image number is escaped.
+    size_t batchSize = MemBufMaxSize(dts->txBuf) / 4;
+    if (batchSize > FIRMWARE_DETAILS_BATCH_SIZE) {
+        batchSize = FIRMWARE_DETAILS_BATCH_SIZE;
+    }
+
+    MemBufReset(dts->txBuf);
+    for (size_t i = 0; i < batchSize; ++i) {
+        uint8_t imageNumber = (uint8_t)(dts->nrfImageIndex + i);
+        AppendRequest(dts, NrfDfuOp_FirmwareVersion, &imageNumber, 1);
+    }
+    dts->firmwareDetailsOutstanding = (uint8_t)batchSize;
+    dts->state = DfuState_FirmwareVersionReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
 // called on DfuState_FirmwareVersionReceivedResponse
-static StateTransition HandleFirmwareVersionReceivedResponse(void)
+static StateTransition HandleFirmwareVersionReceivedResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_FirmwareVersion)) {
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_FirmwareVersion)) {
         return StateTransition_Failed;
     }
 
     size_t currentOffset = 0;
-    uint8_t type = MemBufRead8(dts.decodedRxBuf, currentOffset);
+    uint8_t type = MemBufRead8(dts->decodedRxBuf, currentOffset);
     currentOffset += 1;
-    uint32_t version = MemBufReadLe32(dts.decodedRxBuf, currentOffset);
+    uint32_t version = MemBufReadLe32(dts->decodedRxBuf, currentOffset);
     currentOffset += sizeof(version);
-    uint32_t addr = MemBufReadLe32(dts.decodedRxBuf, currentOffset);
+    uint32_t addr = MemBufReadLe32(dts->decodedRxBuf, currentOffset);
     currentOffset += sizeof(addr);
-    uint32_t len = MemBufReadLe32(dts.decodedRxBuf, currentOffset);
+    uint32_t len = MemBufReadLe32(dts->decodedRxBuf, currentOffset);
 
-    // Unknown image type means no more images are present on the nRF52
-    if (type == IMAGE_TYPE_UNKNOWN) {
-        dts.state = DfuState_SelectNextImage;
-        return StateTransition_MoveImmediately;
-    }
+    uint8_t imageNumber = dts->nrfImageIndex++;
+    dts->firmwareDetailsOutstanding--;
 
-    Log_Debug("Image %zu has type %" PRIu8 " version %" PRIu32 " address %" PRIu32 " size %" PRIu32
-              ".\n",
-              nrfImageIndex - 1, type, version, addr, len);
-
-    for (unsigned int i = 0; i < numberOfImages; ++i) {
-        if ((uint8_t)type == (uint8_t)allImages[i].firmwareType) {
-            allImages[i].isInstalled = true;
-            allImages[i].installedVersion = version;
-            if (allImages[i].installedVersion != allImages[i].version) {
-                Log_Debug("Image %s (%zu/%zu) with version %zu needs update to version %zu.\n",
-                          allImages[i].datPathname, i + 1, numberOfImages, version,
-                          allImages[i].version);
-            }
+    // Unknown image type means no more images are present on the nRF52.  The responses
+    // to the rest of the batch report the same, and are discarded.
+    if (type == IMAGE_TYPE_UNKNOWN) {
+        if (!dts->firmwareDetailsComplete) {
+            // The details can only be used again if every image fitted in the table.
+            dts->firmwareDetailsComplete = true;
+            dts->hasInstalledImages = imageNumber == dts->installedImageCount;
+        }
+    } else if (!dts->firmwareDetailsComplete) {
+        Log_Debug("Image %" PRIu8 " has type %" PRIu8 " version %" PRIu32 " address %" PRIu32
+                  " size %" PRIu32 ".\n",
+                  imageNumber, type, version, addr, len);
+        if (dts->installedImageCount < MAX_INSTALLED_IMAGES) {
+            dts->installedImages[dts->installedImageCount++] =
+                (DfuInstalledImage){.type = type, .version = version, .size = len};
         }
     }
 
-    dts.state = DfuState_GetFirmwareDetails;
+    if (dts->firmwareDetailsOutstanding > 0) {
+        return StateTransition_LaunchRead;
+    }
+
+    if (!dts->firmwareDetailsComplete) {
+        dts->state = DfuState_GetFirmwareDetails;
+        return StateTransition_MoveImmediately;
+    }
+
+    ApplyInstalledImages(dts);
+    dts->state = DfuState_SelectNextImage;
     return StateTransition_MoveImmediately;
 }
 
+// Sets the installed details of each image from the images which the attached board reported.
+static void ApplyInstalledImages(DfuTarget *dts)
+{
+    for (size_t n = 0; n < dts->installedImageCount; ++n) {
+        const DfuInstalledImage *installed = &dts->installedImages[n];
+        for (unsigned int i = 0; i < dts->numberOfImages; ++i) {
+            if (installed->type == (uint8_t)dts->allImages[i].firmwareType) {
+                dts->allImages[i].isInstalled = true;
+                dts->allImages[i].installedVersion = installed->version;
+                dts->allImages[i].installedImageNumber = (uint8_t)n;
+                dts->allImages[i].installedSize = installed->size;
+                if (installed->version != dts->allImages[i].version) {
+                    Log_Debug("Image %s (%zu/%zu) with version %zu needs update to version %zu.\n",
+                              dts->allImages[i].datPathname, i + 1, dts->numberOfImages,
+                              installed->version, dts->allImages[i].version);
+                }
+            }
+        }
+    }
+}
+
 // Called on DfuState_SelectNextImage.
-static StateTransition HandleSelectNextImage(void)
+static StateTransition HandleSelectNextImage(DfuTarget *dts)
 {
-    while (nextImageIndex < numberOfImages) {
-        currentImage = &(allImages[nextImageIndex]);
-        nextImageIndex++;
+    while (dts->nextImageIndex < dts->numberOfImages) {
+        dts->currentImage = &(dts->allImages[dts->nextImageIndex]);
+        dts->nextImageIndex++;
+        dts->deltaFailed = false;
         // if there is an image to add, it will be added
-        if (!currentImage->isInstalled) {
-            Log_Debug("Adding image %s (%zu/%zu) with version %zu.\n", currentImage->datPathname,
-                      nextImageIndex, numberOfImages, currentImage->version);
-            dts.state = DfuState_InitPacketStart;
+        if (!dts->currentImage->isInstalled) {
+            Log_Debug("Adding image %s (%zu/%zu) with version %zu.\n", dts->currentImage->datPathname,
+                      dts->nextImageIndex, dts->numberOfImages, dts->currentImage->version);
+            dts->state = DfuState_InitPacketStart;
             break;
         }
-        // if there is an image to update, it will be updated
-        if (currentImage->installedVersion != currentImage->version) {
-            Log_Debug("Updating image %s (%zu/%zu) from version %zu to version %zu.\n", currentImage->datPathname, nextImageIndex, numberOfImages,
-                      currentImage->installedVersion, currentImage->version);
-            dts.state = DfuState_InitPacketStart;
+        // if there is an image to update, it will be updated unless the installed
+        // image has the same contents
+        if (dts->currentImage->installedVersion != dts->currentImage->version) {
+            // Read the file on a worker, and carry on in HandleImageCrcCalculated. If the job
+            // cannot be submitted, the file is read here instead.
+            if (dts->workerPool != NULL && !dts->currentImage->binStream &&
+                WorkerPool_Submit(dts->workerPool, &dts->imageCrcJob) == 0) {
+                dts->state = DfuState_ImageCrcCalculated;
+                return StateTransition_WaitAsync;
+            }
+            if (LaunchImageCrcCheck(dts)) {
+                return StateTransition_LaunchWriteThenRead;
+            }
+            UpdateCurrentImage(dts);
             break;
         }
         Log_Debug("Image %s (%zu/%zu) with version %zu doesn't need update.\n",
-                  currentImage->datPathname, nextImageIndex, numberOfImages, currentImage->version);
+                  dts->currentImage->datPathname, dts->nextImageIndex, dts->numberOfImages, dts->currentImage->version);
     }
 
     // if no image needs update (including the last image), then the DFU update operation is aborted
-    if (nextImageIndex >= numberOfImages && dts.state != DfuState_InitPacketStart) {
+    if (dts->nextImageIndex >= dts->numberOfImages && dts->state != DfuState_InitPacketStart) {
         Log_Debug("All images are up to date.\n");
-        EncodeHeaderAndOptionalPayload(NrfDfuOp_Abort, NULL, 0);
-        dts.state = DfuState_Success;
+        EncodeHeaderAndOptionalPayload(dts, NrfDfuOp_Abort, NULL, 0);
+        dts->state = DfuState_Success;
         return StateTransition_LaunchWrite;
     }
 
     return StateTransition_MoveImmediately;
 }
 
+// Called when the current image has to be written to the attached board.
+static StateTransition UpdateCurrentImage(DfuTarget *dts)
+{
+    Log_Debug("Updating image %s (%zu/%zu) from version %zu to version %zu.\n",
+              dts->currentImage->datPathname, dts->nextImageIndex, dts->numberOfImages,
+              dts->currentImage->installedVersion, dts->currentImage->version);
+    dts->state = DfuState_InitPacketStart;
+    return StateTransition_MoveImmediately;
+}
+
+/// <summary>
+/// Asks the attached board for the CRC-32 of the installed version of the current image,
+/// so that an image which was given a new version without changing it is not written again.
+/// </summary>
+/// <returns>true if the request was encoded; false if the image cannot be checked.</returns>
+static bool LaunchImageCrcCheck(DfuTarget *dts)
+{
+    // The CRC-32 of a download is only known once all of it has arrived.
+    if (dts->currentImage->binStream) {
+        return false;
+    }
+
+    if (!CalcFileCrc32(dts->currentImage->binPathname, &dts->imageSize, &dts->imageCrc32)) {
+        return false;
+    }
+
+    return LaunchImageCrcRequest(dts);
+}
+
+/// <summary>
+/// Encodes the request for the CRC-32 of the installed image, once imageSize and imageCrc32
+/// hold the size and CRC-32 of the current image file.
+/// </summary>
+/// <returns>true if the request was encoded; false if the installed image cannot
+/// match.</returns>
+static bool LaunchImageCrcRequest(DfuTarget *dts)
+{
+    // The installed image cannot match if it is smaller than the file.
+    if (dts->imageSize == 0 || dts->imageSize > dts->currentImage->installedSize ||
+        dts->imageSize > MAX_IMAGE_CRC_LENGTH) {
+        return false;
+    }
+
+    uint8_t buf[5];
+    buf[0] = IMAGE_CRC_OBJECT_TYPE;
+    uint32_t sizeLe =
+        htole32(((uint32_t)dts->currentImage->installedImageNumber << 24) | dts->imageSize);
+    memcpy(&buf[1], &sizeLe, sizeof(sizeLe));
+    EncodeHeaderAndPayload(dts, NrfDfuOp_ObjectCreate, buf, sizeof(buf));
+    dts->state = DfuState_ImageCrcReceivedCreateResponse;
+    return true;
+}
+
+/// <summary>
+/// Calculates the CRC-32 of the current image file on a worker thread.  The state machine
+/// waits until the job completes, so nothing else touches imageSize or imageCrc32 meanwhile.
+/// </summary>
+static void CalcImageCrcJob(WorkerPoolJob *job)
+{
+    DfuTarget *dts = job->context;
+    dts->imageCrcCalculated =
+        CalcFileCrc32(dts->currentImage->binPathname, &dts->imageSize, &dts->imageCrc32);
+}
+
+// Called on the event loop thread when CalcImageCrcJob has finished.
+static void ImageCrcJobCompleted(WorkerPoolJob *job)
+{
+    MoveToNextDfuState(job->context);
+}
+
+// Called on DfuState_ImageCrcCalculated.
+static StateTransition HandleImageCrcCalculated(DfuTarget *dts)
+{
+    if (dts->imageCrcCalculated && LaunchImageCrcRequest(dts)) {
+        return StateTransition_LaunchWriteThenRead;
+    }
+    return UpdateCurrentImage(dts);
+}
+
+/// <summary>
+/// Calculates the size and CRC-32 of a file in the image package.
+/// </summary>
+/// <returns>true on success; false otherwise.</returns>
+static bool CalcFileCrc32(const char *pathname, uint32_t *size, uint32_t *crc32)
+{
+    FileView *fv = OpenFileView(pathname, /* windowSize */ 4096);
+    if (!fv) {
+        Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n", pathname,
+                  strerror(errno), errno);
+        return false;
+    }
+
+    off_t fileSize;
+    FileViewFileOffsetSize(fv, NULL, &fileSize);
+
+    bool success = true;
+    uint32_t crc = 0;
+    for (off_t offset = 0; offset < fileSize && success;) {
+        success = FileViewMoveWindow(fv, offset);
+        if (success) {
+            const uint8_t *data;
+            off_t extent;
+            FileViewWindow(fv, &data, &extent);
+            crc = CalcCrc32WithSeed(data, (size_t)extent, crc);
+            offset += extent;
+        }
+    }
+
+    CloseFileView(fv);
+
+    *size = (uint32_t)fileSize;
+    *crc32 = crc;
+    return success;
+}
+
+/// <summary>
+/// Checks that an init packet describes its image in the way which the bootloader
+/// requires, so that an image is not sent only to be rejected.  The size of the firmware is
+/// only checked if the firmware file is in the image package.
+/// </summary>
+/// <returns>true if the init packet matches the image; false otherwise.</returns>
+static bool CheckInitPacket(const DfuImageData *image, const uint8_t *packet, size_t length)
+{
+    InitPacketInfo info;
+    if (!ParseInitPacket(packet, length, &info)) {
+        Log_Debug("ERROR: %s is not a valid init packet.\n", image->datPathname);
+        return false;
+    }
+
+    bool isApplication = image->firmwareType == DfuFirmware_Application;
+    uint32_t firmwareSize = isApplication ? info.appSize : info.sdSize + info.blSize;
+    bool typeMatches = isApplication ? info.type == InitPacketType_Application
+                                     : (info.type == InitPacketType_Softdevice ||
+                                        info.type == InitPacketType_SoftdeviceBootloader);
+    if (!typeMatches) {
+        Log_Debug("ERROR: %s has firmware type %d, which does not match the image.\n",
+                  image->datPathname, info.type);
+        return false;
+    }
+
+    if (!info.hasHwVersion || info.hwVersion != DFU_BOOTLOADER_HW_VERSION) {
+        Log_Debug("ERROR: %s is not for hardware version %d.\n", image->datPathname,
+                  DFU_BOOTLOADER_HW_VERSION);
+        return false;
+    }
+
+    // The version which the bootloader reports afterwards is the one in the init packet, so
+    // if it differed, the image would not be seen as installed and would be sent every time.
+    if (isApplication && (!info.hasFwVersion || info.fwVersion != image->version)) {
+        Log_Debug("ERROR: %s does not have version %u.\n", image->datPathname, image->version);
+        return false;
+    }
+
+    if (!image->binStream) {
+        FileView *fv = OpenFileView(image->binPathname, /* windowSize */ 4096);
+        if (!fv) {
+            Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n",
+                      image->binPathname, strerror(errno), errno);
+            return false;
+        }
+        off_t fileSize;
+        FileViewFileOffsetSize(fv, NULL, &fileSize);
+        CloseFileView(fv);
+
+        if (fileSize != (off_t)firmwareSize) {
+            Log_Debug("ERROR: %s is %lld bytes, but %s is for %u bytes.\n", image->binPathname,
+                      (long long)fileSize, image->datPathname, firmwareSize);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Reads the init packet of an image from the image package and checks it.  An init packet
+/// which is downloaded is checked when it has arrived.
+/// </summary>
+/// <returns>true if the init packet matches the image or is downloaded; false otherwise.</returns>
+static bool CheckPackagedInitPacket(const DfuImageData *image)
+{
+    if (image->datStream) {
+        return true;
+    }
+
+    FileView *fv = OpenFileView(image->datPathname, INIT_PACKET_MAX_SIZE);
+    if (!fv) {
+        Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n",
+                  image->datPathname, strerror(errno), errno);
+        return false;
+    }
+
+    bool valid = false;
+    off_t fileSize;
+    FileViewFileOffsetSize(fv, NULL, &fileSize);
+    if (fileSize > INIT_PACKET_MAX_SIZE) {
+        Log_Debug("ERROR: %s is larger than the bootloader accepts.\n", image->datPathname);
+    } else if (FileViewMoveWindow(fv, 0)) {
+        const uint8_t *initPacket;
+        off_t extent;
+        FileViewWindow(fv, &initPacket, &extent);
+        valid = CheckInitPacket(image, initPacket, (size_t)extent);
+    }
+
+    CloseFileView(fv);
+    return valid;
+}
+
+// Called on DfuState_ImageCrcReceivedCreateResponse.
+static StateTransition HandleImageCrcReceivedCreateResponse(DfuTarget *dts)
+{
+    // The bootloader may not support this check, in which case the image is written.
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_ObjectCreate)) {
+        return UpdateCurrentImage(dts);
+    }
+
+    EncodeHeaderOnly(dts, NrfDfuOp_CrcGet);
+    dts->state = DfuState_ImageCrcReceivedCrcResponse;
+    return StateTransition_LaunchWriteThenRead;
+}
+
+// Called on DfuState_ImageCrcReceivedCrcResponse.
+static StateTransition HandleImageCrcReceivedCrcResponse(DfuTarget *dts)
+{
+    uint32_t reportedSize;
+    uint32_t reportedCrc32;
+    if (!ReadChecksumResponse(dts, &reportedSize, &reportedCrc32) ||
+        reportedSize != dts->imageSize || reportedCrc32 != dts->imageCrc32) {
+        return UpdateCurrentImage(dts);
+    }
+
+    Log_Debug("Image %s (%zu/%zu) with version %zu is already installed as version %zu.\n",
+              dts->currentImage->datPathname, dts->nextImageIndex, dts->numberOfImages,
+              dts->currentImage->version, dts->currentImage->installedVersion);
+
+    // Treat the image as up to date, so that it is not written after a later image either.
+    size_t imageIndex = (size_t)(dts->currentImage - dts->allImages);
+    dts->allImages[imageIndex].installedVersion = dts->currentImage->version;
+
+    dts->state = DfuState_SelectNextImage;
+    return StateTransition_MoveImmediately;
+}
+
 // Called on INIT_PACKET_START.
-static StateTransition HandleInitPacketStart(void)
+static StateTransition HandleInitPacketStart(DfuTarget *dts)
 {
-    return LaunchSelect(0x01, DfuState_InitPacketDoneSelectCommand);
+    // Writing an image changes what is installed, so the next operation reads it again.
+    dts->hasInstalledImages = false;
+    return LaunchSelect(dts, 0x01, DfuState_InitPacketDoneSelectCommand);
 }
 
 // Called on DfuState_InitPacketDoneSelectCommand.
-static StateTransition HandleInitPacketDoneSelectCommand(void)
+static StateTransition HandleInitPacketDoneSelectCommand(DfuTarget *dts)
 {
-    // Open the init packet file and send send it to the nRF52.
-    dts.fv = OpenFileView(currentImage->datPathname, dts.maxTxSize);
-    if (!dts.fv) {
+    // Open the init packet file and send send it to the nRF52.  If it is being
+    // downloaded, this state runs again until the file view can be opened and filled.
+    ImageStream *datStream = dts->currentImage->datStream;
+    if (!dts->fv) {
+        dts->fv = OpenImageFileView(dts->currentImage->datPathname, datStream, dts->maxTxSize);
+    }
+    if (!dts->fv) {
+        if (IsWaitingForStream(datStream)) {
+            return WaitForStreamData(dts, datStream);
+        }
         Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n",
-                  currentImage->datPathname, strerror(errno), errno);
+                  dts->currentImage->datPathname, strerror(errno), errno);
         return StateTransition_Failed;
     }
 
     // The init packet file must fit within a single transfer.
     off_t fileSize;
-    FileViewFileOffsetSize(dts.fv, NULL, &fileSize);
-    if (fileSize > (off_t)dts.maxTxSize) {
+    FileViewFileOffsetSize(dts->fv, NULL, &fileSize);
+    if (fileSize > (off_t)dts->maxTxSize) {
         return StateTransition_Failed;
     }
 
-    if (!FileViewMoveWindow(dts.fv, 0)) {
+    if (!FileViewMoveWindow(dts->fv, 0)) {
+        if (IsWaitingForStream(datStream)) {
+            return WaitForStreamData(dts, datStream);
+        }
         return StateTransition_Failed;
     }
 
-    return TransferDataInFileViewWindow(0x1, DfuState_FirmwareStart);
+    // An init packet in the image package was checked by ProgramImages.
+    if (datStream) {
+        const uint8_t *initPacket;
+        off_t extent;
+        FileViewWindow(dts->fv, &initPacket, &extent);
+        if (!CheckInitPacket(dts->currentImage, initPacket, (size_t)extent)) {
+            return StateTransition_Failed;
+        }
+    }
+
+    // Creating the command object would reset the progress on the attached board,
+    // so do not send the init packet again when resuming an interrupted transfer.
+    if (CanResumeCurrentImage(dts, fileSize)) {
+        Log_Debug("Resuming image %s from offset %u.\n", dts->currentImage->binPathname,
+                  dts->savedProgress.fileOffset);
+        dts->resumingImage = true;
+
+        CloseFileView(dts->fv);
+        dts->fv = NULL;
+        dts->state = DfuState_FirmwareStart;
+        return StateTransition_MoveImmediately;
+    }
+
+    // Creating the command object discards any earlier progress, so start from
+    // the beginning.
+    dts->resumingImage = false;
+    dts->runningCrc32 = 0;
+    return TransferDataInFileViewWindow(dts, 0x1, DfuState_FirmwareStart);
+}
+
+// Tests whether the attached board already holds the init packet for the current
+// image, and whether the saved progress is for the same image.
+static bool CanResumeCurrentImage(DfuTarget *dts, off_t initPacketSize)
+{
+    if (!dts->hasSavedProgress) {
+        return false;
+    }
+
+    size_t imageIndex = (size_t)(dts->currentImage - dts->allImages);
+    if (dts->savedProgress.imageIndex != imageIndex ||
+        dts->savedProgress.imageVersion != dts->currentImage->version) {
+        return false;
+    }
+
+    const uint8_t *initPacket;
+    off_t extent;
+    FileViewWindow(dts->fv, &initPacket, &extent);
+
+    return dts->selectOffset == (uint32_t)initPacketSize &&
+           dts->selectCrc32 == CalcCrc32(initPacket, (size_t)extent);
 }
 
 // ---- Firmware (.DAT) programming states.
 
 // Called on DfuState_FirmwareStart.
-static StateTransition HandleFirmwareStart(void)
+static StateTransition HandleFirmwareStart(DfuTarget *dts)
 {
-    return LaunchSelect(0x02, DfuState_FirmwareDoneSelectData);
+    return LaunchSelect(dts, 0x02, DfuState_FirmwareDoneSelectData);
 }
 
 // Called on DATA_DONE_SELECT_COMMAND.
-static StateTransition HandleFirmwareDoneSelectData(void)
+static StateTransition HandleFirmwareDoneSelectData(DfuTarget *dts)
 {
+    // If the installed application is the patch's base version, then send the patch
+    // instead of the full image.  Otherwise, send the compressed image if there is one.
+    const DfuImageData *image = dts->currentImage;
+    if (!image->binStream && !dts->resumingImage && !dts->deltaFailed && dts->selectOffset == 0 &&
+        ((ShouldSendDelta(dts) &&
+          StartDeltaTransfer(dts, image->deltaPathname, DELTA_OBJECT_TYPE)) ||
+         (image->compressedPathname != NULL &&
+          StartDeltaTransfer(dts, image->compressedPathname, COMPRESSED_OBJECT_TYPE)))) {
+        Log_Debug("Sending image %s from %s.\n", image->binPathname, dts->deltaPathname);
+        StartTransferProgress(dts, 0, dts->deltaImageSize);
+        return TransferDataInFileViewWindow(dts, dts->deltaObjectType, DfuState_PostValidateImage);
+    }
+
     // The init packet must fit within a single transfer so
-    // open the init packet file and move to the start.
-    dts.fv = OpenFileView(currentImage->binPathname, dts.maxTxSize);
-    if (!dts.fv) {
+    // open the init packet file and move to the start.  If the firmware is being
+    // downloaded, this state runs again until its size is known.
+    dts->fv = OpenImageFileView(image->binPathname, image->binStream, dts->maxTxSize);
+    if (!dts->fv) {
+        if (IsWaitingForStream(image->binStream)) {
+            return WaitForStreamData(dts, image->binStream);
+        }
         Log_Debug("ERROR: Opening file %s failed with error code: %s (%d).\n",
-                  currentImage->binPathname, strerror(errno), errno);
+                  dts->currentImage->binPathname, strerror(errno), errno);
         return StateTransition_Failed;
     }
 
-    if (!FileViewMoveWindow(dts.fv, 0)) {
+    // If resuming, the attached board must report the offset and CRC-32 which were
+    // saved when the last object was executed.  Otherwise, it only makes sense for
+    // offset == 0 at this point because no file data has been transferred.  This can
+    // fail if the device has not fully reset since the last file was transferred.
+    off_t startOffset = 0;
+    if (dts->resumingImage) {
+        dts->resumingImage = false;
+
+        off_t fileSize;
+        FileViewFileOffsetSize(dts->fv, NULL, &fileSize);
+        if (dts->selectOffset != dts->savedProgress.fileOffset ||
+            dts->selectCrc32 != dts->savedProgress.crc32 ||
+            (off_t)dts->selectOffset >= fileSize) {
+            // Do not try to resume from this progress again.
+            Log_Debug("ERROR: Attached board does not match saved DFU progress.\n");
+            ClearDfuProgress(dts->progressSlot);
+            dts->hasSavedProgress = false;
+            return StateTransition_Failed;
+        }
+
+        startOffset = (off_t)dts->selectOffset;
+    } else if (dts->deltaFailed && dts->selectOffset != 0) {
+        // Objects which were rebuilt from the patch before it failed are kept.
+        off_t fileSize;
+        FileViewFileOffsetSize(dts->fv, NULL, &fileSize);
+        if (dts->selectOffset != dts->deltaObjectOffset ||
+            dts->selectCrc32 != dts->deltaObjectCrc32 || (off_t)dts->selectOffset >= fileSize) {
+            Log_Debug("ERROR: Attached board does not match the data sent from the patch.\n");
+            return StateTransition_Failed;
+        }
+
+        startOffset = (off_t)dts->selectOffset;
+    } else if (dts->selectOffset != 0) {
         return StateTransition_Failed;
     }
 
-    return TransferDataInFileViewWindow(0x2, DfuState_PostValidateImage);
+    off_t fileSize;
+    FileViewFileOffsetSize(dts->fv, NULL, &fileSize);
+    StartTransferProgress(dts, startOffset, fileSize);
+
+    dts->firmwareWindowOffset = startOffset;
+    dts->state = DfuState_FirmwareMoveWindow;
+    return StateTransition_MoveImmediately;
+}
+
+// Called on DfuState_FirmwareMoveWindow.
+static StateTransition HandleFirmwareMoveWindow(DfuTarget *dts)
+{
+    ImageStream *binStream = dts->currentImage->binStream;
+    if (!FileViewMoveWindow(dts->fv, dts->firmwareWindowOffset)) {
+        if (IsWaitingForStream(binStream)) {
+            return WaitForStreamData(dts, binStream);
+        }
+        return StateTransition_Failed;
+    }
+
+    dts->offsetIntoFileView = 0;
+    return TransferDataInFileViewWindow(dts, 0x2, DfuState_PostValidateImage);
+}
+
+// Opens the init packet or firmware of the current image, from its download if it has one,
+// or otherwise from the image package.
+static FileView *OpenImageFileView(const char *pathname, ImageStream *stream, size_t windowSize)
+{
+    return stream ? OpenStreamFileView(stream, windowSize) : OpenFileView(pathname, windowSize);
+}
+
+// Tests whether a file view operation on a download failed only because the data has not
+// arrived yet.  Call this straight after the operation, before errno changes.
+static bool IsWaitingForStream(const ImageStream *stream)
+{
+    return stream && errno == EAGAIN;
+}
+
+/// <summary>
+/// Leaves the state machine until more of a download arrives, and then runs the current
+/// state again.  The attached board is between objects, so it does not expect a request.
+/// If the download fails, the state is run again and fails too.
+/// </summary>
+static StateTransition WaitForStreamData(DfuTarget *dts, ImageStream *stream)
+{
+    dts->waitingStream = stream;
+    ImageStreamSetDataHandler(stream, &StreamDataArrived, dts);
+    return StateTransition_WaitAsync;
+}
+
+// Called when more of the download which the state machine is waiting for arrives.
+static void StreamDataArrived(ImageStream *stream, void *context)
+{
+    DfuTarget *dts = context;
+    ImageStreamSetDataHandler(stream, NULL, NULL);
+    dts->waitingStream = NULL;
+    MoveToNextDfuState(dts);
+}
+
+// Tests whether the current image has a patch against the installed application.
+static bool ShouldSendDelta(const DfuTarget *dts)
+{
+    const DfuImageData *image = dts->currentImage;
+    return image->deltaPathname != NULL && image->firmwareType == DfuFirmware_Application &&
+           image->isInstalled && image->installedVersion == image->deltaBaseVersion;
+}
+
+/// <summary>
+/// Opens a patch or compressed image for the current image and moves the file view to
+/// the first segment.
+/// </summary>
+/// <param name="pathname">Patch or compressed image file.</param>
+/// <param name="objectType">DELTA_OBJECT_TYPE or COMPRESSED_OBJECT_TYPE.</param>
+/// <returns>true if the file can be sent; false otherwise.</returns>
+static bool StartDeltaTransfer(DfuTarget *dts, const char *pathname, uint8_t objectType)
+{
+    // Each segment must fit in the window, and its patch can be a little larger than
+    // the object which is rebuilt from it.
+    dts->fv = OpenFileView(pathname, 2 * dts->maxTxSize);
+    if (!dts->fv) {
+        Log_Debug("WARNING: Opening file %s failed with error code: %s (%d).\n", pathname,
+                  strerror(errno), errno);
+        return false;
+    }
+
+    const uint8_t *header;
+    off_t extent;
+    if (!FileViewMoveWindow(dts->fv, 0)) {
+        goto fail;
+    }
+    FileViewWindow(dts->fv, &header, &extent);
+    if (extent < DELTA_FILE_HEADER_SIZE || ReadLe32(&header[0]) != DELTA_MAGIC ||
+        (header[4] | (header[5] << 8)) != DELTA_FORMAT_VERSION) {
+        Log_Debug("WARNING: %s is not a patch file.\n", pathname);
+        goto fail;
+    }
+
+    // A compressed image has no base image.
+    bool hasBase = ReadLe32(&header[8]) != 0;
+    if (hasBase != (objectType == DELTA_OBJECT_TYPE)) {
+        Log_Debug("WARNING: %s is not a %s.\n", pathname,
+                  hasBase ? "compressed image" : "patch");
+        goto fail;
+    }
+
+    dts->deltaPathname = pathname;
+    dts->deltaObjectType = objectType;
+    dts->deltaImageSize = ReadLe32(&header[16]);
+    dts->sendingDelta = true;
+    dts->abandoningDelta = false;
+    dts->deltaObjectOffset = 0;
+    dts->deltaObjectCrc32 = 0;
+    if (!LoadDeltaSegment(dts, DELTA_FILE_HEADER_SIZE)) {
+        dts->sendingDelta = false;
+        goto fail;
+    }
+
+    return true;
+
+fail:
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
+    return false;
+}
+
+/// <summary>
+/// Moves the file view window to the segment at the supplied offset in the patch file,
+/// and reads its header.
+/// </summary>
+/// <returns>true if the segment is valid; false otherwise.</returns>
+static bool LoadDeltaSegment(DfuTarget *dts, off_t segmentOffset)
+{
+    if (!FileViewMoveWindow(dts->fv, segmentOffset)) {
+        return false;
+    }
+
+    const uint8_t *segment;
+    off_t extent;
+    FileViewWindow(dts->fv, &segment, &extent);
+    if (extent < DELTA_SEGMENT_HEADER_SIZE) {
+        return false;
+    }
+
+    dts->deltaPatchLength = ReadLe32(&segment[0]);
+    dts->deltaOutputLength = ReadLe32(&segment[4]);
+    dts->deltaOutputCrc32 = ReadLe32(&segment[8]);
+
+    if (dts->deltaPatchLength == 0 ||
+        dts->deltaPatchLength > (uint32_t)(extent - DELTA_SEGMENT_HEADER_SIZE) ||
+        dts->deltaOutputLength == 0 || dts->deltaOutputLength > dts->maxTxSize) {
+        Log_Debug("WARNING: Invalid segment at offset %ld in %s.\n", (long)segmentOffset,
+                  dts->deltaPathname);
+        return false;
+    }
+
+    return true;
+}
+
+// Called when the attached board cannot apply the patch or compressed image, to send
+// the rest of the image from the .bin file instead.
+static StateTransition FallBackFromDelta(DfuTarget *dts)
+{
+    Log_Debug("WARNING: %s could not be applied, sending image %s instead.\n",
+              dts->deltaPathname, dts->currentImage->binPathname);
+
+    dts->sendingDelta = false;
+    dts->abandoningDelta = false;
+    dts->deltaFailed = true;
+
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
+
+    // Select the data object again to find out how much of the image was kept.
+    dts->state = DfuState_FirmwareStart;
+    return StateTransition_MoveImmediately;
+}
+
+// Reads a little-endian 32-bit value from a file.
+static uint32_t ReadLe32(const uint8_t *p)
+{
+    uint32_t valueLe;
+    memcpy(&valueLe, p, sizeof(valueLe));
+    return le32toh(valueLe);
 }
 
 // ---- Functionality shared by init packet and data packet.
 
 // Called to send a "select command" or "select data" request when the
 // init packet or data packet are sent respectively.
-static StateTransition LaunchSelect(uint8_t objectType, DfuProtocolStates continueState)
+static StateTransition LaunchSelect(DfuTarget *dts, uint8_t objectType, DfuProtocolStates continueState)
 {
-    EncodeHeaderAndPayload(NrfDfuOp_ObjectSelect, &objectType, sizeof(objectType));
-    dts.selectContinueState = continueState;
-    dts.state = DfuState_SelectReceivedSelectResponse;
+    EncodeHeaderAndPayload(dts, NrfDfuOp_ObjectSelect, &objectType, sizeof(objectType));
+    dts->selectContinueState = continueState;
+    dts->state = DfuState_SelectReceivedSelectResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
 // Called on COMMON_RECEIVED_SELECT_RESPONSE.
 //
-// On exit from this state, dts.maxTxSize and dts.runningCrc32
-// have been updated with the values in the select response.
-static StateTransition HandleSelectReceivedSelectResponse(void)
+// On exit from this state, dts->maxTxSize, dts->selectOffset, dts->selectCrc32,
+// and dts->runningCrc32 have been updated with the values in the select response.
+static StateTransition HandleSelectReceivedSelectResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_ObjectSelect)) {
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_ObjectSelect)) {
         return StateTransition_Failed;
     }
 
-    if (MemBufCurSize(dts.decodedRxBuf) != 12) {
+    if (MemBufCurSize(dts->decodedRxBuf) != 12) {
         return StateTransition_Failed;
     }
 
-    dts.maxTxSize = MemBufReadLe32(dts.decodedRxBuf, 0);
+    dts->maxTxSize = MemBufReadLe32(dts->decodedRxBuf, 0);
 
-    // It only makes sense for offset == 0 at this point because
-    // no file data has been transferred.  If the returned value
-    // is not zero then abort.  This can happen if the device has
-    // not fully reset since the last file was transferred.
-    uint32_t offset = MemBufReadLe32(dts.decodedRxBuf, 4);
-    if (offset != 0) {
-        return StateTransition_Failed;
-    }
+    // The continue state checks the offset, which is only non-zero
+    // when an earlier transfer was interrupted.
+    dts->selectOffset = MemBufReadLe32(dts->decodedRxBuf, 4);
+    dts->selectCrc32 = MemBufReadLe32(dts->decodedRxBuf, 8);
+    dts->runningCrc32 = dts->selectCrc32;
 
-    dts.runningCrc32 = MemBufReadLe32(dts.decodedRxBuf, 8);
-
-    dts.state = dts.selectContinueState;
+    dts->state = dts->selectContinueState;
     return StateTransition_MoveImmediately;
 }
 
-// Called on DfuState_FileTransferReceivedCreateResponse.
-static StateTransition TransferDataInFileViewWindow(uint8_t objectType,
+// Called to send the data in the file view to the attached board.
+static StateTransition TransferDataInFileViewWindow(DfuTarget *dts, uint8_t objectType,
                                                     DfuProtocolStates continueState)
+{
+    dts->objectType = objectType;
+    dts->fileTransferContinueState = continueState;
+
+    // Remember the CRC-32 at the start of the file view, in case it has to be sent again.
+    dts->windowStartCrc32 = dts->runningCrc32;
+    dts->windowRetries = 0;
+
+    return LaunchCreateObject(dts);
+}
+
+// Called to create the object which the data in the file view is written to.
+static StateTransition LaunchCreateObject(DfuTarget *dts)
 {
     // Create an object.
     // For the init packet, this will be a command object; for the
     // firmware it will be a data object.
 
+    // An object which is rebuilt from a patch has the size of the rebuilt data.
     off_t extent;
-    FileViewWindow(dts.fv, /* data */ NULL, &extent);
+    if (dts->sendingDelta) {
+        extent = (off_t)dts->deltaOutputLength;
+    } else {
+        FileViewWindow(dts->fv, /* data */ NULL, &extent);
+    }
 
     uint8_t buf[5];
-    buf[0] = objectType;
+    buf[0] = dts->objectType;
     uint32_t lenLe = htole32((uint32_t)extent);
     memcpy(&buf[1], &lenLe, sizeof(lenLe));
-    EncodeHeaderAndPayload(NrfDfuOp_ObjectCreate, buf, sizeof(buf));
-    dts.fileTransferContinueState = continueState;
-    dts.state = DfuState_FileTransferReceivedCreateResponse;
+    EncodeHeaderAndPayload(dts, NrfDfuOp_ObjectCreate, buf, sizeof(buf));
+    dts->state = DfuState_FileTransferReceivedCreateResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
+// Gets the data which is written to the current object.  When sending a patch,
+// this is the patch for the object, which follows the segment header.
+static void GetObjectData(DfuTarget *dts, const uint8_t **data, off_t *extent)
+{
+    const uint8_t *windowData;
+    FileViewWindow(dts->fv, &windowData, extent);
+
+    if (dts->sendingDelta) {
+        windowData += DELTA_SEGMENT_HEADER_SIZE;
+        *extent = (off_t)dts->deltaPatchLength;
+    }
+
+    if (data) {
+        *data = windowData;
+    }
+}
+
+// Gets the offset and CRC-32 which the attached board should report when all of
+// the current object has been written.
+static void GetObjectEnd(DfuTarget *dts, uint32_t *offset, uint32_t *crc32)
+{
+    if (dts->sendingDelta) {
+        *offset = dts->deltaObjectOffset + dts->deltaOutputLength;
+        *crc32 = dts->deltaOutputCrc32;
+        return;
+    }
+
+    off_t fileOffset;
+    FileViewFileOffsetSize(dts->fv, &fileOffset, /* size */ NULL);
+    off_t windowExtent;
+    FileViewWindow(dts->fv, /* data */ NULL, &windowExtent);
+
+    *offset = (uint32_t)(fileOffset + windowExtent);
+    *crc32 = dts->runningCrc32;
+}
+
 // Called on DfuState_FileTransferReceivedCreateResponse.
-static StateTransition HandleFileTransferReceivedCreateResponse(void)
+static StateTransition HandleFileTransferReceivedCreateResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_ObjectCreate)) {
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_ObjectCreate)) {
+        // The bootloader may not support patches or compression, or the installed
+        // application may not be valid.
+        if (dts->sendingDelta) {
+            return FallBackFromDelta(dts);
+        }
         return StateTransition_Failed;
     }
 
-    // The SLIP encoding can, in the worst case, double the payload
-    // size and then add a terminator, so ensure there is enough space
-    // in the MTU-sized buffer.
-    dts.stepSize = (dts.mtu - 1) / 2 - 1;
-    dts.offsetIntoFileView = 0;
+    if (dts->mtu <= 2) {
+        Log_Debug("ERROR: MTU %hu is too small to send file data.\n", dts->mtu);
+        return StateTransition_Failed;
+    }
 
-    dts.state = DfuState_FileTransferSendNextFragmentFromFileView;
+    // Each write request is the opcode, the SLIP-encoded payload, and a
+    // terminator. The opcode is not a SLIP special character, so the
+    // remainder of the MTU-sized buffer is available for the encoded payload.
+    dts->stepSize = dts->mtu - 2;
+    dts->offsetIntoFileView = 0;
+
+    // The attached board counts writes towards the next packet receipt
+    // notification from the start of each object.
+    dts->writesSinceReceipt = 0;
+    dts->receiptHead = 0;
+    dts->receiptCount = 0;
+    dts->checksumRequested = false;
+
+    dts->state = DfuState_FileTransferSendNextFragmentFromFileView;
     return StateTransition_MoveImmediately;
 }
 
 // Called on DfuState_FileTransferSendNextFragmentFromFileView.
-static StateTransition HandleFileTransferSendNextFragmentFromFileView(void)
+static StateTransition HandleFileTransferSendNextFragmentFromFileView(DfuTarget *dts)
 {
     const uint8_t *data;
     off_t extent;
-    FileViewWindow(dts.fv, &data, &extent);
-
-    off_t bytesToSend = extent - dts.offsetIntoFileView;
-    if (bytesToSend > dts.stepSize) {
-        bytesToSend = dts.stepSize;
+    GetObjectData(dts, &data, &extent);
+
+    // Send as much data as fits in the MTU after SLIP encoding. The attached board
+    // writes each fragment straight to flash, which takes whole words, so only the
+    // last fragment in the file view may end part way through a word.
+    const uint8_t *dataToSend = &data[dts->offsetIntoFileView];
+    off_t remaining = extent - dts->offsetIntoFileView;
+    off_t bytesToSend =
+        (off_t)SlipEncodeFit(dataToSend, (size_t)remaining, (size_t)dts->stepSize, NULL);
+    if (bytesToSend < remaining) {
+        bytesToSend -= bytesToSend % FLASH_WORD_SIZE;
     }
+    if (bytesToSend == 0) {
+        Log_Debug("ERROR: MTU %hu is too small to send file data.\n", dts->mtu);
+        return StateTransition_Failed;
+    }
+
+    dts->fvFragmentLen = bytesToSend;
+
+    EncodeHeaderAndPayload(dts, NrfDfuOp_ObjectWrite, dataToSend, (size_t)bytesToSend);
 
-    dts.fvFragmentLen = bytesToSend;
+    dts->runningCrc32 = CalcCrc32WithSeed(dataToSend, (size_t)bytesToSend, dts->runningCrc32);
 
-    const uint8_t *dataToSend = &data[dts.offsetIntoFileView];
-    EncodeHeaderAndPayload(NrfDfuOp_ObjectWrite, dataToSend, (size_t)bytesToSend);
+    // If the attached board will acknowledge this write, then record what it should report.
+    if (dts->prn != 0 && ++dts->writesSinceReceipt == dts->prn) {
+        dts->writesSinceReceipt = 0;
 
-    dts.runningCrc32 = CalcCrc32WithSeed(dataToSend, (size_t)bytesToSend, dts.runningCrc32);
+        if (dts->sendingDelta) {
+            // The attached board only writes the rebuilt object when all of the patch
+            // for it has arrived.
+            if (dts->offsetIntoFileView + bytesToSend < extent) {
+                AddReceiptCheckpoint(dts, dts->deltaObjectOffset, dts->deltaObjectCrc32);
+            } else {
+                uint32_t endOffset;
+                uint32_t endCrc32;
+                GetObjectEnd(dts, &endOffset, &endCrc32);
+                AddReceiptCheckpoint(dts, endOffset, endCrc32);
+            }
+        } else {
+            off_t fileOffset;
+            FileViewFileOffsetSize(dts->fv, &fileOffset, /* size */ NULL);
+            AddReceiptCheckpoint(dts,
+                                 (uint32_t)(fileOffset + dts->offsetIntoFileView + bytesToSend),
+                                 dts->runningCrc32);
+        }
+    }
 
-    dts.state = DfuState_FileTransferSentWriteObjectRequest;
+    dts->state = DfuState_FileTransferSentWriteObjectRequest;
     return StateTransition_LaunchWrite;
 }
 
 // Called on HandleFileTransferSentWriteObjectRequest.
-static StateTransition HandleFileTransferSentWriteObjectRequest(void)
+static StateTransition HandleFileTransferSentWriteObjectRequest(DfuTarget *dts)
 {
     // No response to check.
 
-    dts.offsetIntoFileView += dts.fvFragmentLen;
+    dts->offsetIntoFileView += dts->fvFragmentLen;
+
+    // Check any packet receipt notifications which have already arrived,
+    // without waiting for the others.
+    while (dts->receiptCount > 0) {
+        int result = ReceivePacket(dts);
+        if (result == -1) {
+            return ResyncFileTransfer(dts);
+        } else if (result == 0) {
+            break;
+        }
+
+        result = CheckReceiptNotification(dts);
+        if (result == -1) {
+            return ResyncFileTransfer(dts);
+        } else if (result == 1) {
+            return RewindFileViewWindow(dts);
+        }
+    }
+
+    // Limit how much data is in flight by waiting for the oldest notification.
+    if (dts->receiptCount == MAX_OUTSTANDING_RECEIPTS) {
+        dts->state = DfuState_FileTransferReceivedReceiptNotification;
+        return StateTransition_LaunchRead;
+    }
+
+    return SendNextFragmentOrRequestChecksum(dts);
+}
+
+// Called on DfuState_FileTransferReceivedReceiptNotification.
+static StateTransition HandleFileTransferReceivedReceiptNotification(DfuTarget *dts)
+{
+    int result = CheckReceiptNotification(dts);
+    if (result == -1) {
+        return ResyncFileTransfer(dts);
+    } else if (result == 1) {
+        return RewindFileViewWindow(dts);
+    }
 
+    return SendNextFragmentOrRequestChecksum(dts);
+}
+
+// Called when a write has completed and no more notifications need to be waited for.
+static StateTransition SendNextFragmentOrRequestChecksum(DfuTarget *dts)
+{
     // If data remaining in file view, then send next fragment.
     off_t extent;
-    FileViewWindow(dts.fv, /* data */ NULL, &extent);
-    if (dts.offsetIntoFileView < extent) {
-        dts.state = DfuState_FileTransferSendNextFragmentFromFileView;
+    GetObjectData(dts, /* data */ NULL, &extent);
+    if (dts->offsetIntoFileView < extent) {
+        dts->state = DfuState_FileTransferSendNextFragmentFromFileView;
+        return StateTransition_MoveImmediately;
+    }
+
+    // Have sent all data in file view, so ask for a checksum. Any outstanding
+    // notifications will arrive before the response.
+    EncodeHeaderOnly(dts, NrfDfuOp_CrcGet);
+    dts->checksumRequested = true;
+    dts->state = DfuState_FileTrnasferReceivedWindowChecksumResponse;
+    return StateTransition_LaunchWriteThenRead;
+}
+
+/// <summary>
+/// Reads a response to a NrfDfuOp_CrcGet request, or a packet receipt notification,
+/// which has the same format.
+/// </summary>
+/// <param name="offset">Receives the offset reported by the attached board.</param>
+/// <param name="crc32">Receives the CRC-32 reported by the attached board.</param>
+/// <returns>true if the response was valid; false otherwise.</returns>
+static bool ReadChecksumResponse(DfuTarget *dts, uint32_t *offset, uint32_t *crc32)
+{
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_CrcGet)) {
+        return false;
+    }
+
+    if (MemBufCurSize(dts->decodedRxBuf) != 8) {
+        return false;
+    }
+
+    *offset = MemBufReadLe32(dts->decodedRxBuf, 0);
+    *crc32 = MemBufReadLe32(dts->decodedRxBuf, 4);
+    return true;
+}
+
+// Records the offset and CRC-32 which the next packet receipt notification should report.
+static void AddReceiptCheckpoint(DfuTarget *dts, uint32_t offset, uint32_t crc32)
+{
+    assert(dts->receiptCount < MAX_OUTSTANDING_RECEIPTS);
+
+    size_t idx = (dts->receiptHead + dts->receiptCount) % MAX_OUTSTANDING_RECEIPTS;
+    dts->receiptCheckpoints[idx].offset = offset;
+    dts->receiptCheckpoints[idx].crc32 = crc32;
+    ++dts->receiptCount;
+}
+
+/// <summary>
+/// Checks the packet receipt notification in dts->decodedRxBuf against
+/// the oldest outstanding checkpoint, and removes that checkpoint.
+/// </summary>
+/// <returns>0 if the notification matched; 1 if the offset or CRC-32 did
+/// not match; -1 if the notification was not valid.</returns>
+static int CheckReceiptNotification(DfuTarget *dts)
+{
+    assert(dts->receiptCount > 0);
+
+    uint32_t reportedOffset;
+    uint32_t reportedCrc32;
+    if (!ReadChecksumResponse(dts, &reportedOffset, &reportedCrc32)) {
+        return -1;
+    }
+
+    const DfuReceiptCheckpoint *expected = &dts->receiptCheckpoints[dts->receiptHead];
+    dts->receiptHead = (dts->receiptHead + 1) % MAX_OUTSTANDING_RECEIPTS;
+    --dts->receiptCount;
+
+    if (reportedOffset != expected->offset || reportedCrc32 != expected->crc32) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Called when the attached board reports an unexpected offset or CRC-32, to send
+// the current file view again.
+static StateTransition RewindFileViewWindow(DfuTarget *dts)
+{
+    // A patch which does not rebuild the expected data will not work if it is sent
+    // again, so send the full image once the outstanding responses have arrived.
+    if (dts->sendingDelta) {
+        dts->abandoningDelta = true;
+    } else if (dts->windowRetries >= dts->maxWindowRetries) {
+        return AbandonFileViewWindow(dts);
+    }
+
+    if (!dts->abandoningDelta) {
+        ++dts->windowRetries;
+        ++dts->totalRetries;
+        Log_Debug("WARNING: Offset or checksum mismatch, sending block again (retry %u).\n",
+                  dts->windowRetries);
+    }
+
+    // Responses to data which was sent before the mismatch was found are still in flight.
+    dts->responsesToDiscard = dts->receiptCount + (dts->checksumRequested ? 1 : 0);
+    dts->receiptCount = 0;
+    dts->checksumRequested = false;
+
+    return DiscardNextResponseOrResend(dts);
+}
+
+// Called when the current file view has been sent too many times.
+static StateTransition AbandonFileViewWindow(DfuTarget *dts)
+{
+    // If a faster rate was negotiated, the link may not be reliable at that rate.
+    if (dts->baudRate != DFU_BOOTLOADER_BAUD_RATE) {
+        dts->state = DfuState_BaudRateFailed;
         return StateTransition_MoveImmediately;
     }
 
-    // Have sent all data in file view, so ask for a checksum.
-    EncodeHeaderOnly(NrfDfuOp_CrcGet);
-    dts.state = DfuState_FileTrnasferReceivedWindowChecksumResponse;
+    Log_Debug("ERROR: Data was still corrupted after %u attempts.\n", dts->windowRetries + 1);
+    return StateTransition_Failed;
+}
+
+// Reads the next response which is being discarded, or resends the file view
+// when all of them have arrived.
+static StateTransition DiscardNextResponseOrResend(DfuTarget *dts)
+{
+    if (dts->responsesToDiscard > 0) {
+        dts->state = DfuState_FileTransferDiscardedResponse;
+        return StateTransition_LaunchRead;
+    }
+
+    if (dts->abandoningDelta) {
+        return FallBackFromDelta(dts);
+    }
+
+    // Creating the object again makes the attached board discard the data which
+    // was written to it.
+    dts->runningCrc32 = dts->windowStartCrc32;
+    return LaunchCreateObject(dts);
+}
+
+// Called on DfuState_FileTransferDiscardedResponse.
+static StateTransition HandleFileTransferDiscardedResponse(DfuTarget *dts)
+{
+    --dts->responsesToDiscard;
+    return DiscardNextResponseOrResend(dts);
+}
+
+// Called when a response to a request for the current object cannot be decoded.
+static StateTransition ResyncFileTransfer(DfuTarget *dts)
+{
+    dts->state = DfuState_FileTransferResync;
+    return StateTransition_MoveImmediately;
+}
+
+// Called on DfuState_FileTransferResync.
+static StateTransition HandleFileTransferResync(DfuTarget *dts)
+{
+    if (dts->windowRetries >= dts->maxWindowRetries) {
+        return AbandonFileViewWindow(dts);
+    }
+
+    ++dts->windowRetries;
+    ++dts->totalRetries;
+    Log_Debug("WARNING: Lost response from board, sending block again (retry %u).\n",
+              dts->windowRetries);
+
+    // It is not known how many responses are still in flight, so they are discarded
+    // until the response to this ping arrives.  If the board merged part of an earlier
+    // request with the ping, there is no response, and the ping is sent again.
+    dts->rxInProgress = false;
+    dts->receiptCount = 0;
+    dts->checksumRequested = false;
+    dts->responsesToDiscard = 0;
+
+    ++dts->pingId;
+    EncodeHeaderAndPayload(dts, NrfDfuOp_Ping, &dts->pingId, 1);
+
+    dts->state = DfuState_FileTransferResyncReceivedResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
+// Called on DfuState_FileTransferResyncReceivedResponse.
+static StateTransition HandleFileTransferResyncReceivedResponse(DfuTarget *dts)
+{
+    // Responses which were in flight are not checked, so their error codes are not logged.
+    bool pingResponse = MemBufCurSize(dts->decodedRxBuf) == 4 &&
+                        MemBufRead8(dts->decodedRxBuf, /* idx */ 0) == NrfDfuOp_Response &&
+                        MemBufRead8(dts->decodedRxBuf, /* idx */ 1) == NrfDfuOp_Ping &&
+                        MemBufRead8(dts->decodedRxBuf, /* idx */ 2) == NrfDfuRes_Success &&
+                        MemBufRead8(dts->decodedRxBuf, /* idx */ 3) == dts->pingId;
+    if (!pingResponse) {
+        return StateTransition_LaunchRead;
+    }
+
+    // Creating the object again discards the data which was written to it.
+    return DiscardNextResponseOrResend(dts);
+}
+
 // DfuState_FileTrnasferReceivedWindowChecksumResponse
-static StateTransition HandleFileTransferReceivedWindowChecksumResponse(void)
+static StateTransition HandleFileTransferReceivedWindowChecksumResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_CrcGet)) {
-        return StateTransition_Failed;
+    // Packet receipt notifications which are still outstanding arrive before
+    // the response to the checksum request.
+    if (dts->receiptCount > 0) {
+        int result = CheckReceiptNotification(dts);
+        if (result == -1) {
+            return ResyncFileTransfer(dts);
+        } else if (result == 1) {
+            return RewindFileViewWindow(dts);
+        }
+
+        return StateTransition_LaunchRead;
     }
 
+    dts->checksumRequested = false;
+
     // Check whether the reported offset and CRC match the expected values.
-    uint32_t reportedOffset = MemBufReadLe32(dts.decodedRxBuf, 0);
-    uint32_t reportedCrc32 = MemBufReadLe32(dts.decodedRxBuf, 4);
+    uint32_t reportedOffset;
+    uint32_t reportedCrc32;
+    if (!ReadChecksumResponse(dts, &reportedOffset, &reportedCrc32)) {
+        return ResyncFileTransfer(dts);
+    }
 
     // Have just sent another window's worth of data from the
     // file, so ensure the offset matches the expected file position.
+    uint32_t expectedOffset;
+    uint32_t expectedCrc32;
+    GetObjectEnd(dts, &expectedOffset, &expectedCrc32);
 
-    off_t fileOffset;
-    FileViewFileOffsetSize(dts.fv, &fileOffset, /* size */ NULL);
-    off_t windowExtent;
-    FileViewWindow(dts.fv, /* data */ NULL, &windowExtent);
-
-    if (reportedOffset != fileOffset + windowExtent) {
-        return StateTransition_Failed;
-    }
-
-    if (reportedCrc32 != dts.runningCrc32) {
-        return StateTransition_Failed;
+    if (reportedOffset != expectedOffset || reportedCrc32 != expectedCrc32) {
+        return RewindFileViewWindow(dts);
     }
 
     // Send the execute opcode.
-    EncodeHeaderOnly(NrfDfuOp_ObjectExecute);
-    dts.state = DfuState_FileTransferReceivedExecuteResponse;
+    EncodeHeaderOnly(dts, NrfDfuOp_ObjectExecute);
+    dts->state = DfuState_FileTransferReceivedExecuteResponse;
     return StateTransition_LaunchWriteThenRead;
 }
 
 // Called on DfuState_FileTransferReceivedExecuteResponse.
-static StateTransition HandleFileTransferReceivedExecuteResponse(void)
+static StateTransition HandleFileTransferReceivedExecuteResponse(DfuTarget *dts)
 {
-    if (!ValidateAndRemoveHeader(NrfDfuOp_ObjectExecute)) {
+    if (!ValidateAndRemoveHeader(dts, NrfDfuOp_ObjectExecute)) {
         return StateTransition_Failed;
     }
 
+    // Each object which is rebuilt from a patch is followed by the next segment.
+    if (dts->sendingDelta) {
+        off_t segmentOffset;
+        off_t deltaSize;
+        FileViewFileOffsetSize(dts->fv, &segmentOffset, &deltaSize);
+
+        dts->deltaObjectOffset += dts->deltaOutputLength;
+        dts->deltaObjectCrc32 = dts->deltaOutputCrc32;
+        ReportTransferProgress(dts, dts->deltaObjectOffset);
+
+        off_t nextSegmentOffset = segmentOffset + DELTA_SEGMENT_HEADER_SIZE + dts->deltaPatchLength;
+        if (nextSegmentOffset < deltaSize) {
+            if (!LoadDeltaSegment(dts, nextSegmentOffset)) {
+                return FallBackFromDelta(dts);
+            }
+            return TransferDataInFileViewWindow(dts, dts->deltaObjectType,
+                                                DfuState_PostValidateImage);
+        }
+
+        dts->sendingDelta = false;
+        CloseFileView(dts->fv);
+        dts->fv = NULL;
+
+        dts->state = dts->fileTransferContinueState;
+        return StateTransition_MoveImmediately;
+    }
+
     // If there is more data after the file view then move the
     // window and send the next block of data.
     off_t fileOffset;
     off_t fileSize;
-    FileViewFileOffsetSize(dts.fv, &fileOffset, &fileSize);
+    FileViewFileOffsetSize(dts->fv, &fileOffset, &fileSize);
     off_t windowExtent;
-    FileViewWindow(dts.fv, /* data */ NULL, &windowExtent);
+    FileViewWindow(dts->fv, /* data */ NULL, &windowExtent);
+
+    // Save how far the firmware has been written, so an interrupted transfer can be
+    // resumed from here.  The init packet is always sent again, so it is not saved.
+    if (dts->resumeEnabled && dts->objectType == 0x2) {
+        if (fileOffset + windowExtent < fileSize) {
+            DfuProgress progress = {
+                .imageIndex = (uint32_t)(dts->currentImage - dts->allImages),
+                .imageVersion = dts->currentImage->version,
+                .fileOffset = (uint32_t)(fileOffset + windowExtent),
+                .crc32 = dts->runningCrc32};
+            SaveDfuProgress(dts->progressSlot, &progress);
+        } else {
+            ClearDfuProgress(dts->progressSlot);
+        }
+    }
+
+    if (dts->objectType == 0x2) {
+        ReportTransferProgress(dts, (uint32_t)(fileOffset + windowExtent));
+    }
 
     if (fileOffset + windowExtent < fileSize) {
-        FileViewMoveWindow(dts.fv, fileOffset + windowExtent);
-        dts.state = DfuState_FileTransferSendNextFragmentFromFileView;
-        dts.offsetIntoFileView = 0;
-        return TransferDataInFileViewWindow(0x2, DfuState_PostValidateImage);
+        dts->firmwareWindowOffset = fileOffset + windowExtent;
+        dts->state = DfuState_FirmwareMoveWindow;
+        return StateTransition_MoveImmediately;
     }
 
-    CloseFileView(dts.fv);
-    dts.fv = NULL;
+    CloseFileView(dts->fv);
+    dts->fv = NULL;
 
-    dts.state = dts.fileTransferContinueState;
+    dts->state = dts->fileTransferContinueState;
     return StateTransition_MoveImmediately;
 }
 
+// Records when the firmware transfer of the current image starts, and reports it to the
+// progress handler.
+static void StartTransferProgress(DfuTarget *dts, off_t startOffset, off_t imageSize)
+{
+    clock_gettime(CLOCK_MONOTONIC, &dts->transferStartTime);
+    dts->transferStartOffset = (uint32_t)startOffset;
+    dts->transferImageSize = (uint32_t)imageSize;
+    ReportTransferProgress(dts, (uint32_t)startOffset);
+}
+
+// Calls the progress handler, if there is one, once bytesSent of the current image have been
+// executed.  The rate and the time remaining are measured from the start of the transfer.
+static void ReportTransferProgress(DfuTarget *dts, uint32_t bytesSent)
+{
+    if (!dts->progressHandler) {
+        return;
+    }
+
+    DfuTransferProgress progress = {.imageIndex = (size_t)(dts->currentImage - dts->allImages),
+                                    .imageCount = dts->numberOfImages,
+                                    .bytesSent = bytesSent,
+                                    .bytesTotal = dts->transferImageSize,
+                                    .bytesPerSecond = 0,
+                                    .retries = dts->totalRetries,
+                                    .msRemaining = UINT32_MAX};
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsedMs = (int64_t)(now.tv_sec - dts->transferStartTime.tv_sec) * 1000 +
+                        (now.tv_nsec - dts->transferStartTime.tv_nsec) / (1000 * 1000);
+    uint64_t bytesTransferred =
+        bytesSent > dts->transferStartOffset ? bytesSent - dts->transferStartOffset : 0;
+
+    if (elapsedMs > 0 && bytesTransferred > 0) {
+        progress.bytesPerSecond = (uint32_t)(bytesTransferred * 1000 / (uint64_t)elapsedMs);
+        uint64_t bytesLeft = bytesSent < dts->transferImageSize
+                                 ? dts->transferImageSize - bytesSent
+                                 : 0;
+        uint64_t msRemaining = bytesLeft * (uint64_t)elapsedMs / bytesTransferred;
+        progress.msRemaining = msRemaining < UINT32_MAX ? (uint32_t)msRemaining : UINT32_MAX - 1;
+    }
+
+    dts->progressHandler(dts, &progress);
+}
+
 // Called on DfuState_PostValidateImage.
 //
 // Waits for DFU to postvalidate the updated image.
-static StateTransition HandlePostValidateImage(void)
+static StateTransition HandlePostValidateImage(DfuTarget *dts)
 {
     // Finished sending an image update, so wait for postvalidation on DFU side.
     // the waiting time differs based on the firmware type
-    time_t waitTime = 1;
-    if (currentImage->firmwareType == DfuFirmware_Softdevice) {
-        waitTime = 5;
+    uint32_t waitTimeMs = POST_VALIDATE_APP_WAIT_MS;
+    if (dts->currentImage->firmwareType == DfuFirmware_Softdevice) {
+        waitTimeMs = POST_VALIDATE_SOFTDEVICE_WAIT_MS;
     }
+    dts->postValidateProbesLeft =
+        waitTimeMs / (POST_VALIDATE_PROBE_INTERVAL_MS + POST_VALIDATE_PROBE_RESPONSE_TIME_MS);
+    dts->postValidateBoardSilent = false;
+
+    // The board restarts at the bootloader's rate, and the faster rate is negotiated again.
+    dts->baudRateNegotiated = false;
+    if (!SwitchUartBaudRate(dts, DFU_BOOTLOADER_BAUD_RATE)) {
+        return StateTransition_Failed;
+    }
+
+    Log_Debug("Waiting for image %s postvalidation\n", dts->currentImage->datPathname);
+    return LaunchPostValidateProbe(dts);
+}
 
-    const struct timespec postValidateTimerDuration = {.tv_sec = waitTime, .tv_nsec = 0};
-    if (LaunchOneShotTimer(dts.postValidateTimerEventData.fd, &postValidateTimerDuration) == -1) {
+// Waits for a short time before pinging the attached board again.
+static StateTransition LaunchPostValidateProbe(DfuTarget *dts)
+{
+    static const struct timespec probeInterval = {
+        .tv_sec = 0, .tv_nsec = POST_VALIDATE_PROBE_INTERVAL_MS * 1000 * 1000};
+    if (LaunchOneShotTimer(dts->postValidateTimerEventData.fd, &probeInterval) == -1) {
         return StateTransition_Failed;
     }
 
-    Log_Debug("Waiting for image %s postvalidation\n", currentImage->datPathname);
     // Do not set next state - that happens in postValidateTimerExpiredEvent.
     return StateTransition_WaitAsync;
 }
 
 static void PostValidateTimerExpiredEvent(EventData *eventData)
 {
-    bool consumed = (ConsumeTimerFdEvent(dts.postValidateTimerEventData.fd) == 0);
-    dts.state = consumed ? DfuState_Success : DfuState_Failed;
+    DfuTarget *dts = EventDataToTarget(eventData, offsetof(DfuTarget, postValidateTimerEventData));
+
+    bool consumed = (ConsumeTimerFdEvent(dts->postValidateTimerEventData.fd) == 0);
+    dts->state = consumed ? DfuState_PostValidateProbe : DfuState_Failed;
+
+    MoveToNextDfuState(dts);
+}
+
+// Called on DfuState_PostValidateProbe.
+static StateTransition HandlePostValidateProbe(DfuTarget *dts)
+{
+    if (dts->postValidateProbesLeft == 0) {
+        Log_Debug("Board did not answer after postvalidation, resetting it.\n");
+        return FinishPostValidate(dts, /* bootloaderReady */ false);
+    }
+    --dts->postValidateProbesLeft;
+
+    // Discard any late response to an earlier probe.
+    MemBufReset(dts->encodedRxBuf);
+    dts->rxInProgress = false;
+    if (!DiscardUartInput(dts)) {
+        return StateTransition_Failed;
+    }
+
+    ++dts->pingId;
+    EncodeHeaderAndPayload(dts, NrfDfuOp_Ping, &dts->pingId, 1);
+
+    dts->state = DfuState_PostValidateProbeReceivedResponse;
+    return StateTransition_LaunchWriteThenRead;
+}
+
+// Called on DfuState_PostValidateProbeReceivedResponse.
+static StateTransition HandlePostValidateProbeReceivedResponse(DfuTarget *dts)
+{
+    bool validResponse = ValidateAndRemoveHeader(dts, NrfDfuOp_Ping) &&
+                         MemBufCurSize(dts->decodedRxBuf) == 1 &&
+                         MemBufRead8(dts->decodedRxBuf, /* idx */ 0) == dts->pingId;
+
+    // The bootloader answers pings between sending the execute response and resetting,
+    // so an answer only shows that the board is ready once it has stopped answering.
+    if (validResponse && dts->postValidateBoardSilent) {
+        return FinishPostValidate(dts, /* bootloaderReady */ true);
+    }
+
+    if (!validResponse) {
+        dts->postValidateBoardSilent = true;
+    }
+    return LaunchPostValidateProbe(dts);
+}
+
+// Called on DfuState_PostValidateProbeNoResponse.
+static StateTransition HandlePostValidateProbeNoResponse(DfuTarget *dts)
+{
+    dts->postValidateBoardSilent = true;
+    return LaunchPostValidateProbe(dts);
+}
+
+/// <summary>
+/// Starts writing the next image which needs to be added or updated, or finishes the
+/// operation if there are none.
+/// </summary>
+/// <param name="bootloaderReady">Whether the bootloader has restarted and answered a ping,
+/// so the board does not have to be reset into DFU mode.</param>
+static StateTransition FinishPostValidate(DfuTarget *dts, bool bootloaderReady)
+{
+    dts->state = DfuState_Success;
 
     // check if there are images which have to be added or updated
-    for (size_t i = nextImageIndex; i < numberOfImages && dts.state != DfuState_Failed; ++i) {
-        if (!allImages[i].isInstalled || (allImages[i].installedVersion != allImages[i].version)) {
-            dts.state = DfuState_Start;
-            CleanUpStateMachine();
+    for (size_t i = dts->nextImageIndex; i < dts->numberOfImages; ++i) {
+        if (!dts->allImages[i].isInstalled || (dts->allImages[i].installedVersion != dts->allImages[i].version)) {
+            dts->state = DfuState_Start;
+            dts->bootloaderReady = bootloaderReady;
+            CleanUpStateMachine(dts);
             break;
         }
     }
 
-    MoveToNextDfuState();
+    return StateTransition_MoveImmediately;
+}
+
+/// <summary>
+/// Reads and discards any data which is waiting in the OS receive buffer.
+/// </summary>
+/// <returns>true on success; false if a read error occurred.</returns>
+static bool DiscardUartInput(DfuTarget *dts)
+{
+    bool cleared = false;
+    do {
+        uint8_t b;
+        int r = read(dts->uartFd, &b, 1);
+
+        // If a read error occurred then abort.
+        if (r < 0 && errno != EAGAIN) {
+            return false;
+        }
+
+        // If no data was read, or the read would block, then have exhausted
+        // the OS receive buffer so stop reading from the UART.
+        else if (r <= 0) {
+            cleared = true;
+        }
+
+        // Else a byte was read from the buffer, so iterate again.
+    } while (!cleared);
+
+    return true;
 }
 
-static int CreateDisarmedTimer(EventData *eventData)
+static int CreateDisarmedTimer(DfuTarget *dts, EventData *eventData)
 {
     // Setting both fields to zero disarms the timer.
     struct timespec ts = {.tv_sec = 0, .tv_nsec = 0};
-    int fd = CreateTimerFdAndAddToEpoll(epollFd, &ts, eventData, EPOLLIN);
+    int fd = CreateTimerFdAndAddToEpoll(dts->epollFd, &ts, eventData, EPOLLIN);
     return fd;
 }
 
@@ -3,6 +3,9 @@ LICENSE.txt in this directory, and for more background, see the README.md for th
 
 #pragma once
 
+#include "../image_stream.h"
+#include "worker_pool.h"
+
 /// <summary>
 /// These enums are equivalent with the ones used by the nRF52 bootloader to
 /// check the firmware version.
@@ -49,6 +52,51 @@ typedef struct {
     /// <summary>Whether an existing version of the image is present on the nRF52
     /// device.</summary>
     bool isInstalled;
+
+    /// <summary>Firmware image number of the installed version on the attached board.
+    /// If the firmware is not present on the attached board, this field will
+    /// have an undetermined value.</summary>
+    uint8_t installedImageNumber;
+
+    /// <summary>Size in bytes of the installed version on the attached board.
+    /// If the firmware is not present on the attached board, this field will
+    /// have an undetermined value.</summary>
+    uint32_t installedSize;
+
+    /// <summary>
+    /// Optional patch, made with DeltaTool/make_delta.py, which turns the application
+    /// with version deltaBaseVersion into this image.  If that version is installed,
+    /// the patch is sent instead of binPathname.  If the attached board cannot apply
+    /// the patch, the rest of the image is sent from binPathname.  Set to NULL to
+    /// always send the full image.  Only used for DfuFirmware_Application.
+    /// </summary>
+    const char *deltaPathname;
+
+    /// <summary>Version of the installed application which deltaPathname applies to.</summary>
+    uint32_t deltaBaseVersion;
+
+    /// <summary>
+    /// Optional compressed copy of binPathname, made with DeltaTool/make_delta.py without
+    /// a base image.  It is sent when deltaPathname is not, and binPathname is sent if the
+    /// attached board cannot decompress it.  Set to NULL to send binPathname.
+    /// </summary>
+    const char *compressedPathname;
+
+    /// <summary>
+    /// Optional download of the init packet, which is read instead of datPathname.
+    /// datPathname still names the image in log messages.  Set to NULL to read
+    /// datPathname from the image package.
+    /// </summary>
+    ImageStream *datStream;
+
+    /// <summary>
+    /// Optional download of the firmware, which is written to the attached board
+    /// as it arrives, instead of binPathname.  binPathname still names the image in
+    /// log messages.  A streamed image is always written in full: it is not checked
+    /// against the installed image first, and deltaPathname and compressedPathname are
+    /// not used.  Set to NULL to read binPathname from the image package.
+    /// </summary>
+    ImageStream *binStream;
 } DfuImageData;
 
 /// <summary>
@@ -65,14 +113,63 @@ typedef enum {
     DfuResult_Fail
 } DfuResultStatus;
 
+/// <summary>
+/// An attached board which is updated over its own UART.  Each target has its own
+/// state machine, timers, and buffers, so several targets can be updated at once
+/// from the same epoll loop.
+/// </summary>
+typedef struct DfuTarget DfuTarget;
+
 /// <summary>
 /// When the firmware update completes successfully or otherwise, it invokes
 /// a callback of this type.
 /// </summary>
-typedef void (*DfuResultHandler)(DfuResultStatus statusToReturn);
+typedef void (*DfuResultHandler)(DfuTarget *target, DfuResultStatus statusToReturn);
 
 /// <summary>
-/// Supply opened file descriptors to the device firmware update protocol.
+/// Progress of the firmware of the image which is being written.
+/// </summary>
+typedef struct {
+    /// <summary>Index of the image in the array which was passed to ProgramImages.</summary>
+    size_t imageIndex;
+
+    /// <summary>Number of images in the array which was passed to ProgramImages.  Images
+    /// which are already installed are skipped, so they are not reported.</summary>
+    size_t imageCount;
+
+    /// <summary>Number of firmware bytes which the attached board has executed.  This
+    /// includes bytes which were written before an interrupted update was resumed, and
+    /// counts the bytes which were rebuilt from a patch, not the size of the patch.</summary>
+    uint32_t bytesSent;
+
+    /// <summary>Size of the image's firmware.</summary>
+    uint32_t bytesTotal;
+
+    /// <summary>Firmware bytes per second since this image's transfer started, or zero
+    /// before the first object has been executed.</summary>
+    uint32_t bytesPerSecond;
+
+    /// <summary>Number of times a block has been written again, because of a timeout or a
+    /// mismatched checksum, since ProgramImages was called.</summary>
+    unsigned int retries;
+
+    /// <summary>Estimated time until this image's firmware has been written, in
+    /// milliseconds, at bytesPerSecond.  UINT32_MAX if bytesPerSecond is zero.</summary>
+    uint32_t msRemaining;
+} DfuTransferProgress;
+
+/// <summary>
+/// Called when the firmware transfer of an image starts, and each time the attached board
+/// has executed an object of it.  The handler must not call ProgramImages or
+/// CloseDfuTarget.
+/// <param name="target">Target which is being updated.</param>
+/// <param name="progress">Progress of the current image.  This is only valid for the
+/// duration of the call.</param>
+/// </summary>
+typedef void (*DfuProgressHandler)(DfuTarget *target, const DfuTransferProgress *progress);
+
+/// <summary>
+/// Creates a target from opened file descriptors.
 /// These resources must not be closed while the firmware is being updated.
 /// The firmware update mechanism uses, but does not clean up these handles.
 /// <param name="openedUartFd">Descriptor used to write to and read from attached board.</param>
@@ -80,16 +177,136 @@ typedef void (*DfuResultHandler)(DfuResultStatus statusToReturn);
 /// <param name="openedDfuFd">GPIO used to put attached board into DFU mode.</param>
 /// <param name="openedEpollFd">Descriptor used to register for notifications when issuing
 /// asynchronous reads and writes.</param>
+/// <returns>On success, a newly-allocated target which the caller must dispose of with
+/// CloseDfuTarget.  On failure it returns NULL.</returns>
+/// </summary>
+DfuTarget *OpenDfuTarget(int openedUartFd, int openedResetFd, int openedDfuFd,
+                         int openedEpollFd);
+
+/// <summary>
+/// Frees a target which was allocated with OpenDfuTarget.  The target must not be
+/// updating its images.  It is safe to call this function with a NULL pointer.
+/// </summary>
+void CloseDfuTarget(DfuTarget *target);
+
+/// <summary>
+/// Save the progress of each image to mutable storage whenever an object has been
+/// executed by the attached board.  If an update is interrupted, for example by a
+/// power failure, the next call to ProgramImages resumes from the last executed object
+/// when the attached board reports matching progress.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
+/// <param name="slot">Position of this target's progress in the mutable file.  Each
+/// target which is updated at the same time must use a different slot.</param>
+/// </summary>
+void EnableDfuResume(DfuTarget *target, size_t slot);
+
+/// <summary>
+/// Baud rate which the nRF52 bootloader uses when it enters DFU mode.  The UART which
+/// is passed to OpenDfuTarget must be opened at this rate.
+/// </summary>
+#define DFU_BOOTLOADER_BAUD_RATE 115200
+
+/// <summary>
+/// Hardware version which the nRF52 bootloader accepts, which is NRF_DFU_HW_VERSION in its
+/// sdk_config.h.  An image whose init packet is for another version is not sent.
+/// </summary>
+#define DFU_BOOTLOADER_HW_VERSION 52
+
+/// <summary>
+/// Called when the UART must be reopened at a different baud rate.  The handler must
+/// close the UART which the target is currently using, and open it again with the same
+/// settings apart from the baud rate.
+/// <param name="target">Target whose UART is changing rate.</param>
+/// <param name="baudRate">Baud rate at which to reopen the UART.</param>
+/// <returns>File descriptor for the reopened UART, or -1 on failure.</returns>
+/// </summary>
+typedef int (*DfuUartReopenHandler)(DfuTarget *target, uint32_t baudRate);
+
+/// <summary>
+/// Set faster baud rates to try after the attached board has entered DFU mode.
+/// The rates are tried in order until one is accepted by the bootloader and the
+/// board responds correctly at that rate.  If the data written at the negotiated
+/// rate repeatedly fails its checksum, the board is reset and the next rate is
+/// tried.  A rate which fails is not tried again for this target.  By default,
+/// the images are written at DFU_BOOTLOADER_BAUD_RATE.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
+/// <param name="baudRates">Rates to try, fastest first.  This array must remain
+/// valid until the target is closed.</param>
+/// <param name="count">Number of rates in baudRates.</param>
+/// <param name="reopenHandler">Function to invoke to change the UART's rate.</param>
+/// </summary>
+void SetDfuBaudRates(DfuTarget *target, const uint32_t *baudRates, size_t count,
+                     DfuUartReopenHandler reopenHandler);
+
+/// <summary>
+/// Gets the baud rate at which the images were written by the most recent call to
+/// ProgramImages.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
+/// <returns>The baud rate, in bits per second.</returns>
+/// </summary>
+uint32_t GetDfuBaudRate(const DfuTarget *target);
+
+/// <summary>
+/// Set how often the attached board acknowledges written data while images are
+/// being written.  The acknowledgements are checked as they arrive, so several
+/// writes are in flight at once; if one reports an unexpected offset or checksum,
+/// the current block of the file is written again.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
+/// <param name="interval">Number of writes per acknowledgement; zero to check the
+/// data only at the end of each block.</param>
+/// </summary>
+void SetPacketReceiptInterval(DfuTarget *target, uint16_t interval);
+
+/// <summary>
+/// Set how a lost or corrupted response is handled while images are being written.
+/// Each request is given a time to respond which depends on the operation and on how
+/// much data is still in flight at the current baud rate.  If a response does not arrive
+/// in time, or cannot be decoded, while a block of the file is being written, that block
+/// is written again.  Other requests are not repeated, so the update fails.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
+/// <param name="extraTimeoutMs">Time to add to each timeout, in milliseconds, for a
+/// board whose bootloader responds more slowly than the one in this sample.  The default
+/// is zero.</param>
+/// <param name="maxRetries">How many times a block is written again, because of a timeout
+/// or a mismatched checksum, before the update fails.  The default is three.</param>
+/// </summary>
+void SetDfuRetryPolicy(DfuTarget *target, uint32_t extraTimeoutMs, unsigned int maxRetries);
+
+/// <summary>
+/// Set a function to call with the progress of each image while it is written, for
+/// example to show when the update will finish or to detect an update which has stalled.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
+/// <param name="handler">Function to call, or NULL to stop calling one.</param>
+/// </summary>
+void SetDfuProgressHandler(DfuTarget *target, DfuProgressHandler handler);
+
+/// <summary>
+/// Set a worker pool on which the CRC-32 of an image file is calculated, before it is
+/// compared with the installed image.  Reading and checking a large file takes long enough
+/// to delay other events, such as a second target's UART, so without a pool the event loop
+/// thread is blocked while it runs.  The pool must be closed before the target.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
+/// <param name="pool">Pool initialized with the same epoll instance, or NULL to calculate the
+/// CRC-32 on the event loop thread.</param>
 /// </summary>
-void InitUartProtocol(int openedUartFd, int openedResetFd, int openedDfuFd, int openedEpollFd);
+void SetDfuWorkerPool(DfuTarget *target, WorkerPool *pool);
 
 /// <summary>
 /// Start writing the supplied images to the attached board.  When the
 /// images have been successfully written, or when the operation has failed,
-/// the supplied exit handler will be called.
+/// the supplied exit handler will be called.  Each target which is being updated
+/// at the same time needs its own array of images, because the version information
+/// is written back to it.  Before the attached board is reset, the init packet of each
+/// image is decoded and checked, so that an image which the bootloader would reject fails
+/// at once: the firmware type, the hardware version, the version in DfuImageData and the
+/// size of the firmware file must match the init packet.  An init packet which is
+/// downloaded is checked when it has arrived, and the size of a downloaded firmware file
+/// is not checked.
+/// <param name="target">Target returned by OpenDfuTarget.</param>
 /// <param name="imagesToWrite">Array of images to write to the attached board.</param>
 /// <param name="imageCount">Number of images in imagesToWrite array.</param>
 /// <param name="exitHandler">Function to invoke when completed successfully or otherwise.</param>
 /// </summary>
-void ProgramImages(DfuImageData *imagesToWrite, size_t imageCount, DfuResultHandler exitHandler);
+void ProgramImages(DfuTarget *target, DfuImageData *imagesToWrite, size_t imageCount,
+                   DfuResultHandler exitHandler);
 
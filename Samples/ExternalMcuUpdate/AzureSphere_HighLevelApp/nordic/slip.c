@@ -2,23 +2,102 @@
 LICENSE.txt in this directory, and for more background, see the README.md for this sample. */
 
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "slip.h"
 
+// Byte-wise masks used to test four input bytes at once for END or ESC.
+#define SLIP_REPEAT_BYTE(b) ((uint32_t)(b)*0x01010101u)
+#define SLIP_HAS_ZERO_BYTE(w) (((w)-0x01010101u) & ~(w)&0x80808080u)
+
+/// <summary>
+/// Find the first END or ESC byte in the supplied data.  Four bytes are
+/// tested at a time while clean words are found, and the remaining tail
+/// is tested one byte at a time.
+/// <param name="data">Start of data to search.</param>
+/// <param name="len">Length of data in bytes.</param>
+/// <returns>Offset of the first special byte, or len if there is none.</returns>
+/// </summary>
+static size_t FindNextSpecialByte(const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + sizeof(uint32_t) <= len; i += sizeof(uint32_t)) {
+        // Copy to a local value to avoid alignment problems.
+        uint32_t word;
+        memcpy(&word, &data[i], sizeof(word));
+
+        uint32_t endBytes = word ^ SLIP_REPEAT_BYTE(NRF_SLIP_BYTE_END);
+        uint32_t escBytes = word ^ SLIP_REPEAT_BYTE(NRF_SLIP_BYTE_ESC);
+        if (SLIP_HAS_ZERO_BYTE(endBytes) || SLIP_HAS_ZERO_BYTE(escBytes)) {
+            break;
+        }
+    }
+
+    for (; i < len; ++i) {
+        if (data[i] == NRF_SLIP_BYTE_END || data[i] == NRF_SLIP_BYTE_ESC) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+size_t SlipEncodeFit(const uint8_t *data, size_t len, size_t maxEncodedLen, size_t *encodedLen)
+{
+    size_t consumed = 0;
+    size_t produced = 0;
+
+    while (consumed < len) {
+        // Copy as much of the clean run as fits.
+        size_t run = FindNextSpecialByte(&data[consumed], len - consumed);
+        if (run > maxEncodedLen - produced) {
+            run = maxEncodedLen - produced;
+        }
+        consumed += run;
+        produced += run;
+
+        // Stop if the data is exhausted, or if the escaped byte would not fit.
+        if (consumed == len || maxEncodedLen - produced < 2) {
+            break;
+        }
+
+        ++consumed;
+        produced += 2;
+    }
+
+    if (encodedLen) {
+        *encodedLen = produced;
+    }
+
+    return consumed;
+}
+
+size_t SlipEncodedLength(const uint8_t *data, size_t len)
+{
+    size_t encodedLen;
+    SlipEncodeFit(data, len, SIZE_MAX, &encodedLen);
+    return encodedLen;
+}
+
 void SlipEncodeAppend(MemBuf *encBuf, const uint8_t *data, size_t len)
 {
-    for (size_t i = 0; i < len; ++i) {
-        uint8_t elem = data[i];
-
-        if (elem == NRF_SLIP_BYTE_END) {
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC);
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC_END);
-        } else if (elem == NRF_SLIP_BYTE_ESC) {
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC);
-            MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC_ESC);
-        } else {
-            MemBufAppend8(encBuf, elem);
+    while (len > 0) {
+        size_t run = FindNextSpecialByte(data, len);
+        MemBufAppend(encBuf, data, run);
+        data += run;
+        len -= run;
+
+        if (len == 0) {
+            break;
         }
+
+        MemBufAppend8(encBuf, NRF_SLIP_BYTE_ESC);
+        MemBufAppend8(encBuf, (*data == NRF_SLIP_BYTE_END) ? NRF_SLIP_BYTE_ESC_END
+                                                           : NRF_SLIP_BYTE_ESC_ESC);
+        ++data;
+        --len;
     }
 }
 
@@ -65,3 +144,27 @@ void SlipDecodeAddByte(uint8_t b, MemBuf *decBuf, NrfSlipDecodeState *state, boo
         break;
     }
 }
+
+size_t SlipDecodeAppend(const uint8_t *data, size_t len, MemBuf *decBuf, NrfSlipDecodeState *state,
+                        bool *finished)
+{
+    *finished = false;
+    size_t consumed = 0;
+
+    while (consumed < len && !*finished && *state != NRF_SLIP_STATE_CLEARING_INVALID_PACKET) {
+        // Copy a run of unescaped bytes straight into the decoded buffer.
+        if (*state == NRF_SLIP_STATE_DECODING) {
+            size_t run = FindNextSpecialByte(&data[consumed], len - consumed);
+            MemBufAppend(decBuf, &data[consumed], run);
+            consumed += run;
+            if (consumed == len) {
+                break;
+            }
+        }
+
+        SlipDecodeAddByte(data[consumed], decBuf, state, finished);
+        ++consumed;
+    }
+
+    return consumed;
+}
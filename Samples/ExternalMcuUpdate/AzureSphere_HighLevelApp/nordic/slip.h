@@ -42,6 +42,26 @@ typedef enum {
 /// </summary>
 void SlipEncodeAppend(MemBuf *encBuf, const uint8_t *data, size_t len);
 
+/// <summary>
+/// Calculate the exact number of bytes which the supplied data would occupy
+/// after SLIP encoding, excluding the end-of-packet marker.
+/// <param name="data">Start of unencoded data.</param>
+/// <param name="len">Length of unencoded data in bytes.</param>
+/// <returns>Length of the encoded data in bytes.</returns>
+/// </summary>
+size_t SlipEncodedLength(const uint8_t *data, size_t len);
+
+/// <summary>
+/// Calculate the longest prefix of the supplied data which, after SLIP encoding,
+/// fits in the supplied number of bytes.  An escape sequence is never split.
+/// <param name="data">Start of unencoded data.</param>
+/// <param name="len">Length of unencoded data in bytes.</param>
+/// <param name="maxEncodedLen">Space available for the encoded data in bytes.</param>
+/// <param name="encodedLen">If not NULL, receives the encoded length of the prefix.</param>
+/// <returns>Length of the unencoded prefix in bytes.</returns>
+/// </summary>
+size_t SlipEncodeFit(const uint8_t *data, size_t len, size_t maxEncodedLen, size_t *encodedLen);
+
 /// <summary>
 /// Append an end-of-packet marker to the SLIP-encoded buffer.
 /// <param name="encBuf">Buffer which contains SLIP-encoded data.</param>
@@ -58,3 +78,20 @@ void SlipEncodeAddEndMarker(MemBuf *encBuf);
 /// <param name="finished">Set to true if reached end of packet, false otherwise.</param>
 /// </summary>
 void SlipDecodeAddByte(uint8_t b, MemBuf *decBuf, NrfSlipDecodeState *state, bool *finished);
+
+/// <summary>
+/// Process a block of SLIP-encoded bytes and add them to the buffer which
+/// contains decoded data.  Decoding stops after the end-of-packet marker, or
+/// as soon as invalid data is found, so any following bytes are left for the
+/// caller to process later.
+/// <param name="data">Start of encoded data to process.</param>
+/// <param name="len">Length of encoded data in bytes.</param>
+/// <param name="decBuf">Buffer which contains decoded data.  It must have space
+/// for at least len more bytes.</param>
+/// <param name="state">Keeps track of whether in escaped sequence or
+/// processing invalid data.</param>
+/// <param name="finished">Set to true if reached end of packet, false otherwise.</param>
+/// <returns>Number of encoded bytes which were consumed.</returns>
+/// </summary>
+size_t SlipDecodeAppend(const uint8_t *data, size_t len, MemBuf *decBuf, NrfSlipDecodeState *state,
+                        bool *finished);
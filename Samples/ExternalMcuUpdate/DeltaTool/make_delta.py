@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+"""Creates a patch which turns one nRF52 application image into another, or compresses an image.
+
+The Azure Sphere app sends the patch instead of the full .bin file when the
+attached board reports that the base version is installed. The bootloader in
+this sample rebuilds each data object from the application which is already
+in flash, so the offsets and CRCs which it reports are the same as for the
+full image.
+
+Without a base image, the output is a compressed copy of the image, which
+only refers to earlier data in the same object. The app sends it instead of
+the full .bin file when no patch applies, and it can be used for any image.
+
+Usage: make_delta.py [--base BASE.bin] TARGET.bin OUTPUT [--object-size N]
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+# Keep these values the same as in nordic/dfu_defs.h and nrf_dfu_delta.h.
+DELTA_MAGIC = 0x544C444E  # "NDLT"
+DELTA_FORMAT_VERSION = 1
+
+OP_LITERAL = 0x00
+OP_COPY = 0x01
+OP_BASE = 0x02
+OP_REPEAT = 0x03
+OP_SHORT_LITERAL = 0x40
+OP_SHORT_REPEAT = 0x80
+
+# Limits of the short forms, which take one byte for a literal and two bytes for a repeat.
+SHORT_LITERAL_MAX_LENGTH = 64
+SHORT_REPEAT_MIN_LENGTH = 3
+SHORT_REPEAT_MAX_LENGTH = 18
+SHORT_REPEAT_MAX_DISTANCE = 2048
+
+# Length of the runs which are used to find matches in the base image.
+KEY_LENGTH = 8
+
+# Length of the runs which are used to find matches earlier in the same object.
+REPEAT_KEY_LENGTH = SHORT_REPEAT_MIN_LENGTH
+
+# A copy operation takes seven bytes, so shorter matches are sent as literals.
+MIN_MATCH_LENGTH = 12
+
+# A long repeat operation takes five bytes.
+MIN_REPEAT_LENGTH = 6
+
+# Maximum number of offsets which are remembered for each key.
+MAX_CANDIDATES = 16
+
+MAX_OP_LENGTH = 0xFFFF
+
+
+def index_base(base):
+    index = {}
+    for offset in range(len(base) - KEY_LENGTH + 1):
+        candidates = index.setdefault(base[offset:offset + KEY_LENGTH], [])
+        if len(candidates) < MAX_CANDIDATES:
+            candidates.append(offset)
+    return index
+
+
+def longest_match(base, index, target, pos, end):
+    """Returns (length, base offset) of the longest match for target[pos:end]."""
+    best_len, best_src = 0, 0
+    limit = min(end - pos, MAX_OP_LENGTH)
+    for src in index.get(target[pos:pos + KEY_LENGTH], ()):
+        length = 0
+        max_len = min(limit, len(base) - src)
+        while length < max_len and base[src + length] == target[pos + length]:
+            length += 1
+        if length > best_len:
+            best_len, best_src = length, src
+    return best_len, best_src
+
+
+def repeat_saving(length, distance):
+    """Returns (bytes saved, length to use) for a repeat of the supplied match."""
+    saving, used = 0, 0
+    if length >= MIN_REPEAT_LENGTH:
+        saving, used = length - 5, length
+    if length >= SHORT_REPEAT_MIN_LENGTH and distance <= SHORT_REPEAT_MAX_DISTANCE:
+        short_len = min(length, SHORT_REPEAT_MAX_LENGTH)
+        if short_len - 2 > saving:
+            saving, used = short_len - 2, short_len
+    return saving, used
+
+
+def best_repeat(recent, target, pos, end):
+    """Returns (bytes saved, length, distance) of the best match for target[pos:end] earlier
+    in the object.
+
+    The match may overlap pos, because the bootloader copies it one byte at a time.
+    """
+    best = (0, 0, 0)
+    limit = min(end - pos, MAX_OP_LENGTH)
+    for src in recent.get(target[pos:pos + REPEAT_KEY_LENGTH], ()):
+        length = 0
+        while length < limit and target[src + length] == target[pos + length]:
+            length += 1
+        saving, used = repeat_saving(length, pos - src)
+        if saving > best[0]:
+            best = (saving, used, pos - src)
+    return best
+
+
+def encode_object(base, base_crc, index, target, start, end):
+    """Returns the operations which produce target[start:end].
+
+    If base is None, then the operations do not refer to a base image.
+    """
+    ops = bytearray()
+    if base is not None:
+        ops.extend(struct.pack('<BII', OP_BASE, len(base), base_crc))
+    literal_start = start
+    pos = start
+
+    # Offsets in this object, most recent last, which repeat operations can refer to.
+    recent = {}
+    indexed = start
+
+    def index_up_to(upto):
+        nonlocal indexed
+        while indexed < min(upto, end - REPEAT_KEY_LENGTH + 1):
+            candidates = recent.setdefault(target[indexed:indexed + REPEAT_KEY_LENGTH], [])
+            candidates.append(indexed)
+            if len(candidates) > MAX_CANDIDATES:
+                del candidates[0]
+            indexed += 1
+
+    def flush_literal(upto):
+        nonlocal literal_start
+        while literal_start < upto:
+            length = min(upto - literal_start, MAX_OP_LENGTH)
+            if length <= SHORT_LITERAL_MAX_LENGTH:
+                ops.append(OP_SHORT_LITERAL | (length - 1))
+            else:
+                ops.extend(struct.pack('<BH', OP_LITERAL, length))
+            ops.extend(target[literal_start:literal_start + length])
+            literal_start += length
+
+    while pos < end:
+        index_up_to(pos)
+
+        # Use whichever match saves more bytes.
+        copy_len, src = (0, 0)
+        if base is not None:
+            copy_len, src = longest_match(base, index, target, pos, end)
+        saving, repeat_len, distance = best_repeat(recent, target, pos, end)
+        copy_saving = copy_len - 7 if copy_len >= MIN_MATCH_LENGTH else 0
+
+        if copy_saving == 0 and saving == 0:
+            pos += 1
+            continue
+
+        flush_literal(pos)
+        if copy_saving >= saving:
+            ops.extend(struct.pack('<BHI', OP_COPY, copy_len, src))
+            pos += copy_len
+        elif repeat_len <= SHORT_REPEAT_MAX_LENGTH and distance <= SHORT_REPEAT_MAX_DISTANCE:
+            code = ((repeat_len - SHORT_REPEAT_MIN_LENGTH) << 11) | (distance - 1)
+            ops.extend(struct.pack('>H', (OP_SHORT_REPEAT << 8) | code))
+            pos += repeat_len
+        else:
+            ops.extend(struct.pack('<BHH', OP_REPEAT, repeat_len, distance))
+            pos += repeat_len
+        literal_start = pos
+
+    flush_literal(end)
+    return ops
+
+
+def make_delta(base, target, object_size):
+    """Returns a patch from base to target, or a compressed copy of target if base is None."""
+    if base is None:
+        base_size, base_crc, index = 0, 0, None
+    else:
+        base_size, base_crc, index = len(base), zlib.crc32(base) & 0xFFFFFFFF, index_base(base)
+
+    out = bytearray(struct.pack('<IHHIIII', DELTA_MAGIC, DELTA_FORMAT_VERSION, 0, base_size,
+                                base_crc, len(target), zlib.crc32(target) & 0xFFFFFFFF))
+
+    running_crc = 0
+    for start in range(0, len(target), object_size):
+        end = min(start + object_size, len(target))
+        ops = encode_object(base, base_crc, index, target, start, end)
+        running_crc = zlib.crc32(target[start:end], running_crc) & 0xFFFFFFFF
+        out.extend(struct.pack('<III', len(ops), end - start, running_crc))
+        out.extend(ops)
+
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--base', help='application image which is installed on the board; '
+                        'if omitted, the output is a compressed image')
+    parser.add_argument('target', help='new image')
+    parser.add_argument('output', help='patch or compressed image file to create')
+    parser.add_argument('--object-size', type=int, default=4096,
+                        help='size of each data object; must match the bootloader (default 4096)')
+    args = parser.parse_args()
+    if args.object_size > 0xFFFF:
+        parser.error('the object size must be less than 64 KB')
+
+    base = None
+    if args.base:
+        with open(args.base, 'rb') as f:
+            base = f.read()
+    with open(args.target, 'rb') as f:
+        target = f.read()
+
+    delta = make_delta(base, target, args.object_size)
+    with open(args.output, 'wb') as f:
+        f.write(delta)
+
+    print('Wrote {} bytes ({:.1%} of {} bytes).'.format(len(delta), len(delta) / max(len(target), 1),
+                                                      len(target)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,624 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+"""Simulates the nRF52 bootloader in this sample, and measures DFU performance.
+
+Connect the MT3620 UART which the Azure Sphere app uses for DFU, including
+RTS and CTS, to a serial port on a Linux PC, for example with a USB to serial
+adapter, and run this script on that port instead of attaching an nRF52. The script answers the
+DFU requests in the same way as the bootloader in this sample, including the
+baud rate change, patches, compressed objects and image CRC checks. It keeps
+the images which it receives in memory, so that a second update sees them as
+installed.
+
+For each image, the script reports:
+- the image size and the number of bytes which were received over the UART
+- the throughput, from the first select request to the last execute response
+- the number of responses, which is the number of round trips
+- the mean time which the app took to send the next request after a response
+
+Use --latency-ms to delay each response, to see how the transfer copes with
+a slower peer. On a pseudo-terminal, which has no line rate, use --pace to hold
+each request and response back for as long as it would take on a UART at the
+current baud rate. The DfuBench harness in Samples/Benchmarks runs the app's
+DFU code against this script in this way, without a device.
+
+Usage: fake_bootloader.py PORT [--baud N] [--latency-ms N] [--mtu N] [--object-size N]
+                          [--pace]
+                          [--installed-app FILE:VERSION] [--installed-sd FILE:VERSION]
+                          [--no-baud-change] [--no-vendor-objects]
+"""
+
+import argparse
+import os
+import struct
+import sys
+import termios
+import time
+import tty
+import zlib
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+
+OP_CREATE = 0x01
+OP_PRN_SET = 0x02
+OP_CRC_GET = 0x03
+OP_EXECUTE = 0x04
+OP_SELECT = 0x06
+OP_MTU_GET = 0x07
+OP_WRITE = 0x08
+OP_PING = 0x09
+OP_FW_VERSION = 0x0B
+OP_ABORT = 0x0C
+OP_RESPONSE = 0x60
+
+RES_SUCCESS = 0x01
+RES_OP_NOT_SUPPORTED = 0x02
+RES_INVALID_PARAMETER = 0x03
+RES_INSUFFICIENT_RESOURCES = 0x04
+RES_INVALID_OBJECT = 0x05
+RES_NOT_PERMITTED = 0x08
+
+OBJ_COMMAND = 0x01
+OBJ_DATA = 0x02
+OBJ_BAUD_RATE = 0x80
+OBJ_DELTA_DATA = 0x81
+OBJ_COMPRESSED_DATA = 0x82
+OBJ_IMAGE_CRC = 0x83
+
+# Values which are reported by NrfDfuOp_FirmwareVersion.
+FW_TYPE_SOFTDEVICE = 0x00
+FW_TYPE_APPLICATION = 0x01
+FW_TYPE_BOOTLOADER = 0x02
+FW_TYPE_UNKNOWN = 0xFF
+
+# Values of the type field in the init packet.
+INIT_TYPE_APPLICATION = 0
+INIT_TYPE_SOFTDEVICE = 1
+
+COMMAND_MAX_SIZE = 512
+# Largest object which is rebuilt from a patch or decompressed.
+DELTA_OBJECT_MAX_SIZE = 4096
+
+# Time for which the bootloader does not answer while it activates an image and restarts.
+RESTART_TIME_S = 0.2
+
+# Bits on the line for each byte: a start bit, eight data bits and a stop bit.
+UART_BITS_PER_BYTE = 10
+
+BAUD_RATES = {
+    115200: termios.B115200,
+    230400: termios.B230400,
+    460800: termios.B460800,
+    921600: getattr(termios, 'B921600', None),
+    1000000: getattr(termios, 'B1000000', None),
+}
+
+
+def crc32(data, crc=0):
+    return zlib.crc32(data, crc) & 0xFFFFFFFF
+
+
+def slip_encode(data):
+    out = bytearray()
+    for b in data:
+        if b == SLIP_END:
+            out += bytes((SLIP_ESC, SLIP_ESC_END))
+        elif b == SLIP_ESC:
+            out += bytes((SLIP_ESC, SLIP_ESC_ESC))
+        else:
+            out.append(b)
+    out.append(SLIP_END)
+    return bytes(out)
+
+
+def read_varint(data, pos):
+    value, shift = 0, 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def parse_protobuf(data):
+    """Returns a dict from field number to a list of values, for one message."""
+    fields = {}
+    pos = 0
+    while pos < len(data):
+        key, pos = read_varint(data, pos)
+        number, wire_type = key >> 3, key & 7
+        if wire_type == 0:
+            value, pos = read_varint(data, pos)
+        elif wire_type == 2:
+            length, pos = read_varint(data, pos)
+            value, pos = data[pos:pos + length], pos + length
+        elif wire_type == 5:
+            value, pos = data[pos:pos + 4], pos + 4
+        elif wire_type == 1:
+            value, pos = data[pos:pos + 8], pos + 8
+        else:
+            raise ValueError('unsupported protobuf wire type {}'.format(wire_type))
+        fields.setdefault(number, []).append(value)
+    return fields
+
+
+def parse_init_packet(packet):
+    """Returns (type, firmware version, firmware size) from an init packet."""
+    fields = parse_protobuf(packet)
+    if 2 in fields:
+        # Signed command.
+        fields = parse_protobuf(fields[2][0])
+    command = parse_protobuf(fields[1][0])
+    init = parse_protobuf(command[2][0])
+
+    fw_type = init.get(4, [INIT_TYPE_APPLICATION])[0]
+    if fw_type == INIT_TYPE_SOFTDEVICE:
+        size = init.get(5, [0])[0]
+    else:
+        size = init.get(7, [0])[0]
+    return fw_type, init.get(1, [0])[0], size
+
+
+def apply_ops(ops, size, base):
+    """Rebuilds an object from patch or compressed operations, as nrf_dfu_delta.c does.
+
+    Returns None if the operations are not valid.
+    """
+    out = bytearray()
+    pos = 0
+    base_matched = base is None
+    while pos < len(ops):
+        op = ops[pos]
+        if op & 0x80:
+            length = 3 + ((op >> 3) & 0x0F)
+            distance = 1 + (((op & 0x07) << 8) | ops[pos + 1])
+            op, pos = 0x03, pos + 2
+        elif op & 0x40:
+            length = 1 + (op & 0x3F)
+            op, pos = 0x00, pos + 1
+        elif op == 0x02:
+            base_size, base_crc = struct.unpack_from('<II', ops, pos + 1)
+            pos += 9
+            base_matched = (base is not None and base_size == len(base) and
+                            base_crc == crc32(base))
+            if not base_matched:
+                return None
+            continue
+        else:
+            length = struct.unpack_from('<H', ops, pos + 1)[0]
+            if op == 0x01:
+                src = struct.unpack_from('<I', ops, pos + 3)[0]
+                pos += 7
+            elif op == 0x03:
+                distance = struct.unpack_from('<H', ops, pos + 3)[0]
+                pos += 5
+            elif op == 0x00:
+                pos += 3
+            else:
+                return None
+
+        if not base_matched or len(out) + length > size:
+            return None
+
+        if op == 0x00:
+            out += ops[pos:pos + length]
+            pos += length
+        elif op == 0x01:
+            if base is None or src + length > len(base):
+                return None
+            out += base[src:src + length]
+        else:
+            if distance == 0 or distance > len(out):
+                return None
+            for _ in range(length):
+                out.append(out[-distance])
+
+    return bytes(out) if len(out) == size else None
+
+
+class ImageStats:
+    def __init__(self):
+        self.start = None
+        self.end = None
+        self.image_size = 0
+        self.image_bytes = 0
+        self.wire_bytes = 0
+        self.responses = 0
+        self.turnaround = 0.0
+        self.turnarounds = 0
+
+
+class FakeBootloader:
+    def __init__(self, port, args):
+        self.port = port
+        self.args = args
+        self.baud_rate = args.baud
+        self.pending_baud_rate = None
+        self.prn = 0
+        self.writes_since_prn = 0
+
+        # Installed images by firmware version type: (version, contents).
+        self.installed = {}
+
+        self.current_object = OBJ_COMMAND
+        self.init_packet = b''
+        self.command_size = 0
+        self.init_info = None
+        self.data = bytearray()
+        self.executed = 0
+        self.object_start = 0
+        self.object_size = 0
+        self.delta_ops = None
+        self.crc_image = None
+
+        self.stats = None
+        self.last_response_time = None
+        self.restart_until = None
+
+        # With --pace, the time at which the bytes received so far, and the bytes sent so far,
+        # would have finished on the line.
+        self.rx_line_time = 0.0
+        self.tx_line_time = 0.0
+
+    # ---- serial port ----
+
+    def set_baud_rate(self, baud_rate):
+        speed = BAUD_RATES[baud_rate]
+        attrs = termios.tcgetattr(self.port)
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(self.port, termios.TCSADRAIN, attrs)
+        self.baud_rate = baud_rate
+
+    def line_time(self, count):
+        return count * UART_BITS_PER_BYTE / self.baud_rate
+
+    def wait_until(self, deadline):
+        delay = deadline - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+    def send(self, request, result, payload=b''):
+        if self.args.latency_ms:
+            time.sleep(self.args.latency_ms / 1000.0)
+        encoded = slip_encode(bytes((OP_RESPONSE, request, result)) + payload)
+        if self.args.pace:
+            # The response starts when the previous one has left, and arrives when it has all
+            # been sent.
+            self.tx_line_time = max(self.tx_line_time, time.monotonic())
+            self.tx_line_time += self.line_time(len(encoded))
+            self.wait_until(self.tx_line_time)
+        os.write(self.port, encoded)
+        self.last_response_time = time.monotonic()
+        if self.stats:
+            self.stats.responses += 1
+
+        # Change the rate after the response has been sent at the old rate.
+        if self.pending_baud_rate:
+            termios.tcdrain(self.port)
+            self.set_baud_rate(self.pending_baud_rate)
+            self.pending_baud_rate = None
+
+    def packets(self):
+        """Yields each decoded packet, with the number of bytes which it took on the wire."""
+        packet = bytearray()
+        wire = 0
+        escaped = False
+        while True:
+            chunk = os.read(self.port, 4096)
+            if not chunk:
+                return
+            if self.args.pace:
+                # The chunk has all arrived when the line has carried it after the bytes before.
+                self.rx_line_time = max(self.rx_line_time, time.monotonic())
+                self.rx_line_time += self.line_time(len(chunk))
+                self.wait_until(self.rx_line_time)
+            for b in chunk:
+                # Measure how long the app took to start the next request.
+                if wire == 0 and self.last_response_time is not None and self.stats:
+                    self.stats.turnaround += time.monotonic() - self.last_response_time
+                    self.stats.turnarounds += 1
+                    self.last_response_time = None
+                wire += 1
+                if escaped:
+                    packet.append(SLIP_END if b == SLIP_ESC_END else SLIP_ESC)
+                    escaped = False
+                elif b == SLIP_ESC:
+                    escaped = True
+                elif b == SLIP_END:
+                    if packet:
+                        yield bytes(packet), wire
+                    packet = bytearray()
+                    wire = 0
+                else:
+                    packet.append(b)
+
+    # ---- request handling ----
+
+    def run(self):
+        for packet, wire in self.packets():
+            if self.stats:
+                self.stats.wire_bytes += wire
+            # Requests which arrive while the bootloader restarts are lost.
+            if self.restart_until is not None:
+                if time.monotonic() < self.restart_until:
+                    continue
+                self.restart_until = None
+            self.handle(packet[0], packet[1:])
+
+    def handle(self, op, payload):
+        if op == OP_PING:
+            self.send(op, RES_SUCCESS, payload[:1])
+        elif op == OP_PRN_SET:
+            self.prn = struct.unpack('<H', payload[:2])[0]
+            self.send(op, RES_SUCCESS)
+        elif op == OP_MTU_GET:
+            self.send(op, RES_SUCCESS, struct.pack('<H', self.args.mtu))
+        elif op == OP_FW_VERSION:
+            self.send(op, RES_SUCCESS, self.firmware_info(payload[0]))
+        elif op == OP_ABORT:
+            self.report()
+        elif op in (OP_SELECT, OP_CREATE):
+            self.current_object = payload[0]
+            self.handle_object(op, payload)
+        elif op in (OP_WRITE, OP_CRC_GET, OP_EXECUTE):
+            self.handle_object(op, payload)
+        else:
+            self.send(op, RES_OP_NOT_SUPPORTED)
+
+    def firmware_info(self, image_number):
+        """Returns the payload of a firmware version response, or None."""
+        images = [(FW_TYPE_BOOTLOADER, 1, 0x78000, 0x6000)]
+        addr = 0x1000
+        for fw_type in (FW_TYPE_SOFTDEVICE, FW_TYPE_APPLICATION):
+            if fw_type in self.installed:
+                version, contents = self.installed[fw_type]
+                images.append((fw_type, version, addr, len(contents)))
+                addr += len(contents)
+        if image_number >= len(images):
+            return struct.pack('<BIII', FW_TYPE_UNKNOWN, 0, 0, 0)
+        return struct.pack('<BIII', *images[image_number])
+
+    def handle_object(self, op, payload):
+        vendor = self.current_object >= OBJ_BAUD_RATE
+        if vendor and self.args.no_vendor_objects:
+            self.send(op, RES_INVALID_OBJECT)
+        elif self.current_object == OBJ_COMMAND:
+            self.handle_command(op, payload)
+        elif self.current_object in (OBJ_DATA, OBJ_DELTA_DATA, OBJ_COMPRESSED_DATA):
+            self.handle_data(op, payload)
+        elif self.current_object == OBJ_BAUD_RATE:
+            self.handle_baud_rate(op, payload)
+        elif self.current_object == OBJ_IMAGE_CRC:
+            self.handle_image_crc(op, payload)
+        else:
+            self.send(op, RES_INVALID_OBJECT)
+
+    def handle_command(self, op, payload):
+        if op == OP_SELECT:
+            self.stats = ImageStats()
+            self.stats.start = time.monotonic()
+            self.send(op, RES_SUCCESS, struct.pack('<III', COMMAND_MAX_SIZE, len(self.init_packet),
+                                                   crc32(self.init_packet)))
+        elif op == OP_CREATE:
+            self.command_size = struct.unpack('<I', payload[1:5])[0]
+            if self.command_size > COMMAND_MAX_SIZE:
+                self.send(op, RES_INSUFFICIENT_RESOURCES)
+                return
+            # Creating the command object discards any firmware which was received.
+            self.init_packet = b''
+            self.init_info = None
+            self.data = bytearray()
+            self.executed = 0
+            self.writes_since_prn = 0
+            self.send(op, RES_SUCCESS)
+        elif op == OP_WRITE:
+            self.init_packet += payload
+            self.count_write(len(self.init_packet), crc32(self.init_packet))
+        elif op == OP_CRC_GET:
+            self.send(op, RES_SUCCESS, struct.pack('<II', len(self.init_packet),
+                                                   crc32(self.init_packet)))
+        elif op == OP_EXECUTE:
+            try:
+                self.init_info = parse_init_packet(self.init_packet)
+            except (IndexError, KeyError, ValueError):
+                self.send(op, RES_INVALID_PARAMETER)
+                return
+            self.send(op, RES_SUCCESS)
+
+    def handle_data(self, op, payload):
+        if op == OP_SELECT:
+            self.send(op, RES_SUCCESS, struct.pack('<III', self.args.object_size, len(self.data),
+                                                   crc32(self.data)))
+        elif op == OP_CREATE:
+            size = struct.unpack('<I', payload[1:5])[0]
+            max_size = self.args.object_size if self.current_object == OBJ_DATA \
+                else DELTA_OBJECT_MAX_SIZE
+            if self.init_info is None or size > max_size:
+                self.send(op, RES_NOT_PERMITTED)
+                return
+            base = None
+            if self.current_object == OBJ_DELTA_DATA:
+                if FW_TYPE_APPLICATION not in self.installed:
+                    self.send(op, RES_NOT_PERMITTED)
+                    return
+                base = self.installed[FW_TYPE_APPLICATION][1]
+            # Data after the last executed object is discarded.
+            del self.data[self.executed:]
+            self.object_start = self.executed
+            self.object_size = size
+            self.writes_since_prn = 0
+            self.delta_ops = (bytearray(), base) if self.current_object != OBJ_DATA else None
+            self.send(op, RES_SUCCESS)
+        elif op == OP_WRITE:
+            # The bootloader decodes a request of up to one byte less than the MTU, with its
+            # opcode, and drops a longer one.
+            if len(payload) > self.args.mtu - 2:
+                return
+            if self.stats:
+                self.stats.image_bytes += len(payload)
+            if self.delta_ops is None:
+                self.data += payload
+            else:
+                ops, base = self.delta_ops
+                ops += payload
+                try:
+                    rebuilt = apply_ops(bytes(ops), self.object_size, base)
+                except (IndexError, struct.error):
+                    # The last operation has not been received yet.
+                    rebuilt = None
+                if rebuilt is not None:
+                    self.data += rebuilt
+                    self.delta_ops = None
+            self.count_write(len(self.data), crc32(self.data))
+        elif op == OP_CRC_GET:
+            self.send(op, RES_SUCCESS, struct.pack('<II', len(self.data), crc32(self.data)))
+        elif op == OP_EXECUTE:
+            if len(self.data) != self.object_start + self.object_size:
+                self.send(op, RES_NOT_PERMITTED)
+                return
+            self.executed = len(self.data)
+            self.send(op, RES_SUCCESS)
+            self.check_image_complete()
+
+    def count_write(self, offset, crc):
+        """Sends a packet receipt notification if one is due."""
+        self.writes_since_prn += 1
+        if self.prn and self.writes_since_prn >= self.prn:
+            self.writes_since_prn = 0
+            self.send(OP_CRC_GET, RES_SUCCESS, struct.pack('<II', offset, crc))
+
+    def check_image_complete(self):
+        fw_type, version, size = self.init_info
+        if self.executed < size:
+            return
+
+        key = FW_TYPE_SOFTDEVICE if fw_type == INIT_TYPE_SOFTDEVICE else FW_TYPE_APPLICATION
+        self.installed[key] = (version, bytes(self.data))
+        if self.stats:
+            self.stats.image_size = len(self.data)
+        self.init_packet = b''
+        self.init_info = None
+        self.data = bytearray()
+        self.executed = 0
+        self.report()
+
+        # The bootloader activates the image and restarts at its initial rate.
+        self.restart_until = time.monotonic() + RESTART_TIME_S
+        termios.tcdrain(self.port)
+        self.set_baud_rate(self.args.baud)
+
+    def handle_baud_rate(self, op, payload):
+        rate = struct.unpack('<I', payload[1:5])[0] if op == OP_CREATE else 0
+        if op != OP_CREATE:
+            self.send(op, RES_NOT_PERMITTED)
+        elif self.args.no_baud_change or BAUD_RATES.get(rate) is None:
+            self.send(op, RES_INVALID_PARAMETER)
+        else:
+            self.pending_baud_rate = rate
+            self.send(op, RES_SUCCESS)
+            print('Changed to {} baud.'.format(rate))
+
+    def handle_image_crc(self, op, payload):
+        if op == OP_CREATE:
+            value = struct.unpack('<I', payload[1:5])[0]
+            info = self.firmware_info(value >> 24)
+            fw_type = info[0]
+            length = value & 0x00FFFFFF
+            if fw_type not in self.installed or length > len(self.installed[fw_type][1]):
+                self.crc_image = None
+                self.send(op, RES_INVALID_PARAMETER)
+                return
+            self.crc_image = self.installed[fw_type][1][:length]
+            self.send(op, RES_SUCCESS)
+        elif op == OP_CRC_GET and self.crc_image is not None:
+            self.send(op, RES_SUCCESS, struct.pack('<II', len(self.crc_image),
+                                                   crc32(self.crc_image)))
+        else:
+            self.send(op, RES_NOT_PERMITTED)
+
+    def report(self):
+        stats, self.stats = self.stats, None
+        if not stats or stats.image_bytes == 0:
+            return
+        stats.end = time.monotonic()
+        elapsed = max(stats.end - stats.start, 1e-6)
+        turnaround = stats.turnaround / stats.turnarounds if stats.turnarounds else 0.0
+        print('Image of {} bytes: {} bytes of data objects, {} bytes received in {:.2f} s '
+              'at {} baud.'.format(stats.image_size, stats.image_bytes, stats.wire_bytes, elapsed,
+                                   self.baud_rate))
+        print('  Throughput: {:.0f} image bytes/s, {:.0f} bytes/s on the wire.'.format(
+            stats.image_size / elapsed, stats.wire_bytes / elapsed))
+        print('  Round trips: {}, mean app turnaround {:.2f} ms.'.format(
+            stats.responses, turnaround * 1000))
+        sys.stdout.flush()
+
+
+def parse_installed(value):
+    pathname, _, version = value.rpartition(':')
+    with open(pathname, 'rb') as f:
+        return int(version), f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('port', help='serial port which is connected to the MT3620')
+    parser.add_argument('--baud', type=int, default=115200,
+                        help='initial baud rate (default 115200)')
+    parser.add_argument('--latency-ms', type=float, default=0,
+                        help='delay before each response in milliseconds')
+    parser.add_argument('--mtu', type=int, default=507,
+                        help='MTU to report; the bootloader in this sample reports 507, '
+                             'and the SDK bootloader 131')
+    parser.add_argument('--object-size', type=int, default=16384,
+                        help='largest data object to report; the bootloader in this sample '
+                        'reports 16384, and the SDK bootloader 4096')
+    parser.add_argument('--installed-app', metavar='FILE:VERSION', type=parse_installed,
+                        help='application which is already installed')
+    parser.add_argument('--installed-sd', metavar='FILE:VERSION', type=parse_installed,
+                        help='SoftDevice which is already installed')
+    parser.add_argument('--no-baud-change', action='store_true',
+                        help='reject requests to change the baud rate')
+    parser.add_argument('--no-vendor-objects', action='store_true',
+                        help='reject all of the object types which this sample adds, '
+                        'like the SDK bootloader')
+    parser.add_argument('--pace', action='store_true',
+                        help='take as long as a UART at the current baud rate would, '
+                        'for a pseudo-terminal')
+    args = parser.parse_args()
+
+    if BAUD_RATES.get(args.baud) is None:
+        parser.error('unsupported baud rate {}'.format(args.baud))
+
+    port = os.open(args.port, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(port)
+    # The app uses RTS/CTS flow control, as the nRF52 does.
+    attrs = termios.tcgetattr(port)
+    attrs[2] |= termios.CRTSCTS | termios.CLOCAL
+    termios.tcsetattr(port, termios.TCSANOW, attrs)
+
+    bootloader = FakeBootloader(port, args)
+    bootloader.set_baud_rate(args.baud)
+    if args.installed_sd:
+        bootloader.installed[FW_TYPE_SOFTDEVICE] = args.installed_sd
+    if args.installed_app:
+        bootloader.installed[FW_TYPE_APPLICATION] = args.installed_app
+
+    print('Waiting for DFU requests on {} at {} baud.'.format(args.port, args.baud))
+    try:
+        bootloader.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(port)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,45 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "nrf_dfu_crc32.h"
+
+#define CRC32_POLYNOMIAL    (0xEDB88320UL)  /**< Reflected polynomial used by crc32_compute. */
+
+static uint32_t m_table[256];               /**< CRC-32 of each byte value. */
+static bool     m_table_ready;
+
+
+static void table_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (uint32_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        m_table[i] = crc;
+    }
+
+    m_table_ready = true;
+}
+
+
+uint32_t nrf_dfu_crc32_compute(uint8_t const * p_data, uint32_t size, uint32_t const * p_crc)
+{
+    if (!m_table_ready)
+    {
+        table_init();
+    }
+
+    uint32_t crc = (p_crc == NULL) ? 0xFFFFFFFF : ~(*p_crc);
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        crc = (crc >> 8) ^ m_table[(crc ^ p_data[i]) & 0xFF];
+    }
+
+    return ~crc;
+}
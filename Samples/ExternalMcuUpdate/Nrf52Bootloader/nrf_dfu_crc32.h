@@ -0,0 +1,24 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef NRF_DFU_CRC32_H__
+#define NRF_DFU_CRC32_H__
+
+#include <stdint.h>
+
+/**@brief Function for calculating a CRC-32, in the same way as crc32_compute.
+ *
+ * This uses a 256-entry table, which is built in RAM on the first call, so it processes
+ * a byte per table lookup instead of a bit per iteration. The nRF52832 has no CRC
+ * peripheral, and the CPU stalls while NVMC programs flash, so the CRC cannot run
+ * alongside the flash writes; this keeps the time spent on it short instead.
+ *
+ * @param[in] p_data    Data to calculate the CRC-32 over.
+ * @param[in] size      Number of bytes in p_data.
+ * @param[in] p_crc     CRC-32 of the data which precedes p_data, or NULL to start a new CRC.
+ *
+ * @return  The CRC-32 of the data so far.
+ */
+uint32_t nrf_dfu_crc32_compute(uint8_t const * p_data, uint32_t size, uint32_t const * p_crc);
+
+#endif // NRF_DFU_CRC32_H__
@@ -0,0 +1,218 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include "nrf_dfu_delta.h"
+#include "app_util.h"
+
+#define NRF_LOG_MODULE_NAME nrf_dfu_delta
+#include "nrf_log.h"
+NRF_LOG_MODULE_REGISTER();
+
+#define OP_HEADER_MAX_SIZE  (1 + 8)     /**< Largest operation before any literal bytes. */
+
+/**@brief State of the object which is being reconstructed. A patch is decoded as it arrives,
+ *        so an operation may be split between writes. */
+typedef struct
+{
+    uint8_t       * p_out;
+    uint32_t        size;           /**< Size of the object. */
+    uint32_t        out_len;        /**< Number of bytes which have been reconstructed. */
+    uint8_t const * p_base;
+    uint32_t        base_size;
+    uint32_t        base_crc;
+    bool            base_matched;   /**< Whether the patch is for the installed application, or the object is compressed. */
+    bool            failed;
+    uint8_t         op[OP_HEADER_MAX_SIZE];
+    uint8_t         op_len;         /**< Number of bytes of the current operation in op. */
+    uint32_t        literal_remaining;
+} delta_state_t;
+
+static delta_state_t m_delta;
+
+
+static uint32_t le16_get(uint8_t const * p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+
+static uint32_t le32_get(uint8_t const * p)
+{
+    return le16_get(p) | (le16_get(p + 2) << 16);
+}
+
+
+/* Returns the size of the operation whose opcode is supplied, excluding literal bytes,
+ * or 0 if the opcode is not valid. */
+static uint8_t op_header_size(uint8_t opcode)
+{
+    if (opcode & NRF_DFU_DELTA_OP_SHORT_REPEAT)
+    {
+        return 2;
+    }
+    if (opcode & NRF_DFU_DELTA_OP_SHORT_LITERAL)
+    {
+        return 1;
+    }
+
+    switch (opcode)
+    {
+        case NRF_DFU_DELTA_OP_LITERAL: return 1 + 2;
+        case NRF_DFU_DELTA_OP_COPY:    return 1 + 2 + 4;
+        case NRF_DFU_DELTA_OP_BASE:    return 1 + 4 + 4;
+        case NRF_DFU_DELTA_OP_REPEAT:  return 1 + 2 + 2;
+        default:                       return 0;
+    }
+}
+
+
+/* Applies the operation in m_delta.op, which is complete. */
+static bool op_execute(void)
+{
+    uint8_t const * p_op   = m_delta.op;
+    uint8_t         opcode = p_op[0];
+
+    if (opcode == NRF_DFU_DELTA_OP_BASE)
+    {
+        m_delta.base_matched = (m_delta.p_base != NULL)
+                            && (le32_get(&p_op[1]) == m_delta.base_size)
+                            && (le32_get(&p_op[5]) == m_delta.base_crc);
+        if (!m_delta.base_matched)
+        {
+            NRF_LOG_ERROR("Patch is not for the installed application.");
+        }
+        return m_delta.base_matched;
+    }
+
+    /* Decode the short forms into the operations which they abbreviate. */
+    uint32_t len;
+    uint32_t distance = 0;
+    if (opcode & NRF_DFU_DELTA_OP_SHORT_REPEAT)
+    {
+        len      = 3 + ((opcode >> 3) & 0x0F);
+        distance = 1 + ((((uint32_t)opcode & 0x07) << 8) | p_op[1]);
+        opcode   = NRF_DFU_DELTA_OP_REPEAT;
+    }
+    else if (opcode & NRF_DFU_DELTA_OP_SHORT_LITERAL)
+    {
+        len    = 1 + (opcode & 0x3F);
+        opcode = NRF_DFU_DELTA_OP_LITERAL;
+    }
+    else
+    {
+        len = le16_get(&p_op[1]);
+        if (opcode == NRF_DFU_DELTA_OP_REPEAT)
+        {
+            distance = le16_get(&p_op[3]);
+        }
+    }
+
+    /* The other operations need the base to be checked first, unless the object is
+     * compressed. */
+    if ((!m_delta.base_matched) || (len > m_delta.size - m_delta.out_len))
+    {
+        NRF_LOG_ERROR("Invalid patch operation.");
+        return false;
+    }
+
+    if (opcode == NRF_DFU_DELTA_OP_COPY)
+    {
+        uint32_t src = le32_get(&p_op[3]);
+        if ((m_delta.p_base == NULL) || (src > m_delta.base_size) || (len > m_delta.base_size - src))
+        {
+            NRF_LOG_ERROR("Patch copies from outside the installed application.");
+            return false;
+        }
+
+        memcpy(&m_delta.p_out[m_delta.out_len], &m_delta.p_base[src], len);
+        m_delta.out_len += len;
+    }
+    else if (opcode == NRF_DFU_DELTA_OP_REPEAT)
+    {
+        if ((distance == 0) || (distance > m_delta.out_len))
+        {
+            NRF_LOG_ERROR("Patch repeats data from before the object.");
+            return false;
+        }
+
+        /* The source may overlap the output, in which case the bytes must be copied in order. */
+        uint8_t       * p_dst = &m_delta.p_out[m_delta.out_len];
+        uint8_t const * p_src = p_dst - distance;
+        for (uint32_t i = 0; i < len; i++)
+        {
+            p_dst[i] = p_src[i];
+        }
+        m_delta.out_len += len;
+    }
+    else
+    {
+        m_delta.literal_remaining = len;
+    }
+
+    return true;
+}
+
+
+void nrf_dfu_delta_object_start(uint8_t       * p_out,
+                                uint32_t        size,
+                                uint8_t const * p_base,
+                                uint32_t        base_size,
+                                uint32_t        base_crc)
+{
+    memset(&m_delta, 0, sizeof(m_delta));
+    m_delta.p_out     = p_out;
+    m_delta.size      = size;
+    m_delta.p_base    = p_base;
+    m_delta.base_size = base_size;
+    m_delta.base_crc  = base_crc;
+
+    /* A compressed object does not refer to the installed application. */
+    m_delta.base_matched = (p_base == NULL);
+}
+
+
+bool nrf_dfu_delta_apply(uint8_t const * p_data, uint32_t len)
+{
+    while ((len > 0) && !m_delta.failed)
+    {
+        /* Copy literal bytes straight to the output. */
+        if (m_delta.literal_remaining > 0)
+        {
+            uint32_t chunk = MIN(len, m_delta.literal_remaining);
+            memcpy(&m_delta.p_out[m_delta.out_len], p_data, chunk);
+            m_delta.out_len           += chunk;
+            m_delta.literal_remaining -= chunk;
+            p_data                    += chunk;
+            len                       -= chunk;
+            continue;
+        }
+
+        /* Otherwise collect the next operation. */
+        m_delta.op[m_delta.op_len++] = *p_data++;
+        len--;
+
+        uint8_t header_size = op_header_size(m_delta.op[0]);
+        if (header_size == 0)
+        {
+            NRF_LOG_ERROR("Invalid patch opcode 0x%x.", m_delta.op[0]);
+            m_delta.failed = true;
+        }
+        else if (m_delta.op_len == header_size)
+        {
+            m_delta.op_len = 0;
+            m_delta.failed = !op_execute();
+        }
+    }
+
+    return !m_delta.failed;
+}
+
+
+bool nrf_dfu_delta_object_complete(void)
+{
+    return !m_delta.failed
+        && (m_delta.out_len == m_delta.size)
+        && (m_delta.literal_remaining == 0)
+        && (m_delta.op_len == 0);
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef NRF_DFU_DELTA_H__
+#define NRF_DFU_DELTA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Object type for a data object which is sent as a patch against the installed
+ *        application.
+ *
+ * The create request carries the size of the reconstructed object, as for a data object.
+ * Each write carries the next part of the patch. The offsets and CRCs which are reported
+ * for the object are those of the reconstructed firmware, so they match the values which
+ * the full image would produce.
+ */
+#define NRF_DFU_OBJ_TYPE_DELTA_DATA     (0x81)
+
+/**
+ * @brief Object type for a data object which is sent compressed.
+ *
+ * This uses the same operations as a patch, except for those which refer to the installed
+ * application, so it does not need one.
+ */
+#define NRF_DFU_OBJ_TYPE_COMPRESSED_DATA (0x82)
+
+/**
+ * @brief Patch operations. Each object is made by a sequence of these, which must produce
+ *        exactly the object size. A patch must start with NRF_DFU_DELTA_OP_BASE, and a
+ *        compressed object must not contain NRF_DFU_DELTA_OP_BASE or NRF_DFU_DELTA_OP_COPY.
+ *        All values are little-endian.
+ */
+#define NRF_DFU_DELTA_OP_LITERAL        (0x00)  /**< u16 length, then that many bytes to output. */
+#define NRF_DFU_DELTA_OP_COPY           (0x01)  /**< u16 length, u32 offset into the installed application. */
+#define NRF_DFU_DELTA_OP_BASE           (0x02)  /**< u32 size and u32 CRC-32 of the installed application. */
+#define NRF_DFU_DELTA_OP_REPEAT         (0x03)  /**< u16 length, u16 distance back from the end of the output. */
+#define NRF_DFU_DELTA_OP_SHORT_LITERAL  (0x40)  /**< 01LLLLLL: 1 + L bytes to output follow. */
+#define NRF_DFU_DELTA_OP_SHORT_REPEAT   (0x80)  /**< 1LLLLDDD DDDDDDDD: 3 + L bytes from 1 + D bytes back. */
+
+/**
+ * @brief Function for starting to reconstruct a data object from a patch.
+ *
+ * @param[out] p_out        Buffer which receives the reconstructed object.
+ * @param[in]  size         Size of the object, which must fit in p_out.
+ * @param[in]  p_base       Start of the installed application in flash, or NULL if the object
+ *                          is compressed instead.
+ * @param[in]  base_size    Size of the installed application.
+ * @param[in]  base_crc     CRC-32 of the installed application.
+ */
+void nrf_dfu_delta_object_start(uint8_t       * p_out,
+                                uint32_t        size,
+                                uint8_t const * p_base,
+                                uint32_t        base_size,
+                                uint32_t        base_crc);
+
+/**
+ * @brief Function for applying the next part of the patch for the current object.
+ *
+ * @param[in] p_data    Patch data.
+ * @param[in] len       Length of p_data.
+ *
+ * @retval true     The data was applied.
+ * @retval false    The patch is invalid, is not for the installed application, or produces
+ *                  more data than the object size. The rest of the object is ignored.
+ */
+bool nrf_dfu_delta_apply(uint8_t const * p_data, uint32_t len);
+
+/**
+ * @brief Function for checking whether the whole object has been reconstructed.
+ */
+bool nrf_dfu_delta_object_complete(void);
+
+#endif // NRF_DFU_DELTA_H__
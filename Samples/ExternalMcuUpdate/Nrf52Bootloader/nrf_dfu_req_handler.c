@@ -49,6 +49,7 @@
  */
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "sdk_config.h"
 #include "nrf_dfu.h"
 #include "nrf_dfu_types.h"
@@ -64,11 +65,13 @@
 #include "pb_common.h"
 #include "pb_decode.h"
 #include "dfu-cc.pb.h"
-#include "crc32.h"
+#include "nrf_dfu_crc32.h"
 #include "app_scheduler.h"
 #include "sdk_macros.h"
 #include "nrf_assert.h"
 #include "nrf_dfu_validation.h"
+#include "nrf_drv_uart_baudrate.h"
+#include "nrf_dfu_delta.h"
 
 #define NRF_LOG_MODULE_NAME nrf_dfu_req_handler
 #include "nrf_log.h"
@@ -76,6 +79,38 @@ NRF_LOG_MODULE_REGISTER();
 
 #define NRF_DFU_PROTOCOL_VERSION    (0x01)
 
+/* Object type used to change the UART rate. A create request for this type carries the
+ * new rate, in bits per second, in place of the object size. */
+#define NRF_DFU_OBJ_TYPE_BAUD_RATE  (0x80)
+
+/* Object type used to read the CRC of an installed image. A create request for this type
+ * carries the firmware image number, as used by NRF_DFU_OP_FIRMWARE_VERSION, in the top 8
+ * bits of the object size, and the number of bytes to check from the start of the image in
+ * the other 24 bits. A CRC request then reports that length and the CRC-32 of those bytes. */
+#define NRF_DFU_OBJ_TYPE_IMAGE_CRC  (0x83)
+
+/* Number of requests which can wait while a write waits for space in the flash queue. Each
+ * waiting write holds one of the transport's receive buffers, so this covers all of those
+ * and the few other requests which can follow them. */
+#define DEFERRED_REQ_QUEUE_SIZE     (NRF_DFU_SERIAL_UART_RX_BUFFERS + 4)
+
+/* Number of flash pages in the largest data object. Each object costs a create, CRC and
+ * execute round trip, so larger objects mean fewer of them per image. A data object is
+ * written to flash as it arrives, so its size is not limited by RAM. */
+#ifndef NRF_DFU_DATA_OBJECT_PAGES
+#define NRF_DFU_DATA_OBJECT_PAGES   (4)
+#endif
+
+/* Largest data object. It is reported in the select response, which the peer uses to
+ * divide the image. */
+#define DFU_DATA_OBJECT_MAX_SIZE    (NRF_DFU_DATA_OBJECT_PAGES * CODE_PAGE_SIZE)
+
+/* Largest object which is rebuilt from a patch or decompressed. The whole object is
+ * rebuilt in RAM before it is written, so this stays at the SDK's object size. */
+#define DELTA_OBJECT_MAX_SIZE       (DATA_OBJECT_MAX_SIZE)
+
+STATIC_ASSERT(DFU_DATA_OBJECT_MAX_SIZE >= DELTA_OBJECT_MAX_SIZE);
+
 
 STATIC_ASSERT(DFU_SIGNED_COMMAND_SIZE <= INIT_COMMAND_MAX_SIZE);
 
@@ -84,6 +119,18 @@ static uint32_t m_firmware_size_req;            /**< The size of the entire firm
 
 static nrf_dfu_observer_t m_observer;
 
+static uint8_t m_delta_object[DELTA_OBJECT_MAX_SIZE] __ALIGN(4); /**< Data object which is reconstructed from a patch or decompressed. */
+
+static nrf_dfu_request_t m_deferred_reqs[DEFERRED_REQ_QUEUE_SIZE]; /**< Requests which wait for a write to be stored, oldest first. */
+static uint8_t           m_deferred_head;                          /**< Index of the oldest request in m_deferred_reqs. */
+static uint8_t           m_deferred_count;                         /**< Number of requests in m_deferred_reqs. */
+static bool              m_write_deferred;                         /**< Set when a write could not be queued for flash. */
+
+static uint32_t m_erased_addr;                  /**< Start of the pre-erased flash which no data object has used yet. */
+static uint32_t m_erase_next;                   /**< Next page to pre-erase. The flash from m_erased_addr up to here is erased. */
+static uint32_t m_erase_end;                    /**< End of the flash to pre-erase, or 0 if there is none. */
+static bool     m_erase_scheduled;              /**< Set while a pre-erase step waits in the scheduler. */
+
 
 static void on_dfu_complete(nrf_fstorage_evt_t * p_evt)
 {
@@ -228,6 +275,7 @@ static void on_ping_request(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_re
 static void on_mtu_get_request(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_res)
 {
     NRF_LOG_DEBUG("Handle NRF_DFU_OP_MTU_GET");
+    /* The transport fills in its own MTU, which for UART is NRF_DFU_SERIAL_UART_MTU. */
     p_res->mtu.size = p_req->mtu.size;
 }
 
@@ -240,12 +288,108 @@ static void on_prn_set_request(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p
 }
 
 
+/**@brief Function for stopping the pre-erase, so that each data object is erased when it is
+ *        created.
+ */
+static void preerase_stop(void)
+{
+    m_erased_addr = 0;
+    m_erase_next  = 0;
+    m_erase_end   = 0;
+}
+
+
+static void preerase_step(void * p_evt, uint16_t event_length);
+
+
+static void preerase_schedule(void)
+{
+    if (m_erase_scheduled)
+    {
+        return;
+    }
+
+    if (app_sched_event_put(NULL, 0, preerase_step) != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Failed to schedule pre-erase. Objects are erased when created.");
+        m_erase_end = m_erase_next;
+        return;
+    }
+
+    m_erase_scheduled = true;
+}
+
+
+/**@brief Function for erasing the next page of the firmware region.
+ *
+ * @details Each step erases one page and schedules the next, so that requests which arrive
+ *          meanwhile are handled between the pages instead of waiting for the whole region.
+ */
+static void preerase_step(void * p_evt, uint16_t event_length)
+{
+    UNUSED_PARAMETER(p_evt);
+    UNUSED_PARAMETER(event_length);
+
+    m_erase_scheduled = false;
+
+    if (m_erase_next >= m_erase_end)
+    {
+        return;
+    }
+
+    if (nrf_dfu_flash_erase(m_erase_next, 1, NULL) != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Pre-erase failed at 0x%08x. Objects are erased when created.",
+                        m_erase_next);
+        m_erase_end = m_erase_next;
+        return;
+    }
+
+    m_erase_next += CODE_PAGE_SIZE;
+    if (m_erase_next < m_erase_end)
+    {
+        preerase_schedule();
+    }
+    else
+    {
+        NRF_LOG_DEBUG("Pre-erase complete.");
+    }
+}
+
+
+/**@brief Function for starting to erase the flash which the firmware image will be written
+ *        to, from the point where the transfer continues, while the peer prepares the data.
+ *
+ * @details The region is only erased in advance when it is not bank 0, which holds the
+ *          installed application until the new image has been received.
+ */
+static void preerase_start(void)
+{
+    preerase_stop();
+
+    if (m_firmware_start_addr == nrf_dfu_bank0_start_addr())
+    {
+        return;
+    }
+
+    m_erased_addr = m_firmware_start_addr + s_dfu_settings.progress.firmware_image_offset_last;
+    m_erase_next  = m_erased_addr;
+    m_erase_end   = m_firmware_start_addr
+                  + CEIL_DIV(m_firmware_size_req, CODE_PAGE_SIZE) * CODE_PAGE_SIZE;
+
+    NRF_LOG_DEBUG("Pre-erasing 0x%08x to 0x%08x.", m_erase_next, m_erase_end);
+    preerase_schedule();
+}
+
+
 static void on_abort_request(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_res)
 {
     UNUSED_PARAMETER(p_req);
     UNUSED_PARAMETER(p_res);
     NRF_LOG_DEBUG("Handle NRF_DFU_OP_ABORT");
 
+    preerase_stop();
+
     m_observer(NRF_DFU_EVT_DFU_ABORTED);
 }
 
@@ -280,6 +424,8 @@ static void on_cmd_obj_create_request(nrf_dfu_request_t * p_req, nrf_dfu_respons
 
     m_observer(NRF_DFU_EVT_DFU_STARTED);
 
+    preerase_stop();
+
     nrf_dfu_result_t ret_val = nrf_dfu_validation_init_cmd_create(p_req->create.object_size);
     p_res->result = ext_err_code_handle(ret_val);
 }
@@ -328,6 +474,9 @@ static void on_cmd_obj_execute_request(nrf_dfu_request_t const * p_req, nrf_dfu_
         {
             /* Setting DFU to initialized */
             NRF_LOG_DEBUG("Writing valid init command to flash.");
+
+            /* The erase steps run after this response has been sent. */
+            preerase_start();
         }
         else
         {
@@ -402,7 +551,7 @@ static void on_data_obj_select_request(nrf_dfu_request_t * p_req, nrf_dfu_respon
     p_res->select.crc    = s_dfu_settings.progress.firmware_image_crc;
     p_res->select.offset = s_dfu_settings.progress.firmware_image_offset;
 
-    p_res->select.max_size = DATA_OBJECT_MAX_SIZE;
+    p_res->select.max_size = DFU_DATA_OBJECT_MAX_SIZE;
 
     NRF_LOG_DEBUG("crc = 0x%x, offset = 0x%x, max_size = 0x%x",
                   p_res->select.crc,
@@ -438,7 +587,7 @@ static void on_data_obj_create_request(nrf_dfu_request_t * p_req, nrf_dfu_respon
         return;
     }
 
-    if (p_req->create.object_size > DATA_OBJECT_MAX_SIZE)
+    if (p_req->create.object_size > DFU_DATA_OBJECT_MAX_SIZE)
     {
         /* It is impossible to handle the command because the size is too large */
         NRF_LOG_ERROR("Invalid size for object (too large)");
@@ -464,9 +613,34 @@ static void on_data_obj_create_request(nrf_dfu_request_t * p_req, nrf_dfu_respon
     s_dfu_settings.progress.firmware_image_offset = s_dfu_settings.progress.firmware_image_offset_last;
     s_dfu_settings.write_offset                   = s_dfu_settings.progress.firmware_image_offset_last;
 
-    /* Erase the page we're at. */
-    if (nrf_dfu_flash_erase((m_firmware_start_addr + s_dfu_settings.progress.firmware_image_offset),
-                            CEIL_DIV(p_req->create.object_size, CODE_PAGE_SIZE), NULL) != NRF_SUCCESS)
+    uint32_t const object_addr = m_firmware_start_addr + s_dfu_settings.progress.firmware_image_offset;
+    uint32_t const object_end  = object_addr
+                               + CEIL_DIV(p_req->create.object_size, CODE_PAGE_SIZE) * CODE_PAGE_SIZE;
+    uint32_t       erase_addr  = object_addr;
+
+    if ((m_erase_end != 0) && (object_addr == m_erased_addr))
+    {
+        /* Only erase the pages which the pre-erase has not reached yet. */
+        if (m_erase_next < object_end)
+        {
+            erase_addr   = m_erase_next;
+            m_erase_next = object_end;
+        }
+        else
+        {
+            erase_addr = object_end;
+        }
+        m_erased_addr = object_end;
+    }
+    else
+    {
+        /* An object which is created again may have been written, so it is erased again. */
+        preerase_stop();
+    }
+
+    /* Erase the pages we're at. */
+    if (   (erase_addr < object_end)
+        && (nrf_dfu_flash_erase(erase_addr, (object_end - erase_addr) / CODE_PAGE_SIZE, NULL) != NRF_SUCCESS))
     {
         NRF_LOG_ERROR("Erase operation failed");
         p_res->result = NRF_DFU_RES_CODE_INVALID_OBJECT;
@@ -509,10 +683,19 @@ static void on_data_obj_write_request(nrf_dfu_request_t * p_req, nrf_dfu_respons
     ret_code_t ret =
         nrf_dfu_flash_store(write_addr, p_req->write.p_data, p_req->write.len, p_req->callback.write);
 
+    if (ret == NRF_ERROR_NO_MEM)
+    {
+        /* There is no space in the flash queue. Keep the buffer, and try the write again
+         * when an earlier flash operation has completed. The response waits with it, so the
+         * peer stops sending when it runs out of packet receipt notifications.
+         */
+        m_write_deferred = true;
+        return;
+    }
+
     if (ret != NRF_SUCCESS)
     {
-        /* When nrf_dfu_flash_store() fails because there is no space in the queue,
-         * stop processing the request so that the peer can detect a CRC error
+        /* Stop processing the request so that the peer can detect a CRC error
          * and retransmit this object. Remember to manually free the buffer !
          */
         p_req->callback.write((void*)p_req->write.p_data);
@@ -523,7 +706,7 @@ static void on_data_obj_write_request(nrf_dfu_request_t * p_req, nrf_dfu_respons
     s_dfu_settings.write_offset                   += p_req->write.len;
     s_dfu_settings.progress.firmware_image_offset += p_req->write.len;
     s_dfu_settings.progress.firmware_image_crc     =
-        crc32_compute(p_req->write.p_data, p_req->write.len, &s_dfu_settings.progress.firmware_image_crc);
+        nrf_dfu_crc32_compute(p_req->write.p_data, p_req->write.len, &s_dfu_settings.progress.firmware_image_crc);
 
     /* This is only used when the PRN is triggered and the 'write' message
      * is answered with a CRC message and these field are copied into the response.
@@ -675,6 +858,219 @@ static bool nrf_dfu_data_req(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_r
 }
 
 
+static void on_delta_obj_create_request(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_res)
+{
+    NRF_LOG_DEBUG("Handle NRF_DFU_OP_OBJECT_CREATE (delta data)");
+
+    bool const is_patch = (p_req->create.object_type == NRF_DFU_OBJ_TYPE_DELTA_DATA);
+
+    /* The patch is applied to the installed application, so the new firmware must not be
+     * written over it. A compressed object does not need the installed application. */
+    if (   is_patch
+        && (   (s_dfu_settings.bank_0.bank_code != NRF_DFU_BANK_VALID_APP)
+            || (m_firmware_start_addr == nrf_dfu_bank0_start_addr())))
+    {
+        NRF_LOG_ERROR("Cannot apply a patch without a valid application in a separate bank");
+        p_res->result = NRF_DFU_RES_CODE_OPERATION_NOT_PERMITTED;
+        return;
+    }
+
+    if (p_req->create.object_size > DELTA_OBJECT_MAX_SIZE)
+    {
+        NRF_LOG_ERROR("Invalid size for delta object (too large)");
+        p_res->result = NRF_DFU_RES_CODE_INSUFFICIENT_RESOURCES;
+        return;
+    }
+
+    on_data_obj_create_request(p_req, p_res);
+    if (p_res->result != NRF_DFU_RES_CODE_SUCCESS)
+    {
+        return;
+    }
+
+    /* Pad a short final object with the value of erased flash, so it can be written in words. */
+    memset(m_delta_object, 0xFF, sizeof(m_delta_object));
+    nrf_dfu_delta_object_start(m_delta_object,
+                               p_req->create.object_size,
+                               is_patch ? (uint8_t const *)nrf_dfu_bank0_start_addr() : NULL,
+                               s_dfu_settings.bank_0.image_size,
+                               s_dfu_settings.bank_0.image_crc);
+}
+
+
+static void on_delta_obj_write_request(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_res)
+{
+    NRF_LOG_DEBUG("Handle NRF_DFU_OP_OBJECT_WRITE (delta data)");
+
+    if (!nrf_dfu_validation_init_cmd_present())
+    {
+        /* Can't accept data because DFU isn't initialized by init command. */
+        p_res->result = NRF_DFU_RES_CODE_OPERATION_NOT_PERMITTED;
+        return;
+    }
+
+    /* The patch is copied as it is decoded, so the buffer can be released straight away. If the
+     * patch cannot be applied, the progress does not change, and the peer detects this from the
+     * offset and CRC. */
+    bool applied = nrf_dfu_delta_apply(p_req->write.p_data, p_req->write.len);
+    p_req->callback.write((void*)p_req->write.p_data);
+
+    /* Write the object to flash when it has been reconstructed. The next object is not created
+     * until this one has been executed, which waits for the flash operation to finish. */
+    if (applied && nrf_dfu_delta_object_complete())
+    {
+        uint32_t const len        = s_dfu_settings.progress.data_object_size;
+        uint32_t const write_addr = m_firmware_start_addr + s_dfu_settings.write_offset;
+
+        ret_code_t ret = nrf_dfu_flash_store(write_addr,
+                                             m_delta_object,
+                                             CEIL_DIV(len, sizeof(uint32_t)) * sizeof(uint32_t),
+                                             NULL);
+        if (ret == NRF_SUCCESS)
+        {
+            s_dfu_settings.write_offset                   += len;
+            s_dfu_settings.progress.firmware_image_offset += len;
+            s_dfu_settings.progress.firmware_image_crc     =
+                nrf_dfu_crc32_compute(m_delta_object, len, &s_dfu_settings.progress.firmware_image_crc);
+        }
+    }
+
+    p_res->write.crc    = s_dfu_settings.progress.firmware_image_crc;
+    p_res->write.offset = s_dfu_settings.progress.firmware_image_offset;
+}
+
+
+/**@brief Function for handling requests for a data object which is sent as a patch or compressed.
+ *
+ * Only the create and write requests differ from those for a data object.
+ *
+ * @param[in]  p_req    Request.
+ * @param[out] p_res    Response.
+ *
+ * @return  Whether response is ready to be sent.
+ */
+static bool nrf_dfu_delta_req(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_res)
+{
+    switch (p_req->request)
+    {
+        case NRF_DFU_OP_OBJECT_CREATE:
+        {
+            on_delta_obj_create_request(p_req, p_res);
+        } break;
+
+        case NRF_DFU_OP_OBJECT_WRITE:
+        {
+            on_delta_obj_write_request(p_req, p_res);
+        } break;
+
+        default:
+        {
+            return nrf_dfu_data_req(p_req, p_res);
+        }
+    }
+
+    return true;
+}
+
+
+/**@brief Function for handling a request to change the UART rate.
+ *
+ * The response is sent at the current rate, and the new rate is used after that.
+ *
+ * @param[in]  p_req    Request.
+ * @param[out] p_res    Response.
+ */
+static void on_baud_rate_request(nrf_dfu_request_t const * p_req, nrf_dfu_response_t * p_res)
+{
+    if (p_req->request != NRF_DFU_OP_OBJECT_CREATE)
+    {
+        NRF_LOG_ERROR("Only create is supported for the baud rate object.");
+        p_res->result = NRF_DFU_RES_CODE_OPERATION_NOT_PERMITTED;
+        return;
+    }
+
+    NRF_LOG_DEBUG("Handle baud rate request: %d", p_req->create.object_size);
+
+    if (!nrf_drv_uart_baudrate_set_after_tx(p_req->create.object_size))
+    {
+        NRF_LOG_ERROR("Unsupported baud rate.");
+        p_res->result = NRF_DFU_RES_CODE_INVALID_PARAMETER;
+    }
+}
+
+
+/**@brief Function for handling a request for the CRC of an installed image.
+ *
+ * The peer uses this to skip an image which is already installed with the same contents,
+ * even if it has a different version.
+ *
+ * @param[in]  p_req    Request.
+ * @param[out] p_res    Response.
+ */
+static void on_image_crc_request(nrf_dfu_request_t const * p_req, nrf_dfu_response_t * p_res)
+{
+    static uint32_t image_addr;
+    static uint32_t image_len;
+    static bool     image_crc_known;
+
+    switch (p_req->request)
+    {
+        case NRF_DFU_OP_OBJECT_CREATE:
+        {
+            /* Find the image in the same way as for a firmware version request. */
+            nrf_dfu_request_t  fw_req = { .request = NRF_DFU_OP_FIRMWARE_VERSION };
+            nrf_dfu_response_t fw_res = { .request = NRF_DFU_OP_FIRMWARE_VERSION };
+
+            fw_req.firmware.image_number = (uint8_t)(p_req->create.object_size >> 24);
+            on_fw_version_request(&fw_req, &fw_res);
+
+            uint32_t const len = p_req->create.object_size & 0x00FFFFFF;
+            if (   (fw_res.result != NRF_DFU_RES_CODE_SUCCESS)
+                || (fw_res.firmware.type == NRF_DFU_FIRMWARE_TYPE_UNKNOWN)
+                || (len > fw_res.firmware.len))
+            {
+                NRF_LOG_ERROR("Invalid image for CRC request.");
+                image_len     = 0;
+                p_res->result = NRF_DFU_RES_CODE_INVALID_PARAMETER;
+                return;
+            }
+
+            image_addr = fw_res.firmware.addr;
+            image_len  = len;
+
+            /* The CRC of the whole application was stored when it was received, so it does
+             * not have to be calculated again. */
+            image_crc_known = (fw_res.firmware.type == NRF_DFU_FIRMWARE_TYPE_APPLICATION)
+                           && (len == s_dfu_settings.bank_0.image_size);
+        } break;
+
+        case NRF_DFU_OP_CRC_GET:
+        {
+            NRF_LOG_DEBUG("Image CRC at 0x%x, %d bytes", image_addr, image_len);
+            p_res->crc.offset = image_len;
+            if (image_len == 0)
+            {
+                p_res->crc.crc = 0;
+            }
+            else if (image_crc_known)
+            {
+                p_res->crc.crc = s_dfu_settings.bank_0.image_crc;
+            }
+            else
+            {
+                p_res->crc.crc = nrf_dfu_crc32_compute((uint8_t const *)image_addr, image_len, NULL);
+            }
+        } break;
+
+        default:
+        {
+            NRF_LOG_ERROR("Only create and CRC requests are supported for the image CRC object.");
+            p_res->result = NRF_DFU_RES_CODE_OPERATION_NOT_PERMITTED;
+        } break;
+    }
+}
+
+
 /**@brief Function for handling requests to manipulate data or command objects.
  *
  * @param[in]  p_req    Request.
@@ -709,6 +1105,19 @@ static bool nrf_dfu_obj_op(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_res
             response_ready = nrf_dfu_data_req(p_req, p_res);
             break;
 
+        case NRF_DFU_OBJ_TYPE_DELTA_DATA:
+        case NRF_DFU_OBJ_TYPE_COMPRESSED_DATA:
+            response_ready = nrf_dfu_delta_req(p_req, p_res);
+            break;
+
+        case NRF_DFU_OBJ_TYPE_BAUD_RATE:
+            on_baud_rate_request(p_req, p_res);
+            break;
+
+        case NRF_DFU_OBJ_TYPE_IMAGE_CRC:
+            on_image_crc_request(p_req, p_res);
+            break;
+
         default:
             /* The select request had an invalid object type. */
             NRF_LOG_ERROR("Invalid object type in request.");
@@ -721,7 +1130,14 @@ static bool nrf_dfu_obj_op(nrf_dfu_request_t * p_req, nrf_dfu_response_t * p_res
 }
 
 
-static void nrf_dfu_req_handler_req_process(nrf_dfu_request_t * p_req)
+/**@brief Function for handling a request.
+ *
+ * @param[in]  p_req    Request.
+ *
+ * @return  False if the request is a write which must be handled again later, because there
+ *          was no space in the flash queue. Otherwise, true.
+ */
+static bool nrf_dfu_req_handler_req_process(nrf_dfu_request_t * p_req)
 {
     ASSERT(p_req->callback.response);
 
@@ -789,6 +1205,12 @@ static void nrf_dfu_req_handler_req_process(nrf_dfu_request_t * p_req)
             break;
     }
 
+    if (m_write_deferred)
+    {
+        m_write_deferred = false;
+        return false;
+    }
+
     if (response_ready)
     {
         NRF_LOG_DEBUG("Request handling complete. Result: 0x%x", response.result);
@@ -800,13 +1222,95 @@ static void nrf_dfu_req_handler_req_process(nrf_dfu_request_t * p_req)
             m_observer(NRF_DFU_EVT_DFU_FAILED);
         }
     }
+
+    return true;
+}
+
+
+/**@brief Function for adding a request to the end of the deferred requests.
+ *
+ * @param[in]  p_req    Request.
+ *
+ * @return  Whether there was space for the request.
+ */
+static bool deferred_req_push(nrf_dfu_request_t const * p_req)
+{
+    if (m_deferred_count == DEFERRED_REQ_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    uint8_t const idx = (m_deferred_head + m_deferred_count) % DEFERRED_REQ_QUEUE_SIZE;
+    m_deferred_reqs[idx] = *p_req;
+    m_deferred_count++;
+
+    return true;
+}
+
+
+static void deferred_reqs_process(void * p_evt, uint16_t event_length);
+
+
+/**@brief Function for trying the deferred requests again when the scheduler has handled
+ *        the events which are waiting, which include the flash operations that complete.
+ */
+static void deferred_reqs_schedule(void)
+{
+    ret_code_t ret = app_sched_event_put(NULL, 0, deferred_reqs_process);
+    if (ret != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Failed to schedule deferred requests: 0x%x.", ret);
+    }
+}
+
+
+/**@brief Function for handling the deferred requests in order, until one of them is a
+ *        write which still does not fit in the flash queue.
+ */
+static void deferred_reqs_process(void * p_evt, uint16_t event_length)
+{
+    UNUSED_PARAMETER(p_evt);
+    UNUSED_PARAMETER(event_length);
+
+    while (m_deferred_count != 0)
+    {
+        if (!nrf_dfu_req_handler_req_process(&m_deferred_reqs[m_deferred_head]))
+        {
+            deferred_reqs_schedule();
+            return;
+        }
+
+        m_deferred_head = (m_deferred_head + 1) % DEFERRED_REQ_QUEUE_SIZE;
+        m_deferred_count--;
+    }
 }
 
 
 static void nrf_dfu_req_handler_req(void * p_evt, uint16_t event_length)
 {
     nrf_dfu_request_t * p_req = (nrf_dfu_request_t *)(p_evt);
-    nrf_dfu_req_handler_req_process(p_req);
+
+    /* While a write is waiting for the flash queue, later requests wait behind it, so that
+     * the data is written in order and the CRC covers it. */
+    if (m_deferred_count != 0)
+    {
+        if (!deferred_req_push(p_req))
+        {
+            /* The peer detects the missing data or response and retransmits. */
+            NRF_LOG_ERROR("Too many requests while waiting for flash. Request dropped.");
+            if (p_req->request == NRF_DFU_OP_OBJECT_WRITE)
+            {
+                p_req->callback.write((void*)p_req->write.p_data);
+            }
+        }
+        return;
+    }
+
+    if (!nrf_dfu_req_handler_req_process(p_req))
+    {
+        UNUSED_RETURN_VALUE(deferred_req_push(p_req));
+        deferred_reqs_schedule();
+    }
 }
 
 
@@ -57,7 +57,7 @@
 #include "pb_common.h"
 #include "pb_decode.h"
 #include "dfu-cc.pb.h"
-#include "crc32.h"
+#include "nrf_dfu_crc32.h"
 #include "nrf_assert.h"
 #include "nrf_dfu_validation.h"
 #include "nrf_dfu_ver_validation.h"
@@ -199,9 +199,9 @@ nrf_dfu_result_t nrf_dfu_validation_init_cmd_append(uint8_t const * p_data, uint
                 length);
 
         s_dfu_settings.progress.command_offset += length;
-        s_dfu_settings.progress.command_crc = crc32_compute(p_data,
-                                                            length,
-                                                            &s_dfu_settings.progress.command_crc);
+        s_dfu_settings.progress.command_crc = nrf_dfu_crc32_compute(p_data,
+                                                                    length,
+                                                                    &s_dfu_settings.progress.command_crc);
     }
     return ret_val;
 }
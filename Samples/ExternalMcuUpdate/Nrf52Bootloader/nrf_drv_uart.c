@@ -50,6 +50,8 @@
  */
 
 #include "nrf_drv_uart.h"
+#include "nrf_drv_uart_baudrate.h"
+#include "nrf_delay.h"
 #include "nrf_gpio.h"
 #include "custom_board.h"
 
@@ -66,6 +68,97 @@ static void *                   m_contexts[INSTANCE_COUNT];
 uint8_t nrf_drv_uart_use_easy_dma[INSTANCE_COUNT];
 #endif
 
+/* Time to wait after a transmission has completed before the rate is changed. The
+ * driver reports completion when the last byte has been moved into the peripheral,
+ * so this allows two characters at the slowest supported rate to be shifted out. */
+#define BAUDRATE_CHANGE_DELAY_US    200
+
+static nrf_drv_uart_t const * mp_dfu_instance;      /**< Instance used by the DFU transport. */
+static volatile bool          m_baudrate_pending;   /**< Whether a rate change is waiting for TX. */
+static uint32_t               m_pending_baud_rate;  /**< Rate to apply, in bits per second. */
+
+static bool baudrate_supported(uint32_t baud_rate)
+{
+    switch (baud_rate)
+    {
+        case 115200:
+        case 230400:
+        case 460800:
+        case 921600:
+        case 1000000:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+#if defined(NRF_DRV_UART_WITH_UARTE)
+static nrf_uarte_baudrate_t uarte_baudrate_get(uint32_t baud_rate)
+{
+    switch (baud_rate)
+    {
+        case 230400:  return NRF_UARTE_BAUDRATE_230400;
+        case 460800:  return NRF_UARTE_BAUDRATE_460800;
+        case 921600:  return NRF_UARTE_BAUDRATE_921600;
+        case 1000000: return NRF_UARTE_BAUDRATE_1000000;
+        default:      return NRF_UARTE_BAUDRATE_115200;
+    }
+}
+#endif // defined(NRF_DRV_UART_WITH_UARTE)
+
+#if defined(NRF_DRV_UART_WITH_UART)
+static nrf_uart_baudrate_t uart_baudrate_get(uint32_t baud_rate)
+{
+    switch (baud_rate)
+    {
+        case 230400:  return NRF_UART_BAUDRATE_230400;
+        case 460800:  return NRF_UART_BAUDRATE_460800;
+        case 921600:  return NRF_UART_BAUDRATE_921600;
+        case 1000000: return NRF_UART_BAUDRATE_1000000;
+        default:      return NRF_UART_BAUDRATE_115200;
+    }
+}
+#endif // defined(NRF_DRV_UART_WITH_UART)
+
+/* Applies a rate change which was requested with nrf_drv_uart_baudrate_set_after_tx. */
+static void pending_baudrate_apply(void)
+{
+    nrf_drv_uart_t const * p_instance = mp_dfu_instance;
+    if (!m_baudrate_pending || p_instance == NULL)
+    {
+        return;
+    }
+    m_baudrate_pending = false;
+
+    nrf_delay_us(BAUDRATE_CHANGE_DELAY_US);
+
+    if (NRF_DRV_UART_USE_UARTE)
+    {
+#if defined(NRF_DRV_UART_WITH_UARTE)
+        nrf_uarte_baudrate_set(p_instance->uarte.p_reg, uarte_baudrate_get(m_pending_baud_rate));
+#endif
+    }
+    else if (NRF_DRV_UART_USE_UART)
+    {
+#if defined(NRF_DRV_UART_WITH_UART)
+        nrf_uart_baudrate_set(p_instance->uart.p_reg, uart_baudrate_get(m_pending_baud_rate));
+#endif
+    }
+}
+
+bool nrf_drv_uart_baudrate_set_after_tx(uint32_t baud_rate)
+{
+    if (!baudrate_supported(baud_rate))
+    {
+        return false;
+    }
+
+    m_pending_baud_rate = baud_rate;
+    m_baudrate_pending  = true;
+    return true;
+}
+
 #if defined(NRF_DRV_UART_WITH_UARTE)
 static void uarte_evt_handler(nrfx_uarte_event_t const * p_event,
                               void *                     p_context)
@@ -87,6 +180,10 @@ static void uarte_evt_handler(nrfx_uarte_event_t const * p_event,
             }
         }
     };
+    if (p_event->type == NRFX_UARTE_EVT_TX_DONE)
+    {
+        pending_baudrate_apply();
+    }
     m_handlers[inst_idx](&event, m_contexts[inst_idx]);
 }
 #endif // defined(NRF_DRV_UART_WITH_UARTE)
@@ -112,6 +209,10 @@ static void uart_evt_handler(nrfx_uart_event_t const * p_event,
             }
         }
     };
+    if (p_event->type == NRFX_UART_EVT_TX_DONE)
+    {
+        pending_baudrate_apply();
+    }
     m_handlers[inst_idx](&event, m_contexts[inst_idx]);
 }
 #endif // defined(NRF_DRV_UART_WITH_UART)
@@ -122,6 +223,7 @@ ret_code_t nrf_drv_uart_init(nrf_drv_uart_t const *        p_instance,
 {
     uint32_t inst_idx = p_instance->inst_idx;
     m_handlers[inst_idx] = event_handler;
+    mp_dfu_instance = p_instance;
     m_contexts[inst_idx] = p_config->p_context;
 
 #if defined(NRF_DRV_UART_WITH_UARTE) && defined(NRF_DRV_UART_WITH_UART)
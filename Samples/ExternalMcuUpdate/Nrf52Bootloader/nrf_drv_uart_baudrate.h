@@ -0,0 +1,24 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef NRF_DRV_UART_BAUDRATE_H__
+#define NRF_DRV_UART_BAUDRATE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Function for changing the rate of the DFU UART after the next transmission.
+ *
+ * The new rate is applied when the transmission which is started next has completed,
+ * so the response to the request which asked for the change is still sent at the
+ * current rate.
+ *
+ * @param[in] baud_rate  New rate, in bits per second.
+ *
+ * @retval true   The rate is supported, and will be applied.
+ * @retval false  The rate is not supported.
+ */
+bool nrf_drv_uart_baudrate_set_after_tx(uint32_t baud_rate);
+
+#endif // NRF_DRV_UART_BAUDRATE_H__
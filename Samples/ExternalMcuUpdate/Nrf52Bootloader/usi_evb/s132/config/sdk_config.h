@@ -1066,7 +1066,7 @@
 // <i> The init packet is always saved in flash, regardless of this setting.
 
 #ifndef NRF_DFU_SAVE_PROGRESS_IN_FLASH
-#define NRF_DFU_SAVE_PROGRESS_IN_FLASH 0
+#define NRF_DFU_SAVE_PROGRESS_IN_FLASH 1
 #endif
 
 // <q> NRF_DFU_SETTINGS_ALLOW_UPDATE_FROM_APP  - Whether to allow the app to receive firmware updates for the bootloader to activate.
@@ -1112,7 +1112,18 @@
 // <i> to received packets being dropped.
 
 #ifndef NRF_DFU_SERIAL_UART_RX_BUFFERS
-#define NRF_DFU_SERIAL_UART_RX_BUFFERS 3
+#define NRF_DFU_SERIAL_UART_RX_BUFFERS 8
+#endif
+
+// <o> NRF_DFU_SERIAL_UART_MTU - Largest SLIP-encoded request, in bytes.
+// <i> Reported to the DFU controller in response to NRF_DFU_OP_MTU_GET. Each RX buffer
+// <i> holds one request after decoding, so the buffers take about
+// <i> NRF_DFU_SERIAL_UART_RX_BUFFERS times this many bytes of RAM: 4 KB for 8 buffers of
+// <i> the default 507, which leaves 252 bytes for each write even if all of them are escaped.
+// <i> The SDK uses 131.
+
+#ifndef NRF_DFU_SERIAL_UART_MTU
+#define NRF_DFU_SERIAL_UART_MTU 507
 #endif
 
 // </h>
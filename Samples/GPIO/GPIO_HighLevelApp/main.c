@@ -35,18 +35,35 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
-// This sample uses a single-thread event loop pattern, based on epoll and timerfd
+// This sample uses a single-thread event loop pattern, based on epoll and timerfd. Both of
+// its periodic jobs are scheduled on a timer wheel, so they share a single timerfd.
 #include "epoll_timerfd_utilities.h"
+#include "timer_wheel.h"
+#include "input_manager.h"
 
 // File descriptors - initialized to invalid value
 static int ledBlinkRateButtonGpioFd = -1;
-static int buttonPollTimerFd = -1;
 static int blinkingLedGpioFd = -1;
-static int blinkingLedTimerFd = -1;
 static int epollFd = -1;
 
-// Button state variables
-static GPIO_Value_Type buttonState = GPIO_Value_High;
+// Timer wheel which drives the LED blink timer
+static TimerWheel timerWheel;
+static bool timerWheelInitialized = false;
+
+// Timer wheel timers. Only the event handler field needs to be populated.
+static void BlinkingLedTimerEventHandler(EventData *eventData);
+static TimerWheelTimer blinkingLedTimer = {.eventData.eventHandler =
+                                               &BlinkingLedTimerEventHandler};
+
+// Input manager which samples and debounces the button. The button has GPIO_Value_Low when
+// pressed and GPIO_Value_High when released.
+static void ButtonChangedHandler(InputManagerInput *input, bool isPressed);
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error);
+static InputManager inputManager;
+static InputManagerInput ledBlinkRateButton = {.activeValue = GPIO_Value_Low,
+                                               .changedHandler = &ButtonChangedHandler};
+
+// LED state variables
 static GPIO_Value_Type ledState = GPIO_Value_High;
 
 // Blink interval variables
@@ -71,11 +88,6 @@ static void TerminationHandler(int signalNumber)
 /// </summary>
 static void BlinkingLedTimerEventHandler(EventData *eventData)
 {
-    if (ConsumeTimerFdEvent(blinkingLedTimerFd) != 0) {
-        terminationRequired = true;
-        return;
-    }
-
     // The blink interval has elapsed, so toggle the LED state
     // The LED is active-low so GPIO_Value_Low is on and GPIO_Value_High is off
     ledState = (ledState == GPIO_Value_Low ? GPIO_Value_High : GPIO_Value_Low);
@@ -87,40 +99,26 @@ static void BlinkingLedTimerEventHandler(EventData *eventData)
 }
 
 /// <summary>
-///     Handle button timer event: if the button is pressed, change the LED blink rate.
+///     Handle the button changing state: if it has just been pressed, change the LED blink rate.
 /// </summary>
-static void ButtonTimerEventHandler(EventData *eventData)
+static void ButtonChangedHandler(InputManagerInput *input, bool isPressed)
 {
-    if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0) {
-        terminationRequired = true;
-        return;
-    }
-
-    // Check for a button press
-    GPIO_Value_Type newButtonState;
-    int result = GPIO_GetValue(ledBlinkRateButtonGpioFd, &newButtonState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        terminationRequired = true;
-        return;
-    }
-
-    // If the button has just been pressed, change the LED blink interval
-    // The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
-    if (newButtonState != buttonState) {
-        if (newButtonState == GPIO_Value_Low) {
-            blinkIntervalIndex = (blinkIntervalIndex + 1) % numBlinkIntervals;
-            if (SetTimerFdToPeriod(blinkingLedTimerFd, &blinkIntervals[blinkIntervalIndex]) != 0) {
-                terminationRequired = true;
-            }
+    if (isPressed) {
+        blinkIntervalIndex = (blinkIntervalIndex + 1) % numBlinkIntervals;
+        if (TimerWheel_SetTimerToPeriod(&timerWheel, &blinkingLedTimer,
+                                        &blinkIntervals[blinkIntervalIndex]) != 0) {
+            terminationRequired = true;
         }
-        buttonState = newButtonState;
     }
 }
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData buttonEventData = {.eventHandler = &ButtonTimerEventHandler};
-static EventData blinkingLedTimerEventData = {.eventHandler = &BlinkingLedTimerEventHandler};
+/// <summary>
+///     The input manager could not read the button, so exit.
+/// </summary>
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error)
+{
+    terminationRequired = true;
+}
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -138,19 +136,31 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    // Open button GPIO as input, and set up a timer to poll it
+    struct timespec timerWheelResolution = {0, 1000000};
+    if (TimerWheel_Init(&timerWheel, epollFd, &timerWheelResolution) != 0) {
+        return -1;
+    }
+    timerWheelInitialized = true;
+
+    // Open button GPIO as input, and sample it every 10ms, rather than polling it every 1ms.
+    // The input manager reports a press once the button has been stable for 20ms.
     Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
     ledBlinkRateButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (ledBlinkRateButtonGpioFd < 0) {
         Log_Debug("ERROR: Could not open button GPIO: %s (%d).\n", strerror(errno), errno);
         return -1;
     }
-    struct timespec buttonPressCheckPeriod = {0, 1000000};
-    buttonPollTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod, &buttonEventData, EPOLLIN);
-    if (buttonPollTimerFd < 0) {
+    if (InputManager_Init(&inputManager, epollFd, NULL, 0, &ButtonReadErrorHandler) != 0) {
         return -1;
     }
+    // Sample the button less often while it is not changing.
+    static const struct timespec idleSamplePeriod = {0,
+                                                     INPUT_MANAGER_SUGGESTED_IDLE_SAMPLE_PERIOD_NS};
+    if (InputManager_SetIdleSamplePeriod(&inputManager, &idleSamplePeriod) != 0) {
+        return -1;
+    }
+    ledBlinkRateButton.gpioFd = ledBlinkRateButtonGpioFd;
+    InputManager_AddInput(&inputManager, &ledBlinkRateButton);
 
     // Open LED GPIO, set as output with value GPIO_Value_High (off), and set up a timer to blink it
     Log_Debug("Opening SAMPLE_LED as output.\n");
@@ -159,9 +169,8 @@ static int InitPeripheralsAndHandlers(void)
         Log_Debug("ERROR: Could not open LED GPIO: %s (%d).\n", strerror(errno), errno);
         return -1;
     }
-    blinkingLedTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &blinkIntervals[blinkIntervalIndex],
-                                                    &blinkingLedTimerEventData, EPOLLIN);
-    if (blinkingLedTimerFd < 0) {
+    if (TimerWheel_SetTimerToPeriod(&timerWheel, &blinkingLedTimer,
+                                    &blinkIntervals[blinkIntervalIndex]) != 0) {
         return -1;
     }
 
@@ -179,9 +188,11 @@ static void ClosePeripheralsAndHandlers(void)
     }
 
     Log_Debug("Closing file descriptors.\n");
-    CloseFdAndPrintError(blinkingLedTimerFd, "BlinkingLedTimer");
+    if (timerWheelInitialized) {
+        TimerWheel_Close(&timerWheel);
+    }
+    InputManager_Close(&inputManager);
     CloseFdAndPrintError(blinkingLedGpioFd, "BlinkingLedGpio");
-    CloseFdAndPrintError(buttonPollTimerFd, "ButtonPollTimer");
     CloseFdAndPrintError(ledBlinkRateButtonGpioFd, "LedBlinkRateButtonGpio");
     CloseFdAndPrintError(epollFd, "Epoll");
 }
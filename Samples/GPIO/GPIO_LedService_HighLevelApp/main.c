@@ -0,0 +1,224 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This sample C application for Azure Sphere shows LED patterns without waking up for each
+// change of the LED. The GPIO_LedService_RTApp_MT3620_BareMetal real-time capable application
+// plays blink, breathe and color sequence patterns on LED1, and this application only sends it
+// a small command when the pattern should change.
+// A press of button A selects the next pattern.
+//
+// It uses the API for the following Azure Sphere application libraries:
+// - gpio (digital input for button)
+// - log (messages shown in Visual Studio's Device Output window during debugging)
+// - application (establish a connection with a real-time capable application)
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/gpio.h>
+#include <applibs/log.h>
+
+// By default, this sample's CMake build targets hardware that follows the MT3620
+// Reference Development Board (RDB) specification, such as the MT3620 Dev Kit from
+// Seeed Studios.
+//
+// To target different hardware, you'll need to update the CMake build. The necessary
+// steps to do this vary depending on if you are building in Visual Studio, in Visual
+// Studio Code or via the command line.
+//
+// See https://github.com/Azure/azure-sphere-samples/tree/master/Hardware for more details.
+//
+// This #include imports the sample_hardware abstraction from that hardware definition.
+#include <hw/sample_hardware.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "input_manager.h"
+#include "intercore_channel.h"
+#include "led_service_messages.h"
+
+INTERCORE_CHANNEL_DEFINE_CODEC(LedServiceCommand)
+
+static int epollFd = -1;
+static int patternButtonGpioFd = -1;
+static IntercoreChannel rtAppChannel = {.sockFd = -1};
+static volatile sig_atomic_t terminationRequired = false;
+
+static const char rtAppComponentId[] = "ab2d2826-2888-4fd0-b402-3b81e2924d94";
+
+// Input manager which samples and debounces the button. The button has GPIO_Value_Low when
+// pressed and GPIO_Value_High when released.
+static void ButtonChangedHandler(InputManagerInput *input, bool isPressed);
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error);
+static InputManager inputManager;
+static InputManagerInput patternButton = {.activeValue = GPIO_Value_Low,
+                                          .changedHandler = &ButtonChangedHandler};
+
+// The patterns which the button cycles through: the blink rates of the GPIO sample, a status
+// indication which breathes, and a color sequence.
+static const LedServiceCommand patterns[] = {
+    {.pattern = LedPattern_Blink, .colorCount = 1, .stepMs = 125, .colors = {LedColor_Red}},
+    {.pattern = LedPattern_Blink, .colorCount = 1, .stepMs = 250, .colors = {LedColor_Red}},
+    {.pattern = LedPattern_Blink, .colorCount = 1, .stepMs = 500, .colors = {LedColor_Red}},
+    {.pattern = LedPattern_Breathe, .colorCount = 1, .stepMs = 1500, .colors = {LedColor_Cyan}},
+    {.pattern = LedPattern_Sequence,
+     .colorCount = 3,
+     .stepMs = 300,
+     .colors = {LedColor_Red, LedColor_Green, LedColor_Blue}},
+    {.pattern = LedPattern_Solid, .colorCount = 1, .colors = {LedColor_Green}}};
+static size_t patternIndex = 0;
+
+static void TerminationHandler(int signalNumber);
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size);
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error);
+static int SendPattern(void);
+static int InitPeripheralsAndHandlers(void);
+static void ClosePeripheralsAndHandlers(void);
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+    // Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Handle a message from the real-time capable application, which does not send any.
+/// </summary>
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size)
+{
+    Log_Debug("WARNING: Discarding message of %zu bytes.\n", size);
+}
+
+/// <summary>
+///     Handle a failure of the connection to the real-time capable application.
+/// </summary>
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error)
+{
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Send the current pattern to the real-time capable application, which plays it until the
+///     next one arrives.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int SendPattern(void)
+{
+    Log_Debug("Sending LED pattern %u.\n", patterns[patternIndex].pattern);
+    if (LedServiceCommand_Send(&rtAppChannel, &patterns[patternIndex]) != 0) {
+        Log_Debug("ERROR: Unable to send the LED pattern: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Handle the button changing state: if it has just been pressed, select the next pattern.
+/// </summary>
+static void ButtonChangedHandler(InputManagerInput *input, bool isPressed)
+{
+    if (isPressed) {
+        patternIndex = (patternIndex + 1) % (sizeof(patterns) / sizeof(patterns[0]));
+        if (SendPattern() != 0) {
+            terminationRequired = true;
+        }
+    }
+}
+
+/// <summary>
+///     The input manager could not read the button, so exit.
+/// </summary>
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error)
+{
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitPeripheralsAndHandlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    epollFd = CreateEpollFd();
+    if (epollFd < 0) {
+        return -1;
+    }
+
+    // Open button GPIO as input. The input manager samples it less often while it is not
+    // changing, so the application is idle between patterns.
+    Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
+    patternButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
+    if (patternButtonGpioFd < 0) {
+        Log_Debug("ERROR: Could not open button GPIO: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    if (InputManager_Init(&inputManager, epollFd, NULL, 0, &ButtonReadErrorHandler) != 0) {
+        return -1;
+    }
+    static const struct timespec idleSamplePeriod = {0,
+                                                     INPUT_MANAGER_SUGGESTED_IDLE_SAMPLE_PERIOD_NS};
+    if (InputManager_SetIdleSamplePeriod(&inputManager, &idleSamplePeriod) != 0) {
+        return -1;
+    }
+    patternButton.gpioFd = patternButtonGpioFd;
+    InputManager_AddInput(&inputManager, &patternButton);
+
+    if (IntercoreChannel_Open(&rtAppChannel, epollFd, rtAppComponentId, RTCoreMessageHandler,
+                              RTCoreChannelErrorHandler) != 0) {
+        return -1;
+    }
+
+    return SendPattern();
+}
+
+/// <summary>
+///     Turn the LED off, and close peripherals and handlers.
+/// </summary>
+static void ClosePeripheralsAndHandlers(void)
+{
+    // This is sent on a best-effort basis. The LED keeps its last pattern if it is lost.
+    static const LedServiceCommand off = {
+        .pattern = LedPattern_Solid, .colorCount = 1, .colors = {LedColor_Off}};
+    LedServiceCommand_Send(&rtAppChannel, &off);
+
+    Log_Debug("Closing file descriptors.\n");
+    IntercoreChannel_Close(&rtAppChannel);
+    InputManager_Close(&inputManager);
+    CloseFdAndPrintError(patternButtonGpioFd, "PatternButtonGpio");
+    CloseFdAndPrintError(epollFd, "Epoll");
+}
+
+/// <summary>
+///     Main entry point for this application.
+/// </summary>
+int main(int argc, char *argv[])
+{
+    Log_Debug("LED service application starting.\n");
+    if (InitPeripheralsAndHandlers() != 0) {
+        terminationRequired = true;
+    }
+
+    while (!terminationRequired) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
+            terminationRequired = true;
+        }
+    }
+
+    ClosePeripheralsAndHandlers();
+    Log_Debug("Application exiting.\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "led-effects.h"
+#include "mt3620-timer-scheduler.h"
+
+static const GpioPort *ledPort;
+// Port bits of the red, green and blue elements, in the order of the LedColor bits.
+static uint32_t elementBits[3];
+
+static LedServiceCommand current;
+// Index of the color which is shown in a sequence, or 1 while a blink is off.
+static uint8_t position;
+// Time since the start of the current breath, in milliseconds.
+static uint32_t breathPhaseMs;
+
+// Times the steps of a blink or sequence, or the periods of the software PWM.
+static ScheduledTimer stepTimer;
+// Turns the LED off part of the way through a PWM period.
+static ScheduledTimer pwmOffTimer;
+
+static void ShowColor(uint8_t color)
+{
+    uint32_t litBits = 0;
+    for (size_t i = 0; i < sizeof(elementBits) / sizeof(elementBits[0]); ++i) {
+        if ((color & (1U << i)) != 0) {
+            litBits |= elementBits[i];
+        }
+    }
+
+    // The elements are lit when their pins are driven low. One write sets every element.
+    Mt3620_Gpio_WritePort(ledPort, ~litBits);
+}
+
+static void HandleStepTimerIrq(void)
+{
+    if (current.pattern == LedPattern_Blink) {
+        position ^= 1;
+        ShowColor(position == 0 ? current.colors[0] : LedColor_Off);
+    } else {
+        position = (uint8_t)((position + 1) % current.colorCount);
+        ShowColor(current.colors[position]);
+    }
+}
+
+static void HandlePwmOffTimerIrq(void)
+{
+    ShowColor(LedColor_Off);
+}
+
+static void HandlePwmPeriodTimerIrq(void)
+{
+    uint32_t breathMs = 2U * current.stepMs;
+    breathPhaseMs = (breathPhaseMs + LED_EFFECTS_PWM_PERIOD_US / 1000) % breathMs;
+    uint32_t rampMs = breathPhaseMs < current.stepMs ? breathPhaseMs : breathMs - breathPhaseMs;
+
+    // The brightness in 1/1024ths rises linearly, and the time lit rises with its square, as
+    // the eye sees a small change at low brightness as a large one. This fits in 32 bits.
+    uint32_t level = rampMs * 1024U / current.stepMs;
+    uint32_t onUs = (((level * level) >> 10) * LED_EFFECTS_PWM_PERIOD_US) >> 10;
+
+    if (onUs < LED_EFFECTS_MIN_ON_US) {
+        ShowColor(LedColor_Off);
+        return;
+    }
+
+    ShowColor(current.colors[0]);
+    if (onUs < LED_EFFECTS_PWM_PERIOD_US) {
+        TimerScheduler_Start(&pwmOffTimer, onUs, 0, HandlePwmOffTimerIrq);
+    }
+}
+
+static bool IsValidCommand(const LedServiceCommand *command)
+{
+    if (command->pattern > LedPattern_Sequence || command->colorCount == 0 ||
+        command->colorCount > LED_SERVICE_MAX_COLORS) {
+        return false;
+    }
+
+    for (size_t i = 0; i < command->colorCount; ++i) {
+        if (command->colors[i] > LedColor_White) {
+            return false;
+        }
+    }
+
+    switch (command->pattern) {
+    case LedPattern_Solid:
+        return true;
+    case LedPattern_Breathe:
+        return command->stepMs >= LED_SERVICE_MIN_BREATHE_STEP_MS;
+    default:
+        return command->stepMs != 0;
+    }
+}
+
+void LedEffects_Init(const GpioPort *port, int redPin, int greenPin, int bluePin)
+{
+    ledPort = port;
+    elementBits[0] = Mt3620_Gpio_PortBit(port, redPin);
+    elementBits[1] = Mt3620_Gpio_PortBit(port, greenPin);
+    elementBits[2] = Mt3620_Gpio_PortBit(port, bluePin);
+    ShowColor(LedColor_Off);
+}
+
+bool LedEffects_Play(const LedServiceCommand *command)
+{
+    if (!IsValidCommand(command)) {
+        return false;
+    }
+
+    TimerScheduler_Stop(&stepTimer);
+    TimerScheduler_Stop(&pwmOffTimer);
+
+    current = *command;
+    position = 0;
+    breathPhaseMs = 0;
+
+    uint32_t stepUs = (uint32_t)current.stepMs * 1000;
+    switch (current.pattern) {
+    case LedPattern_Solid:
+        // Nothing changes until the next command, so no timer runs.
+        ShowColor(current.colors[0]);
+        break;
+    case LedPattern_Breathe:
+        ShowColor(LedColor_Off);
+        TimerScheduler_Start(&stepTimer, LED_EFFECTS_PWM_PERIOD_US, LED_EFFECTS_PWM_PERIOD_US,
+                             HandlePwmPeriodTimerIrq);
+        break;
+    default:
+        ShowColor(current.colors[0]);
+        TimerScheduler_Start(&stepTimer, stepUs, stepUs, HandleStepTimerIrq);
+        break;
+    }
+
+    return true;
+}
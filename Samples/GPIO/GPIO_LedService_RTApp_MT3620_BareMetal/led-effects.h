@@ -0,0 +1,51 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef LED_EFFECTS_H
+#define LED_EFFECTS_H
+
+#include <stdbool.h>
+
+#include "mt3620-gpio.h"
+#include "led_service_messages.h"
+
+/// <summary>
+/// Period of the software PWM which dims the LED while it breathes, in microseconds. At 100Hz
+/// the LED does not visibly flicker.
+/// </summary>
+#define LED_EFFECTS_PWM_PERIOD_US 10000
+
+/// <summary>
+/// Shortest time for which the LED is lit in a PWM period, in microseconds. A dimmer level
+/// turns the LED off for the whole period, rather than taking an interrupt to light it only
+/// briefly.
+/// </summary>
+#define LED_EFFECTS_MIN_ON_US 100
+
+/// <summary>
+/// <para>Set up the effects engine to drive an RGB LED, which is lit by driving its pins low,
+/// and turn the LED off.</para>
+/// <para>The engine times the LED with two software timers on the scheduler, so
+/// <see cref="TimerScheduler_Init" /> must have been called. A solid color needs no timer,
+/// a blink or sequence takes one interrupt per change of color, and only breathing runs the
+/// software PWM.</para>
+/// </summary>
+/// <param name="port">Port which contains the LED's pins, configured for output. This must stay
+/// in memory while the engine is used.</param>
+/// <param name="redPin">The pin of the red element.</param>
+/// <param name="greenPin">The pin of the green element.</param>
+/// <param name="bluePin">The pin of the blue element.</param>
+void LedEffects_Init(const GpioPort *port, int redPin, int greenPin, int bluePin);
+
+/// <summary>
+/// <para>Stop the current pattern and start playing another one.</para>
+/// <para>Call this from an interrupt handler at the priority of the GPT interrupt, such as the
+/// intercore interrupt handler, so that it does not preempt the engine's timer callbacks, or
+/// with that interrupt blocked.</para>
+/// </summary>
+/// <param name="command">The pattern to play, which is copied.</param>
+/// <returns>true if the pattern is playing; false if the command is not valid, in which case
+/// the current pattern continues.</returns>
+bool LedEffects_Play(const LedServiceCommand *command);
+
+#endif // #ifndef LED_EFFECTS_H
@@ -0,0 +1,146 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-gpio.h"
+#include "mt3620-intercore.h"
+#include "mt3620-timer.h"
+#include "mt3620-timer-scheduler.h"
+#include "mt3620-uart-poll.h"
+#include "led-effects.h"
+#include "led_service_messages.h"
+
+INTERCORE_DEFINE_RING_CODEC(LedServiceCommand)
+
+extern uint32_t StackTop; // &StackTop == end of TCM
+
+static _Noreturn void DefaultExceptionHandler(void);
+static void HandleIntercoreIrq(void);
+static _Noreturn void RTCoreMain(void);
+
+// LED1 is an RGB LED on GPIO8-10, which are in the same block, so one port drives all three.
+static const int led1RedGpio = 8;
+static const int led1GreenGpio = 9;
+static const int led1BlueGpio = 10;
+static GpioPort led1Port;
+
+static BufferHeader *outbound, *inbound;
+static uint32_t sharedBufSize = 0;
+
+// ARM DDI0403E.d SB1.5.2-3
+// From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
+// value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
+// of 128 bytes.". The array is aligned in linker.ld, using the dedicated section ".vector_table".
+
+// The exception vector table contains a stack pointer, 15 exception handlers, and an entry for
+// each interrupt.
+#define INTERRUPT_COUNT 100 // from datasheet
+#define EXCEPTION_COUNT (16 + INTERRUPT_COUNT)
+#define INT_TO_EXC(i_) (16 + (i_))
+const uintptr_t ExceptionVectorTable[EXCEPTION_COUNT] __attribute__((section(".vector_table")))
+__attribute__((used)) = {
+    [0] = (uintptr_t)&StackTop,                // Main Stack Pointer (MSP)
+    [1] = (uintptr_t)RTCoreMain,               // Reset
+    [2] = (uintptr_t)DefaultExceptionHandler,  // NMI
+    [3] = (uintptr_t)DefaultExceptionHandler,  // HardFault
+    [4] = (uintptr_t)DefaultExceptionHandler,  // MPU Fault
+    [5] = (uintptr_t)DefaultExceptionHandler,  // Bus Fault
+    [6] = (uintptr_t)DefaultExceptionHandler,  // Usage Fault
+    [11] = (uintptr_t)DefaultExceptionHandler, // SVCall
+    [12] = (uintptr_t)DefaultExceptionHandler, // Debug monitor
+    [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
+    [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
+
+    [INT_TO_EXC(0)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(1)] = (uintptr_t)Gpt_HandleIrq1,
+    [INT_TO_EXC(2)... INT_TO_EXC(10)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(11)] = (uintptr_t)Intercore_HandleIrq11,
+    [INT_TO_EXC(12)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+
+static _Noreturn void DefaultExceptionHandler(void)
+{
+    for (;;) {
+        // empty.
+    }
+}
+
+// Play each pattern which the high-level application sends. The intercore interrupt has the
+// same priority as the GPT interrupt, so it does not preempt the engine's timer callbacks.
+static void HandleIntercoreIrq(void)
+{
+    IntercoreCursor readCursor;
+    if (BeginDequeue(&readCursor, outbound, inbound, sharedBufSize) == -1) {
+        return;
+    }
+
+    IntercoreBlock block;
+    while (PeekNextBlock(&readCursor, &block) == 0) {
+        uint16_t typeId;
+        uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+        LedServiceCommand command;
+        if (!IsTypedMessage(&block, &typeId) || typeId != LedServiceCommand_TypeId ||
+            LedServiceCommand_Decode(&block, messageHeader, &command) == -1) {
+            Uart_WriteStringPoll("Discarding unexpected message\r\n");
+            continue;
+        }
+
+        if (LedEffects_Play(&command)) {
+            Uart_WriteStringPoll("Playing pattern ");
+            Uart_WriteIntegerPoll(command.pattern);
+            Uart_WriteStringPoll("\r\n");
+        } else {
+            Uart_WriteStringPoll("Ignoring invalid pattern\r\n");
+        }
+    }
+
+    CommitDequeue(&readCursor);
+}
+
+static _Noreturn void RTCoreMain(void)
+{
+    // SCB->VTOR = ExceptionVectorTable
+    WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
+
+    Uart_Init();
+    Uart_WriteStringPoll("--------------------------------\r\n");
+    Uart_WriteStringPoll("GPIO_LedService_RTApp_MT3620_BareMetal\r\n");
+    Uart_WriteStringPoll("App built on: " __DATE__ ", " __TIME__ "\r\n");
+
+    Gpt_Init();
+    // The effects engine's timers share TimerGpt0, which leaves TimerGpt1 free.
+    TimerScheduler_Init(TimerGpt0);
+
+    // Block includes GPIO8-11.
+    static const GpioBlock pwm2 = {
+        .baseAddr = 0x38030000, .type = GpioBlock_PWM, .firstPin = 8, .pinCount = 4};
+
+    Mt3620_Gpio_AddBlock(&pwm2);
+
+    const int led1Pins[] = {led1RedGpio, led1GreenGpio, led1BlueGpio};
+    Mt3620_Gpio_OpenPort(led1Pins, sizeof(led1Pins) / sizeof(led1Pins[0]), &led1Port);
+    Mt3620_Gpio_ConfigurePortForOutput(&led1Port);
+    LedEffects_Init(&led1Port, led1RedGpio, led1GreenGpio, led1BlueGpio);
+
+    if (GetIntercoreBuffers(&outbound, &inbound, &sharedBufSize) == -1) {
+        Uart_WriteStringPoll("ERROR: Unable to get shared buffers\r\n");
+        for (;;) {
+            // empty.
+        }
+    }
+
+    EnableIntercoreIrq(HandleIntercoreIrq);
+
+    // Handle any commands which arrived before the interrupt was enabled, with interrupts
+    // blocked as they would be in the interrupt handler.
+    uint32_t prevBasePri = BlockIrqs();
+    HandleIntercoreIrq();
+    RestoreIrqs(prevBasePri);
+
+    for (;;) {
+        __asm__("wfi");
+    }
+}
@@ -7,6 +7,7 @@
 
 #include "mt3620-baremetal.h"
 #include "mt3620-timer.h"
+#include "mt3620-timer-scheduler.h"
 #include "mt3620-gpio.h"
 
 extern uint32_t StackTop; // &StackTop == end of TCM
@@ -15,14 +16,20 @@ static _Noreturn void DefaultExceptionHandler(void);
 
 static bool led1RedOn = false;
 static const int led1RedGpio = 8;
+// The LED is written through a port, which finds its register once at startup.
+static GpioPort led1Port;
 static const int blinkIntervalsMs[] = {125, 250, 500};
 static int blinkIntervalIndex = 0;
 static const int numBlinkIntervals = sizeof(blinkIntervalsMs) / sizeof(blinkIntervalsMs[0]);
+static ScheduledTimer blinkTimer;
 static void HandleBlinkTimerIrq(void);
 
 static const int buttonAGpio = 12;
-static const int buttonPressCheckPeriodMs = 10;
-static void HandleButtonTimerIrq(void);
+// The button is read once it has stopped bouncing, this long after the last edge.
+static const uint32_t buttonDebounceUs = 20 * 1000;
+static ScheduledTimer buttonDebounceTimer;
+static void HandleButtonEdgeIrq(int pin);
+static void HandleButtonDebounceTimerIrq(void);
 
 static _Noreturn void RTCoreMain(void);
 
@@ -52,7 +59,11 @@ __attribute__((used)) = {
 
     [INT_TO_EXC(0)] = (uintptr_t)DefaultExceptionHandler,
     [INT_TO_EXC(1)] = (uintptr_t)Gpt_HandleIrq1,
-    [INT_TO_EXC(2)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+    [INT_TO_EXC(2)... INT_TO_EXC(GPIO_EINT_FIRST_IRQ - 1)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(GPIO_EINT_FIRST_IRQ)... INT_TO_EXC(GPIO_EINT_FIRST_IRQ + GPIO_EINT_COUNT - 1)] =
+        (uintptr_t)Mt3620_Gpio_HandleEintIrq,
+    [INT_TO_EXC(GPIO_EINT_FIRST_IRQ + GPIO_EINT_COUNT)... INT_TO_EXC(INTERRUPT_COUNT - 1)] =
+        (uintptr_t)DefaultExceptionHandler};
 
 static _Noreturn void DefaultExceptionHandler(void)
 {
@@ -64,12 +75,22 @@ static _Noreturn void DefaultExceptionHandler(void)
 static void HandleBlinkTimerIrq(void)
 {
     led1RedOn = !led1RedOn;
-    Mt3620_Gpio_Write(led1RedGpio, led1RedOn);
+    Mt3620_Gpio_WritePort(&led1Port, led1RedOn ? led1Port.mask : 0);
+}
+
+static void StartBlinkTimer(void)
+{
+    uint32_t intervalUs = (uint32_t)blinkIntervalsMs[blinkIntervalIndex] * 1000;
+    TimerScheduler_Start(&blinkTimer, intervalUs, intervalUs, HandleBlinkTimerIrq);
+}
 
-    Gpt_LaunchTimerMs(TimerGpt0, blinkIntervalsMs[blinkIntervalIndex], HandleBlinkTimerIrq);
+static void HandleButtonEdgeIrq(int pin)
+{
+    // Restart the debounce timer on every edge, so the button is only read once it is stable.
+    TimerScheduler_Start(&buttonDebounceTimer, buttonDebounceUs, 0, HandleButtonDebounceTimerIrq);
 }
 
-static void HandleButtonTimerIrq(void)
+static void HandleButtonDebounceTimerIrq(void)
 {
     // Assume initial state is high, i.e. button not pressed.
     static bool prevState = true;
@@ -80,13 +101,11 @@ static void HandleButtonTimerIrq(void)
         bool pressed = !newState;
         if (pressed) {
             blinkIntervalIndex = (blinkIntervalIndex + 1) % numBlinkIntervals;
-            Gpt_LaunchTimerMs(TimerGpt0, blinkIntervalsMs[blinkIntervalIndex], HandleBlinkTimerIrq);
+            StartBlinkTimer();
         }
 
         prevState = newState;
     }
-
-    Gpt_LaunchTimerMs(TimerGpt1, buttonPressCheckPeriodMs, HandleButtonTimerIrq);
 }
 
 static _Noreturn void RTCoreMain(void)
@@ -95,6 +114,8 @@ static _Noreturn void RTCoreMain(void)
     WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
 
     Gpt_Init();
+    // The software timers share TimerGpt0, which leaves TimerGpt1 free.
+    TimerScheduler_Init(TimerGpt0);
 
     // Block includes led1RedGpio, GPIO8.
     static const GpioBlock pwm2 = {
@@ -108,11 +129,14 @@ static _Noreturn void RTCoreMain(void)
 
     Mt3620_Gpio_AddBlock(&grp3);
 
-    Mt3620_Gpio_ConfigurePinForOutput(led1RedGpio);
+    const int led1Pins[] = {led1RedGpio};
+    Mt3620_Gpio_OpenPort(led1Pins, sizeof(led1Pins) / sizeof(led1Pins[0]), &led1Port);
+    Mt3620_Gpio_ConfigurePortForOutput(&led1Port);
     Mt3620_Gpio_ConfigurePinForInput(buttonAGpio);
 
-    Gpt_LaunchTimerMs(TimerGpt0, blinkIntervalsMs[blinkIntervalIndex], HandleBlinkTimerIrq);
-    Gpt_LaunchTimerMs(TimerGpt1, buttonPressCheckPeriodMs, HandleButtonTimerIrq);
+    StartBlinkTimer();
+    // GPIO12 has an EINT, so the button interrupts when it changes rather than being polled.
+    Mt3620_Gpio_EnableEdgeInterrupt(buttonAGpio, GpioEdge_Both, HandleButtonEdgeIrq);
 
     for (;;) {
         __asm__("wfi");
@@ -20,6 +20,27 @@ static const uintptr_t NVIC_IPR_BASE = 0xE000E400;
 /// <summary>The IOM4 cores on the MT3620 use three bits to encode interrupt priorities.</summary>
 #define IRQ_PRIORITY_BITS 3
 
+/// <summary>
+/// Place a function in HOT_CODE_REGION, which is TCM, even when linker.ld runs the rest of the
+/// code from flash. Use this for interrupt handlers and inner loops, such as DSP kernels and
+/// ring-buffer copies, which must run without wait states.
+/// </summary>
+#define TCM_CODE __attribute__((section(".tcm_text")))
+
+/// <summary>
+/// Place a function in COLD_CODE_REGION, which linker.ld runs in place from flash, so that it
+/// does not use TCM. Use this for startup code which runs once. The function is also optimized
+/// for size.
+/// </summary>
+#define COLD_CODE __attribute__((section(".cold_text"), cold))
+
+/// <summary>
+/// Place a zero-initialized variable in LARGE_BSS_REGION, which is SYSRAM, so that it does not
+/// use TCM. Use this for large buffers, such as message and DMA buffers, which are not accessed
+/// in the innermost loops.
+/// </summary>
+#define SYSRAM_BSS __attribute__((section(".bss.sysram")))
+
 /// <summary>
 /// Zero-argument callback.
 /// </summary>
@@ -0,0 +1,73 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef MT3620_TIMER_SCHEDULER_H
+#define MT3620_TIMER_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mt3620-timer.h"
+
+/// <summary>
+/// Longest delay or period, in microseconds, which can be passed to
+/// <see cref="TimerScheduler_Start" />. Deadlines are compared by signed difference on the
+/// wrapping microsecond counter, so they must be less than half its range in the future.
+/// </summary>
+#define TIMER_SCHEDULER_MAX_DELAY_US 0x7FFFFFFFU
+
+/// <summary>
+/// <para>A software timer, which is multiplexed with other software timers onto one hardware
+/// GPT by the scheduler.</para>
+/// <para>The application allocates these, typically statically, and must not modify them
+/// directly. A timer must not be deallocated while it is running.</para>
+/// </summary>
+typedef struct ScheduledTimer {
+    /// <summary>Function which is invoked in interrupt context when the timer expires.</summary>
+    Callback callback;
+    /// <summary>Period in microseconds, or zero for a one-shot timer.</summary>
+    uint32_t periodUs;
+    /// <summary>Value of <see cref="Gpt_GetMicroseconds" /> when the timer next expires.</summary>
+    uint32_t deadlineUs;
+    /// <summary>Number of expiries of a periodic timer which were skipped, because the
+    /// callbacks took longer than the period.</summary>
+    uint32_t missedPeriods;
+    /// <summary>Next timer in the scheduler's queue, which is sorted by deadline.</summary>
+    struct ScheduledTimer *next;
+    /// <summary>Whether the timer is in the scheduler's queue.</summary>
+    bool isActive;
+} ScheduledTimer;
+
+/// <summary>
+/// Initialize the scheduler to multiplex software timers onto the supplied GPT. Call this once,
+/// after <see cref="Gpt_Init" />. The GPT must not be used directly after this.
+/// </summary>
+/// <param name="gpt">Hardware timer which the scheduler uses.</param>
+void TimerScheduler_Init(TimerGpt gpt);
+
+/// <summary>
+/// <para>Start, or restart, a software timer.</para>
+/// <para>The deadlines are absolute times on the microsecond counter. Each deadline of a
+/// periodic timer is the previous deadline plus the period, so the timer does not drift by the
+/// time taken to handle the interrupt or run other callbacks. If the callbacks take longer
+/// than a period, the missed expiries are skipped and counted in
+/// <see cref="ScheduledTimer.missedPeriods" />, rather than being run back to back.</para>
+/// <para>This function can be called from the main loop, or from a timer callback.</para>
+/// </summary>
+/// <param name="timer">Timer to start. If it is already running, it is restarted.</param>
+/// <param name="delayUs">Time until the first expiry, in microseconds. This must not exceed
+/// <see cref="TIMER_SCHEDULER_MAX_DELAY_US" />.</param>
+/// <param name="periodUs">Time between subsequent expiries, in microseconds, or zero for a
+/// one-shot timer. This must not exceed <see cref="TIMER_SCHEDULER_MAX_DELAY_US" />.</param>
+/// <param name="callback">Function to invoke in interrupt context when the timer expires.</param>
+void TimerScheduler_Start(ScheduledTimer *timer, uint32_t delayUs, uint32_t periodUs,
+                          Callback callback);
+
+/// <summary>
+/// Stop a software timer, so its callback is not invoked again. It is safe to call this
+/// function when the timer is not running.
+/// </summary>
+/// <param name="timer">Timer to stop.</param>
+void TimerScheduler_Stop(ScheduledTimer *timer);
+
+#endif // #ifndef MT3620_TIMER_SCHEDULER_H
@@ -0,0 +1,64 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "intercore_typed_defs.h"
+
+/// <summary>
+/// Colors of the RGB LED, as the set of its red, green and blue elements which are lit.
+/// </summary>
+typedef enum {
+    LedColor_Off = 0,
+    LedColor_Red = 1 << 0,
+    LedColor_Green = 1 << 1,
+    LedColor_Blue = 1 << 2,
+    LedColor_Yellow = LedColor_Red | LedColor_Green,
+    LedColor_Magenta = LedColor_Red | LedColor_Blue,
+    LedColor_Cyan = LedColor_Green | LedColor_Blue,
+    LedColor_White = LedColor_Red | LedColor_Green | LedColor_Blue
+} LedColor;
+
+/// <summary>
+/// Patterns which the LED service can play.
+/// </summary>
+typedef enum {
+    /// <summary>Show colors[0] until the next command.</summary>
+    LedPattern_Solid = 0,
+    /// <summary>Show colors[0] for stepMs, then turn the LED off for stepMs, and
+    /// repeat.</summary>
+    LedPattern_Blink = 1,
+    /// <summary>Fade colors[0] up over stepMs and back down over stepMs, and repeat.</summary>
+    LedPattern_Breathe = 2,
+    /// <summary>Show each of the colorCount colors for stepMs in turn, and repeat.</summary>
+    LedPattern_Sequence = 3
+} LedPattern;
+
+/// <summary>Most colors in a <see cref="LedPattern_Sequence" />.</summary>
+#define LED_SERVICE_MAX_COLORS 8
+
+/// <summary>Shortest stepMs which the LED service accepts for a
+/// <see cref="LedPattern_Breathe" />, so that each fade has several brightness steps.</summary>
+#define LED_SERVICE_MIN_BREATHE_STEP_MS 100
+
+/// <summary>
+/// <para>Sent by the high-level application to make the real-time capable application play a
+/// pattern on LED1, until the next command. The real-time core times every change of the LED
+/// itself, so the high-level core only wakes up when it wants a different pattern.</para>
+/// <para>A command which is not valid is ignored, and the previous pattern continues.</para>
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>A <see cref="LedPattern" />.</summary>
+    uint8_t pattern;
+    /// <summary>Number of entries in colors which are used, from 1 to
+    /// LED_SERVICE_MAX_COLORS. Only a sequence uses more than one.</summary>
+    uint8_t colorCount;
+    /// <summary>Duration of each step of the pattern, in milliseconds. This is not used for a
+    /// solid color.</summary>
+    uint16_t stepMs;
+    /// <summary>The colors, each a <see cref="LedColor" />.</summary>
+    uint8_t colors[LED_SERVICE_MAX_COLORS];
+} LedServiceCommand;
+INTERCORE_TYPED_MESSAGE(LedServiceCommand, 21, 1);
@@ -25,6 +25,10 @@
 #include <applibs/storage.h>
 
 #include "epoll_timerfd_utilities.h"
+#include "memory_metrics.h"
+#include "resolve_cache.h"
+#include "response_sink.h"
+#include "transfer_metrics.h"
 
 static volatile sig_atomic_t terminationRequired = false;
 
@@ -41,40 +45,36 @@ static void TerminationHandler(int signalNumber)
 static int webpageDownloadTimerFd = -1;
 static int epollFd = -1;
 
-/// <summary>
-///     Data pointer and size of a block of memory allocated on the heap.
-/// </summary>
-typedef struct {
-    char *data;
-    size_t size;
-} MemoryBlock;
-
-/// <summary>
-///     Callback for curl_easy_perform() that copies all the downloaded chunks in a single memory
-///     block.
-/// <param name="chunks">The pointer to the chunks array</param>
-/// <param name="chunkSize">The size of each chunk</param>
-/// <param name="chunksCount">The count of the chunks</param>
-/// <param name="memoryBlock">The pointer where all the downloaded chunks are aggregated</param>
-/// </summary>
-static size_t StoreDownloadedDataCallback(void *chunks, size_t chunkSize, size_t chunksCount,
-                                          void *memoryBlock)
-{
-    MemoryBlock *block = (MemoryBlock *)memoryBlock;
-
-    size_t additionalDataSize = chunkSize * chunksCount;
-    block->data = realloc(block->data, block->size + additionalDataSize + 1);
-    if (block->data == NULL) {
-        Log_Debug("Out of memory, realloc returned NULL: errno=%d (%s)'n", errno, strerror(errno));
-        abort();
-    }
-
-    memcpy(block->data + block->size, chunks, additionalDataSize);
-    block->size += additionalDataSize;
-    block->data[block->size] = 0; // Ensure the block of memory is null terminated.
-
-    return additionalDataSize;
-}
+// The cURL easy handle, which is kept between downloads so that its connection can be reused.
+static CURL *curlHandle = NULL;
+static bool curlGlobalInitialized = false;
+static char *certificatePath = NULL;
+
+// The web page which is downloaded.
+static const char downloadUrl[] = "https://example.com";
+
+// Time that a connection is idle before the first TCP keep-alive probe, and the time between
+// probes. The downloads are 10 seconds apart, so the connection is kept alive between them.
+static const long keepAliveIdleSeconds = 5;
+static const long keepAliveIntervalSeconds = 5;
+
+// Receives each downloaded page. Its block is kept between downloads, and a page which is larger
+// than maxDownloadSize fails to download rather than using more memory.
+static ResponseSink downloadSink;
+static const size_t maxDownloadSize = 64 * 1024;
+
+// The address of the server, which is passed to cURL so that it does not resolve the name again.
+// The easy handle's own DNS cache forgets the address after a minute, so it is kept here for
+// longer. It is forgotten sooner if the server cannot be connected to.
+static ResolveCache resolveCache;
+static const uint32_t learnedAddressTtlSeconds = 5 * 60;
+static struct curl_slist *resolveList = NULL;
+
+// The timing of the downloads, which is logged once a minute, and the number of downloads since
+// it was last logged.
+static TransferMetrics downloadMetrics;
+static const unsigned int downloadsPerMetricsLog = 6;
+static unsigned int downloadsSinceMetricsLog = 0;
 
 /// <summary>
 ///     Logs a cURL error.
@@ -88,46 +88,40 @@ static void LogCurlError(const char *message, int curlErrCode)
 }
 
 /// <summary>
-///     Download a web page over HTTPS protocol using cURL.
+///     Initializes the cURL library and sets up the easy handle which is used for every download.
+///     The handle keeps the connection to the server open after a download completes, along with
+///     the TLS session, so that the next download can reuse the connection without a new TCP
+///     connection or TLS handshake.
 /// </summary>
-static void PerformWebPageDownload(void)
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitCurl(void)
 {
-    CURL *curlHandle = NULL;
     CURLcode res = 0;
-    MemoryBlock block = {.data = NULL, .size = 0};
-    char *certificatePath = NULL;
-
-    bool isNetworkingReady = false;
-    if ((Networking_IsNetworkingReady(&isNetworkingReady) < 0) || !isNetworkingReady) {
-        Log_Debug("\nNot doing download because there is no internet connectivity.\n");
-        goto exitLabel;
-    }
-
-    Log_Debug("\n -===- Starting download -===-\n");
 
     // Init the cURL library.
     if ((res = curl_global_init(CURL_GLOBAL_ALL)) != CURLE_OK) {
         LogCurlError("curl_global_init", res);
-        goto exitLabel;
+        return -1;
     }
+    curlGlobalInitialized = true;
 
     if ((curlHandle = curl_easy_init()) == NULL) {
         Log_Debug("curl_easy_init() failed\n");
-        goto cleanupLabel;
+        return -1;
     }
 
     // Specify URL to download.
     // Important: any change in the domain name must be reflected in the AllowedConnections
     // capability in app_manifest.json.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_URL, "https://example.com")) != CURLE_OK) {
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_URL, downloadUrl)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_URL", res);
-        goto cleanupLabel;
+        return -1;
     }
 
     // Set output level to verbose.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_VERBOSE, 1L)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_VERBOSE", res);
-        goto cleanupLabel;
+        return -1;
     }
 
     // Get the full path to the certificate file used to authenticate the HTTPS server identity.
@@ -137,13 +131,13 @@ static void PerformWebPageDownload(void)
     if (certificatePath == NULL) {
         Log_Debug("The certificate path could not be resolved: errno=%d (%s)\n", errno,
                   strerror(errno));
-        goto cleanupLabel;
+        return -1;
     }
 
     // Set the path for the certificate file that cURL uses to validate the server certificate.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_CAINFO, certificatePath)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_CAINFO", res);
-        goto cleanupLabel;
+        return -1;
     }
 
     // Let cURL follow any HTTP 3xx redirects.
@@ -151,46 +145,172 @@ static void PerformWebPageDownload(void)
     // app_manifest.json.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1L)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_FOLLOWLOCATION", res);
-        goto cleanupLabel;
+        return -1;
     }
 
-    // Set up callback for cURL to use when downloading data.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, StoreDownloadedDataCallback)) !=
-        CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_FOLLOWLOCATION", res);
-        goto cleanupLabel;
+    ResolveCache_Init(&resolveCache, learnedAddressTtlSeconds);
+
+    // Set up callback for cURL to use when downloading data, and the sink which it writes to.
+    ResponseSink_InitBuffer(&downloadSink, maxDownloadSize);
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION,
+                                ResponseSink_CurlWriteCallback)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_WRITEFUNCTION", res);
+        return -1;
     }
 
-    // Set the custom parameter of the callback to the memory block.
-    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, (void *)&block)) != CURLE_OK) {
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, (void *)&downloadSink)) !=
+        CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_WRITEDATA", res);
-        goto cleanupLabel;
+        return -1;
+    }
+
+    // Let the sink see the Content-Length header, so that it can allocate the whole page at once,
+    // or fail the download before the body arrives if the page is too large.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_HEADERFUNCTION,
+                                ResponseSink_CurlHeaderCallback)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_HEADERFUNCTION", res);
+        return -1;
+    }
+
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, (void *)&downloadSink)) !=
+        CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_HEADERDATA", res);
+        return -1;
     }
 
     // Specify a user agent.
     if ((res = curl_easy_setopt(curlHandle, CURLOPT_USERAGENT, "libcurl-agent/1.0")) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_USERAGENT", res);
-        goto cleanupLabel;
+        return -1;
+    }
+
+    // Send TCP keep-alive probes while the connection is idle between downloads, so that the
+    // server and any NAT on the way do not drop it, and so that a dead connection is detected
+    // before the next download tries to use it.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPALIVE, 1L)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_TCP_KEEPALIVE", res);
+        return -1;
+    }
+
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPIDLE, keepAliveIdleSeconds)) !=
+        CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_TCP_KEEPIDLE", res);
+        return -1;
+    }
+
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPINTVL, keepAliveIntervalSeconds)) !=
+        CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_TCP_KEEPINTVL", res);
+        return -1;
+    }
+
+    // Cache the TLS session, so that if the server closes the connection, the next download can
+    // resume the session with an abbreviated handshake instead of a full one.
+    if ((res = curl_easy_setopt(curlHandle, CURLOPT_SSL_SESSIONID_CACHE, 1L)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_SSL_SESSIONID_CACHE", res);
+        return -1;
+    }
+
+    return 0;
+}
+
+/// <summary>
+///     Cleans up the easy handle, which closes any connection that it kept open, and the cURL
+///     library's resources.
+/// </summary>
+static void CloseCurl(void)
+{
+    // Clean up sample's cURL resources.
+    if (curlHandle != NULL) {
+        curl_easy_cleanup(curlHandle);
+        curlHandle = NULL;
+    }
+    curl_slist_free_all(resolveList);
+    resolveList = NULL;
+
+    // Clean up cURL library's resources.
+    if (curlGlobalInitialized) {
+        curl_global_cleanup();
+        curlGlobalInitialized = false;
+    }
+
+    free(certificatePath);
+    certificatePath = NULL;
+
+    ResponseSink_Fini(&downloadSink);
+}
+
+/// <summary>
+///     Download a web page over HTTPS protocol using cURL.
+/// </summary>
+static void PerformWebPageDownload(void)
+{
+    CURLcode res = 0;
+
+    bool isNetworkingReady = false;
+    if ((Networking_IsNetworkingReady(&isNetworkingReady) < 0) || !isNetworkingReady) {
+        Log_Debug("\nNot doing download because there is no internet connectivity.\n");
+        goto exitLabel;
+    }
+
+    Log_Debug("\n -===- Starting download -===-\n");
+
+    // Discard the previous page, but keep its memory for this one.
+    ResponseSink_Reset(&downloadSink);
+
+    // Connect to the cached address of the server, if it has not expired.
+    if (ResolveCache_SetupTransfer(&resolveCache, curlHandle, downloadUrl, &resolveList) != 0) {
+        goto exitLabel;
     }
 
     // Perform the download of the web page.
-    if ((res = curl_easy_perform(curlHandle)) != CURLE_OK) {
+    res = curl_easy_perform(curlHandle);
+
+    // Break the time down, so that DNS, TLS and server latency can be told apart.
+    TransferTiming timing;
+    long httpStatus = 0;
+    curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &httpStatus);
+    if (TransferMetrics_Measure(curlHandle, &timing) == 0) {
+        TransferMetrics_LogTiming(&timing);
+        TransferMetrics_Record(&downloadMetrics, downloadUrl, &timing,
+                               res == CURLE_OK && httpStatus < 400);
+    }
+    ResolveCache_RecordTransfer(&resolveCache, curlHandle, downloadUrl, res);
+
+    if (res != CURLE_OK) {
         LogCurlError("curl_easy_perform", res);
+        if (downloadSink.error == ResponseSinkError_Full) {
+            Log_Debug("ERROR: The page is larger than %zu bytes.\n", maxDownloadSize);
+        } else if (downloadSink.error == ResponseSinkError_OutOfMemory) {
+            Log_Debug("ERROR: Out of memory for the downloaded page.\n");
+        }
     } else {
-        Log_Debug("\n -===- Downloaded content (%zu bytes): -===-\n", block.size);
-        Log_Debug("%s\n", block.data);
+        Log_Debug("\n -===- Downloaded content (%zu bytes): -===-\n", downloadSink.buffer.size);
+        if (downloadSink.buffer.data != NULL) {
+            Log_Debug("%s\n", (const char *)downloadSink.buffer.data);
+        }
+
+        // No new connections means the connection from the previous download was reused.
+        long newConnections = 0;
+        if (curl_easy_getinfo(curlHandle, CURLINFO_NUM_CONNECTS, &newConnections) == CURLE_OK) {
+            if (newConnections == 0) {
+                Log_Debug("INFO: Reused the existing connection.\n");
+            } else {
+                Log_Debug("INFO: Opened %ld new connection(s).\n", newConnections);
+            }
+        }
     }
 
-cleanupLabel:
-    // Clean up allocated memory.
-    free(block.data);
-    free(certificatePath);
-    // Clean up sample's cURL resources.
-    curl_easy_cleanup(curlHandle);
-    // Clean up cURL library's resources.
-    curl_global_cleanup();
     Log_Debug("\n -===- End of download -===-\n");
 
+    if (++downloadsSinceMetricsLog == downloadsPerMetricsLog) {
+        Log_Debug("\n -===- Download metrics -===-\n");
+        TransferMetrics_Log(&downloadMetrics);
+        Log_Debug("Resolve cache: %u download(s) used the cached address, %u resolved the host.\n",
+                  resolveCache.hits, resolveCache.misses);
+        downloadsSinceMetricsLog = 0;
+    }
+
 exitLabel:
     return;
 }
@@ -235,6 +355,10 @@ static int InitHandlers(void)
         return -1;
     }
 
+    if (InitCurl() != 0) {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -243,6 +367,8 @@ static int InitHandlers(void)
 /// </summary>
 static void CloseHandlers(void)
 {
+    CloseCurl();
+
     // Close the timer and epoll file descriptors.
     CloseFdAndPrintError(webpageDownloadTimerFd, "WebpageDownloadTimer");
     CloseFdAndPrintError(epollFd, "Epoll");
@@ -253,6 +379,8 @@ static void CloseHandlers(void)
 /// </summary>
 int main(int argc, char *argv[])
 {
+    MemoryMetrics_PaintStack(16 * 1024);
+
     Log_Debug("cURL easy interface based application starting.\n");
     Log_Debug("This sample periodically attempts to download a webpage, using curl's 'easy' API.");
 
@@ -271,6 +399,11 @@ int main(int argc, char *argv[])
     }
 
     CloseHandlers();
+
+    MemoryMetrics memoryMetrics;
+    MemoryMetrics_GetSnapshot(&memoryMetrics);
+    MemoryMetrics_Log(&memoryMetrics);
+
     Log_Debug("Application exiting.\n");
     return 0;
 }
@@ -27,6 +27,11 @@
 #include <applibs/networking.h>
 
 #include "epoll_timerfd_utilities.h"
+#include "memory_metrics.h"
+#include "perf_profile.h"
+#include "resumable_download.h"
+#include "shutdown_coordinator.h"
+#include "storage_metrics.h"
 #include "web_client.h"
 
 // By default, this sample's CMake build targets hardware that follows the MT3620
@@ -45,9 +50,29 @@
 // File descriptors - initialized to invalid value
 static int epollFd = -1;
 
+// Multiplex the transfers, which are all to the same server, over one HTTP/2 connection. The
+// limits on connections and on requests which run at once come from the performance profile;
+// with the Balanced profile, two transfers run at once if HTTP/2 cannot be used, at most four
+// requests run at once, and the rest wait in the web client's queue. Content is downloaded
+// compressed where the server supports it, and the validators for conditional requests are kept
+// in the mutable file after the progress of the resumable download.
+static const WebClientConfig webClientConfig = {
+    .multiplex = true,
+    .acceptCompressed = true,
+    .validatorCacheOffset = RESUMABLE_DOWNLOAD_STORAGE_SIZE};
+
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
+// When the application is asked to exit, the running web requests are given time to complete,
+// and then the progress of the download is saved.
+static ShutdownCoordinator shutdownCoordinator;
+static const struct timespec shutdownGracePeriod = {SHUTDOWN_GRACE_PERIOD_SECONDS - 2, 0};
+static ShutdownHook webClientShutdownHook = {
+    .name = "WebClient", .handler = &WebClient_ShutdownHook, .deadline = {6, 0}};
+static ShutdownHook downloadShutdownHook = {
+    .name = "ResumableDownload", .handler = &ResumableDownload_ShutdownHook, .deadline = {8, 0}};
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -73,12 +98,25 @@ int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
+    // The size of the mutable file which app_manifest.json allows, so that the storage metrics
+    // show how much of it is left.
+    StorageMetrics_SetMutableFileQuota(8 * 1024);
+
     if ((Ui_Init(epollFd)) != 0) {
         return -1;
     }
-    if ((WebClient_Init(epollFd)) != 0) {
+    const PerfProfile *profile = PerfProfile_GetDefaults(PERF_PROFILE_DEFAULT);
+    WebClientConfig config = webClientConfig;
+    config.maxHostConnections = (long)profile->webClient.maxHostConnections;
+    config.maxConcurrentRequests = profile->webClient.maxConcurrentRequests;
+    Log_Debug("INFO: Using the %s performance profile.\n", PerfProfile_GetName(profile->id));
+    if ((WebClient_Init(epollFd, &config)) != 0) {
         return -1;
     }
+
+    ShutdownCoordinator_Init(&shutdownCoordinator, &shutdownGracePeriod);
+    ShutdownCoordinator_AddHook(&shutdownCoordinator, &webClientShutdownHook);
+    ShutdownCoordinator_AddHook(&shutdownCoordinator, &downloadShutdownHook);
     return 0;
 }
 
@@ -99,11 +137,18 @@ void ClosePeripheralsAndHandlers(void)
 /// </summary>
 int main(int argc, char **argv)
 {
+    // Paint the stack first, so that its high-water mark includes the deepest cURL callbacks.
+    MemoryMetrics_PaintStack(16 * 1024);
+
     Log_Debug("cURL multi interface based application starting.\n");
     Log_Debug("Press button A to initialize a set of parallel, asynchronous web transfers.\n");
 
     if (InitPeripheralsAndHandlers() != 0) {
         terminationRequired = true;
+    } else {
+        // From here on, the memory metrics count the heap allocations of each module, or
+        // reject them in the static-allocation build.
+        MemoryMetrics_EndInit();
     }
 
     // Use epoll to wait for events and trigger handlers, until an error or SIGTERM happens
@@ -113,8 +158,15 @@ int main(int argc, char **argv)
         }
     }
 
+    // Let the running requests complete, and save the download progress, before closing.
+    ShutdownCoordinator_Drain(&shutdownCoordinator, epollFd);
     ClosePeripheralsAndHandlers();
 
+    // Any bytes which are still allocated here were not freed by the web client or by cURL.
+    MemoryMetrics memoryMetrics;
+    MemoryMetrics_GetSnapshot(&memoryMetrics);
+    MemoryMetrics_Log(&memoryMetrics);
+
     Log_Debug("Application exiting.\n");
     return 0;
 }
@@ -0,0 +1,377 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "dual_slot.h"
+#include "log_utils.h"
+#include "resumable_download.h"
+#include "response_sink.h"
+#include "storage_metrics.h"
+#include "web_client.h"
+
+// Identifies the progress record, which is saved in two slots at the start of the mutable file,
+// and its layout.
+#define PROGRESS_MAGIC 0x4C445352u // "RSDL"
+#define PROGRESS_VERSION 1u
+
+/// <summary>
+///     How far a download has got, as it is saved in mutable storage.
+/// </summary>
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /// <summary>Hash of the URL, so that the progress of another file is not used.</summary>
+    uint32_t urlHash;
+    /// <summary>Whether all of the content has been consumed.</summary>
+    uint32_t completed;
+    /// <summary>Offset in the content up to which the consumer has taken the data.</summary>
+    uint64_t contentOffset;
+    /// <summary>The ETag of the content, or an empty string if the server sent none.</summary>
+    char etag[WEB_CLIENT_MAX_ETAG_LENGTH + 1];
+} DownloadProgress;
+
+_Static_assert(DUAL_SLOT_STORAGE_SIZE(sizeof(DownloadProgress)) <= RESUMABLE_DOWNLOAD_STORAGE_SIZE,
+               "The download progress does not fit in its part of the mutable file");
+
+// The progress is saved each time that this much more content has been consumed, rather than
+// for each chunk, so that mutable storage is not worn out by small writes.
+static const uint64_t progressSaveInterval = 64 * 1024;
+
+// Number of times which the request for each part of the download is retried.
+static const unsigned int maxRetries = 3;
+
+// The download which is running.
+static bool downloadRunning = false;
+static char *downloadUrl = NULL;
+static ResponseSink *downloadSink = NULL;
+static ResumableDownloadStartHandler downloadStartHandler = NULL;
+static ResumableDownloadCompletionHandler downloadCompletionHandler = NULL;
+static void *downloadContext = NULL;
+// Whether the download has already started again from the beginning, because the content
+// changed. It is only started again once, so that a server which ignores ranges does not make
+// the download loop.
+static bool downloadRestarted = false;
+// The progress of the running download, and the offset at which it was last saved.
+static DownloadProgress progress;
+static uint64_t savedContentOffset = 0;
+// Sequence number of the newest saved copy of the progress.
+static uint32_t progressSequence = 0;
+
+static int EnqueueDownload(void);
+
+/// <summary>
+///     Computes the 32-bit FNV-1a hash of a string.
+/// </summary>
+static uint32_t HashString(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    for (; *text != '\0'; ++text) {
+        hash ^= (uint8_t)*text;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// <summary>
+///     Reads the saved progress.
+/// </summary>
+/// <param name="saved">Receives the progress.</param>
+/// <returns>0 if valid progress was read, or -1 if there is none</returns>
+static int LoadProgress(DownloadProgress *saved)
+{
+    int fd = StorageMetrics_OpenMutableFile();
+    if (fd < 0) {
+        LogErrno("ERROR: Could not open mutable file");
+        return -1;
+    }
+
+    int result = DualSlot_Load(fd, 0, saved, sizeof(*saved), &progressSequence);
+    close(fd);
+
+    // A mutable file which is empty, or was written by another version, holds no progress. If
+    // the power failed while the progress was being saved, the copy before it is read.
+    if (result != 0 || saved->magic != PROGRESS_MAGIC || saved->version != PROGRESS_VERSION) {
+        return -1;
+    }
+    saved->etag[sizeof(saved->etag) - 1] = '\0';
+    return 0;
+}
+
+/// <summary>
+///     Saves the progress of the running download.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int SaveProgress(void)
+{
+    int fd = StorageMetrics_OpenMutableFile();
+    if (fd < 0) {
+        LogErrno("ERROR: Could not open mutable file");
+        return -1;
+    }
+
+    if (DualSlot_Save(fd, 0, &progress, sizeof(progress), &progressSequence) != 0) {
+        LogErrno("ERROR: Could not save the download progress");
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    savedContentOffset = progress.contentOffset;
+    return 0;
+}
+
+/// <summary>
+///     Updates the progress from the offset up to which the sink has accepted content. The data
+///     which is still in a ring sink's buffer has not reached its destination, so it is not
+///     counted.
+/// </summary>
+static void UpdateProgress(uint64_t contentOffset, const char *etag)
+{
+    progress.contentOffset = contentOffset - ResponseSink_GetBufferedLength(downloadSink);
+    if (strcmp(progress.etag, etag) != 0) {
+        strncpy(progress.etag, etag, sizeof(progress.etag) - 1);
+        progress.etag[sizeof(progress.etag) - 1] = '\0';
+    }
+}
+
+/// <summary>
+///     Ends the running download, and calls its completion handler.
+/// </summary>
+static void EndDownload(bool completed)
+{
+    ResumableDownloadCompletionHandler completionHandler = downloadCompletionHandler;
+    void *context = downloadContext;
+    uint64_t contentOffset = progress.contentOffset;
+
+    free(downloadUrl);
+    downloadUrl = NULL;
+    downloadSink = NULL;
+    downloadRunning = false;
+
+    completionHandler(completed, contentOffset, context);
+}
+
+/// <summary>
+///     Progress handler for the download's requests, which saves the progress each time that
+///     enough more content has been consumed.
+/// </summary>
+static void DownloadProgressHandler(uint64_t contentOffset, const char *etag, void *context)
+{
+    UpdateProgress(contentOffset, etag);
+    if (progress.contentOffset - savedContentOffset >= progressSaveInterval) {
+        SaveProgress();
+    }
+}
+
+/// <summary>
+///     Completion handler for the download's requests.
+/// </summary>
+static void DownloadCompletionHandler(const WebClientResult *result, void *context)
+{
+    // If the content changed since the progress was saved, or the saved offset is past its end,
+    // the content which has been consumed is stale. Start again from the beginning.
+    if ((result->rangeIgnored || result->httpStatus == 416) && !downloadRestarted) {
+        Log_Debug("INFO: %s has changed, so the download starts again from the beginning.\n",
+                  result->url);
+        downloadRestarted = true;
+        progress.contentOffset = 0;
+        progress.etag[0] = '\0';
+        SaveProgress();
+
+        ResponseSink_Reset(downloadSink);
+        downloadStartHandler(0, downloadContext);
+        if (EnqueueDownload() != 0) {
+            LogErrno("ERROR: Could not queue the download of %s", result->url);
+            EndDownload(false);
+        }
+        return;
+    }
+
+    UpdateProgress(result->contentOffset, result->etag);
+    bool completed = result->curlCode == CURLE_OK && result->httpStatus >= 200 &&
+                     result->httpStatus <= 299 && !result->rangeIgnored;
+    progress.completed = completed;
+    SaveProgress();
+
+    if (completed) {
+        Log_Debug("INFO: Download of %s complete (%llu bytes, %u attempt(s)).\n", result->url,
+                  (unsigned long long)progress.contentOffset, result->attempts);
+    } else {
+        Log_Debug("ERROR: Download of %s stopped at %llu bytes (curl err=%d, HTTP status %ld).\n",
+                  result->url, (unsigned long long)progress.contentOffset, result->curlCode,
+                  result->httpStatus);
+    }
+    EndDownload(completed);
+}
+
+/// <summary>
+///     Queues the request for the rest of the running download.
+/// </summary>
+static int EnqueueDownload(void)
+{
+    const WebClientRequest request = {.url = downloadUrl,
+                                      .method = WebClientMethod_Get,
+                                      .priority = WebClientPriority_Low,
+                                      .maxRetries = maxRetries,
+                                      .sink = downloadSink,
+                                      .resumeFrom = progress.contentOffset,
+                                      .ifRange = (progress.etag[0] != '\0') ? progress.etag : NULL,
+                                      .progressHandler = &DownloadProgressHandler,
+                                      .completionHandler = &DownloadCompletionHandler};
+    return WebClient_Enqueue(&request);
+}
+
+int ResumableDownload_Start(const char *url, ResponseSink *sink,
+                            ResumableDownloadStartHandler startHandler,
+                            ResumableDownloadCompletionHandler completionHandler, void *context)
+{
+    if (downloadRunning) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    // Continue from the saved progress if it is for the same URL.
+    uint32_t urlHash = HashString(url);
+    if (LoadProgress(&progress) != 0 || progress.urlHash != urlHash) {
+        memset(&progress, 0, sizeof(progress));
+        progress.magic = PROGRESS_MAGIC;
+        progress.version = PROGRESS_VERSION;
+        progress.urlHash = urlHash;
+    }
+    savedContentOffset = progress.contentOffset;
+
+    if (progress.completed) {
+        Log_Debug("INFO: %s has already been downloaded (%llu bytes).\n", url,
+                  (unsigned long long)progress.contentOffset);
+        completionHandler(true, progress.contentOffset, context);
+        return 0;
+    }
+
+    downloadUrl = strdup(url);
+    if (downloadUrl == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    downloadSink = sink;
+    downloadStartHandler = startHandler;
+    downloadCompletionHandler = completionHandler;
+    downloadContext = context;
+    downloadRestarted = false;
+    downloadRunning = true;
+
+    if (progress.contentOffset != 0) {
+        Log_Debug("INFO: Resuming the download of %s from %llu bytes.\n", url,
+                  (unsigned long long)progress.contentOffset);
+    }
+    ResponseSink_Reset(sink);
+    startHandler(progress.contentOffset, context);
+
+    if (EnqueueDownload() != 0) {
+        int error = errno;
+        free(downloadUrl);
+        downloadUrl = NULL;
+        downloadRunning = false;
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int ResumableDownload_Discard(void)
+{
+    if (downloadRunning) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (Storage_DeleteMutableFile() != 0) {
+        LogErrno("ERROR: Could not delete the mutable file");
+        return -1;
+    }
+    return 0;
+}
+
+// The sample's large file. Replace this with the URL of a large file on a server which supports
+// range requests, and add its host name to AllowedConnections in app_manifest.json.
+static const char sampleDownloadUrl[] = "https://httpstat.us/200";
+
+// The sample's ring buffer, which bounds the memory which the download uses however large the
+// file is.
+static uint8_t sampleRingBuffer[4 * 1024];
+static ResponseSink sampleSink;
+// Number of bytes of the file which the sample has consumed.
+static uint64_t sampleConsumedBytes = 0;
+
+/// <summary>
+///     Start handler for the sample's download.
+/// </summary>
+static void SampleDownloadStartHandler(uint64_t contentOffset, void *context)
+{
+    sampleConsumedBytes = contentOffset;
+}
+
+/// <summary>
+///     Consumer for the sample's sink. An application would write the data to its destination
+///     here, such as external flash or a serial port; the sample only counts it.
+/// </summary>
+static size_t SampleDownloadConsumer(ResponseSink *sink, const uint8_t *data, size_t length,
+                                     void *context)
+{
+    sampleConsumedBytes += length;
+    return length;
+}
+
+/// <summary>
+///     Completion handler for the sample's download.
+/// </summary>
+static void SampleDownloadCompletionHandler(bool completed, uint64_t contentOffset, void *context)
+{
+    Log_Debug("\n -==- Resumable download %s (%llu bytes consumed) -==-\n",
+              completed ? "complete" : "stopped", (unsigned long long)sampleConsumedBytes);
+    if (!completed) {
+        Log_Debug("Press button B again to resume it from %llu bytes.\n",
+                  (unsigned long long)contentOffset);
+    }
+}
+
+bool ResumableDownload_ShutdownHook(ShutdownHook *hook)
+{
+    if (downloadRunning && progress.contentOffset != savedContentOffset) {
+        Log_Debug("INFO: Saving the download progress at %llu bytes.\n",
+                  (unsigned long long)progress.contentOffset);
+        SaveProgress();
+    }
+    return true;
+}
+
+int ResumableDownload_StartSample(void)
+{
+    // The sink is in use until the running download ends.
+    if (downloadRunning) {
+        Log_Debug("INFO: The download of %s is already running.\n", sampleDownloadUrl);
+        return 0;
+    }
+
+    ResponseSink_InitRing(&sampleSink, sampleRingBuffer, sizeof(sampleRingBuffer),
+                          &SampleDownloadConsumer, NULL);
+    if (ResumableDownload_Start(sampleDownloadUrl, &sampleSink, &SampleDownloadStartHandler,
+                                &SampleDownloadCompletionHandler, NULL) != 0) {
+        LogErrno("ERROR: Could not start the download of %s", sampleDownloadUrl);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "response_sink.h"
+#include "shutdown_coordinator.h"
+
+/// <summary>
+///     Number of bytes at the start of the mutable file in which the progress of the download
+///     is saved, in two slots. The application can use the rest of the mutable file.
+/// </summary>
+#define RESUMABLE_DOWNLOAD_STORAGE_SIZE 256
+
+/// <summary>
+///     Function which is called before the content is passed to the sink, with the offset in the
+///     content from which it continues. The application positions its destination there, and
+///     discards anything after it. This is called again with 0 if the content changed on the
+///     server and the download starts again from the beginning.
+/// </summary>
+/// <param name="contentOffset">Offset in the content of the first byte which the sink
+/// receives.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="ResumableDownload_Start" />.</param>
+typedef void (*ResumableDownloadStartHandler)(uint64_t contentOffset, void *context);
+
+/// <summary>
+///     Function which is called when the download ends, whether it completed or not.
+/// </summary>
+/// <param name="completed">Whether all of the content has been passed to the sink.</param>
+/// <param name="contentOffset">Offset in the content up to which the sink has consumed the
+/// data. A download which did not complete resumes from here.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="ResumableDownload_Start" />.</param>
+typedef void (*ResumableDownloadCompletionHandler)(bool completed, uint64_t contentOffset,
+                                                   void *context);
+
+/// <summary>
+/// <para>Starts or resumes the download of a large file. How far the download has got is saved
+/// in mutable storage, together with the ETag of the content, so that a download which was
+/// interrupted by a network failure, or by the device restarting, continues from where it
+/// stopped with a range request. If the content has changed on the server since, the server
+/// sends the whole content instead, and the download starts again from the beginning.</para>
+/// <para>Only the progress is saved in mutable storage, which is too small to hold a large
+/// file. The content is passed to the sink, whose consumer writes it to its destination. The
+/// progress which is saved only counts the data which the consumer has taken, so the consumer
+/// must only take data once it is safely stored.</para>
+/// <para>One download can run at a time, and the progress of one URL is saved.</para>
+/// </summary>
+/// <param name="url">HTTPS URL of the file. This is copied.</param>
+/// <param name="sink">Sink which receives the content. It must remain valid until the download
+/// ends.</param>
+/// <param name="startHandler">Function which is called with the offset from which the content
+/// continues.</param>
+/// <param name="completionHandler">Function which is called when the download ends. If the
+/// saved progress shows that the file has already been downloaded, it is called before this
+/// function returns.</param>
+/// <param name="context">Value which is passed to the handlers.</param>
+/// <returns>0 on success, or -1 on failure, with errno set to EBUSY if a download is already
+/// running.</returns>
+int ResumableDownload_Start(const char *url, ResponseSink *sink,
+                            ResumableDownloadStartHandler startHandler,
+                            ResumableDownloadCompletionHandler completionHandler, void *context);
+
+/// <summary>
+///     Deletes the saved progress, so that the next download starts from the beginning.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int ResumableDownload_Discard(void);
+
+/// <summary>
+///     Shutdown hook which saves the progress of the running download, which is otherwise only
+///     saved every 64 KB, so that it resumes from where it stopped. Register it after
+///     <see cref="WebClient_ShutdownHook" />, so that it saves the content which arrives while
+///     the web client is waiting for its requests.
+/// </summary>
+/// <param name="hook">The hook. Its context is not used.</param>
+/// <returns>true, as the progress is saved at once</returns>
+bool ResumableDownload_ShutdownHook(ShutdownHook *hook);
+
+/// <summary>
+///     Starts or resumes the sample's download of a large file.
+/// </summary>
+/// <returns>0 on success, -1 on error</returns>
+int ResumableDownload_StartSample(void);
@@ -15,6 +15,7 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+#include "resumable_download.h"
 #include "web_client.h"
 #include "ui.h"
 
@@ -22,16 +23,53 @@
 static int blinkingLedGpioFd = -1;
 static int blinkingLedTimerFd = -1;
 static int triggerDownloadButtonGpioFd = -1;
+static int triggerResumableDownloadButtonGpioFd = -1;
 static int buttonPollTimerFd = -1;
 static int epollFd = -1;
 
 // Initial status of LED
 static bool ledState = GPIO_Value_High;
-// Initial status of button A
+// Initial status of buttons A and B
 static GPIO_Value_Type buttonState = GPIO_Value_High;
+static GPIO_Value_Type resumableDownloadButtonState = GPIO_Value_High;
 
 /// <summary>
-///     Handle button timer event: if the button is pressed, an download is started if not alrady in
+///     Checks whether a button has just been pressed.
+/// </summary>
+/// <param name="fd">The button's GPIO file descriptor</param>
+/// <param name="oldState">The button's previous state, which is updated</param>
+/// <returns>true if the button has just been pressed, otherwise false</returns>
+static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+{
+    GPIO_Value_Type newButtonState;
+    int result = GPIO_GetValue(fd, &newButtonState);
+    if (result != 0) {
+        LogErrno("ERROR: Could not read button GPIO");
+        return false;
+    }
+
+    // The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
+    bool isButtonPressed = (newButtonState != *oldState) && (newButtonState == GPIO_Value_Low);
+    *oldState = newButtonState;
+    return isButtonPressed;
+}
+
+/// <summary>
+///     Checks whether the network is up before starting a cURL based web download.
+/// </summary>
+static bool IsNetworkReady(void)
+{
+    bool isNetworkingReady = false;
+    if ((Networking_IsNetworkingReady(&isNetworkingReady) < 0) || !isNetworkingReady) {
+        Log_Debug("WARNING: Not starting the download because network is not up.\n");
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+///     Handle button timer event: if button A is pressed, the web page downloads are started; if
+///     button B is pressed, the resumable download is started or resumed, if not already in
 ///     progress.
 /// </summary>
 static void ButtonPollTimerEventHandler(EventData *userData)
@@ -41,35 +79,21 @@ static void ButtonPollTimerEventHandler(EventData *userData)
         return;
     }
 
-    // Check for a button press
-    GPIO_Value_Type newButtonState;
-    int result = GPIO_GetValue(triggerDownloadButtonGpioFd, &newButtonState);
-    if (result != 0) {
-        LogErrno("ERROR: Could not read button GPIO");
-        return;
+    if (IsButtonPressed(triggerDownloadButtonGpioFd, &buttonState) && IsNetworkReady()) {
+        if (WebClient_StartTransfers()) {
+            Log_Debug("ERROR: error starting the downloads.\n");
+        }
     }
 
-    // If the button has just been pressed, start the web page downloads.
-    // The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
-    if (newButtonState != buttonState) {
-        if (newButtonState == GPIO_Value_Low) {
-
-            //  Check whether the network is up before starting an cURL based web download.
-            bool isNetworkingReady = false;
-            if ((Networking_IsNetworkingReady(&isNetworkingReady) < 0) || !isNetworkingReady) {
-                Log_Debug("WARNING: Not starting the download because network is not up.\n");
-                return;
-            }
-
-            if (WebClient_StartTransfers()) {
-                Log_Debug("ERROR: error starting the downloads.\n");
-            }
+    if (IsButtonPressed(triggerResumableDownloadButtonGpioFd, &resumableDownloadButtonState) &&
+        IsNetworkReady()) {
+        if (ResumableDownload_StartSample()) {
+            Log_Debug("ERROR: error starting the resumable download.\n");
         }
-        buttonState = newButtonState;
     }
 }
 
-/// The context of the timerfd for polling button A.
+/// The context of the timerfd for polling buttons A and B.
 static EventData buttonPollTimerEventData = {.eventHandler = &ButtonPollTimerEventHandler};
 
 /// <summary>
@@ -120,7 +144,14 @@ int Ui_Init(int epollFdInstance)
         LogErrno("ERROR: Could not open button GPIO");
         return -1;
     }
-    // Check whether button A is pressed periodically.
+    // Open button B GPIO as input.
+    Log_Debug("Opening SAMPLE_BUTTON_2 as input.\n");
+    triggerResumableDownloadButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_2);
+    if (triggerResumableDownloadButtonGpioFd < 0) {
+        LogErrno("ERROR: Could not open button GPIO");
+        return -1;
+    }
+    // Check whether buttons A and B are pressed periodically.
     struct timespec buttonPressCheckPeriod = {0, 100000000};
     buttonPollTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod,
                                                    &buttonPollTimerEventData, EPOLLIN);
@@ -139,6 +170,8 @@ void Ui_Fini(void)
 
     Log_Debug("Closing file descriptors.\n");
     CloseFdAndLogOnError(triggerDownloadButtonGpioFd, "TriggerDownloadButtonGpio");
+    CloseFdAndLogOnError(triggerResumableDownloadButtonGpioFd,
+                         "TriggerResumableDownloadButtonGpio");
     CloseFdAndLogOnError(buttonPollTimerFd, "ButtonPollTimer");
     CloseFdAndLogOnError(blinkingLedTimerFd, "BlinkingLedTimer");
     CloseFdAndLogOnError(blinkingLedGpioFd, "BlinkingLedGpio");
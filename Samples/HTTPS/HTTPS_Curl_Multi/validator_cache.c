@@ -0,0 +1,180 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "log_utils.h"
+#include "storage_metrics.h"
+#include "validator_cache.h"
+
+// Marks an entry of the mutable file which holds validators, and its layout.
+#define ENTRY_MAGIC 0x4C415643u // "CVAL"
+
+/// <summary>
+///     The validators of one URL, as they are saved in mutable storage.
+/// </summary>
+typedef struct {
+    uint32_t magic;
+    /// <summary>Hash of the URL.</summary>
+    uint32_t urlHash;
+    /// <summary>Increases with each entry which is saved, so that the least recently used entry
+    /// can be found again after a restart.</summary>
+    uint32_t useOrder;
+    Validators validators;
+} CacheEntry;
+
+static off_t cacheStorageOffset = 0;
+static bool cacheLoaded = false;
+static CacheEntry cache[VALIDATOR_CACHE_ENTRIES];
+static uint32_t nextUseOrder = 1;
+
+/// <summary>
+///     Computes the 32-bit FNV-1a hash of a string.
+/// </summary>
+static uint32_t HashString(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    for (; *text != '\0'; ++text) {
+        hash ^= (uint8_t)*text;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// <summary>
+///     Reads the cache from mutable storage, the first time that it is used.
+/// </summary>
+static void LoadCache(void)
+{
+    if (cacheLoaded) {
+        return;
+    }
+    cacheLoaded = true;
+    memset(cache, 0, sizeof(cache));
+
+    int fd = StorageMetrics_OpenMutableFile();
+    if (fd < 0) {
+        LogErrno("ERROR: Could not open mutable file");
+        return;
+    }
+    ssize_t result =
+        StorageMetrics_PRead(StorageFile_Mutable, fd, cache, sizeof(cache), cacheStorageOffset);
+    close(fd);
+
+    // A mutable file which is shorter than the cache leaves the remaining entries empty.
+    size_t entriesRead = (result > 0) ? (size_t)result / sizeof(CacheEntry) : 0;
+    for (size_t i = 0; i < VALIDATOR_CACHE_ENTRIES; i++) {
+        if (i >= entriesRead || cache[i].magic != ENTRY_MAGIC) {
+            memset(&cache[i], 0, sizeof(cache[i]));
+            continue;
+        }
+        cache[i].validators.etag[sizeof(cache[i].validators.etag) - 1] = '\0';
+        cache[i].validators.lastModified[sizeof(cache[i].validators.lastModified) - 1] = '\0';
+        if (cache[i].useOrder >= nextUseOrder) {
+            nextUseOrder = cache[i].useOrder + 1;
+        }
+    }
+}
+
+/// <summary>
+///     Writes one entry of the cache to mutable storage.
+/// </summary>
+static void SaveEntry(size_t index)
+{
+    int fd = StorageMetrics_OpenMutableFile();
+    if (fd < 0) {
+        LogErrno("ERROR: Could not open mutable file");
+        return;
+    }
+    off_t offset = cacheStorageOffset + (off_t)(index * sizeof(CacheEntry));
+    if (StorageMetrics_PWrite(fd, &cache[index], sizeof(cache[index]), offset) !=
+        (ssize_t)sizeof(cache[index])) {
+        LogErrno("ERROR: Could not save the validators");
+    }
+    close(fd);
+}
+
+/// <summary>
+///     Finds the entry of a URL.
+/// </summary>
+/// <returns>The index of the entry, or -1 if the URL has none</returns>
+static int FindEntry(uint32_t urlHash)
+{
+    for (size_t i = 0; i < VALIDATOR_CACHE_ENTRIES; i++) {
+        if (cache[i].magic == ENTRY_MAGIC && cache[i].urlHash == urlHash) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void ValidatorCache_Init(off_t storageOffset)
+{
+    cacheStorageOffset = storageOffset;
+    cacheLoaded = false;
+}
+
+bool ValidatorCache_Find(const char *url, Validators *validators)
+{
+    LoadCache();
+    int index = FindEntry(HashString(url));
+    if (index < 0) {
+        return false;
+    }
+
+    // The order of use is only kept in memory, so that a lookup does not write to mutable
+    // storage.
+    cache[index].useOrder = nextUseOrder++;
+    *validators = cache[index].validators;
+    return true;
+}
+
+void ValidatorCache_Update(const char *url, const Validators *validators)
+{
+    LoadCache();
+    uint32_t urlHash = HashString(url);
+    int index = FindEntry(urlHash);
+    bool hasValidators = validators->etag[0] != '\0' || validators->lastModified[0] != '\0';
+
+    if (!hasValidators) {
+        if (index >= 0) {
+            memset(&cache[index], 0, sizeof(cache[index]));
+            SaveEntry((size_t)index);
+        }
+        return;
+    }
+
+    if (index >= 0 && memcmp(&cache[index].validators, validators, sizeof(*validators)) == 0) {
+        cache[index].useOrder = nextUseOrder++;
+        return;
+    }
+
+    // Use a free entry if there is one, otherwise replace the least recently used one.
+    if (index < 0) {
+        index = 0;
+        for (size_t i = 0; i < VALIDATOR_CACHE_ENTRIES; i++) {
+            if (cache[i].magic != ENTRY_MAGIC) {
+                index = (int)i;
+                break;
+            }
+            if (cache[i].useOrder < cache[index].useOrder) {
+                index = (int)i;
+            }
+        }
+    }
+
+    memset(&cache[index], 0, sizeof(cache[index]));
+    cache[index].magic = ENTRY_MAGIC;
+    cache[index].urlHash = urlHash;
+    cache[index].useOrder = nextUseOrder++;
+    cache[index].validators = *validators;
+    SaveEntry((size_t)index);
+}
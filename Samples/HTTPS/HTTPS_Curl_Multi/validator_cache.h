@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include "web_client.h"
+
+/// <summary>
+///     Number of URLs whose validators are kept. When it is full, the URL which was used least
+///     recently is replaced.
+/// </summary>
+#define VALIDATOR_CACHE_ENTRIES 8
+
+/// <summary>
+///     Longest Last-Modified date which is kept, not including the null terminator. An HTTP date
+///     such as "Sun, 06 Nov 1994 08:49:37 GMT" has 29 characters.
+/// </summary>
+#define VALIDATOR_CACHE_MAX_DATE_LENGTH 31
+
+/// <summary>
+///     The validators of a URL, which are sent back to the server in If-None-Match and
+///     If-Modified-Since headers, so that the server can answer 304 Not Modified without the
+///     content if the content has not changed.
+/// </summary>
+typedef struct {
+    /// <summary>The ETag of the content, or an empty string.</summary>
+    char etag[WEB_CLIENT_MAX_ETAG_LENGTH + 1];
+    /// <summary>The Last-Modified date of the content, or an empty string.</summary>
+    char lastModified[VALIDATOR_CACHE_MAX_DATE_LENGTH + 1];
+} Validators;
+
+/// <summary>
+///     Sets where the cache is kept in the mutable file. The cache is read from there when it is
+///     first used.
+/// </summary>
+/// <param name="storageOffset">Offset in the mutable file of the cache, which takes up
+/// VALIDATOR_CACHE_ENTRIES entries of about 140 bytes each.</param>
+void ValidatorCache_Init(off_t storageOffset);
+
+/// <summary>
+///     Looks up the validators of a URL.
+/// </summary>
+/// <param name="url">The URL.</param>
+/// <param name="validators">Receives the validators.</param>
+/// <returns>true if the URL has validators, otherwise false</returns>
+bool ValidatorCache_Find(const char *url, Validators *validators);
+
+/// <summary>
+///     Records the validators of a URL from a complete 200 response. If the response had
+///     neither an ETag nor a Last-Modified header, the URL is removed from the cache. Mutable
+///     storage is only written if the validators changed.
+/// </summary>
+/// <param name="url">The URL.</param>
+/// <param name="validators">The validators of the response.</param>
+void ValidatorCache_Update(const char *url, const Validators *validators);
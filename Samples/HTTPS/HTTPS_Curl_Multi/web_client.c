@@ -4,8 +4,13 @@
 #include <assert.h>
 #include <errno.h>
 #include <memory.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <sys/timerfd.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 
@@ -14,53 +19,157 @@
 #include <applibs/log.h>
 #include <applibs/storage.h>
 
+#include "app_log.h"
 #include "epoll_timerfd_utilities.h"
 #include "log_utils.h"
+#include "memory_metrics.h"
+#include "resolve_cache.h"
+#include "response_sink.h"
+#include "storage_metrics.h"
+#include "timer_wheel.h"
+#include "transfer_metrics.h"
+#include "validator_cache.h"
 #include "web_client.h"
 
 /// File descriptor for the timerfd running for cURL.
 static int curlTimerFd = -1;
 static int epollFd = -1;
 
-/// <summary>
-///     Data pointer and size of a block of memory allocated on the heap.
-/// </summary>
-typedef struct {
-    uint8_t *data;
-    size_t size;
-} MemoryBlock;
+// Largest response content which is kept for each request. A longer response fails rather than
+// using more memory.
+static const size_t maxResponseContentSize = 16 * 1024;
 
-/// <summary>
-///     The storage for an HTTP response content.
-/// </summary>
-typedef struct {
-    MemoryBlock content;
-} HttpResponse;
+// Defaults for the members of WebClientRequest which are 0.
+static const long defaultTimeoutMilliseconds = 30 * 1000;
+static const long defaultRetryDelayMilliseconds = 1000;
+// Longest delay before a retry, however many retries have been made.
+static const long maxRetryDelayMilliseconds = 5 * 60 * 1000;
 
 // The cURL's 'multi' interface instance.
 static CURLM *curlMulti = 0;
+// The cURL share instance, which holds the DNS, TLS session and connection caches.
+static CURLSH *curlShare = 0;
+// How the web client connects to the web servers.
+static WebClientConfig webClientConfig;
+
+// The certificates bundle which is used to authenticate the HTTPS servers' identity. It is read
+// once, when the web client is initialized, and every easy handle uses the same copy in memory,
+// so that cURL does not open and read the file for each handle or connection.
+static const char caBundleRelativePath[] = "certs/bundle.pem";
+static uint8_t *caBundleData = NULL;
+static size_t caBundleSize = 0;
+// Full path to the certificates bundle, for a cURL library which cannot take the bundle from
+// memory.
+static char *certificatePath = NULL;
+
+// Tags of the web client's own allocations, and of cURL's, which are counted separately so that
+// the memory metrics show which of them uses the heap.
+static MemoryTag webClientMemoryTag = MemoryTag_Other;
+static MemoryTag curlMemoryTag = MemoryTag_Other;
+
+// Each request which is waiting to be retried has its own timer on this wheel.
+static TimerWheel retryTimerWheel;
+
+// The timing of every attempt, aggregated per host.
+static TransferMetrics transferMetrics;
+
+// The addresses of the hosts, which are passed to cURL so that it does not resolve them again.
+// The share's DNS cache forgets an address after a minute, so the addresses which cURL resolved
+// are kept here for longer, and the addresses from DNS service discovery for their TTLs.
+static ResolveCache resolveCache;
+static const uint32_t learnedAddressTtlSeconds = 5 * 60;
+
+/// <summary>
+///     The stages of a request's life.
+/// </summary>
+typedef enum {
+    /// <summary>The slot does not hold a request.</summary>
+    WebRequestState_Free,
+    /// <summary>The request is waiting to be started.</summary>
+    WebRequestState_Queued,
+    /// <summary>The request's easy handle is in the multi handle.</summary>
+    WebRequestState_Running,
+    /// <summary>An attempt failed, and the retry timer is armed.</summary>
+    WebRequestState_WaitingToRetry
+} WebRequestState;
 
-// Data type containing data for each web transfer.
+// Data type containing data for each request. Each slot keeps its easy handle for as long as
+// the web client is initialized, so only the per-request options are set for each request.
 typedef struct {
+    /// <summary>Timer for the delay before a retry. The handler finds the request from the
+    /// address of its event data.</summary>
+    TimerWheelTimer retryTimer;
+    WebRequestState state;
     CURL *easyHandle;
+    /// <summary>Copies of the request's strings and body, which the slot owns.</summary>
     char *url;
-    HttpResponse httpResponse;
-    struct timespec startTime;
-} WebTransfer;
+    uint8_t *body;
+    char contentTypeHeader[128];
+    /// <summary>The headers of the current attempt.</summary>
+    struct curl_slist *headers;
+    /// <summary>The CURLOPT_RESOLVE entry of the current attempt.</summary>
+    struct curl_slist *resolveList;
+    /// <summary>The request, with the defaults filled in.</summary>
+    WebClientRequest request;
+    /// <summary>Storage of the response content, for a request without its own sink.</summary>
+    ResponseSink content;
+    /// <summary>The sink which receives the content: the request's own, or content.</summary>
+    ResponseSink *sink;
+    /// <summary>Offset in the content up to which the sink has accepted data.</summary>
+    uint64_t contentOffset;
+    /// <summary>Whether the current attempt asked for the content from contentOffset.</summary>
+    bool rangeRequested;
+    /// <summary>Whether the server sent the whole content in response to a range
+    /// request.</summary>
+    bool rangeIgnored;
+    /// <summary>ETag which is sent in the If-Range header of range requests.</summary>
+    char ifRange[WEB_CLIENT_MAX_ETAG_LENGTH + 1];
+    /// <summary>Status, ETag and Last-Modified date of the response whose headers were received
+    /// last. Each redirect has its own headers, so these belong to the final response once the
+    /// content arrives.</summary>
+    long headerStatus;
+    char etag[WEB_CLIENT_MAX_ETAG_LENGTH + 1];
+    char lastModified[VALIDATOR_CACHE_MAX_DATE_LENGTH + 1];
+    /// <summary>The timing of the last attempt.</summary>
+    TransferTiming timing;
+    unsigned int attempts;
+    /// <summary>Increases with each request which is queued, so that requests of the same
+    /// priority are started in order.</summary>
+    uint64_t queueOrder;
+    struct timespec queuedTime;
+} WebRequest;
 
-// The web transfers executed with cURL.
-WebTransfer webTransfers[] = {
-    // Download a web page with a delay of 5 seconds with status 200.
-    {.url = "https://httpstat.us/200?sleep=5000"},
-    // Download a web page with a delay of 1 second with status 400.
-    {.url = "https://httpstat.us/400?sleep=1000"}};
+static WebRequest webRequests[WEB_CLIENT_MAX_REQUESTS];
+// Number of requests in WebRequestState_Running.
+static size_t runningRequestCount = 0;
+static uint64_t nextQueueOrder = 0;
+// Set when the application is shutting down, after which no more requests are started.
+static bool isShuttingDown = false;
 
-/// cURL transfers in progress (i.e. not completed) as reported by curl_multi_socket_action().
-static int runningEasyHandles = 0;
-/// Time out provided by cURL.
-static int curlTimeout = -1;
-// The number of outstanding transfers in progress executed by cURL.
-size_t curlTransferInProgress = 0;
+// The sample's set of downloads, which are queued each time that button A is pressed.
+typedef struct {
+    const char *url;
+    WebClientPriority priority;
+    unsigned int maxRetries;
+    bool conditional;
+} SampleDownload;
+
+static const SampleDownload sampleDownloads[] = {
+    // Download a web page with a delay of 5 seconds with status 200. The request is conditional,
+    // so a server which sends validators answers 304 if the page has not changed since the
+    // last time.
+    {.url = "https://httpstat.us/200?sleep=5000",
+     .priority = WebClientPriority_Normal,
+     .conditional = true},
+    // Download a web page with a delay of 1 second with status 400, which is not retried.
+    {.url = "https://httpstat.us/400?sleep=1000", .priority = WebClientPriority_Normal},
+    // Download a web page with status 503, which is retried twice, after 1 and 2 seconds.
+    {.url = "https://httpstat.us/503", .priority = WebClientPriority_High, .maxRetries = 2}};
+
+// Number of the sample's downloads which have not completed yet.
+static size_t sampleDownloadsPending = 0;
+
+static void StartQueuedRequests(void);
 
 /// <summary>
 ///     Logs a cURL error.
@@ -74,45 +183,153 @@ static void LogCurlError(const char *message, int curlErrCode)
 }
 
 /// <summary>
-///     cURL callback that aggregates all the downloaded chunks in a single
-///     memory block.
+///     Logs an error of a cURL share handle.
+/// </summary>
+/// <param name="message">The message to print</param>
+/// <param name="shareErrCode">The cURL share error code to describe</param>
+static void LogCurlShareError(const char *message, CURLSHcode shareErrCode)
+{
+    Log_Debug(message);
+    Log_Debug(" (curl share err=%d, '%s')\n", shareErrCode, curl_share_strerror(shareErrCode));
+}
+
+/// <summary>
+///     Computes the time in milliseconds since an earlier time.
+/// </summary>
+static long ElapsedMilliseconds(const struct timespec *since)
+{
+    struct timespec currentTime;
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    return (currentTime.tv_sec - since->tv_sec) * 1000 +
+           (currentTime.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/// <summary>
+///     cURL callback that passes the content of the final response to the request's sink.
 /// </summary>
 /// <param name="chunks">The pointer to the chunks array</param>
 /// <param name="chunkSize">The size of each chunk</param>
 /// <param name="chunksCount">The count of the chunks</param>
-/// <param name="memoryBlock">The pointer where all the downloaded chunks are aggregated</param>
-static size_t CurlStoreDownloadedContentCallback(void *chunks, size_t chunkSize, size_t chunksCount,
-                                                 void *userData)
+/// <param name="userData">The request which receives the content</param>
+static size_t CurlWriteCallback(char *chunks, size_t chunkSize, size_t chunksCount,
+                                void *userData)
+{
+    WebRequest *webRequest = (WebRequest *)userData;
+    size_t length = chunkSize * chunksCount;
+    bool ownSink = webRequest->sink != &webRequest->content;
+    bool success = webRequest->headerStatus >= 200 && webRequest->headerStatus < 300;
+
+    // A sink which belongs to the caller can only take the content which it asked for, so the
+    // content of an error response is discarded, and the whole content is refused if only a
+    // range was asked for. cURL normally fails such a transfer with CURLE_RANGE_ERROR before
+    // any content arrives.
+    if (ownSink && !success) {
+        return length;
+    }
+    if (webRequest->rangeRequested && webRequest->headerStatus != 206) {
+        webRequest->rangeIgnored = true;
+        return 0;
+    }
+
+    size_t accepted = ResponseSink_Write(webRequest->sink, chunks, length);
+    webRequest->contentOffset += accepted;
+    if (accepted != 0 && webRequest->request.progressHandler != NULL) {
+        webRequest->request.progressHandler(webRequest->contentOffset, webRequest->etag,
+                                            webRequest->request.context);
+    }
+    return accepted;
+}
+
+/// <summary>
+///     Copies the value of a header line, without the surrounding white space. A value which
+///     does not fit is ignored.
+/// </summary>
+/// <param name="header">The header line, which is not null terminated</param>
+/// <param name="length">The length of the header line</param>
+/// <param name="nameLength">The length of the header's name, including the colon</param>
+/// <param name="value">Receives the value, followed by a null terminator</param>
+/// <param name="valueSize">The size of the value buffer</param>
+static void CopyHeaderValue(const char *header, size_t length, size_t nameLength, char *value,
+                            size_t valueSize)
 {
-    MemoryBlock *block = (MemoryBlock *)userData;
-    size_t additionalDataSize = chunkSize * chunksCount;
-    block->data = realloc(block->data, block->size + additionalDataSize + 1);
-    if (block->data == NULL) {
-        LogErrno("ERROR: Out of memory, realloc returned NULL");
-        abort();
+    size_t start = nameLength;
+    while (start < length && (header[start] == ' ' || header[start] == '\t')) {
+        ++start;
+    }
+    size_t end = length;
+    while (end > start && (header[end - 1] == '\r' || header[end - 1] == '\n' ||
+                           header[end - 1] == ' ' || header[end - 1] == '\t')) {
+        --end;
+    }
+    if (end - start < valueSize) {
+        memcpy(value, header + start, end - start);
+        value[end - start] = 0;
+    }
+}
+
+/// <summary>
+///     cURL callback for each header line, which records the status and validators of the
+///     response, and lets the sink reserve space for the content.
+/// </summary>
+/// <param name="header">The header line, which is not null terminated</param>
+/// <param name="size">Always 1</param>
+/// <param name="count">The length of the header line</param>
+/// <param name="userData">The request which receives the response</param>
+static size_t CurlHeaderCallback(char *header, size_t size, size_t count, void *userData)
+{
+    WebRequest *webRequest = (WebRequest *)userData;
+    size_t length = size * count;
+
+    if (length > 5 && strncmp(header, "HTTP/", 5) == 0) {
+        // Each response, including each redirect, starts with a status line such as
+        // "HTTP/1.1 206 Partial Content".
+        size_t i = 5;
+        while (i < length && header[i] != ' ') {
+            ++i;
+        }
+        long status = 0;
+        for (++i; i < length && header[i] >= '0' && header[i] <= '9'; ++i) {
+            status = status * 10 + (header[i] - '0');
+        }
+        webRequest->headerStatus = status;
+        webRequest->etag[0] = 0;
+        webRequest->lastModified[0] = 0;
+        return length;
+    }
+
+    if (length > 5 && strncasecmp(header, "ETag:", 5) == 0) {
+        CopyHeaderValue(header, length, 5, webRequest->etag, sizeof(webRequest->etag));
+        return length;
     }
-    memcpy(block->data + block->size, chunks, additionalDataSize);
-    block->size += additionalDataSize;
-    block->data[block->size] = 0; // Ensure the block of memory is null terminated.
-    return additionalDataSize;
+    if (length > 14 && strncasecmp(header, "Last-Modified:", 14) == 0) {
+        CopyHeaderValue(header, length, 14, webRequest->lastModified,
+                        sizeof(webRequest->lastModified));
+        return length;
+    }
+
+    // Only the content of a successful response reaches a sink which belongs to the caller,
+    // so only its length is reserved.
+    bool success = webRequest->headerStatus >= 200 && webRequest->headerStatus < 300;
+    if (webRequest->sink == &webRequest->content || success) {
+        return ResponseSink_CurlHeaderCallback(header, size, count, webRequest->sink);
+    }
+    return length;
 }
 
 /// <summary>
-///     Creates an cURL easy handle to download the specified URL.
+///     Creates a cURL easy handle for a request slot, with the options which are the same for
+///     every request.
 ///     Note that:
 ///         - download is restricted to HTTP and HTTPS protocols only;
 ///         - redirects are followed;
 ///         - it is necessary to update the AllowedConnection's hostnames
 ///           in app_manifest.json.
 /// </summary>
-/// <param name="url">HTTP or HTTPS URL to download</param>
-/// <param name="reponse">Storage of the response</param>
-static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response)
+/// <param name="webRequest">The slot which uses the handle</param>
+static CURL *CurlSetupEasyHandle(WebRequest *webRequest)
 {
     CURL *returnedEasyHandle = NULL; // Easy cURL handle for a transfer.
     CURLcode res = 0;
-    // Certificates bundle path storage.
-    char *certificatePath = NULL;
 
     // Create the cURL easy handle.
     CURL *easyHandle = NULL;
@@ -121,9 +338,9 @@ static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response)
         goto errorLabel;
     }
 
-    // Set the URL to be downloaded.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_URL, url)) != CURLE_OK) {
-        LogCurlError("curl_easy_setopt CURLOPT_URL", res);
+    // Let the completion code find the slot from the easy handle.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_PRIVATE, (void *)webRequest)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_PRIVATE", res);
         goto errorLabel;
     }
 
@@ -146,21 +363,29 @@ static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response)
     }
 
     // Set up callback for cURL to use when downloading data.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_WRITEFUNCTION,
-                                &CurlStoreDownloadedContentCallback)) != CURLE_OK) {
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_WRITEFUNCTION, &CurlWriteCallback)) !=
+        CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_WRITEFUNCTION", res);
         goto errorLabel;
     }
 
-    // Set the custom parameter of the callback to the memory block.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, (void *)&response->content)) !=
-        CURLE_OK) {
+    // Set the custom parameter of the callback to the request.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_WRITEDATA, (void *)webRequest)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_WRITEDATA", res);
         goto errorLabel;
     }
 
+    // Record the status and ETag, and let the sink see the Content-Length header, so that it can
+    // allocate the whole content at once, or fail the transfer before the content arrives if it
+    // is too large.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HEADERFUNCTION, &CurlHeaderCallback)) !=
+        CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_HEADERFUNCTION", res);
+        goto errorLabel;
+    }
+
     // Set the custom parameter of the for headers retrieval.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, (void *)response)) != CURLE_OK) {
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HEADERDATA, (void *)webRequest)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_HEADERDATA", res);
         goto errorLabel;
     }
@@ -171,20 +396,57 @@ static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response)
         goto errorLabel;
     }
 
-    // Get the full path to the certificates bundle file used to authenticate the HTTPS server
-    // identity.
-    certificatePath = Storage_GetAbsolutePathInImagePackage("certs/bundle.pem");
-    if (certificatePath == NULL) {
-        LogErrno("ERROR: The certificate path could not be resolved");
-        goto errorLabel;
+    // Validate the server certificate against the certificates bundle in memory. cURL does not
+    // copy it, so all the handles share one copy. Older cURL libraries do not have this option,
+    // and read the bundle from its file instead.
+    if (caBundleData != NULL) {
+        struct curl_blob caBundle = {
+            .data = caBundleData, .len = caBundleSize, .flags = CURL_BLOB_NOCOPY};
+        res = curl_easy_setopt(easyHandle, CURLOPT_CAINFO_BLOB, &caBundle);
+        if (res == CURLE_UNKNOWN_OPTION || res == CURLE_NOT_BUILT_IN) {
+            Log_Debug("INFO: The cURL library cannot use a certificates bundle in memory; it reads "
+                      "%s instead.\n",
+                      certificatePath);
+            MemoryMetrics_Free(caBundleData);
+            caBundleData = NULL;
+        } else if (res != CURLE_OK) {
+            LogCurlError("curl_easy_setopt CURLOPT_CAINFO_BLOB", res);
+            goto errorLabel;
+        }
     }
 
-    // Set the path for the certificate file that cURL uses to validate the server certificate.
-    if ((res = curl_easy_setopt(easyHandle, CURLOPT_CAINFO, certificatePath)) != CURLE_OK) {
+    // Without the bundle in memory, set the path for the certificate file that cURL uses to
+    // validate the server certificate. Otherwise clear the path, so that cURL does not also load
+    // its default bundle.
+    const char *caInfo = (caBundleData == NULL) ? certificatePath : NULL;
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_CAINFO, caInfo)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_CAINFO", res);
         goto errorLabel;
     }
 
+    // Use the shared DNS, TLS session and connection caches.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_SHARE, curlShare)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_SHARE", res);
+        goto errorLabel;
+    }
+
+    if (webClientConfig.multiplex) {
+        // Negotiate HTTP/2 for HTTPS transfers, falling back to HTTP/1.1 if the server does not
+        // support it.
+        if ((res = curl_easy_setopt(easyHandle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS)) !=
+            CURLE_OK) {
+            LogCurlError("curl_easy_setopt CURLOPT_HTTP_VERSION", res);
+            goto errorLabel;
+        }
+
+        // Wait for a connection which is being opened to the same server, so that the transfer
+        // can be multiplexed over it, rather than opening another one.
+        if ((res = curl_easy_setopt(easyHandle, CURLOPT_PIPEWAIT, 1L)) != CURLE_OK) {
+            LogCurlError("curl_easy_setopt CURLOPT_PIPEWAIT", res);
+            goto errorLabel;
+        }
+    }
+
     // Turn off verbosity of cURL.
     if ((res = curl_easy_setopt(easyHandle, CURLOPT_VERBOSE, 0)) != CURLE_OK) {
         LogCurlError("curl_easy_setopt CURLOPT_VERBOSE", res);
@@ -197,21 +459,483 @@ static CURL *CurlSetupEasyHandle(char *url, HttpResponse *response)
 errorLabel:
     if (returnedEasyHandle == NULL)
         curl_easy_cleanup(easyHandle);
-    free(certificatePath);
     return returnedEasyHandle;
 }
 
 /// <summary>
-///     Notify cURL to start the transfers.
+///     Reads the certificates bundle into memory, and resolves its full path.
+/// </summary>
+/// <returns>0 on success, -1 on error</returns>
+static int LoadCaBundle(void)
+{
+    certificatePath = Storage_GetAbsolutePathInImagePackage(caBundleRelativePath);
+    if (certificatePath == NULL) {
+        LogErrno("ERROR: The certificate path could not be resolved");
+        return -1;
+    }
+
+    int fd = StorageMetrics_OpenFileInImagePackage(caBundleRelativePath);
+    if (fd < 0) {
+        LogErrno("ERROR: Could not open the certificates bundle");
+        return -1;
+    }
+
+    off_t fileSize = lseek(fd, 0, SEEK_END);
+    if (fileSize <= 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        LogErrno("ERROR: Could not get the size of the certificates bundle");
+        close(fd);
+        return -1;
+    }
+
+    caBundleData = MemoryMetrics_Malloc(webClientMemoryTag, (size_t)fileSize);
+    if (caBundleData == NULL) {
+        Log_Debug("ERROR: Out of memory for the certificates bundle.\n");
+        close(fd);
+        return -1;
+    }
+
+    size_t bytesRead = 0;
+    while (bytesRead < (size_t)fileSize) {
+        ssize_t result = StorageMetrics_Read(StorageFile_ImagePackage, fd, caBundleData + bytesRead,
+                                             (size_t)fileSize - bytesRead);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            LogErrno("ERROR: Could not read the certificates bundle");
+            close(fd);
+            MemoryMetrics_Free(caBundleData);
+            caBundleData = NULL;
+            return -1;
+        }
+        bytesRead += (size_t)result;
+    }
+
+    close(fd);
+    caBundleSize = bytesRead;
+    return 0;
+}
+
+/// <summary>
+///     Frees the certificates bundle. No easy handle may use it any more.
+/// </summary>
+static void FreeCaBundle(void)
+{
+    MemoryMetrics_Free(caBundleData);
+    caBundleData = NULL;
+    caBundleSize = 0;
+    free(certificatePath);
+    certificatePath = NULL;
+}
+
+/// <summary>
+///     Sets the options of a slot's easy handle which differ from one request to another. cURL
+///     keeps the options between transfers, so every one of them is set for each request.
+/// </summary>
+/// <param name="webRequest">The slot which holds the request</param>
+/// <returns>0 on success, -1 on error</returns>
+static int CurlSetupRequest(WebRequest *webRequest)
+{
+    CURL *easyHandle = webRequest->easyHandle;
+    CURLcode res = 0;
+
+    // Set the URL to be downloaded.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_URL, webRequest->url)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_URL", res);
+        return -1;
+    }
+
+    if (webRequest->request.method == WebClientMethod_Get) {
+        // Switch back to GET, in case the previous request of this slot had a body.
+        if ((res = curl_easy_setopt(easyHandle, CURLOPT_HTTPGET, 1L)) != CURLE_OK) {
+            LogCurlError("curl_easy_setopt CURLOPT_HTTPGET", res);
+            return -1;
+        }
+    } else {
+        // The body is sent as POST data. PUT and DELETE replace the method in the request line.
+        if ((res = curl_easy_setopt(easyHandle, CURLOPT_POSTFIELDSIZE_LARGE,
+                                    (curl_off_t)webRequest->request.bodySize)) != CURLE_OK) {
+            LogCurlError("curl_easy_setopt CURLOPT_POSTFIELDSIZE_LARGE", res);
+            return -1;
+        }
+        const char *body = (webRequest->body != NULL) ? (const char *)webRequest->body : "";
+        if ((res = curl_easy_setopt(easyHandle, CURLOPT_POSTFIELDS, body)) != CURLE_OK) {
+            LogCurlError("curl_easy_setopt CURLOPT_POSTFIELDS", res);
+            return -1;
+        }
+    }
+
+    const char *customMethod = NULL;
+    if (webRequest->request.method == WebClientMethod_Put) {
+        customMethod = "PUT";
+    } else if (webRequest->request.method == WebClientMethod_Delete) {
+        customMethod = "DELETE";
+    }
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_CUSTOMREQUEST, customMethod)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_CUSTOMREQUEST", res);
+        return -1;
+    }
+
+    // cURL ends an attempt which takes longer than this, and reports CURLE_OPERATION_TIMEDOUT.
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_TIMEOUT_MS,
+                                webRequest->request.timeoutMilliseconds)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_TIMEOUT_MS", res);
+        return -1;
+    }
+
+    return 0;
+}
+
+/// <summary>
+///     Appends a header line to the headers of a slot's current attempt.
+/// </summary>
+/// <returns>0 on success, -1 on error</returns>
+static int AppendHeader(WebRequest *webRequest, const char *format, const char *value)
+{
+    char header[160];
+    int length = snprintf(header, sizeof(header), format, value);
+    if (length < 0 || (size_t)length >= sizeof(header)) {
+        return -1;
+    }
+
+    struct curl_slist *headers = curl_slist_append(webRequest->headers, header);
+    if (headers == NULL) {
+        return -1;
+    }
+    webRequest->headers = headers;
+    return 0;
+}
+
+/// <summary>
+///     Sets the options of a slot's easy handle which differ from one attempt to another: the
+///     range of the content, its encoding, the headers, and the cached address of the host.
+/// </summary>
+/// <param name="webRequest">The slot which holds the request</param>
+/// <returns>0 on success, -1 on error</returns>
+static int CurlSetupAttempt(WebRequest *webRequest)
+{
+    CURL *easyHandle = webRequest->easyHandle;
+    CURLcode res = 0;
+
+    // Ask for the content from where the sink stopped, with a "Range: bytes=offset-" header.
+    webRequest->rangeRequested = webRequest->contentOffset != 0;
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_RESUME_FROM_LARGE,
+                                (curl_off_t)webRequest->contentOffset)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_RESUME_FROM_LARGE", res);
+        return -1;
+    }
+
+    // Offsets in compressed content are not offsets in the decoded content which the sink
+    // receives, so a range is always asked for uncompressed. A NULL encoding sends no
+    // Accept-Encoding header.
+    const char *encoding =
+        (webClientConfig.acceptCompressed && !webRequest->rangeRequested) ? "gzip, deflate" : NULL;
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_ACCEPT_ENCODING, encoding)) != CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_ACCEPT_ENCODING", res);
+        return -1;
+    }
+
+    curl_slist_free_all(webRequest->headers);
+    webRequest->headers = NULL;
+    if (webRequest->contentTypeHeader[0] != 0 &&
+        AppendHeader(webRequest, "%s", webRequest->contentTypeHeader) != 0) {
+        return -1;
+    }
+    if (webRequest->rangeRequested && webRequest->ifRange[0] != 0 &&
+        AppendHeader(webRequest, "If-Range: %s", webRequest->ifRange) != 0) {
+        return -1;
+    }
+
+    // Let the server answer 304 without the content if it has not changed since the last 200
+    // response.
+    Validators validators;
+    if (webRequest->request.conditional && webRequest->request.method == WebClientMethod_Get &&
+        !webRequest->rangeRequested && ValidatorCache_Find(webRequest->url, &validators)) {
+        if (validators.etag[0] != 0 &&
+            AppendHeader(webRequest, "If-None-Match: %s", validators.etag) != 0) {
+            return -1;
+        }
+        if (validators.lastModified[0] != 0 &&
+            AppendHeader(webRequest, "If-Modified-Since: %s", validators.lastModified) != 0) {
+            return -1;
+        }
+    }
+
+    if ((res = curl_easy_setopt(easyHandle, CURLOPT_HTTPHEADER, webRequest->headers)) !=
+        CURLE_OK) {
+        LogCurlError("curl_easy_setopt CURLOPT_HTTPHEADER", res);
+        return -1;
+    }
+
+    // The address is looked up for each attempt, so a retry after a failed connection resolves
+    // the host again.
+    if (ResolveCache_SetupTransfer(&resolveCache, easyHandle, webRequest->url,
+                                   &webRequest->resolveList) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/// <summary>
+///     Frees the request's copies of its data, and makes its slot available for another
+///     request. The slot's easy handle is kept.
+/// </summary>
+static void ReleaseRequest(WebRequest *webRequest)
+{
+    TimerWheel_CancelTimer(&retryTimerWheel, &webRequest->retryTimer);
+    MemoryMetrics_Free(webRequest->url);
+    webRequest->url = NULL;
+    MemoryMetrics_Free(webRequest->body);
+    webRequest->body = NULL;
+    webRequest->contentTypeHeader[0] = 0;
+    curl_slist_free_all(webRequest->headers);
+    webRequest->headers = NULL;
+    curl_slist_free_all(webRequest->resolveList);
+    webRequest->resolveList = NULL;
+
+    // Free the content, so that an idle slot does not hold any memory.
+    ResponseSink_Fini(&webRequest->content);
+    ResponseSink_InitBuffer(&webRequest->content, maxResponseContentSize);
+    webRequest->state = WebRequestState_Free;
+}
+
+/// <summary>
+///     Reports the outcome of a request to its completion handler, and releases it.
+/// </summary>
+static void CompleteRequest(WebRequest *webRequest, int curlCode, long httpStatus)
+{
+    // Only a response with the whole content has validators for the content.
+    if (webRequest->request.conditional && curlCode == CURLE_OK && httpStatus == 200 &&
+        !webRequest->rangeRequested) {
+        Validators validators;
+        memset(&validators, 0, sizeof(validators));
+        strcpy(validators.etag, webRequest->etag);
+        strcpy(validators.lastModified, webRequest->lastModified);
+        ValidatorCache_Update(webRequest->url, &validators);
+    }
+
+    WebClientResult result = {.url = webRequest->url,
+                              .curlCode = curlCode,
+                              .httpStatus = httpStatus,
+                              .content = webRequest->content.buffer.data,
+                              .contentSize = webRequest->content.buffer.size,
+                              .etag = webRequest->etag,
+                              .contentOffset = webRequest->contentOffset,
+                              .rangeIgnored = webRequest->rangeIgnored,
+                              .timing = &webRequest->timing,
+                              .attempts = webRequest->attempts,
+                              .elapsedMilliseconds = ElapsedMilliseconds(&webRequest->queuedTime)};
+
+    if (webRequest->request.completionHandler != NULL) {
+        webRequest->request.completionHandler(&result, webRequest->request.context);
+    }
+    ReleaseRequest(webRequest);
+}
+
+/// <summary>
+///     Reports whether an attempt failed in a way which another attempt might not. Errors which
+///     are caused by the request itself, such as a malformed URL or content which is too large,
+///     are not retried.
+/// </summary>
+static bool IsRetryable(CURLcode curlCode, long httpStatus)
+{
+    switch (curlCode) {
+    case CURLE_OK:
+        return httpStatus == 408 || httpStatus == 429 || httpStatus >= 500;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+///     Starts the next attempt of a request, by adding its easy handle to the multi handle.
+/// </summary>
+static void StartAttempt(WebRequest *webRequest)
+{
+    if (webRequest->sink == &webRequest->content) {
+        // Discard the content of a failed attempt.
+        ResponseSink_Reset(&webRequest->content);
+        webRequest->contentOffset = 0;
+    } else if (webRequest->ifRange[0] == 0) {
+        // Only resume from where an earlier attempt stopped if the content has not changed
+        // since then.
+        memcpy(webRequest->ifRange, webRequest->etag, sizeof(webRequest->ifRange));
+    }
+    ++webRequest->attempts;
+    memset(&webRequest->timing, 0, sizeof(webRequest->timing));
+    webRequest->headerStatus = 0;
+    webRequest->etag[0] = 0;
+    webRequest->lastModified[0] = 0;
+
+    if (CurlSetupAttempt(webRequest) != 0) {
+        CompleteRequest(webRequest, CURLE_FAILED_INIT, 0);
+        return;
+    }
+
+    CURLMcode code;
+    if ((code = curl_multi_add_handle(curlMulti, webRequest->easyHandle)) != CURLM_OK) {
+        LogCurlError("curl_multi_add_handle", code);
+        CompleteRequest(webRequest, CURLE_FAILED_INIT, 0);
+        return;
+    }
+
+    webRequest->state = WebRequestState_Running;
+    ++runningRequestCount;
+}
+
+/// <summary>
+///     Starts queued requests, highest priority first, until the concurrency limit is reached.
+/// </summary>
+static void StartQueuedRequests(void)
+{
+    while (!isShuttingDown && runningRequestCount < webClientConfig.maxConcurrentRequests) {
+        WebRequest *next = NULL;
+        for (size_t i = 0; i < WEB_CLIENT_MAX_REQUESTS; i++) {
+            WebRequest *candidate = &webRequests[i];
+            if (candidate->state == WebRequestState_Queued &&
+                (next == NULL || candidate->request.priority > next->request.priority ||
+                 (candidate->request.priority == next->request.priority &&
+                  candidate->queueOrder < next->queueOrder))) {
+                next = candidate;
+            }
+        }
+
+        if (next == NULL) {
+            break;
+        }
+        StartAttempt(next);
+    }
+}
+
+/// <summary>
+///     Retry timer event handler, which queues the request again.
+/// </summary>
+static void RetryTimerEventHandler(EventData *eventData)
+{
+    WebRequest *webRequest =
+        (WebRequest *)((uint8_t *)eventData - offsetof(WebRequest, retryTimer.eventData));
+
+    // The request keeps its original place in the queue, so it goes ahead of requests of the
+    // same priority which were queued after it.
+    webRequest->state = WebRequestState_Queued;
+    StartQueuedRequests();
+}
+
+/// <summary>
+///     Handles the end of an attempt: the request is either retried after a delay, or
+///     completed.
+/// </summary>
+static void CurlProcessCompletedAttempt(WebRequest *webRequest, CURLcode curlCode)
+{
+    CURLMcode code;
+    if ((code = curl_multi_remove_handle(curlMulti, webRequest->easyHandle)) != CURLM_OK) {
+        LogCurlError("curl_multi_remove_handle", code);
+    }
+    --runningRequestCount;
+
+    long httpStatus = 0;
+    if (curlCode == CURLE_OK) {
+        curl_easy_getinfo(webRequest->easyHandle, CURLINFO_RESPONSE_CODE, &httpStatus);
+    } else if (curlCode == CURLE_RANGE_ERROR) {
+        // cURL found that the server did not send the range which was asked for.
+        webRequest->rangeIgnored = true;
+    }
+
+    // Every attempt counts towards the metrics, so that failed attempts show where they spent
+    // their time too.
+    if (TransferMetrics_Measure(webRequest->easyHandle, &webRequest->timing) == 0) {
+        TransferMetrics_Record(&transferMetrics, webRequest->url, &webRequest->timing,
+                               curlCode == CURLE_OK && httpStatus < 400);
+    }
+    ResolveCache_RecordTransfer(&resolveCache, webRequest->easyHandle, webRequest->url, curlCode);
+
+    // Pass on any data which the sink still holds, now that the content is complete.
+    bool ownSink = webRequest->sink != &webRequest->content;
+    if (curlCode == CURLE_OK && ownSink && httpStatus >= 200 && httpStatus < 300 &&
+        ResponseSink_Finish(webRequest->sink) != 0) {
+        curlCode = CURLE_WRITE_ERROR;
+    }
+
+    if (webRequest->attempts <= webRequest->request.maxRetries && !webRequest->rangeIgnored &&
+        IsRetryable(curlCode, httpStatus)) {
+        // Double the delay for each retry, up to the limit.
+        long delayMilliseconds = webRequest->request.retryDelayMilliseconds;
+        for (unsigned int i = 1; i < webRequest->attempts &&
+                                 delayMilliseconds < maxRetryDelayMilliseconds;
+             i++) {
+            delayMilliseconds *= 2;
+        }
+        if (delayMilliseconds > maxRetryDelayMilliseconds) {
+            delayMilliseconds = maxRetryDelayMilliseconds;
+        }
+
+        // Many requests to an unreachable server fail together, so these are rate limited.
+        APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_INFO, 4, 1000,
+                             "INFO: %s attempt %u failed (curl err=%d, HTTP status %ld); retrying "
+                             "in %ld milliseconds.\n",
+                             webRequest->url, webRequest->attempts, curlCode, httpStatus,
+                             delayMilliseconds);
+
+        const struct timespec delay = {.tv_sec = delayMilliseconds / 1000,
+                                       .tv_nsec = (delayMilliseconds % 1000) * 1000000};
+        if (TimerWheel_SetTimerToSingleExpiry(&retryTimerWheel, &webRequest->retryTimer,
+                                              &delay) == 0) {
+            webRequest->state = WebRequestState_WaitingToRetry;
+            return;
+        }
+        Log_Debug("ERROR: Could not arm the retry timer.\n");
+    }
+
+    CompleteRequest(webRequest, curlCode, httpStatus);
+}
+
+/// <summary>
+///     Process the completed web transfers, and start any queued requests which can now run.
+/// </summary>
+static void CurlProcessCompletedTransfers(void)
+{
+    struct CURLMsg *curlMessage = NULL;
+    do {
+        int msgq = 0;
+        curlMessage = curl_multi_info_read(curlMulti, &msgq);
+        if ((curlMessage != NULL) && (curlMessage->msg == CURLMSG_DONE)) {
+            WebRequest *webRequest = NULL;
+            curl_easy_getinfo(curlMessage->easy_handle, CURLINFO_PRIVATE, (char **)&webRequest);
+            if (webRequest != NULL && webRequest->state == WebRequestState_Running) {
+                CurlProcessCompletedAttempt(webRequest, curlMessage->data.result);
+            }
+        }
+    } while (curlMessage);
+
+    StartQueuedRequests();
+}
+
+/// <summary>
+///     Notify cURL that its timeout expired, so that it can start transfers and detect those
+///     which have timed out.
 /// </summary>
 static void CurlProcessTransfers(void)
 {
     CURLMcode code;
+    int runningEasyHandles = 0;
     if ((code = curl_multi_socket_action(curlMulti, CURL_SOCKET_TIMEOUT, 0, &runningEasyHandles)) !=
         CURLM_OK) {
         LogCurlError("curl_multi_socket_action", code);
         return;
     }
+    CurlProcessCompletedTransfers();
 }
 
 /// <summary>
@@ -231,40 +955,22 @@ static void CurlTimerEventHandler(EventData *eventData)
 static EventData curlTimerEventData = {.eventHandler = &CurlTimerEventHandler};
 
 /// <summary>
-///     Process a completed web transfer by display HTTP status and content of the transfer.
+///     Event data of a socket which cURL polls. Its registeredEvents tells which events the
+///     socket is registered for, so that a change of the events takes one system call and an
+///     unchanged request takes none.
 /// </summary>
-static void CurlProcessCompletedTransfer(void)
-{
-    struct CURLMsg *curlMessage = NULL;
-    do {
-        int msgq = 0;
-        curlMessage = curl_multi_info_read(curlMulti, &msgq);
-        if ((curlMessage != NULL) && (curlMessage->msg == CURLMSG_DONE)) {
-            curlTransferInProgress--;
-            CURL *e = curlMessage->easy_handle;
-            for (size_t i = 0; i < sizeof(webTransfers) / sizeof(*webTransfers); i++) {
-                if (webTransfers[i].easyHandle == e) {
-                    struct timespec currentTime;
-                    clock_gettime(CLOCK_MONOTONIC, &currentTime);
-                    // Display the HTTP status header and the content of the completed web transfer.
-                    Log_Debug(
-                        "\n -==- %s download complete (elapsed time %ld milliseconds) -==-\n",
-                        webTransfers[i].url,
-                        // Compute the elapsed time in milliseconds out of the timespecs.
-                        (currentTime.tv_sec - webTransfers[i].startTime.tv_sec) * 1000 +
-                            (currentTime.tv_nsec - webTransfers[i].startTime.tv_nsec) / 1000000);
-                    Log_Debug("Downloaded content:\n\n%s\n",
-                              webTransfers[i].httpResponse.content.data);
-                    Log_Debug("End of downloaded content.\n");
-
-                    free(webTransfers[i].httpResponse.content.data);
-                    webTransfers[i].httpResponse.content.data = 0;
-                    webTransfers[i].httpResponse.content.size = 0;
-                }
-            }
-        }
-    } while (curlMessage);
-}
+typedef struct CurlSocketContext {
+    EventData eventData;
+    /// <summary>Next context on the free list, while this one is free.</summary>
+    struct CurlSocketContext *nextFree;
+} CurlSocketContext;
+
+// The context of each socket which cURL polls, so that no memory is allocated when cURL opens a
+// connection. cURL returns the context of a socket with the socket's callback, through
+// curl_multi_assign, so it is found without a search, and a free one is taken from the head of
+// the free list.
+static CurlSocketContext curlSocketContexts[WEB_CLIENT_MAX_SOCKETS];
+static CurlSocketContext *freeCurlSocketContexts = NULL;
 
 /// <summary>
 ///     The callback function called by upon activity on a cURL managed file descriptor.
@@ -274,25 +980,63 @@ static void CurlProcessCompletedTransfer(void)
 /// <param name="eventData">Event data provided.</param>
 static void CurlFdEventHandler(EventData *eventData)
 {
+    // Tell cURL which events occurred, so that it does not poll the socket to find out.
+    int eventMask = 0;
+    if ((eventData->readyEvents & EPOLLIN) != 0) {
+        eventMask |= CURL_CSELECT_IN;
+    }
+    if ((eventData->readyEvents & EPOLLOUT) != 0) {
+        eventMask |= CURL_CSELECT_OUT;
+    }
+    if ((eventData->readyEvents & (EPOLLERR | EPOLLHUP)) != 0) {
+        eventMask |= CURL_CSELECT_ERR;
+    }
+
     CURLMcode code;
-    int newRunningEasyHandles = 0;
-    if ((code = curl_multi_socket_action(curlMulti, eventData->fd, 0, &newRunningEasyHandles)) !=
-        CURLM_OK) {
+    int runningEasyHandles = 0;
+    if ((code = curl_multi_socket_action(curlMulti, eventData->fd, eventMask,
+                                         &runningEasyHandles)) != CURLM_OK) {
         LogCurlError("curl_multi_socket_action", code);
         return;
     }
-    // Each time the 'running_handles' counter changes, curl_multi_info_read() will return info
-    // about the specific transfers that completed.
-    if (newRunningEasyHandles != runningEasyHandles) {
-        CurlProcessCompletedTransfer();
+    // A request can complete without the number of running handles changing, when a queued
+    // request has replaced it, so the completed transfers are always checked.
+    CurlProcessCompletedTransfers();
+}
+
+static void CurlInitSocketContexts(void)
+{
+    freeCurlSocketContexts = NULL;
+    for (size_t i = WEB_CLIENT_MAX_SOCKETS; i > 0; i--) {
+        curlSocketContexts[i - 1].nextFree = freeCurlSocketContexts;
+        freeCurlSocketContexts = &curlSocketContexts[i - 1];
     }
-    runningEasyHandles = newRunningEasyHandles;
 }
 
-static void CurlInitCallbackData(EventData *curlData, int fd)
+/// <summary>
+///     Takes a free context for a socket.
+/// </summary>
+/// <returns>The context, or NULL if every context is in use</returns>
+static CurlSocketContext *CurlAllocateSocketContext(int fd)
 {
-    curlData->eventHandler = CurlFdEventHandler;
-    curlData->fd = fd;
+    CurlSocketContext *context = freeCurlSocketContexts;
+    if (context == NULL) {
+        return NULL;
+    }
+    freeCurlSocketContexts = context->nextFree;
+
+    // Zero the event data so its priority and bookkeeping fields start in a known state.
+    memset(context, 0, sizeof(*context));
+    context->eventData.eventHandler = CurlFdEventHandler;
+    context->eventData.fd = fd;
+    return context;
+}
+
+static void CurlReleaseSocketContext(CurlSocketContext *context)
+{
+    context->eventData.fd = -1;
+    context->nextFree = freeCurlSocketContexts;
+    freeCurlSocketContexts = context;
 }
 
 /// <summary>
@@ -302,19 +1046,21 @@ static void CurlInitCallbackData(EventData *curlData, int fd)
 static int CurlSocketCallback(CURL *easy, curl_socket_t fd, int action, void *u,
                               void *socketUserData)
 {
-    EventData *curlCallbackData = (EventData *)socketUserData;
+    CurlSocketContext *context = (CurlSocketContext *)socketUserData;
 
     // The kernel could remove closed file descriptors from the epoll set,
     // hence EBADF failures are expected and ignored.
     if (action == CURL_POLL_REMOVE) {
-        int res = UnregisterEventHandlerFromEpoll(epollFd, fd);
+        if (context == NULL) {
+            return 0;
+        }
+
+        int res = UnregisterPersistentEventHandlerFromEpoll(epollFd, &context->eventData);
+        CurlReleaseSocketContext(context);
         if (res == -1) {
             Log_Debug("ERROR: Removal of event handler from epoll fd set failed.\n");
             return -1;
         }
-
-        // Release the memory allocated for the 'fd' socket.
-        free(curlCallbackData);
         return 0;
     }
 
@@ -327,22 +1073,36 @@ static int CurlSocketCallback(CURL *easy, curl_socket_t fd, int action, void *u,
         eventsMask |= EPOLLOUT;
     }
 
-    if (eventsMask != 0) {
-
-        // Allocate memory to associate callback data to the socket's file descriptor.
-        if (curlCallbackData == NULL) {
-            curlCallbackData = malloc(sizeof(EventData));
-            curl_multi_assign(curlMulti, fd, curlCallbackData);
+    // With CURL_POLL_NONE, cURL keeps the socket but waits for no events on it, so the socket is
+    // taken off the epoll set until cURL asks for events again.
+    if (eventsMask == 0) {
+        if (context != NULL &&
+            UnregisterPersistentEventHandlerFromEpoll(epollFd, &context->eventData) == -1) {
+            Log_Debug("ERROR: Removal of event handler from epoll fd set failed.\n");
+            return -1;
         }
+        return 0;
+    }
 
-        // Associate the user data with the socket's file descriptor.
-        CurlInitCallbackData(curlCallbackData, fd);
-
-        int res = RegisterEventHandlerToEpoll(epollFd, fd, curlCallbackData, eventsMask);
-        if (res == -1) {
-            LogErrno("ERROR: Could not add or modify fd '%d' the epoll set", fd);
+    // Associate a context with the socket's file descriptor.
+    if (context == NULL) {
+        context = CurlAllocateSocketContext(fd);
+        if (context == NULL) {
+            Log_Debug("ERROR: No context for socket %d; increase WEB_CLIENT_MAX_SOCKETS.\n", fd);
             return -1;
         }
+        curl_multi_assign(curlMulti, fd, context);
+    }
+
+    // cURL calls back each time the events which a transfer waits for are recalculated, which
+    // is often with the same events.
+    if (eventsMask == context->eventData.registeredEvents) {
+        return 0;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, fd, &context->eventData, eventsMask) == -1) {
+        LogErrno("ERROR: Could not add or modify fd '%d' the epoll set", fd);
+        return -1;
     }
 
     return 0;
@@ -356,25 +1116,49 @@ static int CurlSocketCallback(CURL *easy, curl_socket_t fd, int action, void *u,
 /// <param name="timeoutMillis">The timeout expressed in milliseconds</param>
 static int CurlTimerCallback(CURLM *multi, long timeoutMillis, void *unused)
 {
-    curlTimeout = timeoutMillis;
-
     // A value of -1 means the timer does not need to be started.
     if (timeoutMillis != -1) {
-        // Invoke cURL immediately if requested to do so.
-        if (timeoutMillis == 0) {
-            CurlProcessTransfers();
-        } else {
-            // Start a single shot timer with the period as provided by cURL.
-            // The timer handler will invoke cURL to process the web transfers.
-            const struct timespec timeout = {.tv_sec = timeoutMillis / 1000,
-                                             .tv_nsec = (timeoutMillis % 1000) * 1000000};
-            SetTimerFdToSingleExpiry(curlTimerFd, &timeout);
-        }
+        // A timeout of 0 asks for cURL to be invoked immediately. cURL must not be invoked from
+        // its own callback, and this callback is called when a queued request is added to the
+        // multi handle, so the timer is set to expire as soon as possible instead.
+        const struct timespec timeout = {.tv_sec = timeoutMillis / 1000,
+                                         .tv_nsec = (timeoutMillis % 1000) * 1000000 +
+                                                    (timeoutMillis == 0 ? 1 : 0)};
+        // Start a single shot timer with the period as provided by cURL.
+        // The timer handler will invoke cURL to process the web transfers.
+        SetTimerFdToSingleExpiry(curlTimerFd, &timeout);
     }
 
     return 0;
 }
 
+// cURL's allocations, which it makes through these functions once it is initialized with
+// curl_global_init_mem.
+static void *CurlMalloc(size_t size)
+{
+    return MemoryMetrics_Malloc(curlMemoryTag, size);
+}
+
+static void CurlFree(void *pointer)
+{
+    MemoryMetrics_Free(pointer);
+}
+
+static void *CurlRealloc(void *pointer, size_t size)
+{
+    return MemoryMetrics_Realloc(curlMemoryTag, pointer, size);
+}
+
+static char *CurlStrdup(const char *string)
+{
+    return MemoryMetrics_Strdup(curlMemoryTag, string);
+}
+
+static void *CurlCalloc(size_t count, size_t size)
+{
+    return MemoryMetrics_Calloc(curlMemoryTag, count, size);
+}
+
 /// <summary>
 ///     Initializes the cURL library for downloading concurrently a set of web pages.
 /// </summary>
@@ -382,18 +1166,57 @@ static int CurlTimerCallback(CURLM *multi, long timeoutMillis, void *unused)
 static int CurlInit(void)
 {
     CURLMcode res;
+    CURLSHcode shareRes;
 
-    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+    if (curl_global_init_mem(CURL_GLOBAL_ALL, CurlMalloc, CurlFree, CurlRealloc, CurlStrdup,
+                             CurlCalloc) != CURLE_OK) {
         Log_Debug("curl_global_init failed!\n");
         return -1;
     }
     Log_Debug("Using %s\n", curl_version());
 
-    for (size_t i = 0; i < sizeof(webTransfers) / sizeof(*webTransfers); i++) {
-        webTransfers[i].easyHandle =
-            CurlSetupEasyHandle(webTransfers[i].url, &webTransfers[i].httpResponse);
+    if (webClientConfig.multiplex &&
+        (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2) == 0) {
+        Log_Debug("WARNING: The cURL library does not support HTTP/2; transfers will not be "
+                  "multiplexed.\n");
+        webClientConfig.multiplex = false;
+    }
+    if (webClientConfig.acceptCompressed &&
+        (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_LIBZ) == 0) {
+        Log_Debug("WARNING: The cURL library does not support compression; content will be "
+                  "downloaded uncompressed.\n");
+        webClientConfig.acceptCompressed = false;
+    }
 
-        if (webTransfers[i].easyHandle == NULL) {
+    if (LoadCaBundle() != 0) {
+        goto errorLabel;
+    }
+
+    // Setup the cache which is shared by all the transfers. Every transfer is made from this
+    // thread, so the share does not need lock functions.
+    curlShare = curl_share_init();
+    if (curlShare == NULL) {
+        Log_Debug("curl_share_init() failed!\n");
+        goto errorLabel;
+    }
+
+    static const curl_lock_data sharedData[] = {CURL_LOCK_DATA_DNS, CURL_LOCK_DATA_SSL_SESSION,
+                                                CURL_LOCK_DATA_CONNECT};
+    for (size_t i = 0; i < sizeof(sharedData) / sizeof(*sharedData); i++) {
+        if ((shareRes = curl_share_setopt(curlShare, CURLSHOPT_SHARE, sharedData[i])) !=
+            CURLSHE_OK) {
+            LogCurlShareError("curl_share_setopt CURLSHOPT_SHARE", shareRes);
+            goto errorLabel;
+        }
+    }
+
+    CurlInitSocketContexts();
+
+    for (size_t i = 0; i < WEB_CLIENT_MAX_REQUESTS; i++) {
+        ResponseSink_InitBuffer(&webRequests[i].content, maxResponseContentSize);
+        webRequests[i].easyHandle = CurlSetupEasyHandle(&webRequests[i]);
+
+        if (webRequests[i].easyHandle == NULL) {
             goto errorLabel;
         }
     }
@@ -416,12 +1239,35 @@ static int CurlInit(void)
         goto errorLabel;
     }
 
+    long pipelining = webClientConfig.multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING;
+    if ((res = curl_multi_setopt(curlMulti, CURLMOPT_PIPELINING, pipelining)) != CURLM_OK) {
+        LogCurlError("curl_multi_setopt CURLMOPT_PIPELINING", res);
+        goto errorLabel;
+    }
+    if ((res = curl_multi_setopt(curlMulti, CURLMOPT_MAX_HOST_CONNECTIONS,
+                                 webClientConfig.maxHostConnections)) != CURLM_OK) {
+        LogCurlError("curl_multi_setopt CURLMOPT_MAX_HOST_CONNECTIONS", res);
+        goto errorLabel;
+    }
+
+    Log_Debug("Transfers %s multiplexed, with at most %ld connection(s) per host.\n",
+              webClientConfig.multiplex ? "are" : "are not", webClientConfig.maxHostConnections);
     return 0;
 
 errorLabel:
-    for (size_t i = 0; i < sizeof(webTransfers) / sizeof(*webTransfers); i++) {
-        curl_easy_cleanup(webTransfers[i].easyHandle);
+    if (curlMulti != NULL) {
+        curl_multi_cleanup(curlMulti);
+        curlMulti = NULL;
+    }
+    for (size_t i = 0; i < WEB_CLIENT_MAX_REQUESTS; i++) {
+        curl_easy_cleanup(webRequests[i].easyHandle);
+        webRequests[i].easyHandle = NULL;
+        ResponseSink_Fini(&webRequests[i].content);
     }
+    // The share and the certificates bundle can only be freed once no easy handle uses them.
+    curl_share_cleanup(curlShare);
+    curlShare = NULL;
+    FreeCaBundle();
     return -1;
 }
 
@@ -430,47 +1276,214 @@ errorLabel:
 /// <summary>
 static void CurlFini(void)
 {
-    for (size_t i = 0; i < sizeof(webTransfers) / sizeof(*webTransfers); i++) {
-        curl_easy_cleanup(&webTransfers[i]);
+    for (size_t i = 0; i < WEB_CLIENT_MAX_REQUESTS; i++) {
+        if (webRequests[i].state == WebRequestState_Running) {
+            curl_multi_remove_handle(curlMulti, webRequests[i].easyHandle);
+        }
+        if (webRequests[i].state != WebRequestState_Free) {
+            ReleaseRequest(&webRequests[i]);
+        }
+        curl_easy_cleanup(webRequests[i].easyHandle);
+        webRequests[i].easyHandle = NULL;
+        ResponseSink_Fini(&webRequests[i].content);
     }
+    runningRequestCount = 0;
 
     CURLMcode res;
     if ((res = curl_multi_cleanup(curlMulti)) != CURLM_OK) {
         LogCurlError("curl_multi_cleanup failed", res);
     }
+
+    // The share can only be cleaned up once no easy handle uses it.
+    CURLSHcode shareRes;
+    if ((shareRes = curl_share_cleanup(curlShare)) != CURLSHE_OK) {
+        LogCurlShareError("curl_share_cleanup failed", shareRes);
+    }
+    FreeCaBundle();
     curl_global_cleanup();
 }
 
+int WebClient_Enqueue(const WebClientRequest *request)
+{
+    if (request->url == NULL || (request->body == NULL && request->bodySize != 0) ||
+        (request->resumeFrom != 0 && request->sink == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    WebRequest *webRequest = NULL;
+    for (size_t i = 0; i < WEB_CLIENT_MAX_REQUESTS && webRequest == NULL; i++) {
+        if (webRequests[i].state == WebRequestState_Free) {
+            webRequest = &webRequests[i];
+        }
+    }
+    if (webRequest == NULL) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    webRequest->request = *request;
+    if (webRequest->request.timeoutMilliseconds == 0) {
+        webRequest->request.timeoutMilliseconds = defaultTimeoutMilliseconds;
+    }
+    if (webRequest->request.retryDelayMilliseconds == 0) {
+        webRequest->request.retryDelayMilliseconds = defaultRetryDelayMilliseconds;
+    }
+
+    // Copy the data, so that the caller does not need to keep it.
+    webRequest->url = MemoryMetrics_Strdup(webClientMemoryTag, request->url);
+    if (webRequest->url == NULL) {
+        goto errorLabel;
+    }
+    if (request->bodySize != 0) {
+        webRequest->body = MemoryMetrics_Malloc(webClientMemoryTag, request->bodySize);
+        if (webRequest->body == NULL) {
+            goto errorLabel;
+        }
+        memcpy(webRequest->body, request->body, request->bodySize);
+    }
+    if (request->contentType != NULL) {
+        int length = snprintf(webRequest->contentTypeHeader, sizeof(webRequest->contentTypeHeader),
+                              "Content-Type: %s", request->contentType);
+        if (length < 0 || (size_t)length >= sizeof(webRequest->contentTypeHeader)) {
+            errno = EINVAL;
+            goto errorLabel;
+        }
+    }
+    webRequest->ifRange[0] = 0;
+    if (request->ifRange != NULL) {
+        if (strlen(request->ifRange) > WEB_CLIENT_MAX_ETAG_LENGTH) {
+            errno = EINVAL;
+            goto errorLabel;
+        }
+        strcpy(webRequest->ifRange, request->ifRange);
+    }
+    // The request's copies are now referenced by the easy handle.
+    webRequest->request.url = webRequest->url;
+    webRequest->request.body = webRequest->body;
+    webRequest->request.contentType = NULL;
+    webRequest->request.ifRange = NULL;
+
+    // Content for the web client's own buffer always starts from the beginning.
+    webRequest->sink = (request->sink != NULL) ? request->sink : &webRequest->content;
+    webRequest->contentOffset = (request->sink != NULL) ? request->resumeFrom : 0;
+    webRequest->rangeIgnored = false;
+    webRequest->etag[0] = 0;
+    webRequest->lastModified[0] = 0;
+
+    if (CurlSetupRequest(webRequest) != 0) {
+        errno = EINVAL;
+        goto errorLabel;
+    }
+
+    webRequest->attempts = 0;
+    webRequest->queueOrder = nextQueueOrder++;
+    clock_gettime(CLOCK_MONOTONIC, &webRequest->queuedTime);
+    webRequest->state = WebRequestState_Queued;
+
+    StartQueuedRequests();
+    return 0;
+
+errorLabel:
+    ReleaseRequest(webRequest);
+    return -1;
+}
+
+/// <summary>
+///     Completion handler for the sample's downloads, which displays the HTTP status and the
+///     content.
+/// </summary>
+static void SampleDownloadCompletionHandler(const WebClientResult *result, void *context)
+{
+    Log_Debug("\n -==- %s download complete (elapsed time %ld milliseconds, %u attempt(s)) -==-\n",
+              result->url, result->elapsedMilliseconds, result->attempts);
+    if (APP_LOG_LEVEL >= APP_LOG_LEVEL_DEBUG) {
+        TransferMetrics_LogTiming(result->timing);
+    }
+
+    if (result->curlCode != CURLE_OK) {
+        LogCurlError("ERROR: Transfer failed", result->curlCode);
+    } else {
+        Log_Debug("HTTP status: %ld\n", result->httpStatus);
+        if (result->httpStatus == 304) {
+            Log_Debug("The content has not changed since it was last downloaded.\n");
+        } else {
+            Log_Debug("Downloaded content (%zu bytes):\n\n%s\n", result->contentSize,
+                      result->content != NULL ? (const char *)result->content : "");
+            Log_Debug("End of downloaded content.\n");
+        }
+    }
+
+    // Once the whole set has completed, show the metrics which an application would send as
+    // telemetry.
+    if (--sampleDownloadsPending == 0) {
+        TransferMetrics snapshot;
+        WebClient_GetMetrics(&snapshot);
+        Log_Debug("\n -==- Transfer metrics -==-\n");
+        TransferMetrics_Log(&snapshot);
+        Log_Debug("Resolve cache: %u attempt(s) used a cached address, %u resolved the host.\n",
+                  resolveCache.hits, resolveCache.misses);
+
+        static char telemetry[4096];
+        if (TransferMetrics_FormatJson(&snapshot, telemetry, sizeof(telemetry)) >= 0) {
+            Log_Debug("Telemetry: %s\n", telemetry);
+        }
+
+        StorageMetrics storageSnapshot;
+        StorageMetrics_GetSnapshot(&storageSnapshot);
+        Log_Debug("\n -==- Storage metrics -==-\n");
+        StorageMetrics_Log(&storageSnapshot);
+    }
+}
+
+int WebClient_AddResolvedHost(const char *host, uint16_t port, struct in_addr address,
+                              uint32_t ttlSeconds)
+{
+    return ResolveCache_Add(&resolveCache, host, port, address, ttlSeconds);
+}
+
+void WebClient_GetMetrics(TransferMetrics *snapshot)
+{
+    *snapshot = transferMetrics;
+}
+
+void WebClient_ResetMetrics(void)
+{
+    TransferMetrics_Reset(&transferMetrics);
+}
+
 int WebClient_StartTransfers(void)
 {
-    int res = 0;
-    // Start new web page downloads if not already in progress.
-    if (curlTransferInProgress == 0) {
-        struct timespec currentTime;
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        CURLMcode res;
-        for (size_t i = 0; i < sizeof(webTransfers) / sizeof(*webTransfers); i++) {
-            if ((res = curl_multi_remove_handle(curlMulti, webTransfers[i].easyHandle)) !=
-                CURLM_OK) {
-                LogCurlError("curl_multi_remove_handle", res);
-                res = -1;
-                break;
-            }
-            if ((res = curl_multi_add_handle(curlMulti, webTransfers[i].easyHandle)) != CURLM_OK) {
-                LogCurlError("curl_multi_add_handle", res);
-                res = -1;
-                break;
-            }
-            webTransfers[i].startTime = currentTime;
-            curlTransferInProgress++;
+    for (size_t i = 0; i < sizeof(sampleDownloads) / sizeof(*sampleDownloads); i++) {
+        const WebClientRequest request = {.url = sampleDownloads[i].url,
+                                          .method = WebClientMethod_Get,
+                                          .priority = sampleDownloads[i].priority,
+                                          .maxRetries = sampleDownloads[i].maxRetries,
+                                          .conditional = sampleDownloads[i].conditional,
+                                          .completionHandler = &SampleDownloadCompletionHandler};
+        if (WebClient_Enqueue(&request) != 0) {
+            LogErrno("ERROR: Could not queue the download of %s", sampleDownloads[i].url);
+            return -1;
         }
+        ++sampleDownloadsPending;
     }
-    return res;
+    return 0;
 }
 
-int WebClient_Init(int epollFdInstance)
+int WebClient_Init(int epollFdInstance, const WebClientConfig *config)
 {
     epollFd = epollFdInstance;
+    webClientConfig = *config;
+    if (webClientConfig.maxConcurrentRequests == 0 ||
+        webClientConfig.maxConcurrentRequests > WEB_CLIENT_MAX_REQUESTS) {
+        webClientConfig.maxConcurrentRequests = WEB_CLIENT_MAX_REQUESTS;
+    }
+    ValidatorCache_Init(webClientConfig.validatorCacheOffset);
+    TransferMetrics_Reset(&transferMetrics);
+    ResolveCache_Init(&resolveCache, learnedAddressTtlSeconds);
+    isShuttingDown = false;
+    webClientMemoryTag = MemoryMetrics_AddTag("web_client");
+    curlMemoryTag = MemoryMetrics_AddTag("curl");
 
     // By default this timer is disarmed.
     static const struct timespec curlTimerInterval = {0, 0};
@@ -480,11 +1493,36 @@ int WebClient_Init(int epollFdInstance)
         return -1;
     }
 
+    // Set up the retry timers, for later use.
+    static const struct timespec retryTimerResolution = {0, 100 * 1000 * 1000};
+    if (TimerWheel_Init(&retryTimerWheel, epollFd, &retryTimerResolution) != 0) {
+        return -1;
+    }
+    // A retry may start a little late, so that requests which failed together are retried
+    // on one wakeup.
+    static const struct timespec retryTimerSlack = {0, 250 * 1000 * 1000};
+    for (size_t i = 0; i < WEB_CLIENT_MAX_REQUESTS; i++) {
+        memset(&webRequests[i], 0, sizeof(webRequests[i]));
+        webRequests[i].retryTimer.eventData.eventHandler = &RetryTimerEventHandler;
+        TimerWheel_SetTimerSlack(&retryTimerWheel, &webRequests[i].retryTimer, &retryTimerSlack);
+    }
+
     return CurlInit();
 }
 
+bool WebClient_ShutdownHook(ShutdownHook *hook)
+{
+    if (hook->calls == 0) {
+        isShuttingDown = true;
+        Log_Debug("INFO: Waiting for %zu running web request(s) to complete.\n",
+                  runningRequestCount);
+    }
+    return runningRequestCount == 0;
+}
+
 void WebClient_Fini(void)
 {
     CurlFini();
+    TimerWheel_Close(&retryTimerWheel);
     CloseFdAndLogOnError(curlTimerFd, "curlTimerFd");
 }
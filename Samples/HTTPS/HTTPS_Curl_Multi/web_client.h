@@ -3,20 +3,256 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "shutdown_coordinator.h"
+#include "transfer_metrics.h"
+
+/// <summary>
+///     Number of requests which the web client can hold at once, whether they are queued,
+///     running or waiting to be retried.
+/// </summary>
+#define WEB_CLIENT_MAX_REQUESTS 8
+
+#ifndef WEB_CLIENT_MAX_SOCKETS
+/// <summary>
+///     Number of sockets which cURL can have polled at once. Each running request uses one,
+///     or two while cURL races the IPv4 and IPv6 addresses of its host. When every slot is in
+///     use, the transfer which needs another socket fails. Define this before building to
+///     change it.
+/// </summary>
+#define WEB_CLIENT_MAX_SOCKETS (2 * WEB_CLIENT_MAX_REQUESTS)
+#endif
+
+/// <summary>
+///     Longest ETag which the web client keeps, not including the null terminator. A longer
+///     ETag is ignored.
+/// </summary>
+#define WEB_CLIENT_MAX_ETAG_LENGTH 95
+
+struct ResponseSink;
+
+/// <summary>
+///     How the web client connects to the web servers.
+/// </summary>
+typedef struct {
+    /// <summary>Whether to use HTTP/2 where the server supports it, so that concurrent
+    /// transfers to the same server are multiplexed over one connection instead of each opening
+    /// its own. This is ignored if the cURL library does not support HTTP/2.</summary>
+    bool multiplex;
+    /// <summary>Largest number of connections which are open to each host at once, or 0 for no
+    /// limit. Transfers which would need another connection wait for one to become
+    /// free.</summary>
+    long maxHostConnections;
+    /// <summary>Largest number of requests which run at once, or 0 for
+    /// WEB_CLIENT_MAX_REQUESTS. Further requests wait in the queue.</summary>
+    size_t maxConcurrentRequests;
+    /// <summary>Whether to ask servers to compress content with gzip or deflate. cURL
+    /// decompresses the content as it arrives, so sinks receive the decoded content. Range
+    /// requests ask for the content uncompressed, so that offsets in the content are the same
+    /// whether it was compressed or not. This is ignored if the cURL library does not support
+    /// compression.</summary>
+    bool acceptCompressed;
+    /// <summary>Offset in the mutable file of the cache of validators for conditional requests.
+    /// The application's own data in the mutable file must not overlap it.</summary>
+    off_t validatorCacheOffset;
+} WebClientConfig;
+
+/// <summary>The HTTP method of a <see cref="WebClientRequest" />.</summary>
+typedef enum {
+    WebClientMethod_Get,
+    WebClientMethod_Post,
+    WebClientMethod_Put,
+    WebClientMethod_Delete
+} WebClientMethod;
+
+/// <summary>
+///     The order in which queued requests are started. Requests of the same priority are started
+///     in the order in which they were queued.
+/// </summary>
+typedef enum {
+    WebClientPriority_Low,
+    WebClientPriority_Normal,
+    WebClientPriority_High
+} WebClientPriority;
+
+/// <summary>
+///     The outcome of a request, which is passed to its completion handler.
+/// </summary>
+typedef struct {
+    /// <summary>The URL of the request.</summary>
+    const char *url;
+    /// <summary>The CURLcode of the last attempt; CURLE_OK if a response was received.</summary>
+    int curlCode;
+    /// <summary>The HTTP status of the response, or 0 if no response was received. A
+    /// conditional request reports 304 if the content has not changed.</summary>
+    long httpStatus;
+    /// <summary>The response content, followed by a null terminator, or NULL if there is no
+    /// content or the request had its own sink. This is only valid until the completion handler
+    /// returns.</summary>
+    const uint8_t *content;
+    /// <summary>Number of bytes of content, not including the null terminator.</summary>
+    size_t contentSize;
+    /// <summary>The ETag of the last response, or an empty string if it had none.</summary>
+    const char *etag;
+    /// <summary>For a request with its own sink, the offset in the content up to which the
+    /// sink has accepted data. This is where a later request should resume.</summary>
+    uint64_t contentOffset;
+    /// <summary>Whether the request asked for a range of the content, but the server sent the
+    /// whole content, because the content changed or the server does not support ranges. The
+    /// content was not passed to the sink, so the download must be started again from the
+    /// beginning.</summary>
+    bool rangeIgnored;
+    /// <summary>The timing of the last attempt, which tells DNS, connection, TLS and server
+    /// latency apart.</summary>
+    const TransferTiming *timing;
+    /// <summary>Number of attempts which were made, including the first one.</summary>
+    unsigned int attempts;
+    /// <summary>Time from when the request was queued until it completed.</summary>
+    long elapsedMilliseconds;
+} WebClientResult;
+
+/// <summary>
+///     Function which is called when a request completes, whether it succeeded or not.
+/// </summary>
+/// <param name="result">The outcome of the request.</param>
+/// <param name="context">The context from the request.</param>
+typedef void (*WebClientCompletionHandler)(const WebClientResult *result, void *context);
+
+/// <summary>
+///     Function which is called each time that a request's own sink accepts more content.
+/// </summary>
+/// <param name="contentOffset">The offset in the content up to which the sink has accepted
+/// data.</param>
+/// <param name="etag">The ETag of the response, or an empty string if it has none.</param>
+/// <param name="context">The context from the request.</param>
+typedef void (*WebClientProgressHandler)(uint64_t contentOffset, const char *etag,
+                                         void *context);
+
+/// <summary>
+///     A request to pass to <see cref="WebClient_Enqueue" />.
+/// </summary>
+typedef struct {
+    /// <summary>HTTP or HTTPS URL. Its host name must be listed in the AllowedConnections
+    /// capability in app_manifest.json.</summary>
+    const char *url;
+    /// <summary>The HTTP method.</summary>
+    WebClientMethod method;
+    /// <summary>Body which is sent with POST and PUT requests, or NULL for none.</summary>
+    const void *body;
+    /// <summary>Number of bytes of body.</summary>
+    size_t bodySize;
+    /// <summary>Content-Type of the body, or NULL for none.</summary>
+    const char *contentType;
+    /// <summary>The order in which the request is started.</summary>
+    WebClientPriority priority;
+    /// <summary>Longest time which each attempt can take, including connecting, or 0 for the
+    /// default of 30 seconds.</summary>
+    long timeoutMilliseconds;
+    /// <summary>Number of times which the request is retried if an attempt fails with a
+    /// network error, a timeout, an HTTP 408 or 429 status or a 5xx status.</summary>
+    unsigned int maxRetries;
+    /// <summary>Delay before the first retry, or 0 for the default of 1 second. The delay
+    /// doubles for each further retry.</summary>
+    long retryDelayMilliseconds;
+    /// <summary>Sink which receives the content, or NULL to collect the content in the web
+    /// client's own buffer. An attempt which is retried after it failed part way through
+    /// continues from where it stopped, with a range request, because a sink cannot take back
+    /// the data which it has accepted.</summary>
+    struct ResponseSink *sink;
+    /// <summary>For a request with its own sink, the offset in the content from which to start,
+    /// such as where an earlier request stopped. A non-zero offset is requested with a Range
+    /// header.</summary>
+    uint64_t resumeFrom;
+    /// <summary>ETag which the content must still have for a range to be sent, or NULL. It is
+    /// sent in an If-Range header, so that the server sends the whole content, which is reported
+    /// as rangeIgnored, if the content changed. If it is NULL, retries use the ETag of the
+    /// first response.</summary>
+    const char *ifRange;
+    /// <summary>Whether to make a conditional GET request. The ETag and Last-Modified date of
+    /// the last 200 response for the URL are kept in mutable storage, and sent in If-None-Match
+    /// and If-Modified-Since headers, so that the server answers with status 304 and no content
+    /// if the content has not changed.</summary>
+    bool conditional;
+    /// <summary>Function which is called when the request's own sink accepts more content, or
+    /// NULL.</summary>
+    WebClientProgressHandler progressHandler;
+    /// <summary>Function which is called when the request completes.</summary>
+    WebClientCompletionHandler completionHandler;
+    /// <summary>Value which is passed to the completion handler.</summary>
+    void *context;
+} WebClientRequest;
+
 /// <summary>
-///     Initializes the web client's resources.
+///     Initializes the web client's resources. All transfers share one cache of DNS results,
+///     TLS sessions and connections, whichever mode is configured.
 /// </summary>
 /// <param name="epollFdInstance">The epoll instance</param>
+/// <param name="config">How to connect to the web servers. This is copied.</param>
 /// <returns>0 on success, -1 on error</returns>
-int WebClient_Init(int epollFdInstance);
+int WebClient_Init(int epollFdInstance, const WebClientConfig *config);
 
 /// <summary>
-///     Finalizes the web client's resources.
+///     Finalizes the web client's resources. Requests which have not completed are abandoned
+///     without calling their completion handlers.
 /// </summary>
 void WebClient_Fini(void);
 
 /// <summary>
-///     Starts web page download.
+///     Shutdown hook which stops starting queued requests and retries, and waits for the
+///     running requests to complete, so that their completion handlers save their progress.
+///     Register it with <see cref="ShutdownCoordinator_AddHook" />.
+/// </summary>
+/// <param name="hook">The hook. Its context is not used.</param>
+/// <returns>true once no request is running, or false to be called again</returns>
+bool WebClient_ShutdownHook(ShutdownHook *hook);
+
+/// <summary>
+///     Queues a request. It is started from the event loop as soon as fewer than
+///     maxConcurrentRequests requests are running, and no higher priority request is waiting.
+///     This can be called from a completion handler.
+/// </summary>
+/// <param name="request">The request. The URL, body, content type and ETag are copied, but the
+/// sink must remain valid until the request completes.</param>
+/// <returns>0 on success, or -1 on failure, with errno set to ENOSPC if
+/// WEB_CLIENT_MAX_REQUESTS requests are already held, or EINVAL if the request is
+/// invalid.</returns>
+int WebClient_Enqueue(const WebClientRequest *request);
+
+/// <summary>
+///     Adds the address of a host, such as one which DNS service discovery found, so that
+///     transfers to it connect without resolving its name. The address is used until its TTL
+///     expires, or until a connection to it fails. The web client also keeps the address of each
+///     host which it has connected to for 5 minutes.
+/// </summary>
+/// <param name="host">The host name, which must be listed in the AllowedConnections capability
+/// in app_manifest.json.</param>
+/// <param name="port">The port of the URLs which use the address, such as 443.</param>
+/// <param name="address">The IPv4 address.</param>
+/// <param name="ttlSeconds">How long the address is valid, in seconds.</param>
+/// <returns>0 on success, or -1 if the host name is too long or the TTL is 0</returns>
+int WebClient_AddResolvedHost(const char *host, uint16_t port, struct in_addr address,
+                              uint32_t ttlSeconds);
+
+/// <summary>
+///     Takes a snapshot of the timing metrics of every attempt since the web client was
+///     initialized or the metrics were reset, aggregated per host.
+/// </summary>
+/// <param name="snapshot">Receives the metrics.</param>
+void WebClient_GetMetrics(TransferMetrics *snapshot);
+
+/// <summary>
+///     Discards the timing metrics, such as after they have been reported, so that the next
+///     snapshot only covers the attempts since then.
+/// </summary>
+void WebClient_ResetMetrics(void);
+
+/// <summary>
+///     Queues the sample's set of web page downloads.
 /// </summary>
 /// <returns>0 on success, -1 on error</returns>
 int WebClient_StartTransfers(void);
\ No newline at end of file
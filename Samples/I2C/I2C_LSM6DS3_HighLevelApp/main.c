@@ -6,7 +6,7 @@
 //
 // It uses the APIs for the following Azure Sphere application libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging)
-// - i2c (communicates with LSM6DS3 accelerometer)
+// - i2c (communicates with LSM6DS3 accelerometer, from a worker thread which shares the bus)
 
 #include <errno.h>
 #include <signal.h>
@@ -19,9 +19,14 @@
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include "epoll_timerfd_utilities.h"
+#include "startup_sequence.h"
+#include "i2c_bus_scheduler.h"
+#include "lsm6ds3_convert.h"
+#include "lsm6ds3_i2c.h"
 
 #include <applibs/log.h>
 #include <applibs/i2c.h>
+#include <applibs/gpio.h>
 
 // By default, this sample's CMake build targets hardware that follows the MT3620
 // Reference Development Board (RDB) specification, such as the MT3620 Dev Kit from
@@ -36,11 +41,24 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+// Fail the build if the hardware definition maps two of the peripherals which this sample
+// uses to the same pins. See mt3620_pin_check.h.
+#include <hw/mt3620_pin_check.h>
+MT3620_CHECK_GPIOS_NOT_ON_I2C(SAMPLE_LSM6DS3_I2C, SAMPLE_LSM6DS3_INT1);
+
 // Support functions.
 static void TerminationHandler(int signalNumber);
 static void AccelTimerEventHandler(EventData *eventData);
+static ssize_t DrainFifoJobHandler(I2cBusTransaction *transaction, int i2cFd);
+static void DrainFifoCompletionHandler(I2cBusTransaction *transaction);
+static double FixedToDouble(int64_t value);
 static int ReadWhoAmI(void);
 static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t actualBytes);
+static StartupStepResult OpenI2cStepHandler(StartupStep *step);
+static StartupStepResult CheckWhoAmIStepHandler(StartupStep *step);
+static StartupStepResult ResetLsm6ds3StepHandler(StartupStep *step);
+static StartupStepResult OpenInt1StepHandler(StartupStep *step);
+static void StartupFinishedHandler(StartupSequence *sequence, int result);
 static int InitPeripheralsAndHandlers(void);
 static void ClosePeripheralsAndHandlers(void);
 
@@ -48,11 +66,63 @@ static void ClosePeripheralsAndHandlers(void);
 static int epollFd = -1;
 static int accelTimerFd = -1;
 static int i2cFd = -1;
+static int int1GpioFd = -1;
 
 // DocID026899 Rev 10, S6.1.1, I2C operation
 // SDO is tied to ground so the least significant bit of the address is zero.
 static const uint8_t lsm6ds3Address = 0x6A;
 
+// Both sensors sample at 104Hz into the FIFO. INT1 is asserted when the FIFO reaches the
+// watermark of one second of samples, and then the FIFO is drained. The FIFO holds over six
+// seconds of samples, so none are lost if a drain is late.
+static Lsm6ds3I2cBus lsm6ds3Bus = {.i2cFd = -1, .address = lsm6ds3Address};
+static Lsm6ds3 lsm6ds3;
+static const Lsm6ds3FifoConfig lsm6ds3Config = {.odr = Lsm6ds3Odr_104Hz,
+                                                .accelRange = Lsm6ds3AccelRange_4g,
+                                                .gyroRange = Lsm6ds3GyroRange_245dps,
+                                                .watermarkSamples = 104};
+static Lsm6ds3Sample lsm6ds3Samples[256];
+// Each batch is converted to g and degrees per second in fixed point as it is read.
+static Lsm6ds3FixedSample lsm6ds3FixedSamples[256];
+static Lsm6ds3Scale lsm6ds3Scale;
+
+// Once the sensor is sampling, the bus is shared through the scheduler, and the FIFO is drained
+// on its worker thread, so the event loop does not wait for the transfers. Other devices on the
+// same ISU would be added to the scheduler with their own queues.
+static I2cBusScheduler i2cBusScheduler = {.eventFd = -1};
+static I2cBusDevice lsm6ds3BusDevice = {.address = lsm6ds3Address};
+static I2cBusTransaction drainTransaction = {.jobHandler = &DrainFifoJobHandler,
+                                             .completionHandler = &DrainFifoCompletionHandler};
+
+// Written by the drain job on the worker thread, and read by its completion handler.
+static struct {
+    size_t sampleCount;
+    int64_t sums[6];
+    bool overrun;
+} drainResult;
+
+// Applibs does not report GPIO edges, so sample INT1 every 10ms once the sensor is sampling. The
+// data is printed each time the FIFO reaches the watermark, which is about once a second.
+static const struct timespec accelReadPeriod = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+
+// The peripherals are opened by a sequence of startup steps, which logs how long each one took.
+// The reset is checked every millisecond from a timer, for up to 100ms, rather than by polling
+// the bus in a loop, and INT1 is opened while the device resets.
+static StartupSequence startupSequence;
+static const uint32_t maxResetChecks = 100;
+static StartupStep openI2cStep = {
+    .name = "I2C", .handler = &OpenI2cStepHandler, .isCritical = true};
+static StartupStep whoAmIStep = {.name = "WHO_AM_I",
+                                 .handler = &CheckWhoAmIStepHandler,
+                                 .isCritical = true,
+                                 .after = &openI2cStep};
+static StartupStep resetStep = {.name = "LSM6DS3 reset",
+                                .handler = &ResetLsm6ds3StepHandler,
+                                .isCritical = true,
+                                .after = &whoAmIStep,
+                                .retryDelay = {0, 1000 * 1000}};
+static StartupStep int1Step = {.name = "INT1", .handler = &OpenInt1StepHandler, .isCritical = true};
+
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
@@ -66,53 +136,119 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Print latest data from accelerometer.
+///     Check INT1, and if the FIFO has reached the watermark, queue a drain of the FIFO.
 /// </summary>
 static void AccelTimerEventHandler(EventData *eventData)
 {
-    static int iter = 1;
-
     if (ConsumeTimerFdEvent(accelTimerFd) != 0) {
         terminationRequired = true;
         return;
     }
 
-    // Status register describes whether accelerometer is available.
-    // DocID026899 Rev 10, S9.26, STATUS_REG (1Eh); [0] = XLDA
-    static const uint8_t statusRegId = 0x1E;
-    uint8_t status;
-    ssize_t transferredBytes = I2CMaster_WriteThenRead(
-        i2cFd, lsm6ds3Address, &statusRegId, sizeof(statusRegId), &status, sizeof(status));
-    if (!CheckTransferSize("I2CMaster_WriteThenRead (STATUS_REG)",
-                           sizeof(statusRegId) + sizeof(status), transferredBytes)) {
+    // Reading the pin does not use the bus, so the bus is only used when there is a batch of
+    // samples to read.
+    GPIO_Value_Type int1;
+    if (GPIO_GetValue(int1GpioFd, &int1) != 0) {
+        Log_Debug("ERROR: Could not read LSM6DS3 INT1: %s (%d).\n", strerror(errno), errno);
         terminationRequired = true;
         return;
     }
 
-    if ((status & 0x1) == 0) {
-        Log_Debug("INFO: %d: No accelerometer data.\n", iter);
-    } else {
-        // Read two-byte Z-axis output register.
-        // DocID026899 Rev 10, S9.38, OUTZ_L_XL (2Ch)
-        static const uint8_t outZLXl = 0x2C;
-        int16_t zRaw;
-        transferredBytes = I2CMaster_WriteThenRead(i2cFd, lsm6ds3Address, &outZLXl, sizeof(outZLXl),
-                                                   (uint8_t *)&zRaw, sizeof(zRaw));
-        if (!CheckTransferSize("I2CMaster_WriteThenRead (OUTZ_L_XL)",
-                               sizeof(outZLXl) + sizeof(zRaw), transferredBytes)) {
-            terminationRequired = true;
-            return;
+    if (int1 == GPIO_Value_Low) {
+        return;
+    }
+
+    // A drain is still running, so the FIFO will be drained anyway.
+    if (drainTransaction.isBusy) {
+        return;
+    }
+
+    if (I2cBusScheduler_Submit(&i2cBusScheduler, &lsm6ds3BusDevice, &drainTransaction) != 0) {
+        Log_Debug("ERROR: Could not queue LSM6DS3 FIFO drain: %s (%d).\n", strerror(errno),
+                  errno);
+        terminationRequired = true;
+    }
+}
+
+/// <summary>
+///     Bus job: drain the FIFO and add up the samples. This runs on the scheduler's worker
+///     thread, which has the bus to itself meanwhile.
+/// </summary>
+static ssize_t DrainFifoJobHandler(I2cBusTransaction *transaction, int i2cFd)
+{
+    memset(&drainResult, 0, sizeof(drainResult));
+
+    // Each drain reads the FIFO status and then the samples in bursts, rather than reading
+    // STATUS_REG and an output register for every sample.
+    Lsm6ds3FifoStatus fifoStatus;
+    do {
+        if (Lsm6ds3_ReadFifo(&lsm6ds3, lsm6ds3Samples,
+                             sizeof(lsm6ds3Samples) / sizeof(lsm6ds3Samples[0]),
+                             &fifoStatus) != 0) {
+            return -1;
         }
 
-        // DocID026899 Rev 10, S4.1, Mechanical characteristics
-        // These constants are specific to LA_So where FS = +/-4g, as set in CTRL1_X.
-        double g = (zRaw * 0.122) / 1000.0;
-        Log_Debug("INFO: %d: vertical acceleration: %.2lfg\n", iter, g);
+        drainResult.overrun |= fifoStatus.overrun;
+
+        Lsm6ds3_ConvertBlock(&lsm6ds3Scale, lsm6ds3Samples, fifoStatus.samplesRead,
+                             lsm6ds3FixedSamples);
+        for (size_t i = 0; i < fifoStatus.samplesRead; ++i) {
+            const Lsm6ds3FixedSample *sample = &lsm6ds3FixedSamples[i];
+            drainResult.sums[0] += sample->gyroX;
+            drainResult.sums[1] += sample->gyroY;
+            drainResult.sums[2] += sample->gyroZ;
+            drainResult.sums[3] += sample->accelX;
+            drainResult.sums[4] += sample->accelY;
+            drainResult.sums[5] += sample->accelZ;
+        }
+        drainResult.sampleCount += fifoStatus.samplesRead;
+    } while (fifoStatus.samplesRemaining > 0);
+
+    return 0;
+}
+
+/// <summary>
+///     Print the average of the samples which the drain collected.
+/// </summary>
+static void DrainFifoCompletionHandler(I2cBusTransaction *transaction)
+{
+    static int iter = 1;
+
+    if (transaction->result != 0) {
+        terminationRequired = true;
+        return;
+    }
+
+    if (drainResult.overrun) {
+        Log_Debug("WARNING: %d: LSM6DS3 FIFO overran; samples were lost.\n", iter);
+    }
+
+    const int64_t *sums = drainResult.sums;
+    if (drainResult.sampleCount == 0) {
+        Log_Debug("INFO: %d: No accelerometer data.\n", iter);
+    } else {
+        int64_t n = (int64_t)drainResult.sampleCount;
+        Log_Debug("INFO: %d: %zu samples, vertical acceleration: %.2lfg\n", iter,
+                  drainResult.sampleCount, FixedToDouble(sums[5] / n));
+        Log_Debug("INFO: %d: acceleration (%.2lf, %.2lf, %.2lf)g, "
+                  "angular rate (%.1lf, %.1lf, %.1lf)dps\n",
+                  iter, FixedToDouble(sums[3] / n), FixedToDouble(sums[4] / n),
+                  FixedToDouble(sums[5] / n), FixedToDouble(sums[0] / n),
+                  FixedToDouble(sums[1] / n), FixedToDouble(sums[2] / n));
     }
 
     ++iter;
 }
 
+/// <summary>
+///     Convert a fixed-point value from <see cref="Lsm6ds3_ConvertBlock" /> to a double, to
+///     display it. Only the averages are converted, rather than every sample.
+/// </summary>
+static double FixedToDouble(int64_t value)
+{
+    return (double)value / (1 << LSM6DS3_FIXED_FRACTION_BITS);
+}
+
 // Demonstrates three ways of reading data from the attached device.
 // This also works as a smoke test to ensure the Azure Sphere can talk to the I2C device.
 static int ReadWhoAmI(void)
@@ -194,82 +330,26 @@ static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t ac
 }
 
 /// <summary>
-///     Resets the accelerometer and samples the vertical acceleration.
-/// </summary>
-/// <returns>0 on success, or -1 on failure</returns>
-static int ResetAndSampleLsm6ds3(void)
-{
-    // Reset device to put registers into default state.
-    // DocID026899 Rev 10, S9.14, CTRL3_C (12h); [0] = SW_RESET
-    static const uint8_t ctrl3cRegId = 0x12;
-    const uint8_t resetCommand[] = {ctrl3cRegId, 0x01};
-    ssize_t transferredBytes =
-        I2CMaster_Write(i2cFd, lsm6ds3Address, resetCommand, sizeof(resetCommand));
-    if (!CheckTransferSize("I2CMaster_Write (CTRL3_C)", sizeof(resetCommand), transferredBytes)) {
-        return -1;
-    }
-
-    // Wait for device to come out of reset.
-    uint8_t ctrl3c;
-    do {
-        transferredBytes = I2CMaster_WriteThenRead(i2cFd, lsm6ds3Address, &ctrl3cRegId,
-                                                   sizeof(ctrl3cRegId), &ctrl3c, sizeof(ctrl3c));
-    } while (!(transferredBytes == (sizeof(ctrl3cRegId) + sizeof(ctrl3c)) && (ctrl3c & 0x1) == 0));
-
-    // Use sample range +/- 4g, with 12.5Hz frequency.
-    // DocID026899 Rev 10, S9.12, CTRL1_XL (10h)
-    static const uint8_t setCtrl1XlCommand[] = {0x10, 0x18};
-    transferredBytes =
-        I2CMaster_Write(i2cFd, lsm6ds3Address, setCtrl1XlCommand, sizeof(setCtrl1XlCommand));
-    if (!CheckTransferSize("I2CMaster_Write (CTRL1_XL)", sizeof(setCtrl1XlCommand),
-                           transferredBytes)) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/// <summary>
-///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
+///     Startup step: opens the I2C master and configures it for the LSM6DS3.
 /// </summary>
-/// <returns>0 on success, or -1 on failure</returns>
-static int InitPeripheralsAndHandlers(void)
+static StartupStepResult OpenI2cStepHandler(StartupStep *step)
 {
-    struct sigaction action;
-    memset(&action, 0, sizeof(struct sigaction));
-    action.sa_handler = TerminationHandler;
-    sigaction(SIGTERM, &action, NULL);
-
-    epollFd = CreateEpollFd();
-    if (epollFd < 0) {
-        return -1;
-    }
-
-    // Print accelerometer data every second.
-    struct timespec accelReadPeriod = {.tv_sec = 1, .tv_nsec = 0};
-    // event handler data structures. Only the event handler field needs to be populated.
-    static EventData accelEventData = {.eventHandler = &AccelTimerEventHandler};
-    accelTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &accelReadPeriod, &accelEventData, EPOLLIN);
-    if (accelTimerFd < 0) {
-        return -1;
-    }
-
     i2cFd = I2CMaster_Open(SAMPLE_LSM6DS3_I2C);
     if (i2cFd < 0) {
         Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
-        return -1;
+        return StartupStepResult_Failed;
     }
 
     int result = I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_STANDARD);
     if (result != 0) {
         Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
-        return -1;
+        return StartupStepResult_Failed;
     }
 
     result = I2CMaster_SetTimeout(i2cFd, 100);
     if (result != 0) {
         Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
-        return -1;
+        return StartupStepResult_Failed;
     }
 
     // This default address is used for POSIX read and write calls.  The AppLibs APIs take a target
@@ -278,20 +358,122 @@ static int InitPeripheralsAndHandlers(void)
     if (result != 0) {
         Log_Debug("ERROR: I2CMaster_SetDefaultTargetAddress: errno=%d (%s)\n", errno,
                   strerror(errno));
+        return StartupStepResult_Failed;
+    }
+
+    return StartupStepResult_Done;
+}
+
+/// <summary>
+///     Startup step: checks that the device on the bus is an LSM6DS3.
+/// </summary>
+static StartupStepResult CheckWhoAmIStepHandler(StartupStep *step)
+{
+    return ReadWhoAmI() == 0 ? StartupStepResult_Done : StartupStepResult_Failed;
+}
+
+/// <summary>
+///     Startup step: resets the accelerometer, and starts sampling both sensors into the FIFO.
+///     The step is called again every retryDelay until the device has come out of reset.
+/// </summary>
+static StartupStepResult ResetLsm6ds3StepHandler(StartupStep *step)
+{
+    if (step->calls == 0) {
+        lsm6ds3Bus.i2cFd = i2cFd;
+        Lsm6ds3_Init(&lsm6ds3, &Lsm6ds3I2cTransportOps, &lsm6ds3Bus);
+
+        // Reset device to put registers into default state.
+        return Lsm6ds3_StartReset(&lsm6ds3) == 0 ? StartupStepResult_Pending
+                                                 : StartupStepResult_Failed;
+    }
+
+    if (Lsm6ds3_IsResetComplete(&lsm6ds3) != 1) {
+        if (step->calls >= maxResetChecks) {
+            Log_Debug("ERROR: LSM6DS3 did not come out of reset.\n");
+            return StartupStepResult_Failed;
+        }
+        return StartupStepResult_Pending;
+    }
+
+    // Start both sensors, and collect their samples in the FIFO.
+    if (Lsm6ds3_StartFifo(&lsm6ds3, &lsm6ds3Config) != 0) {
+        return StartupStepResult_Failed;
+    }
+    Lsm6ds3_InitScale(&lsm6ds3Scale, lsm6ds3Config.accelRange, lsm6ds3Config.gyroRange);
+
+    if (Lsm6ds3_EnableFifoWatermarkInterrupt(&lsm6ds3) != 0) {
+        return StartupStepResult_Failed;
+    }
+
+    return StartupStepResult_Done;
+}
+
+/// <summary>
+///     Startup step: opens the GPIO which INT1 is connected to.
+/// </summary>
+static StartupStepResult OpenInt1StepHandler(StartupStep *step)
+{
+    int1GpioFd = GPIO_OpenAsInput(SAMPLE_LSM6DS3_INT1);
+    if (int1GpioFd < 0) {
+        Log_Debug("ERROR: Could not open LSM6DS3 INT1 GPIO: %s (%d).\n", strerror(errno), errno);
+        return StartupStepResult_Failed;
+    }
+    return StartupStepResult_Done;
+}
+
+/// <summary>
+///     Starts the bus scheduler and sampling INT1 once every startup step has finished, or
+///     exits if one failed.
+/// </summary>
+static void StartupFinishedHandler(StartupSequence *sequence, int result)
+{
+    StartupSequence_LogTrace(sequence);
+    if (result != 0 || I2cBusScheduler_Init(&i2cBusScheduler, epollFd, i2cFd) != 0) {
+        terminationRequired = true;
+        return;
+    }
+    I2cBusScheduler_AddDevice(&i2cBusScheduler, &lsm6ds3BusDevice);
+
+    if (SetTimerFdToPeriod(accelTimerFd, &accelReadPeriod) != 0) {
+        terminationRequired = true;
+    }
+}
+
+/// <summary>
+///     Set up SIGTERM termination handler, and start the steps which initialize the peripherals.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitPeripheralsAndHandlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    epollFd = CreateEpollFd();
+    if (epollFd < 0) {
         return -1;
     }
 
-    result = ReadWhoAmI();
-    if (result != 0) {
+    if (StartupSequence_Init(&startupSequence, epollFd, &StartupFinishedHandler) != 0) {
         return -1;
     }
 
-    result = ResetAndSampleLsm6ds3();
-    if (result != 0) {
+    // The timer is started when the sensor is sampling. Only the event handler field of its
+    // event data needs to be populated.
+    static EventData accelEventData = {.eventHandler = &AccelTimerEventHandler};
+    static const struct timespec accelTimerDisabled = {0, 0};
+    accelTimerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &accelTimerDisabled, &accelEventData, EPOLLIN);
+    if (accelTimerFd < 0) {
         return -1;
     }
 
-    return 0;
+    StartupSequence_AddStep(&startupSequence, &openI2cStep);
+    StartupSequence_AddStep(&startupSequence, &whoAmIStep);
+    StartupSequence_AddStep(&startupSequence, &resetStep);
+    StartupSequence_AddStep(&startupSequence, &int1Step);
+    return StartupSequence_Start(&startupSequence);
 }
 
 /// <summary>
@@ -300,8 +482,12 @@ static int InitPeripheralsAndHandlers(void)
 static void ClosePeripheralsAndHandlers(void)
 {
     Log_Debug("Closing file descriptors.\n");
+    // Stop the worker before the bus is closed.
+    I2cBusScheduler_Close(&i2cBusScheduler);
     CloseFdAndPrintError(i2cFd, "i2c");
+    CloseFdAndPrintError(int1GpioFd, "Int1Gpio");
     CloseFdAndPrintError(accelTimerFd, "accelTimer");
+    StartupSequence_Close(&startupSequence);
     CloseFdAndPrintError(epollFd, "Epoll");
 }
 
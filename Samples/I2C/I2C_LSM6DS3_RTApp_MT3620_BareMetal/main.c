@@ -0,0 +1,489 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-timer.h"
+#include "mt3620-uart-poll.h"
+#include "mt3620-i2c.h"
+#include "mt3620-intercore.h"
+#include "lsm6ds3.h"
+#include "lsm6ds3_convert.h"
+#include "imu_stream_messages.h"
+#include "motion-events.h"
+
+INTERCORE_DEFINE_RING_CODEC(ImuStreamSubscribe)
+INTERCORE_DEFINE_RING_CODEC(ImuSampleBlock)
+INTERCORE_DEFINE_RING_CODEC(ImuMotionSubscribe)
+INTERCORE_DEFINE_RING_CODEC(ImuMotionEvent)
+INTERCORE_DEFINE_RING_CODEC(ImuMotionSummary)
+
+extern uint32_t StackTop; // &StackTop == end of TCM
+
+static _Noreturn void DefaultExceptionHandler(void);
+
+static void HandleDrainTimerIrq(void);
+static int ReadLsm6ds3Registers(uint8_t firstRegId, void *data, size_t length);
+static int WriteLsm6ds3Registers(const uint8_t *command, size_t length);
+static int ConfigureLsm6ds3(void);
+static int DrainLsm6ds3Fifo(void);
+static void AddToSummary(const Lsm6ds3FixedSample *sample);
+static void PrintSummary(void);
+static void PollStreamSubscription(void);
+static void AddToStreamBlock(const Lsm6ds3Sample *sample);
+static void SendStreamBlock(void);
+static void HandleMotionSubscription(const ImuMotionSubscribe *subscribe);
+static void SendMotionEvent(const ImuMotionEvent *event);
+static void SendMotionSummary(const ImuMotionSummary *summary);
+static _Noreturn void RTCoreMain(void);
+
+// The LSM6DS3 is on ISU2, which must not be used by a high-level application at the same time.
+// SDO is tied to ground so the least significant bit of the address is zero.
+static const I2cIsu lsm6ds3Isu = I2cIsu2;
+static const uint8_t lsm6ds3Address = 0x6A;
+
+// DocID026899 Rev 10, S9, Register description.
+static const uint8_t fifoCtrl1RegId = 0x06;
+static const uint8_t whoAmIRegId = 0x0F;
+static const uint8_t ctrl1XlRegId = 0x10;
+static const uint8_t ctrl3cRegId = 0x12;
+static const uint8_t fifoStatus1RegId = 0x3A;
+static const uint8_t fifoDataOutLRegId = 0x3E;
+static const uint8_t expectedWhoAmI = 0x69;
+
+// Both sensors sample at 1.66kHz, into the LSM6DS3's FIFO. Each sample is 12 bytes, so at the
+// I2C fast-mode speed of 400kHz the samples take a little under half of the bus time.
+static const Lsm6ds3Odr sampleOdr = Lsm6ds3Odr_1_66kHz;
+static const Lsm6ds3AccelRange accelRange = Lsm6ds3AccelRange_4g;
+static const Lsm6ds3GyroRange gyroRange = Lsm6ds3GyroRange_245dps;
+#define SAMPLE_RATE_HZ 1666
+static Lsm6ds3Scale sampleScale;
+
+// The FIFO is drained every DRAIN_PERIOD_MS, from a hardware-reloaded timer, so about 17
+// samples are read each time. The FIFO holds 680 samples, so a late drain does not lose any.
+#define DRAIN_PERIOD_MS 10
+static volatile bool drainDue = false;
+
+// FIFO_STATUS2 (3Bh) flags; DIFF_FIFO[11:8] is in the low nibble.
+static const uint8_t fifoStatus2Overrun = 0x40;
+static const uint8_t fifoStatus2Empty = 0x10;
+#define WORDS_PER_SAMPLE (sizeof(Lsm6ds3Sample) / sizeof(int16_t))
+
+static uint64_t samplesRead = 0;
+static uint32_t overrunCount = 0;
+static uint32_t busErrorCount = 0;
+
+// A summary of each second of samples is printed over the debug UART. The sum is of the
+// fixed-point accelerations from Lsm6ds3_ConvertBlock.
+typedef struct {
+    uint32_t sampleCount;
+    int64_t accelZSum;
+    uint32_t maxDrainUs;
+} ImuSummary;
+static ImuSummary summary;
+
+// The samples are streamed, in blocks, to a high-level application which subscribes with an
+// ImuStreamSubscribe message.
+static BufferHeader *outbound, *inbound;
+static uint32_t sharedBufSize = 0;
+static bool intercoreAvailable = false;
+static bool streamEnabled = false;
+static uint8_t subscriberHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+static ImuSampleBlock streamBlock;
+static uint32_t nextBlockSequence = 0;
+static uint32_t lastDrainTimeUs = 0;
+
+// Motion events are detected here, from every sample, for a high-level application which
+// subscribes with an ImuMotionSubscribe message. Only the events and summaries are sent, so
+// the high-level application does not need the stream of samples.
+static bool motionEnabled = false;
+static MotionDetector motionDetector;
+static uint32_t nextMotionEventSequence = 0;
+static uint32_t nextMotionSummarySequence = 0;
+
+// ARM DDI0403E.d SB1.5.2-3
+// From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
+// value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
+// of 128 bytes.". The array is aligned in linker.ld, using the dedicated section ".vector_table".
+
+// The exception vector table contains a stack pointer, 15 exception handlers, and an entry for
+// each interrupt.
+#define INTERRUPT_COUNT 100 // from datasheet
+#define EXCEPTION_COUNT (16 + INTERRUPT_COUNT)
+#define INT_TO_EXC(i_) (16 + (i_))
+const uintptr_t ExceptionVectorTable[EXCEPTION_COUNT] __attribute__((section(".vector_table")))
+__attribute__((used)) = {
+    [0] = (uintptr_t)&StackTop,                // Main Stack Pointer (MSP)
+    [1] = (uintptr_t)RTCoreMain,               // Reset
+    [2] = (uintptr_t)DefaultExceptionHandler,  // NMI
+    [3] = (uintptr_t)DefaultExceptionHandler,  // HardFault
+    [4] = (uintptr_t)DefaultExceptionHandler,  // MPU Fault
+    [5] = (uintptr_t)DefaultExceptionHandler,  // Bus Fault
+    [6] = (uintptr_t)DefaultExceptionHandler,  // Usage Fault
+    [11] = (uintptr_t)DefaultExceptionHandler, // SVCall
+    [12] = (uintptr_t)DefaultExceptionHandler, // Debug monitor
+    [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
+    [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
+
+    [INT_TO_EXC(0)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(1)] = (uintptr_t)Gpt_HandleIrq1,
+    [INT_TO_EXC(2)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+
+static _Noreturn void DefaultExceptionHandler(void)
+{
+    for (;;) {
+        // empty.
+    }
+}
+
+// The drain itself runs in the main loop, so that the I2C transfers do not hold up other
+// interrupts.
+static void HandleDrainTimerIrq(void)
+{
+    drainDue = true;
+}
+
+// Read consecutive registers: write the first register address, then read with a repeated
+// start, in one transaction.
+static int ReadLsm6ds3Registers(uint8_t firstRegId, void *data, size_t length)
+{
+    return I2c_WriteThenRead(lsm6ds3Isu, lsm6ds3Address, &firstRegId, sizeof(firstRegId), data,
+                             length);
+}
+
+// Write consecutive registers. command[0] is the first register.
+static int WriteLsm6ds3Registers(const uint8_t *command, size_t length)
+{
+    return I2c_Write(lsm6ds3Isu, lsm6ds3Address, command, length);
+}
+
+// Reset the LSM6DS3 and start both sensors sampling into the FIFO in continuous mode. This uses
+// the same register settings as the shared LSM6DS3 driver in common/lsm6ds3.
+static int ConfigureLsm6ds3(void)
+{
+    uint8_t whoAmI;
+    if (ReadLsm6ds3Registers(whoAmIRegId, &whoAmI, sizeof(whoAmI)) == -1 ||
+        whoAmI != expectedWhoAmI) {
+        Uart_WriteStringPoll("ERROR: Unexpected WHO_AM_I value\r\n");
+        return -1;
+    }
+
+    // DocID026899 Rev 10, S9.14, CTRL3_C (12h); [0] = SW_RESET
+    const uint8_t resetCommand[] = {ctrl3cRegId, 0x01};
+    if (WriteLsm6ds3Registers(resetCommand, sizeof(resetCommand)) == -1) {
+        return -1;
+    }
+
+    // The device may not respond while it resets, so failed reads are retried.
+    bool reset = false;
+    for (int attempt = 0; attempt < 1000 && !reset; ++attempt) {
+        uint8_t ctrl3c;
+        reset = ReadLsm6ds3Registers(ctrl3cRegId, &ctrl3c, sizeof(ctrl3c)) == 0 &&
+                (ctrl3c & 0x1) == 0;
+    }
+    if (!reset) {
+        Uart_WriteStringPoll("ERROR: LSM6DS3 did not come out of reset\r\n");
+        return -1;
+    }
+
+    // DocID026899 Rev 10, S9.12-13, CTRL1_XL (10h) and CTRL2_G (11h)
+    const uint8_t ctrlCommand[] = {ctrl1XlRegId, (uint8_t)((sampleOdr << 4) | (accelRange << 2)),
+                                   (uint8_t)((sampleOdr << 4) | (gyroRange << 2))};
+    if (WriteLsm6ds3Registers(ctrlCommand, sizeof(ctrlCommand)) == -1) {
+        return -1;
+    }
+
+    // DocID026899 Rev 10, S9.3-7, FIFO_CTRL1 (06h) to FIFO_CTRL5 (0Ah)
+    // FIFO_CTRL1-2: no watermark, because the FIFO is drained on a timer.
+    // FIFO_CTRL3: DEC_FIFO_GYRO = DEC_FIFO_XL = 1, store every sample of both sensors.
+    // FIFO_CTRL4: no third or fourth data set.
+    // FIFO_CTRL5: ODR_FIFO = the sensor rate, continuous mode.
+    const uint8_t fifoCommand[] = {fifoCtrl1RegId, 0, 0, (1 << 3) | 1, 0,
+                                   (uint8_t)((sampleOdr << 3) | 0x6)};
+    if (WriteLsm6ds3Registers(fifoCommand, sizeof(fifoCommand)) == -1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Read every complete sample from the FIFO: the FIFO status in one transaction, and then the
+// samples in bursts.
+static int DrainLsm6ds3Fifo(void)
+{
+    lastDrainTimeUs = Gpt_GetMicroseconds();
+
+    // DocID026899 Rev 10, S9.51-54, FIFO_STATUS1 (3Ah) to FIFO_STATUS4 (3Dh)
+    uint8_t fifoStatus[4];
+    if (ReadLsm6ds3Registers(fifoStatus1RegId, fifoStatus, sizeof(fifoStatus)) == -1) {
+        return -1;
+    }
+
+    size_t unreadWords = fifoStatus[0] | ((fifoStatus[1] & 0x0F) << 8);
+    if (unreadWords == 0 && (fifoStatus[1] & fifoStatus2Empty) == 0) {
+        // DIFF_FIFO is 12 bits wide, so a full FIFO reads as zero.
+        unreadWords = LSM6DS3_FIFO_WORDS;
+    }
+    if ((fifoStatus[1] & fifoStatus2Overrun) != 0) {
+        ++overrunCount;
+    }
+
+    // FIFO_PATTERN is the position within a sample of the next word. It is only non-zero if
+    // the FIFO overran or a failed read stopped part way through a sample, so discard words up
+    // to the start of the next sample.
+    size_t pattern = fifoStatus[2] | ((fifoStatus[3] & 0x03) << 8);
+    if (pattern != 0) {
+        size_t skipWords = WORDS_PER_SAMPLE - pattern;
+        if (skipWords > unreadWords) {
+            return 0;
+        }
+
+        int16_t discard[WORDS_PER_SAMPLE];
+        if (ReadLsm6ds3Registers(fifoDataOutLRegId, discard, skipWords * sizeof(int16_t)) ==
+            -1) {
+            return -1;
+        }
+        unreadWords -= skipWords;
+    }
+
+    // The FIFO words are little-endian, as is the MT3620, so they are read straight into the
+    // samples.
+    size_t samplesToRead = unreadWords / WORDS_PER_SAMPLE;
+    while (samplesToRead > 0) {
+        static Lsm6ds3Sample samples[LSM6DS3_FIFO_BURST_SAMPLES];
+        static Lsm6ds3FixedSample convertedSamples[LSM6DS3_FIFO_BURST_SAMPLES];
+        size_t burst =
+            samplesToRead < LSM6DS3_FIFO_BURST_SAMPLES ? samplesToRead : LSM6DS3_FIFO_BURST_SAMPLES;
+        if (ReadLsm6ds3Registers(fifoDataOutLRegId, samples, burst * sizeof(Lsm6ds3Sample)) ==
+            -1) {
+            return -1;
+        }
+
+        // The whole burst is converted at once, with the DSP extension's halfword multiplies.
+        Lsm6ds3_ConvertBlock(&sampleScale, samples, burst, convertedSamples);
+        if (motionEnabled) {
+            MotionDetector_ProcessBlock(&motionDetector, convertedSamples, burst, samplesRead);
+        }
+        for (size_t i = 0; i < burst; ++i) {
+            AddToSummary(&convertedSamples[i]);
+            AddToStreamBlock(&samples[i]);
+            ++samplesRead;
+        }
+        samplesToRead -= burst;
+    }
+
+    uint32_t drainUs = Gpt_GetMicroseconds() - lastDrainTimeUs;
+    if (drainUs > summary.maxDrainUs) {
+        summary.maxDrainUs = drainUs;
+    }
+    return 0;
+}
+
+static void AddToSummary(const Lsm6ds3FixedSample *sample)
+{
+    summary.accelZSum += sample->accelZ;
+    if (++summary.sampleCount == SAMPLE_RATE_HZ) {
+        PrintSummary();
+        summary = (ImuSummary){0};
+    }
+}
+
+// Print the mean Z acceleration in mg, and how long the longest drain took. The drain time
+// shows how much of each drain period the bus is busy.
+static void PrintSummary(void)
+{
+    int64_t meanMilliG = (summary.accelZSum * 1000 / (int64_t)summary.sampleCount) >>
+                         LSM6DS3_FIXED_FRACTION_BITS;
+    Uart_WriteStringPoll("Accel Z ");
+    Uart_WriteIntegerPoll((int)meanMilliG);
+    Uart_WriteStringPoll(" mg (samples ");
+    Uart_WriteIntegerPoll((int)summary.sampleCount);
+    Uart_WriteStringPoll(", max drain ");
+    Uart_WriteIntegerPoll((int)summary.maxDrainUs);
+    Uart_WriteStringPoll(" us, overruns ");
+    Uart_WriteIntegerPoll((int)overrunCount);
+    Uart_WriteStringPoll(", bus errors ");
+    Uart_WriteIntegerPoll((int)busErrorCount);
+    Uart_WriteStringPoll(")\r\n");
+}
+
+// Start or stop the stream or motion detection when the high-level application sends a
+// subscription.
+static void PollStreamSubscription(void)
+{
+    IntercoreCursor readCursor;
+    if (BeginDequeue(&readCursor, outbound, inbound, sharedBufSize) == -1) {
+        return;
+    }
+
+    IntercoreBlock block;
+    while (PeekNextBlock(&readCursor, &block) == 0) {
+        uint16_t typeId;
+        uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+        ImuStreamSubscribe subscribe;
+        ImuMotionSubscribe motionSubscribe;
+        if (IsTypedMessage(&block, &typeId) && typeId == ImuMotionSubscribe_TypeId &&
+            ImuMotionSubscribe_Decode(&block, messageHeader, &motionSubscribe) == 0) {
+            __builtin_memcpy(subscriberHeader, messageHeader, sizeof(subscriberHeader));
+            HandleMotionSubscription(&motionSubscribe);
+            continue;
+        }
+        if (!IsTypedMessage(&block, &typeId) || typeId != ImuStreamSubscribe_TypeId ||
+            ImuStreamSubscribe_Decode(&block, messageHeader, &subscribe) == -1) {
+            Uart_WriteStringPoll("Discarding unexpected message\r\n");
+            continue;
+        }
+
+        // Send the blocks to the application which subscribed, starting with a new block.
+        __builtin_memcpy(subscriberHeader, messageHeader, sizeof(subscriberHeader));
+        streamEnabled = subscribe.enable != 0;
+        streamBlock.sampleCount = 0;
+        Uart_WriteStringPoll(streamEnabled ? "Stream started\r\n" : "Stream stopped\r\n");
+    }
+
+    CommitDequeue(&readCursor);
+}
+
+// Add a sample to the block which is being filled, and send the block once it is full.
+static void AddToStreamBlock(const Lsm6ds3Sample *sample)
+{
+    if (!streamEnabled) {
+        return;
+    }
+
+    if (streamBlock.sampleCount == 0) {
+        streamBlock.firstSampleIndex = samplesRead;
+        streamBlock.readTimeUs = lastDrainTimeUs;
+    }
+
+    // The block is packed, so its values are assigned individually rather than through a
+    // pointer.
+    size_t n = streamBlock.sampleCount++;
+    streamBlock.samples[n][0] = sample->gyroX;
+    streamBlock.samples[n][1] = sample->gyroY;
+    streamBlock.samples[n][2] = sample->gyroZ;
+    streamBlock.samples[n][3] = sample->accelX;
+    streamBlock.samples[n][4] = sample->accelY;
+    streamBlock.samples[n][5] = sample->accelZ;
+
+    if (streamBlock.sampleCount == IMU_STREAM_BLOCK_SAMPLE_COUNT) {
+        SendStreamBlock();
+    }
+}
+
+// Write the full block directly into the shared buffer. If the high-level application has not
+// kept up, the block is dropped rather than holding up sampling, and the gap in the sequence
+// numbers tells the high-level application.
+static void SendStreamBlock(void)
+{
+    streamBlock.sequence = nextBlockSequence++;
+    streamBlock.sampleRateHz = SAMPLE_RATE_HZ;
+    streamBlock.accelRange = (uint8_t)accelRange;
+    streamBlock.gyroRange = (uint8_t)gyroRange;
+    streamBlock.overrunCount = overrunCount;
+
+    IntercoreCursor writeCursor;
+    if (BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == 0 &&
+        ImuSampleBlock_Enqueue(&writeCursor, subscriberHeader, &streamBlock) == 0) {
+        CommitEnqueue(&writeCursor);
+    }
+
+    streamBlock.sampleCount = 0;
+}
+
+// Start the detectors from their initial state, or stop them. A subscription which is not
+// valid is ignored.
+static void HandleMotionSubscription(const ImuMotionSubscribe *subscribe)
+{
+    if (subscribe->enable == 0) {
+        motionEnabled = false;
+        Uart_WriteStringPoll("Motion detection stopped\r\n");
+        return;
+    }
+
+    if (MotionDetector_Configure(&motionDetector, subscribe, SAMPLE_RATE_HZ, SendMotionEvent,
+                                 SendMotionSummary) == -1) {
+        Uart_WriteStringPoll("Discarding invalid motion subscription\r\n");
+        return;
+    }
+    motionEnabled = true;
+    Uart_WriteStringPoll("Motion detection started\r\n");
+}
+
+// Events and summaries are written directly into the shared buffer, as the blocks are, and are
+// dropped if the high-level application has not kept up.
+static void SendMotionEvent(const ImuMotionEvent *event)
+{
+    ImuMotionEvent message = *event;
+    message.sequence = nextMotionEventSequence++;
+    message.readTimeUs = lastDrainTimeUs;
+
+    IntercoreCursor writeCursor;
+    if (BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == 0 &&
+        ImuMotionEvent_Enqueue(&writeCursor, subscriberHeader, &message) == 0) {
+        CommitEnqueue(&writeCursor);
+    }
+}
+
+static void SendMotionSummary(const ImuMotionSummary *summary)
+{
+    ImuMotionSummary message = *summary;
+    message.sequence = nextMotionSummarySequence++;
+    message.overrunCount = overrunCount;
+
+    IntercoreCursor writeCursor;
+    if (BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == 0 &&
+        ImuMotionSummary_Enqueue(&writeCursor, subscriberHeader, &message) == 0) {
+        CommitEnqueue(&writeCursor);
+    }
+}
+
+static _Noreturn void RTCoreMain(void)
+{
+    // SCB->VTOR = ExceptionVectorTable
+    WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
+
+    Uart_Init();
+    Uart_WriteStringPoll("--------------------------------\r\n");
+    Uart_WriteStringPoll("I2C_LSM6DS3_RTApp_MT3620_BareMetal\r\n");
+    Uart_WriteStringPoll("App built on: " __DATE__ ", " __TIME__ "\r\n");
+
+    Gpt_Init();
+
+    // The samples are still summarized if the shared buffers are unusable, but cannot be
+    // streamed.
+    intercoreAvailable = GetIntercoreBuffers(&outbound, &inbound, &sharedBufSize) == 0;
+    if (!intercoreAvailable) {
+        Uart_WriteStringPoll("WARNING: Unable to get shared buffers; not streaming\r\n");
+    }
+
+    if (I2c_Init(lsm6ds3Isu, I2C_BUS_SPEED_FAST) == -1 || ConfigureLsm6ds3() == -1) {
+        Uart_WriteStringPoll("ERROR: Unable to configure the LSM6DS3\r\n");
+        for (;;) {
+            // empty.
+        }
+    }
+    Lsm6ds3_InitScale(&sampleScale, accelRange, gyroRange);
+
+    Gpt_LaunchPeriodicTimerMs(TimerGpt0, DRAIN_PERIOD_MS, HandleDrainTimerIrq);
+
+    for (;;) {
+        __asm__("wfi");
+
+        if (intercoreAvailable) {
+            PollStreamSubscription();
+        }
+
+        if (drainDue) {
+            drainDue = false;
+            // A failed transfer loses the samples which it was reading, but the FIFO keeps
+            // the rest, and the pattern realigns the next drain.
+            if (DrainLsm6ds3Fifo() == -1) {
+                ++busErrorCount;
+            }
+        }
+    }
+}
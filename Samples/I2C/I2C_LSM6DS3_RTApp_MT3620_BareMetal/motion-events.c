@@ -0,0 +1,287 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "motion-events.h"
+
+// Once a motion event has been detected, the magnitude must stay within the threshold for this
+// long before another one is detected, so that one movement is reported once.
+#define MOTION_HOLDOFF_MS 500
+
+// Taps which follow the previous one within this time are ignored, so that the ringing of one
+// tap is not reported as several.
+#define TAP_QUIET_MS 100
+
+// Gravity is filtered with a time constant of 2^ORIENTATION_FILTER_SHIFT samples, about 80ms at
+// 1.66kHz, so that vibration does not change the orientation. An axis must then carry at least
+// ORIENTATION_MIN_MILLIG of gravity, so that a tilt between two axes keeps the previous
+// orientation.
+#define ORIENTATION_FILTER_SHIFT 7
+#define ORIENTATION_MIN_MILLIG 700
+
+#define ONE_G_MILLIG 1000
+
+static uint32_t MillisecondsToSamples(uint32_t ms, uint32_t sampleRateHz)
+{
+    return ms * sampleRateHz / 1000;
+}
+
+// Bit-by-bit integer square root, which is only used for the values which are reported.
+static uint32_t SquareRoot(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1u << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+static void ResetSummary(MotionDetector *detector)
+{
+    detector->summary = (ImuMotionSummary){0};
+    for (size_t i = 0; i < 3; ++i) {
+        detector->summarySums[i] = 0;
+    }
+    detector->summaryMinSquared = UINT32_MAX;
+    detector->summaryMaxSquared = 0;
+}
+
+int MotionDetector_Configure(MotionDetector *detector, const ImuMotionSubscribe *subscribe,
+                             uint32_t sampleRateHz, MotionEventHandler eventHandler,
+                             MotionSummaryHandler summaryHandler)
+{
+    if (sampleRateHz == 0 || subscribe->freeFallMilliG >= ONE_G_MILLIG) {
+        return -1;
+    }
+
+    *detector = (MotionDetector){0};
+    detector->eventHandler = eventHandler;
+    detector->summaryHandler = summaryHandler;
+
+    // A threshold beyond the range of the sensor can never be crossed, so the squared bound is
+    // limited to what fits in 32 bits.
+    uint32_t motion = subscribe->motionMilliG;
+    uint64_t above = (uint64_t)(ONE_G_MILLIG + motion) * (ONE_G_MILLIG + motion);
+    detector->motionEnabled = motion != 0;
+    detector->motionAboveSquared = above > UINT32_MAX ? UINT32_MAX : (uint32_t)above;
+    detector->motionBelowSquared =
+        motion < ONE_G_MILLIG ? (ONE_G_MILLIG - motion) * (ONE_G_MILLIG - motion) : 0;
+    detector->motionHoldoffSamples = MillisecondsToSamples(MOTION_HOLDOFF_MS, sampleRateHz);
+
+    detector->tapMilliG = subscribe->tapMilliG;
+    detector->tapQuietSamples = MillisecondsToSamples(TAP_QUIET_MS, sampleRateHz);
+
+    // Free fall is detected on the first sample after the time has passed, so a time which is
+    // shorter than one sample still needs one sample below the threshold.
+    if (subscribe->freeFallMilliG != 0 && subscribe->freeFallMs != 0) {
+        uint32_t freeFall = subscribe->freeFallMilliG;
+        detector->freeFallSquared = freeFall * freeFall;
+        detector->freeFallSamples = MillisecondsToSamples(subscribe->freeFallMs, sampleRateHz);
+        if (detector->freeFallSamples == 0) {
+            detector->freeFallSamples = 1;
+        }
+    }
+
+    if (subscribe->orientationMs != 0) {
+        detector->orientationSamples =
+            MillisecondsToSamples(subscribe->orientationMs, sampleRateHz);
+        if (detector->orientationSamples == 0) {
+            detector->orientationSamples = 1;
+        }
+    }
+
+    detector->summarySamples = MillisecondsToSamples(subscribe->summaryPeriodMs, sampleRateHz);
+    ResetSummary(detector);
+    return 0;
+}
+
+static void ReportEvent(MotionDetector *detector, ImuMotionEventType type, int32_t value,
+                        uint64_t sampleIndex)
+{
+    // The event is packed, so its values are assigned individually rather than through a
+    // pointer.
+    ImuMotionEvent event = {0};
+    event.sampleIndex = sampleIndex;
+    event.type = (uint8_t)type;
+    event.orientation = detector->orientation;
+    event.value = value;
+    detector->eventHandler(&event);
+
+    size_t index = (size_t)(type - ImuMotionEventType_Motion);
+    if (detector->summary.eventCounts[index] < UINT16_MAX) {
+        ++detector->summary.eventCounts[index];
+    }
+}
+
+// Find the face which gravity is nearest to, or keep the current orientation if gravity is not
+// clearly along one axis.
+static uint8_t FindOrientation(const MotionDetector *detector, const int32_t *gravity)
+{
+    size_t axis = 0;
+    int32_t largest = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        int32_t magnitude = gravity[i] < 0 ? -gravity[i] : gravity[i];
+        if (magnitude > largest) {
+            largest = magnitude;
+            axis = i;
+        }
+    }
+
+    if (largest < ORIENTATION_MIN_MILLIG) {
+        return detector->orientation;
+    }
+
+    // At rest, an axis reads +1 g when it points up.
+    return (uint8_t)(ImuOrientation_XUp + 2 * axis + (gravity[axis] < 0 ? 1 : 0));
+}
+
+static void DetectOrientation(MotionDetector *detector, const int32_t *milliG,
+                              uint64_t sampleIndex)
+{
+    int32_t gravity[3];
+    for (size_t i = 0; i < 3; ++i) {
+        // The filter holds gravity scaled by 2^ORIENTATION_FILTER_SHIFT, and starts from the
+        // first sample rather than from zero.
+        if (detector->hasPreviousSample) {
+            detector->gravityFilter[i] +=
+                milliG[i] - (detector->gravityFilter[i] >> ORIENTATION_FILTER_SHIFT);
+        } else {
+            detector->gravityFilter[i] = milliG[i] * (1 << ORIENTATION_FILTER_SHIFT);
+        }
+        gravity[i] = detector->gravityFilter[i] >> ORIENTATION_FILTER_SHIFT;
+    }
+
+    uint8_t candidate = FindOrientation(detector, gravity);
+    if (candidate == detector->orientation) {
+        detector->candidateSamples = 0;
+        return;
+    }
+    if (candidate != detector->candidateOrientation) {
+        detector->candidateOrientation = candidate;
+        detector->candidateSamples = 0;
+    }
+    if (++detector->candidateSamples >= detector->orientationSamples) {
+        uint8_t previous = detector->orientation;
+        detector->orientation = candidate;
+        detector->candidateSamples = 0;
+        ReportEvent(detector, ImuMotionEventType_Orientation, previous, sampleIndex);
+    }
+}
+
+void MotionDetector_ProcessBlock(MotionDetector *detector, const Lsm6ds3FixedSample *samples,
+                                 size_t count, uint64_t firstSampleIndex)
+{
+    for (size_t n = 0; n < count; ++n) {
+        const Lsm6ds3FixedSample *sample = &samples[n];
+        uint64_t sampleIndex = firstSampleIndex + n;
+
+        // 1000 / 2^16 is 125 / 2^13, and 16 g in Q15.16 times 125 still fits in 32 bits.
+        int32_t milliG[3] = {(sample->accelX * 125) >> 13, (sample->accelY * 125) >> 13,
+                             (sample->accelZ * 125) >> 13};
+        uint32_t magnitudeSquared = 0;
+        for (size_t i = 0; i < 3; ++i) {
+            magnitudeSquared += (uint32_t)(milliG[i] * milliG[i]);
+        }
+
+        if (detector->motionEnabled) {
+            bool isOutside = magnitudeSquared > detector->motionAboveSquared ||
+                             magnitudeSquared < detector->motionBelowSquared;
+            if (!detector->inMotion && isOutside) {
+                detector->inMotion = true;
+                ReportEvent(detector, ImuMotionEventType_Motion,
+                            (int32_t)SquareRoot(magnitudeSquared), sampleIndex);
+            }
+            if (detector->inMotion) {
+                detector->motionQuietSamples = isOutside ? 0 : detector->motionQuietSamples + 1;
+                if (detector->motionQuietSamples >= detector->motionHoldoffSamples) {
+                    detector->inMotion = false;
+                }
+            }
+        }
+
+        if (detector->tapMilliG != 0 && detector->hasPreviousSample) {
+            int32_t largestChange = 0;
+            for (size_t i = 0; i < 3; ++i) {
+                int32_t change = milliG[i] - detector->previousMilliG[i];
+                change = change < 0 ? -change : change;
+                largestChange = change > largestChange ? change : largestChange;
+            }
+            if (detector->tapQuietRemaining > 0) {
+                --detector->tapQuietRemaining;
+            } else if (largestChange > detector->tapMilliG) {
+                detector->tapQuietRemaining = detector->tapQuietSamples;
+                ReportEvent(detector, ImuMotionEventType_Tap, largestChange, sampleIndex);
+            }
+        }
+
+        if (detector->freeFallSamples != 0) {
+            if (magnitudeSquared < detector->freeFallSquared) {
+                if (detector->freeFallCount == 0 ||
+                    magnitudeSquared < detector->freeFallMinSquared) {
+                    detector->freeFallMinSquared = magnitudeSquared;
+                }
+                if (++detector->freeFallCount == detector->freeFallSamples) {
+                    ReportEvent(detector, ImuMotionEventType_FreeFall,
+                                (int32_t)SquareRoot(detector->freeFallMinSquared), sampleIndex);
+                }
+            } else {
+                detector->freeFallCount = 0;
+            }
+        }
+
+        if (detector->orientationSamples != 0) {
+            DetectOrientation(detector, milliG, sampleIndex);
+        }
+
+        for (size_t i = 0; i < 3; ++i) {
+            detector->previousMilliG[i] = milliG[i];
+        }
+        detector->hasPreviousSample = true;
+
+        if (detector->summarySamples == 0) {
+            continue;
+        }
+        if (detector->summary.sampleCount == 0) {
+            detector->summary.firstSampleIndex = sampleIndex;
+        }
+        for (size_t i = 0; i < 3; ++i) {
+            detector->summarySums[i] += milliG[i];
+        }
+        if (magnitudeSquared < detector->summaryMinSquared) {
+            detector->summaryMinSquared = magnitudeSquared;
+        }
+        if (magnitudeSquared > detector->summaryMaxSquared) {
+            detector->summaryMaxSquared = magnitudeSquared;
+        }
+        const int32_t rates[] = {sample->gyroX, sample->gyroY, sample->gyroZ};
+        for (size_t i = 0; i < 3; ++i) {
+            int32_t dps = (rates[i] < 0 ? -rates[i] : rates[i]) >> LSM6DS3_FIXED_FRACTION_BITS;
+            if (dps > detector->summary.maxAngularRateDps) {
+                detector->summary.maxAngularRateDps = (uint16_t)dps;
+            }
+        }
+
+        if (++detector->summary.sampleCount == detector->summarySamples) {
+            int32_t sampleCount = (int32_t)detector->summary.sampleCount;
+            detector->summary.meanMilliG[0] = (int16_t)(detector->summarySums[0] / sampleCount);
+            detector->summary.meanMilliG[1] = (int16_t)(detector->summarySums[1] / sampleCount);
+            detector->summary.meanMilliG[2] = (int16_t)(detector->summarySums[2] / sampleCount);
+            detector->summary.minMagnitudeMilliG =
+                (uint16_t)SquareRoot(detector->summaryMinSquared);
+            detector->summary.maxMagnitudeMilliG =
+                (uint16_t)SquareRoot(detector->summaryMaxSquared);
+            detector->summary.orientation = detector->orientation;
+            detector->summaryHandler(&detector->summary);
+            ResetSummary(detector);
+        }
+    }
+}
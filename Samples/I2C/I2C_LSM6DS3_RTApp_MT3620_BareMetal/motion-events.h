@@ -0,0 +1,95 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef MOTION_EVENTS_H
+#define MOTION_EVENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lsm6ds3_convert.h"
+#include "imu_stream_messages.h"
+
+/// <summary>
+/// Called from <see cref="MotionDetector_ProcessBlock" /> for each event which is detected. The
+/// sequence and readTimeUs members are left for the caller to fill in.
+/// </summary>
+typedef void (*MotionEventHandler)(const ImuMotionEvent *event);
+
+/// <summary>
+/// Called from <see cref="MotionDetector_ProcessBlock" /> at the end of each summary period. The
+/// sequence and overrunCount members are left for the caller to fill in.
+/// </summary>
+typedef void (*MotionSummaryHandler)(const ImuMotionSummary *summary);
+
+/// <summary>
+/// <para>State of the motion detectors. Initialize it with
+/// <see cref="MotionDetector_Configure" />. The members must not be modified by the
+/// caller.</para>
+/// <para>The thresholds are kept as squared magnitudes in mg^2, so that the magnitude of a
+/// sample is compared without a square root, and the times as numbers of samples.</para>
+/// </summary>
+typedef struct {
+    MotionEventHandler eventHandler;
+    MotionSummaryHandler summaryHandler;
+
+    bool motionEnabled;
+    uint32_t motionAboveSquared;
+    uint32_t motionBelowSquared;
+    uint32_t motionHoldoffSamples;
+    bool inMotion;
+    uint32_t motionQuietSamples;
+
+    int32_t tapMilliG;
+    uint32_t tapQuietSamples;
+    uint32_t tapQuietRemaining;
+    bool hasPreviousSample;
+    int32_t previousMilliG[3];
+
+    uint32_t freeFallSquared;
+    uint32_t freeFallSamples;
+    uint32_t freeFallCount;
+    uint32_t freeFallMinSquared;
+
+    uint32_t orientationSamples;
+    int32_t gravityFilter[3];
+    uint8_t orientation;
+    uint8_t candidateOrientation;
+    uint32_t candidateSamples;
+
+    uint32_t summarySamples;
+    ImuMotionSummary summary;
+    int64_t summarySums[3];
+    uint32_t summaryMinSquared;
+    uint32_t summaryMaxSquared;
+} MotionDetector;
+
+/// <summary>
+/// Set up and reset the detectors from a subscription, as described for
+/// <see cref="ImuMotionSubscribe" />.
+/// </summary>
+/// <param name="detector">The detectors to set up.</param>
+/// <param name="subscribe">The thresholds and times. The enable member is not used.</param>
+/// <param name="sampleRateHz">Output data rate of the samples which will be processed.</param>
+/// <param name="eventHandler">Called for each event.</param>
+/// <param name="summaryHandler">Called for each summary.</param>
+/// <returns>0 on success; -1 if the free-fall threshold is 1 g or more, so that a sensor at rest
+/// would be falling, or the sample rate is zero.</returns>
+int MotionDetector_Configure(MotionDetector *detector, const ImuMotionSubscribe *subscribe,
+                             uint32_t sampleRateHz, MotionEventHandler eventHandler,
+                             MotionSummaryHandler summaryHandler);
+
+/// <summary>
+/// Run the detectors over a block of consecutive samples, and call the handlers for the events
+/// and summaries which complete in it.
+/// </summary>
+/// <param name="detector">The detectors.</param>
+/// <param name="samples">Samples converted by <see cref="Lsm6ds3_ConvertBlock" />, oldest
+/// first.</param>
+/// <param name="count">Number of samples.</param>
+/// <param name="firstSampleIndex">Index of the first sample.</param>
+void MotionDetector_ProcessBlock(MotionDetector *detector, const Lsm6ds3FixedSample *samples,
+                                 size_t count, uint64_t firstSampleIndex);
+
+#endif // #ifndef MOTION_EVENTS_H
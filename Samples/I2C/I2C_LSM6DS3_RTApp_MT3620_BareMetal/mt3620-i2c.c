@@ -0,0 +1,178 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+#include "mt3620-timer.h"
+#include "mt3620-i2c.h"
+
+// Each ISU's registers are 64KB apart, and the I2C master registers are at offset 0x200.
+static const uintptr_t ISU_BASE = 0x38070000;
+static const uintptr_t ISU_STRIDE = 0x10000;
+static const size_t I2C_MASTER_OFFSET = 0x200;
+
+typedef enum {
+    I2C_MM_CNT_VAL_PHL = 0x04,
+    I2C_MM_CNT_VAL_PHH = 0x08,
+    I2C_MM_CNT_BYTE_VAL_PK0 = 0x14,
+    I2C_MM_CNT_BYTE_VAL_PK1 = 0x18,
+    I2C_MM_ID_CON0 = 0x20,
+    I2C_MM_PACK_CON0 = 0x28,
+    I2C_MM_ACK_VAL = 0x2C,
+    I2C_MM_CON0 = 0x30,
+    I2C_MM_FIFO_CON0 = 0x38,
+    I2C_MM_FIFO_DATA = 0x3C,
+    I2C_MM_FIFO_STATUS = 0x40
+} I2cReg;
+
+// The controller divides the 26MHz oscillator to make SCL.
+static const uint32_t I2C_CLOCK_HZ = 26000000;
+// I2C_MM_CNT_VAL_PHL and I2C_MM_CNT_VAL_PHH [7:0] = SCL low and high time, in clock cycles.
+static const uint32_t I2C_MAX_HALF_PERIOD = 0xFF;
+// The TX and RX FIFOs each hold this many bytes.
+static const uint32_t I2C_FIFO_SIZE = 8;
+// I2C_MM_CNT_BYTE_VAL_PKn [15:0] = number of bytes in packet n.
+static const size_t I2C_MAX_PACKET_LENGTH = 0xFFFF;
+
+// Allow for clock stretching, and for the controller's own overhead, on top of the time which
+// the bits take at the nominal bus speed.
+static const uint32_t I2C_TIMEOUT_MARGIN_US = 1000;
+
+static uint32_t busSpeeds[I2cIsu4 + 1];
+
+static inline uintptr_t I2cBase(I2cIsu isu)
+{
+    return ISU_BASE + ISU_STRIDE * (uintptr_t)isu + I2C_MASTER_OFFSET;
+}
+
+static inline uint32_t ReadI2cReg32(I2cIsu isu, I2cReg reg)
+{
+    return ReadReg32(I2cBase(isu), reg);
+}
+
+static inline void WriteI2cReg32(I2cIsu isu, I2cReg reg, uint32_t value)
+{
+    WriteReg32(I2cBase(isu), reg, value);
+}
+
+int I2c_Init(I2cIsu isu, uint32_t busSpeedHz)
+{
+    if (isu > I2cIsu4 || busSpeedHz == 0) {
+        return -1;
+    }
+
+    // Split each SCL period evenly between the low and high phases.
+    uint32_t halfPeriod = (I2C_CLOCK_HZ / busSpeedHz + 1) / 2;
+    if (halfPeriod < 2 || halfPeriod > I2C_MAX_HALF_PERIOD) {
+        return -1;
+    }
+
+    // I2C_MM_CON0[15] = 0 -> disable the master while it is configured.
+    WriteI2cReg32(isu, I2C_MM_CON0, 0);
+    WriteI2cReg32(isu, I2C_MM_CNT_VAL_PHL, halfPeriod - 1);
+    WriteI2cReg32(isu, I2C_MM_CNT_VAL_PHH, halfPeriod - 1);
+
+    // I2C_MM_FIFO_CON0[1:0] = 0b11 -> flush both FIFOs.
+    WriteI2cReg32(isu, I2C_MM_FIFO_CON0, 0x3);
+
+    // I2C_MM_CON0[15] = 1 -> enable the master.
+    WriteI2cReg32(isu, I2C_MM_CON0, UINT32_C(1) << 15);
+
+    busSpeeds[isu] = busSpeedHz;
+    return 0;
+}
+
+int I2c_WriteThenRead(I2cIsu isu, uint8_t address, const uint8_t *writeData, size_t writeLength,
+                      uint8_t *readData, size_t readLength)
+{
+    if ((writeLength == 0 && readLength == 0) || writeLength > I2C_MAX_PACKET_LENGTH ||
+        readLength > I2C_MAX_PACKET_LENGTH || address > 0x7F || isu > I2cIsu4 ||
+        busSpeeds[isu] == 0) {
+        return -1;
+    }
+
+    // The write and the read are each a packet. When there are both, the controller sends a
+    // repeated start between them.
+    uint32_t packetCount = 0;
+    uint32_t readPacketMask = 0;
+    if (writeLength > 0) {
+        WriteI2cReg32(isu, I2C_MM_CNT_BYTE_VAL_PK0, (uint32_t)writeLength);
+        ++packetCount;
+    }
+    if (readLength > 0) {
+        WriteI2cReg32(isu, packetCount == 0 ? I2C_MM_CNT_BYTE_VAL_PK0 : I2C_MM_CNT_BYTE_VAL_PK1,
+                      (uint32_t)readLength);
+        readPacketMask = UINT32_C(1) << packetCount;
+        ++packetCount;
+    }
+
+    // I2C_MM_ID_CON0[6:0] and [14:8] = device address for packets 0 and 1.
+    WriteI2cReg32(isu, I2C_MM_ID_CON0, ((uint32_t)address << 8) | address);
+    // I2C_MM_PACK_CON0[1:0] = number of packets minus one.
+    // I2C_MM_PACK_CON0[5:4] = 1 for each packet which is a read.
+    WriteI2cReg32(isu, I2C_MM_PACK_CON0, (packetCount - 1) | (readPacketMask << 4));
+
+    WriteI2cReg32(isu, I2C_MM_FIFO_CON0, 0x3);
+
+    // Prime the TX FIFO before starting, so the controller does not stall on the first byte.
+    size_t written = 0;
+    while (written < writeLength && written < I2C_FIFO_SIZE) {
+        WriteI2cReg32(isu, I2C_MM_FIFO_DATA, writeData[written++]);
+    }
+
+    // Each byte takes nine SCL cycles, including its acknowledge bit.
+    uint64_t transferBits = 9 * ((uint64_t)writeLength + readLength + 2);
+    uint32_t timeoutUs =
+        (uint32_t)((transferBits * 1000000) / busSpeeds[isu]) + I2C_TIMEOUT_MARGIN_US;
+    uint32_t startUs = Gpt_GetMicroseconds();
+
+    // I2C_MM_CON0[0] = 1 -> start the transfer. The bit clears itself when it finishes.
+    SetReg32(I2cBase(isu), I2C_MM_CON0, 0x1);
+
+    size_t received = 0;
+    bool finished = false;
+    while (!finished) {
+        // I2C_MM_FIFO_STATUS[3:0] = bytes in the TX FIFO, [7:4] = bytes in the RX FIFO.
+        uint32_t fifoStatus = ReadI2cReg32(isu, I2C_MM_FIFO_STATUS);
+        uint32_t txCount = fifoStatus & 0xF;
+        uint32_t rxCount = (fifoStatus >> 4) & 0xF;
+
+        while (written < writeLength && txCount < I2C_FIFO_SIZE) {
+            WriteI2cReg32(isu, I2C_MM_FIFO_DATA, writeData[written++]);
+            ++txCount;
+        }
+        while (received < readLength && rxCount > 0) {
+            readData[received++] = (uint8_t)ReadI2cReg32(isu, I2C_MM_FIFO_DATA);
+            --rxCount;
+        }
+
+        finished = (ReadI2cReg32(isu, I2C_MM_CON0) & 0x1) == 0;
+        if (!finished && Gpt_GetMicroseconds() - startUs > timeoutUs) {
+            // I2C_MM_CON0[0] = 0 -> abandon the transfer.
+            ClearReg32(I2cBase(isu), I2C_MM_CON0, 0x1);
+            return -1;
+        }
+    }
+
+    // Collect the bytes which arrived after the last check of the FIFO.
+    uint32_t rxCount = (ReadI2cReg32(isu, I2C_MM_FIFO_STATUS) >> 4) & 0xF;
+    while (received < readLength && rxCount-- > 0) {
+        readData[received++] = (uint8_t)ReadI2cReg32(isu, I2C_MM_FIFO_DATA);
+    }
+
+    // I2C_MM_ACK_VAL[15:0] = 1 for each byte which was not acknowledged.
+    uint32_t nacks = ReadI2cReg32(isu, I2C_MM_ACK_VAL) & 0xFFFF;
+    if (nacks != 0 || written != writeLength || received != readLength) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int I2c_Write(I2cIsu isu, uint8_t address, const uint8_t *data, size_t length)
+{
+    return I2c_WriteThenRead(isu, address, data, length, NULL, 0);
+}
@@ -0,0 +1,70 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef MT3620_I2C_H
+#define MT3620_I2C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+/// <para>Identifies an I2C master. Each ISU can be a UART, SPI master, I2C master or I2C
+/// slave, so the application must request the ISU with "I2cMaster" in its manifest, and it
+/// cannot be used by a high-level application at the same time.</para>
+/// </summary>
+typedef enum {
+    I2cIsu0 = 0,
+    I2cIsu1 = 1,
+    I2cIsu2 = 2,
+    I2cIsu3 = 3,
+    I2cIsu4 = 4
+} I2cIsu;
+
+/// <summary>Standard-mode bus speed, in Hz.</summary>
+#define I2C_BUS_SPEED_STANDARD 100000
+/// <summary>Fast-mode bus speed, in Hz.</summary>
+#define I2C_BUS_SPEED_FAST 400000
+/// <summary>Fast-mode plus bus speed, in Hz.</summary>
+#define I2C_BUS_SPEED_FAST_PLUS 1000000
+
+/// <summary>
+/// <para>Enable the I2C master on the supplied ISU, and set its bus speed.</para>
+/// <para>The driver polls the controller, so transfers are made from the caller's context and
+/// take a predictable time. It uses the microsecond counter, so call Gpt_Init before this
+/// function.</para>
+/// </summary>
+/// <param name="isu">Which ISU to use.</param>
+/// <param name="busSpeedHz">SCL frequency, such as <see cref="I2C_BUS_SPEED_FAST" />.</param>
+/// <returns>0 on success; -1 if the speed is not supported.</returns>
+int I2c_Init(I2cIsu isu, uint32_t busSpeedHz);
+
+/// <summary>
+/// <para>Write bytes to a device, then read bytes from it, with a repeated start and no stop in
+/// between. This is how registers are read from most devices: the write sends the register
+/// address, and the read returns consecutive registers.</para>
+/// <para>Either length can be zero, but not both. The transfer is made in one transaction,
+/// however long it is; the controller's FIFO is refilled and drained as it runs.</para>
+/// </summary>
+/// <param name="isu">The ISU, which <see cref="I2c_Init" /> has enabled.</param>
+/// <param name="address">7-bit device address.</param>
+/// <param name="writeData">Bytes to write.</param>
+/// <param name="writeLength">Number of bytes to write.</param>
+/// <param name="readData">Receives the bytes which are read.</param>
+/// <param name="readLength">Number of bytes to read.</param>
+/// <returns>0 on success; -1 if the device did not acknowledge, or the transfer did not
+/// complete in time.</returns>
+int I2c_WriteThenRead(I2cIsu isu, uint8_t address, const uint8_t *writeData, size_t writeLength,
+                      uint8_t *readData, size_t readLength);
+
+/// <summary>
+/// Write bytes to a device in one transaction. This is equivalent to
+/// <see cref="I2c_WriteThenRead" /> with no bytes to read.
+/// </summary>
+/// <param name="isu">The ISU, which <see cref="I2c_Init" /> has enabled.</param>
+/// <param name="address">7-bit device address.</param>
+/// <param name="data">Bytes to write.</param>
+/// <param name="length">Number of bytes to write.</param>
+/// <returns>0 on success, or -1 on failure.</returns>
+int I2c_Write(I2cIsu isu, uint8_t address, const uint8_t *data, size_t length);
+
+#endif // #ifndef MT3620_I2C_H
@@ -0,0 +1,499 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This sample C application for Azure Sphere receives a stream of LSM6DS3 accelerometer and
+// gyroscope samples from the I2C_LSM6DS3_RTApp_MT3620_BareMetal real-time capable application,
+// which reads the LSM6DS3 FIFO at 1.66kHz on a fixed schedule. That is a far higher rate than
+// I2C_LSM6DS3_HighLevelApp samples at, and the real-time core reads every sample.
+// By default, the real-time core detects motion events from the samples itself, and only sends
+// the events and a summary every few seconds, which are formatted as telemetry messages in the
+// same form as the AzureIoT sample sends to IoT Hub. With IMU_STREAM_SAMPLES, every sample is
+// also streamed; the samples arrive in blocks through the epoll loop, and every few seconds the
+// mean of each axis, and the health of the stream, are sent as telemetry.
+//
+// It uses the following Azure Sphere libraries
+// - log (messages shown in Visual Studio's Device Output window during debugging);
+// - application (establish a connection with a real-time capable application).
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "intercore_channel.h"
+#include "lsm6ds3.h"
+#include "lsm6ds3_convert.h"
+#include "imu_stream_messages.h"
+
+INTERCORE_CHANNEL_DEFINE_CODEC(ImuStreamSubscribe)
+INTERCORE_CHANNEL_DEFINE_CODEC(ImuSampleBlock)
+INTERCORE_CHANNEL_DEFINE_CODEC(ImuMotionSubscribe)
+INTERCORE_CHANNEL_DEFINE_CODEC(ImuMotionEvent)
+INTERCORE_CHANNEL_DEFINE_CODEC(ImuMotionSummary)
+
+static int epollFd = -1;
+static int telemetryTimerFd = -1;
+static IntercoreChannel rtAppChannel = {.sockFd = -1};
+static volatile sig_atomic_t terminationRequired = false;
+
+static const char rtAppComponentId[] = "8527df08-e1e9-4338-bff7-54eac729b9b6";
+
+#define TELEMETRY_PERIOD_SECONDS 5
+
+/// <summary>
+///     Define this as 1 when compiling to stream every sample from the real-time core, as well
+///     as the motion events. The stream wakes this application about 100 times a second, while
+///     the events and summaries only wake it when something happens.
+/// </summary>
+#ifndef IMU_STREAM_SAMPLES
+#define IMU_STREAM_SAMPLES 0
+#endif
+
+// The motion detectors on the real-time core, and a summary for each telemetry period.
+static const ImuMotionSubscribe motionSubscription = {.enable = 1,
+                                                      .motionMilliG = 250,
+                                                      .tapMilliG = 1500,
+                                                      .freeFallMilliG = 300,
+                                                      .freeFallMs = 100,
+                                                      .orientationMs = 500,
+                                                      .summaryPeriodMs =
+                                                          TELEMETRY_PERIOD_SECONDS * 1000};
+
+// Motion events and summaries which were missing from their sequences, because the real-time
+// core dropped them when the shared buffer was full.
+static bool motionStarted = false;
+static uint32_t nextExpectedEventSequence = 0;
+static uint32_t nextExpectedSummarySequence = 0;
+static uint32_t lostMotionMessages = 0;
+
+/// <summary>
+///     Aggregates of the blocks which have arrived since telemetry was last sent.
+/// </summary>
+typedef struct {
+    /// <summary>Number of samples.</summary>
+    uint32_t sampleCount;
+    /// <summary>Sum of the fixed-point values of each axis, in the order of
+    /// <see cref="Lsm6ds3FixedSample" />.</summary>
+    int64_t axisSums[IMU_STREAM_AXIS_COUNT];
+    /// <summary>Number of blocks which were missing from the sequence.</summary>
+    uint32_t lostBlocks;
+    /// <summary>Number of FIFO overruns reported by the real-time capable application.
+    /// </summary>
+    uint32_t overruns;
+    /// <summary>Smallest and largest difference, in microseconds, between when a block
+    /// arrived and when its samples were read. The spread is the delivery jitter.</summary>
+    int64_t minDelayUs;
+    int64_t maxDelayUs;
+} ImuAggregate;
+
+static ImuAggregate aggregate;
+
+// State of the stream, which carries over between telemetry periods.
+static bool streamStarted = false;
+static uint32_t nextExpectedSequence = 0;
+static uint32_t lastOverrunCount = 0;
+// The real-time core's microsecond counter wraps around about every 71 minutes, so it is
+// extended to 64 bits by adding the difference between consecutive blocks.
+static uint32_t lastReadTimeUs = 0;
+static int64_t readTimeUs = 0;
+// Offset from the extended read times to CLOCK_MONOTONIC, taken from the first block. Only
+// the variation in the delay is meaningful, not its absolute value.
+static int64_t timestampOffsetUs = 0;
+
+static void TerminationHandler(int signalNumber);
+static void TelemetryTimerEventHandler(EventData *eventData);
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size);
+static void RTCoreTypedMessageHandler(IntercoreChannel *channel,
+                                      const IntercoreTypedHeader *header, const uint8_t *body,
+                                      size_t bodySize);
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error);
+static void HandleSampleBlock(const ImuSampleBlock *block);
+static void HandleMotionEvent(const ImuMotionEvent *event);
+static void HandleMotionSummary(const ImuMotionSummary *summary);
+static const char *OrientationName(uint8_t orientation);
+static void ResetAggregate(void);
+static double FixedToDouble(int64_t value);
+static void SendTelemetry(const char *message);
+static int64_t GetMonotonicTimeUs(void);
+static int InitHandlers(void);
+static void CloseHandlers(void);
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+    // Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Handle telemetry timer event: sends the aggregates of the samples which have arrived
+///     since the last event.
+/// </summary>
+static void TelemetryTimerEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(telemetryTimerFd) != 0) {
+        terminationRequired = true;
+        return;
+    }
+
+    if (aggregate.sampleCount == 0) {
+        Log_Debug("WARNING: No IMU samples have arrived from the real-time core.\n");
+        return;
+    }
+
+    double means[IMU_STREAM_AXIS_COUNT];
+    for (size_t i = 0; i < IMU_STREAM_AXIS_COUNT; ++i) {
+        means[i] = FixedToDouble(aggregate.axisSums[i] / (int64_t)aggregate.sampleCount);
+    }
+
+    static char message[384];
+    int len = snprintf(message, sizeof(message),
+                       "{ \"ImuAccelX\": \"%.3f\", \"ImuAccelY\": \"%.3f\", "
+                       "\"ImuAccelZ\": \"%.3f\", \"ImuGyroX\": \"%.2f\", "
+                       "\"ImuGyroY\": \"%.2f\", \"ImuGyroZ\": \"%.2f\", "
+                       "\"ImuSampleCount\": \"%u\", \"ImuLostBlocks\": \"%u\", "
+                       "\"ImuOverruns\": \"%u\", \"ImuJitterUs\": \"%lld\" }",
+                       means[3], means[4], means[5], means[0], means[1], means[2],
+                       aggregate.sampleCount, aggregate.lostBlocks, aggregate.overruns,
+                       (long long)(aggregate.maxDelayUs - aggregate.minDelayUs));
+    if (len > 0 && (size_t)len < sizeof(message)) {
+        SendTelemetry(message);
+    }
+
+    ResetAggregate();
+}
+
+/// <summary>
+///     Handle an untyped message from the real-time capable application, which only sends
+///     typed messages.
+/// </summary>
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size)
+{
+    Log_Debug("WARNING: Discarding untyped message of %zu bytes.\n", size);
+}
+
+/// <summary>
+///     Handle a typed message from the real-time capable application.
+/// </summary>
+static void RTCoreTypedMessageHandler(IntercoreChannel *channel,
+                                      const IntercoreTypedHeader *header, const uint8_t *body,
+                                      size_t bodySize)
+{
+    ImuSampleBlock block;
+    if (ImuSampleBlock_Decode(header, body, bodySize, &block)) {
+        HandleSampleBlock(&block);
+        return;
+    }
+
+    ImuMotionEvent event;
+    if (ImuMotionEvent_Decode(header, body, bodySize, &event)) {
+        HandleMotionEvent(&event);
+        return;
+    }
+
+    ImuMotionSummary summary;
+    if (ImuMotionSummary_Decode(header, body, bodySize, &summary)) {
+        HandleMotionSummary(&summary);
+        return;
+    }
+
+    Log_Debug("WARNING: Discarding typed message of type %u version %u.\n", header->typeId,
+              header->version);
+}
+
+/// <summary>
+///     Handle a failure of the connection to the real-time capable application.
+/// </summary>
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error)
+{
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Add a block of samples to the aggregates, and check it for lost blocks and overruns.
+/// </summary>
+static void HandleSampleBlock(const ImuSampleBlock *block)
+{
+    if (block->sampleCount == 0 || block->sampleCount > IMU_STREAM_BLOCK_SAMPLE_COUNT) {
+        Log_Debug("WARNING: Discarding block with %u samples.\n", block->sampleCount);
+        return;
+    }
+
+    int64_t nowUs = GetMonotonicTimeUs();
+
+    if (!streamStarted) {
+        streamStarted = true;
+        nextExpectedSequence = block->sequence;
+        lastOverrunCount = block->overrunCount;
+        lastReadTimeUs = block->readTimeUs;
+        timestampOffsetUs = nowUs;
+    }
+
+    // The sequence numbers are consecutive unless the real-time core dropped blocks because the
+    // shared buffer was full.
+    aggregate.lostBlocks += block->sequence - nextExpectedSequence;
+    nextExpectedSequence = block->sequence + 1;
+
+    aggregate.overruns += block->overrunCount - lastOverrunCount;
+    lastOverrunCount = block->overrunCount;
+
+    readTimeUs += (uint32_t)(block->readTimeUs - lastReadTimeUs);
+    lastReadTimeUs = block->readTimeUs;
+
+    int64_t delayUs = nowUs - readTimeUs - timestampOffsetUs;
+    if (aggregate.sampleCount == 0 || delayUs < aggregate.minDelayUs) {
+        aggregate.minDelayUs = delayUs;
+    }
+    if (aggregate.sampleCount == 0 || delayUs > aggregate.maxDelayUs) {
+        aggregate.maxDelayUs = delayUs;
+    }
+
+    // Each block carries its own ranges, so it is converted with its own scale. The raw
+    // values are in the order of Lsm6ds3Sample, and are copied out of the packed message so
+    // that they are aligned.
+    Lsm6ds3Scale scale;
+    Lsm6ds3_InitScale(&scale, (Lsm6ds3AccelRange)block->accelRange,
+                      (Lsm6ds3GyroRange)block->gyroRange);
+    Lsm6ds3Sample samples[IMU_STREAM_BLOCK_SAMPLE_COUNT];
+    Lsm6ds3FixedSample convertedSamples[IMU_STREAM_BLOCK_SAMPLE_COUNT];
+    _Static_assert(sizeof(samples) == sizeof(block->samples),
+                   "Lsm6ds3Sample does not match the stream layout");
+    memcpy(samples, block->samples, sizeof(samples));
+    Lsm6ds3_ConvertBlock(&scale, samples, block->sampleCount, convertedSamples);
+
+    for (size_t i = 0; i < block->sampleCount; ++i) {
+        const Lsm6ds3FixedSample *sample = &convertedSamples[i];
+        aggregate.axisSums[0] += sample->gyroX;
+        aggregate.axisSums[1] += sample->gyroY;
+        aggregate.axisSums[2] += sample->gyroZ;
+        aggregate.axisSums[3] += sample->accelX;
+        aggregate.axisSums[4] += sample->accelY;
+        aggregate.axisSums[5] += sample->accelZ;
+    }
+    aggregate.sampleCount += block->sampleCount;
+}
+
+/// <summary>
+///     Send a telemetry message for a motion event as soon as it arrives.
+/// </summary>
+static void HandleMotionEvent(const ImuMotionEvent *event)
+{
+    static const char *const typeNames[] = {"Motion", "Tap", "FreeFall", "Orientation"};
+    if (event->type < ImuMotionEventType_Motion || event->type > ImuMotionEventType_Orientation) {
+        Log_Debug("WARNING: Discarding motion event of type %u.\n", event->type);
+        return;
+    }
+
+    if (!motionStarted) {
+        motionStarted = true;
+        nextExpectedEventSequence = event->sequence;
+    }
+    lostMotionMessages += event->sequence - nextExpectedEventSequence;
+    nextExpectedEventSequence = event->sequence + 1;
+
+    // The value of an orientation event is the previous orientation; the others are in mg.
+    static char message[192];
+    int len;
+    if (event->type == ImuMotionEventType_Orientation) {
+        len = snprintf(message, sizeof(message),
+                       "{ \"ImuEvent\": \"Orientation\", \"ImuOrientation\": \"%s\", "
+                       "\"ImuPreviousOrientation\": \"%s\" }",
+                       OrientationName(event->orientation),
+                       OrientationName((uint8_t)event->value));
+    } else {
+        len = snprintf(message, sizeof(message),
+                       "{ \"ImuEvent\": \"%s\", \"ImuEventMilliG\": \"%ld\", "
+                       "\"ImuOrientation\": \"%s\" }",
+                       typeNames[event->type - ImuMotionEventType_Motion], (long)event->value,
+                       OrientationName(event->orientation));
+    }
+    if (len > 0 && (size_t)len < sizeof(message)) {
+        SendTelemetry(message);
+    }
+}
+
+/// <summary>
+///     Send the summary of a telemetry period from the real-time core as a telemetry message.
+/// </summary>
+static void HandleMotionSummary(const ImuMotionSummary *summary)
+{
+    if (!motionStarted) {
+        motionStarted = true;
+        nextExpectedSummarySequence = summary->sequence;
+    }
+    lostMotionMessages += summary->sequence - nextExpectedSummarySequence;
+    nextExpectedSummarySequence = summary->sequence + 1;
+
+    static char message[448];
+    int len = snprintf(
+        message, sizeof(message),
+        "{ \"ImuMeanAccelX\": \"%.3f\", \"ImuMeanAccelY\": \"%.3f\", "
+        "\"ImuMeanAccelZ\": \"%.3f\", \"ImuMinMagnitude\": \"%.3f\", "
+        "\"ImuMaxMagnitude\": \"%.3f\", \"ImuMaxAngularRate\": \"%u\", "
+        "\"ImuMotionEvents\": \"%u\", \"ImuTaps\": \"%u\", \"ImuFreeFalls\": \"%u\", "
+        "\"ImuOrientationChanges\": \"%u\", \"ImuOrientation\": \"%s\", "
+        "\"ImuSampleCount\": \"%u\", \"ImuLostMessages\": \"%u\", "
+        "\"ImuOverruns\": \"%u\" }",
+        summary->meanMilliG[0] / 1000.0, summary->meanMilliG[1] / 1000.0,
+        summary->meanMilliG[2] / 1000.0, summary->minMagnitudeMilliG / 1000.0,
+        summary->maxMagnitudeMilliG / 1000.0, summary->maxAngularRateDps,
+        summary->eventCounts[0], summary->eventCounts[1], summary->eventCounts[2],
+        summary->eventCounts[3], OrientationName(summary->orientation), summary->sampleCount,
+        lostMotionMessages, summary->overrunCount);
+    if (len > 0 && (size_t)len < sizeof(message)) {
+        SendTelemetry(message);
+    }
+    lostMotionMessages = 0;
+}
+
+/// <summary>
+///     Get the name of an ImuOrientation value, for telemetry.
+/// </summary>
+static const char *OrientationName(uint8_t orientation)
+{
+    static const char *const names[] = {"Unknown", "XUp", "XDown", "YUp",
+                                        "YDown",   "ZUp", "ZDown"};
+    return orientation < sizeof(names) / sizeof(names[0]) ? names[orientation] : "Unknown";
+}
+
+/// <summary>
+///     Clear the aggregates at the start of a telemetry period.
+/// </summary>
+static void ResetAggregate(void)
+{
+    memset(&aggregate, 0, sizeof(aggregate));
+}
+
+/// <summary>
+///     Convert a fixed-point value from <see cref="Lsm6ds3_ConvertBlock" /> to a double, to
+///     format it.
+/// </summary>
+static double FixedToDouble(int64_t value)
+{
+    return (double)value / (1 << LSM6DS3_FIXED_FRACTION_BITS);
+}
+
+/// <summary>
+///     Hand a telemetry message to the telemetry path. This sample only logs it; the AzureIoT
+///     sample's SendTelemetry shows how to send the same message to IoT Hub with
+///     IoTHubMessage_CreateFromString and IoTHubDeviceClient_LL_SendEventAsync.
+/// </summary>
+/// <param name="message">The telemetry message, as a JSON object.</param>
+static void SendTelemetry(const char *message)
+{
+    Log_Debug("Sending telemetry: %s\n", message);
+}
+
+/// <summary>
+///     Get the current CLOCK_MONOTONIC time in microseconds.
+/// </summary>
+static int64_t GetMonotonicTimeUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// event handler data structures. Only the event handler field needs to be populated.
+static EventData telemetryTimerEventData = {.eventHandler = &TelemetryTimerEventHandler};
+
+/// <summary>
+///     Set up SIGTERM termination handler, the connection to the real-time capable
+///     application, and start motion detection. With IMU_STREAM_SAMPLES, also set up the
+///     telemetry timer and start the stream.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int InitHandlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    ResetAggregate();
+
+    epollFd = CreateEpollFd();
+    if (epollFd < 0) {
+        return -1;
+    }
+
+    if (IntercoreChannel_Open(&rtAppChannel, epollFd, rtAppComponentId, RTCoreMessageHandler,
+                              RTCoreChannelErrorHandler) != 0) {
+        return -1;
+    }
+    IntercoreChannel_SetTypedMessageHandler(&rtAppChannel, RTCoreTypedMessageHandler);
+
+    // The real-time capable application sends its events, summaries and blocks to this
+    // application once it has received the subscriptions.
+    if (ImuMotionSubscribe_Send(&rtAppChannel, &motionSubscription) != 0) {
+        Log_Debug("ERROR: Unable to start motion detection: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+#if IMU_STREAM_SAMPLES
+    static const struct timespec telemetryPeriod = {.tv_sec = TELEMETRY_PERIOD_SECONDS,
+                                                    .tv_nsec = 0};
+    telemetryTimerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &telemetryPeriod, &telemetryTimerEventData, EPOLLIN);
+    if (telemetryTimerFd < 0) {
+        return -1;
+    }
+
+    ImuStreamSubscribe subscribe = {.enable = 1};
+    if (ImuStreamSubscribe_Send(&rtAppChannel, &subscribe) != 0) {
+        Log_Debug("ERROR: Unable to start the IMU stream: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/// <summary>
+///     Stop motion detection and the stream, and clean up the resources previously allocated.
+/// </summary>
+static void CloseHandlers(void)
+{
+    // These are sent on a best-effort basis. If they are lost, the real-time capable
+    // application drops its messages once the shared buffer is full.
+    ImuMotionSubscribe motionSubscribe = {.enable = 0};
+    ImuMotionSubscribe_Send(&rtAppChannel, &motionSubscribe);
+#if IMU_STREAM_SAMPLES
+    ImuStreamSubscribe subscribe = {.enable = 0};
+    ImuStreamSubscribe_Send(&rtAppChannel, &subscribe);
+#endif
+
+    Log_Debug("Closing file descriptors.\n");
+    IntercoreChannel_Close(&rtAppChannel);
+    CloseFdAndPrintError(telemetryTimerFd, "TelemetryTimer");
+    CloseFdAndPrintError(epollFd, "Epoll");
+}
+
+int main(void)
+{
+    Log_Debug("IMU streaming application starting.\n");
+
+    if (InitHandlers() != 0) {
+        terminationRequired = true;
+    }
+
+    while (!terminationRequired) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
+            terminationRequired = true;
+        }
+    }
+
+    CloseHandlers();
+    Log_Debug("Application exiting.\n");
+    return 0;
+}
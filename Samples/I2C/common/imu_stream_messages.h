@@ -0,0 +1,188 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "intercore_typed_defs.h"
+
+/// <summary>
+/// Number of samples in each <see cref="ImuSampleBlock" />. At 1.66kHz, this is about 10ms of
+/// samples, which is as much as one typed message can carry.
+/// </summary>
+#define IMU_STREAM_BLOCK_SAMPLE_COUNT 16
+
+/// <summary>
+/// Number of raw values in each sample: the gyroscope X, Y and Z axes, and then the
+/// accelerometer X, Y and Z axes, in the order which the LSM6DS3 FIFO stores them.
+/// </summary>
+#define IMU_STREAM_AXIS_COUNT 6
+
+/// <summary>
+/// Sent by the high-level application to start or stop the stream of
+/// <see cref="ImuSampleBlock" /> messages. The blocks are sent to the application which sent
+/// the most recent subscription.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>1 to start the stream, 0 to stop it.</summary>
+    uint32_t enable;
+} ImuStreamSubscribe;
+INTERCORE_TYPED_MESSAGE(ImuStreamSubscribe, 18, 1);
+
+/// <summary>
+/// <para>Sent by the real-time capable application for each block of consecutive samples
+/// which it reads from the LSM6DS3 FIFO, while the stream is enabled.</para>
+/// <para>The LSM6DS3 takes the samples at its own output data rate, so their spacing does not
+/// depend on when the FIFO is read. The sample index counts every sample which has been read
+/// from the FIFO; if overrunCount has changed since the previous block, the FIFO filled up and
+/// samples were lost in between.</para>
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Incremented for each block which is made while the stream is enabled, so a
+    /// gap means blocks were dropped because the shared buffer was full.</summary>
+    uint32_t sequence;
+    /// <summary>Index of the first sample, counting from the first sample read after the
+    /// LSM6DS3 was configured.</summary>
+    uint64_t firstSampleIndex;
+    /// <summary>Microsecond counter value when the FIFO status was read, in the drain which
+    /// read the first sample. The first sample was taken at most one drain period
+    /// earlier.</summary>
+    uint32_t readTimeUs;
+    /// <summary>Nominal output data rate of the LSM6DS3, in Hz.</summary>
+    uint16_t sampleRateHz;
+    /// <summary>Accelerometer range, as a Lsm6ds3AccelRange value.</summary>
+    uint8_t accelRange;
+    /// <summary>Gyroscope range, as a Lsm6ds3GyroRange value.</summary>
+    uint8_t gyroRange;
+    /// <summary>Number of times that the FIFO has been found to have overrun.</summary>
+    uint32_t overrunCount;
+    /// <summary>Number of entries in samples which are used.</summary>
+    uint8_t sampleCount;
+    /// <summary>Raw sample values, oldest first.</summary>
+    int16_t samples[IMU_STREAM_BLOCK_SAMPLE_COUNT][IMU_STREAM_AXIS_COUNT];
+} ImuSampleBlock;
+INTERCORE_TYPED_MESSAGE(ImuSampleBlock, 19, 1);
+
+/// <summary>
+/// <para>Sent by the high-level application to start or stop motion event detection. While it
+/// is enabled, the real-time capable application runs the detectors over every sample which it
+/// reads, and sends an <see cref="ImuMotionEvent" /> for each event which they detect and an
+/// <see cref="ImuMotionSummary" /> every summary period, to the application which sent the most
+/// recent subscription. It is independent of <see cref="ImuStreamSubscribe" />, so the events
+/// can be detected without streaming the samples.</para>
+/// <para>Each threshold or time which is 0 turns that detector off. The times are rounded down
+/// to a whole number of samples.</para>
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>1 to start detection, 0 to stop it.</summary>
+    uint8_t enable;
+    uint8_t reserved;
+    /// <summary>A motion event is detected when the magnitude of the acceleration differs
+    /// from 1 g by more than this, in mg.</summary>
+    uint16_t motionMilliG;
+    /// <summary>A tap is detected when any axis of the acceleration changes by more than this
+    /// from one sample to the next, in mg.</summary>
+    uint16_t tapMilliG;
+    /// <summary>Free fall is detected when the magnitude of the acceleration stays below
+    /// freeFallMilliG for freeFallMs.</summary>
+    uint16_t freeFallMilliG;
+    uint16_t freeFallMs;
+    /// <summary>An orientation change is detected when gravity is nearest to a different axis
+    /// for this long, in milliseconds.</summary>
+    uint16_t orientationMs;
+    /// <summary>Time between summaries, in milliseconds.</summary>
+    uint16_t summaryPeriodMs;
+} ImuMotionSubscribe;
+INTERCORE_TYPED_MESSAGE(ImuMotionSubscribe, 24, 1);
+
+/// <summary>
+/// What an <see cref="ImuMotionEvent" /> reports.
+/// </summary>
+typedef enum {
+    /// <summary>The magnitude of the acceleration moved away from 1 g. The value is the
+    /// magnitude, in mg. No further motion event is detected until the magnitude has stayed
+    /// within the threshold for half a second.</summary>
+    ImuMotionEventType_Motion = 1,
+    /// <summary>The acceleration changed sharply. The value is the largest change of any axis
+    /// between two samples, in mg. Taps within 100 ms of the previous one are ignored.</summary>
+    ImuMotionEventType_Tap = 2,
+    /// <summary>The LSM6DS3 is falling. The value is the smallest magnitude during the fall
+    /// so far, in mg. No further free fall is detected until the magnitude rises above the
+    /// threshold again.</summary>
+    ImuMotionEventType_FreeFall = 3,
+    /// <summary>Gravity is nearest to a different axis. The orientation is the new one, and the
+    /// value is the previous one.</summary>
+    ImuMotionEventType_Orientation = 4
+} ImuMotionEventType;
+
+/// <summary>
+/// Which way up the LSM6DS3 is: the axis which gravity is nearest to, and whether that axis
+/// points up or down.
+/// </summary>
+typedef enum {
+    /// <summary>The orientation is not known yet.</summary>
+    ImuOrientation_Unknown = 0,
+    ImuOrientation_XUp = 1,
+    ImuOrientation_XDown = 2,
+    ImuOrientation_YUp = 3,
+    ImuOrientation_YDown = 4,
+    ImuOrientation_ZUp = 5,
+    ImuOrientation_ZDown = 6
+} ImuOrientation;
+
+/// <summary>
+/// Sent by the real-time capable application for each event which the motion detectors
+/// detect, while detection is enabled.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Incremented for each event which is detected, so a gap means events were
+    /// dropped because the shared buffer was full.</summary>
+    uint32_t sequence;
+    /// <summary>Index of the sample which completed the event, counting as in
+    /// <see cref="ImuSampleBlock" />.</summary>
+    uint64_t sampleIndex;
+    /// <summary>Microsecond counter value when the FIFO status was read, in the drain which
+    /// read the sample.</summary>
+    uint32_t readTimeUs;
+    /// <summary>What happened, as an ImuMotionEventType value.</summary>
+    uint8_t type;
+    /// <summary>The orientation after the event, as an ImuOrientation value.</summary>
+    uint8_t orientation;
+    /// <summary>Depends on the type; see ImuMotionEventType.</summary>
+    int32_t value;
+} ImuMotionEvent;
+INTERCORE_TYPED_MESSAGE(ImuMotionEvent, 25, 1);
+
+/// <summary>
+/// Number of entries in <see cref="ImuMotionSummary.eventCounts" />, one for each
+/// ImuMotionEventType, starting with ImuMotionEventType_Motion.
+/// </summary>
+#define IMU_MOTION_EVENT_TYPE_COUNT 4
+
+/// <summary>
+/// Sent by the real-time capable application every summary period while detection is
+/// enabled, with statistics of the samples in that period.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Incremented for each summary, so a gap means summaries were dropped.</summary>
+    uint32_t sequence;
+    /// <summary>Index of the first sample in the period.</summary>
+    uint64_t firstSampleIndex;
+    /// <summary>Number of samples in the period.</summary>
+    uint32_t sampleCount;
+    /// <summary>Mean acceleration of the X, Y and Z axes, in mg.</summary>
+    int16_t meanMilliG[3];
+    /// <summary>Smallest and largest magnitude of the acceleration, in mg.</summary>
+    uint16_t minMagnitudeMilliG;
+    uint16_t maxMagnitudeMilliG;
+    /// <summary>Largest angular rate of any axis, in degrees per second.</summary>
+    uint16_t maxAngularRateDps;
+    /// <summary>Number of events of each type which were detected in the period.</summary>
+    uint16_t eventCounts[IMU_MOTION_EVENT_TYPE_COUNT];
+    /// <summary>The orientation at the end of the period, as an ImuOrientation value.</summary>
+    uint8_t orientation;
+    /// <summary>Number of times that the FIFO has been found to have overrun.</summary>
+    uint32_t overrunCount;
+} ImuMotionSummary;
+INTERCORE_TYPED_MESSAGE(ImuMotionSummary, 26, 1);
@@ -0,0 +1,350 @@
+﻿/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This application for Azure Sphere measures the throughput and round-trip latency of the
+// connection to a real-time capable application, which echoes each message with upper-case and
+// lower-case letters swapped. For each echo mode of the real-time capable application, and each
+// payload size, it logs:
+// - the median and 99th percentile round-trip time of one message at a time;
+// - the messages and bytes per second with several messages in flight.
+// The application exits once every measurement has been made.
+//
+// It uses the following Azure Sphere libraries
+// - log (messages shown in Visual Studio's Device Output window during debugging);
+// - application (establish a connection with a real-time capable application).
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <applibs/log.h>
+#include <applibs/application.h>
+
+#include "intercore_benchmark_defs.h"
+
+static int sockFd = -1;
+static volatile sig_atomic_t terminationRequired = false;
+
+static const char rtAppComponentId[] = "3ca0d3b0-deb3-461f-8120-b10ff5c9a3e1";
+
+// Application_Socket messages carry at most 1 KB.
+#define MAX_PAYLOAD_SIZE 1024
+// The first bytes of each payload hold its sequence number as lower-case letters, so that late
+// replies can be told apart. Every payload is at least this long.
+#define SEQUENCE_DIGITS 4
+#define SEQUENCE_RANGE (26 * 26 * 26 * 26)
+
+#define LATENCY_SAMPLE_COUNT 500
+#define THROUGHPUT_MESSAGE_COUNT 2000
+// Enough messages in flight to keep both cores busy, and few enough that the real-time capable
+// application always has space for the replies at the largest payload size.
+#define THROUGHPUT_WINDOW 4
+
+static const size_t payloadSizes[] = {4, 16, 64, 256, 1024};
+
+typedef struct {
+    const char *name;
+    IntercoreBenchmarkSetMode mode;
+} BenchmarkMode;
+
+static const BenchmarkMode benchmarkModes[] = {
+    {"copy, notify every reply",
+     {.magic = INTERCORE_BENCHMARK_SET_MODE_MAGIC, .notificationThreshold = 1, .zeroCopy = 0}},
+    {"zero-copy, notify every reply",
+     {.magic = INTERCORE_BENCHMARK_SET_MODE_MAGIC, .notificationThreshold = 1, .zeroCopy = 1}},
+    {"copy, coalesce notifications",
+     {.magic = INTERCORE_BENCHMARK_SET_MODE_MAGIC, .notificationThreshold = 0, .zeroCopy = 0}},
+    {"zero-copy, coalesce notifications",
+     {.magic = INTERCORE_BENCHMARK_SET_MODE_MAGIC, .notificationThreshold = 0, .zeroCopy = 1}},
+};
+
+static uint32_t latencySamplesNs[LATENCY_SAMPLE_COUNT];
+static uint32_t nextSequence = 0;
+
+static void TerminationHandler(int signalNumber);
+static uint64_t GetMonotonicNs(void);
+static void BuildPayload(uint8_t *payload, size_t size, uint32_t sequence);
+static bool ParseReply(const uint8_t *reply, ssize_t replySize, size_t payloadSize,
+                       uint32_t *sequence);
+static int SendPayload(size_t size, uint32_t *sequence);
+static int SetMode(const IntercoreBenchmarkSetMode *mode);
+static int CompareSamples(const void *a, const void *b);
+static int MeasureLatency(size_t size);
+static int MeasureThroughput(size_t size);
+static int OpenSocket(void);
+
+/// <summary>
+///     Signal handler for termination requests. This handler must be async-signal-safe.
+/// </summary>
+static void TerminationHandler(int signalNumber)
+{
+    // Don't use Log_Debug here, as it is not guaranteed to be async-signal-safe.
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Get the current time from the monotonic clock.
+/// </summary>
+static uint64_t GetMonotonicNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/// <summary>
+///     Fill a payload with lower-case letters, starting with its sequence number.
+/// </summary>
+static void BuildPayload(uint8_t *payload, size_t size, uint32_t sequence)
+{
+    for (size_t i = 0; i < SEQUENCE_DIGITS; ++i) {
+        payload[i] = (uint8_t)('a' + sequence % 26);
+        sequence /= 26;
+    }
+    for (size_t i = SEQUENCE_DIGITS; i < size; ++i) {
+        payload[i] = (uint8_t)('a' + i % 26);
+    }
+}
+
+/// <summary>
+///     Check that a reply is a correctly echoed payload of the expected size, and get its
+///     sequence number.
+/// </summary>
+static bool ParseReply(const uint8_t *reply, ssize_t replySize, size_t payloadSize,
+                       uint32_t *sequence)
+{
+    if (replySize != (ssize_t)payloadSize) {
+        return false;
+    }
+
+    uint32_t value = 0;
+    for (size_t i = SEQUENCE_DIGITS; i > 0; --i) {
+        if (reply[i - 1] < 'A' || reply[i - 1] > 'Z') {
+            return false;
+        }
+        value = value * 26 + (uint32_t)(reply[i - 1] - 'A');
+    }
+
+    *sequence = value;
+    return true;
+}
+
+/// <summary>
+///     Send a payload with the next sequence number.
+/// </summary>
+static int SendPayload(size_t size, uint32_t *sequence)
+{
+    static uint8_t payload[MAX_PAYLOAD_SIZE];
+
+    *sequence = nextSequence;
+    nextSequence = (nextSequence + 1) % SEQUENCE_RANGE;
+    BuildPayload(payload, size, *sequence);
+
+    if (send(sockFd, payload, size, 0) == -1) {
+        Log_Debug("ERROR: Unable to send message: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Change the echo mode of the real-time capable application, and wait until it has
+///     changed. Any late replies to earlier messages are discarded.
+/// </summary>
+static int SetMode(const IntercoreBenchmarkSetMode *mode)
+{
+    if (send(sockFd, mode, sizeof(*mode), 0) == -1) {
+        Log_Debug("ERROR: Unable to send mode: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    IntercoreBenchmarkSetMode reply;
+    for (;;) {
+        ssize_t replySize = recv(sockFd, &reply, sizeof(reply), 0);
+        if (replySize == -1) {
+            Log_Debug("ERROR: No reply to mode change: %d (%s)\n", errno, strerror(errno));
+            return -1;
+        }
+        if (replySize == sizeof(reply) && memcmp(&reply, mode, sizeof(reply)) == 0) {
+            return 0;
+        }
+    }
+}
+
+static int CompareSamples(const void *a, const void *b)
+{
+    uint32_t sampleA = *(const uint32_t *)a;
+    uint32_t sampleB = *(const uint32_t *)b;
+    return (sampleA > sampleB) - (sampleA < sampleB);
+}
+
+/// <summary>
+///     Send one message at a time, and log the median and 99th percentile round-trip times.
+/// </summary>
+static int MeasureLatency(size_t size)
+{
+    static uint8_t reply[MAX_PAYLOAD_SIZE];
+    size_t sampleCount = 0;
+    unsigned lostCount = 0;
+
+    for (size_t i = 0; i < LATENCY_SAMPLE_COUNT && !terminationRequired; ++i) {
+        uint32_t sequence;
+        uint64_t startNs = GetMonotonicNs();
+        if (SendPayload(size, &sequence) == -1) {
+            return -1;
+        }
+
+        // Discard late replies to earlier messages. A timeout counts the message as lost.
+        for (;;) {
+            ssize_t replySize = recv(sockFd, reply, sizeof(reply), 0);
+            if (replySize == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno,
+                              strerror(errno));
+                    return -1;
+                }
+                ++lostCount;
+                break;
+            }
+
+            uint32_t replySequence;
+            if (ParseReply(reply, replySize, size, &replySequence) && replySequence == sequence) {
+                latencySamplesNs[sampleCount++] = (uint32_t)(GetMonotonicNs() - startNs);
+                break;
+            }
+        }
+    }
+
+    if (sampleCount == 0) {
+        Log_Debug("  %4zu bytes: no replies\n", size);
+        return 0;
+    }
+
+    qsort(latencySamplesNs, sampleCount, sizeof(latencySamplesNs[0]), CompareSamples);
+    Log_Debug("  %4zu bytes: round trip p50 %u us, p99 %u us, %u lost\n", size,
+              latencySamplesNs[sampleCount / 2] / 1000,
+              latencySamplesNs[sampleCount * 99 / 100] / 1000, lostCount);
+    return 0;
+}
+
+/// <summary>
+///     Keep THROUGHPUT_WINDOW messages in flight, sending another as each reply arrives, and
+///     log the messages and bytes per second.
+/// </summary>
+static int MeasureThroughput(size_t size)
+{
+    static uint8_t reply[MAX_PAYLOAD_SIZE];
+    unsigned sentCount = 0;
+    unsigned receivedCount = 0;
+    unsigned lostCount = 0;
+    unsigned inFlight = 0;
+    uint32_t firstSequence = nextSequence;
+
+    uint64_t startNs = GetMonotonicNs();
+    while ((sentCount < THROUGHPUT_MESSAGE_COUNT || inFlight > 0) && !terminationRequired) {
+        while (sentCount < THROUGHPUT_MESSAGE_COUNT && inFlight < THROUGHPUT_WINDOW) {
+            uint32_t sequence;
+            if (SendPayload(size, &sequence) == -1) {
+                return -1;
+            }
+            ++sentCount;
+            ++inFlight;
+        }
+
+        ssize_t replySize = recv(sockFd, reply, sizeof(reply), 0);
+        if (replySize == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno,
+                          strerror(errno));
+                return -1;
+            }
+            // Nothing arrived before the timeout, so every message in flight is lost.
+            lostCount += inFlight;
+            inFlight = 0;
+            continue;
+        }
+
+        // Discard late replies to messages from an earlier measurement, or which have already
+        // been counted as lost.
+        uint32_t replySequence;
+        if (inFlight > 0 && ParseReply(reply, replySize, size, &replySequence) &&
+            (replySequence + SEQUENCE_RANGE - firstSequence) % SEQUENCE_RANGE < sentCount) {
+            ++receivedCount;
+            --inFlight;
+        }
+    }
+    uint64_t elapsedNs = GetMonotonicNs() - startNs;
+
+    uint64_t messagesPerSecond =
+        elapsedNs == 0 ? 0 : (uint64_t)receivedCount * 1000000000ull / elapsedNs;
+    Log_Debug("  %4zu bytes: %llu msgs/s, %llu bytes/s each way, %u lost\n", size,
+              (unsigned long long)messagesPerSecond,
+              (unsigned long long)(messagesPerSecond * size), lostCount);
+    return 0;
+}
+
+/// <summary>
+///     Open the connection to the real-time capable application.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int OpenSocket(void)
+{
+    sockFd = Application_Socket(rtAppComponentId);
+    if (sockFd == -1) {
+        Log_Debug("ERROR: Unable to create socket: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    // Set timeout, to handle the case where a message or its reply is lost.
+    static const struct timeval recvTimeout = {.tv_sec = 1, .tv_usec = 0};
+    int result = setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
+    if (result == -1) {
+        Log_Debug("ERROR: Unable to set socket timeout: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    Log_Debug("Intercore benchmark application.\n");
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = TerminationHandler;
+    sigaction(SIGTERM, &action, NULL);
+
+    if (OpenSocket() != 0) {
+        terminationRequired = true;
+    }
+
+    for (size_t m = 0; m < sizeof(benchmarkModes) / sizeof(benchmarkModes[0]); ++m) {
+        if (terminationRequired || SetMode(&benchmarkModes[m].mode) != 0) {
+            break;
+        }
+
+        Log_Debug("Mode: %s\n", benchmarkModes[m].name);
+        for (size_t s = 0; s < sizeof(payloadSizes) / sizeof(payloadSizes[0]); ++s) {
+            if (terminationRequired || MeasureLatency(payloadSizes[s]) != 0 ||
+                MeasureThroughput(payloadSizes[s]) != 0) {
+                terminationRequired = true;
+                break;
+            }
+        }
+    }
+
+    if (sockFd >= 0) {
+        close(sockFd);
+    }
+    Log_Debug("Application exiting.\n");
+    return 0;
+}
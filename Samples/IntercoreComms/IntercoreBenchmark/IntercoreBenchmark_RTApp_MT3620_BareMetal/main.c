@@ -0,0 +1,262 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// This real-time capable application echoes messages from the IntercoreBenchmark high-level
+// application as fast as it can, so that the high-level application can measure the throughput
+// and latency of the intercore channel. The high-level application chooses whether messages are
+// echoed in place or through a local buffer, and how many replies are coalesced into one
+// mailbox notification.
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+#include "deferred-callbacks.h"
+#include "mt3620-intercore.h"
+#include "mt3620-uart-poll.h"
+#include "intercore_benchmark_defs.h"
+
+extern uint32_t StackTop; // &StackTop == end of TCM
+
+static _Noreturn void DefaultExceptionHandler(void);
+
+static bool IsSetModeMessage(const IntercoreBlock *message, IntercoreBenchmarkSetMode *mode);
+static void ApplyMode(const IntercoreBenchmarkSetMode *mode);
+static bool EchoInPlace(void);
+static bool EchoWithCopy(void);
+
+static void HandleIntercoreIrq(void);
+static void HandleIntercoreIrqDeferred(void);
+
+static BufferHeader *outbound, *inbound;
+static uint32_t sharedBufSize = 0;
+
+// Messages from the high-level application are limited to 1 KB of payload, after the
+// 20-byte header.
+#define MAX_MESSAGE_SIZE (INTERCORE_MESSAGE_HEADER_SIZE + 1024)
+
+static bool zeroCopy = true;
+
+static _Noreturn void RTCoreMain(void);
+
+// ARM DDI0403E.d SB1.5.2-3
+// From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
+// value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
+// of 128 bytes.". The array is aligned in linker.ld, using the dedicated section ".vector_table".
+
+// The exception vector table contains a stack pointer, 15 exception handlers, and an entry for
+// each interrupt.
+#define INTERRUPT_COUNT 100 // from datasheet
+#define EXCEPTION_COUNT (16 + INTERRUPT_COUNT)
+#define INT_TO_EXC(i_) (16 + (i_))
+const uintptr_t ExceptionVectorTable[EXCEPTION_COUNT] __attribute__((section(".vector_table")))
+__attribute__((used)) = {
+    [0] = (uintptr_t)&StackTop,                // Main Stack Pointer (MSP)
+    [1] = (uintptr_t)RTCoreMain,               // Reset
+    [2] = (uintptr_t)DefaultExceptionHandler,  // NMI
+    [3] = (uintptr_t)DefaultExceptionHandler,  // HardFault
+    [4] = (uintptr_t)DefaultExceptionHandler,  // MPU Fault
+    [5] = (uintptr_t)DefaultExceptionHandler,  // Bus Fault
+    [6] = (uintptr_t)DefaultExceptionHandler,  // Usage Fault
+    [11] = (uintptr_t)DefaultExceptionHandler, // SVCall
+    [12] = (uintptr_t)DefaultExceptionHandler, // Debug monitor
+    [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
+    [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
+
+    [INT_TO_EXC(0)... INT_TO_EXC(10)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(11)] = (uintptr_t)Intercore_HandleIrq11,
+    [INT_TO_EXC(12)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+
+static _Noreturn void DefaultExceptionHandler(void)
+{
+    for (;;) {
+        // empty.
+    }
+}
+
+static uint8_t GetBlockByte(const IntercoreBlock *block, uint32_t offset)
+{
+    if (offset < block->firstPartSize) {
+        return block->firstPart[offset];
+    }
+    return block->secondPart[offset - block->firstPartSize];
+}
+
+static void SetBlockByte(const IntercoreBlock *block, uint32_t offset, uint8_t value)
+{
+    if (offset < block->firstPartSize) {
+        block->firstPart[offset] = value;
+    } else {
+        block->secondPart[offset - block->firstPartSize] = value;
+    }
+}
+
+static uint8_t SwapCase(uint8_t b)
+{
+    // This must be an unsigned char, rather than a char, else a compile-time warning
+    // is triggered by __ctype_lookup in ctype.h.
+    unsigned char c = b;
+    if (isupper(c)) {
+        return (uint8_t)tolower(c);
+    } else if (islower(c)) {
+        return (uint8_t)toupper(c);
+    }
+    return c;
+}
+
+static bool IsSetModeMessage(const IntercoreBlock *message, IntercoreBenchmarkSetMode *mode)
+{
+    uint32_t dataSize = message->firstPartSize + message->secondPartSize;
+    if (dataSize != INTERCORE_MESSAGE_HEADER_SIZE + sizeof(*mode)) {
+        return false;
+    }
+
+    uint8_t *mode8 = (uint8_t *)mode;
+    for (uint32_t i = 0; i < sizeof(*mode); ++i) {
+        mode8[i] = GetBlockByte(message, INTERCORE_MESSAGE_HEADER_SIZE + i);
+    }
+    return mode->magic == INTERCORE_BENCHMARK_SET_MODE_MAGIC;
+}
+
+static void ApplyMode(const IntercoreBenchmarkSetMode *mode)
+{
+    SetIntercoreNotificationThreshold(mode->notificationThreshold);
+    zeroCopy = mode->zeroCopy != 0;
+
+    Uart_WriteStringPoll("Mode: notification threshold ");
+    Uart_WriteIntegerPoll((int)mode->notificationThreshold);
+    Uart_WriteStringPoll(zeroCopy ? ", zero-copy\r\n" : ", copy\r\n");
+}
+
+// Echo every message which has arrived, reading it and writing the reply directly in the shared
+// buffers. Messages whose reply does not fit are left until the high-level application has read
+// some replies. Returns true if it stopped after a mode change.
+static bool EchoInPlace(void)
+{
+    IntercoreCursor readCursor, writeCursor;
+    if (BeginDequeue(&readCursor, outbound, inbound, sharedBufSize) == -1 ||
+        BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == -1) {
+        return false;
+    }
+
+    for (;;) {
+        IntercoreCursor readCursorBeforePeek = readCursor;
+        IntercoreBlock message, reply;
+        if (PeekNextBlock(&readCursor, &message) != 0) {
+            break;
+        }
+
+        uint32_t dataSize = message.firstPartSize + message.secondPartSize;
+        if (ReserveBlock(&writeCursor, dataSize, &reply) != 0) {
+            readCursor = readCursorBeforePeek;
+            break;
+        }
+
+        IntercoreBenchmarkSetMode mode;
+        bool isSetMode = IsSetModeMessage(&message, &mode);
+
+        // The header is sent back unchanged, so that the reply reaches the sender.
+        for (uint32_t i = 0; i < dataSize; ++i) {
+            uint8_t b = GetBlockByte(&message, i);
+            SetBlockByte(&reply, i,
+                         (isSetMode || i < INTERCORE_MESSAGE_HEADER_SIZE) ? b : SwapCase(b));
+        }
+
+        if (isSetMode) {
+            // Later messages may be echoed in the other mode, so publish what has been done.
+            CommitEnqueue(&writeCursor);
+            CommitDequeue(&readCursor);
+            ApplyMode(&mode);
+            return true;
+        }
+    }
+
+    CommitEnqueue(&writeCursor);
+    CommitDequeue(&readCursor);
+    return false;
+}
+
+// Echo every message which has arrived, copying each one out of the shared buffer and its reply
+// back in, one at a time. Returns true if it stopped after a mode change.
+static bool EchoWithCopy(void)
+{
+    static uint8_t buf[MAX_MESSAGE_SIZE];
+
+    for (;;) {
+        uint32_t dataSize = sizeof(buf);
+        if (DequeueData(outbound, inbound, sharedBufSize, buf, &dataSize) == -1) {
+            return false;
+        }
+
+        IntercoreBenchmarkSetMode mode;
+        bool isSetMode = false;
+        if (dataSize == INTERCORE_MESSAGE_HEADER_SIZE + sizeof(mode)) {
+            __builtin_memcpy(&mode, buf + INTERCORE_MESSAGE_HEADER_SIZE, sizeof(mode));
+            isSetMode = mode.magic == INTERCORE_BENCHMARK_SET_MODE_MAGIC;
+        }
+
+        if (!isSetMode) {
+            for (uint32_t i = INTERCORE_MESSAGE_HEADER_SIZE; i < dataSize; ++i) {
+                buf[i] = SwapCase(buf[i]);
+            }
+        }
+
+        // The high-level application keeps few enough messages in flight that the replies fit;
+        // a reply which does not fit is lost, and counted by the high-level application.
+        if (EnqueueData(inbound, outbound, sharedBufSize, buf, dataSize) == -1) {
+            Uart_WriteStringPoll("EchoWithCopy: no space for reply\r\n");
+        }
+
+        if (isSetMode) {
+            ApplyMode(&mode);
+            return true;
+        }
+    }
+}
+
+static void HandleIntercoreIrq(void)
+{
+    static DeferredCallback cbn =
+        DEFERRED_CALLBACK_INIT(HandleIntercoreIrqDeferred, DeferredPriority_Normal);
+    Deferred_Enqueue(&cbn);
+}
+
+static void HandleIntercoreIrqDeferred(void)
+{
+    // After a mode change, carry on with any remaining messages in the new mode.
+    while (zeroCopy ? EchoInPlace() : EchoWithCopy()) {
+        // empty.
+    }
+}
+
+static _Noreturn void RTCoreMain(void)
+{
+    // SCB->VTOR = ExceptionVectorTable
+    WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
+
+    Uart_Init();
+    Uart_WriteStringPoll("--------------------------------\r\n");
+    Uart_WriteStringPoll("IntercoreBenchmark_RTApp_MT3620_BareMetal\r\n");
+    Uart_WriteStringPoll("App built on: " __DATE__ ", " __TIME__ "\r\n");
+
+    if (GetIntercoreBuffers(&outbound, &inbound, &sharedBufSize) == -1) {
+        for (;;) {
+            // empty.
+        }
+    }
+
+    EnableIntercoreIrq(HandleIntercoreIrq);
+
+    // Handle any messages which arrived before the interrupt was enabled.
+    HandleIntercoreIrq();
+
+    for (;;) {
+        Deferred_WaitForCallbacks();
+        Deferred_InvokeCallbacks();
+
+        // Send any notifications which were held back while echoing.
+        FlushIntercoreNotifications();
+    }
+}
@@ -0,0 +1,445 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+#include <applibs/application.h>
+
+#include "intercore_channel.h"
+
+static void SocketEventHandler(EventData *eventData);
+static void FailChannel(IntercoreChannel *channel, int error);
+static void FlushTxQueue(IntercoreChannel *channel);
+static size_t AddToTxLane(IntercoreChannel *channel, IntercoreChannelTxLane *lane);
+static void DrainRx(IntercoreChannel *channel);
+static void DeliverStreamRecords(IntercoreChannel *channel, const uint8_t *records, size_t size);
+static void DeliverPackedRecords(IntercoreChannel *channel, const uint8_t *message, size_t size);
+
+/// <summary>
+///     Stops using the socket after an unrecoverable error, and tells the application.
+/// </summary>
+static void FailChannel(IntercoreChannel *channel, int error)
+{
+    Log_Debug("ERROR: Intercore channel failed: %s (%d).\n", strerror(error), error);
+    channel->failed = true;
+    UnregisterPersistentEventHandlerFromEpoll(channel->epollFd, &channel->sockEventData);
+
+    if (channel->errorHandler != NULL) {
+        channel->errorHandler(channel, error);
+    }
+}
+
+/// <summary>
+///     Takes the next free entry at the end of a lane, which must not be full, and records
+///     the new depth of the TX queue.
+/// </summary>
+/// <returns>The index of the entry in the lane's storage.</returns>
+static size_t AddToTxLane(IntercoreChannel *channel, IntercoreChannelTxLane *lane)
+{
+    size_t index = (lane->head + lane->count) % lane->capacity;
+    ++lane->count;
+
+    size_t depth = channel->txControl.count + channel->txBulk.count;
+    if (depth > channel->stats.maxTxQueueDepth) {
+        channel->stats.maxTxQueueDepth = depth;
+    }
+    return index;
+}
+
+/// <summary>
+///     Sends queued fragments until the queue is empty or the socket is full, taking each one
+///     from the control lane if it is not empty. If the socket is full, the remaining
+///     fragments are sent when EPOLLOUT is reported.
+/// </summary>
+static void FlushTxQueue(IntercoreChannel *channel)
+{
+    while (!channel->txBlocked && !channel->failed) {
+        IntercoreChannelTxLane *lane =
+            (channel->txControl.count > 0) ? &channel->txControl : &channel->txBulk;
+        if (lane->count == 0) {
+            return;
+        }
+
+        size_t index = lane->head;
+        ssize_t result =
+            send(channel->sockFd, lane->fragments[index], lane->fragmentSizes[index], 0);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                channel->txBlocked = true;
+                ++channel->stats.txBlockedCount;
+                return;
+            }
+            FailChannel(channel, errno);
+            return;
+        }
+
+        channel->stats.messagesSent += lane->messageCounts[index];
+        lane->head = (index + 1) % lane->capacity;
+        --lane->count;
+    }
+}
+
+/// <summary>
+///     Delivers each record of a stream message, stopping at a record which overruns the
+///     message.
+/// </summary>
+static void DeliverStreamRecords(IntercoreChannel *channel, const uint8_t *records, size_t size)
+{
+    if (channel->streamRecordHandler == NULL) {
+        ++channel->stats.rxDrops;
+        return;
+    }
+
+    size_t offset = 0;
+    while (offset < size) {
+        IntercoreStreamRecordHeader header;
+        if (size - offset < sizeof(header)) {
+            ++channel->stats.rxDrops;
+            return;
+        }
+        memcpy(&header, records + offset, sizeof(header));
+        offset += sizeof(header);
+        if (header.size > size - offset) {
+            ++channel->stats.rxDrops;
+            return;
+        }
+
+        ++channel->stats.messagesReceived;
+        channel->streamRecordHandler(channel, header.streamId, records + offset, header.size);
+        offset += header.size;
+    }
+}
+
+/// <summary>
+///     Delivers the records of a packed message, which follow its header, if they fill the
+///     message exactly.
+/// </summary>
+static void DeliverPackedRecords(IntercoreChannel *channel, const uint8_t *message, size_t size)
+{
+    IntercorePackedHeader header;
+    if (channel->packedRecordsHandler == NULL || size < sizeof(header)) {
+        ++channel->stats.rxDrops;
+        return;
+    }
+
+    memcpy(&header, message, sizeof(header));
+    if ((size_t)header.recordSize * header.recordCount != size - sizeof(header)) {
+        ++channel->stats.rxDrops;
+        return;
+    }
+
+    channel->stats.messagesReceived += header.recordCount;
+    channel->packedRecordsHandler(channel, header.recordSize, message + sizeof(header),
+                                  header.recordCount);
+}
+
+/// <summary>
+///     Reads fragments until the socket is empty, delivering each message as it completes.
+///     The socket is registered edge-triggered, so it must be read until EAGAIN.
+/// </summary>
+static void DrainRx(IntercoreChannel *channel)
+{
+    uint8_t fragment[INTERCORE_MAX_FRAGMENT_SIZE];
+    while (!channel->failed) {
+        ssize_t bytesReceived = recv(channel->sockFd, fragment, sizeof(fragment), 0);
+        if (bytesReceived == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                FailChannel(channel, errno);
+            }
+            return;
+        }
+
+        IntercoreTypedHeader typedHeader;
+        if ((size_t)bytesReceived >= sizeof(typedHeader)) {
+            memcpy(&typedHeader, fragment, sizeof(typedHeader));
+            if (typedHeader.marker == INTERCORE_TYPED_MESSAGE_MARKER) {
+                if (channel->typedMessageHandler == NULL) {
+                    ++channel->stats.rxDrops;
+                    continue;
+                }
+                ++channel->stats.messagesReceived;
+                channel->typedMessageHandler(channel, &typedHeader, fragment + sizeof(typedHeader),
+                                             (size_t)bytesReceived - sizeof(typedHeader));
+                continue;
+            }
+            if (typedHeader.marker == INTERCORE_STREAM_MESSAGE_MARKER) {
+                DeliverStreamRecords(channel, fragment + sizeof(typedHeader.marker),
+                                     (size_t)bytesReceived - sizeof(typedHeader.marker));
+                continue;
+            }
+            if (typedHeader.marker == INTERCORE_PACKED_MESSAGE_MARKER) {
+                DeliverPackedRecords(channel, fragment + sizeof(typedHeader.marker),
+                                     (size_t)bytesReceived - sizeof(typedHeader.marker));
+                continue;
+            }
+        }
+
+        int result =
+            IntercoreSocket_AddFragment(&channel->reassembly, fragment, (size_t)bytesReceived);
+        if (result == -1) {
+            ++channel->stats.rxDrops;
+        } else if (result == 1) {
+            ++channel->stats.messagesReceived;
+            channel->messageHandler(channel, channel->rxMessage, channel->reassembly.totalSize);
+        }
+    }
+}
+
+/// <summary>
+///     Handles the socket becoming readable or writable.
+/// </summary>
+static void SocketEventHandler(EventData *eventData)
+{
+    IntercoreChannel *channel =
+        (IntercoreChannel *)((uint8_t *)eventData - offsetof(IntercoreChannel, sockEventData));
+
+    if ((eventData->readyEvents & EPOLLOUT) != 0) {
+        channel->txBlocked = false;
+        FlushTxQueue(channel);
+    }
+
+    if ((eventData->readyEvents & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0) {
+        DrainRx(channel);
+    }
+}
+
+int IntercoreChannel_Open(IntercoreChannel *channel, int epollFd, const char *componentId,
+                          IntercoreChannel_MessageHandler messageHandler,
+                          IntercoreChannel_ErrorHandler errorHandler)
+{
+    memset(channel, 0, sizeof(*channel));
+    channel->epollFd = epollFd;
+    channel->messageHandler = messageHandler;
+    channel->errorHandler = errorHandler;
+    channel->sockEventData.eventHandler = SocketEventHandler;
+    // Messages from the real-time core are serviced ahead of other work, as the shared buffer
+    // is small and the real-time core cannot send while it is full.
+    channel->sockEventData.priority = EventPriority_High;
+    channel->reassembly.buffer = channel->rxMessage;
+    channel->reassembly.bufferSize = sizeof(channel->rxMessage);
+    channel->txBulk = (IntercoreChannelTxLane){.fragments = channel->txFragments,
+                                               .fragmentSizes = channel->txFragmentSizes,
+                                               .messageCounts = channel->txMessageCounts,
+                                               .capacity = INTERCORE_CHANNEL_TX_QUEUE_CAPACITY};
+    channel->txControl =
+        (IntercoreChannelTxLane){.fragments = channel->txControlMessages,
+                                 .fragmentSizes = channel->txControlMessageSizes,
+                                 .messageCounts = channel->txControlMessageCounts,
+                                 .capacity = INTERCORE_CHANNEL_CONTROL_QUEUE_CAPACITY};
+    clock_gettime(CLOCK_MONOTONIC, &channel->statsStartTime);
+
+    channel->sockFd = Application_Socket(componentId);
+    if (channel->sockFd == -1) {
+        Log_Debug("ERROR: Unable to create socket: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    int flags = fcntl(channel->sockFd, F_GETFL, 0);
+    if (flags == -1 || fcntl(channel->sockFd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        Log_Debug("ERROR: Unable to make socket non-blocking: %d (%s)\n", errno,
+                  strerror(errno));
+        return -1;
+    }
+
+    if (RegisterPersistentEventHandlerToEpoll(epollFd, channel->sockFd, &channel->sockEventData,
+                                              EPOLLIN | EPOLLOUT) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void IntercoreChannel_Close(IntercoreChannel *channel)
+{
+    if (channel->sockFd >= 0) {
+        UnregisterPersistentEventHandlerFromEpoll(channel->epollFd, &channel->sockEventData);
+    }
+    CloseFdAndPrintError(channel->sockFd, "IntercoreSocket");
+    channel->sockFd = -1;
+    channel->txBulk.count = 0;
+    channel->txControl.count = 0;
+    channel->failed = true;
+}
+
+int IntercoreChannel_Send(IntercoreChannel *channel, const void *data, size_t size)
+{
+    if (channel->failed) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    size_t fragmentCount = IntercoreSocket_GetFragmentCount(size);
+    if (size > UINT32_MAX || fragmentCount > INTERCORE_CHANNEL_TX_QUEUE_CAPACITY) {
+        ++channel->stats.txDrops;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    IntercoreChannelTxLane *lane = &channel->txBulk;
+    if (fragmentCount > lane->capacity - lane->count) {
+        ++channel->stats.txDrops;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    uint16_t messageId = channel->nextMessageId++;
+    for (size_t i = 0; i < fragmentCount; ++i) {
+        size_t index = AddToTxLane(channel, lane);
+        lane->fragmentSizes[index] = (uint16_t)IntercoreSocket_BuildFragment(
+            lane->fragments[index], messageId, (uint16_t)i, data, size);
+        lane->messageCounts[index] = (i == fragmentCount - 1) ? 1 : 0;
+    }
+
+    FlushTxQueue(channel);
+    return 0;
+}
+
+void IntercoreChannel_SetTypedMessageHandler(
+    IntercoreChannel *channel, IntercoreChannel_TypedMessageHandler typedMessageHandler)
+{
+    channel->typedMessageHandler = typedMessageHandler;
+}
+
+int IntercoreChannel_SendTyped(IntercoreChannel *channel, uint16_t typeId, uint16_t version,
+                               const void *body, size_t bodySize)
+{
+    if (channel->failed) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    if (bodySize > INTERCORE_MAX_FRAGMENT_SIZE - sizeof(IntercoreTypedHeader)) {
+        ++channel->stats.txDrops;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    IntercoreChannelTxLane *lane = &channel->txControl;
+    if (lane->count == lane->capacity) {
+        ++channel->stats.txDrops;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // A typed message always fits in one entry of the control lane.
+    size_t index = AddToTxLane(channel, lane);
+    IntercoreTypedHeader header = {
+        .marker = INTERCORE_TYPED_MESSAGE_MARKER, .typeId = typeId, .version = version};
+    memcpy(lane->fragments[index], &header, sizeof(header));
+    memcpy(lane->fragments[index] + sizeof(header), body, bodySize);
+    lane->fragmentSizes[index] = (uint16_t)(sizeof(header) + bodySize);
+    lane->messageCounts[index] = 1;
+
+    FlushTxQueue(channel);
+    return 0;
+}
+
+void IntercoreChannel_SetStreamRecordHandler(
+    IntercoreChannel *channel, IntercoreChannel_StreamRecordHandler streamRecordHandler)
+{
+    channel->streamRecordHandler = streamRecordHandler;
+}
+
+void IntercoreChannel_SetPackedRecordsHandler(
+    IntercoreChannel *channel, IntercoreChannel_PackedRecordsHandler packedRecordsHandler)
+{
+    channel->packedRecordsHandler = packedRecordsHandler;
+}
+
+int IntercoreChannel_SendStreamRecord(IntercoreChannel *channel, uint8_t streamId,
+                                      const void *data, size_t size)
+{
+    static const uint32_t marker = INTERCORE_STREAM_MESSAGE_MARKER;
+
+    if (channel->failed) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    if (size > INTERCORE_STREAM_MAX_RECORD_SIZE) {
+        ++channel->stats.txDrops;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    // Entries in the control lane are only sent by FlushTxQueue, so the newest one can still be
+    // extended while it waits.
+    IntercoreChannelTxLane *lane = &channel->txControl;
+    size_t recordSize = sizeof(IntercoreStreamRecordHeader) + size;
+    size_t index = (lane->head + lane->count + lane->capacity - 1) % lane->capacity;
+    bool extendNewest = lane->count > 0 &&
+                        memcmp(lane->fragments[index], &marker, sizeof(marker)) == 0 &&
+                        lane->fragmentSizes[index] + recordSize <= INTERCORE_MAX_FRAGMENT_SIZE &&
+                        lane->messageCounts[index] < UINT8_MAX;
+
+    if (!extendNewest) {
+        if (lane->count == lane->capacity) {
+            ++channel->stats.txDrops;
+            errno = ENOBUFS;
+            return -1;
+        }
+
+        index = AddToTxLane(channel, lane);
+        memcpy(lane->fragments[index], &marker, sizeof(marker));
+        lane->fragmentSizes[index] = sizeof(marker);
+        lane->messageCounts[index] = 0;
+    }
+
+    IntercoreStreamRecordHeader header = {.streamId = streamId, .size = (uint8_t)size};
+    uint8_t *record = lane->fragments[index] + lane->fragmentSizes[index];
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), data, size);
+    lane->fragmentSizes[index] = (uint16_t)(lane->fragmentSizes[index] + recordSize);
+    ++lane->messageCounts[index];
+
+    FlushTxQueue(channel);
+    return 0;
+}
+
+void IntercoreChannel_GetStats(const IntercoreChannel *channel, IntercoreChannelStats *stats)
+{
+    *stats = channel->stats;
+    stats->txQueueDepth = channel->txControl.count + channel->txBulk.count;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t elapsedMs = (uint64_t)(now.tv_sec - channel->statsStartTime.tv_sec) * 1000 +
+                         (uint64_t)((now.tv_nsec - channel->statsStartTime.tv_nsec) / 1000000);
+    if (elapsedMs > 0) {
+        stats->messagesSentPerSecond = (uint32_t)(stats->messagesSent * 1000ull / elapsedMs);
+        stats->messagesReceivedPerSecond =
+            (uint32_t)(stats->messagesReceived * 1000ull / elapsedMs);
+    }
+}
+
+void IntercoreChannel_ResetStats(IntercoreChannel *channel)
+{
+    memset(&channel->stats, 0, sizeof(channel->stats));
+    channel->stats.maxTxQueueDepth = channel->txControl.count + channel->txBulk.count;
+    clock_gettime(CLOCK_MONOTONIC, &channel->statsStartTime);
+}
+
+void IntercoreChannel_LogStats(const char *name, const IntercoreChannel *channel)
+{
+    IntercoreChannelStats stats;
+    IntercoreChannel_GetStats(channel, &stats);
+
+    Log_Debug("INFO: %s: sent %" PRIu32 " msgs (%" PRIu32 "/s), received %" PRIu32
+              " msgs (%" PRIu32 "/s), TX queue %zu (max %zu), %" PRIu32 " TX drops, %" PRIu32
+              " RX drops, blocked %" PRIu32 " times.\n",
+              name, stats.messagesSent, stats.messagesSentPerSecond, stats.messagesReceived,
+              stats.messagesReceivedPerSecond, stats.txQueueDepth, stats.maxTxQueueDepth,
+              stats.txDrops, stats.rxDrops, stats.txBlockedCount);
+}
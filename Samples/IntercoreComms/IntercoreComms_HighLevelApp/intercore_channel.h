@@ -0,0 +1,339 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "intercore_packed_defs.h"
+#include "intercore_socket.h"
+#include "intercore_stream_defs.h"
+#include "intercore_typed_defs.h"
+
+/// <summary>Number of fragments which can wait to be sent in a channel's bulk lane.</summary>
+#define INTERCORE_CHANNEL_TX_QUEUE_CAPACITY 32
+
+/// <summary>Number of typed and stream messages which can wait to be sent in a channel's
+/// control lane.</summary>
+#define INTERCORE_CHANNEL_CONTROL_QUEUE_CAPACITY 8
+
+/// <summary>Maximum size of a message which can be received on a channel.</summary>
+#define INTERCORE_CHANNEL_MAX_RX_MESSAGE_SIZE 4096
+
+struct IntercoreChannel;
+
+/// <summary>
+///     Function which is called for each complete message which arrives on a channel.
+/// </summary>
+/// <param name="channel">The channel on which the message arrived.</param>
+/// <param name="data">The message data, which is only valid until the function returns.</param>
+/// <param name="size">Size of the message data in bytes.</param>
+typedef void (*IntercoreChannel_MessageHandler)(struct IntercoreChannel *channel,
+                                                const uint8_t *data, size_t size);
+
+/// <summary>
+///     Function which is called for each typed message which arrives on a channel. Use the
+///     Type_Decode functions which are generated by <see cref="INTERCORE_CHANNEL_DEFINE_CODEC" />
+///     to read it.
+/// </summary>
+/// <param name="channel">The channel on which the message arrived.</param>
+/// <param name="header">The typed message header.</param>
+/// <param name="body">The struct which follows the header. This is only valid until the
+/// function returns.</param>
+/// <param name="bodySize">Size of the struct in bytes.</param>
+typedef void (*IntercoreChannel_TypedMessageHandler)(struct IntercoreChannel *channel,
+                                                     const IntercoreTypedHeader *header,
+                                                     const uint8_t *body, size_t bodySize);
+
+/// <summary>
+///     Function which is called for each record of a stream message which arrives on a
+///     channel, in the order of the records.
+/// </summary>
+/// <param name="channel">The channel on which the record arrived.</param>
+/// <param name="streamId">The logical stream which the record belongs to.</param>
+/// <param name="data">The record data, which is only valid until the function returns.</param>
+/// <param name="size">Size of the record data in bytes.</param>
+typedef void (*IntercoreChannel_StreamRecordHandler)(struct IntercoreChannel *channel,
+                                                     uint8_t streamId, const uint8_t *data,
+                                                     size_t size);
+
+/// <summary>
+///     Function which is called for each packed message which arrives on a channel, with all
+///     of its records at once, so that the application can process them as an array.
+/// </summary>
+/// <param name="channel">The channel on which the message arrived.</param>
+/// <param name="recordSize">Size of each record in bytes.</param>
+/// <param name="records">The records, back to back, which are only valid until the function
+/// returns. They are not aligned.</param>
+/// <param name="recordCount">Number of records.</param>
+typedef void (*IntercoreChannel_PackedRecordsHandler)(struct IntercoreChannel *channel,
+                                                      size_t recordSize, const uint8_t *records,
+                                                      size_t recordCount);
+
+/// <summary>
+///     Function which is called when the channel's socket fails with an error other than
+///     EAGAIN or EINTR. The channel stops using the socket until it is closed.
+/// </summary>
+/// <param name="channel">The channel which failed.</param>
+/// <param name="error">The errno value.</param>
+typedef void (*IntercoreChannel_ErrorHandler)(struct IntercoreChannel *channel, int error);
+
+/// <summary>
+///     Counters which are recorded for a channel. The rates are averaged since the channel was
+///     opened or the statistics were last reset.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages which were completely sent. Each record of a stream
+    /// message counts as one message.</summary>
+    uint32_t messagesSent;
+    /// <summary>Number of complete messages which were received, counting each record of a
+    /// stream or packed message as one message.</summary>
+    uint32_t messagesReceived;
+    /// <summary>Messages sent per second.</summary>
+    uint32_t messagesSentPerSecond;
+    /// <summary>Messages received per second.</summary>
+    uint32_t messagesReceivedPerSecond;
+    /// <summary>Number of fragments which are waiting to be sent, in both lanes.</summary>
+    size_t txQueueDepth;
+    /// <summary>Largest number of fragments which have waited to be sent, in both lanes.
+    /// </summary>
+    size_t maxTxQueueDepth;
+    /// <summary>Number of messages which were not sent because the TX queue was full.</summary>
+    uint32_t txDrops;
+    /// <summary>Number of received fragments which were discarded because they were invalid,
+    /// out of order, or belonged to a message which was too large.</summary>
+    uint32_t rxDrops;
+    /// <summary>Number of times a send was held back because the socket was full.</summary>
+    uint32_t txBlockedCount;
+} IntercoreChannelStats;
+
+/// <summary>
+///     Messages which are waiting to be sent in one lane of a channel, in a ring. The storage
+///     belongs to the channel.
+/// </summary>
+typedef struct {
+    /// <summary>The messages or fragments.</summary>
+    uint8_t (*fragments)[INTERCORE_MAX_FRAGMENT_SIZE];
+    /// <summary>Size of each entry in fragments.</summary>
+    uint16_t *fragmentSizes;
+    /// <summary>Number of messages which each entry in fragments completes: 0 for a fragment
+    /// other than the last one in its message, or the number of records in a stream message.
+    /// </summary>
+    uint8_t *messageCounts;
+    /// <summary>Number of entries in fragments.</summary>
+    size_t capacity;
+    /// <summary>Index in fragments of the oldest entry.</summary>
+    size_t head;
+    /// <summary>Number of entries which are waiting.</summary>
+    size_t count;
+} IntercoreChannelTxLane;
+
+/// <summary>
+/// <para>A connection to a real-time capable application, which queues outgoing messages and
+/// delivers incoming ones from the event loop. Messages of any size are carried in fragments,
+/// as described by <see cref="IntercoreFragmentHeader" />.</para>
+/// <para>The socket is non-blocking. If it fills up, fragments wait in the TX queue and are sent
+/// when the socket becomes writable again. All the fragments which have arrived are read on
+/// each wakeup.</para>
+/// <para>The TX queue has two lanes. Typed messages and stream records wait in the control
+/// lane, which is always sent first, so they overtake the fragments of large messages which are
+/// waiting in the bulk lane, and their latency does not depend on how much bulk data is
+/// queued.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="IntercoreChannel_Open" /> and disposes of it with
+/// <see cref="IntercoreChannel_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct IntercoreChannel {
+    /// <summary>Epoll instance on which the socket is registered.</summary>
+    int epollFd;
+    /// <summary>The socket returned by Application_Socket.</summary>
+    int sockFd;
+    /// <summary>Event data for the socket.</summary>
+    EventData sockEventData;
+    /// <summary>Called for each message which arrives.</summary>
+    IntercoreChannel_MessageHandler messageHandler;
+    /// <summary>Called for each typed message which arrives, or NULL.</summary>
+    IntercoreChannel_TypedMessageHandler typedMessageHandler;
+    /// <summary>Called for each stream record which arrives, or NULL.</summary>
+    IntercoreChannel_StreamRecordHandler streamRecordHandler;
+    /// <summary>Called for each packed message which arrives, or NULL.</summary>
+    IntercoreChannel_PackedRecordsHandler packedRecordsHandler;
+    /// <summary>Called if the socket fails, or NULL.</summary>
+    IntercoreChannel_ErrorHandler errorHandler;
+    /// <summary>Whether the socket has failed.</summary>
+    bool failed;
+    /// <summary>Storage for the bulk lane.</summary>
+    uint8_t txFragments[INTERCORE_CHANNEL_TX_QUEUE_CAPACITY][INTERCORE_MAX_FRAGMENT_SIZE];
+    uint16_t txFragmentSizes[INTERCORE_CHANNEL_TX_QUEUE_CAPACITY];
+    uint8_t txMessageCounts[INTERCORE_CHANNEL_TX_QUEUE_CAPACITY];
+    /// <summary>Storage for the control lane.</summary>
+    uint8_t txControlMessages[INTERCORE_CHANNEL_CONTROL_QUEUE_CAPACITY]
+                             [INTERCORE_MAX_FRAGMENT_SIZE];
+    uint16_t txControlMessageSizes[INTERCORE_CHANNEL_CONTROL_QUEUE_CAPACITY];
+    uint8_t txControlMessageCounts[INTERCORE_CHANNEL_CONTROL_QUEUE_CAPACITY];
+    /// <summary>Fragments of messages which are sent with
+    /// <see cref="IntercoreChannel_Send" />.</summary>
+    IntercoreChannelTxLane txBulk;
+    /// <summary>Typed messages and stream messages, which are sent before txBulk.</summary>
+    IntercoreChannelTxLane txControl;
+    /// <summary>Whether the socket was full on the last send, so the queue is waiting for
+    /// EPOLLOUT.</summary>
+    bool txBlocked;
+    /// <summary>Message ID for the next message which is sent.</summary>
+    uint16_t nextMessageId;
+    /// <summary>Storage for the message which is being received.</summary>
+    uint8_t rxMessage[INTERCORE_CHANNEL_MAX_RX_MESSAGE_SIZE];
+    /// <summary>Reassembly of the message which is being received.</summary>
+    IntercoreSocketReassembly reassembly;
+    /// <summary>Counters for <see cref="IntercoreChannel_GetStats" />.</summary>
+    IntercoreChannelStats stats;
+    /// <summary>When the counters were last reset.</summary>
+    struct timespec statsStartTime;
+} IntercoreChannel;
+
+/// <summary>
+///     Connects to a real-time capable application and adds the socket to an epoll instance.
+/// </summary>
+/// <param name="channel">Channel to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="componentId">Component ID of the real-time capable application.</param>
+/// <param name="messageHandler">Called for each message which arrives.</param>
+/// <param name="errorHandler">Called if the socket fails, or NULL.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int IntercoreChannel_Open(IntercoreChannel *channel, int epollFd, const char *componentId,
+                          IntercoreChannel_MessageHandler messageHandler,
+                          IntercoreChannel_ErrorHandler errorHandler);
+
+/// <summary>
+///     Discards any fragments which are waiting to be sent, and closes the socket.
+/// </summary>
+/// <param name="channel">Channel which was initialized with
+/// <see cref="IntercoreChannel_Open" />.</param>
+void IntercoreChannel_Close(IntercoreChannel *channel);
+
+/// <summary>
+///     Queues a message to the real-time capable application, and sends as much of it as the
+///     socket accepts. Either all of the message is queued, or none of it.
+/// </summary>
+/// <param name="channel">Channel on which to send the message.</param>
+/// <param name="data">The message data, which is copied.</param>
+/// <param name="size">Size of the message data in bytes.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set to ENOBUFS if the TX
+/// queue is full, EMSGSIZE if the message could never fit, or EPIPE if the socket has
+/// failed.</returns>
+int IntercoreChannel_Send(IntercoreChannel *channel, const void *data, size_t size);
+
+/// <summary>
+///     Sets the function which is called for each typed message which arrives. Typed messages
+///     are discarded, and counted as RX drops, until this is set.
+/// </summary>
+/// <param name="channel">Channel which was initialized with
+/// <see cref="IntercoreChannel_Open" />.</param>
+/// <param name="typedMessageHandler">Handler for typed messages, or NULL.</param>
+void IntercoreChannel_SetTypedMessageHandler(
+    IntercoreChannel *channel, IntercoreChannel_TypedMessageHandler typedMessageHandler);
+
+/// <summary>
+///     Queues a typed message to the real-time capable application, in the same way as
+///     <see cref="IntercoreChannel_Send" />, in the control lane. Prefer the Type_Send functions
+///     which are generated by <see cref="INTERCORE_CHANNEL_DEFINE_CODEC" />.
+/// </summary>
+/// <param name="channel">Channel on which to send the message.</param>
+/// <param name="typeId">Type ID of the struct.</param>
+/// <param name="version">Layout version of the struct.</param>
+/// <param name="body">The struct, which is copied.</param>
+/// <param name="bodySize">Size of the struct in bytes.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set as for
+/// <see cref="IntercoreChannel_Send" />.</returns>
+int IntercoreChannel_SendTyped(IntercoreChannel *channel, uint16_t typeId, uint16_t version,
+                               const void *body, size_t bodySize);
+
+/// <summary>
+///     <para>Generates inline functions which send and read a typed message, which has been
+///     declared with INTERCORE_TYPED_MESSAGE:</para>
+///     <para>int Type_Send(IntercoreChannel *channel, const Type *message)</para>
+///     <para>bool Type_Decode(const IntercoreTypedHeader *header, const uint8_t *body,
+///     size_t bodySize, Type *message), which returns false unless the message has this type,
+///     version and size.</para>
+/// </summary>
+#define INTERCORE_CHANNEL_DEFINE_CODEC(Type)                                                  \
+    static inline int Type##_Send(IntercoreChannel *channel, const Type *message)             \
+    {                                                                                         \
+        return IntercoreChannel_SendTyped(channel, Type##_TypeId, Type##_Version, message,    \
+                                          sizeof(*message));                                  \
+    }                                                                                         \
+    static inline bool Type##_Decode(const IntercoreTypedHeader *header, const uint8_t *body, \
+                                     size_t bodySize, Type *message)                          \
+    {                                                                                         \
+        if (header->typeId != Type##_TypeId || header->version != Type##_Version ||           \
+            bodySize != sizeof(*message)) {                                                   \
+            return false;                                                                     \
+        }                                                                                     \
+        memcpy(message, body, sizeof(*message));                                              \
+        return true;                                                                          \
+    }
+
+/// <summary>
+///     Sets the function which is called for each stream record which arrives. Stream messages
+///     are discarded, and counted as RX drops, until this is set.
+/// </summary>
+/// <param name="channel">Channel which was initialized with
+/// <see cref="IntercoreChannel_Open" />.</param>
+/// <param name="streamRecordHandler">Handler for stream records, or NULL.</param>
+void IntercoreChannel_SetStreamRecordHandler(
+    IntercoreChannel *channel, IntercoreChannel_StreamRecordHandler streamRecordHandler);
+
+/// <summary>
+///     Sets the function which is called for each packed message which arrives, as described
+///     by <see cref="IntercorePackedHeader" />. Packed messages are discarded, and counted as
+///     RX drops, until this is set.
+/// </summary>
+/// <param name="channel">Channel which was initialized with
+/// <see cref="IntercoreChannel_Open" />.</param>
+/// <param name="packedRecordsHandler">Handler for packed records, or NULL.</param>
+void IntercoreChannel_SetPackedRecordsHandler(
+    IntercoreChannel *channel, IntercoreChannel_PackedRecordsHandler packedRecordsHandler);
+
+/// <summary>
+///     Queues a record on one of the logical streams to the real-time capable application, in
+///     a stream message, as described by <see cref="IntercoreStreamRecordHeader" />, in the
+///     control lane. If the newest entry in the lane is a stream message with space for the
+///     record, because the socket was full, the record is added to it; otherwise it starts a
+///     new stream message. So records which are sent while the real-time core is busy share a
+///     message.
+/// </summary>
+/// <param name="channel">Channel on which to send the record.</param>
+/// <param name="streamId">The logical stream which the record belongs to.</param>
+/// <param name="data">The record data, which is copied.</param>
+/// <param name="size">Size of the record data in bytes, up to
+/// INTERCORE_STREAM_MAX_RECORD_SIZE.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set as for
+/// <see cref="IntercoreChannel_Send" />.</returns>
+int IntercoreChannel_SendStreamRecord(IntercoreChannel *channel, uint8_t streamId,
+                                      const void *data, size_t size);
+
+/// <summary>
+///     Gets the counters for a channel.
+/// </summary>
+/// <param name="channel">Channel to query.</param>
+/// <param name="stats">Receives the counters.</param>
+void IntercoreChannel_GetStats(const IntercoreChannel *channel, IntercoreChannelStats *stats);
+
+/// <summary>
+///     Resets the counters for a channel, apart from the TX queue depth.
+/// </summary>
+/// <param name="channel">Channel whose counters to reset.</param>
+void IntercoreChannel_ResetStats(IntercoreChannel *channel);
+
+/// <summary>
+///     Writes the counters for a channel to the debug log.
+/// </summary>
+/// <param name="name">Name which identifies the channel in the log.</param>
+/// <param name="channel">Channel to log.</param>
+void IntercoreChannel_LogStats(const char *name, const IntercoreChannel *channel);
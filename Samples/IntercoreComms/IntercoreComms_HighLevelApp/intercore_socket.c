@@ -0,0 +1,125 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "intercore_socket.h"
+
+size_t IntercoreSocket_GetFragmentCount(size_t size)
+{
+    if (size == 0) {
+        return 1;
+    }
+    return (size + INTERCORE_MAX_FRAGMENT_DATA_SIZE - 1) / INTERCORE_MAX_FRAGMENT_DATA_SIZE;
+}
+
+size_t IntercoreSocket_BuildFragment(uint8_t *fragment, uint16_t messageId, uint16_t fragmentIndex,
+                                     const void *data, size_t size)
+{
+    size_t offset = (size_t)fragmentIndex * INTERCORE_MAX_FRAGMENT_DATA_SIZE;
+    size_t dataSize = size - offset;
+    if (dataSize > INTERCORE_MAX_FRAGMENT_DATA_SIZE) {
+        dataSize = INTERCORE_MAX_FRAGMENT_DATA_SIZE;
+    }
+
+    IntercoreFragmentHeader header = {
+        .totalSize = (uint32_t)size, .messageId = messageId, .fragmentIndex = fragmentIndex};
+    memcpy(fragment, &header, sizeof(header));
+    memcpy(fragment + sizeof(header), (const uint8_t *)data + offset, dataSize);
+    return sizeof(header) + dataSize;
+}
+
+int IntercoreSocket_Send(int sockFd, uint16_t messageId, const void *data, size_t size)
+{
+    if (size > UINT32_MAX || IntercoreSocket_GetFragmentCount(size) > UINT16_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    uint8_t fragment[INTERCORE_MAX_FRAGMENT_SIZE];
+    size_t fragmentCount = IntercoreSocket_GetFragmentCount(size);
+    for (size_t i = 0; i < fragmentCount; ++i) {
+        size_t fragmentSize =
+            IntercoreSocket_BuildFragment(fragment, messageId, (uint16_t)i, data, size);
+        if (send(sockFd, fragment, fragmentSize, 0) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int IntercoreSocket_AddFragment(IntercoreSocketReassembly *reassembly, const uint8_t *fragment,
+                                size_t fragmentSize)
+{
+    if (fragmentSize < sizeof(IntercoreFragmentHeader)) {
+        Log_Debug("WARNING: Discarding fragment of %zu bytes, which is too small.\n",
+                  fragmentSize);
+        reassembly->inProgress = false;
+        return -1;
+    }
+
+    IntercoreFragmentHeader header;
+    memcpy(&header, fragment, sizeof(header));
+
+    // The first fragment starts a new message.
+    if (header.fragmentIndex == 0) {
+        if (header.totalSize > reassembly->bufferSize) {
+            Log_Debug("WARNING: Discarding message of %u bytes, which is too large.\n",
+                      header.totalSize);
+            reassembly->inProgress = false;
+            return -1;
+        }
+
+        reassembly->totalSize = header.totalSize;
+        reassembly->receivedSize = 0;
+        reassembly->messageId = header.messageId;
+        reassembly->nextFragmentIndex = 0;
+        reassembly->inProgress = true;
+    } else if (!reassembly->inProgress || header.messageId != reassembly->messageId ||
+               header.fragmentIndex != reassembly->nextFragmentIndex) {
+        Log_Debug("WARNING: Discarding unexpected fragment %u of message %u.\n",
+                  header.fragmentIndex, header.messageId);
+        reassembly->inProgress = false;
+        return -1;
+    }
+
+    size_t dataSize = fragmentSize - sizeof(IntercoreFragmentHeader);
+    if (dataSize > reassembly->totalSize - reassembly->receivedSize) {
+        Log_Debug("WARNING: Discarding message %u, as a fragment exceeds its size.\n",
+                  header.messageId);
+        reassembly->inProgress = false;
+        return -1;
+    }
+
+    memcpy(reassembly->buffer + reassembly->receivedSize, fragment + sizeof(header), dataSize);
+    reassembly->receivedSize += dataSize;
+    ++reassembly->nextFragmentIndex;
+
+    if (reassembly->receivedSize < reassembly->totalSize) {
+        return 0;
+    }
+
+    reassembly->inProgress = false;
+    return 1;
+}
+
+ssize_t IntercoreSocket_Receive(int sockFd, IntercoreSocketReassembly *reassembly)
+{
+    uint8_t fragment[INTERCORE_MAX_FRAGMENT_SIZE];
+    ssize_t bytesReceived = recv(sockFd, fragment, sizeof(fragment), 0);
+    if (bytesReceived == -1) {
+        return -1;
+    }
+
+    if (IntercoreSocket_AddFragment(reassembly, fragment, (size_t)bytesReceived) != 1) {
+        return 0;
+    }
+
+    return (ssize_t)reassembly->totalSize;
+}
@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "intercore_fragment_defs.h"
+
+/// <summary>
+///     Joins up the fragments of a message from the real-time capable application. Set the
+///     buffer and bufferSize members, and zero the others, before the first call to
+///     <see cref="IntercoreSocket_Receive" />. The other members are managed by that function.
+/// </summary>
+typedef struct {
+    /// <summary>Storage for the message data.</summary>
+    uint8_t *buffer;
+    /// <summary>Size of buffer in bytes. This limits the size of the messages which can be
+    /// received.</summary>
+    size_t bufferSize;
+    /// <summary>Total size of the message data in bytes.</summary>
+    size_t totalSize;
+    /// <summary>Number of bytes of message data received so far.</summary>
+    size_t receivedSize;
+    /// <summary>Message ID from the fragment headers.</summary>
+    uint16_t messageId;
+    /// <summary>Index of the next fragment which is expected.</summary>
+    uint16_t nextFragmentIndex;
+    /// <summary>Whether a message has been started but is not yet complete.</summary>
+    bool inProgress;
+} IntercoreSocketReassembly;
+
+/// <summary>
+///     Write one fragment of a message into a buffer. The number of fragments in the message
+///     is given by <see cref="IntercoreSocket_GetFragmentCount" />.
+/// </summary>
+/// <param name="fragment">Buffer of at least INTERCORE_MAX_FRAGMENT_SIZE bytes.</param>
+/// <param name="messageId">Message ID to write in the fragment header.</param>
+/// <param name="fragmentIndex">Position of the fragment in the message.</param>
+/// <param name="data">The message data.</param>
+/// <param name="size">Size of the message data in bytes, which must fit in 32 bits.</param>
+/// <returns>The size of the fragment in bytes.</returns>
+size_t IntercoreSocket_BuildFragment(uint8_t *fragment, uint16_t messageId, uint16_t fragmentIndex,
+                                     const void *data, size_t size);
+
+/// <summary>
+///     Get the number of fragments which carry a message. An empty message still needs one.
+/// </summary>
+/// <param name="size">Size of the message data in bytes.</param>
+/// <returns>The number of fragments.</returns>
+size_t IntercoreSocket_GetFragmentCount(size_t size);
+
+/// <summary>
+///     Add a fragment, which has been received from the real-time capable application, to the
+///     message.
+/// </summary>
+/// <param name="reassembly">Reassembly which holds the message.</param>
+/// <param name="fragment">The fragment which was received.</param>
+/// <param name="fragmentSize">Size of the fragment in bytes.</param>
+/// <returns>1 if the message is complete, in which case its data is in the reassembly buffer;
+///     0 if more fragments are needed; or -1 if the fragment was invalid and the message
+///     discarded.</returns>
+int IntercoreSocket_AddFragment(IntercoreSocketReassembly *reassembly, const uint8_t *fragment,
+                                size_t fragmentSize);
+
+/// <summary>
+///     Send a message of any size to the real-time capable application, as a sequence of
+///     fragments which each fit in one intercore message.
+/// </summary>
+/// <param name="sockFd">Socket returned by Application_Socket.</param>
+/// <param name="messageId">Message ID to write in the fragment headers.</param>
+/// <param name="data">The message data.</param>
+/// <param name="size">Size of the message data in bytes.</param>
+/// <returns>0 on success, or -1 on failure, in which case errno is set.</returns>
+int IntercoreSocket_Send(int sockFd, uint16_t messageId, const void *data, size_t size);
+
+/// <summary>
+///     Read one fragment from the real-time capable application and add it to the message.
+///     Call this each time the socket is readable.
+/// </summary>
+/// <param name="sockFd">Socket returned by Application_Socket.</param>
+/// <param name="reassembly">Reassembly which holds the message.</param>
+/// <returns>The size of the message if it is complete, in which case its data is in the
+///     reassembly buffer; 0 if more fragments are needed, or an invalid fragment was
+///     discarded; or -1 if the socket could not be read, in which case errno is set.</returns>
+ssize_t IntercoreSocket_Receive(int sockFd, IntercoreSocketReassembly *reassembly);
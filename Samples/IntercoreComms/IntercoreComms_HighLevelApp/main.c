@@ -3,7 +3,16 @@
 
 // This sample C application for Azure Sphere sends messages to, and receives
 // responses from, the real-time core.  It sends a message every second and prints
-// the message which was sent, and the response which was received.
+// the message which was sent, and the response which was received. Every fifth message
+// is several kilobytes long. The messages are carried by an intercore_channel, which
+// queues and fragments them, and the channel statistics are logged every ten seconds.
+// Alongside each text message it sends a typed counter message, a fixed-layout struct which
+// both applications share from intercore_sample_messages.h, so that neither side has to
+// format or parse text. With the channel statistics, it reads the timing of the real-time
+// capable application's interrupt handlers and deferred callbacks, one profile site at a time.
+// It also turns on two of the real-time capable application's logical streams, which share
+// stream messages with a two-byte header per record: its log lines, and a sample of how long
+// it took to handle each batch of messages.
 //
 // It uses the following Azure Sphere libraries
 // - log (messages shown in Visual Studio's Device Output window during debugging);
@@ -17,25 +26,49 @@
 #include <errno.h>
 #include <unistd.h>
 
-#include <sys/time.h>
-#include <sys/socket.h>
-
 #include <applibs/log.h>
-#include <applibs/application.h>
 
 #include "epoll_timerfd_utilities.h"
+#include "intercore_channel.h"
+#include "intercore_sample_messages.h"
+
+INTERCORE_CHANNEL_DEFINE_CODEC(IntercoreCounterMessage)
+INTERCORE_CHANNEL_DEFINE_CODEC(IntercoreCounterReply)
+INTERCORE_CHANNEL_DEFINE_CODEC(IntercoreProfileRequest)
+INTERCORE_CHANNEL_DEFINE_CODEC(IntercoreProfileReply)
 
 static int epollFd = -1;
 static int timerFd = -1;
-static int sockFd = -1;
+static IntercoreChannel rtAppChannel = {.sockFd = -1};
 static volatile sig_atomic_t terminationRequired = false;
 
 static const char rtAppComponentId[] = "005180bc-402f-4cb3-a662-72937dbcde47";
 
+// Handler samples received since they were last logged.
+static uint32_t handlerSampleCount = 0;
+static uint32_t handlerMessageCount = 0;
+static uint32_t handlerMaxCycles = 0;
+
+#define LARGE_MESSAGE_SIZE 2048
+#define LARGE_MESSAGE_INTERVAL 5
+#define STATS_LOG_INTERVAL 10
+// Only the start of a large message is printed.
+#define MAX_MESSAGE_CHARS_PRINTED 64
+
 static void TerminationHandler(int signalNumber);
 static void TimerEventHandler(EventData *eventData);
 static void SendMessageToRTCore(void);
-static void SocketEventHandler(EventData *eventData);
+static void RequestProfileSite(uint8_t siteIndex);
+static void LogProfileReply(const IntercoreProfileReply *reply);
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size);
+static void RTCoreTypedMessageHandler(IntercoreChannel *channel,
+                                      const IntercoreTypedHeader *header, const uint8_t *body,
+                                      size_t bodySize);
+static void RTCoreStreamRecordHandler(IntercoreChannel *channel, uint8_t streamId,
+                                      const uint8_t *data, size_t size);
+static void LogHandlerSamples(void);
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error);
+static void PrintMessage(const char *prefix, const uint8_t *message, size_t size);
 static int InitHandlers(void);
 static void CloseHandlers(void);
 
@@ -59,6 +92,13 @@ static void TimerEventHandler(EventData *eventData)
     }
 
     SendMessageToRTCore();
+
+    static int ticks = 0;
+    if (++ticks % STATS_LOG_INTERVAL == 0) {
+        IntercoreChannel_LogStats("RT core channel", &rtAppChannel);
+        LogHandlerSamples();
+        RequestProfileSite(0);
+    }
 }
 
 /// <summary>
@@ -68,43 +108,186 @@ static void SendMessageToRTCore(void)
 {
     static int iter = 0;
 
-    // Send "HELLO-WORLD-%d" message to real-time capable application.
-    static char txMessage[32];
-    sprintf(txMessage, "Hello-World-%d", iter++);
-    Log_Debug("Sending: %s\n", txMessage);
+    // Send "HELLO-WORLD-%d" message to real-time capable application. Every few messages, the
+    // text is repeated to fill a message which needs several fragments.
+    static char txMessage[LARGE_MESSAGE_SIZE];
+    int messageSize = snprintf(txMessage, sizeof(txMessage), "Hello-World-%d ", iter);
+    if (iter % LARGE_MESSAGE_INTERVAL == LARGE_MESSAGE_INTERVAL - 1) {
+        for (int i = messageSize; i < LARGE_MESSAGE_SIZE; ++i) {
+            txMessage[i] = txMessage[i % messageSize];
+        }
+        messageSize = LARGE_MESSAGE_SIZE;
+    } else {
+        // Don't send the separator when the text is not repeated.
+        --messageSize;
+    }
 
-    int bytesSent = send(sockFd, txMessage, strlen(txMessage), 0);
-    if (bytesSent == -1) {
-        Log_Debug("ERROR: Unable to send message: %d (%s)\n", errno, strerror(errno));
-        terminationRequired = true;
-        return;
+    PrintMessage("Sending", (const uint8_t *)txMessage, (size_t)messageSize);
+
+    ++iter;
+
+    // A full queue means the real-time core is not keeping up, so this message is dropped and
+    // counted in the channel statistics. The channel reports socket failures separately.
+    int result = IntercoreChannel_Send(&rtAppChannel, txMessage, (size_t)messageSize);
+    if (result == -1 && errno != EPIPE) {
+        Log_Debug("WARNING: Unable to send message: %d (%s)\n", errno, strerror(errno));
+    }
+
+    static uint32_t counter = 0;
+    IntercoreCounterMessage counterMessage = {.counter = counter++};
+    Log_Debug("Sending counter message %u\n", counterMessage.counter);
+    result = IntercoreCounterMessage_Send(&rtAppChannel, &counterMessage);
+    if (result == -1 && errno != EPIPE) {
+        Log_Debug("WARNING: Unable to send counter message: %d (%s)\n", errno, strerror(errno));
     }
 }
 
 /// <summary>
-///     Handle socket event by reading incoming data from real-time capable application.
+///     Ask the real-time capable application for the timing of one of its profile sites. Each
+///     reply asks for the next site, until all have been logged.
 /// </summary>
-static void SocketEventHandler(EventData *eventData)
+static void RequestProfileSite(uint8_t siteIndex)
 {
-    // Read response from real-time capable application.
-    char rxBuf[32];
-    int bytesReceived = recv(sockFd, rxBuf, sizeof(rxBuf), 0);
+    IntercoreProfileRequest request = {.siteIndex = siteIndex};
+    int result = IntercoreProfileRequest_Send(&rtAppChannel, &request);
+    if (result == -1 && errno != EPIPE) {
+        Log_Debug("WARNING: Unable to send profile request: %d (%s)\n", errno, strerror(errno));
+    }
+}
 
-    if (bytesReceived == -1) {
-        Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno, strerror(errno));
-        terminationRequired = true;
+/// <summary>
+///     Log the timing of a profile site, in microseconds.
+/// </summary>
+static void LogProfileReply(const IntercoreProfileReply *reply)
+{
+    if (reply->siteIndex >= reply->siteCount) {
+        return;
     }
 
-    Log_Debug("Received %d bytes: ", bytesReceived);
-    for (int i = 0; i < bytesReceived; ++i) {
-        Log_Debug("%c", isprint(rxBuf[i]) ? rxBuf[i] : '.');
+    double cyclesPerUs = reply->cpuHz / 1e6;
+    char name[INTERCORE_PROFILE_NAME_SIZE + 1];
+    memcpy(name, reply->name, INTERCORE_PROFILE_NAME_SIZE);
+    name[INTERCORE_PROFILE_NAME_SIZE] = '\0';
+
+    if (reply->count == 0) {
+        Log_Debug("RT core profile %s: not run\n", name);
+        return;
+    }
+
+    Log_Debug("RT core profile %s: %u runs, min/avg/max %.1f/%.1f/%.1f us", name, reply->count,
+              reply->minCycles / cyclesPerUs,
+              (double)reply->totalCycles / reply->count / cyclesPerUs,
+              reply->maxCycles / cyclesPerUs);
+    if (reply->count > 1) {
+        Log_Debug(", interval %.1f-%.1f us", reply->minIntervalCycles / cyclesPerUs,
+                  reply->maxIntervalCycles / cyclesPerUs);
     }
     Log_Debug("\n");
 }
 
+/// <summary>
+///     Handle a complete message from the real-time capable application.
+/// </summary>
+static void RTCoreMessageHandler(IntercoreChannel *channel, const uint8_t *data, size_t size)
+{
+    PrintMessage("Received", data, size);
+}
+
+/// <summary>
+///     Handle a typed message from the real-time capable application.
+/// </summary>
+static void RTCoreTypedMessageHandler(IntercoreChannel *channel,
+                                      const IntercoreTypedHeader *header, const uint8_t *body,
+                                      size_t bodySize)
+{
+    IntercoreCounterReply reply;
+    if (IntercoreCounterReply_Decode(header, body, bodySize, &reply)) {
+        Log_Debug("Received counter reply %u; the real-time core has received %u\n",
+                  reply.counter, reply.messagesReceived);
+        return;
+    }
+
+    IntercoreProfileReply profileReply;
+    if (IntercoreProfileReply_Decode(header, body, bodySize, &profileReply)) {
+        LogProfileReply(&profileReply);
+        if (profileReply.siteIndex + 1 < profileReply.siteCount) {
+            RequestProfileSite((uint8_t)(profileReply.siteIndex + 1));
+        }
+        return;
+    }
+
+    Log_Debug("WARNING: Discarding typed message of type %u version %u.\n", header->typeId,
+              header->version);
+}
+
+/// <summary>
+///     Handle a record on one of the real-time capable application's logical streams.
+/// </summary>
+static void RTCoreStreamRecordHandler(IntercoreChannel *channel, uint8_t streamId,
+                                      const uint8_t *data, size_t size)
+{
+    switch (streamId) {
+    case IntercoreStream_Log:
+        Log_Debug("RT core: %.*s\n", (int)size, (const char *)data);
+        break;
+
+    case IntercoreStream_Samples: {
+        IntercoreHandlerSample sample;
+        if (size != sizeof(sample)) {
+            break;
+        }
+        memcpy(&sample, data, sizeof(sample));
+        ++handlerSampleCount;
+        handlerMessageCount += sample.messagesHandled;
+        if (sample.cycles > handlerMaxCycles) {
+            handlerMaxCycles = sample.cycles;
+        }
+        break;
+    }
+
+    default:
+        Log_Debug("WARNING: Discarding record of %zu bytes on stream %u.\n", size, streamId);
+        break;
+    }
+}
+
+/// <summary>
+///     Log the handler samples which have arrived since the last call, and start counting
+///     again.
+/// </summary>
+static void LogHandlerSamples(void)
+{
+    Log_Debug("INFO: RT core handled %u messages in %u batches, longest %u cycles.\n",
+              handlerMessageCount, handlerSampleCount, handlerMaxCycles);
+    handlerSampleCount = 0;
+    handlerMessageCount = 0;
+    handlerMaxCycles = 0;
+}
+
+/// <summary>
+///     Handle a failure of the connection to the real-time capable application.
+/// </summary>
+static void RTCoreChannelErrorHandler(IntercoreChannel *channel, int error)
+{
+    terminationRequired = true;
+}
+
+/// <summary>
+///     Print the size and the start of a message.
+/// </summary>
+static void PrintMessage(const char *prefix, const uint8_t *message, size_t size)
+{
+    size_t printedChars = size < MAX_MESSAGE_CHARS_PRINTED ? size : MAX_MESSAGE_CHARS_PRINTED;
+
+    Log_Debug("%s %zu bytes: ", prefix, size);
+    for (size_t i = 0; i < printedChars; ++i) {
+        Log_Debug("%c", isprint(message[i]) ? message[i] : '.');
+    }
+    Log_Debug("%s\n", printedChars < size ? "..." : "");
+}
+
 // event handler data structures. Only the event handler field needs to be populated.
 static EventData timerEventData = {.eventHandler = &TimerEventHandler};
-static EventData socketEventData = {.eventHandler = &SocketEventHandler};
 
 /// <summary>
 ///     Set up SIGTERM termination handler and event handlers for send timer
@@ -131,23 +314,20 @@ static int InitHandlers(void)
     }
     RegisterEventHandlerToEpoll(epollFd, timerFd, &timerEventData, EPOLLIN);
 
-    // Open connection to real-time capable application.
-    sockFd = Application_Socket(rtAppComponentId);
-    if (sockFd == -1) {
-        Log_Debug("ERROR: Unable to create socket: %d (%s)\n", errno, strerror(errno));
-        return -1;
-    }
-
-    // Set timeout, to handle case where real-time capable application does not respond.
-    static const struct timeval recvTimeout = {.tv_sec = 5, .tv_usec = 0};
-    int result = setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
-    if (result == -1) {
-        Log_Debug("ERROR: Unable to set socket timeout: %d (%s)\n", errno, strerror(errno));
+    // Open connection to real-time capable application. The channel's socket is
+    // non-blocking, so a real-time capable application which does not respond cannot stall
+    // the event loop.
+    if (IntercoreChannel_Open(&rtAppChannel, epollFd, rtAppComponentId, RTCoreMessageHandler,
+                              RTCoreChannelErrorHandler) != 0) {
         return -1;
     }
+    IntercoreChannel_SetTypedMessageHandler(&rtAppChannel, RTCoreTypedMessageHandler);
+    IntercoreChannel_SetStreamRecordHandler(&rtAppChannel, RTCoreStreamRecordHandler);
 
-    // Register handler for incoming messages from real-time capable application.
-    if (RegisterEventHandlerToEpoll(epollFd, sockFd, &socketEventData, EPOLLIN) != 0) {
+    // Ask for the log and sample streams, which are then sent to this application.
+    static const IntercoreStreamControl streamControl = {.samplesEnabled = 1, .logEnabled = 1};
+    if (IntercoreChannel_SendStreamRecord(&rtAppChannel, IntercoreStream_Control,
+                                          &streamControl, sizeof(streamControl)) != 0) {
         return -1;
     }
 
@@ -160,7 +340,7 @@ static int InitHandlers(void)
 static void CloseHandlers(void)
 {
     Log_Debug("Closing file descriptors.\n");
-    CloseFdAndPrintError(sockFd, "Socket");
+    IntercoreChannel_Close(&rtAppChannel);
     CloseFdAndPrintError(timerFd, "Timer");
     CloseFdAndPrintError(epollFd, "Epoll");
 }
@@ -175,7 +355,8 @@ int main(void)
     }
 
     while (!terminationRequired) {
-        if (WaitForEventAndCallHandler(epollFd) != 0) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
             terminationRequired = true;
         }
     }
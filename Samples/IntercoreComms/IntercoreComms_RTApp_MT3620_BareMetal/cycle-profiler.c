@@ -0,0 +1,193 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "cycle-profiler.h"
+#include "format.h"
+
+_Static_assert((CYCLE_PROFILER_RING_SIZE & (CYCLE_PROFILER_RING_SIZE - 1)) == 0,
+               "CYCLE_PROFILER_RING_SIZE must be a power of two");
+
+// Debug Exception and Monitor Control Register, ARM DDI 0403E.d SC1.6.5.
+static const uintptr_t DEMCR_ADDR = 0xE000EDFC;
+
+// Sites which have been measured, in the order of their first measurements.
+static ProfileSite *firstSite = NULL;
+static ProfileSite *lastSite = NULL;
+static size_t siteCount = 0;
+
+// The most recent measurements. nextRecord counts every measurement, so it identifies both the
+// slot which is written next and how many slots are in use.
+static ProfileRecord recentRecords[CYCLE_PROFILER_RING_SIZE];
+static uint32_t nextRecord = 0;
+
+void Profiler_Init(void)
+{
+    // DEMCR[24] = TRCENA, which powers the DWT.
+    SetReg32(DEMCR_ADDR, 0x00, UINT32_C(1) << 24);
+
+    // DWT_CYCCNT = 0, then DWT_CTRL[0] = CYCCNTENA.
+    WriteReg32(DWT_BASE, 0x04, 0);
+    SetReg32(DWT_BASE, 0x00, UINT32_C(1) << 0);
+}
+
+void Profiler_Record(ProfileSite *site, uint32_t startCycles, uint32_t endCycles)
+{
+    uint32_t cycles = endCycles - startCycles;
+
+    uint32_t prevBasePri = BlockIrqs();
+
+    if (!site->isRegistered) {
+        site->isRegistered = true;
+        if (lastSite == NULL) {
+            firstSite = site;
+        } else {
+            lastSite->next = site;
+        }
+        lastSite = site;
+        ++siteCount;
+    }
+
+    if (site->count != 0) {
+        uint32_t interval = startCycles - site->lastStartCycles;
+        if (interval < site->minIntervalCycles) {
+            site->minIntervalCycles = interval;
+        }
+        if (interval > site->maxIntervalCycles) {
+            site->maxIntervalCycles = interval;
+        }
+    }
+
+    ++site->count;
+    site->lastStartCycles = startCycles;
+    site->totalCycles += cycles;
+    if (cycles < site->minCycles) {
+        site->minCycles = cycles;
+    }
+    if (cycles > site->maxCycles) {
+        site->maxCycles = cycles;
+    }
+
+    ProfileRecord *record = &recentRecords[nextRecord & (CYCLE_PROFILER_RING_SIZE - 1)];
+    record->site = site;
+    record->startCycles = startCycles;
+    record->cycles = cycles;
+    ++nextRecord;
+
+    RestoreIrqs(prevBasePri);
+}
+
+const ProfileSite *Profiler_FirstSite(void)
+{
+    return firstSite;
+}
+
+size_t Profiler_GetSiteCount(void)
+{
+    return siteCount;
+}
+
+bool Profiler_GetSite(size_t index, ProfileSite *site)
+{
+    const ProfileSite *entry = firstSite;
+    for (size_t i = 0; i < index && entry != NULL; ++i) {
+        entry = entry->next;
+    }
+    if (entry == NULL) {
+        return false;
+    }
+
+    uint32_t prevBasePri = BlockIrqs();
+    *site = *entry;
+    RestoreIrqs(prevBasePri);
+    return true;
+}
+
+size_t Profiler_GetRecent(ProfileRecord *records, size_t maxRecords)
+{
+    uint32_t prevBasePri = BlockIrqs();
+
+    size_t available =
+        nextRecord < CYCLE_PROFILER_RING_SIZE ? nextRecord : CYCLE_PROFILER_RING_SIZE;
+    size_t count = available < maxRecords ? available : maxRecords;
+    uint32_t first = nextRecord - (uint32_t)count;
+    for (size_t i = 0; i < count; ++i) {
+        records[i] = recentRecords[(first + i) & (CYCLE_PROFILER_RING_SIZE - 1)];
+    }
+
+    RestoreIrqs(prevBasePri);
+    return count;
+}
+
+void Profiler_Reset(void)
+{
+    uint32_t prevBasePri = BlockIrqs();
+
+    for (ProfileSite *site = firstSite; site != NULL; site = site->next) {
+        site->count = 0;
+        site->minCycles = UINT32_MAX;
+        site->maxCycles = 0;
+        site->totalCycles = 0;
+        site->minIntervalCycles = UINT32_MAX;
+        site->maxIntervalCycles = 0;
+    }
+    nextRecord = 0;
+
+    RestoreIrqs(prevBasePri);
+}
+
+// Format a time in tenths of a microsecond as microseconds with one decimal place.
+#define US_FORMAT "%u.%u"
+#define US_ARGS(tenths_) (unsigned)((tenths_) / 10), (unsigned)((tenths_) % 10)
+
+void Profiler_Report(ProfileWriteLine writeLine, size_t maxRecent)
+{
+    // Copy the recent measurements first, before writing the report adds its own, such as
+    // those of a UART interrupt.
+    ProfileRecord records[CYCLE_PROFILER_RING_SIZE];
+    size_t recordCount = Profiler_GetRecent(
+        records, maxRecent < CYCLE_PROFILER_RING_SIZE ? maxRecent : CYCLE_PROFILER_RING_SIZE);
+
+    char line[128];
+
+    uint32_t tenthsMhz = CYCLE_PROFILER_CPU_HZ / 100000u;
+    Format_Snprintf(line, sizeof(line), "Profile at %u.%u MHz: count, min/avg/max us, interval us",
+                    US_ARGS(tenthsMhz));
+    writeLine(line);
+
+    ProfileSite site;
+    for (size_t index = 0; Profiler_GetSite(index, &site); ++index) {
+        if (site.count == 0) {
+            Format_Snprintf(line, sizeof(line), "  %s: 0", site.name);
+            writeLine(line);
+            continue;
+        }
+
+        uint32_t minUs = Profiler_CyclesToTenthsUs(site.minCycles);
+        uint32_t avgUs = Profiler_CyclesToTenthsUs(site.totalCycles / site.count);
+        uint32_t maxUs = Profiler_CyclesToTenthsUs(site.maxCycles);
+        size_t length = Format_Snprintf(line, sizeof(line),
+                                        "  %s: %u, " US_FORMAT "/" US_FORMAT "/" US_FORMAT,
+                                        site.name, (unsigned)site.count, US_ARGS(minUs),
+                                        US_ARGS(avgUs), US_ARGS(maxUs));
+        if (site.count > 1) {
+            uint32_t minIntervalUs = Profiler_CyclesToTenthsUs(site.minIntervalCycles);
+            uint32_t maxIntervalUs = Profiler_CyclesToTenthsUs(site.maxIntervalCycles);
+            Format_Snprintf(line + length, sizeof(line) - length,
+                            ", " US_FORMAT "-" US_FORMAT, US_ARGS(minIntervalUs),
+                            US_ARGS(maxIntervalUs));
+        }
+        writeLine(line);
+    }
+
+    if (recordCount == 0) {
+        return;
+    }
+
+    writeLine("Recent, oldest first: start cycle, site, us");
+    for (size_t i = 0; i < recordCount; ++i) {
+        uint32_t us = Profiler_CyclesToTenthsUs(records[i].cycles);
+        Format_Snprintf(line, sizeof(line), "  %08x %s " US_FORMAT,
+                        (unsigned)records[i].startCycles, records[i].site->name, US_ARGS(us));
+        writeLine(line);
+    }
+}
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License.
+
+"""Decodes the binary log records which Uart_LogPoll writes in UartLogMode_Binary.
+
+Each record holds the address of its format string, rather than the text. This
+script reads the format strings from the application's ELF file, formats the
+records, and writes them to stdout. Other bytes, such as the text which the
+Uart_Write*Poll functions write, are passed through unchanged.
+
+Capture the output of the real-time core UART to a file, or pipe it into this
+script, for example:
+
+    stty -F /dev/ttyUSB0 115200 raw
+    cat /dev/ttyUSB0 | decode_binary_log.py out/ARM-Debug-<API set>/IntercoreComms_RTApp_MT3620_BareMetal.out
+
+Usage: decode_binary_log.py ELF_FILE [CAPTURE_FILE]
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+RECORD_MARKER = 0xA5
+
+SHT_NOBITS = 8
+SHF_ALLOC = 0x2
+
+# The conversions which Format_Vsnprintf supports.
+CONVERSION_RE = re.compile(rb"%([-0]*)(\*|\d+)?(?:\.(\*|\d+))?(?:hh|h|l|z)?(.?)", re.DOTALL)
+
+
+class ElfImage:
+    """The sections of a 32-bit little-endian ELF file which are loaded onto the device."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError(f"{path} is not a 32-bit little-endian ELF file")
+
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+
+        self.sections = []
+        for i in range(shnum):
+            (_, sh_type, sh_flags, sh_addr, sh_offset, sh_size) = struct.unpack_from(
+                "<IIIIII", self.data, shoff + i * shentsize)
+            if sh_flags & SHF_ALLOC and sh_type != SHT_NOBITS:
+                self.sections.append((sh_addr, sh_offset, sh_size))
+
+    def read_string(self, addr):
+        """Returns the null-terminated string at addr, or None if it is not in the image."""
+        for (sh_addr, sh_offset, sh_size) in self.sections:
+            if sh_addr <= addr < sh_addr + sh_size:
+                start = sh_offset + (addr - sh_addr)
+                end = self.data.find(b"\0", start, sh_offset + sh_size)
+                return self.data[start:end if end != -1 else sh_offset + sh_size]
+        return None
+
+
+class ArgReader:
+    """Reads the arguments which Format_EncodeArgs encoded."""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def word(self):
+        if self.pos + 4 > len(self.data):
+            return None
+        value, = struct.unpack_from("<I", self.data, self.pos)
+        self.pos += 4
+        return value
+
+    def string(self):
+        if self.pos >= len(self.data):
+            return None
+        length = self.data[self.pos]
+        value = self.data[self.pos + 1:self.pos + 1 + length]
+        self.pos += 1 + length
+        return value
+
+
+def pad(text, flags, width):
+    if len(text) >= width:
+        return text
+    if "-" in flags:
+        return text + b" " * (width - len(text))
+    if "0" in flags and text[:1] == b"-":
+        return b"-" + text[1:].rjust(width - 1, b"0")
+    if "0" in flags:
+        return text.rjust(width, b"0")
+    return text.rjust(width, b" ")
+
+
+def format_record(fmt, args):
+    """Formats the encoded arguments with the format string, as Format_Vsnprintf does."""
+
+    def convert(match):
+        flags = match.group(1).decode()
+        width = match.group(2)
+        precision = match.group(3)
+        conversion = match.group(4)
+
+        if width == b"*":
+            value = args.word()
+            if value is None:
+                return b"<missing>"
+            width = struct.unpack("<i", struct.pack("<I", value))[0]
+            if width < 0:
+                flags += "-"
+                width = -width
+        else:
+            width = int(width) if width else 0
+
+        if precision == b"*":
+            precision = args.word()
+
+        if conversion == b"%":
+            return b"%"
+        if conversion == b"s":
+            value = args.string()
+            if value is None:
+                return b"<missing>"
+            # Pad with spaces only, as Format_Vsnprintf does.
+            return pad(value, flags.replace("0", ""), width)
+        if conversion not in (b"d", b"i", b"u", b"x", b"X", b"c", b"p"):
+            return match.group(0)
+
+        value = args.word()
+        if value is None:
+            return b"<missing>"
+        if conversion == b"c":
+            return pad(bytes([value & 0xFF]), flags.replace("0", ""), width)
+        if conversion == b"p":
+            return b"0x%08x" % value
+        if conversion in (b"d", b"i"):
+            text = b"%d" % struct.unpack("<i", struct.pack("<I", value))[0]
+        elif conversion == b"u":
+            text = b"%d" % value
+        elif conversion == b"x":
+            text = b"%x" % value
+        else:
+            text = b"%X" % value
+        return pad(text, flags, width)
+
+    return CONVERSION_RE.sub(convert, fmt)
+
+
+def decode(image, stream, out):
+    buffer = b""
+    while True:
+        chunk = stream.read1(4096) if hasattr(stream, "read1") else stream.read(4096)
+        if not chunk:
+            break
+        buffer += chunk
+
+        while buffer:
+            marker = buffer.find(bytes([RECORD_MARKER]))
+            if marker == -1:
+                out.write(buffer)
+                buffer = b""
+                break
+            out.write(buffer[:marker])
+            buffer = buffer[marker:]
+
+            # Wait for the rest of the record.
+            if len(buffer) < 2 or len(buffer) < 2 + buffer[1]:
+                break
+
+            length = buffer[1]
+            record = buffer[2:2 + length]
+            buffer = buffer[2 + length:]
+
+            if length < 4:
+                out.write(b"<short log record>\n")
+                continue
+
+            fmt_addr, = struct.unpack_from("<I", record, 0)
+            fmt = image.read_string(fmt_addr)
+            if fmt is None:
+                out.write(b"<log record with unknown format string 0x%08x>\n" % fmt_addr)
+                continue
+            out.write(format_record(fmt, ArgReader(record[4:])))
+
+        out.flush()
+
+    out.write(buffer)
+    out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode binary log records from an RTApp.")
+    parser.add_argument("elf", help="the application's ELF file, which has the format strings")
+    parser.add_argument("capture", nargs="?", help="captured UART output (default: stdin)")
+    args = parser.parse_args()
+
+    image = ElfImage(args.elf)
+    if args.capture:
+        with open(args.capture, "rb") as stream:
+            decode(image, stream, sys.stdout.buffer)
+    else:
+        decode(image, sys.stdin.buffer, sys.stdout.buffer)
+
+
+if __name__ == "__main__":
+    main()
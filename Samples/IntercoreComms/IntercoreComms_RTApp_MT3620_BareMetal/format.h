@@ -0,0 +1,51 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+/// <para>Formats text into the supplied buffer, like vsnprintf, without allocating memory or
+/// using the C library. The output is always null-terminated, and is truncated if it does not
+/// fit in the buffer.</para>
+/// <para>The supported conversions are %d, %i, %u, %x, %X, %c, %s, %p and %%. Each conversion
+/// can have the '-' (left-justify) and '0' (pad with zeroes) flags and a field width, which can
+/// be '*'. %s can have a precision, which can also be '*'. The 'h', 'hh', 'l' and 'z' length
+/// modifiers are accepted and ignored, because int, long and size_t all have 32 bits on the
+/// real-time cores. Floating point and 64-bit conversions are not supported.</para>
+/// </summary>
+/// <param name="buffer">Buffer which receives the text.</param>
+/// <param name="bufferSize">Size of the buffer in bytes, including the null terminator.</param>
+/// <param name="format">printf-style format string.</param>
+/// <param name="args">Arguments for the format string.</param>
+/// <returns>Number of characters which were written, not including the null terminator.
+/// </returns>
+size_t Format_Vsnprintf(char *buffer, size_t bufferSize, const char *format, va_list args);
+
+/// <summary>
+/// Formats text into the supplied buffer. See <see cref="Format_Vsnprintf" />.
+/// </summary>
+size_t Format_Snprintf(char *buffer, size_t bufferSize, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/// <summary>
+/// <para>Encodes the arguments for a format string, rather than the text which they would
+/// produce, so that the text can be formatted later on another computer.</para>
+/// <para>Each integer, character, pointer and '*' width or precision is encoded as a 32-bit
+/// little-endian value. Each string is encoded as a length byte followed by up to 255
+/// characters, without a null terminator. Encoding stops at the last argument which fits in the
+/// buffer.</para>
+/// </summary>
+/// <param name="buffer">Buffer which receives the encoded arguments.</param>
+/// <param name="bufferSize">Size of the buffer in bytes.</param>
+/// <param name="format">printf-style format string, with the conversions which
+/// <see cref="Format_Vsnprintf" /> supports.</param>
+/// <param name="args">Arguments for the format string.</param>
+/// <returns>Number of bytes which were written.</returns>
+size_t Format_EncodeArgs(uint8_t *buffer, size_t bufferSize, const char *format, va_list args);
+
+#endif // #ifndef FORMAT_H
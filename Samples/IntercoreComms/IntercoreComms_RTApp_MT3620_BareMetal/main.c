@@ -9,15 +9,52 @@
 #include <limits.h>
 
 #include "mt3620-baremetal.h"
+#include "cycle-profiler.h"
+#include "deferred-callbacks.h"
+#include "format.h"
 #include "mt3620-intercore.h"
 #include "mt3620-uart-poll.h"
+#include "intercore_sample_messages.h"
+
+INTERCORE_DEFINE_RING_CODEC(IntercoreCounterMessage)
+INTERCORE_DEFINE_RING_CODEC(IntercoreCounterReply)
+INTERCORE_DEFINE_RING_CODEC(IntercoreProfileRequest)
+INTERCORE_DEFINE_RING_CODEC(IntercoreProfileReply)
 
 extern uint32_t StackTop; // &StackTop == end of TCM
 
 static _Noreturn void DefaultExceptionHandler(void);
 
-static void PrintBytes(const uint8_t *buf, int start, int end);
+static uint32_t ReadLittleEndian(const uint8_t *buf, size_t size);
 static void PrintGuid(const uint8_t *guid);
+static void HandleMessage(void);
+static int HandleTypedMessage(const IntercoreBlock *message, uint16_t typeId,
+                              IntercoreCursor *writeCursor);
+static void HandleStreamMessage(const IntercoreBlock *message);
+static void SendStreamRecord(IntercoreCursor *writeCursor, uint8_t streamId, const void *data,
+                             uint32_t size);
+
+static void HandleIntercoreIrq(void);
+static void HandleIntercoreIrqDeferred(void);
+static void FillProfileReply(uint8_t siteIndex, IntercoreProfileReply *reply);
+
+static BufferHeader *outbound, *inbound;
+static uint32_t sharedBufSize = 0;
+
+// Messages from the high-level application can be larger than the shared buffer, so they are
+// reassembled here from their fragments. The reply is sent from the same storage.
+#define MAX_MESSAGE_SIZE 4096
+static uint8_t messageBuffer[MAX_MESSAGE_SIZE] SYSRAM_BSS;
+static IntercoreReassembly reassembly;
+static IntercoreFragmenter replySender;
+
+static uint32_t counterMessagesReceived = 0;
+
+// Records for the high-level application's logical streams are collected here while the
+// messages are handled, and sent together in one stream message. Nothing is sent until the
+// high-level application has sent a control record.
+static IntercoreStreamBatch streamBatch;
+static IntercoreStreamControl streamControl = {.samplesEnabled = 0, .logEnabled = 0};
 
 static _Noreturn void RTCoreMain(void);
 
@@ -45,7 +82,9 @@ __attribute__((used)) = {
     [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
     [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
 
-    [INT_TO_EXC(0)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+    [INT_TO_EXC(0)... INT_TO_EXC(10)] = (uintptr_t)DefaultExceptionHandler,
+    [INT_TO_EXC(11)] = (uintptr_t)Intercore_HandleIrq11,
+    [INT_TO_EXC(12)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
 
 static _Noreturn void DefaultExceptionHandler(void)
 {
@@ -54,27 +93,281 @@ static _Noreturn void DefaultExceptionHandler(void)
     }
 }
 
-static void PrintBytes(const uint8_t *buf, int start, int end)
+static uint32_t ReadLittleEndian(const uint8_t *buf, size_t size)
 {
-    int step = (end >= start) ? +1 : -1;
-
-    for (/* nop */; start != end; start += step) {
-        Uart_WriteHexBytePoll(buf[start]);
+    uint32_t value = 0;
+    for (size_t i = size; i > 0; --i) {
+        value = (value << 8) | buf[i - 1];
     }
-    Uart_WriteHexBytePoll(buf[end]);
+    return value;
 }
 
 static void PrintGuid(const uint8_t *guid)
 {
-    PrintBytes(guid, 3, 0); // 4-byte little-endian word
-    Uart_WriteStringPoll("-");
-    PrintBytes(guid, 5, 4); // 2-byte little-endian half
-    Uart_WriteStringPoll("-");
-    PrintBytes(guid, 7, 6); // 2-byte little-endian half
-    Uart_WriteStringPoll("-");
-    PrintBytes(guid, 8, 9); // 2 bytes
-    Uart_WriteStringPoll("-");
-    PrintBytes(guid, 10, 15); // 6 bytes
+    // The first three fields are little-endian, and the last two are in byte order.
+    Uart_LogPoll("%08x-%04x-%04x-%02x%02x-", (unsigned)ReadLittleEndian(guid, 4),
+                 (unsigned)ReadLittleEndian(guid + 4, 2), (unsigned)ReadLittleEndian(guid + 6, 2),
+                 guid[8], guid[9]);
+    Uart_WriteHexBytesPoll(guid + 10, 6, '\0');
+}
+
+// Only the start of a large payload is printed.
+#define MAX_PAYLOAD_BYTES_PRINTED 64
+
+// Print a message which has been reassembled into messageBuffer, and start sending the reply.
+static void HandleMessage(void)
+{
+    uint32_t payloadBytes = reassembly.totalSize;
+    uint32_t printedBytes =
+        payloadBytes < MAX_PAYLOAD_BYTES_PRINTED ? payloadBytes : MAX_PAYLOAD_BYTES_PRINTED;
+
+    Uart_LogPoll("Received message of %u bytes in %u fragments:\r\n", (unsigned)payloadBytes,
+                 (unsigned)reassembly.nextFragmentIndex);
+
+    Uart_WriteStringPoll("  Component Id (16 bytes): ");
+    PrintGuid(reassembly.messageHeader);
+    Uart_WriteStringPoll("\r\n");
+
+    // Print reserved field as little-endian 4-byte integer.
+    Uart_LogPoll("  Reserved (4 bytes): %08x\r\n",
+                 (unsigned)ReadLittleEndian(reassembly.messageHeader + 16, 4));
+
+    // Print message as hex.
+    Uart_LogPoll("  Payload (%u bytes as hex): ", (unsigned)printedBytes);
+    Uart_WriteHexBytesPoll(messageBuffer, printedBytes, ':');
+    Uart_WriteStringPoll("\r\n");
+
+    // Print message as text.
+    char text[MAX_PAYLOAD_BYTES_PRINTED + 1];
+    for (uint32_t i = 0; i < printedBytes; ++i) {
+        text[i] = isprint(messageBuffer[i]) ? (char)messageBuffer[i] : '.';
+    }
+    text[printedBytes] = '\0';
+    Uart_LogPoll("  Payload (%u bytes as text): %s\r\n", (unsigned)printedBytes, text);
+
+    // Transform the payload by converting upper-case text to lower-case and vice versa.
+    for (uint32_t i = 0; i < payloadBytes; ++i) {
+        // This must be an unsigned char, rather than a char, else a compile-time warning
+        // is triggered by __ctype_lookup in ctype.h.
+        unsigned char c = messageBuffer[i];
+        if (isupper(c)) {
+            c = tolower(c);
+        } else if (islower(c)) {
+            c = toupper(c);
+        }
+
+        messageBuffer[i] = c;
+    }
+
+    // Send the payload back with the header unchanged, so that the reply reaches the sender.
+    StartFragmentedSend(&replySender, reassembly.messageHeader, reassembly.messageId,
+                        messageBuffer, payloadBytes);
+}
+
+// Handle a typed message which is still in the shared buffer, and write the reply directly into
+// the shared buffer. Returns -1 if there was no space for the reply, so the message should be
+// handled again later.
+static int HandleTypedMessage(const IntercoreBlock *message, uint16_t typeId,
+                              IntercoreCursor *writeCursor)
+{
+    uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+
+    switch (typeId) {
+    case IntercoreCounterMessage_TypeId: {
+        IntercoreCounterMessage counterMessage;
+        if (IntercoreCounterMessage_Decode(message, messageHeader, &counterMessage) == -1) {
+            Uart_LogPoll("Discarding counter message with wrong version or size\r\n");
+            return 0;
+        }
+
+        IntercoreCounterReply reply = {.counter = counterMessage.counter,
+                                       .messagesReceived = counterMessagesReceived + 1};
+        if (IntercoreCounterReply_Enqueue(writeCursor, messageHeader, &reply) == -1) {
+            return -1;
+        }
+
+        ++counterMessagesReceived;
+        Uart_LogPoll("Received counter message %u\r\n", (unsigned)counterMessage.counter);
+        if (streamControl.logEnabled) {
+            char line[40];
+            size_t length = Format_Snprintf(line, sizeof(line), "Received counter message %u",
+                                            (unsigned)counterMessage.counter);
+            SendStreamRecord(writeCursor, IntercoreStream_Log, line, (uint32_t)length);
+        }
+        return 0;
+    }
+
+    case IntercoreProfileRequest_TypeId: {
+        IntercoreProfileRequest request;
+        if (IntercoreProfileRequest_Decode(message, messageHeader, &request) == -1) {
+            Uart_LogPoll("Discarding profile request with wrong version or size\r\n");
+            return 0;
+        }
+
+        IntercoreProfileReply reply;
+        FillProfileReply(request.siteIndex, &reply);
+        return IntercoreProfileReply_Enqueue(writeCursor, messageHeader, &reply);
+    }
+
+    default:
+        Uart_LogPoll("Discarding typed message of unknown type %u\r\n", typeId);
+        return 0;
+    }
+}
+
+// Read the records of a stream message. The streams are then sent to the application which
+// sent it.
+static void HandleStreamMessage(const IntercoreBlock *message)
+{
+    uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+    IsStreamMessage(message, messageHeader);
+
+    uint8_t data[INTERCORE_STREAM_MAX_RECORD_SIZE];
+    uint32_t offset = 0, size;
+    uint8_t streamId;
+    int result;
+    while ((result = ReadStreamRecord(message, &offset, &streamId, data, &size)) == 1) {
+        if (streamId != IntercoreStream_Control || size != sizeof(streamControl)) {
+            Uart_LogPoll("Discarding record of %u bytes on stream %u\r\n", (unsigned)size,
+                         streamId);
+            continue;
+        }
+
+        __builtin_memcpy(&streamControl, data, sizeof(streamControl));
+        // Records which are waiting to be sent to a previous application are dropped.
+        if (__builtin_memcmp(streamBatch.messageHeader, messageHeader, sizeof(messageHeader)) !=
+            0) {
+            InitStreamBatch(&streamBatch, messageHeader);
+        }
+        Uart_LogPoll("Streams: samples %s, log %s\r\n", streamControl.samplesEnabled ? "on" : "off",
+                     streamControl.logEnabled ? "on" : "off");
+    }
+
+    if (result == -1) {
+        Uart_WriteStringPoll("Discarding invalid stream record\r\n");
+    }
+}
+
+// Add a record to the stream batch, sending the batch first if the record does not fit. If
+// there is no space for the batch in the shared buffer, the record is dropped.
+static void SendStreamRecord(IntercoreCursor *writeCursor, uint8_t streamId, const void *data,
+                             uint32_t size)
+{
+    if (AddStreamRecord(&streamBatch, streamId, data, size) == 0) {
+        return;
+    }
+
+    if (EnqueueStreamBatch(writeCursor, &streamBatch) == -1 ||
+        AddStreamRecord(&streamBatch, streamId, data, size) == -1) {
+        Uart_LogPoll("Dropping record of %u bytes on stream %u\r\n", (unsigned)size, streamId);
+    }
+}
+
+// Copy the counts of a profile site into a reply, or leave them zero if there is no such site.
+static void FillProfileReply(uint8_t siteIndex, IntercoreProfileReply *reply)
+{
+    *reply = (IntercoreProfileReply){.siteIndex = siteIndex};
+    size_t siteCount = Profiler_GetSiteCount();
+    reply->siteCount = (uint8_t)(siteCount < UINT8_MAX ? siteCount : UINT8_MAX);
+
+    ProfileSite site;
+    if (!Profiler_GetSite(siteIndex, &site)) {
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < INTERCORE_PROFILE_NAME_SIZE && site.name[i] != '\0'; ++i) {
+        reply->name[i] = site.name[i];
+    }
+    reply->cpuHz = CYCLE_PROFILER_CPU_HZ;
+    reply->count = site.count;
+    if (site.count != 0) {
+        reply->minCycles = site.minCycles;
+        reply->maxCycles = site.maxCycles;
+        reply->totalCycles = site.totalCycles;
+    }
+    if (site.count > 1) {
+        reply->minIntervalCycles = site.minIntervalCycles;
+        reply->maxIntervalCycles = site.maxIntervalCycles;
+    }
+}
+
+static void HandleIntercoreIrq(void)
+{
+    static ProfileSite profileSite = PROFILE_SITE_INIT("intercore irq");
+    uint32_t startCycles = Profiler_Now();
+
+    static DeferredCallback cbn =
+        DEFERRED_CALLBACK_INIT(HandleIntercoreIrqDeferred, DeferredPriority_Normal);
+    Deferred_Enqueue(&cbn);
+
+    Profiler_Stop(&profileSite, startCycles);
+}
+
+static void HandleIntercoreIrqDeferred(void)
+{
+    static ProfileSite profileSite = PROFILE_SITE_INIT("intercore messages");
+    uint32_t startCycles = Profiler_Now();
+
+    IntercoreCursor readCursor, writeCursor;
+    if (BeginDequeue(&readCursor, outbound, inbound, sharedBufSize) == -1 ||
+        BeginEnqueue(&writeCursor, inbound, outbound, sharedBufSize) == -1) {
+        return;
+    }
+
+    // Write as much of the current reply as fits. A reply which does not fit completely is
+    // continued after the high-level application has read from the shared buffer.
+    ContinueFragmentedSend(&replySender, &writeCursor);
+
+    // Read typed and stream messages, and fragments until a message is complete. While its
+    // reply is being sent, because messageBuffer holds the reply, reading stops at the next
+    // fragment, which stays in the shared buffer until then. The control messages ahead of it
+    // are still handled, and their replies go in the control lane, which the reply leaves free.
+    IntercoreBlock block;
+    uint16_t messagesHandled = 0;
+    for (;;) {
+        IntercoreCursor readCursorBeforePeek = readCursor;
+        if (PeekNextBlock(&readCursor, &block) != 0) {
+            break;
+        }
+
+        ++messagesHandled;
+        uint16_t typeId;
+        if (IsStreamMessage(&block, NULL)) {
+            HandleStreamMessage(&block);
+        } else if (IsTypedMessage(&block, &typeId)) {
+            if (HandleTypedMessage(&block, typeId, &writeCursor) == -1) {
+                // Leave the message in the shared buffer until there is space for its reply.
+                readCursor = readCursorBeforePeek;
+                --messagesHandled;
+                break;
+            }
+        } else if (replySender.inProgress) {
+            readCursor = readCursorBeforePeek;
+            --messagesHandled;
+            break;
+        } else if (ReassembleFragment(&reassembly, &block) == 1) {
+            HandleMessage();
+            ContinueFragmentedSend(&replySender, &writeCursor);
+        }
+    }
+
+    // Only send a sample when messages were handled, because the high-level application reading
+    // the sample raises this interrupt again.
+    if (messagesHandled > 0 && streamControl.samplesEnabled) {
+        IntercoreHandlerSample sample = {.messagesHandled = messagesHandled,
+                                         .cycles = Profiler_Now() - startCycles};
+        SendStreamRecord(&writeCursor, IntercoreStream_Samples, &sample, sizeof(sample));
+    }
+
+    // The records of every message handled here go in one stream message. If there is not
+    // space for it, they are sent with the next batch.
+    EnqueueStreamBatch(&writeCursor, &streamBatch);
+
+    CommitEnqueue(&writeCursor);
+    CommitDequeue(&readCursor);
+
+    Profiler_Stop(&profileSite, startCycles);
 }
 
 static _Noreturn void RTCoreMain(void)
@@ -82,86 +375,37 @@ static _Noreturn void RTCoreMain(void)
     // SCB->VTOR = ExceptionVectorTable
     WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
 
+    Profiler_Init();
+
     Uart_Init();
+    // To shorten the output, and avoid formatting it on this core, set this to
+    // UartLogMode_Binary and decode the output with decode_binary_log.py.
+    Uart_SetLogMode(UartLogMode_Text);
     Uart_WriteStringPoll("--------------------------------\r\n");
     Uart_WriteStringPoll("IntercoreComms_RTApp_MT3620_BareMetal\r\n");
     Uart_WriteStringPoll("App built on: " __DATE__ ", " __TIME__ "\r\n");
 
-    BufferHeader *outbound, *inbound;
-    uint32_t sharedBufSize = 0;
     if (GetIntercoreBuffers(&outbound, &inbound, &sharedBufSize) == -1) {
         for (;;) {
             // empty.
         }
     }
 
-    static const size_t payloadStart = 20;
-
-    for (;;) {
-        uint8_t buf[256];
-        uint32_t dataSize = sizeof(buf);
+    InitReassembly(&reassembly, messageBuffer, sizeof(messageBuffer));
 
-        // On success, dataSize is set to the actual number of bytes which were read.
-        int r = DequeueData(outbound, inbound, sharedBufSize, buf, &dataSize);
+    // Keep space in the outbound buffer for typed replies while a large reply is sent.
+    SetIntercoreControlLaneSize(INTERCORE_SUGGESTED_CONTROL_LANE_SIZE);
 
-        if (r == -1 || dataSize < payloadStart) {
-            continue;
-        }
+    EnableIntercoreIrq(HandleIntercoreIrq);
 
-        Uart_WriteStringPoll("Received message of ");
-        Uart_WriteIntegerPoll(dataSize);
-        Uart_WriteStringPoll(" bytes:\r\n");
-
-        Uart_WriteStringPoll("  Component Id (16 bytes): ");
-        PrintGuid(buf);
-        Uart_WriteStringPoll("\r\n");
-
-        // Print reserved field as little-endian 4-byte integer.
-        Uart_WriteStringPoll("  Reserved (4 bytes): ");
-        PrintBytes(buf, 19, 16);
-        Uart_WriteStringPoll("\r\n");
-
-        // Print message as hex.
-        size_t payloadBytes = dataSize - payloadStart;
-        Uart_WriteStringPoll("  Payload (");
-        Uart_WriteIntegerPoll(payloadBytes);
-        Uart_WriteStringPoll(" bytes as hex): ");
-
-        for (size_t i = payloadStart; i < dataSize; ++i) {
-            Uart_WriteHexBytePoll(buf[i]);
-            if (i != dataSize - 1) {
-                Uart_WriteStringPoll(":");
-            }
-        }
-        Uart_WriteStringPoll("\r\n");
-
-        // Print message as text.
-        Uart_WriteStringPoll("  Payload (");
-        Uart_WriteIntegerPoll(payloadBytes);
-        Uart_WriteStringPoll(" bytes as text): ");
-        for (size_t i = payloadStart; i < dataSize; ++i) {
-            char c[2];
-            c[0] = isprint(buf[i]) ? buf[i] : '.';
-            c[1] = '\0';
-            Uart_WriteStringPoll(c);
-        }
-        Uart_WriteStringPoll("\r\n");
-
-        // Transform the payload by converting upper-case text to lower-case and vice versa,
-        // and send the payload back to the sender.
-        for (size_t i = payloadStart; i < dataSize; ++i) {
-            // This must be an unsigned char, rather than a char, else a compile-time warning
-            // is triggered by __ctype_lookup in ctype.h.
-            unsigned char c = buf[i];
-            if (isupper(c)) {
-                c = tolower(c);
-            } else if (islower(c)) {
-                c = toupper(c);
-            }
+    // Handle any messages which arrived before the interrupt was enabled.
+    HandleIntercoreIrq();
 
-            buf[i] = c;
-        }
+    for (;;) {
+        Deferred_WaitForCallbacks();
+        Deferred_InvokeCallbacks();
 
-        EnqueueData(inbound, outbound, sharedBufSize, buf, dataSize);
+        // Send any notifications which were held back while handling the callbacks.
+        FlushIntercoreNotifications();
     }
 }
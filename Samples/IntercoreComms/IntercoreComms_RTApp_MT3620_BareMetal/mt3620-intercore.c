@@ -9,6 +9,30 @@
 
 static const uintptr_t MAILBOX_BASE = 0x21050000;
 
+// Mailbox software interrupt, which the high-level application raises on this core.
+static const int MAILBOX_SW_IRQ = 11;
+// SW_RX_INT_EN and SW_RX_INT_STS. Port 0 and port 1 are raised when the high-level application
+// has written data and read data respectively; either means the buffers should be checked.
+static const size_t MAILBOX_SW_RX_INT_EN = 0x18;
+static const size_t MAILBOX_SW_RX_INT_STS = 0x1C;
+static const uint32_t MAILBOX_SW_RX_PORTS = (1U << 0) | (1U << 1);
+
+static Callback intercoreIrqHandler = NULL;
+
+// SW_TX_INT_PORT. Port 0 tells the high-level application that data has been written, and
+// port 1 that data has been read.
+static const size_t MAILBOX_SW_TX_INT_PORT = 0x14;
+static const uint32_t MAILBOX_DATA_WRITTEN_PORT = 1U << 0;
+static const uint32_t MAILBOX_DATA_READ_PORT = 1U << 1;
+
+// Notifications which are held back until the threshold is reached or they are flushed.
+static uint32_t notificationThreshold = 1;
+static uint32_t pendingNotificationPorts = 0;
+static uint32_t pendingNotificationCount = 0;
+
+// Space in the outbound buffer which bulk blocks leave free for control messages.
+static uint32_t controlLaneSize = 0;
+
 static void ReceiveMessage(uint32_t *command, uint32_t *data);
 static uint32_t GetBufferSize(uint32_t bufferBase);
 static BufferHeader *GetBufferHeader(uint32_t bufferBase);
@@ -36,10 +60,11 @@ static uint32_t GetBufferSize(uint32_t bufferBase)
 
 static BufferHeader *GetBufferHeader(uint32_t bufferBase)
 {
-    return (BufferHeader *)(bufferBase & ~0x1F);
+    return (BufferHeader *)(uintptr_t)(bufferBase & ~0x1F);
 }
 
-int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_t *bufSize)
+COLD_CODE int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound,
+                                   uint32_t *bufSize)
 {
     // Wait for the mailbox to be set up.
     uint32_t baseRead = 0, baseWrite = 0;
@@ -75,6 +100,67 @@ int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_
     return 0;
 }
 
+void EnableIntercoreIrq(Callback handler)
+{
+    intercoreIrqHandler = handler;
+
+    // Discard any notifications which were raised while the mailbox was being set up.
+    WriteReg32(MAILBOX_BASE, MAILBOX_SW_RX_INT_STS, MAILBOX_SW_RX_PORTS);
+    WriteReg32(MAILBOX_BASE, MAILBOX_SW_RX_INT_EN, MAILBOX_SW_RX_PORTS);
+
+    SetNvicPriority(MAILBOX_SW_IRQ, 2);
+    EnableNvicInterrupt(MAILBOX_SW_IRQ);
+}
+
+TCM_CODE void Intercore_HandleIrq11(void)
+{
+    // Writing the status bits back clears them.
+    uint32_t status = ReadReg32(MAILBOX_BASE, MAILBOX_SW_RX_INT_STS);
+    WriteReg32(MAILBOX_BASE, MAILBOX_SW_RX_INT_STS, status);
+
+    if ((status & MAILBOX_SW_RX_PORTS) != 0 && intercoreIrqHandler != NULL) {
+        intercoreIrqHandler();
+    }
+}
+
+void SetIntercoreNotificationThreshold(uint32_t messageCount)
+{
+    notificationThreshold = messageCount;
+    if (notificationThreshold != 0 && pendingNotificationCount >= notificationThreshold) {
+        FlushIntercoreNotifications();
+    }
+}
+
+void FlushIntercoreNotifications(void)
+{
+    if (pendingNotificationPorts != 0) {
+        WriteReg32(MAILBOX_BASE, MAILBOX_SW_TX_INT_PORT, pendingNotificationPorts);
+    }
+    pendingNotificationPorts = 0;
+    pendingNotificationCount = 0;
+}
+
+void SetIntercoreControlLaneSize(uint32_t size)
+{
+    controlLaneSize = size;
+}
+
+static void NotifyHighLevelApp(uint32_t port, uint32_t messageCount)
+{
+    // A commit of no blocks has not moved the shared position, so there is nothing for the
+    // high-level app to read. It is not counted, and leaves what is pending to the next commit
+    // or to FlushIntercoreNotifications.
+    if (messageCount == 0) {
+        return;
+    }
+
+    pendingNotificationPorts |= port;
+    pendingNotificationCount += messageCount;
+    if (notificationThreshold != 0 && pendingNotificationCount >= notificationThreshold) {
+        FlushIntercoreNotifications();
+    }
+}
+
 static uint8_t *DataAreaOffset8(BufferHeader *header, size_t offset)
 {
     // Data storage area following header in buffer.
@@ -96,17 +182,146 @@ static uint32_t RoundUp(uint32_t value, uint32_t alignment)
     return (value + (alignment - 1)) & ~(alignment - 1);
 }
 
-int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, const void *src,
-                uint32_t dataSize)
+static uint32_t AdvancePosition(uint32_t position, uint32_t dataSize, uint32_t bufSize)
 {
-    uint32_t remoteReadPosition = inbound->readPosition;
-    uint32_t localWritePosition = outbound->writePosition;
+    // Round position to next aligned block, and wraparound end of buffer if required.
+    position = RoundUp(position + sizeof(uint32_t) + dataSize, RINGBUFFER_ALIGNMENT);
+    if (position >= bufSize) {
+        position -= bufSize;
+    }
+    return position;
+}
 
-    if (remoteReadPosition >= bufSize) {
+static void GetBlockParts(BufferHeader *header, uint32_t bufSize, uint32_t position,
+                          uint32_t dataSize, IntercoreBlock *block)
+{
+    // The block size is stored contiguously before the data, but the data itself can wrap
+    // around the end of the buffer.
+    uint32_t dataStart = position + sizeof(uint32_t);
+    uint32_t dataToEnd = bufSize - dataStart;
+
+    block->firstPart = DataAreaOffset8(header, dataStart);
+    if (dataSize <= dataToEnd) {
+        block->firstPartSize = dataSize;
+        block->secondPart = NULL;
+        block->secondPartSize = 0;
+    } else {
+        block->firstPartSize = dataToEnd;
+        block->secondPart = DataAreaOffset8(header, 0);
+        block->secondPartSize = dataSize - dataToEnd;
+    }
+}
+
+int BeginDequeue(IntercoreCursor *cursor, BufferHeader *outbound, BufferHeader *inbound,
+                 uint32_t bufSize)
+{
+    cursor->outbound = outbound;
+    cursor->inbound = inbound;
+    cursor->bufSize = bufSize;
+    cursor->remotePosition = inbound->writePosition;
+    cursor->startPosition = outbound->readPosition;
+    cursor->localPosition = cursor->startPosition;
+    cursor->blockCount = 0;
+
+    if (cursor->remotePosition >= bufSize) {
+        Uart_WriteStringPoll("DequeueData: remoteWritePosition invalid\r\n");
+        // Leave the cursor empty, so that PeekNextBlock does not return any blocks.
+        cursor->remotePosition = cursor->localPosition;
+        return -1;
+    }
+
+    return 0;
+}
+
+int PeekNextBlock(IntercoreCursor *cursor, IntercoreBlock *block)
+{
+    uint32_t remoteWritePosition = cursor->remotePosition;
+    uint32_t localReadPosition = cursor->localPosition;
+    uint32_t bufSize = cursor->bufSize;
+
+    size_t availData;
+    // If data is contiguous in buffer then difference between write and read positions...
+    if (remoteWritePosition >= localReadPosition) {
+        availData = remoteWritePosition - localReadPosition;
+    }
+    // ...else data wraps around end and resumes at start of buffer
+    else {
+        availData = remoteWritePosition - localReadPosition + bufSize;
+    }
+
+    // There must be at least four contiguous bytes to hold the block size.
+    if (availData < sizeof(uint32_t)) {
+        if (availData > 0) {
+            Uart_WriteStringPoll("DequeueData: availData < 4 bytes\r\n");
+        }
+
+        return -1;
+    }
+
+    size_t dataToEnd = bufSize - localReadPosition;
+    if (dataToEnd < sizeof(uint32_t)) {
+        Uart_WriteStringPoll("DequeueData: dataToEnd < 4 bytes\r\n");
+        return -1;
+    }
+
+    uint32_t blockSize = *DataAreaOffset32(cursor->inbound, localReadPosition);
+
+    // Ensure the block size is no greater than the available data.
+    if (blockSize + sizeof(uint32_t) > availData) {
+        Uart_WriteStringPoll("DequeueData: message size greater than available data\r\n");
+        return -1;
+    }
+
+    GetBlockParts(cursor->inbound, bufSize, localReadPosition, blockSize, block);
+    cursor->localPosition = AdvancePosition(localReadPosition, blockSize, bufSize);
+    ++cursor->blockCount;
+    return 0;
+}
+
+void CommitDequeue(const IntercoreCursor *cursor)
+{
+    // The position only moves when a block is added, so this is also a batch of no blocks.
+    if (cursor->localPosition == cursor->startPosition) {
+        return;
+    }
+
+    cursor->outbound->readPosition = cursor->localPosition;
+
+    // SW_TX_INT_PORT[1] = 1 -> indicate message received.
+    NotifyHighLevelApp(MAILBOX_DATA_READ_PORT, cursor->blockCount);
+}
+
+int BeginEnqueue(IntercoreCursor *cursor, BufferHeader *inbound, BufferHeader *outbound,
+                 uint32_t bufSize)
+{
+    cursor->outbound = outbound;
+    cursor->inbound = inbound;
+    cursor->bufSize = bufSize;
+    cursor->remotePosition = inbound->readPosition;
+    cursor->startPosition = outbound->writePosition;
+    cursor->localPosition = cursor->startPosition;
+    cursor->blockCount = 0;
+
+    if (cursor->remotePosition >= bufSize) {
         Uart_WriteStringPoll("EnqueueData: remoteReadPosition invalid\r\n");
         return -1;
     }
 
+    return 0;
+}
+
+// Allocate a block, leaving at least headroom bytes of the buffer free after it.
+static int ReserveBlockWithHeadroom(IntercoreCursor *cursor, uint32_t dataSize,
+                                    uint32_t headroom, IntercoreBlock *block)
+{
+    uint32_t remoteReadPosition = cursor->remotePosition;
+    uint32_t localWritePosition = cursor->localPosition;
+    uint32_t bufSize = cursor->bufSize;
+
+    if (remoteReadPosition >= bufSize) {
+        return -1;
+    }
+
     // If the read pointer is behind the write pointer, then the free space wraps around.
     uint32_t availSpace;
     if (remoteReadPosition <= localWritePosition) {
@@ -115,96 +330,516 @@ int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
         availSpace = remoteReadPosition - localWritePosition;
     }
 
-    // If there isn't enough space to enqueue a block, then abort the operation.
-    if (availSpace < sizeof(uint32_t) + dataSize + RINGBUFFER_ALIGNMENT) {
-        Uart_WriteStringPoll("EnqueueData: not enough space to enqueue block\r\n");
+    // If there isn't enough space to enqueue a block, then abort the operation. A full bulk
+    // lane is the normal back-pressure on a stream, so it is not reported.
+    if (availSpace < sizeof(uint32_t) + dataSize + RINGBUFFER_ALIGNMENT + headroom) {
+        if (headroom == 0) {
+            Uart_WriteStringPoll("EnqueueData: not enough space to enqueue block\r\n");
+        }
         return -1;
     }
 
-    // Write up to end of buffer. If the block ends before then, only write up to the end of the
-    // block.
-    uint32_t dataToEnd = bufSize - localWritePosition;
-
     // There must be enough space between the write pointer and the end of the buffer to store the
     // block size as a contiguous 4-byte value. The remainder of message can wrap around.
+    uint32_t dataToEnd = bufSize - localWritePosition;
     if (dataToEnd < sizeof(uint32_t)) {
         Uart_WriteStringPoll("EnqueueData: not enough space for block size\r\n");
         return -1;
     }
 
-    uint32_t writeToEnd = sizeof(uint32_t) + dataSize;
-    if (dataToEnd < writeToEnd) {
-        writeToEnd = dataToEnd;
+    // Write block size to first word in block.
+    *DataAreaOffset32(cursor->outbound, localWritePosition) = dataSize;
+
+    GetBlockParts(cursor->outbound, bufSize, localWritePosition, dataSize, block);
+    cursor->localPosition = AdvancePosition(localWritePosition, dataSize, bufSize);
+    ++cursor->blockCount;
+    return 0;
+}
+
+int ReserveBlock(IntercoreCursor *cursor, uint32_t dataSize, IntercoreBlock *block)
+{
+    return ReserveBlockWithHeadroom(cursor, dataSize, 0, block);
+}
+
+int ReserveBulkBlock(IntercoreCursor *cursor, uint32_t dataSize, IntercoreBlock *block)
+{
+    return ReserveBlockWithHeadroom(cursor, dataSize, controlLaneSize, block);
+}
+
+void CommitEnqueue(const IntercoreCursor *cursor)
+{
+    // The position only moves when a block is added, so this is also a batch of no blocks.
+    if (cursor->localPosition == cursor->startPosition) {
+        return;
     }
 
-    // Write block size to first word in block.
-    *DataAreaOffset32(outbound, localWritePosition) = dataSize;
-    writeToEnd -= sizeof(uint32_t);
+    cursor->outbound->writePosition = cursor->localPosition;
 
+    // SW_TX_INT_PORT[0] = 1 -> indicate message received.
+    NotifyHighLevelApp(MAILBOX_DATA_WRITTEN_PORT, cursor->blockCount);
+}
+
+static TCM_CODE void CopyFromBlock(const IntercoreBlock *block, uint32_t offset, void *dest,
+                                   uint32_t size)
+{
+    uint8_t *dest8 = dest;
+    if (offset < block->firstPartSize) {
+        uint32_t firstSize = block->firstPartSize - offset;
+        if (firstSize > size) {
+            firstSize = size;
+        }
+        __builtin_memcpy(dest8, block->firstPart + offset, firstSize);
+        dest8 += firstSize;
+        size -= firstSize;
+        offset = 0;
+    } else {
+        offset -= block->firstPartSize;
+    }
+
+    if (size > 0) {
+        __builtin_memcpy(dest8, block->secondPart + offset, size);
+    }
+}
+
+static TCM_CODE void CopyToBlock(const IntercoreBlock *block, uint32_t offset, const void *src,
+                                 uint32_t size)
+{
     const uint8_t *src8 = src;
-    uint8_t *dest8 = DataAreaOffset8(outbound, localWritePosition + sizeof(uint32_t));
+    if (offset < block->firstPartSize) {
+        uint32_t firstSize = block->firstPartSize - offset;
+        if (firstSize > size) {
+            firstSize = size;
+        }
+        __builtin_memcpy(block->firstPart + offset, src8, firstSize);
+        src8 += firstSize;
+        size -= firstSize;
+        offset = 0;
+    } else {
+        offset -= block->firstPartSize;
+    }
 
-    __builtin_memcpy(dest8, src8, writeToEnd);
-    __builtin_memcpy(DataAreaOffset8(outbound, 0), src8 + writeToEnd, dataSize - writeToEnd);
+    if (size > 0) {
+        __builtin_memcpy(block->secondPart + offset, src8, size);
+    }
+}
 
-    // Advance write position.
-    localWritePosition =
-        RoundUp(localWritePosition + sizeof(uint32_t) + dataSize, RINGBUFFER_ALIGNMENT);
-    if (localWritePosition >= bufSize) {
-        localWritePosition -= bufSize;
+void InitReassembly(IntercoreReassembly *reassembly, uint8_t *buffer, uint32_t bufferSize)
+{
+    reassembly->buffer = buffer;
+    reassembly->bufferSize = bufferSize;
+    reassembly->totalSize = 0;
+    reassembly->receivedSize = 0;
+    reassembly->messageId = 0;
+    reassembly->nextFragmentIndex = 0;
+    reassembly->inProgress = false;
+}
+
+int ReassembleFragment(IntercoreReassembly *reassembly, const IntercoreBlock *block)
+{
+    static const uint32_t fragmentDataStart =
+        INTERCORE_MESSAGE_HEADER_SIZE + sizeof(IntercoreFragmentHeader);
+
+    uint32_t blockSize = block->firstPartSize + block->secondPartSize;
+    if (blockSize < fragmentDataStart) {
+        Uart_WriteStringPoll("ReassembleFragment: block too small for fragment header\r\n");
+        reassembly->inProgress = false;
+        return -1;
     }
-    outbound->writePosition = localWritePosition;
 
-    // SW_TX_INT_PORT[0] = 1 -> indicate message received.
-    WriteReg32(MAILBOX_BASE, 0x14, 1U << 0);
+    IntercoreFragmentHeader fragmentHeader;
+    CopyFromBlock(block, INTERCORE_MESSAGE_HEADER_SIZE, &fragmentHeader, sizeof(fragmentHeader));
+
+    // The first fragment starts a new message.
+    if (fragmentHeader.fragmentIndex == 0) {
+        if (fragmentHeader.totalSize > reassembly->bufferSize) {
+            Uart_WriteStringPoll("ReassembleFragment: message too large for buffer\r\n");
+            reassembly->inProgress = false;
+            return -1;
+        }
+
+        CopyFromBlock(block, 0, reassembly->messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+        reassembly->totalSize = fragmentHeader.totalSize;
+        reassembly->receivedSize = 0;
+        reassembly->messageId = fragmentHeader.messageId;
+        reassembly->nextFragmentIndex = 0;
+        reassembly->inProgress = true;
+    } else if (!reassembly->inProgress || fragmentHeader.messageId != reassembly->messageId ||
+               fragmentHeader.fragmentIndex != reassembly->nextFragmentIndex) {
+        Uart_WriteStringPoll("ReassembleFragment: unexpected fragment\r\n");
+        reassembly->inProgress = false;
+        return -1;
+    }
+
+    uint32_t dataSize = blockSize - fragmentDataStart;
+    if (dataSize > reassembly->totalSize - reassembly->receivedSize) {
+        Uart_WriteStringPoll("ReassembleFragment: fragment exceeds message size\r\n");
+        reassembly->inProgress = false;
+        return -1;
+    }
+
+    CopyFromBlock(block, fragmentDataStart, reassembly->buffer + reassembly->receivedSize,
+                  dataSize);
+    reassembly->receivedSize += dataSize;
+    ++reassembly->nextFragmentIndex;
+
+    if (reassembly->receivedSize < reassembly->totalSize) {
+        return 0;
+    }
+
+    reassembly->inProgress = false;
+    return 1;
+}
+
+void StartFragmentedSend(IntercoreFragmenter *fragmenter, const uint8_t *messageHeader,
+                         uint16_t messageId, const void *data, uint32_t size)
+{
+    fragmenter->data = data;
+    fragmenter->size = size;
+    fragmenter->sentSize = 0;
+    __builtin_memcpy(fragmenter->messageHeader, messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    fragmenter->messageId = messageId;
+    fragmenter->nextFragmentIndex = 0;
+    fragmenter->inProgress = true;
+}
+
+int ContinueFragmentedSend(IntercoreFragmenter *fragmenter, IntercoreCursor *cursor)
+{
+    static const uint32_t fragmentDataStart =
+        INTERCORE_MESSAGE_HEADER_SIZE + sizeof(IntercoreFragmentHeader);
+
+    while (fragmenter->inProgress) {
+        uint32_t dataSize = fragmenter->size - fragmenter->sentSize;
+        if (dataSize > INTERCORE_MAX_FRAGMENT_DATA_SIZE) {
+            dataSize = INTERCORE_MAX_FRAGMENT_DATA_SIZE;
+        }
+
+        IntercoreBlock block;
+        if (ReserveBulkBlock(cursor, fragmentDataStart + dataSize, &block) == -1) {
+            return 0;
+        }
+
+        IntercoreFragmentHeader fragmentHeader = {.totalSize = fragmenter->size,
+                                                  .messageId = fragmenter->messageId,
+                                                  .fragmentIndex = fragmenter->nextFragmentIndex};
+        CopyToBlock(&block, 0, fragmenter->messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+        CopyToBlock(&block, INTERCORE_MESSAGE_HEADER_SIZE, &fragmentHeader, sizeof(fragmentHeader));
+        CopyToBlock(&block, fragmentDataStart, fragmenter->data + fragmenter->sentSize, dataSize);
+
+        fragmenter->sentSize += dataSize;
+        ++fragmenter->nextFragmentIndex;
+        if (fragmenter->sentSize == fragmenter->size) {
+            fragmenter->inProgress = false;
+        }
+    }
+
+    return 1;
+}
+
+bool IsTypedMessage(const IntercoreBlock *block, uint16_t *typeId)
+{
+    if (block->firstPartSize + block->secondPartSize <
+        INTERCORE_MESSAGE_HEADER_SIZE + sizeof(IntercoreTypedHeader)) {
+        return false;
+    }
+
+    IntercoreTypedHeader header;
+    CopyFromBlock(block, INTERCORE_MESSAGE_HEADER_SIZE, &header, sizeof(header));
+    if (header.marker != INTERCORE_TYPED_MESSAGE_MARKER) {
+        return false;
+    }
+
+    *typeId = header.typeId;
+    return true;
+}
+
+int DecodeTypedMessage(const IntercoreBlock *block, uint16_t typeId, uint16_t version,
+                       uint8_t *messageHeader, void *body, uint32_t bodySize)
+{
+    static const uint32_t bodyStart = INTERCORE_MESSAGE_HEADER_SIZE + sizeof(IntercoreTypedHeader);
+
+    if (block->firstPartSize + block->secondPartSize != bodyStart + bodySize) {
+        return -1;
+    }
+
+    IntercoreTypedHeader header;
+    CopyFromBlock(block, INTERCORE_MESSAGE_HEADER_SIZE, &header, sizeof(header));
+    if (header.marker != INTERCORE_TYPED_MESSAGE_MARKER || header.typeId != typeId ||
+        header.version != version) {
+        return -1;
+    }
+
+    if (messageHeader != NULL) {
+        CopyFromBlock(block, 0, messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    }
+    CopyFromBlock(block, bodyStart, body, bodySize);
     return 0;
 }
 
-int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
-                uint32_t *dataSize)
+// Write a typed message into a block which leaves at least headroom bytes free.
+static int EnqueueTypedMessageWithHeadroom(IntercoreCursor *cursor, const uint8_t *messageHeader,
+                                           uint16_t typeId, uint16_t version, const void *body,
+                                           uint32_t bodySize, uint32_t headroom)
 {
-    uint32_t remoteWritePosition = inbound->writePosition;
-    uint32_t localReadPosition = outbound->readPosition;
+    static const uint32_t bodyStart = INTERCORE_MESSAGE_HEADER_SIZE + sizeof(IntercoreTypedHeader);
 
-    if (remoteWritePosition >= bufSize) {
-        Uart_WriteStringPoll("DequeueData: remoteWritePosition invalid\r\n");
+    IntercoreBlock block;
+    if (ReserveBlockWithHeadroom(cursor, bodyStart + bodySize, headroom, &block) == -1) {
         return -1;
     }
 
-    size_t availData;
-    // If data is contiguous in buffer then difference between write and read positions...
-    if (remoteWritePosition >= localReadPosition) {
-        availData = remoteWritePosition - localReadPosition;
+    IntercoreTypedHeader header = {
+        .marker = INTERCORE_TYPED_MESSAGE_MARKER, .typeId = typeId, .version = version};
+    CopyToBlock(&block, 0, messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    CopyToBlock(&block, INTERCORE_MESSAGE_HEADER_SIZE, &header, sizeof(header));
+    CopyToBlock(&block, bodyStart, body, bodySize);
+    return 0;
+}
+
+int EnqueueTypedMessage(IntercoreCursor *cursor, const uint8_t *messageHeader, uint16_t typeId,
+                        uint16_t version, const void *body, uint32_t bodySize)
+{
+    return EnqueueTypedMessageWithHeadroom(cursor, messageHeader, typeId, version, body, bodySize,
+                                           0);
+}
+
+int EnqueueBulkTypedMessage(IntercoreCursor *cursor, const uint8_t *messageHeader,
+                            uint16_t typeId, uint16_t version, const void *body,
+                            uint32_t bodySize)
+{
+    return EnqueueTypedMessageWithHeadroom(cursor, messageHeader, typeId, version, body, bodySize,
+                                           controlLaneSize);
+}
+
+void InitStreamBatch(IntercoreStreamBatch *batch, const uint8_t *messageHeader)
+{
+    __builtin_memcpy(batch->messageHeader, messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    batch->size = 0;
+}
+
+int AddStreamRecord(IntercoreStreamBatch *batch, uint8_t streamId, const void *data,
+                    uint32_t size)
+{
+    if (size > sizeof(batch->records) - sizeof(IntercoreStreamRecordHeader) - batch->size) {
+        return -1;
     }
-    // ...else data wraps around end and resumes at start of buffer
-    else {
-        availData = remoteWritePosition - localReadPosition + bufSize;
+
+    IntercoreStreamRecordHeader header = {.streamId = streamId, .size = (uint8_t)size};
+    __builtin_memcpy(batch->records + batch->size, &header, sizeof(header));
+    __builtin_memcpy(batch->records + batch->size + sizeof(header), data, size);
+    batch->size += sizeof(header) + size;
+    return 0;
+}
+
+int EnqueueStreamBatch(IntercoreCursor *cursor, IntercoreStreamBatch *batch)
+{
+    static const uint32_t recordsStart = INTERCORE_MESSAGE_HEADER_SIZE + sizeof(uint32_t);
+
+    if (batch->size == 0) {
+        return 0;
     }
 
-    // There must be at least four contiguous bytes to hold the block size.
-    if (availData < sizeof(uint32_t)) {
-        if (availData > 0) {
-            Uart_WriteStringPoll("DequeueData: availData < 4 bytes\r\n");
-        }
+    IntercoreBlock block;
+    if (ReserveBlock(cursor, recordsStart + batch->size, &block) == -1) {
+        return -1;
+    }
+
+    uint32_t marker = INTERCORE_STREAM_MESSAGE_MARKER;
+    CopyToBlock(&block, 0, batch->messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    CopyToBlock(&block, INTERCORE_MESSAGE_HEADER_SIZE, &marker, sizeof(marker));
+    CopyToBlock(&block, recordsStart, batch->records, batch->size);
+    batch->size = 0;
+    return 0;
+}
+
+bool IsStreamMessage(const IntercoreBlock *block, uint8_t *messageHeader)
+{
+    if (block->firstPartSize + block->secondPartSize <
+        INTERCORE_MESSAGE_HEADER_SIZE + sizeof(uint32_t)) {
+        return false;
+    }
+
+    uint32_t marker;
+    CopyFromBlock(block, INTERCORE_MESSAGE_HEADER_SIZE, &marker, sizeof(marker));
+    if (marker != INTERCORE_STREAM_MESSAGE_MARKER) {
+        return false;
+    }
+
+    if (messageHeader != NULL) {
+        CopyFromBlock(block, 0, messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    }
+    return true;
+}
 
+int ReadStreamRecord(const IntercoreBlock *block, uint32_t *offset, uint8_t *streamId,
+                     void *data, uint32_t *size)
+{
+    static const uint32_t recordsStart = INTERCORE_MESSAGE_HEADER_SIZE + sizeof(uint32_t);
+
+    uint32_t blockSize = block->firstPartSize + block->secondPartSize;
+    uint32_t position = recordsStart + *offset;
+    if (position >= blockSize) {
+        return 0;
+    }
+
+    IntercoreStreamRecordHeader header;
+    if (blockSize - position < sizeof(header)) {
+        return -1;
+    }
+    CopyFromBlock(block, position, &header, sizeof(header));
+    position += sizeof(header);
+    if (header.size > blockSize - position || header.size > INTERCORE_STREAM_MAX_RECORD_SIZE) {
         return -1;
     }
 
-    size_t dataToEnd = bufSize - localReadPosition;
-    if (dataToEnd < sizeof(uint32_t)) {
-        Uart_WriteStringPoll("DequeueData: dataToEnd < 4 bytes\r\n");
+    CopyFromBlock(block, position, data, header.size);
+    *streamId = header.streamId;
+    *size = header.size;
+    *offset += sizeof(header) + header.size;
+    return 1;
+}
+
+int InitPackedBatch(IntercorePackedBatch *batch, const uint8_t *messageHeader,
+                    uint32_t recordSize)
+{
+    if (recordSize == 0 || recordSize > sizeof(batch->records)) {
         return -1;
     }
 
-    uint32_t blockSize = *DataAreaOffset32(inbound, localReadPosition);
+    __builtin_memcpy(batch->messageHeader, messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    batch->recordSize = (uint16_t)recordSize;
+    batch->recordCount = 0;
+    batch->recordCapacity = (uint16_t)(sizeof(batch->records) / recordSize);
+    batch->firstRecordTime = 0;
+    return 0;
+}
 
-    // Ensure the block size is no greater than the available data.
-    if (blockSize + sizeof(uint32_t) > availData) {
-        Uart_WriteStringPoll("DequeueData: message size greater than available data\r\n");
+int AddPackedRecord(IntercorePackedBatch *batch, const void *record, uint32_t now)
+{
+    if (batch->recordCount == batch->recordCapacity) {
+        return -1;
+    }
+
+    if (batch->recordCount == 0) {
+        batch->firstRecordTime = now;
+    }
+    __builtin_memcpy(batch->records + batch->recordCount * batch->recordSize, record,
+                     batch->recordSize);
+    ++batch->recordCount;
+    return 0;
+}
+
+bool IsPackedBatchDue(const IntercorePackedBatch *batch, uint32_t now, uint32_t maxAge)
+{
+    // Unsigned subtraction gives the age even if the time has wrapped around.
+    return batch->recordCount == batch->recordCapacity ||
+           (batch->recordCount != 0 && now - batch->firstRecordTime >= maxAge);
+}
+
+int EnqueuePackedBatch(IntercoreCursor *cursor, IntercorePackedBatch *batch)
+{
+    static const uint32_t recordsStart =
+        INTERCORE_MESSAGE_HEADER_SIZE + sizeof(uint32_t) + sizeof(IntercorePackedHeader);
+
+    if (batch->recordCount == 0) {
+        return 0;
+    }
+
+    uint32_t recordsSize = (uint32_t)batch->recordCount * batch->recordSize;
+    IntercoreBlock block;
+    if (ReserveBulkBlock(cursor, recordsStart + recordsSize, &block) == -1) {
+        return -1;
+    }
+
+    uint32_t marker = INTERCORE_PACKED_MESSAGE_MARKER;
+    IntercorePackedHeader header = {.recordSize = batch->recordSize,
+                                    .recordCount = batch->recordCount};
+    CopyToBlock(&block, 0, batch->messageHeader, INTERCORE_MESSAGE_HEADER_SIZE);
+    CopyToBlock(&block, INTERCORE_MESSAGE_HEADER_SIZE, &marker, sizeof(marker));
+    CopyToBlock(&block, INTERCORE_MESSAGE_HEADER_SIZE + sizeof(marker), &header, sizeof(header));
+    CopyToBlock(&block, recordsStart, batch->records, recordsSize);
+    batch->recordCount = 0;
+    return 0;
+}
+
+bool IsPackedMessage(const IntercoreBlock *block, IntercorePackedHeader *header)
+{
+    static const uint32_t recordsStart =
+        INTERCORE_MESSAGE_HEADER_SIZE + sizeof(uint32_t) + sizeof(IntercorePackedHeader);
+
+    uint32_t blockSize = block->firstPartSize + block->secondPartSize;
+    if (blockSize < recordsStart) {
+        return false;
+    }
+
+    uint32_t marker;
+    CopyFromBlock(block, INTERCORE_MESSAGE_HEADER_SIZE, &marker, sizeof(marker));
+    if (marker != INTERCORE_PACKED_MESSAGE_MARKER) {
+        return false;
+    }
+
+    IntercorePackedHeader packedHeader;
+    CopyFromBlock(block, INTERCORE_MESSAGE_HEADER_SIZE + sizeof(marker), &packedHeader,
+                  sizeof(packedHeader));
+    if ((uint32_t)packedHeader.recordSize * packedHeader.recordCount !=
+        blockSize - recordsStart) {
+        return false;
+    }
+
+    if (header != NULL) {
+        *header = packedHeader;
+    }
+    return true;
+}
+
+int ReadPackedRecords(const IntercoreBlock *block, const IntercorePackedHeader *header,
+                      uint32_t firstRecord, void *records, uint32_t count)
+{
+    static const uint32_t recordsStart =
+        INTERCORE_MESSAGE_HEADER_SIZE + sizeof(uint32_t) + sizeof(IntercorePackedHeader);
+
+    if (firstRecord > header->recordCount || count > header->recordCount - firstRecord) {
         return -1;
     }
 
-    // Abort if the caller-supplied buffer is not large enough to hold the message.
+    CopyFromBlock(block, recordsStart + firstRecord * header->recordSize, records,
+                  count * header->recordSize);
+    return 0;
+}
+
+int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, const void *src,
+                uint32_t dataSize)
+{
+    IntercoreCursor cursor;
+    IntercoreBlock block;
+    if (BeginEnqueue(&cursor, inbound, outbound, bufSize) == -1 ||
+        ReserveBlock(&cursor, dataSize, &block) == -1) {
+        return -1;
+    }
+
+    const uint8_t *src8 = src;
+    __builtin_memcpy(block.firstPart, src8, block.firstPartSize);
+    // If block wraps around the end of the buffer, then write remainder to start.
+    if (block.secondPartSize > 0) {
+        __builtin_memcpy(block.secondPart, src8 + block.firstPartSize, block.secondPartSize);
+    }
+
+    CommitEnqueue(&cursor);
+    return 0;
+}
+
+int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
+                uint32_t *dataSize)
+{
+    IntercoreCursor cursor;
+    IntercoreBlock block;
+    if (BeginDequeue(&cursor, outbound, inbound, bufSize) == -1 ||
+        PeekNextBlock(&cursor, &block) == -1) {
+        return -1;
+    }
+
+    // Abort if the caller-supplied buffer is not large enough to hold the message. The block is
+    // left in the shared buffer, because the cursor is not committed.
+    uint32_t blockSize = block.firstPartSize + block.secondPartSize;
     if (blockSize > *dataSize) {
         Uart_WriteStringPoll("DequeueData: message too large for buffer\r\n");
         *dataSize = blockSize;
@@ -214,30 +849,13 @@ int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
     // Tell the caller the actual block size.
     *dataSize = blockSize;
 
-    // Read up to the end of the buffer. If the block ends before then, only read up to the end
-    // of the block.
-    uint32_t readFromEnd = dataToEnd - sizeof(uint32_t);
-    if (blockSize < readFromEnd) {
-        readFromEnd = blockSize;
-    }
-
-    const uint8_t *src8 = DataAreaOffset8(inbound, localReadPosition + sizeof(uint32_t));
     uint8_t *dest8 = dest;
-    __builtin_memcpy(dest8, src8, readFromEnd);
+    __builtin_memcpy(dest8, block.firstPart, block.firstPartSize);
     // If block wrapped around the end of the buffer, then read remainder from start.
-    __builtin_memcpy(dest8 + readFromEnd, DataAreaOffset8(inbound, 0), blockSize - readFromEnd);
-
-    // Round read position to next aligned block, and wraparound end of buffer if required.
-    localReadPosition =
-        RoundUp(localReadPosition + sizeof(uint32_t) + blockSize, RINGBUFFER_ALIGNMENT);
-    if (localReadPosition >= bufSize) {
-        localReadPosition -= bufSize;
+    if (block.secondPartSize > 0) {
+        __builtin_memcpy(dest8 + block.firstPartSize, block.secondPart, block.secondPartSize);
     }
 
-    outbound->readPosition = localReadPosition;
-
-    // SW_TX_INT_PORT[1] = 1 -> indicate message received.
-    WriteReg32(MAILBOX_BASE, 0x14, 1U << 1);
-
+    CommitDequeue(&cursor);
     return 0;
 }
@@ -4,8 +4,15 @@
 #ifndef MT3620_INTERCORE_H
 #define MT3620_INTERCORE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "mt3620-baremetal.h"
+#include "intercore_fragment_defs.h"
+#include "intercore_packed_defs.h"
+#include "intercore_stream_defs.h"
+#include "intercore_typed_defs.h"
+
 /// <summary>
 /// There are two buffers, inbound and outbound, which are used to track
 /// how much data has been written to, and read from, each shared buffer.
@@ -30,6 +37,45 @@ typedef struct {
 /// <summary>Blocks inside the shared buffer have this alignment.</summary>
 #define RINGBUFFER_ALIGNMENT 16
 
+/// <summary>
+/// <para>Tracks a batch of blocks which are read from, or written to, a shared buffer in
+/// place.</para>
+/// <para>The cursor is set up by <see cref="BeginDequeue" /> or <see cref="BeginEnqueue" />.
+/// Its members are managed by the intercore functions and must not be modified by the caller.
+/// </para>
+/// </summary>
+typedef struct {
+    /// <summary>The outbound buffer.</summary>
+    BufferHeader *outbound;
+    /// <summary>The inbound buffer.</summary>
+    BufferHeader *inbound;
+    /// <summary>Total size of shared buffer in bytes.</summary>
+    uint32_t bufSize;
+    /// <summary>Local read or write position, after the blocks in the batch so far.</summary>
+    uint32_t localPosition;
+    /// <summary>Remote write or read position, as it was when the batch began.</summary>
+    uint32_t remotePosition;
+    /// <summary>Local position when the batch began.</summary>
+    uint32_t startPosition;
+    /// <summary>Number of blocks in the batch so far.</summary>
+    uint32_t blockCount;
+} IntercoreCursor;
+
+/// <summary>
+/// <para>The data of one block in a shared buffer. A block which wraps around the end of the
+/// buffer is split into two parts; otherwise, secondPart is NULL and secondPartSize is 0.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Start of the block data.</summary>
+    uint8_t *firstPart;
+    /// <summary>Number of bytes at firstPart.</summary>
+    uint32_t firstPartSize;
+    /// <summary>Remainder of the block data, at the start of the buffer.</summary>
+    uint8_t *secondPart;
+    /// <summary>Number of bytes at secondPart.</summary>
+    uint32_t secondPartSize;
+} IntercoreBlock;
+
 /// <summary>
 /// <para>Gets the inbound and outbound buffers used to communicate with the high-level
 /// application.  This function blocks until that data is available from the mailbox.</para>
@@ -44,6 +90,54 @@ typedef struct {
 /// <returns>0 on success, -1 on failure.</returns>
 int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_t *bufSize);
 
+/// <summary>
+/// <para>Enable the mailbox interrupt which the high-level application raises when it has
+/// written to, or read from, the shared buffers.</para>
+/// <para>The supplied callback is called from the interrupt handler, so it should only schedule
+/// work. Call this after <see cref="GetIntercoreBuffers" />, which reads the mailbox itself.
+/// </para>
+/// </summary>
+/// <param name="handler">Called from the interrupt handler each time the interrupt is raised.
+/// </param>
+void EnableIntercoreIrq(Callback handler);
+
+/// <summary>
+/// Handles the mailbox software interrupt. Install this in the exception vector table at
+/// interrupt 11.
+/// </summary>
+void Intercore_HandleIrq11(void);
+
+/// <summary>
+/// <para>Set how many messages are written or read before the high-level application is
+/// notified. By default it is notified after every message, or after every batch which is
+/// committed with <see cref="CommitEnqueue" /> or <see cref="CommitDequeue" />.</para>
+/// <para>With a larger threshold, notifications are held back and sent together as one mailbox
+/// interrupt. The caller must call <see cref="FlushIntercoreNotifications" /> once it has
+/// finished sending, e.g. before it sleeps, so that the last messages are not held back
+/// indefinitely.</para>
+/// </summary>
+/// <param name="messageCount">Number of messages after which a notification is sent; 0 to only
+/// send notifications from <see cref="FlushIntercoreNotifications" />.</param>
+void SetIntercoreNotificationThreshold(uint32_t messageCount);
+
+/// <summary>
+/// Send any notifications which have been held back by
+/// <see cref="SetIntercoreNotificationThreshold" />, as a single mailbox interrupt.
+/// </summary>
+void FlushIntercoreNotifications(void);
+
+/// <summary>
+/// <para>Set how much of the outbound buffer is kept for control messages. Blocks which are
+/// written with <see cref="ReserveBulkBlock" />, such as fragments and stream samples, leave
+/// this much space free, so that a control message, such as a typed reply written with
+/// <see cref="ReserveBlock" />, can still be sent while a stream fills the rest.</para>
+/// <para>The shared buffer is a single FIFO, so this bounds how long control messages wait
+/// behind bulk data, rather than letting them overtake it. By default nothing is kept.</para>
+/// </summary>
+/// <param name="size">Bytes to keep free for control messages, such as
+/// INTERCORE_SUGGESTED_CONTROL_LANE_SIZE, or 0 to share the whole buffer.</param>
+void SetIntercoreControlLaneSize(uint32_t size);
+
 /// <summary>
 /// Add data to the shared buffer, to be read by the high-level application.
 /// </summary>
@@ -76,4 +170,438 @@ int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
 int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
                 uint32_t *dataSize);
 
+/// <summary>
+/// Every message which is exchanged with a high-level application starts with that application's
+/// component ID (16 bytes) and 4 reserved bytes.
+/// </summary>
+#define INTERCORE_MESSAGE_HEADER_SIZE 20
+
+/// <summary>
+/// Control lane size for <see cref="SetIntercoreControlLaneSize" /> which leaves space for one
+/// control message of the largest size. This is small enough that a bulk block of the largest
+/// size still fits in the rest of a 1 KB shared buffer.
+/// </summary>
+#define INTERCORE_SUGGESTED_CONTROL_LANE_SIZE \
+    (sizeof(uint32_t) + INTERCORE_MESSAGE_HEADER_SIZE + INTERCORE_MAX_FRAGMENT_SIZE + \
+     RINGBUFFER_ALIGNMENT)
+
+/// <summary>
+/// <para>Joins up the fragments of a message from the high-level application, as described by
+/// <see cref="IntercoreFragmentHeader" />.</para>
+/// <para>The reassembly is set up by <see cref="InitReassembly" />. Its members are managed by
+/// the intercore functions and must not be modified by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Storage for the message data.</summary>
+    uint8_t *buffer;
+    /// <summary>Size of buffer in bytes.</summary>
+    uint32_t bufferSize;
+    /// <summary>Message header of the first fragment, which identifies the sender.</summary>
+    uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+    /// <summary>Total size of the message data in bytes.</summary>
+    uint32_t totalSize;
+    /// <summary>Number of bytes of message data received so far.</summary>
+    uint32_t receivedSize;
+    /// <summary>Message ID from the fragment headers.</summary>
+    uint16_t messageId;
+    /// <summary>Index of the next fragment which is expected.</summary>
+    uint16_t nextFragmentIndex;
+    /// <summary>Whether a message has been started but is not yet complete.</summary>
+    bool inProgress;
+} IntercoreReassembly;
+
+/// <summary>
+/// <para>Splits a message to the high-level application into fragments, as described by
+/// <see cref="IntercoreFragmentHeader" />.</para>
+/// <para>The fragmenter is set up by <see cref="StartFragmentedSend" />. Its members are managed
+/// by the intercore functions and must not be modified by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The message data, which must remain valid until the message is sent.</summary>
+    const uint8_t *data;
+    /// <summary>Size of the message data in bytes.</summary>
+    uint32_t size;
+    /// <summary>Number of bytes of message data written so far.</summary>
+    uint32_t sentSize;
+    /// <summary>Message header which is written at the start of every fragment.</summary>
+    uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+    /// <summary>Message ID which is written in the fragment headers.</summary>
+    uint16_t messageId;
+    /// <summary>Index of the next fragment to write.</summary>
+    uint16_t nextFragmentIndex;
+    /// <summary>Whether some fragments of the message remain to be written.</summary>
+    bool inProgress;
+} IntercoreFragmenter;
+
+/// <summary>
+/// Start reading a batch of blocks, which have been written by the high-level application, in
+/// place. Blocks are then read with <see cref="PeekNextBlock" />, and released together with
+/// <see cref="CommitDequeue" />.
+/// </summary>
+/// <param name="cursor">Cursor which tracks the batch.</param>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <returns>0 on success, -1 if the shared buffer is in an invalid state.</returns>
+int BeginDequeue(IntercoreCursor *cursor, BufferHeader *outbound, BufferHeader *inbound,
+                 uint32_t bufSize);
+
+/// <summary>
+/// Get the next block of the batch, directly in the shared buffer. The block remains valid, and
+/// is not released to the high-level application, until <see cref="CommitDequeue" /> is called.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginDequeue" />.</param>
+/// <param name="block">On success, contains the parts of the block data.</param>
+/// <returns>0 if a block was read, -1 if there are no more blocks.</returns>
+int PeekNextBlock(IntercoreCursor *cursor, IntercoreBlock *block);
+
+/// <summary>
+/// Release all the blocks which were read with <see cref="PeekNextBlock" /> to the high-level
+/// application. The read position is updated once and the high-level application is notified
+/// once, however many blocks were read.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginDequeue" />.</param>
+void CommitDequeue(const IntercoreCursor *cursor);
+
+/// <summary>
+/// Start writing a batch of blocks, to be read by the high-level application, in place. Blocks
+/// are then allocated with <see cref="ReserveBlock" />, and published together with
+/// <see cref="CommitEnqueue" />.
+/// </summary>
+/// <param name="cursor">Cursor which tracks the batch.</param>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <returns>0 on success, -1 if the shared buffer is in an invalid state.</returns>
+int BeginEnqueue(IntercoreCursor *cursor, BufferHeader *inbound, BufferHeader *outbound,
+                 uint32_t bufSize);
+
+/// <summary>
+/// Allocate the next block of the batch directly in the shared buffer. The caller fills in the
+/// block data; it is not visible to the high-level application until
+/// <see cref="CommitEnqueue" /> is called.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginEnqueue" />.</param>
+/// <param name="dataSize">Length of the block data in bytes.</param>
+/// <param name="block">On success, contains the parts of the block data to fill in.</param>
+/// <returns>0 if the block was allocated, -1 if there is not enough space.</returns>
+int ReserveBlock(IntercoreCursor *cursor, uint32_t dataSize, IntercoreBlock *block);
+
+/// <summary>
+/// Allocate the next block of the batch in the same way as <see cref="ReserveBlock" />, for
+/// bulk data. The block is only allocated if it leaves the space which is kept for control
+/// messages by <see cref="SetIntercoreControlLaneSize" />.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginEnqueue" />.</param>
+/// <param name="dataSize">Length of the block data in bytes.</param>
+/// <param name="block">On success, contains the parts of the block data to fill in.</param>
+/// <returns>0 if the block was allocated, -1 if the bulk lane is full.</returns>
+int ReserveBulkBlock(IntercoreCursor *cursor, uint32_t dataSize, IntercoreBlock *block);
+
+/// <summary>
+/// Publish all the blocks which were allocated with <see cref="ReserveBlock" /> to the high-level
+/// application. The write position is updated once and the high-level application is notified
+/// once, however many blocks were written.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginEnqueue" />.</param>
+void CommitEnqueue(const IntercoreCursor *cursor);
+
+/// <summary>
+/// Set up a reassembly to join up fragmented messages.
+/// </summary>
+/// <param name="reassembly">The reassembly to set up.</param>
+/// <param name="buffer">Storage for the message data. This limits the size of the messages
+/// which can be received.</param>
+/// <param name="bufferSize">Size of buffer in bytes.</param>
+void InitReassembly(IntercoreReassembly *reassembly, uint8_t *buffer, uint32_t bufferSize);
+
+/// <summary>
+/// Add a fragment, which has been read with <see cref="PeekNextBlock" />, to the message. The
+/// fragment data is copied, so the block can be released afterwards.
+/// </summary>
+/// <param name="reassembly">Reassembly set up by <see cref="InitReassembly" />.</param>
+/// <param name="block">The block which holds the fragment.</param>
+/// <returns>1 if the message is complete, in which case its data is in the reassembly buffer;
+/// 0 if more fragments are needed; -1 if the fragment was invalid and the message discarded.
+/// </returns>
+int ReassembleFragment(IntercoreReassembly *reassembly, const IntercoreBlock *block);
+
+/// <summary>
+/// Start sending a message, in fragments, to a high-level application. The fragments are then
+/// written with <see cref="ContinueFragmentedSend" />.
+/// </summary>
+/// <param name="fragmenter">The fragmenter to set up.</param>
+/// <param name="messageHeader">Message header which identifies the high-level application,
+/// e.g. the one from a message which it sent.</param>
+/// <param name="messageId">Message ID to write in the fragment headers.</param>
+/// <param name="data">The message data, which must remain valid until the message is sent.
+/// </param>
+/// <param name="size">Size of the message data in bytes.</param>
+void StartFragmentedSend(IntercoreFragmenter *fragmenter, const uint8_t *messageHeader,
+                         uint16_t messageId, const void *data, uint32_t size);
+
+/// <summary>
+/// Write as many of the remaining fragments as fit in the bulk lane of the shared buffer, as
+/// part of a batch which is published with <see cref="CommitEnqueue" />.
+/// </summary>
+/// <param name="fragmenter">Fragmenter set up by <see cref="StartFragmentedSend" />.</param>
+/// <param name="cursor">Cursor set up by <see cref="BeginEnqueue" />.</param>
+/// <returns>1 if every fragment has been written; 0 if some remain, in which case call this
+/// again once the high-level application has read from the shared buffer.</returns>
+int ContinueFragmentedSend(IntercoreFragmenter *fragmenter, IntercoreCursor *cursor);
+
+/// <summary>
+/// Find out whether a block, which has been read with <see cref="PeekNextBlock" />, holds a
+/// typed message rather than a fragment.
+/// </summary>
+/// <param name="block">The block to examine.</param>
+/// <param name="typeId">If the block holds a typed message, receives its type ID.</param>
+/// <returns>true if the block holds a typed message; false otherwise.</returns>
+bool IsTypedMessage(const IntercoreBlock *block, uint16_t *typeId);
+
+/// <summary>
+/// Copy the struct out of a typed message. Prefer the Type_Decode functions which are generated
+/// by <see cref="INTERCORE_DEFINE_RING_CODEC" />.
+/// </summary>
+/// <param name="block">The block which holds the message.</param>
+/// <param name="typeId">Expected type ID.</param>
+/// <param name="version">Expected layout version.</param>
+/// <param name="messageHeader">If not NULL, receives the INTERCORE_MESSAGE_HEADER_SIZE byte
+/// header which identifies the sender.</param>
+/// <param name="body">Receives the struct.</param>
+/// <param name="bodySize">Size of the struct in bytes.</param>
+/// <returns>0 on success; -1 if the block does not hold a message of this type, version and
+/// size.</returns>
+int DecodeTypedMessage(const IntercoreBlock *block, uint16_t typeId, uint16_t version,
+                       uint8_t *messageHeader, void *body, uint32_t bodySize);
+
+/// <summary>
+/// Write a typed message as part of a batch which is published with
+/// <see cref="CommitEnqueue" />. Prefer the Type_Enqueue functions which are generated by
+/// <see cref="INTERCORE_DEFINE_RING_CODEC" />.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginEnqueue" />.</param>
+/// <param name="messageHeader">Message header which identifies the high-level application,
+/// e.g. the one from a message which it sent.</param>
+/// <param name="typeId">Type ID of the struct.</param>
+/// <param name="version">Layout version of the struct.</param>
+/// <param name="body">The struct.</param>
+/// <param name="bodySize">Size of the struct in bytes.</param>
+/// <returns>0 on success; -1 if there is not enough space in the shared buffer.</returns>
+int EnqueueTypedMessage(IntercoreCursor *cursor, const uint8_t *messageHeader, uint16_t typeId,
+                        uint16_t version, const void *body, uint32_t bodySize);
+
+/// <summary>
+/// Write a typed message in the same way as <see cref="EnqueueTypedMessage" />, in the bulk
+/// lane, as described by <see cref="SetIntercoreControlLaneSize" />. Prefer the
+/// Type_EnqueueBulk functions which are generated by <see cref="INTERCORE_DEFINE_RING_CODEC" />.
+/// </summary>
+/// <returns>0 on success; -1 if the bulk lane is full.</returns>
+int EnqueueBulkTypedMessage(IntercoreCursor *cursor, const uint8_t *messageHeader,
+                            uint16_t typeId, uint16_t version, const void *body,
+                            uint32_t bodySize);
+
+/// <summary>
+/// <para>Generates inline functions which read and write a typed message, which has been
+/// declared with INTERCORE_TYPED_MESSAGE, directly in the shared buffers:</para>
+/// <para>int Type_Decode(const IntercoreBlock *block, uint8_t *messageHeader, Type *message)
+/// </para>
+/// <para>int Type_Enqueue(IntercoreCursor *cursor, const uint8_t *messageHeader,
+/// const Type *message)</para>
+/// <para>int Type_EnqueueBulk(IntercoreCursor *cursor, const uint8_t *messageHeader,
+/// const Type *message)</para>
+/// <para>See <see cref="DecodeTypedMessage" />, <see cref="EnqueueTypedMessage" /> and
+/// <see cref="EnqueueBulkTypedMessage" />.</para>
+/// </summary>
+#define INTERCORE_DEFINE_RING_CODEC(Type)                                                       \
+    static inline int Type##_Decode(const IntercoreBlock *block, uint8_t *messageHeader,        \
+                                    Type *message)                                              \
+    {                                                                                           \
+        return DecodeTypedMessage(block, Type##_TypeId, Type##_Version, messageHeader, message, \
+                                  sizeof(*message));                                            \
+    }                                                                                           \
+    static inline int Type##_Enqueue(IntercoreCursor *cursor, const uint8_t *messageHeader,     \
+                                     const Type *message)                                       \
+    {                                                                                           \
+        return EnqueueTypedMessage(cursor, messageHeader, Type##_TypeId, Type##_Version,        \
+                                   message, sizeof(*message));                                  \
+    }                                                                                           \
+    static inline int Type##_EnqueueBulk(IntercoreCursor *cursor, const uint8_t *messageHeader, \
+                                         const Type *message)                                   \
+    {                                                                                           \
+        return EnqueueBulkTypedMessage(cursor, messageHeader, Type##_TypeId, Type##_Version,    \
+                                       message, sizeof(*message));                              \
+    }
+
+/// <summary>
+/// <para>Collects records for a stream message to a high-level application, as described by
+/// <see cref="IntercoreStreamRecordHeader" />.</para>
+/// <para>The batch is set up by <see cref="InitStreamBatch" />. Its members are managed by the
+/// intercore functions and must not be modified by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Message header which is written at the start of the message.</summary>
+    uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+    /// <summary>The records which have been added, back to back.</summary>
+    uint8_t records[INTERCORE_STREAM_RECORDS_SIZE];
+    /// <summary>Number of bytes in records.</summary>
+    uint32_t size;
+} IntercoreStreamBatch;
+
+/// <summary>
+/// Set up an empty batch of stream records.
+/// </summary>
+/// <param name="batch">The batch to set up.</param>
+/// <param name="messageHeader">Message header which identifies the high-level application,
+/// e.g. the one from a message which it sent.</param>
+void InitStreamBatch(IntercoreStreamBatch *batch, const uint8_t *messageHeader);
+
+/// <summary>
+/// Add a record to a batch. The record data is copied.
+/// </summary>
+/// <param name="batch">Batch set up by <see cref="InitStreamBatch" />.</param>
+/// <param name="streamId">The logical stream which the record belongs to.</param>
+/// <param name="data">The record data.</param>
+/// <param name="size">Size of the record data in bytes, up to
+/// INTERCORE_STREAM_MAX_RECORD_SIZE.</param>
+/// <returns>0 on success; -1 if the record does not fit in the batch, in which case send the
+/// batch with <see cref="EnqueueStreamBatch" /> and add the record again.</returns>
+int AddStreamRecord(IntercoreStreamBatch *batch, uint8_t streamId, const void *data,
+                    uint32_t size);
+
+/// <summary>
+/// Write the records of a batch as one stream message, as part of a batch of blocks which is
+/// published with <see cref="CommitEnqueue" />, and empty it. Nothing is written if the batch
+/// is empty.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginEnqueue" />.</param>
+/// <param name="batch">Batch set up by <see cref="InitStreamBatch" />.</param>
+/// <returns>0 on success; -1 if there is not enough space in the shared buffer, in which case
+/// the records stay in the batch.</returns>
+int EnqueueStreamBatch(IntercoreCursor *cursor, IntercoreStreamBatch *batch);
+
+/// <summary>
+/// Find out whether a block, which has been read with <see cref="PeekNextBlock" />, holds a
+/// stream message rather than a fragment or a typed message.
+/// </summary>
+/// <param name="block">The block to examine.</param>
+/// <param name="messageHeader">If not NULL, and the block holds a stream message, receives
+/// the INTERCORE_MESSAGE_HEADER_SIZE byte header which identifies the sender.</param>
+/// <returns>true if the block holds a stream message; false otherwise.</returns>
+bool IsStreamMessage(const IntercoreBlock *block, uint8_t *messageHeader);
+
+/// <summary>
+/// Read the next record of a stream message.
+/// </summary>
+/// <param name="block">The block which holds the message.</param>
+/// <param name="offset">Position of the next record. Set this to 0 to read the first record;
+/// it is advanced past each record which is read.</param>
+/// <param name="streamId">Receives the stream ID of the record.</param>
+/// <param name="data">Receives the record data. This must have space for
+/// INTERCORE_STREAM_MAX_RECORD_SIZE bytes.</param>
+/// <param name="size">Receives the size of the record data in bytes.</param>
+/// <returns>1 if a record was read; 0 if there are no more records; -1 if the rest of the
+/// message is not a valid record.</returns>
+int ReadStreamRecord(const IntercoreBlock *block, uint32_t *offset, uint8_t *streamId,
+                     void *data, uint32_t *size);
+
+/// <summary>
+/// <para>Collects fixed-size records for a packed message to a high-level application, as
+/// described by <see cref="IntercorePackedHeader" />.</para>
+/// <para>The batch is sent when it is full, or when its oldest record has waited long enough,
+/// as <see cref="IsPackedBatchDue" /> tells, so that a slow stream of records is not held back
+/// indefinitely. The times are in whatever unit the caller counts, such as milliseconds.
+/// </para>
+/// <para>The batch is set up by <see cref="InitPackedBatch" />. Its members are managed by the
+/// intercore functions and must not be modified by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Message header which is written at the start of the message.</summary>
+    uint8_t messageHeader[INTERCORE_MESSAGE_HEADER_SIZE];
+    /// <summary>The records which have been added, back to back.</summary>
+    uint8_t records[INTERCORE_PACKED_RECORDS_SIZE];
+    /// <summary>Size of each record in bytes.</summary>
+    uint16_t recordSize;
+    /// <summary>Number of records in records, and the number which fit.</summary>
+    uint16_t recordCount;
+    uint16_t recordCapacity;
+    /// <summary>Time at which the oldest record in the batch was added.</summary>
+    uint32_t firstRecordTime;
+} IntercorePackedBatch;
+
+/// <summary>
+/// Set up an empty batch of packed records.
+/// </summary>
+/// <param name="batch">The batch to set up.</param>
+/// <param name="messageHeader">Message header which identifies the high-level application,
+/// e.g. the one from a message which it sent.</param>
+/// <param name="recordSize">Size of each record in bytes, from 1 to
+/// INTERCORE_PACKED_RECORDS_SIZE.</param>
+/// <returns>0 on success; -1 if recordSize is not valid.</returns>
+int InitPackedBatch(IntercorePackedBatch *batch, const uint8_t *messageHeader,
+                    uint32_t recordSize);
+
+/// <summary>
+/// Add a record to a batch. The record is copied.
+/// </summary>
+/// <param name="batch">Batch set up by <see cref="InitPackedBatch" />.</param>
+/// <param name="record">The record, of the batch's record size.</param>
+/// <param name="now">The current time, which is kept if this is the first record in the batch.
+/// </param>
+/// <returns>0 on success; -1 if the batch is full, in which case send the batch with
+/// <see cref="EnqueuePackedBatch" /> and add the record again.</returns>
+int AddPackedRecord(IntercorePackedBatch *batch, const void *record, uint32_t now);
+
+/// <summary>
+/// Find out whether a batch should be sent: because it is full, or because its oldest record
+/// was added at least maxAge ago.
+/// </summary>
+/// <param name="batch">Batch set up by <see cref="InitPackedBatch" />.</param>
+/// <param name="now">The current time, in the same unit as was passed to
+/// <see cref="AddPackedRecord" />.</param>
+/// <param name="maxAge">Longest time that a record may wait in the batch.</param>
+/// <returns>true if the batch should be sent; false otherwise, including if it is empty.
+/// </returns>
+bool IsPackedBatchDue(const IntercorePackedBatch *batch, uint32_t now, uint32_t maxAge);
+
+/// <summary>
+/// Write the records of a batch as one packed message, as part of a batch of blocks which is
+/// published with <see cref="CommitEnqueue" />, and empty it. Packed records are bulk data, so
+/// the message is written in the bulk lane, as for <see cref="ReserveBulkBlock" />. Nothing is
+/// written if the batch is empty.
+/// </summary>
+/// <param name="cursor">Cursor set up by <see cref="BeginEnqueue" />.</param>
+/// <param name="batch">Batch set up by <see cref="InitPackedBatch" />.</param>
+/// <returns>0 on success; -1 if there is not enough space in the shared buffer, in which case
+/// the records stay in the batch.</returns>
+int EnqueuePackedBatch(IntercoreCursor *cursor, IntercorePackedBatch *batch);
+
+/// <summary>
+/// Find out whether a block, which has been read with <see cref="PeekNextBlock" />, holds a
+/// packed message, and read its header.
+/// </summary>
+/// <param name="block">The block to examine.</param>
+/// <param name="header">If not NULL, and the block holds a valid packed message, receives
+/// its header.</param>
+/// <returns>true if the block holds a packed message whose records fill it exactly; false
+/// otherwise.</returns>
+bool IsPackedMessage(const IntercoreBlock *block, IntercorePackedHeader *header);
+
+/// <summary>
+/// Read records from a packed message.
+/// </summary>
+/// <param name="block">The block which holds the message, which
+/// <see cref="IsPackedMessage" /> has accepted.</param>
+/// <param name="header">The message's header, from <see cref="IsPackedMessage" />.</param>
+/// <param name="firstRecord">Index of the first record to read.</param>
+/// <param name="records">Receives the records, back to back.</param>
+/// <param name="count">Number of records to read.</param>
+/// <returns>0 on success; -1 if the message does not have that many records.</returns>
+int ReadPackedRecords(const IntercoreBlock *block, const IntercorePackedHeader *header,
+                      uint32_t firstRecord, void *records, uint32_t count);
+
 #endif // #ifndef MT3620_INTERCORE_H
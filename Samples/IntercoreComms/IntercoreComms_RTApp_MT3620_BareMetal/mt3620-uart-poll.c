@@ -1,14 +1,19 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#include <stdarg.h>
 #include <stdbool.h>
 
+#include "format.h"
 #include "mt3620-baremetal.h"
 #include "mt3620-uart-poll.h"
 
 static const uintptr_t UART_BASE = 0x21040000;
 
+static UartLogMode logMode = UartLogMode_Text;
+
 static void WriteIntegerAsStringWidth(int value, int width);
+static void WriteBytesPoll(const uint8_t *data, size_t length);
 
 void Uart_Init(void)
 {
@@ -26,13 +31,18 @@ void Uart_Init(void)
 
 void Uart_WriteStringPoll(const char *msg)
 {
-    while (*msg) {
+    WriteBytesPoll((const uint8_t *)msg, __builtin_strlen(msg));
+}
+
+static void WriteBytesPoll(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
         // When LSR[5] is set, can write another character.
         while (!(ReadReg32(UART_BASE, 0x14) & (1U << 5))) {
             // empty.
         }
 
-        WriteReg32(UART_BASE, 0x0, *msg++);
+        WriteReg32(UART_BASE, 0x0, data[i]);
     }
 }
 
@@ -100,3 +110,72 @@ void Uart_WriteHexBytePoll(uint8_t value)
 
     Uart_WriteStringPoll(text);
 }
+
+void Uart_WriteHexBytesPoll(const uint8_t *data, size_t length, char separator)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    // Each byte takes up to three characters, including the separator.
+    char text[3 * 16];
+    size_t textLength = 0;
+
+    for (size_t i = 0; i < length; ++i) {
+        if (separator != '\0' && i != 0) {
+            text[textLength++] = separator;
+        }
+        text[textLength++] = digits[data[i] >> 4];
+        text[textLength++] = digits[data[i] & 0xF];
+
+        if (textLength > sizeof(text) - 3) {
+            WriteBytesPoll((const uint8_t *)text, textLength);
+            textLength = 0;
+        }
+    }
+
+    WriteBytesPoll((const uint8_t *)text, textLength);
+}
+
+void Uart_WriteFormatPoll(const char *format, ...)
+{
+    char text[UART_FORMAT_BUFFER_SIZE];
+
+    va_list args;
+    va_start(args, format);
+    size_t length = Format_Vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    WriteBytesPoll((const uint8_t *)text, length);
+}
+
+void Uart_SetLogMode(UartLogMode mode)
+{
+    logMode = mode;
+}
+
+void Uart_LogPoll(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    if (logMode == UartLogMode_Text) {
+        char text[UART_FORMAT_BUFFER_SIZE];
+        size_t length = Format_Vsnprintf(text, sizeof(text), format, args);
+        WriteBytesPoll((const uint8_t *)text, length);
+    } else {
+        // Marker, length, format string address, then the arguments.
+        uint8_t record[1 + 1 + sizeof(uint32_t) + UART_LOG_MAX_ARGS_SIZE];
+        uintptr_t formatAddr = (uintptr_t)format;
+        size_t argsLength =
+            Format_EncodeArgs(&record[2 + sizeof(uint32_t)], UART_LOG_MAX_ARGS_SIZE, format, args);
+
+        record[0] = UART_LOG_RECORD_MARKER;
+        record[1] = (uint8_t)(sizeof(uint32_t) + argsLength);
+        for (size_t i = 0; i < sizeof(uint32_t); ++i) {
+            record[2 + i] = (uint8_t)(formatAddr >> (8 * i));
+        }
+
+        WriteBytesPoll(record, 2 + sizeof(uint32_t) + argsLength);
+    }
+
+    va_end(args);
+}
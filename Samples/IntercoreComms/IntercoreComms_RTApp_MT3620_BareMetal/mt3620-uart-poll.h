@@ -4,6 +4,7 @@
 #ifndef MT3620_UART_POLL_H
 #define MT3620_UART_POLL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /// <summary>
@@ -51,4 +52,71 @@ void Uart_WriteIntegerWidthPoll(int value, int width);
 /// <param name="value">The value whose string representation is written to the UART.</param>
 void Uart_WriteHexBytePoll(uint8_t value);
 
+/// <summary>
+/// <para>Write the hexadecimal representation of a sequence of bytes to the debug UART, two
+/// digits per byte. The text is formatted in blocks on the stack, rather than one byte at a
+/// time. This function polls until all of the text has been written to the UART.</para>
+/// <para>Call <see cref="Uart_Init" /> before calling this function.</para>
+/// </summary>
+/// <param name="data">Start of the bytes.</param>
+/// <param name="length">Number of bytes.</param>
+/// <param name="separator">Character to write between bytes, or '\0' for none.</param>
+void Uart_WriteHexBytesPoll(const uint8_t *data, size_t length, char separator);
+
+/// <summary>
+/// <para>Format a printf-style string into a buffer on the stack, and write it to the debug UART.
+/// The conversions which <see cref="Format_Vsnprintf" /> supports can be used. Text which
+/// does not fit in UART_FORMAT_BUFFER_SIZE bytes is discarded. This function polls until all of
+/// the text has been written to the UART.</para>
+/// <para>Call <see cref="Uart_Init" /> before calling this function.</para>
+/// </summary>
+/// <param name="format">printf-style format string.</param>
+void Uart_WriteFormatPoll(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/// <summary>Size of the stack buffer which <see cref="Uart_WriteFormatPoll" /> uses, including
+/// the null terminator.</summary>
+#define UART_FORMAT_BUFFER_SIZE 128
+
+/// <summary>How <see cref="Uart_LogPoll" /> writes to the debug UART.</summary>
+typedef enum {
+    /// <summary>Format each message as text, with <see cref="Uart_WriteFormatPoll" />.</summary>
+    UartLogMode_Text,
+    /// <summary>
+    /// Write each message as a binary record, which holds the address of the format string and
+    /// the encoded arguments, rather than the formatted text. The records are much shorter than
+    /// the text, and nothing is formatted on the real-time core. Decode the output on the
+    /// computer which is connected to the UART with decode_binary_log.py, which reads the format
+    /// strings from the application's ELF file.
+    /// </summary>
+    UartLogMode_Binary
+} UartLogMode;
+
+/// <summary>First byte of each binary log record. This is not an ASCII character, so text
+/// which is written with the other functions can be mixed with binary log records.</summary>
+#define UART_LOG_RECORD_MARKER 0xA5
+
+/// <summary>Largest encoded argument data in a binary log record, in bytes. Arguments which do
+/// not fit are not sent.</summary>
+#define UART_LOG_MAX_ARGS_SIZE 96
+
+/// <summary>
+/// Selects how <see cref="Uart_LogPoll" /> writes messages. The default is
+/// <see cref="UartLogMode_Text" />.
+/// </summary>
+/// <param name="mode">The new mode.</param>
+void Uart_SetLogMode(UartLogMode mode);
+
+/// <summary>
+/// <para>Write a log message to the debug UART, as text or as a binary record depending on
+/// <see cref="Uart_SetLogMode" />. This function polls until the message has been written to the
+/// UART.</para>
+/// <para>A binary record is the UART_LOG_RECORD_MARKER byte, a byte which holds the number of
+/// bytes which follow, the 32-bit little-endian address of the format string, and the arguments
+/// which <see cref="Format_EncodeArgs" /> encodes. The format string must therefore be a string
+/// literal, or another string which is in the application's image.</para>
+/// <para>Call <see cref="Uart_Init" /> before calling this function.</para>
+/// </summary>
+/// <param name="format">printf-style format string.</param>
+void Uart_LogPoll(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
 #endif // #ifndef MT3620_UART_POLL_H
@@ -0,0 +1,31 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+/// <para>Messages which the IntercoreBenchmark high-level application sends to the real-time
+/// capable application. Any message which is not a <see cref="IntercoreBenchmarkSetMode" />
+/// is echoed back with upper-case and lower-case letters swapped.</para>
+/// <para>The high-level application only puts lower-case letters in the messages which it
+/// echoes, so they cannot be mistaken for a mode change.</para>
+/// </summary>
+#define INTERCORE_BENCHMARK_SET_MODE_MAGIC 0x444F4D42u // "BMOD"
+
+/// <summary>
+/// Changes the way in which the real-time capable application echoes messages. It replies with
+/// the same message once the mode has changed.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>INTERCORE_BENCHMARK_SET_MODE_MAGIC.</summary>
+    uint32_t magic;
+    /// <summary>Number of replies after which the high-level application is notified, as
+    /// passed to SetIntercoreNotificationThreshold. 0 means only when the real-time capable
+    /// application runs out of messages to echo.</summary>
+    uint32_t notificationThreshold;
+    /// <summary>Non-zero to echo each message directly between the shared buffers; zero to
+    /// copy it out, and the reply back in, through a local buffer.</summary>
+    uint8_t zeroCopy;
+} IntercoreBenchmarkSetMode;
@@ -0,0 +1,33 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+/// <para>Messages which are larger than one intercore message can carry are split into
+/// fragments. Every fragment starts with this header, followed by the next part of the
+/// message data.</para>
+/// <para>Fragments of a message are sent in order, with fragmentIndex counting up from 0. A
+/// fragment with index 0 starts a new message, discarding any incomplete one. The message is
+/// complete once totalSize bytes have been received.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Total size of the message data in bytes, not counting fragment headers.</summary>
+    uint32_t totalSize;
+    /// <summary>Identifies the message which the fragment belongs to.</summary>
+    uint16_t messageId;
+    /// <summary>Position of the fragment in the message.</summary>
+    uint16_t fragmentIndex;
+} IntercoreFragmentHeader;
+
+/// <summary>
+/// Maximum size of a fragment, including its header. This is kept well below the size of the
+/// shared buffers, so that several fragments can be in flight at once.
+/// </summary>
+#define INTERCORE_MAX_FRAGMENT_SIZE 256
+
+/// <summary>Maximum number of message data bytes in one fragment.</summary>
+#define INTERCORE_MAX_FRAGMENT_DATA_SIZE \
+    (INTERCORE_MAX_FRAGMENT_SIZE - sizeof(IntercoreFragmentHeader))
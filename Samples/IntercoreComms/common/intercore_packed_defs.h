@@ -0,0 +1,36 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "intercore_fragment_defs.h"
+
+/// <summary>
+/// <para>Packed messages carry many small records of the same fixed size, such as sensor
+/// samples, back to back after one <see cref="IntercorePackedHeader" />. A record costs only
+/// its own size: a 4-byte sample sent on its own takes a 32-byte block of the shared buffer,
+/// with its length, the 20-byte intercore message header and the padding, but 62 of them
+/// share one 288-byte block in a packed message.</para>
+/// <para>Packed messages share the connection with fragments, typed messages and stream
+/// messages. A packed message starts with this marker where a fragment has its totalSize,
+/// which is never this large.</para>
+/// </summary>
+#define INTERCORE_PACKED_MESSAGE_MARKER 0xFFFFFFFDu
+
+/// <summary>
+/// Header at the start of every packed message, after the marker. The records follow
+/// immediately.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Size of each record in bytes. The applications agree on what the records
+    /// hold for each size, or put a type in the records.</summary>
+    uint16_t recordSize;
+    /// <summary>Number of records which follow.</summary>
+    uint16_t recordCount;
+} IntercorePackedHeader;
+
+/// <summary>Space for records after the marker and header of a packed message.</summary>
+#define INTERCORE_PACKED_RECORDS_SIZE \
+    (INTERCORE_MAX_FRAGMENT_SIZE - sizeof(uint32_t) - sizeof(IntercorePackedHeader))
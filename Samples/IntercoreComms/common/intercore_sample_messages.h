@@ -0,0 +1,110 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "intercore_stream_defs.h"
+#include "intercore_typed_defs.h"
+
+/// <summary>
+/// Sent by the high-level application every second.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Number of counter messages which were sent before this one.</summary>
+    uint32_t counter;
+} IntercoreCounterMessage;
+INTERCORE_TYPED_MESSAGE(IntercoreCounterMessage, 1, 1);
+
+/// <summary>
+/// Sent by the real-time capable application in reply to each
+/// <see cref="IntercoreCounterMessage" />.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>The counter from the message.</summary>
+    uint32_t counter;
+    /// <summary>Number of counter messages which the real-time capable application has
+    /// received, including this one.</summary>
+    uint32_t messagesReceived;
+} IntercoreCounterReply;
+INTERCORE_TYPED_MESSAGE(IntercoreCounterReply, 2, 1);
+
+/// <summary>
+/// Sent by the high-level application to read the timing of one of the real-time capable
+/// application's profile sites.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Index of the site, from 0.</summary>
+    uint8_t siteIndex;
+} IntercoreProfileRequest;
+INTERCORE_TYPED_MESSAGE(IntercoreProfileRequest, 3, 1);
+
+/// <summary>Size of the name in <see cref="IntercoreProfileReply" />.</summary>
+#define INTERCORE_PROFILE_NAME_SIZE 24
+
+/// <summary>
+/// Sent by the real-time capable application in reply to each
+/// <see cref="IntercoreProfileRequest" />. The times are in cycles of the real-time core's
+/// clock, which runs at cpuHz.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>The index from the request.</summary>
+    uint8_t siteIndex;
+    /// <summary>Number of sites which have been measured. If siteIndex is not less than this,
+    /// the other fields are zero.</summary>
+    uint8_t siteCount;
+    /// <summary>Name of the site, which is null-terminated unless it fills the array.</summary>
+    char name[INTERCORE_PROFILE_NAME_SIZE];
+    uint32_t cpuHz;
+    /// <summary>Number of measurements.</summary>
+    uint32_t count;
+    /// <summary>Shortest and longest measurement, and the sum of all of them.</summary>
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    /// <summary>Shortest and longest time from the start of one measurement to the start of
+    /// the next.</summary>
+    uint32_t minIntervalCycles;
+    uint32_t maxIntervalCycles;
+} IntercoreProfileReply;
+INTERCORE_TYPED_MESSAGE(IntercoreProfileReply, 4, 1);
+
+/// <summary>
+/// The logical streams which the applications exchange in stream messages, as described by
+/// <see cref="IntercoreStreamRecordHeader" />.
+/// </summary>
+typedef enum {
+    /// <summary><see cref="IntercoreStreamControl" /> records from the high-level application.
+    /// </summary>
+    IntercoreStream_Control = 0,
+    /// <summary><see cref="IntercoreHandlerSample" /> records from the real-time capable
+    /// application.</summary>
+    IntercoreStream_Samples = 1,
+    /// <summary>Lines of text which the real-time capable application also writes to its
+    /// UART, without the line ending.</summary>
+    IntercoreStream_Log = 2
+} IntercoreStreamId;
+
+/// <summary>
+/// Sent by the high-level application on <see cref="IntercoreStream_Control" /> to choose
+/// which streams the real-time capable application sends. The streams are sent to the
+/// application which sent the most recent control record.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>1 to send <see cref="IntercoreStream_Samples" />, 0 not to.</summary>
+    uint8_t samplesEnabled;
+    /// <summary>1 to send <see cref="IntercoreStream_Log" />, 0 not to.</summary>
+    uint8_t logEnabled;
+} IntercoreStreamControl;
+
+/// <summary>
+/// Sent by the real-time capable application on <see cref="IntercoreStream_Samples" /> each
+/// time it has handled messages from the high-level application.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Number of messages which were handled.</summary>
+    uint16_t messagesHandled;
+    /// <summary>Cycles of the real-time core's clock which handling them took.</summary>
+    uint32_t cycles;
+} IntercoreHandlerSample;
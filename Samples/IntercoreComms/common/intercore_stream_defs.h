@@ -0,0 +1,41 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "intercore_fragment_defs.h"
+
+/// <summary>
+/// <para>Stream messages carry several small records, each for one of up to 256 logical
+/// streams, such as control, samples and logs. A record only costs a two-byte header, so many
+/// small records share the 20-byte intercore message header and the padding of one block in the
+/// shared buffer, instead of each paying for its own.</para>
+/// <para>Stream messages share the connection with fragments and typed messages. A stream
+/// message starts with this marker where a fragment has its totalSize, which is never this
+/// large, and a typed message has INTERCORE_TYPED_MESSAGE_MARKER. The records follow the
+/// marker back to back, without padding, until the end of the message.</para>
+/// </summary>
+#define INTERCORE_STREAM_MESSAGE_MARKER 0xFFFFFFFEu
+
+/// <summary>
+/// Header at the start of every record in a stream message. The record data follows
+/// immediately.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Identifies the logical stream. The applications agree on the IDs.</summary>
+    uint8_t streamId;
+    /// <summary>Size of the record data in bytes, which may be 0.</summary>
+    uint8_t size;
+} IntercoreStreamRecordHeader;
+
+/// <summary>Space for records after the marker of a stream message.</summary>
+#define INTERCORE_STREAM_RECORDS_SIZE (INTERCORE_MAX_FRAGMENT_SIZE - sizeof(uint32_t))
+
+/// <summary>Maximum size of the data in one record.</summary>
+#define INTERCORE_STREAM_MAX_RECORD_SIZE \
+    (INTERCORE_STREAM_RECORDS_SIZE - sizeof(IntercoreStreamRecordHeader))
+
+_Static_assert(INTERCORE_STREAM_MAX_RECORD_SIZE <= UINT8_MAX,
+               "Record size does not fit in IntercoreStreamRecordHeader");
@@ -0,0 +1,43 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "intercore_fragment_defs.h"
+
+/// <summary>
+/// <para>Typed messages carry one fixed-layout struct, which both applications include from a
+/// shared header, so that neither has to format or parse text. They are always sent whole,
+/// never in fragments.</para>
+/// <para>Typed messages and fragments share the connection. A typed message starts with this
+/// marker where a fragment has its totalSize, which is never this large.</para>
+/// </summary>
+#define INTERCORE_TYPED_MESSAGE_MARKER 0xFFFFFFFFu
+
+/// <summary>
+/// Header at the start of every typed message. The struct follows immediately.
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>INTERCORE_TYPED_MESSAGE_MARKER.</summary>
+    uint32_t marker;
+    /// <summary>Identifies the struct which follows.</summary>
+    uint16_t typeId;
+    /// <summary>Layout version of the struct. It changes whenever the layout changes, so that
+    /// a message from an application built against a different layout is rejected.</summary>
+    uint16_t version;
+} IntercoreTypedHeader;
+
+/// <summary>
+/// <para>Declares the type ID and version of a typed message struct, as the enum values
+/// Type_TypeId and Type_Version. Each core generates its encode and decode functions from
+/// these: INTERCORE_DEFINE_RING_CODEC on the real-time core, INTERCORE_CHANNEL_DEFINE_CODEC on
+/// the high-level core.</para>
+/// <para>The struct must be packed and only contain fixed-width types, so that it has the same
+/// layout on both cores. With its header, it must fit in INTERCORE_MAX_FRAGMENT_SIZE.</para>
+/// </summary>
+#define INTERCORE_TYPED_MESSAGE(Type, typeId, version)                                         \
+    enum { Type##_TypeId = (typeId), Type##_Version = (version) };                             \
+    _Static_assert(sizeof(Type) <= INTERCORE_MAX_FRAGMENT_SIZE - sizeof(IntercoreTypedHeader), \
+                   #Type " is too large to be sent as one typed message")
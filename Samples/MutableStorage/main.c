@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
@@ -23,6 +24,10 @@
 #include <applibs/gpio.h>
 
 #include "epoll_timerfd_utilities.h"
+#include "input_manager.h"
+#include "kv_store.h"
+#include "shutdown_coordinator.h"
+#include "storage_metrics.h"
 
 // By default, this sample's CMake build targets hardware that follows the MT3620
 // Reference Development Board (RDB) specification, such as the MT3620 Dev Kit from
@@ -45,66 +50,42 @@ static int triggerDeleteButtonGpioFd = -1;
 // LEDs
 static int appRunningLedFd = -1;
 
-// Timer / polling
-static int buttonPollTimerFd = -1;
+// Polling
+static InputManager inputManager;
 static int epollFd = -1;
 
-// Button state variables
-static GPIO_Value_Type triggerUpdateButtonState = GPIO_Value_High;
-static GPIO_Value_Type triggerDeleteButtonState = GPIO_Value_High;
+// The values are kept in a key-value store in the mutable file, which is opened once.
+static KvStore store;
+static uint8_t storeBuffer[KV_STORE_MAX_RECORD_SIZE];
+// Size of the mutable file, which is set by MutableStorage in the application manifest.
+#define STORE_SIZE (8 * 1024)
+// Changes are written this long after the first one, so that repeated presses of button A
+// are written to flash together.
+static const struct timespec commitDelay = {5, 0};
+
+// When the application is asked to exit, the changes which are waiting for the commit timer are
+// written before the store is closed.
+static ShutdownCoordinator shutdownCoordinator;
+static const struct timespec shutdownGracePeriod = {SHUTDOWN_GRACE_PERIOD_SECONDS - 2, 0};
+static ShutdownHook storeShutdownHook = {
+    .name = "KvStore", .handler = &KvStore_ShutdownHook, .context = &store, .deadline = {2, 0}};
 
 /// <summary>
-/// Write an integer to this application's persistent data file
+/// Open this application's persistent data file, and the key-value store in it, which stays
+/// open until the application exits
 /// </summary>
-static void WriteToMutableFile(int value)
-{
-    int fd = Storage_OpenMutableFile();
-    if (fd < 0) {
-        Log_Debug("ERROR: Could not open mutable file:  %s (%d).\n", strerror(errno), errno);
-        return;
-    }
-    ssize_t ret = write(fd, &value, sizeof(value));
-    if (ret < 0) {
-        // If the file has reached the maximum size specified in the application manifest,
-        // then -1 will be returned with errno EDQUOT (122)
-        Log_Debug("ERROR: An error occurred while writing to mutable file:  %s (%d).\n",
-                  strerror(errno), errno);
-    } else if (ret < sizeof(value)) {
-        // For simplicity, this sample logs an error here. In the general case, this should be
-        // handled by retrying the write with the remaining data until all the data has been
-        // written.
-        Log_Debug("ERROR: Only wrote %d of %d bytes requested\n", ret, (int)sizeof(value));
-    }
-    close(fd);
-}
-
-/// <summary>
-/// Read an integer from this application's persistent data file
-/// </summary>
-/// <returns>
-/// The integer that was read from the file.  If the file is empty, this returns 0.  If the storage
-/// API fails, this returns -1.
-/// </returns>
-static int ReadMutableFile(void)
+/// <returns>0 on success, or -1 on failure</returns>
+static int OpenStore(void)
 {
-    int fd = Storage_OpenMutableFile();
+    int fd = StorageMetrics_OpenMutableFile();
     if (fd < 0) {
         Log_Debug("ERROR: Could not open mutable file:  %s (%d).\n", strerror(errno), errno);
         return -1;
     }
-    int value = 0;
-    ssize_t ret = read(fd, &value, sizeof(value));
-    if (ret < 0) {
-        Log_Debug("ERROR: An error occurred while reading file:  %s (%d).\n", strerror(errno),
-                  errno);
-    }
-    close(fd);
-
-    if (ret < sizeof(value)) {
-        return 0;
+    if (KvStore_Open(&store, fd, 0, STORE_SIZE, storeBuffer, sizeof(storeBuffer)) != 0) {
+        return -1;
     }
-
-    return value;
+    return KvStore_StartCommitTimer(&store, epollFd, &commitDelay);
 }
 
 static volatile sig_atomic_t terminationRequired = false;
@@ -118,39 +99,21 @@ static void TerminationHandler(int signalNumber)
     terminationRequired = true;
 }
 
-/// <summary>
-///     Check whether a given button has just been pressed.
-/// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>true if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
-{
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        terminationRequired = true;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
-    }
-
-    return isButtonPressed;
-}
-
 /// <summary>
 /// Pressing button A will:
-///		- Read from this application's file
-///		- If there is data in this file, read it and increment
-///		- Write the integer to file
+///		- Read the count from this application's file
+///		- If there is a count, increment it
+///		- Write the count, and the time of the update, to the file in one commit, a few
+///		  seconds later
 /// </summary>
-static void UpdateButtonHandler(void)
+static void UpdateButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    if (IsButtonPressed(triggerUpdateButtonGpioFd, &triggerUpdateButtonState)) {
-        int readFromFile = ReadMutableFile();
+    if (isPressed) {
+        int readFromFile = 0;
+        if (KvStore_Get(&store, "count", &readFromFile, sizeof(readFromFile)) !=
+            sizeof(readFromFile)) {
+            readFromFile = 0;
+        }
         int writeToFile = readFromFile + 1;
 
         if (readFromFile <= 0) {
@@ -159,16 +122,29 @@ static void UpdateButtonHandler(void)
             Log_Debug("Read %d from the mutable file, updating to %d\n", readFromFile, writeToFile);
         }
 
-        WriteToMutableFile(writeToFile);
+        // Both values are committed together by the store's timer, so that a power failure
+        // cannot leave only one of them updated. Presses before then replace the values in
+        // memory, and are written once.
+        time_t now = time(NULL);
+        if (KvStore_Set(&store, "count", &writeToFile, sizeof(writeToFile)) != 0 ||
+            KvStore_Set(&store, "updated", &now, sizeof(now)) != 0) {
+            // If the file has reached the maximum size specified in the application manifest,
+            // then errno is EDQUOT (122)
+            Log_Debug("ERROR: An error occurred while writing to mutable file:  %s (%d).\n",
+                      strerror(errno), errno);
+        }
     }
 }
 
 /// <summary>
 /// Pressing button B will delete the user file
 /// </summary>
-static void DeleteButtonHandler(void)
+static void DeleteButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    if (IsButtonPressed(triggerDeleteButtonGpioFd, &triggerDeleteButtonState)) {
+    if (isPressed) {
+        // The file must be closed before it is deleted. It is created again, empty, when the
+        // store is reopened.
+        KvStore_Close(&store);
         int ret = Storage_DeleteMutableFile();
         if (ret < 0) {
             Log_Debug("An error occurred while deleting the mutable file: %s (%d).\n",
@@ -176,24 +152,25 @@ static void DeleteButtonHandler(void)
         } else {
             Log_Debug("Successfully deleted the mutable file!\n");
         }
+        if (OpenStore() != 0) {
+            terminationRequired = true;
+        }
     }
 }
 
 /// <summary>
-/// Button timer event:  Check the status of both buttons
+/// The input manager could not read a button, so exit.
 /// </summary>
-static void ButtonPollTimerEventHandler(EventData *eventData)
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error)
 {
-    if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0) {
-        terminationRequired = true;
-        return;
-    }
-    UpdateButtonHandler();
-    DeleteButtonHandler();
+    terminationRequired = true;
 }
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData buttonPollEventData = {.eventHandler = &ButtonPollTimerEventHandler};
+// The buttons read low when they are pressed.
+static InputManagerInput triggerUpdateButton = {.activeValue = GPIO_Value_Low,
+                                                .changedHandler = &UpdateButtonHandler};
+static InputManagerInput triggerDeleteButton = {.activeValue = GPIO_Value_Low,
+                                                .changedHandler = &DeleteButtonHandler};
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -237,14 +214,29 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    // Set up a timer to poll for button events.
-    struct timespec buttonPressCheckPeriod = {0, 1000 * 1000};
-    buttonPollTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod, &buttonPollEventData, EPOLLIN);
-    if (buttonPollTimerFd < 0) {
+    StorageMetrics_SetMutableFileQuota(STORE_SIZE);
+    if (OpenStore() != 0) {
         return -1;
     }
 
+    // Sample both buttons on one timer, which reports only debounced presses and releases.
+    if (InputManager_Init(&inputManager, epollFd, NULL, 0, &ButtonReadErrorHandler) != 0) {
+        return -1;
+    }
+    // Sample the buttons less often while neither of them is changing.
+    static const struct timespec idleSamplePeriod = {0,
+                                                     INPUT_MANAGER_SUGGESTED_IDLE_SAMPLE_PERIOD_NS};
+    if (InputManager_SetIdleSamplePeriod(&inputManager, &idleSamplePeriod) != 0) {
+        return -1;
+    }
+    triggerUpdateButton.gpioFd = triggerUpdateButtonGpioFd;
+    InputManager_AddInput(&inputManager, &triggerUpdateButton);
+    triggerDeleteButton.gpioFd = triggerDeleteButtonGpioFd;
+    InputManager_AddInput(&inputManager, &triggerDeleteButton);
+
+    ShutdownCoordinator_Init(&shutdownCoordinator, &shutdownGracePeriod);
+    ShutdownCoordinator_AddHook(&shutdownCoordinator, &storeShutdownHook);
+
     return 0;
 }
 
@@ -260,7 +252,13 @@ static void ClosePeripheralsAndHandlers(void)
         GPIO_SetValue(appRunningLedFd, GPIO_Value_High);
     }
 
-    CloseFdAndPrintError(buttonPollTimerFd, "ButtonPollTimer");
+    InputManager_Close(&inputManager);
+    KvStore_Close(&store);
+
+    // Show how often, and how much, the application wrote to flash.
+    StorageMetrics storageMetrics;
+    StorageMetrics_GetSnapshot(&storageMetrics);
+    StorageMetrics_Log(&storageMetrics);
     CloseFdAndPrintError(triggerUpdateButtonGpioFd, "TriggerUpdateButtonGpio");
     CloseFdAndPrintError(triggerDeleteButtonGpioFd, "TriggerDeleteButtonGpio");
     CloseFdAndPrintError(appRunningLedFd, "AppRunningLedBlueGpio");
@@ -286,6 +284,8 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Let the modules flush their data, such as the changes to the store, before closing them.
+    ShutdownCoordinator_Drain(&shutdownCoordinator, epollFd);
     ClosePeripheralsAndHandlers();
     Log_Debug("Application exiting\n");
     return 0;
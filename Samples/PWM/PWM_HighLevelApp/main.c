@@ -34,20 +34,31 @@
 
 // This sample uses a single-thread event loop pattern, based on epoll and timerfd
 #include "epoll_timerfd_utilities.h"
+#include "pwm_batch.h"
+#include "pwm_waveform.h"
 
 // File descriptors - initialized to invalid value
 static int pwmFd = -1;
-static int stepTimerFd = -1;
 static int epollFd = -1;
 
 // Each time the step timer fires (every stepIntervalNs), we increase the current duty cycle
-// (dutyCycleNs) by the step increment (stepIncrementNs), until the full duty cycle
-// (fullCycleNs) is reached, at which point the current duty cycle is reset to 0.
+// by the step increment (stepIncrementNs), until the full duty cycle (fullCycleNs) is
+// reached, at which point the current duty cycle is reset to 0. The duty cycles are
+// precomputed into ledWaveformNs, which the waveform player steps through.
 // Supported PWM periods and duty cycles will vary depending on the hardware used;
 // consult your specific device’s datasheet for details.
-static const unsigned int fullCycleNs = 20000;
-static const unsigned int stepIncrementNs = 1000;
-static unsigned int dutyCycleNs = 0;
+#define FULL_CYCLE_NS 20000
+#define STEP_INCREMENT_NS 1000
+static const unsigned int fullCycleNs = FULL_CYCLE_NS;
+static unsigned int ledWaveformNs[FULL_CYCLE_NS / STEP_INCREMENT_NS + 1];
+
+// All channels on the controller are updated through one batch, so a step which changes
+// several channels is applied with one commit, and channels which did not change are skipped.
+static PwmBatch pwmBatch;
+static PwmWaveformPlayer waveformPlayer;
+static PwmWaveformTrack ledTrack = {.channel = SAMPLE_LED_PWM_CHANNEL,
+                                    .dutyCyclesNs = ledWaveformNs,
+                                    .length = sizeof(ledWaveformNs) / sizeof(ledWaveformNs[0])};
 
 // The polarity is inverted because LEDs are driven low
 static PwmState ledPwmState = {.period_nsec = fullCycleNs,
@@ -76,50 +87,24 @@ static void TerminationHandler(int signalNumber)
 /// <returns>0 on success, or -1 on failure</returns>
 static int TurnAllChannelsOff(void)
 {
-
-    for (unsigned int i = MT3620_PWM_CHANNEL0; i <= MT3620_PWM_CHANNEL3; ++i) {
-        int result = PWM_Apply(pwmFd, i, &ledPwmState);
-        if (result != 0) {
-            Log_Debug("PWM_Apply failed: result = %d, errno value: %s (%d)\n", result,
-                      strerror(errno), errno);
-            terminationRequired = true;
-            return result;
-        }
+    PwmBatch_StageAll(&pwmBatch, &ledPwmState);
+    int result = PwmBatch_Commit(&pwmBatch);
+    if (result != 0) {
+        Log_Debug("ERROR: Could not turn all channels off: %s (%d)\n", strerror(errno), errno);
+        terminationRequired = true;
     }
 
-    return 0;
+    return result;
 }
 
 /// <summary>
-///     Handle LED timer event: change LED brightness.
+///     Handle a failure to step the LED waveform.
 /// </summary>
-static void StepTimerEventHandler(EventData *eventData)
+static void WaveformErrorHandler(PwmWaveformPlayer *player)
 {
-    if (ConsumeTimerFdEvent(stepTimerFd) != 0) {
-        terminationRequired = true;
-        return;
-    }
-
-    // The step interval has elapsed, so increment the duty cycle.
-    if (dutyCycleNs < fullCycleNs) {
-        dutyCycleNs += stepIncrementNs;
-    } else {
-        dutyCycleNs = 0;
-    }
-
-    ledPwmState.dutyCycle_nsec = dutyCycleNs;
-
-    int result = PWM_Apply(pwmFd, SAMPLE_LED_PWM_CHANNEL, &ledPwmState);
-    if (result != 0) {
-        Log_Debug("PWM_Apply failed: result = %d, errno: %s (%d)\n", result, strerror(errno),
-                  errno);
-        terminationRequired = true;
-    }
+    terminationRequired = true;
 }
 
-// Event handler data structures. Only the event handler field needs to be populated.
-static EventData stepTimerEventData = {.eventHandler = &StepTimerEventHandler};
-
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
 /// </summary>
@@ -136,12 +121,6 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    stepTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &stepIntervalNs, &stepTimerEventData, EPOLLIN);
-    if (stepTimerFd < 0) {
-        return -1;
-    }
-
     pwmFd = PWM_Open(SAMPLE_LED_PWM_CONTROLLER);
     if (pwmFd == -1) {
         Log_Debug(
@@ -151,10 +130,18 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
+    PwmBatch_Init(&pwmBatch, pwmFd, MT3620_PWM_CHANNEL0,
+                  MT3620_PWM_CHANNEL3 - MT3620_PWM_CHANNEL0 + 1);
     if (TurnAllChannelsOff()) {
         return -1;
     }
 
+    PwmWaveform_FillRamp(ledWaveformNs, ledTrack.length, 0, fullCycleNs);
+    if (PwmWaveformPlayer_Start(&waveformPlayer, epollFd, &pwmBatch, &ledTrack, 1,
+                                &stepIntervalNs, WaveformErrorHandler) != 0) {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -163,12 +150,20 @@ static int InitPeripheralsAndHandlers(void)
 /// </summary>
 static void ClosePeripheralsAndHandlers(void)
 {
+    PwmWaveformPlayer_Stop(&waveformPlayer);
+
     // Leave the LED off
-    TurnAllChannelsOff();
+    if (pwmFd >= 0) {
+        TurnAllChannelsOff();
+
+        PwmBatchStats stats;
+        PwmBatch_GetStats(&pwmBatch, &stats);
+        Log_Debug("PWM batch: %u commits, %u PWM_Apply calls, %u unchanged channels skipped.\n",
+                  stats.commits, stats.applyCalls, stats.skippedChannels);
+    }
 
     Log_Debug("Closing file descriptors.\n");
     CloseFdAndPrintError(pwmFd, "PwmFd");
-    CloseFdAndPrintError(stepTimerFd, "stepTimerFd");
     CloseFdAndPrintError(epollFd, "epollFd");
 }
 
@@ -0,0 +1,131 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "pwm_batch.h"
+
+static bool GetChannelIndex(const PwmBatch *batch, PwmChannelId channel, unsigned int *index)
+{
+    if (channel < batch->firstChannel || channel - batch->firstChannel >= batch->channelCount) {
+        errno = EINVAL;
+        return false;
+    }
+
+    *index = channel - batch->firstChannel;
+    return true;
+}
+
+static bool IsSameState(const PwmState *a, const PwmState *b)
+{
+    return a->period_nsec == b->period_nsec && a->dutyCycle_nsec == b->dutyCycle_nsec &&
+           a->polarity == b->polarity && a->enabled == b->enabled;
+}
+
+int PwmBatch_Init(PwmBatch *batch, int pwmFd, PwmChannelId firstChannel,
+                  unsigned int channelCount)
+{
+    if (channelCount == 0 || channelCount > PWM_BATCH_MAX_CHANNELS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(batch, 0, sizeof(*batch));
+    batch->pwmFd = pwmFd;
+    batch->firstChannel = firstChannel;
+    batch->channelCount = channelCount;
+    return 0;
+}
+
+int PwmBatch_Stage(PwmBatch *batch, PwmChannelId channel, const PwmState *state)
+{
+    unsigned int index;
+    if (!GetChannelIndex(batch, channel, &index)) {
+        return -1;
+    }
+
+    batch->staged[index] = *state;
+    batch->stagedMask |= 1U << index;
+    return 0;
+}
+
+int PwmBatch_StageDutyCycle(PwmBatch *batch, PwmChannelId channel, unsigned int dutyCycleNs)
+{
+    unsigned int index;
+    if (!GetChannelIndex(batch, channel, &index)) {
+        return -1;
+    }
+
+    uint32_t mask = 1U << index;
+    if ((batch->stagedMask & mask) == 0) {
+        // Start from the applied state, which staged[index] still holds after a commit.
+        if ((batch->appliedMask & mask) == 0) {
+            errno = ENODATA;
+            return -1;
+        }
+        batch->staged[index] = batch->applied[index];
+    }
+
+    batch->staged[index].dutyCycle_nsec = dutyCycleNs;
+    batch->stagedMask |= mask;
+    return 0;
+}
+
+void PwmBatch_StageAll(PwmBatch *batch, const PwmState *state)
+{
+    for (unsigned int index = 0; index < batch->channelCount; ++index) {
+        batch->staged[index] = *state;
+    }
+    batch->stagedMask = (1U << batch->channelCount) - 1;
+}
+
+int PwmBatch_Commit(PwmBatch *batch)
+{
+    int result = 0;
+    int firstError = 0;
+    ++batch->stats.commits;
+
+    for (unsigned int index = 0; index < batch->channelCount; ++index) {
+        uint32_t mask = 1U << index;
+        if ((batch->stagedMask & mask) == 0) {
+            continue;
+        }
+
+        if ((batch->appliedMask & mask) != 0 &&
+            IsSameState(&batch->staged[index], &batch->applied[index])) {
+            ++batch->stats.skippedChannels;
+            batch->stagedMask &= ~mask;
+            continue;
+        }
+
+        ++batch->stats.applyCalls;
+        if (PWM_Apply(batch->pwmFd, batch->firstChannel + index, &batch->staged[index]) != 0) {
+            if (result == 0) {
+                firstError = errno;
+                Log_Debug("ERROR: PWM_Apply failed for channel %u: %s (%d).\n",
+                          batch->firstChannel + index, strerror(firstError), firstError);
+            }
+            // The channel's state is now unknown, so it must be applied again.
+            batch->appliedMask &= ~mask;
+            result = -1;
+            continue;
+        }
+
+        batch->applied[index] = batch->staged[index];
+        batch->appliedMask |= mask;
+        batch->stagedMask &= ~mask;
+    }
+
+    if (result != 0) {
+        errno = firstError;
+    }
+    return result;
+}
+
+void PwmBatch_GetStats(const PwmBatch *batch, PwmBatchStats *stats)
+{
+    *stats = batch->stats;
+}
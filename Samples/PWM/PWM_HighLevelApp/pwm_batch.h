@@ -0,0 +1,112 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <applibs/pwm.h>
+
+/// <summary>Number of channels on each MT3620 PWM controller.</summary>
+#define PWM_BATCH_MAX_CHANNELS 4
+
+/// <summary>
+///     Counters which show how much work <see cref="PwmBatch_Commit" /> saved.
+/// </summary>
+typedef struct {
+    /// <summary>Number of calls to <see cref="PwmBatch_Commit" />.</summary>
+    uint32_t commits;
+    /// <summary>Number of calls to PWM_Apply.</summary>
+    uint32_t applyCalls;
+    /// <summary>Number of staged channels which were not applied, because their state had not
+    /// changed since it was last applied.</summary>
+    uint32_t skippedChannels;
+} PwmBatchStats;
+
+/// <summary>
+/// <para>Stages new states for the channels of one PWM controller, and applies them together
+/// with <see cref="PwmBatch_Commit" />.</para>
+/// <para>The PWM API applies one channel per call. The batch only calls PWM_Apply for the
+/// channels whose staged state differs from the state which was last applied, so an animation
+/// which changes a few channels at a high step rate does not make a system call for every
+/// channel on every step.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="PwmBatch_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The controller, which was opened with PWM_Open.</summary>
+    int pwmFd;
+    /// <summary>Channel which corresponds to index 0 of the arrays.</summary>
+    PwmChannelId firstChannel;
+    /// <summary>Number of channels which can be staged.</summary>
+    unsigned int channelCount;
+    /// <summary>State which was last applied to each channel.</summary>
+    PwmState applied[PWM_BATCH_MAX_CHANNELS];
+    /// <summary>State which will be applied to each channel by the next commit.</summary>
+    PwmState staged[PWM_BATCH_MAX_CHANNELS];
+    /// <summary>Bit n is set if applied[n] holds the channel's current state.</summary>
+    uint32_t appliedMask;
+    /// <summary>Bit n is set if staged[n] has been staged since the last commit.</summary>
+    uint32_t stagedMask;
+    /// <summary>The counters.</summary>
+    PwmBatchStats stats;
+} PwmBatch;
+
+/// <summary>
+///     Initializes a batch for a range of a controller's channels. No channels are staged, and
+///     the state of every channel is unknown, so the first commit applies every staged channel.
+/// </summary>
+/// <param name="batch">The batch to initialize.</param>
+/// <param name="pwmFd">The controller, which was opened with PWM_Open.</param>
+/// <param name="firstChannel">First channel in the range.</param>
+/// <param name="channelCount">Number of channels, up to
+/// <see cref="PWM_BATCH_MAX_CHANNELS" />.</param>
+/// <returns>0 on success, or -1 with errno set to EINVAL if channelCount is out of range.
+/// </returns>
+int PwmBatch_Init(PwmBatch *batch, int pwmFd, PwmChannelId firstChannel,
+                  unsigned int channelCount);
+
+/// <summary>
+///     Stages a new state for a channel. It is applied by the next commit.
+/// </summary>
+/// <param name="batch">The batch.</param>
+/// <param name="channel">The channel.</param>
+/// <param name="state">The new state. This is copied.</param>
+/// <returns>0 on success, or -1 with errno set to EINVAL if the channel is out of range.
+/// </returns>
+int PwmBatch_Stage(PwmBatch *batch, PwmChannelId channel, const PwmState *state);
+
+/// <summary>
+///     Stages a new duty cycle for a channel, keeping the rest of its staged or applied state.
+///     The channel must have been staged with <see cref="PwmBatch_Stage" /> before.
+/// </summary>
+/// <param name="batch">The batch.</param>
+/// <param name="channel">The channel.</param>
+/// <param name="dutyCycleNs">The new duty cycle in nanoseconds.</param>
+/// <returns>0 on success, or -1 with errno set to EINVAL if the channel is out of range, or
+/// ENODATA if it has no state to modify.</returns>
+int PwmBatch_StageDutyCycle(PwmBatch *batch, PwmChannelId channel, unsigned int dutyCycleNs);
+
+/// <summary>
+///     Stages the same state for every channel in the batch, such as to turn them all off.
+/// </summary>
+/// <param name="batch">The batch.</param>
+/// <param name="state">The new state. This is copied.</param>
+void PwmBatch_StageAll(PwmBatch *batch, const PwmState *state);
+
+/// <summary>
+///     Applies every staged channel whose state has changed, with one call to PWM_Apply for
+///     each. If a call fails, the remaining channels are still applied, and the failed channel
+///     stays staged so the next commit retries it.
+/// </summary>
+/// <param name="batch">The batch.</param>
+/// <returns>0 on success, or -1 if any channel could not be applied, with errno set by the
+/// first failed call to PWM_Apply.</returns>
+int PwmBatch_Commit(PwmBatch *batch);
+
+/// <summary>
+///     Takes a snapshot of a batch's counters.
+/// </summary>
+/// <param name="batch">Batch to query.</param>
+/// <param name="stats">Receives the counters.</param>
+void PwmBatch_GetStats(const PwmBatch *batch, PwmBatchStats *stats);
@@ -0,0 +1,102 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "pwm_waveform.h"
+
+static void ReportError(PwmWaveformPlayer *player)
+{
+    if (player->errorHandler != NULL) {
+        player->errorHandler(player);
+    }
+}
+
+static void StepTimerEventHandler(EventData *eventData)
+{
+    PwmWaveformPlayer *player = (PwmWaveformPlayer *)eventData;
+
+    uint64_t steps;
+    if (ConsumeTimerFdExpiries(player->timerFd, &steps) != 0) {
+        ReportError(player);
+        return;
+    }
+
+    for (size_t i = 0; i < player->trackCount; ++i) {
+        PwmWaveformTrack *track = &player->tracks[i];
+        track->position = (size_t)((track->position + steps) % track->length);
+        PwmBatch_StageDutyCycle(player->batch, track->channel,
+                                track->dutyCyclesNs[track->position]);
+    }
+
+    // All of the tracks change on the same step, so they are applied together.
+    if (PwmBatch_Commit(player->batch) != 0) {
+        ReportError(player);
+    }
+}
+
+int PwmWaveformPlayer_Start(PwmWaveformPlayer *player, int epollFd, PwmBatch *batch,
+                            PwmWaveformTrack *tracks, size_t trackCount,
+                            const struct timespec *stepInterval,
+                            PwmWaveformErrorHandler errorHandler)
+{
+    memset(player, 0, sizeof(*player));
+    player->timerFd = -1;
+
+    for (size_t i = 0; i < trackCount; ++i) {
+        if (tracks[i].length == 0) {
+            Log_Debug("ERROR: PWM waveform track %zu is empty.\n", i);
+            errno = EINVAL;
+            return -1;
+        }
+        tracks[i].position = 0;
+    }
+
+    player->timerEventData.eventHandler = &StepTimerEventHandler;
+    player->batch = batch;
+    player->tracks = tracks;
+    player->trackCount = trackCount;
+    player->errorHandler = errorHandler;
+
+    player->timerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, stepInterval, &player->timerEventData, EPOLLIN);
+    if (player->timerFd < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void PwmWaveformPlayer_Stop(PwmWaveformPlayer *player)
+{
+    if (player->timerFd >= 0) {
+        CloseFdAndPrintError(player->timerFd, "PwmWaveformTimer");
+        player->timerFd = -1;
+    }
+}
+
+void PwmWaveform_FillRamp(unsigned int *table, size_t length, unsigned int fromNs,
+                          unsigned int toNs)
+{
+    long long span = (long long)toNs - fromNs;
+    for (size_t i = 0; i < length; ++i) {
+        table[i] = (unsigned int)(fromNs + span * (long long)i / (long long)(length - 1));
+    }
+}
+
+void PwmWaveform_FillTriangle(unsigned int *table, size_t length, unsigned int minNs,
+                              unsigned int maxNs)
+{
+    // Rise over the first half of the table, then fall over the second half. The last entry
+    // stops one step above minNs, because the table wraps back to minNs in the first entry.
+    size_t peak = length / 2;
+    PwmWaveform_FillRamp(table, peak + 1, minNs, maxNs);
+    long long span = (long long)maxNs - minNs;
+    for (size_t i = peak + 1; i < length; ++i) {
+        long long fall = span * (long long)(i - peak) / (long long)(length - peak);
+        table[i] = (unsigned int)(maxNs - fall);
+    }
+}
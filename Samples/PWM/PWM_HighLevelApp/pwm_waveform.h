@@ -0,0 +1,102 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stddef.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "pwm_batch.h"
+
+/// <summary>
+///     A precomputed table of duty cycles which is played on one channel, one entry per step.
+///     The table wraps around when the end is reached.
+/// </summary>
+typedef struct {
+    /// <summary>The channel to drive.</summary>
+    PwmChannelId channel;
+    /// <summary>Duty cycles in nanoseconds. This must stay in memory while it is played.</summary>
+    const unsigned int *dutyCyclesNs;
+    /// <summary>Number of entries in dutyCyclesNs.</summary>
+    size_t length;
+    /// <summary>Index of the entry which was last staged.</summary>
+    size_t position;
+} PwmWaveformTrack;
+
+struct PwmWaveformPlayer;
+
+/// <summary>
+///     Called when the player's timer cannot be read, or a step cannot be applied. The player
+///     keeps running; the handler decides whether the application should stop.
+/// </summary>
+typedef void (*PwmWaveformErrorHandler)(struct PwmWaveformPlayer *player);
+
+/// <summary>
+/// <para>Plays waveform tracks on the channels of a <see cref="PwmBatch" /> from one timer.
+/// On each step every track advances, and the new duty cycles are applied with a single
+/// commit. If steps were missed, the tracks skip ahead by the number of missed steps so the
+/// waveforms stay in time.</para>
+/// <para>The caller allocates this struct and starts it with
+/// <see cref="PwmWaveformPlayer_Start" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct PwmWaveformPlayer {
+    /// <summary>Event handler data for the step timer. This must be the first member.</summary>
+    EventData timerEventData;
+    /// <summary>The step timer, or -1 if the player is stopped.</summary>
+    int timerFd;
+    /// <summary>The batch which the tracks are staged into.</summary>
+    PwmBatch *batch;
+    /// <summary>The tracks, which are owned by the caller.</summary>
+    PwmWaveformTrack *tracks;
+    /// <summary>Number of tracks.</summary>
+    size_t trackCount;
+    /// <summary>Called on failure. May be NULL.</summary>
+    PwmWaveformErrorHandler errorHandler;
+} PwmWaveformPlayer;
+
+/// <summary>
+///     Starts playing tracks. Each track's channel must already have a state in the batch, e.g.
+///     from a previous commit, because only the duty cycle is changed. The first entry is
+///     staged after one step interval has elapsed.
+/// </summary>
+/// <param name="player">The player to start.</param>
+/// <param name="epollFd">Epoll file descriptor which the step timer is added to.</param>
+/// <param name="batch">The batch which the tracks are staged into.</param>
+/// <param name="tracks">The tracks. These must stay in memory until the player is stopped.
+/// </param>
+/// <param name="trackCount">Number of tracks.</param>
+/// <param name="stepInterval">Time between steps.</param>
+/// <param name="errorHandler">Called on failure. May be NULL.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int PwmWaveformPlayer_Start(PwmWaveformPlayer *player, int epollFd, PwmBatch *batch,
+                            PwmWaveformTrack *tracks, size_t trackCount,
+                            const struct timespec *stepInterval,
+                            PwmWaveformErrorHandler errorHandler);
+
+/// <summary>
+///     Stops the player and closes its timer. The channels keep their last applied state.
+///     This can be called on a stopped player.
+/// </summary>
+/// <param name="player">The player to stop.</param>
+void PwmWaveformPlayer_Stop(PwmWaveformPlayer *player);
+
+/// <summary>
+///     Fills a table with a linear ramp which starts at fromNs and ends at toNs.
+/// </summary>
+/// <param name="table">The table to fill.</param>
+/// <param name="length">Number of entries, which must be at least two.</param>
+/// <param name="fromNs">Duty cycle of the first entry.</param>
+/// <param name="toNs">Duty cycle of the last entry.</param>
+void PwmWaveform_FillRamp(unsigned int *table, size_t length, unsigned int fromNs,
+                          unsigned int toNs);
+
+/// <summary>
+///     Fills a table with one cycle of a triangle wave, which ramps from minNs up to maxNs and
+///     back down again. When played, the table wraps around without repeating minNs.
+/// </summary>
+/// <param name="table">The table to fill.</param>
+/// <param name="length">Number of entries, which must be at least two.</param>
+/// <param name="minNs">Lowest duty cycle, in the first entry.</param>
+/// <param name="maxNs">Highest duty cycle, in the middle entry.</param>
+void PwmWaveform_FillTriangle(unsigned int *table, size_t length, unsigned int minNs,
+                              unsigned int maxNs);
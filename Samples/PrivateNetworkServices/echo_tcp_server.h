@@ -5,13 +5,22 @@
 
 #include "netinet/in.h"
 
-#include "epoll_timerfd_utilities.h"
+#include "net_server.h"
+
+/// <summary>Number of clients which can be connected at once. While this many are connected,
+/// further connections wait in the listen backlog.</summary>
+#define ECHO_SERVER_MAX_CONNECTIONS NET_SERVER_MAX_CONNECTIONS
+
+#ifndef ECHO_SERVER_MAX_LINE_LENGTH
+/// <summary>Longest line which the server echoes, not including its terminator. Longer lines
+/// are discarded. Define this before building to change it.</summary>
+#define ECHO_SERVER_MAX_LINE_LENGTH 127
+#endif
 
 /// <summary>Reason why the TCP server stopped.</summary>
 typedef enum {
-    /// <summary>The echo server stopped because the client closed the connection.</summary>
-    EchoServer_StopReason_ClientClosed,
-    /// <summary>The echo server stopped because an error occurred.</summary>
+    /// <summary>The echo server stopped because an error occurred on the listening
+    /// socket.</summary>
     EchoServer_StopReason_Error
 } EchoServer_StopReason;
 
@@ -21,33 +30,11 @@ typedef enum {
 /// <see cref="EchoServer_ShutDown" />. The client should not directly modify member variables.
 /// </summary>
 typedef struct {
-    /// <summary>Epoll which is used to respond asynchronously to incoming connections.</summary>
-    int epollFd;
-    /// <summary>Socket which listens for incoming connections.</summary>
-    int listenFd;
-    /// <summary>Callback which is invoked when a new connection is received.</summary>
-    EventData listenEvent;
-    /// <summary>Accept socket. Only one client socket supported at a time.</summary>
-    int clientFd;
-    /// <summary>Callback which is invoked when server receives data from client.</summary>
-    EventData clientReadEvent;
-    /// <summary>Whether currently waiting for input from client.</summary>
-    bool epollInEnabled;
-    /// <summary>Whether currently writing response to client.</summary>
-    bool epollOutEnabled;
-    /// <summary>Number of characters received from client.</summary>
-    size_t inLineSize;
-    /// <summary>Data received from client.</summary>
-    char input[16];
-    /// <summary>Callback which is invoked when have written data to client.</summary>
-    EventData clientWriteEvent;
-    /// <summary>Payload to write to client.</summary>
-    uint8_t *txPayload;
-    /// <summary>Number of bytes to write to client.</summary>
-    size_t txPayloadSize;
-    /// <summary>Number of characters from paylod which have been written to client so
-    /// far.</summary>
-    size_t txBytesSent;
+    /// <summary>Serves the line protocol, and holds the connections.</summary>
+    NetServer server;
+    /// <summary>Input buffer of each connection, which holds the received lines. Responses are
+    /// sent from it and from constant strings, so they are not copied or allocated.</summary>
+    uint8_t input[ECHO_SERVER_MAX_CONNECTIONS][ECHO_SERVER_MAX_LINE_LENGTH + 1];
     /// <summary>
     /// <para>Callback to invoke when the server stops processing connections.</para>
     /// <para>When this callback is invoked, the owner should clean up the server with
@@ -59,16 +46,21 @@ typedef struct {
 
 /// <summary>
 /// <para>Open a non-blocking TCP listening socket on the supplied IP address and port.</para>
+/// <para>Up to ECHO_SERVER_MAX_CONNECTIONS clients are served at once, each echoing its own
+/// lines. A connection is closed when its client closes it, when an error occurs on it, or
+/// when the client is idle for too long; the server keeps serving the other clients.</para>
 /// <param name="epollFd">Descriptor to epoll created with CreateEpollFd.</param>
 /// <param name="ipAddr">IP address to which the listen socket is bound.</param>
 /// <param name="port">TCP port to which the socket is bound.</param>
 /// <param name="backlogSize">Listening socket queue length.</param>
+/// <param name="idleTimeout">How long a client can send nothing before its connection is
+/// closed.</param>
 /// <param name="shutdownCallback">Callback to invoke when server shuts down.</param>
 /// <returns>Server state which is used to manage the server's resources, NULL on failure.
 /// Should be disposed with <see cref="EchoServer_ShutDown" />.</returns>
 /// </summary>
 EchoServer_ServerState *EchoServer_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
-                                         int backlogSize,
+                                         int backlogSize, const struct timespec *idleTimeout,
                                          void (*shutdownCallback)(EchoServer_StopReason));
 
 /// <summary>
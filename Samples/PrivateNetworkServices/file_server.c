@@ -0,0 +1,302 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "app_log.h"
+#include "file_server.h"
+
+// Support functions.
+static bool HandleRequest(NetServerConnection *connection, uint8_t *message, size_t length,
+                          void *context);
+static void HandleConnection(NetServerConnection *connection, bool connected, void *context);
+static void HandleServerStopped(NetServer *server, void *context);
+static bool IsValidPath(const char *path);
+static int ParseRange(const char *range, off_t size, off_t *offset, size_t *length);
+static int OpenFile(FileServer_Connection *client, const char *path);
+static void CloseFile(FileServer_Connection *client);
+static bool SendError(NetServerConnection *connection, int code, const char *reason);
+
+FileServer_ServerState *FileServer_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
+                                         int backlogSize, const struct timespec *idleTimeout,
+                                         const char *directory,
+                                         void (*shutdownCallback)(FileServer_StopReason))
+{
+    FileServer_ServerState *serverState = malloc(sizeof(*serverState));
+    if (!serverState) {
+        abort();
+    }
+    memset(serverState, 0, sizeof(*serverState));
+    for (size_t i = 0; i < FILE_SERVER_MAX_CONNECTIONS; ++i) {
+        serverState->connections[i].fd = -1;
+    }
+    serverState->directory = directory;
+    serverState->shutdownCallback = shutdownCallback;
+
+    // Each line is a request, and its file is sent before the next line is read.
+    const NetServerConfig config = {.protocol = NetServerProtocol_Line,
+                                    .address = ipAddr,
+                                    .port = port,
+                                    .backlogSize = backlogSize,
+                                    .maxConnections = FILE_SERVER_MAX_CONNECTIONS,
+                                    .buffers = &serverState->input[0][0],
+                                    .bufferSize = sizeof(serverState->input[0]),
+                                    .sendBuffers = &serverState->copyBuffers[0][0],
+                                    .sendBufferSize = sizeof(serverState->copyBuffers[0]),
+                                    .idleTimeout = *idleTimeout,
+                                    .messageHandler = HandleRequest,
+                                    .connectionHandler = HandleConnection,
+                                    .stoppedHandler = HandleServerStopped,
+                                    .context = serverState};
+    if (NetServer_Start(&serverState->server, epollFd, &config) != 0) {
+        free(serverState);
+        return NULL;
+    }
+    return serverState;
+}
+
+void FileServer_ShutDown(FileServer_ServerState *serverState)
+{
+    if (!serverState) {
+        return;
+    }
+
+    // Closing the connections closes their files.
+    NetServer_Stop(&serverState->server);
+    free(serverState);
+}
+
+static bool HandleRequest(NetServerConnection *connection, uint8_t *message, size_t length,
+                          void *context)
+{
+    FileServer_ServerState *serverState = context;
+    FileServer_Connection *client = connection->userData;
+
+    // Copy the line, so that it can be split into null-terminated words.
+    char request[FILE_SERVER_MAX_REQUEST_LENGTH + 1];
+    memcpy(request, message, length);
+    request[length] = '\0';
+
+    char *savePtr = NULL;
+    const char *method = strtok_r(request, " ", &savePtr);
+    const char *path = strtok_r(NULL, " ", &savePtr);
+    const char *range = strtok_r(NULL, " ", &savePtr);
+    if (method == NULL || strcmp(method, "GET") != 0 || path == NULL ||
+        strtok_r(NULL, " ", &savePtr) != NULL) {
+        return SendError(connection, 400, "bad request");
+    }
+    if (!IsValidPath(path)) {
+        return SendError(connection, 400, "bad path");
+    }
+
+    char fullPath[FILE_SERVER_MAX_PATH_LENGTH + 1];
+    int pathLength = snprintf(fullPath, sizeof(fullPath), "%s/%s", serverState->directory, path);
+    if (pathLength < 0 || (size_t)pathLength >= sizeof(fullPath)) {
+        return SendError(connection, 414, "path too long");
+    }
+
+    APP_LOG_DEBUG("INFO: File server: GET \"%s\" %s (fd %d)\n", path, range ? range : "",
+                  connection->fd);
+
+    if (OpenFile(client, fullPath) != 0) {
+        return (errno == ENOENT) ? SendError(connection, 404, "not found")
+                                 : SendError(connection, 500, "cannot open file");
+    }
+
+    off_t offset;
+    size_t dataLength;
+    int status = ParseRange(range, client->size, &offset, &dataLength);
+    if (status == 400) {
+        return SendError(connection, 400, "bad range");
+    }
+    if (status == 416) {
+        return SendError(connection, 416, "range not satisfiable");
+    }
+
+    // The header is formatted into the connection's own buffer, which is not reused until the
+    // reply has been sent, and the data is sent straight from the file.
+    int headerLength = snprintf(client->header, sizeof(client->header), "OK %lld %zu %lld\r\n",
+                                (long long)offset, dataLength, (long long)client->size);
+    const struct iovec header = {.iov_base = client->header, .iov_len = (size_t)headerLength};
+
+    // Close the connection if the reply cannot be sent, since the client cannot tell where it
+    // stopped.
+    return NetServer_SendFile(connection, &header, 1, client->fd, offset, dataLength) == 0;
+}
+
+static void HandleConnection(NetServerConnection *connection, bool connected, void *context)
+{
+    FileServer_ServerState *serverState = context;
+    FileServer_Connection *client =
+        &serverState->connections[connection - serverState->server.connections];
+    if (connected) {
+        connection->userData = client;
+        APP_LOG_INFO("INFO: File server: Accepted client connection (fd %d), %zu connected.\n",
+                     connection->fd, serverState->server.connectionCount);
+    } else {
+        CloseFile(client);
+    }
+}
+
+static void HandleServerStopped(NetServer *server, void *context)
+{
+    FileServer_ServerState *serverState = context;
+    serverState->shutdownCallback(FileServer_StopReason_Error);
+}
+
+/// <summary>
+///     Checks that a requested path names a file in the served directory: it must be relative,
+///     and must not go up a directory.
+/// </summary>
+static bool IsValidPath(const char *path)
+{
+    if (path[0] == '/' || strstr(path, "..") != NULL || strstr(path, "//") != NULL) {
+        return false;
+    }
+    for (const char *c = path; *c != '\0'; ++c) {
+        if (!isalnum((unsigned char)*c) && strchr("._-/", *c) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+///     Parses a decimal number which starts at *text, and moves *text past it.
+/// </summary>
+/// <returns>true if there was a number which fits in an off_t; false otherwise</returns>
+static bool ParseOffset(const char **text, off_t *value)
+{
+    if (!isdigit((unsigned char)**text)) {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    long long number = strtoll(*text, &end, 10);
+    if (errno == ERANGE || (off_t)number != number) {
+        return false;
+    }
+    *text = end;
+    *value = (off_t)number;
+    return true;
+}
+
+/// <summary>
+///     Works out which bytes of a file a range asks for. The range is "first-last", "first-" or
+///     "-count", as in an HTTP Range header; no range asks for the whole file.
+/// </summary>
+/// <param name="range">The range, or NULL.</param>
+/// <param name="size">Size of the file.</param>
+/// <param name="offset">Receives the offset of the first byte.</param>
+/// <param name="length">Receives the number of bytes.</param>
+/// <returns>0 on success, 400 if the range cannot be parsed, or 416 if it is not in the
+/// file</returns>
+static int ParseRange(const char *range, off_t size, off_t *offset, size_t *length)
+{
+    if (range == NULL) {
+        *offset = 0;
+        *length = (size_t)size;
+        return 0;
+    }
+
+    off_t first = 0;
+    off_t last = size - 1;
+    const char *text = range;
+    if (*text == '-') {
+        // The last count bytes, or the whole file if it is shorter.
+        ++text;
+        off_t count;
+        if (!ParseOffset(&text, &count) || *text != '\0') {
+            return 400;
+        }
+        if (count == 0 || size == 0) {
+            return 416;
+        }
+        first = (count < size) ? size - count : 0;
+    } else {
+        if (!ParseOffset(&text, &first) || *text++ != '-') {
+            return 400;
+        }
+        if (*text != '\0') {
+            off_t requestedLast;
+            if (!ParseOffset(&text, &requestedLast) || *text != '\0' || requestedLast < first) {
+                return 400;
+            }
+            if (requestedLast < last) {
+                last = requestedLast;
+            }
+        }
+        if (first >= size) {
+            return 416;
+        }
+    }
+
+    *offset = first;
+    *length = (size_t)(last - first + 1);
+    return 0;
+}
+
+/// <summary>
+///     Opens a file in the image package for a connection, unless it already has that file
+///     open.
+/// </summary>
+/// <returns>0 on success, or -1 on failure, with errno set</returns>
+static int OpenFile(FileServer_Connection *client, const char *path)
+{
+    if (client->fd >= 0 && strcmp(client->path, path) == 0) {
+        return 0;
+    }
+
+    CloseFile(client);
+    int fd = Storage_OpenFileInImagePackage(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    client->fd = fd;
+    client->size = status.st_size;
+    strcpy(client->path, path);
+    return 0;
+}
+
+static void CloseFile(FileServer_Connection *client)
+{
+    if (client->fd >= 0) {
+        CloseFdAndPrintError(client->fd, "file");
+        client->fd = -1;
+    }
+}
+
+/// <summary>
+///     Sends an error line, such as "ERROR 404 not found".
+/// </summary>
+/// <returns>true if the line was sent, so the connection can stay open; false otherwise</returns>
+static bool SendError(NetServerConnection *connection, int code, const char *reason)
+{
+    FileServer_Connection *client = connection->userData;
+    APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_INFO, 5, 1000, "INFO: File server: Error %d: %s (fd %d)\n",
+                         code, reason, connection->fd);
+
+    int headerLength =
+        snprintf(client->header, sizeof(client->header), "ERROR %d %s\r\n", code, reason);
+    const struct iovec reply = {.iov_base = client->header, .iov_len = (size_t)headerLength};
+    return NetServer_Send(connection, &reply, 1) == 0;
+}
@@ -0,0 +1,117 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <sys/types.h>
+#include "netinet/in.h"
+
+#include "net_server.h"
+
+#ifndef FILE_SERVER_MAX_CONNECTIONS
+/// <summary>Number of clients which can download at once. While this many are connected,
+/// further connections wait in the listen backlog. Define this before building to change
+/// it.</summary>
+#define FILE_SERVER_MAX_CONNECTIONS 4
+#endif
+
+/// <summary>Longest request line, not including its terminator. Longer lines are
+/// discarded.</summary>
+#define FILE_SERVER_MAX_REQUEST_LENGTH 127
+
+/// <summary>Longest path of a file in the image package, including the directory from which
+/// the files are served, not including the null terminator.</summary>
+#define FILE_SERVER_MAX_PATH_LENGTH 95
+
+#ifndef FILE_SERVER_COPY_BUFFER_SIZE
+/// <summary>Size of the buffer of each connection through which a file is copied if it cannot
+/// be sent with sendfile. Define this before building to change it.</summary>
+#define FILE_SERVER_COPY_BUFFER_SIZE 2048
+#endif
+
+/// <summary>Size of the buffer of each connection which holds the header of a reply.</summary>
+#define FILE_SERVER_HEADER_SIZE 80
+
+/// <summary>Reason why the file server stopped.</summary>
+typedef enum {
+    /// <summary>The file server stopped because an error occurred on the listening
+    /// socket.</summary>
+    FileServer_StopReason_Error
+} FileServer_StopReason;
+
+/// <summary>
+///     The file which a connection has open, which is kept for the next request, so that a
+///     client which downloads a file in ranges does not open it again for each one.
+/// </summary>
+typedef struct {
+    /// <summary>The file, or -1 if none is open.</summary>
+    int fd;
+    /// <summary>Size of the file in bytes.</summary>
+    off_t size;
+    /// <summary>Path of the file in the image package.</summary>
+    char path[FILE_SERVER_MAX_PATH_LENGTH + 1];
+    /// <summary>Header of the reply which is being sent.</summary>
+    char header[FILE_SERVER_HEADER_SIZE];
+} FileServer_Connection;
+
+/// <summary>
+/// Bundles together state about an active file server.
+/// This should be allocated with <see cref="FileServer_Start" /> and freed with
+/// <see cref="FileServer_ShutDown" />. The client should not directly modify member variables.
+/// </summary>
+typedef struct {
+    /// <summary>Serves the line protocol, and holds the connections.</summary>
+    NetServer server;
+    /// <summary>Input buffer of each connection, which holds the received requests.</summary>
+    uint8_t input[FILE_SERVER_MAX_CONNECTIONS][FILE_SERVER_MAX_REQUEST_LENGTH + 1];
+    /// <summary>Send buffer of each connection, which is only used if sendfile fails.</summary>
+    uint8_t copyBuffers[FILE_SERVER_MAX_CONNECTIONS][FILE_SERVER_COPY_BUFFER_SIZE];
+    /// <summary>The open file and reply header of each connection, in the same order as the
+    /// server's connections.</summary>
+    FileServer_Connection connections[FILE_SERVER_MAX_CONNECTIONS];
+    /// <summary>Directory in the image package from which files are served.</summary>
+    const char *directory;
+    /// <summary>
+    /// <para>Callback to invoke when the server stops processing connections.</para>
+    /// <para>When this callback is invoked, the owner should clean up the server with
+    /// <see cref="FileServer_ShutDown" />.</para>
+    /// <param name="reason">Why the server stopped.</param>
+    /// </summary>
+    void (*shutdownCallback)(FileServer_StopReason reason);
+} FileServer_ServerState;
+
+/// <summary>
+/// <para>Open a non-blocking TCP listening socket on the supplied IP address and port, and serve
+/// the files in a directory of the image package to the clients, such as firmware or
+/// configuration for the devices on the private network.</para>
+/// <para>Each request is a line "GET path [range]", where the path is relative to the
+/// directory and the optional range is "first-last", "first-" or "-count" bytes, as in an HTTP
+/// Range header. The reply is the line "OK offset length size", with the offset and length of
+/// the data and the size of the file, followed by the data; or the line "ERROR code reason",
+/// with an HTTP status code.</para>
+/// <para>The files are sent with sendfile, or copied through a fixed buffer for each connection,
+/// so no memory is allocated per request.</para>
+/// <param name="epollFd">Descriptor to epoll created with CreateEpollFd.</param>
+/// <param name="ipAddr">IP address to which the listen socket is bound.</param>
+/// <param name="port">TCP port to which the socket is bound.</param>
+/// <param name="backlogSize">Listening socket queue length.</param>
+/// <param name="idleTimeout">How long a client can send nothing before its connection is
+/// closed.</param>
+/// <param name="directory">Directory in the image package from which files are served. This
+/// must remain valid until the server is shut down.</param>
+/// <param name="shutdownCallback">Callback to invoke when server shuts down.</param>
+/// <returns>Server state which is used to manage the server's resources, NULL on failure.
+/// Should be disposed with <see cref="FileServer_ShutDown" />.</returns>
+/// </summary>
+FileServer_ServerState *FileServer_Start(int epollFd, in_addr_t ipAddr, uint16_t port,
+                                         int backlogSize, const struct timespec *idleTimeout,
+                                         const char *directory,
+                                         void (*shutdownCallback)(FileServer_StopReason));
+
+/// <summary>
+/// <para>Closes any resources which were allocated by the supplied server. This includes
+/// closing listen and accepted sockets and open files, and freeing any heap memory that was
+/// allocated.</para>
+/// <param name="serverState">Server state allocated with <see cref="FileServer_Start" />.</param>
+/// </summary>
+void FileServer_ShutDown(FileServer_ServerState *serverState);
@@ -4,11 +4,13 @@
 // This sample C application shows how to set up services on a private Ethernet network. It
 // configures the network with a static IP address, starts the DHCP service allowing dynamically
 // assigning IP address and network configuration parameters, enables the SNTP service allowing
-// other devices to synchronize time via this device, and sets up a TCP server.
+// other devices to synchronize time via this device, and sets up a TCP echo server and a TCP
+// server which serves files from the image package.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - log (messages shown in Visual Studio's Device Output window during debugging)
 // - networking (sets up private Ethernet configuration)
+// - storage (opens the files in the image package which are served)
 
 #include <errno.h>
 #include <signal.h>
@@ -39,14 +41,18 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+#include "app_log.h"
 #include "echo_tcp_server.h"
+#include "file_server.h"
+#include "network_monitor.h"
+#include "service_launcher.h"
 
 // File descriptors - initialized to invalid value
 static int epollFd = -1;
-static int timerFd = -1;
 
 static bool isNetworkStackReady = false;
 EchoServer_ServerState *serverState = NULL;
+static FileServer_ServerState *fileServerState = NULL;
 
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
@@ -56,9 +62,41 @@ static struct in_addr localServerIpAddress;
 static struct in_addr subnetMask;
 static struct in_addr gatewayIpAddress;
 static const uint16_t LocalTcpServerPort = 11000;
+// The file server serves the files in this directory of the image package.
+static const uint16_t LocalFileServerPort = 11001;
+static const char FileServerDirectory[] = "files";
 static int serverBacklogSize = 3;
+// Connections whose clients send nothing for this long are closed, so that clients which went
+// away without closing their connections do not hold on to them.
+static const struct timespec serverIdleTimeout = {300, 0};
 static const char NetworkInterface[] = "eth0";
 
+// Detects when the network stack is ready. It checks quickly at first, so that the servers start
+// soon after, and less often while nothing changes.
+static NetworkMonitor networkMonitor;
+static const NetworkMonitorConfig networkMonitorConfig = {
+    .interfaceName = NetworkInterface,
+    .requiredStatus = 0,
+    .minInterval = {0, 100 * 1000 * 1000},
+    .waitingInterval = {2, 0},
+    .readyInterval = {30, 0}};
+
+// The services, in the order in which they are declared to the launcher. Every server needs the
+// static IP address, but the servers do not need one another, so they are started together.
+typedef enum {
+    Service_StaticIp,
+    Service_SntpServer,
+    Service_DhcpServer,
+    Service_TcpServer,
+    Service_FileServer,
+    Service_Count
+} Service;
+
+// Starts the services, and retries each one which fails without stopping the others.
+static ServiceLauncher serviceLauncher;
+static const int ServiceMinRetryDelaySeconds = 1;
+static const int ServiceMaxRetryDelaySeconds = 60;
+
 /// <summary>
 ///     Signal handler for termination requests. This handler must be async-signal-safe.
 /// </summary>
@@ -75,10 +113,6 @@ static void ServerStoppedHandler(EchoServer_StopReason reason)
 {
     const char *reasonText;
     switch (reason) {
-    case EchoServer_StopReason_ClientClosed:
-        reasonText = "client closed the connection.";
-        break;
-
     case EchoServer_StopReason_Error:
         reasonText = "an error occurred. See previous log output for more information.";
         break;
@@ -89,17 +123,34 @@ static void ServerStoppedHandler(EchoServer_StopReason reason)
     }
 
     Log_Debug("INFO: TCP server stopped: %s\n", reasonText);
-    terminationRequired = true;
+
+    // The server is shut down and started again after the retry delay. The other services keep
+    // running.
+    ServiceLauncher_ReportStopped(&serviceLauncher, Service_TcpServer);
 }
 
 /// <summary>
-///     Shut down TCP server and close epoll event handler.
+///     Called when the file server stops processing requests from clients.
+/// </summary>
+static void FileServerStoppedHandler(FileServer_StopReason reason)
+{
+    Log_Debug("INFO: File server stopped: an error occurred. See previous log output for more "
+              "information.\n");
+
+    // As for the TCP server, only this service is started again.
+    ServiceLauncher_ReportStopped(&serviceLauncher, Service_FileServer);
+}
+
+/// <summary>
+///     Shut down TCP servers and close epoll event handler.
 /// </summary>
 static void ShutDownServerAndCleanup(void)
 {
     EchoServer_ShutDown(serverState);
+    FileServer_ShutDown(fileServerState);
+    ServiceLauncher_Close(&serviceLauncher);
+    NetworkMonitor_Close(&networkMonitor);
     CloseFdAndPrintError(epollFd, "Epoll");
-    CloseFdAndPrintError(timerFd, "Timer");
 }
 
 /// <summary>
@@ -286,8 +337,58 @@ static int ConfigureAndStartDhcpSever(const char *interfaceName)
     return 0;
 }
 
+// Functions which start each service, for the launcher.
+static int StartStaticIp(void *context)
+{
+    return ConfigureNetworkInterfaceWithStaticIp(NetworkInterface);
+}
+
+static int StartSntp(void *context)
+{
+    return StartSntpServer(NetworkInterface);
+}
+
+static int StartDhcp(void *context)
+{
+    return ConfigureAndStartDhcpSever(NetworkInterface);
+}
+
+static int StartTcpServer(void *context)
+{
+    // Clean up a server which has stopped, before it is started again.
+    EchoServer_ShutDown(serverState);
+    serverState = EchoServer_Start(epollFd, localServerIpAddress.s_addr, LocalTcpServerPort,
+                                   serverBacklogSize, &serverIdleTimeout, ServerStoppedHandler);
+    return (serverState == NULL) ? -1 : 0;
+}
+
+static int StartFileServer(void *context)
+{
+    FileServer_ShutDown(fileServerState);
+    fileServerState =
+        FileServer_Start(epollFd, localServerIpAddress.s_addr, LocalFileServerPort,
+                         serverBacklogSize, &serverIdleTimeout, FileServerDirectory,
+                         FileServerStoppedHandler);
+    return (fileServerState == NULL) ? -1 : 0;
+}
+
+static const ServiceDefinition services[Service_Count] = {
+    [Service_StaticIp] = {.name = "static IP address", .start = StartStaticIp},
+    [Service_SntpServer] = {.name = "SNTP server",
+                            .dependencies = SERVICE_LAUNCHER_DEPENDS_ON(Service_StaticIp),
+                            .start = StartSntp},
+    [Service_DhcpServer] = {.name = "DHCP server",
+                            .dependencies = SERVICE_LAUNCHER_DEPENDS_ON(Service_StaticIp),
+                            .start = StartDhcp},
+    [Service_TcpServer] = {.name = "TCP server",
+                           .dependencies = SERVICE_LAUNCHER_DEPENDS_ON(Service_StaticIp),
+                           .start = StartTcpServer},
+    [Service_FileServer] = {.name = "file server",
+                            .dependencies = SERVICE_LAUNCHER_DEPENDS_ON(Service_StaticIp),
+                            .start = StartFileServer}};
+
 /// <summary>
-///     Configure network interface, start SNTP server and TCP server.
+///     Check the network stack and, once it is ready, launch the services.
 /// </summary>
 /// <returns>0 on success, or -1 on failure</returns>
 static int CheckNetworkStackStatusAndLaunchServers(void)
@@ -297,60 +398,29 @@ static int CheckNetworkStackStatusAndLaunchServers(void)
         return -1;
     }
 
-    // The network stack is ready, so unregister the timer event handler and launch servers.
+    // The network stack is ready, so launch the services. A service which fails is retried
+    // later, while the others run.
     if (isNetworkStackReady) {
-        UnregisterEventHandlerFromEpoll(epollFd, timerFd);
-
-        // Use static IP addressing to configure network interface.
-        int result = ConfigureNetworkInterfaceWithStaticIp(NetworkInterface);
-        if (result != 0) {
-            return -1;
-        }
-
-        // Start the SNTP server.
-        result = StartSntpServer(NetworkInterface);
-        if (result != 0) {
-            return -1;
-        }
-
-        // Configure and start DHCP server.
-        result = ConfigureAndStartDhcpSever(NetworkInterface);
-        if (result != 0) {
-            return -1;
-        }
-
-        // Start the TCP server.
-        serverState = EchoServer_Start(epollFd, localServerIpAddress.s_addr, LocalTcpServerPort,
-                                       serverBacklogSize, ServerStoppedHandler);
-        if (serverState == NULL) {
-            return -1;
-        }
+        ServiceLauncher_Launch(&serviceLauncher);
     }
 
     return 0;
 }
 
 /// <summary>
-///     The timer event handler.
+///     Called when the state of the network interface changes.
 /// </summary>
-static void TimerEventHandler(EventData *eventData)
+static void NetworkStateHandler(NetworkMonitor *monitor, uint32_t events,
+                                const NetworkMonitorState *state, void *context)
 {
-    if (ConsumeTimerFdEvent(timerFd) != 0) {
-        terminationRequired = true;
-        return;
-    }
-
-    // Check whether the network stack is ready.
-    if (!isNetworkStackReady) {
+    // Launch the servers once, when the network stack first becomes ready.
+    if ((events & NetworkMonitorEvent_Up) && !isNetworkStackReady) {
         if (CheckNetworkStackStatusAndLaunchServers() != 0) {
             terminationRequired = true;
         }
     }
 }
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData timerEventData = {.eventHandler = &TimerEventHandler};
-
 /// <summary>
 ///     Set up SIGTERM termination handler, set up epoll event handling, configure network
 ///     interface, start SNTP server and TCP server.
@@ -368,10 +438,14 @@ static int InitializeAndLaunchServers(void)
         return -1;
     }
 
-    // Check network interface status at the specified period until it is ready.
-    struct timespec checkInterval = {1, 0};
-    timerFd = CreateTimerFdAndAddToEpoll(epollFd, &checkInterval, &timerEventData, EPOLLIN);
-    if (timerFd < 0) {
+    if (ServiceLauncher_Init(&serviceLauncher, epollFd, services, Service_Count,
+                             ServiceMinRetryDelaySeconds, ServiceMaxRetryDelaySeconds) != 0) {
+        return -1;
+    }
+
+    // Launch the servers as soon as the network stack is ready.
+    if (NetworkMonitor_Init(&networkMonitor, epollFd, &networkMonitorConfig) != 0 ||
+        NetworkMonitor_AddHandler(&networkMonitor, &NetworkStateHandler, NULL) != 0) {
         return -1;
     }
 
@@ -384,18 +458,26 @@ static int InitializeAndLaunchServers(void)
 int main(int argc, char *argv[])
 {
     Log_Debug("INFO: Private Ethernet TCP server application starting.\n");
+
+    // The servers log each message and connection, so those logs are copied to a ring by the
+    // handlers, and only formatted once the handlers for a wait have run.
+    AppLog_SetMode(AppLogMode_Deferred);
+
     if (InitializeAndLaunchServers() != 0) {
         terminationRequired = true;
     }
 
     // Use epoll to wait for events and trigger handlers, until an error or SIGTERM happens
     while (!terminationRequired) {
-        if (WaitForEventAndCallHandler(epollFd) != 0) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
             terminationRequired = true;
         }
+        AppLog_Drain(SIZE_MAX);
     }
 
     ShutDownServerAndCleanup();
+    AppLog_SetMode(AppLogMode_Immediate);
     Log_Debug("INFO: Application exiting.\n");
     return 0;
 }
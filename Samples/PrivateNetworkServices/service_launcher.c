@@ -0,0 +1,206 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "service_launcher.h"
+
+static bool IsDue(const struct timespec *time, const struct timespec *now)
+{
+    return (now->tv_sec != time->tv_sec) ? (now->tv_sec > time->tv_sec)
+                                         : (now->tv_nsec >= time->tv_nsec);
+}
+
+static double ElapsedSeconds(const struct timespec *from, const struct timespec *to)
+{
+    return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/// <summary>
+///     Checks whether every service which a service depends on has started.
+/// </summary>
+static bool DependenciesStarted(const ServiceLauncher *launcher, size_t index)
+{
+    uint32_t dependencies = launcher->services[index].dependencies;
+    for (size_t i = 0; i < launcher->serviceCount; i++) {
+        if ((dependencies & SERVICE_LAUNCHER_DEPENDS_ON(i)) && !launcher->states[i].isStarted) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+///     Schedules the next attempt to start a service which has failed or stopped.
+/// </summary>
+static void ScheduleRetry(ServiceLauncher *launcher, size_t index, const struct timespec *now)
+{
+    ServiceLauncherState *state = &launcher->states[index];
+    int delaySeconds = launcher->minRetryDelaySeconds;
+    for (uint32_t i = 1; i < state->failures && delaySeconds < launcher->maxRetryDelaySeconds;
+         i++) {
+        delaySeconds *= 2;
+    }
+    if (delaySeconds > launcher->maxRetryDelaySeconds) {
+        delaySeconds = launcher->maxRetryDelaySeconds;
+    }
+
+    state->nextAttempt = *now;
+    state->nextAttempt.tv_sec += delaySeconds;
+    Log_Debug("INFO: Will start %s again in %d seconds.\n", launcher->services[index].name,
+              delaySeconds);
+}
+
+/// <summary>
+///     Arms the retry timer for the earliest attempt which is due, or disarms it if no service
+///     is waiting for one.
+/// </summary>
+static void ArmRetryTimer(ServiceLauncher *launcher, const struct timespec *now)
+{
+    const struct timespec *earliest = NULL;
+    for (size_t i = 0; i < launcher->serviceCount; i++) {
+        const ServiceLauncherState *state = &launcher->states[i];
+        if (!state->isStarted && state->failures > 0 &&
+            (earliest == NULL || IsDue(&state->nextAttempt, earliest))) {
+            earliest = &state->nextAttempt;
+        }
+    }
+
+    struct timespec delay = {0, 0};
+    if (earliest != NULL) {
+        delay.tv_sec = earliest->tv_sec - now->tv_sec;
+        delay.tv_nsec = earliest->tv_nsec - now->tv_nsec;
+        if (delay.tv_nsec < 0) {
+            delay.tv_nsec += 1000 * 1000 * 1000;
+            --delay.tv_sec;
+        }
+        // A zero delay would disarm the timer.
+        if (delay.tv_sec < 0 || (delay.tv_sec == 0 && delay.tv_nsec == 0)) {
+            delay.tv_sec = 0;
+            delay.tv_nsec = 1;
+        }
+    }
+    SetTimerFdToSingleExpiry(launcher->timerFd, &delay);
+}
+
+/// <summary>
+///     Starts each service whose dependencies have started and whose retry is due, until no
+///     more can be started.
+/// </summary>
+static void StartReadyServices(ServiceLauncher *launcher)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // A service which starts may allow the services which depend on it to start, so the
+    // services are examined again until none starts.
+    bool anyStarted = true;
+    while (anyStarted) {
+        anyStarted = false;
+        for (size_t i = 0; i < launcher->serviceCount; i++) {
+            ServiceLauncherState *state = &launcher->states[i];
+            if (state->isStarted || !IsDue(&state->nextAttempt, &now) ||
+                !DependenciesStarted(launcher, i)) {
+                continue;
+            }
+
+            const ServiceDefinition *service = &launcher->services[i];
+            if (service->start(service->context) != 0) {
+                ++state->failures;
+                Log_Debug("ERROR: Could not start %s (attempt %u).\n", service->name,
+                          state->failures);
+                ScheduleRetry(launcher, i, &now);
+                continue;
+            }
+
+            state->isStarted = true;
+            state->failures = 0;
+            anyStarted = true;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            Log_Debug("INFO: Started %s, %.3f seconds after launch.\n", service->name,
+                      ElapsedSeconds(&launcher->launchTime, &now));
+        }
+    }
+
+    ArmRetryTimer(launcher, &now);
+}
+
+static void ServiceLauncherTimerEventHandler(EventData *eventData)
+{
+    ServiceLauncher *launcher = (ServiceLauncher *)eventData;
+    if (ConsumeTimerFdEvent(launcher->timerFd) != 0) {
+        return;
+    }
+    StartReadyServices(launcher);
+}
+
+int ServiceLauncher_Init(ServiceLauncher *launcher, int epollFd,
+                         const ServiceDefinition *services, size_t serviceCount,
+                         int minRetryDelaySeconds, int maxRetryDelaySeconds)
+{
+    memset(launcher, 0, sizeof(*launcher));
+    launcher->timerFd = -1;
+    launcher->services = services;
+    launcher->serviceCount = serviceCount;
+    launcher->minRetryDelaySeconds = minRetryDelaySeconds;
+    launcher->maxRetryDelaySeconds = maxRetryDelaySeconds;
+    launcher->timerEventData.eventHandler = &ServiceLauncherTimerEventHandler;
+
+    if (serviceCount > SERVICE_LAUNCHER_MAX_SERVICES) {
+        Log_Debug("ERROR: Too many services to launch.\n");
+        return -1;
+    }
+
+    static const struct timespec disarmed = {0, 0};
+    launcher->timerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &launcher->timerEventData, EPOLLIN);
+    return (launcher->timerFd < 0) ? -1 : 0;
+}
+
+void ServiceLauncher_Launch(ServiceLauncher *launcher)
+{
+    if (launcher->isLaunched) {
+        return;
+    }
+    launcher->isLaunched = true;
+    clock_gettime(CLOCK_MONOTONIC, &launcher->launchTime);
+    StartReadyServices(launcher);
+}
+
+void ServiceLauncher_ReportStopped(ServiceLauncher *launcher, size_t index)
+{
+    ServiceLauncherState *state = &launcher->states[index];
+    if (!state->isStarted) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    state->isStarted = false;
+    state->failures = 1;
+    Log_Debug("INFO: %s has stopped.\n", launcher->services[index].name);
+    ScheduleRetry(launcher, index, &now);
+    ArmRetryTimer(launcher, &now);
+}
+
+bool ServiceLauncher_AllStarted(const ServiceLauncher *launcher)
+{
+    for (size_t i = 0; i < launcher->serviceCount; i++) {
+        if (!launcher->states[i].isStarted) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ServiceLauncher_Close(ServiceLauncher *launcher)
+{
+    // A zero-initialized launcher has timerFd 0, which it does not own.
+    if (launcher->timerEventData.eventHandler != NULL) {
+        CloseFdAndPrintError(launcher->timerFd, "ServiceLauncherTimer");
+    }
+
+    launcher->timerFd = -1;
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Number of services which one launcher can start.</summary>
+#define SERVICE_LAUNCHER_MAX_SERVICES 8
+
+/// <summary>Flag for the dependencies of a service, on the service at the given index.</summary>
+#define SERVICE_LAUNCHER_DEPENDS_ON(index) (1u << (index))
+
+/// <summary>
+///     Function which starts a service. It must not block, and may be called again after it
+///     fails.
+/// </summary>
+/// <param name="context">The context of the service.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+typedef int (*ServiceStartFunction)(void *context);
+
+/// <summary>
+///     A service, and the services which must be started before it.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the service, which is logged.</summary>
+    const char *name;
+    /// <summary>SERVICE_LAUNCHER_DEPENDS_ON flags for the indexes of the services which this
+    /// service needs.</summary>
+    uint32_t dependencies;
+    ServiceStartFunction start;
+    void *context;
+} ServiceDefinition;
+
+/// <summary>
+///     Progress of one service.
+/// </summary>
+typedef struct {
+    bool isStarted;
+    /// <summary>Number of attempts in a row which have failed.</summary>
+    uint32_t failures;
+    /// <summary>Time after which the next attempt may be made.</summary>
+    struct timespec nextAttempt;
+} ServiceLauncherState;
+
+/// <summary>
+/// <para>Starts a set of services in the order of their dependencies, rather than one after the
+/// other. Each service is started as soon as the services which it needs have started, so a
+/// service which fails, or is waiting for its retry, does not hold back the services which do
+/// not need it.</para>
+/// <para>A service which fails to start is tried again on a timer, after a delay which doubles
+/// with each failure in a row, from the minimum to the maximum. The other services keep
+/// running.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="ServiceLauncher_Init" /> and disposes of it with
+/// <see cref="ServiceLauncher_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Event data for the retry timer. This is the first member, so the event handler
+    /// can find the launcher.</summary>
+    EventData timerEventData;
+    int timerFd;
+    const ServiceDefinition *services;
+    size_t serviceCount;
+    ServiceLauncherState states[SERVICE_LAUNCHER_MAX_SERVICES];
+    int minRetryDelaySeconds;
+    int maxRetryDelaySeconds;
+    /// <summary>Whether <see cref="ServiceLauncher_Launch" /> has been called.</summary>
+    bool isLaunched;
+    /// <summary>When the services were launched, for the time which they took to start.</summary>
+    struct timespec launchTime;
+} ServiceLauncher;
+
+/// <summary>
+///     Creates the retry timer and adds it to an epoll instance. No service is started until
+///     <see cref="ServiceLauncher_Launch" /> is called.
+/// </summary>
+/// <param name="launcher">Launcher to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="services">The services, which may only depend on one another. This must remain
+/// valid until the launcher is closed.</param>
+/// <param name="serviceCount">Number of services, up to SERVICE_LAUNCHER_MAX_SERVICES.</param>
+/// <param name="minRetryDelaySeconds">Delay after the first failure of a service.</param>
+/// <param name="maxRetryDelaySeconds">Longest delay.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int ServiceLauncher_Init(ServiceLauncher *launcher, int epollFd,
+                         const ServiceDefinition *services, size_t serviceCount,
+                         int minRetryDelaySeconds, int maxRetryDelaySeconds);
+
+/// <summary>
+///     Starts every service whose dependencies have started, which is all of them unless some
+///     fail. The failed services, and those which depend on them, are started later.
+/// </summary>
+/// <param name="launcher">The launcher.</param>
+void ServiceLauncher_Launch(ServiceLauncher *launcher);
+
+/// <summary>
+///     Records that a service which had started has stopped, so it is started again after the
+///     retry delay. The services which depend on it are not affected.
+/// </summary>
+/// <param name="launcher">The launcher.</param>
+/// <param name="index">Index of the service.</param>
+void ServiceLauncher_ReportStopped(ServiceLauncher *launcher, size_t index);
+
+/// <summary>
+///     Checks whether every service has started.
+/// </summary>
+/// <param name="launcher">The launcher.</param>
+bool ServiceLauncher_AllStarted(const ServiceLauncher *launcher);
+
+/// <summary>
+///     Closes the retry timer. It is safe to call this function on a launcher which has been
+///     zero-initialized, or whose initialization failed.
+/// </summary>
+/// <param name="launcher">The launcher.</param>
+void ServiceLauncher_Close(ServiceLauncher *launcher);
@@ -19,9 +19,13 @@
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include "epoll_timerfd_utilities.h"
+#include "startup_sequence.h"
+#include "lsm6ds3_convert.h"
+#include "lsm6ds3_spi.h"
 
 #include <applibs/log.h>
 #include <applibs/spi.h>
+#include <applibs/gpio.h>
 
 // By default, this sample's CMake build targets hardware that follows the MT3620
 // Reference Development Board (RDB) specification, such as the MT3620 Dev Kit from
@@ -36,11 +40,22 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+// Fail the build if the hardware definition maps two of the peripherals which this sample
+// uses to the same pins. See mt3620_pin_check.h.
+#include <hw/mt3620_pin_check.h>
+MT3620_CHECK_GPIOS_NOT_ON_SPI(SAMPLE_LSM6DS3_SPI, SAMPLE_LSM6DS3_INT1);
+
 // Support functions.
 static void TerminationHandler(int signalNumber);
 static void AccelTimerEventHandler(EventData *eventData);
+static double FixedToDouble(int64_t value);
 static int ReadWhoAmI(void);
 static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t actualBytes);
+static StartupStepResult OpenSpiStepHandler(StartupStep *step);
+static StartupStepResult CheckWhoAmIStepHandler(StartupStep *step);
+static StartupStepResult ResetLsm6ds3StepHandler(StartupStep *step);
+static StartupStepResult OpenInt1StepHandler(StartupStep *step);
+static void StartupFinishedHandler(StartupSequence *sequence, int result);
 static int InitPeripheralsAndHandlers(void);
 static void ClosePeripheralsAndHandlers(void);
 
@@ -48,6 +63,43 @@ static void ClosePeripheralsAndHandlers(void);
 static int epollFd = -1;
 static int accelTimerFd = -1;
 static int spiFd = -1;
+static int int1GpioFd = -1;
+
+// Both sensors sample at 104Hz into the FIFO. INT1 is asserted when the FIFO reaches the
+// watermark of one second of samples, and then the FIFO is drained. The FIFO holds over six
+// seconds of samples, so none are lost if a drain is late.
+static Lsm6ds3SpiBus lsm6ds3Bus = {.spiFd = -1};
+static Lsm6ds3 lsm6ds3;
+static const Lsm6ds3FifoConfig lsm6ds3Config = {.odr = Lsm6ds3Odr_104Hz,
+                                                .accelRange = Lsm6ds3AccelRange_4g,
+                                                .gyroRange = Lsm6ds3GyroRange_245dps,
+                                                .watermarkSamples = 104};
+static Lsm6ds3Sample lsm6ds3Samples[256];
+// Each batch is converted to g and degrees per second in fixed point as it is read.
+static Lsm6ds3FixedSample lsm6ds3FixedSamples[256];
+static Lsm6ds3Scale lsm6ds3Scale;
+
+// Applibs does not report GPIO edges, so sample INT1 every 10ms once the sensor is sampling. The
+// data is printed each time the FIFO reaches the watermark, which is about once a second.
+static const struct timespec accelReadPeriod = {.tv_sec = 0, .tv_nsec = 10 * 1000 * 1000};
+
+// The peripherals are opened by a sequence of startup steps, which logs how long each one took.
+// The reset is checked every millisecond from a timer, for up to 100ms, rather than by polling
+// the bus in a loop, and INT1 is opened while the device resets.
+static StartupSequence startupSequence;
+static const uint32_t maxResetChecks = 100;
+static StartupStep openSpiStep = {
+    .name = "SPI", .handler = &OpenSpiStepHandler, .isCritical = true};
+static StartupStep whoAmIStep = {.name = "WHO_AM_I",
+                                 .handler = &CheckWhoAmIStepHandler,
+                                 .isCritical = true,
+                                 .after = &openSpiStep};
+static StartupStep resetStep = {.name = "LSM6DS3 reset",
+                                .handler = &ResetLsm6ds3StepHandler,
+                                .isCritical = true,
+                                .after = &whoAmIStep,
+                                .retryDelay = {0, 1000 * 1000}};
+static StartupStep int1Step = {.name = "INT1", .handler = &OpenInt1StepHandler, .isCritical = true};
 
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
@@ -62,7 +114,8 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Print latest data from accelerometer.
+///     Check INT1, and if the FIFO has reached the watermark, drain the FIFO and print the
+///     average of the samples which were collected.
 /// </summary>
 static void AccelTimerEventHandler(EventData *eventData)
 {
@@ -73,46 +126,75 @@ static void AccelTimerEventHandler(EventData *eventData)
         return;
     }
 
-    // Status register describes whether accelerometer is available.
-    // DocID026899 Rev 10, S9.26, STATUS_REG (1Eh); [0] = XLDA
-    // Set bit 7 to instruct the accelerometer that this is a read
-    // from register 0x1E.
-    static const uint8_t statusRegIdReadCmd = (0x1E | 0x80);
-    uint8_t status;
-    ssize_t transferredBytes = SPIMaster_WriteThenRead(
-        spiFd, &statusRegIdReadCmd, sizeof(statusRegIdReadCmd), &status, sizeof(status));
-    if (!CheckTransferSize("SPIMaster_WriteThenRead (STATUS_REG)",
-                           sizeof(statusRegIdReadCmd) + sizeof(status), transferredBytes)) {
+    // Reading the pin does not use the bus, so the bus is only used when there is a batch of
+    // samples to read.
+    GPIO_Value_Type int1;
+    if (GPIO_GetValue(int1GpioFd, &int1) != 0) {
+        Log_Debug("ERROR: Could not read LSM6DS3 INT1: %s (%d).\n", strerror(errno), errno);
         terminationRequired = true;
         return;
     }
 
-    if ((status & 0x1) == 0) {
-        Log_Debug("INFO: %d: No accelerometer data.\n", iter);
-    } else {
-        // Read two-byte Z-axis output register.
-        // DocID026899 Rev 10, S9.38, OUTZ_L_XL (2Ch)
-        // Set bit 7 to instruct the accelerometer that this is a read
-        // from register 0x2C.
-        static const uint8_t outZLXlReadCmd = (0x2C | 0x80);
-        int16_t zRaw;
-        transferredBytes = SPIMaster_WriteThenRead(spiFd, &outZLXlReadCmd, sizeof(outZLXlReadCmd),
-                                                   (uint8_t *)&zRaw, sizeof(zRaw));
-        if (!CheckTransferSize("SPIMaster_WriteThenRead (OUTZ_L_XL)",
-                               sizeof(outZLXlReadCmd) + sizeof(zRaw), transferredBytes)) {
+    if (int1 == GPIO_Value_Low) {
+        return;
+    }
+
+    // Each drain reads the FIFO status and then the samples in bursts, rather than reading
+    // STATUS_REG and an output register for every sample.
+    Lsm6ds3FifoStatus fifoStatus;
+    size_t sampleCount = 0;
+    int64_t sums[6] = {0};
+    do {
+        if (Lsm6ds3_ReadFifo(&lsm6ds3, lsm6ds3Samples,
+                             sizeof(lsm6ds3Samples) / sizeof(lsm6ds3Samples[0]),
+                             &fifoStatus) != 0) {
             terminationRequired = true;
             return;
         }
 
-        // DocID026899 Rev 10, S4.1, Mechanical characteristics
-        // These constants are specific to LA_So where FS = +/-4g, as set in CTRL1_X.
-        double g = (zRaw * 0.122) / 1000.0;
-        Log_Debug("INFO: %d: vertical acceleration: %.2lfg\n", iter, g);
+        if (fifoStatus.overrun) {
+            Log_Debug("WARNING: %d: LSM6DS3 FIFO overran; samples were lost.\n", iter);
+        }
+
+        Lsm6ds3_ConvertBlock(&lsm6ds3Scale, lsm6ds3Samples, fifoStatus.samplesRead,
+                             lsm6ds3FixedSamples);
+        for (size_t i = 0; i < fifoStatus.samplesRead; ++i) {
+            const Lsm6ds3FixedSample *sample = &lsm6ds3FixedSamples[i];
+            sums[0] += sample->gyroX;
+            sums[1] += sample->gyroY;
+            sums[2] += sample->gyroZ;
+            sums[3] += sample->accelX;
+            sums[4] += sample->accelY;
+            sums[5] += sample->accelZ;
+        }
+        sampleCount += fifoStatus.samplesRead;
+    } while (fifoStatus.samplesRemaining > 0);
+
+    if (sampleCount == 0) {
+        Log_Debug("INFO: %d: No accelerometer data.\n", iter);
+    } else {
+        int64_t n = (int64_t)sampleCount;
+        Log_Debug("INFO: %d: %zu samples, vertical acceleration: %.2lfg\n", iter, sampleCount,
+                  FixedToDouble(sums[5] / n));
+        Log_Debug("INFO: %d: acceleration (%.2lf, %.2lf, %.2lf)g, "
+                  "angular rate (%.1lf, %.1lf, %.1lf)dps\n",
+                  iter, FixedToDouble(sums[3] / n), FixedToDouble(sums[4] / n),
+                  FixedToDouble(sums[5] / n), FixedToDouble(sums[0] / n),
+                  FixedToDouble(sums[1] / n), FixedToDouble(sums[2] / n));
     }
 
     ++iter;
 }
 
+/// <summary>
+///     Convert a fixed-point value from <see cref="Lsm6ds3_ConvertBlock" /> to a double, to
+///     display it. Only the averages are converted, rather than every sample.
+/// </summary>
+static double FixedToDouble(int64_t value)
+{
+    return (double)value / (1 << LSM6DS3_FIXED_FRACTION_BITS);
+}
+
 /// <summary>
 ///	Demonstrates two ways of reading data from the attached device.
 ///	This also works as a smoke test to ensure Azure Sphere can talk to the SPI device.
@@ -201,65 +283,109 @@ static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t ac
 }
 
 /// <summary>
-///     Resets the accelerometer and samples the vertical acceleration.
+///     Startup step: opens the SPI master and configures it for the LSM6DS3.
 /// </summary>
-/// <returns>0 on success, or -1 on failure</returns>
-static int ResetAndSampleLsm6ds3(void)
+static StartupStepResult OpenSpiStepHandler(StartupStep *step)
 {
-    const size_t transferCount = 1;
-    SPIMaster_Transfer transfer;
+    SPIMaster_Config config;
+    int ret = SPIMaster_InitConfig(&config);
+    if (ret != 0) {
+        Log_Debug("ERROR: SPIMaster_InitConfig = %d errno = %s (%d)\n", ret, strerror(errno),
+                  errno);
+        return StartupStepResult_Failed;
+    }
+    config.csPolarity = SPI_ChipSelectPolarity_ActiveLow;
+    spiFd = SPIMaster_Open(SAMPLE_LSM6DS3_SPI, SAMPLE_LSM6DS3_SPI_CS, &config);
+    if (spiFd < 0) {
+        Log_Debug("ERROR: SPIMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
+        return StartupStepResult_Failed;
+    }
 
-    int result = SPIMaster_InitTransfers(&transfer, transferCount);
+    int result = SPIMaster_SetBusSpeed(spiFd, 400000);
     if (result != 0) {
-        return -1;
+        Log_Debug("ERROR: SPIMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
+        return StartupStepResult_Failed;
     }
 
-    // Reset device to put registers into default state.
-    // DocID026899 Rev 10, S9.14, CTRL3_C (12h); [0] = SW_RESET
-    static const uint8_t ctrl3cRegId = 0x12;
-    const uint8_t resetCommand[] = {ctrl3cRegId, 0x01};
+    result = SPIMaster_SetMode(spiFd, SPI_Mode_3);
+    if (result != 0) {
+        Log_Debug("ERROR: SPIMaster_SetMode: errno=%d (%s)\n", errno, strerror(errno));
+        return StartupStepResult_Failed;
+    }
 
-    transfer.flags = SPI_TransferFlags_Write;
-    transfer.writeData = resetCommand;
-    transfer.length = sizeof(resetCommand);
+    return StartupStepResult_Done;
+}
 
-    ssize_t transferredBytes = SPIMaster_TransferSequential(spiFd, &transfer, transferCount);
-    if (!CheckTransferSize("SPIMaster_TransferSequential (CTRL3_C)", transfer.length,
-                           transferredBytes)) {
-        return -1;
+/// <summary>
+///     Startup step: checks that the device on the bus is an LSM6DS3.
+/// </summary>
+static StartupStepResult CheckWhoAmIStepHandler(StartupStep *step)
+{
+    return ReadWhoAmI() == 0 ? StartupStepResult_Done : StartupStepResult_Failed;
+}
+
+/// <summary>
+///     Startup step: resets the accelerometer, and starts sampling both sensors into the FIFO.
+///     The step is called again every retryDelay until the device has come out of reset.
+/// </summary>
+static StartupStepResult ResetLsm6ds3StepHandler(StartupStep *step)
+{
+    if (step->calls == 0) {
+        lsm6ds3Bus.spiFd = spiFd;
+        Lsm6ds3_Init(&lsm6ds3, &Lsm6ds3SpiTransportOps, &lsm6ds3Bus);
+
+        // Reset device to put registers into default state.
+        return Lsm6ds3_StartReset(&lsm6ds3) == 0 ? StartupStepResult_Pending
+                                                 : StartupStepResult_Failed;
     }
 
-    // Set bit 7 to instruct the accelerometer that this is a read
-    // from register 0x12.
-    static const uint8_t ctrl3cRegIdReadCmd = (0x12 | 0x80);
+    if (Lsm6ds3_IsResetComplete(&lsm6ds3) != 1) {
+        if (step->calls >= maxResetChecks) {
+            Log_Debug("ERROR: LSM6DS3 did not come out of reset.\n");
+            return StartupStepResult_Failed;
+        }
+        return StartupStepResult_Pending;
+    }
 
-    // Wait for device to come out of reset.
-    uint8_t ctrl3c;
-    do {
-        transferredBytes = SPIMaster_WriteThenRead(
-            spiFd, &ctrl3cRegIdReadCmd, sizeof(ctrl3cRegIdReadCmd), &ctrl3c, sizeof(ctrl3c));
-    } while (!(transferredBytes == (sizeof(ctrl3cRegIdReadCmd) + sizeof(ctrl3c)) &&
-               (ctrl3c & 0x1) == 0));
+    // Start both sensors, and collect their samples in the FIFO.
+    if (Lsm6ds3_StartFifo(&lsm6ds3, &lsm6ds3Config) != 0) {
+        return StartupStepResult_Failed;
+    }
+    Lsm6ds3_InitScale(&lsm6ds3Scale, lsm6ds3Config.accelRange, lsm6ds3Config.gyroRange);
 
-    // Use sample range +/- 4g, with 12.5Hz frequency.
-    // DocID026899 Rev 10, S9.12, CTRL1_XL (10h)
-    static const uint8_t setCtrl1XlCommand[] = {0x10, 0x18};
+    if (Lsm6ds3_EnableFifoWatermarkInterrupt(&lsm6ds3) != 0) {
+        return StartupStepResult_Failed;
+    }
 
-    transfer.flags = SPI_TransferFlags_Write;
-    transfer.writeData = setCtrl1XlCommand;
-    transfer.length = sizeof(setCtrl1XlCommand);
+    return StartupStepResult_Done;
+}
 
-    transferredBytes = SPIMaster_TransferSequential(spiFd, &transfer, transferCount);
-    if (!CheckTransferSize("SPIMaster_TransferSequential (CTRL1_XL)", transfer.length,
-                           transferredBytes)) {
-        return -1;
+/// <summary>
+///     Startup step: opens the GPIO which INT1 is connected to.
+/// </summary>
+static StartupStepResult OpenInt1StepHandler(StartupStep *step)
+{
+    int1GpioFd = GPIO_OpenAsInput(SAMPLE_LSM6DS3_INT1);
+    if (int1GpioFd < 0) {
+        Log_Debug("ERROR: Could not open LSM6DS3 INT1 GPIO: %s (%d).\n", strerror(errno), errno);
+        return StartupStepResult_Failed;
     }
+    return StartupStepResult_Done;
+}
 
-    return 0;
+/// <summary>
+///     Starts sampling INT1 once every startup step has finished, or exits if one failed.
+/// </summary>
+static void StartupFinishedHandler(StartupSequence *sequence, int result)
+{
+    StartupSequence_LogTrace(sequence);
+    if (result != 0 || SetTimerFdToPeriod(accelTimerFd, &accelReadPeriod) != 0) {
+        terminationRequired = true;
+    }
 }
 
 /// <summary>
-///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
+///     Set up SIGTERM termination handler, and start the steps which initialize the peripherals.
 /// </summary>
 /// <returns>0 on success, or -1 on failure</returns>
 static int InitPeripheralsAndHandlers(void)
@@ -274,52 +400,25 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    // Print accelerometer data every second.
-    struct timespec accelReadPeriod = {.tv_sec = 1, .tv_nsec = 0};
-    // event handler data structures. Only the event handler field needs to be populated.
-    static EventData accelEventData = {.eventHandler = &AccelTimerEventHandler};
-    accelTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &accelReadPeriod, &accelEventData, EPOLLIN);
-    if (accelTimerFd < 0) {
-        return -1;
-    }
-
-    SPIMaster_Config config;
-    int ret = SPIMaster_InitConfig(&config);
-    if (ret != 0) {
-        Log_Debug("ERROR: SPIMaster_InitConfig = %d errno = %s (%d)\n", ret, strerror(errno),
-                  errno);
-        return -1;
-    }
-    config.csPolarity = SPI_ChipSelectPolarity_ActiveLow;
-    spiFd = SPIMaster_Open(SAMPLE_LSM6DS3_SPI, SAMPLE_LSM6DS3_SPI_CS, &config);
-    if (spiFd < 0) {
-        Log_Debug("ERROR: SPIMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
-        return -1;
-    }
-
-    int result = SPIMaster_SetBusSpeed(spiFd, 400000);
-    if (result != 0) {
-        Log_Debug("ERROR: SPIMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
-        return -1;
-    }
-
-    result = SPIMaster_SetMode(spiFd, SPI_Mode_3);
-    if (result != 0) {
-        Log_Debug("ERROR: SPIMaster_SetMode: errno=%d (%s)\n", errno, strerror(errno));
+    if (StartupSequence_Init(&startupSequence, epollFd, &StartupFinishedHandler) != 0) {
         return -1;
     }
 
-    result = ReadWhoAmI();
-    if (result != 0) {
-        return -1;
-    }
-
-    result = ResetAndSampleLsm6ds3();
-    if (result != 0) {
+    // The timer is started when the sensor is sampling. Only the event handler field of its
+    // event data needs to be populated.
+    static EventData accelEventData = {.eventHandler = &AccelTimerEventHandler};
+    static const struct timespec accelTimerDisabled = {0, 0};
+    accelTimerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &accelTimerDisabled, &accelEventData, EPOLLIN);
+    if (accelTimerFd < 0) {
         return -1;
     }
 
-    return 0;
+    StartupSequence_AddStep(&startupSequence, &openSpiStep);
+    StartupSequence_AddStep(&startupSequence, &whoAmIStep);
+    StartupSequence_AddStep(&startupSequence, &resetStep);
+    StartupSequence_AddStep(&startupSequence, &int1Step);
+    return StartupSequence_Start(&startupSequence);
 }
 
 /// <summary>
@@ -329,7 +428,9 @@ static void ClosePeripheralsAndHandlers(void)
 {
     Log_Debug("Closing file descriptors.\n");
     CloseFdAndPrintError(spiFd, "Spi");
+    CloseFdAndPrintError(int1GpioFd, "Int1Gpio");
     CloseFdAndPrintError(accelTimerFd, "accelTimer");
+    StartupSequence_Close(&startupSequence);
     CloseFdAndPrintError(epollFd, "Epoll");
 }
 
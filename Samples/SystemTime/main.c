@@ -22,6 +22,8 @@
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include "epoll_timerfd_utilities.h"
+#include "input_manager.h"
+#include "timing.h"
 
 #include <applibs/gpio.h>
 #include <applibs/log.h>
@@ -44,9 +46,15 @@
 // File descriptors - initialized to invalid value
 static int incrementTimeButtonGpioFd = -1;
 static int writeToRtcButtonGpioFd = -1;
-static int buttonPollTimerFd = -1;
 static int epollFd = -1;
 
+static InputManager inputManager;
+
+// Maps the monotonic clock to the system time. A difference of more than 100ms between them
+// means that the system time has been set.
+static TimingWallClock wallClock;
+static const int64_t wallClockTolerance = 100 * 1000 * 1000;
+
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
@@ -64,115 +72,101 @@ static void TerminationHandler(int signalNumber)
 /// </summary>
 static void PrintTime(void)
 {
-    // Ask for CLOCK_REALTIME to obtain the current system time. This is not to be confused with the
-    // hardware RTC used below to persist the time.
-    struct timespec currentTime;
-    if (clock_gettime(CLOCK_REALTIME, &currentTime) == -1) {
-        Log_Debug("ERROR: clock_gettime failed with error code: %s (%d).\n", strerror(errno),
+    // The system time (CLOCK_REALTIME) is read through the mapping from the monotonic clock.
+    // This is not to be confused with the hardware RTC used below to persist the time. If the
+    // system time has been set since the mapping was made, such as by NTP, map it again.
+    if (Timing_CheckWallClock(&wallClock, wallClockTolerance)) {
+        Log_Debug("INFO: The system time has been set since it was last read.\n");
+    }
+    int64_t currentTime = Timing_ToWallClockNs(&wallClock, Timing_GetMonotonicNs());
+
+    char displayTimeBuffer[TIMING_ISO8601_MAX_LENGTH + 1];
+    Timing_FormatIso8601(displayTimeBuffer, sizeof(displayTimeBuffer), currentTime, 0);
+    Log_Debug("UTC:            %s\n", displayTimeBuffer);
+
+    // Only the offset of the local time zone, and whether it is daylight saving time, are
+    // needed from localtime_r.
+    time_t seconds = (time_t)(currentTime / 1000000000);
+    struct tm localTime;
+    if (!localtime_r(&seconds, &localTime)) {
+        Log_Debug("ERROR: localtime_r failed with error code: %s (%d).\n", strerror(errno),
                   errno);
         terminationRequired = true;
         return;
-    } else {
-        char displayTimeBuffer[26];
-        if (!asctime_r((gmtime(&currentTime.tv_sec)), (char *restrict) & displayTimeBuffer)) {
-            Log_Debug("ERROR: asctime_r failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            terminationRequired = true;
-            return;
-        }
-        Log_Debug("UTC:            %s", displayTimeBuffer);
-
-        if (!asctime_r((localtime(&currentTime.tv_sec)), (char *restrict) & displayTimeBuffer)) {
-            Log_Debug("ERROR: asctime_r failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            terminationRequired = true;
-            return;
-        }
-
-        // Remove the new line at the end of 'displayTimeBuffer'
-        displayTimeBuffer[strlen(displayTimeBuffer) - 1] = '\0';
-        size_t tznameIndex = ((localtime(&currentTime.tv_sec))->tm_isdst) ? 1 : 0;
-        Log_Debug("Local time:     %s %s\n", displayTimeBuffer, tzname[tznameIndex]);
     }
+    Timing_FormatIso8601(displayTimeBuffer, sizeof(displayTimeBuffer), currentTime,
+                         (int32_t)localTime.tm_gmtoff);
+    size_t tznameIndex = localTime.tm_isdst ? 1 : 0;
+    Log_Debug("Local time:     %s %s\n", displayTimeBuffer, tzname[tznameIndex]);
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+///     Handle SAMPLE_BUTTON_1 changing state: when it is pressed, the current time will be
+///     incremented by 3 hours. The changes will not be synchronized with the hardware RTC until
+///     the other button is pressed.
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>True if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+static void IncrementTimeButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
+    if (!isPressed) {
+        return;
+    }
+
+    Log_Debug(
+        "\nSAMPLE_BUTTON_1 was pressed: the current system time will be incremented by 3 hours."
+        "To synchronize the time with the hardware RTC, press SAMPLE_BUTTON_2.\n");
+    struct timespec currentTime;
+    if (clock_gettime(CLOCK_REALTIME, &currentTime) == -1) {
+        Log_Debug("ERROR: clock_gettime failed with error code: %s (%d).\n", strerror(errno),
+                  errno);
         terminationRequired = true;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
+        return;
     }
 
-    return isButtonPressed;
+    // Add three hours to the current time
+    currentTime.tv_sec += 10800;
+    if (clock_settime(CLOCK_REALTIME, &currentTime) == -1) {
+        Log_Debug("ERROR: clock_settime failed with error code: %s (%d).\n", strerror(errno),
+                  errno);
+        terminationRequired = true;
+        return;
+    }
+    Timing_SyncWallClock(&wallClock, TimingClockSource_Manual);
+    PrintTime();
 }
 
 /// <summary>
-///     Handle button timer event: if SAMPLE_BUTTON_1 is pressed, then the current time will be
-///     incremented by 3 hours. If SAMPLE_BUTTON_2 is pressed, then the current time will be
+///     Handle SAMPLE_BUTTON_2 changing state: when it is pressed, the current time will be
 ///     synchronized with the hardware RTC.
 /// </summary>
-static void ButtonPollTimerEventHandler(EventData *eventData)
+static void WriteToRtcButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    if (ConsumeTimerFdEvent(buttonPollTimerFd) != 0) {
-        terminationRequired = true;
+    if (!isPressed) {
         return;
     }
 
-    // Check for advance-clock button press; the changes will not be synchronized with the hardware
-    // RTC until the other button is pressed
-    static GPIO_Value_Type incrementTimeButtonState;
-    if (IsButtonPressed(incrementTimeButtonGpioFd, &incrementTimeButtonState)) {
-        Log_Debug(
-            "\nSAMPLE_BUTTON_1 was pressed: the current system time will be incremented by 3 hours."
-            "To synchronize the time with the hardware RTC, press SAMPLE_BUTTON_2.\n");
-        struct timespec currentTime;
-        if (clock_gettime(CLOCK_REALTIME, &currentTime) == -1) {
-            Log_Debug("ERROR: clock_gettime failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            terminationRequired = true;
-            return;
-        }
-
-        // Add three hours to the current time
-        currentTime.tv_sec += 10800;
-        if (clock_settime(CLOCK_REALTIME, &currentTime) == -1) {
-            Log_Debug("ERROR: clock_settime failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            terminationRequired = true;
-            return;
-        }
-        PrintTime();
+    Log_Debug(
+        "\nSAMPLE_BUTTON_2 was pressed: the current system time will be synchronized to the "
+        "hardware RTC.\n");
+    if (clock_systohc() == -1) {
+        Log_Debug("ERROR: clock_systohc failed with error code: %s (%d).\n", strerror(errno),
+                  errno);
+        terminationRequired = true;
     }
+}
 
-    // Check for SAMPLE_BUTTON_2 press: the changes will be synchronized with the hardware RTC
-    static GPIO_Value_Type writeToRtcButtonState;
-    if (IsButtonPressed(writeToRtcButtonGpioFd, &writeToRtcButtonState)) {
-        Log_Debug(
-            "\nSAMPLE_BUTTON_2 was pressed: the current system time will be synchronized to the "
-            "hardware RTC.\n");
-        if (clock_systohc() == -1) {
-            Log_Debug("ERROR: clock_systohc failed with error code: %s (%d).\n", strerror(errno),
-                      errno);
-            terminationRequired = true;
-        }
-    }
+/// <summary>
+///     The input manager could not read a button, so exit.
+/// </summary>
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error)
+{
+    terminationRequired = true;
 }
 
-// Event handler data structures. Only the event handler field needs to be populated.
-static EventData buttonPollTimerEventData = {.eventHandler = &ButtonPollTimerEventHandler};
+// The buttons read low when they are pressed.
+static InputManagerInput incrementTimeButton = {.activeValue = GPIO_Value_Low,
+                                                .changedHandler = &IncrementTimeButtonHandler};
+static InputManagerInput writeToRtcButton = {.activeValue = GPIO_Value_Low,
+                                             .changedHandler = &WriteToRtcButtonHandler};
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -206,13 +200,20 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    // Set up a timer to poll the buttons
-    struct timespec buttonPressCheckPeriod = {0, 1000000};
-    buttonPollTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod,
-                                                   &buttonPollTimerEventData, EPOLLIN);
-    if (buttonPollTimerFd < 0) {
+    // Sample both buttons on one timer, which reports only debounced presses and releases.
+    if (InputManager_Init(&inputManager, epollFd, NULL, 0, &ButtonReadErrorHandler) != 0) {
         return -1;
     }
+    // Sample the buttons less often while neither of them is changing.
+    static const struct timespec idleSamplePeriod = {0,
+                                                     INPUT_MANAGER_SUGGESTED_IDLE_SAMPLE_PERIOD_NS};
+    if (InputManager_SetIdleSamplePeriod(&inputManager, &idleSamplePeriod) != 0) {
+        return -1;
+    }
+    incrementTimeButton.gpioFd = incrementTimeButtonGpioFd;
+    InputManager_AddInput(&inputManager, &incrementTimeButton);
+    writeToRtcButton.gpioFd = writeToRtcButtonGpioFd;
+    InputManager_AddInput(&inputManager, &writeToRtcButton);
 
     return 0;
 }
@@ -225,7 +226,7 @@ static void ClosePeripheralsAndHandlers(void)
     Log_Debug("Closing file descriptors.\n");
     CloseFdAndPrintError(incrementTimeButtonGpioFd, "IncrementTimeButtonGpio");
     CloseFdAndPrintError(writeToRtcButtonGpioFd, "WriteToRtcButtonGpio");
-    CloseFdAndPrintError(buttonPollTimerFd, "ButtonPollTimer");
+    InputManager_Close(&inputManager);
     CloseFdAndPrintError(epollFd, "Epoll");
 }
 
@@ -243,6 +244,14 @@ static void CheckTimeSyncState(void)
         return;
     }
 
+    // The system time is restored from the hardware RTC when the device starts, and then
+    // NTP may set it, if time sync is enabled.
+    if (Timing_SyncWallClock(&wallClock, isTimeSyncEnabled ? TimingClockSource_Ntp
+                                                           : TimingClockSource_Rtc) != 0) {
+        terminationRequired = true;
+        return;
+    }
+
     // If time sync is enabled, NTP can reset the time
     if (isTimeSyncEnabled) {
         Log_Debug(
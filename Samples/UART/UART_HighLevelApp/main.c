@@ -3,8 +3,8 @@
 
 // This sample C application for Azure Sphere demonstrates how to use a UART (serial port).
 // The sample opens a UART with a baud rate of 115200. Pressing a button causes characters
-// to be sent from the device over the UART; data received by the device from the UART is echoed to
-// the Visual Studio Output Window.
+// to be sent from the device over the UART; each line received by the device from the UART is
+// echoed to the Visual Studio Output Window.
 //
 // It uses the API for the following Azure Sphere application libraries:
 // - UART (serial port)
@@ -22,6 +22,8 @@
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 #include "epoll_timerfd_utilities.h"
+#include "uart_stream.h"
+#include "uart_benchmark.h"
 #include <applibs/uart.h>
 #include <applibs/gpio.h>
 #include <applibs/log.h>
@@ -39,15 +41,43 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+// Fail the build if the hardware definition maps two of the peripherals which this sample
+// uses to the same pins. See mt3620_pin_check.h.
+#include <hw/mt3620_pin_check.h>
+MT3620_CHECK_GPIOS_NOT_ON_UART(SAMPLE_UART, SAMPLE_BUTTON_1);
+
 // File descriptors - initialized to invalid value
 static int uartFd = -1;
 static int gpioButtonFd = -1;
 static int gpioButtonTimerFd = -1;
 static int epollFd = -1;
 
+// Splits the received data into lines. The buffer must hold the longest line.
+static uint8_t uartReceiveBuffer[256];
+static UartStream uartStream;
+
 // State variables
 static GPIO_Value_Type buttonState = GPIO_Value_High;
 
+#if defined(UART_BENCHMARK)
+// In the benchmark build, the button measures the UART at each of these baud rates, and the
+// results are written to the Output window.
+static const UART_BaudRate_Type benchmarkBaudRates[] = {115200,  230400,  460800, 921600,
+                                                        1000000, 2000000, 3000000};
+static void HandleBenchmarkDone(void);
+static const UartBenchmarkConfig benchmarkConfig = {
+    .uartId = SAMPLE_UART,
+    .baudRates = benchmarkBaudRates,
+    .baudRateCount = sizeof(benchmarkBaudRates) / sizeof(benchmarkBaudRates[0]),
+    .streamMs = 2000,
+    .probeCount = 16,
+    .windowBytes = 1024,
+    .doneHandler = &HandleBenchmarkDone};
+#endif
+
+static int OpenUart(void);
+static void CloseUart(void);
+
 // Termination state
 static volatile sig_atomic_t terminationRequired = false;
 
@@ -61,32 +91,26 @@ static void TerminationHandler(int signalNumber)
 }
 
 /// <summary>
-///     Helper function to send a fixed message via the given UART.
+///     Helper function to send a fixed message via the UART stream. Any data which the UART
+///     cannot accept immediately is sent from the event loop.
 /// </summary>
-/// <param name="uartFd">The open file descriptor of the UART to write to</param>
 /// <param name="dataToSend">The data to send over the UART</param>
-static void SendUartMessage(int uartFd, const char *dataToSend)
+static void SendUartMessage(const char *dataToSend)
 {
-    size_t totalBytesSent = 0;
-    size_t totalBytesToSend = strlen(dataToSend);
-    int sendIterations = 0;
-    while (totalBytesSent < totalBytesToSend) {
-        sendIterations++;
-
-        // Send as much of the remaining data as possible
-        size_t bytesLeftToSend = totalBytesToSend - totalBytesSent;
-        const char *remainingMessageToSend = dataToSend + totalBytesSent;
-        ssize_t bytesSent = write(uartFd, remainingMessageToSend, bytesLeftToSend);
-        if (bytesSent < 0) {
-            Log_Debug("ERROR: Could not write to UART: %s (%d).\n", strerror(errno), errno);
-            terminationRequired = true;
-            return;
-        }
+    const struct iovec message = {.iov_base = (void *)dataToSend, .iov_len = strlen(dataToSend)};
 
-        totalBytesSent += (size_t)bytesSent;
+    int result = UartStream_Send(&uartStream, &message, 1);
+    if (result == -1 && errno == EBUSY) {
+        Log_Debug("Not sending over UART: the previous message is still being sent.\n");
+    } else if (result == -1) {
+        Log_Debug("ERROR: Could not write to UART: %s (%d).\n", strerror(errno), errno);
+        terminationRequired = true;
+    } else if (result == 0) {
+        Log_Debug("Sending %zu bytes over UART; the rest is sent when the UART has space.\n",
+                  message.iov_len);
+    } else {
+        Log_Debug("Sent %zu bytes over UART.\n", message.iov_len);
     }
-
-    Log_Debug("Sent %zu bytes over UART in %d calls.\n", totalBytesSent, sendIterations);
 }
 
 /// <summary>
@@ -112,40 +136,101 @@ static void ButtonTimerEventHandler(EventData *eventData)
     // The button has GPIO_Value_Low when pressed and GPIO_Value_High when released
     if (newButtonState != buttonState) {
         if (newButtonState == GPIO_Value_Low) {
-            SendUartMessage(uartFd, "Hello world!\n");
+#if defined(UART_BENCHMARK)
+            // The benchmark opens the UART itself, at each baud rate in turn.
+            if (!UartBenchmark_IsRunning()) {
+                CloseUart();
+                if (UartBenchmark_Start(epollFd, &benchmarkConfig) != 0) {
+                    Log_Debug("ERROR: Could not start UART benchmark: %s (%d).\n",
+                              strerror(errno), errno);
+                    terminationRequired = true;
+                }
+            }
+#else
+            SendUartMessage("Hello world!\n");
+#endif
         }
         buttonState = newButtonState;
     }
 }
 
 /// <summary>
-///     Handle UART event: if there is incoming data, print it.
+///     Handle a line which was received on the UART: print it.
 /// </summary>
-static void UartEventHandler(EventData *eventData)
+static void UartLineHandler(UartStream *stream, const uint8_t *line, size_t length, void *context)
 {
-    const size_t receiveBufferSize = 256;
-    uint8_t receiveBuffer[receiveBufferSize + 1]; // allow extra byte for string termination
-    ssize_t bytesRead;
-
-    // Read incoming UART data. It is expected behavior that messages may be received in multiple
-    // partial chunks.
-    bytesRead = read(uartFd, receiveBuffer, receiveBufferSize);
-    if (bytesRead < 0) {
-        Log_Debug("ERROR: Could not read UART: %s (%d).\n", strerror(errno), errno);
-        terminationRequired = true;
-        return;
+    // Lines which end with "\r\n" are printed without the '\r'.
+    if (length > 0 && line[length - 1] == '\r') {
+        --length;
     }
 
-    if (bytesRead > 0) {
-        // Null terminate the buffer to make it a valid string, and print it
-        receiveBuffer[bytesRead] = 0;
-        Log_Debug("UART received %d bytes: '%s'.\n", bytesRead, (char *)receiveBuffer);
+    Log_Debug("UART received line of %zu bytes: '%.*s'.\n", length, (int)length,
+              (const char *)line);
+}
+
+/// <summary>
+///     Handle an error reading the UART: exit the application.
+/// </summary>
+static void UartErrorHandler(UartStream *stream, int error, void *context)
+{
+    terminationRequired = true;
+}
+
+#if defined(UART_BENCHMARK)
+/// <summary>
+///     Handle the end of the benchmark: open the UART again at the sample's baud rate.
+/// </summary>
+static void HandleBenchmarkDone(void)
+{
+    if (OpenUart() != 0) {
+        terminationRequired = true;
     }
 }
+#endif
 
 // event handler data structures. Only the event handler field needs to be populated.
 static EventData buttonEventData = {.eventHandler = &ButtonTimerEventHandler};
-static EventData uartEventData = {.eventHandler = &UartEventHandler};
+
+/// <summary>
+///     Open the UART and start reading lines from it.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int OpenUart(void)
+{
+    // Create a UART_Config object, open the UART and set up UART event handler
+    UART_Config uartConfig;
+    UART_InitConfig(&uartConfig);
+    uartConfig.baudRate = 115200;
+    uartConfig.flowControl = UART_FlowControl_None;
+    uartFd = UART_Open(SAMPLE_UART, &uartConfig);
+    if (uartFd < 0) {
+        Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    const UartStreamConfig uartStreamConfig = {.buffer = uartReceiveBuffer,
+                                               .bufferSize = sizeof(uartReceiveBuffer),
+                                               .framing = UartStreamFraming_Delimiter,
+                                               .delimiter = '\n',
+                                               .frameHandler = &UartLineHandler,
+                                               .errorHandler = &UartErrorHandler};
+    if (UartStream_Open(&uartStream, epollFd, uartFd, &uartStreamConfig) != 0) {
+        Log_Debug("ERROR: Could not start reading UART: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Stop reading the UART and close it, if it is open.
+/// </summary>
+static void CloseUart(void)
+{
+    if (uartFd >= 0) {
+        UartStream_Close(&uartStream, epollFd);
+        CloseFdAndPrintError(uartFd, "Uart");
+        uartFd = -1;
+    }
+}
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -163,17 +248,7 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    // Create a UART_Config object, open the UART and set up UART event handler
-    UART_Config uartConfig;
-    UART_InitConfig(&uartConfig);
-    uartConfig.baudRate = 115200;
-    uartConfig.flowControl = UART_FlowControl_None;
-    uartFd = UART_Open(SAMPLE_UART, &uartConfig);
-    if (uartFd < 0) {
-        Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
-        return -1;
-    }
-    if (RegisterEventHandlerToEpoll(epollFd, uartFd, &uartEventData, EPOLLIN) != 0) {
+    if (OpenUart() != 0) {
         return -1;
     }
 
@@ -202,7 +277,10 @@ static void ClosePeripheralsAndHandlers(void)
     Log_Debug("Closing file descriptors.\n");
     CloseFdAndPrintError(gpioButtonTimerFd, "ButtonTimer");
     CloseFdAndPrintError(gpioButtonFd, "GpioButton");
-    CloseFdAndPrintError(uartFd, "Uart");
+#if defined(UART_BENCHMARK)
+    UartBenchmark_Stop();
+#endif
+    CloseUart();
     CloseFdAndPrintError(epollFd, "Epoll");
 }
 
@@ -218,7 +296,8 @@ int main(int argc, char *argv[])
 
     // Use epoll to wait for events and trigger handlers, until an error or SIGTERM happens
     while (!terminationRequired) {
-        if (WaitForEventAndCallHandler(epollFd) != 0) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
             terminationRequired = true;
         }
     }
@@ -0,0 +1,395 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// applibs_versions.h defines the API struct versions to use for applibs APIs.
+#include "applibs_versions.h"
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "uart_benchmark.h"
+
+// The timer checks for timeouts, and ends each stream.
+#define TICK_PERIOD_MS 10
+
+// A probe which has not been read back after this long is counted as lost.
+#define PROBE_TIMEOUT_NS (100 * 1000000ull)
+
+// Largest block of the pattern which is written at once.
+#define PATTERN_CHUNK_SIZE 256
+
+typedef enum {
+    BenchmarkPhase_Idle,
+    BenchmarkPhase_Latency,
+    BenchmarkPhase_Stream,
+    BenchmarkPhase_Drain
+} BenchmarkPhase;
+
+static void UartEventHandler(EventData *eventData);
+static void TickEventHandler(EventData *eventData);
+static void StartNextRate(void);
+static void SendProbe(void);
+static void FinishProbe(void);
+static void StartStream(void);
+static void FillWindow(void);
+static void CheckPattern(const uint8_t *data, size_t length);
+static void FinishRate(void);
+static void CloseUart(void);
+
+static const UartBenchmarkConfig *benchConfig = NULL;
+static BenchmarkPhase phase = BenchmarkPhase_Idle;
+static int benchEpollFd = -1;
+static int uartFd = -1;
+static int tickTimerFd = -1;
+static EventData uartEventData = {.eventHandler = &UartEventHandler};
+static EventData tickEventData = {.eventHandler = &TickEventHandler};
+static size_t rateIndex;
+static UART_BaudRate_Type baudRate;
+
+// How long the line can be silent while bytes are in flight before they are counted as missing.
+static uint64_t stallTimeoutNs;
+
+// Two copies of the counting pattern, so that a chunk can start at any phase of it.
+static uint8_t pattern[256 + PATTERN_CHUNK_SIZE];
+static uint8_t readBuffer[1024];
+
+// Round-trip times of the probes.
+static unsigned int probeIndex;
+static bool isProbeOutstanding;
+static uint64_t probeSentNs;
+static unsigned int probesLost;
+static unsigned int rttCount;
+static uint64_t rttMinNs;
+static uint64_t rttMaxNs;
+static uint64_t rttTotalNs;
+
+// Progress of the stream. The bytes which are in flight are those which have been written, and
+// neither read back nor counted as missing.
+static size_t bytesSent;
+static size_t bytesReceived;
+static size_t bytesMissing;
+static size_t patternErrors;
+static uint64_t streamStartNs;
+static uint64_t lastRxNs;
+static uint64_t streamStartCpuNs;
+
+static uint64_t ReadClockNs(clockid_t clockId)
+{
+    struct timespec now;
+    clock_gettime(clockId, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static inline size_t BytesInFlight(void)
+{
+    return bytesSent - bytesReceived - bytesMissing;
+}
+
+int UartBenchmark_Start(int epollFd, const UartBenchmarkConfig *config)
+{
+    if (UartBenchmark_IsRunning()) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (config->baudRateCount == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(pattern); ++i) {
+        pattern[i] = (uint8_t)i;
+    }
+
+    const struct timespec tickPeriod = {0, TICK_PERIOD_MS * 1000000};
+    tickTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &tickPeriod, &tickEventData, EPOLLIN);
+    if (tickTimerFd < 0) {
+        return -1;
+    }
+
+    benchConfig = config;
+    benchEpollFd = epollFd;
+    Log_Debug("UART benchmark: %zu baud rates, %u ms each, %zu bytes in flight.\n",
+              config->baudRateCount, config->streamMs, config->windowBytes);
+
+    rateIndex = 0;
+    StartNextRate();
+    return 0;
+}
+
+void UartBenchmark_Stop(void)
+{
+    if (!UartBenchmark_IsRunning()) {
+        return;
+    }
+
+    CloseUart();
+    CloseFdAndPrintError(tickTimerFd, "BenchmarkTimer");
+    tickTimerFd = -1;
+    phase = BenchmarkPhase_Idle;
+}
+
+bool UartBenchmark_IsRunning(void)
+{
+    return tickTimerFd >= 0;
+}
+
+static void CloseUart(void)
+{
+    if (uartFd >= 0) {
+        UnregisterPersistentEventHandlerFromEpoll(benchEpollFd, &uartEventData);
+        CloseFdAndPrintError(uartFd, "BenchmarkUart");
+        uartFd = -1;
+    }
+}
+
+/// <summary>
+///     Opens the UART at the next baud rate which it supports, and sends the first probe. Once
+///     every baud rate has been measured, stops the benchmark and calls the done handler.
+/// </summary>
+static void StartNextRate(void)
+{
+    for (; rateIndex < benchConfig->baudRateCount; ++rateIndex) {
+        baudRate = benchConfig->baudRates[rateIndex];
+
+        UART_Config uartConfig;
+        UART_InitConfig(&uartConfig);
+        uartConfig.baudRate = baudRate;
+        uartConfig.flowControl = UART_FlowControl_None;
+        uartFd = UART_Open(benchConfig->uartId, &uartConfig);
+        if (uartFd < 0) {
+            Log_Debug("%7u baud: could not open UART: %s (%d).\n", baudRate, strerror(errno),
+                      errno);
+            continue;
+        }
+
+        // Reads and writes carry on until they would block, so the UART is registered once,
+        // edge-triggered, for both.
+        if (RegisterPersistentEventHandlerToEpoll(benchEpollFd, uartFd, &uartEventData,
+                                                  EPOLLIN | EPOLLOUT) != 0) {
+            CloseUart();
+            continue;
+        }
+
+        // Allow twice the time to send a full window, plus a few ticks.
+        stallTimeoutNs = 2ull * benchConfig->windowBytes * 10 * 1000000000u / baudRate +
+                         2 * TICK_PERIOD_MS * 1000000ull;
+
+        probeIndex = 0;
+        probesLost = 0;
+        rttCount = 0;
+        rttMinNs = UINT64_MAX;
+        rttMaxNs = 0;
+        rttTotalNs = 0;
+        phase = BenchmarkPhase_Latency;
+        SendProbe();
+        return;
+    }
+
+    UartBenchmarkDoneHandler doneHandler = benchConfig->doneHandler;
+    UartBenchmark_Stop();
+    Log_Debug("UART benchmark finished.\n");
+    if (doneHandler != NULL) {
+        doneHandler();
+    }
+}
+
+static void SendProbe(void)
+{
+    uint8_t probe = (uint8_t)probeIndex;
+    isProbeOutstanding = true;
+    probeSentNs = ReadClockNs(CLOCK_MONOTONIC);
+    if (write(uartFd, &probe, 1) != 1) {
+        // The timeout counts the probe as lost.
+        Log_Debug("ERROR: Could not write probe to UART: %s (%d).\n", strerror(errno), errno);
+    }
+}
+
+/// <summary>
+///     Sends the next probe, or starts streaming once every probe has been sent.
+/// </summary>
+static void FinishProbe(void)
+{
+    isProbeOutstanding = false;
+    if (++probeIndex < benchConfig->probeCount) {
+        SendProbe();
+    } else {
+        StartStream();
+    }
+}
+
+static void StartStream(void)
+{
+    bytesSent = 0;
+    bytesReceived = 0;
+    bytesMissing = 0;
+    patternErrors = 0;
+    phase = BenchmarkPhase_Stream;
+
+    streamStartCpuNs = ReadClockNs(CLOCK_THREAD_CPUTIME_ID);
+    streamStartNs = ReadClockNs(CLOCK_MONOTONIC);
+    lastRxNs = streamStartNs;
+    FillWindow();
+}
+
+/// <summary>
+///     Writes the counting pattern until the window is full or the UART would block. In the
+///     latter case, the edge-triggered registration calls the handler when it has space.
+/// </summary>
+static void FillWindow(void)
+{
+    while (BytesInFlight() < benchConfig->windowBytes) {
+        size_t length = benchConfig->windowBytes - BytesInFlight();
+        if (length > PATTERN_CHUNK_SIZE) {
+            length = PATTERN_CHUNK_SIZE;
+        }
+        ssize_t bytesWritten = write(uartFd, &pattern[bytesSent & 0xFF], length);
+        if (bytesWritten < 0) {
+            if (errno != EAGAIN) {
+                Log_Debug("ERROR: Could not write pattern to UART: %s (%d).\n", strerror(errno),
+                          errno);
+            }
+            return;
+        }
+        bytesSent += (size_t)bytesWritten;
+        if ((size_t)bytesWritten < length) {
+            return;
+        }
+    }
+}
+
+/// <summary>
+///     Compares received bytes with the pattern. After a byte which does not match, skips ahead
+///     in the pattern if the byte is one which is in flight, because the bytes in between were
+///     lost; otherwise counts it as a corrupted byte in place of the expected one.
+/// </summary>
+static void CheckPattern(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t expectedByte = (uint8_t)(bytesReceived + bytesMissing);
+        if (data[i] != expectedByte) {
+            ++patternErrors;
+            uint8_t skipped = (uint8_t)(data[i] - expectedByte);
+            if (skipped < BytesInFlight()) {
+                bytesMissing += skipped;
+            }
+        }
+
+        if (BytesInFlight() > 0) {
+            ++bytesReceived;
+        }
+    }
+}
+
+static void UartEventHandler(EventData *eventData)
+{
+    for (;;) {
+        ssize_t bytesRead = read(uartFd, readBuffer, sizeof(readBuffer));
+        if (bytesRead <= 0) {
+            if (bytesRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log_Debug("ERROR: Could not read UART: %s (%d).\n", strerror(errno), errno);
+            }
+            break;
+        }
+
+        if (phase == BenchmarkPhase_Latency) {
+            // A late reply to a probe which timed out is ignored.
+            if (isProbeOutstanding && readBuffer[bytesRead - 1] == (uint8_t)probeIndex) {
+                uint64_t rttNs = ReadClockNs(CLOCK_MONOTONIC) - probeSentNs;
+                ++rttCount;
+                rttTotalNs += rttNs;
+                rttMinNs = rttNs < rttMinNs ? rttNs : rttMinNs;
+                rttMaxNs = rttNs > rttMaxNs ? rttNs : rttMaxNs;
+                FinishProbe();
+            }
+        } else {
+            CheckPattern(readBuffer, (size_t)bytesRead);
+            lastRxNs = ReadClockNs(CLOCK_MONOTONIC);
+        }
+    }
+
+    if (phase == BenchmarkPhase_Stream) {
+        FillWindow();
+    } else if (phase == BenchmarkPhase_Drain && BytesInFlight() == 0) {
+        FinishRate();
+    }
+}
+
+static void TickEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(tickTimerFd) != 0) {
+        return;
+    }
+
+    uint64_t nowNs = ReadClockNs(CLOCK_MONOTONIC);
+    switch (phase) {
+    case BenchmarkPhase_Latency:
+        if (isProbeOutstanding && nowNs - probeSentNs > PROBE_TIMEOUT_NS) {
+            ++probesLost;
+            FinishProbe();
+        }
+        break;
+
+    case BenchmarkPhase_Stream:
+        // If nothing has arrived for a while, the bytes in flight were lost, and the window is
+        // refilled so the stream carries on.
+        if (BytesInFlight() > 0 && nowNs - lastRxNs > stallTimeoutNs) {
+            bytesMissing += BytesInFlight();
+            lastRxNs = nowNs;
+            FillWindow();
+        }
+        if (nowNs - streamStartNs >= benchConfig->streamMs * 1000000ull) {
+            phase = BenchmarkPhase_Drain;
+        }
+        break;
+
+    case BenchmarkPhase_Drain:
+        if (BytesInFlight() == 0 || nowNs - lastRxNs > stallTimeoutNs) {
+            bytesMissing += BytesInFlight();
+            FinishRate();
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/// <summary>
+///     Logs the results for the current baud rate, and moves on to the next one.
+/// </summary>
+static void FinishRate(void)
+{
+    uint64_t cpuNs = ReadClockNs(CLOCK_THREAD_CPUTIME_ID) - streamStartCpuNs;
+    CloseUart();
+
+    // The stream ends when its last byte arrives, rather than when the drain timed out.
+    uint64_t elapsedNs = lastRxNs - streamStartNs;
+    uint64_t bytesPerSecond = elapsedNs > 0 ? bytesReceived * 1000000000ull / elapsedNs : 0;
+    // One byte takes ten bit times, with its start and stop bits.
+    unsigned int lineRateTenthsPercent = (unsigned int)(bytesPerSecond * 10 * 1000 / baudRate);
+
+    Log_Debug("%7u baud: %llu B/s, %u.%u%% of line rate\n", baudRate,
+              (unsigned long long)bytesPerSecond, lineRateTenthsPercent / 10,
+              lineRateTenthsPercent % 10);
+    Log_Debug("  sent %zu, received %zu, missing %zu, mismatched %zu\n", bytesSent,
+              bytesReceived, bytesMissing, patternErrors);
+    Log_Debug("  CPU %llu ns/byte, %llu%% busy\n",
+              (unsigned long long)(bytesReceived > 0 ? cpuNs / bytesReceived : 0),
+              (unsigned long long)(elapsedNs > 0 ? cpuNs * 100 / elapsedNs : 0));
+    if (rttCount > 0) {
+        Log_Debug("  round trip min %llu us, avg %llu us, max %llu us, %u of %u probes lost\n",
+                  (unsigned long long)(rttMinNs / 1000),
+                  (unsigned long long)(rttTotalNs / rttCount / 1000),
+                  (unsigned long long)(rttMaxNs / 1000), probesLost, benchConfig->probeCount);
+    } else {
+        Log_Debug("  round trip: %u of %u probes lost\n", probesLost, benchConfig->probeCount);
+    }
+
+    ++rateIndex;
+    StartNextRate();
+}
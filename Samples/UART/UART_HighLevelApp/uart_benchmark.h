@@ -0,0 +1,70 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <applibs/uart.h>
+
+/// <summary>
+///     Called on the event loop when every baud rate has been measured, after the benchmark
+///     has closed the UART.
+/// </summary>
+typedef void (*UartBenchmarkDoneHandler)(void);
+
+/// <summary>
+///     What to measure, for <see cref="UartBenchmark_Start" />.
+/// </summary>
+typedef struct {
+    /// <summary>UART to measure. Its TX pin must be looped back to its RX pin, and the
+    /// application must not have it open while the benchmark runs.</summary>
+    UART_Id uartId;
+    /// <summary>Baud rates to measure, in order. The array must remain valid until the
+    /// benchmark finishes.</summary>
+    const UART_BaudRate_Type *baudRates;
+    size_t baudRateCount;
+    /// <summary>How long the pattern is streamed at each baud rate, in milliseconds.</summary>
+    unsigned int streamMs;
+    /// <summary>Number of single bytes which are sent one at a time at each baud rate, to
+    /// measure the round-trip time.</summary>
+    unsigned int probeCount;
+    /// <summary>Most bytes of the pattern which are in flight at once.</summary>
+    size_t windowBytes;
+    /// <summary>Called when the benchmark finishes, or NULL.</summary>
+    UartBenchmarkDoneHandler doneHandler;
+} UartBenchmarkConfig;
+
+/// <summary>
+/// <para>Starts measuring a UART with a loopback connection at each of the supplied baud rates.
+/// The benchmark runs from the event loop, with its own timer.</para>
+/// <para>At each baud rate, the UART is opened, and single bytes are sent one at a time; the
+/// time until each is read back is the round-trip time. Then a counting pattern is streamed for
+/// the configured time, keeping no more than windowBytes in flight.</para>
+/// <para>The results for each baud rate are logged: the received bytes per second and the
+/// fraction of the line rate which they reach; the bytes which were missing from the pattern
+/// and the received bytes which did not match it; the CPU time of the event loop thread per
+/// byte; and the shortest, average and longest round-trip time. The UART driver does not report
+/// its receive counters to applications, so bytes which it dropped or overran are counted as
+/// missing.</para>
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor of the event loop.</param>
+/// <param name="config">What to measure. This must remain valid until the benchmark
+/// finishes.</param>
+/// <returns>0 on success, or -1 with errno set to EBUSY if the benchmark is already running,
+/// EINVAL if no baud rates were supplied, or the error from creating the timer.</returns>
+int UartBenchmark_Start(int epollFd, const UartBenchmarkConfig *config);
+
+/// <summary>
+///     Stops the benchmark if it is running, and closes the UART and timer. The done handler is
+///     not called.
+/// </summary>
+void UartBenchmark_Stop(void);
+
+/// <summary>
+///     Queries whether the benchmark is running.
+/// </summary>
+/// <returns>true from when <see cref="UartBenchmark_Start" /> succeeds until just before the
+/// done handler is called; false otherwise.</returns>
+bool UartBenchmark_IsRunning(void);
@@ -0,0 +1,177 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef CYCLE_PROFILER_H
+#define CYCLE_PROFILER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+
+/// <summary>Base address of the Data Watchpoint and Trace unit, ARM DDI 0403E.d SC1.8.7.</summary>
+static const uintptr_t DWT_BASE = 0xE0001000;
+
+/// <summary>Frequency of the core clock, which the cycle counter counts. Define this when
+/// compiling if the application changes the clock.</summary>
+#ifndef CYCLE_PROFILER_CPU_HZ
+#define CYCLE_PROFILER_CPU_HZ 197600000u
+#endif
+
+/// <summary>Number of recent measurements which are kept. This must be a power of two.</summary>
+#ifndef CYCLE_PROFILER_RING_SIZE
+#define CYCLE_PROFILER_RING_SIZE 32
+#endif
+
+/// <summary>
+/// <para>A piece of code which is measured, such as an interrupt handler. The application
+/// allocates these statically, and initializes them with <see cref="PROFILE_SITE_INIT" />.
+/// Other than that, the fields must only be read, by walking the list from
+/// <see cref="Profiler_FirstSite" />.</para>
+/// <para>The times are elapsed cycles, so they include any interrupts which preempted the
+/// code. The cycle counter wraps after 2^32 cycles, about 21 seconds, so longer times and
+/// intervals are not measured correctly.</para>
+/// </summary>
+typedef struct ProfileSite {
+    /// <summary>Name of the site, which is reported.</summary>
+    const char *name;
+    /// <summary>Number of measurements.</summary>
+    uint32_t count;
+    /// <summary>Shortest and longest measurement, and the sum of all of them.</summary>
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    /// <summary>Start of the last measurement.</summary>
+    uint32_t lastStartCycles;
+    /// <summary>Shortest and longest time from the start of one measurement to the start of
+    /// the next. For a periodic interrupt, the difference between them is its jitter.</summary>
+    uint32_t minIntervalCycles;
+    uint32_t maxIntervalCycles;
+    /// <summary>Next site in the list, in the order of their first measurements.</summary>
+    struct ProfileSite *next;
+    /// <summary>Whether the site is in the list.</summary>
+    bool isRegistered;
+} ProfileSite;
+
+/// <summary>
+/// Static initializer for a <see cref="ProfileSite" />.
+/// </summary>
+/// <param name="name_">Name of the site, which must remain valid.</param>
+#define PROFILE_SITE_INIT(name_)                                                       \
+    {                                                                                  \
+        .name = (name_), .minCycles = UINT32_MAX, .minIntervalCycles = UINT32_MAX,     \
+        .next = NULL, .isRegistered = false                                            \
+    }
+
+/// <summary>
+/// One recent measurement.
+/// </summary>
+typedef struct {
+    const ProfileSite *site;
+    uint32_t startCycles;
+    uint32_t cycles;
+} ProfileRecord;
+
+/// <summary>
+/// Line of text which <see cref="Profiler_Report" /> writes, without a line ending.
+/// </summary>
+typedef void (*ProfileWriteLine)(const char *line);
+
+/// <summary>
+/// Enable the DWT cycle counter, and reset it. Call this before any other function in this
+/// module.
+/// </summary>
+void Profiler_Init(void);
+
+/// <summary>
+/// Read the cycle counter, DWT_CYCCNT. This takes a few cycles, so it can be used in
+/// interrupt handlers.
+/// </summary>
+/// <returns>Number of core clock cycles since <see cref="Profiler_Init" />, modulo 2^32.
+/// </returns>
+static inline uint32_t Profiler_Now(void)
+{
+    return ReadReg32(DWT_BASE, 0x04);
+}
+
+/// <summary>
+/// <para>Record a measurement for a site, and add it to the ring of recent measurements. The
+/// site is added to the list of sites on its first measurement.</para>
+/// <para>This blocks interrupts for a few cycles while it updates the counts, so it can be
+/// called from interrupt handlers and from the main loop.</para>
+/// </summary>
+/// <param name="site">The site.</param>
+/// <param name="startCycles">Value of <see cref="Profiler_Now" /> when the code started.
+/// </param>
+/// <param name="endCycles">Value of <see cref="Profiler_Now" /> when it finished.</param>
+void Profiler_Record(ProfileSite *site, uint32_t startCycles, uint32_t endCycles);
+
+/// <summary>
+/// Record a measurement which ends now. See <see cref="Profiler_Record" />.
+/// </summary>
+/// <param name="site">The site.</param>
+/// <param name="startCycles">Value of <see cref="Profiler_Now" /> when the code started.
+/// </param>
+static inline void Profiler_Stop(ProfileSite *site, uint32_t startCycles)
+{
+    Profiler_Record(site, startCycles, Profiler_Now());
+}
+
+/// <summary>
+/// Get the first site which has been measured. The others follow it through
+/// <see cref="ProfileSite.next" />.
+/// </summary>
+/// <returns>The first site, or NULL if none has been measured.</returns>
+const ProfileSite *Profiler_FirstSite(void);
+
+/// <summary>
+/// Get the number of sites which have been measured.
+/// </summary>
+size_t Profiler_GetSiteCount(void);
+
+/// <summary>
+/// Copy a site, with interrupts blocked, so that its counts are consistent with each other.
+/// </summary>
+/// <param name="index">Index of the site, in the order of their first measurements.</param>
+/// <param name="site">Receives the site.</param>
+/// <returns>true on success; false if index is not less than
+/// <see cref="Profiler_GetSiteCount" />.</returns>
+bool Profiler_GetSite(size_t index, ProfileSite *site);
+
+/// <summary>
+/// Copy the most recent measurements, oldest first.
+/// </summary>
+/// <param name="records">Receives the measurements.</param>
+/// <param name="maxRecords">Size of the records array.</param>
+/// <returns>Number of measurements which were copied, which is at most
+/// CYCLE_PROFILER_RING_SIZE.</returns>
+size_t Profiler_GetRecent(ProfileRecord *records, size_t maxRecords);
+
+/// <summary>
+/// Clear the counts of every site, and the recent measurements. The sites stay in the list.
+/// </summary>
+void Profiler_Reset(void);
+
+/// <summary>
+/// Convert cycles to tenths of a microsecond, at CYCLE_PROFILER_CPU_HZ.
+/// </summary>
+static inline uint32_t Profiler_CyclesToTenthsUs(uint64_t cycles)
+{
+    return (uint32_t)(cycles * 10000000u / CYCLE_PROFILER_CPU_HZ);
+}
+
+/// <summary>
+/// <para>Format the counts of each site, and the most recent measurements, as lines of text.
+/// The recent measurements are copied first, so they do not include any which are made while
+/// the lines are written.
+/// Times are reported in microseconds, with one decimal place, and minimum and maximum
+/// intervals are reported for sites which have been measured more than once.</para>
+/// <para>Call this from the main loop. Each site is copied with interrupts blocked, so its
+/// counts are consistent with each other, but the sites are copied one at a time.</para>
+/// </summary>
+/// <param name="writeLine">Called with each line.</param>
+/// <param name="maxRecent">Number of recent measurements to include.</param>
+void Profiler_Report(ProfileWriteLine writeLine, size_t maxRecent);
+
+#endif // #ifndef CYCLE_PROFILER_H
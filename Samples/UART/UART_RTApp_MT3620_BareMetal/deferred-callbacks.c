@@ -0,0 +1,165 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+
+#include "cycle-profiler.h"
+#include "deferred-callbacks.h"
+
+// Each priority has an intrusive multiple-producer, single-consumer FIFO. Interrupt handlers
+// append to the tail with an atomic exchange, and only the main loop removes from the head.
+// The queue always holds a stub node, so the tail is never NULL and appending does not need
+// to update the head.
+typedef struct {
+    // Only accessed from the main loop.
+    DeferredCallback *head;
+    DeferredCallback *volatile tail;
+    DeferredCallback stub;
+} DeferredQueue;
+
+static DeferredQueue queues[DEFERRED_PRIORITY_COUNT] = {
+    [DeferredPriority_High] = {.head = &queues[DeferredPriority_High].stub,
+                               .tail = &queues[DeferredPriority_High].stub},
+    [DeferredPriority_Normal] = {.head = &queues[DeferredPriority_Normal].stub,
+                                 .tail = &queues[DeferredPriority_Normal].stub},
+    [DeferredPriority_Low] = {.head = &queues[DeferredPriority_Low].stub,
+                              .tail = &queues[DeferredPriority_Low].stub}};
+
+// Cycles spent in wfi, which is only updated by the main loop.
+static uint32_t idleCycles = 0;
+
+// Atomically replace *location with newValue, and return the previous value. The M4 only has
+// one core, and an exception entry or return clears the exclusive monitor, so STREX fails if
+// this is preempted between the LDREX and STREX and the loop retries.
+static inline uintptr_t AtomicExchange(volatile uintptr_t *location, uintptr_t newValue)
+{
+    uintptr_t prevValue;
+    uint32_t failed;
+    do {
+        __asm__ volatile("ldrex %0, [%1]" : "=r"(prevValue) : "r"(location) : "memory");
+        __asm__ volatile("strex %0, %2, [%1]"
+                         : "=&r"(failed)
+                         : "r"(location), "r"(newValue)
+                         : "memory");
+    } while (failed);
+
+    return prevValue;
+}
+
+static void Push(DeferredQueue *queue, DeferredCallback *node)
+{
+    node->next = NULL;
+    DeferredCallback *prev = (DeferredCallback *)AtomicExchange(
+        (volatile uintptr_t *)&queue->tail, (uintptr_t)node);
+    // Between the exchange and this store, the queue is briefly split. If a higher-priority
+    // interrupt appends in between, its node is linked after this one, so order is preserved.
+    // The main loop cannot run until both have returned.
+    prev->next = node;
+}
+
+// Remove the oldest node from the queue, or return NULL if it is empty.
+static DeferredCallback *Pop(DeferredQueue *queue)
+{
+    DeferredCallback *head = queue->head;
+    DeferredCallback *next = head->next;
+
+    if (head == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+
+        queue->head = next;
+        head = next;
+        next = next->next;
+    }
+
+    if (next != NULL) {
+        queue->head = next;
+        return head;
+    }
+
+    // head is the last node. It can only be removed once the stub has been appended behind
+    // it, because the tail must not be left pointing at a removed node.
+    if (head != queue->tail) {
+        return NULL;
+    }
+
+    Push(queue, &queue->stub);
+    next = head->next;
+    if (next != NULL) {
+        queue->head = next;
+        return head;
+    }
+
+    return NULL;
+}
+
+static bool IsEmpty(const DeferredQueue *queue)
+{
+    return queue->head == &queue->stub && queue->stub.next == NULL;
+}
+
+bool Deferred_Enqueue(DeferredCallback *node)
+{
+    if (AtomicExchange(&node->isQueued, 1) != 0) {
+        return false;
+    }
+
+    node->enqueuedCycles = Profiler_Now();
+    Push(&queues[node->priority], node);
+    return true;
+}
+
+void Deferred_InvokeCallbacks(void)
+{
+    static ProfileSite waitProfileSite = PROFILE_SITE_INIT("deferred wait");
+    static ProfileSite runProfileSite = PROFILE_SITE_INIT("deferred run");
+
+    for (;;) {
+        // Take the next callback from the highest-priority queue which has one, so that a
+        // higher-priority callback which is queued by an interrupt runs next.
+        DeferredCallback *node = NULL;
+        for (int priority = 0; priority < DEFERRED_PRIORITY_COUNT && node == NULL; ++priority) {
+            node = Pop(&queues[priority]);
+        }
+
+        if (node == NULL) {
+            return;
+        }
+
+        // Clear the flag before invoking the callback, so an interrupt which occurs while it
+        // is running queues it again.
+        uint32_t enqueuedCycles = node->enqueuedCycles;
+        __atomic_store_n(&node->isQueued, 0, __ATOMIC_RELEASE);
+
+        uint32_t startCycles = Profiler_Now();
+        Profiler_Record(&waitProfileSite, enqueuedCycles, startCycles);
+        node->callback();
+        Profiler_Stop(&runProfileSite, startCycles);
+    }
+}
+
+void Deferred_WaitForCallbacks(void)
+{
+    // PRIMASK holds off any interrupt which is raised after the check, but a pending
+    // interrupt still wakes the core from wfi.
+    __asm__("cpsid i");
+
+    bool isEmpty = true;
+    for (int priority = 0; priority < DEFERRED_PRIORITY_COUNT; ++priority) {
+        isEmpty = isEmpty && IsEmpty(&queues[priority]);
+    }
+
+    if (isEmpty) {
+        uint32_t startCycles = Profiler_Now();
+        __asm__("wfi");
+        idleCycles += Profiler_Now() - startCycles;
+    }
+
+    __asm__("cpsie i");
+}
+
+uint32_t Deferred_GetIdleCycles(void)
+{
+    return idleCycles;
+}
@@ -0,0 +1,94 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef DEFERRED_CALLBACKS_H
+#define DEFERRED_CALLBACKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+
+/// <summary>
+/// Priority of a deferred callback. Queued callbacks with a higher priority are invoked before
+/// those with a lower priority. Callbacks with the same priority are invoked in the order they
+/// were queued.
+/// </summary>
+typedef enum {
+    /// <summary>Invoked before any other queued callbacks.</summary>
+    DeferredPriority_High = 0,
+    /// <summary>Default priority.</summary>
+    DeferredPriority_Normal = 1,
+    /// <summary>Invoked only when no other callbacks are queued.</summary>
+    DeferredPriority_Low = 2
+} DeferredPriority;
+
+/// <summary>Number of values in <see cref="DeferredPriority" />.</summary>
+#define DEFERRED_PRIORITY_COUNT 3
+
+/// <summary>
+/// <para>Work which an interrupt handler defers to the main loop. The application allocates
+/// these, typically statically, and initializes them with
+/// <see cref="DEFERRED_CALLBACK_INIT" />. Other than that, the fields must not be accessed
+/// directly.</para>
+/// </summary>
+typedef struct DeferredCallback {
+    /// <summary>Next callback in the queue.</summary>
+    struct DeferredCallback *volatile next;
+    /// <summary>Function which is invoked from <see cref="Deferred_InvokeCallbacks" />.</summary>
+    Callback callback;
+    /// <summary>Queue which the callback is added to.</summary>
+    DeferredPriority priority;
+    /// <summary>Non-zero while the callback is queued.</summary>
+    volatile uintptr_t isQueued;
+    /// <summary>Cycle count when the callback was queued, which is used to measure how long
+    /// it waited.</summary>
+    uint32_t enqueuedCycles;
+} DeferredCallback;
+
+/// <summary>
+/// Static initializer for a <see cref="DeferredCallback" />.
+/// </summary>
+/// <param name="callback_">Function to invoke from the main loop.</param>
+/// <param name="priority_">A <see cref="DeferredPriority" /> value.</param>
+#define DEFERRED_CALLBACK_INIT(callback_, priority_)                                \
+    {.next = NULL, .callback = (callback_), .priority = (priority_), .isQueued = 0, \
+     .enqueuedCycles = 0}
+
+/// <summary>
+/// <para>Queue a callback, to be invoked by <see cref="Deferred_InvokeCallbacks" />. This
+/// function is typically called from an interrupt handler.</para>
+/// <para>It does not block interrupts. It uses LDREX and STREX, so it can be called from
+/// interrupt handlers of any priority, which preempt each other, and from the main loop.</para>
+/// </summary>
+/// <param name="node">Callback to queue.</param>
+/// <returns>true if the callback was queued; false if it was already queued and has not been
+/// invoked yet. The callback is invoked once, however many times it is queued before then.
+/// </returns>
+bool Deferred_Enqueue(DeferredCallback *node);
+
+/// <summary>
+/// <para>Invoke queued callbacks, in order of priority and then in the order they were queued,
+/// until none are queued. A callback can queue itself, or other callbacks. Call this function
+/// only from the main loop.</para>
+/// <para>The time from queuing each callback until it is invoked is measured as the
+/// "deferred wait" profile site, and the time it runs as "deferred run".</para>
+/// </summary>
+void Deferred_InvokeCallbacks(void);
+
+/// <summary>
+/// Sleep until an interrupt occurs, unless a callback is already queued. Call this function
+/// only from the main loop, before <see cref="Deferred_InvokeCallbacks" />.
+/// </summary>
+void Deferred_WaitForCallbacks(void);
+
+/// <summary>
+/// <para>Get the number of cycles which <see cref="Deferred_WaitForCallbacks" /> has spent
+/// asleep. The interrupt handlers which woke the core are not included, because they run after
+/// it wakes.</para>
+/// <para>Subtract two readings to find how long the core slept in between, and so how busy it
+/// was. The count wraps after 2^32 cycles, about 21 seconds.</para>
+/// </summary>
+uint32_t Deferred_GetIdleCycles(void);
+
+#endif // #ifndef DEFERRED_CALLBACKS_H
@@ -0,0 +1,324 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdbool.h>
+
+#include "format.h"
+
+// A conversion specification, such as "%-8s" or "%04x".
+typedef struct {
+    bool leftJustify;
+    bool zeroPad;
+    bool widthFromArgs;
+    bool precisionFromArgs;
+    // Zero if the specification does not have a width.
+    int width;
+    // Negative if the specification does not have a precision.
+    int precision;
+    // The conversion character, such as 'd' or 's'. Zero if the format string ended early.
+    char conversion;
+} Conversion;
+
+// The text which has been formatted so far. The last byte of the buffer is reserved for the
+// null terminator.
+typedef struct {
+    char *buffer;
+    size_t bufferSize;
+    size_t length;
+} Output;
+
+// Parses the conversion specification which follows a '%', and returns a pointer to the
+// character after it.
+static const char *ParseConversion(const char *p, Conversion *conv)
+{
+    *conv = (Conversion){.precision = -1};
+
+    for (;; ++p) {
+        if (*p == '-') {
+            conv->leftJustify = true;
+        } else if (*p == '0') {
+            conv->zeroPad = true;
+        } else {
+            break;
+        }
+    }
+
+    if (*p == '*') {
+        conv->widthFromArgs = true;
+        ++p;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            conv->width = conv->width * 10 + (*p++ - '0');
+        }
+    }
+
+    if (*p == '.') {
+        ++p;
+        conv->precision = 0;
+        if (*p == '*') {
+            conv->precisionFromArgs = true;
+            ++p;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                conv->precision = conv->precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+
+    // All of the integer types which the length modifiers select have 32 bits.
+    while (*p == 'h' || *p == 'l' || *p == 'z') {
+        ++p;
+    }
+
+    conv->conversion = *p;
+    return (*p != '\0') ? p + 1 : p;
+}
+
+static void PutChar(Output *out, char c)
+{
+    if (out->length + 1 < out->bufferSize) {
+        out->buffer[out->length++] = c;
+    }
+}
+
+static void PutRepeated(Output *out, char c, int count)
+{
+    while (count-- > 0) {
+        PutChar(out, c);
+    }
+}
+
+static void PutText(Output *out, const char *text, size_t length, const Conversion *conv)
+{
+    int padding = conv->width - (int)length;
+
+    if (!conv->leftJustify) {
+        PutRepeated(out, ' ', padding);
+    }
+    for (size_t i = 0; i < length; ++i) {
+        PutChar(out, text[i]);
+    }
+    if (conv->leftJustify) {
+        PutRepeated(out, ' ', padding);
+    }
+}
+
+static void PutNumber(Output *out, uint32_t value, bool isNegative, uint32_t base,
+                      const char *digits, const Conversion *conv)
+{
+    // Generate the digits in reverse order. The largest value has ten decimal digits.
+    char text[10];
+    int digitCount = 0;
+    do {
+        text[digitCount++] = digits[value % base];
+        value /= base;
+    } while (value);
+
+    int padding = conv->width - digitCount - (isNegative ? 1 : 0);
+
+    if (!conv->leftJustify && !conv->zeroPad) {
+        PutRepeated(out, ' ', padding);
+    }
+    if (isNegative) {
+        PutChar(out, '-');
+    }
+    if (!conv->leftJustify && conv->zeroPad) {
+        PutRepeated(out, '0', padding);
+    }
+    while (digitCount) {
+        PutChar(out, text[--digitCount]);
+    }
+    if (conv->leftJustify) {
+        PutRepeated(out, ' ', padding);
+    }
+}
+
+// Returns the length of the string, up to maxLength, without reading beyond maxLength bytes.
+static size_t BoundedStrlen(const char *s, size_t maxLength)
+{
+    size_t length = 0;
+    while (length < maxLength && s[length] != '\0') {
+        ++length;
+    }
+    return length;
+}
+
+size_t Format_Vsnprintf(char *buffer, size_t bufferSize, const char *format, va_list args)
+{
+    static const char lowerDigits[] = "0123456789abcdef";
+    static const char upperDigits[] = "0123456789ABCDEF";
+
+    if (bufferSize == 0) {
+        return 0;
+    }
+
+    Output out = {.buffer = buffer, .bufferSize = bufferSize, .length = 0};
+
+    const char *p = format;
+    while (*p) {
+        if (*p != '%') {
+            PutChar(&out, *p++);
+            continue;
+        }
+
+        Conversion conv;
+        p = ParseConversion(p + 1, &conv);
+
+        if (conv.widthFromArgs) {
+            conv.width = va_arg(args, int);
+            if (conv.width < 0) {
+                conv.leftJustify = true;
+                conv.width = -conv.width;
+            }
+        }
+        if (conv.precisionFromArgs) {
+            conv.precision = va_arg(args, int);
+        }
+
+        switch (conv.conversion) {
+        case 'd':
+        case 'i': {
+            int value = va_arg(args, int);
+            // Negate as an unsigned value, so INT_MIN does not overflow.
+            uint32_t magnitude = (value < 0) ? 0U - (uint32_t)value : (uint32_t)value;
+            PutNumber(&out, magnitude, value < 0, 10, lowerDigits, &conv);
+        } break;
+
+        case 'u':
+            PutNumber(&out, va_arg(args, unsigned int), false, 10, lowerDigits, &conv);
+            break;
+
+        case 'x':
+            PutNumber(&out, va_arg(args, unsigned int), false, 16, lowerDigits, &conv);
+            break;
+
+        case 'X':
+            PutNumber(&out, va_arg(args, unsigned int), false, 16, upperDigits, &conv);
+            break;
+
+        case 'p': {
+            const Conversion pointerConv = {.zeroPad = true, .width = 8};
+            PutChar(&out, '0');
+            PutChar(&out, 'x');
+            PutNumber(&out, (uint32_t)(uintptr_t)va_arg(args, void *), false, 16, lowerDigits,
+                      &pointerConv);
+        } break;
+
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            PutText(&out, &c, 1, &conv);
+        } break;
+
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            size_t maxLength = (conv.precision >= 0) ? (size_t)conv.precision : SIZE_MAX;
+            PutText(&out, s, BoundedStrlen(s, maxLength), &conv);
+        } break;
+
+        case '%':
+            PutChar(&out, '%');
+            break;
+
+        case '\0':
+            break;
+
+        default:
+            // Write unsupported conversions as they appear in the format string.
+            PutChar(&out, '%');
+            PutChar(&out, conv.conversion);
+            break;
+        }
+    }
+
+    buffer[out.length] = '\0';
+    return out.length;
+}
+
+size_t Format_Snprintf(char *buffer, size_t bufferSize, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t length = Format_Vsnprintf(buffer, bufferSize, format, args);
+    va_end(args);
+    return length;
+}
+
+// Appends a 32-bit little-endian value, if it fits in the buffer.
+static bool EncodeWord(uint8_t *buffer, size_t bufferSize, size_t *length, uint32_t value)
+{
+    if (bufferSize - *length < sizeof(value)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(value); ++i) {
+        buffer[(*length)++] = (uint8_t)(value >> (8 * i));
+    }
+    return true;
+}
+
+size_t Format_EncodeArgs(uint8_t *buffer, size_t bufferSize, const char *format, va_list args)
+{
+    size_t length = 0;
+
+    const char *p = format;
+    while (*p) {
+        if (*p++ != '%') {
+            continue;
+        }
+
+        Conversion conv;
+        p = ParseConversion(p, &conv);
+
+        if (conv.widthFromArgs &&
+            !EncodeWord(buffer, bufferSize, &length, (uint32_t)va_arg(args, int))) {
+            break;
+        }
+        if (conv.precisionFromArgs) {
+            conv.precision = va_arg(args, int);
+            if (!EncodeWord(buffer, bufferSize, &length, (uint32_t)conv.precision)) {
+                break;
+            }
+        }
+
+        bool encoded = true;
+        switch (conv.conversion) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+            encoded = EncodeWord(buffer, bufferSize, &length, va_arg(args, unsigned int));
+            break;
+
+        case 'p':
+            encoded = EncodeWord(buffer, bufferSize, &length,
+                                 (uint32_t)(uintptr_t)va_arg(args, void *));
+            break;
+
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            size_t maxLength = (conv.precision >= 0 && conv.precision < 255)
+                                   ? (size_t)conv.precision
+                                   : 255;
+            size_t sLength = BoundedStrlen(s, maxLength);
+            encoded = (bufferSize - length >= 1 + sLength);
+            if (encoded) {
+                buffer[length++] = (uint8_t)sLength;
+                __builtin_memcpy(&buffer[length], s, sLength);
+                length += sLength;
+            }
+        } break;
+
+        default:
+            // '%%' and unsupported conversions do not consume an argument.
+            break;
+        }
+
+        if (!encoded) {
+            break;
+        }
+    }
+
+    return length;
+}
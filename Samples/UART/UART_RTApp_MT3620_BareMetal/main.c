@@ -6,15 +6,19 @@
 #include <stdint.h>
 
 #include "mt3620-baremetal.h"
+#include "cycle-profiler.h"
+#include "deferred-callbacks.h"
 #include "mt3620-timer.h"
 #include "mt3620-gpio.h"
 #include "mt3620-uart.h"
+#include "uart-benchmark.h"
 
 extern uint32_t StackTop; // &StackTop == end of TCM
 
 _Noreturn static void DefaultExceptionHandler(void);
 
 static const int buttonAGpio = 12;
+static const int buttonBGpio = 13;
 static const int buttonPressCheckPeriodMs = 10;
 static void HandleButtonTimerIrq(void);
 static void HandleButtonTimerIrqDeferred(void);
@@ -22,13 +26,46 @@ static void HandleButtonTimerIrqDeferred(void);
 static void HandleUartIsu0RxIrq(void);
 static void HandleUartIsu0RxIrqDeferred(void);
 
-typedef struct CallbackNode {
-    bool enqueued;
-    struct CallbackNode *next;
-    Callback cb;
-} CallbackNode;
-
-static void EnqueueCallback(CallbackNode *node);
+// ISU0 runs in block mode, with larger buffers than Uart_Init provides, so that it can keep up
+// with a fast link.
+static uint8_t uartIsu0TxBuffer[1024] SYSRAM_BSS;
+static uint8_t uartIsu0RxBuffer[1024] SYSRAM_BSS;
+
+// The debug UART has a larger transmit buffer than Uart_Init provides, so that it can hold the
+// whole profile report.
+static uint8_t uartDebugTxBuffer[2048] SYSRAM_BSS;
+static uint8_t uartDebugRxBuffer[32];
+
+// Number of recent measurements which the profile report includes.
+#define PROFILE_RECENT_RECORDS 8
+
+static const UartBlockModeConfig uartIsu0Config = {.txBuffer = uartIsu0TxBuffer,
+                                                    .txBufferSize = sizeof(uartIsu0TxBuffer),
+                                                    .rxBuffer = uartIsu0RxBuffer,
+                                                    .rxBufferSize = sizeof(uartIsu0RxBuffer),
+                                                    .rxCallback = HandleUartIsu0RxIrq,
+                                                    .baudRate = 115200};
+
+#if defined(UART_BENCHMARK)
+// In the benchmark build, button A measures ISU0 at each of these baud rates, and the results
+// are written to the debug UART.
+static const uint32_t benchmarkBaudRates[] = {115200,  230400,  460800, 921600,
+                                              1500000, 2000000, 3000000};
+static void WriteProfileLine(const char *line);
+static void HandleBenchmarkDone(void);
+static const UartBenchmarkConfig benchmarkConfig = {
+    .id = UartIsu0,
+    .txBuffer = uartIsu0TxBuffer,
+    .txBufferSize = sizeof(uartIsu0TxBuffer),
+    .rxBuffer = uartIsu0RxBuffer,
+    .rxBufferSize = sizeof(uartIsu0RxBuffer),
+    .baudRates = benchmarkBaudRates,
+    .baudRateCount = sizeof(benchmarkBaudRates) / sizeof(benchmarkBaudRates[0]),
+    .streamMs = 2000,
+    .probeCount = 16,
+    .writeLine = WriteProfileLine,
+    .doneCallback = HandleBenchmarkDone};
+#endif
 
 static _Noreturn void RTCoreMain(void);
 
@@ -73,10 +110,27 @@ static _Noreturn void DefaultExceptionHandler(void)
 
 static void HandleButtonTimerIrq(void)
 {
-    static CallbackNode cbn = {.enqueued = false, .cb = HandleButtonTimerIrqDeferred};
-    EnqueueCallback(&cbn);
+    static DeferredCallback cbn =
+        DEFERRED_CALLBACK_INIT(HandleButtonTimerIrqDeferred, DeferredPriority_Normal);
+    Deferred_Enqueue(&cbn);
+}
+
+static void WriteProfileLine(const char *line)
+{
+    Uart_EnqueueString(UartCM4Debug, line);
+    Uart_EnqueueString(UartCM4Debug, "\r\n");
 }
 
+#if defined(UART_BENCHMARK)
+static void HandleBenchmarkDone(void)
+{
+    // Go back to the sample's own receive callback and baud rate.
+    __asm__("cpsid i");
+    Uart_InitBlockMode(UartIsu0, &uartIsu0Config);
+    __asm__("cpsie i");
+}
+#endif
+
 static void HandleButtonTimerIrqDeferred(void)
 {
     // Assume initial state is high, i.e. button not pressed.
@@ -87,70 +141,65 @@ static void HandleButtonTimerIrqDeferred(void)
     if (newState != prevState) {
         bool pressed = !newState;
         if (pressed) {
+#if defined(UART_BENCHMARK)
+            if (UartBenchmark_Start(&benchmarkConfig) != 0) {
+                Uart_EnqueueString(UartCM4Debug, "UART benchmark is already running.\r\n");
+            }
+#else
             Uart_EnqueueString(UartIsu0, "RTCore: Hello world!\r\n");
+#endif
         }
 
         prevState = newState;
     }
 
+    // Button B writes the timing of the interrupt handlers and deferred callbacks.
+    static bool prevStateB = true;
+    bool newStateB;
+    Mt3620_Gpio_Read(buttonBGpio, &newStateB);
+
+    if (newStateB != prevStateB) {
+        bool pressed = !newStateB;
+        if (pressed) {
+            Profiler_Report(WriteProfileLine, PROFILE_RECENT_RECORDS);
+        }
+
+        prevStateB = newStateB;
+    }
+
     Gpt_LaunchTimerMs(TimerGpt1, buttonPressCheckPeriodMs, HandleButtonTimerIrq);
 }
 
 static void HandleUartIsu0RxIrq(void)
 {
-    static CallbackNode cbn = {.enqueued = false, .cb = HandleUartIsu0RxIrqDeferred};
-    EnqueueCallback(&cbn);
+    // Run before other deferred work, so the receive buffer is emptied quickly.
+    static DeferredCallback cbn =
+        DEFERRED_CALLBACK_INIT(HandleUartIsu0RxIrqDeferred, DeferredPriority_High);
+    Deferred_Enqueue(&cbn);
 }
 
 static void HandleUartIsu0RxIrqDeferred(void)
 {
-    uint8_t buffer[32];
-
-    for (;;) {
-        size_t availBytes = Uart_DequeueData(UartIsu0, buffer, sizeof(buffer));
-
-        if (availBytes == 0) {
-            return;
-        }
-
-        Uart_EnqueueString(UartCM4Debug, "UART received ");
-        Uart_EnqueueIntegerAsString(UartCM4Debug, availBytes);
-        Uart_EnqueueString(UartCM4Debug, " bytes: \'");
-        Uart_EnqueueData(UartCM4Debug, buffer, availBytes);
+    // Copy the received data straight from the receive buffer to the debug UART.
+    UartRxSpan spans[2];
+    size_t availBytes = Uart_PeekRxData(UartIsu0, spans);
+    if (availBytes > 0) {
+        Uart_EnqueueFormat(UartCM4Debug, "UART received %u bytes: \'", (unsigned)availBytes);
+        Uart_EnqueueData(UartCM4Debug, spans[0].data, spans[0].length);
+        Uart_EnqueueData(UartCM4Debug, spans[1].data, spans[1].length);
         Uart_EnqueueString(UartCM4Debug, "\'.\r\n");
+        Uart_ConsumeRxData(UartIsu0, availBytes);
     }
-}
 
-static CallbackNode *volatile callbacks = NULL;
-
-static void EnqueueCallback(CallbackNode *node)
-{
-    uint32_t prevBasePri = BlockIrqs();
-    if (!node->enqueued) {
-        CallbackNode *prevHead = callbacks;
-        node->enqueued = true;
-        callbacks = node;
-        node->next = prevHead;
+    // Report any data which was lost because the receive buffer was full.
+    static uint32_t prevDroppedBytes = 0;
+    UartStats stats;
+    Uart_GetStats(UartIsu0, &stats);
+    if (stats.rxDroppedBytes != prevDroppedBytes) {
+        Uart_EnqueueFormat(UartCM4Debug, "UART dropped %u bytes.\r\n",
+                           (unsigned)(stats.rxDroppedBytes - prevDroppedBytes));
+        prevDroppedBytes = stats.rxDroppedBytes;
     }
-    RestoreIrqs(prevBasePri);
-}
-
-static void InvokeCallbacks(void)
-{
-    CallbackNode *node;
-    do {
-        uint32_t prevBasePri = BlockIrqs();
-        node = callbacks;
-        if (node) {
-            node->enqueued = false;
-            callbacks = node->next;
-        }
-        RestoreIrqs(prevBasePri);
-
-        if (node) {
-            (*node->cb)();
-        }
-    } while (node);
 }
 
 static _Noreturn void RTCoreMain(void)
@@ -158,28 +207,44 @@ static _Noreturn void RTCoreMain(void)
     // SCB->VTOR = ExceptionVectorTable
     WriteReg32(SCB_BASE, 0x08, (uint32_t)ExceptionVectorTable);
 
-    Uart_Init(UartCM4Debug, NULL);
+    Profiler_Init();
+
+    static const UartBlockModeConfig uartDebugConfig = {.txBuffer = uartDebugTxBuffer,
+                                                         .txBufferSize = sizeof(uartDebugTxBuffer),
+                                                         .rxBuffer = uartDebugRxBuffer,
+                                                         .rxBufferSize = sizeof(uartDebugRxBuffer),
+                                                         .rxCallback = NULL,
+                                                         .baudRate = 115200};
+    Uart_InitBlockMode(UartCM4Debug, &uartDebugConfig);
     Uart_EnqueueString(UartCM4Debug, "--------------------------------\r\n");
     Uart_EnqueueString(UartCM4Debug, "UART_RTApp_MT3620_BareMetal\r\n");
     Uart_EnqueueString(UartCM4Debug, "App built on: " __DATE__ " " __TIME__ "\r\n");
+#if defined(UART_BENCHMARK)
+    Uart_EnqueueString(
+        UartCM4Debug,
+        "Install a loopback header on ISU0, and press button A to run the benchmark.\r\n");
+#else
     Uart_EnqueueString(
         UartCM4Debug,
         "Install a loopback header on ISU0, and press button A to send a message.\r\n");
+#endif
+    Uart_EnqueueString(UartCM4Debug, "Press button B to show the interrupt timing.\r\n");
 
-    Uart_Init(UartIsu0, HandleUartIsu0RxIrq);
+    Uart_InitBlockMode(UartIsu0, &uartIsu0Config);
 
-    // Block includes buttonAGpio, GPIO12
+    // Block includes buttonAGpio, GPIO12, and buttonBGpio, GPIO13
     static const GpioBlock grp3 = {
         .baseAddr = 0x38040000, .type = GpioBlock_GRP, .firstPin = 12, .pinCount = 4};
 
     Mt3620_Gpio_AddBlock(&grp3);
     Mt3620_Gpio_ConfigurePinForInput(buttonAGpio);
+    Mt3620_Gpio_ConfigurePinForInput(buttonBGpio);
 
     Gpt_Init();
     Gpt_LaunchTimerMs(TimerGpt1, buttonPressCheckPeriodMs, HandleButtonTimerIrq);
 
     for (;;) {
-        __asm__("wfi");
-        InvokeCallbacks();
+        Deferred_WaitForCallbacks();
+        Deferred_InvokeCallbacks();
     }
 }
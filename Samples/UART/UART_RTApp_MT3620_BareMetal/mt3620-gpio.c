@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "mt3620-baremetal.h"
 #include "mt3620-gpio.h"
 
 // The location of the DIN register depends on the type of block.
@@ -44,6 +45,14 @@ typedef struct {
 #define GPIO_COUNT 76
 static PinInfo pins[GPIO_COUNT];
 
+// Each EINT has a control register, EINT_CON, at EINT_BASE + 4 * n.
+static const uintptr_t EINT_BASE = 0x21000000;
+static const uint32_t EINT_CON_EN = 0x1;   // EINT_CON[0] = 1 -> enable interrupt
+static const uint32_t EINT_CON_POL = 0x2;  // EINT_CON[1] = 1 -> rising edge, 0 -> falling
+static const uint32_t EINT_CON_DUAL = 0x4; // EINT_CON[2] = 1 -> both edges
+
+static volatile GpioEdgeCallback edgeCallbacks[GPIO_EINT_COUNT];
+
 // ---- register access ----
 
 // Multiple GPIO pins are controlled by a single register. This function
@@ -94,15 +103,8 @@ static uint32_t Gpio_ReadReg32(const GpioBlock *block, GpioReg reg)
 
 // ---- pin configuration / status ----
 
-static int ConfigurePin(int pin, bool asInput)
+static void ConfigurePins(const GpioBlock *block, uint32_t pinMask, bool asInput)
 {
-    PinInfo *pinInfo;
-    uint32_t pinMask;
-    const GpioBlock *block = PinIdToBlock(pin, &pinInfo, &pinMask);
-    if (block == NULL) {
-        return -ENOENT;
-    }
-
     Gpio_WriteReg32(block, GpioRegOeReset, pinMask);
     Gpio_WriteReg32(block, GpioRegIesReset, pinMask);
 
@@ -111,7 +113,18 @@ static int ConfigurePin(int pin, bool asInput)
     } else {
         Gpio_WriteReg32(block, GpioRegOeSet, pinMask);
     }
+}
 
+static int ConfigurePin(int pin, bool asInput)
+{
+    PinInfo *pinInfo;
+    uint32_t pinMask;
+    const GpioBlock *block = PinIdToBlock(pin, &pinInfo, &pinMask);
+    if (block == NULL) {
+        return -ENOENT;
+    }
+
+    ConfigurePins(block, pinMask, asInput);
     return 0;
 }
 
@@ -154,9 +167,111 @@ int Mt3620_Gpio_Read(int pin, bool *state)
     return 0;
 }
 
+// ---- ports ----
+
+int Mt3620_Gpio_OpenPort(const int *pinList, size_t pinCount, GpioPort *port)
+{
+    if (pinCount == 0) {
+        return -EINVAL;
+    }
+
+    const GpioBlock *portBlock = NULL;
+    uint32_t portMask = 0;
+    for (size_t i = 0; i < pinCount; ++i) {
+        uint32_t pinMask;
+        const GpioBlock *block = PinIdToBlock(pinList[i], NULL, &pinMask);
+        if (block == NULL) {
+            return -ENOENT;
+        }
+        if (portBlock != NULL && block != portBlock) {
+            return -EINVAL;
+        }
+
+        portBlock = block;
+        portMask |= pinMask;
+    }
+
+    port->block = portBlock;
+    port->mask = portMask;
+    port->doutSet = BlockRegToPtr32(portBlock, GpioRegDoutSet);
+    port->doutReset = BlockRegToPtr32(portBlock, GpioRegDoutReset);
+    port->din = BlockRegToPtr32(portBlock, blockTypes[portBlock->type].dinReg);
+    return 0;
+}
+
+void Mt3620_Gpio_ConfigurePortForOutput(const GpioPort *port)
+{
+    ConfigurePins(port->block, port->mask, /* asInput */ false);
+}
+
+void Mt3620_Gpio_ConfigurePortForInput(const GpioPort *port)
+{
+    ConfigurePins(port->block, port->mask, /* asInput */ true);
+}
+
+// ---- edge interrupts ----
+
+int Mt3620_Gpio_EnableEdgeInterrupt(int pin, GpioEdge edge, GpioEdgeCallback callback)
+{
+    if (pin < 0 || pin >= GPIO_EINT_COUNT || PinIdToBlock(pin, NULL, NULL) == NULL) {
+        return -ENOENT;
+    }
+
+    if (callback == NULL || (edge & GpioEdge_Both) == 0) {
+        return -EINVAL;
+    }
+
+    uint32_t con = EINT_CON_EN;
+    if (edge == GpioEdge_Both) {
+        con |= EINT_CON_DUAL;
+    } else if (edge == GpioEdge_Rising) {
+        con |= EINT_CON_POL;
+    }
+
+    // Disable the interrupt while it is reconfigured, so a spurious edge is not reported.
+    int irq = GPIO_EINT_FIRST_IRQ + pin;
+    DisableNvicInterrupt(irq);
+    edgeCallbacks[pin] = callback;
+    WriteReg32(EINT_BASE, 4 * (size_t)pin, con);
+    SetNvicPriority(irq, GPIO_EINT_PRIORITY);
+    EnableNvicInterrupt(irq);
+
+    return 0;
+}
+
+int Mt3620_Gpio_DisableEdgeInterrupt(int pin)
+{
+    if (pin < 0 || pin >= GPIO_EINT_COUNT) {
+        return -ENOENT;
+    }
+
+    DisableNvicInterrupt(GPIO_EINT_FIRST_IRQ + pin);
+    WriteReg32(EINT_BASE, 4 * (size_t)pin, 0);
+    edgeCallbacks[pin] = NULL;
+
+    return 0;
+}
+
+TCM_CODE void Mt3620_Gpio_HandleEintIrq(void)
+{
+    // IPSR holds the active exception number, which is 16 + the IRQ number.
+    uint32_t ipsr;
+    __asm__("mrs %0, IPSR" : "=r"(ipsr));
+    int pin = (int)(ipsr & 0x1FF) - 16 - GPIO_EINT_FIRST_IRQ;
+
+    if (pin < 0 || pin >= GPIO_EINT_COUNT) {
+        return;
+    }
+
+    GpioEdgeCallback callback = edgeCallbacks[pin];
+    if (callback != NULL) {
+        callback(pin);
+    }
+}
+
 // ---- initialization ----
 
-int Mt3620_Gpio_AddBlock(const GpioBlock *block)
+COLD_CODE int Mt3620_Gpio_AddBlock(const GpioBlock *block)
 {
     int low = block->firstPin;
     int high = block->firstPin + block->pinCount - 1;
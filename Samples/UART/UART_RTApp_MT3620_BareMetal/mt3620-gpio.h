@@ -5,6 +5,7 @@
 #define MT3620_GPIO_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /// <summary>
@@ -97,4 +98,169 @@ int Mt3620_Gpio_Write(int pin, bool state);
 /// <returns>Zero on success, a standard errno.h code otherwise.</returns>
 int Mt3620_Gpio_Read(int pin, bool *state);
 
+/// <summary>
+/// <para>A set of pins in one GPIO block, which are read or written together with a single
+/// register access. Open it with <see cref="Mt3620_Gpio_OpenPort" />, typically once at
+/// startup, and then use the inline functions below, which do not look up the pins again.
+/// </para>
+/// <para>Bit n of each value corresponds to pin firstPin + n of the block. Use
+/// <see cref="Mt3620_Gpio_PortBit" /> to find the bit for a pin. Bits which do not belong
+/// to the port are ignored.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The block which contains the pins.</summary>
+    const GpioBlock *block;
+    /// <summary>Bits of the pins in the port.</summary>
+    uint32_t mask;
+    /// <summary>Register which drives the pins in a mask high.</summary>
+    volatile uint32_t *doutSet;
+    /// <summary>Register which drives the pins in a mask low.</summary>
+    volatile uint32_t *doutReset;
+    /// <summary>Register which holds the input value of every pin in the block.</summary>
+    const volatile uint32_t *din;
+} GpioPort;
+
+/// <summary>
+/// <para>Find the registers and mask for a set of pins, so they can be read and written
+/// together. The pins must all be in the same block. This does not configure the pins; call
+/// <see cref="Mt3620_Gpio_ConfigurePortForOutput" /> or
+/// <see cref="Mt3620_Gpio_ConfigurePortForInput" />, or configure each pin.</para>
+/// <para>**Errors**</para>
+/// <para>-ENOENT if a pin has not been added with <see cref="Mt3620_Gpio_AddBlock" />.</para>
+/// <para>-EINVAL if there are no pins, or they are not all in the same block.</para>
+/// </summary>
+/// <param name="pinList">The pins in the port.</param>
+/// <param name="pinCount">Number of pins in pinList.</param>
+/// <param name="port">On success, contains the port.</param>
+/// <returns>Zero on success, a negative error code on failure.</returns>
+int Mt3620_Gpio_OpenPort(const int *pinList, size_t pinCount, GpioPort *port);
+
+/// <summary>
+/// Configure every pin in a port for output, with one write to each configuration register.
+/// </summary>
+/// <param name="port">A port which was opened with <see cref="Mt3620_Gpio_OpenPort" />.</param>
+void Mt3620_Gpio_ConfigurePortForOutput(const GpioPort *port);
+
+/// <summary>
+/// Configure every pin in a port for input, with one write to each configuration register.
+/// As with <see cref="Mt3620_Gpio_ConfigurePinForInput" />, this does not control the pull-up
+/// or pull-down resistors.
+/// </summary>
+/// <param name="port">A port which was opened with <see cref="Mt3620_Gpio_OpenPort" />.</param>
+void Mt3620_Gpio_ConfigurePortForInput(const GpioPort *port);
+
+/// <summary>
+/// Get the bit which corresponds to a pin in the values of a port.
+/// </summary>
+/// <param name="port">The port.</param>
+/// <param name="pin">A pin in the same block as the port.</param>
+/// <returns>The bit for the pin.</returns>
+static inline uint32_t Mt3620_Gpio_PortBit(const GpioPort *port, int pin)
+{
+    return UINT32_C(1) << (pin - port->block->firstPin);
+}
+
+/// <summary>
+/// Drive the pins of a port whose bits are set in bits high, and leave the others unchanged.
+/// </summary>
+/// <param name="port">A port whose pins are configured for output.</param>
+/// <param name="bits">The pins to drive high.</param>
+static inline void Mt3620_Gpio_SetPort(const GpioPort *port, uint32_t bits)
+{
+    *port->doutSet = bits & port->mask;
+}
+
+/// <summary>
+/// Drive the pins of a port whose bits are set in bits low, and leave the others unchanged.
+/// </summary>
+/// <param name="port">A port whose pins are configured for output.</param>
+/// <param name="bits">The pins to drive low.</param>
+static inline void Mt3620_Gpio_ClearPort(const GpioPort *port, uint32_t bits)
+{
+    *port->doutReset = bits & port->mask;
+}
+
+/// <summary>
+/// Drive every pin in a port high or low. The pins which go high are driven before the pins
+/// which go low, with one register write each.
+/// </summary>
+/// <param name="port">A port whose pins are configured for output.</param>
+/// <param name="values">For each pin in the port, a set bit to drive it high, or a clear bit
+/// to drive it low.</param>
+static inline void Mt3620_Gpio_WritePort(const GpioPort *port, uint32_t values)
+{
+    *port->doutSet = values & port->mask;
+    *port->doutReset = ~values & port->mask;
+}
+
+/// <summary>
+/// Read every pin in a port with a single register read.
+/// </summary>
+/// <param name="port">A port whose pins are configured for input.</param>
+/// <returns>A set bit for each pin which is high. The bits of other pins are clear.</returns>
+static inline uint32_t Mt3620_Gpio_ReadPort(const GpioPort *port)
+{
+    return *port->din & port->mask;
+}
+
+/// <summary>Number of GPIOs, starting from GPIO0, which have an external interrupt (EINT).
+/// </summary>
+#define GPIO_EINT_COUNT 24
+
+/// <summary>First IRQ number for the EINTs. GPIOn raises IRQ GPIO_EINT_FIRST_IRQ + n.
+/// </summary>
+#define GPIO_EINT_FIRST_IRQ 20
+
+/// <summary>Priority of the EINT interrupts. This is the same as the GPT priority, so that
+/// edge callbacks and timer callbacks do not preempt each other.</summary>
+#define GPIO_EINT_PRIORITY 2
+
+/// <summary>Which edges of an input raise an interrupt.</summary>
+typedef enum {
+    /// <summary>Low to high.</summary>
+    GpioEdge_Rising = 1,
+    /// <summary>High to low.</summary>
+    GpioEdge_Falling = 2,
+    /// <summary>Both low to high and high to low.</summary>
+    GpioEdge_Both = 3
+} GpioEdge;
+
+/// <summary>
+/// Function which is called in interrupt context when an edge is detected on an input.
+/// </summary>
+/// <param name="pin">The pin which raised the interrupt.</param>
+typedef void (*GpioEdgeCallback)(int pin);
+
+/// <summary>
+/// <para>Call the supplied function when an edge is detected on an input, instead of polling
+/// it with <see cref="Mt3620_Gpio_Read" />. A mechanical switch bounces, so the callback may
+/// be called several times for one press. Read the pin after it has been stable for some
+/// time to debounce it.</para>
+/// <para>Only GPIO0 to GPIO23 have an EINT. The application must also install
+/// <see cref="Mt3620_Gpio_HandleEintIrq" /> in the vector table for the pin's IRQ,
+/// GPIO_EINT_FIRST_IRQ + pin.</para>
+/// <para><see cref="Mt3620_Gpio_ConfigurePinForInput" /> must be called before this
+/// function.</para>
+/// </summary>
+/// <param name="pin">A specific pin.</param>
+/// <param name="edge">Which edges to detect.</param>
+/// <param name="callback">Function to call in interrupt context for each edge.</param>
+/// <returns>Zero on success, a standard errno.h code otherwise.</returns>
+int Mt3620_Gpio_EnableEdgeInterrupt(int pin, GpioEdge edge, GpioEdgeCallback callback);
+
+/// <summary>
+/// Stop detecting edges on an input. It is safe to call this function for a pin whose edge
+/// interrupt is not enabled.
+/// </summary>
+/// <param name="pin">A specific pin.</param>
+/// <returns>Zero on success, a standard errno.h code otherwise.</returns>
+int Mt3620_Gpio_DisableEdgeInterrupt(int pin);
+
+/// <summary>
+/// Interrupt handler for the EINTs. Install this in the vector table for each pin which is
+/// passed to <see cref="Mt3620_Gpio_EnableEdgeInterrupt" />. It finds the pin from the active
+/// IRQ number.
+/// </summary>
+void Mt3620_Gpio_HandleEintIrq(void);
+
 #endif // #ifndef MT3620_GPIO_H
@@ -3,11 +3,20 @@
 
 #include <stdbool.h>
 
+#include "cycle-profiler.h"
 #include "mt3620-baremetal.h"
 #include "mt3620-timer.h"
 
 static const uintptr_t GPT_BASE = 0x21030000;
 
+// GPT3 registers. GPT3 is a free-running counter which does not interrupt.
+static const size_t GPT3_CTRL = 0x50;
+static const size_t GPT3_INIT = 0x54;
+static const size_t GPT3_CNT = 0x58;
+// GPT3_CTRL[21:16] (OSC_CNT_1US) = number of cycles of the 26MHz oscillator in one
+// microsecond, minus one.
+static const uint32_t GPT3_OSC_CNT_1US = 26 - 1;
+
 static volatile Callback timerCallbacks[TIMER_GPT_COUNT] = {[TimerGpt0] = NULL, [TimerGpt1] = NULL};
 
 typedef struct {
@@ -19,7 +28,7 @@ static const GptInfo gptRegOffsets[TIMER_GPT_COUNT] = {
     [TimerGpt0] = {.ctrlRegOffset = 0x10, .icntRegOffset = 0x14},
     [TimerGpt1] = {.ctrlRegOffset = 0x20, .icntRegOffset = 0x24}};
 
-void Gpt_Init(void)
+COLD_CODE void Gpt_Init(void)
 {
     // Enable INT1 in the NVIC. This allows the processor to receive an interrupt
     // from GPT0 or GPT1. The interrupt for the specific timer is enabled in Gpt_CallbackMs.
@@ -27,26 +36,50 @@ void Gpt_Init(void)
     // IO CM4 GPT0 timer and GPT1 timer interrupt both use INT1.
     SetNvicPriority(1, GPT_PRIORITY);
     EnableNvicInterrupt(1);
+
+    // Start GPT3 counting microseconds from zero.
+    // GPT3_CTRL[0] = 1 -> enable.
+    WriteReg32(GPT_BASE, GPT3_CTRL, 0);
+    WriteReg32(GPT_BASE, GPT3_INIT, 0);
+    WriteReg32(GPT_BASE, GPT3_CTRL, (GPT3_OSC_CNT_1US << 16) | 0x1);
 }
 
-void Gpt_HandleIrq1(void)
+TCM_CODE void Gpt_HandleIrq1(void)
 {
+    static ProfileSite profileSite = PROFILE_SITE_INIT("gpt irq");
+    uint32_t startCycles = Profiler_Now();
+
     // GPT_ISR -> read, clear interrupts.
     uint32_t activeIrqs = ReadReg32(GPT_BASE, 0x00);
     WriteReg32(GPT_BASE, 0x00, activeIrqs);
 
-    // Do not need to disable interrupts or timer because only used in one-shot mode.
+    // Do not need to disable interrupts or timer. One-shot timers stop when they expire, and
+    // periodic timers are reloaded by the hardware.
     for (int gpt = 0; gpt < TIMER_GPT_COUNT; ++gpt) {
         uint32_t mask = UINT32_C(1) << gpt;
-        if ((activeIrqs & mask) == 0) {
+        Callback callback = timerCallbacks[gpt];
+        if ((activeIrqs & mask) == 0 || callback == NULL) {
             continue;
         }
 
-        timerCallbacks[gpt]();
+        callback();
     }
+
+    Profiler_Stop(&profileSite, startCycles);
 }
 
 void Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback)
+{
+    Gpt_LaunchTimer(gpt, periodMs, GptSpeed_1KHz, /* periodic */ false, callback);
+}
+
+void Gpt_LaunchPeriodicTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback)
+{
+    Gpt_LaunchTimer(gpt, periodMs, GptSpeed_1KHz, /* periodic */ true, callback);
+}
+
+void Gpt_LaunchTimer(TimerGpt gpt, uint32_t ticks, GptSpeed speed, bool periodic,
+                     Callback callback)
 {
     timerCallbacks[gpt] = callback;
 
@@ -64,11 +97,44 @@ void Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback)
     SetReg32(GPT_BASE, 0x04, mask);
     RestoreIrqs(prevBasePri);
 
-    // GPTx_ICNT = delay in milliseconds (assuming 1KHz clock in GPTx_CTRL).
-    // Note 1KHz is approximate - the precise value depends on the clock source,
-    // but it will be 0.99kHz to 2 decimal places.
-    WriteReg32(GPT_BASE, gptRegOffsets[gpt].icntRegOffset, periodMs);
+    // GPTx_ICNT = delay in ticks. Note 1KHz is approximate - the precise value depends on
+    // the clock source, but it will be 0.99kHz to 2 decimal places.
+    WriteReg32(GPT_BASE, gptRegOffsets[gpt].icntRegOffset, ticks);
+
+    // GPTx_CTRL[3] = 1 -> auto clear
+    // GPTx_CTRL[2] = speed -> 1kHz or 32kHz
+    // GPTx_CTRL[1] = periodic -> one shot or repeat
+    // GPTx_CTRL[0] = 1 -> enable timer
+    uint32_t ctrl = 0x9 | ((uint32_t)speed << 2) | (periodic ? 0x2 : 0);
+    WriteReg32(GPT_BASE, gptRegOffsets[gpt].ctrlRegOffset, ctrl);
+}
+
+void Gpt_StopTimer(TimerGpt gpt)
+{
+    uint32_t mask = UINT32_C(1) << gpt;
+
+    // GPTx_CTRL[0] = 0 -> disable.
+    ClearReg32(GPT_BASE, gptRegOffsets[gpt].ctrlRegOffset, 0x01);
+
+    // As in Gpt_LaunchTimer, block timer ISRs while modifying the shared IER register.
+    uint32_t prevBasePri = BlockIrqs();
+    // GPT_IER[gpt] = 0 -> disable interrupt.
+    ClearReg32(GPT_BASE, 0x04, mask);
+    // GPT_ISR[gpt] = 1 -> clear an interrupt which was raised before the timer was disabled.
+    WriteReg32(GPT_BASE, 0x00, mask);
+    timerCallbacks[gpt] = NULL;
+    RestoreIrqs(prevBasePri);
+}
+
+uint32_t Gpt_GetMicroseconds(void)
+{
+    return ReadReg32(GPT_BASE, GPT3_CNT);
+}
 
-    // GPTx_CTRL -> auto clear; 1kHz, one shot, enable timer.
-    WriteReg32(GPT_BASE, gptRegOffsets[gpt].ctrlRegOffset, 0x9);
+void Gpt_WaitMicroseconds(uint32_t delayUs)
+{
+    uint32_t start = Gpt_GetMicroseconds();
+    while (Gpt_GetMicroseconds() - start < delayUs) {
+        // empty.
+    }
 }
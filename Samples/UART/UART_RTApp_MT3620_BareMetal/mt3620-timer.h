@@ -4,6 +4,7 @@
 #ifndef MT3620_TIMER_H
 #define MT3620_TIMER_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "mt3620-baremetal.h"
@@ -22,11 +23,24 @@ typedef enum {
 
 /// <summary>Total number of supported GPTs.</summary>
 #define TIMER_GPT_COUNT 2
+
+/// <summary>Clock which an interrupt-based GPT counts.</summary>
+typedef enum {
+    /// <summary>Approximately 1kHz. Each tick is about one millisecond.</summary>
+    GptSpeed_1KHz = 0,
+    /// <summary>32.768kHz. Each tick is about 30.5 microseconds.</summary>
+    GptSpeed_32KHz = 1
+} GptSpeed;
+
+/// <summary>Frequency of <see cref="GptSpeed_32KHz" /> in Hz.</summary>
+#define GPT_32KHZ_CLOCK_HZ 32768
 /// <summary>The GPT interrupts (and hence callbacks) run at this priority level.</summary>
 static const uint32_t GPT_PRIORITY = 2;
 
 /// <summary>
-/// Call this once before registering any callbacks with <see cref="Gpt_LaunchTimerMs" />.
+/// Call this once before registering any callbacks with <see cref="Gpt_LaunchTimerMs" />. This
+/// also starts the free-running microsecond counter, GPT3, which
+/// <see cref="Gpt_GetMicroseconds" /> reads.
 /// </summary>
 void Gpt_Init(void);
 
@@ -52,4 +66,55 @@ void Gpt_HandleIrq1(void);
 /// <param name="callback">Function to invoke in interrupt context when the timer expires.</param>
 void Gpt_LaunchTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback);
 
+/// <summary>
+/// <para>Register a callback which is invoked every periodMs milliseconds, until the timer is
+/// stopped with <see cref="Gpt_StopTimer" /> or relaunched. The hardware reloads the timer when
+/// it expires, so the period does not drift by the time taken to handle the interrupt.</para>
+/// <para>The other requirements are the same as for <see cref="Gpt_LaunchTimerMs" />.</para>
+/// </summary>
+/// <param name="gpt">Which hardware timer to use.</param>
+/// <param name="periodMs">Period in milliseconds.</param>
+/// <param name="callback">Function to invoke in interrupt context each time the timer expires.
+/// </param>
+void Gpt_LaunchPeriodicTimerMs(TimerGpt gpt, uint32_t periodMs, Callback callback);
+
+/// <summary>
+/// <para>Register a callback for the supplied timer, with a period in ticks of the selected
+/// clock. <see cref="Gpt_LaunchTimerMs" /> and <see cref="Gpt_LaunchPeriodicTimerMs" /> call
+/// this function with <see cref="GptSpeed_1KHz" />.</para>
+/// <para>The other requirements are the same as for <see cref="Gpt_LaunchTimerMs" />.</para>
+/// </summary>
+/// <param name="gpt">Which hardware timer to use.</param>
+/// <param name="ticks">Period in clock ticks. This must be at least one.</param>
+/// <param name="speed">Clock which the timer counts.</param>
+/// <param name="periodic">If true, the callback is invoked every period until the timer is
+/// stopped. If false, it is invoked once.</param>
+/// <param name="callback">Function to invoke in interrupt context when the timer expires.</param>
+void Gpt_LaunchTimer(TimerGpt gpt, uint32_t ticks, GptSpeed speed, bool periodic,
+                     Callback callback);
+
+/// <summary>
+/// Stop the supplied timer, so its callback is not invoked again. It is safe to call this
+/// function when the timer is not running.
+/// </summary>
+/// <param name="gpt">Which hardware timer to stop.</param>
+void Gpt_StopTimer(TimerGpt gpt);
+
+/// <summary>
+/// <para>Read the free-running microsecond counter, GPT3. The counter wraps around about every
+/// 71 minutes, so compare two readings by subtracting them as unsigned values, rather than
+/// directly.</para>
+/// <para>GPT3 does not interrupt, so it does not use up a timer which
+/// <see cref="Gpt_LaunchTimerMs" /> can use.</para>
+/// </summary>
+/// <returns>Microseconds since <see cref="Gpt_Init" /> was called, modulo 2^32.</returns>
+uint32_t Gpt_GetMicroseconds(void);
+
+/// <summary>
+/// Busy-wait for the supplied number of microseconds, with the microsecond counter. Use this
+/// only for short delays, because it does not let the core sleep.
+/// </summary>
+/// <param name="delayUs">Time to wait in microseconds.</param>
+void Gpt_WaitMicroseconds(uint32_t delayUs);
+
 #endif /* MT3620_TIMER_H */
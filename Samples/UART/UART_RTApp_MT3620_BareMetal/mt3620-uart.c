@@ -1,66 +1,198 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved.
    Licensed under the MIT License. */
 
+#include <stdarg.h>
 #include <stdbool.h>
 
+#include "cycle-profiler.h"
+#include "format.h"
 #include "mt3620-baremetal.h"
 #include "mt3620-uart.h"
 
 // This is the physical TX FIFO size, taken from the datasheet.
-// To adjust the size of the in-memory FIFO, set TX_BUFFER_SIZE below.
+// To adjust the size of the in-memory FIFO, define UART_TX_BUFFER_SIZE when compiling, or
+// supply buffers to Uart_InitBlockMode.
 #define TX_FIFO_DEPTH 16
 
-// This must be able to hold a value which is strictly greater than TX_BUFFER_SIZE.
-typedef uint16_t EnqCtrType;
-
-// Buffer sizes must be a power of two, and less than 65536.
-#define TX_BUFFER_SIZE 256
-#define TX_BUFFER_MASK (TX_BUFFER_SIZE - 1)
-#define RX_BUFFER_SIZE 32
-#define RX_BUFFER_MASK (RX_BUFFER_SIZE - 1)
-
+// The counters run freely and wrap around, so the number of bytes in a buffer is the
+// difference between them. This must be able to hold a value which is strictly greater than
+// the largest buffer size.
+typedef uint32_t EnqCtrType;
+_Static_assert(UART_MAX_BUFFER_SIZE <= (EnqCtrType)~0U / 2 + 1,
+               "EnqCtrType cannot hold the size of the largest buffer.");
+
+// The size of the buffers which Uart_Init uses. Define these when compiling to change them.
+// Uart_InitBlockMode takes buffers of any size up to UART_MAX_BUFFER_SIZE.
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 256
+#endif
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 32
+#endif
+_Static_assert(UART_TX_BUFFER_SIZE > 0 && UART_TX_BUFFER_SIZE <= UART_MAX_BUFFER_SIZE &&
+                   (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) == 0,
+               "UART_TX_BUFFER_SIZE must be a power of two.");
+_Static_assert(UART_RX_BUFFER_SIZE > 0 && UART_RX_BUFFER_SIZE <= UART_MAX_BUFFER_SIZE &&
+                   (UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) == 0,
+               "UART_RX_BUFFER_SIZE must be a power of two.");
+
+// FCR[RFTL] values, which set how many bytes the RX FIFO holds before it interrupts. 14 is
+// the highest which leaves space for bytes which arrive while the interrupt is handled.
+#define RX_FIFO_TRIGGER_12 2
+#define RX_FIFO_TRIGGER_14 3
+#define RX_FIFO_TRIGGER_BYTES(rftl_) ((rftl_) == RX_FIFO_TRIGGER_14 ? 14 : 12)
+
+// Each buffer is a single-producer, single-consumer ring. The producer only writes the enqueued
+// counter and the consumer only writes the dequeued counter, so neither side takes a lock. The
+// counters are published with release stores and read with acquire loads, so the data in the
+// ring is always written before the counter which makes it visible to the other side.
 typedef struct {
     uintptr_t baseAddr;
     int nvicIrq;
-    uint8_t txBuffer[TX_BUFFER_SIZE];
-    volatile EnqCtrType txEnqueuedBytes;
-    volatile EnqCtrType txDequeuedBytes;
+    uint8_t *txBuffer;
+    EnqCtrType txBufferMask;
+    EnqCtrType txEnqueuedBytes;
+    EnqCtrType txDequeuedBytes;
+    uint32_t txDroppedBytes;
 
     Callback rxCallback;
-    uint8_t rxBuffer[RX_BUFFER_SIZE];
-    volatile EnqCtrType rxEnqueuedBytes;
-    volatile EnqCtrType rxDequeuedBytes;
+    uint8_t *rxBuffer;
+    EnqCtrType rxBufferMask;
+    // When the RX FIFO passes its trigger level, the callback is only invoked once this many
+    // bytes are buffered. It is always invoked when the line goes idle.
+    EnqCtrType rxCallbackLevel;
+    // Number of bytes in the RX FIFO which trigger the RX interrupt.
+    EnqCtrType rxFifoTriggerBytes;
+    EnqCtrType rxEnqueuedBytes;
+    EnqCtrType rxDequeuedBytes;
+
+    // Written by the interrupt handler, and read by Uart_GetStats.
+    volatile uint32_t rxBytes;
+    volatile uint32_t rxDroppedBytes;
+    volatile uint32_t rxFifoOverruns;
+    volatile uint32_t rxHighWaterMark;
 } UartInfo;
 
+static uint8_t defaultTxBuffers[2][UART_TX_BUFFER_SIZE];
+static uint8_t defaultRxBuffers[2][UART_RX_BUFFER_SIZE];
+
 static UartInfo uarts[] = {
     [UartCM4Debug] = {.baseAddr = 0x21040000, .nvicIrq = 4},
     [UartIsu0] = {.baseAddr = 0x38070500, .nvicIrq = 47},
 };
 
 static void Uart_HandleIrq(UartId id);
+static void InitUnit(UartId id, Callback rxCallback, uint32_t rxFifoTrigger,
+                     const UartBaudSettings *baudSettings);
+
+static bool IsValidBufferSize(size_t size)
+{
+    return size != 0 && size <= UART_MAX_BUFFER_SIZE && (size & (size - 1)) == 0;
+}
+
+static inline EnqCtrType LoadCounter(const EnqCtrType *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+static inline void StoreCounter(EnqCtrType *counter, EnqCtrType value)
+{
+    __atomic_store_n(counter, value, __ATOMIC_RELEASE);
+}
+
+// Reads the Line Status Register, and counts RX FIFO overruns. Reading LSR clears LSR[OE].
+static uint32_t ReadLsr(UartInfo *unit)
+{
+    uint32_t lsr = ReadReg32(unit->baseAddr, 0x14);
+    // LSR[1] = 1 -> Overrun Error
+    if (lsr & 0x02) {
+        ++unit->rxFifoOverruns;
+    }
+    return lsr;
+}
+
+COLD_CODE void Uart_Init(UartId id, Callback rxCallback)
+{
+    const UartConfig config = {.baudRate = 115200, .rxCallback = rxCallback};
+    Uart_InitWithConfig(id, &config);
+}
+
+COLD_CODE void Uart_InitWithBaudSettings(UartId id, const UartBaudSettings *baudSettings,
+                                         Callback rxCallback)
+{
+    UartInfo *unit = &uarts[id];
 
-void Uart_Init(UartId id, Callback rxCallback)
+    unit->txBuffer = defaultTxBuffers[id];
+    unit->txBufferMask = UART_TX_BUFFER_SIZE - 1;
+    unit->rxBuffer = defaultRxBuffers[id];
+    unit->rxBufferMask = UART_RX_BUFFER_SIZE - 1;
+    unit->rxCallbackLevel = 1;
+
+    InitUnit(id, rxCallback, RX_FIFO_TRIGGER_12, baudSettings);
+}
+
+COLD_CODE int Uart_InitBlockMode(UartId id, const UartBlockModeConfig *config)
+{
+    if (!IsValidBufferSize(config->txBufferSize) || !IsValidBufferSize(config->rxBufferSize)) {
+        return -1;
+    }
+
+    UartBaudSettings baudSettings;
+    uint32_t baudRate = config->baudRate != 0 ? config->baudRate : 115200;
+    if (Uart_CalculateBaudSettings(baudRate, &baudSettings) == -1) {
+        return -1;
+    }
+
+    UartInfo *unit = &uarts[id];
+
+    unit->txBuffer = config->txBuffer;
+    unit->txBufferMask = (EnqCtrType)(config->txBufferSize - 1);
+    unit->rxBuffer = config->rxBuffer;
+    unit->rxBufferMask = (EnqCtrType)(config->rxBufferSize - 1);
+    unit->rxCallbackLevel = (EnqCtrType)(config->rxBufferSize / 2);
+    if (unit->rxCallbackLevel == 0) {
+        unit->rxCallbackLevel = 1;
+    }
+
+    InitUnit(id, config->rxCallback, RX_FIFO_TRIGGER_14, &baudSettings);
+    return 0;
+}
+
+static COLD_CODE void InitUnit(UartId id, Callback rxCallback, uint32_t rxFifoTrigger,
+                               const UartBaudSettings *baudSettings)
 {
     UartInfo *unit = &uarts[id];
 
-    // Configure UART to use 115200-8-N-1.
+    unit->rxFifoTriggerBytes = RX_FIFO_TRIGGER_BYTES(rxFifoTrigger);
+    unit->txEnqueuedBytes = 0;
+    unit->txDequeuedBytes = 0;
+    unit->rxEnqueuedBytes = 0;
+    unit->rxDequeuedBytes = 0;
+    unit->txDroppedBytes = 0;
+    unit->rxBytes = 0;
+    unit->rxDroppedBytes = 0;
+    unit->rxFifoOverruns = 0;
+    unit->rxHighWaterMark = 0;
+
+    // Configure UART to use the baud rate, 8-N-1.
     WriteReg32(unit->baseAddr, 0x0C, 0xBF); // LCR (enable DLL, DLM)
     WriteReg32(unit->baseAddr, 0x08, 0x10); // EFR (enable enhancement features)
     WriteReg32(unit->baseAddr, 0x24, 0x3);  // HIGHSPEED
-    WriteReg32(unit->baseAddr, 0x04, 0);    // Divisor Latch (MS)
-    WriteReg32(unit->baseAddr, 0x00, 1);    // Divisor Latch (LS)
-    WriteReg32(unit->baseAddr, 0x28, 224);  // SAMPLE_COUNT
-    WriteReg32(unit->baseAddr, 0x2C, 110);  // SAMPLE_POINT
-    WriteReg32(unit->baseAddr, 0x58, 0);    // FRACDIV_M
-    WriteReg32(unit->baseAddr, 0x54, 223);  // FRACDIV_L
+    WriteReg32(unit->baseAddr, 0x04, baudSettings->divisor >> 8);   // Divisor Latch (MS)
+    WriteReg32(unit->baseAddr, 0x00, baudSettings->divisor & 0xFF); // Divisor Latch (LS)
+    WriteReg32(unit->baseAddr, 0x28, baudSettings->sampleCount);    // SAMPLE_COUNT
+    WriteReg32(unit->baseAddr, 0x2C, baudSettings->samplePoint);    // SAMPLE_POINT
+    WriteReg32(unit->baseAddr, 0x58, baudSettings->fracDivM);       // FRACDIV_M
+    WriteReg32(unit->baseAddr, 0x54, baudSettings->fracDivL);       // FRACDIV_L
     WriteReg32(unit->baseAddr, 0x0C, 0x03); // LCR (8-bit word length)
 
-    // FCR[RFTL] = 2 -> 12 element RX FIFO trigger
+    // FCR[RFTL] = rxFifoTrigger -> 12 or 14 element RX FIFO trigger
     // FCR[TFTL] = 1 -> 4 element TX FIFO trigger
     // FCR[CLRT] = 1 -> Clear Transmit FIFO
     // FCR[CLRR] = 1 -> Clear Receive FIFO
     // FCR[FIFOE] = 1 -> FIFO Enable
-    const uint8_t fcr = (2U << 6) | (1U << 4) | (1U << 2) | (1U << 1) | (1U << 0);
+    const uint8_t fcr =
+        (uint8_t)((rxFifoTrigger << 6) | (1U << 4) | (1U << 2) | (1U << 1) | (1U << 0));
     WriteReg32(unit->baseAddr, 0x08, fcr);
 
     // If an RX callback was supplied then enable the Receive Buffer Full Interrupt.
@@ -74,17 +206,23 @@ void Uart_Init(UartId id, Callback rxCallback)
     EnableNvicInterrupt(unit->nvicIrq);
 }
 
-void Uart_HandleIrq4(void)
+TCM_CODE void Uart_HandleIrq4(void)
 {
+    static ProfileSite profileSite = PROFILE_SITE_INIT("uart debug irq");
+    uint32_t startCycles = Profiler_Now();
     Uart_HandleIrq(UartCM4Debug);
+    Profiler_Stop(&profileSite, startCycles);
 }
 
-void Uart_HandleIrq47(void)
+TCM_CODE void Uart_HandleIrq47(void)
 {
+    static ProfileSite profileSite = PROFILE_SITE_INIT("uart isu0 irq");
+    uint32_t startCycles = Profiler_Now();
     Uart_HandleIrq(UartIsu0);
+    Profiler_Stop(&profileSite, startCycles);
 }
 
-static void Uart_HandleIrq(UartId id)
+static TCM_CODE void Uart_HandleIrq(UartId id)
 {
     UartInfo *unit = &uarts[id];
 
@@ -97,7 +235,7 @@ static void Uart_HandleIrq(UartId id)
             break;
             // The TX FIFO can accept more data.
         case 0x02: { // TX Holding Register Empty Interrupt
-            EnqCtrType localEnqueuedBytes = unit->txEnqueuedBytes;
+            EnqCtrType localEnqueuedBytes = LoadCounter(&unit->txEnqueuedBytes);
             EnqCtrType localDequeuedBytes = unit->txDequeuedBytes;
 
             // TX_OFFSET, holds number of bytes in TX FIFO.
@@ -105,7 +243,7 @@ static void Uart_HandleIrq(UartId id)
             uint32_t spaceInTxFifo = TX_FIFO_DEPTH - txOffset;
 
             while (localDequeuedBytes != localEnqueuedBytes && spaceInTxFifo > 0) {
-                EnqCtrType txIdx = localDequeuedBytes & TX_BUFFER_MASK;
+                EnqCtrType txIdx = localDequeuedBytes & unit->txBufferMask;
                 // TX Holding Register
                 WriteReg32(unit->baseAddr, 0x00, unit->txBuffer[txIdx]);
 
@@ -118,7 +256,7 @@ static void Uart_HandleIrq(UartId id)
                 // Interrupt Enable Register
                 ClearReg32(unit->baseAddr, 0x04, 0x02);
             }
-            unit->txDequeuedBytes = localDequeuedBytes;
+            StoreCounter(&unit->txDequeuedBytes, localDequeuedBytes);
         } break;
 
         // Read from the FIFO if it has passed its trigger level, or if a timeout
@@ -126,30 +264,51 @@ static void Uart_HandleIrq(UartId id)
         case 0x0C:   // RX Data Timeout Interrupt
         case 0x04: { // RX Data Received Interrupt
             EnqCtrType localEnqueuedBytes = unit->rxEnqueuedBytes;
-            EnqCtrType localDequeuedBytes = unit->rxDequeuedBytes;
-
-            EnqCtrType availSpace;
-            if (localEnqueuedBytes >= localDequeuedBytes) {
-                availSpace = RX_BUFFER_SIZE - (localEnqueuedBytes - localDequeuedBytes);
-            }
-            // If counter wrapped around, work out true remaining space.
-            else {
-                availSpace = (localDequeuedBytes & RX_BUFFER_MASK) - localEnqueuedBytes;
+            EnqCtrType localDequeuedBytes = LoadCounter(&unit->rxDequeuedBytes);
+
+            EnqCtrType availSpace = (EnqCtrType)(unit->rxBufferMask + 1) -
+                                    (EnqCtrType)(localEnqueuedBytes - localDequeuedBytes);
+            EnqCtrType readLimit = availSpace;
+
+            // In block mode, leave at least one byte in the FIFO when it passes its trigger
+            // level. The FIFO then raises the timeout interrupt if the line goes idle, even if
+            // the data so far exactly filled the FIFO each time.
+            if (iirId == 0x04 && unit->rxCallbackLevel > 1 &&
+                readLimit > unit->rxFifoTriggerBytes - 1) {
+                readLimit = (EnqCtrType)(unit->rxFifoTriggerBytes - 1);
             }
 
+            EnqCtrType bytesRead = 0;
             // LSR[0] = 1 -> Data Ready
-            while (availSpace > 0 && (ReadReg32(unit->baseAddr, 0x14) & 0x01)) {
-                EnqCtrType idx = localEnqueuedBytes & RX_BUFFER_MASK;
+            while (bytesRead < readLimit && (ReadLsr(unit) & 0x01)) {
+                EnqCtrType idx = (localEnqueuedBytes + bytesRead) & unit->rxBufferMask;
                 // RX Buffer Register
                 unit->rxBuffer[idx] = ReadReg32(unit->baseAddr, 0x00);
+                ++bytesRead;
+            }
 
-                ++localEnqueuedBytes;
-                --availSpace;
+            // If the buffer is full then discard the rest of the FIFO. Otherwise the FIFO would
+            // stay above its trigger level, and the interrupt would fire continuously.
+            if (bytesRead == availSpace) {
+                while (ReadLsr(unit) & 0x01) {
+                    (void)ReadReg32(unit->baseAddr, 0x00);
+                    ++unit->rxDroppedBytes;
+                }
             }
 
-            unit->rxEnqueuedBytes = localEnqueuedBytes;
+            localEnqueuedBytes += bytesRead;
+            StoreCounter(&unit->rxEnqueuedBytes, localEnqueuedBytes);
 
-            if (unit->rxCallback) {
+            EnqCtrType bufferedBytes = (EnqCtrType)(localEnqueuedBytes - localDequeuedBytes);
+            unit->rxBytes += bytesRead;
+            if (bufferedBytes > unit->rxHighWaterMark) {
+                unit->rxHighWaterMark = bufferedBytes;
+            }
+
+            // A timeout means the line has gone idle with data still to read, so the caller is
+            // always told about it. Otherwise, wait until enough data is buffered.
+            bool invokeCallback = iirId == 0x0C || bufferedBytes >= unit->rxCallbackLevel;
+            if (unit->rxCallback && invokeCallback) {
                 unit->rxCallback();
             }
         } break;
@@ -162,40 +321,37 @@ bool Uart_EnqueueData(UartId id, const uint8_t *data, size_t length)
     UartInfo *unit = &uarts[id];
 
     EnqCtrType localEnqueuedBytes = unit->txEnqueuedBytes;
-    EnqCtrType localDequeuedBytes = unit->txDequeuedBytes;
-
-    EnqCtrType availSpace;
-    if (localEnqueuedBytes >= localDequeuedBytes) {
-        availSpace = TX_BUFFER_SIZE - (localEnqueuedBytes - localDequeuedBytes);
-    }
-    // If counter wrapped around, work out true remaining space.
-    else {
-        availSpace = (localDequeuedBytes & TX_BUFFER_MASK) - localEnqueuedBytes;
-    }
+    EnqCtrType localDequeuedBytes = LoadCounter(&unit->txDequeuedBytes);
 
-    // If no available space then do not enable TX interrupt.
-    if (availSpace == 0) {
-        return false;
-    }
+    EnqCtrType availSpace = (EnqCtrType)(unit->txBufferMask + 1) -
+                            (EnqCtrType)(localEnqueuedBytes - localDequeuedBytes);
 
     // Copy as much data as possible from the message to the buffer.
     // Any unqueued data will be lost.
     bool writeAll = (availSpace >= length);
-    EnqCtrType bytesToWrite = writeAll ? length : availSpace;
+    EnqCtrType bytesToWrite = writeAll ? (EnqCtrType)length : availSpace;
+    unit->txDroppedBytes += (uint32_t)(length - bytesToWrite);
 
-    while (bytesToWrite--) {
-        EnqCtrType idx = localEnqueuedBytes & TX_BUFFER_MASK;
-        unit->txBuffer[idx] = *data++;
-        ++localEnqueuedBytes;
+    // If no available space then do not enable TX interrupt.
+    if (availSpace == 0) {
+        return false;
     }
 
+    // Copy up to the end of the buffer, then wrap around to the start.
+    EnqCtrType enqueueIndex = localEnqueuedBytes & unit->txBufferMask;
+    EnqCtrType bytesToEnd = (EnqCtrType)(unit->txBufferMask + 1 - enqueueIndex);
+    EnqCtrType firstSpan = bytesToWrite < bytesToEnd ? bytesToWrite : bytesToEnd;
+    __builtin_memcpy(&unit->txBuffer[enqueueIndex], data, firstSpan);
+    __builtin_memcpy(&unit->txBuffer[0], data + firstSpan, bytesToWrite - firstSpan);
+    localEnqueuedBytes += bytesToWrite;
+
     // Block IRQs here because the the UART IRQ could already be enabled, and run
     // between updating txEnqueuedBytes and re-enabling the IRQ here. If that happened,
     // the IRQ could exhaust the software buffer and disable the TX interrupt, only
     // for it to be re-enabled here, in which case it would not get cleared because
     // there was no data to write to the TX FIFO.
     uint32_t prevPriBase = BlockIrqs();
-    unit->txEnqueuedBytes = localEnqueuedBytes;
+    StoreCounter(&unit->txEnqueuedBytes, localEnqueuedBytes);
     // IER[ETBEI] = 1 -> Enable Transmitter Buffer Empty Interrupt
     SetReg32(unit->baseAddr, 0x04, 0x02);
     RestoreIrqs(prevPriBase);
@@ -203,44 +359,65 @@ bool Uart_EnqueueData(UartId id, const uint8_t *data, size_t length)
     return writeAll;
 }
 
-size_t Uart_DequeueData(UartId id, uint8_t *buffer, size_t bufferSize)
+size_t Uart_PeekRxData(UartId id, UartRxSpan spans[2])
 {
     UartInfo *unit = &uarts[id];
 
-    EnqCtrType localEnqueuedBytes = unit->rxEnqueuedBytes;
+    EnqCtrType localEnqueuedBytes = LoadCounter(&unit->rxEnqueuedBytes);
     EnqCtrType localDequeuedBytes = unit->rxDequeuedBytes;
 
-    EnqCtrType availData;
-    if (localEnqueuedBytes >= localDequeuedBytes) {
-        availData = localEnqueuedBytes - localDequeuedBytes;
-    }
-    // Wraparound occurred so work out the true available data.
-    else {
-        availData = RX_BUFFER_SIZE - ((localDequeuedBytes & RX_BUFFER_MASK) - localEnqueuedBytes);
-    }
+    EnqCtrType availData = (EnqCtrType)(localEnqueuedBytes - localDequeuedBytes);
+    EnqCtrType dequeueIndex = localDequeuedBytes & unit->rxBufferMask;
+    EnqCtrType bytesToEnd = (EnqCtrType)(unit->rxBufferMask + 1 - dequeueIndex);
 
-    // This check is required to distinguish an empty buffer from a full buffer, because
-    // in both cases the enqueue and dequeue indices point to the same index.
-    if (availData == 0) {
-        return 0;
-    }
+    // The data runs from the dequeue index to the end of the buffer, and then wraps around to
+    // the start of the buffer.
+    spans[0].data = &unit->rxBuffer[dequeueIndex];
+    spans[0].length = availData < bytesToEnd ? availData : bytesToEnd;
+    spans[1].data = &unit->rxBuffer[0];
+    spans[1].length = availData - spans[0].length;
 
-    EnqCtrType enqueueIndex = localEnqueuedBytes & RX_BUFFER_MASK;
-    EnqCtrType dequeueIndex = localDequeuedBytes & RX_BUFFER_MASK;
+    return availData;
+}
 
-    // If the available data does not wraparound use one memcpy...
-    if (enqueueIndex > dequeueIndex) {
-        __builtin_memcpy(buffer, &unit->rxBuffer[dequeueIndex], availData);
-    }
-    // ...otherwise copy data from end of buffer, then from start.
-    else {
-        size_t bytesFromEnd = RX_BUFFER_SIZE - dequeueIndex;
-        __builtin_memcpy(buffer, &unit->rxBuffer[dequeueIndex], bytesFromEnd);
-        __builtin_memcpy(buffer + bytesFromEnd, &unit->rxBuffer[0], enqueueIndex);
-    }
+void Uart_ConsumeRxData(UartId id, size_t length)
+{
+    UartInfo *unit = &uarts[id];
+    StoreCounter(&unit->rxDequeuedBytes, (EnqCtrType)(unit->rxDequeuedBytes + length));
+}
 
-    unit->rxDequeuedBytes += availData;
-    return availData;
+size_t Uart_DequeueData(UartId id, uint8_t *buffer, size_t bufferSize)
+{
+    UartRxSpan spans[2];
+    Uart_PeekRxData(id, spans);
+
+    // Only copy as much data as fits in the caller's buffer. The rest is returned by the next
+    // call.
+    size_t firstBytes = spans[0].length < bufferSize ? spans[0].length : bufferSize;
+    size_t secondBytes = spans[1].length < bufferSize - firstBytes ? spans[1].length
+                                                                   : bufferSize - firstBytes;
+
+    __builtin_memcpy(buffer, spans[0].data, firstBytes);
+    __builtin_memcpy(buffer + firstBytes, spans[1].data, secondBytes);
+
+    Uart_ConsumeRxData(id, firstBytes + secondBytes);
+    return firstBytes + secondBytes;
+}
+
+void Uart_GetStats(UartId id, UartStats *stats)
+{
+    UartInfo *unit = &uarts[id];
+
+    // Take a consistent copy of the counters which the interrupt handler updates.
+    uint32_t prevPriBase = BlockIrqs();
+    stats->rxBytes = unit->rxBytes;
+    stats->rxDroppedBytes = unit->rxDroppedBytes;
+    stats->rxFifoOverruns = unit->rxFifoOverruns;
+    stats->rxHighWaterMark = unit->rxHighWaterMark;
+    RestoreIrqs(prevPriBase);
+
+    stats->rxBufferSize = unit->rxBufferMask + 1;
+    stats->txDroppedBytes = unit->txDroppedBytes;
 }
 
 bool Uart_EnqueueString(UartId id, const char *msg)
@@ -286,25 +463,36 @@ bool Uart_EnqueueIntegerAsString(UartId id, int value)
 
 bool Uart_EnqueueIntegerAsHexString(UartId id, uint32_t value)
 {
-    // EnqueueIntegerAsStringWithBase takes a signed integer, so print each half-word
-    // separately, so the value is not interpreted as negative integer if bit 31 is set.
-    if (value & 0xFFFF0000) {
-        return EnqueueIntegerAsStringWithBase(id, (int)(value >> 16), 16) &&
-               Uart_EnqueueIntegerAsHexStringWidth(id, value, 4);
-    }
-
-    return EnqueueIntegerAsStringWithBase(id, value & 0x0000FFFF, 16);
+    return Uart_EnqueueFormat(id, "%x", (unsigned int)value);
 }
 
 bool Uart_EnqueueIntegerAsHexStringWidth(UartId id, uint32_t value, size_t width)
 {
-    while (width) {
-        uint32_t printNybble = (value >> ((width - 1) * 4)) & 0xF;
-        if (!EnqueueIntegerAsStringWithBase(id, printNybble, 16)) {
-            return false;
-        }
-        --width;
+    static const char digits[] = "0123456789abcdef";
+
+    // Write the digits into a local buffer, so they are enqueued in one call. Digits beyond the
+    // eighth are leading zeroes.
+    char txt[32];
+    if (width > sizeof(txt)) {
+        width = sizeof(txt);
+    }
+
+    for (size_t i = 0; i < width; ++i) {
+        size_t shift = (width - 1 - i) * 4;
+        txt[i] = (shift < 32) ? digits[(value >> shift) & 0xF] : '0';
     }
 
-    return true;
+    return Uart_EnqueueData(id, (const uint8_t *)txt, width);
+}
+
+bool Uart_EnqueueFormat(UartId id, const char *format, ...)
+{
+    char txt[UART_FORMAT_BUFFER_SIZE];
+
+    va_list args;
+    va_start(args, format);
+    size_t length = Format_Vsnprintf(txt, sizeof(txt), format, args);
+    va_end(args);
+
+    return Uart_EnqueueData(id, (const uint8_t *)txt, length);
 }
@@ -41,13 +41,163 @@ static const uint32_t UART_PRIORITY = 2;
 /// application should call <see cref="Uart_DequeueData" /> to retrieve the data.</param>
 void Uart_Init(UartId id, Callback rxCallback);
 
+/// <summary>Frequency of the clock which the UARTs divide down to the baud rate.</summary>
+#define UART_CLOCK_HZ 26000000
+
+/// <summary>Lowest baud rate which <see cref="Uart_CalculateBaudSettings" /> supports.
+/// </summary>
+#define UART_MIN_BAUD_RATE 1200
+
+/// <summary>Highest baud rate which <see cref="Uart_CalculateBaudSettings" /> supports: the
+/// ISU UART maximum of 3Mbps.</summary>
+#define UART_MAX_BAUD_RATE 3000000
+
+/// <summary>
+/// <para>Register values which set a UART's baud rate in high-speed mode. Each bit lasts
+/// (sampleCount + 1) * divisor clock cycles, and the fractional divider adds one cycle to some
+/// of the ten bits in each frame, to get closer to the requested rate.</para>
+/// <para>Calculate these with <see cref="Uart_CalculateBaudSettings" />.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Divisor latch (DLM:DLL).</summary>
+    uint16_t divisor;
+    /// <summary>SAMPLE_COUNT: clock cycles per bit, after division, minus one.</summary>
+    uint8_t sampleCount;
+    /// <summary>SAMPLE_POINT: the cycle in each bit at which the line is sampled.</summary>
+    uint8_t samplePoint;
+    /// <summary>FRACDIV_L: which of the eight data bits last an extra cycle.</summary>
+    uint8_t fracDivL;
+    /// <summary>FRACDIV_M: whether the start and stop bits last an extra cycle.</summary>
+    uint8_t fracDivM;
+} UartBaudSettings;
+
+/// <summary>
+/// <para>Calculate the register values for a baud rate. This is inline so that, for a
+/// constant baud rate, the compiler calculates the values at compile time.</para>
+/// <para>The smallest divisor is used which lets SAMPLE_COUNT fit in eight bits, because more
+/// samples per bit give finer control over the rate, and the remainder, in tenths of a cycle,
+/// is spread over the frame by the fractional divider. For 115200 baud this gives a divisor of
+/// 1, SAMPLE_COUNT 224, SAMPLE_POINT 110 and FRACDIV_L 0xDF, which is within 0.01%.</para>
+/// </summary>
+/// <param name="baudRate">The baud rate, from UART_MIN_BAUD_RATE to UART_MAX_BAUD_RATE.</param>
+/// <param name="settings">Receives the register values.</param>
+/// <returns>0 on success; -1 if the baud rate is out of range.</returns>
+static inline int Uart_CalculateBaudSettings(uint32_t baudRate, UartBaudSettings *settings)
+{
+    // Patterns with 0 to 10 bits set, spread across the frame.
+    static const uint8_t fracDivLPatterns[] = {0x00, 0x10, 0x44, 0x92, 0xAA, 0xB5,
+                                               0xBB, 0xDF, 0xFF, 0xFF, 0xFF};
+    static const uint8_t fracDivMPatterns[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 3};
+
+    if (baudRate < UART_MIN_BAUD_RATE || baudRate > UART_MAX_BAUD_RATE) {
+        return -1;
+    }
+
+    uint32_t divisor = (UART_CLOCK_HZ + 256 * baudRate - 1) / (256 * baudRate);
+    uint32_t hundredthCyclesPerBit = (UART_CLOCK_HZ * 100U) / (baudRate * divisor);
+    uint32_t cyclesPerBit = hundredthCyclesPerBit / 100;
+    uint32_t extraTenths = ((hundredthCyclesPerBit % 100) + 5) / 10;
+
+    settings->divisor = (uint16_t)divisor;
+    settings->sampleCount = (uint8_t)(cyclesPerBit - 1);
+    settings->samplePoint = (uint8_t)((cyclesPerBit - 1) / 2 - 2);
+    settings->fracDivL = fracDivLPatterns[extraTenths];
+    settings->fracDivM = fracDivMPatterns[extraTenths];
+    return 0;
+}
+
+/// <summary>
+/// Settings for <see cref="Uart_InitWithConfig" />.
+/// </summary>
+typedef struct {
+    /// <summary>The baud rate, from UART_MIN_BAUD_RATE to UART_MAX_BAUD_RATE.</summary>
+    uint32_t baudRate;
+    /// <summary>An optional callback, as for <see cref="Uart_Init" />.</summary>
+    Callback rxCallback;
+} UartConfig;
+
+/// <summary>
+/// The same as <see cref="Uart_Init" />, with register values which were calculated by
+/// <see cref="Uart_CalculateBaudSettings" />. Prefer <see cref="Uart_InitWithConfig" />.
+/// </summary>
+/// <param name="id">Which UART to initialize.</param>
+/// <param name="baudSettings">The baud rate register values.</param>
+/// <param name="rxCallback">An optional callback, as for <see cref="Uart_Init" />.</param>
+void Uart_InitWithBaudSettings(UartId id, const UartBaudSettings *baudSettings,
+                               Callback rxCallback);
+
+/// <summary>
+/// The same as <see cref="Uart_Init" />, with a baud rate other than 115200. The register
+/// values are calculated at compile time if the baud rate is constant.
+/// </summary>
+/// <param name="id">Which UART to initialize.</param>
+/// <param name="config">The baud rate and callback.</param>
+/// <returns>0 on success; -1 if the baud rate is out of range.</returns>
+static inline int Uart_InitWithConfig(UartId id, const UartConfig *config)
+{
+    UartBaudSettings baudSettings;
+    if (Uart_CalculateBaudSettings(config->baudRate, &baudSettings) == -1) {
+        return -1;
+    }
+
+    Uart_InitWithBaudSettings(id, &baudSettings, config->rxCallback);
+    return 0;
+}
+
+/// <summary>Largest buffer which can be supplied to <see cref="Uart_InitBlockMode" />.</summary>
+#define UART_MAX_BUFFER_SIZE 0x80000000U
+
+/// <summary>
+/// Buffers and callback for <see cref="Uart_InitBlockMode" />.
+/// </summary>
+typedef struct {
+    /// <summary>Buffer for data which is waiting to be sent. It must remain valid while the UART
+    /// is used.</summary>
+    uint8_t *txBuffer;
+    /// <summary>Size of txBuffer in bytes. This must be a power of two, no greater than
+    /// UART_MAX_BUFFER_SIZE.</summary>
+    size_t txBufferSize;
+    /// <summary>Buffer for data which has been received. It must remain valid while the UART is
+    /// used.</summary>
+    uint8_t *rxBuffer;
+    /// <summary>Size of rxBuffer in bytes. This must be a power of two, no greater than
+    /// UART_MAX_BUFFER_SIZE.</summary>
+    size_t rxBufferSize;
+    /// <summary>An optional callback to invoke when rxBuffer is half full, or when the line
+    /// goes idle after data was received. This can be NULL if the application does not want to
+    /// read any data from the UART.</summary>
+    Callback rxCallback;
+    /// <summary>The baud rate, from UART_MIN_BAUD_RATE to UART_MAX_BAUD_RATE, or 0 for 115200.
+    /// </summary>
+    uint32_t baudRate;
+} UartBlockModeConfig;
+
+/// <summary>
+/// <para>Alternative to <see cref="Uart_Init" /> for fast links, such as ISU0 at high baud
+/// rates. The application supplies the buffers, so they can be as large as the link needs.
+/// </para>
+/// <para>Data is received in blocks: the RX FIFO interrupts when it holds 14 bytes rather than
+/// 12, and the receive callback is only invoked once rxBuffer is half full, or when the line
+/// goes idle for four character times after data was received. The application calls
+/// <see cref="Uart_DequeueData" /> from the callback as usual. Between callbacks, the interrupt
+/// handler only moves data from the FIFO to rxBuffer.</para>
+/// <para><see cref="Uart_EnqueueData" /> and <see cref="Uart_DequeueData" /> work in the same
+/// way as after <see cref="Uart_Init" />.</para>
+/// </summary>
+/// <param name="id">Which UART to initialize.</param>
+/// <param name="config">The buffers and callback.</param>
+/// <returns>0 on success; -1 if a buffer size or the baud rate is invalid.</returns>
+int Uart_InitBlockMode(UartId id, const UartBlockModeConfig *config);
+
 /// <summary>
 /// <para>Buffers the supplied data and asynchronously writes it to the supplied UART.
 /// If there is not enough space to buffer the data, then any unbuffered data will be discarded.
-/// The size of the buffer is defined by the TX_BUFFER_SIZE macro in mt3620-uart.c.</para>
+/// The size of the buffer is defined by the UART_TX_BUFFER_SIZE macro in mt3620-uart.c, or by the
+/// buffer which was supplied to <see cref="Uart_InitBlockMode" />.</para>
 /// <para>To send a null-terminated string, call <see cref="Uart_EnqueueString" />.
 /// To send an integer call <see cref="Uart_EnqueueIntegerAsString" /> or
-/// <see cref="Uart_EnqueueIntegerAsHexString"/>.</para>
+/// <see cref="Uart_EnqueueIntegerAsHexString"/>. To send formatted text, call
+/// <see cref="Uart_EnqueueFormat" />.</para>
 /// </summary>
 /// <param name="id">Which UART to write the data to.</param>
 /// <param name="data">Start of the data buffer.</param>
@@ -69,6 +219,70 @@ bool Uart_EnqueueData(UartId id, const uint8_t *data, size_t length);
 /// <returns>How many bytes were read from the UART. This can be zero.</returns>
 size_t Uart_DequeueData(UartId id, uint8_t *buffer, size_t bufferSize);
 
+/// <summary>
+/// A contiguous run of received bytes in a UART's receive buffer.
+/// </summary>
+typedef struct {
+    /// <summary>Start of the bytes.</summary>
+    const uint8_t *data;
+    /// <summary>Number of bytes. This can be zero.</summary>
+    size_t length;
+} UartRxSpan;
+
+/// <summary>
+/// <para>Describes the data which has been received on the UART, without copying it. The
+/// receive buffer is a ring, so the data is in up to two spans: spans[0] runs to the end of the
+/// buffer, and spans[1] continues from the start of the buffer. spans[1] is empty unless the data
+/// wraps around.</para>
+/// <para>The data remains in the buffer, and the interrupt handler does not overwrite it, until
+/// the application calls <see cref="Uart_ConsumeRxData" />. The receive buffer is a
+/// single-producer, single-consumer ring, so call this function and
+/// <see cref="Uart_DequeueData" /> from one context only.</para>
+/// </summary>
+/// <param name="id">Which UART to read the data from.</param>
+/// <param name="spans">Receives the two spans.</param>
+/// <returns>Total number of bytes in the two spans.</returns>
+size_t Uart_PeekRxData(UartId id, UartRxSpan spans[2]);
+
+/// <summary>
+/// Releases data which was returned by <see cref="Uart_PeekRxData" />, so the interrupt handler
+/// can reuse its space in the receive buffer.
+/// </summary>
+/// <param name="id">Which UART the data was read from.</param>
+/// <param name="length">Number of bytes to release, from the start of spans[0]. This must not be
+/// greater than the value which <see cref="Uart_PeekRxData" /> returned.</param>
+void Uart_ConsumeRxData(UartId id, size_t length);
+
+/// <summary>
+/// Counters which show whether a UART is losing data. The counters start at zero when the UART
+/// is initialized, and wrap around.
+/// </summary>
+typedef struct {
+    /// <summary>Bytes which were moved from the RX FIFO to the receive buffer.</summary>
+    uint32_t rxBytes;
+    /// <summary>Bytes which were discarded because the receive buffer was full. If this
+    /// increases, read the data more often, or supply a larger buffer to
+    /// <see cref="Uart_InitBlockMode" />.</summary>
+    uint32_t rxDroppedBytes;
+    /// <summary>Number of times the RX FIFO overflowed before the interrupt handler read it,
+    /// because interrupts were blocked for too long.</summary>
+    uint32_t rxFifoOverruns;
+    /// <summary>Largest number of bytes which the receive buffer has held.</summary>
+    uint32_t rxHighWaterMark;
+    /// <summary>Size of the receive buffer in bytes.</summary>
+    uint32_t rxBufferSize;
+    /// <summary>Bytes which <see cref="Uart_EnqueueData" /> discarded because the transmit
+    /// buffer was full.</summary>
+    uint32_t txDroppedBytes;
+} UartStats;
+
+/// <summary>
+/// Reads the UART's counters.
+/// </summary>
+/// <param name="id">Which UART to read the counters for.</param>
+/// <param name="stats">Receives the counters.</param>
+void Uart_GetStats(UartId id, UartStats *stats);
+
 /// <summary>
 /// <para>Buffers the supplied string and asynchronously writes it to the supplied UART. Does not
 /// send the null terminator. If there is not enough space to buffer the entire string, then the
@@ -117,6 +331,22 @@ bool Uart_EnqueueIntegerAsHexString(UartId id, uint32_t value);
 /// <returns>Whether all text was written to the internal buffer.</returns>
 bool Uart_EnqueueIntegerAsHexStringWidth(UartId id, uint32_t value, size_t width);
 
+/// <summary>Size of the stack buffer which <see cref="Uart_EnqueueFormat" /> uses, including
+/// the null terminator.</summary>
+#define UART_FORMAT_BUFFER_SIZE 128
+
+/// <summary>
+/// <para>Formats a printf-style string into a buffer on the stack, and asynchronously writes it
+/// to the supplied UART with one call to <see cref="Uart_EnqueueData" />. The conversions which
+/// <see cref="Format_Vsnprintf" /> supports can be used. Text which does not fit in
+/// UART_FORMAT_BUFFER_SIZE bytes is discarded.</para>
+/// <para>See <see cref="Uart_EnqueueData" /> for more information about the transmit buffer.</para>
+/// </summary>
+/// <param name="id">Which UART to write the text to.</param>
+/// <param name="format">printf-style format string.</param>
+/// <returns>Whether all text was written to the internal buffer.</returns>
+bool Uart_EnqueueFormat(UartId id, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
 /// <summary>
 /// Interrupt handler for <see cref="UartCM4Debug" />. The application should not call
 /// this function directly, but should include it in the vector table.
@@ -0,0 +1,375 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include "deferred-callbacks.h"
+#include "format.h"
+#include "mt3620-timer.h"
+#include "uart-benchmark.h"
+
+// The timer checks for timeouts, and ends each stream.
+#define TICK_PERIOD_MS 10
+
+// A probe which has not been received after this long is counted as lost.
+#define PROBE_TIMEOUT_US 20000
+
+// Largest block of the pattern which is enqueued at once.
+#define PATTERN_CHUNK_SIZE 64
+
+typedef enum {
+    BenchmarkPhase_Idle,
+    BenchmarkPhase_Latency,
+    BenchmarkPhase_Stream,
+    BenchmarkPhase_Drain
+} BenchmarkPhase;
+
+static const UartBenchmarkConfig *benchConfig = NULL;
+static BenchmarkPhase phase = BenchmarkPhase_Idle;
+static size_t rateIndex;
+static uint32_t baudRate;
+
+// Most bytes which are in flight at once, and how long the line can be silent while some are
+// in flight before they are counted as missing.
+static uint32_t windowBytes;
+static uint32_t stallTimeoutUs;
+
+// Round-trip times of the probes.
+static uint32_t probeIndex;
+static bool isProbeOutstanding;
+static uint32_t probeSentUs;
+static uint32_t probesLost;
+static uint32_t rttCount;
+static uint32_t rttMinUs;
+static uint32_t rttMaxUs;
+static uint32_t rttTotalUs;
+
+// Progress of the stream. The bytes which are in flight are those which have been sent, and
+// neither received nor counted as missing.
+static uint32_t bytesSent;
+static uint32_t bytesReceived;
+static uint32_t bytesMissing;
+static uint32_t patternErrors;
+static uint8_t expectedByte;
+static uint32_t streamStartUs;
+static uint32_t lastRxUs;
+static uint32_t streamStartCycles;
+static uint32_t streamStartIdleCycles;
+
+static void HandleRxIrq(void);
+static void HandleRxIrqDeferred(void);
+static void HandleTickIrq(void);
+static void HandleTickIrqDeferred(void);
+static void StartNextRate(void);
+static void SendProbe(void);
+static void FinishProbe(void);
+static void StartStream(void);
+static void FillWindow(void);
+static void CheckPattern(const uint8_t *data, size_t length);
+static void FinishRate(void);
+static void WriteFormat(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static inline uint32_t BytesInFlight(void)
+{
+    return bytesSent - bytesReceived - bytesMissing;
+}
+
+static void WriteFormat(const char *format, ...)
+{
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    Format_Vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    benchConfig->writeLine(line);
+}
+
+int UartBenchmark_Start(const UartBenchmarkConfig *config)
+{
+    if (phase != BenchmarkPhase_Idle || config->baudRateCount == 0) {
+        return -1;
+    }
+
+    benchConfig = config;
+    windowBytes = (uint32_t)(config->txBufferSize < config->rxBufferSize ? config->txBufferSize
+                                                                         : config->rxBufferSize);
+    WriteFormat("UART benchmark: %u baud rates, %u ms each, %u bytes in flight",
+                (unsigned)config->baudRateCount, (unsigned)config->streamMs,
+                (unsigned)windowBytes);
+
+    rateIndex = 0;
+    Gpt_LaunchPeriodicTimerMs(UART_BENCHMARK_TIMER, TICK_PERIOD_MS, HandleTickIrq);
+    StartNextRate();
+    return 0;
+}
+
+bool UartBenchmark_IsRunning(void)
+{
+    return phase != BenchmarkPhase_Idle;
+}
+
+static void HandleRxIrq(void)
+{
+    // Run before the tick, so the receive buffer is emptied quickly.
+    static DeferredCallback cbn =
+        DEFERRED_CALLBACK_INIT(HandleRxIrqDeferred, DeferredPriority_High);
+    Deferred_Enqueue(&cbn);
+}
+
+static void HandleTickIrq(void)
+{
+    static DeferredCallback cbn =
+        DEFERRED_CALLBACK_INIT(HandleTickIrqDeferred, DeferredPriority_Normal);
+    Deferred_Enqueue(&cbn);
+}
+
+/// <summary>
+///     Initialize the UART at the next baud rate which it supports, and send the first probe.
+///     Once every baud rate has been measured, stop the benchmark.
+/// </summary>
+static void StartNextRate(void)
+{
+    for (; rateIndex < benchConfig->baudRateCount; ++rateIndex) {
+        baudRate = benchConfig->baudRates[rateIndex];
+        const UartBlockModeConfig uartConfig = {.txBuffer = benchConfig->txBuffer,
+                                                .txBufferSize = benchConfig->txBufferSize,
+                                                .rxBuffer = benchConfig->rxBuffer,
+                                                .rxBufferSize = benchConfig->rxBufferSize,
+                                                .rxCallback = HandleRxIrq,
+                                                .baudRate = baudRate};
+
+        // The UART interrupt handler must not run while its buffers are reset.
+        __asm__("cpsid i");
+        int result = Uart_InitBlockMode(benchConfig->id, &uartConfig);
+        __asm__("cpsie i");
+
+        if (result == 0) {
+            // Allow twice the time to send a full window, plus a few ticks.
+            stallTimeoutUs = (uint32_t)(2ull * windowBytes * 10 * 1000000 / baudRate) +
+                             2 * TICK_PERIOD_MS * 1000;
+
+            probeIndex = 0;
+            probesLost = 0;
+            rttCount = 0;
+            rttMinUs = UINT32_MAX;
+            rttMaxUs = 0;
+            rttTotalUs = 0;
+            phase = BenchmarkPhase_Latency;
+            SendProbe();
+            return;
+        }
+
+        WriteFormat("%7u baud: not supported", (unsigned)baudRate);
+    }
+
+    phase = BenchmarkPhase_Idle;
+    Gpt_StopTimer(UART_BENCHMARK_TIMER);
+    benchConfig->writeLine("UART benchmark finished");
+    if (benchConfig->doneCallback != NULL) {
+        benchConfig->doneCallback();
+    }
+}
+
+static void SendProbe(void)
+{
+    uint8_t probe = (uint8_t)probeIndex;
+    isProbeOutstanding = true;
+    probeSentUs = Gpt_GetMicroseconds();
+    Uart_EnqueueData(benchConfig->id, &probe, 1);
+}
+
+/// <summary>
+///     Send the next probe, or start streaming once every probe has been sent.
+/// </summary>
+static void FinishProbe(void)
+{
+    isProbeOutstanding = false;
+    if (++probeIndex < benchConfig->probeCount) {
+        SendProbe();
+    } else {
+        StartStream();
+    }
+}
+
+static void StartStream(void)
+{
+    bytesSent = 0;
+    bytesReceived = 0;
+    bytesMissing = 0;
+    patternErrors = 0;
+    expectedByte = 0;
+    phase = BenchmarkPhase_Stream;
+
+    streamStartIdleCycles = Deferred_GetIdleCycles();
+    streamStartCycles = Profiler_Now();
+    streamStartUs = Gpt_GetMicroseconds();
+    lastRxUs = streamStartUs;
+    FillWindow();
+}
+
+/// <summary>
+///     Enqueue the counting pattern until the window is full. The window is no larger than the
+///     transmit buffer, so the pattern is never discarded.
+/// </summary>
+static void FillWindow(void)
+{
+    uint8_t chunk[PATTERN_CHUNK_SIZE];
+    while (BytesInFlight() < windowBytes) {
+        uint32_t length = windowBytes - BytesInFlight();
+        if (length > sizeof(chunk)) {
+            length = sizeof(chunk);
+        }
+        for (uint32_t i = 0; i < length; ++i) {
+            chunk[i] = (uint8_t)(bytesSent + i);
+        }
+        Uart_EnqueueData(benchConfig->id, chunk, length);
+        bytesSent += length;
+    }
+}
+
+/// <summary>
+///     Compare received bytes with the pattern. After a byte which does not match, skip ahead
+///     in the pattern if the byte is one which is in flight, because the bytes in between were
+///     lost; otherwise count it as a corrupted byte in place of the expected one.
+/// </summary>
+static void CheckPattern(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] != expectedByte) {
+            ++patternErrors;
+            uint8_t skipped = (uint8_t)(data[i] - expectedByte);
+            if (skipped < BytesInFlight()) {
+                bytesMissing += skipped;
+            }
+        }
+
+        if (BytesInFlight() > 0) {
+            ++bytesReceived;
+        }
+        expectedByte = (uint8_t)(bytesSent - BytesInFlight());
+    }
+}
+
+static void HandleRxIrqDeferred(void)
+{
+    UartRxSpan spans[2];
+    size_t availBytes = Uart_PeekRxData(benchConfig->id, spans);
+    if (availBytes == 0) {
+        return;
+    }
+
+    if (phase == BenchmarkPhase_Latency) {
+        // A late reply to a probe which timed out is ignored.
+        const UartRxSpan *lastSpan = spans[1].length > 0 ? &spans[1] : &spans[0];
+        uint8_t lastByte = lastSpan->data[lastSpan->length - 1];
+        Uart_ConsumeRxData(benchConfig->id, availBytes);
+        if (isProbeOutstanding && lastByte == (uint8_t)probeIndex) {
+            uint32_t rttUs = Gpt_GetMicroseconds() - probeSentUs;
+            ++rttCount;
+            rttTotalUs += rttUs;
+            rttMinUs = rttUs < rttMinUs ? rttUs : rttMinUs;
+            rttMaxUs = rttUs > rttMaxUs ? rttUs : rttMaxUs;
+            FinishProbe();
+        }
+        return;
+    }
+
+    if (phase == BenchmarkPhase_Stream || phase == BenchmarkPhase_Drain) {
+        CheckPattern(spans[0].data, spans[0].length);
+        CheckPattern(spans[1].data, spans[1].length);
+        lastRxUs = Gpt_GetMicroseconds();
+    }
+    Uart_ConsumeRxData(benchConfig->id, availBytes);
+
+    if (phase == BenchmarkPhase_Stream) {
+        FillWindow();
+    } else if (phase == BenchmarkPhase_Drain && BytesInFlight() == 0) {
+        FinishRate();
+    }
+}
+
+static void HandleTickIrqDeferred(void)
+{
+    uint32_t nowUs = Gpt_GetMicroseconds();
+
+    switch (phase) {
+    case BenchmarkPhase_Latency:
+        if (isProbeOutstanding && nowUs - probeSentUs > PROBE_TIMEOUT_US) {
+            ++probesLost;
+            FinishProbe();
+        }
+        break;
+
+    case BenchmarkPhase_Stream:
+        // If nothing has arrived for a while, the bytes in flight were lost, and the window is
+        // refilled so the stream carries on.
+        if (BytesInFlight() > 0 && nowUs - lastRxUs > stallTimeoutUs) {
+            bytesMissing += BytesInFlight();
+            lastRxUs = nowUs;
+            FillWindow();
+        }
+        if (nowUs - streamStartUs >= benchConfig->streamMs * 1000) {
+            phase = BenchmarkPhase_Drain;
+        }
+        break;
+
+    case BenchmarkPhase_Drain:
+        if (BytesInFlight() == 0 || nowUs - lastRxUs > stallTimeoutUs) {
+            bytesMissing += BytesInFlight();
+            FinishRate();
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/// <summary>
+///     Write the results for the current baud rate, and move on to the next one.
+/// </summary>
+static void FinishRate(void)
+{
+    uint32_t elapsedCycles = Profiler_Now() - streamStartCycles;
+    uint32_t idleCycles = Deferred_GetIdleCycles() - streamStartIdleCycles;
+    uint32_t busyCycles = elapsedCycles - idleCycles;
+
+    // The stream ends when its last byte arrives, rather than when the drain timed out.
+    uint32_t elapsedUs = lastRxUs - streamStartUs;
+    uint32_t bytesPerSecond =
+        elapsedUs > 0 ? (uint32_t)((uint64_t)bytesReceived * 1000000 / elapsedUs) : 0;
+    // One byte takes ten bit times, with its start and stop bits.
+    uint32_t lineRateTenthsPercent = (uint32_t)((uint64_t)bytesPerSecond * 10 * 1000 / baudRate);
+
+    WriteFormat("%7u baud: %u B/s, %u.%u%% of line rate", (unsigned)baudRate,
+                (unsigned)bytesPerSecond, (unsigned)(lineRateTenthsPercent / 10),
+                (unsigned)(lineRateTenthsPercent % 10));
+
+    UartStats stats;
+    Uart_GetStats(benchConfig->id, &stats);
+    WriteFormat("  sent %u, received %u, missing %u, mismatched %u", (unsigned)bytesSent,
+                (unsigned)bytesReceived, (unsigned)bytesMissing, (unsigned)patternErrors);
+    WriteFormat("  rx dropped %u, FIFO overruns %u, high water %u/%u, tx dropped %u",
+                (unsigned)stats.rxDroppedBytes, (unsigned)stats.rxFifoOverruns,
+                (unsigned)stats.rxHighWaterMark, (unsigned)stats.rxBufferSize,
+                (unsigned)stats.txDroppedBytes);
+
+    uint32_t busyPercent =
+        elapsedCycles > 0 ? (uint32_t)((uint64_t)busyCycles * 100 / elapsedCycles) : 0;
+    WriteFormat("  CPU %u cycles/byte, %u%% busy",
+                (unsigned)(bytesReceived > 0 ? busyCycles / bytesReceived : 0),
+                (unsigned)busyPercent);
+
+    if (rttCount > 0) {
+        WriteFormat("  round trip min %u us, avg %u us, max %u us, %u of %u probes lost",
+                    (unsigned)rttMinUs, (unsigned)(rttTotalUs / rttCount), (unsigned)rttMaxUs,
+                    (unsigned)probesLost, (unsigned)benchConfig->probeCount);
+    } else {
+        WriteFormat("  round trip: %u of %u probes lost", (unsigned)probesLost,
+                    (unsigned)benchConfig->probeCount);
+    }
+
+    ++rateIndex;
+    StartNextRate();
+}
@@ -0,0 +1,83 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef UART_BENCHMARK_H
+#define UART_BENCHMARK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mt3620-baremetal.h"
+#include "cycle-profiler.h"
+#include "mt3620-uart.h"
+
+/// <summary>Timer which the benchmark uses while it runs. The application must not use this
+/// timer at the same time. Define this when compiling to use the other timer.</summary>
+#ifndef UART_BENCHMARK_TIMER
+#define UART_BENCHMARK_TIMER TimerGpt0
+#endif
+
+/// <summary>
+/// What to measure, for <see cref="UartBenchmark_Start" />.
+/// </summary>
+typedef struct {
+    /// <summary>UART to measure. Its TX pin must be looped back to its RX pin.</summary>
+    UartId id;
+    /// <summary>Buffers which the UART is initialized with, as for
+    /// <see cref="Uart_InitBlockMode" />. They must remain valid until the benchmark
+    /// finishes.</summary>
+    uint8_t *txBuffer;
+    size_t txBufferSize;
+    uint8_t *rxBuffer;
+    size_t rxBufferSize;
+    /// <summary>Baud rates to measure, in order. The array must remain valid until the
+    /// benchmark finishes.</summary>
+    const uint32_t *baudRates;
+    size_t baudRateCount;
+    /// <summary>How long the pattern is streamed at each baud rate, in milliseconds. This must
+    /// be less than 10 seconds, because the cycle counter wraps after about 21 seconds.</summary>
+    uint32_t streamMs;
+    /// <summary>Number of single bytes which are sent one at a time at each baud rate, to
+    /// measure the round-trip time.</summary>
+    uint32_t probeCount;
+    /// <summary>Called from the main loop with each line of the results.</summary>
+    ProfileWriteLine writeLine;
+    /// <summary>Called from the main loop when every baud rate has been measured. The UART is
+    /// left at the last baud rate, with the benchmark's receive callback, so the application
+    /// should initialize it again. This can be NULL.</summary>
+    Callback doneCallback;
+} UartBenchmarkConfig;
+
+/// <summary>
+/// <para>Start measuring a UART with a loopback connection at each of the supplied baud rates.
+/// The benchmark runs from deferred callbacks and its timer, so call
+/// <see cref="Deferred_InvokeCallbacks" /> from the main loop as usual.</para>
+/// <para>At each baud rate, the UART is initialized with <see cref="Uart_InitBlockMode" />,
+/// which clears its counters. Single bytes are then sent one at a time, and the time until each
+/// is received is the round-trip time. This includes the four idle character times after which
+/// the receive callback is invoked. Then a counting pattern is streamed for the configured time,
+/// keeping no more bytes in flight than the smaller buffer holds, so that a buffer which
+/// overflows shows that the application did not keep up, rather than that it sent too much.
+/// </para>
+/// <para>The results for each baud rate are the received bytes per second and the fraction of
+/// the line rate which they reach; the bytes which were missing from the pattern and the
+/// received bytes which did not match it; the dropped bytes, FIFO overruns and high water mark
+/// from <see cref="Uart_GetStats" />; the core cycles used per byte, which are the elapsed
+/// cycles less those spent asleep in <see cref="Deferred_WaitForCallbacks" />; and the
+/// shortest, average and longest round-trip time.</para>
+/// </summary>
+/// <param name="config">What to measure. This must remain valid until the benchmark
+/// finishes.</param>
+/// <returns>0 on success; -1 if the benchmark is already running, or no baud rates were
+/// supplied.</returns>
+int UartBenchmark_Start(const UartBenchmarkConfig *config);
+
+/// <summary>
+/// Query whether the benchmark is running.
+/// </summary>
+/// <returns>true from when <see cref="UartBenchmark_Start" /> succeeds until just before the
+/// done callback is invoked; false otherwise.</returns>
+bool UartBenchmark_IsRunning(void);
+
+#endif // #ifndef UART_BENCHMARK_H
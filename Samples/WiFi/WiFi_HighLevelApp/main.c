@@ -10,6 +10,7 @@
 // - gpio (digital input for button)
 // - wificonfig (for configuring the example Wi-Fi connection)
 // - networking (for reading the device's overall network state)
+// - storage (for remembering the last connection to each stored network)
 // - log (messages shown in Visual Studio's Device Output window during debugging)
 
 #include <errno.h>
@@ -28,6 +29,7 @@
 #include <applibs/wificonfig.h>
 #include <applibs/networking.h>
 #include <applibs/log.h>
+#include <applibs/storage.h>
 
 // By default, this sample's CMake build targets hardware that follows the MT3620
 // Reference Development Board (RDB) specification, such as the MT3620 Dev Kit from
@@ -44,9 +46,22 @@
 
 // This sample uses a single-thread event loop pattern, based on epoll and timerfd
 #include "epoll_timerfd_utilities.h"
-
-// The MT3620 currently handles a maximum of 37 stored wifi networks.
-static const unsigned int MAX_NUMBER_STORED_NETWORKS = 37;
+// The buttons are debounced on a single timer, which reports only presses and releases
+#include "input_manager.h"
+// Wi-Fi scans run on a worker thread so that a scan doesn't stall the event loop
+#include "wifi_scan_manager.h"
+#include "wifi_scan_aggregator.h"
+// The last connection to each stored network is kept, so the device can look for it at boot
+#include "wifi_connection_cache.h"
+#include "network_monitor.h"
+// A copy of the stored networks is kept, so they are not read again for every state
+#include "stored_network_manager.h"
+
+// Maximum number of available networks which are output after a scan.
+#define MAX_NUMBER_AVAILABLE_NETWORKS_SHOWN 20
+
+// Collapses the scanned networks; static because it is too large for the stack.
+static WifiScanAggregator scanAggregator;
 
 // Network configuration: Configure the variables with your Wpa2 network information
 static const uint8_t sampleNetworkSsid[] = "WIFI_NETWORK_SSID";
@@ -63,15 +78,23 @@ static const char *securityTypeToString[] = {"Unknown", "Open", "WPA2/PSK"};
 // File descriptors - initialized to invalid value
 static int changeNetworkConfigButtonGpioFd = -1;
 static int showNetworkStatusButtonGpioFd = -1;
-static int buttonPollTimerFd = -1;
 static int epollFd = -1;
 
-// Button state variables
-static GPIO_Value_Type changeNetworkConfigButtonState = GPIO_Value_High;
-static GPIO_Value_Type showNetworkStatusButtonState = GPIO_Value_High;
+static InputManager inputManager;
 
 static int sampleStoredNetworkId = -1;
 
+// The last connection to each stored network is kept in a key-value store in the mutable file.
+// The sample works without it if the file cannot be opened.
+#define CONNECTION_CACHE_SIZE (8 * 1024)
+static KvStore connectionCache;
+static uint8_t connectionCacheBuffer[KV_STORE_MAX_RECORD_SIZE];
+static bool connectionCacheOpen = false;
+
+// Watches for the Wi-Fi connection, so that it is recorded each time it is made.
+static NetworkMonitor networkMonitor;
+static const char wifiInterface[] = "wlan0";
+
 // Available states
 static void WifiNetworkConfigureAndAddState(void);
 static void WifiNetworkEnableState(void);
@@ -108,81 +131,6 @@ static void StateStatusOutputHelper(const char *currentStateMessage, const char
         currentStateMessage, statusIsSuccessful ? "SUCCESS" : "FAILED", nextStateMessage);
 }
 
-/// <summary>
-///     Checks if the given stored network is the same as the one specified in the configuration
-///     above.
-/// </summary>
-/// <param name="target">Target network used for comparison</param>
-/// <param name="source">Source network used for comparison</param>
-/// <returns>True if is the same access point, false otherwise</returns>
-static bool IsSameStoredWifiNetwork(const WifiConfig_StoredNetwork *target)
-{
-    if (target->security == sampleNetworkSecurityType &&
-        target->ssidLength == sampleNetworkSsidLength) {
-        return 0 == memcmp(target->ssid, sampleNetworkSsid, sampleNetworkSsidLength);
-    }
-    return false;
-}
-
-/// <summary>
-///     Checks if the given scanned network is the same as the one specified in the configuration
-///     above.
-/// </summary>
-/// <param name="target">Target network used for comparison</param>
-/// <param name="source">Source network used for comparison</param>
-/// <returns>True if is the same access point, false otherwise</returns>
-static bool IsSameScannedWifiNetwork(const WifiConfig_ScannedNetwork *target,
-                                     const WifiConfig_ScannedNetwork *source)
-{
-    if (target->security == source->security && target->ssidLength == source->ssidLength) {
-        return 0 == memcmp(target->ssid, source->ssid, target->ssidLength);
-    }
-    return false;
-}
-
-/// <summary>
-///     Retrieves the stored networks on the device.
-/// </summary>
-/// <param name="numberOfNetworksStored">Output param used to retrieve the number of stored
-/// networks on the device</param>
-/// <param name="storedNetworksArray">Output param used to maintain the stored networks on the
-/// device.</param>
-/// <returns>Returns 0 in case of success, -1 otherwise</returns>
-static int WifiRetrieveStoredNetworks(ssize_t *numberOfNetworksStored,
-                                      WifiConfig_StoredNetwork *storedNetworksArray)
-{
-    ssize_t temporaryNumberOfNetworks = WifiConfig_GetStoredNetworkCount();
-    if (temporaryNumberOfNetworks < 0) {
-        Log_Debug("ERROR: WifiConfig_GetStoredNetworkCount failed: %s (%d).\n", strerror(errno),
-                  errno);
-        return -1;
-    }
-
-    assert(temporaryNumberOfNetworks <= MAX_NUMBER_STORED_NETWORKS);
-
-    if (temporaryNumberOfNetworks == 0) {
-        *numberOfNetworksStored = 0;
-        return 0;
-    }
-
-    WifiConfig_StoredNetwork temporaryStoredNetworksArray[temporaryNumberOfNetworks];
-    temporaryNumberOfNetworks = WifiConfig_GetStoredNetworks(temporaryStoredNetworksArray,
-                                                             (size_t)temporaryNumberOfNetworks);
-    if (temporaryNumberOfNetworks < 0) {
-        Log_Debug("ERROR: WifiConfig_GetStoredNetworks failed: %s (%d).\n", strerror(errno), errno);
-        return -1;
-    }
-    for (size_t i = 0; i < temporaryNumberOfNetworks; ++i) {
-        storedNetworksArray[i] = temporaryStoredNetworksArray[i];
-    }
-
-    memcpy(storedNetworksArray, temporaryStoredNetworksArray, (size_t)temporaryNumberOfNetworks);
-
-    *numberOfNetworksStored = temporaryNumberOfNetworks;
-
-    return 0;
-}
-
 /// <summary>
 ///     Configures and stores a new network based on the SSID, network security type and the psk
 ///     provided and saves the configuration.
@@ -200,33 +148,35 @@ static void WifiNetworkConfigureAndAddState(void)
         return;
     }
 
-    ssize_t numberOfNetworksStored;
-    WifiConfig_StoredNetwork storedNetworksArray[MAX_NUMBER_STORED_NETWORKS];
-    int result = WifiRetrieveStoredNetworks(&numberOfNetworksStored, storedNetworksArray);
-    if (result != 0) {
+    // If the ssid is stored, move to the next state
+    // otherwise continue configuring the new network
+    sampleStoredNetworkId = StoredNetworkManager_Find(sampleNetworkSsid, sampleNetworkSsidLength,
+                                                      sampleNetworkSecurityType);
+    if (sampleStoredNetworkId >= 0) {
+        nextStateFunction = WifiNetworkEnableState;
+        StateStatusOutputHelper("storing the existing", "enabled", true);
+        return;
+    }
+    if (errno != ENOENT) {
         terminationRequired = true;
         return;
     }
 
-    // If the ssid is stored, move to the next state
-    // otherwise continue configuring the new network
-    for (size_t i = 0; i < numberOfNetworksStored; ++i) {
-        if (IsSameStoredWifiNetwork(&storedNetworksArray[i])) {
-            sampleStoredNetworkId = (int)i;
-            nextStateFunction = WifiNetworkEnableState;
-            StateStatusOutputHelper("storing the existing", "enabled", true);
-            return;
-        }
-    }
+    // Look for the network by name if the device has connected to it before
+    WifiConnectionCacheEntry cachedConnection;
+    bool targetedScan =
+        connectionCacheOpen &&
+        WifiConnectionCache_Get(&connectionCache, sampleNetworkSsid, sampleNetworkSsidLength,
+                                sampleNetworkSecurityType, &cachedConnection) == 0;
 
-    sampleStoredNetworkId = WifiConfig_AddNetwork();
+    sampleStoredNetworkId = StoredNetworkManager_AddNetwork();
     if (sampleStoredNetworkId < 0) {
         Log_Debug("ERROR: WifiConfig_AddNetwork failed: %s (%d).\n", strerror(errno), errno);
         terminationRequired = true;
         return;
     }
 
-    result = WifiConfig_SetSecurityType(sampleStoredNetworkId, sampleNetworkSecurityType);
+    int result = WifiConfig_SetSecurityType(sampleStoredNetworkId, sampleNetworkSecurityType);
     if (result < 0) {
         Log_Debug("ERROR: WifiConfig_SetSecurityType failed: %s (%d).\n", strerror(errno), errno);
         terminationRequired = true;
@@ -251,6 +201,14 @@ static void WifiNetworkConfigureAndAddState(void)
         return;
     }
 
+    result = WifiConfig_SetTargetedScanEnabled(sampleStoredNetworkId, targetedScan);
+    if (result < 0) {
+        Log_Debug("ERROR: WifiConfig_SetTargetedScanEnabled failed: %s (%d).\n", strerror(errno),
+                  errno);
+        terminationRequired = true;
+        return;
+    }
+
     result = WifiConfig_PersistConfig();
     if (result < 0) {
         Log_Debug("ERROR: WifiConfig_PersistConfig failed: %s (%d).\n", strerror(errno), errno);
@@ -268,7 +226,7 @@ static void WifiNetworkConfigureAndAddState(void)
 /// </summary>
 static void WifiNetworkEnableState(void)
 {
-    int result = WifiConfig_SetNetworkEnabled(sampleStoredNetworkId, true);
+    int result = StoredNetworkManager_SetNetworkEnabled(sampleStoredNetworkId, true);
     if (result < 0) {
         Log_Debug("ERROR: WifiConfig_SetNetworkEnabled failed: %s (%d).\n", strerror(errno), errno);
         terminationRequired = true;
@@ -285,7 +243,7 @@ static void WifiNetworkEnableState(void)
 /// </summary>
 static void WifiNetworkDisableState(void)
 {
-    int result = WifiConfig_SetNetworkEnabled(sampleStoredNetworkId, false);
+    int result = StoredNetworkManager_SetNetworkEnabled(sampleStoredNetworkId, false);
     if (result < 0) {
         Log_Debug("ERROR: WifiConfig_SetNetworkEnabled failed: %s (%d).\n", strerror(errno), errno);
         terminationRequired = true;
@@ -302,7 +260,7 @@ static void WifiNetworkDisableState(void)
 /// </summary>
 static void WifiNetworkDeleteState(void)
 {
-    int result = WifiConfig_ForgetNetworkById(sampleStoredNetworkId);
+    int result = StoredNetworkManager_ForgetNetwork(sampleStoredNetworkId);
     if (result < 0) {
         Log_Debug("ERROR: WifiConfig_ForgetNetworkById failed: %s (%d).\n", strerror(errno), errno);
         terminationRequired = true;
@@ -316,69 +274,45 @@ static void WifiNetworkDeleteState(void)
         return;
     }
 
+    // The network is gone, so its last connection is no longer needed
+    if (connectionCacheOpen) {
+        WifiConnectionCache_Forget(&connectionCache, sampleNetworkSsid, sampleNetworkSsidLength,
+                                   sampleNetworkSecurityType);
+    }
+
     // set the next state
     nextStateFunction = WifiNetworkConfigureAndAddState;
     StateStatusOutputHelper("deleting the", "configured and added", true);
 }
 
 /// <summary>
-///     Comparison function used to sort available networks based on SSID.
-/// </summary>
-/// <param name="network1">The first scanned network to compare</param>
-/// <param name="network2">The second scanned network to compare</param>
-int CompareSsid(const void *network1, const void *network2)
-{
-    const WifiConfig_ScannedNetwork *scannedNetwork1 = (const WifiConfig_ScannedNetwork *)network1;
-    const WifiConfig_ScannedNetwork *scannedNetwork2 = (const WifiConfig_ScannedNetwork *)network2;
-    size_t minSsidLength = 0;
-    if (scannedNetwork1->ssidLength > scannedNetwork2->ssidLength) {
-        minSsidLength = scannedNetwork2->ssidLength;
-    } else {
-        minSsidLength = scannedNetwork1->ssidLength;
-    }
-
-    return memcmp(scannedNetwork1->ssid, scannedNetwork2->ssid, minSsidLength);
-}
-
-/// <summary>
-///     Sorts the available scanned networks based on their RSSI signals and outputs the SSID and
-///     the RSSI signal.
+///     Outputs the SSID, security type and RSSI signal of the strongest available networks,
+///     strongest first.
 /// </summary>
 /// <param name="scannedNetworksArray">An array which contains the scanned networks</param>
 /// <param name="numberOfScannedNetworks">The size of the array</param>
-static void SortAndDeduplicateAvailableNetworks(
-    const WifiConfig_ScannedNetwork *scannedNetworksArray, size_t numberOfScannedNetworks)
+static void OutputStrongestAvailableNetworks(const WifiConfig_ScannedNetwork *scannedNetworksArray,
+                                             size_t numberOfScannedNetworks)
 {
-    // sort the array based on the SSID
-    qsort((void *)scannedNetworksArray, numberOfScannedNetworks, sizeof(WifiConfig_ScannedNetwork),
-          CompareSsid);
-
-    WifiConfig_ScannedNetwork deduplicatedScannedNetworks[numberOfScannedNetworks];
-    deduplicatedScannedNetworks[0] = scannedNetworksArray[0];
-    unsigned int j = 0;
-    unsigned int i = 1;
-
-    // iterate over the array and keep the SSID with the highest RSSI signal
-    for (i = 1; i < numberOfScannedNetworks; ++i) {
-        if (!IsSameScannedWifiNetwork(&deduplicatedScannedNetworks[j], &scannedNetworksArray[i])) {
-            j++;
-            deduplicatedScannedNetworks[j] = scannedNetworksArray[i];
-        } else if (deduplicatedScannedNetworks[j].signalRssi < scannedNetworksArray[i].signalRssi) {
-            deduplicatedScannedNetworks[j] = scannedNetworksArray[i];
-        }
-    }
-    size_t numberOfDeduplicatedNetworks = j + 1;
+    // keep the strongest signal seen for each SSID and security type
+    WifiScanAggregator_Reset(&scanAggregator);
+    WifiScanAggregator_AddAll(&scanAggregator, scannedNetworksArray, numberOfScannedNetworks);
+
+    const WifiConfig_ScannedNetwork *strongestNetworks[MAX_NUMBER_AVAILABLE_NETWORKS_SHOWN];
+    size_t numberOfStrongestNetworks = WifiScanAggregator_GetStrongest(
+        &scanAggregator, strongestNetworks, MAX_NUMBER_AVAILABLE_NETWORKS_SHOWN);
 
     Log_Debug("INFO: Available Wi-Fi networks:\n");
-    for (i = 0; i < numberOfDeduplicatedNetworks; ++i) {
-        for (j = 0; j < deduplicatedScannedNetworks[i].ssidLength; ++j) {
-            Log_Debug("%c", isprint(deduplicatedScannedNetworks[i].ssid[j])
-                                ? deduplicatedScannedNetworks[i].ssid[j]
-                                : '.');
+    for (size_t i = 0; i < numberOfStrongestNetworks; ++i) {
+        const WifiConfig_ScannedNetwork *network = strongestNetworks[i];
+        for (size_t j = 0; j < network->ssidLength; ++j) {
+            Log_Debug("%c", isprint(network->ssid[j]) ? network->ssid[j] : '.');
         }
-        assert(deduplicatedScannedNetworks[i].security < 3);
-        Log_Debug(" : %s : %d dB\n", securityTypeToString[deduplicatedScannedNetworks[i].security],
-                  deduplicatedScannedNetworks[i].signalRssi);
+        assert(network->security < 3);
+        Log_Debug(" : %s : %d dB\n", securityTypeToString[network->security], network->signalRssi);
+    }
+    if (scanAggregator.count > numberOfStrongestNetworks || scanAggregator.droppedCount > 0) {
+        Log_Debug("INFO: Only the %zu strongest networks are shown.\n", numberOfStrongestNetworks);
     }
 }
 
@@ -429,6 +363,9 @@ static int CheckCurrentWifiNetworkStatus(void)
         assert(connectedNetwork.security < 3);
         Log_Debug(" : %s : %d dB\n", securityTypeToString[connectedNetwork.security],
                   connectedNetwork.signalRssi);
+        if (connectionCacheOpen) {
+            WifiConnectionCache_Record(&connectionCache, &connectedNetwork);
+        }
     }
 
     return result;
@@ -440,10 +377,13 @@ static int CheckCurrentWifiNetworkStatus(void)
 /// <returns>0 in case of success, any other value in case of failure</returns>
 static int OutputStoredWifiNetworks(void)
 {
-    ssize_t numberOfNetworksStored;
-    WifiConfig_StoredNetwork storedNetworksArray[MAX_NUMBER_STORED_NETWORKS];
-    int result = WifiRetrieveStoredNetworks(&numberOfNetworksStored, storedNetworksArray);
-    if (result != 0) {
+    // Whether a network is connected can change at any time, so read the networks again
+    const WifiConfig_StoredNetwork *storedNetworksArray;
+    ssize_t numberOfNetworksStored = -1;
+    if (StoredNetworkManager_Refresh() == 0) {
+        numberOfNetworksStored = StoredNetworkManager_GetNetworks(&storedNetworksArray);
+    }
+    if (numberOfNetworksStored < 0) {
         terminationRequired = true;
         return -1;
     }
@@ -466,35 +406,39 @@ static int OutputStoredWifiNetworks(void)
 }
 
 /// <summary>
-///     Triggers a Wi-Fi network scan, stores the available networks, deduplicates them and outputs
-///     the SSID of the available networks sorted and deduplicated based on their SSID.
+///     Triggers a Wi-Fi network scan. When the scan finishes, the SSID of the available networks
+///     is output, deduplicated based on their SSID and sorted by signal strength.
 /// </summary>
 /// <returns>0 in case of success, any other value in case of failure</returns>
 static int OutputScannedWifiNetworks(void)
 {
-    // Check the available Wi-Fi networks
-    ssize_t numberOfNetworks = WifiConfig_TriggerScanAndGetScannedNetworkCount();
-    if (numberOfNetworks < 0) {
-        Log_Debug("ERROR: WifiConfig_TriggerScanAndGetScannedNetworkCount failed: %s (%d).\n",
-                  strerror(errno), errno);
+    // Check the available Wi-Fi networks. The results are output by WifiScanCompletedHandler
+    // once the scan has finished.
+    if (WifiScanManager_StartScan() != 0) {
         return -1;
-    } else if (numberOfNetworks == 0) {
-        Log_Debug("INFO: Couldn't find any available Wi-Fi networks\n");
-        return 0;
     }
+    Log_Debug("INFO: Scanning for Wi-Fi networks.\n");
+    return 0;
+}
 
-    WifiConfig_ScannedNetwork scannedNetworksArray[numberOfNetworks];
-    ssize_t numberOfScannedNetworks =
-        WifiConfig_GetScannedNetworks(scannedNetworksArray, (size_t)numberOfNetworks);
+/// <summary>
+///     Wi-Fi scan completed event: output the available Wi-Fi networks.
+/// </summary>
+/// <param name="eventData">Contains context data for epoll events.</param>
+static void WifiScanCompletedHandler(EventData *eventData)
+{
+    const WifiConfig_ScannedNetwork *scannedNetworks;
+    ssize_t numberOfScannedNetworks = WifiScanManager_GetResults(&scannedNetworks);
     if (numberOfScannedNetworks < 0) {
-        Log_Debug("ERROR: WifiConfig_GetScannedNetworks failed: %s (%d).\n", strerror(errno),
-                  errno);
-        return -1;
+        Log_Debug("ERROR: Wi-Fi scan failed: %s (%d).\n", strerror(errno), errno);
+        terminationRequired = true;
+        return;
+    } else if (numberOfScannedNetworks == 0) {
+        Log_Debug("INFO: Couldn't find any available Wi-Fi networks\n");
+        return;
     }
 
-    SortAndDeduplicateAvailableNetworks(scannedNetworksArray, (size_t)numberOfScannedNetworks);
-
-    return 0;
+    OutputStrongestAvailableNetworks(scannedNetworks, (size_t)numberOfScannedNetworks);
 }
 
 /// <summary>
@@ -524,55 +468,79 @@ static void ShowDeviceNetworkStatus(void)
 }
 
 /// <summary>
-///     Check whether a given button has just been pressed.
+/// BUTTON_1 changed state: when it is pressed, advance to the next state.
 /// </summary>
-/// <param name="fd">The button file descriptor</param>
-/// <param name="oldState">Old state of the button (pressed or released)</param>
-/// <returns>True if pressed, false otherwise</returns>
-static bool IsButtonPressed(int fd, GPIO_Value_Type *oldState)
+/// <param name="input">The button.</param>
+/// <param name="isPressed">Whether the button has been pressed or released.</param>
+static void ChangeNetworkConfigButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    bool isButtonPressed = false;
-    GPIO_Value_Type newState;
-    int result = GPIO_GetValue(fd, &newState);
-    if (result != 0) {
-        Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n", strerror(errno), errno);
-        terminationRequired = true;
-    } else {
-        // Button is pressed if it is low and different than last known state.
-        isButtonPressed = (newState != *oldState) && (newState == GPIO_Value_Low);
-        *oldState = newState;
+    if (isPressed) {
+        nextStateFunction();
     }
-
-    return isButtonPressed;
 }
 
 /// <summary>
-/// Button timer event:  Check the status of both buttons.
+/// BUTTON_2 changed state: when it is pressed, show the network status.
 /// </summary>
-/// <param name="eventData">Contains context data for epoll events.</param>
-static void ButtonEventTimeHandler(EventData *eventData)
+/// <param name="input">The button.</param>
+/// <param name="isPressed">Whether the button has been pressed or released.</param>
+static void ShowNetworkStatusButtonHandler(InputManagerInput *input, bool isPressed)
 {
-    if (ConsumeTimerFdEvent(eventData->fd) != 0) {
-        terminationRequired = true;
-        return;
+    if (isPressed) {
+        ShowDeviceNetworkStatus();
     }
+}
 
-    // Check if BUTTON_1 was pressed
-    bool isButtonPressed =
-        IsButtonPressed(changeNetworkConfigButtonGpioFd, &changeNetworkConfigButtonState);
-    if (isButtonPressed) {
-        nextStateFunction();
-    }
+/// <summary>
+/// The input manager could not read a button, so exit.
+/// </summary>
+static void ButtonReadErrorHandler(InputManager *manager, InputManagerInput *input, int error)
+{
+    terminationRequired = true;
+}
 
-    // Check if BUTTON_2 was pressed
-    isButtonPressed = IsButtonPressed(showNetworkStatusButtonGpioFd, &showNetworkStatusButtonState);
-    if (isButtonPressed) {
-        ShowDeviceNetworkStatus();
+// The buttons read low when they are pressed.
+static InputManagerInput changeNetworkConfigButton = {
+    .activeValue = GPIO_Value_Low, .changedHandler = &ChangeNetworkConfigButtonHandler};
+static InputManagerInput showNetworkStatusButton = {
+    .activeValue = GPIO_Value_Low, .changedHandler = &ShowNetworkStatusButtonHandler};
+
+// event handler data structures. Only the event handler field needs to be populated.
+static EventData wifiScanCompletedEventData = {.eventHandler = &WifiScanCompletedHandler};
+
+/// <summary>
+///     The state of the Wi-Fi connection has changed: when it has been made, record it.
+/// </summary>
+static void NetworkStateHandler(NetworkMonitor *monitor, uint32_t events,
+                                const NetworkMonitorState *state, void *context)
+{
+    WifiConfig_ConnectedNetwork connectedNetwork;
+    if ((events & NetworkMonitorEvent_Up) != 0 && connectionCacheOpen &&
+        WifiConfig_GetCurrentNetwork(&connectedNetwork) == 0) {
+        WifiConnectionCache_Record(&connectionCache, &connectedNetwork);
     }
 }
 
-// event handler data structures. Only the event handler field needs to be populated.
-static EventData buttonPollTimerEventData = {.eventHandler = &ButtonEventTimeHandler};
+/// <summary>
+///     Opens the cache of the last connection to each stored network, and uses a targeted scan
+///     for the networks which the device has connected to before.
+/// </summary>
+static void OpenConnectionCache(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        Log_Debug("ERROR: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    if (KvStore_Open(&connectionCache, fd, 0, CONNECTION_CACHE_SIZE, connectionCacheBuffer,
+                     sizeof(connectionCacheBuffer)) != 0) {
+        Log_Debug("ERROR: Could not open the Wi-Fi connection cache.\n");
+        return;
+    }
+    connectionCacheOpen = true;
+
+    WifiConnectionCache_PreferCachedNetworks(&connectionCache);
+}
 
 /// <summary>
 ///     Set up SIGTERM termination handler, initialize peripherals, and set up event handlers.
@@ -590,7 +558,7 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    // Open button GPIO as input, and set up a timer to poll it
+    // Open button GPIO as input
     Log_Debug("Opening SAMPLE_BUTTON_1 as input.\n");
     changeNetworkConfigButtonGpioFd = GPIO_OpenAsInput(SAMPLE_BUTTON_1);
     if (changeNetworkConfigButtonGpioFd < 0) {
@@ -608,10 +576,33 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
-    struct timespec buttonPressCheckPeriod = {0, 1000000};
-    buttonPollTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &buttonPressCheckPeriod,
-                                                   &buttonPollTimerEventData, EPOLLIN);
-    if (buttonPollTimerFd < 0) {
+    if (InputManager_Init(&inputManager, epollFd, NULL, 0, &ButtonReadErrorHandler) != 0) {
+        return -1;
+    }
+    // Sample the buttons less often while neither of them is changing.
+    static const struct timespec idleSamplePeriod = {0,
+                                                     INPUT_MANAGER_SUGGESTED_IDLE_SAMPLE_PERIOD_NS};
+    if (InputManager_SetIdleSamplePeriod(&inputManager, &idleSamplePeriod) != 0) {
+        return -1;
+    }
+    changeNetworkConfigButton.gpioFd = changeNetworkConfigButtonGpioFd;
+    InputManager_AddInput(&inputManager, &changeNetworkConfigButton);
+    showNetworkStatusButton.gpioFd = showNetworkStatusButtonGpioFd;
+    InputManager_AddInput(&inputManager, &showNetworkStatusButton);
+
+    if (WifiScanManager_Init(epollFd, &wifiScanCompletedEventData) != 0) {
+        return -1;
+    }
+
+    OpenConnectionCache();
+    const NetworkMonitorConfig networkMonitorConfig = {
+        .interfaceName = wifiInterface,
+        .requiredStatus = Networking_InterfaceConnectionStatus_ConnectedToNetwork,
+        .minInterval = {1, 0},
+        .waitingInterval = {8, 0},
+        .readyInterval = {60, 0}};
+    if (NetworkMonitor_Init(&networkMonitor, epollFd, &networkMonitorConfig) != 0 ||
+        NetworkMonitor_AddHandler(&networkMonitor, &NetworkStateHandler, NULL) != 0) {
         return -1;
     }
 
@@ -624,7 +615,10 @@ static int InitPeripheralsAndHandlers(void)
 static void ClosePeripheralsAndHandlers(void)
 {
     Log_Debug("\nClosing file descriptors.\n");
-    CloseFdAndPrintError(buttonPollTimerFd, "ButtonPollTimer");
+    WifiScanManager_Cleanup();
+    NetworkMonitor_Close(&networkMonitor);
+    KvStore_Close(&connectionCache);
+    InputManager_Close(&inputManager);
     CloseFdAndPrintError(changeNetworkConfigButtonGpioFd, "Button1Gpio");
     CloseFdAndPrintError(showNetworkStatusButtonGpioFd, "Button2Gpio");
     CloseFdAndPrintError(epollFd, "Epoll");
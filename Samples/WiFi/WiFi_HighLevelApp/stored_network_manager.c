@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "stored_network_manager.h"
+
+static WifiConfig_StoredNetwork storedNetworks[STORED_NETWORK_MANAGER_MAX_NETWORKS];
+static size_t storedNetworkCount = 0;
+static bool storedNetworksValid = false;
+
+int StoredNetworkManager_Refresh(void)
+{
+    storedNetworksValid = false;
+
+    // The networks are read straight into the copy, so no temporary array is needed
+    ssize_t count =
+        WifiConfig_GetStoredNetworks(storedNetworks, STORED_NETWORK_MANAGER_MAX_NETWORKS);
+    if (count < 0) {
+        Log_Debug("ERROR: WifiConfig_GetStoredNetworks failed: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    storedNetworkCount = (size_t)count < STORED_NETWORK_MANAGER_MAX_NETWORKS
+                             ? (size_t)count
+                             : STORED_NETWORK_MANAGER_MAX_NETWORKS;
+    storedNetworksValid = true;
+    return 0;
+}
+
+ssize_t StoredNetworkManager_GetNetworks(const WifiConfig_StoredNetwork **networks)
+{
+    if (!storedNetworksValid && StoredNetworkManager_Refresh() != 0) {
+        *networks = NULL;
+        return -1;
+    }
+
+    *networks = storedNetworks;
+    return (ssize_t)storedNetworkCount;
+}
+
+int StoredNetworkManager_Find(const uint8_t *ssid, size_t ssidLength,
+                              WifiConfig_Security_Type security)
+{
+    const WifiConfig_StoredNetwork *networks;
+    ssize_t count = StoredNetworkManager_GetNetworks(&networks);
+    if (count < 0) {
+        return -1;
+    }
+
+    for (ssize_t i = 0; i < count; ++i) {
+        if (networks[i].security == security && networks[i].ssidLength == ssidLength &&
+            memcmp(networks[i].ssid, ssid, ssidLength) == 0) {
+            return (int)i;
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+int StoredNetworkManager_AddNetwork(void)
+{
+    storedNetworksValid = false;
+    return WifiConfig_AddNetwork();
+}
+
+int StoredNetworkManager_SetNetworkEnabled(int networkId, bool enabled)
+{
+    int result = WifiConfig_SetNetworkEnabled(networkId, enabled);
+    if (result != 0) {
+        // The copy may no longer match the device, so it is read again when it is next used.
+        storedNetworksValid = false;
+        return result;
+    }
+
+    if (storedNetworksValid && networkId >= 0 && (size_t)networkId < storedNetworkCount) {
+        storedNetworks[networkId].isEnabled = enabled;
+    }
+    return 0;
+}
+
+int StoredNetworkManager_ForgetNetwork(int networkId)
+{
+    storedNetworksValid = false;
+    return WifiConfig_ForgetNetworkById(networkId);
+}
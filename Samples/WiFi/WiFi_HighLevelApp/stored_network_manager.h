@@ -0,0 +1,69 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "applibs_versions.h"
+#include <applibs/wificonfig.h>
+
+/// <summary>The MT3620 currently handles a maximum of 37 stored Wi-Fi networks.</summary>
+#define STORED_NETWORK_MANAGER_MAX_NETWORKS 37
+
+// Keeps a copy of the device's stored Wi-Fi networks, indexed by network ID, so that
+// finding a network or changing its state does not read every stored network with
+// WifiConfig_GetStoredNetworks each time.
+// The copy is read when it is first needed, and again after this application adds or
+// forgets a network through the manager, since the IDs of the other networks can then
+// change. Enabling or disabling a network through the manager updates the copy in place.
+// Whether a network is connected changes without the application doing anything, so call
+// StoredNetworkManager_Refresh before that is shown.
+
+/// <summary>
+///     Gets the stored networks, reading them only if the copy is not valid.
+/// </summary>
+/// <param name="networks">Receives a pointer to the networks, whose indices are their IDs. The
+/// array belongs to the manager, and remains valid until the copy is next read.</param>
+/// <returns>The number of networks, or -1 on failure</returns>
+ssize_t StoredNetworkManager_GetNetworks(const WifiConfig_StoredNetwork **networks);
+
+/// <summary>
+///     Reads the stored networks again, even if the copy is valid.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int StoredNetworkManager_Refresh(void);
+
+/// <summary>
+///     Finds a stored network by its SSID and security type.
+/// </summary>
+/// <param name="ssid">SSID of the network.</param>
+/// <param name="ssidLength">Length of the SSID in bytes.</param>
+/// <param name="security">Security type of the network.</param>
+/// <returns>The ID of the network, or -1 if it is not stored, in which case errno is ENOENT,
+/// or if the networks could not be read</returns>
+int StoredNetworkManager_Find(const uint8_t *ssid, size_t ssidLength,
+                              WifiConfig_Security_Type security);
+
+/// <summary>
+///     Adds a network with WifiConfig_AddNetwork, and marks the copy as not valid.
+/// </summary>
+/// <returns>The ID of the new network, or -1 on failure</returns>
+int StoredNetworkManager_AddNetwork(void);
+
+/// <summary>
+///     Enables or disables a stored network, and updates the copy.
+/// </summary>
+/// <param name="networkId">ID of the network.</param>
+/// <param name="enabled">Whether the network is enabled.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int StoredNetworkManager_SetNetworkEnabled(int networkId, bool enabled);
+
+/// <summary>
+///     Forgets a stored network, and marks the copy as not valid.
+/// </summary>
+/// <param name="networkId">ID of the network.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int StoredNetworkManager_ForgetNetwork(int networkId);
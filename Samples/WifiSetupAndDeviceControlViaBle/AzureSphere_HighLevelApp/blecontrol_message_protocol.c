@@ -15,6 +15,9 @@
 static uint8_t bleDeviceName[BLE_DEVICE_NAME_MAX_LEN];
 static uint8_t bleDeviceNameLength;
 #define BLE_PASSKEY_LEN 6
+// Baud rate asked for once the BLE device is initialized. Both the MT3620 and the nRF52 run
+// this rate exactly.
+#define BLE_UART_FAST_BAUD_RATE 1000000u
 static uint8_t blePasskey[BLE_PASSKEY_LEN + 1];
 static BleControlMessageProtocol_StateChangeHandlerType bleStateChangeHandler = NULL;
 static bool initializeDeviceRequired;
@@ -22,6 +25,9 @@ static bool setPasskeyRequired;
 static bool changeBleAdvertisingModeRequired;
 static bool deleteAllBleBondsDeviceRequired;
 static int bleAdvertiseToAllTimerFd = -1;
+static int uartBaudRateSettleTimerFd = -1;
+static uint32_t uartBaudRate = BLE_CONTROL_MESSAGE_PROTOCOL_DEFAULT_UART_BAUD_RATE;
+static uint32_t pendingUartBaudRate;
 
 static BleControlMessageProtocol_BleAdvertisingMode currentAdvertisingMode;
 static BleControlMessageProtocol_BleAdvertisingMode desiredAdvertisingMode;
@@ -45,6 +51,7 @@ static void GenerateRandomBlePasskey(void)
 }
 
 static void ChangeBleProtocolState(BleControlMessageProtocolState state);
+static void SendSetUartBaudRateRequest(void);
 
 static void SetPasskeyResponseHandler(MessageProtocol_CategoryId categoryId,
                                       MessageProtocol_RequestId requestId, const uint8_t *data,
@@ -109,9 +116,14 @@ static void InitializeBleDeviceResponseHandler(MessageProtocol_CategoryId catego
     }
 
     if (blePublicState == BleControlMessageProtocolState_Uninitialized) {
-        // Do the next initialization step - send passkey.
+        // Do the next initialization step - speed up the UART if possible, then send passkey.
         Log_Debug("INFO: \"Initialize BLE Device\" succeeded.\n");
-        SendSetPasskeyRequest();
+        if (MessageProtocol_CanChangeUartBaudRate() &&
+            uartBaudRate != BLE_UART_FAST_BAUD_RATE) {
+            SendSetUartBaudRateRequest();
+        } else {
+            SendSetPasskeyRequest();
+        }
     } else {
         // This response should only be received during the initialization phase.
         Log_Debug("ERROR: \"Initialize BLE Device\" response received when not expected.\n");
@@ -162,6 +174,56 @@ static void ChangeBleAdvertisingModeResponseHandler(MessageProtocol_CategoryId c
     ChangeBleProtocolState(newState);
 }
 
+static void SetUartBaudRateResponseHandler(MessageProtocol_CategoryId categoryId,
+                                           MessageProtocol_RequestId requestId,
+                                           const uint8_t *data, size_t dataSize,
+                                           MessageProtocol_ResponseResult result, bool timedOut)
+{
+    // A BLE device which cannot change rate keeps the link at the default rate, so carry on
+    // with the initialization either way.
+    if (timedOut || result != 0 ||
+        dataSize != sizeof(BleControlMessageProtocol_SetUartBaudRateStruct)) {
+        Log_Debug("INFO: \"Set UART Baud Rate\" was not accepted; staying at %u baud.\n",
+                  uartBaudRate);
+        SendSetPasskeyRequest();
+        return;
+    }
+
+    // The BLE device switches rate after sending this response. Give it time to do so before
+    // following it, so the next request is not sent while it is still at the old rate.
+    pendingUartBaudRate = ((const BleControlMessageProtocol_SetUartBaudRateStruct *)data)->baudRate;
+    static const struct timespec settleTime = {0, 10 * 1000 * 1000};
+    SetTimerFdToSingleExpiry(uartBaudRateSettleTimerFd, &settleTime);
+}
+
+static void UartBaudRateSettleTimeoutEventHandler(EventData *eventData)
+{
+    if (ConsumeTimerFdEvent(uartBaudRateSettleTimerFd) != 0) {
+        return;
+    }
+
+    if (MessageProtocol_ChangeUartBaudRate(pendingUartBaudRate) != 0) {
+        ChangeBleProtocolState(BleControlMessageProtocolState_Error);
+        return;
+    }
+    uartBaudRate = pendingUartBaudRate;
+    Log_Debug("INFO: UART to BLE device is now at %u baud.\n", uartBaudRate);
+    SendSetPasskeyRequest();
+}
+
+static void SendSetUartBaudRateRequest(void)
+{
+    BleControlMessageProtocol_SetUartBaudRateStruct baudRateStruct;
+    memset(&baudRateStruct, 0, sizeof(baudRateStruct));
+    baudRateStruct.baudRate = BLE_UART_FAST_BAUD_RATE;
+
+    Log_Debug("INFO: Sending \"Set UART Baud Rate\" request with rate set to: %u.\n",
+              baudRateStruct.baudRate);
+    MessageProtocol_SendRequest(
+        MessageProtocol_BleControlCategoryId, BleControlMessageProtocol_SetUartBaudRateRequestId,
+        (const uint8_t *)&baudRateStruct, sizeof(baudRateStruct), &SetUartBaudRateResponseHandler);
+}
+
 static void SendDeleteAllBondsResponseHandler(MessageProtocol_CategoryId categoryId,
                                               MessageProtocol_RequestId requestId,
                                               const uint8_t *data, size_t dataSize,
@@ -247,6 +309,7 @@ static void BleDeviceUpEventHandler(MessageProtocol_CategoryId categoryId,
     deleteAllBleBondsDeviceRequired = false;
     struct timespec disabled = {0, 0};
     SetTimerFdToPeriod(bleAdvertiseToAllTimerFd, &disabled);
+    SetTimerFdToPeriod(uartBaudRateSettleTimerFd, &disabled);
 
     // Start to initialize nRF52.
     SendInitializeBleDeviceRequest();
@@ -323,6 +386,18 @@ static void BleAdvertiseToAllTimeoutEventHandler(EventData *eventData)
 
 static void ChangeBleProtocolState(BleControlMessageProtocolState state)
 {
+    // The BLE device is reset when it is in the error state, and it restarts at the default
+    // rate, so go back to that rate to hear it come up.
+    if (state == BleControlMessageProtocolState_Error &&
+        uartBaudRate != BLE_CONTROL_MESSAGE_PROTOCOL_DEFAULT_UART_BAUD_RATE) {
+        struct timespec disabled = {0, 0};
+        SetTimerFdToPeriod(uartBaudRateSettleTimerFd, &disabled);
+        if (MessageProtocol_ChangeUartBaudRate(BLE_CONTROL_MESSAGE_PROTOCOL_DEFAULT_UART_BAUD_RATE) ==
+            0) {
+            uartBaudRate = BLE_CONTROL_MESSAGE_PROTOCOL_DEFAULT_UART_BAUD_RATE;
+        }
+    }
+
     if (blePublicState != state) {
         blePublicState = state;
         if (bleStateChangeHandler != NULL) {
@@ -347,6 +422,16 @@ int BleControlMessageProtocol_Init(BleControlMessageProtocol_StateChangeHandlerT
         return -1;
     }
 
+    // Set up the timer which waits for the BLE device to change UART rate, for later use.
+    static EventData uartBaudRateSettleTimeoutEventData = {
+        .eventHandler = &UartBaudRateSettleTimeoutEventHandler};
+    uartBaudRateSettleTimerFd = CreateTimerFdAndAddToEpoll(
+        epollFd, &disabled, &uartBaudRateSettleTimeoutEventData, EPOLLIN);
+    if (uartBaudRateSettleTimerFd < 0) {
+        return -1;
+    }
+    uartBaudRate = BLE_CONTROL_MESSAGE_PROTOCOL_DEFAULT_UART_BAUD_RATE;
+
     MessageProtocol_RegisterEventHandler(MessageProtocol_BleControlCategoryId,
                                          BleControlMessageProtocol_BleDeviceUpEventId,
                                          BleDeviceUpEventHandler);
@@ -375,6 +460,7 @@ int BleControlMessageProtocol_Init(BleControlMessageProtocol_StateChangeHandlerT
 void BleControlMessageProtocol_Cleanup(void)
 {
     CloseFdAndPrintError(bleAdvertiseToAllTimerFd, "BleAdvertiseToAllTimer");
+    CloseFdAndPrintError(uartBaudRateSettleTimerFd, "UartBaudRateSettleTimer");
 }
 
 int BleControlMessageProtocol_AllowNewBleBond(struct timespec *timeout)
@@ -4,6 +4,7 @@
 #include "devicecontrol_message_protocol.h"
 #include "devicecontrol_message_protocol_defs.h"
 #include "message_protocol.h"
+#include "property_sync.h"
 #include "applibs_versions.h"
 #include <applibs/log.h>
 #include <string.h>
@@ -14,9 +15,10 @@
 static DeviceControlMessageProtocol_SetLedStatusHandlerType setLedStatusHandler = NULL;
 static DeviceControlMessageProtocol_GetLedStatusHandlerType getLedStatusHandler = NULL;
 static bool getDesiredLedStatusRequestNeeded;
-static bool reportLedStatusRequestNeeded;
 
-static void ReportLedStatus(void);
+// The LED status which is reported to the remote device.
+static PropertySync ledStatusProperty;
+
 static void GetDesiredLedStatusResponseHandler(MessageProtocol_CategoryId categoryId,
                                                MessageProtocol_RequestId requestId,
                                                const uint8_t *data, size_t dataSize,
@@ -42,25 +44,9 @@ static void GetDesiredLedStatusResponseHandler(MessageProtocol_CategoryId catego
         (DeviceControlMessageProtocol_LedStatusStruct *)data;
 
     setLedStatusHandler(desiredLedStatus->status == 0x01);
-    ReportLedStatus();
-}
 
-static void ReportLedStatusResponseHandler(MessageProtocol_CategoryId categoryId,
-                                           MessageProtocol_RequestId requestId, const uint8_t *data,
-                                           size_t dataSize, MessageProtocol_ResponseResult result,
-                                           bool timedOut)
-{
-    if (timedOut) {
-        Log_Debug("ERROR: Timed out waiting for \"Report LED Status\" response.\n");
-        return;
-    }
-
-    // This response contains no data, so check its result to see whether the request was successful
-    if (result != 0) {
-        Log_Debug("ERROR: \"Report LED Status\" failed with error code: %u.\n", result);
-        return;
-    }
-    Log_Debug("INFO: \"Report LED Status\" succeeded.\n");
+    // Confirm the status which was set, even if the remote device already has it.
+    PropertySync_MarkDirty(&ledStatusProperty, true);
 }
 
 static void SendGetDesiredLedStatusRequest(void)
@@ -85,37 +71,22 @@ static void DesiredLedStatusAvailableEventHandler(MessageProtocol_CategoryId cat
     }
 }
 
-static void SendReportLedStatusRequest(void)
+static size_t GetLedStatusValue(uint8_t *value)
 {
-    reportLedStatusRequestNeeded = false;
-
     // Get the current LED status and set it in ledStatus
     DeviceControlMessageProtocol_LedStatusStruct ledStatus;
     memset(&ledStatus, 0, sizeof(ledStatus));
     ledStatus.status = getLedStatusHandler() ? 0x01 : 0x00;
 
-    // Send a "Report LED Status" request
-    Log_Debug("INFO: Sending request: \"Report LED Status\" with value %u.\n", ledStatus.status);
-    MessageProtocol_SendRequest(MessageProtocol_DeviceControlCategoryId,
-                                DeviceControlMessageProtocol_ReportLedStatusRequestId,
-                                (const uint8_t *)&ledStatus, sizeof(ledStatus),
-                                &ReportLedStatusResponseHandler);
-}
-
-static void ReportLedStatus(void)
-{
-    if (MessageProtocol_IsIdle()) {
-        SendReportLedStatusRequest();
-    } else {
-        reportLedStatusRequestNeeded = true;
-    }
+    memcpy(value, &ledStatus, sizeof(ledStatus));
+    return sizeof(ledStatus);
 }
 
 static void LedStatusNeededEventHandler(MessageProtocol_CategoryId categoryId,
                                         MessageProtocol_EventId eventId)
 {
     Log_Debug("INFO: Handling event: \"LED Status Needed\".\n");
-    ReportLedStatus();
+    PropertySync_MarkDirty(&ledStatusProperty, true);
 }
 
 static void IdleHandler(void)
@@ -124,10 +95,7 @@ static void IdleHandler(void)
         SendGetDesiredLedStatusRequest();
         return;
     }
-    if (reportLedStatusRequestNeeded) {
-        SendReportLedStatusRequest();
-        return;
-    }
+    PropertySync_SendPending();
 }
 
 void DeviceControlMessageProtocol_Init(
@@ -136,6 +104,9 @@ void DeviceControlMessageProtocol_Init(
 {
     setLedStatusHandler = setHandler;
     getLedStatusHandler = getHandler;
+    PropertySync_Init(&ledStatusProperty, MessageProtocol_DeviceControlCategoryId,
+                      DeviceControlMessageProtocol_ReportLedStatusRequestId, "Report LED Status",
+                      GetLedStatusValue);
 
     // Register event handlers
     MessageProtocol_RegisterEventHandler(
@@ -151,13 +122,15 @@ void DeviceControlMessageProtocol_Init(
 
     // Initialize event pending flags
     getDesiredLedStatusRequestNeeded = false;
-    reportLedStatusRequestNeeded = false;
 }
 
-void DeviceControlMessageProtocol_Cleanup(void) {}
+void DeviceControlMessageProtocol_Cleanup(void)
+{
+    PropertySync_Cleanup();
+}
 
 void DeviceControlMessageProtocol_NotifyLedStatusChange(void)
 {
     Log_Debug("INFO: Notify LED status change.\n");
-    ReportLedStatus();
+    PropertySync_MarkDirty(&ledStatusProperty, false);
 }
\ No newline at end of file
@@ -52,11 +52,24 @@
 // This #include imports the sample_hardware abstraction from that hardware definition.
 #include <hw/sample_hardware.h>
 
+// Fail the build if the hardware definition maps two of the peripherals which this sample
+// uses to the same pins. See mt3620_pin_check.h.
+#include <hw/mt3620_pin_check.h>
+MT3620_CHECK_GPIOS_DISTINCT(SAMPLE_BUTTON_1, SAMPLE_BUTTON_2, SAMPLE_DEVICE_STATUS_LED,
+                            SAMPLE_RGBLED_RED, SAMPLE_RGBLED_GREEN, SAMPLE_RGBLED_BLUE,
+                            SAMPLE_NRF52_RESET);
+MT3620_CHECK_GPIOS_NOT_ON_UART(SAMPLE_NRF52_UART, SAMPLE_BUTTON_1, SAMPLE_BUTTON_2,
+                               SAMPLE_DEVICE_STATUS_LED, SAMPLE_RGBLED_RED, SAMPLE_RGBLED_GREEN,
+                               SAMPLE_RGBLED_BLUE, SAMPLE_NRF52_RESET);
+
 // This sample uses a single-thread event loop pattern, based on epoll and timerfd
 #include "epoll_timerfd_utilities.h"
+#include "deferred_work.h"
+#include "perf_profile.h"
 
 #include "message_protocol.h"
 #include "blecontrol_message_protocol.h"
+#include "blecontrol_message_protocol_defs.h"
 #include "wificonfig_message_protocol.h"
 #include "devicecontrol_message_protocol.h"
 
@@ -72,6 +85,10 @@ static int bleDeviceResetPinGpioFd = -1;
 static struct timespec bleAdvertiseToAllTimeoutPeriod = {60u, 0};
 static GPIO_Value_Type deviceStatusLedGpioFd = GPIO_Value_High;
 
+// Work which message protocol handlers defer until the UART has been serviced.
+static DeferredWorkQueue deferredWorkQueue;
+static bool deferredWorkQueueInitialized = false;
+
 /// <summary>
 ///     Button events.
 /// </summary>
@@ -284,7 +301,7 @@ static void ButtonTimerEventHandler(EventData *eventData)
     } else if (button2Event == ButtonEvent_Held) {
         // Forget all stored Wi-Fi networks
         Log_Debug("INFO: SAMPLE_BUTTON_2 is held; forgetting all stored Wi-Fi networks...\n");
-        if (WifiConfig_ForgetAllNetworks() != 0) {
+        if (WifiConfigMessageProtocol_ForgetAllNetworks() != 0) {
             Log_Debug("ERROR: Unable to forget all stored Wi-Fi networks: %s (%d).\n",
                       strerror(errno), errno);
         } else {
@@ -294,6 +311,28 @@ static void ButtonTimerEventHandler(EventData *eventData)
     // No actions are defined for other events.
 }
 
+/// <summary>
+///     Close the UART to the nRF52 and open it again at a different baud rate. Hardware flow
+///     control stays enabled at every rate.
+/// </summary>
+/// <param name="baudRate">The baud rate to open the UART at.</param>
+/// <returns>The new UART file descriptor, or -1 on failure.</returns>
+static int ReopenUart(uint32_t baudRate)
+{
+    CloseFdAndPrintError(uartFd, "Uart");
+
+    UART_Config uartConfig;
+    UART_InitConfig(&uartConfig);
+    uartConfig.baudRate = baudRate;
+    uartConfig.flowControl = UART_FlowControl_RTSCTS;
+    uartFd = UART_Open(SAMPLE_NRF52_UART, &uartConfig);
+    if (uartFd < 0) {
+        Log_Debug("ERROR: Could not open UART at %u baud: %s (%d).\n", baudRate, strerror(errno),
+                  errno);
+    }
+    return uartFd;
+}
+
 // event handler data structures. Only the event handler field needs to be populated.
 static EventData buttonsEventData = {.eventHandler = &ButtonTimerEventHandler};
 
@@ -321,22 +360,36 @@ static int InitPeripheralsAndHandlers(void)
         return -1;
     }
 
+    // Limit how long deferred work, such as a Wi-Fi scan request, can hold up the UART.
+    static const struct timespec deferredWorkBudget = {0, 10 * 1000 * 1000};
+    if (DeferredWorkQueue_Init(&deferredWorkQueue, epollFd, &deferredWorkBudget) != 0) {
+        return -1;
+    }
+    deferredWorkQueueInitialized = true;
+
     // Open the UART and set up UART event handler.
     UART_Config uartConfig;
     UART_InitConfig(&uartConfig);
-    uartConfig.baudRate = 115200;
+    uartConfig.baudRate = BLE_CONTROL_MESSAGE_PROTOCOL_DEFAULT_UART_BAUD_RATE;
     uartConfig.flowControl = UART_FlowControl_RTSCTS;
     uartFd = UART_Open(SAMPLE_NRF52_UART, &uartConfig);
     if (uartFd < 0) {
         Log_Debug("ERROR: Could not open UART: %s (%d).\n", strerror(errno), errno);
         return -1;
     }
-    if (MessageProtocol_Init(epollFd, uartFd) < 0) {
+    if (MessageProtocol_Init(epollFd, uartFd, &deferredWorkQueue) < 0) {
         return -1;
     }
+    MessageProtocol_SetUartReopenHandler(ReopenUart);
+    // The number of requests which wait for the nRF52 at once comes from the performance
+    // profile, so that a battery-powered device keeps fewer in flight.
+    const PerfProfile *profile = PerfProfile_GetDefaults(PERF_PROFILE_DEFAULT);
+    MessageProtocol_SetMaxOutstandingRequests(profile->messageProtocol.maxOutstandingRequests);
 
     BleControlMessageProtocol_Init(BleStateChangeHandler, epollFd);
-    WifiConfigMessageProtocol_Init();
+    if (WifiConfigMessageProtocol_Init(epollFd) < 0) {
+        return -1;
+    }
     DeviceControlMessageProtocol_Init(SetDeviceControlLedStatusHandler,
                                       GetDeviceControlLedStatusHandler);
 
@@ -434,6 +487,9 @@ static void ClosePeripheralsAndHandlers(void)
     CloseFdAndPrintError(bleAdvertiseToBondedDevicesLedGpioFd, "BleAdvertiseToBondedDevicesLed");
     CloseFdAndPrintError(bleAdvertiseToAllDevicesLedGpioFd, "BleAdvertiseToAllDevicesLed");
     CloseFdAndPrintError(bleConnectedLedGpioFd, "BleConnectedLed");
+    if (deferredWorkQueueInitialized) {
+        DeferredWorkQueue_Close(&deferredWorkQueue);
+    }
     CloseFdAndPrintError(epollFd, "Epoll");
     CloseFdAndPrintError(uartFd, "Uart");
     DeviceControlMessageProtocol_Cleanup();
@@ -466,7 +522,8 @@ int main(int argc, char *argv[])
 
     // Use epoll to wait for events and trigger handlers, until an error or SIGTERM happens
     while (!terminationRequired) {
-        if (WaitForEventAndCallHandler(epollFd) != 0) {
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, -1,
+                                         &terminationRequired) < 0) {
             terminationRequired = true;
         }
     }
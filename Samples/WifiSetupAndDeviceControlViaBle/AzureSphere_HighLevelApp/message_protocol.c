@@ -6,61 +6,114 @@
 #include "message_protocol_utilities.h"
 #include "applibs_versions.h"
 #include "epoll_timerfd_utilities.h"
+#include "timer_wheel.h"
+#include "app_log.h"
 #include <applibs/log.h>
 #include <applibs/uart.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 
-#define UART_RECEIVED_BUFFER_SIZE 1024u
+#define UART_RECEIVED_BUFFER_SIZE 1024u // Must be a power of two.
 #define UART_SEND_BUFFER_SIZE 247u // This is the max MTU size of BLE GATT.
 
-#define REQUEST_TIMEOUT 5u
+// A request which has no response is sent again with the same sequence number, so its receiver
+// can answer it without handling it twice. The retransmission timeout is estimated from the
+// round-trip times of earlier requests in the same category, in the same way as TCP's (RFC
+// 6298), and doubles on each retransmission. Requests in the BLE control category are answered
+// by the nRF52, but the others are forwarded over BLE, so their round-trip times differ.
+#define INITIAL_RETRANSMIT_TIMEOUT_MS 1000u
+#define MIN_RETRANSMIT_TIMEOUT_MS 200u
+#define MAX_RETRANSMIT_TIMEOUT_MS 5000u
+#define MAX_RETRANSMISSIONS 4u
 
-// File descriptors - initialized to invalid value.
-static int epollFdRef = -1;
-static int messageUartFd = -1;
-static int sendRequestMessageTimerFd = -1;
-
-// Buffer for data received via UART and index at which to write future data.
-static uint8_t receiveBuffer[UART_RECEIVED_BUFFER_SIZE];
-static uint16_t receiveBufferPos = 0;
-
-// Buffer for data to be writtern via UART.
-static uint8_t sendBuffer[UART_SEND_BUFFER_SIZE];
+// Maximum number of requests which can wait for their responses at the same time.
+// MessageProtocol_SetMaxOutstandingRequests can lower it.
+#define MAX_OUTSTANDING_REQUESTS 4u
 
-// Total amount of data in sendBuffer.
-static size_t sendBufferDataLength = 0;
+// Errors about the received data are logged at most 5 at once, then once per second, from each
+// call site, so that a noisy UART does not flood the log.
+#define LOG_RECEIVE_ERROR(...) APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_ERROR, 5, 1000, __VA_ARGS__)
 
-// Amount of data so far written to the UART.
-static size_t sendBufferDataSent = 0;
+// The send queue can hold one frame for each outstanding request.
+#define UART_SEND_QUEUE_FRAMES MAX_OUTSTANDING_REQUESTS
 
-// Message protocol states.
-typedef enum {
-    MessageProtocolState_Idle,
-    MessageProtocolState_RequestOutstanding
-} MessageProtocolState;
-
-// Current state of the message protocol.
-static MessageProtocolState protocolState;
-
-// True if the EPOLLOUT event is registered for the UART fd; false if not.
-static bool uartFdEpolloutEnabled = false;
+// File descriptors - initialized to invalid value.
+static int epollFdRef = -1;
+static int messageUartFd = -1;
 
-static MessageProtocol_ResponseHandlerType currentResponseHandler;
+// Each outstanding request has its own timeout on this wheel.
+static TimerWheel requestTimerWheel;
+
+// Ring buffer for data received via UART. Data is written at receiveTail and messages are
+// parsed from receiveHead. Both count bytes from the start, so receiveTail - receiveHead is the
+// amount of data in the buffer.
+static uint8_t receiveBuffer[UART_RECEIVED_BUFFER_SIZE] __attribute__((aligned(4)));
+static size_t receiveHead = 0;
+static size_t receiveTail = 0;
+
+// A message which wraps around the end of receiveBuffer, or which is not aligned, is copied
+// here so that its handler can read it as a struct.
+static uint8_t receivedMessage[UART_RECEIVED_BUFFER_SIZE] __attribute__((aligned(4)));
+
+// A message which is waiting to be written via UART.
+typedef struct {
+    uint8_t data[UART_SEND_BUFFER_SIZE];
+    size_t length;
+} SendFrame;
+
+// Queue of frames to be written via UART, in order. sendQueueHead is the frame being written.
+static SendFrame sendQueue[UART_SEND_QUEUE_FRAMES];
+static size_t sendQueueHead = 0;
+static size_t sendQueueCount = 0;
+
+// Amount of the frame at sendQueueHead so far written to the UART.
+static size_t sendFrameDataSent = 0;
+
+// True if the last write to the UART would have blocked, so the rest of the queue is written
+// when the next EPOLLOUT event arrives; false if the queue can be written immediately.
+static bool uartWriteBlocked = false;
+
+// A request which is waiting for its response, matched by sequence number. The message is kept
+// so that it can be sent again.
+typedef struct {
+    TimerWheelTimer timeoutTimer;
+    bool inUse;
+    MessageProtocol_SequenceNumber sequenceNumber;
+    MessageProtocol_CategoryId categoryId;
+    MessageProtocol_RequestId requestId;
+    MessageProtocol_ResponseHandlerType responseHandler;
+    uint8_t message[UART_SEND_BUFFER_SIZE];
+    size_t messageLength;
+    struct timespec sendTime;
+    unsigned int retransmissions;
+    uint32_t retransmitTimeoutMs;
+} OutstandingRequest;
+
+// Round-trip time estimate for the requests in one category, in milliseconds.
+typedef struct {
+    bool measured;
+    uint32_t smoothedRttMs;
+    uint32_t rttVariationMs;
+    uint32_t retransmitTimeoutMs;
+} RoundTripEstimate;
+
+static RoundTripEstimate roundTripEstimates[MESSAGE_PROTOCOL_MAX_CATEGORY_ID + 1];
+
+static void RequestTimeoutEventHandler(EventData *eventData);
+static OutstandingRequest outstandingRequests[MAX_OUTSTANDING_REQUESTS];
+static size_t outstandingRequestCount = 0;
+static size_t maxOutstandingRequests = MAX_OUTSTANDING_REQUESTS;
 
 // Request sequence number
 static uint16_t currentSequenceNumber = 0;
 
-// Event handlers list
-struct EventHandlerNode {
-    MessageProtocol_CategoryId categoryId;
-    MessageProtocol_EventId eventId;
-    MessageProtocol_EventHandlerType handler;
-    struct EventHandlerNode *nextNode;
-};
-static struct EventHandlerNode *eventHandlerList;
+// Event handlers, indexed by category ID and event ID.
+static MessageProtocol_EventHandlerType eventHandlers[MESSAGE_PROTOCOL_MAX_CATEGORY_ID + 1]
+                                                    [MESSAGE_PROTOCOL_MAX_EVENT_ID + 1];
 
 // Idle handlers list
 struct IdleHandlerNode {
@@ -69,124 +122,226 @@ struct IdleHandlerNode {
 };
 static struct IdleHandlerNode *idleHandlerList;
 
-static void RemoveFirstCompleteMessage(void)
+// The idle handlers can do lengthy work, such as requesting a Wi-Fi scan, so they are run from
+// the deferred work queue instead of inline from the UART and timer handlers.
+static DeferredWorkQueue *deferredWorkQueueRef = NULL;
+
+static MessageProtocol_UartReopenHandlerType uartReopenHandler = NULL;
+
+// Incremented each time the UART is reopened, so a receive loop can tell that its data has gone.
+static unsigned int uartGeneration = 0;
+static void IdleWorkHandler(EventData *eventData);
+static DeferredWorkItem idleWorkItem = {.eventData.eventHandler = &IdleWorkHandler};
+
+static size_t ReceiveBufferIndex(size_t position)
+{
+    return position & (UART_RECEIVED_BUFFER_SIZE - 1);
+}
+
+// Copies data out of the receive buffer, starting at the given position.
+static void CopyFromReceiveBuffer(uint8_t *destination, size_t position, size_t length)
 {
-    MessageProtocol_MessageHeader *messageHeader = (MessageProtocol_MessageHeader *)receiveBuffer;
-    uint16_t topMessageLength =
-        (uint16_t)(messageHeader->length + sizeof(MessageProtocol_MessageHeader));
-    if (receiveBufferPos == topMessageLength) {
-        // There is only one complete message in the buffer: set receivedBufferIndex to 0.
-        receiveBufferPos = 0;
-    } else if (receiveBufferPos > topMessageLength) {
-        // There is more than one complete message in the buffer: remove the top message, move
-        // the rest forward and subtract the message length from receiveBufferPos.
-        receiveBufferPos = (uint16_t)(receiveBufferPos - topMessageLength);
-        memmove(receiveBuffer, receiveBuffer + topMessageLength, receiveBufferPos);
+    size_t index = ReceiveBufferIndex(position);
+    size_t firstPartLength = UART_RECEIVED_BUFFER_SIZE - index;
+    if (firstPartLength > length) {
+        firstPartLength = length;
     }
+    memcpy(destination, receiveBuffer + index, firstPartLength);
+    memcpy(destination + firstPartLength, receiveBuffer, length - firstPartLength);
 }
 
 static void RemoveInvalidBytesBeforePreamble(void)
 {
-    size_t preambleSize = sizeof(MessageProtocol_MessagePreamble);
-    bool foundPreamble = false;
-    size_t pos = 0;
+    const size_t preambleSize = sizeof(MessageProtocol_MessagePreamble);
+
+    while (receiveHead != receiveTail) {
+        // Find the first byte of the preamble in the data up to the end of the buffer.
+        size_t index = ReceiveBufferIndex(receiveHead);
+        size_t searchLength = UART_RECEIVED_BUFFER_SIZE - index;
+        if (searchLength > receiveTail - receiveHead) {
+            searchLength = receiveTail - receiveHead;
+        }
+        const uint8_t *searchStart = receiveBuffer + index;
+        const uint8_t *found = memchr(searchStart, MessageProtocol_MessagePreamble[0], searchLength);
+        if (found == NULL) {
+            receiveHead += searchLength;
+            continue;
+        }
+        receiveHead += (size_t)(found - searchStart);
 
-    while (pos < receiveBufferPos) {
-        size_t remainingDataSize = receiveBufferPos - pos;
-        // Check whether we can find a complete or partial preamble by the end of current data.
+        // Check whether a complete or partial preamble starts there.
+        size_t remainingDataSize = receiveTail - receiveHead;
         size_t checkPreambleSize =
             (remainingDataSize >= preambleSize) ? preambleSize : remainingDataSize;
-        if (memcmp(MessageProtocol_MessagePreamble, receiveBuffer + pos, checkPreambleSize) == 0) {
-            foundPreamble = true;
-            break;
+        uint8_t candidate[sizeof(MessageProtocol_MessagePreamble)];
+        CopyFromReceiveBuffer(candidate, receiveHead, checkPreambleSize);
+        if (memcmp(MessageProtocol_MessagePreamble, candidate, checkPreambleSize) == 0) {
+            return;
         }
-        ++pos;
-    }
-    uint16_t validMessageLength = (uint16_t)(receiveBufferPos - pos);
-    receiveBufferPos = validMessageLength;
-
-    // Found complete or partial preamble. If it's not at the beginning of the
-    // message, move everything between i and (pos - 1) to the front, otherwise
-    // doing nothing as receivedBufferIndex is set to 0 already.
-    if (pos > 0 && foundPreamble) {
-        memmove(receiveBuffer, receiveBuffer + pos, validMessageLength);
+        ++receiveHead;
     }
 }
 
-static MessageProtocol_EventInfo *GetEventInfo(uint8_t *message, uint16_t messageLength)
+static MessageProtocol_EventInfo *GetEventInfo(uint8_t *message, size_t messageLength)
 {
     MessageProtocol_MessageHeader *messageHeader = (MessageProtocol_MessageHeader *)message;
     if (messageLength <
             sizeof(MessageProtocol_MessageHeaderWithType) + sizeof(MessageProtocol_EventInfo) ||
         messageHeader->length + sizeof(MessageProtocol_MessageHeader) !=
             sizeof(MessageProtocol_MessageHeaderWithType) + sizeof(MessageProtocol_EventInfo)) {
-        Log_Debug("ERROR: Received invalid event message - incorrect length.\n");
+        LOG_RECEIVE_ERROR("ERROR: Received invalid event message - incorrect length.\n");
         return NULL;
     }
     MessageProtocol_EventMessage *eventMessage = (MessageProtocol_EventMessage *)(message);
     return &(eventMessage->eventInfo);
 }
 
-static void CallIdleHandlers(void)
+static void IdleWorkHandler(EventData *eventData)
 {
+    (void)eventData;
+
     // Call all registered idle handlers as long as protocol state is still idle.
     struct IdleHandlerNode *current = idleHandlerList;
-    while (current != NULL && protocolState == MessageProtocolState_Idle) {
+    while (current != NULL && outstandingRequestCount == 0) {
         current->handler();
         current = current->nextNode;
     }
 }
 
-static void CallEventHandler(void)
+static void CallIdleHandlers(void)
+{
+    DeferredWorkQueue_Post(deferredWorkQueueRef, &idleWorkItem);
+}
+
+static void CallEventHandler(uint8_t *message, size_t messageLength)
 {
-    MessageProtocol_EventInfo *eventInfo = GetEventInfo(receiveBuffer, receiveBufferPos);
+    MessageProtocol_EventInfo *eventInfo = GetEventInfo(message, messageLength);
     if (eventInfo == NULL) {
-        Log_Debug("ERROR: Received malformed event message.\n");
+        LOG_RECEIVE_ERROR("ERROR: Received malformed event message.\n");
         return;
     }
 
-    struct EventHandlerNode *current = eventHandlerList;
-    while (current != NULL) {
-        if (current->categoryId == eventInfo->categoryId &&
-            current->eventId == eventInfo->eventId && current->handler != NULL) {
-            current->handler(current->categoryId, current->eventId);
+    if (eventInfo->categoryId <= MESSAGE_PROTOCOL_MAX_CATEGORY_ID &&
+        eventInfo->eventId <= MESSAGE_PROTOCOL_MAX_EVENT_ID) {
+        MessageProtocol_EventHandlerType handler =
+            eventHandlers[eventInfo->categoryId][eventInfo->eventId];
+        if (handler != NULL) {
+            handler(eventInfo->categoryId, eventInfo->eventId);
             return;
         }
-        current = current->nextNode;
     }
-    Log_Debug("ERROR: Received event message with unknown Category ID and Event ID: 0x%x, 0x%x.\n",
-              eventInfo->categoryId, eventInfo->eventId);
+    LOG_RECEIVE_ERROR(
+        "ERROR: Received event message with unknown Category ID and Event ID: 0x%x, 0x%x.\n",
+        eventInfo->categoryId, eventInfo->eventId);
 }
 
-static void CallResponseHandler(void)
+static RoundTripEstimate *GetRoundTripEstimate(MessageProtocol_CategoryId categoryId)
 {
-    MessageProtocol_ResponseMessage *responseMessage =
-        (MessageProtocol_ResponseMessage *)(receiveBuffer);
+    // Categories without a table entry share the last one.
+    if (categoryId > MESSAGE_PROTOCOL_MAX_CATEGORY_ID) {
+        categoryId = MESSAGE_PROTOCOL_MAX_CATEGORY_ID;
+    }
+    return &roundTripEstimates[categoryId];
+}
+
+static uint32_t ElapsedMs(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsedMs = (int64_t)(now.tv_sec - since->tv_sec) * 1000 +
+                        (now.tv_nsec - since->tv_nsec) / (1000 * 1000);
+    return (elapsedMs < 0) ? 0 : (uint32_t)elapsedMs;
+}
 
-    if (receiveBufferPos < sizeof(MessageProtocol_ResponseHeader) ||
+// Updates the estimate from the round-trip time of a request which was sent once only; the
+// time for a retransmitted request is ambiguous, so it is not used (Karn's algorithm).
+static void AddRoundTripSample(RoundTripEstimate *estimate, uint32_t rttMs)
+{
+    if (!estimate->measured) {
+        estimate->measured = true;
+        estimate->smoothedRttMs = rttMs;
+        estimate->rttVariationMs = rttMs / 2;
+    } else {
+        uint32_t deviation = (rttMs > estimate->smoothedRttMs)
+                                 ? rttMs - estimate->smoothedRttMs
+                                 : estimate->smoothedRttMs - rttMs;
+        estimate->rttVariationMs = (3 * estimate->rttVariationMs + deviation) / 4;
+        estimate->smoothedRttMs = (7 * estimate->smoothedRttMs + rttMs) / 8;
+    }
+
+    uint32_t timeoutMs = estimate->smoothedRttMs + 4 * estimate->rttVariationMs;
+    if (timeoutMs < MIN_RETRANSMIT_TIMEOUT_MS) {
+        timeoutMs = MIN_RETRANSMIT_TIMEOUT_MS;
+    } else if (timeoutMs > MAX_RETRANSMIT_TIMEOUT_MS) {
+        timeoutMs = MAX_RETRANSMIT_TIMEOUT_MS;
+    }
+    estimate->retransmitTimeoutMs = timeoutMs;
+}
+
+// Arms the timer which retransmits the request if its response has not arrived in time.
+static void StartRetransmitTimer(OutstandingRequest *request)
+{
+    // The timer may expire up to a quarter of the timeout late, so that the timeouts of
+    // requests which were sent together share one wakeup.
+    uint32_t timeoutMs = request->retransmitTimeoutMs;
+    const struct timespec slack = {(time_t)(timeoutMs / 4000),
+                                   (long)(timeoutMs / 4 % 1000) * 1000 * 1000};
+    TimerWheel_SetTimerSlack(&requestTimerWheel, &request->timeoutTimer, &slack);
+
+    const struct timespec expiry = {(time_t)(timeoutMs / 1000),
+                                    (long)(timeoutMs % 1000) * 1000 * 1000};
+    TimerWheel_SetTimerToSingleExpiry(&requestTimerWheel, &request->timeoutTimer, &expiry);
+}
+
+static OutstandingRequest *FindOutstandingRequest(MessageProtocol_SequenceNumber sequenceNumber)
+{
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; ++i) {
+        if (outstandingRequests[i].inUse &&
+            outstandingRequests[i].sequenceNumber == sequenceNumber) {
+            return &outstandingRequests[i];
+        }
+    }
+    return NULL;
+}
+
+// Stops waiting for the response to a request, and returns the handler for that response.
+static MessageProtocol_ResponseHandlerType ReleaseOutstandingRequest(OutstandingRequest *request)
+{
+    TimerWheel_CancelTimer(&requestTimerWheel, &request->timeoutTimer);
+    request->inUse = false;
+    --outstandingRequestCount;
+
+    MessageProtocol_ResponseHandlerType handler = request->responseHandler;
+    request->responseHandler = NULL;
+    return handler;
+}
+
+static void CallResponseHandler(uint8_t *message, size_t messageLength)
+{
+    MessageProtocol_ResponseMessage *responseMessage = (MessageProtocol_ResponseMessage *)(message);
+
+    if (messageLength < sizeof(MessageProtocol_ResponseHeader) ||
         responseMessage->responseHeader.messageHeaderWithType.messageHeader.length +
                 sizeof(MessageProtocol_MessageHeader) <
             sizeof(MessageProtocol_ResponseHeader)) {
-        Log_Debug("ERROR: Received invalid response message - too short.\n");
+        LOG_RECEIVE_ERROR("ERROR: Received invalid response message - too short.\n");
         return;
     }
 
-    if (currentSequenceNumber != responseMessage->responseHeader.sequenceNumber) {
-        Log_Debug("ERROR: Received a response with invalid sequence number: %x.\n",
-                  responseMessage->responseHeader.sequenceNumber);
+    // Responses can arrive in any order, so find the request which this one answers.
+    OutstandingRequest *request =
+        FindOutstandingRequest(responseMessage->responseHeader.sequenceNumber);
+    if (request == NULL) {
+        LOG_RECEIVE_ERROR("ERROR: Received a response with invalid sequence number: %x.\n",
+                          responseMessage->responseHeader.sequenceNumber);
         return;
     }
 
-    if (protocolState != MessageProtocolState_RequestOutstanding) {
-        Log_Debug("ERROR: Received a response when not expecting one\n");
-        return;
+    if (request->retransmissions == 0) {
+        AddRoundTripSample(GetRoundTripEstimate(request->categoryId),
+                           ElapsedMs(&request->sendTime));
     }
-    protocolState = MessageProtocolState_Idle;
-    struct timespec disabled = {0, 0};
-    SetTimerFdToPeriod(sendRequestMessageTimerFd, &disabled);
-
-    MessageProtocol_ResponseHandlerType handler = currentResponseHandler;
-    currentResponseHandler = NULL;
+    MessageProtocol_ResponseHandlerType handler = ReleaseOutstandingRequest(request);
 
     if (handler != NULL) {
         size_t dataLength =
@@ -200,126 +355,240 @@ static void CallResponseHandler(void)
     CallIdleHandlers();
 }
 
-static void HandleReceivedMessage(EventData *eventData)
+static void CallMessageHandler(uint8_t *message, size_t messageLength)
 {
-    // Attempt to read message from UART.
-    ssize_t bytesRead = read(messageUartFd, receiveBuffer + receiveBufferPos,
-                             UART_RECEIVED_BUFFER_SIZE - receiveBufferPos);
-    if (bytesRead < 0) {
-        Log_Debug("ERROR: Could not read from UART: %s (%d).\n", strerror(errno), errno);
-        return;
+    MessageProtocol_MessageHeaderWithType *messageHeader =
+        (MessageProtocol_MessageHeaderWithType *)message;
+    if (messageLength < sizeof(MessageProtocol_MessageHeaderWithType)) {
+        LOG_RECEIVE_ERROR("ERROR: Skipping message: too short.\n");
+    } else if (messageHeader->type == MessageProtocol_EventMessageType) {
+        CallEventHandler(message, messageLength);
+    } else if (messageHeader->type == MessageProtocol_ResponseMessageType) {
+        CallResponseHandler(message, messageLength);
+    } else {
+        LOG_RECEIVE_ERROR("ERROR: Skipping message: unknown or invalid message type.\n");
     }
+}
+
+// Reads from the UART into the free space in the receive buffer, up to the end of the buffer
+// and then into any free space at the start. Returns true if the buffer filled up before the
+// UART ran out of data, so it must be read again once messages have been removed.
+static bool ReadIntoReceiveBuffer(void)
+{
+    while (receiveTail - receiveHead < UART_RECEIVED_BUFFER_SIZE) {
+        size_t index = ReceiveBufferIndex(receiveTail);
+        size_t freeSpace = UART_RECEIVED_BUFFER_SIZE - (receiveTail - receiveHead);
+        size_t readLength = UART_RECEIVED_BUFFER_SIZE - index;
+        if (readLength > freeSpace) {
+            readLength = freeSpace;
+        }
 
-    if (bytesRead > 0) {
-        receiveBufferPos = (uint16_t)(receiveBufferPos + bytesRead);
+        ssize_t bytesRead = read(messageUartFd, receiveBuffer + index, readLength);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0 && errno != EAGAIN) {
+                LOG_RECEIVE_ERROR("ERROR: Could not read from UART: %s (%d).\n", strerror(errno),
+                                  errno);
+            }
+            return false;
+        }
+        receiveTail += (size_t)bytesRead;
+    }
+    return true;
+}
+
+static void HandleReceivedMessages(void)
+{
+    for (;;) {
         // Messages in the receive buffer should always start with a preamble, so remove all invalid
         // bytes before the preamble.
         RemoveInvalidBytesBeforePreamble();
-        while (MessageProtocol_IsMessageComplete(receiveBuffer, (uint8_t)receiveBufferPos)) {
-            // We received a complete message, call its handler.
-            MessageProtocol_MessageHeaderWithType *messageHeader =
-                (MessageProtocol_MessageHeaderWithType *)receiveBuffer;
-            if (messageHeader->type == MessageProtocol_EventMessageType) {
-                CallEventHandler();
-            } else if (messageHeader->type == MessageProtocol_ResponseMessageType) {
-                CallResponseHandler();
+
+        size_t dataLength = receiveTail - receiveHead;
+        if (dataLength < sizeof(MessageProtocol_MessageHeader)) {
+            return;
+        }
+        MessageProtocol_MessageHeader messageHeader;
+        CopyFromReceiveBuffer((uint8_t *)&messageHeader, receiveHead, sizeof(messageHeader));
+        size_t messageLength = messageHeader.length + sizeof(MessageProtocol_MessageHeader);
+
+        // A message which could never fit in the buffer means the preamble was not the start
+        // of a message, so look for the next one.
+        if (messageLength > UART_RECEIVED_BUFFER_SIZE) {
+            LOG_RECEIVE_ERROR("ERROR: Skipping message: too long (%zu bytes).\n", messageLength);
+            ++receiveHead;
+            continue;
+        }
+        if (dataLength < messageLength) {
+            return;
+        }
+
+        // We received a complete message, so call its handler. The message is read in place
+        // unless it wraps around the end of the buffer or is not aligned.
+        size_t index = ReceiveBufferIndex(receiveHead);
+        uint8_t *message = receiveBuffer + index;
+        if (index + messageLength > UART_RECEIVED_BUFFER_SIZE || (index & 3) != 0) {
+            CopyFromReceiveBuffer(receivedMessage, receiveHead, messageLength);
+            message = receivedMessage;
+        }
+        unsigned int generation = uartGeneration;
+        CallMessageHandler(message, messageLength);
+        if (generation != uartGeneration) {
+            // The handler reopened the UART, which discarded the receive buffer.
+            return;
+        }
+
+        // We have finished with this message now, so remove it from the receive buffer.
+        receiveHead += messageLength;
+    }
+}
+
+// Writes queued frames to the UART, in order, until the queue is empty or the write would block.
+static void SendQueuedMessages(void)
+{
+    while (sendQueueCount > 0) {
+        // Send as much of the remaining data in the current frame as possible.
+        const SendFrame *frame = &sendQueue[sendQueueHead];
+        size_t bytesLeftToSend = frame->length - sendFrameDataSent;
+        ssize_t bytesSent = write(messageUartFd, frame->data + sendFrameDataSent, bytesLeftToSend);
+        if (bytesSent < 0) {
+            if (errno == EAGAIN) {
+                // The rest is sent when the UART signals EPOLLOUT.
+                uartWriteBlocked = true;
             } else {
-                Log_Debug("ERROR: Skipping message: unknown or invalid message type.\n");
+                Log_Debug("ERROR: Failed to write to UART: %s (%d).\n", strerror(errno), errno);
             }
-            // We have finished with this message now, so remove it from the receive buffer.
-            RemoveFirstCompleteMessage();
+            return;
+        }
+        sendFrameDataSent += (size_t)bytesSent;
+        if (sendFrameDataSent == frame->length) {
+            sendQueueHead = (sendQueueHead + 1) % UART_SEND_QUEUE_FRAMES;
+            --sendQueueCount;
+            sendFrameDataSent = 0;
         }
     }
 }
 
+static bool QueueUartMessage(const uint8_t *message, size_t messageLength);
+
 static void RequestTimeoutEventHandler(EventData *eventData)
 {
-    if (ConsumeTimerFdEvent(sendRequestMessageTimerFd) != 0) {
+    OutstandingRequest *request =
+        (OutstandingRequest *)((uint8_t *)eventData -
+                               offsetof(OutstandingRequest, timeoutTimer.eventData));
+
+    if (request->retransmissions < MAX_RETRANSMISSIONS) {
+        // Send the request again, with the same sequence number, and back off the timeout. If
+        // the send queue is full, the request is still waiting to be written, so only wait.
+        ++request->retransmissions;
+        Log_Debug("INFO: Retransmitting request %x, %x (sequence number %x, attempt %u).\n",
+                  request->categoryId, request->requestId, request->sequenceNumber,
+                  request->retransmissions + 1);
+        QueueUartMessage(request->message, request->messageLength);
+        request->retransmitTimeoutMs *= 2;
+        if (request->retransmitTimeoutMs > MAX_RETRANSMIT_TIMEOUT_MS) {
+            request->retransmitTimeoutMs = MAX_RETRANSMIT_TIMEOUT_MS;
+        }
+        StartRetransmitTimer(request);
         return;
     }
 
-    // Timed out waiting for response message: change back to Idle state and call the response
+    // Timed out waiting for response message: stop waiting for it, and call the response
     // handler to inform it that the request has timed out.
-    protocolState = MessageProtocolState_Idle;
-    MessageProtocol_ResponseHandlerType handler = currentResponseHandler;
-    currentResponseHandler = NULL;
+    MessageProtocol_ResponseHandlerType handler = ReleaseOutstandingRequest(request);
     if (handler != NULL) {
-        MessageProtocol_RequestMessage *requestMessage =
-            (MessageProtocol_RequestMessage *)sendBuffer;
-        handler(requestMessage->requestHeader.categoryId, requestMessage->requestHeader.requestId,
-                NULL, 0, 0, true);
+        handler(request->categoryId, request->requestId, NULL, 0, 0, true);
     }
 
-    // We are idle now, so call the idle handlers.
+    // We may be idle now, so call the idle handlers.
     CallIdleHandlers();
 }
 
-static void SendUartMessage(EventData *eventData);
-static EventData requestTimeoutEventData = {.eventHandler = &RequestTimeoutEventHandler};
-static EventData uartReceivedEventData = {.eventHandler = &HandleReceivedMessage};
-static EventData uartSendEventData = {.eventHandler = &SendUartMessage};
+// Adds a message to the back of the send queue, and starts writing it if the UART is not
+// already waiting to accept earlier data. Returns false if the queue is full.
+static bool QueueUartMessage(const uint8_t *message, size_t messageLength)
+{
+    if (sendQueueCount >= UART_SEND_QUEUE_FRAMES) {
+        return false;
+    }
+    SendFrame *frame = &sendQueue[(sendQueueHead + sendQueueCount) % UART_SEND_QUEUE_FRAMES];
+    memcpy(frame->data, message, messageLength);
+    frame->length = messageLength;
+    ++sendQueueCount;
 
-static void SendUartMessage(EventData *eventData)
+    if (!uartWriteBlocked) {
+        SendQueuedMessages();
+    }
+    return true;
+}
+
+// The UART stays registered for both directions, edge-triggered, so a pending write does not
+// stop received data from being handled.
+static void UartEventHandler(EventData *eventData)
 {
-    if (uartFdEpolloutEnabled) {
-        RegisterEventHandlerToEpoll(epollFdRef, messageUartFd, &uartReceivedEventData, EPOLLIN);
-        uartFdEpolloutEnabled = false;
+    uint32_t events = eventData->readyEvents;
+
+    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        uartWriteBlocked = false;
+        SendQueuedMessages();
     }
 
-    while (sendBufferDataSent < sendBufferDataLength) {
-        // Send as much of the remaining data as possible.
-        size_t bytesLeftToSend = (size_t)(sendBufferDataLength - sendBufferDataSent);
-        const uint8_t *remainingMessageToSend = sendBuffer + sendBufferDataSent;
-        ssize_t bytesSent = write(messageUartFd, remainingMessageToSend, bytesLeftToSend);
-        if (bytesSent < 0) {
-            if (errno != EAGAIN) {
-                Log_Debug("ERROR: Failed to write to UART: %s (%d).\n", strerror(errno), errno);
-            } else {
-                // Register EPOLLOUT to send the rest
-                RegisterEventHandlerToEpoll(epollFdRef, messageUartFd, &uartSendEventData,
-                                            EPOLLOUT);
-                uartFdEpolloutEnabled = true;
-            }
-            return;
-        }
-        sendBufferDataSent += (size_t)bytesSent;
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        // Edge-triggered, so keep reading until the UART has no more data.
+        bool bufferFull;
+        do {
+            bufferFull = ReadIntoReceiveBuffer();
+            HandleReceivedMessages();
+        } while (bufferFull);
     }
 }
 
-int MessageProtocol_Init(int epollFd, int uartFd)
+// The UART to the nRF52 is serviced ahead of other events in the same wakeup.
+static EventData uartEventData = {.eventHandler = &UartEventHandler,
+                                  .priority = EventPriority_High};
+
+int MessageProtocol_Init(int epollFd, int uartFd, DeferredWorkQueue *deferredWorkQueue)
 {
     epollFdRef = epollFd;
     messageUartFd = uartFd;
-
-    if (RegisterEventHandlerToEpoll(epollFd, messageUartFd, &uartReceivedEventData, EPOLLIN) != 0) {
+    deferredWorkQueueRef = deferredWorkQueue;
+
+    sendQueueHead = 0;
+    sendQueueCount = 0;
+    sendFrameDataSent = 0;
+    uartWriteBlocked = false;
+    if (RegisterPersistentEventHandlerToEpoll(epollFd, messageUartFd, &uartEventData,
+                                              EPOLLIN | EPOLLOUT) != 0) {
         return -1;
     }
 
-    // Set up request timeout timer, for later use.
-    struct timespec disabled = {0, 0};
-    sendRequestMessageTimerFd =
-        CreateTimerFdAndAddToEpoll(epollFd, &disabled, &requestTimeoutEventData, EPOLLIN);
-    if (sendRequestMessageTimerFd < 0) {
+    // Set up request timeout timers, for later use.
+    static const struct timespec requestTimerResolution = {0, 20 * 1000 * 1000};
+    if (TimerWheel_Init(&requestTimerWheel, epollFd, &requestTimerResolution) != 0) {
         return -1;
     }
 
-    protocolState = MessageProtocolState_Idle;
-    currentResponseHandler = NULL;
-    eventHandlerList = NULL;
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS; ++i) {
+        memset(&outstandingRequests[i], 0, sizeof(outstandingRequests[i]));
+        outstandingRequests[i].timeoutTimer.eventData.eventHandler = &RequestTimeoutEventHandler;
+    }
+    outstandingRequestCount = 0;
+    for (size_t i = 0; i <= MESSAGE_PROTOCOL_MAX_CATEGORY_ID; ++i) {
+        memset(&roundTripEstimates[i], 0, sizeof(roundTripEstimates[i]));
+        roundTripEstimates[i].retransmitTimeoutMs = INITIAL_RETRANSMIT_TIMEOUT_MS;
+    }
+    memset(eventHandlers, 0, sizeof(eventHandlers));
     idleHandlerList = NULL;
+    uartReopenHandler = NULL;
     return 0;
 }
 
 void MessageProtocol_Cleanup(void)
 {
-    CloseFdAndPrintError(sendRequestMessageTimerFd, "SendRequestMessageTimer");
-    // Free all event handlers in the list.
-    struct EventHandlerNode *currentEventHandler = NULL;
-    while (eventHandlerList != NULL) {
-        currentEventHandler = eventHandlerList;
-        eventHandlerList = eventHandlerList->nextNode;
-        free(currentEventHandler);
-    }
+    DeferredWorkQueue_Cancel(deferredWorkQueueRef, &idleWorkItem);
+    TimerWheel_Close(&requestTimerWheel);
+    // The caller closes the epoll and UART fds, which removes the UART registration.
+    uartEventData.registeredEvents = 0;
+    memset(eventHandlers, 0, sizeof(eventHandlers));
     // Free all idle handlers in the list.
     struct IdleHandlerNode *currentIdleHandler = NULL;
     while (idleHandlerList != NULL) {
@@ -333,13 +602,12 @@ void MessageProtocol_RegisterEventHandler(MessageProtocol_CategoryId categoryId,
                                           MessageProtocol_EventId eventId,
                                           MessageProtocol_EventHandlerType handler)
 {
-    struct EventHandlerNode *node = malloc(sizeof(struct EventHandlerNode));
-    node->categoryId = categoryId;
-    node->eventId = eventId;
-    node->handler = handler;
-    // Add it to the head of linked list.
-    node->nextNode = eventHandlerList;
-    eventHandlerList = node;
+    if (categoryId > MESSAGE_PROTOCOL_MAX_CATEGORY_ID || eventId > MESSAGE_PROTOCOL_MAX_EVENT_ID) {
+        Log_Debug("ERROR: Can't register handler for Category ID and Event ID: 0x%x, 0x%x.\n",
+                  categoryId, eventId);
+        return;
+    }
+    eventHandlers[categoryId][eventId] = handler;
 }
 
 void MessageProtocol_RegisterIdleHandler(MessageProtocol_IdleHandlerType handler)
@@ -356,13 +624,14 @@ void MessageProtocol_SendRequest(MessageProtocol_CategoryId categoryId,
                                  size_t bodyLength,
                                  MessageProtocol_ResponseHandlerType responseHandler)
 {
-    if (protocolState != MessageProtocolState_Idle) {
+    if (outstandingRequestCount >= maxOutstandingRequests) {
         Log_Debug("INFO: Protocol busy, can't send request: %x, %x.\n", categoryId, requestId);
         return;
     }
 
-    // Set request message data in-place.
-    MessageProtocol_RequestMessage *requestMessage = (MessageProtocol_RequestMessage *)sendBuffer;
+    // Set request message data.
+    MessageProtocol_RequestMessage message;
+    MessageProtocol_RequestMessage *requestMessage = &message;
     memcpy(requestMessage->requestHeader.messageHeaderWithType.messageHeader.preamble,
            MessageProtocol_MessagePreamble, sizeof(MessageProtocol_MessagePreamble));
     requestMessage->requestHeader.messageHeaderWithType.messageHeader.length = (uint16_t)(
@@ -384,19 +653,91 @@ void MessageProtocol_SendRequest(MessageProtocol_CategoryId categoryId,
     }
     memcpy(requestMessage->data, body, bodyLength);
 
-    currentResponseHandler = responseHandler;
-    sendBufferDataLength = messageLength;
-    sendBufferDataSent = 0;
+    // Queue the message behind any which have not been written yet.
+    if (!QueueUartMessage((const uint8_t *)requestMessage, messageLength)) {
+        Log_Debug("ERROR: Send queue full, can't send request: %x, %x.\n", categoryId, requestId);
+        return;
+    }
 
-    // Start timer for response to this request.
-    const struct timespec sendRequestMessageCheckPeriod = {REQUEST_TIMEOUT, 0};
-    SetTimerFdToSingleExpiry(sendRequestMessageTimerFd, &sendRequestMessageCheckPeriod);
-    protocolState = MessageProtocolState_RequestOutstanding;
+    OutstandingRequest *request = NULL;
+    for (size_t i = 0; i < MAX_OUTSTANDING_REQUESTS && request == NULL; ++i) {
+        if (!outstandingRequests[i].inUse) {
+            request = &outstandingRequests[i];
+        }
+    }
+    request->inUse = true;
+    request->sequenceNumber = requestMessage->requestHeader.sequenceNumber;
+    request->categoryId = categoryId;
+    request->requestId = requestId;
+    request->responseHandler = responseHandler;
+    memcpy(request->message, requestMessage, messageLength);
+    request->messageLength = messageLength;
+    clock_gettime(CLOCK_MONOTONIC, &request->sendTime);
+    request->retransmissions = 0;
+    request->retransmitTimeoutMs = GetRoundTripEstimate(categoryId)->retransmitTimeoutMs;
+    ++outstandingRequestCount;
 
-    SendUartMessage(NULL);
+    // Start timer for response to this request.
+    StartRetransmitTimer(request);
 }
 
 bool MessageProtocol_IsIdle(void)
 {
-    return (protocolState == MessageProtocolState_Idle);
+    return (outstandingRequestCount == 0);
+}
+
+bool MessageProtocol_CanSendRequest(void)
+{
+    return (outstandingRequestCount < maxOutstandingRequests);
+}
+
+void MessageProtocol_SetMaxOutstandingRequests(size_t count)
+{
+    if (count == 0) {
+        count = 1;
+    } else if (count > MAX_OUTSTANDING_REQUESTS) {
+        count = MAX_OUTSTANDING_REQUESTS;
+    }
+    maxOutstandingRequests = count;
+}
+
+void MessageProtocol_SetUartReopenHandler(MessageProtocol_UartReopenHandlerType handler)
+{
+    uartReopenHandler = handler;
+}
+
+bool MessageProtocol_CanChangeUartBaudRate(void)
+{
+    return (uartReopenHandler != NULL);
+}
+
+int MessageProtocol_ChangeUartBaudRate(uint32_t baudRate)
+{
+    if (uartReopenHandler == NULL) {
+        return -1;
+    }
+
+    // The UART is closed by the reopen handler, so stop watching it first.
+    UnregisterPersistentEventHandlerFromEpoll(epollFdRef, &uartEventData);
+
+    // Data which was queued or partly received at the old rate is no use at the new one.
+    sendQueueHead = 0;
+    sendQueueCount = 0;
+    sendFrameDataSent = 0;
+    uartWriteBlocked = false;
+    receiveHead = 0;
+    receiveTail = 0;
+    ++uartGeneration;
+
+    messageUartFd = uartReopenHandler(baudRate);
+    if (messageUartFd < 0) {
+        Log_Debug("ERROR: Could not reopen UART at %u baud.\n", baudRate);
+        return -1;
+    }
+
+    if (RegisterPersistentEventHandlerToEpoll(epollFdRef, messageUartFd, &uartEventData,
+                                              EPOLLIN | EPOLLOUT) != 0) {
+        return -1;
+    }
+    return 0;
 }
\ No newline at end of file
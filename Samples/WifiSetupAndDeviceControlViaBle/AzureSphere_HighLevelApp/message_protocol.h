@@ -5,14 +5,17 @@
 #include "message_protocol_public.h"
 #include <sys/types.h>
 #include <stdbool.h>
+#include "deferred_work.h"
 
 /// <summary>
 ///     Initialize the message protocol and UART.
 /// </summary>
 /// <param name="epollFd">epoll file descriptor to use for event polling.</param>
 /// <param name="uartFd">UART file descriptor to use for sending and receiving data.</param>
+/// <param name="deferredWorkQueue">Queue on which the idle handlers are run, so they do not
+/// delay servicing the UART.</param>
 /// <returns>0 if initialization succeeded, -1 if an error occurred.</returns>
-int MessageProtocol_Init(int epollFd, int uartFd);
+int MessageProtocol_Init(int epollFd, int uartFd, DeferredWorkQueue *deferredWorkQueue);
 
 /// <summary>
 ///     Clean up the message protocol callback handlers.
@@ -22,8 +25,17 @@ void MessageProtocol_Cleanup(void);
 typedef void (*MessageProtocol_EventHandlerType)(MessageProtocol_CategoryId categoryId,
                                                  MessageProtocol_EventId eventId);
 
+/// <summary>Largest category ID which can have event handlers.</summary>
+#define MESSAGE_PROTOCOL_MAX_CATEGORY_ID 3u
+
+/// <summary>Largest event ID which can have a handler in each category.</summary>
+#define MESSAGE_PROTOCOL_MAX_EVENT_ID 7u
+
 /// <summary>
-///     Register a callback handler for incoming message protocol event messages.
+///     Register a callback handler for incoming message protocol event messages. Handlers are
+///     held in a fixed table, so the category ID must not be greater than
+///     MESSAGE_PROTOCOL_MAX_CATEGORY_ID and the event ID must not be greater than
+///     MESSAGE_PROTOCOL_MAX_EVENT_ID. A second handler for the same event replaces the first.
 /// </summary>
 /// <param name="categoryId">The message protocol category ID.</param>
 /// <param name="eventId">The message protocol event ID.</param>
@@ -35,7 +47,8 @@ void MessageProtocol_RegisterEventHandler(MessageProtocol_CategoryId categoryId,
 typedef void (*MessageProtocol_IdleHandlerType)(void);
 
 /// <summary>
-///     Register a callback handler for the idle event.
+///     Register a callback handler for the idle event. Idle handlers are called from the deferred
+///     work queue, after any pending UART data has been processed.
 /// </summary>
 /// <param name="handler">The callback handler to register.</param>
 void MessageProtocol_RegisterIdleHandler(MessageProtocol_IdleHandlerType handler);
@@ -47,7 +60,10 @@ typedef void (*MessageProtocol_ResponseHandlerType)(MessageProtocol_CategoryId c
                                                     bool timedOut);
 
 /// <summary>
-///     Send a request using the message protocol.
+///     Send a request using the message protocol. Several requests can wait for their responses
+///     at the same time; each response is matched to its request by sequence number, and each
+///     request times out separately. The request is not sent if
+///     <see cref="MessageProtocol_CanSendRequest" /> returns false.
 /// </summary>
 /// <param name="categoryId">The message protocol category ID.</param>
 /// <param name="requestId">The message protocol request ID.</param>
@@ -64,3 +80,48 @@ void MessageProtocol_SendRequest(MessageProtocol_CategoryId categoryId,
 /// </summary>
 /// <returns>True if the message protocol is currently idle; false if it is busy.</returns>
 bool MessageProtocol_IsIdle(void);
+
+/// <summary>
+///     Query whether another request can be sent before the outstanding ones have had their
+///     responses.
+/// </summary>
+/// <returns>True if a request can be sent; false if too many are outstanding.</returns>
+bool MessageProtocol_CanSendRequest(void);
+
+/// <summary>
+///     Set how many requests can wait for their responses at once. Requests which are already
+///     outstanding are not affected.
+/// </summary>
+/// <param name="count">The number of requests, which is limited to between 1 and the number
+/// which the protocol has room for, 4.</param>
+void MessageProtocol_SetMaxOutstandingRequests(size_t count);
+
+/// <summary>
+///     Function signature for a handler which closes the UART and opens it again at a new baud
+///     rate, with RTS/CTS flow control.
+/// </summary>
+/// <param name="baudRate">The new baud rate.</param>
+/// <returns>The new UART file descriptor, or -1 if the UART could not be opened.</returns>
+typedef int (*MessageProtocol_UartReopenHandlerType)(uint32_t baudRate);
+
+/// <summary>
+///     Register the handler which <see cref="MessageProtocol_ChangeUartBaudRate" /> uses to
+///     reopen the UART.
+/// </summary>
+/// <param name="handler">The handler, or NULL if the baud rate cannot be changed.</param>
+void MessageProtocol_SetUartReopenHandler(MessageProtocol_UartReopenHandlerType handler);
+
+/// <summary>
+///     Query whether the UART baud rate can be changed.
+/// </summary>
+/// <returns>True if a UART reopen handler has been registered; false if not.</returns>
+bool MessageProtocol_CanChangeUartBaudRate(void);
+
+/// <summary>
+///     Reopen the UART at a new baud rate. Data which has not yet been sent or handled is
+///     discarded, so this should only be called when no requests are outstanding. It may be
+///     called from a response handler.
+/// </summary>
+/// <param name="baudRate">The new baud rate.</param>
+/// <returns>0 if the UART was reopened, -1 if an error occurred.</returns>
+int MessageProtocol_ChangeUartBaudRate(uint32_t baudRate);
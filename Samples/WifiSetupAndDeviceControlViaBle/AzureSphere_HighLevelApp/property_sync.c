@@ -0,0 +1,119 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include "property_sync.h"
+#include "applibs_versions.h"
+#include <applibs/log.h>
+#include <string.h>
+
+static PropertySync *propertyList = NULL;
+
+static void TrySendValue(PropertySync *sync);
+
+static PropertySync *FindOutstandingProperty(MessageProtocol_CategoryId categoryId,
+                                             MessageProtocol_RequestId requestId)
+{
+    for (PropertySync *current = propertyList; current != NULL; current = current->nextNode) {
+        if (current->categoryId == categoryId && current->requestId == requestId &&
+            current->requestOutstanding) {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+static void PropertySyncResponseHandler(MessageProtocol_CategoryId categoryId,
+                                        MessageProtocol_RequestId requestId, const uint8_t *data,
+                                        size_t dataSize, MessageProtocol_ResponseResult result,
+                                        bool timedOut)
+{
+    PropertySync *sync = FindOutstandingProperty(categoryId, requestId);
+    if (sync == NULL) {
+        Log_Debug("ERROR: Received unexpected property response: 0x%x, 0x%x.\n", categoryId,
+                  requestId);
+        return;
+    }
+    sync->requestOutstanding = false;
+
+    if (timedOut) {
+        Log_Debug("ERROR: Timed out waiting for \"%s\" response.\n", sync->name);
+        sync->remoteValueKnown = false;
+    } else if (result != 0) {
+        // This response contains no data, so check its result to see whether the request was
+        // successful.
+        Log_Debug("ERROR: \"%s\" failed with error code: %u.\n", sync->name, result);
+        sync->remoteValueKnown = false;
+    } else {
+        Log_Debug("INFO: \"%s\" succeeded.\n", sync->name);
+        memcpy(sync->remoteValue, sync->sentValue, sync->sentValueSize);
+        sync->remoteValueSize = sync->sentValueSize;
+        sync->remoteValueKnown = true;
+    }
+
+    // Send the latest value if the property changed while the request was outstanding.
+    TrySendValue(sync);
+}
+
+static void TrySendValue(PropertySync *sync)
+{
+    if (!sync->dirty || sync->requestOutstanding) {
+        return;
+    }
+
+    uint8_t value[PROPERTY_SYNC_MAX_VALUE_SIZE];
+    size_t valueSize = sync->getValueHandler(value);
+    if (sync->remoteValueKnown && valueSize == sync->remoteValueSize &&
+        memcmp(value, sync->remoteValue, valueSize) == 0) {
+        sync->dirty = false;
+        return;
+    }
+
+    // Otherwise PropertySync_SendPending sends it once a request completes.
+    if (!MessageProtocol_CanSendRequest()) {
+        return;
+    }
+
+    sync->dirty = false;
+    sync->requestOutstanding = true;
+    memcpy(sync->sentValue, value, valueSize);
+    sync->sentValueSize = valueSize;
+
+    Log_Debug("INFO: Sending request: \"%s\".\n", sync->name);
+    MessageProtocol_SendRequest(sync->categoryId, sync->requestId, sync->sentValue,
+                                sync->sentValueSize, &PropertySyncResponseHandler);
+}
+
+void PropertySync_Init(PropertySync *sync, MessageProtocol_CategoryId categoryId,
+                       MessageProtocol_RequestId requestId, const char *name,
+                       PropertySync_GetValueHandlerType getValueHandler)
+{
+    memset(sync, 0, sizeof(*sync));
+    sync->categoryId = categoryId;
+    sync->requestId = requestId;
+    sync->name = name;
+    sync->getValueHandler = getValueHandler;
+
+    sync->nextNode = propertyList;
+    propertyList = sync;
+}
+
+void PropertySync_Cleanup(void)
+{
+    propertyList = NULL;
+}
+
+void PropertySync_MarkDirty(PropertySync *sync, bool force)
+{
+    sync->dirty = true;
+    if (force) {
+        sync->remoteValueKnown = false;
+    }
+    TrySendValue(sync);
+}
+
+void PropertySync_SendPending(void)
+{
+    for (PropertySync *current = propertyList; current != NULL; current = current->nextNode) {
+        TrySendValue(current);
+    }
+}
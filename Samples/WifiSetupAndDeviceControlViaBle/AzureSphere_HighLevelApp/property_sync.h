@@ -0,0 +1,77 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "message_protocol.h"
+
+/// <summary>Largest value, in bytes, which a property can have.</summary>
+#define PROPERTY_SYNC_MAX_VALUE_SIZE 16u
+
+/// <summary>
+///     Signature for a function which gets the current value of a property.
+/// </summary>
+/// <param name="value">Receives the value, which is sent as the body of the request.</param>
+/// <returns>The size of the value in bytes, which must not be more than
+/// PROPERTY_SYNC_MAX_VALUE_SIZE.</returns>
+typedef size_t (*PropertySync_GetValueHandlerType)(uint8_t *value);
+
+/// <summary>
+///     Keeps a property of this device, such as the LED status, in step with the remote device,
+///     by sending its value in a request whenever it changes. At most one request for the
+///     property is outstanding at a time. Changes which are made while a request is outstanding
+///     are coalesced: when its response arrives, only the latest value is sent, and nothing is
+///     sent if that is the value which the remote device already has. The link traffic for a
+///     property is therefore bounded however quickly it changes.
+///     The members are used by the property_sync functions and must not be changed.
+/// </summary>
+typedef struct PropertySync {
+    MessageProtocol_CategoryId categoryId;
+    MessageProtocol_RequestId requestId;
+    const char *name;
+    PropertySync_GetValueHandlerType getValueHandler;
+    bool dirty;
+    bool requestOutstanding;
+    bool remoteValueKnown;
+    uint8_t remoteValue[PROPERTY_SYNC_MAX_VALUE_SIZE];
+    size_t remoteValueSize;
+    uint8_t sentValue[PROPERTY_SYNC_MAX_VALUE_SIZE];
+    size_t sentValueSize;
+    struct PropertySync *nextNode;
+} PropertySync;
+
+/// <summary>
+///     Register a property. Its response handler is shared by all properties, so each must
+///     have a different category ID and request ID.
+/// </summary>
+/// <param name="sync">Storage for the property, which must remain valid until
+/// PropertySync_Cleanup is called.</param>
+/// <param name="categoryId">The message protocol category ID of the request.</param>
+/// <param name="requestId">The message protocol request ID of the request.</param>
+/// <param name="name">Name of the request, which is used in log messages.</param>
+/// <param name="getValueHandler">Function which gets the current value of the property.</param>
+void PropertySync_Init(PropertySync *sync, MessageProtocol_CategoryId categoryId,
+                       MessageProtocol_RequestId requestId, const char *name,
+                       PropertySync_GetValueHandlerType getValueHandler);
+
+/// <summary>
+///     Unregister all properties.
+/// </summary>
+void PropertySync_Cleanup(void);
+
+/// <summary>
+///     Record that the property may have changed, and send its value if no request for it is
+///     outstanding.
+/// </summary>
+/// <param name="sync">The property.</param>
+/// <param name="force">Whether to send the value even if the remote device already has it,
+/// for example because it asked for the value.</param>
+void PropertySync_MarkDirty(PropertySync *sync, bool force);
+
+/// <summary>
+///     Send the value of each changed property which could not be sent when it changed,
+///     because too many requests were outstanding. This should be called from an idle handler.
+/// </summary>
+void PropertySync_SendPending(void);
@@ -6,14 +6,20 @@
 #include "wificonfig_message_protocol.h"
 #include "wificonfig_message_protocol_defs.h"
 #include "message_protocol.h"
+#include "wifi_scan_manager.h"
+#include "wifi_scan_aggregator.h"
+#include "wifi_connection_cache.h"
+#include "network_monitor.h"
 #include "applibs_versions.h"
 #include <applibs/wificonfig.h>
 #include <applibs/networking.h>
 #include <applibs/log.h>
+#include <applibs/storage.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
 
 static bool newWiFiDetailsAvailableRequestNeeded;
 static bool setWifiStatusRequestNeeded;
@@ -23,9 +29,73 @@ static bool setWifiScanResultsSummaryRequestNeeded;
 static WifiConfigureMessageProtocol_WifiScanResultRequestStruct
     foundAPs[MAX_AP_COUNT_FOUND_BY_SCAN];
 static uint8_t foundAccessPointsCount = 0;
+
+// Scan results are kept and sent again for requests which arrive within this many seconds of
+// the scan, so that repeated refreshes do not each wait for a new scan.
+#define DEFAULT_SCAN_CACHE_LIFETIME_SECONDS 10
+static unsigned int scanCacheLifetimeSeconds = DEFAULT_SCAN_CACHE_LIFETIME_SECONDS;
+static bool scanCacheValid = false;
+static struct timespec scanCacheTime;
+
+// Scans run on the scan manager's worker thread. A finished scan is only collapsed into foundAPs
+// when its summary is sent, so that results which are still being sent are not overwritten.
+static bool scanResultsPending = false;
+static uint8_t scanResult = 0;
+
+// Collapses scanned networks with the same SSID and security type.
+static WifiScanAggregator scanAggregator;
 static uint8_t currentAccessPointIndex = 0;
+static bool sendScanResultsInBatches = false;
 static const char wifiInterface[] = "wlan0";
 
+// The last connection to each stored network is kept in the mutable file, so that when the
+// device starts it can use a targeted scan for the networks it has connected to before.
+// The device works without it if the file cannot be opened.
+#define CONNECTION_CACHE_SIZE (8 * 1024)
+static KvStore connectionCache;
+static uint8_t connectionCacheBuffer[KV_STORE_MAX_RECORD_SIZE];
+static bool connectionCacheOpen = false;
+
+// Watches for the Wi-Fi connection, so that it is recorded each time it is made.
+static NetworkMonitor networkMonitor;
+
+static void RecordConnection(const WifiConfig_ConnectedNetwork *network)
+{
+    if (connectionCacheOpen) {
+        WifiConnectionCache_Record(&connectionCache, network);
+    }
+}
+
+static void NetworkStateHandler(NetworkMonitor *monitor, uint32_t events,
+                                const NetworkMonitorState *state, void *context)
+{
+    if ((events & NetworkMonitorEvent_Up) == 0) {
+        return;
+    }
+
+    WifiConfig_ConnectedNetwork network;
+    if (WifiConfig_GetCurrentNetwork(&network) == 0) {
+        RecordConnection(&network);
+    }
+}
+
+static void OpenConnectionCache(void)
+{
+    int fd = Storage_OpenMutableFile();
+    if (fd < 0) {
+        Log_Debug("ERROR: Could not open mutable file: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    if (KvStore_Open(&connectionCache, fd, 0, CONNECTION_CACHE_SIZE, connectionCacheBuffer,
+                     sizeof(connectionCacheBuffer)) != 0) {
+        Log_Debug("ERROR: Could not open the Wi-Fi connection cache.\n");
+        return;
+    }
+    connectionCacheOpen = true;
+
+    WifiConnectionCache_PreferCachedNetworks(&connectionCache);
+}
+
 // Wi-Fi response handlers
 static void SetWifiOperationResultResponseHandler(MessageProtocol_CategoryId categoryId,
                                                   MessageProtocol_RequestId requestId,
@@ -102,9 +172,16 @@ static void GetNewWifiDetailsResponseHandler(MessageProtocol_CategoryId category
         }
     }
 
-    // Use targeted scan if requested
+    // Use targeted scan if requested, or if the device has connected to this network before
     if (configResult != -1) {
-        configResult = WifiConfig_SetTargetedScanEnabled(networkId, newWifiDetails->targetedScan);
+        WifiConnectionCacheEntry entry;
+        bool targetedScan =
+            newWifiDetails->targetedScan ||
+            (connectionCacheOpen &&
+             WifiConnectionCache_Get(&connectionCache, newWifiDetails->ssid,
+                                     newWifiDetails->ssidLength, newWifiDetails->securityType,
+                                     &entry) == 0);
+        configResult = WifiConfig_SetTargetedScanEnabled(networkId, targetedScan);
     }
 
     // Enable the network
@@ -138,7 +215,7 @@ static void GetNewWifiDetailsResponseHandler(MessageProtocol_CategoryId category
                                 &SetWifiOperationResultResponseHandler);
 }
 
-static void SendSetNextWiFiScanResultRequest(void);
+static void SendSetNextWiFiScanResultRequests(void);
 
 static void SetWifiScanResultsSummaryResponseHandler(MessageProtocol_CategoryId categoryId,
                                                      MessageProtocol_RequestId requestId,
@@ -152,7 +229,7 @@ static void SetWifiScanResultsSummaryResponseHandler(MessageProtocol_CategoryId
         return;
     }
 
-    // This response contains no data, so check its result to see whether the request was successful
+    // Check its result to see whether the request was successful
     if (result != 0) {
         Log_Debug("ERROR: \"Set Wi-Fi Scan Results Summary\" failed with error code: %d.\n",
                   result);
@@ -160,8 +237,18 @@ static void SetWifiScanResultsSummaryResponseHandler(MessageProtocol_CategoryId
     }
     Log_Debug("INFO: \"Set Wi-Fi Scan Results Summary\" succeeded.\n");
 
+    // A remote device which accepts batches of results says so in the response. Older devices
+    // send an empty response, and get one result per request.
+    sendScanResultsInBatches = false;
+    if (dataSize >= sizeof(WifiConfigureMessageProtocol_WifiScanResultsSummaryResponseStruct)) {
+        const WifiConfigureMessageProtocol_WifiScanResultsSummaryResponseStruct *summaryResponse =
+            (const WifiConfigureMessageProtocol_WifiScanResultsSummaryResponseStruct *)data;
+        sendScanResultsInBatches =
+            (summaryResponse->flags & WifiConfigureMessageProtocol_ScanResultsBatchSupported) != 0;
+    }
+
     if (foundAccessPointsCount > 0) {
-        SendSetNextWiFiScanResultRequest();
+        SendSetNextWiFiScanResultRequests();
     }
 }
 
@@ -203,7 +290,31 @@ static void SetNextWifiScanResultResponseHandler(MessageProtocol_CategoryId cate
     }
     Log_Debug("INFO: \"Set Next Wi-Fi Scan Result\" succeeded.\n");
     if (foundAccessPointsCount > 0 && currentAccessPointIndex < foundAccessPointsCount) {
-        SendSetNextWiFiScanResultRequest();
+        SendSetNextWiFiScanResultRequests();
+    }
+}
+
+static void SetWifiScanResultsBatchResponseHandler(MessageProtocol_CategoryId categoryId,
+                                                  MessageProtocol_RequestId requestId,
+                                                  const uint8_t *data, size_t dataSize,
+                                                  MessageProtocol_ResponseResult result,
+                                                  bool timedOut)
+{
+    if (timedOut) {
+        Log_Debug("ERROR: Timed out waiting for \"Set Wi-Fi Scan Results Batch\" response.\n");
+        foundAccessPointsCount = 0;
+        currentAccessPointIndex = 0;
+        return;
+    }
+
+    // This response contains no data, so check its result to see whether the request was successful
+    if (result != 0) {
+        Log_Debug("ERROR: \"Set Wi-Fi Scan Results Batch\" failed with error code: %d.\n", result);
+        return;
+    }
+    Log_Debug("INFO: \"Set Wi-Fi Scan Results Batch\" succeeded.\n");
+    if (foundAccessPointsCount > 0 && currentAccessPointIndex < foundAccessPointsCount) {
+        SendSetNextWiFiScanResultRequests();
     }
 }
 
@@ -262,6 +373,7 @@ static void SendSetWifiStatusRequest(void)
         memcpy(wifiStatus.ssid, network.ssid, network.ssidLength);
         wifiStatus.frequency = network.frequencyMHz;
         memcpy(wifiStatus.bssid, network.bssid, WIFICONFIG_BSSID_BUFFER_SIZE);
+        RecordConnection(&network);
     } else {
         // There is no currently connected network
         wifiStatus.connectionStatus = WifiConfigureMessageProtocol_NoConnection;
@@ -284,16 +396,6 @@ static void WifiStatusNeededEventHandler(MessageProtocol_CategoryId categoryId,
     }
 }
 
-static bool IsSameAccessPoint(
-    const WifiConfigureMessageProtocol_WifiScanResultRequestStruct *target,
-    const WifiConfig_ScannedNetwork *source)
-{
-    if (target->securityType == source->security && target->ssidLength == source->ssidLength) {
-        return 0 == memcmp(target->ssid, source->ssid, target->ssidLength);
-    }
-    return false;
-}
-
 static void SetScannedNetwork(WifiConfigureMessageProtocol_WifiScanResultRequestStruct *target,
                               const WifiConfig_ScannedNetwork *source)
 {
@@ -305,64 +407,82 @@ static void SetScannedNetwork(WifiConfigureMessageProtocol_WifiScanResultRequest
 
 static uint8_t CollapseNetworks(const WifiConfig_ScannedNetwork *target, size_t count)
 {
-    uint8_t scannedNetworksCount = 0;
-    for (size_t i = 0; i < count; ++i) {
-        bool found = false;
-        for (size_t j = 0; j < scannedNetworksCount; ++j) {
-            if (IsSameAccessPoint(foundAPs + j, target + i)) {
-                if (foundAPs[j].signalRssi < target[i].signalRssi) {
-                    foundAPs[j].signalRssi = target[i].signalRssi;
-                }
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            if (scannedNetworksCount >= MAX_AP_COUNT_FOUND_BY_SCAN) {
-                Log_Debug("INFO: Returning only the first %d networks found by scan.\n",
-                          MAX_AP_COUNT_FOUND_BY_SCAN);
-                break;
-            }
-            SetScannedNetwork(foundAPs + scannedNetworksCount, target + i);
-            ++scannedNetworksCount;
-        }
+    WifiScanAggregator_Reset(&scanAggregator);
+    WifiScanAggregator_AddAll(&scanAggregator, target, count);
+
+    // Keep the access points with the strongest signals, strongest first.
+    const WifiConfig_ScannedNetwork *strongest[MAX_AP_COUNT_FOUND_BY_SCAN];
+    size_t scannedNetworksCount =
+        WifiScanAggregator_GetStrongest(&scanAggregator, strongest, MAX_AP_COUNT_FOUND_BY_SCAN);
+    if (scanAggregator.count > scannedNetworksCount || scanAggregator.droppedCount > 0) {
+        Log_Debug("INFO: Returning only the strongest %d networks found by scan.\n",
+                  MAX_AP_COUNT_FOUND_BY_SCAN);
     }
-    return scannedNetworksCount;
+    for (size_t i = 0; i < scannedNetworksCount; ++i) {
+        SetScannedNetwork(foundAPs + i, strongest[i]);
+    }
+    return (uint8_t)scannedNetworksCount;
 }
 
-static void SendSetWifiScanResultsSummaryRequestNeeded(void)
+/// <summary>
+///     Check whether the results of the last scan are recent enough to be sent again.
+/// </summary>
+/// <returns>true if the cached scan results can be used; false if a new scan is needed.</returns>
+static bool IsScanCacheFresh(void)
 {
-    setWifiScanResultsSummaryRequestNeeded = false;
+    if (!scanCacheValid || scanCacheLifetimeSeconds == 0) {
+        return false;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    time_t age = now.tv_sec - scanCacheTime.tv_sec;
+    if (now.tv_nsec < scanCacheTime.tv_nsec) {
+        --age;
+    }
+    return age < (time_t)scanCacheLifetimeSeconds;
+}
 
-    // Get Wi-Fi scan results count and populate found access points
-    Log_Debug("INFO: Handle received event message: \"Wi-Fi Scan Needed\".\n");
-    WifiConfigureMessageProtocol_WifiScanResultsSummaryRequestStruct scanSummary;
-    uint8_t scanResult = 0;
+/// <summary>
+///     Collapse the results of the last completed scan into foundAPs.
+/// </summary>
+/// <returns>0 on success, or the scan result code to report on failure.</returns>
+static uint8_t CollectScanResults(void)
+{
+    uint8_t result = 0;
+    scanCacheValid = false;
     foundAccessPointsCount = 0;
-    currentAccessPointIndex = 0;
-    ssize_t result = WifiConfig_TriggerScanAndGetScannedNetworkCount();
-    if (result < 0) {
-        scanResult = 1;
-        Log_Debug("ERROR: Get scanned network count failed with error: %s (%d).\n", strerror(errno),
-                  errno);
-    } else if (result == 0) {
+    const WifiConfig_ScannedNetwork *networks;
+    ssize_t networkCount = WifiScanManager_GetResults(&networks);
+    if (networkCount < 0) {
+        result = 1;
+        Log_Debug("ERROR: Wi-Fi scan failed with error: %s (%d).\n", strerror(errno), errno);
+    } else if (networkCount == 0) {
         Log_Debug("INFO: Scan found no Wi-Fi networks.\n");
     } else {
-        size_t networkCount = (size_t)result;
-        WifiConfig_ScannedNetwork *networks =
-            (WifiConfig_ScannedNetwork *)malloc(sizeof(WifiConfig_ScannedNetwork) * networkCount);
-        ssize_t getScannedNetworksResult = WifiConfig_GetScannedNetworks(networks, networkCount);
-        if (getScannedNetworksResult < 0) {
-            scanResult = 2;
-            Log_Debug("ERROR: Get scanned networks failed with error: %s (%d).\n", strerror(errno),
-                      errno);
-        } else {
-            // Collapse all the found networks to access points based on SSID and Security Type
-            foundAccessPointsCount = CollapseNetworks(networks, (size_t)getScannedNetworksResult);
-            Log_Debug("Scan found %d Wi-Fi networks.\n", foundAccessPointsCount);
-        }
-        free(networks);
+        // Collapse all the found networks to access points based on SSID and Security Type
+        foundAccessPointsCount = CollapseNetworks(networks, (size_t)networkCount);
+        Log_Debug("Scan found %d Wi-Fi networks.\n", foundAccessPointsCount);
+    }
+
+    // Only successful scans are cached, so that a failure is retried on the next request.
+    if (result == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &scanCacheTime);
+        scanCacheValid = true;
     }
+    return result;
+}
+
+static void SendSetWifiScanResultsSummaryRequestNeeded(void)
+{
+    setWifiScanResultsSummaryRequestNeeded = false;
+
+    // Populate found access points from the scan which has just finished
+    if (scanResultsPending) {
+        scanResultsPending = false;
+        scanResult = CollectScanResults();
+    }
+    WifiConfigureMessageProtocol_WifiScanResultsSummaryRequestStruct scanSummary;
+    currentAccessPointIndex = 0;
 
     // Populate the scan summary response struct
     scanSummary.scanResult = scanResult;
@@ -377,9 +497,43 @@ static void SendSetWifiScanResultsSummaryRequestNeeded(void)
                                 &SetWifiScanResultsSummaryResponseHandler);
 }
 
-static void SendSetNextWiFiScanResultRequest(void)
+// Sends as many of the remaining scan results as the message protocol allows, so that they
+// do not each wait for the response to the one before.
+static void SendSetNextWiFiScanResultRequests(void)
 {
-    if (currentAccessPointIndex < foundAccessPointsCount) {
+    if (currentAccessPointIndex >= foundAccessPointsCount) {
+        Log_Debug("ERROR: Invalid index (%d) for scanned network result.\n",
+                  currentAccessPointIndex);
+        currentAccessPointIndex = 0;
+        return;
+    }
+
+    while (sendScanResultsInBatches && currentAccessPointIndex < foundAccessPointsCount &&
+           MessageProtocol_CanSendRequest()) {
+        // Pack as many of the remaining results as fit in one message.
+        WifiConfigureMessageProtocol_WifiScanResultsBatchRequestStruct batch;
+        memset(&batch, 0, sizeof(batch));
+        uint8_t remaining = (uint8_t)(foundAccessPointsCount - currentAccessPointIndex);
+        batch.resultCount = (remaining < WIFI_CONFIGURE_MESSAGE_PROTOCOL_MAX_SCAN_RESULTS_PER_BATCH)
+                                ? remaining
+                                : WIFI_CONFIGURE_MESSAGE_PROTOCOL_MAX_SCAN_RESULTS_PER_BATCH;
+        memcpy(batch.results, &foundAPs[currentAccessPointIndex],
+               batch.resultCount * sizeof(WifiConfigureMessageProtocol_WifiScanResultRequestStruct));
+
+        Log_Debug("INFO: Sending request: \"Set Wi-Fi Scan Results Batch\" (%d-%d).\n",
+                  currentAccessPointIndex, currentAccessPointIndex + batch.resultCount - 1);
+        size_t batchSize =
+            offsetof(WifiConfigureMessageProtocol_WifiScanResultsBatchRequestStruct, results) +
+            batch.resultCount * sizeof(WifiConfigureMessageProtocol_WifiScanResultRequestStruct);
+        MessageProtocol_SendRequest(MessageProtocol_WifiConfigCategoryId,
+                                    WifiConfigureMessageProtocol_SetWifiScanResultsBatchRequestId,
+                                    (const uint8_t *)&batch, batchSize,
+                                    &SetWifiScanResultsBatchResponseHandler);
+        currentAccessPointIndex = (uint8_t)(currentAccessPointIndex + batch.resultCount);
+    }
+
+    while (!sendScanResultsInBatches && currentAccessPointIndex < foundAccessPointsCount &&
+           MessageProtocol_CanSendRequest()) {
         Log_Debug("INFO: Sending request: \"Set Next Wi-Fi Scan Result\" (%d).\n",
                   currentAccessPointIndex);
         MessageProtocol_SendRequest(
@@ -389,15 +543,10 @@ static void SendSetNextWiFiScanResultRequest(void)
             sizeof(WifiConfigureMessageProtocol_WifiScanResultRequestStruct),
             &SetNextWifiScanResultResponseHandler);
         ++currentAccessPointIndex;
-    } else {
-        Log_Debug("ERROR: Invalid index (%d) for scanned network result.\n",
-                  currentAccessPointIndex);
-        currentAccessPointIndex = 0;
     }
 }
 
-static void WifiScanNeededEventHandler(MessageProtocol_CategoryId categoryId,
-                                       MessageProtocol_EventId eventId)
+static void RequestWifiScanResultsSummary(void)
 {
     if (MessageProtocol_IsIdle()) {
         SendSetWifiScanResultsSummaryRequestNeeded();
@@ -406,6 +555,38 @@ static void WifiScanNeededEventHandler(MessageProtocol_CategoryId categoryId,
     }
 }
 
+static void WifiScanNeededEventHandler(MessageProtocol_CategoryId categoryId,
+                                       MessageProtocol_EventId eventId)
+{
+    Log_Debug("INFO: Handle received event message: \"Wi-Fi Scan Needed\".\n");
+    if (WifiScanManager_IsScanning() || scanResultsPending) {
+        // The summary is sent once the scan which is already running has finished.
+        return;
+    }
+
+    if (IsScanCacheFresh()) {
+        Log_Debug("INFO: Using cached scan results (%d Wi-Fi networks).\n", foundAccessPointsCount);
+        scanResult = 0;
+        RequestWifiScanResultsSummary();
+        return;
+    }
+
+    if (WifiScanManager_StartScan() != 0) {
+        scanCacheValid = false;
+        foundAccessPointsCount = 0;
+        scanResult = 1;
+        RequestWifiScanResultsSummary();
+    }
+}
+
+static void WifiScanCompletedHandler(EventData *eventData)
+{
+    scanResultsPending = true;
+    RequestWifiScanResultsSummary();
+}
+
+static EventData wifiScanCompletedEventData = {.eventHandler = &WifiScanCompletedHandler};
+
 static void IdleHandler(void)
 {
     if (newWiFiDetailsAvailableRequestNeeded) {
@@ -422,7 +603,7 @@ static void IdleHandler(void)
     }
 }
 
-void WifiConfigMessageProtocol_Init(void)
+int WifiConfigMessageProtocol_Init(int epollFd)
 {
     // Register event handlers
     MessageProtocol_RegisterEventHandler(
@@ -443,6 +624,42 @@ void WifiConfigMessageProtocol_Init(void)
     newWiFiDetailsAvailableRequestNeeded = false;
     setWifiStatusRequestNeeded = false;
     setWifiScanResultsSummaryRequestNeeded = false;
+    scanCacheValid = false;
+    scanResultsPending = false;
+
+    OpenConnectionCache();
+    const NetworkMonitorConfig networkMonitorConfig = {
+        .interfaceName = wifiInterface,
+        .requiredStatus = Networking_InterfaceConnectionStatus_ConnectedToNetwork,
+        .minInterval = {1, 0},
+        .waitingInterval = {8, 0},
+        .readyInterval = {60, 0}};
+    if (NetworkMonitor_Init(&networkMonitor, epollFd, &networkMonitorConfig) != 0 ||
+        NetworkMonitor_AddHandler(&networkMonitor, &NetworkStateHandler, NULL) != 0) {
+        return -1;
+    }
+
+    return WifiScanManager_Init(epollFd, &wifiScanCompletedEventData);
 }
 
-void WifiConfigMessageProtocol_Cleanup(void) {}
+void WifiConfigMessageProtocol_SetScanCacheLifetime(unsigned int seconds)
+{
+    scanCacheLifetimeSeconds = seconds;
+}
+
+int WifiConfigMessageProtocol_ForgetAllNetworks(void)
+{
+    // The cache entries are found from the stored networks, so they are forgotten first.
+    if (connectionCacheOpen) {
+        WifiConnectionCache_ForgetStoredNetworks(&connectionCache);
+    }
+    return WifiConfig_ForgetAllNetworks();
+}
+
+void WifiConfigMessageProtocol_Cleanup(void)
+{
+    WifiScanManager_Cleanup();
+    NetworkMonitor_Close(&networkMonitor);
+    KvStore_Close(&connectionCache);
+    connectionCacheOpen = false;
+}
@@ -6,9 +6,25 @@
 
 /// <summary>
 ///     Initialize the Wi-Fi configuration message protocol by registering callback handlers
-///     and setting up internal state.
+///     and setting up internal state. Wi-Fi scans run off the event loop thread, and their
+///     results are delivered through the event loop.
 /// </summary>
-void WifiConfigMessageProtocol_Init(void);
+/// <param name="epollFd">epoll file descriptor to use for event polling.</param>
+/// <returns>0 on success, or -1 on failure.</returns>
+int WifiConfigMessageProtocol_Init(int epollFd);
+
+/// <summary>
+///     Set how long the results of a Wi-Fi scan are reused for later scan requests before a
+///     new scan is made. The default is 10 seconds.
+/// </summary>
+/// <param name="seconds">The cache lifetime in seconds, or 0 to scan on every request.</param>
+void WifiConfigMessageProtocol_SetScanCacheLifetime(unsigned int seconds);
+
+/// <summary>
+///     Forget all stored Wi-Fi networks, and the last connection to each of them.
+/// </summary>
+/// <returns>0 on success, or -1 on failure.</returns>
+int WifiConfigMessageProtocol_ForgetAllNetworks(void);
 
 /// <summary>
 ///     Clean up the Wi-Fi configuration message protocol callback handlers and internal state.
@@ -3,6 +3,7 @@
 
 #include "blecontrol_message_protocol.h"
 #include "message_protocol.h"
+#include "uart_utilities.h"
 
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
@@ -102,6 +103,36 @@ static void ble_control_delete_all_bonds_request_handler(uint8_t *p_data, uint16
                                    sequence_number, NULL, 0, result);
 }
 
+static void ble_control_set_uart_baud_rate_request_handler(uint8_t *p_data, uint16_t data_size,
+                                                           uint16_t sequence_number)
+{
+    // process request data and send response
+    if (data_size != sizeof(BleControlMessageProtocol_SetUartBaudRateStruct)) {
+        NRF_LOG_INFO(
+            "INFO: BLE control \"Set UART Baud Rate\" request message has invalid size: %d.\n",
+            data_size);
+        return;
+    }
+
+    BleControlMessageProtocol_SetUartBaudRateStruct *baud_rate_struct =
+        (BleControlMessageProtocol_SetUartBaudRateStruct *)p_data;
+    uint32_t baud_rate = baud_rate_struct->baudRate;
+    uint8_t result = uart_is_baud_rate_supported(baud_rate) ? 0 : 1;
+    if (result != 0) {
+        NRF_LOG_INFO("ERROR: BLE control \"Set UART Baud Rate\" request has unsupported rate: %d.\n",
+                     baud_rate);
+    }
+    message_protocol_send_response(MessageProtocol_BleControlCategoryId,
+                                   BleControlMessageProtocol_SetUartBaudRateRequestId,
+                                   sequence_number, p_data,
+                                   sizeof(BleControlMessageProtocol_SetUartBaudRateStruct), result);
+
+    // The response is sent at the old rate, then the UART switches to the new one.
+    if (result == 0) {
+        uart_change_baud_rate_after_tx(baud_rate);
+    }
+}
+
 void ble_control_message_protocol_init(
     message_protocol_init_ble_device_handler_t init_ble_device_handler,
     message_protocol_set_passkey_handler_t set_passkey_handler,
@@ -125,6 +156,9 @@ void ble_control_message_protocol_init(
     message_protocol_register_request_handler(MessageProtocol_BleControlCategoryId,
                                               BleControlMessageProtocol_DeleteAllBleBondsRequestId,
                                               ble_control_delete_all_bonds_request_handler);
+    message_protocol_register_request_handler(MessageProtocol_BleControlCategoryId,
+                                              BleControlMessageProtocol_SetUartBaudRateRequestId,
+                                              ble_control_set_uart_baud_rate_request_handler);
 }
 
 void ble_control_message_protocol_clean_up(void) {}
@@ -3,28 +3,15 @@
 
 #include "message_protocol.h"
 #include "message_protocol_private.h"
-#include "message_protocol_utilities.h"
 #include "uart_utilities.h"
+#include "ble_nus.h"
 
-#include "nrf_delay.h"
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
 #define UART_SEND_BUFFER_SIZE 247u // This is the max MTU size of BLE GATT
 
-#define PROTOCOL_BUSY 1
-#define INVALID_REQUEST_DATA 2
-#define UART_SEND_MAX_RETRY 20u // Max retry 20 times (2 seconds)
-
-// Message protocol state
-typedef enum 
-{ 
-    IDLE_STATE, 
-    SENDING_DATA_STATE
-} message_protocol_state_t;
-
-static message_protocol_state_t m_state;
 static message_protocol_send_data_to_ble_nus_handler_t m_send_data_to_ble_nus_handler;
 
 // Message protocol request message handlers list
@@ -36,31 +23,33 @@ struct RequestHandlerNode {
 };
 static struct RequestHandlerNode *m_request_handler_list;
 
+// The Azure Sphere app sends a request again, with the same sequence number, if its response
+// does not arrive in time. The most recent requests are remembered, with their responses, so a
+// repeated request is answered again instead of being handled twice.
+#define RECENT_REQUEST_COUNT 4u
+#define RECENT_RESPONSE_MAX_SIZE (sizeof(MessageProtocol_ResponseHeader) + 16u)
+
+typedef struct {
+    bool in_use;
+    bool responded;
+    MessageProtocol_CategoryId category_id;
+    MessageProtocol_RequestId request_id;
+    MessageProtocol_SequenceNumber sequence_number;
+    uint8_t response[RECENT_RESPONSE_MAX_SIZE];
+    uint16_t response_length;
+} recent_request_t;
+
+static recent_request_t m_recent_requests[RECENT_REQUEST_COUNT];
+static uint8_t m_recent_request_next; // Index of the entry to reuse for the next new request.
+
 int message_protocol_send_data_via_uart(uint8_t const *p_data_to_send, uint32_t total_bytes_to_send)
 {
-    int result = 0;
-    uint8_t retry = 0;
-    do {
-        // Check protocol state
-        if (m_state != IDLE_STATE) {
-            result = PROTOCOL_BUSY;
-            nrf_delay_ms(100);
-            retry++;
-        } else {
-            // Before sending data set state to SENDING_DATA_STATE
-            m_state = SENDING_DATA_STATE;
-            send_data_via_uart(p_data_to_send, total_bytes_to_send);
-            // Data sending over, set back to IDLE_STATE
-            m_state = IDLE_STATE;
-            result = 0;
-        }
-    } while (result == PROTOCOL_BUSY && retry < UART_SEND_MAX_RETRY);
-
-    if (result != 0) {
+    // The data is queued and sent in the background, so this does not wait for the UART.
+    uint32_t result = send_data_via_uart(p_data_to_send, total_bytes_to_send);
+    if (result != NRF_SUCCESS) {
         NRF_LOG_INFO("ERROR: Failed to send UART data, error: %d.\n", result);
     }
-    m_state = IDLE_STATE;
-    return result;
+    return (int)result;
 }
 
 static MessageProtocol_RequestMessage *get_ble_request_message(uint8_t *p_message, uint8_t length)
@@ -82,8 +71,54 @@ static MessageProtocol_RequestMessage *get_ble_request_message(uint8_t *p_messag
     return NULL;
 }
 
+static recent_request_t *find_recent_request(MessageProtocol_CategoryId category_id,
+                                             MessageProtocol_RequestId request_id,
+                                             MessageProtocol_SequenceNumber sequence_number)
+{
+    for (size_t i = 0; i < RECENT_REQUEST_COUNT; ++i) {
+        recent_request_t *p_recent = &m_recent_requests[i];
+        if (p_recent->in_use && p_recent->category_id == category_id &&
+            p_recent->request_id == request_id && p_recent->sequence_number == sequence_number) {
+            return p_recent;
+        }
+    }
+    return NULL;
+}
+
+// Returns true if the request has been received before, in which case it must not be handled
+// again. Otherwise it is remembered so that its response can be sent again.
+static bool is_repeated_request(const MessageProtocol_RequestHeader *p_header)
+{
+    recent_request_t *p_recent =
+        find_recent_request(p_header->categoryId, p_header->requestId, p_header->sequenceNumber);
+    if (p_recent != NULL) {
+        if (p_recent->responded) {
+            NRF_LOG_INFO("Repeated request 0x%x, 0x%x: sending the response again.",
+                         p_header->categoryId, p_header->requestId);
+            message_protocol_send_data_via_uart(p_recent->response, p_recent->response_length);
+        } else {
+            NRF_LOG_INFO("Repeated request 0x%x, 0x%x: ignored, as the response is not ready.",
+                         p_header->categoryId, p_header->requestId);
+        }
+        return true;
+    }
+
+    p_recent = &m_recent_requests[m_recent_request_next];
+    m_recent_request_next = (m_recent_request_next + 1) % RECENT_REQUEST_COUNT;
+    p_recent->in_use = true;
+    p_recent->responded = false;
+    p_recent->category_id = p_header->categoryId;
+    p_recent->request_id = p_header->requestId;
+    p_recent->sequence_number = p_header->sequenceNumber;
+    return false;
+}
+
 static void call_request_handler(MessageProtocol_RequestMessage *p_request_message)
 {
+    if (is_repeated_request(&p_request_message->requestHeader)) {
+        return;
+    }
+
     struct RequestHandlerNode *current = m_request_handler_list;
     while (current != NULL) {
         if (current->categoryId == p_request_message->requestHeader.categoryId &&
@@ -103,34 +138,73 @@ static void call_request_handler(MessageProtocol_RequestMessage *p_request_messa
         p_request_message->requestHeader.categoryId, p_request_message->requestHeader.requestId);
 }
 
-void received_uart_data_handler(uint8_t *p_received_data, uint8_t *p_received_data_length)
+static void handle_received_message(uint8_t *p_message, uint16_t length)
 {
-    // Only send UART data over BLE when the message is complete
-    if (MessageProtocol_IsMessageComplete(p_received_data, *p_received_data_length)) {
-        MessageProtocol_RequestMessage *request_message =
-            get_ble_request_message(p_received_data, *p_received_data_length);
-        // If request_message isn't NULL, we have received a valid BLE request, handle the
-        // request.
-        if (request_message != NULL) {
-            NRF_LOG_INFO("Handle BLE control request message");
-            call_request_handler(request_message);
-        } else {
-            NRF_LOG_DEBUG("Ready to send data over BLE NUS");
-            NRF_LOG_HEXDUMP_DEBUG(p_received_data, *p_received_data_length);
-
-            uint32_t err_code;
-            do {
-                NRF_LOG_DEBUG("Forward received UART data over BLE NUS");
-                uint16_t length = (uint16_t)*p_received_data_length;
-                // Send received UART data over BLE NUS
-                err_code = m_send_data_to_ble_nus_handler(p_received_data, length);
-                if ((err_code != NRF_ERROR_INVALID_STATE) && (err_code != NRF_ERROR_BUSY) &&
-                    (err_code != NRF_ERROR_NOT_FOUND)) {
-                    APP_ERROR_CHECK(err_code);
-                }
-            } while (err_code == NRF_ERROR_BUSY);
+    MessageProtocol_RequestMessage *request_message = get_ble_request_message(p_message, length);
+    // If request_message isn't NULL, we have received a valid BLE request, handle the
+    // request.
+    if (request_message != NULL) {
+        NRF_LOG_INFO("Handle BLE control request message");
+        call_request_handler(request_message);
+    } else {
+        NRF_LOG_DEBUG("Ready to send data over BLE NUS");
+        NRF_LOG_HEXDUMP_DEBUG(p_message, length);
+
+        uint32_t err_code;
+        do {
+            NRF_LOG_DEBUG("Forward received UART data over BLE NUS");
+            // Send received UART data over BLE NUS
+            err_code = m_send_data_to_ble_nus_handler(p_message, length);
+            if ((err_code != NRF_ERROR_INVALID_STATE) && (err_code != NRF_ERROR_BUSY) &&
+                (err_code != NRF_ERROR_NOT_FOUND)) {
+                APP_ERROR_CHECK(err_code);
+            }
+        } while (err_code == NRF_ERROR_BUSY);
+    }
+}
+
+static void remove_first_received_byte(uint8_t *p_received_data, uint16_t *p_received_data_length)
+{
+    (*p_received_data_length)--;
+    memmove(p_received_data, p_received_data + 1, *p_received_data_length);
+}
+
+uint16_t received_uart_data_handler(uint8_t *p_received_data, uint16_t *p_received_data_length)
+{
+    const uint16_t header_size = sizeof(MessageProtocol_MessageHeader);
+
+    for (;;) {
+        uint16_t length = *p_received_data_length;
+
+        // Received data should always start with the preamble, so remove any bytes which cannot be
+        // the start of a message.
+        uint16_t check_preamble_size = (length < sizeof(MessageProtocol_MessagePreamble))
+                                           ? length
+                                           : sizeof(MessageProtocol_MessagePreamble);
+        if (memcmp(MessageProtocol_MessagePreamble, p_received_data, check_preamble_size) != 0) {
+            remove_first_received_byte(p_received_data, p_received_data_length);
+            continue;
+        }
+
+        // Receive the rest of the header, and then the rest of the message.
+        if (length < header_size) {
+            return (uint16_t)(header_size - length);
         }
+        MessageProtocol_MessageHeader *message_header =
+            (MessageProtocol_MessageHeader *)p_received_data;
+        uint32_t message_length = message_header->length + (uint32_t)header_size;
+        if (message_length > BLE_NUS_MAX_DATA_LEN) {
+            NRF_LOG_INFO("ERROR: Received invalid message - too long: %d.\n", message_length);
+            remove_first_received_byte(p_received_data, p_received_data_length);
+            continue;
+        }
+        if (length < message_length) {
+            return (uint16_t)(message_length - length);
+        }
+
+        handle_received_message(p_received_data, length);
         *p_received_data_length = 0;
+        return header_size;
     }
 }
 
@@ -164,6 +238,15 @@ void message_protocol_send_response(MessageProtocol_CategoryId category_id,
         memcpy(response_message.data, p_data, data_size);
     }
 
+    // Keep the response in case the request is repeated. A response which is too long to keep
+    // is not sent again, so the repeated request times out.
+    recent_request_t *p_recent = find_recent_request(category_id, request_id, sequence_number);
+    if (p_recent != NULL && total_message_length <= RECENT_RESPONSE_MAX_SIZE) {
+        memcpy(p_recent->response, &response_message, total_message_length);
+        p_recent->response_length = total_message_length;
+        p_recent->responded = true;
+    }
+
     message_protocol_send_data_via_uart((uint8_t *)(&response_message), total_message_length);
 }
 
@@ -200,10 +283,11 @@ void message_protocol_register_request_handler(MessageProtocol_CategoryId catego
 void message_protocol_init(
     message_protocol_send_data_to_ble_nus_handler_t send_data_to_ble_nus_handler)
 {
-    m_state = IDLE_STATE;
     m_send_data_to_ble_nus_handler = send_data_to_ble_nus_handler;
     uart_init(received_uart_data_handler);
     m_request_handler_list = NULL;
+    memset(m_recent_requests, 0, sizeof(m_recent_requests));
+    m_recent_request_next = 0;
 }
 
 void message_protocol_clean_up(void)
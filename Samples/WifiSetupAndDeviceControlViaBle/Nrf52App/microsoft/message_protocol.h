@@ -12,7 +12,7 @@
 /// </summary>
 /// <param name="p_data_to_send">The data to send.</param>
 /// <param name="total_bytes_to_send">The size of the data in bytes.</param>
-/// <returns>0 if the data was sent successfully, any other value indicates an error occurred.</returns>
+/// <returns>0 if the data was queued to be sent, any other value indicates an error occurred.</returns>
 int message_protocol_send_data_via_uart(uint8_t const *p_data_to_send,
                                         uint32_t total_bytes_to_send);
 
@@ -107,6 +107,10 @@
 
 #define APP_ADV_DURATION                BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED       /**< The advertising duration in units of 10 milliseconds (0 means forever). */
 
+#define APP_ADV_RECONNECT_FAST_DURATION 3000                                        /**< Duration of fast advertising after a bonded central disconnects, in units of 10 milliseconds (30 seconds). */
+#define APP_ADV_SLOW_INTERVAL           1600                                        /**< The slow advertising interval (in units of 0.625 ms. This value corresponds to 1 second). */
+#define APP_ADV_SLOW_DURATION           BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED       /**< The slow advertising duration in units of 10 milliseconds (0 means forever). */
+
 #define MIN_CONN_INTERVAL               MSEC_TO_UNITS(20, UNIT_1_25_MS)             /**< Minimum acceptable connection interval (20 ms), Connection interval uses 1.25 ms units. */
 #define MAX_CONN_INTERVAL               MSEC_TO_UNITS(75, UNIT_1_25_MS)             /**< Maximum acceptable connection interval (75 ms), Connection interval uses 1.25 ms units. */
 #define SLAVE_LATENCY                   0                                           /**< Slave latency. */
@@ -115,6 +119,10 @@
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(30000)                      /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
 #define MAX_CONN_PARAMS_UPDATE_COUNT    3                                           /**< Number of attempts before giving up the connection parameter negotiation. */
 
+#define HIGH_THROUGHPUT_MIN_CONN_INTERVAL MSEC_TO_UNITS(7.5, UNIT_1_25_MS)          /**< Minimum connection interval while data is being transferred (7.5 ms). */
+#define HIGH_THROUGHPUT_MAX_CONN_INTERVAL MSEC_TO_UNITS(15, UNIT_1_25_MS)           /**< Maximum connection interval while data is being transferred (15 ms). */
+#define HIGH_THROUGHPUT_IDLE_TIMEOUT    APP_TIMER_TICKS(3000)                       /**< Time without NUS traffic before returning to the low-power connection parameters (3 seconds). */
+
 #define SEC_PARAM_BOND                  1                                           /**< Perform bonding. */
 #define SEC_PARAM_MITM                  1                                           /**< Man In The Middle protection not required. */
 #define SEC_PARAM_LESC                  1                                           /**< LE Secure Connections enabled. */
@@ -124,6 +132,8 @@
 #define SEC_PARAM_MIN_KEY_SIZE          7                                           /**< Minimum encryption key size. */
 #define SEC_PARAM_MAX_KEY_SIZE          16                                          /**< Maximum encryption key size. */
 
+#define NUS_TX_QUEUE_SIZE               8                                           /**< Number of messages which can wait to be sent over BLE NUS. */
+
 #define PASSKEY_LENGTH                  6                                           /**< Length of pass-key received by the stack for display. */
 
 #define DEAD_BEEF                       0xDEADBEEF                                  /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
@@ -131,18 +141,33 @@
 BLE_NUS_DEF(m_nus, NRF_SDH_BLE_TOTAL_LINK_COUNT);                                   /**< BLE NUS service instance. */
 NRF_BLE_GATT_DEF(m_gatt);                                                           /**< GATT module instance. */
 NRF_BLE_QWR_DEF(m_qwr);                                                             /**< Context for the Queued Write module.*/
+APP_TIMER_DEF(m_high_throughput_idle_timer_id);                                     /**< Timer which ends high-throughput mode when the link is idle. */
 BLE_ADVERTISING_DEF(m_advertising);                                                 /**< Advertising module instance. */
 
 static uint16_t     m_conn_handle          = BLE_CONN_HANDLE_INVALID;               /**< Handle of the current connection. */
-static pm_peer_id_t m_peer_id;                                                      /**< Device reference handle to the current bonded central. */
+static pm_peer_id_t m_peer_id              = PM_PEER_ID_INVALID;                    /**< Device reference handle to the current bonded central. */
 static uint16_t     m_ble_nus_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;          /**< Maximum length of data (in bytes) that can be transmitted to the peer by the Nordic UART service module. */
 static ble_uuid_t   m_adv_uuids[]          =                                        /**< Universally unique service identifier. */
 {
     {BLE_UUID_NUS_SERVICE, NUS_SERVICE_UUID_TYPE}
 };
 
+/**@brief A message waiting to be sent over BLE NUS. */
+typedef struct
+{
+    uint8_t  data[BLE_NUS_MAX_DATA_LEN];
+    uint16_t length;
+} nus_tx_message_t;
+
+static nus_tx_message_t m_nus_tx_queue[NUS_TX_QUEUE_SIZE];                          /**< Messages waiting to be sent over BLE NUS, in order. */
+static uint8_t          m_nus_tx_head;                                              /**< Index of the message being sent. */
+static uint8_t          m_nus_tx_count;                                             /**< Number of messages in m_nus_tx_queue. */
+static uint16_t         m_nus_tx_offset;                                            /**< Number of bytes of the message at m_nus_tx_head which have been sent. */
+
 static bool m_initialization_completed = false;
+static bool m_high_throughput_mode = false;
 static bool m_advertising_with_whitelist = true;
+static bool m_fast_reconnect = false;
 
 #define BLE_DEVICE_ALREADY_INITIALIZED 1
 
@@ -198,6 +223,49 @@ static void identities_set(pm_peer_id_list_skip_t skip)
     APP_ERROR_CHECK(err_code);
 }
 
+/**@brief Function for filling in the advertising modes.
+ *
+ * @details Both profiles start with high duty directed advertising to the last bonded central,
+ *          which the advertising module starts on a disconnect. The default profile then
+ *          advertises fast until it is told otherwise. The fast reconnect profile, which is used
+ *          after a bonded central disconnects, only advertises fast for
+ *          @ref APP_ADV_RECONNECT_FAST_DURATION and then falls back to slow advertising, so a
+ *          central which does not come back does not keep the radio busy.
+ *
+ * @param[out] p_config        Advertising modes.
+ * @param[in]  fast_reconnect  Whether to use the fast reconnect profile.
+ */
+static void advertising_modes_get(ble_adv_modes_config_t * p_config, bool fast_reconnect)
+{
+    memset(p_config, 0, sizeof(*p_config));
+
+    p_config->ble_adv_whitelist_enabled          = true;
+    p_config->ble_adv_directed_high_duty_enabled = true;
+    p_config->ble_adv_directed_enabled           = false;
+    p_config->ble_adv_directed_interval          = 0;
+    p_config->ble_adv_directed_timeout           = 0;
+    p_config->ble_adv_fast_enabled  = true;
+    p_config->ble_adv_fast_interval = APP_ADV_INTERVAL;
+    p_config->ble_adv_fast_timeout  = fast_reconnect ? APP_ADV_RECONNECT_FAST_DURATION
+                                                     : APP_ADV_DURATION;
+    p_config->ble_adv_slow_enabled  = fast_reconnect;
+    p_config->ble_adv_slow_interval = APP_ADV_SLOW_INTERVAL;
+    p_config->ble_adv_slow_timeout  = APP_ADV_SLOW_DURATION;
+}
+
+/**@brief Function for selecting the fast reconnect or the default advertising profile.
+ *
+ * @param[in] fast_reconnect  Whether to use the fast reconnect profile.
+ */
+static void advertising_profile_set(bool fast_reconnect)
+{
+    ble_adv_modes_config_t config;
+
+    m_fast_reconnect = fast_reconnect;
+    advertising_modes_get(&config, fast_reconnect);
+    ble_advertising_modes_config_set(&m_advertising, &config);
+}
+
 static int ble_start_advertising_handler(bool use_whitelist)
 {
     ret_code_t ret = 0;
@@ -205,6 +273,9 @@ static int ble_start_advertising_handler(bool use_whitelist)
 
     if(!use_whitelist)
     {
+        // Advertising to all lasts until the Azure Sphere app ends it, so it never slows down.
+        advertising_profile_set(false);
+
         // Disconnect currently connected device before starting advertising to all.
         if(m_conn_handle != BLE_CONN_HANDLE_INVALID)
         {
@@ -277,7 +348,12 @@ static void pm_evt_handler(pm_evt_t const * p_evt)
 
     switch (p_evt->evt_id)
     {
+        case PM_EVT_CONN_SEC_SUCCEEDED:
+            m_peer_id = p_evt->peer_id;
+            break;
+
         case PM_EVT_PEERS_DELETE_SUCCEEDED:
+            m_peer_id = PM_PEER_ID_INVALID;
             ble_start_advertising_handler(m_advertising_with_whitelist);
             break;
 
@@ -297,12 +373,74 @@ static void pm_evt_handler(pm_evt_t const * p_evt)
     }
 }
 
+/**@brief Function for switching between the high-throughput and low-power connection parameters.
+ *
+ * @details High-throughput mode asks the central for a short connection interval, so bulk
+ *          transfers such as the Wi-Fi scan results take fewer connection events. Low-power
+ *          mode asks for the default parameters again.
+ *
+ * @param[in] high_throughput  Whether to use the high-throughput parameters.
+ */
+static void high_throughput_mode_set(bool high_throughput)
+{
+    if (m_high_throughput_mode == high_throughput || m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+
+    ble_gap_conn_params_t conn_params;
+    memset(&conn_params, 0, sizeof(conn_params));
+    conn_params.min_conn_interval = high_throughput ? HIGH_THROUGHPUT_MIN_CONN_INTERVAL : MIN_CONN_INTERVAL;
+    conn_params.max_conn_interval = high_throughput ? HIGH_THROUGHPUT_MAX_CONN_INTERVAL : MAX_CONN_INTERVAL;
+    conn_params.slave_latency     = SLAVE_LATENCY;
+    conn_params.conn_sup_timeout  = CONN_SUP_TIMEOUT;
+
+    ret_code_t err_code = ble_conn_params_change_conn_params(m_conn_handle, &conn_params);
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING("Failed to change connection parameters. Error 0x%x.", err_code);
+        return;
+    }
+
+    NRF_LOG_INFO("%s high-throughput mode.", high_throughput ? "Entering" : "Leaving");
+    m_high_throughput_mode = high_throughput;
+}
+
+/**@brief Function for handling the high-throughput idle timer timeout.
+ *
+ * @param[in] p_context  Unused.
+ */
+static void high_throughput_idle_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    high_throughput_mode_set(false);
+}
+
+/**@brief Function for recording NUS traffic, which keeps the link in high-throughput mode until
+ *        it has been idle for HIGH_THROUGHPUT_IDLE_TIMEOUT.
+ */
+static void nus_traffic_occurred(void)
+{
+    high_throughput_mode_set(true);
+
+    // Restart the idle timer.
+    ret_code_t err_code = app_timer_stop(m_high_throughput_idle_timer_id);
+    APP_ERROR_CHECK(err_code);
+    err_code = app_timer_start(m_high_throughput_idle_timer_id, HIGH_THROUGHPUT_IDLE_TIMEOUT, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
 /**@brief Function for initializing the timer module.
  */
 static void timers_init(void)
 {
     ret_code_t err_code = app_timer_init();
     APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_high_throughput_idle_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                high_throughput_idle_timeout_handler);
+    APP_ERROR_CHECK(err_code);
 }
 
 /**@brief Function for handling Queued Write Module errors.
@@ -317,6 +455,65 @@ static void nrf_qwr_error_handler(uint32_t nrf_error)
     APP_ERROR_HANDLER(nrf_error);
 }
 
+/**@brief Function for handing queued messages to the SoftDevice as notifications.
+ *
+ * @details Notifications are sent until the SoftDevice has no notification buffer left, so as
+ *          many as the link allows go out in each connection event. Messages longer than the
+ *          negotiated ATT MTU allows are sent as several notifications, which the central
+ *          reassembles using the message header. Sending resumes on BLE_NUS_EVT_TX_RDY, when
+ *          the SoftDevice has sent a notification.
+ *
+ *          Must be called with interrupts disabled.
+ */
+static void nus_tx_queue_process(void)
+{
+    while (m_nus_tx_count > 0)
+    {
+        nus_tx_message_t * p_message    = &m_nus_tx_queue[m_nus_tx_head];
+        uint16_t           chunk_length = p_message->length - m_nus_tx_offset;
+        if (chunk_length > m_ble_nus_max_data_len)
+        {
+            chunk_length = m_ble_nus_max_data_len;
+        }
+
+        uint16_t sent_length = chunk_length;
+        uint32_t err_code    = ble_nus_data_send(&m_nus, &p_message->data[m_nus_tx_offset],
+                                                 &sent_length, m_conn_handle);
+        if (err_code == NRF_ERROR_RESOURCES || err_code == NRF_ERROR_BUSY)
+        {
+            return;
+        }
+
+        if (err_code == NRF_SUCCESS)
+        {
+            m_nus_tx_offset += chunk_length;
+            if (m_nus_tx_offset < p_message->length)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            NRF_LOG_WARNING("Dropping BLE NUS message. Error 0x%x.", err_code);
+        }
+
+        m_nus_tx_head   = (m_nus_tx_head + 1) % NUS_TX_QUEUE_SIZE;
+        m_nus_tx_count--;
+        m_nus_tx_offset = 0;
+    }
+}
+
+/**@brief Function for discarding the messages waiting to be sent over BLE NUS.
+ */
+static void nus_tx_queue_clear(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_nus_tx_head   = 0;
+    m_nus_tx_count  = 0;
+    m_nus_tx_offset = 0;
+    CRITICAL_REGION_EXIT();
+}
+
 /**@brief Function for handling the data from the Nordic UART Service.
  *
  * @details This function will process the data received from the Nordic UART BLE Service and send
@@ -332,6 +529,7 @@ static void nus_data_handler(ble_nus_evt_t * p_evt)
     {
         NRF_LOG_DEBUG("Received data from BLE NUS. Writing data on UART.");
         NRF_LOG_HEXDUMP_DEBUG(p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
+        nus_traffic_occurred();
         int result = message_protocol_send_data_via_uart(p_evt->params.rx_data.p_data, 
                                                          p_evt->params.rx_data.length);
 
@@ -340,6 +538,12 @@ static void nus_data_handler(ble_nus_evt_t * p_evt)
             NRF_LOG_ERROR("Failed to send UART data.");
         }
     }
+    else if (p_evt->type == BLE_NUS_EVT_TX_RDY)
+    {
+        CRITICAL_REGION_ENTER();
+        nus_tx_queue_process();
+        CRITICAL_REGION_EXIT();
+    }
 
 }
 
@@ -348,9 +552,10 @@ static void nus_data_handler(ble_nus_evt_t * p_evt)
  * @details This function will be called for all events in the Connection Parameters Module
  *          which are passed to the application.
  *
- * @note All this function does is to disconnect. This could have been done by simply setting
- *       the disconnect_on_fail config parameter, but instead we use the event handler
- *       mechanism to demonstrate its use.
+ * @note If the central does not accept the high-throughput parameters, the link falls back to
+ *       the low-power parameters. Otherwise all this function does is to disconnect. This could
+ *       have been done by simply setting the disconnect_on_fail config parameter, but instead we
+ *       use the event handler mechanism to demonstrate its use.
  *
  * @param[in] p_evt  Event received from the Connection Parameters Module.
  */
@@ -358,7 +563,12 @@ static void on_conn_params_evt(ble_conn_params_evt_t * p_evt)
 {
     uint32_t err_code;
 
-    if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
+    if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED && m_high_throughput_mode)
+    {
+        NRF_LOG_INFO("High-throughput connection parameters rejected.");
+        high_throughput_mode_set(false);
+    }
+    else if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
     {
         err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
         APP_ERROR_CHECK(err_code);
@@ -444,6 +654,12 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
             NRF_LOG_INFO("Slow advertising.");
             err_code = bsp_indication_set(BSP_INDICATE_ADVERTISING_SLOW);
             APP_ERROR_CHECK(err_code);
+            if(m_advertising_with_whitelist)
+            {
+                // Slow advertising is only used to wait for a bonded central.
+                NRF_LOG_INFO("Stop advertising, start fast advertising with whitelist");
+                ble_start_advertising_handler(true);
+            }
             break;
 
         case BLE_ADV_EVT_FAST_WHITELIST:
@@ -545,6 +761,21 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
             APP_ERROR_CHECK(err_code);
             m_advertising_with_whitelist = true;
+            m_high_throughput_mode = false;
+            m_ble_nus_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - OPCODE_LENGTH - HANDLE_LENGTH;
+            {
+                // Ask for the 2M PHY; the central may keep 1M.
+                ble_gap_phys_t const phys =
+                {
+                    .rx_phys = BLE_GAP_PHY_2MBPS,
+                    .tx_phys = BLE_GAP_PHY_2MBPS,
+                };
+                err_code = sd_ble_gap_phy_update(m_conn_handle, &phys);
+                if (err_code != NRF_SUCCESS)
+                {
+                    NRF_LOG_WARNING("Failed to request 2M PHY. Error 0x%x.", err_code);
+                }
+            }
             ble_control_message_protocol_send_connected_event();
             break;
 
@@ -552,9 +783,23 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             NRF_LOG_INFO("Disconnected");
             // LED indication will be changed when advertising starts.
             m_conn_handle = BLE_CONN_HANDLE_INVALID;
+            // The advertising module has already started high duty directed advertising to the
+            // central, if it is bonded. Let the fast advertising which follows it time out.
+            advertising_profile_set(m_advertising_with_whitelist
+                                    && (m_peer_id != PM_PEER_ID_INVALID));
+            m_high_throughput_mode = false;
+            err_code = app_timer_stop(m_high_throughput_idle_timer_id);
+            APP_ERROR_CHECK(err_code);
+            nus_tx_queue_clear();
             ble_control_message_protocol_send_disconnected_event();
             break;
 
+        case BLE_GAP_EVT_PHY_UPDATE:
+            NRF_LOG_INFO("PHY updated: tx 0x%x rx 0x%x.",
+                         p_ble_evt->evt.gap_evt.params.phy_update.tx_phy,
+                         p_ble_evt->evt.gap_evt.params.phy_update.rx_phy);
+            break;
+
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
         {
             NRF_LOG_DEBUG("PHY update request.");
@@ -714,9 +959,57 @@ static void idle_state_handle(void)
     nrf_pwr_mgmt_run();
 }
 
+/**@brief Function for sending a message over BLE NUS.
+ *
+ * @details The message is copied into the TX queue, and this function returns without waiting
+ *          for it to be sent; see @ref nus_tx_queue_process.
+ *
+ * @param[in] data    The message to send.
+ * @param[in] length  The size of the message in bytes.
+ *
+ * @retval NRF_SUCCESS               The message has been queued.
+ * @retval NRF_ERROR_INVALID_LENGTH  The message is longer than BLE_NUS_MAX_DATA_LEN.
+ * @retval NRF_ERROR_INVALID_STATE   No central is connected.
+ * @retval NRF_ERROR_BUSY            The TX queue is full. The caller should try again.
+ */
 static uint32_t send_data_to_ble_nus(uint8_t *data, uint16_t length)
 {
-    return ble_nus_data_send(&m_nus, data, &length, m_conn_handle);
+    if (length == 0 || length > BLE_NUS_MAX_DATA_LEN)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    nus_traffic_occurred();
+
+    uint32_t err_code = NRF_SUCCESS;
+    CRITICAL_REGION_ENTER();
+    if (m_nus_tx_count >= NUS_TX_QUEUE_SIZE)
+    {
+        // BLE_NUS_EVT_TX_RDY is not handled while the caller waits in this context, so hand
+        // notifications to the SoftDevice here as its buffers become free.
+        nus_tx_queue_process();
+    }
+
+    if (m_nus_tx_count >= NUS_TX_QUEUE_SIZE)
+    {
+        err_code = NRF_ERROR_BUSY;
+    }
+    else
+    {
+        nus_tx_message_t * p_message = &m_nus_tx_queue[(m_nus_tx_head + m_nus_tx_count)
+                                                       % NUS_TX_QUEUE_SIZE];
+        memcpy(p_message->data, data, length);
+        p_message->length = length;
+        m_nus_tx_count++;
+        nus_tx_queue_process();
+    }
+    CRITICAL_REGION_EXIT();
+
+    return err_code;
 }
 
 /**@brief Function for the SoftDevice initialization.
@@ -794,6 +1087,10 @@ void gatt_init(void)
 
     err_code = nrf_ble_gatt_att_mtu_periph_set(&m_gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
     APP_ERROR_CHECK(err_code);
+
+    // Request data length extension, so a full ATT MTU fits in one link-layer packet.
+    err_code = nrf_ble_gatt_data_length_set(&m_gatt, BLE_CONN_HANDLE_INVALID, NRF_SDH_BLE_GAP_DATA_LENGTH);
+    APP_ERROR_CHECK(err_code);
 }
 
 /**@snippet [Handling the data received over BLE] */
@@ -838,14 +1135,7 @@ static void advertising_init(void)
     init.srdata.uuids_complete.uuid_cnt = sizeof(m_adv_uuids) / sizeof(m_adv_uuids[0]);
     init.srdata.uuids_complete.p_uuids  = m_adv_uuids;
 
-    init.config.ble_adv_whitelist_enabled          = true;
-    init.config.ble_adv_directed_high_duty_enabled = true;
-    init.config.ble_adv_directed_enabled           = false;
-    init.config.ble_adv_directed_interval          = 0;
-    init.config.ble_adv_directed_timeout           = 0;
-    init.config.ble_adv_fast_enabled  = true;
-    init.config.ble_adv_fast_interval = APP_ADV_INTERVAL;
-    init.config.ble_adv_fast_timeout  = APP_ADV_DURATION;
+    advertising_modes_get(&init.config, m_fast_reconnect);
     init.evt_handler = on_adv_evt;
 
     err_code = ble_advertising_init(&m_advertising, &init);
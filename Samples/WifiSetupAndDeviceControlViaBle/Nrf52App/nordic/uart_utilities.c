@@ -49,8 +49,13 @@
  */
 #include "uart_utilities.h"
 
+#include <stdbool.h>
+#include <string.h>
+
 #include "ble_nus.h"
-#include "app_uart.h"
+#include "app_util_platform.h"
+#include "nrf_drv_uart.h"
+#include "nrf_delay.h"
 #include "bsp_btn_ble.h"
 
 #if defined(UART_PRESENT)
@@ -64,58 +69,172 @@
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 
-#define UART_TX_BUF_SIZE 256 /**< UART TX buffer size. */
-#define UART_RX_BUF_SIZE 256 /**< UART RX buffer size. */
+#define UART_TX_FRAME_SIZE 247  /**< Largest frame which can be queued: the max MTU size of BLE GATT. */
+#define UART_TX_QUEUE_SIZE 4    /**< Number of frames which can wait to be sent. */
+#define UART_DEFAULT_BAUD_RATE 115200 /**< Baud rate used until a faster one is negotiated. */
+#define UART_TX_DRAIN_DELAY_US 200    /**< Time for the last bytes to leave the UART after the final TX_DONE event. */
+
+#if defined(UART_PRESENT)
+#define UART_BAUDRATE_SETTING(rate) NRF_UART_BAUDRATE_##rate
+#else
+#define UART_BAUDRATE_SETTING(rate) (nrf_uart_baudrate_t)NRF_UARTE_BAUDRATE_##rate
+#endif
+
+static nrf_drv_uart_t m_uart = NRF_DRV_UART_INSTANCE(0);
 
 static received_uart_data_handler_t m_received_uart_data_handler;
 
+static uint8_t m_rx_buffer[BLE_NUS_MAX_DATA_LEN]; /**< Data received so far for the current message. */
+static uint16_t m_rx_length;                      /**< Number of bytes in m_rx_buffer. */
+
+/**@brief A frame waiting to be sent via UART. */
+typedef struct {
+    uint8_t data[UART_TX_FRAME_SIZE];
+    uint8_t length;
+} uart_tx_frame_t;
+
+static uart_tx_frame_t m_tx_queue[UART_TX_QUEUE_SIZE]; /**< Frames waiting to be sent, in order. */
+static uint8_t m_tx_head;                              /**< Index of the frame being sent. */
+static uint8_t m_tx_count;                             /**< Number of frames in m_tx_queue. */
+static bool m_tx_in_progress;                          /**< Whether the frame at m_tx_head is being sent. */
+
+static uint32_t m_pending_baud_rate; /**< Baud rate to switch to once the TX queue is empty, or zero. */
+
+static void uart_configure(nrf_uart_baudrate_t baud_rate);
+static void switch_baud_rate(void);
+
+/**@brief Function for getting the driver setting for a baud rate.
+ *
+ * @param[in]  baud_rate  The baud rate in bits per second.
+ * @param[out] p_setting  The driver setting for the baud rate.
+ *
+ * @return true if the baud rate is supported, false otherwise.
+ */
+static bool get_baud_rate_setting(uint32_t baud_rate, nrf_uart_baudrate_t *p_setting)
+{
+    switch (baud_rate) {
+    case 115200:
+        *p_setting = UART_BAUDRATE_SETTING(115200);
+        return true;
+    case 230400:
+        *p_setting = UART_BAUDRATE_SETTING(230400);
+        return true;
+    case 460800:
+        *p_setting = UART_BAUDRATE_SETTING(460800);
+        return true;
+    case 921600:
+        *p_setting = UART_BAUDRATE_SETTING(921600);
+        return true;
+    case 1000000:
+        *p_setting = UART_BAUDRATE_SETTING(1000000);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**@brief Function for starting to send the frame at the front of the TX queue.
+ *
+ * @details Must be called with interrupts disabled, or from the UART event handler.
+ */
+static void start_uart_transfer(void)
+{
+    if (m_tx_in_progress || m_tx_count == 0) {
+        return;
+    }
+
+    uart_tx_frame_t *p_frame = &m_tx_queue[m_tx_head];
+    m_tx_in_progress = true;
+    uint32_t err_code = nrf_drv_uart_tx(&m_uart, p_frame->data, p_frame->length);
+    APP_ERROR_CHECK(err_code);
+}
+
 /**@brief Function for sending data via UART.
  *
- * @details This function will send data to the UART module.
+ * @details This function copies the data into the TX queue and returns without waiting for it
+ *          to be sent. The frames are sent in order by EasyDMA, each one being started when the
+ *          UART driver reports that the previous frame has been sent.
  *
  * @param[in] p_data_to_send       The data to send.
  * @param[in] total_bytes_to_send  The size of the data in bytes.
+ *
+ * @retval NRF_SUCCESS               The data has been queued.
+ * @retval NRF_ERROR_INVALID_LENGTH  The data is larger than a frame.
+ * @retval NRF_ERROR_NO_MEM          The TX queue is full.
  */
-void send_data_via_uart(uint8_t const *p_data_to_send, uint32_t total_bytes_to_send)
+uint32_t send_data_via_uart(uint8_t const *p_data_to_send, uint32_t total_bytes_to_send)
 {
-    uint32_t err_code;
-    NRF_LOG_INFO("Writing data on UART.");
-    for (uint32_t i = 0; i < total_bytes_to_send; i++) {
-        do {
-            err_code = app_uart_put(p_data_to_send[i]);
-            if ((err_code != NRF_SUCCESS) && (err_code != NRF_ERROR_BUSY)) {
-                NRF_LOG_ERROR("Failed sending UART data. Error 0x%x. ", err_code);
-                APP_ERROR_CHECK(err_code);
-            }
-        } while (err_code == NRF_ERROR_BUSY);
+    if (total_bytes_to_send == 0 || total_bytes_to_send > UART_TX_FRAME_SIZE) {
+        NRF_LOG_ERROR("Failed sending UART data. Error 0x%x. ", NRF_ERROR_INVALID_LENGTH);
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    uint32_t err_code = NRF_SUCCESS;
+    CRITICAL_REGION_ENTER();
+    if (m_tx_count >= UART_TX_QUEUE_SIZE) {
+        err_code = NRF_ERROR_NO_MEM;
+    } else {
+        uart_tx_frame_t *p_frame = &m_tx_queue[(m_tx_head + m_tx_count) % UART_TX_QUEUE_SIZE];
+        memcpy(p_frame->data, p_data_to_send, total_bytes_to_send);
+        p_frame->length = (uint8_t)total_bytes_to_send;
+        m_tx_count++;
+        start_uart_transfer();
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (err_code != NRF_SUCCESS) {
+        NRF_LOG_ERROR("Failed sending UART data. Error 0x%x. ", err_code);
+    } else {
+        NRF_LOG_INFO("Writing data on UART.");
+    }
+    return err_code;
+}
+
+/**@brief Function for asking the received UART data handler how much data to receive next, and
+ *        starting the EasyDMA transfer for it.
+ */
+static void start_uart_receive(void)
+{
+    uint16_t length = m_received_uart_data_handler(m_rx_buffer, &m_rx_length);
+    if (length > sizeof(m_rx_buffer) - m_rx_length) {
+        length = sizeof(m_rx_buffer) - m_rx_length;
     }
+
+    uint32_t err_code = nrf_drv_uart_rx(&m_uart, &m_rx_buffer[m_rx_length], (uint8_t)length);
+    APP_ERROR_CHECK(err_code);
 }
 
-/**@brief   Function for handling app_uart events.
+/**@brief   Function for handling UART driver events.
  *
- * @details This function will receive a single character from the app_uart module and append it to
- *          a buffer. If the event type is APP_UART_DATA_READY, the received UART data handle is
- *          called each time to process the data.
+ * @details Data is received by EasyDMA in transfers of exactly the size requested by the
+ *          received UART data handler, so the handler is called once per transfer rather than
+ *          once per byte. Hardware flow control holds off the sender between transfers.
  */
 /**@snippet [Handling the data received over UART] */
-static void uart_event_handle(app_uart_evt_t *p_event)
+static void uart_event_handle(nrf_drv_uart_event_t *p_event, void *p_context)
 {
-    static uint8_t data_array[BLE_NUS_MAX_DATA_LEN];
-    static uint8_t index = 0;
-
-    switch (p_event->evt_type) {
-    case APP_UART_DATA_READY:
-        UNUSED_VARIABLE(app_uart_get(&data_array[index]));
-        index++;
-        m_received_uart_data_handler(data_array, &index);
+    UNUSED_PARAMETER(p_context);
+
+    switch (p_event->type) {
+    case NRF_DRV_UART_EVT_RX_DONE:
+        m_rx_length += p_event->data.rxtx.bytes;
+        start_uart_receive();
         break;
 
-    case APP_UART_COMMUNICATION_ERROR:
-        APP_ERROR_HANDLER(p_event->data.error_communication);
+    case NRF_DRV_UART_EVT_TX_DONE:
+        // The frame at the front of the queue has been sent, so start the next one.
+        m_tx_head = (m_tx_head + 1) % UART_TX_QUEUE_SIZE;
+        m_tx_count--;
+        m_tx_in_progress = false;
+        if (m_tx_count == 0 && m_pending_baud_rate != 0) {
+            switch_baud_rate();
+        } else {
+            start_uart_transfer();
+        }
         break;
 
-    case APP_UART_FIFO_ERROR:
-        APP_ERROR_HANDLER(p_event->data.error_code);
+    case NRF_DRV_UART_EVT_ERROR:
+        APP_ERROR_HANDLER(p_event->data.error.error_mask);
         break;
 
     default:
@@ -123,6 +242,55 @@ static void uart_event_handle(app_uart_evt_t *p_event)
     }
 }
 
+/**@brief Function for configuring the UART driver and starting to receive.
+ *
+ * @details Any partially received message is discarded.
+ *
+ * @param[in] baud_rate  The driver setting for the baud rate.
+ */
+static void uart_configure(nrf_uart_baudrate_t baud_rate)
+{
+    m_rx_length = 0;
+
+    uint32_t err_code;
+    nrf_drv_uart_config_t config = NRF_DRV_UART_DEFAULT_CONFIG;
+    config.pselrxd = RX_PIN_NUMBER;
+    config.pseltxd = TX_PIN_NUMBER;
+    config.pselrts = RTS_PIN_NUMBER;
+    config.pselcts = CTS_PIN_NUMBER;
+    config.hwfc = NRF_UART_HWFC_ENABLED;
+    config.parity = NRF_UART_PARITY_EXCLUDED;
+    config.baudrate = baud_rate;
+    config.interrupt_priority = APP_IRQ_PRIORITY_LOWEST;
+#if defined(NRF_DRV_UART_WITH_UARTE) && defined(NRF_DRV_UART_WITH_UART)
+    config.use_easy_dma = true;
+#endif
+
+    err_code = nrf_drv_uart_init(&m_uart, &config, uart_event_handle);
+    APP_ERROR_CHECK(err_code);
+
+    start_uart_receive();
+}
+
+/**@brief Function for switching to the pending baud rate, once all queued data has been sent.
+ */
+static void switch_baud_rate(void)
+{
+    nrf_uart_baudrate_t setting;
+    bool supported = get_baud_rate_setting(m_pending_baud_rate, &setting);
+    m_pending_baud_rate = 0;
+    if (!supported) {
+        return;
+    }
+
+    // TX_DONE is reported when the last byte has been read from RAM, not when it has left the
+    // UART, so wait for it before changing rate.
+    nrf_delay_us(UART_TX_DRAIN_DELAY_US);
+    nrf_drv_uart_uninit(&m_uart);
+    uart_configure(setting);
+    NRF_LOG_INFO("UART baud rate changed.");
+}
+
 /**@brief  Function for initializing the UART module.
  *
  * @param[in] received_uart_data_handler  The handler for received UART data.
@@ -131,23 +299,40 @@ static void uart_event_handle(app_uart_evt_t *p_event)
 void uart_init(received_uart_data_handler_t received_uart_data_handler)
 {
     m_received_uart_data_handler = received_uart_data_handler;
+    m_tx_head = 0;
+    m_tx_count = 0;
+    m_tx_in_progress = false;
+    m_pending_baud_rate = 0;
 
-    uint32_t err_code;
-    app_uart_comm_params_t const comm_params = {
-        .rx_pin_no = RX_PIN_NUMBER,
-        .tx_pin_no = TX_PIN_NUMBER,
-        .rts_pin_no = RTS_PIN_NUMBER,
-        .cts_pin_no = CTS_PIN_NUMBER,
-        .flow_control = APP_UART_FLOW_CONTROL_ENABLED,
-        .use_parity = false,
-#if defined(UART_PRESENT)
-        .baud_rate = NRF_UART_BAUDRATE_115200
-#else
-        .baud_rate = NRF_UARTE_BAUDRATE_115200
-#endif
-    };
+    nrf_uart_baudrate_t setting;
+    UNUSED_RETURN_VALUE(get_baud_rate_setting(UART_DEFAULT_BAUD_RATE, &setting));
+    uart_configure(setting);
+}
 
-    APP_UART_FIFO_INIT(&comm_params, UART_RX_BUF_SIZE, UART_TX_BUF_SIZE, uart_event_handle,
-                       APP_IRQ_PRIORITY_LOWEST, err_code);
-    APP_ERROR_CHECK(err_code);
+/**@brief Function for checking whether the UART can run at a baud rate.
+ *
+ * @param[in] baud_rate  The baud rate in bits per second.
+ *
+ * @return true if the baud rate is supported, false otherwise.
+ */
+bool uart_is_baud_rate_supported(uint32_t baud_rate)
+{
+    nrf_uart_baudrate_t setting;
+    return get_baud_rate_setting(baud_rate, &setting);
+}
+
+/**@brief Function for changing the UART baud rate once all queued data has been sent.
+ *
+ * @details Hardware flow control stays enabled at every rate.
+ *
+ * @param[in] baud_rate  The baud rate in bits per second.
+ */
+void uart_change_baud_rate_after_tx(uint32_t baud_rate)
+{
+    CRITICAL_REGION_ENTER();
+    m_pending_baud_rate = baud_rate;
+    if (m_tx_count == 0) {
+        switch_baud_rate();
+    }
+    CRITICAL_REGION_EXIT();
 }
\ No newline at end of file
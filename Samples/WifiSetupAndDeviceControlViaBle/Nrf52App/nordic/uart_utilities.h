@@ -50,22 +50,34 @@
 #pragma once
 #include <stdlib.h>
 #include <inttypes.h>
+#include <stdbool.h>
 
 /**@brief Function for sending data via UART.
  *
- * @details This function will send data to the UART module.
+ * @details This function queues the data as one frame and returns without waiting for it to be
+ *          sent.
  *
  * @param[in] p_data_to_send       The data to send.
  * @param[in] total_bytes_to_send  The size of the data in bytes.
+ *
+ * @retval NRF_SUCCESS               The data has been queued.
+ * @retval NRF_ERROR_INVALID_LENGTH  The data is larger than a frame.
+ * @retval NRF_ERROR_NO_MEM          The TX queue is full.
  */
-void send_data_via_uart(uint8_t const *p_data_to_send, uint32_t total_bytes_to_send);
+uint32_t send_data_via_uart(uint8_t const *p_data_to_send, uint32_t total_bytes_to_send);
 
 /**@brief  Function signature for a callback handler for received UART data.
  *
- * @param[in] p_received_data         The received data.
- * @param[in] p_received_data_length  The size of the data in bytes.
+ * @details The handler is called once before any data is received, and then each time the number
+ *          of bytes it asked for has been appended to the received data. It may remove data by
+ *          reducing the length.
+ *
+ * @param[in]     p_received_data         The received data.
+ * @param[in,out] p_received_data_length  The size of the data in bytes.
+ *
+ * @return The number of bytes to receive before the handler is called again.
  */
-typedef void (*received_uart_data_handler_t)(uint8_t *p_received_data, uint8_t *p_received_data_length);
+typedef uint16_t (*received_uart_data_handler_t)(uint8_t *p_received_data, uint16_t *p_received_data_length);
 
 /**@brief  Function for initializing the UART module.
  *
@@ -73,3 +85,19 @@ typedef void (*received_uart_data_handler_t)(uint8_t *p_received_data, uint8_t *
  */
 /**@snippet [UART Initialization] */
 void uart_init(received_uart_data_handler_t received_uart_data_handler);
+
+/**@brief Function for checking whether the UART can run at a baud rate.
+ *
+ * @param[in] baud_rate  The baud rate in bits per second.
+ *
+ * @return true if the baud rate is supported, false otherwise.
+ */
+bool uart_is_baud_rate_supported(uint32_t baud_rate);
+
+/**@brief Function for changing the UART baud rate once all queued data has been sent.
+ *
+ * @details Hardware flow control stays enabled at every rate.
+ *
+ * @param[in] baud_rate  The baud rate in bits per second.
+ */
+void uart_change_baud_rate_after_tx(uint32_t baud_rate);
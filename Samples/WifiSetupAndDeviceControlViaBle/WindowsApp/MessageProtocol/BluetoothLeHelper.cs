@@ -4,6 +4,8 @@
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol
 {
     using System;
+    using System.Buffers;
+    using System.Buffers.Binary;
     using System.Collections.Generic;
     using System.Diagnostics;
     using System.Linq;
@@ -13,6 +15,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
     using Windows.Devices.Bluetooth;
     using Windows.Devices.Bluetooth.GenericAttributeProfile;
     using Windows.Devices.Enumeration;
+    using Windows.Storage.Streams;
 
     internal delegate void NotifyEventHandler(object sender, NotifyEventArgs e);
 
@@ -23,31 +26,182 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
         private static readonly int E_BLUETOOTH_ATT_INVALID_PDU = unchecked((int)0x80650004);
         private static readonly int E_ACCESSDENIED = unchecked((int)0x80070005);
 
+        // An ATT write request or command carries 3 bytes of header in each PDU.
+        private const int AttWriteHeaderLength = 3;
+
+        // Initial size of the receive buffer, which is enough for any message the device sends
+        // today. It is grown if a longer message arrives.
+        private const int InitialReceiveBufferLength = 512;
+
         private GattCharacteristic notificationCharacteristic;
         private bool isListening = false;
 
+        // Characteristic which was last written, so it is not looked up again for every write.
+        private GattDeviceService writeService;
+        private GattCharacteristic writeCharacteristic;
+
+        // Messages which are waiting to be written. Whichever of them fit in one PDU are joined
+        // into a single write, and they are written in the order they were queued.
+        private readonly List<PendingWrite> pendingWrites = new List<PendingWrite>();
+        private bool isWriting = false;
+
+        // Notification data which does not yet form a complete message. It is kept at the start
+        // of a buffer rented from ArrayPool<byte>.Shared, and messages are parsed where they are.
+        private readonly object receiveLock = new object();
+        private byte[] receiveBuffer = ArrayPool<byte>.Shared.Rent(InitialReceiveBufferLength);
+        private int receivedLength = 0;
+
         public event NotifyEventHandler NotificationReceived;
 
-        public static async Task WriteAsync(byte[] data, GattDeviceService service, Guid characteristicId)
+        /// <summary>
+        /// Called for each complete message before <see cref="NotificationReceived"/> is raised
+        /// for it. A message for which it returns false is dropped. As with
+        /// <see cref="NotifyEventArgs.Data"/>, the message is only valid until it returns.
+        /// </summary>
+        public Func<ReadOnlyMemory<byte>, bool> MessageFilter { get; set; }
+
+        /// <summary>
+        /// Queues a message to be written to the characteristic. The returned task completes once
+        /// the message has been written, but the caller does not have to wait for it before
+        /// queueing the next one: messages queued while a write is in progress are sent together.
+        /// The message's array must have been rented from ArrayPool&lt;byte&gt;.Shared, as the
+        /// ones which MessageProtocolFactory creates are; it is returned to the pool once the
+        /// message has been written.
+        /// </summary>
+        public Task WriteAsync(ArraySegment<byte> message, GattDeviceService service, Guid characteristicId)
         {
-            if (data == null || data.Length == 0)
+            if (message.Array == null || message.Count == 0)
             {
                 throw new InvalidOperationException("No data to write to device.");
             }
 
+            var pendingWrite = new PendingWrite(message);
+            bool startWriting;
+            lock (pendingWrites)
+            {
+                pendingWrites.Add(pendingWrite);
+                startWriting = !isWriting;
+                isWriting = true;
+            }
+
+            if (startWriting)
+            {
+                _ = WritePendingAsync(service, characteristicId);
+            }
+
+            return pendingWrite.Completion.Task;
+        }
+
+        private async Task WritePendingAsync(GattDeviceService service, Guid characteristicId)
+        {
+            while (true)
+            {
+                List<PendingWrite> batch;
+                int batchLength;
+                int maxWriteLength = service.Session.MaxPduSize - AttWriteHeaderLength;
+                lock (pendingWrites)
+                {
+                    if (pendingWrites.Count == 0)
+                    {
+                        isWriting = false;
+                        return;
+                    }
+
+                    // Always take at least one message, even if it needs a long write.
+                    int batchCount = 1;
+                    batchLength = pendingWrites[0].Message.Count;
+                    while (batchCount < pendingWrites.Count && batchLength + pendingWrites[batchCount].Message.Count <= maxWriteLength)
+                    {
+                        batchLength += pendingWrites[batchCount].Message.Count;
+                        batchCount++;
+                    }
+
+                    batch = pendingWrites.GetRange(0, batchCount);
+                    pendingWrites.RemoveRange(0, batchCount);
+                }
+
+                try
+                {
+                    await WriteBatchAsync(batch, batchLength, batchLength <= maxWriteLength, service, characteristicId);
+                    foreach (PendingWrite pendingWrite in batch)
+                    {
+                        pendingWrite.Completion.TrySetResult(true);
+                    }
+                }
+                catch (Exception ex)
+                {
+                    foreach (PendingWrite pendingWrite in batch)
+                    {
+                        pendingWrite.Completion.TrySetException(ex);
+                    }
+                }
+                finally
+                {
+                    foreach (PendingWrite pendingWrite in batch)
+                    {
+                        ArrayPool<byte>.Shared.Return(pendingWrite.Message.Array);
+                    }
+                }
+            }
+        }
+
+        private async Task WriteBatchAsync(List<PendingWrite> batch, int batchLength, bool fitsInOnePdu, GattDeviceService service, Guid characteristicId)
+        {
+            if (batch.Count == 1)
+            {
+                await WriteValueAsync(batch[0].Message, fitsInOnePdu, service, characteristicId);
+                return;
+            }
+
+            // Join the messages in a pooled buffer, rather than a new array for every write.
+            byte[] buffer = ArrayPool<byte>.Shared.Rent(batchLength);
+            try
+            {
+                int offset = 0;
+                foreach (PendingWrite pendingWrite in batch)
+                {
+                    ArraySegment<byte> message = pendingWrite.Message;
+                    Buffer.BlockCopy(message.Array, message.Offset, buffer, offset, message.Count);
+                    offset += message.Count;
+                }
+
+                await WriteValueAsync(new ArraySegment<byte>(buffer, 0, batchLength), fitsInOnePdu, service, characteristicId);
+            }
+            finally
+            {
+                ArrayPool<byte>.Shared.Return(buffer);
+            }
+        }
+
+        private async Task WriteValueAsync(ArraySegment<byte> data, bool fitsInOnePdu, GattDeviceService service, Guid characteristicId)
+        {
             try
             {
-                // Writes the value from the buffer to the characteristic.
-                Debug.WriteLine($"Getting Bluetooth LE characteristic to write to.");
-                GattCharacteristic characteristic = await GetCharacteristicAsync(service, characteristicId);
+                if (writeCharacteristic == null || writeService != service || writeCharacteristic.Uuid != characteristicId)
+                {
+                    Debug.WriteLine($"Getting Bluetooth LE characteristic to write to.");
+                    writeCharacteristic = await GetCharacteristicAsync(service, characteristicId);
+                    writeService = service;
+                }
 
-                if (!characteristic.CharacteristicProperties.HasFlag(GattCharacteristicProperties.Write))
+                // A write without response does not wait for an acknowledgement from the device,
+                // but it cannot be longer than one PDU.
+                GattWriteOption writeOption;
+                if (fitsInOnePdu && writeCharacteristic.CharacteristicProperties.HasFlag(GattCharacteristicProperties.WriteWithoutResponse))
+                {
+                    writeOption = GattWriteOption.WriteWithoutResponse;
+                }
+                else if (writeCharacteristic.CharacteristicProperties.HasFlag(GattCharacteristicProperties.Write))
+                {
+                    writeOption = GattWriteOption.WriteWithResponse;
+                }
+                else
                 {
                     throw new InvalidOperationException("This characteristic does not support writing.");
                 }
 
-                Debug.WriteLine($"Writing data to Bluetooth LE characteristic.");
-                var result = await characteristic.WriteValueWithResultAsync(data.AsBuffer());
+                Debug.WriteLine($"Writing {data.Count} bytes to Bluetooth LE characteristic.");
+                var result = await writeCharacteristic.WriteValueWithResultAsync(data.Array.AsBuffer(data.Offset, data.Count), writeOption);
 
                 if (result.Status != GattCommunicationStatus.Success)
                 {
@@ -90,6 +244,10 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
                 throw new InvalidOperationException("Unable to subscribe to notifications.");
             }
 
+            lock (receiveLock)
+            {
+                receivedLength = 0;
+            }
             notificationCharacteristic.ValueChanged += Characteristic_ValueChanged;
             isListening = true;
         }
@@ -114,10 +272,91 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
             if (sender == notificationCharacteristic)
             {
                 Debug.WriteLine($"Received notification of data to Bluetooth LE characteristic.");
-                NotificationReceived?.Invoke(this, new NotifyEventArgs(args.CharacteristicValue.ToArray()));
+                IBuffer value = args.CharacteristicValue;
+                lock (receiveLock)
+                {
+                    EnsureReceiveCapacity(receivedLength + (int)value.Length);
+                    value.CopyTo(0, receiveBuffer, receivedLength, (int)value.Length);
+                    receivedLength += (int)value.Length;
+                    DispatchCompleteMessages();
+                }
             }
         }
 
+        private void EnsureReceiveCapacity(int length)
+        {
+            if (length <= receiveBuffer.Length)
+            {
+                return;
+            }
+
+            byte[] newBuffer = ArrayPool<byte>.Shared.Rent(Math.Max(length, receiveBuffer.Length * 2));
+            Buffer.BlockCopy(receiveBuffer, 0, newBuffer, 0, receivedLength);
+            ArrayPool<byte>.Shared.Return(receiveBuffer);
+            receiveBuffer = newBuffer;
+        }
+
+        // A message which is longer than the negotiated ATT MTU allows arrives in several
+        // notifications, so the data is joined up here and split at message boundaries. Each
+        // complete message is handed to the handlers as a slice of the receive buffer, and then
+        // whatever is left over is moved to the start of the buffer.
+        private void DispatchCompleteMessages()
+        {
+            byte[] preamble = MessageProtocolFactory.Preamble;
+            int start = 0;
+
+            while (start < receivedLength)
+            {
+                var pending = new ReadOnlySpan<byte>(receiveBuffer, start, receivedLength - start);
+
+                // Data should always start with the preamble, so drop any bytes before it.
+                int checkLength = Math.Min(pending.Length, preamble.Length);
+                if (!pending.Slice(0, checkLength).SequenceEqual(new ReadOnlySpan<byte>(preamble, 0, checkLength)))
+                {
+                    int next = pending.Slice(1).IndexOf(preamble[0]);
+                    start += (next < 0) ? pending.Length : next + 1;
+                    continue;
+                }
+
+                if (pending.Length < MessageProtocolFactory.MessageHeaderLength)
+                {
+                    break;
+                }
+
+                int messageLength = MessageProtocolFactory.MessageHeaderLength + BinaryPrimitives.ReadUInt16LittleEndian(pending.Slice(4));
+                if (pending.Length < messageLength)
+                {
+                    break;
+                }
+
+                var message = new ReadOnlyMemory<byte>(receiveBuffer, start, messageLength);
+                start += messageLength;
+
+                if (MessageFilter == null || MessageFilter(message))
+                {
+                    NotificationReceived?.Invoke(this, new NotifyEventArgs(message));
+                }
+            }
+
+            if (start > 0)
+            {
+                Buffer.BlockCopy(receiveBuffer, start, receiveBuffer, 0, receivedLength - start);
+                receivedLength -= start;
+            }
+        }
+
+        private sealed class PendingWrite
+        {
+            public PendingWrite(ArraySegment<byte> message)
+            {
+                Message = message;
+            }
+
+            public ArraySegment<byte> Message { get; }
+
+            public TaskCompletionSource<bool> Completion { get; } = new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously);
+        }
+
         private static async Task<GattCharacteristic> GetCharacteristicAsync(GattDeviceService service, Guid characteristicId)
         {
             if (service == null)
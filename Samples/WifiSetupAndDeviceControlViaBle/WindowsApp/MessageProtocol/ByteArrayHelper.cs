@@ -4,86 +4,66 @@
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol
 {
     using System;
+    using System.Buffers.Binary;
 
+    // The helpers read and write spans, so a message can be parsed or built in place in a
+    // pooled buffer instead of being copied into a new array for each field.
     internal static class ByteArrayHelper
     {
+        private const string HexDigits = "0123456789ABCDEF";
 
-        public static void WriteBytes(byte[] source, byte[] destination, uint offset = 0)
+        public static void WriteBytes(ReadOnlySpan<byte> source, Span<byte> destination, uint offset = 0)
         {
-            if (source.Length > 0)
-            {
-                Buffer.BlockCopy(source, 0, destination, (int)offset, source.Length);
-            }
+            source.CopyTo(destination.Slice((int)offset));
         }
 
-        public static byte[] ReadBytes(byte[] source, uint offset, uint count)
+        public static byte[] ReadBytes(ReadOnlySpan<byte> source, uint offset, uint count)
         {
-            byte[] result = new byte[count];
-            Buffer.BlockCopy(source, (int)offset, result, 0, (int)count);
-
-            return result;
+            return source.Slice((int)offset, (int)count).ToArray();
         }
 
-        public static string ReadDelimitedHex(byte[] source, uint offset, uint count, char? delimiter = null)
+        public static string ReadDelimitedHex(ReadOnlySpan<byte> source, uint offset, uint count, char? delimiter = null)
         {
-            byte[] data = ReadBytes(source, offset, count);
-
-            string result = BitConverter.ToString(data);
-
-            if (delimiter.HasValue)
+            if (count == 0)
             {
-                result = result.Replace('-', delimiter.Value);
+                return string.Empty;
             }
 
-            return result;
-        }
+            // Each byte is written as two hex digits, with a delimiter between bytes.
+            char separator = delimiter ?? '-';
+            char[] result = new char[count * 3 - 1];
+            for (int i = 0; i < count; i++)
+            {
+                byte value = source[(int)offset + i];
+                result[i * 3] = HexDigits[value >> 4];
+                result[i * 3 + 1] = HexDigits[value & 0x0F];
+                if (i * 3 + 2 < result.Length)
+                {
+                    result[i * 3 + 2] = separator;
+                }
+            }
 
-        public static short ReadSignedByte(byte[] source, uint offset)
-        {
-            return (sbyte)source[offset];
+            return new string(result);
         }
 
-        public static ushort ReadLsbUInt16(byte[] source, uint offset)
+        public static short ReadSignedByte(ReadOnlySpan<byte> source, uint offset)
         {
-            return (ushort)ReadLsbNumber(source, offset, 2);
+            return (sbyte)source[(int)offset];
         }
 
-        public static uint ReadLsbUInt32(byte[] source, uint offset)
+        public static ushort ReadLsbUInt16(ReadOnlySpan<byte> source, uint offset)
         {
-            return (uint)ReadLsbNumber(source, offset, 4);
+            return BinaryPrimitives.ReadUInt16LittleEndian(source.Slice((int)offset));
         }
 
-        public static void WriteLsbUInt16(ushort value, byte[] destination, uint offset)
+        public static uint ReadLsbUInt32(ReadOnlySpan<byte> source, uint offset)
         {
-            WriteLsbNumber(value, destination, offset, 2);
+            return BinaryPrimitives.ReadUInt32LittleEndian(source.Slice((int)offset));
         }
 
-        private static ulong ReadLsbNumber(byte[] source, uint offset, uint count)
+        public static void WriteLsbUInt16(ushort value, Span<byte> destination, uint offset)
         {
-            uint value = 0;
-
-            for (int i = 0; i < count; i++)
-            {
-                value += (uint)(source[offset + i] << (i * 8));
-            }
-
-            return value;
-        }
-
-        private static void WriteLsbNumber(ulong value, byte[] destination, uint offset, uint count)
-        {
-            ulong tempValue = value;
-
-            for (int i = 0; i < count; i++)
-            {
-                destination[offset + i] = (byte)(tempValue & 0xFF);
-                tempValue = (tempValue >> 8);
-            }
-
-            if (tempValue != 0)
-            {
-                throw new InvalidOperationException($"The value '{value}' cannot fit in {count} bytes.");
-            }
+            BinaryPrimitives.WriteUInt16LittleEndian(destination.Slice((int)offset), value);
         }
     }
 }
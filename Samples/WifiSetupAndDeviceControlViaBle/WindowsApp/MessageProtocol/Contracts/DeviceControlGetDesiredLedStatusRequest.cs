@@ -3,10 +3,12 @@
 
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
 {
+    using System;
+
     public sealed class DeviceControlGetDesiredLedStatusRequest : RequestBase
     {
         internal DeviceControlGetDesiredLedStatusRequest(DeviceControlRequestId deviceControlRequestId, uint sequenceId)
-            : base(CategoryIdType.DeviceControl, (ushort)deviceControlRequestId, sequenceId, null, 0)
+            : base(CategoryIdType.DeviceControl, (ushort)deviceControlRequestId, sequenceId, ReadOnlySpan<byte>.Empty, 0)
         {
             // This request type doesn't have a payload.
         }
@@ -14,7 +14,9 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
         public bool LedStatus { get; }
 
-        internal override byte[] GetPayload()
+        internal override int PayloadLength => 4;
+
+        internal override void WritePayload(ArraySegment<byte> payload)
         {
             /* Data format:
              * 
@@ -22,11 +24,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
              * - 01 [  3 ] Reserved
              */
 
-            byte[] payload = new byte[4];
-
-            payload[0]  = (byte)(LedStatus ? 0x01 : 0x00);
-
-            return payload;
+            payload.AsSpan()[0] = (byte)(LedStatus ? 0x01 : 0x00);
         }
     }
 }
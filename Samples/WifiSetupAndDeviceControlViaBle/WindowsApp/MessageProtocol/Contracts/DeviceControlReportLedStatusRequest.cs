@@ -3,9 +3,11 @@
 
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
 {
+    using System;
+
     public sealed class DeviceControlReportLedStatusRequest : RequestBase
     {
-        internal DeviceControlReportLedStatusRequest(DeviceControlRequestId deviceControlRequestId, uint sequenceId, byte[] payload)
+        internal DeviceControlReportLedStatusRequest(DeviceControlRequestId deviceControlRequestId, uint sequenceId, ReadOnlySpan<byte> payload)
             : base(CategoryIdType.DeviceControl, (ushort)deviceControlRequestId, sequenceId, payload, 4)
         {
             /* Data format:
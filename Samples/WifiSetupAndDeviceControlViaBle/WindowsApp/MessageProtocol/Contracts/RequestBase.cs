@@ -7,14 +7,11 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
     public abstract class RequestBase
     {
-        internal RequestBase(CategoryIdType categoryId, ushort requestType, uint sequenceId, byte[] payload, int expectedPayloadLength)
+        // The payload is only valid during the call, so derived classes copy out whatever they
+        // keep from it.
+        internal RequestBase(CategoryIdType categoryId, ushort requestType, uint sequenceId, ReadOnlySpan<byte> payload, int expectedPayloadLength)
         {
-            if (payload == null && expectedPayloadLength != 0)
-            {
-                throw new ArgumentNullException(nameof(payload), "Payload should not be null.");
-            }
-
-            if (payload != null && payload.Length != expectedPayloadLength)
+            if (payload.Length != expectedPayloadLength)
             {
                 throw new ArgumentOutOfRangeException(nameof(payload), $"Payload should be {expectedPayloadLength} bytes. It is {payload.Length}.");
             }
@@ -3,8 +3,14 @@
 
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
 {
+    using System;
+
     public abstract class ResponseBase
     {
-        internal abstract byte[] GetPayload();
+        internal abstract int PayloadLength { get; }
+
+        // Writes the payload into the message which is being built. The payload is zeroed
+        // before this is called, so reserved bytes do not need to be written.
+        internal abstract void WritePayload(ArraySegment<byte> payload);
     }
 }
@@ -3,10 +3,12 @@
 
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
 {
+    using System;
+
     public sealed class WifiGetNewDetailsRequest : RequestBase
     {
         internal WifiGetNewDetailsRequest(WifiRequestId wifiRequestType, uint sequenceId)
-            : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, null, 0)
+            : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, ReadOnlySpan<byte>.Empty, 0)
         {
             // This request type doesn't have a payload.
         }
@@ -16,6 +16,9 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
         private const uint MinTextPskLength = 8;
         private const uint MaxTextPskLength = 63;
 
+        // The PSK field in the payload is 64 bytes long.
+        private const int MaxPskDataLength = 64;
+
         public WifiGetNewDetailsResponse(byte[] ssid, SecurityType securityType, string psk, bool targetedScan)
         {
             if (ssid == null)
@@ -44,6 +47,11 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
                 {
                     throw new ArgumentOutOfRangeException(nameof(psk), "PSK must be between 8 and 63 characters.");
                 }
+
+                if (Encoding.UTF8.GetByteCount(psk) > MaxPskDataLength)
+                {
+                    throw new ArgumentOutOfRangeException(nameof(psk), "PSK must not be more than 64 bytes long when encoded as UTF8.");
+                }
             }
 
             Ssid         = ssid;
@@ -60,11 +68,10 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
         public bool TargetedScan { get; }
 
-        internal override byte[] GetPayload()
-        {
-            // Create the byte representation of the PSK
-            byte[] pskData = SecurityType == SecurityType.WPA2 ? Encoding.UTF8.GetBytes(Psk) : new byte[0];
+        internal override int PayloadLength => 108;
 
+        internal override void WritePayload(ArraySegment<byte> payload)
+        {
             /* Data format:
              * 
              * - 00 [  1 ] Security type
@@ -78,16 +85,16 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
              * - 105 [ 3 ] Reserved
              */
 
-            byte[] payload = new byte[108];
+            Span<byte> data = payload.AsSpan();
 
-            payload[0]  = (byte)SecurityType;
-            payload[1]  = (byte)Ssid.Length;
-            ByteArrayHelper.WriteBytes(Ssid, payload, 4);
-            payload[36] = (byte)pskData.Length;
-            ByteArrayHelper.WriteBytes(pskData, payload, 40);
-            payload[104] = Convert.ToByte(TargetedScan);
+            // The PSK is encoded straight into the payload.
+            int pskLength = SecurityType == SecurityType.WPA2 ? Encoding.UTF8.GetBytes(Psk, 0, Psk.Length, payload.Array, payload.Offset + 40) : 0;
 
-            return payload;
+            data[0]  = (byte)SecurityType;
+            data[1]  = (byte)Ssid.Length;
+            ByteArrayHelper.WriteBytes(Ssid, data, 4);
+            data[36] = (byte)pskLength;
+            data[104] = Convert.ToByte(TargetedScan);
         }
     }
 }
@@ -8,7 +8,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
     public sealed class WifiScanResultRequest : RequestBase
     {
-        internal WifiScanResultRequest(WifiRequestId wifiRequestType, uint sequenceId, byte[] payload)
+        internal WifiScanResultRequest(WifiRequestId wifiRequestType, uint sequenceId, ReadOnlySpan<byte> payload)
             : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, payload, 36)
         {
             /* Data format:
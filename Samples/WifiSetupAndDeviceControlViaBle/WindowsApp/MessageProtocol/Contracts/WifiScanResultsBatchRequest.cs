@@ -0,0 +1,42 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
+{
+    using System;
+    using System.Collections.Generic;
+
+    public sealed class WifiScanResultsBatchRequest : RequestBase
+    {
+        private const int HeaderLength = 4;
+        private const int ResultLength = 36;
+
+        internal WifiScanResultsBatchRequest(WifiRequestId wifiRequestType, uint sequenceId, ReadOnlySpan<byte> payload)
+            : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, payload, GetExpectedPayloadLength(payload))
+        {
+            /* Data format:
+             * 
+             * - 00 [  1 ] Result count
+             * - 01 [  3 ] Reserved
+             * - 04 [ 36 ] Result, in the format of a Set Next Wi-Fi Scan Result request
+             * - ...       Further results
+             */
+
+            var networks = new List<WifiScanResultRequest>(payload[0]);
+            for (int i = 0; i < payload[0]; ++i)
+            {
+                ReadOnlySpan<byte> result = payload.Slice(HeaderLength + i * ResultLength, ResultLength);
+                networks.Add(new WifiScanResultRequest(WifiRequestId.SetNextWifiScanResult, sequenceId, result));
+            }
+
+            Networks = networks;
+        }
+
+        public IReadOnlyList<WifiScanResultRequest> Networks { get; }
+
+        private static int GetExpectedPayloadLength(ReadOnlySpan<byte> payload)
+        {
+            return payload.IsEmpty ? HeaderLength : HeaderLength + payload[0] * ResultLength;
+        }
+    }
+}
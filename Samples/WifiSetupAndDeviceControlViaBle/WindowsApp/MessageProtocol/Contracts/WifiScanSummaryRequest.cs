@@ -3,9 +3,11 @@
 
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
 {
+    using System;
+
     public sealed class WifiScanSummaryRequest : RequestBase
     {
-        internal WifiScanSummaryRequest(WifiRequestId wifiRequestType, uint sequenceId, byte[] payload)
+        internal WifiScanSummaryRequest(WifiRequestId wifiRequestType, uint sequenceId, ReadOnlySpan<byte> payload)
             : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, payload, 8)
         {
             /* Data format:
@@ -0,0 +1,26 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
+{
+    using System;
+
+    public sealed class WifiScanSummaryResponse : ResponseBase
+    {
+        // Flag which asks for the scan results to be sent in batches.
+        private const byte ScanResultsBatchSupported = 0x01;
+
+        internal override int PayloadLength => 4;
+
+        internal override void WritePayload(ArraySegment<byte> payload)
+        {
+            /* Data format:
+             * 
+             * - 00 [  1 ] Flags - 0x01 if Set Wi-Fi Scan Results Batch requests are accepted
+             * - 01 [  3 ] Reserved
+             */
+
+            payload.AsSpan()[0] = ScanResultsBatchSupported;
+        }
+    }
+}
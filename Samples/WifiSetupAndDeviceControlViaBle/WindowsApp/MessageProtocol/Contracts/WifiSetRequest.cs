@@ -3,9 +3,11 @@
 
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts
 {
+    using System;
+
     public sealed class WifiSetRequest : RequestBase
     {
-        internal WifiSetRequest(WifiRequestId wifiRequestType, uint sequenceId, byte[] payload)
+        internal WifiSetRequest(WifiRequestId wifiRequestType, uint sequenceId, ReadOnlySpan<byte> payload)
             : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, payload, 4)
         {
             /* Data format:
@@ -7,7 +7,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
     public sealed class WifiStatusRequest : RequestBase
     {
-        internal WifiStatusRequest(WifiRequestId wifiRequestType, uint sequenceId, byte[] payload)
+        internal WifiStatusRequest(WifiRequestId wifiRequestType, uint sequenceId, ReadOnlySpan<byte> payload)
             : base(CategoryIdType.WifiControl, (ushort)wifiRequestType, sequenceId, payload, 48)
         {
             /* Data format:
@@ -4,14 +4,38 @@
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.EventArgs
 {
     using System;
+    using Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts;
 
     internal sealed class NotifyEventArgs : EventArgs
     {
-        public NotifyEventArgs(byte[] data)
+        private RequestBase request;
+
+        public NotifyEventArgs(ReadOnlyMemory<byte> data)
         {
             Data = data;
         }
 
-        public byte[] Data { get; }
+        /// <summary>
+        /// The message, which is in the receive buffer and is only valid until the handler
+        /// returns or first awaits. Anything which is needed after that must be copied out.
+        /// </summary>
+        public ReadOnlyMemory<byte> Data { get; }
+
+        /// <summary>
+        /// The message parsed as a request. It is parsed on first use and shared by all of the
+        /// handlers, so it stays valid after <see cref="Data"/> does.
+        /// </summary>
+        public RequestBase Request
+        {
+            get
+            {
+                if (request == null)
+                {
+                    request = MessageProtocolFactory.ReadRequestMessagePayload(Data.Span);
+                }
+
+                return request;
+            }
+        }
     }
 }
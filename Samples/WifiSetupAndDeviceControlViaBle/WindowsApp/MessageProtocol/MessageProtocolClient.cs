@@ -4,6 +4,7 @@
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol
 {
     using System;
+    using System.Collections.Generic;
     using System.Diagnostics;
     using System.Linq;
     using System.Threading.Tasks;
@@ -27,18 +28,29 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
         private static readonly Guid MessageProtocolRxCharacteristicId = Guid.Parse("59140002-9252-f896-e811-7ab292fa018c");
         private static readonly Guid MessageProtocolTxCharacteristicId = Guid.Parse("59140003-9252-f896-e811-7ab292fa018c");
 
+        // The device sends a request again, with the same sequence ID, if its response does not
+        // arrive in time, and gives up after several seconds. A request which is repeated within
+        // this window is answered again instead of being handled twice.
+        private static readonly TimeSpan RepeatedRequestWindow = TimeSpan.FromSeconds(15);
+
         private BluetoothLeHelper bluetoothLeHelper = new BluetoothLeHelper();
         private GattDeviceService currentService;
         private uint actualWifiNetworkCount;
         private uint expectedWifiNetworkCount;
         private WifiGetNewDetailsResponse wifiGetNewDetailsResponse;
         private DeviceControlGetDesiredLedStatusResponse deviceControlGetDesiredLedStatusResponse;
+        private readonly List<RecentRequest> recentRequests = new List<RecentRequest>();
 
         public event WifiStatusRequestEventHandler WifiStatusRequestReceived;
         public event WifiScanRequestEventHandler WifiNetworkScanReceived;
         public event WifiAddNetworkRequestEventHandler WifiAddNetworkStatusReceived;
         public event ReportLedStatusRequestEventHandler ReportLedStatusRequestReceived;
 
+        public MessageProtocolClient()
+        {
+            bluetoothLeHelper.MessageFilter = FilterRepeatedRequest;
+        }
+
         ~MessageProtocolClient()
         {
             bluetoothLeHelper.EndNotificationListenerAsync().GetAwaiter().GetResult();
@@ -162,7 +174,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
         private async void WifiStatusRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is WifiStatusRequest wifiStatusRequest)
+            if (e.Request is WifiStatusRequest wifiStatusRequest)
             {
                 Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiStatusRequest.RequestType}'");
 
@@ -175,7 +187,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
         private async void WifiScanSummaryRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is WifiScanSummaryRequest wifiScanSummaryRequest)
+            if (e.Request is WifiScanSummaryRequest wifiScanSummaryRequest)
             {
                 Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiScanSummaryRequest.RequestType}'");
 
@@ -199,32 +211,48 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
                     actualWifiNetworkCount = 0;
                     expectedWifiNetworkCount = wifiScanSummaryRequest.NetworkCount;
 
-                    await SendResponseAsync(currentService, wifiScanSummaryRequest, wifiScanSummaryRequest.ErrorCode);
+                    // Ask for the results in batches, so that each one does not need a round trip.
+                    await SendResponseAsync(currentService, wifiScanSummaryRequest, wifiScanSummaryRequest.ErrorCode, new WifiScanSummaryResponse());
                 }
             }
         }
 
         private async void WifiScanResultRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is WifiScanResultRequest wifiScanResultRequest)
+            RequestBase request = e.Request;
+            if (request is WifiScanResultRequest wifiScanResultRequest)
             {
                 Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiScanResultRequest.RequestType}'");
 
                 actualWifiNetworkCount++;
                 WifiNetworkScanReceived?.Invoke(this, new WifiScanRequestEventArgs(wifiScanResultRequest, actualWifiNetworkCount, expectedWifiNetworkCount));
+            }
+            else if (request is WifiScanResultsBatchRequest wifiScanResultsBatchRequest)
+            {
+                Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiScanResultsBatchRequest.RequestType}'");
 
-                await SendResponseAsync(currentService, wifiScanResultRequest, 0x00);
-
-                if (actualWifiNetworkCount == expectedWifiNetworkCount)
+                foreach (WifiScanResultRequest network in wifiScanResultsBatchRequest.Networks)
                 {
-                    bluetoothLeHelper.NotificationReceived -= WifiScanResultRequest_NotificationReceived;
+                    actualWifiNetworkCount++;
+                    WifiNetworkScanReceived?.Invoke(this, new WifiScanRequestEventArgs(network, actualWifiNetworkCount, expectedWifiNetworkCount));
                 }
             }
+            else
+            {
+                return;
+            }
+
+            if (actualWifiNetworkCount >= expectedWifiNetworkCount)
+            {
+                bluetoothLeHelper.NotificationReceived -= WifiScanResultRequest_NotificationReceived;
+            }
+
+            await SendResponseAsync(currentService, request, 0x00);
         }
 
         private async void WifiGetNewDetailsRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is WifiGetNewDetailsRequest wifiGetNewDetailsRequest)
+            if (e.Request is WifiGetNewDetailsRequest wifiGetNewDetailsRequest)
             {
                 Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiGetNewDetailsRequest.RequestType}'");
 
@@ -241,7 +269,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
         private async void WifiSetRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is WifiSetRequest wifiSetRequest)
+            if (e.Request is WifiSetRequest wifiSetRequest)
             {
                 Debug.WriteLine($"Received Wi-Fi config message protocol request: '{wifiSetRequest.RequestType}'");
 
@@ -256,7 +284,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
         private async void DeviceControlGetDesiredLedStatusRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is DeviceControlGetDesiredLedStatusRequest deviceControlGetDesiredLedStatusRequest)
+            if (e.Request is DeviceControlGetDesiredLedStatusRequest deviceControlGetDesiredLedStatusRequest)
             {
                 Debug.WriteLine($"Received Device Control message protocol request: '{deviceControlGetDesiredLedStatusRequest.RequestType}'");
 
@@ -269,7 +297,7 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
 
         private async void DeviceControlReportLedStatusRequest_NotificationReceived(object sender, NotifyEventArgs e)
         {
-            if (MessageProtocolFactory.ReadRequestMessagePayload(e.Data) is DeviceControlReportLedStatusRequest deviceControlReportLedStatusRequest)
+            if (e.Request is DeviceControlReportLedStatusRequest deviceControlReportLedStatusRequest)
             {
                 Debug.WriteLine($"Received Device Control message protocol request: '{deviceControlReportLedStatusRequest.RequestType}'");
 
@@ -283,20 +311,146 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
             }
         }
         
-        private static async Task SendEventMessageAsync(GattDeviceService service, CategoryIdType categoryId, ushort eventType)
+        private async Task SendEventMessageAsync(GattDeviceService service, CategoryIdType categoryId, ushort eventType)
         {
             Debug.WriteLine($"Sending message protocol event: '{categoryId}, {eventType}'");
 
-            byte[] eventMessage = MessageProtocolFactory.CreateEventMessage(categoryId, eventType);
-            await BluetoothLeHelper.WriteAsync(eventMessage, service, MessageProtocolRxCharacteristicId);
+            ArraySegment<byte> eventMessage = MessageProtocolFactory.CreateEventMessage(categoryId, eventType);
+            await bluetoothLeHelper.WriteAsync(eventMessage, service, MessageProtocolRxCharacteristicId);
         }
 
-        private static async Task SendResponseAsync(GattDeviceService service, RequestBase request, byte errorCode, ResponseBase response = null)
+        // The device sends several requests without waiting for each response, and matches the
+        // responses to them by sequence ID. Responses are queued and written in batches, so one
+        // is never held up waiting for the write of the one before.
+        private async Task SendResponseAsync(GattDeviceService service, RequestBase request, byte errorCode, ResponseBase response = null)
         {
-            Debug.WriteLine($"Sending message protocol response: '{request.CategoryId}, {request.RequestType}'");
+            Debug.WriteLine($"Sending message protocol response: '{request.CategoryId}, {request.RequestType}, {request.SequenceId}'");
 
-            byte[] responseMessage = MessageProtocolFactory.CreateResponseMessage(request.CategoryId, request.RequestType, request.SequenceId, errorCode, response);
-            await BluetoothLeHelper.WriteAsync(responseMessage, service, MessageProtocolRxCharacteristicId);
+            ArraySegment<byte> responseMessage = MessageProtocolFactory.CreateResponseMessage(request.CategoryId, request.RequestType, request.SequenceId, errorCode, response);
+            lock (recentRequests)
+            {
+                for (int i = recentRequests.Count - 1; i >= 0; i--)
+                {
+                    if (!recentRequests[i].IsAnswered && recentRequests[i].Answers(request))
+                    {
+                        recentRequests[i].SetResponse(errorCode, response);
+                        break;
+                    }
+                }
+            }
+
+            await bluetoothLeHelper.WriteAsync(responseMessage, service, MessageProtocolRxCharacteristicId);
+        }
+
+        // Returns false for a request which has been received before, and sends its response
+        // again if it has one. A retransmitted request is identical to the original.
+        private bool FilterRepeatedRequest(ReadOnlyMemory<byte> message)
+        {
+            ReadOnlySpan<byte> data = message.Span;
+            if (data.Length < 16 || data[6] != (byte)MessageType.Request)
+            {
+                return true;
+            }
+
+            var request = new RecentRequest(data, DateTime.UtcNow);
+            RecentRequest recentRequest = null;
+            lock (recentRequests)
+            {
+                for (int i = recentRequests.Count - 1; i >= 0; i--)
+                {
+                    if (request.ReceivedTime - recentRequests[i].ReceivedTime > RepeatedRequestWindow)
+                    {
+                        recentRequests.RemoveAt(i);
+                    }
+                    else if (recentRequest == null && recentRequests[i].Matches(request))
+                    {
+                        recentRequest = recentRequests[i];
+                    }
+                }
+
+                if (recentRequest == null)
+                {
+                    recentRequests.Add(request);
+                    return true;
+                }
+            }
+
+            if (recentRequest.IsAnswered && currentService != null)
+            {
+                Debug.WriteLine("Received a repeated message protocol request; sending the response again.");
+                ArraySegment<byte> responseMessage = MessageProtocolFactory.CreateResponseMessage(
+                    recentRequest.CategoryId, recentRequest.RequestType, recentRequest.SequenceId, recentRequest.ErrorCode, recentRequest.Response);
+                _ = bluetoothLeHelper.WriteAsync(responseMessage, currentService, MessageProtocolRxCharacteristicId);
+            }
+            else
+            {
+                Debug.WriteLine("Received a repeated message protocol request; it is still being handled.");
+            }
+            return false;
+        }
+
+        // The request is identified by its header and a hash of the whole message, so that it
+        // does not have to be copied out of the receive buffer. The response is kept as the
+        // object it was built from, and built again if it has to be resent.
+        private sealed class RecentRequest
+        {
+            public RecentRequest(ReadOnlySpan<byte> message, DateTime receivedTime)
+            {
+                CategoryId = (CategoryIdType)ByteArrayHelper.ReadLsbUInt16(message, 8);
+                RequestType = ByteArrayHelper.ReadLsbUInt16(message, 10);
+                SequenceId = ByteArrayHelper.ReadLsbUInt16(message, 12);
+                Length = message.Length;
+                Hash = ComputeHash(message);
+                ReceivedTime = receivedTime;
+            }
+
+            public CategoryIdType CategoryId { get; }
+
+            public ushort RequestType { get; }
+
+            public uint SequenceId { get; }
+
+            public int Length { get; }
+
+            public ulong Hash { get; }
+
+            public DateTime ReceivedTime { get; }
+
+            public bool IsAnswered { get; private set; }
+
+            public byte ErrorCode { get; private set; }
+
+            public ResponseBase Response { get; private set; }
+
+            public void SetResponse(byte errorCode, ResponseBase response)
+            {
+                ErrorCode = errorCode;
+                Response = response;
+                IsAnswered = true;
+            }
+
+            public bool Answers(RequestBase request)
+            {
+                return CategoryId == request.CategoryId && RequestType == request.RequestType && SequenceId == request.SequenceId;
+            }
+
+            public bool Matches(RecentRequest other)
+            {
+                return CategoryId == other.CategoryId && RequestType == other.RequestType && SequenceId == other.SequenceId &&
+                    Length == other.Length && Hash == other.Hash;
+            }
+
+            // 64-bit FNV-1a.
+            private static ulong ComputeHash(ReadOnlySpan<byte> data)
+            {
+                ulong hash = 14695981039346656037;
+                foreach (byte value in data)
+                {
+                    hash = (hash ^ value) * 1099511628211;
+                }
+
+                return hash;
+            }
         }
     }
 }
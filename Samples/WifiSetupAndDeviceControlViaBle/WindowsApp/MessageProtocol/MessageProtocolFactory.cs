@@ -4,13 +4,23 @@
 namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol
 {
     using System;
+    using System.Buffers;
     using Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.MessageProtocol.Contracts;
 
     internal static class MessageProtocolFactory
     {
-        private readonly static byte[] Preamble = { 0x22, 0xB5, 0x58, 0xB9 };
+        internal readonly static byte[] Preamble = { 0x22, 0xB5, 0x58, 0xB9 };
 
-        public static byte[] CreateEventMessage(CategoryIdType categoryId, ushort wifiEventType)
+        // Size of the preamble and length fields, which the length field does not include.
+        internal const int MessageHeaderLength = 6;
+
+        private const int EventMessageLength = 12;
+        private const int ResponseHeaderLength = 16;
+        private const int RequestHeaderLength = 16;
+
+        // Messages are built in buffers rented from ArrayPool<byte>.Shared, which the caller
+        // must return once the message has been written; BluetoothLeHelper.WriteAsync does so.
+        public static ArraySegment<byte> CreateEventMessage(CategoryIdType categoryId, ushort wifiEventType)
         {
             /* Event format:
              * 
@@ -22,25 +32,23 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
              * Length           : UINT16 (LSB) - the message length excluding the first 6 bytes.
              */
 
-            byte[] message = new byte[12];
+            var message = new ArraySegment<byte>(ArrayPool<byte>.Shared.Rent(EventMessageLength), 0, EventMessageLength);
+            Span<byte> data = message.AsSpan();
+            data.Clear();
 
-            ByteArrayHelper.WriteBytes(Preamble, message);
-            ByteArrayHelper.WriteLsbUInt16(6, message, 4); // Length
-            message[6] = (byte)MessageType.Event;
-            ByteArrayHelper.WriteLsbUInt16((ushort)categoryId, message, 8);
-            ByteArrayHelper.WriteLsbUInt16((ushort)wifiEventType, message, 10);
+            ByteArrayHelper.WriteBytes(Preamble, data);
+            ByteArrayHelper.WriteLsbUInt16(6, data, 4); // Length
+            data[6] = (byte)MessageType.Event;
+            ByteArrayHelper.WriteLsbUInt16((ushort)categoryId, data, 8);
+            ByteArrayHelper.WriteLsbUInt16((ushort)wifiEventType, data, 10);
 
             return message;
         }
 
-        public static byte[] CreateResponseMessage(CategoryIdType categoryId, ushort requestType, uint sequenceId, byte errorCode, ResponseBase response = null)
+        public static ArraySegment<byte> CreateResponseMessage(CategoryIdType categoryId, ushort requestType, uint sequenceId, byte errorCode, ResponseBase response = null)
         {
             // Handle response object if provided...
-            byte[] payload = new byte[0];
-            if (response != null)
-            {
-                payload = response.GetPayload();
-            }
+            int payloadLength = response?.PayloadLength ?? 0;
 
             /* Response format:
              * 
@@ -60,25 +68,31 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
              * Result           : 0x00 if successful, > 0x00 as an error code if failed
              */
 
-            byte[] message = new byte[16 + payload.Length];
+            int messageLength = ResponseHeaderLength + payloadLength;
+            var message = new ArraySegment<byte>(ArrayPool<byte>.Shared.Rent(messageLength), 0, messageLength);
+            Span<byte> data = message.AsSpan();
+            data.Clear();
 
-            ByteArrayHelper.WriteBytes(Preamble, message);
-            ByteArrayHelper.WriteLsbUInt16((ushort)(10 + payload.Length), message, 4);
-            message[6] = (byte)MessageType.Response;
-            ByteArrayHelper.WriteLsbUInt16((ushort)categoryId, message, 8);
-            ByteArrayHelper.WriteLsbUInt16(requestType, message, 10);
-            ByteArrayHelper.WriteLsbUInt16((ushort)sequenceId, message, 12);
-            message[14] = errorCode;
-            ByteArrayHelper.WriteBytes(payload, message, 16);
+            ByteArrayHelper.WriteBytes(Preamble, data);
+            ByteArrayHelper.WriteLsbUInt16((ushort)(ResponseHeaderLength - MessageHeaderLength + payloadLength), data, 4);
+            data[6] = (byte)MessageType.Response;
+            ByteArrayHelper.WriteLsbUInt16((ushort)categoryId, data, 8);
+            ByteArrayHelper.WriteLsbUInt16(requestType, data, 10);
+            ByteArrayHelper.WriteLsbUInt16((ushort)sequenceId, data, 12);
+            data[14] = errorCode;
+            response?.WritePayload(new ArraySegment<byte>(message.Array, message.Offset + ResponseHeaderLength, payloadLength));
 
             return message;
         }
 
-        public static RequestBase ReadRequestMessagePayload(byte[] message)
+        // The message is parsed where it is, and the payload is passed to the request's
+        // constructor as a slice of it, so nothing is copied except the fields which the request
+        // keeps.
+        public static RequestBase ReadRequestMessagePayload(ReadOnlySpan<byte> message)
         {
-            if (message.Length < 16)
+            if (message.Length < RequestHeaderLength)
             {
-                throw new ArgumentOutOfRangeException(nameof(message), $"Message should be at least 16 bytes, not {message.Length}.");
+                throw new ArgumentOutOfRangeException(nameof(message), $"Message should be at least {RequestHeaderLength} bytes, not {message.Length}.");
             }
 
             /* Request format:
@@ -101,18 +115,18 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
             ushort requestType = (ushort)ByteArrayHelper.ReadLsbUInt16(message, 10);
             uint sequenceId = ByteArrayHelper.ReadLsbUInt16(message, 12);
 
-            byte[] payload = null;
-            uint payloadLength = length - 10;
-
-            if (payloadLength > 0)
+            int payloadLength = (int)length - (RequestHeaderLength - MessageHeaderLength);
+            if (payloadLength < 0 || RequestHeaderLength + payloadLength > message.Length)
             {
-                payload = ByteArrayHelper.ReadBytes(message, 16, payloadLength);
+                throw new ArgumentOutOfRangeException(nameof(message), $"Message length field {length} does not match the message, which is {message.Length} bytes.");
             }
 
+            ReadOnlySpan<byte> payload = message.Slice(RequestHeaderLength, payloadLength);
+
             return ExtractRequestPayload(categoryId, requestType, sequenceId, payload);
         }
 
-        private static RequestBase ExtractRequestPayload(CategoryIdType categoryId, ushort requestType, uint sequenceId, byte[] payload)
+        private static RequestBase ExtractRequestPayload(CategoryIdType categoryId, ushort requestType, uint sequenceId, ReadOnlySpan<byte> payload)
         {
             switch (categoryId)
             {
@@ -142,6 +156,9 @@ namespace Microsoft.Azure.Sphere.Samples.WifiSetupAndDeviceControlViaBle.Message
                         case WifiRequestId.SetNextWifiScanResult:
                             return new WifiScanResultRequest(wifiRequestId, sequenceId, payload);
 
+                        case WifiRequestId.SetWifiScanResultsBatch:
+                            return new WifiScanResultsBatchRequest(wifiRequestId, sequenceId, payload);
+
                         case WifiRequestId.GetNewWifiDetails:
                             // This request doesn't have a payload
                             return new WifiGetNewDetailsRequest(wifiRequestId, sequenceId);
@@ -24,6 +24,15 @@ static const MessageProtocol_RequestId BleControlMessageProtocol_ChangeBleAdvert
 /// </summary>
 static const MessageProtocol_RequestId BleControlMessageProtocol_DeleteAllBleBondsRequestId =
     0x0004;
+/// <summary>
+///     Request ID for Set UART Baud Rate Request message. If the BLE device accepts the rate, it
+///     switches to it after sending the response, and the sender must switch too. Hardware flow
+///     control stays enabled at every rate.
+/// </summary>
+static const MessageProtocol_RequestId BleControlMessageProtocol_SetUartBaudRateRequestId = 0x0005;
+
+/// <summary>Baud rate of the UART when the BLE device starts up.</summary>
+#define BLE_CONTROL_MESSAGE_PROTOCOL_DEFAULT_UART_BAUD_RATE 115200u
 
 /// <summary>Event ID for a message indicating the attached BLE device has come up.</summary>
 static const MessageProtocol_EventId BleControlMessageProtocol_BleDeviceUpEventId = 0x0001;
@@ -96,3 +105,13 @@ typedef struct {
     /// <summary>Reserved - must all be 0.</summary>
     uint8_t reserved[3];
 } BleControlMessageProtocol_ChangeBleAdvertisingModeStruct;
+
+/// <summary>
+///     Data structure for the body of the
+///     <see cref="BleControlMessageProtocol_SetUartBaudRateRequestId" /> request and response
+///     messages.
+/// </summary>
+typedef struct {
+    /// <summary>Baud rate in bits per second (LSB first).</summary>
+    uint32_t baudRate;
+} BleControlMessageProtocol_SetUartBaudRateStruct;
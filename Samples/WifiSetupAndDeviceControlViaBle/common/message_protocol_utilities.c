@@ -4,7 +4,7 @@
 #include "message_protocol_utilities.h"
 #include <string.h>
 
-bool MessageProtocol_IsMessageComplete(uint8_t *message, uint8_t messageLength)
+bool MessageProtocol_IsMessageComplete(uint8_t *message, size_t messageLength)
 {
     // Check the message has the minimum required length and starts with Preamble bytes
     if (messageLength > sizeof(MessageProtocol_MessageHeader) &&
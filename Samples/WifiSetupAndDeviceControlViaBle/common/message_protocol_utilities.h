@@ -4,6 +4,7 @@
 #pragma once
 #include "message_protocol_private.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 /// <summary>
 ///     Check if the provided message data is complete.
@@ -11,4 +12,4 @@
 /// <param name="message">The message to check.</param>
 /// <param name="messageLength">The size of the message in bytes.</param>
 /// <returns>true if the message is complete, false otherwise.</returns>
-bool MessageProtocol_IsMessageComplete(uint8_t *message, uint8_t messageLength);
+bool MessageProtocol_IsMessageComplete(uint8_t *message, size_t messageLength);
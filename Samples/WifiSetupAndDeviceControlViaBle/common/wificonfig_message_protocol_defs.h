@@ -23,6 +23,10 @@ static const MessageProtocol_RequestId
 static const MessageProtocol_RequestId WifiConfigureMessageProtocol_SetNextWiFiScanResultRequestId =
     0x0005;
 
+/// <summary>Request ID for a Set Wi-Fi Scan Results Batch request message.</summary>
+static const MessageProtocol_RequestId
+    WifiConfigureMessageProtocol_SetWifiScanResultsBatchRequestId = 0x0006;
+
 /// <summary>Event ID for a New Wi-Fi Details Available event message.</summary>
 static const MessageProtocol_EventId WifiConfigureMessageProtocol_NewWiFiDetailsAvailableEventId =
     0x0001;
@@ -53,6 +57,19 @@ static const uint8_t WifiConfigureMessageProtocol_InternetConnected = 0x01 << 1;
 /// </summary>
 static const uint8_t WifiConfigureMessageProtocol_IpAddressAvailable = 0x01 << 2;
 
+/// <summary>
+///     A scan results summary response flag indicating that the remote device accepts
+///     <see cref="WifiConfigureMessageProtocol_SetWifiScanResultsBatchRequestId" /> requests.
+/// </summary>
+static const uint8_t WifiConfigureMessageProtocol_ScanResultsBatchSupported = 0x01 << 0;
+
+/// <summary>
+///     Maximum number of scan results in a
+///     <see cref="WifiConfigureMessageProtocol_SetWifiScanResultsBatchRequestId" /> request
+///     message. This many results, and the batch header, fit in MAX_REQUEST_DATA_SIZE.
+/// </summary>
+#define WIFI_CONFIGURE_MESSAGE_PROTOCOL_MAX_SCAN_RESULTS_PER_BATCH 6
+
 /// <summary>
 ///     Data structure for the body of a
 ///     <see cref="WifiConfigureMessageProtocol_GetNewWifiDetailsRequestId" /> response message.
@@ -134,6 +151,22 @@ typedef struct {
     uint32_t totalResultsSize;
 } WifiConfigureMessageProtocol_WifiScanResultsSummaryRequestStruct;
 
+/// <summary>
+///     Data structure for the body of a
+///     <see cref="WifiConfigureMessageProtocol_SetWifiScanResultsSummaryRequestId"/> response
+///     message. A remote device which sends an empty response gets each result in its own
+///     <see cref="WifiConfigureMessageProtocol_SetNextWiFiScanResultRequestId"/> request.
+/// </summary>
+typedef struct {
+    /// <summary>
+    ///     Features of the remote device - see
+    ///     <see cref="WifiConfigureMessageProtocol_ScanResultsBatchSupported"/>.
+    /// </summary>
+    uint8_t flags;
+    /// <summary>Reserved; must all be 0.</summary>
+    uint8_t reserved[3];
+} WifiConfigureMessageProtocol_WifiScanResultsSummaryResponseStruct;
+
 /// <summary>
 ///     Data structure for the body of a
 ///     <see cref="WifiConfigureMessageProtocol_SetNextWiFiScanResultRequestId"/> request
@@ -154,3 +187,19 @@ typedef struct {
     /// <summary>The SSID for this network, as a fixed-length array of bytes.</summary>
     uint8_t ssid[32];
 } WifiConfigureMessageProtocol_WifiScanResultRequestStruct;
+
+/// <summary>
+///     Data structure for the body of a
+///     <see cref="WifiConfigureMessageProtocol_SetWifiScanResultsBatchRequestId"/> request
+///     message. This structure carries several consecutive results of a network scan. Only the
+///     first resultCount entries of results are sent.
+/// </summary>
+typedef struct {
+    /// <summary>Number of results in this message.</summary>
+    uint8_t resultCount;
+    /// <summary>Reserved; must all be 0.</summary>
+    uint8_t reserved[3];
+    /// <summary>The networks found during the scan.</summary>
+    WifiConfigureMessageProtocol_WifiScanResultRequestStruct
+        results[WIFI_CONFIGURE_MESSAGE_PROTOCOL_MAX_SCAN_RESULTS_PER_BATCH];
+} WifiConfigureMessageProtocol_WifiScanResultsBatchRequestStruct;
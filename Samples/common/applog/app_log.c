@@ -0,0 +1,622 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "app_log.h"
+
+_Static_assert((APP_LOG_RING_RECORDS & (APP_LOG_RING_RECORDS - 1)) == 0,
+               "APP_LOG_RING_RECORDS must be a power of two");
+
+// Size of the buffer into which a message from the ring is formatted.
+#define LINE_SIZE 256
+
+/// <summary>
+///     One message in the ring: the pointer to its format string, and its arguments, which are
+///     stored unaligned, in the order of the conversions in the format. Integers are stored as
+///     8 bytes, floating-point numbers as a double, and a string as a length byte followed by
+///     its characters.
+/// </summary>
+typedef struct {
+    const char *format;
+    uint8_t level;
+    uint8_t argBytes;
+    /// <summary>Whether the arguments did not all fit, in which case the message is only
+    /// formatted up to the first one which did not.</summary>
+    bool isTruncated;
+    uint8_t args[APP_LOG_RECORD_SIZE - sizeof(const char *) - 3];
+} LogRecord;
+
+_Static_assert(sizeof(LogRecord) == APP_LOG_RECORD_SIZE, "LogRecord has padding");
+
+/// <summary>Length modifiers of a conversion specification.</summary>
+typedef enum {
+    Length_None,
+    Length_hh,
+    Length_h,
+    Length_l,
+    Length_ll,
+    Length_j,
+    Length_z,
+    Length_t,
+    Length_L
+} LengthModifier;
+
+/// <summary>
+///     A conversion specification of a format string, such as %-8.3s.
+/// </summary>
+typedef struct {
+    char flags[8];
+    size_t flagCount;
+    /// <summary>Field width and precision, or -1 if they are not given.</summary>
+    int width;
+    int precision;
+    bool isWidthArgument;
+    bool isPrecisionArgument;
+    LengthModifier length;
+    char conversion;
+} ConversionSpec;
+
+static AppLogMode logMode = AppLogMode_Immediate;
+
+// The ring of the deferred mode. The indexes count every message, so they only wrap around
+// after 2^32 of them.
+static LogRecord ring[APP_LOG_RING_RECORDS];
+static uint32_t ringHead = 0;
+static uint32_t ringTail = 0;
+static uint32_t droppedRecords = 0;
+
+static const char *LevelName(int level)
+{
+    switch (level) {
+    case APP_LOG_LEVEL_ERROR:
+        return "ERROR";
+    case APP_LOG_LEVEL_WARNING:
+        return "WARNING";
+    case APP_LOG_LEVEL_INFO:
+        return "INFO";
+    default:
+        return "DEBUG";
+    }
+}
+
+static int ParseNumber(const char **position)
+{
+    int value = 0;
+    while (**position >= '0' && **position <= '9') {
+        value = value * 10 + (**position - '0');
+        ++*position;
+    }
+    return value;
+}
+
+/// <summary>
+///     Parses a conversion specification.
+/// </summary>
+/// <param name="position">The character after the %, which is advanced past the conversion.
+/// </param>
+/// <param name="spec">Receives the specification.</param>
+static void ParseSpec(const char **position, ConversionSpec *spec)
+{
+    const char *p = *position;
+    memset(spec, 0, sizeof(*spec));
+    spec->width = -1;
+    spec->precision = -1;
+
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+        if (spec->flagCount < sizeof(spec->flags) - 1) {
+            spec->flags[spec->flagCount++] = *p;
+        }
+        ++p;
+    }
+
+    if (*p == '*') {
+        spec->isWidthArgument = true;
+        ++p;
+    } else if (*p >= '0' && *p <= '9') {
+        spec->width = ParseNumber(&p);
+    }
+
+    if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+            spec->isPrecisionArgument = true;
+            ++p;
+        } else {
+            spec->precision = ParseNumber(&p);
+        }
+    }
+
+    spec->length = Length_None;
+    switch (*p) {
+    case 'h':
+        ++p;
+        spec->length = Length_h;
+        if (*p == 'h') {
+            ++p;
+            spec->length = Length_hh;
+        }
+        break;
+    case 'l':
+        ++p;
+        spec->length = Length_l;
+        if (*p == 'l') {
+            ++p;
+            spec->length = Length_ll;
+        }
+        break;
+    case 'j':
+        ++p;
+        spec->length = Length_j;
+        break;
+    case 'z':
+        ++p;
+        spec->length = Length_z;
+        break;
+    case 't':
+        ++p;
+        spec->length = Length_t;
+        break;
+    case 'L':
+        ++p;
+        spec->length = Length_L;
+        break;
+    default:
+        break;
+    }
+
+    spec->conversion = *p;
+    if (*p != '\0') {
+        ++p;
+    }
+    *position = p;
+}
+
+/// <summary>
+///     Appends an argument to a message in the ring, or marks the message as truncated if it
+///     does not fit.
+/// </summary>
+static bool PutArgument(LogRecord *record, const void *data, size_t size)
+{
+    if (record->isTruncated || size > sizeof(record->args) - record->argBytes) {
+        record->isTruncated = true;
+        return false;
+    }
+    memcpy(record->args + record->argBytes, data, size);
+    record->argBytes = (uint8_t)(record->argBytes + size);
+    return true;
+}
+
+static int64_t GetSignedArgument(LengthModifier length, va_list *args)
+{
+    switch (length) {
+    case Length_hh:
+        return (signed char)va_arg(*args, int);
+    case Length_h:
+        return (short)va_arg(*args, int);
+    case Length_l:
+        return va_arg(*args, long);
+    case Length_ll:
+        return va_arg(*args, long long);
+    case Length_j:
+        return va_arg(*args, intmax_t);
+    case Length_z:
+    case Length_t:
+        return va_arg(*args, ptrdiff_t);
+    default:
+        return va_arg(*args, int);
+    }
+}
+
+static uint64_t GetUnsignedArgument(LengthModifier length, va_list *args)
+{
+    switch (length) {
+    case Length_hh:
+        return (unsigned char)va_arg(*args, unsigned int);
+    case Length_h:
+        return (unsigned short)va_arg(*args, unsigned int);
+    case Length_l:
+        return va_arg(*args, unsigned long);
+    case Length_ll:
+        return va_arg(*args, unsigned long long);
+    case Length_j:
+        return va_arg(*args, uintmax_t);
+    case Length_z:
+    case Length_t:
+        return va_arg(*args, size_t);
+    default:
+        return va_arg(*args, unsigned int);
+    }
+}
+
+/// <summary>
+///     Copies the arguments of a message into a record of the ring, without formatting them.
+/// </summary>
+static void EncodeArguments(LogRecord *record, const char *format, va_list *args)
+{
+    const char *p = format;
+    while (!record->isTruncated && (p = strchr(p, '%')) != NULL) {
+        ++p;
+        ConversionSpec spec;
+        ParseSpec(&p, &spec);
+
+        if (spec.isWidthArgument) {
+            int width = va_arg(*args, int);
+            PutArgument(record, &width, sizeof(width));
+        }
+        if (spec.isPrecisionArgument) {
+            int precision = va_arg(*args, int);
+            PutArgument(record, &precision, sizeof(precision));
+            spec.precision = precision;
+        }
+
+        switch (spec.conversion) {
+        case '%':
+            break;
+        case 'd':
+        case 'i': {
+            int64_t value = GetSignedArgument(spec.length, args);
+            PutArgument(record, &value, sizeof(value));
+            break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X': {
+            uint64_t value = GetUnsignedArgument(spec.length, args);
+            PutArgument(record, &value, sizeof(value));
+            break;
+        }
+        case 'c': {
+            int64_t value = va_arg(*args, int);
+            PutArgument(record, &value, sizeof(value));
+            break;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            double value = spec.length == Length_L ? (double)va_arg(*args, long double)
+                                                   : va_arg(*args, double);
+            PutArgument(record, &value, sizeof(value));
+            break;
+        }
+        case 'p': {
+            uint64_t value = (uintptr_t)va_arg(*args, void *);
+            PutArgument(record, &value, sizeof(value));
+            break;
+        }
+        case 's': {
+            if (spec.length != Length_None) {
+                // Wide strings are not supported.
+                record->isTruncated = true;
+                break;
+            }
+            const char *string = va_arg(*args, const char *);
+            if (string == NULL) {
+                string = "(null)";
+            }
+            size_t space = sizeof(record->args) - record->argBytes;
+            size_t maxLength = space > 1 ? space - 1 : 0;
+            if (spec.precision >= 0 && (size_t)spec.precision < maxLength) {
+                maxLength = (size_t)spec.precision;
+            }
+            uint8_t length = (uint8_t)strnlen(string, maxLength);
+            if (PutArgument(record, &length, sizeof(length))) {
+                PutArgument(record, string, length);
+            }
+            // A string which was cut short by the space, rather than by its precision, is
+            // still formatted, but it is marked as truncated.
+            if (length == maxLength && string[length] != '\0' &&
+                (spec.precision < 0 || length < (size_t)spec.precision)) {
+                record->isTruncated = true;
+            }
+            break;
+        }
+        case 'n':
+            // Nothing is written back, since the message is formatted later.
+            (void)va_arg(*args, void *);
+            break;
+        default:
+            record->isTruncated = true;
+            break;
+        }
+    }
+}
+
+/// <summary>
+///     A message which is being formatted from a record of the ring.
+/// </summary>
+typedef struct {
+    const LogRecord *record;
+    size_t argOffset;
+    char line[LINE_SIZE];
+    size_t lineLength;
+} Decoder;
+
+static bool GetArgument(Decoder *decoder, void *data, size_t size)
+{
+    if (size > decoder->record->argBytes - decoder->argOffset) {
+        return false;
+    }
+    memcpy(data, decoder->record->args + decoder->argOffset, size);
+    decoder->argOffset += size;
+    return true;
+}
+
+static void AppendFormatted(Decoder *decoder, const char *format, ...)
+{
+    size_t space = sizeof(decoder->line) - decoder->lineLength;
+    if (space <= 1) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(decoder->line + decoder->lineLength, space, format, args);
+    va_end(args);
+    if (written > 0) {
+        decoder->lineLength += (size_t)written < space ? (size_t)written : space - 1;
+    }
+}
+
+/// <summary>
+///     Builds the specification which formats a stored argument: the width and precision
+///     arguments are replaced by their values, and integers are formatted as long long.
+/// </summary>
+static void BuildSpec(char *buffer, size_t size, const ConversionSpec *spec, int width,
+                      int precision, const char *modifier)
+{
+    size_t length = (size_t)snprintf(buffer, size, "%%%s", spec->flags);
+    if (width >= 0 || spec->isWidthArgument) {
+        length += (size_t)snprintf(buffer + length, size - length, "%d", width);
+    }
+    if (precision >= 0) {
+        length += (size_t)snprintf(buffer + length, size - length, ".%d", precision);
+    }
+    snprintf(buffer + length, size - length, "%s%c", modifier, spec->conversion);
+}
+
+/// <summary>
+///     Formats the next conversion of a message from its stored argument.
+/// </summary>
+/// <returns>false if the argument was not stored, because the record was truncated</returns>
+static bool DecodeConversion(Decoder *decoder, const ConversionSpec *spec)
+{
+    int width = spec->width;
+    int precision = spec->precision;
+    if (spec->isWidthArgument && !GetArgument(decoder, &width, sizeof(width))) {
+        return false;
+    }
+    if (spec->isPrecisionArgument && !GetArgument(decoder, &precision, sizeof(precision))) {
+        return false;
+    }
+    if (precision < 0) {
+        precision = -1;
+    }
+
+    char format[48];
+    switch (spec->conversion) {
+    case '%':
+        AppendFormatted(decoder, "%%");
+        return true;
+    case 'n':
+        return true;
+    case 'd':
+    case 'i': {
+        int64_t value;
+        if (!GetArgument(decoder, &value, sizeof(value))) {
+            return false;
+        }
+        BuildSpec(format, sizeof(format), spec, width, precision, "ll");
+        AppendFormatted(decoder, format, (long long)value);
+        return true;
+    }
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X': {
+        uint64_t value;
+        if (!GetArgument(decoder, &value, sizeof(value))) {
+            return false;
+        }
+        BuildSpec(format, sizeof(format), spec, width, precision, "ll");
+        AppendFormatted(decoder, format, (unsigned long long)value);
+        return true;
+    }
+    case 'c': {
+        int64_t value;
+        if (!GetArgument(decoder, &value, sizeof(value))) {
+            return false;
+        }
+        BuildSpec(format, sizeof(format), spec, width, -1, "");
+        AppendFormatted(decoder, format, (int)value);
+        return true;
+    }
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A': {
+        double value;
+        if (!GetArgument(decoder, &value, sizeof(value))) {
+            return false;
+        }
+        BuildSpec(format, sizeof(format), spec, width, precision, "");
+        AppendFormatted(decoder, format, value);
+        return true;
+    }
+    case 'p': {
+        uint64_t value;
+        if (!GetArgument(decoder, &value, sizeof(value))) {
+            return false;
+        }
+        BuildSpec(format, sizeof(format), spec, width, -1, "");
+        AppendFormatted(decoder, format, (void *)(uintptr_t)value);
+        return true;
+    }
+    case 's': {
+        uint8_t length;
+        if (!GetArgument(decoder, &length, sizeof(length)) ||
+            length > decoder->record->argBytes - decoder->argOffset) {
+            return false;
+        }
+        const char *string = (const char *)decoder->record->args + decoder->argOffset;
+        decoder->argOffset += length;
+        // The stored characters are not terminated, so the precision limits them.
+        BuildSpec(format, sizeof(format), spec, width, length, "");
+        AppendFormatted(decoder, format, string);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+///     Formats a record of the ring into a line, and writes it to the debug log.
+/// </summary>
+static void WriteRecord(const LogRecord *record)
+{
+    Decoder decoder = {.record = record, .argOffset = 0, .lineLength = 0};
+    decoder.line[0] = '\0';
+
+    const char *p = record->format;
+    bool isComplete = true;
+    while (*p != '\0') {
+        const char *percent = strchr(p, '%');
+        size_t literalLength = percent != NULL ? (size_t)(percent - p) : strlen(p);
+        AppendFormatted(&decoder, "%.*s", (int)literalLength, p);
+        if (percent == NULL) {
+            break;
+        }
+
+        p = percent + 1;
+        ConversionSpec spec;
+        ParseSpec(&p, &spec);
+        if (!DecodeConversion(&decoder, &spec)) {
+            isComplete = false;
+            break;
+        }
+    }
+
+    size_t length = decoder.lineLength;
+    if (!isComplete || record->isTruncated || length == sizeof(decoder.line) - 1) {
+        // Mark a message which was cut short, keeping its line ending.
+        static const char marker[] = "...\n";
+        if (length > sizeof(decoder.line) - sizeof(marker)) {
+            length = sizeof(decoder.line) - sizeof(marker);
+        } else if (length > 0 && decoder.line[length - 1] == '\n') {
+            --length;
+        }
+        memcpy(decoder.line + length, marker, sizeof(marker));
+    }
+
+    Log_Debug("%s", decoder.line);
+}
+
+void AppLog_Write(int level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    if (logMode == AppLogMode_Immediate) {
+        Log_DebugVarArgs(format, args);
+    } else if (ringTail - ringHead == APP_LOG_RING_RECORDS) {
+        ++droppedRecords;
+    } else {
+        LogRecord *record = &ring[ringTail & (APP_LOG_RING_RECORDS - 1)];
+        record->format = format;
+        record->level = (uint8_t)level;
+        record->argBytes = 0;
+        record->isTruncated = false;
+        EncodeArguments(record, format, &args);
+        ++ringTail;
+    }
+
+    va_end(args);
+}
+
+static int64_t GetMonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool AppLog_IsAllowed(AppLogRateLimit *limit, int level, uint32_t burst, uint32_t intervalMs,
+                      const char *site)
+{
+    if (burst == 0) {
+        burst = 1;
+    }
+    if (!limit->isStarted) {
+        limit->isStarted = true;
+        limit->tokens = burst;
+    }
+
+    if (limit->tokens != 0) {
+        // The clock is only read when the last token is taken, so that the next ones are
+        // counted from then.
+        if (--limit->tokens == 0) {
+            limit->refillStartMs = GetMonotonicMs();
+        }
+    } else {
+        int64_t nowMs = GetMonotonicMs();
+        int64_t refill = intervalMs == 0 ? burst : (nowMs - limit->refillStartMs) / intervalMs;
+        if (refill <= 0) {
+            ++limit->suppressed;
+            return false;
+        }
+        if (refill >= burst) {
+            limit->tokens = burst - 1;
+            limit->refillStartMs = nowMs;
+        } else {
+            limit->tokens = (uint32_t)refill - 1;
+            limit->refillStartMs += refill * intervalMs;
+        }
+    }
+
+    if (limit->suppressed != 0) {
+        AppLog_Write(level, "%s: Suppressed %lu similar message(s) in %s.\n", LevelName(level),
+                     (unsigned long)limit->suppressed, site);
+        limit->suppressed = 0;
+    }
+    return true;
+}
+
+void AppLog_SetMode(AppLogMode mode)
+{
+    if (mode == AppLogMode_Immediate) {
+        AppLog_Drain(SIZE_MAX);
+    }
+    logMode = mode;
+}
+
+size_t AppLog_Drain(size_t maxRecords)
+{
+    size_t written = 0;
+    while (written < maxRecords && ringHead != ringTail) {
+        WriteRecord(&ring[ringHead & (APP_LOG_RING_RECORDS - 1)]);
+        ++ringHead;
+        ++written;
+    }
+
+    if (droppedRecords != 0 && ringHead == ringTail) {
+        Log_Debug("WARNING: Dropped %lu log message(s) because the log ring was full.\n",
+                  (unsigned long)droppedRecords);
+        droppedRecords = 0;
+    }
+    return written;
+}
@@ -0,0 +1,139 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Levels of the log messages, from the most to the least important.</summary>
+#define APP_LOG_LEVEL_NONE 0
+#define APP_LOG_LEVEL_ERROR 1
+#define APP_LOG_LEVEL_WARNING 2
+#define APP_LOG_LEVEL_INFO 3
+#define APP_LOG_LEVEL_DEBUG 4
+
+/// <summary>
+///     The least important level which is compiled. The calls of less important levels are
+///     removed by the compiler, together with their arguments. The applog library sets this to
+///     APP_LOG_LEVEL_INFO in release builds, unless the APP_LOG_LEVEL CMake variable is set.
+/// </summary>
+#ifndef APP_LOG_LEVEL
+#define APP_LOG_LEVEL APP_LOG_LEVEL_DEBUG
+#endif
+
+/// <summary>Number of messages which the ring of the deferred mode holds.</summary>
+#ifndef APP_LOG_RING_RECORDS
+#define APP_LOG_RING_RECORDS 64
+#endif
+
+/// <summary>Size of each message in the ring, including its format string pointer. Strings
+/// and other arguments which do not fit are cut short.</summary>
+#define APP_LOG_RECORD_SIZE 128
+
+/// <summary>
+///     How the messages are written.
+/// </summary>
+typedef enum {
+    /// <summary>Each message is formatted and written to the debug log when it is logged.
+    /// </summary>
+    AppLogMode_Immediate,
+    /// <summary>Each message is copied to a ring, with its arguments in binary, and is only
+    /// formatted and written by <see cref="AppLog_Drain" />. The format must be a string
+    /// literal, since only its pointer is kept.</summary>
+    AppLogMode_Deferred
+} AppLogMode;
+
+/// <summary>
+///     State of one rate-limited call site, which <see cref="APP_LOG_RATE_LIMITED" /> declares.
+///     The site may log a burst of messages, after which it gets back one message for each
+///     interval which passes. The clock is only read once the burst has been used.
+/// </summary>
+typedef struct {
+    /// <summary>Number of messages which may be logged before the clock is read.</summary>
+    uint32_t tokens;
+    /// <summary>Number of messages which were not logged since the last one which was.
+    /// </summary>
+    uint32_t suppressed;
+    /// <summary>Time, in ms of CLOCK_MONOTONIC, from which the next tokens are counted.
+    /// </summary>
+    int64_t refillStartMs;
+    /// <summary>Whether the site has been given its first burst.</summary>
+    bool isStarted;
+} AppLogRateLimit;
+
+/// <summary>
+///     Logs a message at a level, if that level is compiled. Use the APP_LOG_ERROR to
+///     APP_LOG_DEBUG macros rather than calling this directly.
+/// </summary>
+/// <param name="level">Level of the message.</param>
+/// <param name="format">printf format of the message, which includes the line ending.</param>
+#define APP_LOG(level, ...)                     \
+    do {                                        \
+        if ((level) <= APP_LOG_LEVEL) {         \
+            AppLog_Write((level), __VA_ARGS__); \
+        }                                       \
+    } while (0)
+
+#define APP_LOG_ERROR(...) APP_LOG(APP_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define APP_LOG_WARNING(...) APP_LOG(APP_LOG_LEVEL_WARNING, __VA_ARGS__)
+#define APP_LOG_INFO(...) APP_LOG(APP_LOG_LEVEL_INFO, __VA_ARGS__)
+#define APP_LOG_DEBUG(...) APP_LOG(APP_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/// <summary>
+///     Logs a message as <see cref="APP_LOG" /> does, but at most burst messages, then one per
+///     interval, from this call site. When a message is logged after some were not, the number
+///     which were not is logged first.
+/// </summary>
+/// <param name="level">Level of the message.</param>
+/// <param name="burst">Number of messages which may be logged at once.</param>
+/// <param name="intervalMs">Time after which another message may be logged.</param>
+/// <param name="format">printf format of the message, which includes the line ending.</param>
+#define APP_LOG_RATE_LIMITED(level, burst, intervalMs, ...)                            \
+    do {                                                                               \
+        if ((level) <= APP_LOG_LEVEL) {                                                \
+            static AppLogRateLimit appLogRateLimit_;                                   \
+            if (AppLog_IsAllowed(&appLogRateLimit_, (level), (burst), (intervalMs),    \
+                                 __func__)) {                                          \
+                AppLog_Write((level), __VA_ARGS__);                                    \
+            }                                                                          \
+        }                                                                              \
+    } while (0)
+
+/// <summary>
+///     Logs a message, in the current mode. Call this through the macros, so that the call is
+///     removed when its level is not compiled.
+/// </summary>
+/// <param name="level">Level of the message.</param>
+/// <param name="format">printf format of the message.</param>
+void AppLog_Write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/// <summary>
+///     Takes a token from a rate-limited call site. Call this through
+///     <see cref="APP_LOG_RATE_LIMITED" />.
+/// </summary>
+/// <param name="limit">State of the call site.</param>
+/// <param name="level">Level at which the number of suppressed messages is logged.</param>
+/// <param name="burst">Number of messages which may be logged at once.</param>
+/// <param name="intervalMs">Time after which another message may be logged.</param>
+/// <param name="site">Name of the function, which is logged with that number.</param>
+/// <returns>true if the message may be logged; false if it must be suppressed</returns>
+bool AppLog_IsAllowed(AppLogRateLimit *limit, int level, uint32_t burst, uint32_t intervalMs,
+                      const char *site);
+
+/// <summary>
+///     Sets how the messages are written. Switching to the immediate mode first drains the ring.
+///     Neither mode is thread-safe, so only log from the thread which drains the ring.
+/// </summary>
+/// <param name="mode">The mode.</param>
+void AppLog_SetMode(AppLogMode mode);
+
+/// <summary>
+///     Formats and writes the oldest messages from the ring of the deferred mode. If messages
+///     were dropped because the ring was full, their number is logged after the others. Call
+///     this from the main loop, after the event handlers have run, and before exiting.
+/// </summary>
+/// <param name="maxRecords">Most messages to write, so that a full ring does not delay the
+/// event loop; SIZE_MAX writes them all.</param>
+/// <returns>Number of messages which were written</returns>
+size_t AppLog_Drain(size_t maxRecords);
@@ -0,0 +1,76 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "change_filter.h"
+#include "timing.h"
+
+static uint64_t TimespecToNs(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000u + (uint64_t)ts->tv_nsec;
+}
+
+/// <summary>
+///     Decides whether a sample should be reported, given whether it differs from the last
+///     reported value by more than the deadband, and records the report if so.
+/// </summary>
+static bool CheckSample(ChangeFilter *filter, double value, bool changed)
+{
+    uint64_t nowNs = Timing_GetMonotonicNs();
+    bool report;
+    if (!filter->hasReported) {
+        report = true;
+    } else {
+        uint64_t elapsedNs = nowNs - filter->lastReportNs;
+        uint64_t maxIntervalNs = TimespecToNs(&filter->config.maxInterval);
+        if (elapsedNs < TimespecToNs(&filter->config.minInterval)) {
+            report = false;
+        } else {
+            report = changed || (maxIntervalNs != 0 && elapsedNs >= maxIntervalNs);
+        }
+    }
+
+    if (!report) {
+        ++filter->suppressedCount;
+        return false;
+    }
+
+    filter->hasReported = true;
+    filter->lastValue = value;
+    filter->lastReportNs = nowNs;
+    ++filter->reportedCount;
+    return true;
+}
+
+void ChangeFilter_Init(ChangeFilter *filter, const ChangeFilterConfig *config)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->config = *config;
+}
+
+bool ChangeFilter_Check(ChangeFilter *filter, double value)
+{
+    double deadband = filter->config.absoluteDeadband;
+    double relative = filter->config.relativeDeadband * fabs(filter->lastValue);
+    if (relative > deadband) {
+        deadband = relative;
+    }
+
+    // With no deadband, any change is reported, rather than none.
+    double change = fabs(value - filter->lastValue);
+    bool changed = deadband > 0 ? change >= deadband : change > 0;
+    return CheckSample(filter, value, changed);
+}
+
+bool ChangeFilter_CheckBool(ChangeFilter *filter, bool value)
+{
+    double sample = value ? 1.0 : 0.0;
+    return CheckSample(filter, sample, sample != filter->lastValue);
+}
+
+void ChangeFilter_Reset(ChangeFilter *filter)
+{
+    filter->hasReported = false;
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/// <summary>
+///     When a <see cref="ChangeFilter" /> reports a signal.
+/// </summary>
+typedef struct {
+    /// <summary>Smallest change from the last reported value which is reported. If this and
+    /// relativeDeadband are both 0, any change is reported.</summary>
+    double absoluteDeadband;
+    /// <summary>Smallest change which is reported, as a fraction of the magnitude of the last
+    /// reported value, such as 0.05 for 5%. The larger of the two deadbands applies.</summary>
+    double relativeDeadband;
+    /// <summary>Shortest time between two reports. Changes within it are not reported, which
+    /// bounds the rate of reports from a noisy signal. {0, 0} for no limit.</summary>
+    struct timespec minInterval;
+    /// <summary>Longest time between two reports. The value is reported once this has passed
+    /// even if it has not changed, so that the cloud can tell that the signal is still being
+    /// sampled. {0, 0} to report only changes.</summary>
+    struct timespec maxInterval;
+} ChangeFilterConfig;
+
+/// <summary>
+/// <para>Decides, for one signal, whether each new sample needs to be reported, so that a
+/// slow-moving signal is not sent at every sample while a fast-moving one is still sent as soon
+/// as it changes. The first sample is always reported, and after that a sample is reported when
+/// it differs from the last reported one by at least the deadband, or when maxInterval has
+/// passed since the last report, but not within minInterval of it.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="ChangeFilter_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    ChangeFilterConfig config;
+    /// <summary>Whether a value has been reported since the filter was initialized or
+    /// reset.</summary>
+    bool hasReported;
+    /// <summary>The last reported value.</summary>
+    double lastValue;
+    /// <summary>Monotonic time of the last report, in nanoseconds.</summary>
+    uint64_t lastReportNs;
+    /// <summary>Number of samples which were reported, and which were filtered out.</summary>
+    uint32_t reportedCount;
+    uint32_t suppressedCount;
+} ChangeFilter;
+
+/// <summary>
+///     Initializes a filter, so that its first sample is reported.
+/// </summary>
+/// <param name="filter">The filter to initialize.</param>
+/// <param name="config">When the signal is reported. This is copied.</param>
+void ChangeFilter_Init(ChangeFilter *filter, const ChangeFilterConfig *config);
+
+/// <summary>
+///     Checks whether a numeric sample should be reported. If so, it becomes the last
+///     reported value.
+/// </summary>
+/// <param name="filter">The filter.</param>
+/// <param name="value">The new sample.</param>
+/// <returns>true if the sample should be reported; false otherwise</returns>
+bool ChangeFilter_Check(ChangeFilter *filter, double value);
+
+/// <summary>
+///     Checks whether a boolean sample should be reported. Any change is reported, subject to
+///     the intervals; the deadbands do not apply.
+/// </summary>
+/// <param name="filter">The filter.</param>
+/// <param name="value">The new sample.</param>
+/// <returns>true if the sample should be reported; false otherwise</returns>
+bool ChangeFilter_CheckBool(ChangeFilter *filter, bool value);
+
+/// <summary>
+///     Forgets the last reported value, so that the next sample is reported whatever it is,
+///     such as when the last report may not have been delivered.
+/// </summary>
+/// <param name="filter">The filter.</param>
+void ChangeFilter_Reset(ChangeFilter *filter);
@@ -0,0 +1,131 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "dual_slot.h"
+#include "storage_metrics.h"
+
+/// <summary>
+///     The header of a slot as it is written to mutable storage. The data follows it.
+/// </summary>
+typedef struct {
+    uint32_t sequence;
+    uint32_t crc;
+} SlotHeader;
+
+_Static_assert(sizeof(SlotHeader) == DUAL_SLOT_HEADER_SIZE,
+               "A slot header must be DUAL_SLOT_HEADER_SIZE bytes long");
+
+#define SLOT_SIZE(dataSize) (sizeof(SlotHeader) + (dataSize))
+
+/// <summary>
+///     Updates a CRC-32 (IEEE 802.3), four bits at a time, which needs a table of only 16
+///     entries.
+/// </summary>
+static uint32_t UpdateCrc(uint32_t crc, const void *data, size_t length)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+        0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return crc;
+}
+
+/// <summary>
+///     Computes the CRC of a slot. The size is included, so that a record which was saved with
+///     another layout is not valid.
+/// </summary>
+static uint32_t ComputeCrc(uint32_t sequence, const void *data, size_t size)
+{
+    uint32_t size32 = (uint32_t)size;
+    uint32_t crc = UpdateCrc(0xFFFFFFFFu, &sequence, sizeof(sequence));
+    crc = UpdateCrc(crc, &size32, sizeof(size32));
+    return ~UpdateCrc(crc, data, size);
+}
+
+int DualSlot_Load(int fd, off_t offset, void *data, size_t size, uint32_t *sequence)
+{
+    *sequence = 0;
+    if (size > DUAL_SLOT_MAX_DATA_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Both slots are read at once. A slot beyond the end of the file, or whose read was short,
+    // is left zeroed, which is not valid.
+    uint8_t slots[2 * SLOT_SIZE(DUAL_SLOT_MAX_DATA_SIZE)];
+    size_t length = 2 * SLOT_SIZE(size);
+    ssize_t result = StorageMetrics_PRead(StorageFile_Mutable, fd, slots, length, offset);
+    if (result < 0) {
+        Log_Debug("ERROR: Could not read a record from mutable storage: %s (%d).\n",
+                  strerror(errno), errno);
+        return -1;
+    }
+    memset(slots + result, 0, length - (size_t)result);
+
+    const uint8_t *newest = NULL;
+    for (size_t i = 0; i < 2; i++) {
+        const uint8_t *slot = slots + i * SLOT_SIZE(size);
+        SlotHeader header;
+        memcpy(&header, slot, sizeof(header));
+        if (header.sequence == 0 ||
+            header.crc != ComputeCrc(header.sequence, slot + sizeof(header), size)) {
+            continue;
+        }
+        // The difference is taken as signed, so that the order survives the sequence number
+        // wrapping.
+        if (newest == NULL || (int32_t)(header.sequence - *sequence) > 0) {
+            newest = slot;
+            *sequence = header.sequence;
+        }
+    }
+    if (newest == NULL) {
+        return -1;
+    }
+    memcpy(data, newest + sizeof(SlotHeader), size);
+    return 0;
+}
+
+int DualSlot_Save(int fd, off_t offset, const void *data, size_t size, uint32_t *sequence)
+{
+    if (size > DUAL_SLOT_MAX_DATA_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // 0 marks a slot which has never been written, so it is skipped, for 2, which is in the
+    // same slot.
+    uint32_t nextSequence = *sequence + 1;
+    if (nextSequence == 0) {
+        nextSequence = 2;
+    }
+
+    // Consecutive sequence numbers alternate between the slots, so the newest copy, whose
+    // sequence number is the previous one, is in the other slot.
+    uint8_t slot[SLOT_SIZE(DUAL_SLOT_MAX_DATA_SIZE)];
+    SlotHeader header = {.sequence = nextSequence,
+                         .crc = ComputeCrc(nextSequence, data, size)};
+    memcpy(slot, &header, sizeof(header));
+    memcpy(slot + sizeof(header), data, size);
+
+    off_t slotOffset = offset + (off_t)((nextSequence % 2) * SLOT_SIZE(size));
+    ssize_t result = StorageMetrics_PWrite(fd, slot, SLOT_SIZE(size), slotOffset);
+    if (result != (ssize_t)SLOT_SIZE(size)) {
+        Log_Debug("ERROR: Could not write a record to mutable storage: %s (%d).\n",
+                  strerror(errno), errno);
+        return -1;
+    }
+    *sequence = nextSequence;
+    return 0;
+}
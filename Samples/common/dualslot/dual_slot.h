@@ -0,0 +1,51 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Saves a small record in mutable storage so that a power failure while it is being written
+// cannot lose it. The record is kept in two slots, one after the other, which are written in
+// turn, so the save which may be torn never overwrites the newest copy.
+//
+// Each slot holds a sequence number, which increases with each save, and a CRC-32 of the
+// sequence number, the size and the data. The slot to write is chosen by the sequence number,
+// so no other state is needed, and both slots are read with a single read, which picks the
+// newest valid copy. The caller's data holds its own magic number or version, if it needs one.
+
+/// <summary>Size of the header which is written before the data in each slot, in
+/// bytes.</summary>
+#define DUAL_SLOT_HEADER_SIZE 8
+
+/// <summary>Maximum size of the data in a record, in bytes.</summary>
+#define DUAL_SLOT_MAX_DATA_SIZE 256
+
+/// <summary>Number of bytes of the mutable file which a record of the given size uses.</summary>
+#define DUAL_SLOT_STORAGE_SIZE(dataSize) (2 * (DUAL_SLOT_HEADER_SIZE + (dataSize)))
+
+/// <summary>
+///     Reads the newest valid copy of a record.
+/// </summary>
+/// <param name="fd">The mutable file, from Storage_OpenMutableFile.</param>
+/// <param name="offset">Offset of the record in the mutable file.</param>
+/// <param name="data">Receives the data.</param>
+/// <param name="size">Size of the data, no more than DUAL_SLOT_MAX_DATA_SIZE.</param>
+/// <param name="sequence">Receives the sequence number of the copy which was read, or 0 if
+/// neither slot holds a valid copy. Pass it to <see cref="DualSlot_Save" />.</param>
+/// <returns>0 if a valid copy was read, or -1 if there is none</returns>
+int DualSlot_Load(int fd, off_t offset, void *data, size_t size, uint32_t *sequence);
+
+/// <summary>
+///     Saves a record in the slot which does not hold the newest copy, with a single write.
+/// </summary>
+/// <param name="fd">The mutable file, from Storage_OpenMutableFile.</param>
+/// <param name="offset">Offset of the record in the mutable file.</param>
+/// <param name="data">The data.</param>
+/// <param name="size">Size of the data, no more than DUAL_SLOT_MAX_DATA_SIZE.</param>
+/// <param name="sequence">The sequence number of the newest copy, from
+/// <see cref="DualSlot_Load" /> or the previous save, which is incremented if the record is
+/// saved.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int DualSlot_Save(int fd, off_t offset, const void *data, size_t size, uint32_t *sequence);
@@ -0,0 +1,164 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <applibs/log.h>
+#include "deferred_work.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+static void DeferredWorkEventHandler(EventData *eventData);
+static uint64_t GetCurrentTimeNs(void);
+
+int DeferredWorkQueue_Init(DeferredWorkQueue *queue, int epollFd, const struct timespec *budget)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->epollFd = epollFd;
+    queue->eventFd = -1;
+    queue->eventFdEventData.eventHandler = &DeferredWorkEventHandler;
+    // Run deferred work only after the other events in the same wakeup have been handled.
+    queue->eventFdEventData.priority = EventPriority_Idle;
+    queue->budgetNs = (uint64_t)budget->tv_sec * NS_PER_SEC + (uint64_t)budget->tv_nsec;
+
+    queue->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->eventFd < 0) {
+        Log_Debug("ERROR: Could not create eventfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, queue->eventFd, &queue->eventFdEventData, EPOLLIN) !=
+        0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void DeferredWorkQueue_Close(DeferredWorkQueue *queue)
+{
+    for (DeferredWorkItem *item = queue->head; item != NULL; item = item->next) {
+        item->isQueued = false;
+    }
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->queuedCount = 0;
+
+    CloseFdAndPrintError(queue->eventFd, "DeferredWorkQueue");
+    queue->eventFd = -1;
+}
+
+int DeferredWorkQueue_Post(DeferredWorkQueue *queue, DeferredWorkItem *item)
+{
+    if (item->isQueued) {
+        return 0;
+    }
+
+    item->next = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->next = item;
+    } else {
+        queue->head = item;
+    }
+    queue->tail = item;
+    item->isQueued = true;
+    ++queue->queuedCount;
+
+    // The eventfd stays readable until the queue is drained, so it only has to be written when
+    // work is posted to an idle queue.
+    if (!queue->isSignalled) {
+        uint64_t increment = 1;
+        if (write(queue->eventFd, &increment, sizeof(increment)) == -1) {
+            Log_Debug("ERROR: Could not signal deferred work eventfd: %s (%d).\n",
+                      strerror(errno), errno);
+            return -1;
+        }
+        queue->isSignalled = true;
+    }
+
+    return 0;
+}
+
+void DeferredWorkQueue_Cancel(DeferredWorkQueue *queue, DeferredWorkItem *item)
+{
+    if (!item->isQueued) {
+        return;
+    }
+
+    // The eventfd is left signalled. If it is reported before more work is posted, the
+    // handler finds nothing to run and clears it.
+    DeferredWorkItem *previous = NULL;
+    for (DeferredWorkItem *current = queue->head; current != NULL; current = current->next) {
+        if (current == item) {
+            if (previous != NULL) {
+                previous->next = item->next;
+            } else {
+                queue->head = item->next;
+            }
+            if (queue->tail == item) {
+                queue->tail = previous;
+            }
+            break;
+        }
+        previous = current;
+    }
+
+    item->next = NULL;
+    item->isQueued = false;
+    --queue->queuedCount;
+}
+
+bool DeferredWorkQueue_IsQueued(const DeferredWorkItem *item)
+{
+    return item->isQueued;
+}
+
+static void DeferredWorkEventHandler(EventData *eventData)
+{
+    DeferredWorkQueue *queue = (DeferredWorkQueue *)((uint8_t *)eventData -
+                                                     offsetof(DeferredWorkQueue, eventFdEventData));
+
+    // Only run the items which were queued when this wakeup started, so work which posts
+    // further work cannot keep the event loop from servicing I/O.
+    size_t itemsToRun = queue->queuedCount;
+    uint64_t startNs = GetCurrentTimeNs();
+
+    while (itemsToRun > 0 && queue->head != NULL) {
+        DeferredWorkItem *item = queue->head;
+        queue->head = item->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+        item->next = NULL;
+        item->isQueued = false;
+        --queue->queuedCount;
+        --itemsToRun;
+
+        DispatchEvent(&item->eventData);
+
+        if (GetCurrentTimeNs() - startNs >= queue->budgetNs) {
+            break;
+        }
+    }
+
+    // If work remains then leave the eventfd readable, so the event loop comes straight back
+    // once it has serviced any other ready events.
+    if (queue->head == NULL && queue->isSignalled) {
+        uint64_t counter;
+        if (read(queue->eventFd, &counter, sizeof(counter)) == -1 && errno != EAGAIN) {
+            Log_Debug("ERROR: Could not read deferred work eventfd: %s (%d).\n", strerror(errno),
+                      errno);
+        }
+        queue->isSignalled = false;
+    }
+}
+
+static uint64_t GetCurrentTimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,97 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>
+/// <para>A unit of work which is posted to a <see cref="DeferredWorkQueue" />.</para>
+/// <para>The caller allocates this struct and populates eventData.eventHandler. The handler is
+/// called with a pointer to eventData when the work runs, so the existing EventHandler
+/// callbacks can be reused. A handler may post its own work item again to continue later.</para>
+/// <para>The struct must remain valid for as long as the item is queued. The remaining members
+/// are managed by the queue and must not be modified by the caller.</para>
+/// </summary>
+typedef struct DeferredWorkItem {
+    /// <summary>Event data which is passed to the handler when the work runs.</summary>
+    EventData eventData;
+    /// <summary>Next item in the queue.</summary>
+    struct DeferredWorkItem *next;
+    /// <summary>Whether the item is currently queued.</summary>
+    bool isQueued;
+} DeferredWorkItem;
+
+/// <summary>
+/// <para>Queue of work which is run from the event loop after all ready I/O has been serviced.
+/// I/O handlers post continuations to the queue instead of doing lengthy work inline.</para>
+/// <para>The queue is backed by an eventfd which stays readable while work is pending. Each
+/// time the event loop wakes up, the queued work is run until the time budget is used up;
+/// the remainder runs on the next wakeup, after any I/O which became ready in the meantime.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="DeferredWorkQueue_Init" /> and disposes of it with
+/// <see cref="DeferredWorkQueue_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Epoll instance on which the eventfd is registered.</summary>
+    int epollFd;
+    /// <summary>The eventfd which is readable while work is pending.</summary>
+    int eventFd;
+    /// <summary>Event data for the eventfd.</summary>
+    EventData eventFdEventData;
+    /// <summary>Maximum time to spend running work in one wakeup, in nanoseconds.</summary>
+    uint64_t budgetNs;
+    /// <summary>Oldest queued item.</summary>
+    DeferredWorkItem *head;
+    /// <summary>Newest queued item.</summary>
+    DeferredWorkItem *tail;
+    /// <summary>Number of items which are currently queued.</summary>
+    size_t queuedCount;
+    /// <summary>Whether the eventfd has been signalled and not yet cleared.</summary>
+    bool isSignalled;
+} DeferredWorkQueue;
+
+/// <summary>
+///     Creates the queue's eventfd and adds it to an epoll instance. The queue is empty.
+/// </summary>
+/// <param name="queue">Queue to initialize. This must stay in memory until it is closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="budget">Maximum time to spend running queued work each time the event loop
+/// wakes up. At least one item is always run.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int DeferredWorkQueue_Init(DeferredWorkQueue *queue, int epollFd, const struct timespec *budget);
+
+/// <summary>
+///     Discards all queued work without running it, and closes the queue's eventfd.
+/// </summary>
+/// <param name="queue">Queue which was initialized with
+/// <see cref="DeferredWorkQueue_Init" />.</param>
+void DeferredWorkQueue_Close(DeferredWorkQueue *queue);
+
+/// <summary>
+///     Appends a work item to the queue. If the item is already queued, it is not added again.
+///     This function can be called from any event handler, including a deferred work handler.
+/// </summary>
+/// <param name="queue">Queue on which to run the work.</param>
+/// <param name="item">Work to run.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int DeferredWorkQueue_Post(DeferredWorkQueue *queue, DeferredWorkItem *item);
+
+/// <summary>
+///     Removes a work item from the queue. It is safe to call this function on an item which is
+///     not queued. This takes time proportional to the number of queued items.
+/// </summary>
+/// <param name="queue">Queue on which the work was posted.</param>
+/// <param name="item">Work to cancel.</param>
+void DeferredWorkQueue_Cancel(DeferredWorkQueue *queue, DeferredWorkItem *item);
+
+/// <summary>
+///     Queries whether a work item is currently queued.
+/// </summary>
+/// <param name="item">Work item to query.</param>
+/// <returns>true if the item is waiting to run; false otherwise.</returns>
+bool DeferredWorkQueue_IsQueued(const DeferredWorkItem *item);
@@ -0,0 +1,368 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <applibs/log.h>
+#include "epoll_timerfd_utilities.h"
+
+// Number of priority classes in EventPriority, from EventPriority_Idle to EventPriority_High.
+#define EVENT_PRIORITY_COUNT (EventPriority_High - EventPriority_Idle + 1)
+
+/// <summary>
+///     Maps a priority onto a dispatch bucket, where bucket 0 is dispatched first. Values
+///     outside the range of EventPriority are treated as EventPriority_Normal.
+/// </summary>
+static uint8_t PriorityToBucket(EventPriority priority)
+{
+    if (priority < EventPriority_Idle || priority > EventPriority_High) {
+        priority = EventPriority_Normal;
+    }
+    return (uint8_t)(EventPriority_High - priority);
+}
+
+#if EPOLL_TIMERFD_INSTRUMENTATION
+// Event whose handler is currently running, so ConsumeTimerFdEvent can attribute the expiry
+// count which it reads to that event.
+static EventData *currentEventData = NULL;
+
+static uint64_t GetMonotonicTimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t TimespecToNs(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+#endif
+
+int CreateEpollFd(void)
+{
+    int epollFd = -1;
+
+    epollFd = epoll_create1(0);
+    if (epollFd == -1) {
+        Log_Debug("ERROR: Could not create epoll instance: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    return epollFd;
+}
+
+int RegisterEventHandlerToEpoll(int epollFd, int eventFd, EventData *persistentEventData,
+                                const uint32_t epollEventMask)
+{
+    struct epoll_event eventToAddOrModify = {.data.ptr = persistentEventData,
+                                             .events = epollEventMask};
+
+    // If this event data is known to be registered for eventFd then modify the existing
+    // registration, which takes one system call instead of a failed add followed by a modify.
+    if (persistentEventData->registeredEvents != 0 && persistentEventData->fd == eventFd) {
+        if (epoll_ctl(epollFd, EPOLL_CTL_MOD, eventFd, &eventToAddOrModify) == 0) {
+            persistentEventData->registeredEvents = epollEventMask;
+            return 0;
+        }
+        // The fd was removed from the epoll set behind our back, e.g. because it was closed
+        // and its number reused, so fall through and add it again.
+    }
+
+    persistentEventData->fd = eventFd;
+    persistentEventData->registeredEvents = 0;
+
+    // Register the eventFd on the epoll instance referred by epollFd
+    // and register the eventHandler handler for events in epollEventMask.
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &eventToAddOrModify) == -1) {
+        // If the Add fails, retry with the Modify as the file descriptor has already been
+        // added to the epoll set after it was removed by the kernel upon its closure.
+        if (epoll_ctl(epollFd, EPOLL_CTL_MOD, eventFd, &eventToAddOrModify) == -1) {
+            Log_Debug("ERROR: Could not register event to epoll instance: %s (%d).\n",
+                      strerror(errno), errno);
+            return -1;
+        }
+    }
+
+    persistentEventData->registeredEvents = epollEventMask;
+    return 0;
+}
+
+int RegisterPersistentEventHandlerToEpoll(int epollFd, int eventFd,
+                                          EventData *persistentEventData,
+                                          const uint32_t epollEventMask)
+{
+    uint32_t events = epollEventMask | EPOLLET;
+
+    // Already registered with the requested events, so there is nothing to do.
+    if (persistentEventData->registeredEvents == events && persistentEventData->fd == eventFd) {
+        return 0;
+    }
+
+    return RegisterEventHandlerToEpoll(epollFd, eventFd, persistentEventData, events);
+}
+
+int UnregisterPersistentEventHandlerFromEpoll(int epollFd, EventData *persistentEventData)
+{
+    if (persistentEventData->registeredEvents == 0) {
+        return 0;
+    }
+
+    persistentEventData->registeredEvents = 0;
+    return UnregisterEventHandlerFromEpoll(epollFd, persistentEventData->fd);
+}
+
+int UnregisterEventHandlerFromEpoll(int epollFd, int eventFd)
+{
+    int res = 0;
+    // Unregister the eventFd on the epoll instance referred by epollFd.
+    if ((res = epoll_ctl(epollFd, EPOLL_CTL_DEL, eventFd, NULL)) == -1) {
+        if (res == -1 && errno != EBADF) { // Ignore EBADF errors
+            Log_Debug("ERROR: Could not remove event from epoll instance: %s (%d).\n",
+                      strerror(errno), errno);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int SetTimerFdToPeriod(int timerFd, const struct timespec *period)
+{
+    struct itimerspec newValue = {.it_value = *period, .it_interval = *period};
+
+    if (timerfd_settime(timerFd, 0, &newValue, NULL) < 0) {
+        Log_Debug("ERROR: Could not set timerfd period: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+int SetTimerFdToSingleExpiry(int timerFd, const struct timespec *expiry)
+{
+    struct itimerspec newValue = {.it_value = *expiry, .it_interval = {}};
+
+    if (timerfd_settime(timerFd, 0, &newValue, NULL) < 0) {
+        Log_Debug("ERROR: Could not set timerfd interval: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ConsumeTimerFdEvent(int timerFd)
+{
+    return ConsumeTimerFdExpiries(timerFd, NULL);
+}
+
+int ConsumeTimerFdExpiries(int timerFd, uint64_t *expiryCount)
+{
+    uint64_t timerData = 0;
+
+    if (read(timerFd, &timerData, sizeof(timerData)) == -1) {
+        Log_Debug("ERROR: Could not read timerfd %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+#if EPOLL_TIMERFD_INSTRUMENTATION
+    // For a periodic timer, the oldest expiry which was read happened timerData periods before
+    // the next one is due, so compare the time remaining against the expected period.
+    struct itimerspec current;
+    if (currentEventData != NULL && currentEventData->fd == timerFd && timerData > 0 &&
+        timerfd_gettime(timerFd, &current) == 0) {
+        uint64_t periodNs = TimespecToNs(&current.it_interval);
+        uint64_t remainingNs = TimespecToNs(&current.it_value);
+        uint64_t latenessNs = 0;
+        if (periodNs != 0 && timerData * periodNs > remainingNs) {
+            latenessNs = timerData * periodNs - remainingNs;
+        }
+        RecordTimerLateness(currentEventData, timerData - 1, latenessNs);
+    }
+#endif
+
+    if (expiryCount != NULL) {
+        *expiryCount = timerData;
+    }
+
+    return 0;
+}
+
+int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
+                               EventData *persistentEventData, const uint32_t epollEventMask)
+{
+    // Create the timerfd and arm it by setting the interval to period
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerFd < 0) {
+        Log_Debug("ERROR: Could not create timerfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    if (SetTimerFdToPeriod(timerFd, period) != 0) {
+        int result = close(timerFd);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not close timerfd: %s (%d).\n", strerror(errno), errno);
+        }
+        return -1;
+    }
+
+    persistentEventData->fd = timerFd;
+    if (RegisterEventHandlerToEpoll(epollFd, timerFd, persistentEventData, epollEventMask) != 0) {
+        return -1;
+    }
+
+    return timerFd;
+}
+
+int WaitForEventAndCallHandler(int epollFd)
+{
+    return WaitForEventsAndCallHandlers(epollFd, 1, -1, NULL) < 0 ? -1 : 0;
+}
+
+int WaitForEventsAndCallHandlers(int epollFd, int maxEvents, int timeoutMs,
+                                 volatile const sig_atomic_t *stopRequested)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS_PER_WAIT];
+
+    if (maxEvents < 1) {
+        maxEvents = 1;
+    } else if (maxEvents > EPOLL_MAX_EVENTS_PER_WAIT) {
+        maxEvents = EPOLL_MAX_EVENTS_PER_WAIT;
+    }
+
+    int numEventsOccurred = epoll_wait(epollFd, events, maxEvents, timeoutMs);
+
+    if (numEventsOccurred == -1) {
+        if (errno == EINTR) {
+            // interrupted by signal, e.g. due to breakpoint being set; ignore
+            return 0;
+        }
+        Log_Debug("ERROR: Failed waiting on events: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    // Sort the batch by priority with a counting sort, which keeps events of equal priority in
+    // the order in which epoll reported them.
+    int bucketStart[EVENT_PRIORITY_COUNT + 1] = {0};
+    uint8_t eventBucket[EPOLL_MAX_EVENTS_PER_WAIT];
+    for (int i = 0; i < numEventsOccurred; ++i) {
+        const EventData *eventData = events[i].data.ptr;
+        eventBucket[i] = PriorityToBucket(eventData != NULL ? eventData->priority
+                                                            : EventPriority_Normal);
+        ++bucketStart[eventBucket[i] + 1];
+    }
+    for (int b = 0; b < EVENT_PRIORITY_COUNT; ++b) {
+        bucketStart[b + 1] += bucketStart[b];
+    }
+    int dispatchOrder[EPOLL_MAX_EVENTS_PER_WAIT];
+    for (int i = 0; i < numEventsOccurred; ++i) {
+        dispatchOrder[bucketStart[eventBucket[i]]++] = i;
+    }
+
+    int numHandlersCalled = 0;
+    for (int n = 0; n < numEventsOccurred; ++n) {
+        // Stop early if a previous handler in this batch requested termination.
+        if (stopRequested != NULL && *stopRequested) {
+            break;
+        }
+
+        const struct epoll_event *event = &events[dispatchOrder[n]];
+        EventData *eventData = event->data.ptr;
+        if (eventData != NULL) {
+            eventData->readyEvents = event->events;
+            DispatchEvent(eventData);
+            ++numHandlersCalled;
+        }
+    }
+
+    return numHandlersCalled;
+}
+
+void DispatchEvent(EventData *eventData)
+{
+#if EPOLL_TIMERFD_INSTRUMENTATION
+    // Handlers can be nested, e.g. the timer wheel calls the handlers of its logical timers.
+    EventData *outerEventData = currentEventData;
+    currentEventData = eventData;
+    uint64_t startNs = GetMonotonicTimeNs();
+
+    eventData->eventHandler(eventData);
+
+    uint64_t elapsedNs = GetMonotonicTimeNs() - startNs;
+    currentEventData = outerEventData;
+
+    EventHandlerStats *stats = &eventData->stats;
+    ++stats->dispatchCount;
+    stats->totalHandlerNs += elapsedNs;
+    if (elapsedNs > stats->maxHandlerNs) {
+        stats->maxHandlerNs = elapsedNs;
+    }
+#else
+    eventData->eventHandler(eventData);
+#endif
+}
+
+void RecordTimerLateness(EventData *eventData, uint64_t missedExpiries, uint64_t latenessNs)
+{
+#if EPOLL_TIMERFD_INSTRUMENTATION
+    EventHandlerStats *stats = &eventData->stats;
+    ++stats->timerExpiryCount;
+    stats->missedTimerExpiries += (uint32_t)missedExpiries;
+    stats->totalTimerLatenessNs += latenessNs;
+    if (latenessNs > stats->maxTimerLatenessNs) {
+        stats->maxTimerLatenessNs = latenessNs;
+    }
+#else
+    (void)eventData;
+    (void)missedExpiries;
+    (void)latenessNs;
+#endif
+}
+
+void GetEventHandlerStats(const EventData *eventData, EventHandlerStats *stats)
+{
+#if EPOLL_TIMERFD_INSTRUMENTATION
+    *stats = eventData->stats;
+#else
+    (void)eventData;
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void ResetEventHandlerStats(EventData *eventData)
+{
+#if EPOLL_TIMERFD_INSTRUMENTATION
+    memset(&eventData->stats, 0, sizeof(eventData->stats));
+#else
+    (void)eventData;
+#endif
+}
+
+void LogEventHandlerStats(const char *name, const EventData *eventData)
+{
+    EventHandlerStats stats;
+    GetEventHandlerStats(eventData, &stats);
+
+    uint64_t avgHandlerNs =
+        stats.dispatchCount == 0 ? 0 : stats.totalHandlerNs / stats.dispatchCount;
+    uint64_t avgLatenessNs =
+        stats.timerExpiryCount == 0 ? 0 : stats.totalTimerLatenessNs / stats.timerExpiryCount;
+
+    Log_Debug("INFO: %s: %" PRIu32 " dispatches, handler avg %" PRIu64 " us max %" PRIu64
+              " us, timer lateness avg %" PRIu64 " us max %" PRIu64 " us, %" PRIu32
+              " missed expiries.\n",
+              name, stats.dispatchCount, avgHandlerNs / 1000, stats.maxHandlerNs / 1000,
+              avgLatenessNs / 1000, stats.maxTimerLatenessNs / 1000, stats.missedTimerExpiries);
+}
+
+void CloseFdAndPrintError(int fd, const char *fdName)
+{
+    if (fd >= 0) {
+        int result = close(fd);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not close fd %s: %s (%d).\n", fdName, strerror(errno), errno);
+        }
+    }
+}
\ No newline at end of file
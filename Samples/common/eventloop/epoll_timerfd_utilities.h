@@ -0,0 +1,320 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+/// <summary>
+///     Version of the shared event loop library. The minor version is incremented when features
+///     are added, and the major version when existing behavior changes incompatibly.
+/// </summary>
+#define EVENT_LOOP_VERSION_MAJOR 1
+#define EVENT_LOOP_VERSION_MINOR 8
+
+/// <summary>
+///     Set to 0 to compile out the event handler instrumentation. When it is disabled,
+///     <see cref="GetEventHandlerStats" /> reports zero for every metric.
+/// </summary>
+#ifndef EPOLL_TIMERFD_INSTRUMENTATION
+#define EPOLL_TIMERFD_INSTRUMENTATION 1
+#endif
+
+/// Forward declaration of the data type passed to the handlers.
+struct EventData;
+
+/// <summary>
+///     Function signature for event handlers.
+/// </summary>
+/// <param name="eventData">The provided event data</param>
+typedef void (*EventHandler)(struct EventData *eventData);
+
+/// <summary>
+/// <para>Metrics which are recorded for each <see cref="EventData" /> while its handler is
+/// dispatched by the event loop.</para>
+/// <para>Timer metrics are recorded when the handler consumes its timerfd with
+/// <see cref="ConsumeTimerFdEvent" />, or when a timer wheel dispatches a logical timer.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Number of times the handler has been called.</summary>
+    uint32_t dispatchCount;
+    /// <summary>Total time spent in the handler, in nanoseconds.</summary>
+    uint64_t totalHandlerNs;
+    /// <summary>Longest single run of the handler, in nanoseconds.</summary>
+    uint64_t maxHandlerNs;
+    /// <summary>Number of timer expiries which were measured for lateness.</summary>
+    uint32_t timerExpiryCount;
+    /// <summary>Number of timer periods which expired without their own dispatch.</summary>
+    uint32_t missedTimerExpiries;
+    /// <summary>Total time between timer expiry and dispatch, in nanoseconds.</summary>
+    uint64_t totalTimerLatenessNs;
+    /// <summary>Longest time between timer expiry and dispatch, in nanoseconds.</summary>
+    uint64_t maxTimerLatenessNs;
+} EventHandlerStats;
+
+/// <summary>
+/// <para>Priority classes for event handlers.</para>
+/// <para>When several events are ready in the same wakeup, the handlers of higher-priority
+/// events are called first. Events of equal priority are handled in the order in which epoll
+/// reported them. Priorities do not preempt a running handler, and do not hold back a
+/// lower-priority event for a later wakeup.</para>
+/// </summary>
+typedef enum {
+    /// <summary>Deferred work, which runs after all ready I/O has been serviced.</summary>
+    EventPriority_Idle = -2,
+    /// <summary>Work which tolerates latency, e.g. telemetry or LED updates.</summary>
+    EventPriority_Low = -1,
+    /// <summary>The default priority.</summary>
+    EventPriority_Normal = 0,
+    /// <summary>Links with small hardware FIFOs or tight deadlines, e.g. UART receive or
+    /// intercore sockets.</summary>
+    EventPriority_High = 1
+} EventPriority;
+
+/// <summary>
+/// <para>Contains context data for epoll events.</para>
+/// <para>When an event is registered with RegisterEventHandlerToEpoll, supply
+/// a pointer to an instance of this struct.  The pointer must remain valid
+/// for as long as the event is active.</para>
+/// </summary>
+/// <seealso cref="RegisterEventHandlerToEpoll" />
+typedef struct EventData {
+    /// <summary>
+    /// Function which is called when the event occurs.
+    /// </summary>
+    EventHandler eventHandler;
+    /// <summary>
+    /// The file descriptor that generated the event.
+    /// </summary>
+    int fd;
+    /// <summary>
+    /// Events for which fd is currently registered on the epoll instance, or zero if it is not
+    /// known to be registered. Maintained by the registration functions; zero-initialize it and
+    /// do not modify it directly.
+    /// </summary>
+    uint32_t registeredEvents;
+    /// <summary>
+    /// Events which epoll reported for fd. This is set before eventHandler is called.
+    /// </summary>
+    uint32_t readyEvents;
+    /// <summary>
+    /// Order in which <see cref="WaitForEventsAndCallHandlers" /> calls this handler relative
+    /// to the other events which were retrieved in the same wakeup. Zero-initialized event data
+    /// has <see cref="EventPriority_Normal" />.
+    /// </summary>
+    EventPriority priority;
+#if EPOLL_TIMERFD_INSTRUMENTATION
+    /// <summary>
+    /// Metrics for this event. Read them with <see cref="GetEventHandlerStats" />.
+    /// </summary>
+    EventHandlerStats stats;
+#endif
+} EventData;
+
+/// <summary>
+///    Creates an epoll instance.
+/// </summary>
+/// <returns>A valid epoll file descriptor on success, or -1 on failure</returns>
+int CreateEpollFd(void);
+
+/// <summary>
+///     Registers an event with the epoll instance. If the event was previously added, that
+///     registration will be modified to match the new mask.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="eventFd">File descriptor generating events for the epoll</param>
+/// <param name="persistentEventData">Persistent event data structure. This must stay in memory
+/// until the handler is removed from the epoll. Its fd and registeredEvents are set on
+/// success.</param>
+/// <param name="epollEventMask">Bit mask for the epoll event type</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int RegisterEventHandlerToEpoll(int epollFd, int eventFd, EventData *persistentEventData,
+                                const uint32_t epollEventMask);
+
+/// <summary>
+///     Registers a long-lived, edge-triggered interest in an fd. The fd is added to the epoll
+///     instance with EPOLLET once and stays registered until
+///     <see cref="UnregisterPersistentEventHandlerFromEpoll" /> is called, so a handler which
+///     alternates between reading and writing does not need to re-register on every partial
+///     transfer.
+///     <para>Because events are edge-triggered, the handler is only called again when the fd
+///     changes state. It must therefore read or write until the call fails with EAGAIN before
+///     it returns to the event loop. Use readyEvents to find out which events occurred.</para>
+///     <para>Calling this function again with the same mask does not make a system call. Calling
+///     it with a different mask modifies the existing registration. The persistent event data
+///     must be unregistered before eventFd is closed.</para>
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="eventFd">File descriptor generating events for the epoll</param>
+/// <param name="persistentEventData">Persistent event data structure. This must stay in memory
+/// until the handler is removed from the epoll, and registeredEvents must be zero before the
+/// first call.</param>
+/// <param name="epollEventMask">Bit mask for the epoll event type, typically
+/// EPOLLIN | EPOLLOUT. EPOLLET is added automatically.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int RegisterPersistentEventHandlerToEpoll(int epollFd, int eventFd,
+                                          EventData *persistentEventData,
+                                          const uint32_t epollEventMask);
+
+/// <summary>
+///     Removes a registration which was made with
+///     <see cref="RegisterPersistentEventHandlerToEpoll" /> or
+///     <see cref="RegisterEventHandlerToEpoll" />, and clears registeredEvents so that the event
+///     data can be registered again. It is safe to call this function when the event data is not
+///     registered.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="persistentEventData">Event data which was passed to the registration
+/// function.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int UnregisterPersistentEventHandlerFromEpoll(int epollFd, EventData *persistentEventData);
+
+/// <summary>
+///     Unregisters an event with the epoll instance. The event data is not known here, so its
+///     registeredEvents is not cleared. If the event data may be registered again, use
+///     <see cref="UnregisterPersistentEventHandlerFromEpoll" /> instead.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="eventFd">File descriptor generating events for the epoll</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int UnregisterEventHandlerFromEpoll(int epollFd, int eventFd);
+
+/// <summary>
+///     Sets the period of a timer.
+/// </summary>
+/// <param name="timerFd">Timer file descriptor</param>
+/// <param name="period">The new period</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SetTimerFdToPeriod(int timerFd, const struct timespec *period);
+
+/// <summary>
+///     Sets a timer to fire once only, after a duration specified in milliseconds.
+/// </summary>
+/// <param name="timerFd">Timer file descriptor</param>
+/// <param name="expiry">The time elapsed before it expires once</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int SetTimerFdToSingleExpiry(int timerFd, const struct timespec *expiry);
+
+/// <summary>
+///     Consumes an event by reading from the timer file descriptor.
+///     If the event is not consumed, then it will immediately recur.
+/// </summary>
+/// <param name="timerFd">Timer file descriptor</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int ConsumeTimerFdEvent(int timerFd);
+
+/// <summary>
+///     Consumes an event by reading from the timer file descriptor, and reports how many times
+///     the timer has expired since it was last consumed. A count greater than one means that
+///     periods were missed, e.g. because another handler ran for longer than the period.
+/// </summary>
+/// <param name="timerFd">Timer file descriptor</param>
+/// <param name="expiryCount">Receives the number of expiries, which is at least one on
+/// success. May be NULL.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int ConsumeTimerFdExpiries(int timerFd, uint64_t *expiryCount);
+
+/// <summary>
+///     Creates a timerfd and adds it to an epoll instance.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="period">The timer period</param>
+/// <param name="persistentEventData">Persistent event data structure. This must stay in memory
+/// until the handler is removed from the epoll.</param>
+/// <param name="epollEventMask">Bit mask for the epoll event type</param>
+/// <returns>A valid timerfd file descriptor on success, or -1 on failure</returns>
+int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
+                               EventData *persistentEventData, const uint32_t epollEventMask);
+
+/// <summary>
+///     Waits for an event on an epoll instance and triggers the handler.
+/// </summary>
+/// <param name="epollFd">
+///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
+/// </param>
+/// <returns>0 on success, or -1 on failure</returns>
+int WaitForEventAndCallHandler(int epollFd);
+
+/// <summary>
+///     The maximum number of events which <see cref="WaitForEventsAndCallHandlers" /> retrieves
+///     from the epoll instance in a single wakeup.
+/// </summary>
+#define EPOLL_MAX_EVENTS_PER_WAIT 16
+
+/// <summary>
+///     Waits for one or more events on an epoll instance and triggers the handler for each of
+///     them. All events which are ready, up to <paramref name="maxEvents" />, are retrieved with
+///     a single call to epoll_wait.
+///     <para>The handlers are called in order of the priority of their EventData.</para>
+///     <para>Because several events are dispatched from one wakeup, a handler must not release
+///     the EventData of another registration which may still be pending in the same batch. Set
+///     <paramref name="stopRequested" /> instead and perform the cleanup once this function
+///     returns.</para>
+/// </summary>
+/// <param name="epollFd">
+///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
+/// </param>
+/// <param name="maxEvents">
+///     Maximum number of events to dispatch. Values outside the range 1 to
+///     <see cref="EPOLL_MAX_EVENTS_PER_WAIT" /> are clamped to that range.
+/// </param>
+/// <param name="timeoutMs">
+///     Maximum time to wait for an event in milliseconds, or -1 to wait indefinitely.
+/// </param>
+/// <param name="stopRequested">
+///     Optional flag which is checked before each handler is called. When it is set, the
+///     remaining events in the batch are not dispatched. May be NULL.
+/// </param>
+/// <returns>The number of handlers which were called, or -1 on failure</returns>
+int WaitForEventsAndCallHandlers(int epollFd, int maxEvents, int timeoutMs,
+                                 volatile const sig_atomic_t *stopRequested);
+
+/// <summary>
+///     Calls the handler for an event and records its runtime. Dispatchers which call handlers
+///     outside <see cref="WaitForEventsAndCallHandlers" />, such as the timer wheel, use this
+///     function so their handlers are instrumented in the same way.
+/// </summary>
+/// <param name="eventData">Event whose handler to call.</param>
+void DispatchEvent(EventData *eventData);
+
+/// <summary>
+///     Records how late a timer event was dispatched. <see cref="ConsumeTimerFdEvent" /> calls
+///     this automatically for the event which is currently being handled.
+/// </summary>
+/// <param name="eventData">Event which the timer expiry was dispatched to.</param>
+/// <param name="missedExpiries">Number of earlier expiries which were coalesced into this
+/// dispatch.</param>
+/// <param name="latenessNs">Time between the oldest pending expiry and the dispatch, in
+/// nanoseconds.</param>
+void RecordTimerLateness(EventData *eventData, uint64_t missedExpiries, uint64_t latenessNs);
+
+/// <summary>
+///     Takes a snapshot of an event's metrics, e.g. to log them or to send them as telemetry.
+/// </summary>
+/// <param name="eventData">Event to query.</param>
+/// <param name="stats">Receives the metrics.</param>
+void GetEventHandlerStats(const EventData *eventData, EventHandlerStats *stats);
+
+/// <summary>
+///     Resets an event's metrics to zero, e.g. after they have been reported.
+/// </summary>
+/// <param name="eventData">Event to reset.</param>
+void ResetEventHandlerStats(EventData *eventData);
+
+/// <summary>
+///     Prints a summary of an event's metrics with Log_Debug.
+/// </summary>
+/// <param name="name">Name to identify the event in the output.</param>
+/// <param name="eventData">Event to report.</param>
+void LogEventHandlerStats(const char *name, const EventData *eventData);
+
+/// <summary>
+///     Closes a file descriptor and prints an error on failure.
+/// </summary>
+/// <param name="fd">File descriptor to close</param>
+/// <param name="name">File descriptor name to use in error message</param>
+void CloseFdAndPrintError(int fd, const char *name);
\ No newline at end of file
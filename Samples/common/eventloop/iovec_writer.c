@@ -0,0 +1,129 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include "iovec_writer.h"
+
+static int StartWaitingForOutput(IovecWriter *writer);
+static void StopWaitingForOutput(IovecWriter *writer);
+
+void IovecWriter_Init(IovecWriter *writer, int epollFd, int fd, EventData *eventData,
+                      uint32_t idleEvents)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->epollFd = epollFd;
+    writer->fd = fd;
+    writer->eventData = eventData;
+    writer->idleEvents = idleEvents;
+}
+
+int IovecWriter_Start(IovecWriter *writer, const struct iovec *buffers, size_t bufferCount)
+{
+    if (IovecWriter_IsBusy(writer)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (bufferCount > IOVEC_WRITER_MAX_BUFFERS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Leave out empty buffers, so every remaining entry has data to send.
+    writer->bufferCount = 0;
+    writer->nextBuffer = 0;
+    for (size_t i = 0; i < bufferCount; ++i) {
+        if (buffers[i].iov_len != 0) {
+            writer->buffers[writer->bufferCount++] = buffers[i];
+        }
+    }
+
+    return IovecWriter_Continue(writer);
+}
+
+int IovecWriter_Continue(IovecWriter *writer)
+{
+    while (writer->nextBuffer < writer->bufferCount) {
+        ssize_t bytesSent = writev(writer->fd, &writer->buffers[writer->nextBuffer],
+                                   (int)(writer->bufferCount - writer->nextBuffer));
+        if (bytesSent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Wait for the fd to become writable. Adding EPOLLOUT to an edge-triggered
+                // registration reports the fd straight away if it has become writable since
+                // writev was called, so the event cannot be missed.
+                return (StartWaitingForOutput(writer) == 0) ? 0 : -1;
+            }
+
+            return -1;
+        }
+
+        // Skip the buffers which were sent completely, and advance into a partial one.
+        size_t remaining = (size_t)bytesSent;
+        while (remaining > 0) {
+            struct iovec *buffer = &writer->buffers[writer->nextBuffer];
+            if (remaining < buffer->iov_len) {
+                buffer->iov_base = (uint8_t *)buffer->iov_base + remaining;
+                buffer->iov_len -= remaining;
+                break;
+            }
+
+            remaining -= buffer->iov_len;
+            ++writer->nextBuffer;
+        }
+    }
+
+    StopWaitingForOutput(writer);
+    return 1;
+}
+
+int IovecWriter_WaitForOutput(IovecWriter *writer)
+{
+    return StartWaitingForOutput(writer);
+}
+
+bool IovecWriter_IsBusy(const IovecWriter *writer)
+{
+    return writer->nextBuffer < writer->bufferCount;
+}
+
+void IovecWriter_Cancel(IovecWriter *writer)
+{
+    writer->bufferCount = 0;
+    writer->nextBuffer = 0;
+    StopWaitingForOutput(writer);
+}
+
+static int StartWaitingForOutput(IovecWriter *writer)
+{
+    if (writer->waitingForOutput) {
+        return 0;
+    }
+
+    if (RegisterPersistentEventHandlerToEpoll(writer->epollFd, writer->fd, writer->eventData,
+                                              writer->idleEvents | EPOLLOUT) != 0) {
+        return -1;
+    }
+    writer->waitingForOutput = true;
+    return 0;
+}
+
+static void StopWaitingForOutput(IovecWriter *writer)
+{
+    if (!writer->waitingForOutput) {
+        return;
+    }
+
+    // Only modify the registration if the fd is still registered, e.g. not after the owner has
+    // unregistered it to close the fd.
+    writer->waitingForOutput = false;
+    if (writer->eventData->registeredEvents != 0) {
+        RegisterPersistentEventHandlerToEpoll(writer->epollFd, writer->fd, writer->eventData,
+                                              writer->idleEvents);
+    }
+}
@@ -0,0 +1,109 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Maximum number of buffers which one <see cref="IovecWriter_Start" /> call can send.
+/// </summary>
+#define IOVEC_WRITER_MAX_BUFFERS 8
+
+/// <summary>
+/// <para>Sends a list of buffers, such as a header and a payload, to a non-blocking fd with
+/// writev, without copying them into one buffer. If the fd cannot accept all of the data, the
+/// writer remembers where it stopped, and resumes from there when the fd becomes writable.</para>
+/// <para>The fd must be registered on the epoll instance with
+/// <see cref="RegisterPersistentEventHandlerToEpoll" />. The writer only adds EPOLLOUT to the
+/// registration while it is waiting for the fd to become writable, and removes it once the data
+/// has been sent, so the handler does not get EPOLLOUT events while there is nothing to send.
+/// When the handler gets EPOLLOUT while the writer is busy, it calls
+/// <see cref="IovecWriter_Continue" />.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="IovecWriter_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Epoll instance on which the fd is registered.</summary>
+    int epollFd;
+    /// <summary>The fd to send to.</summary>
+    int fd;
+    /// <summary>Event data with which the fd is registered.</summary>
+    EventData *eventData;
+    /// <summary>Events for which the fd is registered while the writer is idle.</summary>
+    uint32_t idleEvents;
+    /// <summary>The buffers which are being sent. The first entries are advanced as data is
+    /// sent.</summary>
+    struct iovec buffers[IOVEC_WRITER_MAX_BUFFERS];
+    /// <summary>Number of entries in buffers.</summary>
+    size_t bufferCount;
+    /// <summary>Index of the first entry in buffers which has not been sent completely.</summary>
+    size_t nextBuffer;
+    /// <summary>Whether EPOLLOUT has been added to the registration.</summary>
+    bool waitingForOutput;
+} IovecWriter;
+
+/// <summary>
+///     Initializes a writer. The writer is idle.
+/// </summary>
+/// <param name="writer">The writer to initialize.</param>
+/// <param name="epollFd">Epoll instance on which the fd is registered.</param>
+/// <param name="fd">Non-blocking fd to send to.</param>
+/// <param name="eventData">Persistent event data with which the fd is registered.</param>
+/// <param name="idleEvents">Events which the fd is registered for when the writer is not
+/// waiting to send, typically EPOLLIN.</param>
+void IovecWriter_Init(IovecWriter *writer, int epollFd, int fd, EventData *eventData,
+                      uint32_t idleEvents);
+
+/// <summary>
+///     Starts to send a list of buffers. As much data as possible is sent immediately. The
+///     iovec entries are copied, but the data which they point to is not, so it must remain
+///     valid until the writer is idle again.
+/// </summary>
+/// <param name="writer">The writer, which must be idle.</param>
+/// <param name="buffers">The buffers to send, in order. Entries may have a length of zero.
+/// </param>
+/// <param name="bufferCount">Number of buffers, up to <see cref="IOVEC_WRITER_MAX_BUFFERS" />.
+/// </param>
+/// <returns>1 if all of the data was sent; 0 if the rest will be sent when the fd becomes
+/// writable; or -1 on failure, with errno set. errno is EBUSY if the writer was not idle, or
+/// EINVAL if there were too many buffers.</returns>
+int IovecWriter_Start(IovecWriter *writer, const struct iovec *buffers, size_t bufferCount);
+
+/// <summary>
+///     Sends more of the data, after the fd has become writable. It is safe to call this
+///     function when the writer is idle.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <returns>1 if all of the data has now been sent, or if the writer was idle; 0 if the writer
+/// is still waiting for the fd to become writable; or -1 on failure, with errno set.</returns>
+int IovecWriter_Continue(IovecWriter *writer);
+
+/// <summary>
+///     Adds EPOLLOUT to the fd's registration while the writer is idle, for an owner which sends
+///     to the fd by other means, such as sendfile, and has to wait for it to become writable. The
+///     event is handled as for the writer's own data: the next call to
+///     <see cref="IovecWriter_Continue" />, <see cref="IovecWriter_Start" /> or
+///     <see cref="IovecWriter_Cancel" /> which finds nothing left to send removes EPOLLOUT
+///     again.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <returns>0 on success, or -1 on failure, with errno set.</returns>
+int IovecWriter_WaitForOutput(IovecWriter *writer);
+
+/// <summary>
+///     Reports whether the writer has data which it has not yet sent.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <returns>true if the writer is waiting to send; false if it is idle.</returns>
+bool IovecWriter_IsBusy(const IovecWriter *writer);
+
+/// <summary>
+///     Abandons any data which has not been sent, and removes EPOLLOUT from the fd's
+///     registration if the writer added it. The writer is idle afterwards.
+/// </summary>
+/// <param name="writer">The writer.</param>
+void IovecWriter_Cancel(IovecWriter *writer);
@@ -0,0 +1,131 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "line_reader.h"
+
+/// <summary>
+///     Finds the first '\r' or '\n'. memchr can only search for one byte, so on NEON both are
+///     compared 16 bytes at a time.
+/// </summary>
+/// <returns>The terminator, or NULL if there is none</returns>
+static const uint8_t *FindLineEnd(const uint8_t *data, size_t length)
+{
+#if defined(__ARM_NEON)
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    const uint8x16_t lf = vdupq_n_u8('\n');
+    while (length >= 16) {
+        uint8x16_t bytes = vld1q_u8(data);
+        uint8x16_t matches = vorrq_u8(vceqq_u8(bytes, cr), vceqq_u8(bytes, lf));
+        // Narrow each byte of the comparison to 4 bits, giving a 64-bit mask with one nibble
+        // per byte, which works on both ARMv7 and AArch64.
+        uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+        if (mask != 0) {
+            return data + (__builtin_ctzll(mask) >> 2);
+        }
+        data += 16;
+        length -= 16;
+    }
+#endif
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] == '\r' || data[i] == '\n') {
+            return data + i;
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Delivers the complete lines in the buffer.
+/// </summary>
+/// <returns>false if the line handler stopped, otherwise true</returns>
+static bool DeliverLines(LineReader *reader)
+{
+    for (;;) {
+        size_t searchFrom = (reader->scanned > reader->start) ? reader->scanned : reader->start;
+        const uint8_t *end =
+            FindLineEnd(reader->buffer + searchFrom, reader->length - searchFrom);
+        if (end == NULL) {
+            reader->scanned = reader->length;
+            return true;
+        }
+
+        size_t lineStart = reader->start;
+        size_t lineLength = (size_t)(end - reader->buffer) - lineStart;
+        reader->start = lineStart + lineLength + 1;
+        reader->scanned = reader->start;
+
+        if (reader->discarding) {
+            // This is the end of an oversized line.
+            reader->discarding = false;
+        } else if (lineLength != 0) {
+            ++reader->linesReceived;
+            if (!reader->lineHandler(reader, (char *)reader->buffer + lineStart, lineLength,
+                                     reader->context)) {
+                return false;
+            }
+        }
+    }
+}
+
+void LineReader_Init(LineReader *reader, int fd, uint8_t *buffer, size_t size,
+                     LineReaderLineHandler lineHandler, void *context)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->buffer = buffer;
+    reader->size = size;
+    reader->lineHandler = lineHandler;
+    reader->context = context;
+}
+
+LineReaderResult LineReader_Read(LineReader *reader)
+{
+    for (;;) {
+        if (!DeliverLines(reader)) {
+            return LineReaderResult_Stopped;
+        }
+
+        // Move the start of an incomplete line to the start of the buffer, to make room.
+        if (reader->start != 0) {
+            memmove(reader->buffer, reader->buffer + reader->start,
+                    reader->length - reader->start);
+            reader->length -= reader->start;
+            reader->scanned -= reader->start;
+            reader->start = 0;
+        }
+
+        // Discard an incomplete line which fills the buffer, and the rest of it as it arrives.
+        if (reader->length == reader->size) {
+            if (!reader->discarding) {
+                ++reader->oversizedLines;
+                reader->discarding = true;
+            }
+            reader->length = 0;
+            reader->scanned = 0;
+        }
+
+        ssize_t received =
+            recv(reader->fd, reader->buffer + reader->length, reader->size - reader->length, 0);
+        if (received > 0) {
+            reader->length += (size_t)received;
+            reader->bytesReceived += (uint64_t)received;
+            ++reader->receiveCalls;
+        } else if (received == 0) {
+            return LineReaderResult_Closed;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return LineReaderResult_WouldBlock;
+        } else if (errno != EINTR) {
+            return LineReaderResult_Error;
+        }
+    }
+}
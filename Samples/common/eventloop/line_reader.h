@@ -0,0 +1,99 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct LineReader;
+
+/// <summary>
+///     Function which is called with each line that a <see cref="LineReader" /> receives.
+/// </summary>
+/// <param name="reader">The reader.</param>
+/// <param name="line">The line, without its terminator. It is in the reader's buffer, and can be
+/// modified in place. It stays valid until <see cref="LineReader_Read" /> is called
+/// again.</param>
+/// <param name="length">Length of the line, which is at least 1.</param>
+/// <param name="context">The context which was passed to <see cref="LineReader_Init" />.</param>
+/// <returns>true to be called with the next line; false to stop, such as while a response to
+/// this line is being sent. <see cref="LineReader_Read" /> then returns
+/// <see cref="LineReaderResult_Stopped" />, and the lines after this one stay in the buffer until
+/// it is called again.</returns>
+typedef bool (*LineReaderLineHandler)(struct LineReader *reader, char *line, size_t length,
+                                      void *context);
+
+/// <summary>
+///     Why <see cref="LineReader_Read" /> returned.
+/// </summary>
+typedef enum {
+    /// <summary>Every line which was available has been delivered, and the fd has no more data.
+    /// Call <see cref="LineReader_Read" /> again when it becomes readable.</summary>
+    LineReaderResult_WouldBlock,
+    /// <summary>The line handler returned false.</summary>
+    LineReaderResult_Stopped,
+    /// <summary>The peer closed the connection. The lines before it were delivered.</summary>
+    LineReaderResult_Closed,
+    /// <summary>recv failed, and errno is set.</summary>
+    LineReaderResult_Error
+} LineReaderResult;
+
+/// <summary>
+/// <para>Reads a line-based protocol from a non-blocking socket. Each recv receives as much as
+/// fits in the buffer rather than one byte, and the received data is searched for line
+/// terminators 16 bytes at a time. Each complete line is passed to a callback in place, without
+/// being copied, and the start of an incomplete line is then moved to the start of the
+/// buffer.</para>
+/// <para>A line ends with '\r' or '\n', so "\r\n" ends a line just once: empty lines are not
+/// delivered. A line which does not fit in the buffer is discarded, up to its terminator.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="LineReader_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct LineReader {
+    /// <summary>The socket to receive from.</summary>
+    int fd;
+    /// <summary>Buffer for received data. The longest line which is delivered is one byte
+    /// shorter than the buffer.</summary>
+    uint8_t *buffer;
+    size_t size;
+    /// <summary>Offset of the first byte which has not been delivered.</summary>
+    size_t start;
+    /// <summary>Number of bytes in the buffer.</summary>
+    size_t length;
+    /// <summary>Offset up to which the buffer has been searched for a terminator.</summary>
+    size_t scanned;
+    /// <summary>Whether the rest of an oversized line is being discarded.</summary>
+    bool discarding;
+    LineReaderLineHandler lineHandler;
+    void *context;
+    /// <summary>Number of bytes which have been received.</summary>
+    uint64_t bytesReceived;
+    /// <summary>Number of recv calls which returned data.</summary>
+    uint32_t receiveCalls;
+    /// <summary>Number of lines which were delivered.</summary>
+    uint32_t linesReceived;
+    /// <summary>Number of lines which were discarded because they did not fit.</summary>
+    uint32_t oversizedLines;
+} LineReader;
+
+/// <summary>
+///     Initializes a reader, whose buffer is empty.
+/// </summary>
+/// <param name="reader">The reader to initialize.</param>
+/// <param name="fd">Non-blocking socket to receive from.</param>
+/// <param name="buffer">Buffer for received data, which must remain valid while the reader is
+/// used. It must be at least 2 bytes long.</param>
+/// <param name="size">Size of the buffer.</param>
+/// <param name="lineHandler">Function which is called with each line.</param>
+/// <param name="context">Value which is passed to lineHandler.</param>
+void LineReader_Init(LineReader *reader, int fd, uint8_t *buffer, size_t size,
+                     LineReaderLineHandler lineHandler, void *context);
+
+/// <summary>
+///     Delivers the lines which are in the buffer, then receives until the socket has no more
+///     data, delivering every complete line, unless the line handler stops.
+/// </summary>
+/// <param name="reader">The reader.</param>
+/// <returns>Why the reader stopped.</returns>
+LineReaderResult LineReader_Read(LineReader *reader);
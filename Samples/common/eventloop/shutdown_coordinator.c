@@ -0,0 +1,119 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include <applibs/log.h>
+#include "shutdown_coordinator.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_MS 1000000ULL
+
+// Longest time to wait for I/O before calling the waiting hooks again, in case the I/O which
+// they are waiting for completes without an event, such as a timed-out request.
+#define SHUTDOWN_POLL_INTERVAL_MS 50
+
+static uint64_t GetCurrentTimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t TimespecToNs(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * NS_PER_SEC + (uint64_t)ts->tv_nsec;
+}
+
+void ShutdownCoordinator_Init(ShutdownCoordinator *coordinator,
+                              const struct timespec *gracePeriod)
+{
+    memset(coordinator, 0, sizeof(*coordinator));
+    coordinator->gracePeriod = *gracePeriod;
+}
+
+void ShutdownCoordinator_AddHook(ShutdownCoordinator *coordinator, ShutdownHook *hook)
+{
+    hook->calls = 0;
+    hook->isDone = false;
+    hook->next = NULL;
+    if (coordinator->tail != NULL) {
+        coordinator->tail->next = hook;
+    } else {
+        coordinator->head = hook;
+    }
+    coordinator->tail = hook;
+}
+
+int ShutdownCoordinator_Drain(ShutdownCoordinator *coordinator, int epollFd)
+{
+    uint64_t startNs = GetCurrentTimeNs();
+    uint64_t graceNs = TimespecToNs(&coordinator->gracePeriod);
+    coordinator->finishedHooks = 0;
+    coordinator->abandonedHooks = 0;
+
+    for (;;) {
+        uint64_t elapsedNs = GetCurrentTimeNs() - startNs;
+        uint64_t nextDeadlineNs = graceNs;
+        bool waiting = false;
+
+        // Each hook is only called once the hooks before it have finished, so that a hook which
+        // passes data to a later one, such as a batch which is saved to storage, runs first.
+        for (ShutdownHook *hook = coordinator->head; hook != NULL && !waiting; hook = hook->next) {
+            if (hook->isDone) {
+                continue;
+            }
+
+            uint64_t deadlineNs = TimespecToNs(&hook->deadline);
+            if (deadlineNs > graceNs) {
+                deadlineNs = graceNs;
+            }
+            if (elapsedNs >= deadlineNs) {
+                Log_Debug("WARNING: Shutdown hook '%s' did not finish within %llu ms.\n",
+                          hook->name, (unsigned long long)(deadlineNs / NS_PER_MS));
+                hook->isDone = true;
+                ++coordinator->abandonedHooks;
+                continue;
+            }
+
+            bool finished = hook->handler(hook);
+            ++hook->calls;
+            if (finished) {
+                Log_Debug("INFO: Shutdown hook '%s' finished after %llu ms.\n", hook->name,
+                          (unsigned long long)((GetCurrentTimeNs() - startNs) / NS_PER_MS));
+                hook->isDone = true;
+                ++coordinator->finishedHooks;
+            } else {
+                waiting = true;
+                nextDeadlineNs = deadlineNs;
+            }
+        }
+
+        if (!waiting) {
+            break;
+        }
+
+        // Run the event loop until the hook's deadline, so that the I/O which it is waiting for
+        // can complete, and then call it again.
+        elapsedNs = GetCurrentTimeNs() - startNs;
+        uint64_t timeoutMs =
+            (nextDeadlineNs > elapsedNs) ? (nextDeadlineNs - elapsedNs + NS_PER_MS - 1) / NS_PER_MS
+                                         : 0;
+        if (timeoutMs > SHUTDOWN_POLL_INTERVAL_MS) {
+            timeoutMs = SHUTDOWN_POLL_INTERVAL_MS;
+        }
+        if (WaitForEventsAndCallHandlers(epollFd, EPOLL_MAX_EVENTS_PER_WAIT, (int)timeoutMs,
+                                         NULL) < 0) {
+            // The event loop has failed, so the I/O which the remaining hooks are waiting for
+            // cannot complete.
+            for (ShutdownHook *hook = coordinator->head; hook != NULL; hook = hook->next) {
+                if (!hook->isDone) {
+                    hook->isDone = true;
+                    ++coordinator->abandonedHooks;
+                }
+            }
+            break;
+        }
+    }
+
+    return coordinator->abandonedHooks == 0 ? 0 : -1;
+}
@@ -0,0 +1,99 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>
+///     How long an application has to exit after SIGTERM, including when a final update is
+///     about to be applied, before it is killed.
+/// </summary>
+#define SHUTDOWN_GRACE_PERIOD_SECONDS 10
+
+struct ShutdownHook;
+
+/// <summary>
+///     Flushes a module's data before the application exits. The hook is called again after the
+///     event loop has run, until it returns true or its deadline passes, so a hook which waits
+///     for I/O, such as a message being acknowledged, starts the I/O on its first call and
+///     returns false until the I/O completes.
+/// </summary>
+/// <param name="hook">The hook, whose calls member counts the earlier calls.</param>
+/// <returns>true when the data has been flushed, or false to be called again</returns>
+typedef bool (*ShutdownHookHandler)(struct ShutdownHook *hook);
+
+/// <summary>
+/// <para>A module's flush hook, which is registered with
+/// <see cref="ShutdownCoordinator_AddHook" />.</para>
+/// <para>The caller allocates this struct and populates name, handler, context and deadline.
+/// The struct must remain valid until the coordinator has been drained. The remaining members
+/// are managed by the coordinator and must not be modified by the caller.</para>
+/// </summary>
+typedef struct ShutdownHook {
+    /// <summary>Name of the hook, which is logged.</summary>
+    const char *name;
+    ShutdownHookHandler handler;
+    void *context;
+    /// <summary>Time after the shutdown starts by which the hook must finish. A hook which
+    /// has not finished then is abandoned, and the next hook is called.</summary>
+    struct timespec deadline;
+    /// <summary>Number of times the hook has been called.</summary>
+    uint32_t calls;
+    /// <summary>Whether the hook has returned true.</summary>
+    bool isDone;
+    struct ShutdownHook *next;
+} ShutdownHook;
+
+/// <summary>
+/// <para>Runs the modules' flush hooks when the application is shutting down, such as after
+/// SIGTERM or a final update event, so that buffered telemetry, uncommitted changes and
+/// in-flight transfers are not lost. The hooks run one after the other, in the order in which
+/// they were registered. <see cref="ShutdownCoordinator_Drain" /> keeps running the event loop
+/// while a hook is waiting for I/O, until every hook has finished or its deadline has passed,
+/// and always returns within the grace period.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="ShutdownCoordinator_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    ShutdownHook *head;
+    ShutdownHook *tail;
+    /// <summary>Time after the shutdown starts by which every hook must finish.</summary>
+    struct timespec gracePeriod;
+    /// <summary>Number of hooks which finished, and which were abandoned at their
+    /// deadline, the last time the coordinator was drained.</summary>
+    uint32_t finishedHooks;
+    uint32_t abandonedHooks;
+} ShutdownCoordinator;
+
+/// <summary>
+///     Initializes a coordinator with no hooks.
+/// </summary>
+/// <param name="coordinator">Coordinator to initialize.</param>
+/// <param name="gracePeriod">Time after the shutdown starts by which every hook must finish,
+/// which must leave time for the application to close its handlers and exit within
+/// SHUTDOWN_GRACE_PERIOD_SECONDS.</param>
+void ShutdownCoordinator_Init(ShutdownCoordinator *coordinator,
+                              const struct timespec *gracePeriod);
+
+/// <summary>
+///     Registers a flush hook. Each hook is called once the hooks which were registered before
+///     it have finished, so register a module which feeds another, such as a batcher whose
+///     messages are saved to storage, before it. The deadlines are measured from the start of
+///     the shutdown, so a later hook should have a later deadline.
+/// </summary>
+/// <param name="coordinator">The coordinator.</param>
+/// <param name="hook">Hook to register.</param>
+void ShutdownCoordinator_AddHook(ShutdownCoordinator *coordinator, ShutdownHook *hook);
+
+/// <summary>
+///     Calls the hooks and runs the event loop until every hook has finished, or its deadline
+///     has passed. Call this after the main loop exits, and before the handlers are closed.
+/// </summary>
+/// <param name="coordinator">The coordinator.</param>
+/// <param name="epollFd">Epoll on which the modules' handlers are registered.</param>
+/// <returns>0 if every hook finished, or -1 if any was abandoned</returns>
+int ShutdownCoordinator_Drain(ShutdownCoordinator *coordinator, int epollFd);
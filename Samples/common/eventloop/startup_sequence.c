@@ -0,0 +1,284 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include <applibs/log.h>
+#include "startup_sequence.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_US 1000ULL
+
+static void StartupTimerEventHandler(EventData *eventData);
+
+static uint64_t GetCurrentTimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t GetElapsedNs(const StartupSequence *sequence)
+{
+    return GetCurrentTimeNs() - sequence->startNs;
+}
+
+static bool IsFinished(const StartupStep *step)
+{
+    return step->state == StartupStepState_Done || step->state == StartupStepState_Failed;
+}
+
+/// <summary>
+///     Whether a step may be called at elapsedNs: it has not finished, the step which it comes
+///     after has finished, and it has not been started or its retry is due.
+/// </summary>
+static bool IsDue(const StartupStep *step, uint64_t elapsedNs)
+{
+    if (IsFinished(step) || (step->after != NULL && step->after->state != StartupStepState_Done)) {
+        return false;
+    }
+    return step->state == StartupStepState_NotStarted || step->retryNs <= elapsedNs;
+}
+
+/// <summary>
+///     Calls a step's handler, and records the result.
+/// </summary>
+/// <returns>true if the step finished or failed, which may let other steps start</returns>
+static bool RunStep(StartupSequence *sequence, StartupStep *step)
+{
+    uint64_t startNs = GetElapsedNs(sequence);
+    if (step->state == StartupStepState_NotStarted) {
+        step->startNs = startNs;
+    }
+
+    StartupStepResult result = step->handler(step);
+    ++step->calls;
+    uint64_t endNs = GetElapsedNs(sequence);
+
+    switch (result) {
+    case StartupStepResult_Pending:
+        step->state = StartupStepState_Pending;
+        step->retryNs = endNs + (uint64_t)step->retryDelay.tv_sec * NS_PER_SEC +
+                        (uint64_t)step->retryDelay.tv_nsec;
+        return false;
+    case StartupStepResult_Done:
+        step->state = StartupStepState_Done;
+        step->endNs = endNs;
+        return true;
+    default:
+        Log_Debug("ERROR: Startup step '%s' failed.\n", step->name);
+        step->state = StartupStepState_Failed;
+        step->endNs = endNs;
+        return true;
+    }
+}
+
+/// <summary>
+///     Marks the steps which come after a failed step as failed, as they cannot start.
+/// </summary>
+/// <returns>true if any step was marked</returns>
+static bool FailDependentSteps(StartupSequence *sequence)
+{
+    bool changed = false;
+    for (StartupStep *step = sequence->head; step != NULL; step = step->next) {
+        if (!IsFinished(step) && step->after != NULL &&
+            step->after->state == StartupStepState_Failed) {
+            Log_Debug("ERROR: Startup step '%s' was not run, as '%s' failed.\n", step->name,
+                      step->after->name);
+            step->state = StartupStepState_Failed;
+            step->startNs = step->endNs = GetElapsedNs(sequence);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/// <summary>
+///     Calls the ready handler once every critical step has finished, or one has failed.
+/// </summary>
+static void CheckReady(StartupSequence *sequence)
+{
+    if (sequence->isReady || sequence->hasFailed) {
+        return;
+    }
+
+    bool allDone = true;
+    for (const StartupStep *step = sequence->head; step != NULL; step = step->next) {
+        if (!step->isCritical) {
+            continue;
+        }
+        if (step->state == StartupStepState_Failed) {
+            sequence->hasFailed = true;
+            Log_Debug("ERROR: Startup failed after %llu ms, in step '%s'.\n",
+                      (unsigned long long)(GetElapsedNs(sequence) / NS_PER_MS), step->name);
+            sequence->readyHandler(sequence, -1);
+            return;
+        }
+        allDone = allDone && step->state == StartupStepState_Done;
+    }
+
+    if (allDone) {
+        sequence->isReady = true;
+        sequence->readyNs = GetElapsedNs(sequence);
+        Log_Debug("INFO: Ready after %llu ms.\n",
+                  (unsigned long long)(sequence->readyNs / NS_PER_MS));
+        sequence->readyHandler(sequence, 0);
+    }
+}
+
+/// <summary>
+///     Calls the critical steps which are due, in the order in which they were added, until
+///     none of them can make progress. If allowBackground is set and the application is ready,
+///     one background step is called as well.
+/// </summary>
+static void RunDueSteps(StartupSequence *sequence, bool allowBackground)
+{
+    bool progress;
+    do {
+        progress = false;
+        uint64_t elapsedNs = GetElapsedNs(sequence);
+        for (StartupStep *step = sequence->head; step != NULL; step = step->next) {
+            if (!IsDue(step, elapsedNs)) {
+                continue;
+            }
+            if (!step->isCritical) {
+                // Only one background step runs per wakeup, so that the event handlers are not
+                // held up while several peripherals are opened.
+                if (!allowBackground || !sequence->isReady) {
+                    continue;
+                }
+                allowBackground = false;
+            }
+            progress = RunStep(sequence, step) || progress;
+        }
+        progress = FailDependentSteps(sequence) || progress;
+        CheckReady(sequence);
+    } while (progress && !sequence->hasFailed);
+}
+
+/// <summary>
+///     Arms the timer for the earliest step which is due: a waiting step's retry, or, once the
+///     application is ready, a background step which has not started.
+/// </summary>
+static void ArmTimer(StartupSequence *sequence)
+{
+    if (sequence->hasFailed) {
+        return;
+    }
+
+    bool anyDue = false;
+    uint64_t earliestNs = 0;
+    for (const StartupStep *step = sequence->head; step != NULL; step = step->next) {
+        if (IsFinished(step) ||
+            (step->after != NULL && step->after->state != StartupStepState_Done) ||
+            (!step->isCritical && !sequence->isReady)) {
+            continue;
+        }
+        uint64_t dueNs = (step->state == StartupStepState_Pending) ? step->retryNs : 0;
+        if (!anyDue || dueNs < earliestNs) {
+            earliestNs = dueNs;
+            anyDue = true;
+        }
+    }
+    if (!anyDue) {
+        return;
+    }
+
+    uint64_t elapsedNs = GetElapsedNs(sequence);
+    uint64_t delayNs = (earliestNs > elapsedNs) ? earliestNs - elapsedNs : 1;
+    struct timespec delay = {.tv_sec = (time_t)(delayNs / NS_PER_SEC),
+                             .tv_nsec = (long)(delayNs % NS_PER_SEC)};
+    if (SetTimerFdToSingleExpiry(sequence->timerFd, &delay) != 0) {
+        Log_Debug("ERROR: Could not arm the startup timer.\n");
+    }
+}
+
+static void StartupTimerEventHandler(EventData *eventData)
+{
+    StartupSequence *sequence = (StartupSequence *)eventData;
+    if (ConsumeTimerFdEvent(sequence->timerFd) != 0) {
+        return;
+    }
+    RunDueSteps(sequence, true);
+    ArmTimer(sequence);
+}
+
+int StartupSequence_Init(StartupSequence *sequence, int epollFd,
+                         StartupReadyHandler readyHandler)
+{
+    memset(sequence, 0, sizeof(*sequence));
+    sequence->startNs = GetCurrentTimeNs();
+    sequence->readyHandler = readyHandler;
+    sequence->timerEventData.eventHandler = &StartupTimerEventHandler;
+
+    static const struct timespec disarmed = {0, 0};
+    sequence->timerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &sequence->timerEventData, EPOLLIN);
+    return sequence->timerFd < 0 ? -1 : 0;
+}
+
+void StartupSequence_AddStep(StartupSequence *sequence, StartupStep *step)
+{
+    step->state = StartupStepState_NotStarted;
+    step->calls = 0;
+    step->startNs = step->endNs = step->retryNs = 0;
+    step->next = NULL;
+    if (sequence->tail != NULL) {
+        sequence->tail->next = step;
+    } else {
+        sequence->head = step;
+    }
+    sequence->tail = step;
+}
+
+int StartupSequence_Start(StartupSequence *sequence)
+{
+    RunDueSteps(sequence, false);
+    ArmTimer(sequence);
+    return sequence->hasFailed ? -1 : 0;
+}
+
+StartupStepState StartupSequence_Require(StartupSequence *sequence, StartupStep *step)
+{
+    if (IsDue(step, GetElapsedNs(sequence))) {
+        if (RunStep(sequence, step)) {
+            // Steps which come after this one may be able to start now.
+            FailDependentSteps(sequence);
+            CheckReady(sequence);
+            ArmTimer(sequence);
+        }
+    }
+    return step->state;
+}
+
+void StartupSequence_LogTrace(const StartupSequence *sequence)
+{
+    static const char *const stateNames[] = {"not started", "pending", "done", "failed"};
+
+    if (sequence->isReady) {
+        Log_Debug("INFO: Startup trace; ready after %llu.%03llu ms:\n",
+                  (unsigned long long)(sequence->readyNs / NS_PER_MS),
+                  (unsigned long long)(sequence->readyNs / NS_PER_US % 1000));
+    } else {
+        Log_Debug("INFO: Startup trace; not ready:\n");
+    }
+    for (const StartupStep *step = sequence->head; step != NULL; step = step->next) {
+        uint64_t durationNs = IsFinished(step) ? step->endNs - step->startNs : 0;
+        Log_Debug("INFO:   %-16s %s%s, started at %llu.%03llu ms, took %llu.%03llu ms in %u "
+                  "call(s).\n",
+                  step->name, stateNames[step->state], step->isCritical ? "" : " (background)",
+                  (unsigned long long)(step->startNs / NS_PER_MS),
+                  (unsigned long long)(step->startNs / NS_PER_US % 1000),
+                  (unsigned long long)(durationNs / NS_PER_MS),
+                  (unsigned long long)(durationNs / NS_PER_US % 1000), step->calls);
+    }
+}
+
+void StartupSequence_Close(StartupSequence *sequence)
+{
+    // A zero-initialized sequence has fd 0, which it does not own.
+    if (sequence->timerEventData.eventHandler != NULL) {
+        CloseFdAndPrintError(sequence->timerFd, "StartupTimer");
+    }
+    sequence->timerFd = -1;
+}
@@ -0,0 +1,170 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+
+struct StartupStep;
+struct StartupSequence;
+
+/// <summary>
+///     Result of a call to a <see cref="StartupStepHandler" />.
+/// </summary>
+typedef enum {
+    /// <summary>The step failed, and the steps which come after it are not run.</summary>
+    StartupStepResult_Failed = -1,
+    /// <summary>The step has finished.</summary>
+    StartupStepResult_Done = 0,
+    /// <summary>The step is waiting, such as for a device to come out of reset, and is called
+    /// again after its retryDelay.</summary>
+    StartupStepResult_Pending = 1
+} StartupStepResult;
+
+/// <summary>
+///     State of a <see cref="StartupStep" />.
+/// </summary>
+typedef enum {
+    StartupStepState_NotStarted,
+    StartupStepState_Pending,
+    StartupStepState_Done,
+    StartupStepState_Failed
+} StartupStepState;
+
+/// <summary>
+///     Runs one step of the application's initialization, such as opening a peripheral. A step
+///     which has to wait must not sleep: it returns <see cref="StartupStepResult_Pending" />, and
+///     is called again from the event loop after its retryDelay, so that the other steps and
+///     the event handlers run in the meantime.
+/// </summary>
+/// <param name="step">The step, whose calls member counts the earlier calls.</param>
+/// <returns>Whether the step has finished, is waiting or has failed</returns>
+typedef StartupStepResult (*StartupStepHandler)(struct StartupStep *step);
+
+/// <summary>
+///     Called once, when every critical step has finished, or when one of them has failed.
+/// </summary>
+/// <param name="sequence">The sequence.</param>
+/// <param name="result">0 if the application is ready, or -1 if a critical step failed</param>
+typedef void (*StartupReadyHandler)(struct StartupSequence *sequence, int result);
+
+/// <summary>
+/// <para>One step of a <see cref="StartupSequence" />, which is added with
+/// <see cref="StartupSequence_AddStep" />.</para>
+/// <para>The caller allocates this struct and populates name, handler, context, isCritical,
+/// after and retryDelay. The handler may change retryDelay before it returns
+/// <see cref="StartupStepResult_Pending" />. The struct must remain valid until the sequence is
+/// closed. The remaining members are managed by the sequence and must not be modified by the
+/// caller.</para>
+/// </summary>
+typedef struct StartupStep {
+    /// <summary>Name of the step, which is logged in the trace.</summary>
+    const char *name;
+    StartupStepHandler handler;
+    void *context;
+    /// <summary>Whether the application is only ready once this step has finished. The other
+    /// steps run in the background once the application is ready, one per event loop wakeup,
+    /// or sooner if they are needed, with <see cref="StartupSequence_Require" />.</summary>
+    bool isCritical;
+    /// <summary>Step which must finish before this one starts, or NULL. Steps which do not
+    /// depend on each other are interleaved while they wait.</summary>
+    struct StartupStep *after;
+    /// <summary>How long to wait before calling a pending step again.</summary>
+    struct timespec retryDelay;
+
+    StartupStepState state;
+    /// <summary>Number of times the handler has been called.</summary>
+    uint32_t calls;
+    /// <summary>When the step was first called and when it finished or failed, in
+    /// nanoseconds after the sequence started.</summary>
+    uint64_t startNs;
+    uint64_t endNs;
+    /// <summary>When a pending step is called again, in nanoseconds after the sequence
+    /// started.</summary>
+    uint64_t retryNs;
+    struct StartupStep *next;
+} StartupStep;
+
+/// <summary>
+/// <para>Runs the steps which initialize an application, and records how long each took and
+/// how long the application took to become ready, so that a slow step can be found when the
+/// application has to be ready within a watchdog window, such as after an update.</para>
+/// <para>The critical steps are started by <see cref="StartupSequence_Start" />. Steps which
+/// do not wait finish at once, in the order in which they were added, and steps which wait
+/// are called again from a timer, so the event loop runs while they wait and several waits
+/// overlap. The other steps, such as opening a peripheral which is used rarely, run once the
+/// application is ready.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="StartupSequence_Init" /> and disposes of it with
+/// <see cref="StartupSequence_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct StartupSequence {
+    /// <summary>Event data for the timer which calls the waiting and background steps. This
+    /// must be the first member, so that the timer's handler can find the sequence.</summary>
+    EventData timerEventData;
+    int timerFd;
+    StartupReadyHandler readyHandler;
+    StartupStep *head;
+    StartupStep *tail;
+    /// <summary>When the sequence was initialized, from CLOCK_MONOTONIC, in
+    /// nanoseconds.</summary>
+    uint64_t startNs;
+    /// <summary>When the last critical step finished, in nanoseconds after the sequence
+    /// started.</summary>
+    uint64_t readyNs;
+    bool isReady;
+    bool hasFailed;
+} StartupSequence;
+
+/// <summary>
+///     Initializes a sequence with no steps, and creates its timer, which is not armed. Call
+///     this as early as possible, as the times in the trace are measured from it.
+/// </summary>
+/// <param name="sequence">Sequence to initialize.</param>
+/// <param name="epollFd">Epoll on which the timer is registered.</param>
+/// <param name="readyHandler">Called when the critical steps have finished, or one has
+/// failed.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int StartupSequence_Init(StartupSequence *sequence, int epollFd,
+                         StartupReadyHandler readyHandler);
+
+/// <summary>
+///     Adds a step. Add the steps before starting the sequence.
+/// </summary>
+/// <param name="sequence">The sequence.</param>
+/// <param name="step">Step to add.</param>
+void StartupSequence_AddStep(StartupSequence *sequence, StartupStep *step);
+
+/// <summary>
+///     Runs the critical steps which can run now. If none of them waits, the ready handler is
+///     called before this function returns.
+/// </summary>
+/// <param name="sequence">The sequence.</param>
+/// <returns>0 on success, or -1 if a critical step failed</returns>
+int StartupSequence_Start(StartupSequence *sequence);
+
+/// <summary>
+///     Runs a background step at once if it has not been run yet, such as when the peripheral
+///     which it opens is first used. A step which is waiting for another step, or whose retry
+///     is not due, is not called.
+/// </summary>
+/// <param name="sequence">The sequence.</param>
+/// <param name="step">The step.</param>
+/// <returns>The state of the step</returns>
+StartupStepState StartupSequence_Require(StartupSequence *sequence, StartupStep *step);
+
+/// <summary>
+///     Logs how long each step took, and how long the application took to become ready.
+/// </summary>
+/// <param name="sequence">The sequence.</param>
+void StartupSequence_LogTrace(const StartupSequence *sequence);
+
+/// <summary>
+///     Closes the timer. Steps which have not finished are not called again. It is safe to call
+///     this function on a sequence which has been zero-initialized.
+/// </summary>
+/// <param name="sequence">The sequence.</param>
+void StartupSequence_Close(StartupSequence *sequence);
@@ -0,0 +1,477 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <applibs/log.h>
+#include "timer_wheel.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define SLOT_MASK (TIMER_WHEEL_SLOT_COUNT - 1)
+#define LEVEL_SHIFT(level) ((level)*TIMER_WHEEL_SLOT_BITS)
+#define WHEEL_RANGE_TICKS (1ULL << LEVEL_SHIFT(TIMER_WHEEL_LEVEL_COUNT))
+#define NO_TICK UINT64_MAX
+
+static void TimerWheelEventHandler(EventData *eventData);
+static uint64_t GetCurrentTimeNs(void);
+static uint64_t GetCurrentTick(const TimerWheel *wheel);
+static uint64_t TimespecToTicks(const TimerWheel *wheel, const struct timespec *ts);
+static uint64_t RotateRight64(uint64_t value, unsigned int count);
+static uint64_t InsertTimer(TimerWheel *wheel, TimerWheelTimer *timer);
+static void UnlinkTimer(TimerWheel *wheel, TimerWheelTimer *timer);
+static void CascadeSlot(TimerWheel *wheel, unsigned int level, unsigned int slot);
+static uint64_t GetNextEventTick(const TimerWheel *wheel);
+static uint64_t GetNextExpiryTick(const TimerWheel *wheel);
+static uint64_t AddSlack(const TimerWheelTimer *timer, uint64_t dueTick);
+static void ProcessTick(TimerWheel *wheel, uint64_t dispatchTick);
+static void AdvanceWheel(TimerWheel *wheel, uint64_t targetTick);
+static int ArmTimerFdForTick(TimerWheel *wheel, uint64_t tick);
+static int ArmTimer(TimerWheel *wheel, TimerWheelTimer *timer, uint64_t delayTicks,
+                    uint64_t periodTicks);
+
+int TimerWheel_Init(TimerWheel *wheel, int epollFd, const struct timespec *resolution)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->epollFd = epollFd;
+    wheel->timerFd = -1;
+    wheel->armedTick = NO_TICK;
+    wheel->timerFdEventData.eventHandler = &TimerWheelEventHandler;
+
+    wheel->tickNs = (uint64_t)resolution->tv_sec * NS_PER_SEC + (uint64_t)resolution->tv_nsec;
+    if (wheel->tickNs == 0) {
+        Log_Debug("ERROR: Timer wheel resolution must be greater than zero.\n");
+        return -1;
+    }
+    wheel->baseNs = GetCurrentTimeNs();
+
+    // The timerfd is created disarmed; it is only armed while there is a timer to expire.
+    wheel->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (wheel->timerFd < 0) {
+        Log_Debug("ERROR: Could not create timerfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, wheel->timerFd, &wheel->timerFdEventData, EPOLLIN) !=
+        0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void TimerWheel_Close(TimerWheel *wheel)
+{
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVEL_COUNT; ++level) {
+        for (unsigned int slot = 0; slot < TIMER_WHEEL_SLOT_COUNT; ++slot) {
+            for (TimerWheelTimer *timer = wheel->slots[level][slot]; timer != NULL;
+                 timer = timer->next) {
+                timer->isArmed = false;
+            }
+            wheel->slots[level][slot] = NULL;
+        }
+        wheel->occupied[level] = 0;
+    }
+    wheel->armedCount = 0;
+
+    CloseFdAndPrintError(wheel->timerFd, "TimerWheel");
+    wheel->timerFd = -1;
+}
+
+int TimerWheel_SetTimerToPeriod(TimerWheel *wheel, TimerWheelTimer *timer,
+                                const struct timespec *period)
+{
+    uint64_t periodTicks = TimespecToTicks(wheel, period);
+    return ArmTimer(wheel, timer, periodTicks, periodTicks);
+}
+
+int TimerWheel_SetTimerToSingleExpiry(TimerWheel *wheel, TimerWheelTimer *timer,
+                                      const struct timespec *expiry)
+{
+    return ArmTimer(wheel, timer, TimespecToTicks(wheel, expiry), /* periodTicks */ 0);
+}
+
+void TimerWheel_SetTimerCatchUpPolicy(TimerWheelTimer *timer, TimerWheelCatchUpPolicy policy,
+                                      uint32_t maxCatchUpCalls)
+{
+    timer->catchUpPolicy = policy;
+    timer->maxCatchUpCalls = maxCatchUpCalls;
+}
+
+void TimerWheel_SetTimerSlack(const TimerWheel *wheel, TimerWheelTimer *timer,
+                              const struct timespec *slack)
+{
+    uint64_t slackNs = (uint64_t)slack->tv_sec * NS_PER_SEC + (uint64_t)slack->tv_nsec;
+    timer->slackTicks = slackNs / wheel->tickNs;
+}
+
+void TimerWheel_CancelTimer(TimerWheel *wheel, TimerWheelTimer *timer)
+{
+    if (!timer->isArmed) {
+        return;
+    }
+
+    // The timerfd is left armed. If it fires before another timer is due, the wheel finds
+    // nothing to dispatch and re-arms it for the next deadline.
+    UnlinkTimer(wheel, timer);
+    timer->isArmed = false;
+    --wheel->armedCount;
+}
+
+bool TimerWheel_IsTimerArmed(const TimerWheelTimer *timer)
+{
+    return timer->isArmed;
+}
+
+static int ArmTimer(TimerWheel *wheel, TimerWheelTimer *timer, uint64_t delayTicks,
+                    uint64_t periodTicks)
+{
+    TimerWheel_CancelTimer(wheel, timer);
+
+    uint64_t nowTick = GetCurrentTick(wheel);
+
+    // If the wheel is empty there is nothing to expire between the last processed tick and
+    // now, so move straight to the current time.
+    if (wheel->armedCount == 0 && !wheel->isDispatching && nowTick > wheel->currentTick) {
+        wheel->currentTick = nowTick;
+    }
+
+    timer->periodTicks = periodTicks;
+    uint64_t dueTick = nowTick + delayTicks;
+    uint64_t expiryTick = AddSlack(timer, dueTick);
+    // While dispatching, the current tick's slot is being drained, so a timer armed from a
+    // handler must expire on a later tick.
+    uint64_t earliestTick = wheel->currentTick + (wheel->isDispatching ? 1 : 0);
+    if (expiryTick < earliestTick) {
+        expiryTick = earliestTick;
+    }
+
+    timer->dueTick = dueTick;
+    timer->expiryTick = expiryTick;
+    timer->eventData.fd = wheel->timerFd;
+    timer->isArmed = true;
+    ++wheel->armedCount;
+    uint64_t wakeTick = InsertTimer(wheel, timer);
+
+    // The timerfd is re-armed once dispatching completes, so only touch it here if this timer
+    // needs the wheel to wake earlier than currently planned.
+    if (!wheel->isDispatching && wakeTick < wheel->armedTick) {
+        return ArmTimerFdForTick(wheel, wakeTick);
+    }
+
+    return 0;
+}
+
+/// <summary>
+///     Places a timer in the slot which matches its expiry tick.
+/// </summary>
+/// <returns>The tick on which the wheel must wake for the timer: its expiry tick, or, for a
+/// timer beyond the range of the wheel, the tick on which it is placed again.</returns>
+static uint64_t InsertTimer(TimerWheel *wheel, TimerWheelTimer *timer)
+{
+    uint64_t delta = timer->expiryTick - wheel->currentTick;
+    uint64_t placementTick = timer->expiryTick;
+
+    unsigned int level = 0;
+    while (level < TIMER_WHEEL_LEVEL_COUNT - 1 && delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+        ++level;
+    }
+
+    // Timers beyond the range of the wheel are parked in the furthest slot, and are placed
+    // again when that slot is cascaded.
+    if (delta >= WHEEL_RANGE_TICKS) {
+        placementTick = wheel->currentTick + WHEEL_RANGE_TICKS - 1;
+    }
+
+    unsigned int slot = (unsigned int)(placementTick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+    timer->prev = NULL;
+    timer->next = wheel->slots[level][slot];
+    if (timer->next != NULL) {
+        timer->next->prev = timer;
+    }
+    wheel->slots[level][slot] = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+
+    if (placementTick == timer->expiryTick) {
+        return timer->expiryTick;
+    }
+    return (placementTick >> LEVEL_SHIFT(level)) << LEVEL_SHIFT(level);
+}
+
+static void UnlinkTimer(TimerWheel *wheel, TimerWheelTimer *timer)
+{
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel->slots[timer->level][timer->slot] = timer->next;
+    }
+
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+
+    if (wheel->slots[timer->level][timer->slot] == NULL) {
+        wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void CascadeSlot(TimerWheel *wheel, unsigned int level, unsigned int slot)
+{
+    TimerWheelTimer *timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ULL << slot);
+
+    while (timer != NULL) {
+        TimerWheelTimer *next = timer->next;
+        InsertTimer(wheel, timer);
+        timer = next;
+    }
+}
+
+/// <summary>
+///     Finds the earliest tick on which the wheel has work to do: either a level 0 timer
+///     expires, or a higher level slot which contains timers must be cascaded.
+/// </summary>
+static uint64_t GetNextEventTick(const TimerWheel *wheel)
+{
+    uint64_t nextTick = NO_TICK;
+    uint64_t currentTick = wheel->currentTick;
+
+    if (wheel->occupied[0] != 0) {
+        uint64_t rotated = RotateRight64(wheel->occupied[0], currentTick & SLOT_MASK);
+        nextTick = currentTick + (uint64_t)__builtin_ctzll(rotated);
+    }
+
+    for (unsigned int level = 1; level < TIMER_WHEEL_LEVEL_COUNT; ++level) {
+        if (wheel->occupied[level] == 0) {
+            continue;
+        }
+
+        // The first slot to consider is the one which is cascaded on or after the current
+        // tick, which includes the current tick itself if it is aligned to this level.
+        uint64_t levelMask = (1ULL << LEVEL_SHIFT(level)) - 1;
+        uint64_t firstBlock = (currentTick + levelMask) >> LEVEL_SHIFT(level);
+        uint64_t rotated = RotateRight64(wheel->occupied[level], firstBlock & SLOT_MASK);
+        uint64_t cascadeTick = (firstBlock + (uint64_t)__builtin_ctzll(rotated))
+                               << LEVEL_SHIFT(level);
+        if (cascadeTick < nextTick) {
+            nextTick = cascadeTick;
+        }
+    }
+
+    return nextTick;
+}
+
+/// <summary>
+///     Finds the earliest tick on which a timer expires, so the wheel only wakes when there is a
+///     handler to call. Slots which must be cascaded before then are cascaded on that wakeup.
+///     Only the first occupied slot on each level needs to be searched, because every timer in
+///     a later slot expires after the timers in it.
+/// </summary>
+static uint64_t GetNextExpiryTick(const TimerWheel *wheel)
+{
+    uint64_t nextTick = NO_TICK;
+    uint64_t currentTick = wheel->currentTick;
+
+    // A level 0 slot only holds timers which expire on its tick.
+    if (wheel->occupied[0] != 0) {
+        uint64_t rotated = RotateRight64(wheel->occupied[0], currentTick & SLOT_MASK);
+        nextTick = currentTick + (uint64_t)__builtin_ctzll(rotated);
+    }
+
+    for (unsigned int level = 1; level < TIMER_WHEEL_LEVEL_COUNT; ++level) {
+        if (wheel->occupied[level] == 0) {
+            continue;
+        }
+
+        uint64_t levelMask = (1ULL << LEVEL_SHIFT(level)) - 1;
+        uint64_t firstBlock = (currentTick + levelMask) >> LEVEL_SHIFT(level);
+        uint64_t rotated = RotateRight64(wheel->occupied[level], firstBlock & SLOT_MASK);
+        uint64_t block = firstBlock + (uint64_t)__builtin_ctzll(rotated);
+        uint64_t cascadeTick = block << LEVEL_SHIFT(level);
+
+        for (const TimerWheelTimer *timer = wheel->slots[level][block & SLOT_MASK];
+             timer != NULL && nextTick > cascadeTick; timer = timer->next) {
+            // A timer which was parked beyond the range of the wheel may expire after timers
+            // in later slots, so the wheel must wake to place it again.
+            uint64_t wakeTick =
+                (timer->expiryTick <= (cascadeTick | levelMask)) ? timer->expiryTick : cascadeTick;
+            if (wakeTick < nextTick) {
+                nextTick = wakeTick;
+            }
+        }
+    }
+
+    return nextTick;
+}
+
+/// <summary>
+///     Finds the tick within a timer's slack on which it expires: the latest tick which is a
+///     multiple of the largest power of two that is not greater than the slack. A periodic
+///     timer's slack is kept below its period, so it never expires after its next period is due.
+/// </summary>
+static uint64_t AddSlack(const TimerWheelTimer *timer, uint64_t dueTick)
+{
+    uint64_t slackTicks = timer->slackTicks;
+    if (timer->periodTicks != 0 && slackTicks >= timer->periodTicks) {
+        slackTicks = timer->periodTicks - 1;
+    }
+    if (slackTicks == 0) {
+        return dueTick;
+    }
+
+    uint64_t alignment = 1ULL << (63 - __builtin_clzll(slackTicks));
+    return (dueTick + slackTicks) & ~(alignment - 1);
+}
+
+static void ProcessTick(TimerWheel *wheel, uint64_t dispatchTick)
+{
+    uint64_t tick = wheel->currentTick;
+
+    // When a lower level wraps, the matching slot on the level above is spread out over it.
+    for (unsigned int level = 1; level < TIMER_WHEEL_LEVEL_COUNT; ++level) {
+        if ((tick & ((1ULL << LEVEL_SHIFT(level)) - 1)) != 0) {
+            break;
+        }
+        CascadeSlot(wheel, level, (unsigned int)(tick >> LEVEL_SHIFT(level)) & SLOT_MASK);
+    }
+
+    TimerWheelTimer *timer;
+    while ((timer = wheel->slots[0][tick & SLOT_MASK]) != NULL) {
+        UnlinkTimer(wheel, timer);
+        timer->isArmed = false;
+        --wheel->armedCount;
+
+        // Re-arm periodic timers before calling the handler, so the handler can cancel or
+        // reschedule them. Periods which were missed entirely are skipped, which matches the
+        // behavior of a periodic timerfd.
+        uint64_t expiryTick = timer->expiryTick;
+        uint64_t missedExpiries = 0;
+        if (timer->periodTicks != 0) {
+            uint64_t nextDue = timer->dueTick + timer->periodTicks;
+            if (nextDue <= dispatchTick) {
+                missedExpiries = (dispatchTick - nextDue) / timer->periodTicks + 1;
+                nextDue += missedExpiries * timer->periodTicks;
+            }
+            timer->dueTick = nextDue;
+            timer->expiryTick = AddSlack(timer, nextDue);
+            timer->isArmed = true;
+            ++wheel->armedCount;
+            InsertTimer(wheel, timer);
+        }
+
+        RecordTimerLateness(&timer->eventData, missedExpiries,
+                            (dispatchTick - expiryTick) * wheel->tickNs);
+
+        uint64_t extraCalls = 0;
+        timer->missedExpiries = 0;
+        if (timer->catchUpPolicy == TimerWheelCatchUpPolicy_Report) {
+            timer->missedExpiries = missedExpiries;
+        } else if (timer->catchUpPolicy == TimerWheelCatchUpPolicy_CatchUp) {
+            extraCalls = missedExpiries < timer->maxCatchUpCalls ? missedExpiries
+                                                                 : timer->maxCatchUpCalls;
+        }
+
+        // Replay missed periods for as long as the handler leaves the timer on its schedule.
+        uint64_t scheduledExpiry = timer->expiryTick;
+        DispatchEvent(&timer->eventData);
+        while (extraCalls > 0 && timer->isArmed && timer->expiryTick == scheduledExpiry) {
+            --extraCalls;
+            DispatchEvent(&timer->eventData);
+        }
+    }
+
+    wheel->currentTick = tick + 1;
+}
+
+static void AdvanceWheel(TimerWheel *wheel, uint64_t targetTick)
+{
+    wheel->isDispatching = true;
+
+    // Jump directly between ticks which have work to do, rather than stepping through every
+    // empty tick.
+    uint64_t nextTick;
+    while ((nextTick = GetNextEventTick(wheel)) <= targetTick) {
+        wheel->currentTick = nextTick;
+        ProcessTick(wheel, targetTick);
+    }
+
+    if (wheel->currentTick <= targetTick) {
+        wheel->currentTick = targetTick + 1;
+    }
+
+    wheel->isDispatching = false;
+}
+
+static int ArmTimerFdForTick(TimerWheel *wheel, uint64_t tick)
+{
+    if (tick == wheel->armedTick) {
+        return 0;
+    }
+
+    struct itimerspec newValue = {.it_value = {0, 0}, .it_interval = {0, 0}};
+    if (tick != NO_TICK) {
+        uint64_t expiryNs = wheel->baseNs + tick * wheel->tickNs;
+        newValue.it_value.tv_sec = (time_t)(expiryNs / NS_PER_SEC);
+        newValue.it_value.tv_nsec = (long)(expiryNs % NS_PER_SEC);
+    }
+
+    if (timerfd_settime(wheel->timerFd, TFD_TIMER_ABSTIME, &newValue, NULL) < 0) {
+        Log_Debug("ERROR: Could not set timer wheel timerfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    wheel->armedTick = tick;
+    return 0;
+}
+
+static void TimerWheelEventHandler(EventData *eventData)
+{
+    TimerWheel *wheel =
+        (TimerWheel *)((uint8_t *)eventData - offsetof(TimerWheel, timerFdEventData));
+
+    // The timerfd is a single-expiry timer, so it is now disarmed. It may have been re-armed
+    // by another handler since epoll reported it, in which case there is nothing to read.
+    uint64_t timerData = 0;
+    if (read(wheel->timerFd, &timerData, sizeof(timerData)) == -1 && errno != EAGAIN) {
+        Log_Debug("ERROR: Could not read timer wheel timerfd %s (%d).\n", strerror(errno), errno);
+    }
+    wheel->armedTick = NO_TICK;
+
+    AdvanceWheel(wheel, GetCurrentTick(wheel));
+    ArmTimerFdForTick(wheel, GetNextExpiryTick(wheel));
+}
+
+static uint64_t GetCurrentTimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t GetCurrentTick(const TimerWheel *wheel)
+{
+    uint64_t nowNs = GetCurrentTimeNs();
+    return nowNs <= wheel->baseNs ? 0 : (nowNs - wheel->baseNs) / wheel->tickNs;
+}
+
+static uint64_t TimespecToTicks(const TimerWheel *wheel, const struct timespec *ts)
+{
+    uint64_t durationNs = (uint64_t)ts->tv_sec * NS_PER_SEC + (uint64_t)ts->tv_nsec;
+    uint64_t ticks = (durationNs + wheel->tickNs - 1) / wheel->tickNs;
+    return ticks == 0 ? 1 : ticks;
+}
+
+static uint64_t RotateRight64(uint64_t value, unsigned int count)
+{
+    count &= 63;
+    return count == 0 ? value : (value >> count) | (value << (64 - count));
+}
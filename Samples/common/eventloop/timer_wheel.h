@@ -0,0 +1,197 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Number of bits of the tick count which select a slot on each wheel level.</summary>
+#define TIMER_WHEEL_SLOT_BITS 6
+/// <summary>Number of slots on each wheel level.</summary>
+#define TIMER_WHEEL_SLOT_COUNT (1 << TIMER_WHEEL_SLOT_BITS)
+/// <summary>
+///     Number of wheel levels. With four levels of 64 slots, timers up to 2^24 ticks in the
+///     future are placed directly; longer timers are re-placed as the wheel turns.
+/// </summary>
+#define TIMER_WHEEL_LEVEL_COUNT 4
+
+/// <summary>
+///     How a periodic timer is dispatched when one or more of its periods expired before the
+///     wheel could process them.
+/// </summary>
+typedef enum {
+    /// <summary>Call the handler once; the missed periods are dropped. This is the default, and
+    /// matches the behavior of a periodic timerfd.</summary>
+    TimerWheelCatchUpPolicy_Skip = 0,
+    /// <summary>Call the handler once for each missed period as well, back to back, up to the
+    /// timer's maxCatchUpCalls. Any further missed periods are dropped.</summary>
+    TimerWheelCatchUpPolicy_CatchUp,
+    /// <summary>Call the handler once, and report the number of missed periods in the timer's
+    /// missedExpiries member so the handler can account for them.</summary>
+    TimerWheelCatchUpPolicy_Report
+} TimerWheelCatchUpPolicy;
+
+/// <summary>
+/// <para>A logical timer which is scheduled on a <see cref="TimerWheel" />.</para>
+/// <para>The caller allocates this struct and populates eventData.eventHandler. The handler is
+/// called with a pointer to eventData when the timer expires, so the existing EventHandler
+/// callbacks can be reused. The handler must not call ConsumeTimerFdEvent, because the wheel
+/// consumes its own timerfd before it dispatches any timer.</para>
+/// <para>The catch-up behavior of a periodic timer is selected with
+/// <see cref="TimerWheel_SetTimerCatchUpPolicy" />; a zero-initialized timer uses
+/// <see cref="TimerWheelCatchUpPolicy_Skip" />.</para>
+/// <para>A timer which does not need to expire on time, such as a timeout, can be given slack
+/// with <see cref="TimerWheel_SetTimerSlack" /> so that it shares a wakeup with other timers.
+/// </para>
+/// <para>The struct must remain valid for as long as the timer is armed. The remaining members
+/// are managed by the wheel and must not be modified by the caller.</para>
+/// </summary>
+typedef struct TimerWheelTimer {
+    /// <summary>Event data which is passed to the handler when the timer expires.</summary>
+    EventData eventData;
+    /// <summary>Next timer in the same slot.</summary>
+    struct TimerWheelTimer *next;
+    /// <summary>Previous timer in the same slot.</summary>
+    struct TimerWheelTimer *prev;
+    /// <summary>Tick on which the timer expires.</summary>
+    uint64_t expiryTick;
+    /// <summary>Tick on which the timer is due. The timer expires up to slackTicks after this,
+    /// and each period is counted from it.</summary>
+    uint64_t dueTick;
+    /// <summary>How many ticks late the timer may expire, so it can share a wakeup with other
+    /// timers. See <see cref="TimerWheel_SetTimerSlack" />.</summary>
+    uint64_t slackTicks;
+    /// <summary>Period in ticks, or zero for a single-expiry timer.</summary>
+    uint64_t periodTicks;
+    /// <summary>Wheel level which currently holds the timer.</summary>
+    uint8_t level;
+    /// <summary>Slot on that level which currently holds the timer.</summary>
+    uint8_t slot;
+    /// <summary>Whether the timer is currently scheduled.</summary>
+    bool isArmed;
+    /// <summary>How missed periods are dispatched.</summary>
+    TimerWheelCatchUpPolicy catchUpPolicy;
+    /// <summary>Maximum number of extra calls per dispatch with
+    /// <see cref="TimerWheelCatchUpPolicy_CatchUp" />.</summary>
+    uint32_t maxCatchUpCalls;
+    /// <summary>With <see cref="TimerWheelCatchUpPolicy_Report" />, the number of periods which
+    /// were missed before the current call to the handler. Zero otherwise.</summary>
+    uint64_t missedExpiries;
+} TimerWheelTimer;
+
+/// <summary>
+/// <para>Hierarchical timer wheel which multiplexes any number of logical timers onto a single
+/// timerfd. Arming and cancelling a timer are O(1) operations.</para>
+/// <para>The caller allocates this struct, initializes it with <see cref="TimerWheel_Init" />
+/// and disposes of it with <see cref="TimerWheel_Close" />. The members must not be modified
+/// directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Epoll instance on which the timerfd is registered.</summary>
+    int epollFd;
+    /// <summary>The single timerfd which is armed for the next timer expiry. Slots on the higher
+    /// levels are cascaded when the wheel next wakes, rather than on a wakeup of their own.
+    /// </summary>
+    int timerFd;
+    /// <summary>Event data for the timerfd.</summary>
+    EventData timerFdEventData;
+    /// <summary>Duration of one tick in nanoseconds.</summary>
+    uint64_t tickNs;
+    /// <summary>CLOCK_MONOTONIC time, in nanoseconds, which corresponds to tick zero.</summary>
+    uint64_t baseNs;
+    /// <summary>Next tick which the wheel will process.</summary>
+    uint64_t currentTick;
+    /// <summary>Tick for which the timerfd is armed, or UINT64_MAX if it is disarmed.</summary>
+    uint64_t armedTick;
+    /// <summary>Number of timers which are currently scheduled.</summary>
+    size_t armedCount;
+    /// <summary>Whether expired timers are currently being dispatched.</summary>
+    bool isDispatching;
+    /// <summary>Bitmap of non-empty slots on each level.</summary>
+    uint64_t occupied[TIMER_WHEEL_LEVEL_COUNT];
+    /// <summary>Head of the list of timers in each slot.</summary>
+    TimerWheelTimer *slots[TIMER_WHEEL_LEVEL_COUNT][TIMER_WHEEL_SLOT_COUNT];
+} TimerWheel;
+
+/// <summary>
+///     Creates the wheel's timerfd and adds it to an epoll instance. No timers are armed.
+/// </summary>
+/// <param name="wheel">Wheel to initialize. This must stay in memory until it is closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="resolution">Duration of one wheel tick. Timer durations are rounded up to a
+/// whole number of ticks.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TimerWheel_Init(TimerWheel *wheel, int epollFd, const struct timespec *resolution);
+
+/// <summary>
+///     Cancels every armed timer, and closes the wheel's timerfd.
+/// </summary>
+/// <param name="wheel">Wheel which was initialized with <see cref="TimerWheel_Init" />.</param>
+void TimerWheel_Close(TimerWheel *wheel);
+
+/// <summary>
+///     Arms a timer to expire periodically. If the timer was already armed, it is rescheduled.
+/// </summary>
+/// <param name="wheel">Wheel on which to schedule the timer.</param>
+/// <param name="timer">Timer to arm.</param>
+/// <param name="period">The timer period</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TimerWheel_SetTimerToPeriod(TimerWheel *wheel, TimerWheelTimer *timer,
+                                const struct timespec *period);
+
+/// <summary>
+///     Arms a timer to expire once only. If the timer was already armed, it is rescheduled.
+/// </summary>
+/// <param name="wheel">Wheel on which to schedule the timer.</param>
+/// <param name="timer">Timer to arm.</param>
+/// <param name="expiry">The time elapsed before it expires once</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TimerWheel_SetTimerToSingleExpiry(TimerWheel *wheel, TimerWheelTimer *timer,
+                                      const struct timespec *expiry);
+
+/// <summary>
+///     Selects how a periodic timer is dispatched when periods are missed. This can be called
+///     whether or not the timer is armed, and takes effect from its next expiry.
+/// </summary>
+/// <param name="timer">Timer to configure.</param>
+/// <param name="policy">The catch-up policy.</param>
+/// <param name="maxCatchUpCalls">For <see cref="TimerWheelCatchUpPolicy_CatchUp" />, the
+/// maximum number of extra calls to make in one dispatch. Ignored by the other policies.</param>
+void TimerWheel_SetTimerCatchUpPolicy(TimerWheelTimer *timer, TimerWheelCatchUpPolicy policy,
+                                      uint32_t maxCatchUpCalls);
+
+/// <summary>
+/// <para>Allows a timer to expire up to a given time after it is due, so that it can share a
+/// wakeup with other timers. Rather than expiring on its exact tick, the timer then expires on
+/// the next tick within its slack which is a multiple of a large power of two, so that timers
+/// with similar slack are rounded to the same ticks and the device wakes less often.</para>
+/// <para>This can be called whether or not the timer is armed, and takes effect from the next
+/// time it is armed or re-armed for its next period. Periods are still counted from the due
+/// tick, so the slack does not make a periodic timer drift, and the slack of a periodic timer
+/// is limited to less than its period. A zero-initialized timer has no slack.</para>
+/// </summary>
+/// <param name="wheel">Wheel on which the timer is scheduled, which sets the tick duration.
+/// </param>
+/// <param name="timer">Timer to configure.</param>
+/// <param name="slack">How late the timer may expire. This is rounded down to whole ticks.
+/// </param>
+void TimerWheel_SetTimerSlack(const TimerWheel *wheel, TimerWheelTimer *timer,
+                              const struct timespec *slack);
+
+/// <summary>
+///     Cancels a timer. It is safe to call this function on a timer which is not armed, and from
+///     within any timer's handler.
+/// </summary>
+/// <param name="wheel">Wheel on which the timer was scheduled.</param>
+/// <param name="timer">Timer to cancel.</param>
+void TimerWheel_CancelTimer(TimerWheel *wheel, TimerWheelTimer *timer);
+
+/// <summary>
+///     Queries whether a timer is currently armed.
+/// </summary>
+/// <param name="timer">Timer to query.</param>
+/// <returns>true if the timer is scheduled to expire; false otherwise.</returns>
+bool TimerWheel_IsTimerArmed(const TimerWheelTimer *timer);
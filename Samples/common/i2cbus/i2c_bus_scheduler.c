@@ -0,0 +1,287 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <applibs/log.h>
+
+#include "i2c_bus_scheduler.h"
+
+static void CompletedEventHandler(EventData *eventData);
+
+static bool IsWriteOnly(const I2cBusTransaction *transaction)
+{
+    return transaction->jobHandler == NULL && transaction->readLength == 0;
+}
+
+static bool IsReadOnly(const I2cBusTransaction *transaction)
+{
+    return transaction->jobHandler == NULL && transaction->writeLength == 0;
+}
+
+/// <summary>
+///     Choose the device to serve next: the highest priority which has work, and of those, the
+///     first after the device which was served last. Call this with the mutex held.
+/// </summary>
+static I2cBusDevice *ChooseDevice(I2cBusScheduler *scheduler)
+{
+    bool hasWork = false;
+    int priority = 0;
+    for (I2cBusDevice *device = scheduler->devices; device != NULL; device = device->next) {
+        if (device->head != NULL && (!hasWork || device->priority > priority)) {
+            hasWork = true;
+            priority = device->priority;
+        }
+    }
+    if (!hasWork) {
+        return NULL;
+    }
+
+    I2cBusDevice *start = scheduler->lastServed != NULL && scheduler->lastServed->next != NULL
+                              ? scheduler->lastServed->next
+                              : scheduler->devices;
+    I2cBusDevice *device = start;
+    while (device->head == NULL || device->priority != priority) {
+        device = device->next != NULL ? device->next : scheduler->devices;
+    }
+    return device;
+}
+
+static void SetResult(I2cBusTransaction *transaction, ssize_t result, int error)
+{
+    transaction->result = result;
+    transaction->error = result < 0 ? error : 0;
+}
+
+/// <summary>
+///     Run one transaction, or a write-only and a read-only transaction together, on the worker
+///     thread.
+/// </summary>
+static void RunTransactions(int i2cFd, I2cBusTransaction *first, I2cBusTransaction *second)
+{
+    I2C_DeviceAddress address = first->device->address;
+    ssize_t result;
+    if (first->jobHandler != NULL) {
+        result = first->jobHandler(first, i2cFd);
+        SetResult(first, result, errno);
+        return;
+    }
+
+    if (second != NULL) {
+        result = I2CMaster_WriteThenRead(i2cFd, address, first->writeData, first->writeLength,
+                                         second->readData, second->readLength);
+        if (result < 0) {
+            SetResult(first, -1, errno);
+            SetResult(second, -1, errno);
+        } else {
+            // Report each transaction's own part of the combined transfer.
+            SetResult(first, (ssize_t)first->writeLength, 0);
+            SetResult(second, result - (ssize_t)first->writeLength, 0);
+        }
+        return;
+    }
+
+    if (first->readLength == 0) {
+        result = I2CMaster_Write(i2cFd, address, first->writeData, first->writeLength);
+    } else if (first->writeLength == 0) {
+        result = I2CMaster_Read(i2cFd, address, first->readData, first->readLength);
+    } else {
+        result = I2CMaster_WriteThenRead(i2cFd, address, first->writeData, first->writeLength,
+                                         first->readData, first->readLength);
+    }
+    SetResult(first, result, errno);
+}
+
+static void AppendCompleted(I2cBusScheduler *scheduler, I2cBusTransaction *transaction)
+{
+    transaction->next = NULL;
+    if (scheduler->completedTail == NULL) {
+        scheduler->completedHead = transaction;
+    } else {
+        scheduler->completedTail->next = transaction;
+    }
+    scheduler->completedTail = transaction;
+}
+
+/// <summary>
+///     Worker thread which runs the queued transactions until the scheduler is closed.
+/// </summary>
+static void *WorkerThread(void *arg)
+{
+    I2cBusScheduler *scheduler = arg;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    while (!scheduler->isStopping) {
+        I2cBusDevice *device = ChooseDevice(scheduler);
+        if (device == NULL) {
+            pthread_cond_wait(&scheduler->workAvailable, &scheduler->mutex);
+            continue;
+        }
+
+        I2cBusTransaction *first = device->head;
+        I2cBusTransaction *second = NULL;
+        if (IsWriteOnly(first) && first->next != NULL && IsReadOnly(first->next)) {
+            second = first->next;
+        }
+        device->head = (second != NULL ? second : first)->next;
+        if (device->head == NULL) {
+            device->tail = NULL;
+        }
+        scheduler->lastServed = device;
+
+        // The transactions have been removed from the queue, so the bus is used without the
+        // lock, and the event loop can submit more work meanwhile.
+        pthread_mutex_unlock(&scheduler->mutex);
+        RunTransactions(scheduler->i2cFd, first, second);
+        pthread_mutex_lock(&scheduler->mutex);
+
+        AppendCompleted(scheduler, first);
+        if (second != NULL) {
+            AppendCompleted(scheduler, second);
+        }
+
+        uint64_t increment = 1;
+        if (write(scheduler->eventFd, &increment, sizeof(increment)) == -1) {
+            Log_Debug("ERROR: Could not signal I2C bus completed eventfd: %s (%d).\n",
+                      strerror(errno), errno);
+        }
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    return NULL;
+}
+
+/// <summary>
+///     Call the completion handlers of the finished transactions on the event loop thread.
+/// </summary>
+static void CompletedEventHandler(EventData *eventData)
+{
+    I2cBusScheduler *scheduler =
+        (I2cBusScheduler *)((uint8_t *)eventData - offsetof(I2cBusScheduler, eventFdEventData));
+
+    uint64_t value;
+    if (read(scheduler->eventFd, &value, sizeof(value)) == -1) {
+        if (errno != EAGAIN) {
+            Log_Debug("ERROR: Could not read I2C bus completed eventfd: %s (%d).\n",
+                      strerror(errno), errno);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    I2cBusTransaction *transaction = scheduler->completedHead;
+    scheduler->completedHead = NULL;
+    scheduler->completedTail = NULL;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    while (transaction != NULL) {
+        // Read the next transaction first, as the handler may submit this one again.
+        I2cBusTransaction *next = transaction->next;
+        transaction->isBusy = false;
+        if (transaction->completionHandler != NULL) {
+            transaction->completionHandler(transaction);
+        }
+        transaction = next;
+    }
+}
+
+int I2cBusScheduler_Init(I2cBusScheduler *scheduler, int epollFd, int i2cFd)
+{
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->i2cFd = i2cFd;
+    scheduler->eventFdEventData.eventHandler = &CompletedEventHandler;
+
+    scheduler->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (scheduler->eventFd < 0) {
+        Log_Debug("ERROR: Could not create eventfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, scheduler->eventFd, &scheduler->eventFdEventData,
+                                    EPOLLIN) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->workAvailable, NULL);
+
+    int result = pthread_create(&scheduler->thread, NULL, &WorkerThread, scheduler);
+    if (result != 0) {
+        Log_Debug("ERROR: Could not create I2C bus thread: %s (%d).\n", strerror(result), result);
+        return -1;
+    }
+    scheduler->isRunning = true;
+
+    return 0;
+}
+
+void I2cBusScheduler_Close(I2cBusScheduler *scheduler)
+{
+    if (scheduler->isRunning) {
+        pthread_mutex_lock(&scheduler->mutex);
+        scheduler->isStopping = true;
+        pthread_cond_signal(&scheduler->workAvailable);
+        pthread_mutex_unlock(&scheduler->mutex);
+
+        int result = pthread_join(scheduler->thread, NULL);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not join I2C bus thread: %s (%d).\n", strerror(result),
+                      result);
+        }
+        scheduler->isRunning = false;
+
+        pthread_cond_destroy(&scheduler->workAvailable);
+        pthread_mutex_destroy(&scheduler->mutex);
+    }
+
+    CloseFdAndPrintError(scheduler->eventFd, "I2cBusCompleted");
+    scheduler->eventFd = -1;
+}
+
+void I2cBusScheduler_AddDevice(I2cBusScheduler *scheduler, I2cBusDevice *device)
+{
+    device->head = NULL;
+    device->tail = NULL;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    device->next = scheduler->devices;
+    scheduler->devices = device;
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+int I2cBusScheduler_Submit(I2cBusScheduler *scheduler, I2cBusDevice *device,
+                           I2cBusTransaction *transaction)
+{
+    if (transaction->isBusy) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (transaction->jobHandler == NULL && transaction->writeLength == 0 &&
+        transaction->readLength == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    transaction->device = device;
+    transaction->result = 0;
+    transaction->error = 0;
+    transaction->next = NULL;
+    transaction->isBusy = true;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    if (device->tail == NULL) {
+        device->head = transaction;
+    } else {
+        device->tail->next = transaction;
+    }
+    device->tail = transaction;
+    pthread_cond_signal(&scheduler->workAvailable);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "applibs_versions.h"
+#include <applibs/i2c.h>
+
+#include "epoll_timerfd_utilities.h"
+
+typedef struct I2cBusTransaction I2cBusTransaction;
+typedef struct I2cBusDevice I2cBusDevice;
+
+/// <summary>
+///     Called on the event loop thread when a transaction has finished. The transaction can be
+///     submitted again from this handler.
+/// </summary>
+typedef void (*I2cBusCompletionHandler)(I2cBusTransaction *transaction);
+
+/// <summary>
+///     Called on the worker thread to run a job, which has the bus to itself until it returns.
+///     A job can make several transfers, for example through a driver's transport, to the
+///     device's address on i2cFd. It must not touch state which the event loop thread uses
+///     until the completion handler is called.
+/// </summary>
+/// <returns>The result to store in the transaction; -1 on failure.</returns>
+typedef ssize_t (*I2cBusJobHandler)(I2cBusTransaction *transaction, int i2cFd);
+
+/// <summary>
+/// <para>One unit of bus work for a device: either a transfer, which writes writeData and then
+/// reads into readData, or a job, which is run on the worker thread.</para>
+/// <para>The caller allocates this struct and populates the fields up to context. The struct
+/// and its buffers must remain valid until the completion handler is called. The remaining
+/// members are managed by the scheduler and must not be modified by the caller.</para>
+/// </summary>
+struct I2cBusTransaction {
+    /// <summary>Bytes to write, or NULL.</summary>
+    const uint8_t *writeData;
+    /// <summary>Number of bytes to write; 0 for a read only.</summary>
+    size_t writeLength;
+    /// <summary>Receives the bytes read, or NULL.</summary>
+    uint8_t *readData;
+    /// <summary>Number of bytes to read; 0 for a write only.</summary>
+    size_t readLength;
+    /// <summary>If this is not NULL, it is run instead of the transfer.</summary>
+    I2cBusJobHandler jobHandler;
+    /// <summary>Called when the transaction has finished, or NULL.</summary>
+    I2cBusCompletionHandler completionHandler;
+    /// <summary>Passed through to the handlers.</summary>
+    void *context;
+
+    /// <summary>The number of bytes transferred, or the job's result; -1 on failure.</summary>
+    ssize_t result;
+    /// <summary>The errno of the failure, if result is -1.</summary>
+    int error;
+    /// <summary>The device which the transaction was submitted to.</summary>
+    I2cBusDevice *device;
+    /// <summary>Next transaction in the device's queue or in the completed list.</summary>
+    I2cBusTransaction *next;
+    /// <summary>Whether the transaction has been submitted and has not completed yet.</summary>
+    bool isBusy;
+};
+
+/// <summary>
+/// <para>A target on the bus, with its own queue of transactions, which are run in the order
+/// in which they were submitted.</para>
+/// <para>The caller allocates this struct and populates address and priority. The remaining
+/// members are managed by the scheduler and must not be modified by the caller.</para>
+/// </summary>
+struct I2cBusDevice {
+    /// <summary>The device's address on the bus.</summary>
+    I2C_DeviceAddress address;
+    /// <summary>Devices with a higher priority are served first. Devices with the same priority
+    /// take turns, one transaction each.</summary>
+    int priority;
+
+    /// <summary>Oldest queued transaction.</summary>
+    I2cBusTransaction *head;
+    /// <summary>Newest queued transaction.</summary>
+    I2cBusTransaction *tail;
+    /// <summary>Next device which was added to the scheduler.</summary>
+    I2cBusDevice *next;
+};
+
+/// <summary>
+/// <para>Shares one I2C master between several devices. Each device has a queue of
+/// transactions, and a worker thread runs them, so the event loop does not wait for the bus.
+/// The worker serves the highest priority device which has work, and takes turns between
+/// devices with the same priority, so a device with a long queue or slow jobs does not stall
+/// the others for more than one transaction at a time.</para>
+/// <para>A write-only transfer which is followed in its device's queue by a read-only transfer,
+/// such as a register address and then a read of the register, is made with one
+/// I2CMaster_WriteThenRead call, using a repeated start instead of a second transaction.</para>
+/// <para>When transactions finish, the worker signals an eventfd which is registered with the
+/// event loop, and their completion handlers are called on the event loop thread. Once the
+/// scheduler has started, all access to the bus must go through it.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="I2cBusScheduler_Init" /> and disposes of it with
+/// <see cref="I2cBusScheduler_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>File descriptor of the I2C master, which was opened with I2CMaster_Open.
+    /// </summary>
+    int i2cFd;
+    /// <summary>The eventfd which the worker signals when transactions have finished.</summary>
+    int eventFd;
+    /// <summary>Event data for the eventfd.</summary>
+    EventData eventFdEventData;
+    /// <summary>Devices which have been added.</summary>
+    I2cBusDevice *devices;
+    /// <summary>Device which the worker served last, where the next turn starts.</summary>
+    I2cBusDevice *lastServed;
+    /// <summary>Finished transactions whose completion handlers have not been called yet.
+    /// </summary>
+    I2cBusTransaction *completedHead;
+    I2cBusTransaction *completedTail;
+    /// <summary>Protects the queues and the completed list.</summary>
+    pthread_mutex_t mutex;
+    /// <summary>Signalled when work is submitted or the worker should stop.</summary>
+    pthread_cond_t workAvailable;
+    /// <summary>The worker thread.</summary>
+    pthread_t thread;
+    /// <summary>Whether the worker thread is running.</summary>
+    bool isRunning;
+    /// <summary>Whether the worker thread should exit.</summary>
+    bool isStopping;
+} I2cBusScheduler;
+
+/// <summary>
+///     Creates the scheduler's eventfd, adds it to an epoll instance, and starts the worker
+///     thread. No devices are added.
+/// </summary>
+/// <param name="scheduler">Scheduler to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor of the event loop.</param>
+/// <param name="i2cFd">File descriptor of the I2C master, which is configured and remains
+/// owned by the caller.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int I2cBusScheduler_Init(I2cBusScheduler *scheduler, int epollFd, int i2cFd);
+
+/// <summary>
+///     Stops the worker thread, after waiting for the transaction which it is running, and
+///     closes the eventfd. Queued transactions are discarded, and their completion handlers are
+///     not called.
+/// </summary>
+/// <param name="scheduler">Scheduler which was initialized with
+/// <see cref="I2cBusScheduler_Init" />.</param>
+void I2cBusScheduler_Close(I2cBusScheduler *scheduler);
+
+/// <summary>
+///     Adds a device to the scheduler. Call this from the event loop thread.
+/// </summary>
+/// <param name="scheduler">The scheduler.</param>
+/// <param name="device">The device, which must remain valid until the scheduler is closed.
+/// </param>
+void I2cBusScheduler_AddDevice(I2cBusScheduler *scheduler, I2cBusDevice *device);
+
+/// <summary>
+///     Appends a transaction to a device's queue. Call this from the event loop thread.
+/// </summary>
+/// <param name="scheduler">The scheduler.</param>
+/// <param name="device">A device which was added to the scheduler.</param>
+/// <param name="transaction">The transaction.</param>
+/// <returns>0 on success, or -1 with errno set to EBUSY if the transaction has not completed
+/// since it was last submitted, or EINVAL if it has no work.</returns>
+int I2cBusScheduler_Submit(I2cBusScheduler *scheduler, I2cBusDevice *device,
+                           I2cBusTransaction *transaction);
@@ -0,0 +1,144 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "input_manager.h"
+
+static void InputManagerTimerEventHandler(EventData *eventData);
+static bool SampleInput(InputManager *manager, InputManagerInput *input);
+static int UpdateSamplePeriod(InputManager *manager, bool isResting);
+
+int InputManager_Init(InputManager *manager, int epollFd, const struct timespec *samplePeriod,
+                      unsigned int debounceSamples, InputErrorHandler errorHandler)
+{
+    static const struct timespec defaultSamplePeriod = {0, INPUT_MANAGER_DEFAULT_SAMPLE_PERIOD_NS};
+
+    memset(manager, 0, sizeof(*manager));
+    manager->timerFd = -1;
+    manager->debounceSamples =
+        (debounceSamples != 0) ? debounceSamples : INPUT_MANAGER_DEFAULT_DEBOUNCE_SAMPLES;
+    manager->errorHandler = errorHandler;
+    manager->samplePeriod = (samplePeriod != NULL) ? *samplePeriod : defaultSamplePeriod;
+    manager->timerEventData.eventHandler = &InputManagerTimerEventHandler;
+
+    manager->timerFd = CreateTimerFdAndAddToEpoll(epollFd, &manager->samplePeriod,
+                                                  &manager->timerEventData, EPOLLIN);
+    return (manager->timerFd < 0) ? -1 : 0;
+}
+
+int InputManager_SetIdleSamplePeriod(InputManager *manager,
+                                     const struct timespec *idleSamplePeriod)
+{
+    static const struct timespec noIdleSamplePeriod = {0, 0};
+    manager->idleSamplePeriod = (idleSamplePeriod != NULL) ? *idleSamplePeriod : noIdleSamplePeriod;
+
+    // Go back to the sample period until the inputs have been seen at rest again.
+    manager->restingSampleCount = 0;
+    return UpdateSamplePeriod(manager, false);
+}
+
+void InputManager_AddInput(InputManager *manager, InputManagerInput *input)
+{
+    input->isActive = false;
+    input->changedSampleCount = 0;
+    input->next = NULL;
+
+    InputManagerInput **link = &manager->inputs;
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    *link = input;
+}
+
+void InputManager_Close(InputManager *manager)
+{
+    // A zero-initialized manager has timerFd 0, which it does not own.
+    if (manager->timerEventData.eventHandler != NULL) {
+        CloseFdAndPrintError(manager->timerFd, "InputManagerTimer");
+    }
+
+    manager->timerFd = -1;
+    manager->inputs = NULL;
+}
+
+static void InputManagerTimerEventHandler(EventData *eventData)
+{
+    InputManager *manager = (InputManager *)eventData;
+
+    if (ConsumeTimerFdEvent(manager->timerFd) != 0) {
+        return;
+    }
+
+    // Each handler is called as its input is sampled, so a handler must not add inputs or
+    // close the manager.
+    bool isResting = true;
+    for (InputManagerInput *input = manager->inputs; input != NULL; input = input->next) {
+        if (!SampleInput(manager, input)) {
+            isResting = false;
+        }
+    }
+
+    if (!isResting) {
+        manager->restingSampleCount = 0;
+    } else if (manager->restingSampleCount < manager->debounceSamples) {
+        ++manager->restingSampleCount;
+    }
+    UpdateSamplePeriod(manager, manager->restingSampleCount >= manager->debounceSamples);
+}
+
+/// <summary>
+///     Switches the sample timer between the sample period and the idle sample period.
+/// </summary>
+/// <param name="isResting">Whether every input has been at rest for long enough to sample
+/// them less often.</param>
+static int UpdateSamplePeriod(InputManager *manager, bool isResting)
+{
+    bool isIdle = isResting &&
+                  (manager->idleSamplePeriod.tv_sec != 0 || manager->idleSamplePeriod.tv_nsec != 0);
+    if (isIdle == manager->isIdle || manager->timerFd < 0) {
+        return 0;
+    }
+
+    manager->isIdle = isIdle;
+    return SetTimerFdToPeriod(manager->timerFd,
+                              isIdle ? &manager->idleSamplePeriod : &manager->samplePeriod);
+}
+
+/// <summary>
+///     Samples one input, and calls its handler if its debounced state has changed.
+/// </summary>
+/// <returns>true if the input is at rest: it matches its debounced state, or could not be
+/// read. false while it may be changing.</returns>
+static bool SampleInput(InputManager *manager, InputManagerInput *input)
+{
+    GPIO_Value_Type value;
+    if (GPIO_GetValue(input->gpioFd, &value) != 0) {
+        int error = errno;
+        Log_Debug("ERROR: Could not read input GPIO: %s (%d).\n", strerror(error), error);
+        if (manager->errorHandler != NULL) {
+            manager->errorHandler(manager, input, error);
+        }
+        return true;
+    }
+
+    bool isActive = (value == input->activeValue);
+    if (isActive == input->isActive) {
+        // A bounce, or no change. Either way, start counting again.
+        input->changedSampleCount = 0;
+        return true;
+    }
+
+    if (++input->changedSampleCount < manager->debounceSamples) {
+        return false;
+    }
+
+    input->isActive = isActive;
+    input->changedSampleCount = 0;
+    input->changedHandler(input, isActive);
+    return false;
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <applibs/gpio.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Default time between samples of the inputs: 10ms.</summary>
+#define INPUT_MANAGER_DEFAULT_SAMPLE_PERIOD_NS (10 * 1000 * 1000)
+
+/// <summary>Default number of consecutive samples which must agree before a change is
+/// reported. With the default sample period, a change is reported after 20ms.</summary>
+#define INPUT_MANAGER_DEFAULT_DEBOUNCE_SAMPLES 2
+
+/// <summary>Time between samples which <see cref="InputManager_SetIdleSamplePeriod" />
+/// suggests while every input is at rest: 50ms. A press must last at least this long to be
+/// seen, which a person pressing a button easily does.</summary>
+#define INPUT_MANAGER_SUGGESTED_IDLE_SAMPLE_PERIOD_NS (50 * 1000 * 1000)
+
+struct InputManagerInput;
+struct InputManager;
+
+/// <summary>
+///     Function which is called when an input's debounced state changes.
+/// </summary>
+/// <param name="input">The input which changed.</param>
+/// <param name="isActive">true if the input has become active, such as a button being
+/// pressed; false if it has become inactive.</param>
+typedef void (*InputChangedHandler)(struct InputManagerInput *input, bool isActive);
+
+/// <summary>
+///     Function which is called when an input cannot be read. The input manager keeps sampling
+///     the other inputs.
+/// </summary>
+/// <param name="manager">The input manager.</param>
+/// <param name="input">The input which could not be read.</param>
+/// <param name="error">The errno value from GPIO_GetValue.</param>
+typedef void (*InputErrorHandler)(struct InputManager *manager, struct InputManagerInput *input,
+                                  int error);
+
+/// <summary>
+/// <para>A GPIO input, such as a button, which is sampled by an <see cref="InputManager" />.
+/// </para>
+/// <para>The caller allocates this struct, typically statically, and populates gpioFd,
+/// activeValue, changedHandler and optionally context before passing it to
+/// <see cref="InputManager_AddInput" />. The struct must remain valid until the manager is
+/// closed. The remaining members are managed by the input manager.</para>
+/// </summary>
+typedef struct InputManagerInput {
+    /// <summary>GPIO which was opened with GPIO_OpenAsInput. The caller closes it.</summary>
+    int gpioFd;
+    /// <summary>Value which means the input is active. The buttons on the MT3620 reference
+    /// development board read GPIO_Value_Low when they are pressed.</summary>
+    GPIO_Value_Type activeValue;
+    /// <summary>Function which is called when the debounced state changes.</summary>
+    InputChangedHandler changedHandler;
+    /// <summary>Value for the caller's use, such as the object which the input controls.
+    /// </summary>
+    void *context;
+    /// <summary>Debounced state of the input. Inputs start inactive, so an input which is
+    /// already active when it is added is reported once it has been sampled.</summary>
+    bool isActive;
+    /// <summary>Number of consecutive samples which have differed from isActive.</summary>
+    unsigned int changedSampleCount;
+    /// <summary>Next input which the manager samples.</summary>
+    struct InputManagerInput *next;
+} InputManagerInput;
+
+/// <summary>
+/// <para>Samples any number of GPIO inputs on a single timer, debounces them, and calls each
+/// input's handler only when its debounced state changes.</para>
+/// <para>The GPIO API does not report edges to high-level applications, so inputs must still be
+/// sampled. Sampling every input on one timer, at a rate which is just fast enough for a
+/// person pressing a button, wakes the application far less often than a timer per button
+/// which fires every millisecond.</para>
+/// <para>The caller allocates this struct, initializes it with <see cref="InputManager_Init" />
+/// and disposes of it with <see cref="InputManager_Close" />. The members must not be modified
+/// directly.</para>
+/// </summary>
+typedef struct InputManager {
+    /// <summary>Event data for the sample timer. This is the first member, so the event handler
+    /// can find the manager.</summary>
+    EventData timerEventData;
+    /// <summary>Timer which fires once for each sample.</summary>
+    int timerFd;
+    /// <summary>Number of consecutive samples which must agree before a change is reported.
+    /// </summary>
+    unsigned int debounceSamples;
+    /// <summary>Time between samples while any input may be changing.</summary>
+    struct timespec samplePeriod;
+    /// <summary>Time between samples while every input is at rest, or zero to always use
+    /// samplePeriod.</summary>
+    struct timespec idleSamplePeriod;
+    /// <summary>Number of consecutive samples in which no input differed from its debounced
+    /// state.</summary>
+    unsigned int restingSampleCount;
+    /// <summary>Whether the timer currently fires at idleSamplePeriod.</summary>
+    bool isIdle;
+    /// <summary>Inputs which are sampled, in the order they were added.</summary>
+    InputManagerInput *inputs;
+    /// <summary>Optional function which is called when an input cannot be read.</summary>
+    InputErrorHandler errorHandler;
+} InputManager;
+
+/// <summary>
+///     Creates the sample timer and adds it to an epoll instance. No inputs are sampled until
+///     they are added with <see cref="InputManager_AddInput" />.
+/// </summary>
+/// <param name="manager">Input manager to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="samplePeriod">Time between samples, or NULL for
+/// <see cref="INPUT_MANAGER_DEFAULT_SAMPLE_PERIOD_NS" />.</param>
+/// <param name="debounceSamples">Number of consecutive samples which must agree before a change
+/// is reported, or 0 for <see cref="INPUT_MANAGER_DEFAULT_DEBOUNCE_SAMPLES" />.</param>
+/// <param name="errorHandler">Optional function which is called when an input cannot be read.
+/// </param>
+/// <returns>0 on success, or -1 on failure</returns>
+int InputManager_Init(InputManager *manager, int epollFd, const struct timespec *samplePeriod,
+                      unsigned int debounceSamples, InputErrorHandler errorHandler);
+
+/// <summary>
+///     Adds an input to the set which is sampled.
+/// </summary>
+/// <param name="manager">The input manager.</param>
+/// <param name="input">The input to add. It must not already have been added.</param>
+void InputManager_AddInput(InputManager *manager, InputManagerInput *input);
+
+/// <summary>
+/// <para>Samples the inputs less often while they are all at rest, so the application wakes
+/// less often while no one is touching them. Once no input has differed from its debounced
+/// state for debounceSamples consecutive samples, the manager samples at idleSamplePeriod;
+/// as soon as a sample differs, it goes back to the sample period for the debounce.</para>
+/// <para>A change is then reported up to idleSamplePeriod later than it would otherwise be,
+/// and a press which is shorter than idleSamplePeriod may be missed.</para>
+/// </summary>
+/// <param name="manager">The input manager.</param>
+/// <param name="idleSamplePeriod">Time between samples while every input is at rest, such as
+/// <see cref="INPUT_MANAGER_SUGGESTED_IDLE_SAMPLE_PERIOD_NS" />, or NULL to always sample at
+/// the sample period.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int InputManager_SetIdleSamplePeriod(InputManager *manager,
+                                     const struct timespec *idleSamplePeriod);
+
+/// <summary>
+///     Stops sampling, and closes the sample timer. This does not close the inputs' GPIOs.
+///     It is safe to call this function on a manager which has been zero-initialized, or whose
+///     initialization failed.
+/// </summary>
+/// <param name="manager">The input manager.</param>
+void InputManager_Close(InputManager *manager);
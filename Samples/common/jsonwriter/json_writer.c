@@ -0,0 +1,368 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <math.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+// Number of significant digits which JsonWriter_Number writes.
+#define NUMBER_DIGITS 6
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static const double powersOf10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/// <summary>
+///     Appends bytes, keeping room for the null terminator, or fails the writer if they do not
+///     fit.
+/// </summary>
+static void Append(JsonWriter *writer, const char *bytes, size_t length)
+{
+    if (writer->failed || length >= writer->size - writer->length) {
+        writer->failed = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, bytes, length);
+    writer->length += length;
+}
+
+static void AppendChar(JsonWriter *writer, char c)
+{
+    Append(writer, &c, 1);
+}
+
+/// <summary>
+///     Writes the comma before a value if one is needed, and checks that a value may be
+///     written here: after a key in an object, or anywhere in an array or at the top level.
+/// </summary>
+static void BeginValue(JsonWriter *writer)
+{
+    if (writer->depth == 0) {
+        if (writer->length > 0) {
+            writer->failed = true; // Only one value at the top level.
+        }
+        return;
+    }
+
+    uint32_t bit = 1u << (writer->depth - 1);
+    if (writer->objectMask & bit) {
+        if (!writer->afterKey) {
+            writer->failed = true;
+        }
+        writer->afterKey = false;
+        return;
+    }
+    if (writer->nonEmptyMask & bit) {
+        AppendChar(writer, ',');
+    }
+    writer->nonEmptyMask |= bit;
+}
+
+static void AppendEscaped(JsonWriter *writer, const char *value)
+{
+    AppendChar(writer, '"');
+    const char *run = value;
+    for (const char *p = value; *p != '\0'; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        Append(writer, run, (size_t)(p - run));
+        run = p + 1;
+
+        char escape[6] = {'\\', 0};
+        size_t escapeLength = 2;
+        switch (c) {
+        case '"':
+        case '\\':
+            escape[1] = (char)c;
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default:
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = hexDigits[c >> 4];
+            escape[5] = hexDigits[c & 0xf];
+            escapeLength = 6;
+            break;
+        }
+        Append(writer, escape, escapeLength);
+    }
+    Append(writer, run, strlen(run));
+    AppendChar(writer, '"');
+}
+
+/// <summary>
+///     Formats an unsigned integer, right-aligned at the end of a buffer.
+/// </summary>
+/// <returns>The first digit</returns>
+static char *FormatUnsigned(uint64_t value, char *end)
+{
+    char *p = end;
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return p;
+}
+
+static void BeginContainer(JsonWriter *writer, bool object)
+{
+    BeginValue(writer);
+    if (writer->depth == JSON_WRITER_MAX_DEPTH) {
+        writer->failed = true;
+        return;
+    }
+    AppendChar(writer, object ? '{' : '[');
+    uint32_t bit = 1u << writer->depth;
+    writer->objectMask = object ? (writer->objectMask | bit) : (writer->objectMask & ~bit);
+    writer->nonEmptyMask &= ~bit;
+    ++writer->depth;
+}
+
+static void EndContainer(JsonWriter *writer, bool object)
+{
+    if (writer->depth == 0 || writer->afterKey ||
+        ((writer->objectMask & (1u << (writer->depth - 1))) != 0) != object) {
+        writer->failed = true;
+        return;
+    }
+    AppendChar(writer, object ? '}' : ']');
+    --writer->depth;
+}
+
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->failed = (buffer == NULL || size == 0);
+}
+
+void JsonWriter_BeginObject(JsonWriter *writer)
+{
+    BeginContainer(writer, true);
+}
+
+void JsonWriter_EndObject(JsonWriter *writer)
+{
+    EndContainer(writer, true);
+}
+
+void JsonWriter_BeginArray(JsonWriter *writer)
+{
+    BeginContainer(writer, false);
+}
+
+void JsonWriter_EndArray(JsonWriter *writer)
+{
+    EndContainer(writer, false);
+}
+
+void JsonWriter_Key(JsonWriter *writer, const char *key)
+{
+    uint32_t bit = (writer->depth > 0) ? 1u << (writer->depth - 1) : 0;
+    if ((writer->objectMask & bit) == 0 || writer->afterKey) {
+        writer->failed = true;
+        return;
+    }
+    if (writer->nonEmptyMask & bit) {
+        AppendChar(writer, ',');
+    }
+    writer->nonEmptyMask |= bit;
+    AppendEscaped(writer, key);
+    AppendChar(writer, ':');
+    writer->afterKey = true;
+}
+
+void JsonWriter_String(JsonWriter *writer, const char *value)
+{
+    BeginValue(writer);
+    AppendEscaped(writer, value);
+}
+
+void JsonWriter_Number(JsonWriter *writer, double value)
+{
+    if (!isfinite(value)) {
+        JsonWriter_Null(writer);
+        return;
+    }
+    if (value == 0) {
+        BeginValue(writer);
+        AppendChar(writer, '0');
+        return;
+    }
+
+    char text[32];
+    size_t length = 0;
+    if (value < 0) {
+        text[length++] = '-';
+        value = -value;
+    }
+
+    // Round to NUMBER_DIGITS significant digits, as an integer and a decimal exponent.
+    int exponent = (int)floor(log10(value));
+    int scale = NUMBER_DIGITS - 1 - exponent;
+    const int powerCount = (int)(sizeof(powersOf10) / sizeof(powersOf10[0]));
+    double scaled;
+    double error = 0; // Sign of the rounding error of scaled, when it can be computed exactly.
+    if (scale >= 0 && scale < powerCount) {
+        scaled = value * powersOf10[scale];
+        error = fma(value, powersOf10[scale], -scaled);
+    } else if (scale < 0 && -scale < powerCount) {
+        scaled = value / powersOf10[-scale];
+        error = -fma(scaled, powersOf10[-scale], -value);
+    } else if (scale > 0) {
+        // Scaled in two steps, so that the power of ten does not overflow for subnormal values.
+        scaled = value * powersOf10[22] * pow(10, scale - 22);
+    } else {
+        scaled = value * pow(10, scale);
+    }
+    uint64_t digits = (uint64_t)floor(scaled);
+    double fraction = scaled - (double)digits;
+    // Halfway cases are rounded by the exact value, and exact ties to even, like printf.
+    if (fraction > 0.5 || (fraction == 0.5 && (error > 0 || (error == 0 && (digits & 1))))) {
+        ++digits;
+    }
+    if (digits >= 1000000) { // Rounded up to the next power of ten.
+        digits /= 10;
+        ++exponent;
+    }
+    // A value just below a power of ten can get the wrong exponent from log10.
+    while (digits != 0 && digits < 100000) {
+        digits *= 10;
+        --exponent;
+    }
+
+    char digitText[NUMBER_DIGITS];
+    FormatUnsigned(digits, digitText + NUMBER_DIGITS);
+    size_t digitCount = NUMBER_DIGITS;
+    while (digitCount > 1 && digitText[digitCount - 1] == '0') {
+        --digitCount;
+    }
+
+    if (exponent < -4 || exponent >= NUMBER_DIGITS) {
+        // d.ddddde+XX, like printf.
+        text[length++] = digitText[0];
+        if (digitCount > 1) {
+            text[length++] = '.';
+            memcpy(text + length, digitText + 1, digitCount - 1);
+            length += digitCount - 1;
+        }
+        text[length++] = 'e';
+        text[length++] = (exponent < 0) ? '-' : '+';
+        unsigned int magnitude = (unsigned int)((exponent < 0) ? -exponent : exponent);
+        if (magnitude < 10) {
+            text[length++] = '0';
+        }
+        char exponentText[4];
+        char *first = FormatUnsigned(magnitude, exponentText + sizeof(exponentText));
+        size_t exponentLength = (size_t)(exponentText + sizeof(exponentText) - first);
+        memcpy(text + length, first, exponentLength);
+        length += exponentLength;
+    } else if (exponent < 0) {
+        // 0.000ddd
+        text[length++] = '0';
+        text[length++] = '.';
+        for (int i = -1; i > exponent; i--) {
+            text[length++] = '0';
+        }
+        memcpy(text + length, digitText, digitCount);
+        length += digitCount;
+    } else {
+        // ddd.ddd
+        size_t integerDigits = (size_t)exponent + 1;
+        for (size_t i = 0; i < integerDigits; i++) {
+            text[length++] = (i < digitCount) ? digitText[i] : '0';
+        }
+        if (digitCount > integerDigits) {
+            text[length++] = '.';
+            memcpy(text + length, digitText + integerDigits, digitCount - integerDigits);
+            length += digitCount - integerDigits;
+        }
+    }
+
+    BeginValue(writer);
+    Append(writer, text, length);
+}
+
+void JsonWriter_Integer(JsonWriter *writer, int64_t value)
+{
+    char text[21];
+    uint64_t magnitude = (value < 0) ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+    char *first = FormatUnsigned(magnitude, text + sizeof(text));
+    if (value < 0) {
+        *--first = '-';
+    }
+    BeginValue(writer);
+    Append(writer, first, (size_t)(text + sizeof(text) - first));
+}
+
+void JsonWriter_Bool(JsonWriter *writer, bool value)
+{
+    BeginValue(writer);
+    if (value) {
+        Append(writer, "true", 4);
+    } else {
+        Append(writer, "false", 5);
+    }
+}
+
+void JsonWriter_Null(JsonWriter *writer)
+{
+    BeginValue(writer);
+    Append(writer, "null", 4);
+}
+
+void JsonWriter_Raw(JsonWriter *writer, const char *json)
+{
+    BeginValue(writer);
+    Append(writer, json, strlen(json));
+}
+
+size_t JsonWriter_EscapedLength(const char *value)
+{
+    size_t length = 0;
+    for (const char *p = value; *p != '\0'; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' ||
+            c == '\t') {
+            length += 2;
+        } else if (c < 0x20) {
+            length += 6;
+        } else {
+            length += 1;
+        }
+    }
+    return length;
+}
+
+int JsonWriter_Finish(JsonWriter *writer)
+{
+    if (writer->failed || writer->depth != 0 || writer->afterKey || writer->length == 0) {
+        if (writer->size > 0 && writer->buffer != NULL) {
+            writer->buffer[0] = '\0';
+        }
+        return -1;
+    }
+    writer->buffer[writer->length] = '\0';
+    return (int)writer->length;
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Deepest nesting of objects and arrays which a writer can write.</summary>
+#define JSON_WRITER_MAX_DEPTH 32
+
+/// <summary>
+/// <para>Writes JSON into a caller-provided buffer, without allocating memory or calling
+/// printf. Keys and strings are escaped, commas are placed between members and elements, and
+/// numbers are formatted directly.</para>
+/// <para>If the JSON does not fit in the buffer, or the calls do not make a valid document, the
+/// writer stops writing and <see cref="JsonWriter_Finish" /> fails, so a document is never
+/// silently truncated. The individual calls therefore do not need to be checked.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="JsonWriter_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    char *buffer;
+    size_t size;
+    /// <summary>Length of the JSON which has been written.</summary>
+    size_t length;
+    /// <summary>Number of objects and arrays which are open.</summary>
+    size_t depth;
+    /// <summary>Bit n is set if the container at depth n + 1 is an object.</summary>
+    uint32_t objectMask;
+    /// <summary>Bit n is set once the container at depth n + 1 has a member or element.
+    /// </summary>
+    uint32_t nonEmptyMask;
+    /// <summary>Whether a key has been written, whose value is next.</summary>
+    bool afterKey;
+    /// <summary>Whether the JSON did not fit, or the calls were not valid.</summary>
+    bool failed;
+} JsonWriter;
+
+/// <summary>
+///     Initializes a writer.
+/// </summary>
+/// <param name="writer">Writer to initialize.</param>
+/// <param name="buffer">Buffer which receives the JSON, followed by a null terminator.</param>
+/// <param name="size">Size of the buffer.</param>
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size);
+
+/// <summary>
+///     Starts an object, as a value or as an element of an array.
+/// </summary>
+void JsonWriter_BeginObject(JsonWriter *writer);
+
+/// <summary>
+///     Ends the object which was started last.
+/// </summary>
+void JsonWriter_EndObject(JsonWriter *writer);
+
+/// <summary>
+///     Starts an array, as a value or as an element of another array.
+/// </summary>
+void JsonWriter_BeginArray(JsonWriter *writer);
+
+/// <summary>
+///     Ends the array which was started last.
+/// </summary>
+void JsonWriter_EndArray(JsonWriter *writer);
+
+/// <summary>
+///     Writes the key of the next member of an object, whose value must be written next.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="key">The key, which is escaped.</param>
+void JsonWriter_Key(JsonWriter *writer, const char *key);
+
+/// <summary>
+///     Writes a string, as a value or as an element of an array.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="value">The string, which is escaped.</param>
+void JsonWriter_String(JsonWriter *writer, const char *value);
+
+/// <summary>
+///     Writes a number with up to six significant digits, like printf's "%.6g". Infinities
+///     and NaN, which JSON cannot hold, are written as null.
+/// </summary>
+void JsonWriter_Number(JsonWriter *writer, double value);
+
+/// <summary>
+///     Writes an integer exactly.
+/// </summary>
+void JsonWriter_Integer(JsonWriter *writer, int64_t value);
+
+/// <summary>
+///     Writes true or false.
+/// </summary>
+void JsonWriter_Bool(JsonWriter *writer, bool value);
+
+/// <summary>
+///     Writes null.
+/// </summary>
+void JsonWriter_Null(JsonWriter *writer);
+
+/// <summary>
+///     Writes a value which is already JSON text, as it is.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <param name="json">The JSON text of one value, such as "true" or "{\"a\":1}".</param>
+void JsonWriter_Raw(JsonWriter *writer, const char *json);
+
+/// <summary>
+///     Gets the length of a string once it has been escaped, not including its quotes.
+/// </summary>
+size_t JsonWriter_EscapedLength(const char *value);
+
+/// <summary>
+///     Checks that the document is complete, and null-terminates it.
+/// </summary>
+/// <param name="writer">The writer.</param>
+/// <returns>The length of the JSON, not including the null terminator, or -1 if it did not fit
+/// in the buffer or is not a complete document</returns>
+int JsonWriter_Finish(JsonWriter *writer);
@@ -0,0 +1,785 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "kv_store.h"
+#include "storage_metrics.h"
+
+/// <summary>
+///     The kinds of record in the log.
+/// </summary>
+typedef enum {
+    /// <summary>Sets a key, whose value follows the key.</summary>
+    RecordType_Put = 0x50, // 'P'
+    /// <summary>Deletes a key.</summary>
+    RecordType_Delete = 0x44, // 'D'
+    /// <summary>Ends a commit. Its value is the number of commits in the log so far,
+    /// including this one.</summary>
+    RecordType_Commit = 0x43 // 'C'
+} RecordType;
+
+/// <summary>
+///     The header of a record as it is written to mutable storage. The key and the value
+///     follow it.
+/// </summary>
+typedef struct {
+    /// <summary>CRC-32 of the log's generation, the other fields, the key and the value.
+    /// Including the generation means that records left in a half by an older log are not
+    /// valid in the newer one.</summary>
+    uint32_t crc;
+    uint16_t valueLength;
+    uint8_t keyLength;
+    uint8_t type;
+} RecordHeader;
+
+_Static_assert(sizeof(RecordHeader) == KV_STORE_RECORD_HEADER_SIZE,
+               "A record header must be KV_STORE_RECORD_HEADER_SIZE bytes long");
+_Static_assert(KV_STORE_MAX_KEYS < 256, "An index into the entries must fit in a slot");
+
+/// <summary>
+///     The header of each half of the store, which is written when a compacted log has been
+///     written after it.
+/// </summary>
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t crc;
+} RegionHeader;
+
+#define REGION_MAGIC 0x3153564Bu // "KVS1"
+#define NUM_SLOTS (KV_STORE_MAX_KEYS * 2)
+#define COMMIT_RECORD_SIZE (sizeof(RecordHeader) + sizeof(uint32_t))
+
+// Size of the buffer which records are copied through when the log is compacted.
+#define COMPACT_CHUNK_SIZE 512
+_Static_assert(COMPACT_CHUNK_SIZE >= KV_STORE_MAX_RECORD_SIZE,
+               "A record must fit in the compaction buffer");
+
+/// <summary>
+///     Updates a CRC-32 (IEEE 802.3), four bits at a time, which needs a table of only 16
+///     entries.
+/// </summary>
+static uint32_t UpdateCrc(uint32_t crc, const void *data, size_t length)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+        0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return crc;
+}
+
+/// <summary>
+///     Computes the CRC of a record, whose key and value follow its header in memory. The
+///     record need not be aligned.
+/// </summary>
+static uint32_t ComputeRecordCrc(const uint8_t *record, uint32_t generation)
+{
+    RecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    uint32_t crc = UpdateCrc(0xFFFFFFFFu, &generation, sizeof(generation));
+    crc = UpdateCrc(crc, record + sizeof(header.crc),
+                    sizeof(header) - sizeof(header.crc) + header.keyLength + header.valueLength);
+    return ~crc;
+}
+
+static uint32_t ComputeRegionCrc(const RegionHeader *header)
+{
+    return ~UpdateCrc(0xFFFFFFFFu, header, offsetof(RegionHeader, crc));
+}
+
+static off_t RegionStart(const KvStore *store, int region)
+{
+    return store->offset + (off_t)region * (off_t)store->regionSize;
+}
+
+static off_t RegionEnd(const KvStore *store, int region)
+{
+    return RegionStart(store, region) + (off_t)store->regionSize;
+}
+
+static size_t EntryRecordSize(const KvStoreEntry *entry)
+{
+    return sizeof(RecordHeader) + entry->keyLength + entry->valueLength;
+}
+
+/// <summary>
+///     Computes the 32-bit FNV-1a hash of a key.
+/// </summary>
+static uint32_t HashKey(const char *key, size_t keyLength)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < keyLength; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// <summary>
+///     Finds the entry of a key, using linear probing in the hash table.
+/// </summary>
+/// <returns>The entry, or NULL if the key does not exist</returns>
+static KvStoreEntry *FindEntry(KvStore *store, const char *key, size_t keyLength)
+{
+    size_t slot = HashKey(key, keyLength) % NUM_SLOTS;
+    for (size_t i = 0; i < NUM_SLOTS && store->slots[slot] != 0; i++) {
+        KvStoreEntry *entry = &store->entries[store->slots[slot] - 1];
+        if (entry->keyLength == keyLength && memcmp(entry->key, key, keyLength) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) % NUM_SLOTS;
+    }
+    return NULL;
+}
+
+static void InsertSlot(KvStore *store, size_t index)
+{
+    const KvStoreEntry *entry = &store->entries[index];
+    size_t slot = HashKey(entry->key, entry->keyLength) % NUM_SLOTS;
+    while (store->slots[slot] != 0) {
+        slot = (slot + 1) % NUM_SLOTS;
+    }
+    store->slots[slot] = (uint8_t)(index + 1);
+}
+
+/// <summary>
+///     Removes an entry, and rebuilds the hash table without it. The table is small enough
+///     that this is simpler than keeping tombstones in it.
+/// </summary>
+static void RemoveEntry(KvStore *store, KvStoreEntry *entry)
+{
+    entry->inUse = false;
+    --store->keyCount;
+    memset(store->slots, 0, sizeof(store->slots));
+    for (size_t i = 0; i < KV_STORE_MAX_KEYS; i++) {
+        if (store->entries[i].inUse) {
+            InsertSlot(store, i);
+        }
+    }
+}
+
+/// <summary>
+///     Records the value of a key in the index.
+/// </summary>
+/// <param name="offset">Offset in the mutable file of the record which holds the
+/// value.</param>
+/// <param name="value">The value, which is cached if it is short enough.</param>
+static int PutEntry(KvStore *store, const char *key, size_t keyLength, off_t offset,
+                    const uint8_t *value, size_t valueLength)
+{
+    KvStoreEntry *entry = FindEntry(store, key, keyLength);
+    if (entry != NULL) {
+        store->garbageBytes += EntryRecordSize(entry);
+    } else {
+        for (size_t i = 0; i < KV_STORE_MAX_KEYS && entry == NULL; i++) {
+            if (!store->entries[i].inUse) {
+                entry = &store->entries[i];
+                memcpy(entry->key, key, keyLength);
+                entry->key[keyLength] = '\0';
+                entry->keyLength = (uint8_t)keyLength;
+                entry->inUse = true;
+                ++store->keyCount;
+                InsertSlot(store, i);
+            }
+        }
+        if (entry == NULL) {
+            Log_Debug("ERROR: The key-value store cannot hold more than %d keys.\n",
+                      KV_STORE_MAX_KEYS);
+            errno = ENOSPC;
+            return -1;
+        }
+    }
+
+    entry->offset = offset;
+    entry->valueLength = (uint16_t)valueLength;
+    if (valueLength <= KV_STORE_CACHED_VALUE_LENGTH) {
+        memcpy(entry->cachedValue, value, valueLength);
+    }
+    return 0;
+}
+
+/// <summary>
+///     Reads through the buffer whilst the log is scanned.
+/// </summary>
+typedef struct {
+    KvStore *store;
+    /// <summary>Offset in the mutable file of the bytes in the buffer.</summary>
+    off_t start;
+    size_t length;
+} Reader;
+
+/// <summary>
+///     Returns bytes of the mutable file from the buffer, refilling it if they are not all in
+///     it.
+/// </summary>
+/// <param name="end">End of the bytes which may be read.</param>
+/// <returns>The bytes, or NULL on failure. Bytes beyond the end of the mutable file are
+/// returned zeroed.</returns>
+static const uint8_t *ReadBytes(Reader *reader, off_t offset, size_t size, off_t end)
+{
+    KvStore *store = reader->store;
+    if (offset < reader->start || offset + (off_t)size > reader->start + (off_t)reader->length) {
+        size_t length = store->bufferSize;
+        if ((off_t)length > end - offset) {
+            length = (size_t)(end - offset);
+        }
+        ssize_t result =
+            StorageMetrics_PRead(StorageFile_Mutable, store->fd, store->buffer, length, offset);
+        if (result < 0) {
+            Log_Debug("ERROR: Could not read the key-value store: %s (%d).\n", strerror(errno),
+                      errno);
+            return NULL;
+        }
+        memset(store->buffer + result, 0, length - (size_t)result);
+        reader->start = offset;
+        reader->length = length;
+        if (size > length) {
+            return NULL;
+        }
+    }
+    return store->buffer + (offset - reader->start);
+}
+
+/// <summary>
+///     Reads and checks the record at an offset in the log.
+/// </summary>
+/// <param name="header">Receives the header of the record.</param>
+/// <param name="key">Receives the key, which the value follows.</param>
+/// <returns>The size of the record, or 0 if it is not valid</returns>
+static size_t ReadRecord(Reader *reader, off_t offset, off_t end, RecordHeader *header,
+                         const uint8_t **key)
+{
+    if (end - offset < (off_t)sizeof(RecordHeader)) {
+        return 0;
+    }
+    const uint8_t *bytes = ReadBytes(reader, offset, sizeof(RecordHeader), end);
+    if (bytes == NULL) {
+        return 0;
+    }
+    memcpy(header, bytes, sizeof(*header));
+
+    bool validLengths;
+    switch (header->type) {
+    case RecordType_Put:
+        validLengths = header->keyLength > 0 && header->keyLength <= KV_STORE_MAX_KEY_LENGTH &&
+                       header->valueLength <= KV_STORE_MAX_VALUE_LENGTH;
+        break;
+    case RecordType_Delete:
+        validLengths = header->keyLength > 0 && header->keyLength <= KV_STORE_MAX_KEY_LENGTH &&
+                       header->valueLength == 0;
+        break;
+    case RecordType_Commit:
+        validLengths = header->keyLength == 0 && header->valueLength == sizeof(uint32_t);
+        break;
+    default:
+        validLengths = false;
+        break;
+    }
+    size_t size = sizeof(*header) + header->keyLength + header->valueLength;
+    if (!validLengths || (off_t)size > end - offset) {
+        return 0;
+    }
+
+    bytes = ReadBytes(reader, offset, size, end);
+    if (bytes == NULL || header->crc != ComputeRecordCrc(bytes, reader->store->generation)) {
+        return 0;
+    }
+    *key = bytes + sizeof(*header);
+    return size;
+}
+
+/// <summary>
+///     Builds the index by reading the log. The first pass finds the end of the last commit,
+///     and the second applies the records before it, so that the records of a commit which
+///     was torn by a power failure are ignored.
+/// </summary>
+static int LoadIndex(KvStore *store)
+{
+    memset(store->entries, 0, sizeof(store->entries));
+    memset(store->slots, 0, sizeof(store->slots));
+    store->keyCount = 0;
+    store->garbageBytes = 0;
+    store->batchLength = 0;
+    store->commits = 0;
+
+    Reader reader = {.store = store, .start = 0, .length = 0};
+    off_t start = RegionStart(store, store->activeRegion) + (off_t)sizeof(RegionHeader);
+    off_t end = RegionEnd(store, store->activeRegion);
+    off_t committedEnd = start;
+    uint32_t records = 0;
+    uint32_t committedRecords = 0;
+
+    // A commit record must be the next in sequence, so that one which was left by an earlier
+    // attempt to write this generation is not taken for the end of a commit in it.
+    RecordHeader header;
+    const uint8_t *key;
+    off_t offset = start;
+    for (size_t size; (size = ReadRecord(&reader, offset, end, &header, &key)) != 0;
+         offset += (off_t)size) {
+        ++records;
+        if (header.type == RecordType_Commit) {
+            uint32_t sequence;
+            memcpy(&sequence, key, sizeof(sequence));
+            if (sequence != store->commits + 1) {
+                break;
+            }
+            ++store->commits;
+            committedEnd = offset + (off_t)size;
+            committedRecords = records;
+        }
+    }
+    store->discardedRecords = records - committedRecords;
+    store->writeOffset = committedEnd;
+
+    offset = start;
+    while (offset < committedEnd) {
+        size_t size = ReadRecord(&reader, offset, committedEnd, &header, &key);
+        if (size == 0) {
+            return -1;
+        }
+        if (header.type == RecordType_Put) {
+            if (PutEntry(store, (const char *)key, header.keyLength, offset,
+                         key + header.keyLength, header.valueLength) != 0) {
+                return -1;
+            }
+        } else if (header.type == RecordType_Delete) {
+            KvStoreEntry *entry = FindEntry(store, (const char *)key, header.keyLength);
+            if (entry != NULL) {
+                store->garbageBytes += EntryRecordSize(entry);
+                RemoveEntry(store, entry);
+            }
+            store->garbageBytes += size;
+        } else {
+            store->garbageBytes += size;
+        }
+        offset += (off_t)size;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Reads the header of one half of the store.
+/// </summary>
+/// <returns>true if the header is valid</returns>
+static bool ReadRegionHeader(const KvStore *store, int region, RegionHeader *header)
+{
+    ssize_t result = StorageMetrics_PRead(StorageFile_Mutable, store->fd, header, sizeof(*header),
+                                          RegionStart(store, region));
+    return result == sizeof(*header) && header->magic == REGION_MAGIC &&
+           header->crc == ComputeRegionCrc(header);
+}
+
+static int WriteRegionHeader(KvStore *store, int region, uint32_t generation)
+{
+    RegionHeader header = {.magic = REGION_MAGIC, .generation = generation};
+    header.crc = ComputeRegionCrc(&header);
+    if (StorageMetrics_PWrite(store->fd, &header, sizeof(header),
+                              RegionStart(store, region)) != sizeof(header)) {
+        Log_Debug("ERROR: Could not write to the key-value store: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Appends a record to the batch, whose buffer must have room for it.
+/// </summary>
+/// <returns>Offset in the mutable file at which the record will be written</returns>
+static off_t AppendRecord(KvStore *store, RecordType type, const char *key, size_t keyLength,
+                          const void *value, size_t valueLength)
+{
+    uint8_t *bytes = store->buffer + store->batchLength;
+    RecordHeader header = {
+        .valueLength = (uint16_t)valueLength, .keyLength = (uint8_t)keyLength, .type = type};
+    memcpy(bytes, &header, sizeof(header));
+    if (keyLength > 0) {
+        memcpy(bytes + sizeof(header), key, keyLength);
+    }
+    if (valueLength > 0) {
+        memcpy(bytes + sizeof(header) + keyLength, value, valueLength);
+    }
+    header.crc = ComputeRecordCrc(bytes, store->generation);
+    memcpy(bytes, &header.crc, sizeof(header.crc));
+
+    off_t offset = store->writeOffset + (off_t)store->batchLength;
+    store->batchLength += sizeof(header) + keyLength + valueLength;
+    return offset;
+}
+
+/// <summary>
+///     Arms the commit timer when the first change is added to the batch.
+/// </summary>
+static void ArmCommitTimer(KvStore *store)
+{
+    if (store->commitTimerFd < 0 || store->commitTimerArmed) {
+        return;
+    }
+    if (SetTimerFdToSingleExpiry(store->commitTimerFd, &store->commitDelay) != 0) {
+        Log_Debug("ERROR: Could not arm the key-value store commit timer.\n");
+        return;
+    }
+    store->commitTimerArmed = true;
+}
+
+static void CommitTimerEventHandler(EventData *eventData)
+{
+    KvStore *store = (KvStore *)eventData;
+    if (ConsumeTimerFdEvent(store->commitTimerFd) != 0) {
+        return;
+    }
+    store->commitTimerArmed = false;
+    KvStore_Commit(store);
+}
+
+/// <summary>
+///     Replaces the value of a key in place, if it is in the batch with the same length, or
+///     leaves it alone if the value is the same, so that neither adds a record to the batch.
+/// </summary>
+/// <returns>true if the change needs no new record</returns>
+static bool CoalesceValue(KvStore *store, KvStoreEntry *entry, const void *value, size_t length)
+{
+    if (entry == NULL || entry->valueLength != length) {
+        return false;
+    }
+    if (entry->offset >= store->writeOffset) {
+        uint8_t *record = store->buffer + (entry->offset - store->writeOffset);
+        memcpy(record + sizeof(RecordHeader) + entry->keyLength, value, length);
+        uint32_t crc = ComputeRecordCrc(record, store->generation);
+        memcpy(record, &crc, sizeof(crc));
+    } else if (length > KV_STORE_CACHED_VALUE_LENGTH ||
+               memcmp(entry->cachedValue, value, length) != 0) {
+        return false;
+    }
+    if (length <= KV_STORE_CACHED_VALUE_LENGTH) {
+        memcpy(entry->cachedValue, value, length);
+    }
+    return true;
+}
+
+/// <summary>
+///     Makes room in the batch for a record, and for the commit record after it, by
+///     committing the batch if it is needed.
+/// </summary>
+static int ReserveBatch(KvStore *store, size_t size)
+{
+    if (store->batchLength + size + COMMIT_RECORD_SIZE > store->bufferSize) {
+        return KvStore_Commit(store);
+    }
+    return 0;
+}
+
+/// <summary>
+///     Writes the first bytes of a compaction buffer to mutable storage.
+/// </summary>
+static int WriteChunk(KvStore *store, const uint8_t *chunk, size_t length, off_t offset)
+{
+    if (StorageMetrics_PWrite(store->fd, chunk, length, offset) != (ssize_t)length) {
+        Log_Debug("ERROR: Could not write to the key-value store: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+    return 0;
+}
+
+int KvStore_Compact(KvStore *store)
+{
+    int region = 1 - store->activeRegion;
+    uint32_t generation = store->generation + 1;
+    off_t end = RegionEnd(store, region);
+    off_t chunkOffset = RegionStart(store, region) + (off_t)sizeof(RegionHeader);
+    off_t newOffsets[KV_STORE_MAX_KEYS];
+    uint8_t chunk[COMPACT_CHUNK_SIZE];
+    size_t chunkLength = 0;
+
+    // The live values, including those in the batch, are copied to the other half, followed
+    // by a commit record. The half only becomes the log when its header is written, so the old
+    // log is still complete if the power fails before then.
+    for (size_t i = 0; i < KV_STORE_MAX_KEYS; i++) {
+        const KvStoreEntry *entry = &store->entries[i];
+        if (!entry->inUse) {
+            continue;
+        }
+        size_t size = EntryRecordSize(entry);
+        if (chunkLength + size > sizeof(chunk)) {
+            if (WriteChunk(store, chunk, chunkLength, chunkOffset) != 0) {
+                return -1;
+            }
+            chunkOffset += (off_t)chunkLength;
+            chunkLength = 0;
+        }
+        if (chunkOffset + (off_t)(chunkLength + size + COMMIT_RECORD_SIZE) > end) {
+            Log_Debug("ERROR: The values do not fit in the key-value store.\n");
+            errno = ENOSPC;
+            return -1;
+        }
+
+        uint8_t *bytes = chunk + chunkLength;
+        if (entry->offset >= store->writeOffset) {
+            memcpy(bytes, store->buffer + (entry->offset - store->writeOffset), size);
+        } else if (StorageMetrics_PRead(StorageFile_Mutable, store->fd, bytes, size,
+                                        entry->offset) != (ssize_t)size) {
+            Log_Debug("ERROR: Could not read the key-value store: %s (%d).\n", strerror(errno),
+                      errno);
+            return -1;
+        }
+        uint32_t crc = ComputeRecordCrc(bytes, generation);
+        memcpy(bytes, &crc, sizeof(crc));
+        newOffsets[i] = chunkOffset + (off_t)chunkLength;
+        chunkLength += size;
+    }
+
+    RecordHeader commit = {.valueLength = sizeof(uint32_t), .type = RecordType_Commit};
+    uint32_t sequence = 1;
+    if (chunkLength + COMMIT_RECORD_SIZE > sizeof(chunk)) {
+        if (WriteChunk(store, chunk, chunkLength, chunkOffset) != 0) {
+            return -1;
+        }
+        chunkOffset += (off_t)chunkLength;
+        chunkLength = 0;
+    }
+    memcpy(chunk + chunkLength, &commit, sizeof(commit));
+    memcpy(chunk + chunkLength + sizeof(commit), &sequence, sizeof(sequence));
+    commit.crc = ComputeRecordCrc(chunk + chunkLength, generation);
+    memcpy(chunk + chunkLength, &commit.crc, sizeof(commit.crc));
+    chunkLength += COMMIT_RECORD_SIZE;
+
+    if (WriteChunk(store, chunk, chunkLength, chunkOffset) != 0 ||
+        WriteRegionHeader(store, region, generation) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < KV_STORE_MAX_KEYS; i++) {
+        if (store->entries[i].inUse) {
+            store->entries[i].offset = newOffsets[i];
+        }
+    }
+    store->activeRegion = region;
+    store->generation = generation;
+    store->writeOffset = chunkOffset + (off_t)chunkLength;
+    store->batchLength = 0;
+    store->garbageBytes = COMMIT_RECORD_SIZE;
+    store->commits = 1;
+    ++store->compactions;
+    Log_Debug("INFO: Compacted the key-value store to %zu key(s) in %lld bytes.\n",
+              store->keyCount,
+              (long long)(store->writeOffset - RegionStart(store, region)));
+    return 0;
+}
+
+int KvStore_Open(KvStore *store, int fd, off_t offset, size_t size, uint8_t *buffer,
+                 size_t bufferSize)
+{
+    memset(store, 0, sizeof(*store));
+    store->commitTimerFd = -1;
+    store->fd = fd;
+    store->offset = offset;
+    store->regionSize = size / 2;
+    store->buffer = buffer;
+    store->bufferSize = bufferSize;
+
+    if (bufferSize < KV_STORE_MAX_RECORD_SIZE ||
+        store->regionSize < sizeof(RegionHeader) + KV_STORE_MAX_RECORD_SIZE + COMMIT_RECORD_SIZE) {
+        Log_Debug("ERROR: The key-value store or its buffer is too small.\n");
+        goto fail;
+    }
+
+    // The half with the newer valid header holds the log. If neither is valid, the store is
+    // new, and a header is written so that commits to it can be found again.
+    RegionHeader headers[2];
+    bool valid[2];
+    for (int i = 0; i < 2; i++) {
+        valid[i] = ReadRegionHeader(store, i, &headers[i]);
+    }
+    if (!valid[0] && !valid[1]) {
+        store->generation = 1;
+        if (WriteRegionHeader(store, 0, store->generation) != 0) {
+            goto fail;
+        }
+    } else {
+        store->activeRegion = (!valid[0] || (valid[1] && headers[1].generation >
+                                                            headers[0].generation))
+                                  ? 1
+                                  : 0;
+        store->generation = headers[store->activeRegion].generation;
+    }
+
+    if (LoadIndex(store) != 0) {
+        goto fail;
+    }
+    if (store->discardedRecords > 0) {
+        Log_Debug("WARNING: Ignored %u record(s) of a commit which was not completed.\n",
+                  store->discardedRecords);
+    }
+    Log_Debug("INFO: Key-value store holds %zu key(s).\n", store->keyCount);
+    return 0;
+
+fail:
+    Log_Debug("ERROR: Could not open the key-value store.\n");
+    CloseFdAndPrintError(fd, "KvStore");
+    store->fd = -1;
+    store->regionSize = 0;
+    return -1;
+}
+
+int KvStore_StartCommitTimer(KvStore *store, int epollFd, const struct timespec *delay)
+{
+    static const struct timespec disarmed = {0, 0};
+    store->commitDelay = *delay;
+    store->commitEventData.eventHandler = &CommitTimerEventHandler;
+    store->commitTimerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &store->commitEventData, EPOLLIN);
+    if (store->commitTimerFd < 0) {
+        return -1;
+    }
+    if (store->batchLength > 0) {
+        ArmCommitTimer(store);
+    }
+    return 0;
+}
+
+ssize_t KvStore_Get(KvStore *store, const char *key, void *value, size_t size)
+{
+    const KvStoreEntry *entry = FindEntry(store, key, strlen(key));
+    if (entry == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (entry->valueLength > size) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    off_t valueOffset = entry->offset + (off_t)(sizeof(RecordHeader) + entry->keyLength);
+    if (entry->valueLength <= KV_STORE_CACHED_VALUE_LENGTH) {
+        memcpy(value, entry->cachedValue, entry->valueLength);
+    } else if (entry->offset >= store->writeOffset) {
+        memcpy(value, store->buffer + (valueOffset - store->writeOffset), entry->valueLength);
+    } else if (StorageMetrics_PRead(StorageFile_Mutable, store->fd, value, entry->valueLength,
+                                    valueOffset) != (ssize_t)entry->valueLength) {
+        Log_Debug("ERROR: Could not read the key-value store: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+    return (ssize_t)entry->valueLength;
+}
+
+int KvStore_Set(KvStore *store, const char *key, const void *value, size_t length)
+{
+    size_t keyLength = strlen(key);
+    if (keyLength == 0 || keyLength > KV_STORE_MAX_KEY_LENGTH ||
+        length > KV_STORE_MAX_VALUE_LENGTH) {
+        Log_Debug("ERROR: The key or value for '%s' is too long.\n", key);
+        errno = EINVAL;
+        return -1;
+    }
+    KvStoreEntry *entry = FindEntry(store, key, keyLength);
+    if (CoalesceValue(store, entry, value, length)) {
+        return 0;
+    }
+    if (entry == NULL && store->keyCount == KV_STORE_MAX_KEYS) {
+        Log_Debug("ERROR: The key-value store cannot hold more than %d keys.\n",
+                  KV_STORE_MAX_KEYS);
+        errno = ENOSPC;
+        return -1;
+    }
+    if (ReserveBatch(store, sizeof(RecordHeader) + keyLength + length) != 0) {
+        return -1;
+    }
+
+    off_t offset = AppendRecord(store, RecordType_Put, key, keyLength, value, length);
+    ArmCommitTimer(store);
+    return PutEntry(store, key, keyLength, offset, value, length);
+}
+
+int KvStore_Delete(KvStore *store, const char *key)
+{
+    size_t keyLength = strlen(key);
+    if (FindEntry(store, key, keyLength) == NULL) {
+        return 0;
+    }
+    if (ReserveBatch(store, sizeof(RecordHeader) + keyLength) != 0) {
+        return -1;
+    }
+
+    // Committing the batch may have compacted the log, so the entry is found again.
+    KvStoreEntry *entry = FindEntry(store, key, keyLength);
+    AppendRecord(store, RecordType_Delete, key, keyLength, NULL, 0);
+    store->garbageBytes += EntryRecordSize(entry) + sizeof(RecordHeader) + keyLength;
+    RemoveEntry(store, entry);
+    ArmCommitTimer(store);
+    return 0;
+}
+
+int KvStore_Commit(KvStore *store)
+{
+    if (store->batchLength == 0) {
+        return 0;
+    }
+
+    // Room for the commit record is always reserved in the batch.
+    uint32_t sequence = store->commits + 1;
+    AppendRecord(store, RecordType_Commit, NULL, 0, &sequence, sizeof(sequence));
+
+    int result;
+    if (store->writeOffset + (off_t)store->batchLength <=
+        RegionEnd(store, store->activeRegion)) {
+        if (WriteChunk(store, store->buffer, store->batchLength, store->writeOffset) == 0) {
+            store->writeOffset += (off_t)store->batchLength;
+            store->batchLength = 0;
+            store->garbageBytes += COMMIT_RECORD_SIZE;
+            ++store->commits;
+            return 0;
+        }
+        result = -1;
+    } else {
+        result = KvStore_Compact(store);
+    }
+
+    if (result != 0) {
+        // The index refers to the changes which were discarded, so it is built again from
+        // what was written.
+        Log_Debug("ERROR: Could not commit to the key-value store.\n");
+        int error = errno;
+        LoadIndex(store);
+        errno = error;
+    }
+    return result;
+}
+
+bool KvStore_ShutdownHook(ShutdownHook *hook)
+{
+    KvStore *store = hook->context;
+    if (store->regionSize > 0 && store->batchLength > 0 && KvStore_Commit(store) != 0) {
+        Log_Debug("ERROR: Could not commit the key-value store before shutting down.\n");
+    }
+    return true;
+}
+
+void KvStore_Close(KvStore *store)
+{
+    // A zero-initialized store has fds 0, which it does not own.
+    if (store->commitEventData.eventHandler != NULL) {
+        CloseFdAndPrintError(store->commitTimerFd, "KvStoreCommitTimer");
+    }
+    if (store->regionSize > 0) {
+        CloseFdAndPrintError(store->fd, "KvStore");
+    }
+
+    store->commitEventData.eventHandler = NULL;
+    store->commitTimerFd = -1;
+    store->fd = -1;
+    store->regionSize = 0;
+}
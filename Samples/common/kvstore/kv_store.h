@@ -0,0 +1,212 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "shutdown_coordinator.h"
+
+/// <summary>Maximum number of keys in the store.</summary>
+#ifndef KV_STORE_MAX_KEYS
+#define KV_STORE_MAX_KEYS 32
+#endif
+
+/// <summary>Maximum length of a key, not including the null terminator.</summary>
+#define KV_STORE_MAX_KEY_LENGTH 31
+
+/// <summary>Maximum length of a value, in bytes.</summary>
+#define KV_STORE_MAX_VALUE_LENGTH 256
+
+/// <summary>Values up to this length are kept in memory as well, so that reading them does
+/// not read the mutable file.</summary>
+#define KV_STORE_CACHED_VALUE_LENGTH 8
+
+/// <summary>Size of the header of each record in the log, in bytes.</summary>
+#define KV_STORE_RECORD_HEADER_SIZE 8
+
+/// <summary>Size of the largest record in the log, in bytes. The buffer which is passed to
+/// <see cref="KvStore_Open" /> must be at least this long.</summary>
+#define KV_STORE_MAX_RECORD_SIZE \
+    (KV_STORE_RECORD_HEADER_SIZE + KV_STORE_MAX_KEY_LENGTH + KV_STORE_MAX_VALUE_LENGTH)
+
+/// <summary>
+///     The value of a key, as it is known in memory.
+/// </summary>
+typedef struct {
+    char key[KV_STORE_MAX_KEY_LENGTH + 1];
+    /// <summary>Offset in the mutable file of the record which holds the value. If this is at
+    /// or after the end of the log, the record is in the batch which has not been
+    /// committed.</summary>
+    off_t offset;
+    uint16_t valueLength;
+    uint8_t keyLength;
+    bool inUse;
+    /// <summary>A copy of the value, if it is no longer than
+    /// KV_STORE_CACHED_VALUE_LENGTH.</summary>
+    uint8_t cachedValue[KV_STORE_CACHED_VALUE_LENGTH];
+} KvStoreEntry;
+
+/// <summary>
+/// <para>Keeps small values by key in mutable storage, in a log which is only ever appended
+/// to, so that a value which is changed does not rewrite the flash in place.</para>
+/// <para>Each record in the log holds one put or delete, with a CRC-32 which detects a record
+/// that was only partly written when the power failed. Changes are collected in memory with
+/// <see cref="KvStore_Set" /> and <see cref="KvStore_Delete" />, and are written together,
+/// followed by a commit record, by <see cref="KvStore_Commit" />. When the store is opened,
+/// only the changes up to the last commit record are applied, so either all of the changes in
+/// a commit survive a power failure, or none of them do.</para>
+/// <para>The file is split into two halves. When the log fills its half, the live values are
+/// copied to the other half, which then becomes the log, and whose header is written last.
+/// The index of the keys, with their positions in the log, is kept in memory, and is rebuilt
+/// by reading the log when the store is opened.</para>
+/// <para>A value which is set again before it is committed replaces the earlier value in
+/// the batch, and setting a key to the value it already has does nothing, so a value which
+/// changes often, such as a counter, is written once per commit. With
+/// <see cref="KvStore_StartCommitTimer" />, the batch is committed a fixed time after the
+/// first change in it.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="KvStore_Open" /> and disposes of it with <see cref="KvStore_Close" />. The
+/// members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Event data for the commit timer. This must be the first member, so that the
+    /// timer's handler can find the store.</summary>
+    EventData commitEventData;
+    /// <summary>Timer which commits the batch, or -1 if there is none.</summary>
+    int commitTimerFd;
+    /// <summary>How long after the first change in a batch it is committed.</summary>
+    struct timespec commitDelay;
+    /// <summary>Whether the commit timer has been armed for the batch.</summary>
+    bool commitTimerArmed;
+    /// <summary>The mutable file, or -1 if the store is not open.</summary>
+    int fd;
+    /// <summary>Offset of the store in the mutable file.</summary>
+    off_t offset;
+    /// <summary>Size of each half of the store, in bytes.</summary>
+    size_t regionSize;
+    /// <summary>Which half holds the log: 0 or 1.</summary>
+    int activeRegion;
+    /// <summary>Generation of the log, which increases by one each time the log is
+    /// compacted.</summary>
+    uint32_t generation;
+    /// <summary>Offset in the mutable file at which the next commit is written.</summary>
+    off_t writeOffset;
+
+    /// <summary>Holds the changes which have not been committed, and is used for reading when
+    /// the store is opened or compacted.</summary>
+    uint8_t *buffer;
+    size_t bufferSize;
+    /// <summary>Number of bytes of changes in the buffer.</summary>
+    size_t batchLength;
+
+    KvStoreEntry entries[KV_STORE_MAX_KEYS];
+    /// <summary>Hash table of indices into entries, plus one; 0 is an empty slot.</summary>
+    uint8_t slots[KV_STORE_MAX_KEYS * 2];
+    size_t keyCount;
+
+    /// <summary>Number of bytes in the log which hold values that have been replaced or
+    /// deleted, and which compaction would free.</summary>
+    size_t garbageBytes;
+    uint32_t commits;
+    uint32_t compactions;
+    /// <summary>Number of records which were not valid when the log was read, and were
+    /// ignored, because a commit was torn by a power failure.</summary>
+    uint32_t discardedRecords;
+} KvStore;
+
+/// <summary>
+///     Opens the store, and builds the index of its keys by reading the log.
+/// </summary>
+/// <param name="store">Store to open.</param>
+/// <param name="fd">The mutable file, from Storage_OpenMutableFile. This is closed by
+/// <see cref="KvStore_Close" />.</param>
+/// <param name="offset">Offset of the store in the mutable file.</param>
+/// <param name="size">Size of the store in bytes, which is split into two halves.</param>
+/// <param name="buffer">Buffer for the changes which have not been committed. It must be at
+/// least KV_STORE_MAX_RECORD_SIZE bytes long, and must remain valid until the store is
+/// closed.</param>
+/// <param name="bufferSize">Size of buffer in bytes.</param>
+/// <returns>0 on success, or -1 on failure, in which case the file is closed</returns>
+int KvStore_Open(KvStore *store, int fd, off_t offset, size_t size, uint8_t *buffer,
+                 size_t bufferSize);
+
+/// <summary>
+///     Commits each batch of changes a fixed time after the first change in it, instead of
+///     only when <see cref="KvStore_Commit" /> is called. Call KvStore_Commit before
+///     <see cref="KvStore_Close" /> to write the changes which are still waiting.
+/// </summary>
+/// <param name="store">The store, which has been opened.</param>
+/// <param name="epollFd">Epoll on which the timer is registered.</param>
+/// <param name="delay">How long after the first change in a batch it is committed.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int KvStore_StartCommitTimer(KvStore *store, int epollFd, const struct timespec *delay);
+
+/// <summary>
+///     Reads the value of a key, including a change which has not been committed.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="key">The key.</param>
+/// <param name="value">Receives the value.</param>
+/// <param name="size">Size of value in bytes.</param>
+/// <returns>The length of the value, or -1 on failure. errno is ENOENT if the key does not
+/// exist, or ENOBUFS if the value is longer than size.</returns>
+ssize_t KvStore_Get(KvStore *store, const char *key, void *value, size_t size);
+
+/// <summary>
+///     Sets the value of a key. The change is written by the next call to
+///     <see cref="KvStore_Commit" />, by the commit timer, or sooner if the buffer is full.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="key">The key, no longer than KV_STORE_MAX_KEY_LENGTH.</param>
+/// <param name="value">The value.</param>
+/// <param name="length">Length of the value, no more than KV_STORE_MAX_VALUE_LENGTH.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int KvStore_Set(KvStore *store, const char *key, const void *value, size_t length);
+
+/// <summary>
+///     Deletes a key. The change is written by the next call to
+///     <see cref="KvStore_Commit" />, by the commit timer, or sooner if the buffer is full.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="key">The key.</param>
+/// <returns>0 on success, including when the key does not exist, or -1 on failure</returns>
+int KvStore_Delete(KvStore *store, const char *key);
+
+/// <summary>
+///     Writes the changes which have not been committed, followed by a commit record, in a
+///     single write. If they do not fit in the log, it is compacted first.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <returns>0 on success, or -1 on failure, in which case the changes are discarded</returns>
+int KvStore_Commit(KvStore *store);
+
+/// <summary>
+///     Shutdown hook which commits the changes which are waiting for the commit timer. Set the
+///     hook's context to the store, and register it with
+///     <see cref="ShutdownCoordinator_AddHook" />.
+/// </summary>
+/// <param name="hook">The hook, whose context is the store.</param>
+/// <returns>true, as the commit is written at once; a commit which fails is logged</returns>
+bool KvStore_ShutdownHook(ShutdownHook *hook);
+
+/// <summary>
+///     Copies the live values to the other half of the store, which frees the space of the
+///     values that were replaced or deleted. This is done by <see cref="KvStore_Commit" />
+///     when it is needed.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int KvStore_Compact(KvStore *store);
+
+/// <summary>
+///     Closes the mutable file and the commit timer. Changes which have not been committed
+///     are discarded. It is safe to call this function on a store which has been
+///     zero-initialized, or whose opening failed.
+/// </summary>
+/// <param name="store">The store.</param>
+void KvStore_Close(KvStore *store);
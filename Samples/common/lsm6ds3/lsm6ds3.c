@@ -0,0 +1,420 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "lsm6ds3.h"
+
+// DocID026899 Rev 10, S9, Register description.
+static const uint8_t fifoCtrl1RegId = 0x06;
+static const uint8_t fifoCtrl5RegId = 0x0A;
+static const uint8_t int1CtrlRegId = 0x0D;
+static const uint8_t whoAmIRegId = 0x0F;
+static const uint8_t ctrl1XlRegId = 0x10;
+static const uint8_t ctrl2GRegId = 0x11;
+static const uint8_t ctrl3cRegId = 0x12;
+static const uint8_t fifoStatus1RegId = 0x3A;
+static const uint8_t fifoDataOutLRegId = 0x3E;
+
+static const uint8_t expectedWhoAmI = 0x69;
+
+// Number of times CTRL3_C is read while waiting for a reset to complete.
+static const int maxResetPolls = 1000;
+
+// FIFO_STATUS2 (3Bh) flags; DIFF_FIFO[11:8] is in the low nibble.
+static const uint8_t fifoStatus2Watermark = 0x80;
+static const uint8_t fifoStatus2Overrun = 0x40;
+static const uint8_t fifoStatus2Empty = 0x10;
+
+// FIFO_CTRL5 (0Ah)[2:0] FIFO_MODE.
+static const uint8_t fifoModeBypass = 0x0;
+static const uint8_t fifoModeContinuous = 0x6;
+
+// With the gyroscope and accelerometer at the same rate, the FIFO pattern repeats every six
+// words: gyroscope X, Y, Z and then accelerometer X, Y, Z.
+#define WORDS_PER_SAMPLE (sizeof(Lsm6ds3Sample) / sizeof(int16_t))
+
+// Cached registers which can be written: all but the reserved register 0Ch and WHO_AM_I (0Fh).
+#define CACHE_ALL_MASK ((UINT32_C(1) << LSM6DS3_CACHE_REG_COUNT) - 1)
+static const uint32_t cacheWritableMask =
+    CACHE_ALL_MASK &
+    ~((UINT32_C(1) << (0x0C - LSM6DS3_CACHE_FIRST_REG)) |
+      (UINT32_C(1) << (0x0F - LSM6DS3_CACHE_FIRST_REG)));
+
+void Lsm6ds3_Init(Lsm6ds3 *device, const Lsm6ds3TransportOps *ops, void *bus)
+{
+    memset(device, 0, sizeof(*device));
+    device->ops = ops;
+    device->bus = bus;
+}
+
+int Lsm6ds3_ReadRegisters(Lsm6ds3 *device, uint8_t firstRegId, void *data, size_t length)
+{
+    return device->ops->readRegisters(device->bus, firstRegId, data, length);
+}
+
+static int WriteRegisters(Lsm6ds3 *device, const uint8_t *command, size_t length)
+{
+    return device->ops->writeRegisters(device->bus, command, length);
+}
+
+static bool IsCachedRegister(uint8_t regId)
+{
+    return regId >= LSM6DS3_CACHE_FIRST_REG &&
+           regId < LSM6DS3_CACHE_FIRST_REG + LSM6DS3_CACHE_REG_COUNT;
+}
+
+int Lsm6ds3_WriteRegister(Lsm6ds3 *device, uint8_t regId, uint8_t value)
+{
+    const uint8_t command[] = {regId, value};
+    int result = WriteRegisters(device, command, sizeof(command));
+    if (!IsCachedRegister(regId)) {
+        return result;
+    }
+
+    // The register's value is not known if the write failed.
+    Lsm6ds3RegisterCache *cache = &device->cache;
+    size_t index = regId - LSM6DS3_CACHE_FIRST_REG;
+    uint32_t bit = UINT32_C(1) << index;
+    if (result != 0) {
+        cache->validMask &= ~bit;
+        cache->dirtyMask &= ~bit;
+        return result;
+    }
+
+    cache->values[index] = value;
+    cache->validMask |= bit;
+    cache->dirtyMask &= ~bit;
+    return 0;
+}
+
+// Calculate the new value of a bit field in a cached register, reading the register first if
+// needed. On success, *index is the register's position in the cache.
+static int ApplyToCachedRegister(Lsm6ds3 *device, uint8_t regId, uint8_t mask, uint8_t value,
+                                 size_t *index, uint8_t *newValue)
+{
+    if (!IsCachedRegister(regId) ||
+        (cacheWritableMask & (UINT32_C(1) << (regId - LSM6DS3_CACHE_FIRST_REG))) == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    Lsm6ds3RegisterCache *cache = &device->cache;
+    *index = regId - LSM6DS3_CACHE_FIRST_REG;
+    uint32_t bit = UINT32_C(1) << *index;
+    if (mask == 0xFF) {
+        *newValue = value;
+        return 0;
+    }
+
+    if ((cache->validMask & bit) == 0) {
+        if (Lsm6ds3_ReadRegisters(device, regId, &cache->values[*index], 1) != 0) {
+            return -1;
+        }
+        cache->validMask |= bit;
+    }
+
+    *newValue = (uint8_t)((cache->values[*index] & ~mask) | (value & mask));
+    return 0;
+}
+
+int Lsm6ds3_UpdateRegister(Lsm6ds3 *device, uint8_t regId, uint8_t mask, uint8_t value)
+{
+    size_t index;
+    uint8_t newValue;
+    if (ApplyToCachedRegister(device, regId, mask, value, &index, &newValue) != 0) {
+        return -1;
+    }
+
+    // The device already holds this value.
+    const Lsm6ds3RegisterCache *cache = &device->cache;
+    uint32_t bit = UINT32_C(1) << index;
+    if ((cache->validMask & bit) != 0 && (cache->dirtyMask & bit) == 0 &&
+        cache->values[index] == newValue) {
+        return 0;
+    }
+
+    return Lsm6ds3_WriteRegister(device, regId, newValue);
+}
+
+int Lsm6ds3_StageRegister(Lsm6ds3 *device, uint8_t regId, uint8_t mask, uint8_t value)
+{
+    size_t index;
+    uint8_t newValue;
+    if (ApplyToCachedRegister(device, regId, mask, value, &index, &newValue) != 0) {
+        return -1;
+    }
+
+    // A register which is already dirty stays dirty, as the device's value is not known.
+    Lsm6ds3RegisterCache *cache = &device->cache;
+    uint32_t bit = UINT32_C(1) << index;
+    if ((cache->validMask & bit) == 0 || cache->values[index] != newValue) {
+        cache->dirtyMask |= bit;
+    }
+    cache->values[index] = newValue;
+    cache->validMask |= bit;
+    return 0;
+}
+
+int Lsm6ds3_FlushRegisters(Lsm6ds3 *device)
+{
+    Lsm6ds3RegisterCache *cache = &device->cache;
+    size_t index = 0;
+    while (cache->dirtyMask != 0) {
+        // Find the next run of dirty registers, and write it with one command.
+        while ((cache->dirtyMask & (UINT32_C(1) << index)) == 0) {
+            ++index;
+        }
+        size_t runLength = 0;
+        uint8_t command[1 + LSM6DS3_CACHE_REG_COUNT];
+        command[0] = (uint8_t)(LSM6DS3_CACHE_FIRST_REG + index);
+        while (index + runLength < LSM6DS3_CACHE_REG_COUNT &&
+               (cache->dirtyMask & (UINT32_C(1) << (index + runLength))) != 0) {
+            command[1 + runLength] = cache->values[index + runLength];
+            ++runLength;
+        }
+
+        // The run stays dirty if the write fails, so the next flush retries it.
+        if (WriteRegisters(device, command, 1 + runLength) != 0) {
+            return -1;
+        }
+
+        uint32_t runMask = ((UINT32_C(1) << runLength) - 1) << index;
+        cache->dirtyMask &= ~runMask;
+        index += runLength;
+    }
+
+    return 0;
+}
+
+int Lsm6ds3_LoadRegisterCache(Lsm6ds3 *device)
+{
+    uint8_t values[LSM6DS3_CACHE_REG_COUNT];
+    if (Lsm6ds3_ReadRegisters(device, LSM6DS3_CACHE_FIRST_REG, values, sizeof(values)) != 0) {
+        return -1;
+    }
+
+    Lsm6ds3RegisterCache *cache = &device->cache;
+    for (size_t index = 0; index < LSM6DS3_CACHE_REG_COUNT; ++index) {
+        if ((cache->dirtyMask & (UINT32_C(1) << index)) == 0) {
+            cache->values[index] = values[index];
+        }
+    }
+    cache->validMask = CACHE_ALL_MASK;
+    return 0;
+}
+
+int Lsm6ds3_CheckWhoAmI(Lsm6ds3 *device)
+{
+    // DocID026899 Rev 10, S9.11, WHO_AM_I (0Fh); has fixed value 0x69.
+    uint8_t whoAmI;
+    if (Lsm6ds3_ReadRegisters(device, whoAmIRegId, &whoAmI, sizeof(whoAmI)) != 0) {
+        return -1;
+    }
+
+    if (whoAmI != expectedWhoAmI) {
+        Log_Debug("ERROR: Unexpected LSM6DS3 WHO_AM_I value 0x%02x.\n", whoAmI);
+        errno = ENODEV;
+        return -1;
+    }
+
+    return 0;
+}
+
+int Lsm6ds3_StartReset(Lsm6ds3 *device)
+{
+    // DocID026899 Rev 10, S9.14, CTRL3_C (12h); [0] = SW_RESET
+    // The registers return to their defaults, so forget the cached values, including any
+    // which were staged.
+    int result = Lsm6ds3_WriteRegister(device, ctrl3cRegId, 0x01);
+    device->cache.validMask = 0;
+    device->cache.dirtyMask = 0;
+    return result;
+}
+
+int Lsm6ds3_IsResetComplete(Lsm6ds3 *device)
+{
+    // SW_RESET is cleared when the reset has completed. The device may not respond while it
+    // resets, so a failed read means that it is still resetting.
+    uint8_t ctrl3c;
+    if (Lsm6ds3_ReadRegisters(device, ctrl3cRegId, &ctrl3c, sizeof(ctrl3c)) != 0) {
+        return 0;
+    }
+    return (ctrl3c & 0x1) == 0 ? 1 : 0;
+}
+
+int Lsm6ds3_Reset(Lsm6ds3 *device)
+{
+    if (Lsm6ds3_StartReset(device) != 0) {
+        return -1;
+    }
+
+    // Wait for device to come out of reset.
+    for (int attempt = 0; attempt < maxResetPolls; ++attempt) {
+        if (Lsm6ds3_IsResetComplete(device) == 1) {
+            return 0;
+        }
+    }
+
+    Log_Debug("ERROR: LSM6DS3 did not come out of reset.\n");
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+int Lsm6ds3_StartFifo(Lsm6ds3 *device, const Lsm6ds3FifoConfig *config)
+{
+    if (config->watermarkSamples == 0 ||
+        config->watermarkSamples * WORDS_PER_SAMPLE >= LSM6DS3_FIFO_WORDS) {
+        Log_Debug("ERROR: LSM6DS3 FIFO watermark of %u samples is out of range.\n",
+                  config->watermarkSamples);
+        errno = EINVAL;
+        return -1;
+    }
+
+    device->config = *config;
+
+    // Switching the FIFO to bypass mode empties it. This is written straight away, and the
+    // rest of the configuration is staged and flushed together, so that only the registers
+    // which change are written, with one command for each run of consecutive registers.
+    // DocID026899 Rev 10, S9.7, FIFO_CTRL5 (0Ah)
+    if (Lsm6ds3_WriteRegister(device, fifoCtrl5RegId, fifoModeBypass) != 0) {
+        return -1;
+    }
+
+    // Both sensors sample at the same rate, so the FIFO holds complete samples.
+    // DocID026899 Rev 10, S9.12-13, CTRL1_XL (10h) and CTRL2_G (11h)
+    Lsm6ds3_StageRegister(device, ctrl1XlRegId, 0xFF,
+                          (uint8_t)((config->odr << 4) | (config->accelRange << 2)));
+    Lsm6ds3_StageRegister(device, ctrl2GRegId, 0xFF,
+                          (uint8_t)((config->odr << 4) | (config->gyroRange << 2)));
+
+    // DocID026899 Rev 10, S9.3-7, FIFO_CTRL1 (06h) to FIFO_CTRL5 (0Ah)
+    // FIFO_CTRL1-2: FTH[11:0], the watermark in words.
+    // FIFO_CTRL3: DEC_FIFO_GYRO = DEC_FIFO_XL = 1, store every sample of both sensors.
+    // FIFO_CTRL4: no third or fourth data set.
+    // FIFO_CTRL5: ODR_FIFO = the sensor rate, continuous mode, so when the FIFO is full the
+    // oldest samples are overwritten.
+    unsigned int watermarkWords = config->watermarkSamples * WORDS_PER_SAMPLE;
+    const uint8_t fifoValues[] = {(uint8_t)(watermarkWords & 0xFF),
+                                  (uint8_t)((watermarkWords >> 8) & 0x0F), (1 << 3) | 1, 0,
+                                  (uint8_t)((config->odr << 3) | fifoModeContinuous)};
+    for (size_t i = 0; i < sizeof(fifoValues); ++i) {
+        Lsm6ds3_StageRegister(device, (uint8_t)(fifoCtrl1RegId + i), 0xFF, fifoValues[i]);
+    }
+
+    return Lsm6ds3_FlushRegisters(device);
+}
+
+int Lsm6ds3_EnableFifoWatermarkInterrupt(Lsm6ds3 *device)
+{
+    // DocID026899 Rev 10, S9.8, INT1_CTRL (0Dh); [3] = INT1_FTH, [4] = INT1_FIFO_OVR
+    return Lsm6ds3_UpdateRegister(device, int1CtrlRegId, 0xFF, 0x18);
+}
+
+int Lsm6ds3_ReadFifo(Lsm6ds3 *device, Lsm6ds3Sample *samples, size_t maxSamples,
+                     Lsm6ds3FifoStatus *status)
+{
+    memset(status, 0, sizeof(*status));
+
+    // Read FIFO_STATUS1 to FIFO_STATUS4 together.
+    // DocID026899 Rev 10, S9.51-54, FIFO_STATUS1 (3Ah) to FIFO_STATUS4 (3Dh)
+    uint8_t fifoStatus[4];
+    if (Lsm6ds3_ReadRegisters(device, fifoStatus1RegId, fifoStatus, sizeof(fifoStatus)) != 0) {
+        return -1;
+    }
+
+    size_t unreadWords = fifoStatus[0] | ((fifoStatus[1] & 0x0F) << 8);
+    if (unreadWords == 0 && (fifoStatus[1] & fifoStatus2Empty) == 0) {
+        // DIFF_FIFO is 12 bits wide, so a full FIFO reads as zero.
+        unreadWords = LSM6DS3_FIFO_WORDS;
+    }
+    status->overrun = (fifoStatus[1] & fifoStatus2Overrun) != 0;
+    status->watermarkReached = (fifoStatus[1] & fifoStatus2Watermark) != 0;
+
+    // FIFO_PATTERN is the position within a sample of the next word. It is only non-zero if
+    // the FIFO overran or a previous read stopped part way through a sample, so discard words
+    // up to the start of the next sample.
+    size_t pattern = fifoStatus[2] | ((fifoStatus[3] & 0x03) << 8);
+    if (pattern != 0) {
+        size_t skipWords = WORDS_PER_SAMPLE - pattern;
+        if (skipWords > unreadWords) {
+            return 0;
+        }
+
+        int16_t discard[WORDS_PER_SAMPLE];
+        if (Lsm6ds3_ReadRegisters(device, fifoDataOutLRegId, discard,
+                                  skipWords * sizeof(int16_t)) != 0) {
+            return -1;
+        }
+        unreadWords -= skipWords;
+    }
+
+    size_t availableSamples = unreadWords / WORDS_PER_SAMPLE;
+    size_t samplesToRead = availableSamples < maxSamples ? availableSamples : maxSamples;
+
+    // The FIFO words are little-endian, as is the MT3620, so they are read straight into
+    // the samples.
+    while (status->samplesRead < samplesToRead) {
+        size_t burst = samplesToRead - status->samplesRead;
+        if (burst > LSM6DS3_FIFO_BURST_SAMPLES) {
+            burst = LSM6DS3_FIFO_BURST_SAMPLES;
+        }
+
+        if (Lsm6ds3_ReadRegisters(device, fifoDataOutLRegId, &samples[status->samplesRead],
+                                  burst * sizeof(Lsm6ds3Sample)) != 0) {
+            return -1;
+        }
+        status->samplesRead += burst;
+    }
+
+    status->samplesRemaining = availableSamples - samplesToRead;
+    return 0;
+}
+
+double Lsm6ds3_AccelToG(int16_t raw, Lsm6ds3AccelRange range)
+{
+    // DocID026899 Rev 10, S4.1, Mechanical characteristics; LA_So in mg/LSB.
+    double mgPerLsb;
+    switch (range) {
+    case Lsm6ds3AccelRange_2g:
+        mgPerLsb = 0.061;
+        break;
+    case Lsm6ds3AccelRange_4g:
+        mgPerLsb = 0.122;
+        break;
+    case Lsm6ds3AccelRange_8g:
+        mgPerLsb = 0.244;
+        break;
+    default:
+        mgPerLsb = 0.488;
+        break;
+    }
+
+    return (raw * mgPerLsb) / 1000.0;
+}
+
+double Lsm6ds3_GyroToDps(int16_t raw, Lsm6ds3GyroRange range)
+{
+    // DocID026899 Rev 10, S4.1, Mechanical characteristics; G_So in mdps/LSB.
+    double mdpsPerLsb;
+    switch (range) {
+    case Lsm6ds3GyroRange_245dps:
+        mdpsPerLsb = 8.75;
+        break;
+    case Lsm6ds3GyroRange_500dps:
+        mdpsPerLsb = 17.5;
+        break;
+    case Lsm6ds3GyroRange_1000dps:
+        mdpsPerLsb = 35.0;
+        break;
+    default:
+        mdpsPerLsb = 70.0;
+        break;
+    }
+
+    return (raw * mdpsPerLsb) / 1000.0;
+}
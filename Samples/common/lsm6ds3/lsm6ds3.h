@@ -0,0 +1,309 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Register and bit definitions are from the LSM6DS3 datasheet, DocID026899 Rev 10.
+
+/// <summary>
+///     Output data rates, which are used for the accelerometer, the gyroscope and the FIFO.
+///     The values are the ODR field of CTRL1_XL, CTRL2_G and FIFO_CTRL5.
+/// </summary>
+typedef enum {
+    Lsm6ds3Odr_12_5Hz = 0x1,
+    Lsm6ds3Odr_26Hz = 0x2,
+    Lsm6ds3Odr_52Hz = 0x3,
+    Lsm6ds3Odr_104Hz = 0x4,
+    Lsm6ds3Odr_208Hz = 0x5,
+    Lsm6ds3Odr_416Hz = 0x6,
+    Lsm6ds3Odr_833Hz = 0x7,
+    Lsm6ds3Odr_1_66kHz = 0x8
+} Lsm6ds3Odr;
+
+/// <summary>Accelerometer full-scale ranges. The values are CTRL1_XL[3:2] (FS_XL).</summary>
+typedef enum {
+    Lsm6ds3AccelRange_2g = 0x0,
+    Lsm6ds3AccelRange_4g = 0x2,
+    Lsm6ds3AccelRange_8g = 0x3,
+    Lsm6ds3AccelRange_16g = 0x1
+} Lsm6ds3AccelRange;
+
+/// <summary>Gyroscope full-scale ranges. The values are CTRL2_G[3:2] (FS_G).</summary>
+typedef enum {
+    Lsm6ds3GyroRange_245dps = 0x0,
+    Lsm6ds3GyroRange_500dps = 0x1,
+    Lsm6ds3GyroRange_1000dps = 0x2,
+    Lsm6ds3GyroRange_2000dps = 0x3
+} Lsm6ds3GyroRange;
+
+/// <summary>
+///     Number of 16-bit words in the FIFO. One sample of both sensors takes six words.
+/// </summary>
+#define LSM6DS3_FIFO_WORDS 4096
+
+/// <summary>
+///     Largest number of samples which are read in one bus transaction. This keeps each
+///     transfer well within the limits of the bus driver.
+/// </summary>
+#define LSM6DS3_FIFO_BURST_SAMPLES 32
+
+/// <summary>
+///     One raw sample of both sensors, in the order which the FIFO stores them.
+/// </summary>
+typedef struct {
+    int16_t gyroX;
+    int16_t gyroY;
+    int16_t gyroZ;
+    int16_t accelX;
+    int16_t accelY;
+    int16_t accelZ;
+} Lsm6ds3Sample;
+
+/// <summary>
+///     How the sensors and the FIFO are configured by <see cref="Lsm6ds3_StartFifo" />.
+/// </summary>
+typedef struct {
+    /// <summary>Output data rate of both sensors, which is also the FIFO rate.</summary>
+    Lsm6ds3Odr odr;
+    /// <summary>Accelerometer range.</summary>
+    Lsm6ds3AccelRange accelRange;
+    /// <summary>Gyroscope range.</summary>
+    Lsm6ds3GyroRange gyroRange;
+    /// <summary>Number of samples at which the FIFO watermark flag is set, between 1 and
+    /// LSM6DS3_FIFO_WORDS / 6.</summary>
+    unsigned int watermarkSamples;
+} Lsm6ds3FifoConfig;
+
+/// <summary>
+///     The result of one call to <see cref="Lsm6ds3_ReadFifo" />.
+/// </summary>
+typedef struct {
+    /// <summary>Number of samples which were read.</summary>
+    size_t samplesRead;
+    /// <summary>Number of complete samples which were left in the FIFO because the caller's
+    /// buffer was full.</summary>
+    size_t samplesRemaining;
+    /// <summary>True if the FIFO had filled up and older samples were overwritten.</summary>
+    bool overrun;
+    /// <summary>True if the FIFO held at least the watermark number of samples.</summary>
+    bool watermarkReached;
+} Lsm6ds3FifoStatus;
+
+/// <summary>
+/// <para>Register access for an LSM6DS3 on a particular bus. The driver only uses these
+/// operations, so it works the same way on I2C and SPI; see lsm6ds3_i2c.h and
+/// lsm6ds3_spi.h.</para>
+/// <para>Both operations use the device's address auto-increment, CTRL3_C[2] (IF_INC), which
+/// is set by default. Each call must be a single bus transaction.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Reads consecutive registers, starting at firstRegId. Reads of
+    /// FIFO_DATA_OUT_H wrap back to FIFO_DATA_OUT_L, so a burst read of the FIFO data
+    /// registers drains many samples. Returns 0 on success, or -1 on failure.</summary>
+    int (*readRegisters)(void *bus, uint8_t firstRegId, void *data, size_t length);
+    /// <summary>Writes consecutive registers. command[0] is the first register, and the
+    /// remaining bytes are its value and those of the registers which follow it. Returns 0
+    /// on success, or -1 on failure.</summary>
+    int (*writeRegisters)(void *bus, const uint8_t *command, size_t length);
+} Lsm6ds3TransportOps;
+
+/// <summary>First register in the register cache, FIFO_CTRL1 (06h).</summary>
+#define LSM6DS3_CACHE_FIRST_REG 0x06
+
+/// <summary>Number of registers in the register cache, up to CTRL10_C (19h). These are the
+/// FIFO, interrupt and control registers, whose values only change when they are
+/// written.</summary>
+#define LSM6DS3_CACHE_REG_COUNT 20
+
+/// <summary>
+///     Shadow copies of the control registers. A register's copy is only used once it is
+///     valid, from a write or a read of the register; and a dirty copy has been staged with
+///     <see cref="Lsm6ds3_StageRegister" />, but not yet written to the device.
+/// </summary>
+typedef struct {
+    /// <summary>Value of each register, indexed from LSM6DS3_CACHE_FIRST_REG.</summary>
+    uint8_t values[LSM6DS3_CACHE_REG_COUNT];
+    /// <summary>Bit n is set if values[n] is known.</summary>
+    uint32_t validMask;
+    /// <summary>Bit n is set if values[n] has not been written to the device yet.</summary>
+    uint32_t dirtyMask;
+} Lsm6ds3RegisterCache;
+
+/// <summary>
+///     An LSM6DS3. The caller allocates this struct and initializes it with
+///     <see cref="Lsm6ds3_Init" />. The members must not be modified directly.
+/// </summary>
+typedef struct {
+    /// <summary>Register access for the bus which the device is on.</summary>
+    const Lsm6ds3TransportOps *ops;
+    /// <summary>The bus, which is passed to ops.</summary>
+    void *bus;
+    /// <summary>The configuration which was applied by <see cref="Lsm6ds3_StartFifo" />.
+    /// </summary>
+    Lsm6ds3FifoConfig config;
+    /// <summary>Shadow copies of the control registers.</summary>
+    Lsm6ds3RegisterCache cache;
+} Lsm6ds3;
+
+/// <summary>
+///     Initializes a device. This does not access the device.
+/// </summary>
+/// <param name="device">The device to initialize.</param>
+/// <param name="ops">Register access for the bus, such as
+/// <see cref="Lsm6ds3I2cTransportOps" />.</param>
+/// <param name="bus">The bus, which must stay in memory while the device is used.</param>
+void Lsm6ds3_Init(Lsm6ds3 *device, const Lsm6ds3TransportOps *ops, void *bus);
+
+/// <summary>
+///     Reads consecutive registers in one bus transaction.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <param name="firstRegId">The first register.</param>
+/// <param name="data">Receives the register values.</param>
+/// <param name="length">Number of registers to read.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_ReadRegisters(Lsm6ds3 *device, uint8_t firstRegId, void *data, size_t length);
+
+/// <summary>
+///     Writes one register. If it is in the register cache, its copy is updated too.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <param name="regId">The register.</param>
+/// <param name="value">The new value.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_WriteRegister(Lsm6ds3 *device, uint8_t regId, uint8_t value);
+
+/// <summary>
+///     Sets a bit field of a cached control register, and writes the register through to the
+///     device straight away. The rest of the register is taken from the cache, so a
+///     read-modify-write only reads the register over the bus if its value is not known yet,
+///     and nothing is written if the value does not change.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <param name="regId">The register, from LSM6DS3_CACHE_FIRST_REG to
+/// LSM6DS3_CACHE_FIRST_REG + LSM6DS3_CACHE_REG_COUNT - 1, except the reserved register 0Ch and
+/// WHO_AM_I.</param>
+/// <param name="mask">The bits of the field. If this is 0xFF, the register is not read.</param>
+/// <param name="value">The new value of the field, in place.</param>
+/// <returns>0 on success, or -1 with errno set to EINVAL if the register is not cached, or on
+/// failure of the bus</returns>
+int Lsm6ds3_UpdateRegister(Lsm6ds3 *device, uint8_t regId, uint8_t mask, uint8_t value);
+
+/// <summary>
+///     Sets a bit field of a cached control register, like
+///     <see cref="Lsm6ds3_UpdateRegister" />, but only in the cache. The register is written
+///     by the next <see cref="Lsm6ds3_FlushRegisters" />, together with the other staged
+///     registers.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <param name="regId">The register, as for <see cref="Lsm6ds3_UpdateRegister" />.</param>
+/// <param name="mask">The bits of the field. If this is 0xFF, the register is not read.</param>
+/// <param name="value">The new value of the field, in place.</param>
+/// <returns>0 on success, or -1 with errno set to EINVAL if the register is not cached, or on
+/// failure of the bus</returns>
+int Lsm6ds3_StageRegister(Lsm6ds3 *device, uint8_t regId, uint8_t mask, uint8_t value);
+
+/// <summary>
+///     Writes every staged register to the device. Each run of consecutive staged registers
+///     is written in one bus transaction, with the device's address auto-increment.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <returns>0 on success, or -1 on failure, in which case the registers which were not written
+/// stay staged</returns>
+int Lsm6ds3_FlushRegisters(Lsm6ds3 *device);
+
+/// <summary>
+///     Reads every cached register in one bus transaction, so that later bit field updates do
+///     not need to read them. Staged registers keep their staged values.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_LoadRegisterCache(Lsm6ds3 *device);
+
+/// <summary>
+///     Checks that WHO_AM_I holds the LSM6DS3's fixed value.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <returns>0 on success, or -1 if the register could not be read or has the wrong value.
+/// </returns>
+int Lsm6ds3_CheckWhoAmI(Lsm6ds3 *device);
+
+/// <summary>
+///     Resets the device, to put its registers into their default state, and waits for the
+///     reset to complete. This polls the device over the bus until it has reset; an event-driven
+///     application should call <see cref="Lsm6ds3_StartReset" /> and poll
+///     <see cref="Lsm6ds3_IsResetComplete" /> from a timer instead.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_Reset(Lsm6ds3 *device);
+
+/// <summary>
+///     Starts to reset the device, without waiting for the reset to complete. The register
+///     cache is emptied, as the registers return to their defaults.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_StartReset(Lsm6ds3 *device);
+
+/// <summary>
+///     Checks whether a reset which was started with <see cref="Lsm6ds3_StartReset" /> has
+///     completed. This reads one register, and does not wait.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <returns>1 if the reset has completed, or 0 if the device is still resetting, including
+/// when it does not respond yet</returns>
+int Lsm6ds3_IsResetComplete(Lsm6ds3 *device);
+
+/// <summary>
+///     Configures a device which has been reset, so both sensors sample at the configured
+///     rate and the FIFO stores every sample in continuous mode. The FIFO is emptied first.
+///     This can be called again to change the rate, ranges or watermark at runtime; the
+///     control registers are staged in the register cache, so only those which change are
+///     written.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <param name="config">The configuration, which is copied.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_StartFifo(Lsm6ds3 *device, const Lsm6ds3FifoConfig *config);
+
+/// <summary>
+///     Routes the FIFO watermark and overrun flags to the INT1 pin. INT1 is active high, and
+///     stays asserted until the FIFO has been drained below the watermark, so it can be
+///     sampled as a level instead of reading the FIFO status over the bus.
+/// </summary>
+/// <param name="device">The device, whose FIFO has been started.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_EnableFifoWatermarkInterrupt(Lsm6ds3 *device);
+
+/// <summary>
+///     Drains the FIFO. The FIFO status is read in one transaction, and then the samples are
+///     read in bursts of up to <see cref="LSM6DS3_FIFO_BURST_SAMPLES" />, instead of two
+///     transactions per sample.
+/// </summary>
+/// <param name="device">The device.</param>
+/// <param name="samples">Receives the samples, oldest first.</param>
+/// <param name="maxSamples">Capacity of samples.</param>
+/// <param name="status">Receives the number of samples read and the FIFO flags.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Lsm6ds3_ReadFifo(Lsm6ds3 *device, Lsm6ds3Sample *samples, size_t maxSamples,
+                     Lsm6ds3FifoStatus *status);
+
+/// <summary>
+///     Converts a raw accelerometer value to g.
+/// </summary>
+/// <param name="raw">The raw value.</param>
+/// <param name="range">The range which the value was sampled with.</param>
+/// <returns>The acceleration in g.</returns>
+double Lsm6ds3_AccelToG(int16_t raw, Lsm6ds3AccelRange range);
+
+/// <summary>
+///     Converts a raw gyroscope value to degrees per second.
+/// </summary>
+/// <param name="raw">The raw value.</param>
+/// <param name="range">The range which the value was sampled with.</param>
+/// <returns>The angular rate in degrees per second.</returns>
+double Lsm6ds3_GyroToDps(int16_t raw, Lsm6ds3GyroRange range);
@@ -0,0 +1,150 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "lsm6ds3_convert.h"
+
+// DocID026899 Rev 10, S4.1, Mechanical characteristics. The sensitivity doubles with the
+// range, so each sensor has one multiplier, which is its smallest sensitivity with as many
+// fractional bits as fit in 15 bits, and the shift is one less for each doubling of the range.
+// LA_So = 0.061mg/LSB at 2g; 0.000061 * 2^(16 + 13) = 32749.
+static const int16_t accelMultiplier = 32749;
+static const uint8_t accel2gShift = 13;
+// G_So = 8.75mdps/LSB at 245dps; 0.00875 * 2^(16 + 5) = 18350.
+static const int16_t gyroMultiplier = 18350;
+static const uint8_t gyro245dpsShift = 5;
+
+// The samples are read as arrays of raw values, so they must not be padded.
+_Static_assert(sizeof(Lsm6ds3Sample) == 6 * sizeof(int16_t), "Lsm6ds3Sample is padded");
+_Static_assert(sizeof(Lsm6ds3FixedSample) == 6 * sizeof(int32_t),
+               "Lsm6ds3FixedSample is padded");
+
+void Lsm6ds3_InitScale(Lsm6ds3Scale *scale, Lsm6ds3AccelRange accelRange,
+                       Lsm6ds3GyroRange gyroRange)
+{
+    uint8_t accelDoublings;
+    switch (accelRange) {
+    case Lsm6ds3AccelRange_2g:
+        accelDoublings = 0;
+        break;
+    case Lsm6ds3AccelRange_4g:
+        accelDoublings = 1;
+        break;
+    case Lsm6ds3AccelRange_8g:
+        accelDoublings = 2;
+        break;
+    default:
+        accelDoublings = 3;
+        break;
+    }
+
+    // The FS_G values are already the number of doublings from 245dps.
+    uint8_t gyroDoublings = (uint8_t)(gyroRange & 0x3);
+
+    scale->accelMultiplier = accelMultiplier;
+    scale->accelShift = (uint8_t)(accel2gShift - accelDoublings);
+    scale->gyroMultiplier = gyroMultiplier;
+    scale->gyroShift = (uint8_t)(gyro245dpsShift - gyroDoublings);
+}
+
+static inline int32_t ScaleValue(int16_t raw, int16_t multiplier, uint8_t shift)
+{
+    return ((int32_t)raw * multiplier) >> shift;
+}
+
+#if defined(__ARM_FEATURE_DSP) && !defined(__ARM_NEON)
+// Read two adjacent 16-bit values as one word, with the first in the low half. The Cortex-M4
+// allows unaligned word loads, which the compiler uses for this copy.
+static inline uint32_t LoadPair(const int16_t *p)
+{
+    uint32_t pair;
+    __builtin_memcpy(&pair, p, sizeof(pair));
+    return pair;
+}
+
+// Multiply the low halves of x and y.
+static inline int32_t MultiplyLow(uint32_t x, uint32_t y)
+{
+    int32_t result;
+    __asm__("smulbb %0, %1, %2" : "=r"(result) : "r"(x), "r"(y));
+    return result;
+}
+
+// Multiply the high halves of x and y.
+static inline int32_t MultiplyHigh(uint32_t x, uint32_t y)
+{
+    int32_t result;
+    __asm__("smultt %0, %1, %2" : "=r"(result) : "r"(x), "r"(y));
+    return result;
+}
+#endif
+
+void Lsm6ds3_ConvertBlock(const Lsm6ds3Scale *scale, const Lsm6ds3Sample *samples, size_t count,
+                          Lsm6ds3FixedSample *output)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    // Each sample is two triplets, the gyroscope and then the accelerometer, so a
+    // de-interleaving load of four samples puts each axis in its own vector, with the lanes
+    // alternating between the sensors. An interleaving store of the results puts them back in
+    // sample order.
+    const int16_t laneMultipliers[4] = {scale->gyroMultiplier, scale->accelMultiplier,
+                                        scale->gyroMultiplier, scale->accelMultiplier};
+    // A negative shift count shifts right.
+    const int32_t laneShifts[4] = {-scale->gyroShift, -scale->accelShift, -scale->gyroShift,
+                                   -scale->accelShift};
+    int16x4_t multipliers = vld1_s16(laneMultipliers);
+    int32x4_t shifts = vld1q_s32(laneShifts);
+
+    for (; i + 4 <= count; i += 4) {
+        int16x8x3_t raw = vld3q_s16((const int16_t *)&samples[i]);
+        int32x4x3_t first, second;
+        for (int axis = 0; axis < 3; ++axis) {
+            first.val[axis] =
+                vshlq_s32(vmull_s16(vget_low_s16(raw.val[axis]), multipliers), shifts);
+            second.val[axis] =
+                vshlq_s32(vmull_s16(vget_high_s16(raw.val[axis]), multipliers), shifts);
+        }
+        vst3q_s32((int32_t *)&output[i], first);
+        vst3q_s32((int32_t *)&output[i + 2], second);
+    }
+#elif defined(__ARM_FEATURE_DSP)
+    // The raw values are loaded in pairs and multiplied in place, so each sample takes three
+    // loads instead of six.
+    uint32_t g = (uint16_t)scale->gyroMultiplier;
+    uint32_t a = (uint16_t)scale->accelMultiplier;
+    uint32_t gg = g | (g << 16);
+    uint32_t ga = g | (a << 16);
+    uint32_t aa = a | (a << 16);
+
+    for (; i < count; ++i) {
+        const int16_t *raw = &samples[i].gyroX;
+        uint32_t gyroXY = LoadPair(raw);
+        uint32_t gyroZAccelX = LoadPair(raw + 2);
+        uint32_t accelYZ = LoadPair(raw + 4);
+
+        output[i].gyroX = MultiplyLow(gyroXY, gg) >> scale->gyroShift;
+        output[i].gyroY = MultiplyHigh(gyroXY, gg) >> scale->gyroShift;
+        output[i].gyroZ = MultiplyLow(gyroZAccelX, ga) >> scale->gyroShift;
+        output[i].accelX = MultiplyHigh(gyroZAccelX, ga) >> scale->accelShift;
+        output[i].accelY = MultiplyLow(accelYZ, aa) >> scale->accelShift;
+        output[i].accelZ = MultiplyHigh(accelYZ, aa) >> scale->accelShift;
+    }
+#endif
+
+    for (; i < count; ++i) {
+        const Lsm6ds3Sample *sample = &samples[i];
+        output[i].gyroX = ScaleValue(sample->gyroX, scale->gyroMultiplier, scale->gyroShift);
+        output[i].gyroY = ScaleValue(sample->gyroY, scale->gyroMultiplier, scale->gyroShift);
+        output[i].gyroZ = ScaleValue(sample->gyroZ, scale->gyroMultiplier, scale->gyroShift);
+        output[i].accelX = ScaleValue(sample->accelX, scale->accelMultiplier, scale->accelShift);
+        output[i].accelY = ScaleValue(sample->accelY, scale->accelMultiplier, scale->accelShift);
+        output[i].accelZ = ScaleValue(sample->accelZ, scale->accelMultiplier, scale->accelShift);
+    }
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lsm6ds3.h"
+
+// The conversions only use integer arithmetic and do not use any Applibs APIs, so they can also
+// be built into a real-time capable application.
+
+/// <summary>
+///     Number of fractional bits in the values of <see cref="Lsm6ds3FixedSample" />.
+/// </summary>
+#define LSM6DS3_FIXED_FRACTION_BITS 16
+
+/// <summary>
+///     One sample of both sensors in physical units, as signed Q15.16 fixed-point values. Divide
+///     by 2^LSM6DS3_FIXED_FRACTION_BITS to get the value as a real number. The members are in
+///     the same order as those of <see cref="Lsm6ds3Sample" />.
+/// </summary>
+typedef struct {
+    /// <summary>Angular rates in degrees per second.</summary>
+    int32_t gyroX;
+    int32_t gyroY;
+    int32_t gyroZ;
+    /// <summary>Accelerations in g.</summary>
+    int32_t accelX;
+    int32_t accelY;
+    int32_t accelZ;
+} Lsm6ds3FixedSample;
+
+/// <summary>
+/// <para>The sensitivities of both sensors at particular ranges, as Q-format multipliers.
+/// Each raw value is multiplied by a 16-bit multiplier, and the 32-bit product is shifted
+/// right, so that a block of samples converts with integer multiplies which the processor can
+/// do several at a time.</para>
+/// <para>Initialize it with <see cref="Lsm6ds3_InitScale" />. The members must not be
+/// modified by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Gyroscope sensitivity in dps/LSB, with LSM6DS3_FIXED_FRACTION_BITS +
+    /// gyroShift fractional bits.</summary>
+    int16_t gyroMultiplier;
+    /// <summary>Number of bits which a gyroscope product is shifted right.</summary>
+    uint8_t gyroShift;
+    /// <summary>Accelerometer sensitivity in g/LSB, with LSM6DS3_FIXED_FRACTION_BITS +
+    /// accelShift fractional bits.</summary>
+    int16_t accelMultiplier;
+    /// <summary>Number of bits which an accelerometer product is shifted right.</summary>
+    uint8_t accelShift;
+} Lsm6ds3Scale;
+
+/// <summary>
+///     Sets up the multipliers for the ranges which the samples were taken with. Each
+///     multiplier is within 0.0005% of the nominal sensitivity in the datasheet.
+/// </summary>
+/// <param name="scale">The scale to initialize.</param>
+/// <param name="accelRange">The accelerometer range.</param>
+/// <param name="gyroRange">The gyroscope range.</param>
+void Lsm6ds3_InitScale(Lsm6ds3Scale *scale, Lsm6ds3AccelRange accelRange,
+                       Lsm6ds3GyroRange gyroRange);
+
+/// <summary>
+/// <para>Converts a block of raw samples to physical units. Each value is rounded towards
+/// negative infinity.</para>
+/// <para>On the high-level core, NEON converts four samples at a time. On a real-time core,
+/// the Cortex-M4 DSP extension multiplies the halves of each pair of raw values in place. The
+/// results are the same as those of the portable code.</para>
+/// </summary>
+/// <param name="scale">Scale set up by <see cref="Lsm6ds3_InitScale" />.</param>
+/// <param name="samples">Raw samples, such as those read by
+/// <see cref="Lsm6ds3_ReadFifo" />.</param>
+/// <param name="count">Number of samples.</param>
+/// <param name="output">Receives count converted samples.</param>
+void Lsm6ds3_ConvertBlock(const Lsm6ds3Scale *scale, const Lsm6ds3Sample *samples, size_t count,
+                          Lsm6ds3FixedSample *output);
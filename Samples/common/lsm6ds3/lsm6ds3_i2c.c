@@ -0,0 +1,52 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "lsm6ds3_i2c.h"
+
+static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t actualBytes)
+{
+    if (actualBytes < 0) {
+        Log_Debug("ERROR: %s: errno=%d (%s)\n", desc, errno, strerror(errno));
+        return false;
+    }
+
+    if (actualBytes != (ssize_t)expectedBytes) {
+        Log_Debug("ERROR: %s: transferred %zd bytes; expected %zu\n", desc, actualBytes,
+                  expectedBytes);
+        return false;
+    }
+
+    return true;
+}
+
+static int ReadRegisters(void *bus, uint8_t firstRegId, void *data, size_t length)
+{
+    const Lsm6ds3I2cBus *i2cBus = bus;
+    ssize_t transferredBytes = I2CMaster_WriteThenRead(
+        i2cBus->i2cFd, i2cBus->address, &firstRegId, sizeof(firstRegId), data, length);
+    if (!CheckTransferSize("I2CMaster_WriteThenRead (LSM6DS3)", sizeof(firstRegId) + length,
+                           transferredBytes)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int WriteRegisters(void *bus, const uint8_t *command, size_t length)
+{
+    const Lsm6ds3I2cBus *i2cBus = bus;
+    ssize_t transferredBytes = I2CMaster_Write(i2cBus->i2cFd, i2cBus->address, command, length);
+    if (!CheckTransferSize("I2CMaster_Write (LSM6DS3)", length, transferredBytes)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+const Lsm6ds3TransportOps Lsm6ds3I2cTransportOps = {.readRegisters = ReadRegisters,
+                                                    .writeRegisters = WriteRegisters};
@@ -0,0 +1,25 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include "applibs_versions.h"
+#include <applibs/i2c.h>
+
+#include "lsm6ds3.h"
+
+/// <summary>
+///     An LSM6DS3 on an I2C bus. Pass this as the bus with <see cref="Lsm6ds3I2cTransportOps" />
+///     to <see cref="Lsm6ds3_Init" />.
+/// </summary>
+typedef struct {
+    /// <summary>The I2C interface, which was opened with I2CMaster_Open.</summary>
+    int i2cFd;
+    /// <summary>The device's I2C address.</summary>
+    I2C_DeviceAddress address;
+} Lsm6ds3I2cBus;
+
+/// <summary>
+///     Register access over I2C. Reads write the register address and then read the values
+///     with a repeated start; writes send the address and the values in one write.
+/// </summary>
+extern const Lsm6ds3TransportOps Lsm6ds3I2cTransportOps;
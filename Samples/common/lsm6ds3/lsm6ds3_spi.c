@@ -0,0 +1,76 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "lsm6ds3_spi.h"
+
+static bool CheckTransferSize(const char *desc, size_t expectedBytes, ssize_t actualBytes)
+{
+    if (actualBytes < 0) {
+        Log_Debug("ERROR: %s: errno=%d (%s)\n", desc, errno, strerror(errno));
+        return false;
+    }
+
+    if (actualBytes != (ssize_t)expectedBytes) {
+        Log_Debug("ERROR: %s: transferred %zd bytes; expected %zu\n", desc, actualBytes,
+                  expectedBytes);
+        return false;
+    }
+
+    return true;
+}
+
+static int ReadRegisters(void *bus, uint8_t firstRegId, void *data, size_t length)
+{
+    const Lsm6ds3SpiBus *spiBus = bus;
+    SPIMaster_Transfer transfers[2];
+    if (SPIMaster_InitTransfers(transfers, 2) != 0) {
+        return -1;
+    }
+
+    // Set bit 7 to instruct the accelerometer that this is a read.
+    const uint8_t readCmd = firstRegId | 0x80;
+    transfers[0].flags = SPI_TransferFlags_Write;
+    transfers[0].writeData = &readCmd;
+    transfers[0].length = sizeof(readCmd);
+
+    transfers[1].flags = SPI_TransferFlags_Read;
+    transfers[1].readData = data;
+    transfers[1].length = length;
+
+    ssize_t transferredBytes = SPIMaster_TransferSequential(spiBus->spiFd, transfers, 2);
+    if (!CheckTransferSize("SPIMaster_TransferSequential (LSM6DS3 read)",
+                           sizeof(readCmd) + length, transferredBytes)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int WriteRegisters(void *bus, const uint8_t *command, size_t length)
+{
+    const Lsm6ds3SpiBus *spiBus = bus;
+    SPIMaster_Transfer transfer;
+    if (SPIMaster_InitTransfers(&transfer, 1) != 0) {
+        return -1;
+    }
+
+    transfer.flags = SPI_TransferFlags_Write;
+    transfer.writeData = command;
+    transfer.length = length;
+
+    ssize_t transferredBytes = SPIMaster_TransferSequential(spiBus->spiFd, &transfer, 1);
+    if (!CheckTransferSize("SPIMaster_TransferSequential (LSM6DS3 write)", length,
+                           transferredBytes)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+const Lsm6ds3TransportOps Lsm6ds3SpiTransportOps = {.readRegisters = ReadRegisters,
+                                                    .writeRegisters = WriteRegisters};
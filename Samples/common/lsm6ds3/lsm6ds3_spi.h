@@ -0,0 +1,24 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include "applibs_versions.h"
+#include <applibs/spi.h>
+
+#include "lsm6ds3.h"
+
+/// <summary>
+///     An LSM6DS3 on a SPI bus. Pass this as the bus with <see cref="Lsm6ds3SpiTransportOps" />
+///     to <see cref="Lsm6ds3_Init" />.
+/// </summary>
+typedef struct {
+    /// <summary>The SPI interface and chip select, which were opened with SPIMaster_Open.
+    /// </summary>
+    int spiFd;
+} Lsm6ds3SpiBus;
+
+/// <summary>
+///     Register access over SPI. Each access is one SPIMaster_TransferSequential call, so chip
+///     select stays asserted between the register address and the values.
+/// </summary>
+extern const Lsm6ds3TransportOps Lsm6ds3SpiTransportOps;
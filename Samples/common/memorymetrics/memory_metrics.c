@@ -0,0 +1,309 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "memory_metrics.h"
+
+#ifndef MEMORY_METRICS_TRACKING
+#define MEMORY_METRICS_TRACKING 1
+#endif
+
+#ifndef MEMORY_METRICS_NO_HEAP_AFTER_INIT
+#define MEMORY_METRICS_NO_HEAP_AFTER_INIT 0
+#endif
+
+// Value which identifies the header of a block which these functions allocated.
+#define BLOCK_MAGIC 0x4D454D54u
+
+// Byte with which the painted stack is filled.
+#define STACK_PAINT_BYTE 0xA5
+
+/// <summary>
+///     Header before each block, which is as large as the strictest alignment, so that the
+///     memory after it is aligned as malloc's is.
+/// </summary>
+typedef union {
+    struct {
+        size_t size;
+        uint32_t tag;
+        uint32_t magic;
+    } info;
+    max_align_t alignment;
+} BlockHeader;
+
+// The metrics of the whole application, which every wrapper adds to.
+static MemoryMetrics memoryMetrics = {
+    .isTracking = MEMORY_METRICS_TRACKING != 0,
+    .rejectsLateAllocations = MEMORY_METRICS_NO_HEAP_AFTER_INIT != 0,
+    .tags = {{.name = "other"}},
+    .tagCount = 1};
+
+// The painted area of the main thread's stack.
+static const uint8_t *stackPaintStart = NULL;
+
+MemoryTag MemoryMetrics_AddTag(const char *name)
+{
+    for (size_t i = 0; i < memoryMetrics.tagCount; i++) {
+        if (strcmp(memoryMetrics.tags[i].name, name) == 0) {
+            return (MemoryTag)i;
+        }
+    }
+    if (memoryMetrics.tagCount == MEMORY_METRICS_MAX_TAGS) {
+        Log_Debug("WARNING: Too many memory tags; allocations for %s are counted as other.\n",
+                  name);
+        return MemoryTag_Other;
+    }
+    memoryMetrics.tags[memoryMetrics.tagCount].name = name;
+    return (MemoryTag)memoryMetrics.tagCount++;
+}
+
+static MemoryTagMetrics *GetTagMetrics(MemoryTag tag)
+{
+    if (tag < 0 || (size_t)tag >= memoryMetrics.tagCount) {
+        tag = MemoryTag_Other;
+    }
+    return &memoryMetrics.tags[tag];
+}
+
+/// <summary>
+///     Counts the bytes of a block which has been allocated, or grown, for a tag.
+/// </summary>
+static void AddBytes(MemoryTagMetrics *tagMetrics, size_t bytes)
+{
+    tagMetrics->currentBytes += bytes;
+    if (tagMetrics->currentBytes > tagMetrics->peakBytes) {
+        tagMetrics->peakBytes = tagMetrics->currentBytes;
+    }
+    memoryMetrics.currentBytes += bytes;
+    if (memoryMetrics.currentBytes > memoryMetrics.peakBytes) {
+        memoryMetrics.peakBytes = memoryMetrics.currentBytes;
+    }
+}
+
+static void RemoveBytes(MemoryTagMetrics *tagMetrics, size_t bytes)
+{
+    tagMetrics->currentBytes -= bytes;
+    memoryMetrics.currentBytes -= bytes;
+}
+
+/// <summary>
+///     Finds the header of a block, or returns NULL and logs an error if the memory was not
+///     allocated by these functions.
+/// </summary>
+static BlockHeader *GetHeader(void *pointer)
+{
+    BlockHeader *header = (BlockHeader *)pointer - 1;
+    if (header->info.magic != BLOCK_MAGIC) {
+        Log_Debug("ERROR: Memory at %p was not allocated by MemoryMetrics.\n", pointer);
+        return NULL;
+    }
+    return header;
+}
+
+/// <summary>
+///     Counts a call which allocates or grows a block after the end of initialization, and
+///     decides whether it fails.
+/// </summary>
+/// <returns>true if the call must fail; false if it can go ahead</returns>
+static bool RejectLateAllocation(MemoryTag tag)
+{
+    if (!memoryMetrics.isInitEnded) {
+        return false;
+    }
+
+    MemoryTagMetrics *tagMetrics = GetTagMetrics(tag);
+    ++tagMetrics->lateCalls;
+    if (!MEMORY_METRICS_NO_HEAP_AFTER_INIT) {
+        return false;
+    }
+
+    if (tagMetrics->lateCalls == 1) {
+        Log_Debug("ERROR: Heap allocation for %s after initialization was rejected.\n",
+                  tagMetrics->name);
+    }
+    ++tagMetrics->failures;
+    errno = ENOMEM;
+    return true;
+}
+
+static void *TrackNewBlock(MemoryTag tag, BlockHeader *header, size_t size)
+{
+    MemoryTagMetrics *tagMetrics = GetTagMetrics(tag);
+    ++tagMetrics->allocCalls;
+    if (header == NULL) {
+        ++tagMetrics->failures;
+        return NULL;
+    }
+
+    header->info.size = size;
+    header->info.tag = (uint32_t)(tagMetrics - memoryMetrics.tags);
+    header->info.magic = BLOCK_MAGIC;
+    ++tagMetrics->currentBlocks;
+    AddBytes(tagMetrics, size);
+    return header + 1;
+}
+
+void *MemoryMetrics_Malloc(MemoryTag tag, size_t size)
+{
+    if (RejectLateAllocation(tag)) {
+        return NULL;
+    }
+    if (!MEMORY_METRICS_TRACKING) {
+        return malloc(size);
+    }
+    if (size > SIZE_MAX - sizeof(BlockHeader)) {
+        return TrackNewBlock(tag, NULL, size);
+    }
+    return TrackNewBlock(tag, malloc(sizeof(BlockHeader) + size), size);
+}
+
+void *MemoryMetrics_Calloc(MemoryTag tag, size_t count, size_t size)
+{
+    if (RejectLateAllocation(tag)) {
+        return NULL;
+    }
+    if (!MEMORY_METRICS_TRACKING) {
+        return calloc(count, size);
+    }
+    if (size != 0 && count > (SIZE_MAX - sizeof(BlockHeader)) / size) {
+        return TrackNewBlock(tag, NULL, 0);
+    }
+    return TrackNewBlock(tag, calloc(1, sizeof(BlockHeader) + count * size), count * size);
+}
+
+void *MemoryMetrics_Realloc(MemoryTag tag, void *pointer, size_t size)
+{
+    if (pointer == NULL) {
+        return MemoryMetrics_Malloc(tag, size);
+    }
+    if (!MEMORY_METRICS_TRACKING) {
+        // Without the header, the old size is not known, so only new blocks are rejected.
+        return realloc(pointer, size);
+    }
+
+    BlockHeader *header = GetHeader(pointer);
+    if (header == NULL) {
+        return NULL;
+    }
+    MemoryTagMetrics *tagMetrics = GetTagMetrics((MemoryTag)header->info.tag);
+    size_t oldSize = header->info.size;
+    // A block can still shrink after initialization.
+    if (size > oldSize && RejectLateAllocation((MemoryTag)header->info.tag)) {
+        return NULL;
+    }
+    ++tagMetrics->reallocCalls;
+    BlockHeader *newHeader = (size <= SIZE_MAX - sizeof(BlockHeader))
+                                 ? realloc(header, sizeof(BlockHeader) + size)
+                                 : NULL;
+    if (newHeader == NULL) {
+        ++tagMetrics->failures;
+        return NULL;
+    }
+
+    newHeader->info.size = size;
+    RemoveBytes(tagMetrics, oldSize);
+    AddBytes(tagMetrics, size);
+    return newHeader + 1;
+}
+
+char *MemoryMetrics_Strdup(MemoryTag tag, const char *string)
+{
+    size_t size = strlen(string) + 1;
+    char *copy = MemoryMetrics_Malloc(tag, size);
+    if (copy != NULL) {
+        memcpy(copy, string, size);
+    }
+    return copy;
+}
+
+void MemoryMetrics_Free(void *pointer)
+{
+    if (!MEMORY_METRICS_TRACKING || pointer == NULL) {
+        free(pointer);
+        return;
+    }
+
+    BlockHeader *header = GetHeader(pointer);
+    if (header == NULL) {
+        // Freeing memory of unknown origin could corrupt the heap, so it is leaked instead.
+        return;
+    }
+    MemoryTagMetrics *tagMetrics = GetTagMetrics((MemoryTag)header->info.tag);
+    ++tagMetrics->freeCalls;
+    --tagMetrics->currentBlocks;
+    RemoveBytes(tagMetrics, header->info.size);
+    header->info.magic = 0;
+    free(header);
+}
+
+void MemoryMetrics_EndInit(void)
+{
+    memoryMetrics.isInitEnded = true;
+}
+
+void __attribute__((noinline)) MemoryMetrics_PaintStack(size_t size)
+{
+    // The area is allocated in this function's frame, so that the frames which are in use are
+    // not written. Once this function returns, it is the stack below the caller, which the
+    // deeper calls use.
+    uint8_t *area = __builtin_alloca(size);
+    memset(area, STACK_PAINT_BYTE, size);
+    __asm__ volatile("" : : "r"(area) : "memory");
+
+    stackPaintStart = area;
+    memoryMetrics.stackPaintedBytes = size;
+}
+
+void MemoryMetrics_GetSnapshot(MemoryMetrics *snapshot)
+{
+    // The stack grows down, so the calls which went deepest overwrote the lowest bytes of the
+    // pattern.
+    if (stackPaintStart != NULL) {
+        const volatile uint8_t *area = stackPaintStart;
+        size_t untouched = 0;
+        while (untouched < memoryMetrics.stackPaintedBytes &&
+               area[untouched] == STACK_PAINT_BYTE) {
+            ++untouched;
+        }
+        memoryMetrics.stackPeakBytes = memoryMetrics.stackPaintedBytes - untouched;
+    }
+    *snapshot = memoryMetrics;
+}
+
+void MemoryMetrics_Log(const MemoryMetrics *metrics)
+{
+    if (!metrics->isTracking) {
+        Log_Debug("INFO: Heap allocations are not tracked.\n");
+    } else {
+        Log_Debug("INFO: Heap: %zu bytes allocated, peak %zu bytes.\n", metrics->currentBytes,
+                  metrics->peakBytes);
+        for (size_t i = 0; i < metrics->tagCount; i++) {
+            const MemoryTagMetrics *tag = &metrics->tags[i];
+            if (tag->allocCalls == 0) {
+                continue;
+            }
+            Log_Debug("INFO: Heap %s: %zu bytes in %lu block(s), peak %zu bytes; %lu alloc, %lu "
+                      "realloc, %lu free, %lu failed\n",
+                      tag->name, tag->currentBytes, (unsigned long)tag->currentBlocks,
+                      tag->peakBytes, (unsigned long)tag->allocCalls,
+                      (unsigned long)tag->reallocCalls, (unsigned long)tag->freeCalls,
+                      (unsigned long)tag->failures);
+            if (tag->lateCalls != 0) {
+                Log_Debug("INFO: Heap %s: %lu alloc or realloc after initialization%s\n",
+                          tag->name, (unsigned long)tag->lateCalls,
+                          metrics->rejectsLateAllocations ? ", rejected" : "");
+            }
+        }
+    }
+
+    if (metrics->stackPaintedBytes != 0) {
+        Log_Debug("INFO: Main thread stack: %s%zu of %zu painted bytes used.\n",
+                  metrics->stackPeakBytes == metrics->stackPaintedBytes ? "at least " : "",
+                  metrics->stackPeakBytes, metrics->stackPaintedBytes);
+    }
+}
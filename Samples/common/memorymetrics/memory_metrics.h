@@ -0,0 +1,166 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Maximum number of tags, including <see cref="MemoryTag_Other" />.</summary>
+#define MEMORY_METRICS_MAX_TAGS 8
+
+/// <summary>
+///     Identifies the module which made an allocation, as returned by
+///     <see cref="MemoryMetrics_AddTag" />.
+/// </summary>
+typedef int MemoryTag;
+
+/// <summary>Tag of the allocations which are not made for a tag which has been added, such
+/// as when there are too many tags.</summary>
+#define MemoryTag_Other 0
+
+/// <summary>
+///     The heap allocations which were made for one tag.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the tag, which is logged.</summary>
+    const char *name;
+    /// <summary>Number of bytes which are allocated now, and the most which were allocated at
+    /// once.</summary>
+    size_t currentBytes;
+    size_t peakBytes;
+    /// <summary>Number of blocks which are allocated now.</summary>
+    uint32_t currentBlocks;
+    /// <summary>Number of calls which allocated a block, including calloc and strdup; which
+    /// resized a block; and which freed a block.</summary>
+    uint32_t allocCalls;
+    uint32_t reallocCalls;
+    uint32_t freeCalls;
+    /// <summary>Number of allocations which failed, including those which were rejected after
+    /// <see cref="MemoryMetrics_EndInit" />.</summary>
+    uint32_t failures;
+    /// <summary>Number of calls which allocated or grew a block, or tried to, after
+    /// <see cref="MemoryMetrics_EndInit" />.</summary>
+    uint32_t lateCalls;
+} MemoryTagMetrics;
+
+/// <summary>
+/// <para>The memory metrics of the application. This is a plain structure, so a snapshot is
+/// taken by copying it.</para>
+/// <para>The allocation functions are not thread-safe, so only call them from one thread, such
+/// as the thread which runs the event loop.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Whether the allocations are tracked. If the library was built without
+    /// MEMORY_METRICS_TRACKING, the wrappers only call the C library, and the tags hold no
+    /// counts.</summary>
+    bool isTracking;
+    /// <summary>Whether <see cref="MemoryMetrics_EndInit" /> has been called.</summary>
+    bool isInitEnded;
+    /// <summary>Whether allocations fail after <see cref="MemoryMetrics_EndInit" />, because
+    /// the library was built with MEMORY_METRICS_NO_HEAP_AFTER_INIT.</summary>
+    bool rejectsLateAllocations;
+    MemoryTagMetrics tags[MEMORY_METRICS_MAX_TAGS];
+    size_t tagCount;
+    /// <summary>Number of bytes which are allocated now for all the tags, and the most which
+    /// were allocated at once. Those bytes do not include the header of each block.</summary>
+    size_t currentBytes;
+    size_t peakBytes;
+    /// <summary>Size of the area of the main thread's stack which was painted by
+    /// <see cref="MemoryMetrics_PaintStack" />, or 0 if it has not been painted.</summary>
+    size_t stackPaintedBytes;
+    /// <summary>Most bytes of the painted area which have been used. If this equals
+    /// stackPaintedBytes, the stack may have grown beyond the painted area.</summary>
+    size_t stackPeakBytes;
+} MemoryMetrics;
+
+/// <summary>
+///     Adds a tag for a module's allocations. Adding a tag whose name has already been added
+///     returns the same tag.
+/// </summary>
+/// <param name="name">Name of the tag, which must remain valid.</param>
+/// <returns>The tag, or <see cref="MemoryTag_Other" /> if there are already
+/// MEMORY_METRICS_MAX_TAGS tags</returns>
+MemoryTag MemoryMetrics_AddTag(const char *name);
+
+/// <summary>
+///     Allocates memory with malloc, and counts it for a tag. Each block has a small header,
+///     which records its size and tag, so it must be freed with
+///     <see cref="MemoryMetrics_Free" />, not with free.
+/// </summary>
+/// <param name="tag">The tag.</param>
+/// <param name="size">Number of bytes to allocate.</param>
+/// <returns>The memory, or NULL if it could not be allocated</returns>
+void *MemoryMetrics_Malloc(MemoryTag tag, size_t size);
+
+/// <summary>
+///     Allocates zeroed memory for an array, as calloc does, and counts it for a tag. Free it
+///     with <see cref="MemoryMetrics_Free" />.
+/// </summary>
+/// <param name="tag">The tag.</param>
+/// <param name="count">Number of elements.</param>
+/// <param name="size">Size of each element in bytes.</param>
+/// <returns>The memory, or NULL if it could not be allocated</returns>
+void *MemoryMetrics_Calloc(MemoryTag tag, size_t count, size_t size);
+
+/// <summary>
+///     Resizes memory which was allocated by these functions, as realloc does. The block stays
+///     counted for the tag which allocated it.
+/// </summary>
+/// <param name="tag">Tag of a new block, if pointer is NULL.</param>
+/// <param name="pointer">The memory, or NULL to allocate a new block.</param>
+/// <param name="size">The new size in bytes.</param>
+/// <returns>The resized memory, or NULL if it could not be resized, in which case pointer
+/// is still valid</returns>
+void *MemoryMetrics_Realloc(MemoryTag tag, void *pointer, size_t size);
+
+/// <summary>
+///     Copies a string into memory which is counted for a tag, as strdup does. Free it with
+///     <see cref="MemoryMetrics_Free" />.
+/// </summary>
+/// <param name="tag">The tag.</param>
+/// <param name="string">The string to copy.</param>
+/// <returns>The copy, or NULL if it could not be allocated</returns>
+char *MemoryMetrics_Strdup(MemoryTag tag, const char *string);
+
+/// <summary>
+///     Frees memory which was allocated by these functions. It is safe to call this function
+///     with NULL.
+/// </summary>
+/// <param name="pointer">The memory.</param>
+void MemoryMetrics_Free(void *pointer);
+
+/// <summary>
+/// <para>Marks the end of the application's initialization. From then on, each call which
+/// allocates or grows a block is counted as late for its tag, so that the log shows which
+/// modules still use the heap while the application runs.</para>
+/// <para>If the library was built with MEMORY_METRICS_NO_HEAP_AFTER_INIT, those calls fail
+/// instead, with errno set to ENOMEM, and the first one of each tag is logged. A module which
+/// takes its buffers from static pools, or from an arena which it reserved during
+/// initialization, is not affected, so an application whose modules all do so runs with no
+/// heap allocations at all, and one which does not fails in the same place each time rather
+/// than after months of fragmentation.</para>
+/// </summary>
+void MemoryMetrics_EndInit(void);
+
+/// <summary>
+///     Fills an area of the main thread's stack, below the caller's frame, with a pattern, so
+///     that <see cref="MemoryMetrics_GetSnapshot" /> can find how much of it has been used since.
+///     Call this at the start of main.
+/// </summary>
+/// <param name="size">Size of the area in bytes. It must be less than the stack which remains
+/// for the main thread.</param>
+void MemoryMetrics_PaintStack(size_t size);
+
+/// <summary>
+///     Copies the metrics, and finds how much of the painted stack has been used. Only call
+///     this on the main thread.
+/// </summary>
+/// <param name="snapshot">Receives the metrics.</param>
+void MemoryMetrics_GetSnapshot(MemoryMetrics *snapshot);
+
+/// <summary>
+///     Logs the allocations of each tag which has been used, and the stack high-water mark.
+/// </summary>
+/// <param name="metrics">The metrics.</param>
+void MemoryMetrics_Log(const MemoryMetrics *metrics);
@@ -0,0 +1,30 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+
+#include "metrics.h"
+
+// The registered metrics, in the order in which they were registered.
+static Metric *firstMetric = NULL;
+static Metric *lastMetric = NULL;
+
+void Metrics_Register(Metric *metric)
+{
+    if (metric->isRegistered) {
+        return;
+    }
+    metric->isRegistered = true;
+    metric->next = NULL;
+    if (lastMetric == NULL) {
+        firstMetric = metric;
+    } else {
+        lastMetric->next = metric;
+    }
+    lastMetric = metric;
+}
+
+Metric *Metrics_First(void)
+{
+    return firstMetric;
+}
@@ -0,0 +1,174 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Most buckets of a histogram, including the one for values above its last bound.
+/// </summary>
+#define METRICS_MAX_BUCKETS 8
+
+/// <summary>Longest name of a metric. The name is the telemetry key of a counter or gauge; a
+/// histogram adds the bound of each bucket to it, such as "BatchBytes_256".</summary>
+#define METRICS_MAX_NAME_LENGTH 20
+
+/// <summary>
+///     The kinds of metrics.
+/// </summary>
+typedef enum {
+    /// <summary>A count which only goes up, such as the number of messages sent. The change
+    /// since the last export is sent.</summary>
+    MetricKind_Counter,
+    /// <summary>A level which goes up and down, such as the bytes allocated on the heap. The
+    /// value is sent when it has changed since the last export.</summary>
+    MetricKind_Gauge,
+    /// <summary>The distribution of a measurement, such as the size of each message, in fixed
+    /// buckets. The change in each bucket since the last export is sent.</summary>
+    MetricKind_Histogram
+} MetricKind;
+
+/// <summary>
+///     The part which every metric starts with. The metrics are allocated statically, with the
+///     initializer macros, and added to the registry with <see cref="Metrics_Register" />.
+/// </summary>
+typedef struct Metric {
+    /// <summary>The name, which must remain valid.</summary>
+    const char *name;
+    MetricKind kind;
+    /// <summary>Next metric in the registry, in the order in which they were registered.
+    /// </summary>
+    struct Metric *next;
+    bool isRegistered;
+} Metric;
+
+/// <summary>
+///     A counter. Update it with <see cref="Metrics_Increment" />, <see cref="Metrics_Add" />
+///     or <see cref="Metrics_SetTotal" />.
+/// </summary>
+typedef struct {
+    Metric metric;
+    uint32_t value;
+    /// <summary>The value at the last export, which only the exporter writes.</summary>
+    uint32_t exportedValue;
+} MetricCounter;
+
+/// <summary>
+///     A gauge. Update it with <see cref="Metrics_SetGauge" />.
+/// </summary>
+typedef struct {
+    Metric metric;
+    int32_t value;
+    int32_t exportedValue;
+    bool hasExported;
+} MetricGauge;
+
+/// <summary>
+///     A histogram. Update it with <see cref="Metrics_Observe" />.
+/// </summary>
+typedef struct {
+    Metric metric;
+    /// <summary>Upper bound of each bucket but the last, in ascending order. A value is
+    /// counted in the first bucket whose bound is not below it, or in the last bucket.
+    /// </summary>
+    uint32_t bounds[METRICS_MAX_BUCKETS - 1];
+    size_t bucketCount;
+    uint32_t buckets[METRICS_MAX_BUCKETS];
+    uint32_t exportedBuckets[METRICS_MAX_BUCKETS];
+} MetricHistogram;
+
+/// <summary>
+///     Static initializer for a <see cref="MetricCounter" />.
+/// </summary>
+/// <param name="name_">Name of the counter.</param>
+#define METRIC_COUNTER_INIT(name_)                                        \
+    {                                                                     \
+        .metric = {.name = (name_), .kind = MetricKind_Counter}, .value = 0 \
+    }
+
+/// <summary>
+///     Static initializer for a <see cref="MetricGauge" />.
+/// </summary>
+/// <param name="name_">Name of the gauge.</param>
+#define METRIC_GAUGE_INIT(name_)                                        \
+    {                                                                   \
+        .metric = {.name = (name_), .kind = MetricKind_Gauge}, .value = 0 \
+    }
+
+/// <summary>
+///     Static initializer for a <see cref="MetricHistogram" />, such as
+///     METRIC_HISTOGRAM_INIT("BatchBytes", 64, 256, 1024) for four buckets.
+/// </summary>
+/// <param name="name_">Name of the histogram.</param>
+/// <param name="...">The upper bounds of the buckets, in ascending order, of which there may be
+/// up to METRICS_MAX_BUCKETS - 1.</param>
+#define METRIC_HISTOGRAM_INIT(name_, ...)                                         \
+    {                                                                             \
+        .metric = {.name = (name_), .kind = MetricKind_Histogram},                \
+        .bounds = {__VA_ARGS__},                                                  \
+        .bucketCount = sizeof((uint32_t[]){__VA_ARGS__}) / sizeof(uint32_t) + 1 \
+    }
+
+/// <summary>
+///     Adds a metric to the registry, so that it is exported. Registering a metric again has
+///     no effect. Only register metrics from the thread which exports them, before the first
+///     export.
+/// </summary>
+/// <param name="metric">The metric, such as &amp;counter.metric, which must stay in memory.
+/// </param>
+void Metrics_Register(Metric *metric);
+
+/// <summary>
+///     Gets the first metric in the registry. The others follow it through
+///     <see cref="Metric.next" />.
+/// </summary>
+/// <returns>The first metric, or NULL if none has been registered.</returns>
+Metric *Metrics_First(void);
+
+/// <summary>
+///     Adds one to a counter. This is a single atomic increment, so it can be called from any
+///     thread.
+/// </summary>
+static inline void Metrics_Increment(MetricCounter *counter)
+{
+    __atomic_fetch_add(&counter->value, 1, __ATOMIC_RELAXED);
+}
+
+/// <summary>
+///     Adds an amount to a counter, such as the number of bytes sent.
+/// </summary>
+static inline void Metrics_Add(MetricCounter *counter, uint32_t amount)
+{
+    __atomic_fetch_add(&counter->value, amount, __ATOMIC_RELAXED);
+}
+
+/// <summary>
+///     Sets a counter to a running total which another module keeps, such as the number of
+///     writes in a storage metrics snapshot, so that the change is exported.
+/// </summary>
+static inline void Metrics_SetTotal(MetricCounter *counter, uint32_t total)
+{
+    __atomic_store_n(&counter->value, total, __ATOMIC_RELAXED);
+}
+
+/// <summary>
+///     Sets the value of a gauge.
+/// </summary>
+static inline void Metrics_SetGauge(MetricGauge *gauge, int32_t value)
+{
+    __atomic_store_n(&gauge->value, value, __ATOMIC_RELAXED);
+}
+
+/// <summary>
+///     Counts a value in the bucket of a histogram which holds it. This compares the value with
+///     the bounds, then makes a single atomic increment.
+/// </summary>
+static inline void Metrics_Observe(MetricHistogram *histogram, uint32_t value)
+{
+    size_t bucket = 0;
+    while (bucket < histogram->bucketCount - 1 && value > histogram->bounds[bucket]) {
+        ++bucket;
+    }
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
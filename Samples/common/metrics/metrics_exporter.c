@@ -0,0 +1,166 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics_exporter.h"
+
+// Longest telemetry key: a name, '_', and the bound of a histogram bucket.
+#define MAX_KEY_LENGTH (METRICS_MAX_NAME_LENGTH + 11)
+
+/// <summary>
+///     Readings which are collected for one telemetry object.
+/// </summary>
+typedef struct {
+    char keyStorage[METRICS_EXPORTER_MAX_VALUES][MAX_KEY_LENGTH + 1];
+    const char *keys[METRICS_EXPORTER_MAX_VALUES];
+    double values[METRICS_EXPORTER_MAX_VALUES];
+    size_t count;
+} ExportRecord;
+
+static void MetricsExporterTimerEventHandler(EventData *eventData);
+
+/// <summary>
+///     Adds the collected readings to the batch as one object, and starts the next one.
+/// </summary>
+static void SendRecord(MetricsExporter *exporter, ExportRecord *record)
+{
+    if (record->count == 0) {
+        return;
+    }
+    TelemetryBatcher_AddValues(exporter->batcher, record->keys, record->values, record->count);
+    exporter->valuesSent += (uint32_t)record->count;
+    record->count = 0;
+}
+
+/// <summary>
+///     Adds a reading to the object, sending the object first if it is full. The key is the
+///     name of the metric, followed by the bound of a histogram bucket if suffix is not NULL.
+/// </summary>
+static void AddValue(MetricsExporter *exporter, ExportRecord *record, const char *name,
+                     const char *suffix, double value)
+{
+    if (record->count == METRICS_EXPORTER_MAX_VALUES) {
+        SendRecord(exporter, record);
+    }
+
+    char *key = record->keyStorage[record->count];
+    if (suffix == NULL) {
+        snprintf(key, MAX_KEY_LENGTH + 1, "%.*s", METRICS_MAX_NAME_LENGTH, name);
+    } else {
+        snprintf(key, MAX_KEY_LENGTH + 1, "%.*s_%s", METRICS_MAX_NAME_LENGTH, name, suffix);
+    }
+    record->keys[record->count] = key;
+    record->values[record->count] = value;
+    ++record->count;
+}
+
+static void ExportCounter(MetricsExporter *exporter, ExportRecord *record, MetricCounter *counter)
+{
+    // Unsigned subtraction gives the increase even if the counter has wrapped around.
+    uint32_t value = __atomic_load_n(&counter->value, __ATOMIC_RELAXED);
+    uint32_t increase = value - counter->exportedValue;
+    if (increase != 0) {
+        AddValue(exporter, record, counter->metric.name, NULL, increase);
+        counter->exportedValue = value;
+    }
+}
+
+static void ExportGauge(MetricsExporter *exporter, ExportRecord *record, MetricGauge *gauge)
+{
+    int32_t value = __atomic_load_n(&gauge->value, __ATOMIC_RELAXED);
+    if (!gauge->hasExported || value != gauge->exportedValue) {
+        AddValue(exporter, record, gauge->metric.name, NULL, value);
+        gauge->exportedValue = value;
+        gauge->hasExported = true;
+    }
+}
+
+static void ExportHistogram(MetricsExporter *exporter, ExportRecord *record,
+                            MetricHistogram *histogram)
+{
+    for (size_t i = 0; i < histogram->bucketCount; i++) {
+        uint32_t value = __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        uint32_t increase = value - histogram->exportedBuckets[i];
+        if (increase == 0) {
+            continue;
+        }
+
+        char bound[12];
+        if (i == histogram->bucketCount - 1) {
+            strcpy(bound, "inf");
+        } else {
+            snprintf(bound, sizeof(bound), "%lu", (unsigned long)histogram->bounds[i]);
+        }
+        AddValue(exporter, record, histogram->metric.name, bound, increase);
+        histogram->exportedBuckets[i] = value;
+    }
+}
+
+int MetricsExporter_Init(MetricsExporter *exporter, int epollFd, const struct timespec *period,
+                         TelemetryBatcher *batcher, MetricsCollectHandler collectHandler,
+                         void *context)
+{
+    memset(exporter, 0, sizeof(*exporter));
+    exporter->timerFd = -1;
+    exporter->batcher = batcher;
+    exporter->collectHandler = collectHandler;
+    exporter->context = context;
+    exporter->timerEventData.eventHandler = &MetricsExporterTimerEventHandler;
+
+    exporter->timerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, period, &exporter->timerEventData, EPOLLIN);
+    return (exporter->timerFd < 0) ? -1 : 0;
+}
+
+void MetricsExporter_Export(MetricsExporter *exporter)
+{
+    if (exporter->collectHandler != NULL) {
+        exporter->collectHandler(exporter, exporter->context);
+    }
+
+    static ExportRecord record;
+    record.count = 0;
+    uint32_t valuesSent = exporter->valuesSent;
+
+    for (Metric *metric = Metrics_First(); metric != NULL; metric = metric->next) {
+        switch (metric->kind) {
+        case MetricKind_Counter:
+            ExportCounter(exporter, &record, (MetricCounter *)metric);
+            break;
+        case MetricKind_Gauge:
+            ExportGauge(exporter, &record, (MetricGauge *)metric);
+            break;
+        case MetricKind_Histogram:
+            ExportHistogram(exporter, &record, (MetricHistogram *)metric);
+            break;
+        }
+    }
+    SendRecord(exporter, &record);
+
+    if (exporter->valuesSent != valuesSent) {
+        ++exporter->exports;
+    }
+}
+
+void MetricsExporter_Close(MetricsExporter *exporter)
+{
+    // A zero-initialized exporter has timerFd 0, which it does not own.
+    if (exporter->timerEventData.eventHandler != NULL) {
+        CloseFdAndPrintError(exporter->timerFd, "MetricsExporterTimer");
+    }
+
+    exporter->timerFd = -1;
+}
+
+static void MetricsExporterTimerEventHandler(EventData *eventData)
+{
+    MetricsExporter *exporter = (MetricsExporter *)eventData;
+
+    if (ConsumeTimerFdEvent(exporter->timerFd) != 0) {
+        return;
+    }
+
+    MetricsExporter_Export(exporter);
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "metrics.h"
+#include "telemetry_batcher.h"
+
+/// <summary>Most readings which one export sends in a single telemetry object. The readings of
+/// an export which has more are sent in several objects of the same batch.</summary>
+#define METRICS_EXPORTER_MAX_VALUES 24
+
+struct MetricsExporter;
+
+/// <summary>
+///     Function which is called before each export, so that the application can copy the
+///     metrics which other modules keep into the registry, such as from a storage metrics
+///     snapshot.
+/// </summary>
+/// <param name="exporter">The exporter.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="MetricsExporter_Init" />.</param>
+typedef void (*MetricsCollectHandler)(struct MetricsExporter *exporter, void *context);
+
+/// <summary>
+/// <para>Sends the changes in the registered metrics as telemetry, at the end of each export
+/// period. Each counter and histogram bucket which has changed is sent as its increase, and
+/// each gauge which has changed as its value, together in one object of the telemetry
+/// batch, such as {"TwinUpdates":2,"HeapBytes":5184,"BatchBytes_256":4,"time":1571234567}.
+/// Nothing is sent for a period in which no metric changed.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="MetricsExporter_Init" /> and disposes of it with
+/// <see cref="MetricsExporter_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct MetricsExporter {
+    /// <summary>Event data for the export timer. This is the first member, so the event
+    /// handler can find the exporter.</summary>
+    EventData timerEventData;
+    int timerFd;
+    TelemetryBatcher *batcher;
+    MetricsCollectHandler collectHandler;
+    void *context;
+    /// <summary>Number of exports which sent any readings, and the number of readings they
+    /// sent.</summary>
+    uint32_t exports;
+    uint32_t valuesSent;
+} MetricsExporter;
+
+/// <summary>
+///     Creates the export timer and adds it to an epoll instance.
+/// </summary>
+/// <param name="exporter">Exporter to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="period">Time between exports.</param>
+/// <param name="batcher">The telemetry batcher which the readings are added to. This must
+/// stay in memory until the exporter is closed.</param>
+/// <param name="collectHandler">Function which is called before each export, or NULL.</param>
+/// <param name="context">Value which is passed to collectHandler.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int MetricsExporter_Init(MetricsExporter *exporter, int epollFd, const struct timespec *period,
+                         TelemetryBatcher *batcher, MetricsCollectHandler collectHandler,
+                         void *context);
+
+/// <summary>
+///     Adds the changes since the last export to the telemetry batch now. The batch is sent
+///     when the batcher next flushes it.
+/// </summary>
+/// <param name="exporter">The exporter.</param>
+void MetricsExporter_Export(MetricsExporter *exporter);
+
+/// <summary>
+///     Closes the export timer. It is safe to call this function on an exporter which has been
+///     zero-initialized, or whose initialization failed.
+/// </summary>
+/// <param name="exporter">The exporter.</param>
+void MetricsExporter_Close(MetricsExporter *exporter);
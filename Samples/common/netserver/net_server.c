@@ -0,0 +1,805 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#define _GNU_SOURCE // required for accept4
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "app_log.h"
+#include "net_server.h"
+
+// Most datagrams which are handled in one wakeup, so a busy UDP server does not starve the other
+// events on the epoll instance. The socket is level-triggered, so the rest are handled next.
+#define MAX_DATAGRAMS_PER_EVENT 16
+
+static void HandleListenEvent(EventData *eventData);
+static void HandleDatagramEvent(EventData *eventData);
+static void HandleConnectionEvent(EventData *eventData);
+static void HandleIdleTimerEvent(EventData *eventData);
+static void SetAccepting(NetServer *server, bool accept);
+static NetServerConnection *AllocateConnection(NetServer *server);
+static void RestartIdleTimer(NetServerConnection *connection);
+static int StartReply(NetServerConnection *connection, const struct iovec *buffers,
+                      size_t bufferCount, size_t fileLength);
+static int ContinueReply(NetServerConnection *connection);
+static int SendFileData(NetServerConnection *connection);
+static bool IsReplying(const NetServerConnection *connection);
+static bool DeliverMessage(NetServerConnection *connection, uint8_t *message, size_t length);
+static bool HandleLine(LineReader *reader, char *line, size_t length, void *context);
+static LineReaderResult ReadLines(NetServerConnection *connection);
+static LineReaderResult ReadLengthPrefixed(NetServerConnection *connection);
+static void ProcessInput(NetServerConnection *connection);
+static void Stop(NetServer *server);
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType);
+static void ReportError(const NetServer *server, const char *desc);
+
+static NetServer *EventDataToServer(EventData *eventData)
+{
+    uint8_t *eventData8 = (uint8_t *)eventData;
+    return (NetServer *)(eventData8 - offsetof(NetServer, listenEvent));
+}
+
+static NetServerConnection *EventDataToConnection(EventData *eventData, size_t offset)
+{
+    uint8_t *eventData8 = (uint8_t *)eventData;
+    return (NetServerConnection *)(eventData8 - offset);
+}
+
+int NetServer_Start(NetServer *server, int epollFd, const NetServerConfig *config)
+{
+    // Set the state to unused values so it can be safely cleaned up if only a subset of the
+    // resources are successfully allocated.
+    memset(server, 0, sizeof(*server));
+    server->epollFd = epollFd;
+    server->fd = -1;
+    server->idleTimerWheel.timerFd = -1;
+    for (size_t i = 0; i < NET_SERVER_MAX_CONNECTIONS; ++i) {
+        server->connections[i].fd = -1;
+    }
+
+    bool isUdp = (config->protocol == NetServerProtocol_Udp);
+    bool validLengthField = (config->lengthFieldSize == 1 || config->lengthFieldSize == 2 ||
+                             config->lengthFieldSize == 4);
+    if (config->messageHandler == NULL || config->buffers == NULL || config->bufferSize < 2 ||
+        (!isUdp &&
+         (config->maxConnections == 0 || config->maxConnections > NET_SERVER_MAX_CONNECTIONS)) ||
+        (config->protocol == NetServerProtocol_LengthPrefixed &&
+         (!validLengthField || config->bufferSize <= config->lengthFieldSize)) ||
+        (config->sendBuffers != NULL && config->sendBufferSize == 0)) {
+        Log_Debug("ERROR: Invalid server configuration for port %u.\n", config->port);
+        errno = EINVAL;
+        return -1;
+    }
+
+    server->config = *config;
+    if (isUdp) {
+        server->config.maxConnections = 1;
+    }
+    for (size_t i = 0; i < server->config.maxConnections; ++i) {
+        NetServerConnection *connection = &server->connections[i];
+        connection->eventData.eventHandler = HandleConnectionEvent;
+        connection->idleTimer.eventData.eventHandler = HandleIdleTimerEvent;
+        connection->server = server;
+        connection->buffer = config->buffers + i * config->bufferSize;
+        connection->fileFd = -1;
+        if (config->sendBuffers != NULL) {
+            connection->sendBuffer = config->sendBuffers + i * config->sendBufferSize;
+        }
+    }
+
+    if (isUdp) {
+        server->fd = OpenIpV4Socket(config->address, config->port,
+                                    SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (server->fd < 0) {
+            goto fail;
+        }
+
+        // Datagrams are handled as they arrive, through the one connection, which stands for
+        // the sender of each one in turn.
+        server->connections[0].fd = server->fd;
+        server->listenEvent.eventHandler = HandleDatagramEvent;
+        if (RegisterEventHandlerToEpoll(epollFd, server->fd, &server->listenEvent, EPOLLIN) !=
+            0) {
+            goto fail;
+        }
+        server->isAccepting = true;
+        Log_Debug("INFO: UDP server: Receiving on port %u (fd %d).\n", config->port, server->fd);
+        return 0;
+    }
+
+    // The idle timeouts only need to be roughly right, so a coarse resolution is enough.
+    static const struct timespec idleTimerResolution = {0, 250 * 1000 * 1000};
+    if (TimerWheel_Init(&server->idleTimerWheel, epollFd, &idleTimerResolution) != 0) {
+        goto fail;
+    }
+    // For the same reason they may expire up to a second late, so that connections which went
+    // quiet at about the same time are closed together on one wakeup.
+    static const struct timespec idleTimerSlack = {1, 0};
+    for (size_t i = 0; i < server->config.maxConnections; ++i) {
+        TimerWheel_SetTimerSlack(&server->idleTimerWheel, &server->connections[i].idleTimer,
+                                 &idleTimerSlack);
+    }
+
+    server->fd = OpenIpV4Socket(config->address, config->port,
+                                SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (server->fd < 0) {
+        goto fail;
+    }
+    if (listen(server->fd, config->backlogSize) != 0) {
+        ReportError(server, "listen");
+        goto fail;
+    }
+
+    // Be notified asynchronously when a client connects.
+    server->listenEvent.eventHandler = HandleListenEvent;
+    SetAccepting(server, true);
+    if (!server->isAccepting) {
+        goto fail;
+    }
+
+    Log_Debug("INFO: TCP server: Listening for client connections on port %u (fd %d).\n",
+              config->port, server->fd);
+    return 0;
+
+fail:
+    NetServer_Stop(server);
+    return -1;
+}
+
+int NetServer_Send(NetServerConnection *connection, const struct iovec *buffers,
+                   size_t bufferCount)
+{
+    return StartReply(connection, buffers, bufferCount, 0);
+}
+
+int NetServer_SendFile(NetServerConnection *connection, const struct iovec *header,
+                       size_t headerCount, int fileFd, off_t offset, size_t length)
+{
+    NetServer *server = connection->server;
+    if (server->config.protocol == NetServerProtocol_Udp || fileFd < 0 || offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (IsReplying(connection)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    // The file follows the header, straight away if the header was sent, or else once
+    // EPOLLOUT reports that the socket has room for the rest of it.
+    connection->fileFd = fileFd;
+    connection->fileOffset = offset;
+    connection->fileRemaining = 0;
+    connection->isCopyingFile = false;
+    if (StartReply(connection, header, headerCount, length) != 0) {
+        return -1;
+    }
+    ++server->stats.fileReplies;
+    connection->fileRemaining = length;
+    if (!IovecWriter_IsBusy(&connection->writer) && ContinueReply(connection) == -1) {
+        ReportError(server, "sendfile");
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Starts to send a reply, whose buffers are followed by fileLength bytes of a file. The
+///     length field, if any, counts both.
+/// </summary>
+static int StartReply(NetServerConnection *connection, const struct iovec *buffers,
+                      size_t bufferCount, size_t fileLength)
+{
+    NetServer *server = connection->server;
+    if (connection->fd < 0 || bufferCount >= IOVEC_WRITER_MAX_BUFFERS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Leave space in front for the length field, so the payload is not copied.
+    struct iovec reply[IOVEC_WRITER_MAX_BUFFERS];
+    size_t payloadLength = fileLength;
+    for (size_t i = 0; i < bufferCount; ++i) {
+        reply[i + 1] = buffers[i];
+        payloadLength += buffers[i].iov_len;
+    }
+
+    struct iovec *first = &reply[1];
+    size_t count = bufferCount;
+    size_t replyLength = payloadLength;
+    if (server->config.protocol == NetServerProtocol_LengthPrefixed) {
+        uint8_t size = server->config.lengthFieldSize;
+        if (size < 4 && payloadLength >= (1u << (8 * size))) {
+            Log_Debug("ERROR: Reply of %zu bytes does not fit in the length field.\n",
+                      payloadLength);
+            errno = EMSGSIZE;
+            return -1;
+        }
+        for (uint8_t i = 0; i < size; ++i) {
+            connection->replyLengthField[i] = (uint8_t)(payloadLength >> (8 * (size - 1 - i)));
+        }
+        reply[0].iov_base = connection->replyLengthField;
+        reply[0].iov_len = size;
+        first = &reply[0];
+        ++count;
+        replyLength += size;
+    }
+
+    if (server->config.protocol == NetServerProtocol_Udp) {
+        struct msghdr message = {.msg_name = &connection->peer,
+                                 .msg_namelen = sizeof(connection->peer),
+                                 .msg_iov = first,
+                                 .msg_iovlen = count};
+        ssize_t sent = sendmsg(connection->fd, &message, MSG_DONTWAIT);
+        if (sent < 0) {
+            // The reply is lost, as it would be on the network, and the client resends.
+            ++server->stats.droppedReplies;
+            return -1;
+        }
+        ++server->stats.repliesSent;
+        server->stats.bytesSent += (uint64_t)sent;
+        return 0;
+    }
+
+    if (IsReplying(connection)) {
+        errno = EBUSY;
+        return -1;
+    }
+    int result = IovecWriter_Start(&connection->writer, first, count);
+    if (result == -1) {
+        ReportError(server, "send");
+        return -1;
+    }
+    if (result == 0) {
+        ++server->stats.blockedReplies;
+    }
+    ++server->stats.repliesSent;
+    server->stats.bytesSent += replyLength;
+    return 0;
+}
+
+void NetServer_CloseConnection(NetServerConnection *connection)
+{
+    NetServer *server = connection->server;
+    if (connection->fd < 0 || server->config.protocol == NetServerProtocol_Udp) {
+        return;
+    }
+
+    if (server->config.connectionHandler != NULL) {
+        server->config.connectionHandler(connection, false, server->config.context);
+    }
+    TimerWheel_CancelTimer(&server->idleTimerWheel, &connection->idleTimer);
+    IovecWriter_Cancel(&connection->writer);
+    connection->fileRemaining = 0;
+    UnregisterPersistentEventHandlerFromEpoll(server->epollFd, &connection->eventData);
+    CloseFdAndPrintError(connection->fd, "clientFd");
+    connection->fd = -1;
+    --server->connectionCount;
+    ++server->stats.connectionsClosed;
+
+    // A connection is free again, so accept the clients which are waiting in the backlog.
+    if (!server->isStopped) {
+        SetAccepting(server, true);
+    }
+}
+
+void NetServer_GetStats(const NetServer *server, NetServerStats *stats)
+{
+    *stats = server->stats;
+}
+
+void NetServer_Stop(NetServer *server)
+{
+    // A zero-initialized server has no handler, and fd 0, which it does not own.
+    if (server->config.messageHandler == NULL) {
+        return;
+    }
+
+    // Stop listening first, so that closing the connections does not resume accepting.
+    Stop(server);
+    if (server->config.protocol != NetServerProtocol_Udp) {
+        for (size_t i = 0; i < server->config.maxConnections; ++i) {
+            NetServer_CloseConnection(&server->connections[i]);
+        }
+    }
+    server->connections[0].fd = -1;
+    TimerWheel_Close(&server->idleTimerWheel);
+    CloseFdAndPrintError(server->fd, "listenFd");
+    server->fd = -1;
+    server->config.messageHandler = NULL;
+}
+
+static void HandleListenEvent(EventData *eventData)
+{
+    NetServer *server = EventDataToServer(eventData);
+
+    // Accept every connection which is waiting, so that a burst of clients is served in one
+    // wakeup, until there are none left or every connection is in use.
+    while (server->isAccepting) {
+        struct sockaddr_in peer;
+        socklen_t peerLength = sizeof(peer);
+        int fd = accept4(server->fd, (struct sockaddr *)&peer, &peerLength,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            // The client may have given up before its connection was accepted, so this does not
+            // stop the server.
+            ReportError(server, "accept");
+            if (errno == ECONNABORTED || errno == EINTR) {
+                continue;
+            }
+            Stop(server);
+            if (server->config.stoppedHandler != NULL) {
+                server->config.stoppedHandler(server, server->config.context);
+            }
+            break;
+        }
+
+        NetServerConnection *connection = AllocateConnection(server);
+        connection->fd = fd;
+        connection->peer = peer;
+        ++server->connectionCount;
+        ++server->stats.connectionsAccepted;
+        if (server->connectionCount > server->stats.peakConnections) {
+            server->stats.peakConnections = server->connectionCount;
+        }
+
+        // Register once, rather than each time a read would block. The writer adds EPOLLOUT
+        // only while a reply is waiting for space in the OS TX buffer.
+        IovecWriter_Init(&connection->writer, server->epollFd, fd, &connection->eventData,
+                         EPOLLIN);
+        LineReader_Init(&connection->lineReader, fd, connection->buffer,
+                        server->config.bufferSize, HandleLine, connection);
+        if (RegisterPersistentEventHandlerToEpoll(server->epollFd, fd, &connection->eventData,
+                                                  EPOLLIN) != 0) {
+            --server->connectionCount;
+            CloseFdAndPrintError(fd, "clientFd");
+            connection->fd = -1;
+            continue;
+        }
+
+        // Leave the rest of the clients in the backlog while every connection is in use.
+        if (server->connectionCount == server->config.maxConnections) {
+            APP_LOG_INFO("INFO: TCP server: All %zu connections on port %u are in use.\n",
+                         server->config.maxConnections, server->config.port);
+            ++server->stats.connectionLimitReached;
+            SetAccepting(server, false);
+        }
+
+        if (server->config.connectionHandler != NULL) {
+            server->config.connectionHandler(connection, true, server->config.context);
+        }
+        RestartIdleTimer(connection);
+        ProcessInput(connection);
+    }
+}
+
+static void HandleDatagramEvent(EventData *eventData)
+{
+    NetServer *server = EventDataToServer(eventData);
+    NetServerConnection *connection = &server->connections[0];
+
+    for (int i = 0; i < MAX_DATAGRAMS_PER_EVENT && !server->isStopped; ++i) {
+        socklen_t peerLength = sizeof(connection->peer);
+        // MSG_TRUNC makes recvfrom return the length of a datagram which does not fit.
+        ssize_t received =
+            recvfrom(server->fd, connection->buffer, server->config.bufferSize, MSG_TRUNC,
+                     (struct sockaddr *)&connection->peer, &peerLength);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            // Errors from ICMP messages about earlier replies do not stop the server.
+            if (errno == EINTR || errno == ECONNREFUSED) {
+                continue;
+            }
+            ReportError(server, "recvfrom");
+            Stop(server);
+            if (server->config.stoppedHandler != NULL) {
+                server->config.stoppedHandler(server, server->config.context);
+            }
+            return;
+        }
+
+        server->stats.bytesReceived += (uint64_t)received;
+        if ((size_t)received > server->config.bufferSize) {
+            ++server->stats.oversizedMessages;
+            APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_INFO, 5, 1000,
+                                 "INFO: UDP server: Discarding a datagram of %zd bytes.\n",
+                                 received);
+            continue;
+        }
+        DeliverMessage(connection, connection->buffer, (size_t)received);
+    }
+}
+
+static void HandleConnectionEvent(EventData *eventData)
+{
+    NetServerConnection *connection =
+        EventDataToConnection(eventData, offsetof(NetServerConnection, eventData));
+
+    // The connection may have been closed by an earlier event in the same wakeup.
+    if (connection->fd < 0) {
+        return;
+    }
+
+    // The socket is edge-triggered, so an event which the current operation is not waiting for
+    // can be ignored. Errors and hang-ups are reported by the next recv or send.
+    uint32_t events = eventData->readyEvents;
+    if (IsReplying(connection)) {
+        if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) == 0) {
+            return;
+        }
+        int result = ContinueReply(connection);
+        if (result == 0) {
+            return;
+        }
+        if (result == -1) {
+            ReportError(connection->server, "send");
+            NetServer_CloseConnection(connection);
+            return;
+        }
+    } else if (!connection->waitingForInput ||
+               (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) == 0) {
+        return;
+    }
+
+    // The reply has been sent, or more input has arrived, so handle the next messages.
+    ProcessInput(connection);
+}
+
+static void HandleIdleTimerEvent(EventData *eventData)
+{
+    NetServerConnection *connection =
+        EventDataToConnection(eventData, offsetof(NetServerConnection, idleTimer.eventData));
+
+    APP_LOG_INFO("INFO: TCP server: Closing idle client connection (fd %d).\n", connection->fd);
+    ++connection->server->stats.idleTimeouts;
+    NetServer_CloseConnection(connection);
+}
+
+static void SetAccepting(NetServer *server, bool accept)
+{
+    if (accept == server->isAccepting) {
+        return;
+    }
+
+    int result = accept ? RegisterEventHandlerToEpoll(server->epollFd, server->fd,
+                                                      &server->listenEvent, EPOLLIN)
+                        : UnregisterPersistentEventHandlerFromEpoll(server->epollFd,
+                                                                    &server->listenEvent);
+    if (result == 0) {
+        server->isAccepting = accept;
+    }
+}
+
+static NetServerConnection *AllocateConnection(NetServer *server)
+{
+    // The server only accepts while a connection is free, so one is always found.
+    NetServerConnection *connection = NULL;
+    for (size_t i = 0; i < server->config.maxConnections && connection == NULL; ++i) {
+        if (server->connections[i].fd < 0) {
+            connection = &server->connections[i];
+        }
+    }
+
+    connection->eventData.registeredEvents = 0;
+    connection->length = 0;
+    connection->start = 0;
+    connection->discardRemaining = 0;
+    connection->fileRemaining = 0;
+    connection->waitingForInput = false;
+    connection->userData = NULL;
+    return connection;
+}
+
+static void RestartIdleTimer(NetServerConnection *connection)
+{
+    NetServer *server = connection->server;
+    if (server->config.idleTimeout.tv_sec == 0 && server->config.idleTimeout.tv_nsec == 0) {
+        return;
+    }
+    TimerWheel_SetTimerToSingleExpiry(&server->idleTimerWheel, &connection->idleTimer,
+                                      &server->config.idleTimeout);
+}
+
+/// <summary>
+///     Passes a message to the message handler.
+/// </summary>
+/// <returns>true if the next message can be handled; false if the connection was closed, or
+/// the reply is waiting for EPOLLOUT.</returns>
+static bool DeliverMessage(NetServerConnection *connection, uint8_t *message, size_t length)
+{
+    NetServer *server = connection->server;
+    ++server->stats.messagesReceived;
+    if (!server->config.messageHandler(connection, message, length, server->config.context)) {
+        NetServer_CloseConnection(connection);
+        return false;
+    }
+    return connection->fd >= 0 && !IsReplying(connection);
+}
+
+/// <summary>
+///     Sends more of the reply, after the socket has become writable: the rest of the buffers,
+///     then the rest of the file.
+/// </summary>
+/// <returns>1 if the reply has been sent; 0 if it is waiting for EPOLLOUT; or -1 on failure,
+/// with errno set.</returns>
+static int ContinueReply(NetServerConnection *connection)
+{
+    int result = IovecWriter_Continue(&connection->writer);
+    while (result == 1 && connection->fileRemaining > 0) {
+        result = SendFileData(connection);
+    }
+    if (result == 1) {
+        // Remove the EPOLLOUT which sendfile may have waited for.
+        result = IovecWriter_Continue(&connection->writer);
+    }
+    return result;
+}
+
+/// <summary>
+///     Sends as much of the file as the socket takes, with sendfile, or one chunk through the
+///     send buffer.
+/// </summary>
+/// <returns>1 if the data was sent, and there may be more; 0 if the rest will be sent when the
+/// socket becomes writable; or -1 on failure, with errno set.</returns>
+static int SendFileData(NetServerConnection *connection)
+{
+    NetServer *server = connection->server;
+    if (!connection->isCopyingFile) {
+        ssize_t sent = sendfile(connection->fd, connection->fileFd, &connection->fileOffset,
+                                connection->fileRemaining);
+        if (sent > 0) {
+            connection->fileRemaining -= (size_t)sent;
+            return 1;
+        }
+        if (sent == 0) {
+            // The file is shorter than the reply, whose length has been sent.
+            errno = EIO;
+            return -1;
+        }
+        if (errno == EINTR) {
+            return 1;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return (IovecWriter_WaitForOutput(&connection->writer) == 0) ? 0 : -1;
+        }
+        // Some files cannot be sent with sendfile, so copy them through the send buffer.
+        if ((errno != EINVAL && errno != ENOSYS) || connection->sendBuffer == NULL) {
+            return -1;
+        }
+        connection->isCopyingFile = true;
+        ++server->stats.copiedFileReplies;
+    }
+
+    // The next chunk is only read once the last one has been sent, so one buffer is enough.
+    size_t size = connection->fileRemaining;
+    if (size > server->config.sendBufferSize) {
+        size = server->config.sendBufferSize;
+    }
+    ssize_t bytesRead = pread(connection->fileFd, connection->sendBuffer, size,
+                              connection->fileOffset);
+    if (bytesRead <= 0) {
+        if (bytesRead < 0 && errno == EINTR) {
+            return 1;
+        }
+        if (bytesRead == 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    connection->fileOffset += bytesRead;
+    connection->fileRemaining -= (size_t)bytesRead;
+    const struct iovec chunk = {.iov_base = connection->sendBuffer,
+                                .iov_len = (size_t)bytesRead};
+    return IovecWriter_Start(&connection->writer, &chunk, 1);
+}
+
+static bool IsReplying(const NetServerConnection *connection)
+{
+    return IovecWriter_IsBusy(&connection->writer) || connection->fileRemaining > 0;
+}
+
+static bool HandleLine(LineReader *reader, char *line, size_t length, void *context)
+{
+    return DeliverMessage(context, (uint8_t *)line, length);
+}
+
+static LineReaderResult ReadLines(NetServerConnection *connection)
+{
+    LineReader *reader = &connection->lineReader;
+    uint64_t bytesReceived = reader->bytesReceived;
+    uint32_t oversizedLines = reader->oversizedLines;
+
+    LineReaderResult result = LineReader_Read(reader);
+
+    connection->server->stats.bytesReceived += reader->bytesReceived - bytesReceived;
+    if (reader->oversizedLines != oversizedLines) {
+        connection->server->stats.oversizedMessages += reader->oversizedLines - oversizedLines;
+        APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_INFO, 5, 1000,
+                             "INFO: TCP server: Discarding a line longer than %zu characters.\n",
+                             reader->size - 1);
+    }
+    return result;
+}
+
+/// <summary>
+///     Handles the complete messages in the buffer, then receives more, until the socket would
+///     block or a message stops the delivery.
+/// </summary>
+static LineReaderResult ReadLengthPrefixed(NetServerConnection *connection)
+{
+    NetServer *server = connection->server;
+    size_t fieldSize = server->config.lengthFieldSize;
+
+    for (;;) {
+        while (connection->start < connection->length) {
+            size_t available = connection->length - connection->start;
+            uint8_t *data = connection->buffer + connection->start;
+
+            // Drop the rest of an oversized message as it arrives.
+            if (connection->discardRemaining > 0) {
+                size_t dropped = (available < connection->discardRemaining)
+                                     ? available
+                                     : connection->discardRemaining;
+                connection->discardRemaining -= dropped;
+                connection->start += dropped;
+                continue;
+            }
+
+            if (available < fieldSize) {
+                break;
+            }
+            size_t messageLength = 0;
+            for (size_t i = 0; i < fieldSize; ++i) {
+                messageLength = (messageLength << 8) | data[i];
+            }
+            if (messageLength > server->config.bufferSize - fieldSize) {
+                ++server->stats.oversizedMessages;
+                APP_LOG_RATE_LIMITED(APP_LOG_LEVEL_INFO, 5, 1000,
+                                     "INFO: TCP server: Discarding a message of %zu bytes.\n",
+                                     messageLength);
+                connection->start += fieldSize;
+                connection->discardRemaining = messageLength;
+                continue;
+            }
+            if (available < fieldSize + messageLength) {
+                break;
+            }
+
+            connection->start += fieldSize + messageLength;
+            if (!DeliverMessage(connection, data + fieldSize, messageLength)) {
+                return LineReaderResult_Stopped;
+            }
+        }
+
+        // Move the start of an incomplete message to the start of the buffer, to make room. The
+        // messages before it have been handled, and their replies sent.
+        if (connection->start != 0) {
+            memmove(connection->buffer, connection->buffer + connection->start,
+                    connection->length - connection->start);
+            connection->length -= connection->start;
+            connection->start = 0;
+        }
+
+        ssize_t received = recv(connection->fd, connection->buffer + connection->length,
+                                server->config.bufferSize - connection->length, 0);
+        if (received > 0) {
+            connection->length += (size_t)received;
+            server->stats.bytesReceived += (uint64_t)received;
+        } else if (received == 0) {
+            return LineReaderResult_Closed;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return LineReaderResult_WouldBlock;
+        } else if (errno != EINTR) {
+            return LineReaderResult_Error;
+        }
+    }
+}
+
+/// <summary>
+///     Handles the messages from a client until no more input is available, a reply has to
+///     wait for space in the OS TX buffer, or the connection is closed. No more requests are read
+///     while a reply waits, so a client which does not read its replies is not buffered for.
+/// </summary>
+static void ProcessInput(NetServerConnection *connection)
+{
+    NetServer *server = connection->server;
+    uint64_t bytesReceived = server->stats.bytesReceived;
+    connection->waitingForInput = false;
+
+    LineReaderResult result = (server->config.protocol == NetServerProtocol_Line)
+                                  ? ReadLines(connection)
+                                  : ReadLengthPrefixed(connection);
+
+    // The connection may have been closed by the message handler.
+    if (connection->fd < 0) {
+        return;
+    }
+    if (server->stats.bytesReceived != bytesReceived) {
+        RestartIdleTimer(connection);
+    }
+
+    switch (result) {
+    // The reply is waiting for EPOLLOUT, and reading resumes once it has been sent.
+    case LineReaderResult_Stopped:
+        return;
+
+    // If the receive buffer is empty then wait for an EPOLLIN event.
+    case LineReaderResult_WouldBlock:
+        connection->waitingForInput = true;
+        return;
+
+    case LineReaderResult_Closed:
+        APP_LOG_INFO("INFO: TCP server: Client has closed connection (fd %d).\n", connection->fd);
+        NetServer_CloseConnection(connection);
+        return;
+
+    default:
+        ReportError(server, "recv");
+        NetServer_CloseConnection(connection);
+        return;
+    }
+}
+
+static void Stop(NetServer *server)
+{
+    server->isStopped = true;
+    if (server->fd < 0) {
+        return;
+    }
+    if (server->config.protocol == NetServerProtocol_Udp) {
+        if (server->isAccepting) {
+            UnregisterPersistentEventHandlerFromEpoll(server->epollFd, &server->listenEvent);
+            server->isAccepting = false;
+        }
+    } else {
+        SetAccepting(server, false);
+    }
+}
+
+static int OpenIpV4Socket(in_addr_t ipAddr, uint16_t port, int sockType)
+{
+    int fd = socket(AF_INET, sockType, /* protocol */ 0);
+    if (fd < 0) {
+        Log_Debug("ERROR: Could not open a socket: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    // Enable rebinding soon after a socket has been closed.
+    int enableReuseAddr = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enableReuseAddr, sizeof(enableReuseAddr)) !=
+        0) {
+        Log_Debug("ERROR: Could not set SO_REUSEADDR: %s (%d).\n", strerror(errno), errno);
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ipAddr;
+    addr.sin_port = htons(port);
+    if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        Log_Debug("ERROR: Could not bind to port %u: %s (%d).\n", port, strerror(errno), errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void ReportError(const NetServer *server, const char *desc)
+{
+    Log_Debug("ERROR: Server on port %u: \"%s\", errno=%d (%s)\n", server->config.port, desc,
+              errno, strerror(errno));
+}
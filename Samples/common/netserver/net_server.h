@@ -0,0 +1,307 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "iovec_writer.h"
+#include "line_reader.h"
+#include "timer_wheel.h"
+
+#ifndef NET_SERVER_MAX_CONNECTIONS
+/// <summary>Most TCP connections which one server can hold. Define this before building to
+/// change it.</summary>
+#define NET_SERVER_MAX_CONNECTIONS 32
+#endif
+
+/// <summary>How a <see cref="NetServer" /> receives requests and sends replies.</summary>
+typedef enum {
+    /// <summary>TCP, where each message is a line which ends with '\r' or '\n'. The terminator is
+    /// not included in the message, and empty lines are skipped.</summary>
+    NetServerProtocol_Line,
+    /// <summary>TCP, where each message starts with a length field, which holds the number of
+    /// bytes which follow it, as in Modbus-TCP-like binary protocols. The length field is not
+    /// included in the message, and is added to each reply by
+    /// <see cref="NetServer_Send" />.</summary>
+    NetServerProtocol_LengthPrefixed,
+    /// <summary>UDP, where each datagram is a message and each reply is sent back to its sender.
+    /// </summary>
+    NetServerProtocol_Udp
+} NetServerProtocol;
+
+struct NetServer;
+struct NetServerConnection;
+
+/// <summary>
+///     Function which is called with each message which a server receives.
+/// </summary>
+/// <param name="connection">The connection which received the message. For UDP, this stands
+/// for the sender of the datagram.</param>
+/// <param name="message">The message. It is in the connection's buffer, can be modified in
+/// place, and is valid until the reply has been sent.</param>
+/// <param name="length">Length of the message in bytes.</param>
+/// <param name="context">The context from the server's configuration.</param>
+/// <returns>true to keep the connection open; false to close it.</returns>
+typedef bool (*NetServerMessageHandler)(struct NetServerConnection *connection, uint8_t *message,
+                                        size_t length, void *context);
+
+/// <summary>
+///     Function which is called when a TCP connection is accepted or closed.
+/// </summary>
+/// <param name="connection">The connection.</param>
+/// <param name="connected">true when it was accepted, false when it is being closed.</param>
+/// <param name="context">The context from the server's configuration.</param>
+typedef void (*NetServerConnectionHandler)(struct NetServerConnection *connection,
+                                           bool connected, void *context);
+
+/// <summary>
+///     Function which is called when the server stops, because its listening or UDP socket
+///     failed.
+/// </summary>
+/// <param name="server">The server.</param>
+/// <param name="context">The context from the server's configuration.</param>
+typedef void (*NetServerStoppedHandler)(struct NetServer *server, void *context);
+
+/// <summary>
+///     Settings for <see cref="NetServer_Start" />.
+/// </summary>
+typedef struct {
+    NetServerProtocol protocol;
+    /// <summary>IP address to which the socket is bound, in network byte order.</summary>
+    in_addr_t address;
+    /// <summary>Port to which the socket is bound.</summary>
+    uint16_t port;
+    /// <summary>Listening socket queue length, for TCP.</summary>
+    int backlogSize;
+    /// <summary>Number of TCP connections which can be open at once, up to
+    /// NET_SERVER_MAX_CONNECTIONS. While this many are open, further clients wait in the
+    /// backlog. UDP servers have one.</summary>
+    size_t maxConnections;
+    /// <summary>Receive buffers of the connections: maxConnections buffers of bufferSize bytes
+    /// each, one after the other. It must remain valid until the server is stopped.</summary>
+    uint8_t *buffers;
+    /// <summary>Size of the buffer of each connection. This limits the longest message, which
+    /// is one byte shorter than the buffer for lines, and the buffer size less the length
+    /// field for length-prefixed messages. Longer messages are discarded.</summary>
+    size_t bufferSize;
+    /// <summary>Size of the length field in bytes, for
+    /// <see cref="NetServerProtocol_LengthPrefixed" />: 1, 2 or 4. It is big-endian.</summary>
+    uint8_t lengthFieldSize;
+    /// <summary>Optional send buffers for <see cref="NetServer_SendFile" />: maxConnections
+    /// buffers of sendBufferSize bytes each, one after the other. A file is copied through the
+    /// buffer of its connection, a chunk at a time, only if it cannot be sent with sendfile. If
+    /// this is NULL, such files cannot be sent.</summary>
+    uint8_t *sendBuffers;
+    size_t sendBufferSize;
+    /// <summary>How long a TCP client can send nothing before its connection is closed, or zero
+    /// to keep idle connections open.</summary>
+    struct timespec idleTimeout;
+    NetServerMessageHandler messageHandler;
+    /// <summary>Optional function which is called when a connection is accepted or
+    /// closed.</summary>
+    NetServerConnectionHandler connectionHandler;
+    /// <summary>Optional function which is called when the server stops.</summary>
+    NetServerStoppedHandler stoppedHandler;
+    /// <summary>Value which is passed to the handlers.</summary>
+    void *context;
+} NetServerConfig;
+
+/// <summary>
+///     Counters which show the load on a <see cref="NetServer" />.
+/// </summary>
+typedef struct {
+    /// <summary>TCP connections which have been accepted and closed.</summary>
+    uint32_t connectionsAccepted;
+    uint32_t connectionsClosed;
+    /// <summary>TCP connections which were closed because their clients were idle.</summary>
+    uint32_t idleTimeouts;
+    /// <summary>Most TCP connections which have been open at once.</summary>
+    size_t peakConnections;
+    /// <summary>Times when every connection was in use, so accepting was paused.</summary>
+    uint32_t connectionLimitReached;
+    /// <summary>Messages which were passed to the message handler.</summary>
+    uint32_t messagesReceived;
+    /// <summary>Bytes which were received, including length fields and line
+    /// terminators.</summary>
+    uint64_t bytesReceived;
+    /// <summary>Messages which were discarded because they did not fit in the buffer.</summary>
+    uint32_t oversizedMessages;
+    /// <summary>Replies which have been sent, and their total length including length
+    /// fields.</summary>
+    uint32_t repliesSent;
+    uint64_t bytesSent;
+    /// <summary>TCP replies which had to wait for EPOLLOUT, during which the connection's
+    /// requests were not read.</summary>
+    uint32_t blockedReplies;
+    /// <summary>UDP replies which were dropped because the socket could not take them.</summary>
+    uint32_t droppedReplies;
+    /// <summary>Replies which were sent with <see cref="NetServer_SendFile" />, and those of them
+    /// which were copied through the send buffer because sendfile could not be used.</summary>
+    uint32_t fileReplies;
+    uint32_t copiedFileReplies;
+} NetServerStats;
+
+/// <summary>
+///     State of one connection. For UDP, the server has a single connection, whose peer is the
+///     sender of the datagram which is being handled.
+/// </summary>
+typedef struct NetServerConnection {
+    /// <summary>Event data for the client socket. This is the first member, so the event
+    /// handler can find the connection.</summary>
+    EventData eventData;
+    /// <summary>Closes the connection when the client has sent nothing for the idle
+    /// timeout.</summary>
+    TimerWheelTimer idleTimer;
+    struct NetServer *server;
+    /// <summary>Client socket, or -1 if the connection is not in use.</summary>
+    int fd;
+    /// <summary>Address of the client.</summary>
+    struct sockaddr_in peer;
+    /// <summary>Receive buffer, which is part of the configured buffers.</summary>
+    uint8_t *buffer;
+    /// <summary>Splits the data into lines, for <see cref="NetServerProtocol_Line" />.</summary>
+    LineReader lineReader;
+    /// <summary>For <see cref="NetServerProtocol_LengthPrefixed" />: number of bytes in the
+    /// buffer, the offset of the first message which has not been handled, and the number of
+    /// bytes of an oversized message which remain to be discarded.</summary>
+    size_t length;
+    size_t start;
+    size_t discardRemaining;
+    /// <summary>Whether the socket has no more data until its next EPOLLIN.</summary>
+    bool waitingForInput;
+    /// <summary>Whether a message is waiting for its reply to be sent before the next one is
+    /// read.</summary>
+    bool waitingForReply;
+    /// <summary>Sends the replies.</summary>
+    IovecWriter writer;
+    /// <summary>The length field of the reply which is being sent.</summary>
+    uint8_t replyLengthField[4];
+    /// <summary>For <see cref="NetServer_SendFile" />: the file, the offset of its next byte to
+    /// send, and the number of bytes which remain to be sent after the header.</summary>
+    int fileFd;
+    off_t fileOffset;
+    size_t fileRemaining;
+    /// <summary>Whether the file is copied through the send buffer, because sendfile could not
+    /// be used.</summary>
+    bool isCopyingFile;
+    /// <summary>Send buffer, which is part of the configured send buffers, or NULL.</summary>
+    uint8_t *sendBuffer;
+    /// <summary>Value which the message handler can use for the state of its protocol, such as
+    /// a session. It is NULL when the connection is accepted.</summary>
+    void *userData;
+} NetServerConnection;
+
+/// <summary>
+/// <para>Serves a request/response protocol on a TCP or UDP port, for services on the local
+/// network such as the echo server, a Modbus-TCP bridge or a configuration API. Several
+/// servers can run on the same epoll instance.</para>
+/// <para>TCP clients are accepted until accept4 returns EAGAIN, into a fixed pool of
+/// connections whose receive buffers the caller provides, so no memory is allocated per
+/// connection or per message. Sockets are registered edge-triggered, and each one is read until
+/// it would block, splitting the data into messages which are passed to the message
+/// handler.</para>
+/// <para>The handler replies with <see cref="NetServer_Send" />, which sends a list of buffers
+/// with writev, or with <see cref="NetServer_SendFile" />, which streams part of a file. If the
+/// client is not reading and the reply has to wait for EPOLLOUT, no more of its requests are
+/// read until the reply has been sent, so a slow client cannot make the server buffer an
+/// unbounded amount of data.</para>
+/// <para>The caller allocates this struct, starts it with <see cref="NetServer_Start" /> and
+/// disposes of it with <see cref="NetServer_Stop" />. The members must not be modified
+/// directly.</para>
+/// </summary>
+typedef struct NetServer {
+    /// <summary>Event data for the listening or UDP socket.</summary>
+    EventData listenEvent;
+    int epollFd;
+    /// <summary>The listening socket for TCP, or the socket for UDP.</summary>
+    int fd;
+    NetServerConfig config;
+    /// <summary>Whether the listening socket is registered. It is unregistered while every
+    /// connection is in use.</summary>
+    bool isAccepting;
+    /// <summary>Whether the server has been stopped, so it does not accept again.</summary>
+    bool isStopped;
+    NetServerConnection connections[NET_SERVER_MAX_CONNECTIONS];
+    size_t connectionCount;
+    /// <summary>The idle timers of the connections.</summary>
+    TimerWheel idleTimerWheel;
+    NetServerStats stats;
+} NetServer;
+
+/// <summary>
+///     Opens the socket and starts serving.
+/// </summary>
+/// <param name="server">Server to start. This must stay in memory until it is stopped.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="config">The protocol, address, buffers and handlers. This is copied.</param>
+/// <returns>0 on success, or -1 on failure, with errno set to EINVAL if the configuration is
+/// invalid.</returns>
+int NetServer_Start(NetServer *server, int epollFd, const NetServerConfig *config);
+
+/// <summary>
+///     Sends a reply on a connection, as a list of buffers such as a header and a payload,
+///     without copying them. For length-prefixed messages, the length field is added in front.
+///     Call this at most once per message, from the message handler.
+/// </summary>
+/// <param name="connection">The connection which received the message.</param>
+/// <param name="buffers">The buffers. For TCP, the data must remain valid until it has been
+/// sent, which is before the next message is passed to the handler.</param>
+/// <param name="bufferCount">Number of buffers, up to IOVEC_WRITER_MAX_BUFFERS - 1.</param>
+/// <returns>0 on success, or -1 on failure. The connection is closed after the handler returns
+/// if a TCP reply fails.</returns>
+int NetServer_Send(NetServerConnection *connection, const struct iovec *buffers,
+                   size_t bufferCount);
+
+/// <summary>
+/// <para>Sends a reply on a TCP connection which consists of a header and part of a file, such as
+/// a file in the image package. The header is sent with writev, then the file with sendfile, so
+/// its contents are not copied through the application. If the kernel cannot sendfile from the
+/// file, it is read into the connection's send buffer a chunk at a time instead, so no memory is
+/// allocated for the reply either way. For length-prefixed messages, the length field counts the
+/// header and the file data. Call this at most once per message, from the message
+/// handler.</para>
+/// <para>Like other replies, the data is sent as the client reads it, and no more requests are
+/// read from the client until all of it has been sent.</para>
+/// </summary>
+/// <param name="connection">The connection which received the message.</param>
+/// <param name="header">The buffers of the header, which may be empty. The data must remain valid
+/// until it has been sent.</param>
+/// <param name="headerCount">Number of buffers, up to IOVEC_WRITER_MAX_BUFFERS - 1.</param>
+/// <param name="fileFd">The file, which must remain open until the reply has been sent, which is
+/// before the next message is passed to the handler, or until the connection is closed. The
+/// server does not close it, or change its file offset.</param>
+/// <param name="offset">Offset of the first byte of the file to send.</param>
+/// <param name="length">Number of bytes of the file to send. The connection is closed if the file
+/// ends before they have been sent.</param>
+/// <returns>0 on success, or -1 on failure, with errno set to EINVAL for a UDP server. The
+/// connection is closed after the handler returns if the reply fails.</returns>
+int NetServer_SendFile(NetServerConnection *connection, const struct iovec *header,
+                       size_t headerCount, int fileFd, off_t offset, size_t length);
+
+/// <summary>
+///     Closes a TCP connection. It is safe to call this from the message handler, and the
+///     connection should not be used afterwards.
+/// </summary>
+/// <param name="connection">The connection.</param>
+void NetServer_CloseConnection(NetServerConnection *connection);
+
+/// <summary>
+///     Takes a snapshot of a server's counters.
+/// </summary>
+/// <param name="server">The server.</param>
+/// <param name="stats">Receives the counters.</param>
+void NetServer_GetStats(const NetServer *server, NetServerStats *stats);
+
+/// <summary>
+///     Closes every connection and the socket. It is safe to call this function on a server
+///     which has been zero-initialized, or whose start failed. Do not call it from a handler.
+/// </summary>
+/// <param name="server">The server.</param>
+void NetServer_Stop(NetServer *server);
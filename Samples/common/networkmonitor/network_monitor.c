@@ -0,0 +1,219 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <applibs/log.h>
+
+#include "network_monitor.h"
+
+static void NetworkMonitorTimerEventHandler(EventData *eventData);
+
+static bool IsLonger(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec != b->tv_sec) ? (a->tv_sec > b->tv_sec) : (a->tv_nsec > b->tv_nsec);
+}
+
+/// <summary>
+///     Reads the IPv4 address of the interface.
+/// </summary>
+/// <returns>The address, or INADDR_ANY if the interface has none</returns>
+static struct in_addr GetInterfaceAddress(const NetworkMonitor *monitor)
+{
+    struct in_addr address = {.s_addr = htonl(INADDR_ANY)};
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, monitor->config.interfaceName, sizeof(request.ifr_name) - 1);
+    request.ifr_addr.sa_family = AF_INET;
+    if (monitor->socketFd >= 0 && ioctl(monitor->socketFd, SIOCGIFADDR, &request) == 0) {
+        address = ((const struct sockaddr_in *)&request.ifr_addr)->sin_addr;
+    }
+    return address;
+}
+
+/// <summary>
+///     Reads the current state of the network.
+/// </summary>
+static void ReadState(const NetworkMonitor *monitor, NetworkMonitorState *state)
+{
+    memset(state, 0, sizeof(*state));
+
+    if (monitor->config.interfaceName == NULL) {
+        bool isReady = false;
+        if (Networking_IsNetworkingReady(&isReady) != 0) {
+            Log_Debug("ERROR: Networking_IsNetworkingReady: %s (%d).\n", strerror(errno), errno);
+        }
+        state->isReady = isReady;
+        return;
+    }
+
+    // EAGAIN means that the networking stack is not ready yet.
+    if (Networking_GetInterfaceConnectionStatus(monitor->config.interfaceName, &state->status) !=
+        0) {
+        if (errno != EAGAIN) {
+            Log_Debug("ERROR: Networking_GetInterfaceConnectionStatus for '%s': %s (%d).\n",
+                      monitor->config.interfaceName, strerror(errno), errno);
+        }
+        state->status = 0;
+        return;
+    }
+    state->isReady =
+        (state->status & monitor->config.requiredStatus) == monitor->config.requiredStatus;
+    if (state->status & Networking_InterfaceConnectionStatus_IpAvailable) {
+        state->address = GetInterfaceAddress(monitor);
+    }
+}
+
+/// <summary>
+///     Arms the timer for the next check, after the current interval.
+/// </summary>
+static void ArmTimer(NetworkMonitor *monitor)
+{
+    if (SetTimerFdToSingleExpiry(monitor->timerFd, &monitor->interval) != 0) {
+        Log_Debug("ERROR: Could not arm the network monitor timer.\n");
+    }
+}
+
+/// <summary>
+///     Checks the state of the network, calls the handlers if it has changed, and works out the
+///     interval until the next check.
+/// </summary>
+static void CheckState(NetworkMonitor *monitor)
+{
+    NetworkMonitorState state;
+    ReadState(monitor, &state);
+    ++monitor->checks;
+
+    uint32_t events = 0;
+    if (state.isReady != monitor->state.isReady) {
+        events |= state.isReady ? NetworkMonitorEvent_Up : NetworkMonitorEvent_Down;
+    }
+    if (state.address.s_addr != monitor->state.address.s_addr) {
+        events |= NetworkMonitorEvent_AddressChanged;
+    }
+    bool statusChanged = (state.status != monitor->state.status);
+    monitor->state = state;
+
+    // Check again soon after any change, because the next one, such as an address following
+    // the link, usually comes shortly after.
+    if (events != 0 || statusChanged) {
+        monitor->interval = monitor->config.minInterval;
+    } else {
+        const struct timespec *longest =
+            state.isReady ? &monitor->config.readyInterval : &monitor->config.waitingInterval;
+        monitor->interval.tv_sec *= 2;
+        monitor->interval.tv_nsec *= 2;
+        if (monitor->interval.tv_nsec >= 1000 * 1000 * 1000) {
+            monitor->interval.tv_sec += 1;
+            monitor->interval.tv_nsec -= 1000 * 1000 * 1000;
+        }
+        if (IsLonger(&monitor->interval, longest)) {
+            monitor->interval = *longest;
+        }
+    }
+    ArmTimer(monitor);
+
+    if (events == 0) {
+        return;
+    }
+    ++monitor->changes;
+    Log_Debug("INFO: Network %s is %s (status 0x%02x, address %s).\n",
+              monitor->config.interfaceName != NULL ? monitor->config.interfaceName : "access",
+              state.isReady ? "ready" : "not ready", state.status, inet_ntoa(state.address));
+    for (size_t i = 0; i < monitor->handlerCount; i++) {
+        monitor->handlers[i](monitor, events, &monitor->state, monitor->contexts[i]);
+    }
+}
+
+static void NetworkMonitorTimerEventHandler(EventData *eventData)
+{
+    NetworkMonitor *monitor = (NetworkMonitor *)eventData;
+    if (ConsumeTimerFdEvent(monitor->timerFd) != 0) {
+        return;
+    }
+    CheckState(monitor);
+}
+
+int NetworkMonitor_Init(NetworkMonitor *monitor, int epollFd, const NetworkMonitorConfig *config)
+{
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->timerFd = -1;
+    monitor->socketFd = -1;
+    monitor->config = *config;
+    monitor->timerEventData.eventHandler = &NetworkMonitorTimerEventHandler;
+
+    if (config->minInterval.tv_sec == 0 && config->minInterval.tv_nsec == 0) {
+        Log_Debug("ERROR: The network monitor interval must not be zero.\n");
+        return -1;
+    }
+    if (config->interfaceName != NULL) {
+        monitor->socketFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (monitor->socketFd < 0) {
+            Log_Debug("WARNING: Could not open a socket to read the address of '%s': %s (%d).\n",
+                      config->interfaceName, strerror(errno), errno);
+        }
+    }
+
+    static const struct timespec disarmed = {0, 0};
+    monitor->interval = config->minInterval;
+    monitor->timerFd =
+        CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &monitor->timerEventData, EPOLLIN);
+    if (monitor->timerFd < 0) {
+        return -1;
+    }
+
+    // The first check is made as soon as the event loop runs.
+    static const struct timespec immediately = {0, 1};
+    return SetTimerFdToSingleExpiry(monitor->timerFd, &immediately);
+}
+
+int NetworkMonitor_AddHandler(NetworkMonitor *monitor, NetworkMonitorHandler handler,
+                              void *context)
+{
+    if (monitor->handlerCount == NETWORK_MONITOR_MAX_HANDLERS) {
+        Log_Debug("ERROR: Too many network monitor handlers.\n");
+        return -1;
+    }
+    monitor->handlers[monitor->handlerCount] = handler;
+    monitor->contexts[monitor->handlerCount] = context;
+    ++monitor->handlerCount;
+
+    if (monitor->state.isReady) {
+        handler(monitor, NetworkMonitorEvent_Up, &monitor->state, context);
+    }
+    return 0;
+}
+
+void NetworkMonitor_Check(NetworkMonitor *monitor)
+{
+    CheckState(monitor);
+    if (monitor->interval.tv_sec != monitor->config.minInterval.tv_sec ||
+        monitor->interval.tv_nsec != monitor->config.minInterval.tv_nsec) {
+        monitor->interval = monitor->config.minInterval;
+        ArmTimer(monitor);
+    }
+}
+
+bool NetworkMonitor_IsReady(const NetworkMonitor *monitor)
+{
+    return monitor->state.isReady;
+}
+
+void NetworkMonitor_Close(NetworkMonitor *monitor)
+{
+    // A zero-initialized monitor has fds 0, which it does not own.
+    if (monitor->timerEventData.eventHandler != NULL) {
+        CloseFdAndPrintError(monitor->timerFd, "NetworkMonitorTimer");
+        CloseFdAndPrintError(monitor->socketFd, "NetworkMonitorSocket");
+    }
+
+    monitor->timerFd = -1;
+    monitor->socketFd = -1;
+}
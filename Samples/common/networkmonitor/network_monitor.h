@@ -0,0 +1,155 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include <applibs/networking.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Number of handlers which can be added to one monitor.</summary>
+#define NETWORK_MONITOR_MAX_HANDLERS 4
+
+struct NetworkMonitor;
+
+/// <summary>
+///     Flags for the changes which a <see cref="NetworkMonitor" /> reports.
+/// </summary>
+typedef enum {
+    /// <summary>The network has become ready.</summary>
+    NetworkMonitorEvent_Up = 1 << 0,
+    /// <summary>The network is no longer ready.</summary>
+    NetworkMonitorEvent_Down = 1 << 1,
+    /// <summary>The IPv4 address of the interface has changed, such as when a new DHCP lease
+    /// is obtained. This is reported with NetworkMonitorEvent_Up and NetworkMonitorEvent_Down
+    /// when the address is obtained and lost.</summary>
+    NetworkMonitorEvent_AddressChanged = 1 << 2
+} NetworkMonitorEvent;
+
+/// <summary>
+///     The state of the network, as of the last check.
+/// </summary>
+typedef struct {
+    /// <summary>Whether the network is ready, according to the configuration.</summary>
+    bool isReady;
+    /// <summary>The connection status of the interface, or 0 if it is not known.</summary>
+    Networking_InterfaceConnectionStatus status;
+    /// <summary>The IPv4 address of the interface, or INADDR_ANY if it has none or no
+    /// interface is monitored.</summary>
+    struct in_addr address;
+} NetworkMonitorState;
+
+/// <summary>
+///     Function which is called when the state of the network changes.
+/// </summary>
+/// <param name="monitor">The monitor.</param>
+/// <param name="events">The changes, as a combination of <see cref="NetworkMonitorEvent" />
+/// flags.</param>
+/// <param name="state">The new state.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="NetworkMonitor_AddHandler" />.</param>
+typedef void (*NetworkMonitorHandler)(struct NetworkMonitor *monitor, uint32_t events,
+                                      const NetworkMonitorState *state, void *context);
+
+/// <summary>
+///     What a <see cref="NetworkMonitor" /> watches, and how often.
+/// </summary>
+typedef struct {
+    /// <summary>Name of the interface, such as "wlan0" or "eth0", or NULL to watch whether
+    /// the device has internet connectivity, with Networking_IsNetworkingReady.</summary>
+    const char *interfaceName;
+    /// <summary>Connection status flags which the interface must have to be ready, such as
+    /// Networking_InterfaceConnectionStatus_IpAvailable. With 0, the interface is ready as
+    /// soon as the networking stack reports its status.</summary>
+    Networking_InterfaceConnectionStatus requiredStatus;
+    /// <summary>Interval after the monitor starts and after each change. It doubles after each
+    /// check which finds no change.</summary>
+    struct timespec minInterval;
+    /// <summary>Longest interval while the network is not ready, which bounds how late a
+    /// service starts when the network becomes ready.</summary>
+    struct timespec waitingInterval;
+    /// <summary>Longest interval while the network is ready, which bounds how late a loss of
+    /// the network or a new address is noticed.</summary>
+    struct timespec readyInterval;
+} NetworkMonitorConfig;
+
+/// <summary>
+/// <para>Watches the state of the network, and calls its handlers when the network becomes
+/// ready, stops being ready, or the address of the interface changes. The applications start
+/// their services from the handlers, rather than each polling the network on its own
+/// timer.</para>
+/// <para>Applications cannot be notified of these changes, so they are checked on a timer. The
+/// interval is short after a change, while a service is most likely waiting for the next one,
+/// and doubles with each check which finds none: up to waitingInterval while the network is not
+/// ready, and up to the longer readyInterval once it is, so an idle device is not woken every
+/// second. Call <see cref="NetworkMonitor_Check" /> when a service finds out that the network
+/// was lost, to check again at once.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="NetworkMonitor_Init" /> and disposes of it with
+/// <see cref="NetworkMonitor_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct NetworkMonitor {
+    /// <summary>Event data for the check timer. This is the first member, so the event handler
+    /// can find the monitor.</summary>
+    EventData timerEventData;
+    int timerFd;
+    /// <summary>Socket through which the address of the interface is read.</summary>
+    int socketFd;
+    NetworkMonitorConfig config;
+    NetworkMonitorState state;
+    /// <summary>Interval until the next check.</summary>
+    struct timespec interval;
+    NetworkMonitorHandler handlers[NETWORK_MONITOR_MAX_HANDLERS];
+    void *contexts[NETWORK_MONITOR_MAX_HANDLERS];
+    size_t handlerCount;
+    /// <summary>Number of checks, and of the changes which they found.</summary>
+    uint32_t checks;
+    uint32_t changes;
+} NetworkMonitor;
+
+/// <summary>
+///     Creates the check timer and adds it to an epoll instance. The first check is made as
+///     soon as the event loop runs, so add the handlers before then.
+/// </summary>
+/// <param name="monitor">Monitor to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="config">What is watched, and how often. This is copied.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int NetworkMonitor_Init(NetworkMonitor *monitor, int epollFd, const NetworkMonitorConfig *config);
+
+/// <summary>
+///     Adds a function which is called when the state of the network changes. If the network is
+///     already ready, the function is called at once with NetworkMonitorEvent_Up.
+/// </summary>
+/// <param name="monitor">The monitor.</param>
+/// <param name="handler">The function.</param>
+/// <param name="context">Value which is passed to the function.</param>
+/// <returns>0 on success, or -1 if NETWORK_MONITOR_MAX_HANDLERS have been added</returns>
+int NetworkMonitor_AddHandler(NetworkMonitor *monitor, NetworkMonitorHandler handler,
+                              void *context);
+
+/// <summary>
+///     Checks the state of the network now, calls the handlers if it has changed, and starts
+///     checking at the shortest interval again.
+/// </summary>
+/// <param name="monitor">The monitor.</param>
+void NetworkMonitor_Check(NetworkMonitor *monitor);
+
+/// <summary>
+///     Gets whether the network was ready at the last check, without making a system call.
+/// </summary>
+/// <param name="monitor">The monitor.</param>
+bool NetworkMonitor_IsReady(const NetworkMonitor *monitor);
+
+/// <summary>
+///     Closes the check timer. It is safe to call this function on a monitor which has been
+///     zero-initialized, or whose initialization failed.
+/// </summary>
+/// <param name="monitor">The monitor.</param>
+void NetworkMonitor_Close(NetworkMonitor *monitor);
@@ -0,0 +1,268 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "perf_profile.h"
+
+#define MS_TIMESPEC(ms) {(ms) / 1000, ((ms) % 1000) * 1000 * 1000}
+
+// Balanced holds the values which the samples used before they had profiles. LowPower stretches
+// every period so that the device wakes less often, and MaxThroughput keeps more requests in
+// flight and sends telemetry sooner.
+static const PerfProfile defaultProfiles[PERF_PROFILE_COUNT] = {
+    [PerfProfileId_LowPower] = {.id = PerfProfileId_LowPower,
+                                .eventLoop = {.busyPollPeriod = MS_TIMESPEC(250),
+                                              .idlePollPeriod = MS_TIMESPEC(10000),
+                                              .inputIdleSamplePeriod = MS_TIMESPEC(200)},
+                                .dfu = {.packetReceiptInterval = 32},
+                                .messageProtocol = {.maxOutstandingRequests = 2},
+                                .webClient = {.maxConcurrentRequests = 2, .maxHostConnections = 1},
+                                .telemetry = {.flushPeriod = MS_TIMESPEC(300000),
+                                              .aggregate = true},
+                                .sensor = {.samplePeriod = MS_TIMESPEC(30000)}},
+    [PerfProfileId_Balanced] = {.id = PerfProfileId_Balanced,
+                                .eventLoop = {.busyPollPeriod = MS_TIMESPEC(100),
+                                              .idlePollPeriod = MS_TIMESPEC(1000),
+                                              .inputIdleSamplePeriod = MS_TIMESPEC(50)},
+                                .dfu = {.packetReceiptInterval = 16},
+                                .messageProtocol = {.maxOutstandingRequests = 4},
+                                .webClient = {.maxConcurrentRequests = 4, .maxHostConnections = 2},
+                                .telemetry = {.flushPeriod = MS_TIMESPEC(60000),
+                                              .aggregate = true},
+                                .sensor = {.samplePeriod = MS_TIMESPEC(5000)}},
+    [PerfProfileId_MaxThroughput] = {
+        .id = PerfProfileId_MaxThroughput,
+        .eventLoop = {.busyPollPeriod = MS_TIMESPEC(20),
+                      .idlePollPeriod = MS_TIMESPEC(1000),
+                      .inputIdleSamplePeriod = MS_TIMESPEC(0)},
+        .dfu = {.packetReceiptInterval = 64},
+        .messageProtocol = {.maxOutstandingRequests = 4},
+        .webClient = {.maxConcurrentRequests = 8, .maxHostConnections = 4},
+        .telemetry = {.flushPeriod = MS_TIMESPEC(10000), .aggregate = false},
+        .sensor = {.samplePeriod = MS_TIMESPEC(1000)}}};
+
+static const char *const profileNames[PERF_PROFILE_COUNT] = {
+    [PerfProfileId_LowPower] = "LowPower",
+    [PerfProfileId_Balanced] = "Balanced",
+    [PerfProfileId_MaxThroughput] = "MaxThroughput"};
+
+typedef enum {
+    ParameterType_Milliseconds,
+    ParameterType_Count,
+    ParameterType_Bool
+} ParameterType;
+
+/// <summary>
+///     A parameter which can be overridden, and where it is kept in a <see cref="PerfProfile" />.
+/// </summary>
+typedef struct {
+    const char *name;
+    ParameterType type;
+    size_t offset;
+    double min;
+    double max;
+} Parameter;
+
+// The ranges keep an override within what the subsystems accept, so that a mistyped value in
+// the device twin cannot stop the device from waking or flood a link. Each subsystem still limits
+// a value to what its own buffers hold.
+static const Parameter parameters[PERF_PROFILE_PARAMETER_COUNT] = {
+    {"EventLoopBusyPollMs", ParameterType_Milliseconds,
+     offsetof(PerfProfile, eventLoop.busyPollPeriod), 10, 10000},
+    {"EventLoopIdlePollMs", ParameterType_Milliseconds,
+     offsetof(PerfProfile, eventLoop.idlePollPeriod), 1000, 600000},
+    {"InputIdleSampleMs", ParameterType_Milliseconds,
+     offsetof(PerfProfile, eventLoop.inputIdleSamplePeriod), 0, 1000},
+    {"DfuPacketReceiptInterval", ParameterType_Count,
+     offsetof(PerfProfile, dfu.packetReceiptInterval), 0, 256},
+    {"MessageProtocolWindow", ParameterType_Count,
+     offsetof(PerfProfile, messageProtocol.maxOutstandingRequests), 1, 16},
+    {"WebClientMaxRequests", ParameterType_Count,
+     offsetof(PerfProfile, webClient.maxConcurrentRequests), 1, 64},
+    {"WebClientMaxConnections", ParameterType_Count,
+     offsetof(PerfProfile, webClient.maxHostConnections), 0, 64},
+    {"TelemetryFlushMs", ParameterType_Milliseconds, offsetof(PerfProfile, telemetry.flushPeriod),
+     1000, 3600000},
+    {"TelemetryAggregate", ParameterType_Bool, offsetof(PerfProfile, telemetry.aggregate), 0, 1},
+    {"SensorSamplePeriodMs", ParameterType_Milliseconds, offsetof(PerfProfile, sensor.samplePeriod),
+     100, 3600000}};
+
+static const Parameter *FindParameter(const char *name, size_t length, size_t *index)
+{
+    for (size_t i = 0; i < PERF_PROFILE_PARAMETER_COUNT; ++i) {
+        if (strncmp(parameters[i].name, name, length) == 0 &&
+            parameters[i].name[length] == '\0') {
+            *index = i;
+            return &parameters[i];
+        }
+    }
+    return NULL;
+}
+
+static double GetParameter(const PerfProfile *profile, const Parameter *parameter)
+{
+    const char *field = (const char *)profile + parameter->offset;
+    switch (parameter->type) {
+    case ParameterType_Milliseconds: {
+        const struct timespec *period = (const struct timespec *)field;
+        return (double)period->tv_sec * 1000 + (double)(period->tv_nsec / (1000 * 1000));
+    }
+    case ParameterType_Count:
+        return *(const uint32_t *)field;
+    case ParameterType_Bool:
+        return *(const bool *)field ? 1 : 0;
+    }
+    return 0;
+}
+
+static void SetParameter(PerfProfile *profile, const Parameter *parameter, double value)
+{
+    char *field = (char *)profile + parameter->offset;
+    switch (parameter->type) {
+    case ParameterType_Milliseconds: {
+        uint32_t ms = (uint32_t)value;
+        *(struct timespec *)field = (struct timespec)MS_TIMESPEC(ms);
+        break;
+    }
+    case ParameterType_Count:
+        *(uint32_t *)field = (uint32_t)value;
+        break;
+    case ParameterType_Bool:
+        *(bool *)field = value != 0;
+        break;
+    }
+}
+
+const PerfProfile *PerfProfile_GetDefaults(PerfProfileId id)
+{
+    return ((unsigned int)id < PERF_PROFILE_COUNT) ? &defaultProfiles[id] : NULL;
+}
+
+const char *PerfProfile_GetName(PerfProfileId id)
+{
+    return ((unsigned int)id < PERF_PROFILE_COUNT) ? profileNames[id] : "Unknown";
+}
+
+bool PerfProfile_FindId(const char *name, size_t length, PerfProfileId *id)
+{
+    for (size_t i = 0; i < PERF_PROFILE_COUNT; ++i) {
+        if (strncmp(profileNames[i], name, length) == 0 && profileNames[i][length] == '\0') {
+            *id = (PerfProfileId)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerfProfileSelection_Init(PerfProfileSelection *selection, PerfProfileId id)
+{
+    memset(selection, 0, sizeof(*selection));
+    selection->id = id;
+}
+
+int PerfProfileSelection_SetOverride(PerfProfileSelection *selection, const char *name,
+                                     size_t length, double value)
+{
+    size_t index;
+    const Parameter *parameter = FindParameter(name, length, &index);
+    // The comparisons are false for NaN, so it is rejected too.
+    if (parameter == NULL || !(value >= parameter->min && value <= parameter->max)) {
+        return -1;
+    }
+    if (parameter->type != ParameterType_Bool && value != (double)(uint32_t)value) {
+        return -1;
+    }
+
+    selection->isOverridden[index] = true;
+    selection->overrides[index] = value;
+    return 0;
+}
+
+int PerfProfileSelection_ClearOverride(PerfProfileSelection *selection, const char *name,
+                                       size_t length)
+{
+    size_t index;
+    if (FindParameter(name, length, &index) == NULL) {
+        return -1;
+    }
+    selection->isOverridden[index] = false;
+    selection->overrides[index] = 0;
+    return 0;
+}
+
+/// <summary>
+///     Builds the profile which a selection stands for, from the defaults and the overrides.
+/// </summary>
+static void BuildProfile(const PerfProfileSelection *selection, PerfProfile *profile)
+{
+    *profile = defaultProfiles[selection->id];
+    for (size_t i = 0; i < PERF_PROFILE_PARAMETER_COUNT; ++i) {
+        if (selection->isOverridden[i]) {
+            SetParameter(profile, &parameters[i], selection->overrides[i]);
+        }
+    }
+}
+
+void PerfProfileManager_Init(PerfProfileManager *manager, PerfProfileId id)
+{
+    memset(manager, 0, sizeof(*manager));
+    if ((unsigned int)id >= PERF_PROFILE_COUNT) {
+        id = PerfProfileId_Balanced;
+    }
+    PerfProfileSelection_Init(&manager->selection, id);
+    BuildProfile(&manager->selection, &manager->active);
+}
+
+int PerfProfileManager_AddHandler(PerfProfileManager *manager, PerfProfileChangedHandler handler,
+                                  void *context)
+{
+    if (manager->handlerCount >= PERF_PROFILE_MAX_HANDLERS) {
+        return -1;
+    }
+    manager->handlers[manager->handlerCount] = handler;
+    manager->contexts[manager->handlerCount] = context;
+    ++manager->handlerCount;
+    return 0;
+}
+
+const PerfProfile *PerfProfileManager_GetActive(const PerfProfileManager *manager)
+{
+    return &manager->active;
+}
+
+const PerfProfileSelection *PerfProfileManager_GetSelection(const PerfProfileManager *manager)
+{
+    return &manager->selection;
+}
+
+int PerfProfileManager_Apply(PerfProfileManager *manager, const PerfProfileSelection *selection)
+{
+    if ((unsigned int)selection->id >= PERF_PROFILE_COUNT) {
+        return -1;
+    }
+
+    PerfProfile profile;
+    BuildProfile(selection, &profile);
+    manager->selection = *selection;
+
+    // The profiles are compared by their parameters rather than with memcmp, which would also
+    // compare the padding.
+    bool changed = profile.id != manager->active.id;
+    for (size_t i = 0; i < PERF_PROFILE_PARAMETER_COUNT && !changed; ++i) {
+        changed = GetParameter(&profile, &parameters[i]) !=
+                  GetParameter(&manager->active, &parameters[i]);
+    }
+    if (!changed) {
+        return 0;
+    }
+
+    PerfProfile previous = manager->active;
+    manager->active = profile;
+    ++manager->changeCount;
+    for (size_t i = 0; i < manager->handlerCount; ++i) {
+        manager->handlers[i](&manager->active, &previous, manager->contexts[i]);
+    }
+    return 1;
+}
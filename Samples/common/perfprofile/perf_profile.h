@@ -0,0 +1,240 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/// <summary>
+///     The named performance profiles.
+/// </summary>
+typedef enum {
+    /// <summary>Wakes the device as little as possible, for battery-powered
+    /// deployments.</summary>
+    PerfProfileId_LowPower,
+    /// <summary>The default of each sample, for most deployments.</summary>
+    PerfProfileId_Balanced,
+    /// <summary>Keeps as much in flight as the links allow, for line-powered deployments and
+    /// the lab.</summary>
+    PerfProfileId_MaxThroughput
+} PerfProfileId;
+
+/// <summary>Number of named profiles.</summary>
+#define PERF_PROFILE_COUNT 3
+
+/// <summary>Number of parameters which <see cref="PerfProfileSelection_SetOverride" /> can
+/// override, across all the subsystems.</summary>
+#define PERF_PROFILE_PARAMETER_COUNT 10
+
+/// <summary>
+///     The profile which applications select at startup. Set the PERF_PROFILE CMake variable
+///     to LowPower, Balanced or MaxThroughput to change it.
+/// </summary>
+#ifndef PERF_PROFILE_DEFAULT
+#define PERF_PROFILE_DEFAULT PerfProfileId_Balanced
+#endif
+
+/// <summary>
+///     How often the event loop wakes for work which it polls, such as
+///     IoTHubDeviceClient_LL_DoWork, and for inputs which are at rest.
+/// </summary>
+typedef struct {
+    /// <summary>Time between polls while work is waiting. Parameter
+    /// "EventLoopBusyPollMs".</summary>
+    struct timespec busyPollPeriod;
+    /// <summary>Longest time between polls while nothing is waiting, up to which the period
+    /// backs off. Parameter "EventLoopIdlePollMs".</summary>
+    struct timespec idlePollPeriod;
+    /// <summary>Time between samples of inputs which are at rest, or {0, 0} to sample them at
+    /// the debounce period. Parameter "InputIdleSampleMs".</summary>
+    struct timespec inputIdleSamplePeriod;
+} PerfEventLoopProfile;
+
+/// <summary>
+///     How an external MCU is updated over DFU.
+/// </summary>
+typedef struct {
+    /// <summary>Number of writes per packet receipt notification, as for
+    /// SetPacketReceiptInterval. A longer interval keeps more writes in flight and wakes the
+    /// application less often, but more is written again after an error. Parameter
+    /// "DfuPacketReceiptInterval".</summary>
+    uint32_t packetReceiptInterval;
+} PerfDfuProfile;
+
+/// <summary>
+///     How the BLE message protocol uses its UART link.
+/// </summary>
+typedef struct {
+    /// <summary>Number of requests which wait for their responses at once. Parameter
+    /// "MessageProtocolWindow".</summary>
+    uint32_t maxOutstandingRequests;
+} PerfMessageProtocolProfile;
+
+/// <summary>
+///     How many web requests run at once.
+/// </summary>
+typedef struct {
+    /// <summary>Parameter "WebClientMaxRequests".</summary>
+    uint32_t maxConcurrentRequests;
+    /// <summary>Connections which are open to each host at once. Parameter
+    /// "WebClientMaxConnections".</summary>
+    uint32_t maxHostConnections;
+} PerfWebClientProfile;
+
+/// <summary>
+///     How telemetry is batched before it is sent.
+/// </summary>
+typedef struct {
+    /// <summary>Longest time for which a reading waits in the batch. Parameter
+    /// "TelemetryFlushMs".</summary>
+    struct timespec flushPeriod;
+    /// <summary>Whether numeric readings are summarized per flush period. Parameter
+    /// "TelemetryAggregate".</summary>
+    bool aggregate;
+} PerfTelemetryProfile;
+
+/// <summary>
+///     How often sensors are read.
+/// </summary>
+typedef struct {
+    /// <summary>Parameter "SensorSamplePeriodMs".</summary>
+    struct timespec samplePeriod;
+} PerfSensorProfile;
+
+/// <summary>
+///     The tuning parameters of every subsystem, for one performance point. Each application
+///     uses the subsystems which it has, and ignores the others.
+/// </summary>
+typedef struct {
+    PerfProfileId id;
+    PerfEventLoopProfile eventLoop;
+    PerfDfuProfile dfu;
+    PerfMessageProtocolProfile messageProtocol;
+    PerfWebClientProfile webClient;
+    PerfTelemetryProfile telemetry;
+    PerfSensorProfile sensor;
+} PerfProfile;
+
+/// <summary>
+///     Gets the compile-time defaults of a profile.
+/// </summary>
+/// <param name="id">The profile.</param>
+/// <returns>The defaults, or NULL if the ID is not valid</returns>
+const PerfProfile *PerfProfile_GetDefaults(PerfProfileId id);
+
+/// <summary>
+///     Gets the name of a profile, such as "LowPower".
+/// </summary>
+/// <returns>The name, or "Unknown" if the ID is not valid</returns>
+const char *PerfProfile_GetName(PerfProfileId id);
+
+/// <summary>
+///     Finds a profile by its name. The comparison is case-sensitive.
+/// </summary>
+/// <param name="name">The name, which need not be null-terminated.</param>
+/// <param name="length">Length of the name.</param>
+/// <param name="id">Receives the profile.</param>
+/// <returns>true if the name is one of the profiles, otherwise false</returns>
+bool PerfProfile_FindId(const char *name, size_t length, PerfProfileId *id);
+
+/// <summary>
+///     A profile, and the parameters whose defaults are overridden in it.
+/// </summary>
+typedef struct {
+    PerfProfileId id;
+    bool isOverridden[PERF_PROFILE_PARAMETER_COUNT];
+    double overrides[PERF_PROFILE_PARAMETER_COUNT];
+} PerfProfileSelection;
+
+/// <summary>
+///     Selects a profile with none of its parameters overridden.
+/// </summary>
+void PerfProfileSelection_Init(PerfProfileSelection *selection, PerfProfileId id);
+
+/// <summary>
+///     Overrides a parameter of the selected profile. Times are in milliseconds, and booleans
+///     are 0 or 1.
+/// </summary>
+/// <param name="selection">The selection.</param>
+/// <param name="name">The name of the parameter, such as "TelemetryFlushMs", which need not be
+/// null-terminated.</param>
+/// <param name="length">Length of the name.</param>
+/// <param name="value">The value.</param>
+/// <returns>0 on success, or -1 if there is no such parameter or the value is out of its range,
+/// in which case the selection is unchanged</returns>
+int PerfProfileSelection_SetOverride(PerfProfileSelection *selection, const char *name,
+                                     size_t length, double value);
+
+/// <summary>
+///     Removes the override of a parameter, so that it has the default of the profile again.
+/// </summary>
+/// <returns>0 on success, or -1 if there is no such parameter</returns>
+int PerfProfileSelection_ClearOverride(PerfProfileSelection *selection, const char *name,
+                                       size_t length);
+
+/// <summary>
+///     Function which applies a profile that has just become active.
+/// </summary>
+/// <param name="profile">The new profile.</param>
+/// <param name="previous">The profile which was active before.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="PerfProfileManager_AddHandler" />.</param>
+typedef void (*PerfProfileChangedHandler)(const PerfProfile *profile, const PerfProfile *previous,
+                                          void *context);
+
+/// <summary>Number of handlers which can be added to a manager.</summary>
+#define PERF_PROFILE_MAX_HANDLERS 8
+
+/// <summary>
+/// <para>Keeps the active profile of an application, so that it can be switched while the
+/// application runs, such as from the device twin. The subsystems apply the new parameters
+/// from their handlers.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="PerfProfileManager_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    PerfProfileSelection selection;
+    PerfProfile active;
+    PerfProfileChangedHandler handlers[PERF_PROFILE_MAX_HANDLERS];
+    void *contexts[PERF_PROFILE_MAX_HANDLERS];
+    size_t handlerCount;
+    /// <summary>Number of times that the active profile has changed.</summary>
+    uint32_t changeCount;
+} PerfProfileManager;
+
+/// <summary>
+///     Initializes a manager with the defaults of a profile. No handlers are called.
+/// </summary>
+/// <param name="manager">Manager to initialize.</param>
+/// <param name="id">The profile, such as PERF_PROFILE_DEFAULT.</param>
+void PerfProfileManager_Init(PerfProfileManager *manager, PerfProfileId id);
+
+/// <summary>
+///     Adds a handler which is called each time that the active profile changes.
+/// </summary>
+/// <returns>0 on success, or -1 if PERF_PROFILE_MAX_HANDLERS have been added</returns>
+int PerfProfileManager_AddHandler(PerfProfileManager *manager, PerfProfileChangedHandler handler,
+                                  void *context);
+
+/// <summary>
+///     Gets the active profile, with its overrides.
+/// </summary>
+const PerfProfile *PerfProfileManager_GetActive(const PerfProfileManager *manager);
+
+/// <summary>
+///     Gets the selection which the active profile was made from, as a starting point for the
+///     next one.
+/// </summary>
+const PerfProfileSelection *PerfProfileManager_GetSelection(const PerfProfileManager *manager);
+
+/// <summary>
+///     Makes a selection the active profile. If any parameter differs from the profile which
+///     was active, the handlers are called in the order in which they were added.
+/// </summary>
+/// <param name="manager">The manager.</param>
+/// <param name="selection">The profile and its overrides. This is copied.</param>
+/// <returns>1 if the active profile changed, 0 if it is the same, or -1 if the profile ID is not
+/// valid</returns>
+int PerfProfileManager_Apply(PerfProfileManager *manager, const PerfProfileSelection *selection);
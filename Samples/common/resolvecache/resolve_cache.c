@@ -0,0 +1,216 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+
+#include <applibs/log.h>
+
+#include "resolve_cache.h"
+
+// Size of a CURLOPT_RESOLVE entry, "host:port:address" or "-host:port", with its null
+// terminator.
+#define RESOLVE_ENTRY_SIZE (RESOLVE_CACHE_MAX_HOST_LENGTH + sizeof("-:65535:") + INET_ADDRSTRLEN)
+
+static time_t GetMonotonicSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/// <summary>
+///     Gets the host name and port of an HTTP or HTTPS URL, such as "example.com" and 443 from
+///     "https://example.com/index.html".
+/// </summary>
+/// <returns>true if the URL has a host name which can be cached; false if it cannot be parsed
+/// or its host is an IP address</returns>
+static bool GetHostAndPort(const char *url, char *host, size_t hostSize, uint16_t *port)
+{
+    const char *start;
+    if (strncasecmp(url, "https://", 8) == 0) {
+        start = url + 8;
+        *port = 443;
+    } else if (strncasecmp(url, "http://", 7) == 0) {
+        start = url + 7;
+        *port = 80;
+    } else {
+        return false;
+    }
+
+    // Skip any user name and password.
+    size_t authorityLength = strcspn(start, "/?#");
+    const char *at = memchr(start, '@', authorityLength);
+    if (at != NULL) {
+        start = at + 1;
+    }
+
+    // An IPv6 address is in brackets, and needs no resolving.
+    size_t length = strcspn(start, ":/?#");
+    if (length == 0 || length >= hostSize || start[0] == '[') {
+        return false;
+    }
+    memcpy(host, start, length);
+    host[length] = '\0';
+
+    if (start[length] == ':') {
+        char *end;
+        unsigned long value = strtoul(start + length + 1, &end, 10);
+        if (end == start + length + 1 || value == 0 || value > UINT16_MAX ||
+            strchr("/?#", *end) == NULL) {
+            return false;
+        }
+        *port = (uint16_t)value;
+    }
+
+    struct in_addr literal;
+    return inet_pton(AF_INET, host, &literal) != 1;
+}
+
+static ResolveCacheEntry *FindEntry(ResolveCache *cache, const char *host, uint16_t port)
+{
+    for (size_t i = 0; i < RESOLVE_CACHE_MAX_ENTRIES; i++) {
+        ResolveCacheEntry *entry = &cache->entries[i];
+        if (entry->host[0] != '\0' && entry->port == port && strcasecmp(entry->host, host) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void ResolveCache_Init(ResolveCache *cache, uint32_t learnedTtlSeconds)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->learnedTtlSeconds = learnedTtlSeconds;
+}
+
+int ResolveCache_Add(ResolveCache *cache, const char *host, uint16_t port,
+                     struct in_addr address, uint32_t ttlSeconds)
+{
+    if (strlen(host) > RESOLVE_CACHE_MAX_HOST_LENGTH || ttlSeconds == 0) {
+        return -1;
+    }
+
+    // Use the host's own entry, else a free one, else the one which expires first.
+    ResolveCacheEntry *entry = FindEntry(cache, host, port);
+    for (size_t i = 0; entry == NULL && i < RESOLVE_CACHE_MAX_ENTRIES; i++) {
+        if (cache->entries[i].host[0] == '\0') {
+            entry = &cache->entries[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &cache->entries[0];
+        for (size_t i = 1; i < RESOLVE_CACHE_MAX_ENTRIES; i++) {
+            if (cache->entries[i].expiry < entry->expiry) {
+                entry = &cache->entries[i];
+            }
+        }
+    }
+
+    strcpy(entry->host, host);
+    entry->port = port;
+    entry->address = address;
+    entry->expiry = GetMonotonicSeconds() + (time_t)ttlSeconds;
+    return 0;
+}
+
+bool ResolveCache_Lookup(const ResolveCache *cache, const char *host, uint16_t port,
+                         struct in_addr *address)
+{
+    const ResolveCacheEntry *entry = FindEntry((ResolveCache *)cache, host, port);
+    if (entry == NULL || GetMonotonicSeconds() >= entry->expiry) {
+        return false;
+    }
+    *address = entry->address;
+    return true;
+}
+
+void ResolveCache_Remove(ResolveCache *cache, const char *host, uint16_t port)
+{
+    ResolveCacheEntry *entry = FindEntry(cache, host, port);
+    if (entry != NULL) {
+        memset(entry, 0, sizeof(*entry));
+    }
+}
+
+int ResolveCache_SetupTransfer(ResolveCache *cache, CURL *easyHandle, const char *url,
+                               struct curl_slist **resolveList)
+{
+    curl_slist_free_all(*resolveList);
+    *resolveList = NULL;
+
+    char host[RESOLVE_CACHE_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    if (GetHostAndPort(url, host, sizeof(host), &port)) {
+        // cURL keeps the addresses which it is given until they are removed, so an address which
+        // has expired here is removed from cURL's DNS cache too.
+        char resolveEntry[RESOLVE_ENTRY_SIZE];
+        struct in_addr address;
+        char addressText[INET_ADDRSTRLEN];
+        if (ResolveCache_Lookup(cache, host, port, &address) &&
+            inet_ntop(AF_INET, &address, addressText, sizeof(addressText)) != NULL) {
+            snprintf(resolveEntry, sizeof(resolveEntry), "%s:%u:%s", host, port, addressText);
+            ++cache->hits;
+        } else {
+            snprintf(resolveEntry, sizeof(resolveEntry), "-%s:%u", host, port);
+            ++cache->misses;
+        }
+
+        *resolveList = curl_slist_append(NULL, resolveEntry);
+        if (*resolveList == NULL) {
+            Log_Debug("ERROR: Could not allocate the resolve list for %s.\n", host);
+            return -1;
+        }
+    }
+
+    CURLcode res = curl_easy_setopt(easyHandle, CURLOPT_RESOLVE, *resolveList);
+    if (res != CURLE_OK) {
+        Log_Debug("ERROR: curl_easy_setopt CURLOPT_RESOLVE (curl err=%d, '%s')\n", res,
+                  curl_easy_strerror(res));
+        return -1;
+    }
+    return 0;
+}
+
+void ResolveCache_RecordTransfer(ResolveCache *cache, CURL *easyHandle, const char *url,
+                                 CURLcode result)
+{
+    char host[RESOLVE_CACHE_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+
+    if (result == CURLE_COULDNT_CONNECT) {
+        if (GetHostAndPort(url, host, sizeof(host), &port) && FindEntry(cache, host, port)) {
+            Log_Debug("INFO: Could not connect to %s; it will be resolved again.\n", host);
+            ResolveCache_Remove(cache, host, port);
+        }
+        return;
+    }
+    if (result != CURLE_OK) {
+        return;
+    }
+
+    // The address is that of the last connection, which was made for the final URL after any
+    // redirects. A different port means that the connection was to a proxy.
+    char *effectiveUrl = NULL;
+    char *primaryIp = NULL;
+    long primaryPort = 0;
+    struct in_addr address;
+    if (curl_easy_getinfo(easyHandle, CURLINFO_EFFECTIVE_URL, &effectiveUrl) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_PRIMARY_IP, &primaryIp) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_PRIMARY_PORT, &primaryPort) != CURLE_OK ||
+        effectiveUrl == NULL || primaryIp == NULL ||
+        !GetHostAndPort(effectiveUrl, host, sizeof(host), &port) || primaryPort != port ||
+        inet_pton(AF_INET, primaryIp, &address) != 1) {
+        return;
+    }
+
+    // An address which is already cached keeps its expiry, so that a TTL from DNS service
+    // discovery is not extended.
+    struct in_addr cachedAddress;
+    if (!ResolveCache_Lookup(cache, host, port, &cachedAddress)) {
+        ResolveCache_Add(cache, host, port, address, cache->learnedTtlSeconds);
+    }
+}
@@ -0,0 +1,124 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include <curl/curl.h>
+
+/// <summary>Number of host names which the cache holds.</summary>
+#define RESOLVE_CACHE_MAX_ENTRIES 8
+
+/// <summary>Longest host name which is kept, not including the null terminator. Longer
+/// names are not cached.</summary>
+#define RESOLVE_CACHE_MAX_HOST_LENGTH 127
+
+/// <summary>
+///     The address which a host name and port resolve to, and until when it is valid.
+/// </summary>
+typedef struct {
+    /// <summary>The host name, or an empty string if the slot is free.</summary>
+    char host[RESOLVE_CACHE_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    struct in_addr address;
+    /// <summary>When the address expires, in seconds of CLOCK_MONOTONIC.</summary>
+    time_t expiry;
+} ResolveCacheEntry;
+
+/// <summary>
+/// <para>Caches the IPv4 addresses of host names, with a TTL for each, so that cURL transfers
+/// connect without resolving the names again. The addresses come from two places: the
+/// results of DNS service discovery, which carry the TTLs of their records, and the addresses
+/// which earlier cURL transfers connected to. getaddrinfo does not report TTLs, so the latter
+/// are kept for a fixed time.</para>
+/// <para>Before each transfer, <see cref="ResolveCache_SetupTransfer" /> passes the cached
+/// address of the URL's host to cURL with CURLOPT_RESOLVE. After it,
+/// <see cref="ResolveCache_RecordTransfer" /> learns the address which cURL used, or forgets a
+/// cached address which could not be connected to.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="ResolveCache_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    ResolveCacheEntry entries[RESOLVE_CACHE_MAX_ENTRIES];
+    /// <summary>How long the addresses which cURL resolved are kept, in seconds.</summary>
+    uint32_t learnedTtlSeconds;
+    /// <summary>Number of transfers whose host was in the cache.</summary>
+    uint32_t hits;
+    /// <summary>Number of transfers whose host cURL had to resolve.</summary>
+    uint32_t misses;
+} ResolveCache;
+
+/// <summary>
+///     Initializes an empty cache.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="learnedTtlSeconds">How long to keep the addresses which cURL resolved, such as
+/// 300 seconds. A shorter time finds a changed address sooner.</param>
+void ResolveCache_Init(ResolveCache *cache, uint32_t learnedTtlSeconds);
+
+/// <summary>
+///     Adds the address of a host name and port, such as one which DNS service discovery
+///     found, replacing any address which was cached for them. When the cache is full, the entry
+///     which expires first is replaced.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="host">The host name.</param>
+/// <param name="port">The port.</param>
+/// <param name="address">The IPv4 address.</param>
+/// <param name="ttlSeconds">How long the address is valid, in seconds.</param>
+/// <returns>0 on success, or -1 if the host name is too long or the TTL is 0</returns>
+int ResolveCache_Add(ResolveCache *cache, const char *host, uint16_t port,
+                     struct in_addr address, uint32_t ttlSeconds);
+
+/// <summary>
+///     Looks up the address of a host name and port which has not expired.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="host">The host name, which is compared without regard to case.</param>
+/// <param name="port">The port.</param>
+/// <param name="address">Receives the address.</param>
+/// <returns>true if the address is cached; false otherwise</returns>
+bool ResolveCache_Lookup(const ResolveCache *cache, const char *host, uint16_t port,
+                         struct in_addr *address);
+
+/// <summary>
+///     Forgets the address of a host name and port, such as when it could not be connected to.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="host">The host name.</param>
+/// <param name="port">The port.</param>
+void ResolveCache_Remove(ResolveCache *cache, const char *host, uint16_t port);
+
+/// <summary>
+///     Sets CURLOPT_RESOLVE on an easy handle before a transfer. If the host of the URL is
+///     cached, cURL is given its address, so it does not resolve the name. Otherwise any address
+///     which an earlier transfer was given is removed from cURL's DNS cache, so that cURL
+///     resolves the name again once the address has expired.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="easyHandle">The easy handle of the transfer.</param>
+/// <param name="url">The URL of the transfer.</param>
+/// <param name="resolveList">The list which is passed to cURL. The list which it held before is
+/// freed. The list must remain valid until the transfer ends, and then be freed with
+/// curl_slist_free_all. It must be initialized to NULL before the first call.</param>
+/// <returns>0 on success, or -1 on failure. A URL whose host is an IP address, or which cannot
+/// be parsed, is not an error; cURL is then left to handle it.</returns>
+int ResolveCache_SetupTransfer(ResolveCache *cache, CURL *easyHandle, const char *url,
+                               struct curl_slist **resolveList);
+
+/// <summary>
+///     Updates the cache after a transfer. If the transfer reached its server, the IPv4
+///     address which cURL connected to is cached for the host of the final URL, unless an
+///     address is already cached for it. If it could not connect, the address of the host of the
+///     URL is forgotten, so that the next transfer resolves the name again.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="easyHandle">The easy handle of the transfer.</param>
+/// <param name="url">The URL which the transfer was started with.</param>
+/// <param name="result">The result of the transfer.</param>
+void ResolveCache_RecordTransfer(ResolveCache *cache, CURL *easyHandle, const char *url,
+                                 CURLcode result);
@@ -0,0 +1,326 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "memory_metrics.h"
+#include "response_sink.h"
+
+// Size of the first block which a buffer sink allocates, when it does not know the length of
+// the body.
+static const size_t initialBufferCapacity = 1024;
+
+// Tag of the blocks of the buffer sinks, which is added when the first block is allocated.
+static MemoryTag memoryTag = MemoryTag_Other;
+
+static size_t WriteBuffer(ResponseSink *sink, const uint8_t *data, size_t length);
+static size_t WriteRing(ResponseSink *sink, const uint8_t *data, size_t length);
+static size_t WriteFile(ResponseSink *sink, const uint8_t *data, size_t length);
+static int ResizeBuffer(ResponseSink *sink, size_t capacity);
+static size_t CopyIntoRing(ResponseSink *sink, const uint8_t *data, size_t length);
+static void DrainRing(ResponseSink *sink);
+
+void ResponseSink_InitBuffer(ResponseSink *sink, size_t maxSize)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->type = ResponseSinkType_Buffer;
+    sink->buffer.maxSize = maxSize;
+}
+
+void ResponseSink_InitRing(ResponseSink *sink, uint8_t *buffer, size_t bufferSize,
+                           ResponseSinkConsumer consumer, void *context)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->type = ResponseSinkType_Ring;
+    sink->ring.data = buffer;
+    sink->ring.size = bufferSize;
+    sink->ring.consumer = consumer;
+    sink->ring.context = context;
+}
+
+void ResponseSink_InitFile(ResponseSink *sink, int fd)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->type = ResponseSinkType_File;
+    sink->file.fd = fd;
+}
+
+int ResponseSink_Reserve(ResponseSink *sink, uint64_t expectedSize)
+{
+    if (sink->type != ResponseSinkType_Buffer) {
+        return 0;
+    }
+
+    if (expectedSize > sink->buffer.maxSize) {
+        sink->error = ResponseSinkError_Full;
+        return -1;
+    }
+
+    // Allow for the null terminator.
+    size_t capacity = (size_t)expectedSize + 1;
+    if (capacity <= sink->buffer.capacity) {
+        return 0;
+    }
+    return ResizeBuffer(sink, capacity);
+}
+
+size_t ResponseSink_Write(ResponseSink *sink, const void *data, size_t length)
+{
+    if (sink->error != ResponseSinkError_None) {
+        return 0;
+    }
+
+    size_t accepted;
+    switch (sink->type) {
+    case ResponseSinkType_Buffer:
+        accepted = WriteBuffer(sink, data, length);
+        break;
+    case ResponseSinkType_Ring:
+        accepted = WriteRing(sink, data, length);
+        break;
+    default:
+        accepted = WriteFile(sink, data, length);
+        break;
+    }
+
+    sink->totalBytes += accepted;
+    return accepted;
+}
+
+int ResponseSink_Finish(ResponseSink *sink)
+{
+    if (sink->error != ResponseSinkError_None) {
+        return -1;
+    }
+
+    if (sink->type == ResponseSinkType_Ring) {
+        DrainRing(sink);
+        if (sink->ring.length != 0) {
+            sink->error = ResponseSinkError_Full;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+size_t ResponseSink_GetBufferedLength(const ResponseSink *sink)
+{
+    return (sink->type == ResponseSinkType_Ring) ? sink->ring.length : 0;
+}
+
+void ResponseSink_Reset(ResponseSink *sink)
+{
+    sink->totalBytes = 0;
+    sink->error = ResponseSinkError_None;
+    sink->lastErrno = 0;
+
+    if (sink->type == ResponseSinkType_Buffer) {
+        sink->buffer.size = 0;
+        if (sink->buffer.data != NULL) {
+            sink->buffer.data[0] = 0;
+        }
+    } else if (sink->type == ResponseSinkType_Ring) {
+        sink->ring.head = 0;
+        sink->ring.length = 0;
+    }
+}
+
+void ResponseSink_Fini(ResponseSink *sink)
+{
+    if (sink->type == ResponseSinkType_Buffer) {
+        MemoryMetrics_Free(sink->buffer.data);
+    }
+    memset(sink, 0, sizeof(*sink));
+}
+
+size_t ResponseSink_CurlWriteCallback(char *chunks, size_t chunkSize, size_t chunksCount,
+                                      void *sink)
+{
+    return ResponseSink_Write((ResponseSink *)sink, chunks, chunkSize * chunksCount);
+}
+
+size_t ResponseSink_CurlHeaderCallback(char *header, size_t size, size_t count, void *sink)
+{
+    static const char contentLengthName[] = "Content-Length:";
+    const size_t nameLength = sizeof(contentLengthName) - 1;
+    size_t length = size * count;
+
+    if (length <= nameLength || strncasecmp(header, contentLengthName, nameLength) != 0) {
+        return length;
+    }
+
+    size_t i = nameLength;
+    while (i < length && (header[i] == ' ' || header[i] == '\t')) {
+        ++i;
+    }
+
+    // Ignore a value which is malformed or too large to be a length, and let the sink grow as
+    // the body arrives instead.
+    uint64_t contentLength = 0;
+    size_t digits = 0;
+    for (; i < length && header[i] >= '0' && header[i] <= '9'; ++i, ++digits) {
+        if (contentLength > (UINT64_MAX - 9) / 10) {
+            return length;
+        }
+        contentLength = contentLength * 10 + (uint64_t)(header[i] - '0');
+    }
+    if (digits == 0) {
+        return length;
+    }
+
+    return (ResponseSink_Reserve((ResponseSink *)sink, contentLength) == 0) ? length : 0;
+}
+
+static size_t WriteBuffer(ResponseSink *sink, const uint8_t *data, size_t length)
+{
+    if (length > sink->buffer.maxSize - sink->buffer.size) {
+        sink->error = ResponseSinkError_Full;
+        return 0;
+    }
+
+    // Allow for the null terminator.
+    size_t required = sink->buffer.size + length + 1;
+    if (required > sink->buffer.capacity) {
+        // Double the block until the data fits, so that the number of reallocations only grows
+        // with the logarithm of the size of the body, but do not allocate more than the largest
+        // body which the sink accepts.
+        size_t capacity =
+            (sink->buffer.capacity != 0) ? sink->buffer.capacity : initialBufferCapacity;
+        size_t maxCapacity = sink->buffer.maxSize + 1;
+        while (capacity < required && capacity <= maxCapacity / 2) {
+            capacity *= 2;
+        }
+        if (capacity < required || capacity > maxCapacity) {
+            capacity = maxCapacity;
+        }
+
+        if (ResizeBuffer(sink, capacity) != 0) {
+            return 0;
+        }
+    }
+
+    memcpy(sink->buffer.data + sink->buffer.size, data, length);
+    sink->buffer.size += length;
+    sink->buffer.data[sink->buffer.size] = 0;
+    return length;
+}
+
+static int ResizeBuffer(ResponseSink *sink, size_t capacity)
+{
+    // Keep the existing block if realloc fails, so that the data which has been received is not
+    // lost and is freed by ResponseSink_Fini.
+    if (memoryTag == MemoryTag_Other) {
+        memoryTag = MemoryMetrics_AddTag("response_sink");
+    }
+    uint8_t *data = MemoryMetrics_Realloc(memoryTag, sink->buffer.data, capacity);
+    if (data == NULL) {
+        sink->error = ResponseSinkError_OutOfMemory;
+        return -1;
+    }
+
+    if (sink->buffer.data == NULL) {
+        data[0] = 0;
+    }
+    sink->buffer.data = data;
+    sink->buffer.capacity = capacity;
+    return 0;
+}
+
+static size_t WriteRing(ResponseSink *sink, const uint8_t *data, size_t length)
+{
+    size_t accepted = 0;
+    while (accepted < length) {
+        // While the ring buffer is empty, the consumer can take the data where it is, without
+        // copying it, and only what it leaves is copied into the ring buffer.
+        if (sink->ring.length == 0) {
+            size_t offered = length - accepted;
+            size_t consumed =
+                sink->ring.consumer(sink, data + accepted, offered, sink->ring.context);
+            accepted += (consumed < offered) ? consumed : offered;
+            if (accepted == length) {
+                break;
+            }
+        }
+
+        size_t copied = CopyIntoRing(sink, data + accepted, length - accepted);
+        accepted += copied;
+        size_t buffered = sink->ring.length;
+        DrainRing(sink);
+
+        // The ring buffer is full and the consumer did not make room for more.
+        if (copied == 0 && sink->ring.length == buffered) {
+            sink->error = ResponseSinkError_Full;
+            break;
+        }
+    }
+
+    return accepted;
+}
+
+static size_t CopyIntoRing(ResponseSink *sink, const uint8_t *data, size_t length)
+{
+    size_t copied = 0;
+    // The free space may wrap around the end of the ring buffer, so it takes up to two copies.
+    while (copied < length && sink->ring.length < sink->ring.size) {
+        size_t tail = (sink->ring.head + sink->ring.length) % sink->ring.size;
+        size_t contiguous = sink->ring.size - sink->ring.length;
+        if (contiguous > sink->ring.size - tail) {
+            contiguous = sink->ring.size - tail;
+        }
+        size_t chunk = (length - copied < contiguous) ? length - copied : contiguous;
+        memcpy(sink->ring.data + tail, data + copied, chunk);
+        sink->ring.length += chunk;
+        copied += chunk;
+    }
+    return copied;
+}
+
+static void DrainRing(ResponseSink *sink)
+{
+    while (sink->ring.length != 0) {
+        size_t contiguous = sink->ring.size - sink->ring.head;
+        if (contiguous > sink->ring.length) {
+            contiguous = sink->ring.length;
+        }
+
+        size_t consumed = sink->ring.consumer(sink, sink->ring.data + sink->ring.head, contiguous,
+                                              sink->ring.context);
+        if (consumed > contiguous) {
+            consumed = contiguous;
+        }
+        sink->ring.head = (sink->ring.head + consumed) % sink->ring.size;
+        sink->ring.length -= consumed;
+
+        // Start again at the beginning of the ring buffer once it is empty, so that the next
+        // data is contiguous for as long as possible.
+        if (sink->ring.length == 0) {
+            sink->ring.head = 0;
+        }
+        if (consumed < contiguous) {
+            break;
+        }
+    }
+}
+
+static size_t WriteFile(ResponseSink *sink, const uint8_t *data, size_t length)
+{
+    size_t written = 0;
+    while (written < length) {
+        ssize_t result = write(sink->file.fd, data + written, length - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sink->error = ResponseSinkError_WriteFailed;
+            sink->lastErrno = errno;
+            break;
+        }
+        written += (size_t)result;
+    }
+    return written;
+}
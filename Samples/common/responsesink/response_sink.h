@@ -0,0 +1,224 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Where a <see cref="ResponseSink" /> puts the data which is written to it.</summary>
+typedef enum {
+    /// <summary>The data is collected in one heap block, which grows geometrically up to a
+    /// maximum size.</summary>
+    ResponseSinkType_Buffer,
+    /// <summary>The data passes through a fixed ring buffer, which is supplied by the caller,
+    /// and is handed to a consumer callback as it arrives.</summary>
+    ResponseSinkType_Ring,
+    /// <summary>The data is written to a file descriptor, such as the one returned by
+    /// Storage_OpenMutableFile.</summary>
+    ResponseSinkType_File
+} ResponseSinkType;
+
+/// <summary>Why a <see cref="ResponseSink" /> stopped accepting data.</summary>
+typedef enum {
+    /// <summary>No error has occurred.</summary>
+    ResponseSinkError_None,
+    /// <summary>The data would not fit: it is larger than the maximum size of a buffer sink, or
+    /// the consumer of a ring sink did not make room for it.</summary>
+    ResponseSinkError_Full,
+    /// <summary>A buffer sink could not allocate memory.</summary>
+    ResponseSinkError_OutOfMemory,
+    /// <summary>Writing to the file descriptor of a file sink failed. See
+    /// lastErrno.</summary>
+    ResponseSinkError_WriteFailed
+} ResponseSinkError;
+
+struct ResponseSink;
+
+/// <summary>
+///     Function which is called by a ring sink to consume the data which is written to it.
+/// </summary>
+/// <param name="sink">The sink which holds the data.</param>
+/// <param name="data">Start of the oldest data which has not been consumed. This points into
+/// the ring buffer, or, while the ring buffer is empty, straight into the data which was passed
+/// to <see cref="ResponseSink_Write" />. It is only valid until the function returns.</param>
+/// <param name="length">Number of contiguous bytes at data. When the data wraps around the end
+/// of the ring buffer, the rest is passed in a further call.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="ResponseSink_InitRing" />.</param>
+/// <returns>The number of bytes consumed, from 0 to length. Bytes which are not consumed stay in
+/// the ring buffer and are passed again when more data arrives.</returns>
+typedef size_t (*ResponseSinkConsumer)(struct ResponseSink *sink, const uint8_t *data,
+                                       size_t length, void *context);
+
+/// <summary>
+/// <para>Receives the body of an HTTP response as it is downloaded, so that the application
+/// chooses how much memory the download uses. A sink can collect the body in a heap block of
+/// bounded size, stream it through a fixed ring buffer to a consumer, or write it straight to
+/// mutable storage. The last two use a constant amount of memory however large the body
+/// is.</para>
+/// <para>A buffer sink grows its block by doubling it, so that the block is reallocated a few
+/// times per body rather than once for each chunk, and the bytes which are moved by the
+/// reallocations add up to less than the size of the body. If the response has a Content-Length
+/// header, <see cref="ResponseSink_CurlHeaderCallback" /> reserves the whole block before the
+/// body arrives, so that it is not reallocated at all.</para>
+/// <para>Once a write fails, the sink keeps the error and rejects further data until it is
+/// reset, so that the transfer fails rather than losing data silently.</para>
+/// <para>All members are managed by the ResponseSink functions and must not be modified by the
+/// caller.</para>
+/// </summary>
+typedef struct ResponseSink {
+    /// <summary>Where the data goes.</summary>
+    ResponseSinkType type;
+    /// <summary>Bytes which have been accepted since the sink was initialized or reset.</summary>
+    uint64_t totalBytes;
+    /// <summary>Why the sink stopped accepting data.</summary>
+    ResponseSinkError error;
+    /// <summary>The errno value for <see cref="ResponseSinkError_WriteFailed" />.</summary>
+    int lastErrno;
+    union {
+        /// <summary>State of a <see cref="ResponseSinkType_Buffer" /> sink.</summary>
+        struct {
+            /// <summary>The data, followed by a null terminator, or NULL if nothing has been
+            /// allocated.</summary>
+            uint8_t *data;
+            /// <summary>Number of bytes of data, not including the null terminator.</summary>
+            size_t size;
+            /// <summary>Number of bytes which are allocated at data.</summary>
+            size_t capacity;
+            /// <summary>Largest number of bytes of data which the buffer can hold.</summary>
+            size_t maxSize;
+        } buffer;
+        /// <summary>State of a <see cref="ResponseSinkType_Ring" /> sink.</summary>
+        struct {
+            /// <summary>The ring buffer which was passed to
+            /// <see cref="ResponseSink_InitRing" />.</summary>
+            uint8_t *data;
+            /// <summary>Size of the ring buffer in bytes.</summary>
+            size_t size;
+            /// <summary>Offset of the oldest byte which has not been consumed.</summary>
+            size_t head;
+            /// <summary>Number of bytes which have not been consumed.</summary>
+            size_t length;
+            /// <summary>Function which consumes the data.</summary>
+            ResponseSinkConsumer consumer;
+            /// <summary>Value which is passed to the consumer.</summary>
+            void *context;
+        } ring;
+        /// <summary>State of a <see cref="ResponseSinkType_File" /> sink.</summary>
+        struct {
+            /// <summary>The file descriptor which the data is written to.</summary>
+            int fd;
+        } file;
+    };
+} ResponseSink;
+
+/// <summary>
+///     Initializes a sink which collects the data in a heap block. Nothing is allocated until
+///     data is written or space is reserved.
+/// </summary>
+/// <param name="sink">The sink to initialize.</param>
+/// <param name="maxSize">Largest body which the sink accepts, in bytes. A longer body fails with
+/// <see cref="ResponseSinkError_Full" />.</param>
+void ResponseSink_InitBuffer(ResponseSink *sink, size_t maxSize);
+
+/// <summary>
+///     Initializes a sink which passes the data through a fixed ring buffer to a consumer. The
+///     consumer is called from <see cref="ResponseSink_Write" /> whenever the ring buffer holds
+///     data, and again from <see cref="ResponseSink_Finish" />, which expects the consumer to
+///     consume everything which is left.
+/// </summary>
+/// <param name="sink">The sink to initialize.</param>
+/// <param name="buffer">The ring buffer. It must remain valid while the sink is used.</param>
+/// <param name="bufferSize">Size of the ring buffer in bytes.</param>
+/// <param name="consumer">Function which consumes the data.</param>
+/// <param name="context">Value which is passed to the consumer.</param>
+void ResponseSink_InitRing(ResponseSink *sink, uint8_t *buffer, size_t bufferSize,
+                           ResponseSinkConsumer consumer, void *context);
+
+/// <summary>
+///     Initializes a sink which writes the data to a file descriptor, from its current offset.
+///     The sink does not close the file descriptor.
+/// </summary>
+/// <param name="sink">The sink to initialize.</param>
+/// <param name="fd">The file descriptor, such as the one returned by
+/// Storage_OpenMutableFile.</param>
+void ResponseSink_InitFile(ResponseSink *sink, int fd);
+
+/// <summary>
+///     Prepares the sink for a body of a known size. A buffer sink allocates the whole block at
+///     once; the other sinks do not need any space.
+/// </summary>
+/// <param name="sink">The sink.</param>
+/// <param name="expectedSize">Number of bytes which are expected in total.</param>
+/// <returns>0 on success, or -1 if the body cannot be accepted, with the sink's error set to
+/// <see cref="ResponseSinkError_Full" /> or <see cref="ResponseSinkError_OutOfMemory" />.
+/// </returns>
+int ResponseSink_Reserve(ResponseSink *sink, uint64_t expectedSize);
+
+/// <summary>
+///     Passes data to the sink.
+/// </summary>
+/// <param name="sink">The sink.</param>
+/// <param name="data">The data.</param>
+/// <param name="length">Number of bytes of data.</param>
+/// <returns>length if all of the data was accepted, or a smaller value if the sink failed, with
+/// the sink's error set.</returns>
+size_t ResponseSink_Write(ResponseSink *sink, const void *data, size_t length);
+
+/// <summary>
+///     Completes the body. A ring sink passes the data which remains in its ring buffer to the
+///     consumer; the other sinks have nothing to do.
+/// </summary>
+/// <param name="sink">The sink.</param>
+/// <returns>0 on success, or -1 if the sink has failed or the consumer did not consume all of
+/// the data.</returns>
+int ResponseSink_Finish(ResponseSink *sink);
+
+/// <summary>
+///     Gets the number of bytes which a ring sink has accepted, but not yet passed to its
+///     consumer. The other sinks pass on data as soon as they accept it, so this is always 0 for
+///     them.
+/// </summary>
+/// <param name="sink">The sink.</param>
+/// <returns>The number of bytes in the ring buffer.</returns>
+size_t ResponseSink_GetBufferedLength(const ResponseSink *sink);
+
+/// <summary>
+///     Discards the data and any error, so that the sink can receive another body. A buffer
+///     sink keeps its block for the next body.
+/// </summary>
+/// <param name="sink">The sink.</param>
+void ResponseSink_Reset(ResponseSink *sink);
+
+/// <summary>
+///     Frees the block of a buffer sink. The sink must be initialized again before it is used.
+/// </summary>
+/// <param name="sink">The sink.</param>
+void ResponseSink_Fini(ResponseSink *sink);
+
+/// <summary>
+///     Function with the signature of a cURL CURLOPT_WRITEFUNCTION callback, which passes the
+///     downloaded data to the sink. Set CURLOPT_WRITEDATA to the sink. If the sink fails, cURL
+///     ends the transfer with CURLE_WRITE_ERROR.
+/// </summary>
+/// <param name="chunks">The downloaded data.</param>
+/// <param name="chunkSize">The size of each chunk.</param>
+/// <param name="chunksCount">The count of the chunks.</param>
+/// <param name="sink">The sink.</param>
+/// <returns>The number of bytes which the sink accepted.</returns>
+size_t ResponseSink_CurlWriteCallback(char *chunks, size_t chunkSize, size_t chunksCount,
+                                      void *sink);
+
+/// <summary>
+///     Function with the signature of a cURL CURLOPT_HEADERFUNCTION callback, which reserves
+///     space in the sink for the length in a Content-Length header, and otherwise ignores the
+///     headers. Set CURLOPT_HEADERDATA to the sink. If the sink cannot accept the body, cURL
+///     ends the transfer with CURLE_WRITE_ERROR before the body is downloaded.
+/// </summary>
+/// <param name="header">One complete header line, which is not null terminated.</param>
+/// <param name="size">Always 1.</param>
+/// <param name="count">Length of the header line.</param>
+/// <param name="sink">The sink.</param>
+/// <returns>The length of the header line, or 0 to end the transfer.</returns>
+size_t ResponseSink_CurlHeaderCallback(char *header, size_t size, size_t count, void *sink);
@@ -0,0 +1,206 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <applibs/log.h>
+#include <applibs/storage.h>
+
+#include "storage_metrics.h"
+
+// Upper bound of each histogram bucket but the last, in microseconds.
+static const uint32_t bucketLimits[STORAGE_METRICS_BUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000};
+
+// Names of the files and operations in the log.
+static const char *const fileNames[StorageFile_Count] = {"mutable", "image"};
+static const char *const operationNames[StorageOperation_Count] = {"open", "read", "write"};
+
+// The metrics of the whole application, which every wrapper adds to.
+static StorageMetrics storageMetrics;
+
+// Protects storageMetrics, as files may also be read on worker threads.
+static pthread_mutex_t storageMetricsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t GetMicroseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+/// <summary>
+///     Adds a duration to a histogram, whose count is the operation's.
+/// </summary>
+static void AddToHistogram(StorageHistogram *histogram, uint32_t count, uint64_t microseconds)
+{
+    uint32_t duration = (microseconds > UINT32_MAX) ? UINT32_MAX : (uint32_t)microseconds;
+    size_t bucket = 0;
+    while (bucket < STORAGE_METRICS_BUCKETS - 1 && duration > bucketLimits[bucket]) {
+        ++bucket;
+    }
+    ++histogram->buckets[bucket];
+
+    if (count == 0 || duration < histogram->minMicroseconds) {
+        histogram->minMicroseconds = duration;
+    }
+    if (duration > histogram->maxMicroseconds) {
+        histogram->maxMicroseconds = duration;
+    }
+    histogram->sumMicroseconds += duration;
+}
+
+/// <summary>
+///     Records an operation which started at the given time.
+/// </summary>
+/// <param name="result">The result of the operation: the number of bytes which were read or
+/// written, or a file descriptor for an open, or -1 if it failed.</param>
+static void Record(StorageFile file, StorageOperation operation, uint64_t start, ssize_t result)
+{
+    uint64_t duration = GetMicroseconds() - start;
+    pthread_mutex_lock(&storageMetricsMutex);
+    StorageOperationMetrics *operationMetrics = &storageMetrics.operations[file][operation];
+    AddToHistogram(&operationMetrics->latency, operationMetrics->count, duration);
+    ++operationMetrics->count;
+    if (result < 0) {
+        ++operationMetrics->failures;
+    } else if (operation != StorageOperation_Open) {
+        operationMetrics->bytes += (uint64_t)result;
+    }
+    pthread_mutex_unlock(&storageMetricsMutex);
+}
+
+void StorageMetrics_SetMutableFileQuota(size_t bytes)
+{
+    pthread_mutex_lock(&storageMetricsMutex);
+    storageMetrics.mutableFileQuota = bytes;
+    pthread_mutex_unlock(&storageMetricsMutex);
+}
+
+int StorageMetrics_OpenMutableFile(void)
+{
+    uint64_t start = GetMicroseconds();
+    int fd = Storage_OpenMutableFile();
+    Record(StorageFile_Mutable, StorageOperation_Open, start, fd);
+
+    struct stat status;
+    if (fd >= 0 && fstat(fd, &status) == 0) {
+        pthread_mutex_lock(&storageMetricsMutex);
+        storageMetrics.mutableFileSize = status.st_size;
+        pthread_mutex_unlock(&storageMetricsMutex);
+    }
+    return fd;
+}
+
+int StorageMetrics_OpenFileInImagePackage(const char *path)
+{
+    uint64_t start = GetMicroseconds();
+    int fd = Storage_OpenFileInImagePackage(path);
+    Record(StorageFile_ImagePackage, StorageOperation_Open, start, fd);
+    return fd;
+}
+
+ssize_t StorageMetrics_Read(StorageFile file, int fd, void *buffer, size_t size)
+{
+    uint64_t start = GetMicroseconds();
+    ssize_t result = read(fd, buffer, size);
+    int error = errno;
+    Record(file, StorageOperation_Read, start, result);
+    errno = error;
+    return result;
+}
+
+ssize_t StorageMetrics_PRead(StorageFile file, int fd, void *buffer, size_t size, off_t offset)
+{
+    uint64_t start = GetMicroseconds();
+    ssize_t result = pread(fd, buffer, size, offset);
+    int error = errno;
+    Record(file, StorageOperation_Read, start, result);
+    errno = error;
+    return result;
+}
+
+ssize_t StorageMetrics_PWrite(int fd, const void *buffer, size_t size, off_t offset)
+{
+    uint64_t start = GetMicroseconds();
+    ssize_t result = pwrite(fd, buffer, size, offset);
+    int error = errno;
+    Record(StorageFile_Mutable, StorageOperation_Write, start, result);
+
+    pthread_mutex_lock(&storageMetricsMutex);
+    if (result < 0 && error == EDQUOT) {
+        ++storageMetrics.quotaErrors;
+    } else if (result > 0 && offset + result > storageMetrics.mutableFileSize) {
+        storageMetrics.mutableFileSize = offset + result;
+    }
+    pthread_mutex_unlock(&storageMetricsMutex);
+    errno = error;
+    return result;
+}
+
+void StorageMetrics_GetSnapshot(StorageMetrics *snapshot)
+{
+    pthread_mutex_lock(&storageMetricsMutex);
+    *snapshot = storageMetrics;
+    pthread_mutex_unlock(&storageMetricsMutex);
+}
+
+void StorageMetrics_Reset(void)
+{
+    pthread_mutex_lock(&storageMetricsMutex);
+    memset(storageMetrics.operations, 0, sizeof(storageMetrics.operations));
+    storageMetrics.quotaErrors = 0;
+    pthread_mutex_unlock(&storageMetricsMutex);
+}
+
+ssize_t StorageMetrics_GetRemainingQuota(const StorageMetrics *metrics)
+{
+    if (metrics->mutableFileQuota == 0) {
+        return -1;
+    }
+    if (metrics->mutableFileSize >= (off_t)metrics->mutableFileQuota) {
+        return 0;
+    }
+    return (ssize_t)(metrics->mutableFileQuota - (size_t)metrics->mutableFileSize);
+}
+
+void StorageMetrics_Log(const StorageMetrics *metrics)
+{
+    for (size_t file = 0; file < StorageFile_Count; file++) {
+        for (size_t operation = 0; operation < StorageOperation_Count; operation++) {
+            const StorageOperationMetrics *operationMetrics =
+                &metrics->operations[file][operation];
+            if (operationMetrics->count == 0) {
+                continue;
+            }
+            const StorageHistogram *histogram = &operationMetrics->latency;
+            Log_Debug("INFO: Storage %s %s: %lu operation(s), %lu failed, %llu bytes; min %lu avg "
+                      "%llu max %lu us, buckets",
+                      fileNames[file], operationNames[operation],
+                      (unsigned long)operationMetrics->count,
+                      (unsigned long)operationMetrics->failures,
+                      (unsigned long long)operationMetrics->bytes,
+                      (unsigned long)histogram->minMicroseconds,
+                      (unsigned long long)(histogram->sumMicroseconds / operationMetrics->count),
+                      (unsigned long)histogram->maxMicroseconds);
+            for (size_t bucket = 0; bucket < STORAGE_METRICS_BUCKETS; bucket++) {
+                Log_Debug(" %lu", (unsigned long)histogram->buckets[bucket]);
+            }
+            Log_Debug("\n");
+        }
+    }
+
+    ssize_t remaining = StorageMetrics_GetRemainingQuota(metrics);
+    if (remaining >= 0) {
+        Log_Debug("INFO: Mutable file is %lld of %zu bytes, %zd remaining; %lu write(s) exceeded "
+                  "the quota.\n",
+                  (long long)metrics->mutableFileSize, metrics->mutableFileQuota, remaining,
+                  (unsigned long)metrics->quotaErrors);
+    }
+}
@@ -0,0 +1,140 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// <summary>
+///     Number of buckets in each histogram. The buckets hold durations of up to 50, 100, 250,
+///     500, 1000, 2500, 5000, 10000 and 50000 microseconds, and the last one holds longer
+///     durations.
+/// </summary>
+#define STORAGE_METRICS_BUCKETS 10
+
+/// <summary>
+///     The files whose operations are measured.
+/// </summary>
+typedef enum {
+    /// <summary>The application's mutable file, which is in flash and wears out.</summary>
+    StorageFile_Mutable,
+    /// <summary>Files in the image package, which are only read.</summary>
+    StorageFile_ImagePackage,
+    StorageFile_Count
+} StorageFile;
+
+/// <summary>
+///     The operations which are measured.
+/// </summary>
+typedef enum {
+    StorageOperation_Open,
+    StorageOperation_Read,
+    StorageOperation_Write,
+    StorageOperation_Count
+} StorageOperation;
+
+/// <summary>
+///     Distribution of the durations of one operation.
+/// </summary>
+typedef struct {
+    /// <summary>Number of durations in each bucket.</summary>
+    uint32_t buckets[STORAGE_METRICS_BUCKETS];
+    uint32_t minMicroseconds;
+    uint32_t maxMicroseconds;
+    uint64_t sumMicroseconds;
+} StorageHistogram;
+
+/// <summary>
+///     The metrics of one operation on one file.
+/// </summary>
+typedef struct {
+    /// <summary>Number of operations, and how many of those failed.</summary>
+    uint32_t count;
+    uint32_t failures;
+    /// <summary>Number of bytes which were read or written.</summary>
+    uint64_t bytes;
+    StorageHistogram latency;
+} StorageOperationMetrics;
+
+/// <summary>
+///     The metrics of the application's storage since they were reset. This is a plain
+///     structure, so a snapshot is taken by copying it.
+/// </summary>
+typedef struct {
+    StorageOperationMetrics operations[StorageFile_Count][StorageOperation_Count];
+    /// <summary>Number of writes which failed because the mutable file had reached the size
+    /// which the application manifest allows, with EDQUOT.</summary>
+    uint32_t quotaErrors;
+    /// <summary>Size of the mutable file which the application manifest allows, in bytes, or 0
+    /// if it has not been set.</summary>
+    size_t mutableFileQuota;
+    /// <summary>Size of the mutable file, as far as it is known from opening and writing
+    /// it.</summary>
+    off_t mutableFileSize;
+} StorageMetrics;
+
+/// <summary>
+///     Sets the size of the mutable file which the application manifest allows, from which the
+///     remaining quota is found.
+/// </summary>
+/// <param name="bytes">The MutableStorage SizeKB of the manifest, in bytes.</param>
+void StorageMetrics_SetMutableFileQuota(size_t bytes);
+
+/// <summary>
+///     Opens the mutable file with Storage_OpenMutableFile, and measures it.
+/// </summary>
+/// <returns>The file descriptor, or -1 on failure</returns>
+int StorageMetrics_OpenMutableFile(void);
+
+/// <summary>
+///     Opens a file in the image package with Storage_OpenFileInImagePackage, and measures
+///     it.
+/// </summary>
+/// <param name="path">Path of the file within the image package.</param>
+/// <returns>The file descriptor, or -1 on failure</returns>
+int StorageMetrics_OpenFileInImagePackage(const char *path);
+
+/// <summary>
+///     Reads from the current position of a file with read, and measures it.
+/// </summary>
+/// <param name="file">Which file fd is.</param>
+/// <returns>The result of read</returns>
+ssize_t StorageMetrics_Read(StorageFile file, int fd, void *buffer, size_t size);
+
+/// <summary>
+///     Reads from an offset in a file with pread, and measures it.
+/// </summary>
+/// <param name="file">Which file fd is.</param>
+/// <returns>The result of pread</returns>
+ssize_t StorageMetrics_PRead(StorageFile file, int fd, void *buffer, size_t size, off_t offset);
+
+/// <summary>
+///     Writes to an offset in the mutable file with pwrite, and measures it.
+/// </summary>
+/// <returns>The result of pwrite</returns>
+ssize_t StorageMetrics_PWrite(int fd, const void *buffer, size_t size, off_t offset);
+
+/// <summary>
+///     Copies the metrics.
+/// </summary>
+/// <param name="snapshot">Receives the metrics.</param>
+void StorageMetrics_GetSnapshot(StorageMetrics *snapshot);
+
+/// <summary>
+///     Discards the metrics, apart from the quota and the size of the mutable file.
+/// </summary>
+void StorageMetrics_Reset(void);
+
+/// <summary>
+///     Gets the number of bytes by which the mutable file can still grow.
+/// </summary>
+/// <param name="metrics">The metrics.</param>
+/// <returns>The remaining quota in bytes, or -1 if the quota has not been set</returns>
+ssize_t StorageMetrics_GetRemainingQuota(const StorageMetrics *metrics);
+
+/// <summary>
+///     Logs the metrics of each operation which has been used.
+/// </summary>
+/// <param name="metrics">The metrics.</param>
+void StorageMetrics_Log(const StorageMetrics *metrics);
@@ -0,0 +1,539 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "json_writer.h"
+#include "telemetry_batcher.h"
+
+// Space which is kept free in a JSON batch for the summary of each aggregated series, on top of
+// four copies of its key: the punctuation, the "Min", "Max" and "Count" suffixes, the time, and
+// four numbers of up to 13 characters each.
+static const size_t jsonSummaryOverhead = 112;
+// Space which is kept free in a CBOR batch for the summary of each aggregated series, on top of
+// its key: the map and array heads, three floats, the count, and the time field.
+static const size_t cborSummaryOverhead = 32;
+// Space which is kept free for the end of the array: ']' and the null terminator for JSON, or
+// the break byte for CBOR.
+static const size_t arrayEndLength = 2;
+// Longest encoding of a single reading or summary.
+#define MAX_ENCODED_RECORD_LENGTH 256
+// Longest encoding of a record of several numeric readings.
+#define MAX_ENCODED_VALUES_LENGTH 512
+
+// CBOR major types and simple values, from RFC 7049.
+#define CBOR_UNSIGNED 0
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_FLOAT32 0xfa
+#define CBOR_INDEFINITE_ARRAY 0x9f
+#define CBOR_BREAK 0xff
+
+static void TelemetryBatcherTimerEventHandler(EventData *eventData);
+
+/// <summary>
+///     Finds the field ID of a key in the schema.
+/// </summary>
+/// <returns>The field ID, or 0 if the key is not in the schema</returns>
+static uint32_t FindFieldId(const TelemetryBatcher *batcher, const char *key)
+{
+    for (size_t i = 0; i < batcher->config.fieldCount; i++) {
+        if (strcmp(batcher->config.fields[i].key, key) == 0) {
+            return batcher->config.fields[i].id;
+        }
+    }
+    return 0;
+}
+
+/// <summary>
+///     Writes the head of a CBOR data item: its major type and a length or value.
+/// </summary>
+/// <returns>The number of bytes written, which is at most 5</returns>
+static size_t EncodeCborHead(uint8_t *out, uint8_t majorType, uint32_t value)
+{
+    uint8_t type = (uint8_t)(majorType << 5);
+    if (value < 24) {
+        out[0] = type | (uint8_t)value;
+        return 1;
+    }
+    if (value <= UINT8_MAX) {
+        out[0] = type | 24;
+        out[1] = (uint8_t)value;
+        return 2;
+    }
+    if (value <= UINT16_MAX) {
+        out[0] = type | 25;
+        out[1] = (uint8_t)(value >> 8);
+        out[2] = (uint8_t)value;
+        return 3;
+    }
+    out[0] = type | 26;
+    out[1] = (uint8_t)(value >> 24);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 8);
+    out[4] = (uint8_t)value;
+    return 5;
+}
+
+/// <summary>
+///     Writes a number as a CBOR single-precision float, which is 5 bytes long.
+/// </summary>
+static size_t EncodeCborFloat(uint8_t *out, double value)
+{
+    float single = (float)value;
+    uint32_t bits;
+    memcpy(&bits, &single, sizeof(bits));
+    out[0] = CBOR_FLOAT32;
+    out[1] = (uint8_t)(bits >> 24);
+    out[2] = (uint8_t)(bits >> 16);
+    out[3] = (uint8_t)(bits >> 8);
+    out[4] = (uint8_t)bits;
+    return 5;
+}
+
+/// <summary>
+///     Writes a CBOR text string, whose length is limited by the caller.
+/// </summary>
+static size_t EncodeCborText(uint8_t *out, const char *text, size_t length)
+{
+    size_t headLength = EncodeCborHead(out, CBOR_TEXT, (uint32_t)length);
+    memcpy(out + headLength, text, length);
+    return headLength + length;
+}
+
+/// <summary>
+///     Writes a key as a CBOR map key: its field ID if it is in the schema, otherwise its name.
+/// </summary>
+static size_t EncodeCborKey(const TelemetryBatcher *batcher, uint8_t *out, const char *key)
+{
+    uint32_t id = FindFieldId(batcher, key);
+    if (id != 0) {
+        return EncodeCborHead(out, CBOR_UNSIGNED, id);
+    }
+    return EncodeCborText(out, key, strlen(key));
+}
+
+/// <summary>
+///     Writes the time field, which ends each CBOR record.
+/// </summary>
+static size_t EncodeCborTime(uint8_t *out, time_t time)
+{
+    size_t length = EncodeCborHead(out, CBOR_UNSIGNED, TELEMETRY_BATCHER_TIME_FIELD_ID);
+    return length + EncodeCborHead(out + length, CBOR_UNSIGNED, (uint32_t)time);
+}
+
+/// <summary>
+///     Encodes a reading as its own object, {"key":value,"time":N} in JSON, or the CBOR map
+///     {key: value, 0: N}.
+/// </summary>
+/// <param name="text">For a string value, the value; otherwise NULL.</param>
+/// <param name="number">For a numeric value, the value.</param>
+/// <returns>The length of the encoded reading, or 0 if it is too long</returns>
+static size_t EncodeReading(const TelemetryBatcher *batcher, uint8_t *out, const char *key,
+                            const char *text, double number, time_t time)
+{
+    if (batcher->config.encoding == TelemetryEncoding_Json) {
+        JsonWriter writer;
+        JsonWriter_Init(&writer, (char *)out, MAX_ENCODED_RECORD_LENGTH);
+        JsonWriter_BeginObject(&writer);
+        JsonWriter_Key(&writer, key);
+        if (text != NULL) {
+            JsonWriter_String(&writer, text);
+        } else {
+            JsonWriter_Number(&writer, number);
+        }
+        JsonWriter_Key(&writer, "time");
+        JsonWriter_Integer(&writer, (int64_t)time);
+        JsonWriter_EndObject(&writer);
+        int length = JsonWriter_Finish(&writer);
+        return (length < 0) ? 0 : (size_t)length;
+    }
+
+    // The map head, the time field, and a key or string value of up to three head bytes.
+    size_t keyLength = strlen(key);
+    size_t textLength = (text != NULL) ? strlen(text) : 0;
+    if (keyLength + textLength + 20 > MAX_ENCODED_RECORD_LENGTH) {
+        return 0;
+    }
+    size_t length = EncodeCborHead(out, CBOR_MAP, 2);
+    length += EncodeCborKey(batcher, out + length, key);
+    if (text != NULL) {
+        length += EncodeCborText(out + length, text, textLength);
+    } else {
+        length += EncodeCborFloat(out + length, number);
+    }
+    return length + EncodeCborTime(out + length, time);
+}
+
+/// <summary>
+///     Encodes several numeric readings as one object, {"k1":v1,"k2":v2,"time":N} in JSON, or
+///     the CBOR map {k1: v1, k2: v2, 0: N}.
+/// </summary>
+/// <returns>The length of the encoded record, or 0 if it is longer than
+/// MAX_ENCODED_VALUES_LENGTH</returns>
+static size_t EncodeValues(const TelemetryBatcher *batcher, uint8_t *out,
+                           const char *const *keys, const double *values, size_t count,
+                           time_t time)
+{
+    if (batcher->config.encoding == TelemetryEncoding_Json) {
+        JsonWriter writer;
+        JsonWriter_Init(&writer, (char *)out, MAX_ENCODED_VALUES_LENGTH);
+        JsonWriter_BeginObject(&writer);
+        for (size_t i = 0; i < count; i++) {
+            JsonWriter_Key(&writer, keys[i]);
+            JsonWriter_Number(&writer, values[i]);
+        }
+        JsonWriter_Key(&writer, "time");
+        JsonWriter_Integer(&writer, (int64_t)time);
+        JsonWriter_EndObject(&writer);
+        int length = JsonWriter_Finish(&writer);
+        return (length < 0) ? 0 : (size_t)length;
+    }
+
+    // For each reading, a key of up to three head bytes and a float; then the map head and
+    // the time field.
+    size_t needed = 16;
+    for (size_t i = 0; i < count; i++) {
+        needed += strlen(keys[i]) + 8;
+    }
+    if (count >= UINT32_MAX || needed > MAX_ENCODED_VALUES_LENGTH) {
+        return 0;
+    }
+    size_t length = EncodeCborHead(out, CBOR_MAP, (uint32_t)count + 1);
+    for (size_t i = 0; i < count; i++) {
+        length += EncodeCborKey(batcher, out + length, keys[i]);
+        length += EncodeCborFloat(out + length, values[i]);
+    }
+    return length + EncodeCborTime(out + length, time);
+}
+
+/// <summary>
+///     Writes the key of a series followed by a suffix, such as "TemperatureMin".
+/// </summary>
+static void WriteSuffixedKey(JsonWriter *writer, const char *key, const char *suffix)
+{
+    char suffixedKey[TELEMETRY_BATCHER_MAX_KEY_LENGTH + sizeof("Count")];
+    size_t keyLength = strlen(key);
+    memcpy(suffixedKey, key, keyLength);
+    memcpy(suffixedKey + keyLength, suffix, strlen(suffix) + 1);
+    JsonWriter_Key(writer, suffixedKey);
+}
+
+/// <summary>
+///     Encodes the summary of a series. In JSON this is
+///     {"K":mean,"KMin":min,"KMax":max,"KCount":count,"time":N}, and in CBOR it is the map
+///     {key: [mean, min, max, count], 0: N}.
+/// </summary>
+/// <returns>The length of the encoded summary</returns>
+static size_t EncodeSummary(const TelemetryBatcher *batcher, uint8_t *out,
+                            const TelemetrySeries *series, time_t time)
+{
+    const char *key = series->key;
+    double mean = series->sum / series->count;
+
+    if (batcher->config.encoding == TelemetryEncoding_Json) {
+        JsonWriter writer;
+        JsonWriter_Init(&writer, (char *)out, MAX_ENCODED_RECORD_LENGTH);
+        JsonWriter_BeginObject(&writer);
+        JsonWriter_Key(&writer, key);
+        JsonWriter_Number(&writer, mean);
+        WriteSuffixedKey(&writer, key, "Min");
+        JsonWriter_Number(&writer, series->min);
+        WriteSuffixedKey(&writer, key, "Max");
+        JsonWriter_Number(&writer, series->max);
+        WriteSuffixedKey(&writer, key, "Count");
+        JsonWriter_Integer(&writer, series->count);
+        JsonWriter_Key(&writer, "time");
+        JsonWriter_Integer(&writer, (int64_t)time);
+        JsonWriter_EndObject(&writer);
+        int length = JsonWriter_Finish(&writer);
+        return (length < 0) ? 0 : (size_t)length;
+    }
+
+    size_t length = EncodeCborHead(out, CBOR_MAP, 2);
+    length += EncodeCborKey(batcher, out + length, key);
+    length += EncodeCborHead(out + length, CBOR_ARRAY, 4);
+    length += EncodeCborFloat(out + length, mean);
+    length += EncodeCborFloat(out + length, series->min);
+    length += EncodeCborFloat(out + length, series->max);
+    length += EncodeCborHead(out + length, CBOR_UNSIGNED, series->count);
+    return length + EncodeCborTime(out + length, time);
+}
+
+/// <summary>
+///     Gets the space which is kept free for the summary of a series.
+/// </summary>
+static size_t SeriesReserve(const TelemetryBatcher *batcher, const char *key)
+{
+    if (batcher->config.encoding == TelemetryEncoding_Json) {
+        return 4 * JsonWriter_EscapedLength(key) + jsonSummaryOverhead;
+    }
+    return strlen(key) + cborSummaryOverhead;
+}
+
+/// <summary>
+///     Gets the space which is kept free for the summaries of the series, which are only
+///     written when the batch is flushed.
+/// </summary>
+static size_t SummaryReserve(const TelemetryBatcher *batcher)
+{
+    size_t reserve = 0;
+    for (size_t i = 0; i < batcher->seriesCount; i++) {
+        reserve += SeriesReserve(batcher, batcher->series[i].key);
+    }
+    return reserve;
+}
+
+/// <summary>
+///     Appends an encoded record to the batch, after a separator in JSON, if it fits with the
+///     given space to spare.
+/// </summary>
+/// <returns>true if the record was appended, otherwise false, in which case the batch is not
+/// changed</returns>
+static bool Append(TelemetryBatcher *batcher, size_t spare, const uint8_t *record, size_t length)
+{
+    bool separate = (batcher->config.encoding == TelemetryEncoding_Json && batcher->length > 1);
+    size_t needed = batcher->length + (separate ? 1 : 0) + length + spare + arrayEndLength;
+    if (needed > batcher->config.bufferSize) {
+        return false;
+    }
+
+    if (separate) {
+        batcher->config.buffer[batcher->length++] = ',';
+    }
+    memcpy(batcher->config.buffer + batcher->length, record, length);
+    batcher->length += length;
+    return true;
+}
+
+/// <summary>
+///     Discards the batch, once it has been sent, and starts the array of the next one.
+/// </summary>
+static void ResetBatch(TelemetryBatcher *batcher)
+{
+    batcher->config.buffer[0] =
+        (batcher->config.encoding == TelemetryEncoding_Json) ? '[' : (char)CBOR_INDEFINITE_ARRAY;
+    batcher->length = 1;
+    batcher->recordCount = 0;
+    batcher->seriesCount = 0;
+}
+
+/// <summary>
+///     Appends an encoded record, flushing the batch first if it does not fit.
+/// </summary>
+/// <param name="key">Key of the record, which is logged if it is dropped.</param>
+/// <param name="length">Length of the record, or 0 if it could not be encoded.</param>
+static void AppendRecord(TelemetryBatcher *batcher, const char *key, const uint8_t *record,
+                         size_t length)
+{
+    for (int attempt = 0; attempt < 2 && length > 0; attempt++) {
+        if (Append(batcher, SummaryReserve(batcher), record, length)) {
+            ++batcher->recordCount;
+            return;
+        }
+        if (attempt == 0 && !TelemetryBatcher_Flush(batcher)) {
+            break;
+        }
+    }
+
+    ++batcher->droppedReadings;
+    Log_Debug("WARNING: Telemetry batch is full; dropped '%s'.\n", key);
+}
+
+/// <summary>
+///     Adds a reading which is sent as its own object, flushing the batch first if it does not
+///     fit.
+/// </summary>
+static void AddRecord(TelemetryBatcher *batcher, const char *key, const char *text, double number,
+                      time_t time)
+{
+    uint8_t record[MAX_ENCODED_RECORD_LENGTH];
+    size_t length = EncodeReading(batcher, record, key, text, number, time);
+    AppendRecord(batcher, key, record, length);
+}
+
+/// <summary>
+///     Finds the series of a key, and adds it if it is not there yet, flushing the batch first
+///     if the summary of another series does not fit.
+/// </summary>
+/// <returns>The series, or NULL if there is no room for it</returns>
+static TelemetrySeries *FindSeries(TelemetryBatcher *batcher, const char *key)
+{
+    for (size_t i = 0; i < batcher->seriesCount; i++) {
+        if (strcmp(batcher->series[i].key, key) == 0) {
+            return &batcher->series[i];
+        }
+    }
+
+    size_t keyLength = strlen(key);
+    if (keyLength > TELEMETRY_BATCHER_MAX_KEY_LENGTH) {
+        return NULL;
+    }
+    size_t newReserve = SeriesReserve(batcher, key);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool fits = batcher->length + SummaryReserve(batcher) + newReserve + arrayEndLength <=
+                    batcher->config.bufferSize;
+        if (fits && batcher->seriesCount < TELEMETRY_BATCHER_MAX_SERIES) {
+            TelemetrySeries *series = &batcher->series[batcher->seriesCount++];
+            memset(series, 0, sizeof(*series));
+            memcpy(series->key, key, keyLength + 1);
+            return series;
+        }
+        if (attempt == 0 && !TelemetryBatcher_Flush(batcher)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int TelemetryBatcher_Init(TelemetryBatcher *batcher, int epollFd,
+                          const TelemetryBatcherConfig *config,
+                          TelemetryBatcherSendHandler sendHandler, void *context)
+{
+    memset(batcher, 0, sizeof(*batcher));
+    batcher->timerFd = -1;
+    batcher->config = *config;
+    batcher->sendHandler = sendHandler;
+    batcher->context = context;
+    batcher->timerEventData.eventHandler = &TelemetryBatcherTimerEventHandler;
+
+    // The buffer must at least hold an empty array.
+    if (config->buffer == NULL || config->bufferSize < arrayEndLength + 1) {
+        Log_Debug("ERROR: The telemetry batch buffer is too small.\n");
+        return -1;
+    }
+    for (size_t i = 0; i < config->fieldCount; i++) {
+        if (config->fields[i].id == TELEMETRY_BATCHER_TIME_FIELD_ID) {
+            Log_Debug("ERROR: Telemetry field ID %u is reserved for the time.\n",
+                      TELEMETRY_BATCHER_TIME_FIELD_ID);
+            return -1;
+        }
+    }
+    ResetBatch(batcher);
+
+    batcher->timerFd = CreateTimerFdAndAddToEpoll(epollFd, &batcher->config.flushPeriod,
+                                                  &batcher->timerEventData, EPOLLIN);
+    return (batcher->timerFd < 0) ? -1 : 0;
+}
+
+void TelemetryBatcher_AddValue(TelemetryBatcher *batcher, const char *key, double value)
+{
+    if (!batcher->config.aggregate) {
+        AddRecord(batcher, key, NULL, value, time(NULL));
+        return;
+    }
+
+    TelemetrySeries *series = FindSeries(batcher, key);
+    if (series == NULL) {
+        ++batcher->droppedReadings;
+        Log_Debug("WARNING: Telemetry batch is full; dropped '%s'.\n", key);
+        return;
+    }
+
+    if (series->count == 0 || value < series->min) {
+        series->min = value;
+    }
+    if (series->count == 0 || value > series->max) {
+        series->max = value;
+    }
+    series->sum += value;
+    ++series->count;
+}
+
+void TelemetryBatcher_AddValueAt(TelemetryBatcher *batcher, const char *key, double value,
+                                 time_t time)
+{
+    AddRecord(batcher, key, NULL, value, time);
+}
+
+void TelemetryBatcher_AddValues(TelemetryBatcher *batcher, const char *const *keys,
+                                const double *values, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    uint8_t record[MAX_ENCODED_VALUES_LENGTH];
+    size_t length = EncodeValues(batcher, record, keys, values, count, time(NULL));
+    AppendRecord(batcher, keys[0], record, length);
+}
+
+void TelemetryBatcher_AddEvent(TelemetryBatcher *batcher, const char *key, const char *value)
+{
+    AddRecord(batcher, key, value, 0, time(NULL));
+}
+
+bool TelemetryBatcher_Flush(TelemetryBatcher *batcher)
+{
+    if (batcher->recordCount == 0 && batcher->seriesCount == 0) {
+        return true;
+    }
+
+    // The summaries always fit, because space was kept free for them.
+    size_t recordsLength = batcher->length;
+    time_t now = time(NULL);
+    for (size_t i = 0; i < batcher->seriesCount; i++) {
+        uint8_t summary[MAX_ENCODED_RECORD_LENGTH];
+        size_t length = EncodeSummary(batcher, summary, &batcher->series[i], now);
+        if (length > 0) {
+            Append(batcher, 0, summary, length);
+        }
+    }
+
+    size_t messageLength = batcher->length;
+    if (batcher->config.encoding == TelemetryEncoding_Json) {
+        batcher->config.buffer[messageLength++] = ']';
+        batcher->config.buffer[messageLength] = '\0';
+    } else {
+        batcher->config.buffer[messageLength++] = (char)CBOR_BREAK;
+    }
+
+    if (!batcher->sendHandler(batcher, batcher->config.buffer, messageLength,
+                              batcher->context)) {
+        // Keep the readings, and the summaries as series, for the next flush.
+        batcher->length = recordsLength;
+        return false;
+    }
+
+    ++batcher->messagesSent;
+    batcher->bytesSent += messageLength;
+    ResetBatch(batcher);
+    return true;
+}
+
+int TelemetryBatcher_SetFlushPeriod(TelemetryBatcher *batcher, const struct timespec *flushPeriod)
+{
+    if (SetTimerFdToPeriod(batcher->timerFd, flushPeriod) != 0) {
+        return -1;
+    }
+    batcher->config.flushPeriod = *flushPeriod;
+    return 0;
+}
+
+void TelemetryBatcher_SetAggregate(TelemetryBatcher *batcher, bool aggregate)
+{
+    batcher->config.aggregate = aggregate;
+}
+
+void TelemetryBatcher_Close(TelemetryBatcher *batcher)
+{
+    // A zero-initialized batcher has timerFd 0, which it does not own.
+    if (batcher->timerEventData.eventHandler != NULL) {
+        CloseFdAndPrintError(batcher->timerFd, "TelemetryBatcherTimer");
+    }
+
+    batcher->timerFd = -1;
+}
+
+static void TelemetryBatcherTimerEventHandler(EventData *eventData)
+{
+    TelemetryBatcher *batcher = (TelemetryBatcher *)eventData;
+
+    if (ConsumeTimerFdEvent(batcher->timerFd) != 0) {
+        return;
+    }
+
+    TelemetryBatcher_Flush(batcher);
+}
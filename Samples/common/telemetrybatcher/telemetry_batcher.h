@@ -0,0 +1,232 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Number of different keys whose numeric readings can be aggregated at once.
+/// </summary>
+#define TELEMETRY_BATCHER_MAX_SERIES 8
+
+/// <summary>Longest key of an aggregated series, not including the null terminator.</summary>
+#define TELEMETRY_BATCHER_MAX_KEY_LENGTH 31
+
+/// <summary>
+///     Field ID which stands for the time of each reading in CBOR batches. The field IDs in
+///     the schema must not use it.
+/// </summary>
+#define TELEMETRY_BATCHER_TIME_FIELD_ID 0
+
+struct TelemetryBatcher;
+
+/// <summary>
+///     How the batches are encoded.
+/// </summary>
+typedef enum {
+    /// <summary>A JSON array of objects, which IoT Hub message routing can query. This is the
+    /// default.</summary>
+    TelemetryEncoding_Json,
+    /// <summary>A CBOR (RFC 7049) array of maps, which takes about a third of the space of
+    /// JSON for numeric readings. Keys are encoded as their field IDs from the schema, values
+    /// as single-precision floats and times as unsigned integers under the key
+    /// TELEMETRY_BATCHER_TIME_FIELD_ID. The summary of an aggregated series is encoded as
+    /// the array [mean, minimum, maximum, count]. The cloud needs the same schema to decode
+    /// the batches.</summary>
+    TelemetryEncoding_Cbor
+} TelemetryEncoding;
+
+/// <summary>
+///     An entry of the schema, which gives the field ID that a key is encoded as in CBOR.
+/// </summary>
+typedef struct {
+    /// <summary>The name of the reading, such as "Temperature".</summary>
+    const char *key;
+    /// <summary>The field ID, which is encoded in a single byte if it is less than 24.</summary>
+    uint32_t id;
+} TelemetryField;
+
+/// <summary>
+///     Function which sends a batch of telemetry, such as by passing it to
+///     IoTHubDeviceClient_LL_SendEventAsync.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <param name="message">The batch, as a null-terminated JSON array or as a CBOR array,
+/// according to the encoding of the batcher. It is only valid until the function
+/// returns.</param>
+/// <param name="length">Length of the message, not including the null terminator of
+/// JSON.</param>
+/// <param name="context">The context which was passed to
+/// <see cref="TelemetryBatcher_Init" />.</param>
+/// <returns>true if the message was accepted for delivery; false to keep the batch and try
+/// again at the next flush, such as while the device is not connected.</returns>
+typedef bool (*TelemetryBatcherSendHandler)(struct TelemetryBatcher *batcher,
+                                            const char *message, size_t length, void *context);
+
+/// <summary>
+///     How a <see cref="TelemetryBatcher" /> collects and sends telemetry.
+/// </summary>
+typedef struct {
+    /// <summary>Buffer in which the batch is built. Its size is the largest message which is
+    /// sent: the batch is flushed when the next reading would not fit. It must remain valid
+    /// until the batcher is closed.</summary>
+    char *buffer;
+    /// <summary>Size of the buffer in bytes.</summary>
+    size_t bufferSize;
+    /// <summary>Longest time for which a reading waits in the batch before the batch is
+    /// flushed.</summary>
+    struct timespec flushPeriod;
+    /// <summary>Whether numeric readings are summarized per flush period, instead of being
+    /// sent one by one. Each key is sent as one object with its mean, minimum, maximum and
+    /// number of readings, such as
+    /// {"Temperature":30.5,"TemperatureMin":29.8,"TemperatureMax":31.2,"TemperatureCount":12}.
+    /// Events are always sent one by one.</summary>
+    bool aggregate;
+    /// <summary>How the batches are encoded.</summary>
+    TelemetryEncoding encoding;
+    /// <summary>The schema, which maps keys to field IDs for CBOR. Keys which are not in it are
+    /// encoded as text strings. It must remain valid until the batcher is closed. May be NULL
+    /// if fieldCount is 0.</summary>
+    const TelemetryField *fields;
+    size_t fieldCount;
+} TelemetryBatcherConfig;
+
+/// <summary>
+///     Summary of the numeric readings of one key during the current flush period.
+/// </summary>
+typedef struct {
+    char key[TELEMETRY_BATCHER_MAX_KEY_LENGTH + 1];
+    uint32_t count;
+    double min;
+    double max;
+    double sum;
+} TelemetrySeries;
+
+/// <summary>
+/// <para>Collects telemetry readings from any number of sources and sends them as one JSON or
+/// CBOR array per flush, rather than as one message per reading. This reduces the number of device
+/// to cloud messages, which count against the IoT Hub daily quota, and the number of times the
+/// radio is woken to send them.</para>
+/// <para>The batch is flushed when the flush period ends, or when the next reading would not fit
+/// in the buffer. Each reading is sent as its own object, with its time in seconds since the
+/// epoch, such as {"ButtonPress":"True","time":1571234567}, unless numeric readings are
+/// aggregated.</para>
+/// <para>Keys and string values are escaped in JSON batches.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="TelemetryBatcher_Init" /> and disposes of it with
+/// <see cref="TelemetryBatcher_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct TelemetryBatcher {
+    /// <summary>Event data for the flush timer. This is the first member, so the event handler
+    /// can find the batcher.</summary>
+    EventData timerEventData;
+    /// <summary>Timer which fires at the end of each flush period.</summary>
+    int timerFd;
+    TelemetryBatcherConfig config;
+    TelemetryBatcherSendHandler sendHandler;
+    void *context;
+    /// <summary>Length of the batch in the buffer, which starts with the '[' of the array.
+    /// </summary>
+    size_t length;
+    /// <summary>Number of readings in the buffer, not counting the aggregated ones.</summary>
+    size_t recordCount;
+    /// <summary>The numeric readings which are being aggregated.</summary>
+    TelemetrySeries series[TELEMETRY_BATCHER_MAX_SERIES];
+    size_t seriesCount;
+    /// <summary>Number of readings which were dropped because the batch was full and could not
+    /// be sent.</summary>
+    uint32_t droppedReadings;
+    /// <summary>Number of messages which have been sent, and their total length.</summary>
+    uint32_t messagesSent;
+    uint64_t bytesSent;
+} TelemetryBatcher;
+
+/// <summary>
+///     Creates the flush timer and adds it to an epoll instance.
+/// </summary>
+/// <param name="batcher">Batcher to initialize. This must stay in memory until it is
+/// closed.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="config">How the telemetry is collected and sent. This is copied.</param>
+/// <param name="sendHandler">Function which sends each batch.</param>
+/// <param name="context">Value which is passed to sendHandler.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TelemetryBatcher_Init(TelemetryBatcher *batcher, int epollFd,
+                          const TelemetryBatcherConfig *config,
+                          TelemetryBatcherSendHandler sendHandler, void *context);
+
+/// <summary>
+///     Adds a numeric reading, which is aggregated if the batcher is configured to do so.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <param name="key">The name of the reading, such as "Temperature".</param>
+/// <param name="value">The value of the reading.</param>
+void TelemetryBatcher_AddValue(TelemetryBatcher *batcher, const char *key, double value);
+
+/// <summary>
+///     Adds a numeric reading which was taken earlier, such as one which was stored while the
+///     device was offline. It is always sent as it is, with its own time, and never aggregated.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <param name="key">The name of the reading, such as "Temperature".</param>
+/// <param name="value">The value of the reading.</param>
+/// <param name="time">When the reading was taken.</param>
+void TelemetryBatcher_AddValueAt(TelemetryBatcher *batcher, const char *key, double value,
+                                 time_t time);
+
+/// <summary>
+///     Adds several numeric readings which are sent together as one object, with one time,
+///     such as {"HeapBytes":2048,"FlashWrites":3,"time":1571234567}. They are never aggregated.
+///     The encoded object must fit in 512 bytes, or it is dropped.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <param name="keys">The names of the readings.</param>
+/// <param name="values">The values of the readings, in the same order.</param>
+/// <param name="count">Number of readings. Nothing is added if this is 0.</param>
+void TelemetryBatcher_AddValues(TelemetryBatcher *batcher, const char *const *keys,
+                                const double *values, size_t count);
+
+/// <summary>
+///     Adds an event with a string value, which is always sent as it is.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <param name="key">The name of the event, such as "ButtonPress".</param>
+/// <param name="value">The value of the event.</param>
+void TelemetryBatcher_AddEvent(TelemetryBatcher *batcher, const char *key, const char *value);
+
+/// <summary>
+///     Sends the batch now, if it holds any readings.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <returns>true if the batch was sent or was empty, or false if the send handler did not
+/// accept it, in which case it is kept.</returns>
+bool TelemetryBatcher_Flush(TelemetryBatcher *batcher);
+
+/// <summary>
+///     Changes the flush period. The current period is restarted, so the batch is next flushed
+///     one new period from now.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <param name="flushPeriod">Longest time for which a reading waits in the batch.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TelemetryBatcher_SetFlushPeriod(TelemetryBatcher *batcher, const struct timespec *flushPeriod);
+
+/// <summary>
+///     Changes whether numeric readings are aggregated. The readings which are already being
+///     aggregated are still sent as summaries at the next flush.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+/// <param name="aggregate">Whether numeric readings are summarized per flush period.</param>
+void TelemetryBatcher_SetAggregate(TelemetryBatcher *batcher, bool aggregate);
+
+/// <summary>
+///     Closes the flush timer. The readings which have not been sent are discarded, so call
+///     <see cref="TelemetryBatcher_Flush" /> first to send them. It is safe to call this
+///     function on a batcher which has been zero-initialized, or whose initialization failed.
+/// </summary>
+/// <param name="batcher">The batcher.</param>
+void TelemetryBatcher_Close(TelemetryBatcher *batcher);
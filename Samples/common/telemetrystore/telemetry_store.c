@@ -0,0 +1,310 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "telemetry_store.h"
+#include "storage_metrics.h"
+
+/// <summary>
+///     The kinds of record in the ring.
+/// </summary>
+typedef enum {
+    /// <summary>A reading, whose data is the value as a float.</summary>
+    RecordType_Reading = 0x52, // 'R'
+    /// <summary>A delivery marker, whose data is the sequence number of the last reading which
+    /// was delivered.</summary>
+    RecordType_Delivered = 0x44 // 'D'
+} RecordType;
+
+/// <summary>
+///     A record as it is written to mutable storage.
+/// </summary>
+typedef struct {
+    uint32_t sequence;
+    uint32_t time;
+    uint32_t data;
+    uint8_t type;
+    uint8_t keyId;
+    /// <summary>Check value of the other fields, which detects a record that was only partly
+    /// written when the power failed.</summary>
+    uint16_t check;
+} StoredRecord;
+
+_Static_assert(sizeof(StoredRecord) == TELEMETRY_STORE_RECORD_SIZE,
+               "A stored record must be TELEMETRY_STORE_RECORD_SIZE bytes long");
+
+// Number of records which are read at once while the ring is scanned.
+#define SCAN_CHUNK_RECORDS 32
+
+/// <summary>
+///     Computes the check value of a record, by folding its 32-bit FNV-1a hash.
+/// </summary>
+static uint16_t ComputeCheck(const StoredRecord *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(StoredRecord, check); i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return (uint16_t)((hash >> 16) ^ hash);
+}
+
+/// <summary>
+///     Checks whether a slot holds a complete record. Slots which were never written, hold
+///     erased flash, or were torn by a power failure are not valid.
+/// </summary>
+static bool IsValidRecord(const StoredRecord *record)
+{
+    if (record->sequence == 0 || record->sequence == UINT32_MAX) {
+        return false;
+    }
+    if (record->type != RecordType_Reading && record->type != RecordType_Delivered) {
+        return false;
+    }
+    return record->check == ComputeCheck(record);
+}
+
+/// <summary>
+///     Reads consecutive records from the ring, without wrapping.
+/// </summary>
+/// <returns>0 on success, or -1 on failure. Records beyond the end of the mutable file are
+/// returned zeroed, so that they are not valid.</returns>
+static int ReadRecords(TelemetryStore *store, size_t slot, StoredRecord *records, size_t count)
+{
+    size_t size = count * sizeof(StoredRecord);
+    off_t position = store->offset + (off_t)(slot * sizeof(StoredRecord));
+    ssize_t result = StorageMetrics_PRead(StorageFile_Mutable, store->fd, records, size, position);
+    if (result < 0) {
+        Log_Debug("ERROR: Could not read the telemetry store: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+    memset((uint8_t *)records + result, 0, size - (size_t)result);
+    return 0;
+}
+
+/// <summary>
+///     Finds the oldest reading after the one which was just overwritten, by walking the ring
+///     from the oldest record. Every reading after the oldest pending one is also pending,
+///     because the ring is written in order.
+/// </summary>
+/// <returns>The slot, or writeSlot if there is none</returns>
+static size_t FindReading(TelemetryStore *store)
+{
+    // The newest record, just before writeSlot, is not examined.
+    size_t slot = store->writeSlot;
+    for (size_t i = 0; i + 1 < store->capacity; i++) {
+        StoredRecord record;
+        if (ReadRecords(store, slot, &record, 1) != 0) {
+            break;
+        }
+        if (IsValidRecord(&record) && record.type == RecordType_Reading) {
+            return slot;
+        }
+        slot = (slot + 1) % store->capacity;
+    }
+    return store->writeSlot;
+}
+
+/// <summary>
+///     Writes a record to the next slot of the ring, overwriting the oldest record.
+/// </summary>
+static int WriteRecord(TelemetryStore *store, RecordType type, uint8_t keyId, uint32_t data,
+                       uint32_t time)
+{
+    StoredRecord record = {.sequence = store->nextSequence,
+                           .time = time,
+                           .data = data,
+                           .type = (uint8_t)type,
+                           .keyId = keyId};
+    record.check = ComputeCheck(&record);
+
+    size_t slot = store->writeSlot;
+    off_t position = store->offset + (off_t)(slot * sizeof(record));
+    if (StorageMetrics_PWrite(store->fd, &record, sizeof(record), position) != sizeof(record)) {
+        Log_Debug("ERROR: Could not write to the telemetry store: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+
+    bool overwrotePending = (store->pendingCount > 0 && slot == store->readSlot);
+    store->writeSlot = (slot + 1) % store->capacity;
+    ++store->nextSequence;
+
+    if (overwrotePending) {
+        --store->pendingCount;
+        ++store->overwrittenReadings;
+        store->readSlot = store->writeSlot;
+        if (store->pendingCount > 0) {
+            store->readSlot = FindReading(store);
+        }
+    }
+
+    if (type == RecordType_Reading) {
+        if (store->pendingCount == 0) {
+            store->readSlot = slot;
+        }
+        ++store->pendingCount;
+    } else if (store->pendingCount == 0) {
+        store->readSlot = store->writeSlot;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Scans the ring for the newest record, which gives the position of the next write, and
+///     for the newest delivery marker.
+/// </summary>
+static int FindPosition(TelemetryStore *store)
+{
+    StoredRecord records[SCAN_CHUNK_RECORDS];
+    uint32_t newestSequence = 0;
+    size_t newestSlot = store->capacity - 1;
+
+    for (size_t first = 0; first < store->capacity; first += SCAN_CHUNK_RECORDS) {
+        size_t count = store->capacity - first;
+        if (count > SCAN_CHUNK_RECORDS) {
+            count = SCAN_CHUNK_RECORDS;
+        }
+        if (ReadRecords(store, first, records, count) != 0) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (!IsValidRecord(&records[i])) {
+                continue;
+            }
+            if (records[i].sequence > newestSequence) {
+                newestSequence = records[i].sequence;
+                newestSlot = first + i;
+            }
+            if (records[i].type == RecordType_Delivered &&
+                records[i].data > store->deliveredSequence) {
+                store->deliveredSequence = records[i].data;
+            }
+        }
+    }
+
+    store->writeSlot = (newestSlot + 1) % store->capacity;
+    store->nextSequence = newestSequence + 1;
+    return 0;
+}
+
+/// <summary>
+///     Counts the readings which have not been delivered, walking the ring from the oldest
+///     record to the newest.
+/// </summary>
+static int CountPending(TelemetryStore *store)
+{
+    StoredRecord record;
+    store->readSlot = store->writeSlot;
+    store->pendingCount = 0;
+
+    size_t slot = store->writeSlot;
+    for (size_t i = 0; i < store->capacity; i++) {
+        if (ReadRecords(store, slot, &record, 1) != 0) {
+            return -1;
+        }
+        if (IsValidRecord(&record) && record.type == RecordType_Reading &&
+            record.sequence > store->deliveredSequence) {
+            if (store->pendingCount == 0) {
+                store->readSlot = slot;
+            }
+            ++store->pendingCount;
+        }
+        slot = (slot + 1) % store->capacity;
+    }
+    return 0;
+}
+
+int TelemetryStore_Open(TelemetryStore *store, int fd, off_t offset, size_t size)
+{
+    memset(store, 0, sizeof(*store));
+    store->fd = fd;
+    store->offset = offset;
+    store->capacity = size / sizeof(StoredRecord);
+
+    if (store->capacity < 2 || FindPosition(store) != 0 || CountPending(store) != 0) {
+        Log_Debug("ERROR: Could not open the telemetry store.\n");
+        CloseFdAndPrintError(fd, "TelemetryStore");
+        store->fd = -1;
+        store->capacity = 0;
+        return -1;
+    }
+
+    Log_Debug("INFO: Telemetry store holds %zu reading(s) which have not been sent.\n",
+              store->pendingCount);
+    return 0;
+}
+
+int TelemetryStore_Append(TelemetryStore *store, uint8_t keyId, float value, time_t time)
+{
+    uint32_t data;
+    memcpy(&data, &value, sizeof(data));
+    return WriteRecord(store, RecordType_Reading, keyId, data, (uint32_t)time);
+}
+
+ssize_t TelemetryStore_Peek(TelemetryStore *store, TelemetryStoreRecord *records,
+                            size_t maxRecords)
+{
+    size_t count = 0;
+    size_t slot = store->readSlot;
+    // When the ring is full of pending readings, readSlot is the same as writeSlot.
+    for (size_t i = 0; i < store->capacity && count < maxRecords && count < store->pendingCount;
+         i++) {
+        StoredRecord record;
+        if (ReadRecords(store, slot, &record, 1) != 0) {
+            return -1;
+        }
+        if (IsValidRecord(&record) && record.type == RecordType_Reading) {
+            records[count].sequence = record.sequence;
+            records[count].time = record.time;
+            memcpy(&records[count].value, &record.data, sizeof(records[count].value));
+            records[count].keyId = record.keyId;
+            ++count;
+        }
+        slot = (slot + 1) % store->capacity;
+    }
+    return (ssize_t)count;
+}
+
+int TelemetryStore_MarkDelivered(TelemetryStore *store, uint32_t sequence)
+{
+    // Skip the delivered readings, whose slots can then be overwritten without loss.
+    for (size_t i = 0; i < store->capacity && store->pendingCount > 0; i++) {
+        StoredRecord record;
+        if (ReadRecords(store, store->readSlot, &record, 1) != 0) {
+            return -1;
+        }
+        if (IsValidRecord(&record) && record.type == RecordType_Reading) {
+            if (record.sequence > sequence) {
+                break;
+            }
+            --store->pendingCount;
+        }
+        store->readSlot = (store->readSlot + 1) % store->capacity;
+    }
+    if (store->pendingCount == 0) {
+        store->readSlot = store->writeSlot;
+    }
+
+    store->deliveredSequence = sequence;
+    return WriteRecord(store, RecordType_Delivered, 0, sequence, (uint32_t)time(NULL));
+}
+
+void TelemetryStore_Close(TelemetryStore *store)
+{
+    // A zero-initialized store has fd 0, which it does not own.
+    if (store->capacity > 0) {
+        CloseFdAndPrintError(store->fd, "TelemetryStore");
+    }
+
+    store->fd = -1;
+    store->capacity = 0;
+}
@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/// <summary>Size of each record in the store, in bytes.</summary>
+#define TELEMETRY_STORE_RECORD_SIZE 16
+
+/// <summary>
+///     A numeric reading which was taken while the device could not send it.
+/// </summary>
+typedef struct {
+    /// <summary>Increases by one with each record which is written, starting from 1.</summary>
+    uint32_t sequence;
+    /// <summary>When the reading was taken, in seconds since the epoch.</summary>
+    uint32_t time;
+    float value;
+    /// <summary>Identifies the reading's key, such as an index into a table of key names which
+    /// the application keeps.</summary>
+    uint8_t keyId;
+} TelemetryStoreRecord;
+
+/// <summary>
+/// <para>Keeps telemetry readings in a bounded ring in mutable storage while the device is
+/// offline, so that they survive until they can be sent, even across a restart.</para>
+/// <para>To spread the wear on the flash, the ring is only ever written sequentially, one
+/// 16-byte record after another. Nothing is rewritten in place: there is no header, and
+/// delivery is recorded by appending a marker record which holds the sequence number of the
+/// last record that was delivered. The position of the ring is found again by scanning it when
+/// it is opened. When the ring is full, the oldest readings are overwritten.</para>
+/// <para>The caller allocates this struct, initializes it with
+/// <see cref="TelemetryStore_Open" /> and disposes of it with
+/// <see cref="TelemetryStore_Close" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The mutable file, or -1 if the store is not open.</summary>
+    int fd;
+    /// <summary>Offset of the ring in the mutable file.</summary>
+    off_t offset;
+    /// <summary>Number of records in the ring.</summary>
+    size_t capacity;
+    /// <summary>Slot which the next record is written to.</summary>
+    size_t writeSlot;
+    /// <summary>Slot of the oldest reading which has not been delivered, or writeSlot if there
+    /// is none.</summary>
+    size_t readSlot;
+    /// <summary>Sequence number of the next record which is written.</summary>
+    uint32_t nextSequence;
+    /// <summary>Sequence number of the last reading which was delivered.</summary>
+    uint32_t deliveredSequence;
+    /// <summary>Number of readings which have not been delivered.</summary>
+    size_t pendingCount;
+    /// <summary>Number of readings which were overwritten before they were delivered.</summary>
+    uint32_t overwrittenReadings;
+} TelemetryStore;
+
+/// <summary>
+///     Opens the store, and finds the readings which were not delivered before the application
+///     last stopped.
+/// </summary>
+/// <param name="store">Store to open.</param>
+/// <param name="fd">The mutable file, from Storage_OpenMutableFile. This is closed by
+/// <see cref="TelemetryStore_Close" />.</param>
+/// <param name="offset">Offset of the ring in the mutable file.</param>
+/// <param name="size">Size of the ring in bytes, which is rounded down to a whole number of
+/// records. It must hold at least two records.</param>
+/// <returns>0 on success, or -1 on failure, in which case the file is closed</returns>
+int TelemetryStore_Open(TelemetryStore *store, int fd, off_t offset, size_t size);
+
+/// <summary>
+///     Appends a reading to the store. If the store is full, the oldest reading is
+///     overwritten.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="keyId">Identifies the key of the reading.</param>
+/// <param name="value">The value of the reading.</param>
+/// <param name="time">When the reading was taken.</param>
+/// <returns>0 on success, or -1 if the reading could not be written</returns>
+int TelemetryStore_Append(TelemetryStore *store, uint8_t keyId, float value, time_t time);
+
+/// <summary>
+///     Reads the oldest readings which have not been delivered, without removing them.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="records">Receives the readings, oldest first.</param>
+/// <param name="maxRecords">The number of elements in records.</param>
+/// <returns>The number of readings which were read, or -1 on failure</returns>
+ssize_t TelemetryStore_Peek(TelemetryStore *store, TelemetryStoreRecord *records,
+                            size_t maxRecords);
+
+/// <summary>
+///     Records that readings were delivered, so that they are not returned again, by appending
+///     a marker record.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="sequence">Sequence number of the last reading which was delivered, from
+/// <see cref="TelemetryStore_Peek" />.</param>
+/// <returns>0 on success, or -1 if the marker could not be written</returns>
+int TelemetryStore_MarkDelivered(TelemetryStore *store, uint32_t sequence);
+
+/// <summary>
+///     Closes the mutable file. It is safe to call this function on a store which has been
+///     zero-initialized, or whose opening failed.
+/// </summary>
+/// <param name="store">The store.</param>
+void TelemetryStore_Close(TelemetryStore *store);
@@ -0,0 +1,169 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "timing.h"
+
+#define NS_PER_SECOND 1000000000LL
+#define SECONDS_PER_DAY 86400
+
+static int64_t TimespecToNs(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * NS_PER_SECOND + ts->tv_nsec;
+}
+
+/// <summary>
+///     Reads the wall clock and the monotonic clock, one straight after the other.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int ReadClocks(int64_t *wallClockNs, uint64_t *monotonicNs)
+{
+    struct timespec realtime;
+    if (clock_gettime(CLOCK_REALTIME, &realtime) == -1) {
+        Log_Debug("ERROR: clock_gettime failed with error code: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+    *monotonicNs = Timing_GetMonotonicNs();
+    *wallClockNs = TimespecToNs(&realtime);
+    return 0;
+}
+
+/// <summary>
+///     Writes a number as a fixed count of decimal digits, with leading zeros.
+/// </summary>
+static char *WriteDigits(char *out, uint32_t value, int count)
+{
+    for (int i = count - 1; i >= 0; --i) {
+        out[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return out + count;
+}
+
+/// <summary>
+///     Converts a count of days since 1970-01-01 to a date in the proleptic Gregorian
+///     calendar, with the algorithm from http://howardhinnant.github.io/date_algorithms.html.
+/// </summary>
+static void DaysToDate(int64_t days, int64_t *year, uint32_t *month, uint32_t *day)
+{
+    // Count from 0000-03-01, so that the leap day is the last day of the year, in eras of 400
+    // years, which each have the same number of days.
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    uint32_t dayOfEra = (uint32_t)(days - era * 146097);
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t monthFromMarch = (5 * dayOfYear + 2) / 153;
+    *day = dayOfYear - (153 * monthFromMarch + 2) / 5 + 1;
+    *month = monthFromMarch < 10 ? monthFromMarch + 3 : monthFromMarch - 9;
+    *year = (int64_t)yearOfEra + era * 400 + (*month <= 2 ? 1 : 0);
+}
+
+uint64_t Timing_GetMonotonicNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)TimespecToNs(&now);
+}
+
+int Timing_SyncWallClock(TimingWallClock *clock, TimingClockSource source)
+{
+    int64_t wallClockNs;
+    uint64_t monotonicNs;
+    if (ReadClocks(&wallClockNs, &monotonicNs) != 0) {
+        return -1;
+    }
+    clock->offsetNs = wallClockNs - (int64_t)monotonicNs;
+    clock->syncedAtNs = monotonicNs;
+    clock->source = source;
+    return 0;
+}
+
+bool Timing_CheckWallClock(TimingWallClock *clock, int64_t toleranceNs)
+{
+    int64_t wallClockNs;
+    uint64_t monotonicNs;
+    if (ReadClocks(&wallClockNs, &monotonicNs) != 0) {
+        return false;
+    }
+    int64_t drift = wallClockNs - Timing_ToWallClockNs(clock, monotonicNs);
+    if (drift >= -toleranceNs && drift <= toleranceNs) {
+        return false;
+    }
+    clock->offsetNs = wallClockNs - (int64_t)monotonicNs;
+    clock->syncedAtNs = monotonicNs;
+    ++clock->steps;
+    return true;
+}
+
+int64_t Timing_ToWallClockNs(const TimingWallClock *clock, uint64_t monotonicNs)
+{
+    return (int64_t)monotonicNs + clock->offsetNs;
+}
+
+size_t Timing_FormatIso8601(char *buffer, size_t size, int64_t wallClockNs,
+                            int32_t utcOffsetSeconds)
+{
+    // "YYYY-MM-DDThh:mm:ss.sss" followed by "Z" or "+hh:mm"; years outside 0 to 9999 are not
+    // written correctly, as ISO 8601 needs an agreed number of extra digits for them.
+    size_t length = (utcOffsetSeconds == 0) ? 24 : TIMING_ISO8601_MAX_LENGTH;
+    if (size < length + 1) {
+        if (size > 0) {
+            buffer[0] = '\0';
+        }
+        return 0;
+    }
+
+    // Round towards minus infinity, so that the times before 1970 are correct too.
+    int64_t seconds = wallClockNs / NS_PER_SECOND;
+    int64_t nanoseconds = wallClockNs % NS_PER_SECOND;
+    if (nanoseconds < 0) {
+        nanoseconds += NS_PER_SECOND;
+        --seconds;
+    }
+    seconds += utcOffsetSeconds;
+    int64_t days = seconds / SECONDS_PER_DAY;
+    int64_t secondOfDay = seconds % SECONDS_PER_DAY;
+    if (secondOfDay < 0) {
+        secondOfDay += SECONDS_PER_DAY;
+        --days;
+    }
+
+    int64_t year;
+    uint32_t month, day;
+    DaysToDate(days, &year, &month, &day);
+
+    char *out = buffer;
+    out = WriteDigits(out, (uint32_t)year, 4);
+    *out++ = '-';
+    out = WriteDigits(out, month, 2);
+    *out++ = '-';
+    out = WriteDigits(out, day, 2);
+    *out++ = 'T';
+    out = WriteDigits(out, (uint32_t)(secondOfDay / 3600), 2);
+    *out++ = ':';
+    out = WriteDigits(out, (uint32_t)(secondOfDay / 60 % 60), 2);
+    *out++ = ':';
+    out = WriteDigits(out, (uint32_t)(secondOfDay % 60), 2);
+    *out++ = '.';
+    out = WriteDigits(out, (uint32_t)(nanoseconds / 1000000), 3);
+    if (utcOffsetSeconds == 0) {
+        *out++ = 'Z';
+    } else {
+        uint32_t offsetMinutes = (uint32_t)(utcOffsetSeconds < 0 ? -(int64_t)utcOffsetSeconds
+                                                                 : utcOffsetSeconds) /
+                                 60;
+        *out++ = utcOffsetSeconds < 0 ? '-' : '+';
+        out = WriteDigits(out, offsetMinutes / 60, 2);
+        *out++ = ':';
+        out = WriteDigits(out, offsetMinutes % 60, 2);
+    }
+    *out = '\0';
+    return length;
+}
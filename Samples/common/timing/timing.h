@@ -0,0 +1,94 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>Length of a timestamp which is formatted by <see cref="Timing_FormatIso8601" />
+/// with a UTC offset, such as "2019-10-01T12:34:56.789-08:00", not including the null
+/// terminator. A UTC timestamp ends with "Z" instead, and is five characters shorter.</summary>
+#define TIMING_ISO8601_MAX_LENGTH 29
+
+/// <summary>
+///     What the wall clock was last set from.
+/// </summary>
+typedef enum {
+    /// <summary>The wall clock has not been set since the device started, so it holds the
+    /// time at which the hardware RTC was first powered on.</summary>
+    TimingClockSource_None,
+    /// <summary>The wall clock was restored from the hardware RTC.</summary>
+    TimingClockSource_Rtc,
+    /// <summary>The NTP time-sync service is enabled, and may set the wall clock.</summary>
+    TimingClockSource_Ntp,
+    /// <summary>The application set the wall clock itself.</summary>
+    TimingClockSource_Manual
+} TimingClockSource;
+
+/// <summary>
+/// <para>Maps the monotonic clock to the wall clock, so that a timestamp which is taken with
+/// <see cref="Timing_GetMonotonicNs" /> can be shown as a time of day, and so that the wall
+/// clock can be read without a second clock_gettime call.</para>
+/// <para>The mapping is made by <see cref="Timing_SyncWallClock" />. It is only correct until
+/// the wall clock is set again, by NTP or by the application, which
+/// <see cref="Timing_CheckWallClock" /> detects.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Wall clock time minus monotonic time, in nanoseconds.</summary>
+    int64_t offsetNs;
+    /// <summary>Monotonic time at which the mapping was made, or 0 if it has not been.</summary>
+    uint64_t syncedAtNs;
+    /// <summary>What the wall clock was last set from.</summary>
+    TimingClockSource source;
+    /// <summary>Number of times that the wall clock was found to have been set since the
+    /// mapping was made.</summary>
+    uint32_t steps;
+} TimingWallClock;
+
+/// <summary>
+///     Reads the monotonic clock, which counts from when the device started and is not
+///     changed when the wall clock is set.
+/// </summary>
+/// <returns>The monotonic time in nanoseconds</returns>
+uint64_t Timing_GetMonotonicNs(void);
+
+/// <summary>
+///     Maps the monotonic clock to the current wall clock.
+/// </summary>
+/// <param name="clock">The mapping to update.</param>
+/// <param name="source">What the wall clock was last set from.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int Timing_SyncWallClock(TimingWallClock *clock, TimingClockSource source);
+
+/// <summary>
+///     Checks whether the wall clock has been set since the mapping was made, by more than a
+///     tolerance, and if so, maps it again and counts the step.
+/// </summary>
+/// <param name="clock">The mapping, which has been made.</param>
+/// <param name="toleranceNs">Largest difference which is not counted as a step.</param>
+/// <returns>true if the wall clock had been set, or false if it had not, or it could not be
+/// read</returns>
+bool Timing_CheckWallClock(TimingWallClock *clock, int64_t toleranceNs);
+
+/// <summary>
+///     Converts a monotonic timestamp to the wall clock, using the mapping.
+/// </summary>
+/// <param name="clock">The mapping, which has been made.</param>
+/// <param name="monotonicNs">A timestamp from <see cref="Timing_GetMonotonicNs" />.</param>
+/// <returns>Nanoseconds since 1970-01-01T00:00:00Z</returns>
+int64_t Timing_ToWallClockNs(const TimingWallClock *clock, uint64_t monotonicNs);
+
+/// <summary>
+///     Formats a wall clock time as ISO 8601, with milliseconds, such as
+///     "2019-10-01T20:34:56.789Z", without gmtime or asctime.
+/// </summary>
+/// <param name="buffer">Receives the null-terminated timestamp.</param>
+/// <param name="size">Size of buffer in bytes, which should be at least
+/// TIMING_ISO8601_MAX_LENGTH + 1.</param>
+/// <param name="wallClockNs">Nanoseconds since 1970-01-01T00:00:00Z.</param>
+/// <param name="utcOffsetSeconds">Offset of the time zone from UTC, which is added to the time
+/// and is written as "+hh:mm" or "-hh:mm"; 0 writes "Z".</param>
+/// <returns>The length of the timestamp, or 0 if buffer is too small</returns>
+size_t Timing_FormatIso8601(char *buffer, size_t size, int64_t wallClockNs,
+                            int32_t utcOffsetSeconds);
@@ -0,0 +1,278 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "transfer_metrics.h"
+
+// Upper bound of each histogram bucket but the last, in microseconds.
+static const uint32_t bucketLimits[TRANSFER_METRICS_BUCKETS - 1] = {
+    10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000};
+
+// Names of the phases in the log and in the JSON.
+static const char *const phaseNames[TransferPhase_Count] = {"dns", "connect", "tls", "server",
+                                                            "total"};
+
+static const char otherHostName[] = "(other)";
+
+/// <summary>
+///     Converts a cURL time in seconds to microseconds.
+/// </summary>
+static uint32_t ToMicroseconds(double seconds)
+{
+    if (seconds <= 0) {
+        return 0;
+    }
+    double microseconds = seconds * 1000000.0;
+    return (microseconds >= (double)UINT32_MAX) ? UINT32_MAX : (uint32_t)microseconds;
+}
+
+/// <summary>
+///     Gets the difference between two of a transfer's cURL times, which are both measured from
+///     the start of the transfer.
+/// </summary>
+static uint32_t PhaseMicroseconds(double endSeconds, double startSeconds)
+{
+    return (endSeconds > startSeconds) ? ToMicroseconds(endSeconds - startSeconds) : 0;
+}
+
+/// <summary>
+///     Copies the host name from a URL, such as "example.com" from
+///     "https://example.com:443/index.html".
+/// </summary>
+static void GetHostName(const char *url, char *host, size_t hostSize)
+{
+    const char *start = strstr(url, "://");
+    start = (start != NULL) ? start + 3 : url;
+    size_t length = strcspn(start, ":/?#");
+    if (length >= hostSize) {
+        length = hostSize - 1;
+    }
+    memcpy(host, start, length);
+    host[length] = '\0';
+}
+
+/// <summary>
+///     Finds the metrics of a host, and adds them if they are not there yet. Once the table is
+///     full, the last entry collects all further hosts.
+/// </summary>
+static TransferHostMetrics *FindHost(TransferMetrics *metrics, const char *host)
+{
+    for (size_t i = 0; i < metrics->hostCount; i++) {
+        if (strcmp(metrics->hosts[i].host, host) == 0) {
+            return &metrics->hosts[i];
+        }
+    }
+
+    TransferHostMetrics *hostMetrics;
+    if (metrics->hostCount < TRANSFER_METRICS_MAX_HOSTS - 1) {
+        hostMetrics = &metrics->hosts[metrics->hostCount++];
+        strncpy(hostMetrics->host, host, sizeof(hostMetrics->host) - 1);
+    } else {
+        hostMetrics = &metrics->hosts[TRANSFER_METRICS_MAX_HOSTS - 1];
+        if (metrics->hostCount < TRANSFER_METRICS_MAX_HOSTS) {
+            metrics->hostCount = TRANSFER_METRICS_MAX_HOSTS;
+            strcpy(hostMetrics->host, otherHostName);
+        }
+    }
+    return hostMetrics;
+}
+
+/// <summary>
+///     Adds a duration to a histogram.
+/// </summary>
+static void AddToHistogram(TransferHistogram *histogram, uint32_t microseconds)
+{
+    size_t bucket = 0;
+    while (bucket < TRANSFER_METRICS_BUCKETS - 1 && microseconds > bucketLimits[bucket]) {
+        ++bucket;
+    }
+    ++histogram->buckets[bucket];
+
+    if (histogram->count == 0 || microseconds < histogram->minMicroseconds) {
+        histogram->minMicroseconds = microseconds;
+    }
+    if (microseconds > histogram->maxMicroseconds) {
+        histogram->maxMicroseconds = microseconds;
+    }
+    histogram->sumMicroseconds += microseconds;
+    ++histogram->count;
+}
+
+/// <summary>
+///     Gets the average duration in a histogram, in microseconds.
+/// </summary>
+static uint32_t AverageMicroseconds(const TransferHistogram *histogram)
+{
+    return (histogram->count != 0) ? (uint32_t)(histogram->sumMicroseconds / histogram->count) : 0;
+}
+
+/// <summary>
+///     Gets the average download speed of a host, in bytes per second.
+/// </summary>
+static uint64_t AverageBytesPerSecond(const TransferHostMetrics *hostMetrics)
+{
+    if (hostMetrics->totalMicroseconds == 0) {
+        return 0;
+    }
+    return hostMetrics->bytesDownloaded * 1000000 / hostMetrics->totalMicroseconds;
+}
+
+int TransferMetrics_Measure(CURL *easyHandle, TransferTiming *timing)
+{
+    double nameLookup = 0;
+    double connect = 0;
+    double appConnect = 0;
+    double preTransfer = 0;
+    double startTransfer = 0;
+    double total = 0;
+    double sizeDownload = 0;
+    double speedDownload = 0;
+
+    memset(timing, 0, sizeof(*timing));
+    if (curl_easy_getinfo(easyHandle, CURLINFO_NAMELOOKUP_TIME, &nameLookup) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_CONNECT_TIME, &connect) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_APPCONNECT_TIME, &appConnect) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_PRETRANSFER_TIME, &preTransfer) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_STARTTRANSFER_TIME, &startTransfer) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_TOTAL_TIME, &total) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_SIZE_DOWNLOAD, &sizeDownload) != CURLE_OK ||
+        curl_easy_getinfo(easyHandle, CURLINFO_SPEED_DOWNLOAD, &speedDownload) != CURLE_OK) {
+        return -1;
+    }
+
+    // cURL measures each time from the start of the transfer. A reused connection has no name
+    // lookup, connect or handshake, so those times stay at 0, and an HTTP transfer has no
+    // handshake, so its APPCONNECT time is 0.
+    timing->phaseMicroseconds[TransferPhase_NameLookup] = ToMicroseconds(nameLookup);
+    timing->phaseMicroseconds[TransferPhase_Connect] = PhaseMicroseconds(connect, nameLookup);
+    timing->phaseMicroseconds[TransferPhase_TlsHandshake] =
+        (appConnect > 0) ? PhaseMicroseconds(appConnect, connect) : 0;
+    timing->phaseMicroseconds[TransferPhase_ServerResponse] =
+        PhaseMicroseconds(startTransfer, preTransfer);
+    timing->phaseMicroseconds[TransferPhase_Total] = ToMicroseconds(total);
+    timing->bytesDownloaded = (sizeDownload > 0) ? (uint64_t)sizeDownload : 0;
+    timing->bytesPerSecond =
+        ((speedDownload > 0) && (speedDownload < (double)UINT32_MAX)) ? (uint32_t)speedDownload : 0;
+    return 0;
+}
+
+void TransferMetrics_Reset(TransferMetrics *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+void TransferMetrics_Record(TransferMetrics *metrics, const char *url,
+                            const TransferTiming *timing, bool succeeded)
+{
+    char host[TRANSFER_METRICS_MAX_HOST_LENGTH + 1];
+    GetHostName(url, host, sizeof(host));
+    TransferHostMetrics *hostMetrics = FindHost(metrics, host);
+
+    ++hostMetrics->transfers;
+    if (!succeeded) {
+        ++hostMetrics->failures;
+    }
+    hostMetrics->bytesDownloaded += timing->bytesDownloaded;
+    hostMetrics->totalMicroseconds += timing->phaseMicroseconds[TransferPhase_Total];
+    for (size_t i = 0; i < TransferPhase_Count; i++) {
+        AddToHistogram(&hostMetrics->phases[i], timing->phaseMicroseconds[i]);
+    }
+}
+
+void TransferMetrics_LogTiming(const TransferTiming *timing)
+{
+    const uint32_t *phases = timing->phaseMicroseconds;
+    Log_Debug("INFO: Timing (ms): dns %.1f, connect %.1f, tls %.1f, server %.1f, total %.1f; "
+              "%llu bytes at %lu bytes/s.\n",
+              phases[TransferPhase_NameLookup] / 1000.0, phases[TransferPhase_Connect] / 1000.0,
+              phases[TransferPhase_TlsHandshake] / 1000.0,
+              phases[TransferPhase_ServerResponse] / 1000.0, phases[TransferPhase_Total] / 1000.0,
+              (unsigned long long)timing->bytesDownloaded, (unsigned long)timing->bytesPerSecond);
+}
+
+void TransferMetrics_Log(const TransferMetrics *metrics)
+{
+    for (size_t i = 0; i < metrics->hostCount; i++) {
+        const TransferHostMetrics *hostMetrics = &metrics->hosts[i];
+        Log_Debug("INFO: %s: %lu transfer(s), %lu failed, %llu bytes at %llu bytes/s.\n",
+                  hostMetrics->host, (unsigned long)hostMetrics->transfers,
+                  (unsigned long)hostMetrics->failures,
+                  (unsigned long long)hostMetrics->bytesDownloaded,
+                  (unsigned long long)AverageBytesPerSecond(hostMetrics));
+
+        for (size_t phase = 0; phase < TransferPhase_Count; phase++) {
+            const TransferHistogram *histogram = &hostMetrics->phases[phase];
+            Log_Debug("  %-7s min %.1f avg %.1f max %.1f ms, buckets", phaseNames[phase],
+                      histogram->minMicroseconds / 1000.0, AverageMicroseconds(histogram) / 1000.0,
+                      histogram->maxMicroseconds / 1000.0);
+            for (size_t bucket = 0; bucket < TRANSFER_METRICS_BUCKETS; bucket++) {
+                Log_Debug(" %lu", (unsigned long)histogram->buckets[bucket]);
+            }
+            Log_Debug("\n");
+        }
+    }
+}
+
+/// <summary>
+///     Appends formatted text to a buffer.
+/// </summary>
+/// <param name="length">The length of the text in the buffer, which is updated. It is set to
+/// bufferSize once the text does not fit.</param>
+static void Append(char *buffer, size_t bufferSize, size_t *length, const char *format, ...)
+{
+    if (*length >= bufferSize) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int result = vsnprintf(buffer + *length, bufferSize - *length, format, args);
+    va_end(args);
+
+    if (result < 0 || (size_t)result >= bufferSize - *length) {
+        *length = bufferSize;
+    } else {
+        *length += (size_t)result;
+    }
+}
+
+int TransferMetrics_FormatJson(const TransferMetrics *metrics, char *buffer, size_t bufferSize)
+{
+    size_t length = 0;
+    Append(buffer, bufferSize, &length, "{\"hosts\":[");
+    for (size_t i = 0; i < metrics->hostCount; i++) {
+        const TransferHostMetrics *hostMetrics = &metrics->hosts[i];
+        // Host names do not contain characters which need escaping in JSON.
+        Append(buffer, bufferSize, &length,
+               "%s{\"host\":\"%s\",\"transfers\":%lu,\"failures\":%lu,\"bytes\":%llu,"
+               "\"bytesPerSecond\":%llu",
+               (i == 0) ? "" : ",", hostMetrics->host, (unsigned long)hostMetrics->transfers,
+               (unsigned long)hostMetrics->failures,
+               (unsigned long long)hostMetrics->bytesDownloaded,
+               (unsigned long long)AverageBytesPerSecond(hostMetrics));
+
+        for (size_t phase = 0; phase < TransferPhase_Count; phase++) {
+            const TransferHistogram *histogram = &hostMetrics->phases[phase];
+            Append(buffer, bufferSize, &length,
+                   ",\"%s\":{\"count\":%lu,\"minMs\":%.1f,\"avgMs\":%.1f,\"maxMs\":%.1f,"
+                   "\"buckets\":[",
+                   phaseNames[phase], (unsigned long)histogram->count,
+                   histogram->minMicroseconds / 1000.0, AverageMicroseconds(histogram) / 1000.0,
+                   histogram->maxMicroseconds / 1000.0);
+            for (size_t bucket = 0; bucket < TRANSFER_METRICS_BUCKETS; bucket++) {
+                Append(buffer, bufferSize, &length, "%s%lu", (bucket == 0) ? "" : ",",
+                       (unsigned long)histogram->buckets[bucket]);
+            }
+            Append(buffer, bufferSize, &length, "]}");
+        }
+        Append(buffer, bufferSize, &length, "}");
+    }
+    Append(buffer, bufferSize, &length, "]}");
+
+    return (length < bufferSize) ? (int)length : -1;
+}
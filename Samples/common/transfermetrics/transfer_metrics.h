@@ -0,0 +1,139 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <curl/curl.h>
+
+/// <summary>
+///     Number of hosts which have their own metrics. Transfers to further hosts are counted
+///     together under the host name "(other)".
+/// </summary>
+#define TRANSFER_METRICS_MAX_HOSTS 4
+
+/// <summary>Longest host name which is kept, not including the null terminator.</summary>
+#define TRANSFER_METRICS_MAX_HOST_LENGTH 63
+
+/// <summary>
+///     Number of buckets in each histogram. The buckets hold durations of up to 10, 25, 50, 100,
+///     250, 500, 1000, 2500 and 5000 milliseconds, and the last one holds longer durations.
+/// </summary>
+#define TRANSFER_METRICS_BUCKETS 10
+
+/// <summary>
+///     The phases which a transfer's time is divided into, so that slow DNS, slow TLS and a
+///     slow server can be told apart.
+/// </summary>
+typedef enum {
+    /// <summary>Resolving the host name.</summary>
+    TransferPhase_NameLookup,
+    /// <summary>Opening the TCP connection.</summary>
+    TransferPhase_Connect,
+    /// <summary>The TLS handshake. This is 0 for HTTP, and for a reused connection.</summary>
+    TransferPhase_TlsHandshake,
+    /// <summary>From sending the request until the first byte of the response arrives, which is
+    /// mostly the server's processing time.</summary>
+    TransferPhase_ServerResponse,
+    /// <summary>The whole transfer, including receiving the content.</summary>
+    TransferPhase_Total,
+    TransferPhase_Count
+} TransferPhase;
+
+/// <summary>
+///     The timing of one transfer, which is taken from its cURL easy handle.
+/// </summary>
+typedef struct {
+    /// <summary>Duration of each phase, in microseconds.</summary>
+    uint32_t phaseMicroseconds[TransferPhase_Count];
+    /// <summary>Number of bytes of content which were downloaded.</summary>
+    uint64_t bytesDownloaded;
+    /// <summary>Average download speed, in bytes per second.</summary>
+    uint32_t bytesPerSecond;
+} TransferTiming;
+
+/// <summary>
+///     Distribution of the durations of one phase.
+/// </summary>
+typedef struct {
+    /// <summary>Number of durations in each bucket.</summary>
+    uint32_t buckets[TRANSFER_METRICS_BUCKETS];
+    uint32_t count;
+    uint32_t minMicroseconds;
+    uint32_t maxMicroseconds;
+    uint64_t sumMicroseconds;
+} TransferHistogram;
+
+/// <summary>
+///     The metrics of the transfers to one host.
+/// </summary>
+typedef struct {
+    char host[TRANSFER_METRICS_MAX_HOST_LENGTH + 1];
+    /// <summary>Number of transfers, and how many of those failed.</summary>
+    uint32_t transfers;
+    uint32_t failures;
+    uint64_t bytesDownloaded;
+    /// <summary>Sum of the total times of the transfers, from which the average download speed
+    /// is found.</summary>
+    uint64_t totalMicroseconds;
+    TransferHistogram phases[TransferPhase_Count];
+} TransferHostMetrics;
+
+/// <summary>
+///     The metrics of all the transfers since the metrics were reset. This is a plain structure,
+///     so a snapshot is taken by copying it.
+/// </summary>
+typedef struct {
+    size_t hostCount;
+    TransferHostMetrics hosts[TRANSFER_METRICS_MAX_HOSTS];
+} TransferMetrics;
+
+/// <summary>
+///     Reads the timing of a completed transfer from its easy handle.
+/// </summary>
+/// <param name="easyHandle">The easy handle of the transfer.</param>
+/// <param name="timing">Receives the timing.</param>
+/// <returns>0 on success, or -1 if cURL could not supply the timing</returns>
+int TransferMetrics_Measure(CURL *easyHandle, TransferTiming *timing);
+
+/// <summary>
+///     Discards all the metrics.
+/// </summary>
+/// <param name="metrics">The metrics.</param>
+void TransferMetrics_Reset(TransferMetrics *metrics);
+
+/// <summary>
+///     Adds a transfer to the metrics of its host.
+/// </summary>
+/// <param name="metrics">The metrics.</param>
+/// <param name="url">The URL of the transfer, whose host name selects the host's
+/// metrics.</param>
+/// <param name="timing">The timing of the transfer.</param>
+/// <param name="succeeded">Whether the transfer succeeded.</param>
+void TransferMetrics_Record(TransferMetrics *metrics, const char *url,
+                            const TransferTiming *timing, bool succeeded);
+
+/// <summary>
+///     Logs the timing of one transfer on a single line.
+/// </summary>
+/// <param name="timing">The timing.</param>
+void TransferMetrics_LogTiming(const TransferTiming *timing);
+
+/// <summary>
+///     Logs the metrics of each host.
+/// </summary>
+/// <param name="metrics">The metrics.</param>
+void TransferMetrics_Log(const TransferMetrics *metrics);
+
+/// <summary>
+///     Formats the metrics as a JSON object, which can be sent as IoT telemetry. For each host,
+///     it holds the transfer counts and the average speed, and for each phase the count, the
+///     minimum, average and maximum in milliseconds, and the bucket counts.
+/// </summary>
+/// <param name="metrics">The metrics.</param>
+/// <param name="buffer">Receives the JSON, followed by a null terminator.</param>
+/// <param name="bufferSize">The size of the buffer.</param>
+/// <returns>The length of the JSON, or -1 if it does not fit in the buffer</returns>
+int TransferMetrics_FormatJson(const TransferMetrics *metrics, char *buffer, size_t bufferSize);
@@ -0,0 +1,241 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "uart_stream.h"
+
+static void UartStreamEventHandler(EventData *eventData);
+static void ReportError(UartStream *stream, const char *operation);
+static void ParseFrames(UartStream *stream);
+static size_t ParseDelimitedFrame(UartStream *stream, size_t start);
+static size_t ParseLengthPrefixedFrame(UartStream *stream, size_t start);
+static uint32_t ReadLengthField(const UartStream *stream, const uint8_t *field);
+
+int UartStream_Open(UartStream *stream, int epollFd, int uartFd, const UartStreamConfig *config)
+{
+    size_t headerSize =
+        (config->framing == UartStreamFraming_LengthPrefixed) ? config->lengthFieldSize : 0;
+
+    bool validFraming = config->framing == UartStreamFraming_Delimiter ||
+                        (config->framing == UartStreamFraming_LengthPrefixed &&
+                         (headerSize == 1 || headerSize == 2 || headerSize == 4));
+    if (!validFraming || config->buffer == NULL || config->bufferSize <= headerSize ||
+        config->frameHandler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(stream, 0, sizeof(*stream));
+    stream->config = *config;
+
+    // A frame must fit in the buffer with its length field, or with the delimiter which shows
+    // that it is complete.
+    size_t largestFrame = config->bufferSize - (headerSize != 0 ? headerSize : 1);
+    if (stream->config.maxFrameSize == 0 || stream->config.maxFrameSize > largestFrame) {
+        stream->config.maxFrameSize = largestFrame;
+    }
+
+    stream->eventData.eventHandler = &UartStreamEventHandler;
+    // Service the UART ahead of other events so its receive FIFO does not overflow.
+    stream->eventData.priority = EventPriority_High;
+    IovecWriter_Init(&stream->writer, epollFd, uartFd, &stream->eventData, EPOLLIN);
+    return RegisterPersistentEventHandlerToEpoll(epollFd, uartFd, &stream->eventData, EPOLLIN);
+}
+
+void UartStream_Close(UartStream *stream, int epollFd)
+{
+    UnregisterPersistentEventHandlerFromEpoll(epollFd, &stream->eventData);
+    IovecWriter_Cancel(&stream->writer);
+}
+
+int UartStream_Send(UartStream *stream, const struct iovec *buffers, size_t bufferCount)
+{
+    return IovecWriter_Start(&stream->writer, buffers, bufferCount);
+}
+
+bool UartStream_IsSending(const UartStream *stream)
+{
+    return IovecWriter_IsBusy(&stream->writer);
+}
+
+void UartStream_GetStats(const UartStream *stream, UartStreamStats *stats)
+{
+    *stats = stream->stats;
+}
+
+static void UartStreamEventHandler(EventData *eventData)
+{
+    UartStream *stream = (UartStream *)eventData;
+
+    // Send more of the pending data if the UART has become writable.
+    if (IovecWriter_IsBusy(&stream->writer) &&
+        (eventData->readyEvents & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        if (IovecWriter_Continue(&stream->writer) == -1) {
+            ReportError(stream, "write");
+            IovecWriter_Cancel(&stream->writer);
+            return;
+        }
+    }
+
+    // The event is edge-triggered, so read until the UART has no more data.
+    for (;;) {
+        ssize_t bytesRead = read(stream->eventData.fd, stream->config.buffer + stream->length,
+                                 stream->config.bufferSize - stream->length);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+
+            ReportError(stream, "read");
+            return;
+        }
+
+        if (bytesRead == 0) {
+            return;
+        }
+
+        stream->length += (size_t)bytesRead;
+        stream->stats.bytesReceived += (uint64_t)bytesRead;
+        if ((size_t)bytesRead > stream->stats.maxReadSize) {
+            stream->stats.maxReadSize = (size_t)bytesRead;
+        }
+
+        ParseFrames(stream);
+    }
+}
+
+static void ReportError(UartStream *stream, const char *operation)
+{
+    int error = errno;
+    Log_Debug("ERROR: Could not %s UART: %s (%d).\n", operation, strerror(error), error);
+    if (stream->config.errorHandler != NULL) {
+        stream->config.errorHandler(stream, error, stream->config.context);
+    }
+}
+
+// Delivers every complete frame in the buffer, then moves the rest of the data to the start of
+// the buffer. Afterwards there is always some free space, because a frame which could fill the
+// buffer is oversized and is discarded.
+static void ParseFrames(UartStream *stream)
+{
+    size_t start = 0;
+    for (;;) {
+        size_t next = (stream->config.framing == UartStreamFraming_Delimiter)
+                          ? ParseDelimitedFrame(stream, start)
+                          : ParseLengthPrefixedFrame(stream, start);
+        if (next == start) {
+            break;
+        }
+        start = next;
+    }
+
+    if (start != 0) {
+        memmove(stream->config.buffer, stream->config.buffer + start, stream->length - start);
+        stream->length -= start;
+        stream->scanned = (stream->scanned > start) ? stream->scanned - start : 0;
+    }
+}
+
+// Parses one frame which starts at the supplied offset, and returns the offset of the data after
+// it. Returns the supplied offset if more data is needed.
+static size_t ParseDelimitedFrame(UartStream *stream, size_t start)
+{
+    uint8_t *buffer = stream->config.buffer;
+
+    // Only search the bytes which have not already been searched.
+    size_t searchFrom = (stream->scanned > start) ? stream->scanned : start;
+    const uint8_t *delimiter =
+        memchr(buffer + searchFrom, stream->config.delimiter, stream->length - searchFrom);
+
+    if (delimiter == NULL) {
+        stream->scanned = stream->length;
+
+        // Discard an incomplete frame which is already too long, and the rest of it as it
+        // arrives.
+        size_t frameLength = stream->length - start;
+        if (frameLength > stream->config.maxFrameSize) {
+            if (!stream->discarding) {
+                ++stream->stats.oversizedFrames;
+                stream->discarding = true;
+            }
+            stream->stats.discardedBytes += frameLength;
+            return stream->length;
+        }
+        return start;
+    }
+
+    size_t end = (size_t)(delimiter - buffer);
+    size_t frameLength = end - start;
+
+    if (stream->discarding) {
+        // This is the end of an oversized frame.
+        stream->discarding = false;
+        stream->stats.discardedBytes += frameLength + 1;
+    } else if (frameLength > stream->config.maxFrameSize) {
+        ++stream->stats.oversizedFrames;
+        stream->stats.discardedBytes += frameLength + 1;
+    } else if (frameLength != 0) {
+        ++stream->stats.framesReceived;
+        stream->config.frameHandler(stream, buffer + start, frameLength, stream->config.context);
+    }
+
+    return end + 1;
+}
+
+// Parses one frame which starts at the supplied offset, and returns the offset of the data after
+// it. Returns the supplied offset if more data is needed.
+static size_t ParseLengthPrefixedFrame(UartStream *stream, size_t start)
+{
+    size_t available = stream->length - start;
+
+    // Skip the rest of an oversized frame.
+    if (stream->discardRemaining != 0) {
+        size_t discard =
+            (stream->discardRemaining < available) ? stream->discardRemaining : available;
+        stream->discardRemaining -= discard;
+        stream->stats.discardedBytes += discard;
+        return start + discard;
+    }
+
+    size_t headerSize = stream->config.lengthFieldSize;
+    if (available < headerSize) {
+        return start;
+    }
+
+    uint32_t frameLength = ReadLengthField(stream, stream->config.buffer + start);
+    if (frameLength > stream->config.maxFrameSize) {
+        ++stream->stats.oversizedFrames;
+        stream->discardRemaining = frameLength;
+        return start + headerSize;
+    }
+
+    if (available - headerSize < frameLength) {
+        return start;
+    }
+
+    ++stream->stats.framesReceived;
+    stream->config.frameHandler(stream, stream->config.buffer + start + headerSize, frameLength,
+                                stream->config.context);
+    return start + headerSize + frameLength;
+}
+
+static uint32_t ReadLengthField(const UartStream *stream, const uint8_t *field)
+{
+    uint32_t value = 0;
+    size_t size = stream->config.lengthFieldSize;
+
+    for (size_t i = 0; i < size; ++i) {
+        size_t byteIndex = stream->config.lengthFieldBigEndian ? i : size - 1 - i;
+        value = (value << 8) | field[byteIndex];
+    }
+
+    return value;
+}
@@ -0,0 +1,178 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "epoll_timerfd_utilities.h"
+#include "iovec_writer.h"
+
+/// <summary>How a <see cref="UartStream" /> splits the received bytes into frames.</summary>
+typedef enum {
+    /// <summary>Each frame ends with a delimiter byte, such as '\n' for NMEA sentences. The
+    /// delimiter is not included in the frame, and empty frames are skipped.</summary>
+    UartStreamFraming_Delimiter,
+    /// <summary>Each frame starts with a length field, which holds the number of bytes which
+    /// follow it. The length field is not included in the frame.</summary>
+    UartStreamFraming_LengthPrefixed
+} UartStreamFraming;
+
+struct UartStream;
+
+/// <summary>
+///     Function which is called for each complete frame.
+/// </summary>
+/// <param name="stream">The stream which received the frame.</param>
+/// <param name="frame">Start of the frame. This points into the stream's buffer, and is only
+/// valid until the function returns.</param>
+/// <param name="length">Length of the frame in bytes.</param>
+/// <param name="context">The context from the stream's configuration.</param>
+typedef void (*UartStreamFrameHandler)(struct UartStream *stream, const uint8_t *frame,
+                                       size_t length, void *context);
+
+/// <summary>
+///     Function which is called when reading from or writing to the UART fails. The stream
+///     stops reading, and abandons the data which it was sending.
+/// </summary>
+/// <param name="stream">The stream which failed.</param>
+/// <param name="error">The errno value from read or writev.</param>
+/// <param name="context">The context from the stream's configuration.</param>
+typedef void (*UartStreamErrorHandler)(struct UartStream *stream, int error, void *context);
+
+/// <summary>
+///     Settings for <see cref="UartStream_Open" />.
+/// </summary>
+typedef struct {
+    /// <summary>Buffer which holds received bytes until a frame is complete. It must remain
+    /// valid until the stream is closed.</summary>
+    uint8_t *buffer;
+    /// <summary>Size of the buffer in bytes. This must be at least large enough for the longest
+    /// frame, including its length field.</summary>
+    size_t bufferSize;
+    /// <summary>How the bytes are split into frames.</summary>
+    UartStreamFraming framing;
+    /// <summary>Byte which ends each frame, for <see cref="UartStreamFraming_Delimiter" />.
+    /// </summary>
+    uint8_t delimiter;
+    /// <summary>Size of the length field in bytes, for
+    /// <see cref="UartStreamFraming_LengthPrefixed" />: 1, 2 or 4.</summary>
+    uint8_t lengthFieldSize;
+    /// <summary>Whether the length field is big-endian rather than little-endian.</summary>
+    bool lengthFieldBigEndian;
+    /// <summary>Longest frame which is delivered, not including the delimiter or length
+    /// field. Longer frames are discarded and counted in <see cref="UartStreamStats" />. Zero
+    /// selects the largest which fits in the buffer.</summary>
+    size_t maxFrameSize;
+    /// <summary>Function which is called for each complete frame.</summary>
+    UartStreamFrameHandler frameHandler;
+    /// <summary>Optional function which is called if reading from or writing to the UART fails.
+    /// </summary>
+    UartStreamErrorHandler errorHandler;
+    /// <summary>Value which is passed to the handlers.</summary>
+    void *context;
+} UartStreamConfig;
+
+/// <summary>
+///     Counters which show how a <see cref="UartStream" /> is keeping up.
+/// </summary>
+typedef struct {
+    /// <summary>Bytes which were read from the UART.</summary>
+    uint64_t bytesReceived;
+    /// <summary>Frames which were delivered to the frame handler.</summary>
+    uint32_t framesReceived;
+    /// <summary>Frames which were discarded because they were longer than maxFrameSize.
+    /// </summary>
+    uint32_t oversizedFrames;
+    /// <summary>Bytes which were discarded as part of oversized frames.</summary>
+    uint64_t discardedBytes;
+    /// <summary>Largest number of bytes which were read in one call to read.</summary>
+    size_t maxReadSize;
+} UartStreamStats;
+
+/// <summary>
+/// <para>Reads a UART through the event loop, and splits the received bytes into frames. Each
+/// complete frame is passed to a callback, so applications which parse line-based or
+/// length-prefixed protocols, such as NMEA or Modbus, do not need to buffer the data
+/// themselves.</para>
+/// <para>The UART is registered with the epoll instance as an edge-triggered event. Each time
+/// the event occurs, the stream reads into the free end of its buffer until the read fails with
+/// EAGAIN, so that no data is left in the UART's receive FIFO, and delivers every complete frame.
+/// Frames are delivered in place, without being copied. The start of an incomplete frame is then
+/// moved to the start of the buffer.</para>
+/// <para>The stream can also send data on the UART with <see cref="UartStream_Send" />, which
+/// adds EPOLLOUT to the registration only while the UART cannot accept more data.</para>
+/// <para>All members are managed by the UartStream functions and must not be modified by the
+/// caller.</para>
+/// </summary>
+typedef struct UartStream {
+    /// <summary>Event data for the UART. This is the first member, so the event handler can find
+    /// the stream.</summary>
+    EventData eventData;
+    /// <summary>The configuration which the stream was opened with.</summary>
+    UartStreamConfig config;
+    /// <summary>Number of bytes in the buffer.</summary>
+    size_t length;
+    /// <summary>Number of bytes at the start of the buffer which have been searched for a
+    /// delimiter.</summary>
+    size_t scanned;
+    /// <summary>Whether the rest of an oversized delimited frame is being discarded.</summary>
+    bool discarding;
+    /// <summary>Number of bytes of an oversized length-prefixed frame which remain to be
+    /// discarded.</summary>
+    size_t discardRemaining;
+    /// <summary>The counters.</summary>
+    UartStreamStats stats;
+    /// <summary>Sends the data which is passed to <see cref="UartStream_Send" />.</summary>
+    IovecWriter writer;
+} UartStream;
+
+/// <summary>
+///     Starts reading from a UART. The UART must have been opened with UART_Open, which opens it
+///     in non-blocking mode.
+/// </summary>
+/// <param name="stream">The stream to initialize. This must remain valid until
+/// <see cref="UartStream_Close" /> is called.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+/// <param name="uartFd">The UART's file descriptor.</param>
+/// <param name="config">The buffer, framing and handlers. This is copied.</param>
+/// <returns>0 on success, or -1 on failure, with errno set to EINVAL if the configuration is
+/// invalid.</returns>
+int UartStream_Open(UartStream *stream, int epollFd, int uartFd, const UartStreamConfig *config);
+
+/// <summary>
+///     Starts to send a list of buffers on the UART, such as a header and a payload, without
+///     copying them. Data which the UART cannot accept immediately is sent from the event loop
+///     when the UART becomes writable. See <see cref="IovecWriter_Start" />.
+/// </summary>
+/// <param name="stream">The stream.</param>
+/// <param name="buffers">The buffers to send. The data must remain valid until it has been
+/// sent, which <see cref="UartStream_IsSending" /> reports.</param>
+/// <param name="bufferCount">Number of buffers, up to <see cref="IOVEC_WRITER_MAX_BUFFERS" />.
+/// </param>
+/// <returns>1 if all of the data was sent; 0 if the rest will be sent later; or -1 on failure,
+/// with errno set to EBUSY if the stream is still sending earlier data.</returns>
+int UartStream_Send(UartStream *stream, const struct iovec *buffers, size_t bufferCount);
+
+/// <summary>
+///     Reports whether the stream has data which it has not yet sent.
+/// </summary>
+/// <param name="stream">The stream.</param>
+/// <returns>true if the stream is waiting to send data; false if it is idle.</returns>
+bool UartStream_IsSending(const UartStream *stream);
+
+/// <summary>
+///     Stops reading from the UART, and abandons any data which has not been sent. This does not close the UART's file descriptor. Do not call
+///     this function from the frame handler.
+/// </summary>
+/// <param name="stream">The stream to close.</param>
+/// <param name="epollFd">Epoll file descriptor</param>
+void UartStream_Close(UartStream *stream, int epollFd);
+
+/// <summary>
+///     Takes a snapshot of a stream's counters.
+/// </summary>
+/// <param name="stream">Stream to query.</param>
+/// <param name="stats">Receives the counters.</param>
+void UartStream_GetStats(const UartStream *stream, UartStreamStats *stats);
@@ -0,0 +1,86 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "update_policy.h"
+
+#define MINUTES_PER_DAY (24 * 60)
+
+static const char *const loadNames[UpdatePolicyLoad_Count] = {"DFU sessions", "HTTP transfers",
+                                                             "telemetry backlog"};
+
+/// <summary>
+///     Works out how many minutes there are until the maintenance window starts.
+/// </summary>
+/// <returns>0 if the time is inside the window, or if there is none</returns>
+static uint32_t GetMinutesUntilWindow(const UpdatePolicyConfig *config, time_t now)
+{
+    uint32_t start = config->maintenanceWindowStart % MINUTES_PER_DAY;
+    uint32_t end = config->maintenanceWindowEnd % MINUTES_PER_DAY;
+    if (start == end) {
+        return 0;
+    }
+
+    // Count from the start of the window, so that a window which wraps past midnight needs no
+    // special case. The wall clock is UTC, and is never before 1970.
+    uint32_t minute = (uint32_t)((now / 60) % MINUTES_PER_DAY);
+    uint32_t sinceStart = (minute + MINUTES_PER_DAY - start) % MINUTES_PER_DAY;
+    uint32_t length = (end + MINUTES_PER_DAY - start) % MINUTES_PER_DAY;
+    return sinceStart < length ? 0 : MINUTES_PER_DAY - sinceStart;
+}
+
+void UpdatePolicy_Init(UpdatePolicy *policy, const UpdatePolicyConfig *config)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->config = *config;
+}
+
+void UpdatePolicy_SetLoad(UpdatePolicy *policy, UpdatePolicyLoad load, uint32_t value)
+{
+    if (load < UpdatePolicyLoad_Count) {
+        policy->load[load] = value;
+    }
+}
+
+bool UpdatePolicy_IsBusy(const UpdatePolicy *policy)
+{
+    for (int i = 0; i < UpdatePolicyLoad_Count; ++i) {
+        if (policy->load[i] > policy->config.idleThresholds[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t UpdatePolicy_GetDeferralMinutes(UpdatePolicy *policy, uint32_t maxDeferralMinutes,
+                                         time_t now)
+{
+    uint32_t minutes = 0;
+    if (UpdatePolicy_IsBusy(policy)) {
+        minutes = policy->config.busyDeferralMinutes;
+        for (int i = 0; i < UpdatePolicyLoad_Count; ++i) {
+            if (policy->load[i] > policy->config.idleThresholds[i]) {
+                Log_Debug("INFO: Update policy: busy with %u %s.\n", policy->load[i],
+                          loadNames[i]);
+            }
+        }
+        ++policy->busyDeferrals;
+    } else {
+        minutes = GetMinutesUntilWindow(&policy->config, now);
+        if (minutes != 0) {
+            Log_Debug("INFO: Update policy: the maintenance window starts in %u minutes.\n",
+                      minutes);
+            ++policy->windowDeferrals;
+        }
+    }
+
+    // The system applies the update anyway once it has been deferred for as long as it allows,
+    // so a deferral which is capped still moves the update as late as possible.
+    if (minutes > maxDeferralMinutes) {
+        minutes = maxDeferralMinutes;
+    }
+    return minutes;
+}
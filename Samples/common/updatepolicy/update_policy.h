@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/// <summary>
+///     Kinds of work which an update would interrupt.
+/// </summary>
+typedef enum {
+    /// <summary>Firmware updates of an attached device which are in progress.</summary>
+    UpdatePolicyLoad_DfuSessions,
+    /// <summary>HTTP transfers which are in flight.</summary>
+    UpdatePolicyLoad_HttpTransfers,
+    /// <summary>Telemetry messages which are waiting to be sent.</summary>
+    UpdatePolicyLoad_TelemetryBacklog,
+    UpdatePolicyLoad_Count
+} UpdatePolicyLoad;
+
+/// <summary>
+///     Settings of an update policy.
+/// </summary>
+typedef struct {
+    /// <summary>How long to defer an update while the application is busy, in minutes. This is
+    /// short, so that the update is offered again soon after the work ends.</summary>
+    uint32_t busyDeferralMinutes;
+    /// <summary>For each kind of load, the largest value at which the application is still
+    /// idle. This is usually 0, except for a telemetry backlog, which a few messages do not
+    /// make worth deferring for.</summary>
+    uint32_t idleThresholds[UpdatePolicyLoad_Count];
+    /// <summary>Start of the maintenance window, in minutes after midnight UTC.</summary>
+    uint16_t maintenanceWindowStart;
+    /// <summary>End of the maintenance window, in minutes after midnight UTC. The window may
+    /// wrap past midnight. If it is the same as the start, there is no window, and an update
+    /// may be applied whenever the application is idle.</summary>
+    uint16_t maintenanceWindowEnd;
+} UpdatePolicyConfig;
+
+/// <summary>
+/// <para>Works out for how long an update should be deferred, so that it is applied when the
+/// application is idle and inside its maintenance window. The application reports its load
+/// with <see cref="UpdatePolicy_SetLoad" />, and calls
+/// <see cref="UpdatePolicy_GetDeferralMinutes" /> when it is notified of a pending update,
+/// and again when its load changes, to apply a deferred update as soon as it may.</para>
+/// <para>The caller allocates this struct and initializes it with
+/// <see cref="UpdatePolicy_Init" />. The members must not be modified directly.</para>
+/// </summary>
+typedef struct {
+    UpdatePolicyConfig config;
+    uint32_t load[UpdatePolicyLoad_Count];
+    /// <summary>Number of times that an update was deferred, and why.</summary>
+    uint32_t busyDeferrals;
+    uint32_t windowDeferrals;
+} UpdatePolicy;
+
+/// <summary>
+///     Initializes an update policy, with no load.
+/// </summary>
+/// <param name="policy">The policy to initialize.</param>
+/// <param name="config">Settings of the policy, which are copied.</param>
+void UpdatePolicy_Init(UpdatePolicy *policy, const UpdatePolicyConfig *config);
+
+/// <summary>
+///     Sets the current amount of one kind of load.
+/// </summary>
+/// <param name="policy">The policy.</param>
+/// <param name="load">Kind of load.</param>
+/// <param name="value">Amount of load, such as a number of transfers or messages.</param>
+void UpdatePolicy_SetLoad(UpdatePolicy *policy, UpdatePolicyLoad load, uint32_t value);
+
+/// <summary>
+///     Whether any kind of load is above its idle threshold.
+/// </summary>
+/// <param name="policy">The policy.</param>
+/// <returns>true if the application is busy, or false if it is idle</returns>
+bool UpdatePolicy_IsBusy(const UpdatePolicy *policy);
+
+/// <summary>
+///     Works out for how long to defer a pending update. While the application is busy, this
+///     is the busy deferral; otherwise, outside the maintenance window, it is the time until
+///     the window starts. It is never longer than the longest deferral which the system allows.
+/// </summary>
+/// <param name="policy">The policy.</param>
+/// <param name="maxDeferralMinutes">max_deferral_time_in_minutes of the update event.</param>
+/// <param name="now">The current time.</param>
+/// <returns>Number of minutes to defer the update for, or 0 to apply it now</returns>
+uint32_t UpdatePolicy_GetDeferralMinutes(UpdatePolicy *policy, uint32_t maxDeferralMinutes,
+                                         time_t now);
@@ -0,0 +1,231 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#include "wifi_connection_cache.h"
+
+// Version of StoredEntry, so that an entry written in another format is ignored.
+#define STORED_ENTRY_VERSION 1
+
+// Keys are "wifi-" followed by the hash of the network in hex.
+#define KEY_LENGTH 13
+
+// Value of each entry in the store. The SSID is kept as well as the hash in the key, so that a
+// network whose key collides with that of another network is not given its entry.
+typedef struct {
+    uint8_t version;
+    uint8_t security;
+    uint8_t ssidLength;
+    int8_t signalRssi;
+    uint32_t frequencyMHz;
+    uint8_t bssid[WIFICONFIG_BSSID_BUFFER_SIZE];
+    uint8_t ssid[WIFICONFIG_SSID_MAX_LENGTH];
+} StoredEntry;
+
+/// <summary>
+///     Makes the key of a network from the FNV-1a hash of its security type and SSID.
+/// </summary>
+static void MakeKey(const uint8_t *ssid, size_t ssidLength, WifiConfig_Security_Type security,
+                    char key[KEY_LENGTH + 1])
+{
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ (uint8_t)security) * 16777619u;
+    for (size_t i = 0; i < ssidLength; ++i) {
+        hash = (hash ^ ssid[i]) * 16777619u;
+    }
+    snprintf(key, KEY_LENGTH + 1, "wifi-%08" PRIx32, hash);
+}
+
+/// <summary>
+///     Reads the entry of a network, and checks that it is for that network.
+/// </summary>
+/// <returns>0 on success, or -1 if there is none, in which case errno is ENOENT</returns>
+static int ReadEntry(KvStore *store, const uint8_t *ssid, size_t ssidLength,
+                     WifiConfig_Security_Type security, StoredEntry *entry)
+{
+    if (ssidLength > WIFICONFIG_SSID_MAX_LENGTH) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    char key[KEY_LENGTH + 1];
+    MakeKey(ssid, ssidLength, security, key);
+    ssize_t length = KvStore_Get(store, key, entry, sizeof(*entry));
+    if (length != (ssize_t)sizeof(*entry) || entry->version != STORED_ENTRY_VERSION ||
+        entry->security != (uint8_t)security || entry->ssidLength != ssidLength ||
+        memcmp(entry->ssid, ssid, ssidLength) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+int WifiConnectionCache_Record(KvStore *store, const WifiConfig_ConnectedNetwork *network)
+{
+    if (network->ssidLength > WIFICONFIG_SSID_MAX_LENGTH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    StoredEntry entry;
+    if (ReadEntry(store, network->ssid, network->ssidLength, network->security, &entry) == 0 &&
+        memcmp(entry.bssid, network->bssid, sizeof(entry.bssid)) == 0 &&
+        entry.frequencyMHz == network->frequencyMHz &&
+        abs(entry.signalRssi - network->signalRssi) <= WIFI_CONNECTION_CACHE_RSSI_HYSTERESIS) {
+        return 0;
+    }
+
+    // The padding is cleared, so that the same connection always has the same value.
+    memset(&entry, 0, sizeof(entry));
+    entry.version = STORED_ENTRY_VERSION;
+    entry.security = (uint8_t)network->security;
+    entry.ssidLength = network->ssidLength;
+    entry.signalRssi = network->signalRssi;
+    entry.frequencyMHz = network->frequencyMHz;
+    memcpy(entry.bssid, network->bssid, sizeof(entry.bssid));
+    memcpy(entry.ssid, network->ssid, network->ssidLength);
+
+    char key[KEY_LENGTH + 1];
+    MakeKey(network->ssid, network->ssidLength, network->security, key);
+    if (KvStore_Set(store, key, &entry, sizeof(entry)) != 0 || KvStore_Commit(store) != 0) {
+        Log_Debug("ERROR: Could not record the Wi-Fi connection: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+
+    Log_Debug("INFO: Recorded the Wi-Fi connection: %02x:%02x:%02x:%02x:%02x:%02x, %" PRIu32
+              " MHz, %d dB.\n",
+              entry.bssid[0], entry.bssid[1], entry.bssid[2], entry.bssid[3], entry.bssid[4],
+              entry.bssid[5], entry.frequencyMHz, entry.signalRssi);
+    return 0;
+}
+
+int WifiConnectionCache_Get(KvStore *store, const uint8_t *ssid, size_t ssidLength,
+                            WifiConfig_Security_Type security, WifiConnectionCacheEntry *entry)
+{
+    StoredEntry storedEntry;
+    if (ReadEntry(store, ssid, ssidLength, security, &storedEntry) != 0) {
+        return -1;
+    }
+
+    memcpy(entry->bssid, storedEntry.bssid, sizeof(entry->bssid));
+    entry->frequencyMHz = storedEntry.frequencyMHz;
+    entry->signalRssi = storedEntry.signalRssi;
+    return 0;
+}
+
+int WifiConnectionCache_Forget(KvStore *store, const uint8_t *ssid, size_t ssidLength,
+                               WifiConfig_Security_Type security)
+{
+    StoredEntry entry;
+    if (ReadEntry(store, ssid, ssidLength, security, &entry) != 0) {
+        return 0;
+    }
+
+    char key[KEY_LENGTH + 1];
+    MakeKey(ssid, ssidLength, security, key);
+    if (KvStore_Delete(store, key) != 0 || KvStore_Commit(store) != 0) {
+        Log_Debug("ERROR: Could not forget the Wi-Fi connection: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+    return 0;
+}
+
+/// <summary>
+///     Gets the stored networks.
+/// </summary>
+/// <param name="networks">Receives the networks.</param>
+/// <param name="maxCount">Number of networks which fit in networks.</param>
+/// <returns>The number of networks, or -1 on failure</returns>
+static ssize_t GetStoredNetworks(WifiConfig_StoredNetwork *networks, size_t maxCount)
+{
+    ssize_t count = WifiConfig_GetStoredNetworks(networks, maxCount);
+    if (count < 0) {
+        Log_Debug("ERROR: WifiConfig_GetStoredNetworks failed: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+    return count;
+}
+
+/// <summary>
+///     Gets the number of stored networks.
+/// </summary>
+/// <returns>The number of networks, or -1 on failure</returns>
+static ssize_t GetStoredNetworkCount(void)
+{
+    ssize_t count = WifiConfig_GetStoredNetworkCount();
+    if (count < 0) {
+        Log_Debug("ERROR: WifiConfig_GetStoredNetworkCount failed: %s (%d).\n", strerror(errno),
+                  errno);
+    }
+    return count;
+}
+
+int WifiConnectionCache_ForgetStoredNetworks(KvStore *store)
+{
+    ssize_t count = GetStoredNetworkCount();
+    if (count <= 0) {
+        return (int)count;
+    }
+
+    WifiConfig_StoredNetwork networks[count];
+    count = GetStoredNetworks(networks, (size_t)count);
+    if (count < 0) {
+        return -1;
+    }
+
+    int result = 0;
+    for (ssize_t i = 0; i < count; ++i) {
+        if (WifiConnectionCache_Forget(store, networks[i].ssid, networks[i].ssidLength,
+                                       networks[i].security) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+int WifiConnectionCache_PreferCachedNetworks(KvStore *store)
+{
+    ssize_t count = GetStoredNetworkCount();
+    if (count <= 0) {
+        return (int)count;
+    }
+
+    WifiConfig_StoredNetwork networks[count];
+    count = GetStoredNetworks(networks, (size_t)count);
+    if (count < 0) {
+        return -1;
+    }
+
+    // The ID of a stored network is its index in the list.
+    int targetedCount = 0;
+    for (ssize_t i = 0; i < count; ++i) {
+        WifiConnectionCacheEntry entry;
+        if (!networks[i].isEnabled ||
+            WifiConnectionCache_Get(store, networks[i].ssid, networks[i].ssidLength,
+                                    networks[i].security, &entry) != 0) {
+            continue;
+        }
+
+        if (WifiConfig_SetTargetedScanEnabled((int)i, true) != 0) {
+            Log_Debug("ERROR: WifiConfig_SetTargetedScanEnabled failed: %s (%d).\n",
+                      strerror(errno), errno);
+            continue;
+        }
+
+        Log_Debug("INFO: Using a targeted scan for stored network %zd, which was last connected "
+                  "on %" PRIu32 " MHz at %d dB.\n",
+                  i, entry.frequencyMHz, entry.signalRssi);
+        ++targetedCount;
+    }
+
+    return targetedCount;
+}
@@ -0,0 +1,89 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "applibs_versions.h"
+#include <applibs/wificonfig.h>
+
+#include "kv_store.h"
+
+/// <summary>A connection to the same access point is only written again if its signal
+/// level has changed by more than this many dB, so that the flash is not written on every
+/// check.</summary>
+#define WIFI_CONNECTION_CACHE_RSSI_HYSTERESIS 10
+
+/// <summary>
+///     The last connection which succeeded to a stored network.
+/// </summary>
+typedef struct {
+    uint8_t bssid[WIFICONFIG_BSSID_BUFFER_SIZE];
+    uint32_t frequencyMHz;
+    int8_t signalRssi;
+} WifiConnectionCacheEntry;
+
+/// <summary>
+/// <para>Remembers, in a <see cref="KvStore" />, the access point, channel and signal level
+/// of the last connection to each stored Wi-Fi network. Each network has its own key, which
+/// is made from its SSID and security type, so the entry of one network is replaced or
+/// forgotten without touching the others.</para>
+/// <para>The Wi-Fi configuration API does not take a BSSID or a channel, so the entries are
+/// used to choose which networks get a targeted scan when the device starts: a network which
+/// the device has connected to before is probed for by name, instead of waiting for it to
+/// be found by a full scan.</para>
+/// </summary>
+
+/// <summary>
+///     Records the network which the device is connected to. Nothing is written if the entry
+///     already has the same access point and channel, and a similar signal level. A change is
+///     committed at once.
+/// </summary>
+/// <param name="store">The store, which has been opened.</param>
+/// <param name="network">The network, from WifiConfig_GetCurrentNetwork.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int WifiConnectionCache_Record(KvStore *store, const WifiConfig_ConnectedNetwork *network);
+
+/// <summary>
+///     Gets the last connection to a network.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="ssid">SSID of the network.</param>
+/// <param name="ssidLength">Length of the SSID in bytes.</param>
+/// <param name="security">Security type of the network.</param>
+/// <param name="entry">Receives the last connection.</param>
+/// <returns>0 on success, or -1 if there is none, in which case errno is ENOENT</returns>
+int WifiConnectionCache_Get(KvStore *store, const uint8_t *ssid, size_t ssidLength,
+                            WifiConfig_Security_Type security, WifiConnectionCacheEntry *entry);
+
+/// <summary>
+///     Forgets the last connection to a network, such as when the network is deleted. The
+///     change is committed at once.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="ssid">SSID of the network.</param>
+/// <param name="ssidLength">Length of the SSID in bytes.</param>
+/// <param name="security">Security type of the network.</param>
+/// <returns>0 on success, including when there is no entry, or -1 on failure</returns>
+int WifiConnectionCache_Forget(KvStore *store, const uint8_t *ssid, size_t ssidLength,
+                               WifiConfig_Security_Type security);
+
+/// <summary>
+///     Forgets the last connection to each stored network. Call this before all of the stored
+///     networks are forgotten with WifiConfig_ForgetAllNetworks, as the store cannot list the
+///     entries of networks which are no longer stored.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int WifiConnectionCache_ForgetStoredNetworks(KvStore *store);
+
+/// <summary>
+///     Enables targeted scans for each enabled stored network which has an entry, so that the
+///     device looks for the networks it has connected to before by name. The change is not
+///     persisted, so it is made again each time the application starts.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <returns>The number of networks whose scans are targeted, or -1 on failure</returns>
+int WifiConnectionCache_PreferCachedNetworks(KvStore *store);
@@ -0,0 +1,127 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <string.h>
+#include "wifi_scan_aggregator.h"
+
+#define HASH_SLOT_MASK (WIFI_SCAN_AGGREGATOR_HASH_TABLE_SIZE - 1)
+
+static uint32_t HashNetwork(const WifiConfig_ScannedNetwork *network)
+{
+    // FNV-1a over the security type, the SSID length and the SSID.
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ (uint8_t)network->security) * 16777619u;
+    hash = (hash ^ network->ssidLength) * 16777619u;
+    for (size_t i = 0; i < network->ssidLength; ++i) {
+        hash = (hash ^ network->ssid[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool IsSameAccessPoint(const WifiConfig_ScannedNetwork *a,
+                              const WifiConfig_ScannedNetwork *b)
+{
+    return a->security == b->security && a->ssidLength == b->ssidLength &&
+           memcmp(a->ssid, b->ssid, a->ssidLength) == 0;
+}
+
+/// <summary>
+///     Find the slot which holds the access point, or the empty slot where it would go.
+/// </summary>
+static size_t FindSlot(const WifiScanAggregator *aggregator,
+                       const WifiConfig_ScannedNetwork *network)
+{
+    size_t slot = HashNetwork(network) & HASH_SLOT_MASK;
+    while (aggregator->slots[slot] != 0 &&
+           !IsSameAccessPoint(&aggregator->networks[aggregator->slots[slot] - 1], network)) {
+        slot = (slot + 1) & HASH_SLOT_MASK;
+    }
+    return slot;
+}
+
+/// <summary>
+///     Rebuild the hash table from networks, after an entry has been replaced.
+/// </summary>
+static void RebuildSlots(WifiScanAggregator *aggregator)
+{
+    memset(aggregator->slots, 0, sizeof(aggregator->slots));
+    for (size_t i = 0; i < aggregator->count; ++i) {
+        aggregator->slots[FindSlot(aggregator, &aggregator->networks[i])] = (uint8_t)(i + 1);
+    }
+}
+
+void WifiScanAggregator_Reset(WifiScanAggregator *aggregator)
+{
+    memset(aggregator->slots, 0, sizeof(aggregator->slots));
+    aggregator->count = 0;
+    aggregator->droppedCount = 0;
+}
+
+bool WifiScanAggregator_Add(WifiScanAggregator *aggregator, const WifiConfig_ScannedNetwork *network)
+{
+    size_t slot = FindSlot(aggregator, network);
+    if (aggregator->slots[slot] != 0) {
+        WifiConfig_ScannedNetwork *existing = &aggregator->networks[aggregator->slots[slot] - 1];
+        if (existing->signalRssi < network->signalRssi) {
+            *existing = *network;
+        }
+        return true;
+    }
+
+    if (aggregator->count < WIFI_SCAN_AGGREGATOR_MAX_NETWORKS) {
+        aggregator->networks[aggregator->count] = *network;
+        ++aggregator->count;
+        aggregator->slots[slot] = (uint8_t)aggregator->count;
+        return true;
+    }
+
+    // Full: keep the strongest access points.
+    size_t weakest = 0;
+    for (size_t i = 1; i < aggregator->count; ++i) {
+        if (aggregator->networks[i].signalRssi < aggregator->networks[weakest].signalRssi) {
+            weakest = i;
+        }
+    }
+    ++aggregator->droppedCount;
+    if (aggregator->networks[weakest].signalRssi >= network->signalRssi) {
+        return false;
+    }
+    aggregator->networks[weakest] = *network;
+    RebuildSlots(aggregator);
+    return true;
+}
+
+void WifiScanAggregator_AddAll(WifiScanAggregator *aggregator,
+                               const WifiConfig_ScannedNetwork *networks, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        WifiScanAggregator_Add(aggregator, &networks[i]);
+    }
+}
+
+size_t WifiScanAggregator_GetStrongest(const WifiScanAggregator *aggregator,
+                                       const WifiConfig_ScannedNetwork **results,
+                                       size_t maxResults)
+{
+    // Insert each access point into the sorted results, dropping the weakest once full. Only a
+    // handful of results are normally asked for, so this is cheaper than sorting everything.
+    size_t resultCount = 0;
+    for (size_t i = 0; i < aggregator->count; ++i) {
+        const WifiConfig_ScannedNetwork *network = &aggregator->networks[i];
+        size_t position = resultCount;
+        while (position > 0 && results[position - 1]->signalRssi < network->signalRssi) {
+            --position;
+        }
+        if (position >= maxResults) {
+            continue;
+        }
+        size_t last = resultCount < maxResults ? resultCount : maxResults - 1;
+        memmove(&results[position + 1], &results[position],
+                (last - position) * sizeof(results[0]));
+        results[position] = network;
+        if (resultCount < maxResults) {
+            ++resultCount;
+        }
+    }
+    return resultCount;
+}
@@ -0,0 +1,72 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "applibs_versions.h"
+#include <applibs/wificonfig.h>
+
+/// <summary>Maximum number of distinct access points which an aggregator holds.</summary>
+#define WIFI_SCAN_AGGREGATOR_MAX_NETWORKS 64
+
+/// <summary>
+///     Number of slots in the aggregator's hash table. This is a power of two at least twice
+///     <see cref="WIFI_SCAN_AGGREGATOR_MAX_NETWORKS" />, so that probe sequences stay short.
+/// </summary>
+#define WIFI_SCAN_AGGREGATOR_HASH_TABLE_SIZE 128
+
+/// <summary>
+/// <para>Collapses scanned networks into one entry per access point, keyed by SSID, SSID length
+/// and security type, and keeps the strongest signal seen for each.</para>
+/// <para>The aggregator has a fixed capacity and does not allocate, so it can be declared
+/// static rather than sized on the stack by the number of networks found. Once it is full, a new
+/// access point only replaces the weakest one held if its signal is stronger.</para>
+/// <para>All members are managed by the WifiScanAggregator functions and must not be modified
+/// by the caller.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The distinct access points found so far.</summary>
+    WifiConfig_ScannedNetwork networks[WIFI_SCAN_AGGREGATOR_MAX_NETWORKS];
+    /// <summary>Open-addressed hash table of indices into networks plus one; 0 is empty.</summary>
+    uint8_t slots[WIFI_SCAN_AGGREGATOR_HASH_TABLE_SIZE];
+    /// <summary>Number of entries in networks which are in use.</summary>
+    size_t count;
+    /// <summary>Number of networks dropped because the aggregator was full.</summary>
+    size_t droppedCount;
+} WifiScanAggregator;
+
+/// <summary>
+///     Remove all access points from the aggregator.
+/// </summary>
+void WifiScanAggregator_Reset(WifiScanAggregator *aggregator);
+
+/// <summary>
+///     Add one scanned network. If the access point is already held, only its signal strength is
+///     raised to the stronger of the two.
+/// </summary>
+/// <returns>true if the network is held by the aggregator; false if it was dropped.</returns>
+bool WifiScanAggregator_Add(WifiScanAggregator *aggregator,
+                            const WifiConfig_ScannedNetwork *network);
+
+/// <summary>
+///     Add each network of a scan.
+/// </summary>
+void WifiScanAggregator_AddAll(WifiScanAggregator *aggregator,
+                               const WifiConfig_ScannedNetwork *networks, size_t count);
+
+/// <summary>
+///     Get the access points with the strongest signals, strongest first.
+/// </summary>
+/// <param name="aggregator">The aggregator to read.</param>
+/// <param name="results">
+///     Receives pointers to the access points. They remain valid until the aggregator is next
+///     modified.
+/// </param>
+/// <param name="maxResults">The number of entries in results.</param>
+/// <returns>The number of pointers written to results.</returns>
+size_t WifiScanAggregator_GetStrongest(const WifiScanAggregator *aggregator,
+                                       const WifiConfig_ScannedNetwork **results,
+                                       size_t maxResults);
@@ -0,0 +1,151 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <applibs/log.h>
+#include "wifi_scan_manager.h"
+
+static void ScanCompletedEventHandler(EventData *eventData);
+
+static int scanCompletedEventFd = -1;
+static EventData scanCompletedEventData = {.eventHandler = &ScanCompletedEventHandler};
+static EventData *clientEventData = NULL;
+static pthread_t scanThread;
+static bool isScanning = false;
+
+// Written by the worker thread while a scan is in progress, and only read on the event loop
+// thread after the worker has been joined.
+static WifiConfig_ScannedNetwork scannedNetworks[WIFI_SCAN_MANAGER_MAX_NETWORKS];
+static ssize_t scannedNetworkCount = 0;
+static int scanError = 0;
+
+/// <summary>
+///     Worker thread which runs one scan and signals the event loop when it is finished.
+/// </summary>
+static void *ScanThread(void *arg)
+{
+    ssize_t count = WifiConfig_TriggerScanAndGetScannedNetworkCount();
+    if (count < 0) {
+        scanError = errno;
+    } else if (count > 0) {
+        if (count > WIFI_SCAN_MANAGER_MAX_NETWORKS) {
+            Log_Debug("WARNING: Keeping %d of %zd scanned networks.\n",
+                      WIFI_SCAN_MANAGER_MAX_NETWORKS, count);
+            count = WIFI_SCAN_MANAGER_MAX_NETWORKS;
+        }
+        count = WifiConfig_GetScannedNetworks(scannedNetworks, (size_t)count);
+        if (count < 0) {
+            scanError = errno;
+        }
+    }
+    scannedNetworkCount = count;
+
+    uint64_t increment = 1;
+    if (write(scanCompletedEventFd, &increment, sizeof(increment)) == -1) {
+        Log_Debug("ERROR: Could not signal Wi-Fi scan completed eventfd: %s (%d).\n",
+                  strerror(errno), errno);
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Join the worker thread once it has finished its scan.
+/// </summary>
+static void JoinScanThread(void)
+{
+    int result = pthread_join(scanThread, NULL);
+    if (result != 0) {
+        Log_Debug("ERROR: Could not join Wi-Fi scan thread: %s (%d).\n", strerror(result), result);
+    }
+    isScanning = false;
+}
+
+static void ScanCompletedEventHandler(EventData *eventData)
+{
+    uint64_t value;
+    if (read(scanCompletedEventFd, &value, sizeof(value)) == -1) {
+        if (errno != EAGAIN) {
+            Log_Debug("ERROR: Could not read Wi-Fi scan completed eventfd: %s (%d).\n",
+                      strerror(errno), errno);
+        }
+        return;
+    }
+
+    if (!isScanning) {
+        return;
+    }
+    JoinScanThread();
+
+    clientEventData->eventHandler(clientEventData);
+}
+
+static void FreeResults(void)
+{
+    scannedNetworkCount = 0;
+    scanError = 0;
+}
+
+int WifiScanManager_Init(int epollFd, EventData *completedEventData)
+{
+    clientEventData = completedEventData;
+    isScanning = false;
+    FreeResults();
+
+    scanCompletedEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (scanCompletedEventFd < 0) {
+        Log_Debug("ERROR: Could not create eventfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, scanCompletedEventFd, &scanCompletedEventData,
+                                    EPOLLIN) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void WifiScanManager_Cleanup(void)
+{
+    if (isScanning) {
+        JoinScanThread();
+    }
+    FreeResults();
+    CloseFdAndPrintError(scanCompletedEventFd, "WifiScanCompleted");
+    scanCompletedEventFd = -1;
+}
+
+int WifiScanManager_StartScan(void)
+{
+    if (isScanning) {
+        return 0;
+    }
+
+    FreeResults();
+    int result = pthread_create(&scanThread, NULL, &ScanThread, NULL);
+    if (result != 0) {
+        Log_Debug("ERROR: Could not create Wi-Fi scan thread: %s (%d).\n", strerror(result),
+                  result);
+        return -1;
+    }
+    isScanning = true;
+    return 0;
+}
+
+bool WifiScanManager_IsScanning(void)
+{
+    return isScanning;
+}
+
+ssize_t WifiScanManager_GetResults(const WifiConfig_ScannedNetwork **networks)
+{
+    *networks = scannedNetworks;
+    if (scannedNetworkCount < 0) {
+        errno = scanError;
+    }
+    return scannedNetworkCount;
+}
@@ -0,0 +1,69 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "applibs_versions.h"
+#include <applibs/wificonfig.h>
+
+#include "epoll_timerfd_utilities.h"
+
+#ifndef WIFI_SCAN_MANAGER_MAX_NETWORKS
+/// <summary>Most networks which are kept from one scan, in a static array, so that a scan
+/// allocates no memory. When more are found, the rest are dropped. Define this before building
+/// to change it.</summary>
+#define WIFI_SCAN_MANAGER_MAX_NETWORKS 32
+#endif
+
+/// <summary>
+/// <para>Runs Wi-Fi scans on a worker thread, so that the event loop keeps servicing other
+/// file descriptors while the radio scans, which can take several seconds.</para>
+/// <para>When a scan finishes, the worker signals an eventfd which is registered with the
+/// event loop, and the completion handler is then called on the event loop thread. The results
+/// can be read with <see cref="WifiScanManager_GetResults" /> from then until the next scan is
+/// started.</para>
+/// </summary>
+
+/// <summary>
+///     Create the eventfd which reports completed scans and register it with the event loop.
+/// </summary>
+/// <param name="epollFd">Epoll file descriptor of the event loop.</param>
+/// <param name="completedEventData">
+///     Event data whose handler is called on the event loop thread each time a scan finishes.
+///     It must remain valid until <see cref="WifiScanManager_Cleanup" /> is called.
+/// </param>
+/// <returns>0 on success, or -1 on failure.</returns>
+int WifiScanManager_Init(int epollFd, EventData *completedEventData);
+
+/// <summary>
+///     Wait for any scan in progress to finish, free the results and close the eventfd.
+/// </summary>
+void WifiScanManager_Cleanup(void);
+
+/// <summary>
+///     Start a Wi-Fi scan on the worker thread. Does nothing if a scan is already in progress;
+///     the completion handler is called once for that scan.
+/// </summary>
+/// <returns>0 if a scan is in progress, or -1 if the scan could not be started.</returns>
+int WifiScanManager_StartScan(void);
+
+/// <summary>
+///     Check whether a scan is in progress.
+/// </summary>
+/// <returns>true if a scan has been started and its completion handler has not been called yet.</returns>
+bool WifiScanManager_IsScanning(void);
+
+/// <summary>
+///     Get the results of the last completed scan.
+/// </summary>
+/// <param name="networks">
+///     Receives a pointer to the scanned networks. The array belongs to the scan manager and its
+///     contents remain valid until the next scan is started.
+/// </param>
+/// <returns>
+///     The number of scanned networks, or -1 if the scan failed, in which case errno is set to the
+///     error from the WifiConfig API.
+/// </returns>
+ssize_t WifiScanManager_GetResults(const WifiConfig_ScannedNetwork **networks);
@@ -0,0 +1,214 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <applibs/log.h>
+
+#include "worker_pool.h"
+
+static void CompletedEventHandler(EventData *eventData);
+
+/// <summary>
+///     Worker thread which runs the queued jobs until the pool is closed.
+/// </summary>
+static void *WorkerThread(void *arg)
+{
+    WorkerPool *pool = arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->isStopping) {
+        WorkerPoolJob *job = pool->queuedHead;
+        if (job == NULL) {
+            pthread_cond_wait(&pool->workAvailable, &pool->mutex);
+            continue;
+        }
+        pool->queuedHead = job->next;
+        if (pool->queuedHead == NULL) {
+            pool->queuedTail = NULL;
+        }
+
+        // The job has been removed from the queue, so it runs without the lock, and the other
+        // workers and the event loop carry on meanwhile.
+        pthread_mutex_unlock(&pool->mutex);
+        job->jobHandler(job);
+        pthread_mutex_lock(&pool->mutex);
+
+        // The eventfd stays readable until the event loop takes the completed list, so it only
+        // has to be written when a job is added to an empty list.
+        bool wasEmpty = (pool->completedHead == NULL);
+        job->next = NULL;
+        if (wasEmpty) {
+            pool->completedHead = job;
+        } else {
+            pool->completedTail->next = job;
+        }
+        pool->completedTail = job;
+
+        if (wasEmpty) {
+            uint64_t increment = 1;
+            if (write(pool->eventFd, &increment, sizeof(increment)) == -1) {
+                Log_Debug("ERROR: Could not signal worker pool eventfd: %s (%d).\n",
+                          strerror(errno), errno);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/// <summary>
+///     Call the completion handlers of the finished jobs on the event loop thread.
+/// </summary>
+static void CompletedEventHandler(EventData *eventData)
+{
+    WorkerPool *pool =
+        (WorkerPool *)((uint8_t *)eventData - offsetof(WorkerPool, eventFdEventData));
+
+    uint64_t value;
+    if (read(pool->eventFd, &value, sizeof(value)) == -1) {
+        if (errno != EAGAIN) {
+            Log_Debug("ERROR: Could not read worker pool eventfd: %s (%d).\n", strerror(errno),
+                      errno);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    WorkerPoolJob *job = pool->completedHead;
+    pool->completedHead = NULL;
+    pool->completedTail = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    while (job != NULL) {
+        // Read the next job first, as the handler may submit this one again.
+        WorkerPoolJob *next = job->next;
+        job->isBusy = false;
+        if (job->completionHandler != NULL) {
+            job->completionHandler(job);
+        }
+        job = next;
+    }
+}
+
+int WorkerPool_Init(WorkerPool *pool, int epollFd, size_t threadCount, size_t stackSize)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->eventFd = -1;
+    pool->eventFdEventData.eventHandler = &CompletedEventHandler;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->workAvailable, NULL);
+
+    if (threadCount == 0 || threadCount > WORKER_POOL_MAX_THREADS) {
+        Log_Debug("ERROR: Invalid number of worker threads: %zu.\n", threadCount);
+        return -1;
+    }
+
+    pool->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->eventFd < 0) {
+        Log_Debug("ERROR: Could not create eventfd: %s (%d).\n", strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(epollFd, pool->eventFd, &pool->eventFdEventData, EPOLLIN) !=
+        0) {
+        return -1;
+    }
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    if (stackSize != 0) {
+        int result = pthread_attr_setstacksize(&attributes, stackSize);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not set worker stack size: %s (%d).\n", strerror(result),
+                      result);
+            pthread_attr_destroy(&attributes);
+            return -1;
+        }
+    }
+
+    // The threads inherit the signal mask of this thread, so block every signal while they
+    // are created, and SIGTERM is handled by the event loop thread.
+    sigset_t allSignals;
+    sigset_t previousSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &previousSignals);
+
+    int result = 0;
+    while (pool->threadCount < threadCount) {
+        result = pthread_create(&pool->threads[pool->threadCount], &attributes, &WorkerThread,
+                                pool);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not create worker thread: %s (%d).\n", strerror(result),
+                      result);
+            break;
+        }
+        ++pool->threadCount;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+    pthread_attr_destroy(&attributes);
+    return (result == 0) ? 0 : -1;
+}
+
+void WorkerPool_Close(WorkerPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->isStopping = true;
+    pthread_cond_broadcast(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 0; i < pool->threadCount; ++i) {
+        int result = pthread_join(pool->threads[i], NULL);
+        if (result != 0) {
+            Log_Debug("ERROR: Could not join worker thread: %s (%d).\n", strerror(result),
+                      result);
+        }
+    }
+    pool->threadCount = 0;
+
+    pthread_cond_destroy(&pool->workAvailable);
+    pthread_mutex_destroy(&pool->mutex);
+
+    CloseFdAndPrintError(pool->eventFd, "WorkerPool");
+    pool->eventFd = -1;
+}
+
+int WorkerPool_Submit(WorkerPool *pool, WorkerPoolJob *job)
+{
+    if (job->isBusy) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (job->jobHandler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    job->next = NULL;
+    job->isBusy = true;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->queuedTail == NULL) {
+        pool->queuedHead = job;
+    } else {
+        pool->queuedTail->next = job;
+    }
+    pool->queuedTail = job;
+    pthread_cond_signal(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return 0;
+}
+
+bool WorkerPool_IsBusy(const WorkerPoolJob *job)
+{
+    return job->isBusy;
+}
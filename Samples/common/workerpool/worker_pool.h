@@ -0,0 +1,123 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#pragma once
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "epoll_timerfd_utilities.h"
+
+/// <summary>Most worker threads which one pool can run.</summary>
+#define WORKER_POOL_MAX_THREADS 4
+
+typedef struct WorkerPoolJob WorkerPoolJob;
+
+/// <summary>
+///     Called on a worker thread to do the work of a job, such as parsing a document or
+///     calculating the CRC of a file. It must not touch state which the event loop thread uses
+///     until the completion handler is called, and should store its results in the job's
+///     context.
+/// </summary>
+typedef void (*WorkerPoolJobHandler)(WorkerPoolJob *job);
+
+/// <summary>
+///     Called on the event loop thread when a job has finished. The job can be submitted again
+///     from this handler.
+/// </summary>
+typedef void (*WorkerPoolCompletionHandler)(WorkerPoolJob *job);
+
+/// <summary>
+/// <para>A unit of work which is run on one of the threads of a <see cref="WorkerPool" />.</para>
+/// <para>The caller allocates this struct and populates the fields up to context. The struct
+/// must remain valid until the completion handler is called. The remaining members are managed
+/// by the pool and must not be modified by the caller.</para>
+/// </summary>
+struct WorkerPoolJob {
+    /// <summary>Does the work, on a worker thread.</summary>
+    WorkerPoolJobHandler jobHandler;
+    /// <summary>Called when the job has finished, or NULL.</summary>
+    WorkerPoolCompletionHandler completionHandler;
+    /// <summary>Passed through to the handlers.</summary>
+    void *context;
+
+    /// <summary>Next job in the queue or in the completed list.</summary>
+    WorkerPoolJob *next;
+    /// <summary>Whether the job has been submitted and has not completed yet.</summary>
+    bool isBusy;
+};
+
+/// <summary>
+/// <para>Runs jobs on a few worker threads, so that CPU-heavy work does not hold up the I/O of
+/// the event loop. Jobs are run in the order in which they were submitted, each on the first
+/// thread which is free.</para>
+/// <para>When jobs finish, the worker signals an eventfd which is registered with the event
+/// loop, and their completion handlers are called on the event loop thread, so the handlers
+/// need no locks. The eventfd is only written when the first job of a batch finishes, so a
+/// burst of completions costs one wakeup.</para>
+/// <para>The caller allocates this struct, initializes it with <see cref="WorkerPool_Init" />
+/// and disposes of it with <see cref="WorkerPool_Close" />. The members must not be modified
+/// directly.</para>
+/// </summary>
+typedef struct {
+    /// <summary>The eventfd which the workers signal when jobs have finished.</summary>
+    int eventFd;
+    /// <summary>Event data for the eventfd.</summary>
+    EventData eventFdEventData;
+    /// <summary>Jobs which are waiting for a thread.</summary>
+    WorkerPoolJob *queuedHead;
+    WorkerPoolJob *queuedTail;
+    /// <summary>Finished jobs whose completion handlers have not been called yet.</summary>
+    WorkerPoolJob *completedHead;
+    WorkerPoolJob *completedTail;
+    /// <summary>Protects the queue and the completed list.</summary>
+    pthread_mutex_t mutex;
+    /// <summary>Signalled when a job is submitted or the workers should stop.</summary>
+    pthread_cond_t workAvailable;
+    /// <summary>The worker threads which are running.</summary>
+    pthread_t threads[WORKER_POOL_MAX_THREADS];
+    size_t threadCount;
+    /// <summary>Whether the worker threads should exit.</summary>
+    bool isStopping;
+} WorkerPool;
+
+/// <summary>
+///     Creates the pool's eventfd, adds it to an epoll instance, and starts the worker threads.
+///     The threads do not receive signals, so signal handlers keep running on the event loop
+///     thread.
+/// </summary>
+/// <param name="pool">Pool to initialize. This must stay in memory until it is closed.</param>
+/// <param name="epollFd">Epoll file descriptor of the event loop.</param>
+/// <param name="threadCount">Number of worker threads, from 1 to
+/// WORKER_POOL_MAX_THREADS.</param>
+/// <param name="stackSize">Stack size of each thread in bytes, or 0 for the default. A small
+/// stack saves memory on devices where it is scarce.</param>
+/// <returns>0 on success, or -1 on failure. Call <see cref="WorkerPool_Close" /> either
+/// way.</returns>
+int WorkerPool_Init(WorkerPool *pool, int epollFd, size_t threadCount, size_t stackSize);
+
+/// <summary>
+///     Stops the worker threads, after waiting for the jobs which they are running, and closes
+///     the eventfd. Queued jobs are discarded, and no more completion handlers are called.
+/// </summary>
+/// <param name="pool">Pool which was initialized with <see cref="WorkerPool_Init" />.</param>
+void WorkerPool_Close(WorkerPool *pool);
+
+/// <summary>
+///     Appends a job to the queue. Call this from the event loop thread.
+/// </summary>
+/// <param name="pool">The pool.</param>
+/// <param name="job">The job.</param>
+/// <returns>0 on success, or -1 with errno set to EBUSY if the job has not completed since it
+/// was last submitted, or EINVAL if it has no job handler.</returns>
+int WorkerPool_Submit(WorkerPool *pool, WorkerPoolJob *job);
+
+/// <summary>
+///     Queries whether a job has been submitted and its completion handler has not yet been
+///     called.
+/// </summary>
+/// <param name="job">The job.</param>
+/// <returns>true if the job is queued, running, or waiting for its completion handler; false
+/// otherwise.</returns>
+bool WorkerPool_IsBusy(const WorkerPoolJob *job);